@@ -467,9 +467,18 @@ namespace BuildXL
                                 Console.WriteLine("*** WARNING: deprecated switch /reportQueueSizeMb; please use /kextReportQueueSizeMb instead");
                                 sandboxConfiguration.KextReportQueueSizeMb = CommandLineUtilities.ParseUInt32Option(opt, 16, 2048);
                             }),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "kextEnablePriorityReportQueue",
+                            sign => sandboxConfiguration.KextEnablePriorityReportQueue = sign),
                         OptionHandlerFactory.CreateBoolOption(
                             "kextEnableReportBatching",
                             sign => sandboxConfiguration.KextEnableReportBatching = sign),
+                        OptionHandlerFactory.CreateOption(
+                            "kextIgnoredOperationClasses",
+                            opt => sandboxConfiguration.KextIgnoredOperationClasses = CommandLineUtilities.ParseUInt32Option(opt, 0, 0x7F)),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "kextMapPipPayloads",
+                            sign => sandboxConfiguration.KextMapPipPayloads = sign),
                         OptionHandlerFactory.CreateBoolOption(
                             "kextMeasureProcessCpuTimes",
                             sign => sandboxConfiguration.KextMeasureProcessCpuTimes = sign),
@@ -479,9 +488,27 @@ namespace BuildXL
                             {
                                 Console.WriteLine("*** WARNING: deprecated switch /kextNumberOfKextConnections; don't use it as it has no effect any longer");
                             }),
+                        OptionHandlerFactory.CreateOption(
+                            "kextNumReportQueues",
+                            opt => sandboxConfiguration.KextNumReportQueues = CommandLineUtilities.ParseUInt32Option(opt, 1, 16)),
+                        OptionHandlerFactory.CreateOption(
+                            "kextPathCacheBudget",
+                            opt => sandboxConfiguration.KextPathCacheBudget = CommandLineUtilities.ParseUInt32Option(opt, 0, uint.MaxValue)),
+                        OptionHandlerFactory.CreateOption(
+                            "kextReportCoalescingWindowUs",
+                            opt => sandboxConfiguration.KextReportCoalescingWindowUs = CommandLineUtilities.ParseUInt32Option(opt, 0, 1000000)),
                         OptionHandlerFactory.CreateOption(
                             "kextReportQueueSizeMb",
                             opt => sandboxConfiguration.KextReportQueueSizeMb = CommandLineUtilities.ParseUInt32Option(opt, 16, 2048)),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "kextSummarizeReportsWhenLagging",
+                            sign => sandboxConfiguration.KextSummarizeReportsWhenLagging = sign),
+                        OptionHandlerFactory.CreateOption(
+                            "kextTimingSampleRate",
+                            opt => sandboxConfiguration.KextTimingSampleRate = CommandLineUtilities.ParseUInt32Option(opt, 0, 65536)),
+                        OptionHandlerFactory.CreateOption(
+                            "kextMaxPipReportRate",
+                            opt => sandboxConfiguration.KextMaxPipReportRate = CommandLineUtilities.ParseUInt32Option(opt, 0, uint.MaxValue)),
                         OptionHandlerFactory.CreateOption(
                             "kextThrottleCpuUsageBlockThresholdPercent",
                             opt => sandboxConfiguration.KextThrottleCpuUsageBlockThresholdPercent = CommandLineUtilities.ParseUInt32Option(opt, 0, 100)),
@@ -491,6 +518,27 @@ namespace BuildXL
                         OptionHandlerFactory.CreateOption(
                             "kextThrottleMinAvailableRamMB",
                             opt => sandboxConfiguration.KextThrottleMinAvailableRamMB = CommandLineUtilities.ParseUInt32Option(opt, 0, uint.MaxValue)),
+                        OptionHandlerFactory.CreateOption(
+                            "kextThrottleRamWakeupMarginMB",
+                            opt => sandboxConfiguration.KextThrottleRamWakeupMarginMB = CommandLineUtilities.ParseUInt32Option(opt, 0, uint.MaxValue)),
+                        OptionHandlerFactory.CreateOption(
+                            "kextThrottleCpuSampleIntervalMs",
+                            opt => sandboxConfiguration.KextThrottleCpuSampleIntervalMs = CommandLineUtilities.ParseUInt32Option(opt, 0, 60000)),
+                        OptionHandlerFactory.CreateOption(
+                            "kextCacheShrinkRamMB",
+                            opt => sandboxConfiguration.KextCacheShrinkRamMB = CommandLineUtilities.ParseUInt32Option(opt, 0, uint.MaxValue)),
+                        OptionHandlerFactory.CreateOption(
+                            "kextThrottleResourceSampleIntervalMs",
+                            opt => sandboxConfiguration.KextThrottleResourceSampleIntervalMs = CommandLineUtilities.ParseUInt32Option(opt, 0, 60000)),
+                        OptionHandlerFactory.CreateOption(
+                            "kextPipReportRingCapacity",
+                            opt => sandboxConfiguration.KextPipReportRingCapacity = CommandLineUtilities.ParseUInt32Option(opt, 0, 65536)),
+                        OptionHandlerFactory.CreateOption(
+                            "kextListenerSpinUs",
+                            opt => sandboxConfiguration.KextListenerSpinUs = CommandLineUtilities.ParseUInt32Option(opt, 0, 100000)),
+                        OptionHandlerFactory.CreateOption(
+                            "kextListenerQosClass",
+                            opt => sandboxConfiguration.KextListenerQosClass = CommandLineUtilities.ParseUInt32Option(opt, 0, 0x21)),
 #endif
                         OptionHandlerFactory.CreateOption2(
                             "help",
@@ -549,6 +597,9 @@ namespace BuildXL
                         OptionHandlerFactory.CreateBoolOption(
                             "logProcessData",
                             sign => sandboxConfiguration.LogProcessData = sign),
+                        OptionHandlerFactory.CreateBoolOption(
+                            "logPipProcessData",
+                            sign => sandboxConfiguration.LogPipProcessData = sign),
                         OptionHandlerFactory.CreateBoolOption(
                             "logProcessDetouringStatus",
                             sign => sandboxConfiguration.LogProcessDetouringStatus = sign),
@@ -695,6 +746,12 @@ namespace BuildXL
                         OptionHandlerFactory.CreateOption(
                             "printFile2FileDependencies",
                             opt => frontEndConfiguration.FileToFileReportDestination = CommandLineUtilities.ParsePathOption(opt, pathTable)),
+                        OptionHandlerFactory.CreateOption(
+                            "processAdmissionMaxWaitMs",
+                            opt => sandboxConfiguration.ProcessAdmissionMaxWaitMs = CommandLineUtilities.ParseUInt32Option(opt, 0, uint.MaxValue)),
+                        OptionHandlerFactory.CreateOption(
+                            "processAdmissionThresholdPercent",
+                            opt => sandboxConfiguration.ProcessAdmissionThresholdPercent = CommandLineUtilities.ParseUInt32Option(opt, 0, 100)),
                         OptionHandlerFactory.CreateOption(
                             "processRetries",
                             opt => schedulingConfiguration.ProcessRetries = CommandLineUtilities.ParseInt32Option(opt, 0, int.MaxValue)),
@@ -239,6 +239,11 @@ namespace BuildXL
                 Strings.HelpText_DisplayHelp_LogProcessData,
                 HelpLevel.Verbose);
 
+            hw.WriteOption(
+                "/logPipProcessData[+|-]",
+                Strings.HelpText_DisplayHelp_LogPipProcessData,
+                HelpLevel.Verbose);
+
             hw.WriteOption(
                 "/logFileAccessTables[+|-]",
                 Strings.HelpText_DisplayHelp_LogFileEnforcementTables,
@@ -716,6 +721,16 @@ namespace BuildXL
                 Strings.HelpText_DisplayHelp_ProcessRetries,
                 HelpLevel.Verbose);
 
+            hw.WriteOption(
+                "/processAdmissionThresholdPercent:<percent>",
+                Strings.HelpText_DisplayHelp_ProcessAdmissionThresholdPercent,
+                HelpLevel.Verbose);
+
+            hw.WriteOption(
+                "/processAdmissionMaxWaitMs:<milliseconds>",
+                Strings.HelpText_DisplayHelp_ProcessAdmissionMaxWaitMs,
+                HelpLevel.Verbose);
+
             hw.WriteOption(
                 "/fileChangeTrackerInitializationMode:<mode>",
                 Strings.HelpText_DisplayHelp_FileChangeTrackerInitializationMode,
@@ -11,6 +11,11 @@
 // tries to open the same file, it fails with sharing validation. The second process will wait for the first 
 // process to close the file and will get the lock once that happens.
 // 
+// Drives are mapped with subst.exe. With RUN_IN_SUBST_DIRECT=1 they are mapped with DefineDosDevice instead, and only the
+// requested drives are queried, so no process is started besides the one to execute. With RUN_IN_SUBST_KEEP_MAPPINGS=1
+// the drives stay mapped after the process exits: the lock file still protects them, so a later run with the same
+// mappings finds them in place and maps nothing, and a run with other mappings remaps them as for a stale subst.
+// 
 
 #pragma warning( disable: 4820 ) // Shut-off padding warnings.
 #include "stdafx.h"
@@ -24,6 +29,8 @@
 #define GET_PATH_TARGET_OFFSET  8
 #define RUN_IN_SUBST_VERBOSE L"RUN_IN_SUBST_VERBOSE"
 #define RUN_IN_SUBST_VERBOSE_BUFF_SIZE 2
+#define RUN_IN_SUBST_DIRECT L"RUN_IN_SUBST_DIRECT"
+#define RUN_IN_SUBST_KEEP_MAPPINGS L"RUN_IN_SUBST_KEEP_MAPPINGS"
 #define MAPPED_PATH_STRING L"\\??\\"
 #define SUBST_FILE_NAME L".SubstLock"
 
@@ -67,6 +74,16 @@ typedef struct _tagSubstListNode
 } SUBST_LIST_NODE, *PSUBST_LIST_NODE;
 
 static bool g_isVerbose = false;
+static bool g_isDirect = false;
+static bool g_keepMappings = false;
+
+// Returns whether the environment variable is set to 1.
+static bool IsEnvironmentFlagSet(PCWSTR name)
+{
+    wchar_t value[RUN_IN_SUBST_VERBOSE_BUFF_SIZE];
+    DWORD len = GetEnvironmentVariable(name, value, RUN_IN_SUBST_VERBOSE_BUFF_SIZE);
+    return len == 1 && value[0] == L'1';
+}
 
 static void printVerbose(PCWSTR format, ...)
 {
@@ -230,10 +247,86 @@ static bool ParseSubstSourcesAndTargets(int argc, _TCHAR* argv[], PSUBST_LIST_NO
     return false;
 }
 
+// Sets the mapped path of a drive to the given DOS device target (null if not mapped), in the form used for the source directory.
+static void SetMappedPath(PSUBST_NODE pSubstNode, const wchar_t* target)
+{
+    if (pSubstNode->szMappedPath != nullptr)
+    {
+        delete[] pSubstNode->szMappedPath;
+        pSubstNode->szMappedPath = nullptr;
+    }
+
+    if (target == nullptr)
+    {
+        return;
+    }
+
+    // Skip leading "\\??\\".
+    if (wcsstr(target, MAPPED_PATH_STRING) == target)
+    {
+        target += wcslen(MAPPED_PATH_STRING);
+    }
+
+    size_t srcLen = wcslen(target);
+    pSubstNode->szMappedPath = new TCHAR[srcLen + 2];
+    for (size_t i = 0; i < srcLen; i++)
+    {
+        pSubstNode->szMappedPath[i] = (TCHAR)::tolower(target[i]);
+    }
+
+    // make sure there is a trailing '\\'.
+    if (srcLen == 0 || pSubstNode->szMappedPath[srcLen - 1] != L'\\')
+    {
+        pSubstNode->szMappedPath[srcLen++] = L'\\';
+    }
+
+    pSubstNode->szMappedPath[srcLen] = L'\0';
+}
+
+// Gets the mapped path of each drive to subst from the DOS device definitions, without running subst.exe.
+// A drive mapped to anything but a path (e.g. a volume) gets no mapped path, like in the subst.exe output.
+static int QueryMappedPaths(PSUBST_NODE* pOrderedSubstList)
+{
+    wchar_t* target = new wchar_t[SUBST_SOURCE_LENGTH];
+
+    for (int i = 0; i < NUMBER_DEFINABLE_SUBST; i++)
+    {
+        PSUBST_NODE pListNode = pOrderedSubstList[i];
+        if (pListNode == nullptr)
+        {
+            continue;
+        }
+
+        TCHAR driveString[3];
+        driveString[0] = pListNode->szDriveLetter;
+        driveString[1] = L':';
+        driveString[2] = L'\0';
+
+        // The first string is the current definition, pushed last.
+        if (QueryDosDevice(driveString, target, SUBST_SOURCE_LENGTH) != 0 && wcsstr(target, MAPPED_PATH_STRING) == target)
+        {
+            SetMappedPath(pListNode, target);
+        }
+        else
+        {
+            SetMappedPath(pListNode, nullptr);
+        }
+    }
+
+    delete[] target;
+
+    return 0;
+}
+
 // Gets the mapped path for each mapped drive.
 // Returns 0 if successful and non-zero if failed.
 static int GetMappedPaths(PSUBST_NODE* pOrderedSubstList)
 {
+    if (g_isDirect)
+    {
+        return QueryMappedPaths(pOrderedSubstList);
+    }
+
     SECURITY_ATTRIBUTES saAttr;
     HANDLE g_hChildStd_IN_Rd = NULL;
     HANDLE g_hChildStd_OUT_Rd = NULL;
@@ -473,6 +566,17 @@ static int UnmapDrive(PSUBST_NODE pSubstNode)
 {
     int ret = 0;
 
+    if (g_isDirect)
+    {
+        TCHAR driveString[3];
+        driveString[0] = pSubstNode->szDriveLetter;
+        driveString[1] = L':';
+        driveString[2] = L'\0';
+
+        // Like subst /D, removes the current definition.
+        return DefineDosDevice(DDD_REMOVE_DEFINITION, driveString, nullptr) ? 0 : 1;
+    }
+
     std::wstring substCommand(L"subst /D \"");
     TCHAR driveString[3];
     driveString[0] = pSubstNode->szDriveLetter;
@@ -490,6 +594,24 @@ static int MapDrive(PSUBST_NODE pSubstNode)
 {
     int ret = 0;
 
+    if (g_isDirect)
+    {
+        TCHAR driveString[3];
+        driveString[0] = pSubstNode->szDriveLetter;
+        driveString[1] = L':';
+        driveString[2] = L'\0';
+
+        // Like subst, fails for a drive that is already defined rather than hiding its definition.
+        wchar_t current[MAX_PATH];
+        if (QueryDosDevice(driveString, current, MAX_PATH) != 0 || GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+        {
+            return 1;
+        }
+
+        std::wstring target(pSubstNode->szSourceDirectory, wcslen(pSubstNode->szSourceDirectory) - 1); // Skip the trailing '\\'.
+        return DefineDosDevice(0, driveString, target.c_str()) ? 0 : 1;
+    }
+
     std::wstring substCommand(L"subst \"");
     TCHAR driveString[3];
     driveString[0] = pSubstNode->szDriveLetter;
@@ -771,6 +893,12 @@ static int SubstDrivesAndExecute(int argc, _TCHAR* argv[], PSUBST_LIST_NODE pSub
             i++;
         }
 
+        // With the direct queries, find the drives left in place by a previous run with the same mappings.
+        if (g_isDirect)
+        {
+            GetMappedPaths(pOrderedSubstList);
+        }
+
         // Now map the drive and check to see if it worked. If not, wait for release and map again.
         for (int i = 0; i < NUMBER_DEFINABLE_SUBST;)
         {
@@ -781,9 +909,17 @@ static int SubstDrivesAndExecute(int argc, _TCHAR* argv[], PSUBST_LIST_NODE pSub
                 continue;
             };
 
-            MapDrive(pListNode);
+            bool isMapped = pListNode->szMappedPath != nullptr && wcscmp(pListNode->szSourceDirectory, pListNode->szMappedPath) == 0;
+            if (!isMapped)
+            {
+                MapDrive(pListNode);
 
-            GetMappedPaths(pOrderedSubstList);
+                GetMappedPaths(pOrderedSubstList);
+            }
+            else
+            {
+                printVerbose(L"Drive %C: is already mapped to %s.", pListNode->szDriveLetter, pListNode->szSourceDirectory);
+            }
 
             if (pListNode->szSourceDirectory != nullptr &&
                 pListNode->szMappedPath != nullptr &&
@@ -872,10 +1008,19 @@ static int SubstDrivesAndExecute(int argc, _TCHAR* argv[], PSUBST_LIST_NODE pSub
             continue;
         };
 
-        LogToFile(pListNode, L"Done! Unsubst drive %C: - %s.",
-            static_cast<char>(pListNode->szDriveLetter), pListNode->szSourceDirectory);
+        if (g_keepMappings)
+        {
+            LogToFile(pListNode, L"Done! Keeping drive %C: - %s.",
+                static_cast<char>(pListNode->szDriveLetter), pListNode->szSourceDirectory);
+        }
+        else
+        {
+            LogToFile(pListNode, L"Done! Unsubst drive %C: - %s.",
+                static_cast<char>(pListNode->szDriveLetter), pListNode->szSourceDirectory);
+
+            UnmapDrive(pListNode);
+        }
 
-        UnmapDrive(pListNode);
         assert(pListNode->hLockFile != INVALID_HANDLE_VALUE && "Invalide state. Lock file handle should not be invalid.");
 
         if (pListNode->hLockFile == INVALID_HANDLE_VALUE)
@@ -900,6 +1045,9 @@ int _tmain(int argc, _TCHAR* argv[])
 
     int executableToRunIndex = -1;
 
+    g_isVerbose = IsEnvironmentFlagSet(RUN_IN_SUBST_VERBOSE);
+    g_isDirect = IsEnvironmentFlagSet(RUN_IN_SUBST_DIRECT);
+    g_keepMappings = IsEnvironmentFlagSet(RUN_IN_SUBST_KEEP_MAPPINGS);
 
     InitializeState(&pSubstList, &pOrderedSubstList, &executableToRunIndex);
 
@@ -0,0 +1,85 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Diagnostics.ContractsLight;
+using System.IO;
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// Attributes, size and timestamps of a declared input, as probing its attributes would return them.
+    /// </summary>
+    /// <remarks>
+    /// The sandbox answers the attribute probes of a file from its metadata (see <see cref="FileAccessManifest.SetDeclaredInputMetadata"/>)
+    /// instead of querying the file system. Timestamps are FILETIMEs (UTC); they are overridden as those returned by the file system are.
+    /// </remarks>
+    public readonly struct DeclaredInputMetadata
+    {
+        /// <summary>
+        /// Attributes of the file.
+        /// </summary>
+        public FileAttributes Attributes { get; }
+
+        /// <summary>
+        /// Size of the file, in bytes.
+        /// </summary>
+        public long Size { get; }
+
+        /// <summary>
+        /// Creation time of the file, as a FILETIME.
+        /// </summary>
+        public long CreationTime { get; }
+
+        /// <summary>
+        /// Last access time of the file, as a FILETIME.
+        /// </summary>
+        public long LastAccessTime { get; }
+
+        /// <summary>
+        /// Last write time of the file, as a FILETIME.
+        /// </summary>
+        public long LastWriteTime { get; }
+
+        /// <summary>
+        /// Creates an instance
+        /// </summary>
+        public DeclaredInputMetadata(FileAttributes attributes, long size, long creationTime, long lastAccessTime, long lastWriteTime)
+        {
+            Contract.Requires(size >= 0);
+
+            Attributes = attributes;
+            Size = size;
+            CreationTime = creationTime;
+            LastAccessTime = lastAccessTime;
+            LastWriteTime = lastWriteTime;
+        }
+
+        /// <summary>
+        /// Creates an instance from UTC times.
+        /// </summary>
+        public DeclaredInputMetadata(FileAttributes attributes, long size, DateTime creationTimeUtc, DateTime lastAccessTimeUtc, DateTime lastWriteTimeUtc)
+            : this(attributes, size, creationTimeUtc.ToFileTimeUtc(), lastAccessTimeUtc.ToFileTimeUtc(), lastWriteTimeUtc.ToFileTimeUtc())
+        {
+        }
+
+        internal void Serialize(BinaryWriter writer)
+        {
+            writer.Write((uint)Attributes);
+            writer.Write(Size);
+            writer.Write(CreationTime);
+            writer.Write(LastAccessTime);
+            writer.Write(LastWriteTime);
+        }
+
+        internal static DeclaredInputMetadata Deserialize(BinaryReader reader)
+        {
+            var attributes = (FileAttributes)reader.ReadUInt32();
+            long size = reader.ReadInt64();
+            long creationTime = reader.ReadInt64();
+            long lastAccessTime = reader.ReadInt64();
+            long lastWriteTime = reader.ReadInt64();
+            return new DeclaredInputMetadata(attributes, size, creationTime, lastAccessTime, lastWriteTime);
+        }
+    }
+}
@@ -0,0 +1,249 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Concurrent;
+using System.Diagnostics.ContractsLight;
+using System.Threading;
+using BuildXL.Interop.MacOS;
+using BuildXL.Utilities;
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// A connection to the Endpoint Security client of the interop library, a user-space alternative to the sandbox kernel extension
+    /// (see <see cref="KextConnection"/>) on macOS 10.15 and later.
+    /// </summary>
+    /// <remarks>
+    /// The client shares the policy code of the kernel extension and delivers the same reports, so <see cref="SandboxedProcessMacKext"/>
+    /// works the same with either connection. Only the accesses of pips that fail unexpected file accesses are authorized before they
+    /// happen; all others are reported after the fact, in batches.
+    ///
+    /// The BuildXL process must run as root and be signed with the 'com.apple.developer.endpoint-security.client' entitlement
+    /// (see BuildXLEndpointSecurity.entitlements, which 'bxl.sh --sign-endpoint-security' signs the 'bxl' executable with).
+    /// </remarks>
+    public sealed class EndpointSecurityConnection : IKextConnection
+    {
+        /// <summary>
+        /// Configuration for <see cref="EndpointSecurityConnection"/>.
+        /// </summary>
+        public sealed class Config
+        {
+            /// <summary>
+            /// Whether to measure user/system CPU times of sandboxed processes.
+            /// </summary>
+            public bool MeasureCpuTimes;
+
+            /// <summary>
+            /// How long (in milliseconds) the reports of a batch may wait for the batch to fill up before they are delivered.
+            /// </summary>
+            public uint FlushIntervalMs = 10;
+
+            /// <summary>
+            /// Callback to invoke in the case of an irrecoverable failure of the client.
+            /// </summary>
+            public Sandbox.ManagedFailureCallback FailureCallback;
+        }
+
+        private const string EntitlementHelper =
+@"The BuildXL process must run as root and be signed with the 'com.apple.developer.endpoint-security.client' entitlement, e.g., with:
+
+    sudo /bin/bash bxl.sh --sign-endpoint-security <identity> ...";
+
+        private readonly ConcurrentDictionary<long, SandboxedProcessMacKext> m_pipProcesses = new ConcurrentDictionary<long, SandboxedProcessMacKext>();
+
+        private readonly Sandbox.EndpointSecurityInfo m_info;
+        private readonly Sandbox.ManagedFailureCallback m_failureCallback;
+
+        /// <summary>
+        /// The native client calls it until it is stopped, so it must not be collected before that
+        /// </summary>
+        private readonly Sandbox.AccessReportBatchCallback m_reportCallback;
+
+        private long m_reportQueueLastEnqueueTime;
+        private long m_lastReportReceivedTimestampTicks = DateTime.UtcNow.Ticks;
+        private int m_released;
+
+        /// <inheritdoc />
+        public bool MeasureCpuTimes { get; }
+
+        /// <inheritdoc />
+        public bool IsInTestMode { get; }
+
+        /// <inheritdoc />
+        public ulong MinReportQueueEnqueueTime => (ulong)Volatile.Read(ref m_reportQueueLastEnqueueTime);
+
+        /// <inheritdoc />
+        public TimeSpan CurrentDrought => DateTime.UtcNow.Subtract(new DateTime(ticks: Volatile.Read(ref m_lastReportReceivedTimestampTicks)));
+
+        /// <summary>
+        /// Starts the Endpoint Security client; throws a <see cref="BuildXLException"/> if it cannot be started.
+        /// </summary>
+        public EndpointSecurityConnection(Config config = null, bool skipDisposingForTests = false)
+        {
+            MeasureCpuTimes = config?.MeasureCpuTimes ?? false;
+            IsInTestMode = skipDisposingForTests;
+            m_failureCallback = config?.FailureCallback;
+            m_reportCallback = ReceiveAccessReports;
+
+            var info = new Sandbox.EndpointSecurityInfo();
+            Sandbox.StartEndpointSecuritySandbox(m_reportCallback, Sandbox.AccessReportBatchSize, config?.FlushIntervalMs ?? 10, ref info);
+            if (info.Error != 0)
+            {
+                var reason = info.Error == Sandbox.EndpointSecurityClientNotEntitled || info.Error == Sandbox.EndpointSecurityClientNotPermitted
+                    ? EntitlementHelper
+                    : "Endpoint Security needs macOS 10.15 or later.";
+                throw new BuildXLException(
+                    $"Unable to start the Endpoint Security client (Code: 0x{info.Error:X}). {reason}",
+                    ExceptionRootCause.MissingRuntimeDependency);
+            }
+
+            m_info = info;
+        }
+
+        /// <summary>
+        /// Counters of the client since they were last reset (see <see cref="Sandbox.EndpointSecurityCounters"/>).
+        /// </summary>
+        public Sandbox.EndpointSecurityCounters GetCounters(bool reset = false)
+        {
+            Sandbox.GetEndpointSecurityCounters(m_info, out var counters, reset);
+            return counters;
+        }
+
+        /// <summary>
+        /// Stops the client, unless this connection is shared by unit tests
+        /// </summary>
+        public void Dispose()
+        {
+            if (!IsInTestMode)
+            {
+                ReleaseResources();
+            }
+        }
+
+        /// <inheritdoc />
+        public void ReleaseResources()
+        {
+            if (Interlocked.Exchange(ref m_released, 1) == 0)
+            {
+                // returns once the reports thread has delivered its last batch
+                Sandbox.StopEndpointSecuritySandbox(m_info);
+            }
+        }
+
+        private void ReceiveAccessReports(Sandbox.AccessReport[] reports, int count, int code)
+        {
+            if (code != Sandbox.ReportQueueSuccessCode)
+            {
+                m_failureCallback?.Invoke(code, "Endpoint Security client failed to deliver reports");
+                return;
+            }
+
+            Volatile.Write(ref m_lastReportReceivedTimestampTicks, DateTime.UtcNow.Ticks);
+            for (int i = 0; i < count; i++)
+            {
+                var report = reports[i];
+                UpdateLastEnqueueTime(report.Statistics.EnqueueTime);
+
+                // The only way it can happen that no process is found for 'report.PipId' is when that pip is
+                // explicitly terminated (e.g., because it timed out or Ctrl-c was pressed)
+                if (!m_pipProcesses.TryGetValue(report.PipId, out var process))
+                {
+                    continue;
+                }
+
+                if (process.ProcessId != report.RootPid)
+                {
+                    m_failureCallback?.Invoke(-1, $"Unexpected PID for Pip {report.PipId:X}: Expected {process.ProcessId}, Reported {report.RootPid}");
+                }
+                else
+                {
+                    process.PostAccessReport(report);
+                }
+            }
+        }
+
+        private void UpdateLastEnqueueTime(ulong enqueueTime)
+        {
+            long current = Volatile.Read(ref m_reportQueueLastEnqueueTime);
+            while ((ulong)current < enqueueTime)
+            {
+                long previous = Interlocked.CompareExchange(ref m_reportQueueLastEnqueueTime, (long)enqueueTime, current);
+                if (previous == current)
+                {
+                    break;
+                }
+
+                current = previous;
+            }
+        }
+
+        /// <summary>
+        /// The Endpoint Security client does not throttle processes, so there is nothing to notify it of.
+        /// </summary>
+        public bool NotifyUsage(uint cpuUsageBasisPoints, uint availableRamMB) => true;
+
+        /// <summary>
+        /// The Endpoint Security client does not throttle processes, so there is no resource usage to sample.
+        /// </summary>
+        public bool StartResourceSampler(uint intervalMs) => true;
+
+        /// <inheritdoc />
+        public bool NotifyKextPipStarted(FileAccessManifest fam, SandboxedProcessMacKext process)
+        {
+            Contract.Requires(process.Started);
+            Contract.Requires(fam.PipId != 0);
+
+            if (!m_pipProcesses.TryAdd(fam.PipId, process))
+            {
+                throw new BuildXLException($"Process with PidId {fam.PipId} already exists");
+            }
+
+            var setup = new FileAccessSetup()
+            {
+                DllNameX64 = string.Empty,
+                DllNameX86 = string.Empty,
+                ReportPath = process.ExecutableAbsolutePath, // piggybacking on ReportPath to pass full executable path
+            };
+
+            using (var wrapper = Pools.MemoryStreamPool.GetInstance())
+            {
+                var debugFlags = true;
+                ArraySegment<byte> manifestBytes = fam.GetPayloadBytes(
+                    setup,
+                    wrapper.Instance,
+                    timeoutMins: 10, // don't care because the client does not kill the process once it times out
+                    debugFlagsMatch: ref debugFlags);
+
+                Contract.Assert(manifestBytes.Offset == 0);
+
+                return Sandbox.EndpointSecuritySendPipStarted(
+                    processId: process.ProcessId,
+                    pipId: fam.PipId,
+                    famBytes: manifestBytes.Array,
+                    famBytesLength: manifestBytes.Count,
+                    info: m_info);
+            }
+        }
+
+        /// <inheritdoc />
+        public void NotifyKextPipProcessTerminated(long pipId, int processId)
+        {
+            Sandbox.EndpointSecuritySendPipProcessTerminated(pipId, processId, m_info);
+        }
+
+        /// <inheritdoc />
+        public bool NotifyKextProcessFinished(long pipId, SandboxedProcessMacKext process)
+        {
+            if (m_pipProcesses.TryRemove(pipId, out var proc))
+            {
+                Contract.Assert(process == proc);
+                return true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+    }
+}
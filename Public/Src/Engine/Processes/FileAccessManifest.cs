@@ -34,16 +34,75 @@ namespace BuildXL.Processes
         /// </summary>
         private FileAccessManifestFlag m_fileAccessManifestFlag;
 
+        private FileAccessManifestExtraFlag m_fileAccessManifestExtraFlag;
+
         /// <summary>
         /// Name of semaphore for message count.
         /// </summary>
         private string m_messageCountSemaphoreName;
 
+        private Internal.SharedCounter m_messageCount;
+
         /// <summary>
         /// Sealed manifest tree.
         /// </summary>
         private byte[] m_sealedManifestTreeBlock;
 
+        /// <summary>
+        /// Policies of the files with a given suffix (see <see cref="AddSuffixPolicy"/>), by normalized suffix.
+        /// </summary>
+        private readonly Dictionary<NormalizedPathString, SuffixPolicy> m_suffixPolicies = new Dictionary<NormalizedPathString, SuffixPolicy>();
+
+        /// <summary>
+        /// Metadata of the declared inputs attribute probes are answered from (see <see cref="SetDeclaredInputMetadata"/>).
+        /// </summary>
+        private readonly Dictionary<AbsolutePath, DeclaredInputMetadata> m_declaredInputMetadata = new Dictionary<AbsolutePath, DeclaredInputMetadata>();
+
+        /// <summary>
+        /// Image names of the child processes that break away from the sandbox (see <see cref="AddChildProcessToBreakaway"/>).
+        /// </summary>
+        private readonly HashSet<string> m_childProcessesToBreakaway = new HashSet<string>(StringComparer.OrdinalIgnoreCase);
+
+        /// <summary>
+        /// Name of the process admission gate detoured processes wait on before starting a child process (see <see cref="SetProcessAdmissionGate"/>).
+        /// </summary>
+        private string m_processAdmissionGateName;
+
+        /// <summary>
+        /// Longest time, in milliseconds, a detoured process waits on the process admission gate (0 for no limit).
+        /// </summary>
+        private uint m_processAdmissionMaxWaitMs;
+
+        /// <summary>
+        /// Untracked temp directory of the pip redirected to a faster volume (see <see cref="RedirectUntrackedTempDirectory"/>).
+        /// </summary>
+        private string m_untrackedTempDirectory;
+
+        /// <summary>
+        /// Root, on a faster volume, of the directory the untracked temp directory is redirected to.
+        /// </summary>
+        private string m_tempRedirectionRoot;
+
+        /// <summary>
+        /// Number of pipes the detoured processes of the pip report to (see <see cref="ReportChannelCount"/>).
+        /// </summary>
+        private int m_reportChannelCount = 1;
+
+        /// <summary>
+        /// Whether the detoured processes count the lookups of the manifest tree (see <see cref="ProfileManifestLookups"/>).
+        /// </summary>
+        private bool m_profileManifestLookups;
+
+        /// <summary>
+        /// CPU priority class of the processes of the pip, if any (see <see cref="PriorityClass"/>).
+        /// </summary>
+        private System.Diagnostics.ProcessPriorityClass? m_priorityClass;
+
+        /// <summary>
+        /// I/O priority of the processes of the pip, if any (see <see cref="IoPriority"/>).
+        /// </summary>
+        private IoPriorityHint? m_ioPriority;
+
         /// <summary>
         /// Creates an empty instance.
         /// </summary>
@@ -83,6 +142,37 @@ namespace BuildXL.Processes
             QBuildIntegrated = false;
             PipId = 0L;
             EnforceAccessPoliciesOnDirectoryCreation = false;
+            UseBinaryReportFormat = false;
+            BufferReports = false;
+            UseReportRingBuffer = false;
+            InternReportedPaths = false;
+            DeduplicateReports = false;
+            CacheReparsePointProbes = false;
+            OmitPassThroughDetours = false;
+            SendReportsAsynchronously = false;
+            CollectDetourStatistics = false;
+            ReportUsnsAfterOpen = false;
+            CacheFinalPathsOfHandles = false;
+            ShareReportCacheAcrossProcesses = false;
+            SummarizeFileAccesses = false;
+            InheritDeviceMap = false;
+            CachePolicyResults = false;
+            SequenceReports = false;
+            UseAccessBitmap = false;
+            HashOutputsWhileWriting = false;
+            LogDebugMessagesAsynchronously = false;
+            CoalesceOutputWrites = false;
+            UseBlockCloneForCopies = false;
+            FastTempFileNames = false;
+            CacheKnownDirectories = false;
+            UseLargeFetchEnumerations = false;
+            CacheCurrentDirectory = false;
+            AdaptiveReportBackpressure = false;
+            PrefetchDeclaredInputs = false;
+            PublishLiveCounters = false;
+            CapturePolicyInputs = false;
+            DetourNtLayerOnly = false;
+            ShrinkCachesUnderMemoryPressure = false;
         }
 
         private bool GetFlag(FileAccessManifestFlag flag) => (m_fileAccessManifestFlag & flag) != 0;
@@ -104,6 +194,20 @@ namespace BuildXL.Processes
             }
         }
 
+        private bool GetExtraFlag(FileAccessManifestExtraFlag flag) => (m_fileAccessManifestExtraFlag & flag) != 0;
+
+        private void SetExtraFlag(FileAccessManifestExtraFlag flag, bool value)
+        {
+            if (value)
+            {
+                m_fileAccessManifestExtraFlag |= flag;
+            }
+            else
+            {
+                m_fileAccessManifestExtraFlag &= ~flag;
+            }
+        }
+
         /// <summary>
         /// Flag indicating if the manifest tree block is sealed.
         /// </summary>
@@ -300,6 +404,9 @@ namespace BuildXL.Processes
         /// <summary>
         /// Whether BuildXL will use larger NtClose preallocated list.
         /// </summary>
+        /// <remarks>
+        /// No longer has any effect: NtClose removes handle overlays without a preallocated list.
+        /// </remarks>
         public bool UseLargeNtClosePreallocatedList
         {
             get => GetFlag(FileAccessManifestFlag.UseLargeNtClosePreallocatedList);
@@ -309,6 +416,9 @@ namespace BuildXL.Processes
         /// <summary>
         /// Whether BuildXL will use extra thread to drain NtClose handle List or clean the cache directly.
         /// </summary>
+        /// <remarks>
+        /// No longer has any effect: NtClose removes handle overlays directly, without taking a lock.
+        /// </remarks>
         public bool UseExtraThreadToDrainNtClose
         {
             get => GetFlag(FileAccessManifestFlag.UseExtraThreadToDrainNtClose);
@@ -371,160 +481,1043 @@ namespace BuildXL.Processes
         }
 
         /// <summary>
-        /// A location for a file where Detours to log failure messages.
+        /// If true, Detours sends reports as length-prefixed binary records instead of '|'-separated text lines.
         /// </summary>
-        public string InternalDetoursErrorNotificationFile { get; set; }
+        /// <remarks>
+        /// File access reports are sent as fixed-layout records that can be parsed with
+        /// <see cref="SandboxedProcessReports.FileAccessReportRecord.TryParse"/>, and process detouring status reports as records that can be passed
+        /// to <see cref="SandboxedProcessReports.ReportProcessDetouringStatus"/>; all other reports are framed text lines.
+        /// <see cref="SandboxedProcess"/> reads the report pipe, the report channels and the report ring as records when this is set, and
+        /// hands them to <see cref="SandboxedProcessReports.ReportRecordReceived"/>.
+        /// </remarks>
+        public bool UseBinaryReportFormat
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.UseBinaryReportFormat);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.UseBinaryReportFormat, value);
+        }
 
         /// <summary>
-        /// The semaphore that keeps count to the sent and received messages.
+        /// If true, Detours collects reports in a per-process buffer and writes them out in batches
+        /// instead of issuing one write per report.
         /// </summary>
-        public System.Threading.Semaphore MessageCountSemaphore { get; private set; }
+        /// <remarks>
+        /// The buffer is written out when it fills up, every 100 milliseconds from a background thread, before the process starts a
+        /// child, right after a denial, and when the process detaches. A process terminated without detaching (e.g. by
+        /// <c>TerminateProcess</c>, or when the pip times out or is cancelled) loses the reports it buffered since the last write,
+        /// which are at most the ones of the last 100 milliseconds. Only turn this on for pips whose processes exit normally, or
+        /// whose last accesses need not be observed.
+        /// </remarks>
+        public bool BufferReports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.BufferReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.BufferReports, value);
+        }
 
         /// <summary>
-        /// Directory translator.
+        /// If true, Detours appends reports to a shared-memory ring instead of writing them to the report pipe.
         /// </summary>
-        public DirectoryTranslator DirectoryTranslator { get; }
+        /// <remarks>
+        /// The ring is a named file mapping created when the manifest is serialized for a process (see <see cref="ReportRing"/>) and named
+        /// after the message count semaphore, so it requires <see cref="SetMessageCountSemaphore"/> to be called first. The sandboxed process
+        /// drains it while the pip runs, next to the report pipe. Detoured processes fall back to the report pipe when the ring cannot be
+        /// opened, when it stays full, or for very large reports; a process that fell back once keeps writing to the pipe, so that its
+        /// reports stay in order.
+        /// </remarks>
+        public bool UseReportRingBuffer
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.UseReportRingBuffer);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.UseReportRingBuffer, value);
+        }
 
         /// <summary>
-        /// The pip's unique id.
-        /// Right now it is the Pip.SemiStableHash.
+        /// If true, each detoured process sends a reported path in full only once and refers to it by a process-local id afterwards.
+        /// Paths that exactly match a manifest node are not sent at all.
         /// </summary>
-        public long PipId { get; set; }
+        /// <remarks>
+        /// Only effective together with <see cref="UseBinaryReportFormat"/>, and ignored when <see cref="UseReportRingBuffer"/> is set.
+        /// </remarks>
+        public bool InternReportedPaths
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.InternReportedPaths);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.InternReportedPaths, value);
+        }
 
         /// <summary>
-        /// Sets message count semaphore.
+        /// If true, each detoured process drops allowed file access reports already implied by an earlier report of the same path.
         /// </summary>
-        public bool SetMessageCountSemaphore(string semaphoreName)
+        /// <remarks>
+        /// Implication follows the macOS sandbox cache: Write implies Read, Read implies Probe, and Probe implies Lookup.
+        /// An enumeration is only dropped when the same process already reported an enumeration of the same directory with the same filter.
+        /// Denied accesses and process start reports are never dropped.
+        /// </remarks>
+        public bool DeduplicateReports
         {
-            Contract.Requires(!string.IsNullOrEmpty(semaphoreName));
-
-            UnsetMessageCountSemaphore();
-            m_messageCountSemaphoreName = semaphoreName;
-            MessageCountSemaphore = new System.Threading.Semaphore(0, int.MaxValue, semaphoreName, out bool newlyCreated);
+            get => GetExtraFlag(FileAccessManifestExtraFlag.DeduplicateReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.DeduplicateReports, value);
+        }
 
-            return newlyCreated;
+        /// <summary>
+        /// If true, each detoured process caches the attributes and reparse point tags it probes to detect reparse points,
+        /// and the chains of paths it resolves from a reparse point to its final target.
+        /// </summary>
+        /// <remarks>
+        /// The cache is dropped whenever the process itself creates, moves, or deletes a file. Changes made by other processes
+        /// (or by device I/O controls setting reparse points) are not observed, so this should only be enabled for pips whose
+        /// processes do not create reparse points under paths that other processes of the pip probe.
+        /// </remarks>
+        public bool CacheReparsePointProbes
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CacheReparsePointProbes);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CacheReparsePointProbes, value);
         }
 
         /// <summary>
-        /// Unset message count semaphore.
+        /// If true, detoured processes do not detour the functions that, given the rest of this manifest, would only call
+        /// through to the real function (the file encryption functions, ReplaceFile, and SetFileInformationByHandle and
+        /// ZwSetInformationFile when those are ignored).
         /// </summary>
-        public void UnsetMessageCountSemaphore()
+        /// <remarks>
+        /// This makes process startup cheaper without changing what gets reported: the omitted detours neither enforce
+        /// nor report anything in that case.
+        /// </remarks>
+        public bool OmitPassThroughDetours
         {
-            if (MessageCountSemaphore == null)
-            {
-                Contract.Assert(m_messageCountSemaphoreName == null);
-                return;
-            }
+            get => GetExtraFlag(FileAccessManifestExtraFlag.OmitPassThroughDetours);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.OmitPassThroughDetours, value);
+        }
 
-            MessageCountSemaphore.Dispose();
-            MessageCountSemaphore = null;
-            m_messageCountSemaphoreName = null;
+        /// <summary>
+        /// If true, detoured processes hand the reports of allowed file accesses to a background thread that formats and sends
+        /// them, instead of doing it on the thread making the access.
+        /// </summary>
+        /// <remarks>
+        /// Reports keep their order: denied accesses, process reports, and starting child processes first wait for the queued
+        /// reports to be sent, and the queue is drained when the process exits.
+        /// </remarks>
+        public bool SendReportsAsynchronously
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.SendReportsAsynchronously);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.SendReportsAsynchronously, value);
         }
 
         /// <summary>
-        /// Adds a policy to an entire scope
+        /// If true, detoured processes count the calls to each detoured function and keep log-bucketed histograms of the time
+        /// spent in the real function and in the detour around it. The statistics are logged with the process data.
         /// </summary>
-        public void AddScope(AbsolutePath path, FileAccessPolicy mask, FileAccessPolicy values)
+        /// <remarks>
+        /// Timing every call has a small cost, so this is meant for investigating the overhead of the sandbox.
+        /// </remarks>
+        public bool CollectDetourStatistics
         {
-            Contract.Requires(!IsManifestTreeBlockSealed);
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CollectDetourStatistics);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CollectDetourStatistics, value);
+        }
 
-            if (!path.IsValid)
-            {
-                // Note that AbsolutePath.Invalid is allowable (representing the root scope).
-                m_rootNode.ApplyRootScope(new FileAccessScope(mask, values));
-                return;
-            }
+        /// <summary>
+        /// If true, detoured processes report the USN of every file they open, as <see cref="FileAccessPolicy.ReportUsnAfterOpen"/>
+        /// does for the files of a scope.
+        /// </summary>
+        /// <remarks>
+        /// Reading a USN costs an extra file system control call per open, so without this flag USNs are only read for the
+        /// scopes asking for them and the paths with an expected USN.
+        /// </remarks>
+        public bool ReportUsnsAfterOpen
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.ReportUsnsAfterOpen);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.ReportUsnsAfterOpen, value);
+        }
 
-            m_rootNode.AddConeWithScope(this, path, new FileAccessScope(mask, values));
+        /// <summary>
+        /// If true, detoured processes resolve the normalized final path of a file handle once and keep it with the handle, instead
+        /// of querying it again for every operation on the handle that needs a path (renames, deletions, GetFinalPathNameByHandle, etc.).
+        /// </summary>
+        /// <remarks>
+        /// The cached paths are dropped whenever the process moves, links, or deletes files. Renames of a parent directory done by
+        /// other processes are not noticed, which is why this is optional.
+        /// </remarks>
+        public bool CacheFinalPathsOfHandles
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CacheFinalPathsOfHandles);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CacheFinalPathsOfHandles, value);
         }
 
         /// <summary>
-        /// Adds a policy to an individual path (without implying any policy to the scope the path may define)
+        /// If true (along with <see cref="DeduplicateReports"/>), the detoured processes of a pip share the table of the accesses
+        /// they already reported, so that an access is dropped if any process of the pip reported an equal or stronger one.
         /// </summary>
-        public void AddPath(AbsolutePath path, FileAccessPolicy mask, FileAccessPolicy values, Usn? expectedUsn = null)
+        /// <remarks>
+        /// The one report that goes through comes from the process that made the first access, so that process is still known;
+        /// the other processes making the same access are not. The table lives in a section created by the first detoured process
+        /// and handed to child processes when they get injected.
+        /// </remarks>
+        public bool ShareReportCacheAcrossProcesses
         {
-            Contract.Requires(!IsManifestTreeBlockSealed);
-            Contract.Requires(path != AbsolutePath.Invalid);
+            get => GetExtraFlag(FileAccessManifestExtraFlag.ShareReportCacheAcrossProcesses);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.ShareReportCacheAcrossProcesses, value);
+        }
 
-            m_rootNode.AddNodeWithScope(this, path, new FileAccessScope(mask, values), expectedUsn ?? ReportedFileAccess.NoUsn);
+        /// <summary>
+        /// If true, detoured processes merge the allowed accesses to each path instead of reporting them one by one, and report
+        /// the merged accesses (as <see cref="ReportedFileOperation.MultipleOperations"/>) all at once when the process exits,
+        /// starts a child process, has merged the accesses of many paths, or every second.
+        /// </summary>
+        /// <remarks>
+        /// The report of a path carries all the accesses requested for it and the error of the last one (and a second report
+        /// carries the error of the first one if they differ). The order of the accesses is lost, and a path accessed again after
+        /// the summary was sent is reported again. Denied accesses, enumerations, and process start reports are still sent right
+        /// away. Meant for pips that only need the set of accessed paths.
+        /// A process terminated without detaching (e.g. by <c>TerminateProcess</c>, or when the pip times out or is cancelled)
+        /// loses the accesses merged since the summary was last sent, which are at most the ones of the last second.
+        /// </remarks>
+        public bool SummarizeFileAccesses
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.SummarizeFileAccesses);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.SummarizeFileAccesses, value);
         }
-        
-        private static void WriteChars(BinaryWriter writer, string str)
+
+        /// <summary>
+        /// If true, the child processes of detoured processes inherit the drive mappings of the pip from their parent, instead of
+        /// getting them applied when they are injected.
+        /// </summary>
+        /// <remarks>
+        /// A process created with another process as its parent (PROC_THREAD_ATTRIBUTE_PARENT_PROCESS) inherits the device map of
+        /// that process instead. The first process of the pip still gets the mappings applied.
+        /// </remarks>
+        public bool InheritDeviceMap
         {
-            var strLen = (uint)(string.IsNullOrEmpty(str) ? 0 : str.Length);
-            writer.Write(strLen);
-            for (var i = 0; i < strLen; i++)
-            {
-                writer.Write((char)str[i]);
-            }
+            get => GetExtraFlag(FileAccessManifestExtraFlag.InheritDeviceMap);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.InheritDeviceMap, value);
         }
 
-        private static string ReadChars(BinaryReader reader)
+        /// <summary>
+        /// If true, detoured processes remember the policy resolved for each path they access, so that accessing a path again
+        /// does not search the manifest nor apply the path translations and special case rules again.
+        /// </summary>
+        /// <remarks>
+        /// Costs memory in the detoured processes, up to a bounded number of paths, hence it is optional.
+        /// </remarks>
+        public bool CachePolicyResults
         {
-            uint length = reader.ReadUInt32();
-            if (length == 0)
-            {
-                // TODO: Make ReadChars and WriteChars symmetric.
-                // Note that there's asymmetry between WriteChars and ReadChars.
-                // WriteChars has existed for long time and is used to serialize string to Detours.
-                // ReadChars is introduced as a way to reuse WriteChars when BuildXL has to serialize/deserialize
-                // manifest to files. We can make WriteChars and ReadChars symmetric, as well as, optimize the encoding.
-                // However, such changes entails changing Detours code.
-                return null;
-            }
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CachePolicyResults);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CachePolicyResults, value);
+        }
 
-            char[] chars = new char[length];
+        /// <summary>
+        /// If true, every binary report carries a sequence number taken from a counter shared by all the detoured processes of the pip,
+        /// so that the order in which the reports were produced can be restored from buffered or queued reports of several processes.
+        /// </summary>
+        /// <remarks>
+        /// Only effective together with <see cref="UseBinaryReportFormat"/>. The counter is a named file mapping created by the consumer
+        /// (see <see cref="Internal.SharedCounter.ReportSequenceNameSuffix"/>) and named after the message count semaphore, so it requires
+        /// <see cref="InternalDetoursErrorNotificationFile"/> to be set. Reports are sent with a sequence of 0 when it cannot be opened.
+        /// A detoured process also writes out its buffered reports before it starts a child process.
+        /// </remarks>
+        public bool SequenceReports
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.SequenceReports);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.SequenceReports, value);
+        }
 
-            for (int i = 0; i < chars.Length; ++i)
-            {
-                chars[i] = reader.ReadChar();
-            }
+        /// <summary>
+        /// If true, the detoured processes record the successful reads and probes of the paths that are nodes of the manifest, when
+        /// explicitly reported, by setting the bit of the node in a bitmap shared by the pip rather than by sending a report.
+        /// The bitmaps are scanned once the pip is done, and yield one access per path (see <see cref="AccessBitmap"/>).
+        /// </summary>
+        /// <remarks>
+        /// Declared inputs are typically accessed that way, which then costs next to nothing to report, but the process, the error and the
+        /// exact operation of each access are lost (the accesses are attributed to the main process). The bitmaps are a named file mapping
+        /// created when the manifest is serialized for a process, and named after the message count semaphore, so it requires
+        /// <see cref="SetMessageCountSemaphore"/> to be called first. Accesses are reported as usual when the bitmaps cannot be opened.
+        /// </remarks>
+        public bool UseAccessBitmap
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.UseAccessBitmap);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.UseAccessBitmap, value);
+        }
 
-            return new string(chars);
+        /// <summary>
+        /// If true, the detoured processes compute the VSO0 hash of each file they create or truncate from the bytes they write to it,
+        /// and report it when the handle is closed (see <see cref="OutputContentHash"/>).
+        /// </summary>
+        /// <remarks>
+        /// Only handles that write the file sequentially from its start get a hash; any other write invalidates it, as does a size that
+        /// differs from the bytes hashed when the handle is closed. Writes made other than through the handle (a mapped view, another
+        /// handle to the same file, another process) are not observed, and one that keeps the size of the file within the same clock
+        /// tick goes unnoticed, so the hash may not be the one of the file on disk: BuildXL does not use it in place of hashing the
+        /// outputs itself. Handles closed with NtClose alone are not reported. This detours NtWriteFile, which otherwise is not.
+        /// </remarks>
+        public bool HashOutputsWhileWriting
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.HashOutputsWhileWriting);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.HashOutputsWhileWriting, value);
         }
 
-        private static void WriteInjectionTimeoutBlock(BinaryWriter writer, uint timeoutInMins)
+        /// <summary>
+        /// If true, the debug messages of the detoured processes are queued and written to the report channel by a background thread,
+        /// instead of by the thread that logs them.
+        /// </summary>
+        /// <remarks>
+        /// Each call site may queue a limited number of messages per second; messages beyond that, or that do not fit into the queue,
+        /// are dropped and counted in a message written with the next batch. Messages are truncated to 511 characters. Only meant
+        /// for diagnosing the sandbox, where logging synchronously would slow the traced process down too much.
+        /// </remarks>
+        public bool LogDebugMessagesAsynchronously
         {
-            writer.Write((uint)timeoutInMins);
+            get => GetExtraFlag(FileAccessManifestExtraFlag.LogDebugMessagesAsynchronously);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.LogDebugMessagesAsynchronously, value);
         }
 
-        private const uint ErrorDumpLocationCheckedCode = 0xABCDEF03;
-        private const uint TranslationPathStringCheckedCode = 0xABCDEF02;
-        private const uint FlagsCheckedCode = 0xF1A6B10C; // Flag block
-        private const uint PipIdCheckedCode = 0xF1A6B10E;
+        /// <summary>
+        /// If true, a detoured process reports an allowed write to a path only once, until the path is deleted or renamed, even if
+        /// <see cref="DeduplicateReports"/> is not set.
+        /// </summary>
+        /// <remarks>
+        /// Meant for tools that open, write and close the same output many times (log appenders, incremental linkers, writers of
+        /// dependency files). Only accesses that include a write are coalesced; other accesses are reported as usual. Has no effect
+        /// when <see cref="DeduplicateReports"/> is set, which deduplicates all accesses the same way.
+        /// </remarks>
+        public bool CoalesceOutputWrites
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CoalesceOutputWrites);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CoalesceOutputWrites, value);
+        }
 
-        [SuppressMessage("Microsoft.Globalization", "CA1308:NormalizeStringsToUppercase", Justification = "Architecture strings are USASCII")]
-        private static void WriteErrorDumpLocation(BinaryWriter writer, string internalDetoursErrorNotificationFile)
+        /// <summary>
+        /// If true, a detoured <c>CopyFile</c> whose destination may be written is made by block cloning (<c>FSCTL_DUPLICATE_EXTENTS_TO_FILE</c>)
+        /// when the source and the destination are on the same volume and the volume supports it (ReFS, Dev Drive).
+        /// </summary>
+        /// <remarks>
+        /// The copy shares the clusters of its source instead of duplicating its bytes, and gets the attributes and last write time of the
+        /// source as with a regular copy. Copies with a progress routine, with copy flags other than <c>COPY_FILE_FAIL_IF_EXISTS</c>, or of
+        /// files that are encrypted, compressed or have alternate data streams are made the regular way, as are copies for which cloning fails.
+        /// The reported accesses are the same either way.
+        /// </remarks>
+        public bool UseBlockCloneForCopies
         {
-#if DEBUG
-            writer.Write(ErrorDumpLocationCheckedCode);
-#endif
-            WriteChars(writer, internalDetoursErrorNotificationFile);
+            get => GetExtraFlag(FileAccessManifestExtraFlag.UseBlockCloneForCopies);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.UseBlockCloneForCopies, value);
         }
 
-        private static string ReadErrorDumpLocation(BinaryReader reader)
+        /// <summary>
+        /// If true, a detoured <c>GetTempFileName</c> that has to create the file tries names from a sequence of its process (seeded from
+        /// the process id) rather than from the time, so that the first name tried is almost always free even in a crowded temp directory.
+        /// </summary>
+        /// <remarks>
+        /// The names have the usual format (up to three characters of the prefix, four hex digits and <c>.TMP</c>). Only the creation of the
+        /// returned file is reported, as a write, instead of every name probed by the real API.
+        /// </remarks>
+        public bool FastTempFileNames
         {
-#if DEBUG
-            uint code = reader.ReadUInt32();
-            Contract.Assert(ErrorDumpLocationCheckedCode == code);
-#endif
-            return ReadChars(reader);
+            get => GetExtraFlag(FileAccessManifestExtraFlag.FastTempFileNames);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.FastTempFileNames, value);
         }
 
-        [SuppressMessage("Microsoft.Globalization", "CA1308:NormalizeStringsToUppercase", Justification = "Architecture strings are USASCII")]
-        private static void WriteTranslationPathStrings(BinaryWriter writer, DirectoryTranslator translatePaths)
+        /// <summary>
+        /// If true, each detoured process remembers the directories it created or found to exist with <c>CreateDirectory</c>, and answers
+        /// later calls for them with <c>ERROR_ALREADY_EXISTS</c> without checking, reporting, or hitting the filesystem again.
+        /// </summary>
+        /// <remarks>
+        /// Meant for tools that create every ancestor of every output (<c>mkdir -p</c>). A process forgets what it knows when it removes or
+        /// moves files; directories removed by other processes of the pip are not seen.
+        /// </remarks>
+        public bool CacheKnownDirectories
         {
-#if DEBUG
-            writer.Write(TranslationPathStringCheckedCode);
-#endif
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CacheKnownDirectories);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CacheKnownDirectories, value);
+        }
 
-            // Write the number of translation paths.
-            uint translatePathLen = (uint)(translatePaths?.Count ?? 0);
-            writer.Write(translatePathLen);
+        /// <summary>
+        /// If true, detoured <c>FindFirstFile</c>/<c>FindFirstFileEx</c> calls enumerate with <c>FindExInfoBasic</c> and
+        /// <c>FIND_FIRST_EX_LARGE_FETCH</c>, so that big directories are read with a few kernel calls rather than one every few entries.
+        /// </summary>
+        /// <remarks>
+        /// The short (8.3) names of the entries (<c>cAlternateFileName</c>) come back empty; only enable this for tools that do not use them.
+        /// </remarks>
+        public bool UseLargeFetchEnumerations
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.UseLargeFetchEnumerations);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.UseLargeFetchEnumerations, value);
+        }
 
-            if (translatePathLen > 0)
-            {
-                Contract.Assert(translatePaths != null);
+        /// <summary>
+        /// If true, each detoured process keeps its current directory until it changes it with <c>SetCurrentDirectory</c>, so that plain
+        /// relative paths (e.g., those of make and of scripts) are canonicalized without asking the process for its current directory each time.
+        /// </summary>
+        /// <remarks>
+        /// The current directory must not be changed by other means than <c>SetCurrentDirectory</c> (e.g., by calling <c>RtlSetCurrentDirectory_U</c>).
+        /// </remarks>
+        public bool CacheCurrentDirectory
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CacheCurrentDirectory);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CacheCurrentDirectory, value);
+        }
+
+        /// <summary>
+        /// If true, a detoured process whose writes to the report channel become slow (i.e., BuildXL lags behind on its reports) summarizes
+        /// its allowed file accesses as with <see cref="SummarizeFileAccesses"/> until the writes speed up again, instead of blocking on each report.
+        /// Each switch is logged as a debug message.
+        /// </summary>
+        public bool AdaptiveReportBackpressure
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.AdaptiveReportBackpressure);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.AdaptiveReportBackpressure, value);
+        }
+
+        /// <summary>
+        /// If true, the first detoured process of the pip reads the files the manifest declares as inputs ahead of the tool, on a few
+        /// background threads, so that its first reads of them find them in the file system cache. The prefetch reads are not reported.
+        /// </summary>
+        public bool PrefetchDeclaredInputs
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.PrefetchDeclaredInputs);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.PrefetchDeclaredInputs, value);
+        }
+
+        /// <summary>
+        /// If true, each detoured process publishes its counters (reports sent, handle overlays, policy cache hits, time spent in the detours)
+        /// while it runs, in a slot of a mapping shared by the pip, where the DetoursMonitor tool reads them.
+        /// </summary>
+        /// <remarks>
+        /// The mapping is created when the manifest is serialized for a process (see <see cref="LiveCounters"/>), and named after the message
+        /// count semaphore, so it requires <see cref="SetMessageCountSemaphore"/> to be called first. Processes publish nothing when it cannot
+        /// be opened or has no free slot.
+        /// </remarks>
+        public bool PublishLiveCounters
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.PublishLiveCounters);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.PublishLiveCounters, value);
+        }
+
+        /// <summary>
+        /// If true, each detoured process records the inputs of its policy evaluations (the operation, the path as passed to the
+        /// detoured function, and its access flags), preceded by its manifest, for the PolicyCaptureReplay tool to evaluate them
+        /// again offline with another version of the policy search.
+        /// </summary>
+        /// <remarks>
+        /// The capture of a process is written next to <see cref="InternalDetoursErrorNotificationFile"/>, which has to be set, in a
+        /// file named after it with the process id and the '.policyinputs' extension. Capturing slows the processes down; it is
+        /// meant for collecting traffic to evaluate changes to the policy search, not for regular builds.
+        /// </remarks>
+        public bool CapturePolicyInputs
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.CapturePolicyInputs);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.CapturePolicyInputs, value);
+        }
+
+        /// <summary>
+        /// If true, detoured processes leave the Win32 file functions that reach the file system through the detoured ntdll
+        /// functions (CreateFile, MoveFile, DeleteFile, CreateDirectory, RemoveDirectory, FindFirstFile and the like) undetoured,
+        /// so that each of their calls is checked and reported once, by the ntdll detours, rather than canonicalized and
+        /// evaluated by both layers.
+        /// </summary>
+        /// <remarks>
+        /// Only takes effect when the ntdll detours enforce the manifest on their own: <see cref="MonitorNtCreateFile"/> and
+        /// <see cref="MonitorZwCreateOpenQueryFile"/> have to be set, and <see cref="IgnoreZwRenameFileInformation"/> and
+        /// <see cref="IgnoreZwOtherFileInformation"/> cleared. The Win32 functions that do not go through these (attributes
+        /// queries, copies, symbolic links, process creation, ...) stay detoured. Accesses are then reported under the name of
+        /// the ntdll function rather than of the Win32 function called by the tool.
+        /// </remarks>
+        public bool DetourNtLayerOnly
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.DetourNtLayerOnly);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.DetourNtLayerOnly, value);
+        }
+
+        /// <summary>
+        /// If true, detoured processes subscribe to the low memory notification of the system and, while memory is low, have their
+        /// caches of policy results, reparse point probes and known directories shed their cold entries down to a small floor.
+        /// </summary>
+        /// <remarks>
+        /// The caches are then only as big as the memory of the machine allows, rather than as big as their own bounds. Each shrink
+        /// is counted in the live counters of the process (see <see cref="PublishLiveCounters"/>).
+        /// </remarks>
+        public bool ShrinkCachesUnderMemoryPressure
+        {
+            get => GetExtraFlag(FileAccessManifestExtraFlag.ShrinkCachesUnderMemoryPressure);
+            set => SetExtraFlag(FileAccessManifestExtraFlag.ShrinkCachesUnderMemoryPressure, value);
+        }
+
+        /// <summary>
+        /// If true, the manifest tree is serialized in the format v2 (see ManifestRecord in DataTypes.h): each bucket of a node holds
+        /// the hash of its child next to the child's offset, the nodes start on cache line boundaries and the children of a node
+        /// follow each other.
+        /// </summary>
+        /// <remarks>
+        /// Searching the tree then mostly touches the nodes on the searched path, at the cost of a larger manifest. Each node tells its
+        /// own format, so the detoured processes need no flag to read it.
+        /// </remarks>
+        public bool UseAlignedManifestTree { get; set; }
+
+        /// <summary>
+        /// A location for a file where Detours to log failure messages.
+        /// </summary>
+        public string InternalDetoursErrorNotificationFile { get; set; }
+
+        /// <summary>
+        /// The semaphore that keeps count to the sent and received messages.
+        /// </summary>
+        public System.Threading.Semaphore MessageCountSemaphore { get; private set; }
+
+        /// <summary>
+        /// Name of <see cref="MessageCountSemaphore"/>, which the other named objects shared with the detoured processes are named after.
+        /// </summary>
+        internal string MessageCountSemaphoreName => m_messageCountSemaphoreName;
+
+        /// <summary>
+        /// Number of messages the detoured processes counted in the shared message count created with the semaphore.
+        /// </summary>
+        /// <remarks>
+        /// Detoured processes add to this count without a system call. Only those that cannot open it release <see cref="MessageCountSemaphore"/>.
+        /// </remarks>
+        public long SentMessageCount => m_messageCount?.Value ?? 0;
+
+        /// <summary>
+        /// The bitmaps the detoured processes record accesses in (see <see cref="UseAccessBitmap"/>), once created.
+        /// </summary>
+        internal Internal.AccessBitmap AccessBitmap { get; private set; }
+
+        /// <summary>
+        /// The counters the detoured processes publish while they run (see <see cref="PublishLiveCounters"/>), once created.
+        /// </summary>
+        internal Internal.LiveCounters LiveCounters { get; private set; }
+
+        /// <summary>
+        /// The counters the detoured processes count the lookups of the manifest tree in (see <see cref="ProfileManifestLookups"/>), once created.
+        /// </summary>
+        internal Internal.ManifestLookupCounters ManifestLookupCounters { get; private set; }
+
+        /// <summary>
+        /// The ring the detoured processes append their reports to (see <see cref="UseReportRingBuffer"/>), once created.
+        /// </summary>
+        internal Internal.ReportRingBuffer ReportRing { get; private set; }
+
+        /// <summary>
+        /// Directory translator.
+        /// </summary>
+        public DirectoryTranslator DirectoryTranslator { get; }
+
+        /// <summary>
+        /// The pip's unique id.
+        /// Right now it is the Pip.SemiStableHash.
+        /// </summary>
+        public long PipId { get; set; }
+
+        /// <summary>
+        /// Sets message count semaphore.
+        /// </summary>
+        public bool SetMessageCountSemaphore(string semaphoreName)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(semaphoreName));
+
+            UnsetMessageCountSemaphore();
+            m_messageCountSemaphoreName = semaphoreName;
+            MessageCountSemaphore = new System.Threading.Semaphore(0, int.MaxValue, semaphoreName, out bool newlyCreated);
+            m_messageCount = Internal.SharedCounter.CreateOrOpen(semaphoreName + Internal.SharedCounter.MessageCountNameSuffix);
+
+            return newlyCreated;
+        }
+
+        /// <summary>
+        /// Unset message count semaphore.
+        /// </summary>
+        public void UnsetMessageCountSemaphore()
+        {
+            if (MessageCountSemaphore == null)
+            {
+                Contract.Assert(m_messageCountSemaphoreName == null);
+                return;
+            }
+
+            MessageCountSemaphore.Dispose();
+            MessageCountSemaphore = null;
+            m_messageCount?.Dispose();
+            m_messageCount = null;
+            AccessBitmap?.Dispose();
+            AccessBitmap = null;
+            LiveCounters?.Dispose();
+            LiveCounters = null;
+            ManifestLookupCounters?.Dispose();
+            ManifestLookupCounters = null;
+            ReportRing?.Dispose();
+            ReportRing = null;
+            m_messageCountSemaphoreName = null;
+        }
+
+        /// <summary>
+        /// Adds a policy to an entire scope
+        /// </summary>
+        public void AddScope(AbsolutePath path, FileAccessPolicy mask, FileAccessPolicy values)
+        {
+            Contract.Requires(!IsManifestTreeBlockSealed);
+
+            if (!path.IsValid)
+            {
+                // Note that AbsolutePath.Invalid is allowable (representing the root scope).
+                m_rootNode.ApplyRootScope(new FileAccessScope(mask, values));
+                return;
+            }
+
+            m_rootNode.AddConeWithScope(this, path, new FileAccessScope(mask, values));
+        }
+
+        /// <summary>
+        /// Adds a policy to an individual path (without implying any policy to the scope the path may define)
+        /// </summary>
+        public void AddPath(AbsolutePath path, FileAccessPolicy mask, FileAccessPolicy values, Usn? expectedUsn = null)
+        {
+            Contract.Requires(!IsManifestTreeBlockSealed);
+            Contract.Requires(path != AbsolutePath.Invalid);
+
+            m_rootNode.AddNodeWithScope(this, path, new FileAccessScope(mask, values), expectedUsn ?? ReportedFileAccess.NoUsn);
+        }
+
+        /// <summary>
+        /// Adds a policy to all the files whose name ends with the given suffix, such as ".pdb" or ".g.cs", wherever they are.
+        /// </summary>
+        /// <remarks>
+        /// The policy applies on top of the one the scopes and paths of the manifest give to such a file, as a scope added last
+        /// would; the longest suffix of the name that has a policy wins. This saves adding each such file to the manifest, and the
+        /// sandbox finds the policy with a lookup on the name of the file. A suffix is at most <see cref="MaxSuffixPolicyLength"/>
+        /// characters long.
+        /// </remarks>
+        public void AddSuffixPolicy(string suffix, FileAccessPolicy mask, FileAccessPolicy values)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(suffix));
+            Contract.Requires(suffix.Length > 1 && suffix[0] == '.', "A suffix starts with a dot");
+            Contract.Requires(suffix.Length <= MaxSuffixPolicyLength, "A suffix is at most MaxSuffixPolicyLength characters long");
+            Contract.Requires(suffix.IndexOfAny(new[] { '\\', '/' }) < 0, "A suffix is part of a file name");
+
+            var normalizedSuffix = new NormalizedPathString(suffix);
+            if (m_suffixPolicies.TryGetValue(normalizedSuffix, out var existing))
+            {
+                // Same as applying both scopes in turn.
+                values = (existing.Scope.Values & mask) | values;
+                mask = existing.Scope.Mask & mask;
+            }
+
+            m_suffixPolicies[normalizedSuffix] = new SuffixPolicy(suffix, new FileAccessScope(mask, values));
+        }
+
+        /// <summary>
+        /// Gets the policy added by <see cref="AddSuffixPolicy"/> for the given suffix, if any.
+        /// </summary>
+        public bool TryGetSuffixPolicy(string suffix, out FileAccessPolicy mask, out FileAccessPolicy values)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(suffix));
+
+            if (m_suffixPolicies.TryGetValue(new NormalizedPathString(suffix), out var suffixPolicy))
+            {
+                mask = suffixPolicy.Scope.Mask;
+                values = suffixPolicy.Scope.Values;
+                return true;
+            }
+
+            mask = FileAccessPolicy.MaskNothing;
+            values = FileAccessPolicy.Deny;
+            return false;
+        }
+
+        /// <summary>
+        /// Sets the metadata of a declared input, from which the sandbox then answers the attribute probes of the file (such as
+        /// GetFileAttributesEx) instead of querying the file system.
+        /// </summary>
+        /// <remarks>
+        /// The metadata is only used for a path added to the manifest (see <see cref="AddPath"/>) with a policy that does not allow writes:
+        /// it has to remain the one of the file until the pip is done. Timestamps are still overridden as for any input.
+        /// </remarks>
+        public void SetDeclaredInputMetadata(AbsolutePath path, DeclaredInputMetadata metadata)
+        {
+            Contract.Requires(path != AbsolutePath.Invalid);
+
+            m_declaredInputMetadata[path] = metadata;
+        }
+
+        /// <summary>
+        /// Gets the metadata of a declared input set by <see cref="SetDeclaredInputMetadata"/>, if any.
+        /// </summary>
+        public bool TryGetDeclaredInputMetadata(AbsolutePath path, out DeclaredInputMetadata metadata)
+        {
+            return m_declaredInputMetadata.TryGetValue(path, out metadata);
+        }
+
+        /// <summary>
+        /// Lets the child processes with the given image name, such as "mspdbsrv.exe" or "VBCSCompiler", break away from the sandbox:
+        /// they are started outside of the job of the pip and without detours, so that they can outlive the pip and be shared by others.
+        /// </summary>
+        /// <remarks>
+        /// The name is compared, case-insensitively, to the file name of the image a detoured process starts; a name without an extension
+        /// matches the ".exe" image as well. Nothing these processes do is observed, so they must only be long-lived servers whose effects
+        /// on the pip go through processes the sandbox does observe (e.g., a compiler server writing the outputs its client asks for). Processes
+        /// that cannot break away (the pip runs in a job that does not allow it) are started in the sandbox as usual.
+        /// Processes that break away inherit no handle from their parent, not even the standard handles it passes: BuildXL waits for the
+        /// standard output and error of the pip and for its report pipe to be closed, which a process outliving the pip would hold up.
+        /// They have to talk to their clients through named objects (pipes, shared memory) instead, as such servers do.
+        /// </remarks>
+        public void AddChildProcessToBreakaway(string imageName)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(imageName));
+            Contract.Requires(imageName.IndexOfAny(new[] { '\\', '/' }) < 0, "An image name is a file name");
+
+            m_childProcessesToBreakaway.Add(imageName);
+        }
+
+        /// <summary>
+        /// Image names of the child processes that break away from the sandbox (see <see cref="AddChildProcessToBreakaway"/>).
+        /// </summary>
+        public IReadOnlyCollection<string> ChildProcessesToBreakaway => m_childProcessesToBreakaway;
+
+        /// <summary>
+        /// Makes the detoured processes wait on the named <see cref="ProcessAdmissionGate"/> before they start a child process, for at most
+        /// <paramref name="maxWaitMs"/> milliseconds (0 for no limit).
+        /// </summary>
+        /// <remarks>
+        /// The gate is a machine-wide event BuildXL closes while the commit charge or the CPU usage is above its thresholds, so that highly
+        /// parallel pips stop spawning processes instead of making the machine page. The time spent waiting is part of the process data report.
+        /// Processes that cannot open the gate start their child processes right away.
+        /// </remarks>
+        public void SetProcessAdmissionGate(string gateName, uint maxWaitMs)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(gateName));
+
+            m_processAdmissionGateName = gateName;
+            m_processAdmissionMaxWaitMs = maxWaitMs;
+        }
+
+        /// <summary>
+        /// Name of the process admission gate set with <see cref="SetProcessAdmissionGate"/>, if any.
+        /// </summary>
+        public string ProcessAdmissionGateName => m_processAdmissionGateName;
+
+        /// <summary>
+        /// Longest time, in milliseconds, the detoured processes wait on the process admission gate (0 for no limit).
+        /// </summary>
+        public uint ProcessAdmissionMaxWaitMs => m_processAdmissionMaxWaitMs;
+
+        /// <summary>
+        /// Redirects the files the detoured processes create and open in the untracked <paramref name="tempDirectory"/> to a directory of
+        /// the pip (<see cref="RedirectedTempDirectory"/>) under <paramref name="fastVolumeRoot"/>, such as a RAM disk or a local NVMe volume.
+        /// </summary>
+        /// <remarks>
+        /// The names opened by the detoured processes are rewritten in the ntdll functions, so the processes keep seeing the temp directory:
+        /// their accesses are checked against its policy, and the final paths of their handles are translated back to it. The temp
+        /// directory is expected to be an untracked scope of the pip, and to exist.
+        /// The first detoured process creates the directory of the pip; <paramref name="fastVolumeRoot"/> has to exist, and the directory is
+        /// to be deleted along with the temp directory once the pip is done. If it cannot be created, the temp directory is not redirected.
+        /// Programs written to the temp directory are started from the redirected directory when given by path, and the names returned by
+        /// GetFileInformationByHandleEx are those of the temp directory. Since the directory is on another volume, the MoveFile functions copy
+        /// the files they move between the temp directory and the rest of the build; moving directories, renaming by handle, and hard links
+        /// between the two fail. Pips whose tools do any of these (or start programs from the temp directory by searching for them) must not
+        /// opt in.
+        /// </remarks>
+        public void RedirectUntrackedTempDirectory(string tempDirectory, string fastVolumeRoot)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(tempDirectory) && Path.IsPathRooted(tempDirectory));
+            Contract.Requires(!string.IsNullOrEmpty(fastVolumeRoot) && Path.IsPathRooted(fastVolumeRoot));
+
+            m_untrackedTempDirectory = tempDirectory.TrimEnd(Path.DirectorySeparatorChar);
+            m_tempRedirectionRoot = fastVolumeRoot;
+        }
+
+        /// <summary>
+        /// Untracked temp directory redirected with <see cref="RedirectUntrackedTempDirectory"/>, if any.
+        /// </summary>
+        public string UntrackedTempDirectory => m_untrackedTempDirectory;
+
+        /// <summary>
+        /// Directory the untracked temp directory is redirected to, if any: the directory named after the <see cref="PipId"/> under the root given
+        /// to <see cref="RedirectUntrackedTempDirectory"/>.
+        /// </summary>
+        public string RedirectedTempDirectory => m_tempRedirectionRoot == null
+            ? null
+            : Path.Combine(m_tempRedirectionRoot, PipId.ToString("X16", CultureInfo.InvariantCulture));
+
+        /// <summary>
+        /// Number of pipes the detoured processes of the pip report to, between 1 and <see cref="MaxReportChannelCount"/>.
+        /// </summary>
+        /// <remarks>
+        /// With a single pipe, every process of the pip writes its reports to the same pipe, and concurrent processes serialize on it.
+        /// With more, each process writes to one of them, assigned round-robin when it is injected (the main process getting the first
+        /// one), and the pipes are read concurrently. The reports of a process stay in order, but the reports of processes writing to
+        /// different pipes interleave arbitrarily: <see cref="SequenceReports"/> tells in which order they were produced.
+        /// Processes injected by a process that does not inherit its handles to them get duplicates of the pipes.
+        /// </remarks>
+        public int ReportChannelCount
+        {
+            get => m_reportChannelCount;
+            set
+            {
+                Contract.Requires(value >= 1 && value <= MaxReportChannelCount);
+                m_reportChannelCount = value;
+            }
+        }
+
+        /// <summary>
+        /// Largest <see cref="ReportChannelCount"/>.
+        /// </summary>
+        public const int MaxReportChannelCount = 64;
+
+        /// <summary>
+        /// Whether the detoured processes count, for each node of the manifest tree, the lookups that find it, and how many probes of the
+        /// hash table of its parent these took. The counts are returned with the result of the pip (see <see cref="ManifestLookupProfile"/>).
+        /// </summary>
+        /// <remarks>
+        /// The counts are kept in a mapping shared by the processes of the pip, created when the manifest is serialized for a process and named
+        /// after the message count semaphore (see <see cref="ManifestLookupCounters"/>); without the semaphore, nothing is counted.
+        /// </remarks>
+        public bool ProfileManifestLookups
+        {
+            get => m_profileManifestLookups;
+            set => m_profileManifestLookups = value;
+        }
+
+        /// <summary>
+        /// CPU priority class of the processes of the pip, or null to leave the processes the class they ask for.
+        /// </summary>
+        /// <remarks>
+        /// The main process is created with it, and the detoured processes create their children with it instead of any higher class they
+        /// ask for; children asking for a lower class keep theirs. The detoured processes also lower their own class to it when they start,
+        /// which covers the children created without going through the detours. Lowering the class of background pips (cache prefetchers,
+        /// non-critical tests) makes the scheduler favor the pips on the critical path. Processes breaking away from the sandbox are not affected.
+        /// On macOS, only the main process gets it, and the processes it forks inherit it.
+        /// </remarks>
+        public System.Diagnostics.ProcessPriorityClass? PriorityClass
+        {
+            get => m_priorityClass;
+            set => m_priorityClass = value;
+        }
+
+        /// <summary>
+        /// I/O priority of the processes of the pip, or null to leave it to the processes.
+        /// </summary>
+        /// <remarks>
+        /// The detoured processes set it on themselves when they start and on their children before these run, lowering it but never raising
+        /// it. The I/O priority is not inherited otherwise, so without it the children of a background pip compete with the critical path for
+        /// the disk. Only applies on Windows.
+        /// </remarks>
+        public IoPriorityHint? IoPriority
+        {
+            get => m_ioPriority;
+            set => m_ioPriority = value;
+        }
+
+        /// <summary>
+        /// Places the children of each node that the lookups of an earlier run of the pip found most often (see <see cref="ProfileManifestLookups"/>)
+        /// ahead of the others in the hash table of the node: the hottest child of a node gets its home bucket, and chains hold the hotter
+        /// children first. The children the profile does not know keep their order, after the others. The size of the manifest does not change.
+        /// </summary>
+        /// <remarks>
+        /// Nodes the profile never saw are not pruned: their policies differ from the ones of their parents, which the paths below them would
+        /// otherwise get. Only applies to the tree of this instance, not to a manifest tree read back by <see cref="Deserialize(Stream)"/>.
+        /// </remarks>
+        public void ApplyLookupProfile(ManifestLookupProfile profile)
+        {
+            Contract.Requires(profile != null);
+
+            var nodes = new Stack<Node>();
+            nodes.Push(m_rootNode);
+            while (nodes.Count > 0)
+            {
+                Node node = nodes.Pop();
+                node.HasChildLookupHits = false;
+                foreach (Node child in node.Children ?? Enumerable.Empty<Node>())
+                {
+                    child.LookupHits = child.PathId.IsValid && profile.HitCounts.TryGetValue(child.PathId, out long hits) ? hits : 0;
+                    node.HasChildLookupHits |= child.LookupHits != 0;
+                    nodes.Push(child);
+                }
+            }
+        }
+
+        /// <summary>
+        /// The profile of the lookups counted by the detoured processes, if <see cref="ProfileManifestLookups"/> and the counters were created.
+        /// Call it once all the detoured processes are done.
+        /// </summary>
+        internal ManifestLookupProfile GetManifestLookupProfile()
+        {
+            Internal.ManifestLookupCounters counters = ManifestLookupCounters;
+            if (counters == null)
+            {
+                return null;
+            }
+
+            var hitCounts = new Dictionary<AbsolutePath, long>();
+            foreach (var hitCount in counters.GetHitCounts())
+            {
+                hitCounts[new AbsolutePath(unchecked((int)(hitCount.Key | counters.PathIdTag)))] = hitCount.Value;
+            }
+
+            return new ManifestLookupProfile(hitCounts, counters.GetProbeLengthHistogram());
+        }
+
+        /// <summary>
+        /// Largest index (<see cref="Internal.AccessBitmap.PathIdIndexMask"/>) of the path ids of the tree, and the bits of the path ids outside of it.
+        /// </summary>
+        private void GetPathIdRange(out uint maxIndex, out uint tag)
+        {
+            maxIndex = 0;
+            tag = 0;
+            var nodes = new Stack<Node>();
+            nodes.Push(m_rootNode);
+            while (nodes.Count > 0)
+            {
+                Node node = nodes.Pop();
+                if (node.PathId.IsValid)
+                {
+                    uint pathId = unchecked((uint)node.PathId.Value.Value);
+                    maxIndex = Math.Max(maxIndex, pathId & Internal.AccessBitmap.PathIdIndexMask);
+                    tag = pathId & ~Internal.AccessBitmap.PathIdIndexMask;
+                }
+
+                foreach (Node child in node.Children ?? Enumerable.Empty<Node>())
+                {
+                    nodes.Push(child);
+                }
+            }
+        }
+
+        private void CreateAccessBitmap()
+        {
+            GetPathIdRange(out uint maxIndex, out uint tag);
+            AccessBitmap = Internal.AccessBitmap.Create(m_messageCountSemaphoreName + Internal.AccessBitmap.NameSuffix, maxIndex, tag);
+        }
+
+        private void CreateManifestLookupCounters()
+        {
+            GetPathIdRange(out uint maxIndex, out uint tag);
+            ManifestLookupCounters = Internal.ManifestLookupCounters.Create(m_messageCountSemaphoreName + Internal.ManifestLookupCounters.NameSuffix, maxIndex, tag);
+        }
+
+        /// <summary>
+        /// Normalizes the fragments of a path about to be added to the tree that have not been normalized yet, in a single native call.
+        /// </summary>
+        /// <remarks>
+        /// The first path below a new directory typically needs several fragments at once; the nodes then find them in the cache.
+        /// </remarks>
+        private void CacheNormalizedFragments(AbsolutePath path)
+        {
+            List<StringId> fragments = null;
+            for (AbsolutePath current = path; current.IsValid; current = current.GetParent(m_pathTable))
+            {
+                StringId fragment = current.GetName(m_pathTable).StringId;
+                if (!m_normalizedFragments.ContainsKey(fragment))
+                {
+                    fragments = fragments ?? new List<StringId>();
+                    if (!fragments.Contains(fragment))
+                    {
+                        fragments.Add(fragment);
+                    }
+                }
+            }
+
+            // A single fragment is normalized as the node is created
+            if (fragments == null || fragments.Count < 2)
+            {
+                return;
+            }
+
+            var strings = new string[fragments.Count];
+            for (int i = 0; i < fragments.Count; i++)
+            {
+                strings[i] = m_pathTable.StringTable.GetString(fragments[i]);
+            }
+
+            var bytes = new byte[fragments.Count][];
+            var hashes = new int[fragments.Count];
+            ProcessUtilities.NormalizeAndHashPaths(strings, bytes, hashes);
+
+            for (int i = 0; i < fragments.Count; i++)
+            {
+                m_normalizedFragments.Add(fragments[i], new NormalizedPathString(bytes[i], hashes[i]));
+            }
+        }
+        
+        private static void WriteChars(BinaryWriter writer, string str)
+        {
+            var strLen = (uint)(string.IsNullOrEmpty(str) ? 0 : str.Length);
+            writer.Write(strLen);
+            for (var i = 0; i < strLen; i++)
+            {
+                writer.Write((char)str[i]);
+            }
+        }
+
+        private static string ReadChars(BinaryReader reader)
+        {
+            uint length = reader.ReadUInt32();
+            if (length == 0)
+            {
+                // TODO: Make ReadChars and WriteChars symmetric.
+                // Note that there's asymmetry between WriteChars and ReadChars.
+                // WriteChars has existed for long time and is used to serialize string to Detours.
+                // ReadChars is introduced as a way to reuse WriteChars when BuildXL has to serialize/deserialize
+                // manifest to files. We can make WriteChars and ReadChars symmetric, as well as, optimize the encoding.
+                // However, such changes entails changing Detours code.
+                return null;
+            }
+
+            char[] chars = new char[length];
+
+            for (int i = 0; i < chars.Length; ++i)
+            {
+                chars[i] = reader.ReadChar();
+            }
+
+            return new string(chars);
+        }
+
+        private static void WriteInjectionTimeoutBlock(BinaryWriter writer, uint timeoutInMins)
+        {
+            writer.Write((uint)timeoutInMins);
+        }
+
+        /// <summary>
+        /// Longest suffix of <see cref="AddSuffixPolicy"/>: the sandbox only looks up the suffixes of a file name up to that length.
+        /// </summary>
+        /// <remarks>
+        /// Keep in sync with ManifestSuffixPolicies::MaxSuffixLength in DataTypes.h.
+        /// </remarks>
+        public const int MaxSuffixPolicyLength = 32;
+
+        private const uint ErrorDumpLocationCheckedCode = 0xABCDEF03;
+        private const uint TranslationPathStringCheckedCode = 0xABCDEF02;
+        private const uint FlagsCheckedCode = 0xF1A6B10C; // Flag block
+        private const uint PipIdCheckedCode = 0xF1A6B10E;
+
+        // Size in bytes of the data area of the report ring (see UseReportRingBuffer).
+        private const int ReportRingCapacity = 1 << 20;
+
+        [SuppressMessage("Microsoft.Globalization", "CA1308:NormalizeStringsToUppercase", Justification = "Architecture strings are USASCII")]
+        private static void WriteErrorDumpLocation(BinaryWriter writer, string internalDetoursErrorNotificationFile)
+        {
+#if DEBUG
+            writer.Write(ErrorDumpLocationCheckedCode);
+#endif
+            WriteChars(writer, internalDetoursErrorNotificationFile);
+        }
+
+        private static string ReadErrorDumpLocation(BinaryReader reader)
+        {
+#if DEBUG
+            uint code = reader.ReadUInt32();
+            Contract.Assert(ErrorDumpLocationCheckedCode == code);
+#endif
+            return ReadChars(reader);
+        }
+
+        [SuppressMessage("Microsoft.Globalization", "CA1308:NormalizeStringsToUppercase", Justification = "Architecture strings are USASCII")]
+        private static void WriteTranslationPathStrings(BinaryWriter writer, DirectoryTranslator translatePaths)
+        {
+#if DEBUG
+            writer.Write(TranslationPathStringCheckedCode);
+#endif
+
+            // Write the number of translation paths.
+            uint translatePathLen = (uint)(translatePaths?.Count ?? 0);
+            writer.Write(translatePathLen);
+
+            if (translatePathLen > 0)
+            {
+                Contract.Assert(translatePaths != null);
 
                 foreach (DirectoryTranslator.Translation translation in translatePaths.Translations)
                 {
@@ -613,6 +1606,16 @@ namespace BuildXL.Processes
             writer.Write((uint)extraFlags);
         }
 
+        private static FileAccessManifestExtraFlag ReadExtraFlagsBlock(BinaryReader reader)
+        {
+#if DEBUG
+            uint code = reader.ReadUInt32();
+            Contract.Assert(0xF1A6B10D == code);
+#endif
+
+            return (FileAccessManifestExtraFlag)reader.ReadUInt32();
+        }
+
         private static void WritePipId(BinaryWriter writer, long pipId)
         {
 #if DEBUG
@@ -676,45 +1679,333 @@ namespace BuildXL.Processes
             }
             else
             {
-                // if there was no report line, we still have the report block, so write 0 for the size
-                writer.Write(0U);
+                // if there was no report line, we still have the report block, so write 0 for the size
+                writer.Write(0U);
+            }
+        }
+
+        private static void WriteDllBlock(BinaryWriter writer, FileAccessSetup setup)
+        {
+#if DEBUG
+            writer.Write((uint)0xD11B10CC); // "dll block"
+#endif
+
+            // order has to match order in DetoursServices.cpp / ParseFileAccessManifest.
+            // $Note(bxl-team): These dll strings MUST be ASCII because IMAGE_EXPORT_DIRECTORY used by Detours only supports ASCII.
+            PaddedByteString[] dlls =
+            {
+                new PaddedByteString(Encoding.ASCII, setup.DllNameX86),
+                new PaddedByteString(Encoding.ASCII, setup.DllNameX64),
+            };
+
+            uint totalSize = 0;
+            foreach (PaddedByteString dll in dlls)
+            {
+                totalSize = checked(totalSize + (uint)dll.Length);
+            }
+
+            writer.Write(totalSize);
+            uint dllCount = (uint)dlls.Length;
+            writer.Write(dllCount);
+
+            uint offset = 0;
+            foreach (PaddedByteString dll in dlls)
+            {
+                writer.Write(offset);
+                offset = checked(offset + (uint)dll.Length);
+            }
+
+            foreach (PaddedByteString dll in dlls)
+            {
+                dll.Serialize(writer);
+            }
+        }
+
+        /// <summary>
+        /// Writes the suffix policies as the hash table the sandbox looks them up in (see ManifestSuffixPolicies in DataTypes.h).
+        /// </summary>
+        private void WriteSuffixPoliciesBlock(BinaryWriter writer)
+        {
+#if DEBUG
+            writer.Write((uint)0x5FF1C5B1); // "suffix policies"
+#endif
+
+            // Keep these in sync with ManifestSuffixPolicies in DataTypes.h
+            const int EntrySize = 4 * sizeof(uint);
+
+            // A load factor below 0.5 keeps the probe sequences short, and leaves an empty bucket to end them.
+            var bucketCount = m_suffixPolicies.Count == 0 ? 0U : checked((uint)(m_suffixPolicies.Count * 2 + 1));
+            var entries = new KeyValuePair<NormalizedPathString, SuffixPolicy>[bucketCount];
+            var occupied = new bool[bucketCount];
+            foreach (var suffixPolicy in m_suffixPolicies)
+            {
+                var index = unchecked((uint)suffixPolicy.Key.HashCode) % bucketCount;
+                while (occupied[index])
+                {
+                    index = (index + 1) % bucketCount;
+                }
+
+                occupied[index] = true;
+                entries[index] = suffixPolicy;
+            }
+
+            // The suffixes follow the buckets, each padded to 4 bytes.
+            uint stringBlockSize = 0;
+            foreach (var suffixPolicy in m_suffixPolicies)
+            {
+                stringBlockSize = checked(stringBlockSize + (uint)((suffixPolicy.Key.Bytes.Length + 3) & ~3));
+            }
+
+            writer.Write(stringBlockSize);
+            writer.Write(bucketCount);
+
+            var suffixOffset = checked((uint)(bucketCount * EntrySize));
+            for (var i = 0; i < bucketCount; i++)
+            {
+                if (!occupied[i])
+                {
+                    writer.Write(0U);
+                    writer.Write(0U);
+                    writer.Write(0U);
+                    writer.Write(0U);
+                    continue;
+                }
+
+                writer.Write(unchecked((uint)entries[i].Key.HashCode));
+                writer.Write((uint)entries[i].Value.Scope.Mask);
+                writer.Write((uint)entries[i].Value.Scope.Values);
+                writer.Write(suffixOffset);
+                suffixOffset = checked(suffixOffset + (uint)((entries[i].Key.Bytes.Length + 3) & ~3));
+            }
+
+            for (var i = 0; i < bucketCount; i++)
+            {
+                if (occupied[i])
+                {
+                    entries[i].Key.Serialize(writer);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Writes the metadata of the declared inputs, sorted by path id (see ManifestFileMetadata in DataTypes.h).
+        /// </summary>
+        private void WriteFileMetadataBlock(BinaryWriter writer)
+        {
+#if DEBUG
+            writer.Write((uint)0xF11EDA7A); // "file data"
+#endif
+
+            // Keep these in sync with ManifestFileMetadata in DataTypes.h
+            writer.Write(m_declaredInputMetadata.Count);
+            foreach (var entry in m_declaredInputMetadata.OrderBy(entry => unchecked((uint)entry.Key.Value.Value)))
+            {
+                DeclaredInputMetadata metadata = entry.Value;
+                writer.Write(unchecked((uint)entry.Key.Value.Value));
+                writer.Write((uint)metadata.Attributes);
+                writer.Write(metadata.CreationTime);
+                writer.Write(metadata.LastAccessTime);
+                writer.Write(metadata.LastWriteTime);
+                writer.Write(unchecked((uint)(metadata.Size >> 32)));
+                writer.Write(unchecked((uint)metadata.Size));
+            }
+        }
+
+        /// <summary>
+        /// Writes the image names of the child processes that break away from the sandbox (see ManifestBreakawayChildProcesses in DataTypes.h).
+        /// </summary>
+        private void WriteBreakawayChildProcessesBlock(BinaryWriter writer)
+        {
+#if DEBUG
+            writer.Write((uint)0xB4EA4A7E); // "breakaway"
+#endif
+
+            // Keep this in sync with ManifestBreakawayChildProcesses in DataTypes.h
+            // The names are null-terminated, and the characters padded to an even count so that the next block stays 4-byte aligned.
+            uint charCount = 0;
+            foreach (var imageName in m_childProcessesToBreakaway)
+            {
+                charCount = checked(charCount + (uint)imageName.Length + 1);
+            }
+
+            uint paddedCharCount = (charCount + 1) & ~1U;
+            writer.Write(paddedCharCount);
+            foreach (var imageName in m_childProcessesToBreakaway)
+            {
+                foreach (var c in imageName)
+                {
+                    writer.Write(c);
+                }
+
+                writer.Write('\0');
+            }
+
+            if (paddedCharCount != charCount)
+            {
+                writer.Write('\0');
+            }
+        }
+
+        /// <summary>
+        /// Writes the process admission gate (see ManifestProcessAdmission in DataTypes.h).
+        /// </summary>
+        private void WriteProcessAdmissionBlock(BinaryWriter writer)
+        {
+#if DEBUG
+            writer.Write((uint)0xAD317ED0); // "admitted"
+#endif
+
+            // Keep this in sync with ManifestProcessAdmission in DataTypes.h
+            // The name is null-terminated, and the characters padded to an even count so that the next block stays 4-byte aligned.
+            writer.Write(m_processAdmissionMaxWaitMs);
+            if (string.IsNullOrEmpty(m_processAdmissionGateName))
+            {
+                writer.Write(0U);
+                return;
+            }
+
+            uint charCount = (uint)m_processAdmissionGateName.Length + 1;
+            uint paddedCharCount = (charCount + 1) & ~1U;
+            writer.Write(paddedCharCount);
+            foreach (var c in m_processAdmissionGateName)
+            {
+                writer.Write(c);
+            }
+
+            for (uint i = (uint)m_processAdmissionGateName.Length; i < paddedCharCount; i++)
+            {
+                writer.Write('\0');
+            }
+        }
+
+        /// <summary>
+        /// Writes the redirection of the untracked temp directory (see ManifestTempRedirection in DataTypes.h).
+        /// </summary>
+        private void WriteTempRedirectionBlock(BinaryWriter writer)
+        {
+#if DEBUG
+            writer.Write((uint)0x7E3D1EC7); // "temp redirected"
+#endif
+
+            // Keep this in sync with ManifestTempRedirection in DataTypes.h
+            // Both paths are null-terminated, and the characters of the second one padded so that the next block stays 4-byte aligned.
+            string redirectedTempDirectory = RedirectedTempDirectory?.TrimEnd(Path.DirectorySeparatorChar);
+            if (string.IsNullOrEmpty(m_untrackedTempDirectory) || string.IsNullOrEmpty(redirectedTempDirectory))
+            {
+                writer.Write(0U);
+                writer.Write(0U);
+                return;
+            }
+
+            uint tempCharCount = (uint)m_untrackedTempDirectory.Length + 1;
+            uint redirectedCharCount = (uint)redirectedTempDirectory.Length + 1;
+            uint paddedRedirectedCharCount = redirectedCharCount + ((tempCharCount + redirectedCharCount) & 1U);
+            writer.Write(tempCharCount);
+            writer.Write(paddedRedirectedCharCount);
+            foreach (var c in m_untrackedTempDirectory)
+            {
+                writer.Write(c);
+            }
+
+            writer.Write('\0');
+            foreach (var c in redirectedTempDirectory)
+            {
+                writer.Write(c);
+            }
+
+            for (uint i = (uint)redirectedTempDirectory.Length; i < paddedRedirectedCharCount; i++)
+            {
+                writer.Write('\0');
+            }
+        }
+
+        /// <summary>
+        /// Writes whether the lookups of the manifest tree are counted (see ManifestLookupProfile in DataTypes.h).
+        /// </summary>
+        private void WriteLookupProfileBlock(BinaryWriter writer)
+        {
+#if DEBUG
+            writer.Write((uint)0x10C0C0DE); // "lookup code"
+#endif
+
+            // Keep this in sync with ManifestLookupProfile in DataTypes.h
+            // Only counted when the counters exist; the detoured processes open them by name.
+            writer.Write(ManifestLookupCounters != null ? 1U : 0U);
+        }
+
+        /// <summary>
+        /// Writes the priorities of the processes of the pip (see ManifestProcessPriority in DataTypes.h).
+        /// </summary>
+        private void WriteProcessPriorityBlock(BinaryWriter writer)
+        {
+#if DEBUG
+            writer.Write((uint)0x9A1057ED); // "priority set"
+#endif
+
+            // Keep this in sync with ManifestProcessPriority in DataTypes.h
+            // 0 leaves a priority to the processes; the I/O priority is written 1 above the hint, since a hint of 0 is a priority.
+            writer.Write(m_priorityClass.HasValue ? (uint)m_priorityClass.Value : 0U);
+            writer.Write(m_ioPriority.HasValue ? (uint)m_ioPriority.Value + 1 : 0U);
+        }
+
+        private void WriteChildProcessesToBreakaway(BinaryWriter writer)
+        {
+            writer.Write(m_childProcessesToBreakaway.Count);
+            foreach (var imageName in m_childProcessesToBreakaway)
+            {
+                WriteChars(writer, imageName);
             }
         }
 
-        private static void WriteDllBlock(BinaryWriter writer, FileAccessSetup setup)
+        private void ReadChildProcessesToBreakaway(BinaryReader reader)
         {
-#if DEBUG
-            writer.Write((uint)0xD11B10CC); // "dll block"
-#endif
-
-            // order has to match order in DetoursServices.cpp / ParseFileAccessManifest.
-            // $Note(bxl-team): These dll strings MUST be ASCII because IMAGE_EXPORT_DIRECTORY used by Detours only supports ASCII.
-            PaddedByteString[] dlls =
+            int count = reader.ReadInt32();
+            for (int i = 0; i < count; i++)
             {
-                new PaddedByteString(Encoding.ASCII, setup.DllNameX86),
-                new PaddedByteString(Encoding.ASCII, setup.DllNameX64),
-            };
+                AddChildProcessToBreakaway(ReadChars(reader));
+            }
+        }
 
-            uint totalSize = 0;
-            foreach (PaddedByteString dll in dlls)
+        private void WriteDeclaredInputMetadata(BinaryWriter writer)
+        {
+            writer.Write(m_declaredInputMetadata.Count);
+            foreach (var entry in m_declaredInputMetadata)
             {
-                totalSize = checked(totalSize + (uint)dll.Length);
+                writer.Write(entry.Key.Value.Value);
+                entry.Value.Serialize(writer);
             }
+        }
 
-            writer.Write(totalSize);
-            uint dllCount = (uint)dlls.Length;
-            writer.Write(dllCount);
+        private void ReadDeclaredInputMetadata(BinaryReader reader)
+        {
+            int count = reader.ReadInt32();
+            for (int i = 0; i < count; i++)
+            {
+                var path = new AbsolutePath(reader.ReadInt32());
+                SetDeclaredInputMetadata(path, DeclaredInputMetadata.Deserialize(reader));
+            }
+        }
 
-            uint offset = 0;
-            foreach (PaddedByteString dll in dlls)
+        private void WriteSuffixPolicies(BinaryWriter writer)
+        {
+            writer.Write(m_suffixPolicies.Count);
+            foreach (var suffixPolicy in m_suffixPolicies.Values)
             {
-                writer.Write(offset);
-                offset = checked(offset + (uint)dll.Length);
+                WriteChars(writer, suffixPolicy.Suffix);
+                writer.Write((uint)suffixPolicy.Scope.Mask);
+                writer.Write((uint)suffixPolicy.Scope.Values);
             }
+        }
 
-            foreach (PaddedByteString dll in dlls)
+        private void ReadSuffixPolicies(BinaryReader reader)
+        {
+            int count = reader.ReadInt32();
+            for (int i = 0; i < count; i++)
             {
-                dll.Serialize(writer);
+                string suffix = ReadChars(reader);
+                var mask = (FileAccessPolicy)reader.ReadUInt32();
+                var values = (FileAccessPolicy)reader.ReadUInt32();
+                AddSuffixPolicy(suffix, mask, values);
             }
         }
 
@@ -724,6 +2015,10 @@ namespace BuildXL.Processes
             {
                 writer.Write(m_sealedManifestTreeBlock);
             }
+            else if (UseAlignedManifestTree)
+            {
+                m_rootNode.InternalSerializeAligned(writer);
+            }
             else
             {
                 m_rootNode.InternalSerialize(default(NormalizedPathString), writer);
@@ -739,6 +2034,28 @@ namespace BuildXL.Processes
         {
             Contract.Requires(setup != null);
             Contract.Requires(stream != null);
+
+            // The bitmaps have to exist before the first detoured process starts, and are sized for the final tree.
+            if (UseAccessBitmap && m_messageCountSemaphoreName != null && AccessBitmap == null)
+            {
+                CreateAccessBitmap();
+            }
+
+            if (PublishLiveCounters && m_messageCountSemaphoreName != null && LiveCounters == null)
+            {
+                LiveCounters = Internal.LiveCounters.Create(m_messageCountSemaphoreName + Internal.LiveCounters.NameSuffix, PipId);
+            }
+
+            if (ProfileManifestLookups && m_messageCountSemaphoreName != null && ManifestLookupCounters == null)
+            {
+                CreateManifestLookupCounters();
+            }
+
+            if (UseReportRingBuffer && m_messageCountSemaphoreName != null && ReportRing == null)
+            {
+                ReportRing = Internal.ReportRingBuffer.Create(m_messageCountSemaphoreName, ReportRingCapacity);
+            }
+
             stream.Position = 0;
             using (var writer = new BinaryWriter(stream, Encoding.Unicode, true))
             {
@@ -747,10 +2064,17 @@ namespace BuildXL.Processes
                 WriteTranslationPathStrings(writer, DirectoryTranslator);
                 WriteErrorDumpLocation(writer, InternalDetoursErrorNotificationFile);
                 WriteFlagsBlock(writer, m_fileAccessManifestFlag);
-                WriteExtraFlagsBlock(writer, FileAccessManifestExtraFlag.None);
+                WriteExtraFlagsBlock(writer, m_fileAccessManifestExtraFlag);
                 WritePipId(writer, PipId);
                 WriteReportBlock(writer, setup);
                 WriteDllBlock(writer, setup);
+                WriteSuffixPoliciesBlock(writer);
+                WriteFileMetadataBlock(writer);
+                WriteBreakawayChildProcessesBlock(writer);
+                WriteProcessAdmissionBlock(writer);
+                WriteTempRedirectionBlock(writer);
+                WriteLookupProfileBlock(writer);
+                WriteProcessPriorityBlock(writer);
                 WriteManifestTreeBlock(writer);
 
                 return new ArraySegment<byte>(stream.GetBuffer(), 0, (int)stream.Position);
@@ -769,8 +2093,20 @@ namespace BuildXL.Processes
                 WriteTranslationPathStrings(writer, DirectoryTranslator);
                 WriteErrorDumpLocation(writer, InternalDetoursErrorNotificationFile);
                 WriteFlagsBlock(writer, m_fileAccessManifestFlag);
+                WriteExtraFlagsBlock(writer, m_fileAccessManifestExtraFlag);
                 WritePipId(writer, PipId);
                 WriteChars(writer, m_messageCountSemaphoreName);
+                WriteSuffixPolicies(writer);
+                WriteDeclaredInputMetadata(writer);
+                WriteChildProcessesToBreakaway(writer);
+                WriteChars(writer, m_processAdmissionGateName);
+                writer.Write(m_processAdmissionMaxWaitMs);
+                WriteChars(writer, m_untrackedTempDirectory);
+                WriteChars(writer, m_tempRedirectionRoot);
+                writer.Write(m_reportChannelCount);
+                writer.Write(m_profileManifestLookups);
+                writer.Write(m_priorityClass.HasValue ? (uint)m_priorityClass.Value : 0U);
+                writer.Write(m_ioPriority.HasValue ? (uint)m_ioPriority.Value + 1 : 0U);
 
                 // The manifest tree block has to be serialized the last.
                 WriteManifestTreeBlock(writer);
@@ -789,9 +2125,25 @@ namespace BuildXL.Processes
                 DirectoryTranslator directoryTranslator = ReadTranslationPathStrings(reader);
                 string internalDetoursErrorNotificationFile = ReadErrorDumpLocation(reader);
                 FileAccessManifestFlag fileAccessManifestFlag = ReadFlagsBlock(reader);
+                FileAccessManifestExtraFlag fileAccessManifestExtraFlag = ReadExtraFlagsBlock(reader);
                 long pipId = ReadPipId(reader);
                 string messageCountSemaphoreName = ReadChars(reader);
 
+                var fam = new FileAccessManifest(new PathTable(), directoryTranslator);
+                fam.ReadSuffixPolicies(reader);
+                fam.ReadDeclaredInputMetadata(reader);
+                fam.ReadChildProcessesToBreakaway(reader);
+                fam.m_processAdmissionGateName = ReadChars(reader);
+                fam.m_processAdmissionMaxWaitMs = reader.ReadUInt32();
+                fam.m_untrackedTempDirectory = ReadChars(reader);
+                fam.m_tempRedirectionRoot = ReadChars(reader);
+                fam.m_reportChannelCount = reader.ReadInt32();
+                fam.m_profileManifestLookups = reader.ReadBoolean();
+                uint priorityClass = reader.ReadUInt32();
+                fam.m_priorityClass = priorityClass != 0 ? (System.Diagnostics.ProcessPriorityClass?)priorityClass : null;
+                uint ioPriority = reader.ReadUInt32();
+                fam.m_ioPriority = ioPriority != 0 ? (IoPriorityHint?)(ioPriority - 1) : null;
+
                 byte[] sealedManifestTreeBlock;
 
                 // TODO: Check perf. a) if this is a good buffer size, b) if the buffers should be pooled (now they are just allocated and thrown away)
@@ -801,14 +2153,13 @@ namespace BuildXL.Processes
                     sealedManifestTreeBlock = ms.ToArray();
                 }
 
-                return new FileAccessManifest(new PathTable(), directoryTranslator)
-                {
-                    InternalDetoursErrorNotificationFile = internalDetoursErrorNotificationFile,
-                    PipId = pipId,
-                    m_fileAccessManifestFlag = fileAccessManifestFlag,
-                    m_sealedManifestTreeBlock = sealedManifestTreeBlock,
-                    m_messageCountSemaphoreName = messageCountSemaphoreName
-                };
+                fam.InternalDetoursErrorNotificationFile = internalDetoursErrorNotificationFile;
+                fam.PipId = pipId;
+                fam.m_fileAccessManifestFlag = fileAccessManifestFlag;
+                fam.m_fileAccessManifestExtraFlag = fileAccessManifestExtraFlag;
+                fam.m_sealedManifestTreeBlock = sealedManifestTreeBlock;
+                fam.m_messageCountSemaphoreName = messageCountSemaphoreName;
+                return fam;
             }
         }
 
@@ -833,7 +2184,7 @@ namespace BuildXL.Processes
             {
                 using (var writer = new BinaryWriter(stream, Encoding.Unicode, true))
                 {
-                    m_rootNode.Serialize(writer);
+                    WriteManifestTreeBlock(writer);
                     var bytes = stream.ToArray();
                     return bytes;
                 }
@@ -889,6 +2240,37 @@ namespace BuildXL.Processes
         private enum FileAccessManifestExtraFlag
         {
             None = 0,
+            UseBinaryReportFormat = 0x1,
+            BufferReports = 0x2,
+            UseReportRingBuffer = 0x4,
+            InternReportedPaths = 0x8,
+            DeduplicateReports = 0x10,
+            CacheReparsePointProbes = 0x20,
+            OmitPassThroughDetours = 0x40,
+            SendReportsAsynchronously = 0x80,
+            CollectDetourStatistics = 0x100,
+            ReportUsnsAfterOpen = 0x200,
+            CacheFinalPathsOfHandles = 0x400,
+            ShareReportCacheAcrossProcesses = 0x800,
+            SummarizeFileAccesses = 0x1000,
+            InheritDeviceMap = 0x2000,
+            CachePolicyResults = 0x4000,
+            SequenceReports = 0x8000,
+            UseAccessBitmap = 0x10000,
+            HashOutputsWhileWriting = 0x20000,
+            LogDebugMessagesAsynchronously = 0x40000,
+            CoalesceOutputWrites = 0x80000,
+            UseBlockCloneForCopies = 0x100000,
+            FastTempFileNames = 0x200000,
+            CacheKnownDirectories = 0x400000,
+            UseLargeFetchEnumerations = 0x800000,
+            CacheCurrentDirectory = 0x1000000,
+            AdaptiveReportBackpressure = 0x2000000,
+            PrefetchDeclaredInputs = 0x4000000,
+            PublishLiveCounters = 0x8000000,
+            CapturePolicyInputs = 0x10000000,
+            DetourNtLayerOnly = 0x20000000,
+            ShrinkCachesUnderMemoryPressure = 0x40000000,
         }
 
         private readonly struct FileAccessScope
@@ -903,6 +2285,21 @@ namespace BuildXL.Processes
             }
         }
 
+        /// <summary>
+        /// A suffix policy (see <see cref="AddSuffixPolicy"/>), with the suffix as it was added.
+        /// </summary>
+        private readonly struct SuffixPolicy
+        {
+            public readonly string Suffix;
+            public readonly FileAccessScope Scope;
+
+            public SuffixPolicy(string suffix, FileAccessScope scope)
+            {
+                Suffix = suffix;
+                Scope = scope;
+            }
+        }
+
         /// <summary>
         /// A class to convert a string into a zero-terminated, padded encoded byte array.
         /// </summary>
@@ -957,6 +2354,14 @@ namespace BuildXL.Processes
                 HashCode = ProcessUtilities.NormalizeAndHashPath(path, out Bytes);
             }
 
+            public NormalizedPathString(byte[] bytes, int hashCode)
+            {
+                Contract.Requires(bytes != null);
+
+                Bytes = bytes;
+                HashCode = hashCode;
+            }
+
             public bool IsValid
             {
                 get { return Bytes != null; }
@@ -1051,6 +2456,24 @@ namespace BuildXL.Processes
             /// </summary>
             internal IEnumerable<Node> Children => m_children?.Values;
 
+            /// <summary>
+            /// Number of lookups that found this node in an earlier run of the pip (see <see cref="ApplyLookupProfile"/>).
+            /// </summary>
+            internal long LookupHits { get; set; }
+
+            /// <summary>
+            /// Whether some children of this node have <see cref="LookupHits"/>.
+            /// </summary>
+            internal bool HasChildLookupHits { get; set; }
+
+            /// <summary>
+            /// The children in the order they get their buckets in the regular table: the most often found first, and otherwise in the order
+            /// of the dictionary. A child placed earlier is never moved by a later one, so the hottest child gets its home bucket.
+            /// </summary>
+            private IEnumerable<KeyValuePair<NormalizedPathString, Node>> ChildrenInLookupOrder => HasChildLookupHits
+                ? m_children.OrderByDescending(child => child.Value.LookupHits)
+                : (IEnumerable<KeyValuePair<NormalizedPathString, Node>>)m_children;
+
             /// <summary>
             /// The path ID as understood by the owning path table.
             /// </summary>
@@ -1149,6 +2572,7 @@ namespace BuildXL.Processes
                 Contract.Requires(owner != null);
                 Contract.Requires(coneRoot.IsValid);
 
+                owner.CacheNormalizedFragments(coneRoot);
                 Node leaf = AddPath(owner, coneRoot);
                 leaf.ApplyConeFileAccess(scope);
             }
@@ -1165,6 +2589,7 @@ namespace BuildXL.Processes
                 Contract.Requires(owner != null);
                 Contract.Requires(path.IsValid);
 
+                owner.CacheNormalizedFragments(path);
                 Node leaf = AddPath(owner, path);
                 leaf.ApplyNodeFileAccess(scope, expectedUsn);
             }
@@ -1213,6 +2638,47 @@ namespace BuildXL.Processes
                 ChainMask = 0x03,
             }
 
+            // Keep these in sync with ManifestRecord in DataTypes.h
+            private const uint BucketCountMask = 0x0FFFFFFF;
+            private const uint InlineChildHashesFlag = 0x80000000;
+            private const uint PerfectHashFlag = 0x40000000;
+            private const uint PerfectHashChildrenPerSeed = 4;
+
+            // Nodes with at least that many children get a perfect hash table, so that the detoured processes find a child of
+            // theirs in one probe. Smaller tables rarely have long collision chains, and are cheaper to build.
+            private const int PerfectHashChildThreshold = 128;
+
+            // Nodes with fewer children also get a perfect hash table if their regular table would make the detoured processes
+            // probe more buckets than that for a child (see ManifestRecord::MaxCollisionChainProbes), as children named to collide do.
+            private const int MaxCollisionChainProbes = 16;
+
+            // Seeds tried for a group of children before giving up on a perfect hash table, per child of the node.
+            private const int PerfectHashSeedAttemptsPerChild = 16;
+
+            // Size of a cache line, which the nodes of a tree in the format v2 are aligned to.
+            private const int AlignedRecordBoundary = 64;
+
+            /// <summary>
+            /// A node waiting to be written by <see cref="InternalSerializeAligned"/>, and the bucket of its parent to point at it.
+            /// </summary>
+            private readonly struct PendingRecord
+            {
+                public readonly Node Node;
+                public readonly NormalizedPathString Fragment;
+                public readonly long ParentStart;
+                public readonly long BucketPosition;
+                public readonly uint BucketFlags;
+
+                public PendingRecord(Node node, NormalizedPathString fragment, long parentStart, long bucketPosition, uint bucketFlags)
+                {
+                    Node = node;
+                    Fragment = fragment;
+                    ParentStart = parentStart;
+                    BucketPosition = bucketPosition;
+                    BucketFlags = bucketFlags;
+                }
+            }
+
             /// <summary>
             /// Add a path to the tree.
             /// </summary>
@@ -1308,13 +2774,15 @@ namespace BuildXL.Processes
                     writer.Write((ulong)ExpectedUsn.Value);
 
                     var childCount = (uint)(m_children == null ? 0 : m_children.Count);
+                    bool perfectHash = TryBuildPerfectHashTable(out var perfectHashBuckets, out var perfectHashSeeds);
 
                     // The children will be added to a hash-table.
                     // As it is known that hash-table performance starts to degrade with load factors > 0.7,
-                    // we size our hash-table appropriately.
-                    var bucketCount = childCount == 0 ? 0 : checked((uint)(childCount / 0.7));
+                    // we size our hash-table appropriately. A perfect hash table has no collisions, hence no such concern.
+                    var bucketCount = perfectHash ? childCount : childCount == 0 ? 0 : checked((uint)(childCount / 0.7));
                     Contract.Assert((bucketCount == 0) == (childCount == 0));
-                    writer.Write(bucketCount);
+                    Contract.Assert((bucketCount & ~BucketCountMask) == 0);
+                    writer.Write(perfectHash ? bucketCount | PerfectHashFlag : bucketCount);
 
                     long offsetsStart = 0;
                     if (m_children != null)
@@ -1325,6 +2793,8 @@ namespace BuildXL.Processes
                             // to be patched up later
                             writer.Write(0U);
                         }
+
+                        WritePerfectHashSeeds(perfectHashSeeds, writer);
                     }
 
                     if (normalizedFragment.IsValid)
@@ -1341,7 +2811,14 @@ namespace BuildXL.Processes
                         // We are now building a simple hash-table with linear chaining for collisions.
                         // The lowest two bits of each record may encoding information about whether a collision chain starts at that point, or continues.
                         uint[] offsets = new uint[bucketCount];
-                        foreach (var child in m_children)
+                        for (var i = 0; perfectHash && i < bucketCount; i++)
+                        {
+                            // no collisions, hence no chain flags
+                            offsets[i] = checked((uint)(writer.BaseStream.Position - start));
+                            perfectHashBuckets[i].Value.InternalSerialize(perfectHashBuckets[i].Key, writer);
+                        }
+
+                        foreach (var child in perfectHash ? Enumerable.Empty<KeyValuePair<NormalizedPathString, Node>>() : ChildrenInLookupOrder)
                         {
                             var hash = unchecked((uint)child.Key.HashCode);
                             var index = hash % bucketCount;
@@ -1378,6 +2855,288 @@ namespace BuildXL.Processes
                 }
             }
 
+            /// <summary>
+            /// Serializes the tree rooted at this node in the format v2 (see <see cref="UseAlignedManifestTree"/>).
+            /// </summary>
+            /// <remarks>
+            /// The nodes are written breadth-first, so that the children of each node follow each other. A node only learns where its
+            /// children are once they are written, so their buckets get patched then.
+            /// </remarks>
+            public void InternalSerializeAligned(BinaryWriter writer)
+            {
+                // always finalize when serializing -- note that this prevents adding additional scopes as before
+                if (!IsPolicyFinalized)
+                {
+                    FinalizePolicies();
+                }
+
+                long treeStart = writer.BaseStream.Position;
+                var pending = new Queue<PendingRecord>();
+                pending.Enqueue(new PendingRecord(this, default(NormalizedPathString), parentStart: -1, bucketPosition: -1, bucketFlags: 0));
+
+                while (pending.Count > 0)
+                {
+                    PendingRecord record = pending.Dequeue();
+
+                    while (((writer.BaseStream.Position - treeStart) % AlignedRecordBoundary) != 0)
+                    {
+                        writer.Write((byte)0);
+                    }
+
+                    long start = writer.BaseStream.Position;
+                    if (record.BucketPosition >= 0)
+                    {
+                        var offset = checked((uint)(start - record.ParentStart));
+                        Contract.Assume((offset & (uint)FileAccessBucketOffsetFlag.ChainMask) == 0);
+
+                        writer.BaseStream.Seek(record.BucketPosition, SeekOrigin.Begin);
+                        writer.Write(offset | record.BucketFlags);
+                        writer.Write(unchecked((uint)record.Fragment.HashCode));
+                        writer.BaseStream.Seek(start, SeekOrigin.Begin);
+                    }
+
+                    record.Node.WriteAlignedRecord(record.Fragment, writer, pending, start);
+                }
+            }
+
+            private void WriteAlignedRecord(NormalizedPathString normalizedFragment, BinaryWriter writer, Queue<PendingRecord> pending, long start)
+            {
+                unchecked
+                {
+#if DEBUG
+                    writer.Write((uint)0xF00DCAFE); // "food cafe"
+#endif
+                    writer.Write((uint)normalizedFragment.HashCode);
+                    writer.Write((uint)ConePolicy);
+                    writer.Write((uint)NodePolicy);
+                    writer.Write((uint)PathId.Value.Value);
+                    writer.Write((ulong)ExpectedUsn.Value);
+
+                    // Same table as InternalSerialize.
+                    var childCount = (uint)(m_children == null ? 0 : m_children.Count);
+                    bool perfectHash = TryBuildPerfectHashTable(out var perfectHashBuckets, out var perfectHashSeeds);
+                    var bucketCount = perfectHash ? childCount : childCount == 0 ? 0 : checked((uint)(childCount / 0.7));
+                    Contract.Assert((bucketCount & ~BucketCountMask) == 0);
+                    writer.Write(bucketCount == 0 ? 0U : bucketCount | InlineChildHashesFlag | (perfectHash ? PerfectHashFlag : 0U));
+
+                    // (offset, hash) pairs, patched when the children get written
+                    long offsetsStart = writer.BaseStream.Position;
+                    for (var i = 0; i < bucketCount; i++)
+                    {
+                        writer.Write(0U);
+                        writer.Write(0U);
+                    }
+
+                    WritePerfectHashSeeds(perfectHashSeeds, writer);
+
+                    if (normalizedFragment.IsValid)
+                    {
+                        normalizedFragment.Serialize(writer);
+                    }
+                    else
+                    {
+                        writer.Write(0U);
+                    }
+
+                    if (perfectHash)
+                    {
+                        for (var i = 0; i < bucketCount; i++)
+                        {
+                            pending.Enqueue(new PendingRecord(perfectHashBuckets[i].Value, perfectHashBuckets[i].Key, start, offsetsStart + (i * 2 * sizeof(uint)), 0));
+                        }
+                    }
+                    else if (m_children != null)
+                    {
+                        // The same hash-table as InternalSerialize builds, except that the buckets are placed before the children are written.
+                        var children = new KeyValuePair<NormalizedPathString, Node>[bucketCount];
+                        var flags = new uint[bucketCount];
+                        var occupied = new bool[bucketCount];
+                        foreach (var child in ChildrenInLookupOrder)
+                        {
+                            var hash = (uint)child.Key.HashCode;
+                            var index = hash % bucketCount;
+
+                            // collision?
+                            if (occupied[index])
+                            {
+                                flags[index] |= (uint)FileAccessBucketOffsetFlag.ChainStart;
+                                index = (index + 1) % bucketCount;
+
+                                // collision?
+                                while (occupied[index])
+                                {
+                                    flags[index] |= (uint)FileAccessBucketOffsetFlag.ChainContinuation;
+                                    index = (index + 1) % bucketCount;
+                                }
+                            }
+
+                            occupied[index] = true;
+                            children[index] = child;
+                        }
+
+                        for (var i = 0; i < bucketCount; i++)
+                        {
+                            if (occupied[i])
+                            {
+                                pending.Enqueue(new PendingRecord(children[i].Value, children[i].Key, start, offsetsStart + (i * 2 * sizeof(uint)), flags[i]));
+                            }
+                        }
+                    }
+                }
+            }
+
+            /// <summary>
+            /// Builds a minimal perfect hash table of the children of this node, if it has enough of them or they would make long collision
+            /// chains in the regular table (see ManifestRecord in DataTypes.h).
+            /// </summary>
+            /// <remarks>
+            /// The children are split in groups by hash, one per seed, and the largest groups get a seed first: the seed of a group is the
+            /// first one putting all its children in free buckets. This fails when children have the same hash, or when no seed works for a
+            /// group in a reasonable number of attempts; the node then gets the regular table.
+            /// </remarks>
+            private bool TryBuildPerfectHashTable(out KeyValuePair<NormalizedPathString, Node>[] buckets, out uint[] seeds)
+            {
+                buckets = null;
+                seeds = null;
+
+                if (m_children == null || (m_children.Count < PerfectHashChildThreshold && GetLongestCollisionChain() <= MaxCollisionChainProbes))
+                {
+                    return false;
+                }
+
+                var bucketCount = (uint)m_children.Count;
+                var seedCount = (bucketCount + PerfectHashChildrenPerSeed - 1) / PerfectHashChildrenPerSeed;
+                var groups = new List<KeyValuePair<NormalizedPathString, Node>>[seedCount];
+                var hashes = new HashSet<uint>();
+                foreach (var child in m_children)
+                {
+                    var hash = unchecked((uint)child.Key.HashCode);
+                    if (!hashes.Add(hash))
+                    {
+                        return false;
+                    }
+
+                    var group = hash % seedCount;
+                    (groups[group] ?? (groups[group] = new List<KeyValuePair<NormalizedPathString, Node>>())).Add(child);
+                }
+
+                var table = new KeyValuePair<NormalizedPathString, Node>[bucketCount];
+                var occupied = new bool[bucketCount];
+                var tableSeeds = new uint[seedCount];
+                var groupBuckets = new List<uint>();
+                int maxAttempts = PerfectHashSeedAttemptsPerChild * m_children.Count;
+
+                foreach (var group in Enumerable.Range(0, (int)seedCount).Where(g => groups[g] != null).OrderByDescending(g => groups[g].Count))
+                {
+                    bool placed = false;
+                    for (uint seed = 0; !placed && seed < maxAttempts; seed++)
+                    {
+                        groupBuckets.Clear();
+                        foreach (var child in groups[group])
+                        {
+                            var bucket = GetPerfectHashBucket(unchecked((uint)child.Key.HashCode), seed, bucketCount);
+                            if (occupied[bucket] || groupBuckets.Contains(bucket))
+                            {
+                                break;
+                            }
+
+                            groupBuckets.Add(bucket);
+                        }
+
+                        if (groupBuckets.Count == groups[group].Count)
+                        {
+                            for (var i = 0; i < groupBuckets.Count; i++)
+                            {
+                                occupied[groupBuckets[i]] = true;
+                                table[groupBuckets[i]] = groups[group][i];
+                            }
+
+                            tableSeeds[group] = seed;
+                            placed = true;
+                        }
+                    }
+
+                    if (!placed)
+                    {
+                        return false;
+                    }
+                }
+
+                buckets = table;
+                seeds = tableSeeds;
+                return true;
+            }
+
+            /// <summary>
+            /// Most buckets ManifestRecord::FindChild probes for a child of this node in the regular table (the one with linear probing).
+            /// </summary>
+            private int GetLongestCollisionChain()
+            {
+                var bucketCount = (uint)(m_children.Count / 0.7);
+                var flags = new uint[bucketCount];
+                var occupied = new bool[bucketCount];
+                foreach (var child in ChildrenInLookupOrder)
+                {
+                    var index = unchecked((uint)child.Key.HashCode) % bucketCount;
+                    if (occupied[index])
+                    {
+                        flags[index] |= (uint)FileAccessBucketOffsetFlag.ChainStart;
+                        index = (index + 1) % bucketCount;
+                        while (occupied[index])
+                        {
+                            flags[index] |= (uint)FileAccessBucketOffsetFlag.ChainContinuation;
+                            index = (index + 1) % bucketCount;
+                        }
+                    }
+
+                    occupied[index] = true;
+                }
+
+                // From the start of a chain, FindChild probes the next bucket, and the ones after it as long as they continue the chain.
+                int longest = 1;
+                for (uint i = 0; i < bucketCount; i++)
+                {
+                    if ((flags[i] & (uint)FileAccessBucketOffsetFlag.ChainStart) == 0)
+                    {
+                        continue;
+                    }
+
+                    int probes = 2;
+                    for (uint next = (i + 1) % bucketCount; probes < bucketCount && (flags[next] & (uint)FileAccessBucketOffsetFlag.ChainContinuation) != 0; next = (next + 1) % bucketCount)
+                    {
+                        probes++;
+                    }
+
+                    longest = Math.Max(longest, probes);
+                }
+
+                return longest;
+            }
+
+            /// <summary>
+            /// The bucket of a child in a perfect hash table, given the seed of its group. Keep in sync with ManifestRecord::GetPerfectHashBucket.
+            /// </summary>
+            private static uint GetPerfectHashBucket(uint hash, uint seed, uint bucketCount)
+            {
+                unchecked
+                {
+                    uint mixed = (hash ^ seed) * 0x85EBCA6B;
+                    mixed ^= mixed >> 13;
+                    return mixed % bucketCount;
+                }
+            }
+
+            private static void WritePerfectHashSeeds(uint[] seeds, BinaryWriter writer)
+            {
+                if (seeds != null)
+                {
+                    foreach (var seed in seeds)
+                    {
+                        writer.Write(seed);
+                    }
+                }
+            }
+
             public void Serialize(BinaryWriter writer)
             {
                 // always finalize when serializing -- note that this prevents adding additional scopes as before
@@ -1462,7 +3221,8 @@ namespace BuildXL.Processes
                                 var pathId = reader.ReadUInt32();
                                 Usn expectedUsn = new Usn(reader.ReadUInt64());
 
-                                int hashtableCount = reader.ReadInt32();
+                                uint bucketCount = reader.ReadUInt32();
+                                int hashtableCount = (int)(bucketCount & BucketCountMask);
                                 List<long> absoluteChildStarts = new List<long>();
                                 for (int i = 0; i < hashtableCount; i++)
                                 {
@@ -1473,6 +3233,12 @@ namespace BuildXL.Processes
                                     }
                                 }
 
+                                if ((bucketCount & PerfectHashFlag) != 0)
+                                {
+                                    // skip the seeds
+                                    reader.BaseStream.Seek((hashtableCount + PerfectHashChildrenPerSeed - 1) / PerfectHashChildrenPerSeed * sizeof(uint), SeekOrigin.Current);
+                                }
+
                                 string partialPath = ReadUnicodeString(reader, buffer);
                                 string fullPath = Path.Combine(item.Path, partialPath);
 
@@ -81,6 +81,15 @@ namespace BuildXL.Processes
         /// </remarks>
         AllowRealInputTimestamps = 0x200,
 
+        /// <summary>
+        /// The file has not been materialized yet: its first open in a detoured process asks BuildXL to materialize it, and
+        /// waits until it has (see <see cref="SandboxedProcessInfo.MaterializeOnOpen"/>).
+        /// </summary>
+        /// <remarks>
+        /// Only applies to a path added to the manifest, not to the paths under a scope.
+        /// </remarks>
+        MaterializeOnOpen = 0x400,
+
         /// <summary>
         /// If set, then we will report attempts to access files under this scope, whether they exist or not (combination of <see cref="ReportAccessIfExistent"/>
         /// and <see cref="ReportAccessIfNonexistent"/>).
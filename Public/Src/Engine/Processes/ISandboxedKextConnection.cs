@@ -43,6 +43,13 @@ namespace BuildXL.Processes
         /// </remarks>
         bool NotifyUsage(uint cpuUsageBasisPoints, uint availableRamMB);
 
+        /// <summary>
+        /// Starts a native thread of the interop library that does what periodic calls to <see cref="NotifyUsage"/> would do,
+        /// every <paramref name="intervalMs"/> milliseconds, independently of how busy the managed side is. It runs until the
+        /// connection is disposed. Returns false if it could not be started, in which case the caller should keep calling <see cref="NotifyUsage"/>.
+        /// </summary>
+        bool StartResourceSampler(uint intervalMs);
+
         /// <summary>
         /// Notifies the kernel extension that a new pip is about to start. Since the kernel extension expects to receive the
         /// process ID of the pip, this method requires that the supplied <paramref name="process"/> has already been started,
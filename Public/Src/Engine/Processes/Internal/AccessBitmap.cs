@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics.ContractsLight;
+using System.IO.MemoryMappedFiles;
+
+namespace BuildXL.Processes.Internal
+{
+    /// <summary>
+    /// A pair of bitmaps in a named file mapping, in which the detoured processes of a pip record the reads and the probes of
+    /// manifest nodes instead of reporting them (see <see cref="FileAccessManifest.UseAccessBitmap"/>).
+    /// </summary>
+    /// <remarks>
+    /// Keep the layout in sync with AccessBitmapHeader in SendReport.cpp: a header holding the number of bits of each bitmap and the mask
+    /// giving the index of a path id, followed by the read bitmap and the probe bitmap, each rounded up to whole 64-bit words.
+    /// Named after the message count semaphore, like <see cref="SharedCounter"/>.
+    /// </remarks>
+    internal sealed class AccessBitmap : IDisposable
+    {
+        /// <summary>
+        /// Suffix appended to the message count semaphore name to form the name of the bitmaps.
+        /// </summary>
+        public const string NameSuffix = "_AccessBitmap";
+
+        /// <summary>
+        /// Bits of a path id (the value of an <see cref="BuildXL.Utilities.AbsolutePath"/>) that give its index in the path table.
+        /// The other bits are the same for all the paths of a table.
+        /// </summary>
+        public const uint PathIdIndexMask = 0x0FFFFFFF;
+
+        private const int HeaderSize = 2 * sizeof(uint);
+
+        private readonly MemoryMappedFile m_file;
+        private readonly MemoryMappedViewAccessor m_view;
+        private readonly int m_wordCount;
+
+        private AccessBitmap(MemoryMappedFile file, MemoryMappedViewAccessor view, int wordCount, uint pathIdTag)
+        {
+            m_file = file;
+            m_view = view;
+            m_wordCount = wordCount;
+            PathIdTag = pathIdTag;
+        }
+
+        /// <summary>
+        /// Bits of the path ids of the manifest outside of <see cref="PathIdIndexMask"/>.
+        /// </summary>
+        public uint PathIdTag { get; }
+
+        /// <summary>
+        /// Creates the named bitmaps, all clear, with room for the path ids up to the given index. They have to exist before the first
+        /// detoured process of the pip starts.
+        /// </summary>
+        public static AccessBitmap Create(string name, uint maxPathIdIndex, uint pathIdTag)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(name));
+            Contract.Requires(maxPathIdIndex <= PathIdIndexMask);
+
+            uint bitCount = maxPathIdIndex + 1;
+            int wordCount = (int)((bitCount + 63) / 64);
+            long size = HeaderSize + 2L * wordCount * sizeof(long);
+
+            // Pages of the mapping are only committed once written, so sparse bitmaps stay cheap.
+            var file = MemoryMappedFile.CreateNew(name, size, MemoryMappedFileAccess.ReadWrite);
+
+            try
+            {
+                var view = file.CreateViewAccessor(0, size);
+                view.Write(0, bitCount);
+                view.Write(sizeof(uint), PathIdIndexMask);
+                return new AccessBitmap(file, view, wordCount, pathIdTag);
+            }
+            catch
+            {
+                file.Dispose();
+                throw;
+            }
+        }
+
+        /// <summary>
+        /// Indices of the path ids whose bit is set in the read bitmap, or in the probe bitmap.
+        /// </summary>
+        public IEnumerable<uint> GetSetIndices(bool probes)
+        {
+            long start = HeaderSize + (probes ? (long)m_wordCount * sizeof(long) : 0);
+            for (int i = 0; i < m_wordCount; i++)
+            {
+                ulong word = m_view.ReadUInt64(start + (long)i * sizeof(long));
+                while (word != 0)
+                {
+                    int bit = 0;
+                    while ((word & (1UL << bit)) == 0)
+                    {
+                        bit++;
+                    }
+
+                    word &= ~(1UL << bit);
+                    yield return (uint)(i * 64 + bit);
+                }
+            }
+        }
+
+        /// <inheritdoc />
+        public void Dispose()
+        {
+            m_view.Dispose();
+            m_file.Dispose();
+        }
+    }
+}
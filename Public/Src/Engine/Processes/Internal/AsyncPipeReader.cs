@@ -16,6 +16,12 @@ namespace BuildXL.Processes.Internal
 {
     internal delegate bool StreamDataReceived(string data);
 
+    /// <summary>
+    /// Callback for the length-prefixed records of a pipe read by <see cref="AsyncPipeReader"/>: the first 4 bytes of each record
+    /// hold its total size. The record is only valid during the call.
+    /// </summary>
+    internal delegate bool RecordReceived(ArraySegment<byte> record);
+
     internal sealed unsafe class AsyncPipeReader : IDisposable, IIOCompletionTarget
     {
         private readonly object m_lock = new object();
@@ -25,6 +31,19 @@ namespace BuildXL.Processes.Internal
         private readonly StreamDataReceived m_userCallBack;
         private bool m_bLastCarriageReturn;
 
+        // Set instead of m_userCallBack when the pipe carries length-prefixed records rather than lines.
+        private readonly RecordReceived m_recordCallBack;
+
+        // Bytes of the records not yet complete, at the start of the buffer.
+        private byte[] m_pendingRecordBytes;
+        private int m_pendingRecordByteCount;
+
+        // Size of the length prefix of a record.
+        private const int RecordSizeLength = sizeof(uint);
+
+        // Records claiming to be larger than this are taken as corruption of the pipe.
+        private const int MaxRecordSize = 64 * 1024 * 1024;
+
         private readonly IAsyncFile m_file;
 
         private readonly int m_byteBufferSize;
@@ -85,6 +104,21 @@ namespace BuildXL.Processes.Internal
             StringBuilderInstace.EnsureCapacity(maxCharsPerBuffer * 2);
         }
 
+        /// <summary>
+        /// Creates a new AsyncStreamReader for the given stream of length-prefixed records, e.g. the reports sent in the binary format
+        /// (see <see cref="FileAccessManifest.UseBinaryReportFormat"/>). The buffer size is in bytes.
+        /// </summary>
+        public AsyncPipeReader(
+            IAsyncFile file,
+            RecordReceived callback,
+            int bufferSize)
+            : this(file, (StreamDataReceived)null, Encoding.Unicode, bufferSize)
+        {
+            Contract.Requires(callback != null);
+            m_recordCallBack = callback;
+            m_pendingRecordBytes = new byte[bufferSize];
+        }
+
         public void Dispose()
         {
             bool waitForCompletion = false;
@@ -230,7 +264,14 @@ namespace BuildXL.Processes.Internal
                     // UserCallback could throw, but we should still signal EOF
                     try
                     {
-                        FlushMessageQueue();
+                        if (m_recordCallBack != null)
+                        {
+                            FlushTruncatedRecord();
+                        }
+                        else
+                        {
+                            FlushMessageQueue();
+                        }
                     }
 #pragma warning disable ERP022 // Unobserved exception in generic exception handler
                     catch
@@ -255,8 +296,15 @@ namespace BuildXL.Processes.Internal
             }
             else
             {
-                int charLen = m_decoder.GetChars(ByteBuffer, 0, byteLen, CharBuffer, 0);
-                GetLinesFromCharBuffers(charLen);
+                if (m_recordCallBack != null)
+                {
+                    GetRecordsFromByteBuffer(byteLen);
+                }
+                else
+                {
+                    int charLen = m_decoder.GetChars(ByteBuffer, 0, byteLen, CharBuffer, 0);
+                    GetLinesFromCharBuffers(charLen);
+                }
 
                 // File offset is ignored since we're reading a pipe.
                 m_file.ReadOverlapped(this, m_byteBufferPtr, m_byteBufferSize, fileOffset: 0);
@@ -333,6 +381,73 @@ namespace BuildXL.Processes.Internal
             FlushMessageQueue();
         }
 
+        private void GetRecordsFromByteBuffer(int len)
+        {
+            if (m_pendingRecordBytes == null)
+            {
+                // The stream got corrupted, or the callback asked to stop; the rest of it is drained and dropped.
+                return;
+            }
+
+            if (m_pendingRecordByteCount + len > m_pendingRecordBytes.Length)
+            {
+                Array.Resize(ref m_pendingRecordBytes, Math.Max(m_pendingRecordByteCount + len, 2 * m_pendingRecordBytes.Length));
+            }
+
+            Buffer.BlockCopy(ByteBuffer, 0, m_pendingRecordBytes, m_pendingRecordByteCount, len);
+            m_pendingRecordByteCount += len;
+
+            int start = 0;
+            while (m_pendingRecordByteCount - start >= RecordSizeLength)
+            {
+                int size = unchecked((int)BitConverter.ToUInt32(m_pendingRecordBytes, start));
+                bool corrupted = size < RecordSizeLength || size > MaxRecordSize;
+                if (!corrupted && m_pendingRecordByteCount - start < size)
+                {
+                    // Not complete yet.
+                    break;
+                }
+
+                lock (m_lock)
+                {
+                    var state = m_state;
+                    if (state == State.Stopped || state == State.Stopping)
+                    {
+                        return;
+                    }
+
+                    // A corrupted record is still handed over, for the callback to fail on it.
+                    var record = new ArraySegment<byte>(m_pendingRecordBytes, start, corrupted ? m_pendingRecordByteCount - start : size);
+                    if (!m_recordCallBack(record) || corrupted)
+                    {
+                        m_pendingRecordBytes = null;
+                        return;
+                    }
+                }
+
+                start += size;
+            }
+
+            m_pendingRecordByteCount -= start;
+            Buffer.BlockCopy(m_pendingRecordBytes, start, m_pendingRecordBytes, 0, m_pendingRecordByteCount);
+        }
+
+        /// <summary>
+        /// Hands the bytes of a record cut short by the end of the stream to the callback, for it to fail on them.
+        /// </summary>
+        private void FlushTruncatedRecord()
+        {
+            lock (m_lock)
+            {
+                if (m_pendingRecordBytes != null && m_pendingRecordByteCount != 0)
+                {
+                    m_recordCallBack(new ArraySegment<byte>(m_pendingRecordBytes, 0, m_pendingRecordByteCount));
+                }
+
+                m_pendingRecordBytes = null;
+            }
+        }
+
         private void FlushMessageQueue()
         {
             while (true)
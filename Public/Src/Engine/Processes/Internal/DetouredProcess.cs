@@ -73,6 +73,8 @@ namespace BuildXL.Processes.Internal
         [SuppressMessage("Microsoft.Reliability", "CA2006:UseSafeHandleToEncapsulateNativeResources")]
         private static readonly IntPtr s_consoleWindow = Native.Processes.Windows.ProcessUtilitiesWin.GetConsoleWindow();
         private readonly ContainerConfiguration m_containerConfiguration;
+        private readonly bool m_allowProcessBreakaway;
+        private readonly System.Diagnostics.ProcessPriorityClass? m_priorityClass;
 
         private readonly LoggingContext m_loggingContext;
 
@@ -309,7 +311,9 @@ namespace BuildXL.Processes.Internal
             bool disableConHostSharing,
             LoggingContext loggingContext,
             string timeoutDumpDirectory,
-            ContainerConfiguration containerConfiguration)
+            ContainerConfiguration containerConfiguration,
+            bool allowProcessBreakaway = false,
+            System.Diagnostics.ProcessPriorityClass? priorityClass = null)
         {
             Contract.Requires(bufferSize >= 128);
             Contract.Requires(!string.IsNullOrEmpty(commandLine));
@@ -332,6 +336,8 @@ namespace BuildXL.Processes.Internal
             m_timeout = timeout;
             m_disableConHostSharing = disableConHostSharing;
             m_containerConfiguration = containerConfiguration;
+            m_allowProcessBreakaway = allowProcessBreakaway;
+            m_priorityClass = priorityClass;
 
             if (m_workingDirectory != null && m_workingDirectory.Length == 0)
             {
@@ -349,7 +355,13 @@ namespace BuildXL.Processes.Internal
         /// <remarks>
         /// Start may be only called once on an instance, and not after this instance was disposed.
         /// A provided <paramref name="inheritableReportHandle"/> will be closed after process creation
-        /// (since it should then be owned by the child process).
+        /// (since it should then be owned by the child process), and so will the <paramref name="inheritableReportChannelHandles"/>.
+        /// When report channels are provided, the first one is <paramref name="inheritableReportHandle"/>, and each process of the tree
+        /// reports to one of them.
+        ///
+        /// When <paramref name="sandboxJob"/> is provided, the processes are sandboxed by the minifilter rather than by Detours (see
+        /// <see cref="MinifilterConnection"/>): it is called with the job of the process before the process is created, and nothing
+        /// gets injected into the process.
         /// </remarks>
         /// <exception cref="BuildXLException">Thrown if creating or detouring the process fails.</exception>
         [SuppressMessage("Microsoft.Reliability", "CA2000:Dispose objects before losing scope")]
@@ -357,8 +369,10 @@ namespace BuildXL.Processes.Internal
             Guid payloadGuid,
             ArraySegment<byte> payloadData,
             SafeFileHandle inheritableReportHandle,
+            SafeFileHandle[] inheritableReportChannelHandles,
             string dllNameX64,
-            string dllNameX86)
+            string dllNameX86,
+            Action<JobObject> sandboxJob = null)
         {
             using (m_syncSemaphore.AcquireSemaphore())
             {
@@ -380,6 +394,13 @@ namespace BuildXL.Processes.Internal
                     ((s_consoleWindow == IntPtr.Zero && !this.m_disableConHostSharing) ?
                         0 : Native.Processes.ProcessUtilities.CREATE_NO_WINDOW) | Native.Processes.ProcessUtilities.CREATE_DEFAULT_ERROR_MODE;
 
+                // The priority class flags of CreateProcess are the values of ProcessPriorityClass.
+                // The detoured processes pass it on to their children (see FileAccessManifest.PriorityClass).
+                if (m_priorityClass.HasValue)
+                {
+                    creationFlags |= (int)m_priorityClass.Value;
+                }
+
                 SafeFileHandle standardInputWritePipeHandle = null;
                 SafeFileHandle standardOutputReadPipeHandle = null;
                 SafeFileHandle standardErrorReadPipeHandle = null;
@@ -427,7 +448,14 @@ namespace BuildXL.Processes.Internal
                         }
 
                         // Initialize the injector
-                        m_processInjector = new ProcessTreeContext(payloadGuid, inheritableReportHandle, payloadData, dllNameX64, dllNameX86, m_loggingContext);
+                        m_processInjector = new ProcessTreeContext(
+                            payloadGuid,
+                            inheritableReportHandle,
+                            inheritableReportChannelHandles,
+                            payloadData,
+                            dllNameX64,
+                            dllNameX86,
+                            m_loggingContext);
 
                         // If path remapping is enabled then we wrap the job object in a container, so the filter drivers get
                         // configured (and they get cleaned up when the container is disposed)
@@ -445,7 +473,8 @@ namespace BuildXL.Processes.Internal
 
                         // We want the effects of SEM_NOGPFAULTERRORBOX on all children (but can't set that with CreateProcess).
                         // That's not set otherwise (even if set in this process) due to CREATE_DEFAULT_ERROR_MODE above.
-                        m_job.SetLimitInformation(terminateOnClose: true, failCriticalErrors: false);
+                        // Child processes that break away from the sandbox (see FileAccessManifest.AddChildProcessToBreakaway) leave the job.
+                        m_job.SetLimitInformation(terminateOnClose: true, failCriticalErrors: false, allowBreakaway: m_allowProcessBreakaway);
 
                         m_processInjector.Listen();
 
@@ -456,6 +485,8 @@ namespace BuildXL.Processes.Internal
                             m_job.StartContainerIfPresent();
                         }
 
+                        sandboxJob?.Invoke(m_job);
+
                         // The call to the CreateDetouredProcess below will add a newly created process to the job.
                         System.Diagnostics.Stopwatch m_startUpTimeWatch = System.Diagnostics.Stopwatch.StartNew();
                         var detouredProcessCreationStatus =
@@ -468,7 +499,7 @@ namespace BuildXL.Processes.Internal
                                 hStdOutput,
                                 hStdError,
                                 m_job,
-                                m_processInjector.Injector,
+                                sandboxJob == null ? m_processInjector.Injector : null,
                                 m_containerConfiguration.IsIsolationEnabled,
                                 out m_processHandle,
                                 out threadHandle,
@@ -547,6 +578,17 @@ namespace BuildXL.Processes.Internal
                             inheritableReportHandle.Dispose();
                         }
 
+                        if (inheritableReportChannelHandles != null)
+                        {
+                            foreach (var channelHandle in inheritableReportChannelHandles)
+                            {
+                                if (!channelHandle.IsInvalid)
+                                {
+                                    channelHandle.Dispose();
+                                }
+                            }
+                        }
+
                         if (threadHandle != null && !threadHandle.IsInvalid)
                         {
                             threadHandle.Dispose();
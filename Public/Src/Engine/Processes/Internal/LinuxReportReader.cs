@@ -0,0 +1,211 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Diagnostics.ContractsLight;
+using System.IO;
+using System.Text;
+using System.Threading.Tasks;
+using BuildXL.Interop.MacOS;
+using static BuildXL.Interop.MacOS.Sandbox;
+
+namespace BuildXL.Processes.Internal
+{
+    /// <summary>
+    /// Reads the reports the Linux sandbox (libBxlLinuxSandbox.so) writes to the report FIFO of a pip, and hands them to a callback
+    /// as <see cref="AccessReport"/>s, like the kext does on macOS.
+    /// </summary>
+    /// <remarks>
+    /// Each report is the 4-byte length of a compact AccessReport (see SandboxCommon.hpp) followed by it: its fixed part and the
+    /// used part of its path, null-terminated. Each process of the pip opens the FIFO when the sandbox gets loaded into it and
+    /// closes it when it exits (or execs), so the reader gets to the end of the reports once all of them have exited.
+    /// </remarks>
+    internal sealed class LinuxReportReader : IDisposable
+    {
+        // CODESYNC: AccessReport in Public/Src/Sandbox/Linux/SandboxCommon.hpp (offsets on x64)
+        private const int OperationOffset = 0;
+        private const int PidOffset = 4;
+        private const int RootPidOffset = 8;
+        private const int RequestedAccessOffset = 12;
+        private const int StatusOffset = 16;
+        private const int ReportExplicitlyOffset = 20;
+        private const int ErrorOffset = 24;
+        private const int PipIdOffset = 32;
+        private const int StatisticsOffset = 40;
+        private const int FileIdentityOffset = 64;
+
+        /// <summary>
+        /// Size of the fixed part of a report, i.e., everything but its path (kAccessReportHeaderSize).
+        /// </summary>
+        internal const int HeaderSize = 80;
+
+        // PATH_MAX on Linux: the size of the path of an AccessReport there
+        private const int MaxPathLength = 4096;
+
+        private const int MaxReportSize = HeaderSize + MaxPathLength;
+
+        private readonly string m_fifoPath;
+        private readonly Action<AccessReport> m_reportCallback;
+        private readonly Action<string> m_errorCallback;
+        private readonly Task m_readLoop;
+        private FileStream m_writeEnd;
+
+        private LinuxReportReader(string fifoPath, Action<AccessReport> reportCallback, Action<string> errorCallback)
+        {
+            m_fifoPath = fifoPath;
+            m_reportCallback = reportCallback;
+            m_errorCallback = errorCallback;
+
+            // Opening either end of a FIFO blocks until the other one gets opened.
+            m_readLoop = Task.Factory.StartNew(ReadLoop, TaskCreationOptions.LongRunning);
+
+            // Holding a write end keeps the reader from getting to the end of the reports before the first process of the pip opens the
+            // FIFO (or when none of them can, e.g., because it is statically linked), until the root process exits.
+            m_writeEnd = new FileStream(fifoPath, FileMode.Open, FileAccess.Write, FileShare.ReadWrite, bufferSize: 1);
+        }
+
+        /// <summary>
+        /// Starts reading the reports from the FIFO at <paramref name="fifoPath"/>, before the root process of the pip starts.
+        /// </summary>
+        /// <remarks>
+        /// <paramref name="errorCallback"/> is called (instead of <paramref name="reportCallback"/>) for the reports that cannot be read.
+        /// </remarks>
+        public static LinuxReportReader Start(string fifoPath, Action<AccessReport> reportCallback, Action<string> errorCallback)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(fifoPath));
+            Contract.Requires(reportCallback != null);
+            Contract.Requires(errorCallback != null);
+
+            return new LinuxReportReader(fifoPath, reportCallback, errorCallback);
+        }
+
+        /// <summary>
+        /// Completes once all the reports have been read, i.e., once all the processes of the pip have exited after
+        /// <see cref="ReleaseWriteEnd"/>.
+        /// </summary>
+        public Task Completion => m_readLoop;
+
+        /// <summary>
+        /// Releases the write end the reader holds itself; to be called once the root process of the pip has exited.
+        /// </summary>
+        public void ReleaseWriteEnd()
+        {
+            m_writeEnd?.Dispose();
+            m_writeEnd = null;
+        }
+
+        /// <inheritdoc />
+        public void Dispose()
+        {
+            ReleaseWriteEnd();
+        }
+
+        private void ReadLoop()
+        {
+            try
+            {
+                using (var stream = new FileStream(m_fifoPath, FileMode.Open, FileAccess.Read, FileShare.ReadWrite, bufferSize: 64 * 1024))
+                {
+                    ReadAll(stream, m_reportCallback, m_errorCallback);
+                }
+            }
+            catch (IOException e)
+            {
+                m_errorCallback($"Could not read the reports from '{m_fifoPath}': {e.Message}");
+            }
+        }
+
+        /// <summary>
+        /// Reads the length-prefixed reports in <paramref name="stream"/> until its end.
+        /// </summary>
+        internal static void ReadAll(Stream stream, Action<AccessReport> reportCallback, Action<string> errorCallback)
+        {
+            var buffer = new byte[MaxReportSize];
+            while (true)
+            {
+                int read = ReadFully(stream, buffer, sizeof(uint));
+                if (read == 0)
+                {
+                    return;
+                }
+
+                int size = read == sizeof(uint) ? unchecked((int)BitConverter.ToUInt32(buffer, 0)) : -1;
+                if (size < HeaderSize + 1 || size > MaxReportSize)
+                {
+                    // The reports after a malformed one cannot be found anymore.
+                    errorCallback($"Malformed report (potentially due to pipe corruption): size {size}");
+                    return;
+                }
+
+                if (ReadFully(stream, buffer, size) != size)
+                {
+                    errorCallback($"Truncated report: expected {size} bytes");
+                    return;
+                }
+
+                if (!TryParse(buffer, size, out var report))
+                {
+                    errorCallback($"Malformed report: the path of the {size}-byte report is not null-terminated");
+                    continue;
+                }
+
+                reportCallback(report);
+            }
+        }
+
+        /// <summary>
+        /// Parses the compact report in the first <paramref name="size"/> bytes of <paramref name="buffer"/>.
+        /// </summary>
+        internal static bool TryParse(byte[] buffer, int size, out AccessReport report)
+        {
+            report = default;
+            if (size <= HeaderSize || buffer[size - 1] != 0)
+            {
+                return false;
+            }
+
+            report = new AccessReport
+            {
+                Operation       = (FileOperation)buffer[OperationOffset],
+                Pid             = BitConverter.ToInt32(buffer, PidOffset),
+                RootPid         = BitConverter.ToInt32(buffer, RootPidOffset),
+                RequestedAccess = BitConverter.ToUInt32(buffer, RequestedAccessOffset),
+                Status          = BitConverter.ToUInt32(buffer, StatusOffset),
+                ExplicitLogging = BitConverter.ToUInt32(buffer, ReportExplicitlyOffset),
+                Error           = BitConverter.ToUInt32(buffer, ErrorOffset),
+                PipId           = BitConverter.ToInt64(buffer, PipIdOffset),
+                Statistics      = new AccessReportStatistics
+                {
+                    CreationTime = BitConverter.ToUInt64(buffer, StatisticsOffset),
+                    EnqueueTime  = BitConverter.ToUInt64(buffer, StatisticsOffset + sizeof(ulong)),
+                    DequeueTime  = BitConverter.ToUInt64(buffer, StatisticsOffset + 2 * sizeof(ulong)),
+                },
+                FileIdentity    = new FileIdentity
+                {
+                    Volume = BitConverter.ToUInt64(buffer, FileIdentityOffset),
+                    File   = BitConverter.ToUInt64(buffer, FileIdentityOffset + sizeof(ulong)),
+                },
+                Path            = Encoding.UTF8.GetString(buffer, HeaderSize, size - HeaderSize - 1),
+            };
+
+            return true;
+        }
+
+        private static int ReadFully(Stream stream, byte[] buffer, int count)
+        {
+            int total = 0;
+            while (total < count)
+            {
+                int read = stream.Read(buffer, total, count - total);
+                if (read == 0)
+                {
+                    break;
+                }
+
+                total += read;
+            }
+
+            return total;
+        }
+    }
+}
@@ -0,0 +1,84 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Diagnostics;
+using System.Diagnostics.ContractsLight;
+using System.IO.MemoryMappedFiles;
+
+namespace BuildXL.Processes.Internal
+{
+    /// <summary>
+    /// A named file mapping in which the detoured processes of a pip publish their counters while they run
+    /// (see <see cref="FileAccessManifest.PublishLiveCounters"/>), for the DetoursMonitor tool to read.
+    /// </summary>
+    /// <remarks>
+    /// Keep the layout in sync with LiveCountersHeader and ProcessLiveCounters in LiveCounters.h: a header of 128 bytes identifying the pip,
+    /// followed by <see cref="DefaultSlotCount"/> process slots of 128 bytes each. The detoured processes claim the slots themselves.
+    /// Named after the message count semaphore, like <see cref="SharedCounter"/>.
+    /// </remarks>
+    internal sealed class LiveCounters : IDisposable
+    {
+        /// <summary>
+        /// Suffix appended to the message count semaphore name to form the name of the counters. The monitor finds the counters of all
+        /// pips by this suffix.
+        /// </summary>
+        public const string NameSuffix = "_LiveCounters";
+
+        /// <summary>
+        /// Number of processes of a pip that can publish their counters at the same time. The slots of exited processes are reused.
+        /// </summary>
+        public const int DefaultSlotCount = 256;
+
+        private const uint Version = 1;
+        private const int HeaderSize = 128;
+        private const int SlotSize = 128;
+
+        private readonly MemoryMappedFile m_file;
+        private readonly MemoryMappedViewAccessor m_view;
+
+        private LiveCounters(MemoryMappedFile file, MemoryMappedViewAccessor view)
+        {
+            m_file = file;
+            m_view = view;
+        }
+
+        /// <summary>
+        /// Creates the named counters of a pip, with all slots free. They have to exist before the first detoured process of the pip starts.
+        /// </summary>
+        public static LiveCounters Create(string name, long pipId, int slotCount = DefaultSlotCount)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(name));
+            Contract.Requires(slotCount > 0);
+
+            long size = HeaderSize + (long)slotCount * SlotSize;
+            var file = MemoryMappedFile.CreateNew(name, size, MemoryMappedFileAccess.ReadWrite);
+
+            try
+            {
+                var view = file.CreateViewAccessor(0, size);
+                view.Write(0, Version);
+                view.Write(4, (uint)slotCount);
+                view.Write(8, pipId);
+                using (var process = Process.GetCurrentProcess())
+                {
+                    view.Write(16, (uint)process.Id);
+                }
+
+                return new LiveCounters(file, view);
+            }
+            catch
+            {
+                file.Dispose();
+                throw;
+            }
+        }
+
+        /// <inheritdoc />
+        public void Dispose()
+        {
+            m_view.Dispose();
+            m_file.Dispose();
+        }
+    }
+}
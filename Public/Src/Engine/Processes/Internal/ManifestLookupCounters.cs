@@ -0,0 +1,119 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics.ContractsLight;
+using System.IO.MemoryMappedFiles;
+
+namespace BuildXL.Processes.Internal
+{
+    /// <summary>
+    /// Counters in a named file mapping, in which the detoured processes of a pip count the lookups of the manifest tree that find a
+    /// node (see <see cref="FileAccessManifest.ProfileManifestLookups"/>).
+    /// </summary>
+    /// <remarks>
+    /// Keep the layout in sync with LookupProfileHeader in LookupProfile.cpp: a header holding the number of hit counters, the mask giving
+    /// the index of a path id and the number of probe lengths, followed by one 64-bit count of hits per probe length (the last one also
+    /// counting longer probes) and one 32-bit count of hits per path id index.
+    /// Named after the message count semaphore, like <see cref="SharedCounter"/>.
+    /// </remarks>
+    internal sealed class ManifestLookupCounters : IDisposable
+    {
+        /// <summary>
+        /// Suffix appended to the message count semaphore name to form the name of the counters.
+        /// </summary>
+        public const string NameSuffix = "_ManifestLookupProfile";
+
+        /// <summary>
+        /// Number of probe lengths counted; the most buckets a lookup probes in a regular table (MaxCollisionChainProbes in DataTypes.h).
+        /// </summary>
+        public const int ProbeLengthCount = 16;
+
+        private const int HeaderSize = 4 * sizeof(uint);
+
+        private readonly MemoryMappedFile m_file;
+        private readonly MemoryMappedViewAccessor m_view;
+        private readonly uint m_hitCounterCount;
+
+        private ManifestLookupCounters(MemoryMappedFile file, MemoryMappedViewAccessor view, uint hitCounterCount, uint pathIdTag)
+        {
+            m_file = file;
+            m_view = view;
+            m_hitCounterCount = hitCounterCount;
+            PathIdTag = pathIdTag;
+        }
+
+        /// <summary>
+        /// Bits of the path ids of the manifest outside of <see cref="AccessBitmap.PathIdIndexMask"/>.
+        /// </summary>
+        public uint PathIdTag { get; }
+
+        /// <summary>
+        /// Creates the named counters, all zero, with room for the path ids up to the given index. They have to exist before the first
+        /// detoured process of the pip starts.
+        /// </summary>
+        public static ManifestLookupCounters Create(string name, uint maxPathIdIndex, uint pathIdTag)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(name));
+            Contract.Requires(maxPathIdIndex <= AccessBitmap.PathIdIndexMask);
+
+            uint hitCounterCount = maxPathIdIndex + 1;
+            long size = HeaderSize + (long)ProbeLengthCount * sizeof(long) + (long)hitCounterCount * sizeof(int);
+
+            // Pages of the mapping are only committed once written, so the counters of the nodes never looked up stay cheap.
+            var file = MemoryMappedFile.CreateNew(name, size, MemoryMappedFileAccess.ReadWrite);
+
+            try
+            {
+                var view = file.CreateViewAccessor(0, size);
+                view.Write(0, hitCounterCount);
+                view.Write(sizeof(uint), AccessBitmap.PathIdIndexMask);
+                view.Write(2 * sizeof(uint), (uint)ProbeLengthCount);
+                return new ManifestLookupCounters(file, view, hitCounterCount, pathIdTag);
+            }
+            catch
+            {
+                file.Dispose();
+                throw;
+            }
+        }
+
+        /// <summary>
+        /// Hits per probe length: entry i counts the lookups that found their node after i + 1 probes.
+        /// </summary>
+        public long[] GetProbeLengthHistogram()
+        {
+            var histogram = new long[ProbeLengthCount];
+            for (int i = 0; i < ProbeLengthCount; i++)
+            {
+                histogram[i] = m_view.ReadInt64(HeaderSize + (long)i * sizeof(long));
+            }
+
+            return histogram;
+        }
+
+        /// <summary>
+        /// Indices of the path ids of the nodes found at least once, with the number of times they were found.
+        /// </summary>
+        public IEnumerable<KeyValuePair<uint, long>> GetHitCounts()
+        {
+            long start = HeaderSize + (long)ProbeLengthCount * sizeof(long);
+            for (uint i = 0; i < m_hitCounterCount; i++)
+            {
+                uint hits = m_view.ReadUInt32(start + (long)i * sizeof(int));
+                if (hits != 0)
+                {
+                    yield return new KeyValuePair<uint, long>(i, hits);
+                }
+            }
+        }
+
+        /// <inheritdoc />
+        public void Dispose()
+        {
+            m_view.Dispose();
+            m_file.Dispose();
+        }
+    }
+}
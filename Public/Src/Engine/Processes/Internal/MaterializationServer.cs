@@ -0,0 +1,125 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Diagnostics.ContractsLight;
+using System.IO;
+using System.IO.Pipes;
+using System.Linq;
+using System.Threading;
+using System.Threading.Tasks;
+using BuildXL.Utilities;
+
+namespace BuildXL.Processes.Internal
+{
+    /// <summary>
+    /// Serves the requests detoured processes make to materialize the files whose policy has <see cref="FileAccessPolicy.MaterializeOnOpen"/>,
+    /// on a named pipe named after the message count semaphore (see <see cref="SandboxedProcessInfo.MaterializeOnOpen"/>).
+    /// </summary>
+    /// <remarks>
+    /// Keep the messages in sync with Materialization.cpp: a request holds the path id and the id of the requesting process (two 32-bit
+    /// integers), and is answered with a 32-bit status, 0 if the file got materialized. Detours makes each request on a connection of its own.
+    /// </remarks>
+    internal sealed class MaterializationServer : IDisposable
+    {
+        /// <summary>
+        /// Suffix appended to the message count semaphore name to form the name of the pipe.
+        /// </summary>
+        public const string NameSuffix = "_Materialize";
+
+        private const int RequestSize = 2 * sizeof(uint);
+        private const uint StatusSucceeded = 0;
+        private const uint StatusFailed = 1;
+
+        // Each instance serves one request at a time; a few let the processes of a pip wait on different files at once.
+        private const int InstanceCount = 4;
+
+        private readonly string m_pipeName;
+        private readonly Func<AbsolutePath, Task<bool>> m_materialize;
+        private readonly CancellationTokenSource m_cancellation = new CancellationTokenSource();
+        private readonly Task[] m_instances;
+
+        private MaterializationServer(string pipeName, Func<AbsolutePath, Task<bool>> materialize)
+        {
+            m_pipeName = pipeName;
+            m_materialize = materialize;
+            m_instances = Enumerable.Range(0, InstanceCount).Select(_ => Task.Run(() => ServeAsync())).ToArray();
+        }
+
+        /// <summary>
+        /// Starts serving requests on the pipe named after the given message count semaphore name, before the first detoured process of
+        /// the pip starts.
+        /// </summary>
+        public static MaterializationServer Start(string messageCountSemaphoreName, Func<AbsolutePath, Task<bool>> materialize)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(messageCountSemaphoreName));
+            Contract.Requires(materialize != null);
+
+            return new MaterializationServer(messageCountSemaphoreName + NameSuffix, materialize);
+        }
+
+        private async Task ServeAsync()
+        {
+            CancellationToken cancellationToken = m_cancellation.Token;
+            var request = new byte[RequestSize];
+
+            while (!cancellationToken.IsCancellationRequested)
+            {
+                using (var pipe = new NamedPipeServerStream(
+                    m_pipeName,
+                    PipeDirection.InOut,
+                    NamedPipeServerStream.MaxAllowedServerInstances,
+                    PipeTransmissionMode.Message,
+                    PipeOptions.Asynchronous))
+                {
+                    try
+                    {
+                        await pipe.WaitForConnectionAsync(cancellationToken);
+
+                        int read = 0;
+                        while (read < RequestSize)
+                        {
+                            int bytes = await pipe.ReadAsync(request, read, RequestSize - read, cancellationToken);
+                            if (bytes == 0)
+                            {
+                                break;
+                            }
+
+                            read += bytes;
+                        }
+
+                        if (read < RequestSize)
+                        {
+                            continue;
+                        }
+
+                        var path = new AbsolutePath(unchecked((int)BitConverter.ToUInt32(request, 0)));
+                        bool materialized = path.IsValid && await m_materialize(path);
+
+                        byte[] status = BitConverter.GetBytes(materialized ? StatusSucceeded : StatusFailed);
+                        await pipe.WriteAsync(status, 0, status.Length, cancellationToken);
+                        pipe.WaitForPipeDrain();
+                    }
+                    catch (OperationCanceledException)
+                    {
+                        return;
+                    }
+                    catch (IOException)
+                    {
+                        // The detoured process went away before getting the answer (e.g., it got killed); the file still got materialized.
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Stops serving requests once no detoured process of the pip can make more.
+        /// </summary>
+        public void Dispose()
+        {
+            m_cancellation.Cancel();
+            Task.WaitAll(m_instances);
+            m_cancellation.Dispose();
+        }
+    }
+}
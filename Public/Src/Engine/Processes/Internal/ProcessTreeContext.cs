@@ -34,7 +34,9 @@ namespace BuildXL.Processes
     /// request the top-of-the-tree process (which contains the ProcessTreeContext) to do the
     /// injection. In order to do that, a server is created to listen to requests from the child
     /// processes. When such requests (containing a newly created process id) are received, the
-    /// injector is called to update the process with the required info:
+    /// injector is called to update the process with the required info.
+    /// Every request names its own completion events, so a child can have several requests in flight; they are
+    /// served concurrently (the native injector does not serialize injections) rather than in the order received.
     /// </summary>
     internal sealed class ProcessTreeContext : IDisposable
     {
@@ -42,10 +44,20 @@ namespace BuildXL.Processes
         private AsyncPipeReader m_injectionRequestReader;
         private bool m_stopping;
 
+        // Number of injections started and not finished yet. Guarded by the Injector lock.
+        private int m_injectionsInFlight;
+
         private readonly LoggingContext m_loggingContext;
 
         [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Reliability", "CA2000:DisposeObjectsBeforeLosingScope")]
-        public ProcessTreeContext(Guid payloadGuid, SafeHandle reportPipe, ArraySegment<byte> payload, string dllNameX64, string dllNameX86, LoggingContext loggingContext)
+        public ProcessTreeContext(
+            Guid payloadGuid,
+            SafeHandle reportPipe,
+            SafeHandle[] reportChannels,
+            ArraySegment<byte> payload,
+            string dllNameX64,
+            string dllNameX86,
+            LoggingContext loggingContext)
         {
             // We cannot create this object in a wow64 process
             Contract.Assume(
@@ -66,6 +78,12 @@ namespace BuildXL.Processes
                 // Create the injector. This will duplicate the handles.
                 Injector = ProcessUtilities.CreateProcessInjector(payloadGuid, childHandle, reportPipe, dllNameX86, dllNameX64, payload);
 
+                // The processes of the tree get one of the channels each (the report pipe being the first one).
+                if (reportChannels != null)
+                {
+                    Injector.SetReportChannels(reportChannels);
+                }
+
                 // Create the request reader. We don't start listening until requested
                 var injectionRequestFile = AsyncFileFactory.CreateAsyncFile(
                     injectorHandle,
@@ -155,9 +173,14 @@ namespace BuildXL.Processes
             Volatile.Write(ref m_stopping, true);
 
             // At this time all processes have exited and the only pipe handle is held by the injector.
-            // Dispose the injector to unblock the pipe reader.
+            // Dispose the injector to unblock the pipe reader, once the injections still running are done with it.
             lock (Injector)
             {
+                while (m_injectionsInFlight > 0)
+                {
+                    Monitor.Wait(Injector);
+                }
+
                 if (!Injector.IsDisposed)
                 {
                     Injector.Dispose();
@@ -220,30 +243,60 @@ namespace BuildXL.Processes
 
             // Once one injection fails, all others also fail.
             succeeded &= !HasDetoursInjectionFailures;
-            if (succeeded)
+            if (!succeeded)
             {
-                lock (Injector)
+                SignalInjectionRequester(processId, eventPathFailure, succeeded: false);
+                return true;
+            }
+
+            lock (Injector)
+            {
+                if (Injector.IsDisposed)
                 {
-                    if (Injector.IsDisposed)
-                    {
-                        // Stop just called. Ignore the request.
-                        Contract.Assert(m_stopping);
-                        return true;
-                    }
+                    // Stop just called. Ignore the request.
+                    Contract.Assert(m_stopping);
+                    return true;
+                }
+
+                m_injectionsInFlight++;
+            }
 
-                    uint injectionError = Injector.Inject(processId, inheritedHandles);
-                    if (injectionError != 0)
+            // Don't hold up the requests behind this one (possibly from other threads of the same process) for the injection.
+            Task.Run(() => Inject(processId, inheritedHandles, eventPathSuccess, eventPathFailure));
+            return true;
+        }
+
+        private void Inject(uint processId, bool inheritedHandles, string eventPathSuccess, string eventPathFailure)
+        {
+            bool succeeded = true;
+            try
+            {
+                uint injectionError = Injector.Inject(processId, inheritedHandles);
+                if (injectionError != 0)
+                {
+                    ReportFailedInjection(processId, injectionError.ToString("X8", CultureInfo.InvariantCulture));
+                    succeeded = false;
+                }
+            }
+            finally
+            {
+                lock (Injector)
+                {
+                    if (--m_injectionsInFlight == 0)
                     {
-                        ReportFailedInjection(processId, injectionError.ToString("X8", CultureInfo.InvariantCulture));
-                        succeeded = false;
+                        Monitor.PulseAll(Injector);
                     }
                 }
             }
 
-            string eventName = succeeded ? eventPathSuccess : eventPathFailure;
+            SignalInjectionRequester(processId, succeeded ? eventPathSuccess : eventPathFailure, succeeded);
+        }
+
+        private void SignalInjectionRequester(uint processId, string eventName, bool succeeded)
+        {
             EventWaitHandle e;
 
-            // Inject data & DLLs and map the drives and signal the caller indicating that we are done
+            // Signal the caller indicating that we are done
             if (EventWaitHandle.TryOpenExisting(eventName, out e))
             {
                 e.Set();
@@ -253,8 +306,6 @@ namespace BuildXL.Processes
             {
                 ReportFailedInjection(processId, string.Format(CultureInfo.InvariantCulture, "Cannot open event '{0}'", eventName));
             }
-
-            return true;
         }
 
         private void ReportFailedInjection(uint processId, string error)
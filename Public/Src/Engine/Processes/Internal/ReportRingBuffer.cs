@@ -0,0 +1,268 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Diagnostics;
+using System.Diagnostics.ContractsLight;
+using System.IO.MemoryMappedFiles;
+using System.Threading;
+using Microsoft.Win32.SafeHandles;
+
+namespace BuildXL.Processes.Internal
+{
+    /// <summary>
+    /// Consumer side of the shared-memory report transport used when <see cref="FileAccessManifest.UseReportRingBuffer"/> is set.
+    /// </summary>
+    /// <remarks>
+    /// Keep this in sync with the C++ version declared in ReportRing.h.
+    /// The mapping consists of a 192-byte header followed by a data area whose size is a power of two. Detoured processes
+    /// reserve slots by advancing the reserve offset with interlocked operations; this class drains committed slots in order,
+    /// zeroes them, and advances the read offset. Each slot payload holds bytes that would otherwise have been written to the report pipe.
+    /// Only one thread may call <see cref="Drain"/> at a time.
+    /// A slot reserved but left uncommitted for <see cref="CommitTimeout"/> (its producer was killed in between) is skipped, and so are
+    /// all uncommitted slots once no producer is left. Its report is lost, like the ones the killed process had yet to send.
+    ///
+    /// A producer writes the size of its slot right after reserving it, so one killed in between leaves a slot of unknown size, which
+    /// stops draining while producers are left (they fall back to the report pipe once the ring stays full). Once none is left, everything
+    /// from that slot up to the reserve offset is skipped, since there is no telling where the slots after it start. The bytes of the
+    /// slots skipped once no producer is left are counted in <see cref="LostBytes"/>.
+    /// </remarks>
+    internal sealed unsafe class ReportRingBuffer : IDisposable
+    {
+        /// <summary>
+        /// Suffix appended to the message count semaphore name to form the name of the mapping.
+        /// </summary>
+        public const string NameSuffix = "_ReportRing";
+
+        private const uint Magic = 0x474E4952;
+        private const uint Version = 2;
+        private const int HeaderSize = 192;
+        private const int CapacityOffset = 8;
+        private const int ReserveOffsetOffset = 64;
+        private const int ReadOffsetOffset = 128;
+        private const int SlotAlignment = 8;
+        private const uint SkipSlot = 0x80000000;
+
+        /// <summary>
+        /// How long a slot may stay reserved but uncommitted before it is skipped.
+        /// </summary>
+        public static readonly TimeSpan CommitTimeout = TimeSpan.FromSeconds(10);
+
+        private readonly MemoryMappedFile m_file;
+        private readonly MemoryMappedViewAccessor m_view;
+        private readonly long m_capacity;
+        private byte* m_base;
+        private byte[] m_payloadBuffer = new byte[4096];
+
+        // Read offset at which an uncommitted slot stopped the last drain, and since when.
+        private long m_stalledReadOffset = -1;
+        private readonly Stopwatch m_stalledTime = new Stopwatch();
+
+        private ReportRingBuffer(MemoryMappedFile file, MemoryMappedViewAccessor view, long capacity)
+        {
+            m_file = file;
+            m_view = view;
+            m_capacity = capacity;
+            m_view.SafeMemoryMappedViewHandle.AcquirePointer(ref m_base);
+            m_base += m_view.PointerOffset;
+
+            *(uint*)m_base = Magic;
+            *(uint*)(m_base + 4) = Version;
+            *(ulong*)(m_base + CapacityOffset) = (ulong)capacity;
+        }
+
+        /// <summary>
+        /// Handle of the section backing the ring, for producers that cannot open it by name (see <see cref="MinifilterConnection"/>).
+        /// </summary>
+        public SafeMemoryMappedFileHandle SectionHandle => m_file.SafeMemoryMappedFileHandle;
+
+        /// <summary>
+        /// Creates the named ring. It has to exist before the first detoured process of the pip starts.
+        /// </summary>
+        public static ReportRingBuffer Create(string semaphoreName, int capacity)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(semaphoreName));
+            Contract.Requires(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+            var file = MemoryMappedFile.CreateNew(semaphoreName + NameSuffix, HeaderSize + (long)capacity, MemoryMappedFileAccess.ReadWrite);
+
+            try
+            {
+                return new ReportRingBuffer(file, file.CreateViewAccessor(), capacity);
+            }
+            catch
+            {
+                file.Dispose();
+                throw;
+            }
+        }
+
+        /// <summary>
+        /// Number of bytes of the slots skipped uncommitted once no producer was left (see <see cref="Drain"/>), i.e., of reports that
+        /// are lost for sure.
+        /// </summary>
+        public long LostBytes { get; private set; }
+
+        /// <summary>
+        /// Drains all slots committed so far, in order.
+        /// </summary>
+        /// <param name="payloadReceived">Invoked with a buffer and the number of valid bytes in it. The buffer is reused across calls.</param>
+        /// <param name="producersExited">Whether no producer is left, in which case the uncommitted slots are skipped right away.</param>
+        /// <returns>The number of payloads drained.</returns>
+        public int Drain(Action<byte[], int> payloadReceived, bool producersExited = false)
+        {
+            Contract.Requires(payloadReceived != null);
+
+            long* readOffsetPtr = (long*)(m_base + ReadOffsetOffset);
+            byte* data = m_base + HeaderSize;
+            long read = *readOffsetPtr;
+            int count = 0;
+
+            while (true)
+            {
+                long position = read & (m_capacity - 1);
+                int* lengthPtr = (int*)(data + position);
+                uint length = unchecked((uint)Volatile.Read(ref *lengthPtr));
+
+                if (length == 0)
+                {
+                    // Reserved but not yet committed (or nothing written yet).
+                    if (!TrySkipUncommittedSlot(read, lengthPtr, producersExited, out length))
+                    {
+                        if (producersExited)
+                        {
+                            read = SkipToReserveOffset(read);
+                            Volatile.Write(ref *readOffsetPtr, read);
+                        }
+
+                        break;
+                    }
+                }
+
+                long consumed;
+                if ((length & SkipSlot) != 0)
+                {
+                    consumed = length & ~SkipSlot;
+                }
+                else
+                {
+                    if (m_payloadBuffer.Length < length)
+                    {
+                        m_payloadBuffer = new byte[Math.Max(length, 2 * m_payloadBuffer.Length)];
+                    }
+
+                    fixed (byte* payload = m_payloadBuffer)
+                    {
+                        Buffer.MemoryCopy(data + position + SlotAlignment, payload, m_payloadBuffer.Length, length);
+                    }
+
+                    payloadReceived(m_payloadBuffer, (int)length);
+                    consumed = (SlotAlignment + length + SlotAlignment - 1) & ~(long)(SlotAlignment - 1);
+                    count++;
+                }
+
+                // Producers rely on consumed space being zeroed: a zero length marks an uncommitted slot.
+                for (long i = 0; i < consumed; i += sizeof(long))
+                {
+                    *(long*)(data + position + i) = 0;
+                }
+
+                read += consumed;
+                Volatile.Write(ref *readOffsetPtr, read);
+            }
+
+            return count;
+        }
+
+        /// <summary>
+        /// Marks the uncommitted slot at <paramref name="read"/> as skipped, if its producer had <see cref="CommitTimeout"/> (or no time
+        /// at all, once <paramref name="producersExited"/>) to commit it. Producers commit by swapping the length from zero, so only one
+        /// of them and the consumer can win.
+        /// </summary>
+        private bool TrySkipUncommittedSlot(long read, int* lengthPtr, bool producersExited, out uint length)
+        {
+            length = 0;
+            long reserve = Volatile.Read(ref *(long*)(m_base + ReserveOffsetOffset));
+            if (reserve <= read)
+            {
+                // Nothing reserved there yet.
+                m_stalledReadOffset = -1;
+                return false;
+            }
+
+            if (!producersExited)
+            {
+                if (m_stalledReadOffset != read)
+                {
+                    m_stalledReadOffset = read;
+                    m_stalledTime.Restart();
+                    return false;
+                }
+
+                if (m_stalledTime.Elapsed < CommitTimeout)
+                {
+                    return false;
+                }
+            }
+
+            // The size is written right after the slot is reserved; without it, there is no telling where the next slot starts.
+            int slotSize = Volatile.Read(ref *(lengthPtr + 1));
+            if (slotSize <= 0)
+            {
+                return false;
+            }
+
+            int skipped = unchecked((int)(SkipSlot | (uint)slotSize));
+            int previous = Interlocked.CompareExchange(ref *lengthPtr, skipped, 0);
+            length = unchecked((uint)(previous == 0 ? skipped : previous));
+            if (previous == 0 && producersExited)
+            {
+                LostBytes += slotSize;
+            }
+
+            m_stalledReadOffset = -1;
+            return true;
+        }
+
+        /// <summary>
+        /// Zeroes everything from <paramref name="read"/> up to the reserve offset and returns the latter; only once no producer is left,
+        /// when the uncommitted slot at <paramref name="read"/> has no size.
+        /// </summary>
+        private long SkipToReserveOffset(long read)
+        {
+            long reserve = Volatile.Read(ref *(long*)(m_base + ReserveOffsetOffset));
+            if (reserve <= read)
+            {
+                return read;
+            }
+
+            byte* data = m_base + HeaderSize;
+            for (long offset = read; offset < reserve; offset += sizeof(long))
+            {
+                *(long*)(data + (offset & (m_capacity - 1))) = 0;
+            }
+
+            LostBytes += reserve - read;
+            m_stalledReadOffset = -1;
+            return reserve;
+        }
+
+        /// <summary>
+        /// Whether producers have reserved space that has not been drained yet.
+        /// </summary>
+        public bool HasPendingData => Volatile.Read(ref *(long*)(m_base + ReserveOffsetOffset)) != Volatile.Read(ref *(long*)(m_base + ReadOffsetOffset));
+
+        /// <inheritdoc />
+        public void Dispose()
+        {
+            if (m_base != null)
+            {
+                m_view.SafeMemoryMappedViewHandle.ReleasePointer();
+                m_base = null;
+            }
+
+            m_view.Dispose();
+            m_file.Dispose();
+        }
+    }
+}
@@ -0,0 +1,156 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Diagnostics.ContractsLight;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace BuildXL.Processes.Internal
+{
+    /// <summary>
+    /// Drains the <see cref="ReportRingBuffer"/> of a pip while its processes run, and hands the report lines in it to a callback, like
+    /// <see cref="AsyncPipeReader"/> does for the report pipe.
+    /// </summary>
+    /// <remarks>
+    /// Each payload holds whole report lines, or whole records with <see cref="FileAccessManifest.UseBinaryReportFormat"/> (the bytes of
+    /// one write to the report pipe), so lines and records are split within a payload only.
+    /// </remarks>
+    internal sealed class ReportRingReader
+    {
+        // How long the drain loop sleeps once the ring is empty.
+        private const int DrainIntervalMs = 10;
+
+        private static readonly char[] s_endOfLine = { '\r', '\n' };
+
+        private readonly ReportRingBuffer m_ring;
+        private readonly Encoding m_encoding;
+        private readonly StreamDataReceived m_callback;
+        private readonly RecordReceived m_recordCallback;
+        private readonly CancellationTokenSource m_cancellation = new CancellationTokenSource();
+        private readonly object m_drainLock = new object();
+        private readonly Task m_drainLoop;
+
+        private ReportRingReader(ReportRingBuffer ring, Encoding encoding, StreamDataReceived callback, RecordReceived recordCallback)
+        {
+            m_ring = ring;
+            m_encoding = encoding;
+            m_callback = callback;
+            m_recordCallback = recordCallback;
+            m_drainLoop = Task.Run(() => DrainLoopAsync());
+        }
+
+        /// <summary>
+        /// Starts draining the ring, before the first detoured process of the pip starts.
+        /// </summary>
+        public static ReportRingReader Start(ReportRingBuffer ring, Encoding encoding, StreamDataReceived callback)
+        {
+            Contract.Requires(ring != null);
+            Contract.Requires(encoding != null);
+            Contract.Requires(callback != null);
+
+            return new ReportRingReader(ring, encoding, callback, recordCallback: null);
+        }
+
+        /// <summary>
+        /// Starts draining a ring of length-prefixed records, before the first detoured process of the pip starts.
+        /// </summary>
+        public static ReportRingReader Start(ReportRingBuffer ring, RecordReceived callback)
+        {
+            Contract.Requires(ring != null);
+            Contract.Requires(callback != null);
+
+            return new ReportRingReader(ring, encoding: null, callback: null, recordCallback: callback);
+        }
+
+        private async Task DrainLoopAsync()
+        {
+            CancellationToken cancellationToken = m_cancellation.Token;
+            while (!cancellationToken.IsCancellationRequested)
+            {
+                if (Drain(producersExited: false) == 0)
+                {
+                    try
+                    {
+                        await Task.Delay(DrainIntervalMs, cancellationToken);
+                    }
+                    catch (OperationCanceledException)
+                    {
+                        return;
+                    }
+                }
+            }
+        }
+
+        private int Drain(bool producersExited)
+        {
+            lock (m_drainLock)
+            {
+                return m_ring.Drain(PayloadReceived, producersExited);
+            }
+        }
+
+        private void PayloadReceived(byte[] payload, int length)
+        {
+            if (m_recordCallback != null)
+            {
+                RecordsReceived(payload, length);
+                return;
+            }
+
+            string lines = m_encoding.GetString(payload, 0, length);
+            int start = 0;
+            while (start < lines.Length)
+            {
+                int end = lines.IndexOfAny(s_endOfLine, start);
+                if (end < 0)
+                {
+                    end = lines.Length;
+                }
+
+                if (end > start)
+                {
+                    m_callback(lines.Substring(start, end - start));
+                }
+
+                start = end + 1;
+            }
+        }
+
+        private void RecordsReceived(byte[] payload, int length)
+        {
+            int start = 0;
+            while (start < length)
+            {
+                // A size that does not fit in the payload is handed over as it is, for the callback to fail on it.
+                int size = length - start >= sizeof(uint) ? unchecked((int)BitConverter.ToUInt32(payload, start)) : 0;
+                if (size < sizeof(uint) || size > length - start)
+                {
+                    m_recordCallback(new ArraySegment<byte>(payload, start, length - start));
+                    return;
+                }
+
+                m_recordCallback(new ArraySegment<byte>(payload, start, size));
+                start += size;
+            }
+        }
+
+        /// <summary>
+        /// Number of bytes of reports that producers killed before committing them left in the ring (see <see cref="ReportRingBuffer.LostBytes"/>);
+        /// final once <see cref="StopAsync"/> completed.
+        /// </summary>
+        public long LostBytes => m_ring.LostBytes;
+
+        /// <summary>
+        /// Stops the drain loop and drains what is left, once no detoured process of the pip can write more.
+        /// </summary>
+        public async Task StopAsync()
+        {
+            m_cancellation.Cancel();
+            await m_drainLoop;
+            Drain(producersExited: true);
+            m_cancellation.Dispose();
+        }
+    }
+}
@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Diagnostics.ContractsLight;
+using System.IO.MemoryMappedFiles;
+
+namespace BuildXL.Processes.Internal
+{
+    /// <summary>
+    /// A 64-bit counter in a named file mapping, incremented with interlocked operations by the detoured processes of a pip.
+    /// </summary>
+    /// <remarks>
+    /// Used for the report sequence (<see cref="FileAccessManifest.SequenceReports"/>; keep in sync with InitializeReportSequence in SendReport.cpp)
+    /// and for the number of reports sent (<see cref="FileAccessManifest.CheckDetoursMessageCount"/>; keep in sync with g_messageCount in globals.h).
+    /// Both are named after the message count semaphore.
+    /// </remarks>
+    internal sealed class SharedCounter : IDisposable
+    {
+        /// <summary>
+        /// Suffix appended to the message count semaphore name to form the name of the report sequence counter.
+        /// The counter holds the sequence of the last report formatted, so the reports sent so far are numbered 1 to <see cref="Value"/>.
+        /// </summary>
+        public const string ReportSequenceNameSuffix = "_ReportSequence";
+
+        /// <summary>
+        /// Suffix appended to the message count semaphore name to form the name of the message count.
+        /// </summary>
+        public const string MessageCountNameSuffix = "_MessageCount";
+
+        private const int Size = sizeof(long);
+
+        private readonly MemoryMappedFile m_file;
+        private readonly MemoryMappedViewAccessor m_view;
+
+        private SharedCounter(MemoryMappedFile file, MemoryMappedViewAccessor view)
+        {
+            m_file = file;
+            m_view = view;
+        }
+
+        /// <summary>
+        /// Creates the named counter, starting at 0, or opens it if it exists already. It has to exist before the first detoured process
+        /// of the pip starts.
+        /// </summary>
+        public static SharedCounter CreateOrOpen(string name)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(name));
+
+            var file = MemoryMappedFile.CreateOrOpen(name, Size, MemoryMappedFileAccess.ReadWrite);
+
+            try
+            {
+                return new SharedCounter(file, file.CreateViewAccessor(0, Size));
+            }
+            catch
+            {
+                file.Dispose();
+                throw;
+            }
+        }
+
+        /// <summary>
+        /// Current value of the counter.
+        /// </summary>
+        public long Value => m_view.ReadInt64(0);
+
+        /// <inheritdoc />
+        public void Dispose()
+        {
+            m_view.Dispose();
+            m_file.Dispose();
+        }
+    }
+}
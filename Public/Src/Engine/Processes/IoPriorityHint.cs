@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// The I/O priority of a process (IO_PRIORITY_HINT), by which the I/O manager orders the I/O of the processes of the machine.
+    /// </summary>
+    public enum IoPriorityHint : uint
+    {
+        /// <summary>
+        /// Background I/O, done when no process of a higher priority has I/O pending.
+        /// </summary>
+        VeryLow = 0,
+
+        /// <summary>
+        /// I/O of a lower priority than the one of most processes.
+        /// </summary>
+        Low = 1,
+
+        /// <summary>
+        /// The I/O priority processes have by default.
+        /// </summary>
+        Normal = 2,
+    }
+}
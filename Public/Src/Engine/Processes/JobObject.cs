@@ -193,7 +193,8 @@ namespace BuildXL.Processes
         /// <param name="terminateOnClose">If set, the job and all children will be terminated when the last handle to the job closes.</param>
         /// <param name="priorityClass">Forces a priority class onto all child processes in the job.</param>
         /// <param name="failCriticalErrors">If set, applies the effects of <c>SEM_NOGPFAULTERRORBOX</c> to all child processes in the job.</param>
-        internal void SetLimitInformation(bool? terminateOnClose = null, ProcessPriorityClass? priorityClass = null, bool failCriticalErrors = false)
+        /// <param name="allowBreakaway">If set, processes in the job may start child processes outside of it (with <c>CREATE_BREAKAWAY_FROM_JOB</c>).</param>
+        internal void SetLimitInformation(bool? terminateOnClose = null, ProcessPriorityClass? priorityClass = null, bool failCriticalErrors = false, bool allowBreakaway = false)
         {
             // There is a race in here; but that shouldn't matter in the way we use JobObjects in BuildXL.
             var limitInfo = default(JOBOBJECT_EXTENDED_LIMIT_INFORMATION);
@@ -231,6 +232,11 @@ namespace BuildXL.Processes
                 limitInfo.LimitFlags |= JOBOBJECT_LIMIT_FLAGS.JOB_OBJECT_LIMIT_DIE_ON_UNHANDLED_EXCEPTION;
             }
 
+            if (allowBreakaway)
+            {
+                limitInfo.LimitFlags |= JOBOBJECT_LIMIT_FLAGS.JOB_OBJECT_LIMIT_BREAKAWAY_OK;
+            }
+
             if (!Native.Processes.ProcessUtilities.SetInformationJobObject(
                 handle,
                 JOBOBJECTINFOCLASS.ExtendedLimitInformation,
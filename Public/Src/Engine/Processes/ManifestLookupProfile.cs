@@ -0,0 +1,80 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System.Collections.Generic;
+using System.Diagnostics.ContractsLight;
+using BuildXL.Utilities;
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// How often the detoured processes of a pip found the nodes of its manifest, and after how many probes
+    /// (see <see cref="FileAccessManifest.ProfileManifestLookups"/>).
+    /// </summary>
+    /// <remarks>
+    /// Given to <see cref="FileAccessManifest.ApplyLookupProfile"/> when the manifest of a later run of the same pip is built, the hit
+    /// counts place the hot children of each node ahead of the others in its hash table.
+    /// </remarks>
+    public sealed class ManifestLookupProfile
+    {
+        /// <summary>
+        /// Number of lookups that found each node, by the path id of the node. Nodes never found are left out.
+        /// </summary>
+        public IReadOnlyDictionary<AbsolutePath, long> HitCounts { get; }
+
+        /// <summary>
+        /// Number of lookups that found their node after i + 1 probes of the hash table of its parent, at index i. The last entry also
+        /// counts the lookups that took more probes.
+        /// </summary>
+        public IReadOnlyList<long> ProbeLengthHistogram { get; }
+
+        /// <summary>
+        /// Creates an instance
+        /// </summary>
+        public ManifestLookupProfile(IReadOnlyDictionary<AbsolutePath, long> hitCounts, IReadOnlyList<long> probeLengthHistogram)
+        {
+            Contract.Requires(hitCounts != null);
+            Contract.Requires(probeLengthHistogram != null);
+
+            HitCounts = hitCounts;
+            ProbeLengthHistogram = probeLengthHistogram;
+        }
+
+        /// <nodoc />
+        public static ManifestLookupProfile Deserialize(BuildXLReader reader)
+        {
+            int hitCountCount = reader.ReadInt32Compact();
+            var hitCounts = new Dictionary<AbsolutePath, long>(hitCountCount);
+            for (int i = 0; i < hitCountCount; i++)
+            {
+                hitCounts.Add(new AbsolutePath(reader.ReadInt32()), reader.ReadInt64Compact());
+            }
+
+            int probeLengthCount = reader.ReadInt32Compact();
+            var probeLengthHistogram = new long[probeLengthCount];
+            for (int i = 0; i < probeLengthCount; i++)
+            {
+                probeLengthHistogram[i] = reader.ReadInt64Compact();
+            }
+
+            return new ManifestLookupProfile(hitCounts, probeLengthHistogram);
+        }
+
+        /// <nodoc />
+        public void Serialize(BuildXLWriter writer)
+        {
+            writer.WriteCompact(HitCounts.Count);
+            foreach (var hitCount in HitCounts)
+            {
+                writer.Write(hitCount.Key.Value.Value);
+                writer.WriteCompact(hitCount.Value);
+            }
+
+            writer.WriteCompact(ProbeLengthHistogram.Count);
+            foreach (long hits in ProbeLengthHistogram)
+            {
+                writer.WriteCompact(hits);
+            }
+        }
+    }
+}
@@ -0,0 +1,168 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Diagnostics.ContractsLight;
+using System.Runtime.InteropServices;
+using BuildXL.Native.IO;
+using BuildXL.Native.Processes;
+using BuildXL.Processes.Internal;
+using Microsoft.Win32.SafeHandles;
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// Connection to the BuildXL minifilter (see Sandbox/Windows/Minifilter), which checks and reports the file accesses of
+    /// processes Detours cannot follow (e.g., statically linked or non-Win32 binaries).
+    /// </summary>
+    /// <remarks>
+    /// The driver tracks pips by silo: the job of a pip is converted to a silo before its first process starts, and the driver
+    /// checks every create, rename, link and delete issued from inside it against the manifest sent with <see cref="AddPip"/>.
+    /// Reports are written to the pip's <see cref="ReportRingBuffer"/> in the text format of the detoured processes.
+    ///
+    /// Keep the message layout in sync with BuildXLFilterShared.h.
+    /// </remarks>
+    internal sealed class MinifilterConnection : IDisposable
+    {
+        /// <summary>
+        /// Name of the communication port of the driver.
+        /// </summary>
+        public const string PortName = @"\BuildXLFilterPort";
+
+        private const uint ProtocolVersion = 1;
+        private const uint CommandAddPip = 1;
+        private const uint CommandRemovePip = 2;
+        private const int MessageHeaderSize = 40;
+        private const int MaxPayloadSize = 64 * 1024 * 1024;
+
+        private readonly SafeFileHandle m_port;
+
+        private MinifilterConnection(SafeFileHandle port)
+        {
+            m_port = port;
+        }
+
+        /// <summary>
+        /// Connects to the driver. Returns false if it is not loaded (or the caller may not connect to it).
+        /// </summary>
+        public static bool TryConnect(out MinifilterConnection connection)
+        {
+            connection = null;
+
+            int hr = FilterConnectCommunicationPort(PortName, 0, IntPtr.Zero, 0, IntPtr.Zero, out SafeFileHandle port);
+            if (hr < 0 || port.IsInvalid)
+            {
+                port.Dispose();
+                return false;
+            }
+
+            connection = new MinifilterConnection(port);
+            return true;
+        }
+
+        /// <summary>
+        /// Converts <paramref name="job"/> to a silo. This has to happen before any process is assigned to it.
+        /// </summary>
+        public static unsafe void ConvertToSilo(JobObject job)
+        {
+            Contract.Requires(job != null);
+
+            if (!Native.Processes.ProcessUtilities.SetInformationJobObject(
+                job.DangerousGetHandle(),
+                JOBOBJECTINFOCLASS.JobObjectCreateSilo,
+                null,
+                0))
+            {
+                throw new NativeWin32Exception(Marshal.GetLastWin32Error(), "Unable to convert job object to a silo.");
+            }
+        }
+
+        /// <summary>
+        /// Starts sandboxing the processes of <paramref name="job"/> (which has to be a silo, see <see cref="ConvertToSilo"/>)
+        /// with the manifest in <paramref name="payload"/>, reporting to <paramref name="ring"/>.
+        /// </summary>
+        /// <remarks>
+        /// The manifest has to be serialized with <see cref="FileAccessManifest.UseReportRingBuffer"/> set and without the binary report format.
+        /// </remarks>
+        public void AddPip(JobObject job, ReportRingBuffer ring, ArraySegment<byte> payload, long pipId)
+        {
+            Contract.Requires(job != null);
+            Contract.Requires(ring != null);
+            Contract.Requires(payload.Count > 0 && payload.Count <= MaxPayloadSize);
+
+            bool ringAdded = false;
+            try
+            {
+                ring.SectionHandle.DangerousAddRef(ref ringAdded);
+                Send(CommandAddPip, pipId, job, ring.SectionHandle.DangerousGetHandle(), payload);
+            }
+            finally
+            {
+                if (ringAdded)
+                {
+                    ring.SectionHandle.DangerousRelease();
+                }
+            }
+        }
+
+        /// <summary>
+        /// Stops sandboxing the processes of <paramref name="job"/>. The driver drops the pip when its silo goes away as well.
+        /// </summary>
+        public void RemovePip(JobObject job, long pipId)
+        {
+            Contract.Requires(job != null);
+
+            Send(CommandRemovePip, pipId, job, IntPtr.Zero, default(ArraySegment<byte>));
+        }
+
+        private unsafe void Send(uint command, long pipId, JobObject job, IntPtr ringSection, ArraySegment<byte> payload)
+        {
+            var message = new byte[MessageHeaderSize + Math.Max(payload.Count, 1)];
+
+            fixed (byte* buffer = message)
+            {
+                *(uint*)buffer = ProtocolVersion;
+                *(uint*)(buffer + 4) = command;
+                *(long*)(buffer + 8) = pipId;
+                *(ulong*)(buffer + 16) = (ulong)job.DangerousGetHandle().ToInt64();
+                *(ulong*)(buffer + 24) = (ulong)ringSection.ToInt64();
+                *(uint*)(buffer + 32) = (uint)payload.Count;
+
+                if (payload.Count > 0)
+                {
+                    Marshal.Copy(payload.Array, payload.Offset, new IntPtr(buffer + MessageHeaderSize), payload.Count);
+                }
+
+                int hr = FilterSendMessage(m_port, buffer, (uint)(MessageHeaderSize + payload.Count), IntPtr.Zero, 0, out _);
+                if (hr < 0)
+                {
+                    throw new NativeWin32Exception(hr, "Unable to send a message to the BuildXL minifilter.");
+                }
+            }
+        }
+
+        /// <inheritdoc />
+        public void Dispose()
+        {
+            m_port.Dispose();
+        }
+
+        [DllImport("fltlib.dll", CharSet = CharSet.Unicode)]
+        private static extern int FilterConnectCommunicationPort(
+            string lpPortName,
+            uint dwOptions,
+            IntPtr lpContext,
+            ushort wSizeOfContext,
+            IntPtr lpSecurityAttributes,
+            out SafeFileHandle hPort);
+
+        [DllImport("fltlib.dll")]
+        private static extern unsafe int FilterSendMessage(
+            SafeFileHandle hPort,
+            byte* lpInBuffer,
+            uint dwInBufferSize,
+            IntPtr lpOutBuffer,
+            uint dwOutBufferSize,
+            out uint lpBytesReturned);
+    }
+}
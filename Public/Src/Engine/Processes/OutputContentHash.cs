@@ -0,0 +1,95 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System.Diagnostics.ContractsLight;
+using BuildXL.Utilities;
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// The content hash of an output, computed by a detoured process while it wrote the file (see <see cref="FileAccessManifest.HashOutputsWhileWriting"/>).
+    /// </summary>
+    /// <remarks>
+    /// The hash is the VSO0 hash of the bytes written through one handle, without the trailing algorithm id byte. It is only a hint:
+    /// writes through a mapped view (as linkers make), through another handle or by another process are not hashed, and the size and
+    /// last write time checked when the handle is closed do not catch one that keeps the size of the file. So a valid hash may not be
+    /// the one of the file on disk, and the content must be hashed again wherever a wrong hash would matter.
+    /// </remarks>
+    public sealed class OutputContentHash
+    {
+        /// <summary>
+        /// Size of <see cref="Hash"/>, in bytes.
+        /// </summary>
+        public const int HashLength = 32;
+
+        /// <summary>
+        /// Id of the process that wrote the file.
+        /// </summary>
+        public uint ProcessId { get; }
+
+        /// <summary>
+        /// Path of the file.
+        /// </summary>
+        public string Path { get; }
+
+        /// <summary>
+        /// Whether the file was written sequentially from its start through the handle, so that <see cref="Hash"/> is the hash of the
+        /// bytes written through it (see the remarks of the class for what it does not cover).
+        /// </summary>
+        public bool IsValid { get; }
+
+        /// <summary>
+        /// The hash, or all zeros if not <see cref="IsValid"/>.
+        /// </summary>
+        public byte[] Hash { get; }
+
+        /// <summary>
+        /// Number of bytes hashed.
+        /// </summary>
+        public long Length { get; }
+
+        /// <summary>
+        /// Last write time of the file when the hash was completed, as a FILETIME (0 if not <see cref="IsValid"/>).
+        /// </summary>
+        public long LastWriteTime { get; }
+
+        /// <summary>
+        /// Creates an instance
+        /// </summary>
+        public OutputContentHash(uint processId, string path, bool isValid, byte[] hash, long length, long lastWriteTime)
+        {
+            Contract.Requires(path != null);
+            Contract.Requires(hash != null && hash.Length == HashLength);
+
+            ProcessId = processId;
+            Path = path;
+            IsValid = isValid;
+            Hash = hash;
+            Length = length;
+            LastWriteTime = lastWriteTime;
+        }
+
+        /// <nodoc />
+        public static OutputContentHash Deserialize(BuildXLReader reader)
+        {
+            return new OutputContentHash(
+                processId: reader.ReadUInt32(),
+                path: reader.ReadString(),
+                isValid: reader.ReadBoolean(),
+                hash: reader.ReadBytes(HashLength),
+                length: reader.ReadInt64(),
+                lastWriteTime: reader.ReadInt64());
+        }
+
+        /// <nodoc />
+        public void Serialize(BuildXLWriter writer)
+        {
+            writer.Write(ProcessId);
+            writer.Write(Path);
+            writer.Write(IsValid);
+            writer.Write(Hash);
+            writer.Write(Length);
+            writer.Write(LastWriteTime);
+        }
+    }
+}
@@ -0,0 +1,190 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Diagnostics;
+using System.Diagnostics.ContractsLight;
+using System.Globalization;
+using System.Threading;
+using BuildXL.Utilities;
+using static BuildXL.Interop.Windows.Processor;
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// A machine-wide named event the detoured processes wait on before they start a child process (see
+    /// <see cref="FileAccessManifest.SetProcessAdmissionGate"/>); the Windows counterpart of the fork throttling of the macOS sandbox.
+    /// </summary>
+    /// <remarks>
+    /// The gate samples the commit charge and the CPU usage of the machine every <see cref="SampleIntervalMs"/>. It closes as soon as
+    /// either is above its threshold, and opens again once both are <see cref="WakeupMarginPercent"/> below it, so that admitting
+    /// the waiting processes does not close it right away. Keep this in sync with WaitForProcessAdmission in DetouredFunctions.cpp.
+    /// </remarks>
+    public sealed class ProcessAdmissionGate : IDisposable
+    {
+        /// <summary>
+        /// Default interval between two samples of the machine counters.
+        /// </summary>
+        public const int DefaultSampleIntervalMs = 500;
+
+        /// <summary>
+        /// How far below their thresholds both counters have to be for a closed gate to open again.
+        /// </summary>
+        public const int WakeupMarginPercent = 5;
+
+        private readonly EventWaitHandle m_gate;
+        private readonly Timer m_sampleTimer;
+        private readonly object m_sampleLock = new object();
+
+        private long m_lastIdleTime;
+        private long m_lastTotalTime;
+        private bool m_isOpen = true;
+        private bool m_disposed;
+
+        /// <summary>
+        /// Name of the event, to be passed to <see cref="FileAccessManifest.SetProcessAdmissionGate"/>.
+        /// </summary>
+        public string Name { get; }
+
+        /// <summary>
+        /// Name of the gate the scheduler of this BuildXL process creates when /processAdmissionThresholdPercent is set, which the
+        /// executors of its pips pass to their manifests.
+        /// </summary>
+        public static string NameForCurrentProcess { get; } = "BuildXL.ProcessAdmission." + Process.GetCurrentProcess().Id.ToString(CultureInfo.InvariantCulture);
+
+        /// <summary>
+        /// Commit charge, in percent of the commit limit, above which the gate closes.
+        /// </summary>
+        public int MaxCommitChargePercent { get; }
+
+        /// <summary>
+        /// CPU usage, in percent, above which the gate closes.
+        /// </summary>
+        public int MaxCpuPercent { get; }
+
+        /// <summary>
+        /// Interval between two samples of the machine counters.
+        /// </summary>
+        public int SampleIntervalMs { get; }
+
+        /// <summary>
+        /// Whether the gate currently admits processes.
+        /// </summary>
+        public bool IsOpen => Volatile.Read(ref m_isOpen);
+
+        /// <summary>
+        /// Number of times the gate closed.
+        /// </summary>
+        public long CloseCount { get; private set; }
+
+        /// <summary>
+        /// Creates the gate, open, and starts sampling the machine counters.
+        /// </summary>
+        public ProcessAdmissionGate(string name, int maxCommitChargePercent, int maxCpuPercent, int sampleIntervalMs = DefaultSampleIntervalMs)
+        {
+            Contract.Requires(!OperatingSystemHelper.IsUnixOS);
+            Contract.Requires(!string.IsNullOrEmpty(name));
+            Contract.Requires(maxCommitChargePercent > WakeupMarginPercent && maxCommitChargePercent <= 100);
+            Contract.Requires(maxCpuPercent > WakeupMarginPercent && maxCpuPercent <= 100);
+            Contract.Requires(sampleIntervalMs > 0);
+
+            Name = name;
+            MaxCommitChargePercent = maxCommitChargePercent;
+            MaxCpuPercent = maxCpuPercent;
+            SampleIntervalMs = sampleIntervalMs;
+
+            m_gate = new EventWaitHandle(initialState: true, EventResetMode.ManualReset, name);
+            m_gate.Set();
+
+            TryGetCpuTimes(out m_lastIdleTime, out m_lastTotalTime);
+            m_sampleTimer = new Timer(_ => Sample(), null, sampleIntervalMs, sampleIntervalMs);
+        }
+
+        private void Sample()
+        {
+            lock (m_sampleLock)
+            {
+                if (m_disposed)
+                {
+                    return;
+                }
+
+                int commitChargePercent = GetCommitChargePercent();
+                int cpuPercent = GetCpuPercent();
+
+                if (m_isOpen)
+                {
+                    if (commitChargePercent > MaxCommitChargePercent || cpuPercent > MaxCpuPercent)
+                    {
+                        m_gate.Reset();
+                        Volatile.Write(ref m_isOpen, false);
+                        CloseCount++;
+                    }
+                }
+                else if (commitChargePercent <= MaxCommitChargePercent - WakeupMarginPercent && cpuPercent <= MaxCpuPercent - WakeupMarginPercent)
+                {
+                    m_gate.Set();
+                    Volatile.Write(ref m_isOpen, true);
+                }
+            }
+        }
+
+        private static int GetCommitChargePercent()
+        {
+            PERFORMANCE_INFORMATION performanceInfo = PERFORMANCE_INFORMATION.CreatePerfInfo();
+            if (!GetPerformanceInfo(out performanceInfo, performanceInfo.cb) || performanceInfo.CommitLimit.ToInt64() == 0)
+            {
+                return 0;
+            }
+
+            return (int)(performanceInfo.CommitTotal.ToInt64() * 100 / performanceInfo.CommitLimit.ToInt64());
+        }
+
+        private int GetCpuPercent()
+        {
+            if (!TryGetCpuTimes(out long idleTime, out long totalTime))
+            {
+                return 0;
+            }
+
+            long idleDelta = idleTime - m_lastIdleTime;
+            long totalDelta = totalTime - m_lastTotalTime;
+            m_lastIdleTime = idleTime;
+            m_lastTotalTime = totalTime;
+
+            return totalDelta > 0 ? (int)((totalDelta - idleDelta) * 100 / totalDelta) : 0;
+        }
+
+        private static bool TryGetCpuTimes(out long idleTime, out long totalTime)
+        {
+            // The kernel time includes the idle time.
+            if (GetSystemTimes(out idleTime, out long kernelTime, out long userTime))
+            {
+                totalTime = kernelTime + userTime;
+                return true;
+            }
+
+            totalTime = 0;
+            return false;
+        }
+
+        /// <summary>
+        /// Stops sampling and leaves the gate open, so that no detoured process keeps waiting on it.
+        /// </summary>
+        public void Dispose()
+        {
+            lock (m_sampleLock)
+            {
+                if (m_disposed)
+                {
+                    return;
+                }
+
+                m_disposed = true;
+                m_sampleTimer.Dispose();
+                m_gate.Set();
+                m_gate.Dispose();
+            }
+        }
+    }
+}
@@ -41,6 +41,11 @@ namespace BuildXL.Processes
         /// </summary>
         Resumed = 5,
 
+        /// <summary>
+        /// Detouring failed transiently; the process creation is retried after a backoff.
+        /// </summary>
+        Retrying = 6,
+
         /// <summary>
         /// Cleanup started but failed to inject process
         /// </summary>
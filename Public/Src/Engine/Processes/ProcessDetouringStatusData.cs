@@ -70,6 +70,11 @@ namespace BuildXL.Processes
         /// </summary>
         public uint CreateProcessStatusReturn { get; private set; }
 
+        /// <summary>
+        /// Time spent in each step of creating the process; only reported with the last status of a process.
+        /// </summary>
+        public ProcessDetouringTimings Timings { get; private set; }
+
         /// <summary>
         /// Creates an instance of this class.
         /// </summary>
@@ -85,6 +90,7 @@ namespace BuildXL.Processes
         /// <param name="detoured">Whether the process was detoured.</param>
         /// <param name="error">The last error that this create process sets.</param>
         /// <param name="createProcessStatusReturn">The return status of the detoured CreateProcess function.</param>
+        /// <param name="timings">Time spent in each step of creating the process.</param>
         public ProcessDetouringStatusData(
             ulong processId,
             uint reportStatus,
@@ -97,7 +103,8 @@ namespace BuildXL.Processes
             uint creationFlags,
             bool detoured,
             uint error,
-            uint createProcessStatusReturn)
+            uint createProcessStatusReturn,
+            ProcessDetouringTimings timings = default)
         {
             ProcessId = processId;
             ReportStatus = reportStatus;
@@ -111,6 +118,7 @@ namespace BuildXL.Processes
             Detoured = detoured;
             Error = error;
             CreateProcessStatusReturn = createProcessStatusReturn;
+            Timings = timings;
         }
 
         /// <nodoc />
@@ -128,7 +136,8 @@ namespace BuildXL.Processes
                 creationFlags: reader.ReadUInt32(),
                 detoured: reader.ReadBoolean(),
                 error: reader.ReadUInt32(),
-                createProcessStatusReturn: reader.ReadUInt32());
+                createProcessStatusReturn: reader.ReadUInt32(),
+                timings: ProcessDetouringTimings.Deserialize(reader));
         }
 
         /// <nodoc />
@@ -146,6 +155,7 @@ namespace BuildXL.Processes
             writer.Write(Detoured);
             writer.Write(Error);
             writer.Write(CreateProcessStatusReturn);
+            Timings.Serialize(writer);
         }
     }
 }
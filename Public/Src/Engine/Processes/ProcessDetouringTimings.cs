@@ -0,0 +1,99 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System.Globalization;
+using BuildXL.Utilities;
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// Time (in microseconds) Detours spent in each step of creating a (nested) process, reported with the
+    /// <c>Done</c> detouring status. Steps that did not run are 0.
+    /// </summary>
+    /// <remarks>
+    /// Keep this in sync with ProcessDetouringTimings in DataTypes.h
+    /// </remarks>
+    public readonly struct ProcessDetouringTimings
+    {
+        /// <summary>
+        /// Building the attribute list of the process (only when BuildXL starts the process itself).
+        /// </summary>
+        public uint AttributesMicroseconds { get; }
+
+        /// <summary>
+        /// The call to CreateProcess, including its retries.
+        /// </summary>
+        public uint CreateProcessMicroseconds { get; }
+
+        /// <summary>
+        /// Injecting Detours and the payload into the process.
+        /// </summary>
+        public uint InjectionMicroseconds { get; }
+
+        /// <summary>
+        /// Assigning the process to its job and resuming it.
+        /// </summary>
+        public uint ResumeMicroseconds { get; }
+
+        /// <nodoc />
+        public ProcessDetouringTimings(uint attributesMicroseconds, uint createProcessMicroseconds, uint injectionMicroseconds, uint resumeMicroseconds)
+        {
+            AttributesMicroseconds = attributesMicroseconds;
+            CreateProcessMicroseconds = createProcessMicroseconds;
+            InjectionMicroseconds = injectionMicroseconds;
+            ResumeMicroseconds = resumeMicroseconds;
+        }
+
+        /// <summary>
+        /// Parses the "attributes;createProcess;injection;resume" field of a text process detouring status report.
+        /// </summary>
+        public static bool TryParse(string value, out ProcessDetouringTimings timings)
+        {
+            timings = default;
+            var items = value.Split(';');
+
+            if (items.Length == 4 &&
+                uint.TryParse(items[0], NumberStyles.None, CultureInfo.InvariantCulture, out uint attributes) &&
+                uint.TryParse(items[1], NumberStyles.None, CultureInfo.InvariantCulture, out uint createProcess) &&
+                uint.TryParse(items[2], NumberStyles.None, CultureInfo.InvariantCulture, out uint injection) &&
+                uint.TryParse(items[3], NumberStyles.None, CultureInfo.InvariantCulture, out uint resume))
+            {
+                timings = new ProcessDetouringTimings(attributes, createProcess, injection, resume);
+                return true;
+            }
+
+            return false;
+        }
+
+        /// <inheritdoc />
+        public override string ToString()
+        {
+            return string.Format(
+                CultureInfo.InvariantCulture,
+                "attributes: {0}us, createProcess: {1}us, injection: {2}us, resume: {3}us",
+                AttributesMicroseconds,
+                CreateProcessMicroseconds,
+                InjectionMicroseconds,
+                ResumeMicroseconds);
+        }
+
+        /// <nodoc />
+        public static ProcessDetouringTimings Deserialize(BuildXLReader reader)
+        {
+            return new ProcessDetouringTimings(
+                attributesMicroseconds: reader.ReadUInt32(),
+                createProcessMicroseconds: reader.ReadUInt32(),
+                injectionMicroseconds: reader.ReadUInt32(),
+                resumeMicroseconds: reader.ReadUInt32());
+        }
+
+        /// <nodoc />
+        public void Serialize(BuildXLWriter writer)
+        {
+            writer.Write(AttributesMicroseconds);
+            writer.Write(CreateProcessMicroseconds);
+            writer.Write(InjectionMicroseconds);
+            writer.Write(ResumeMicroseconds);
+        }
+    }
+}
@@ -40,9 +40,14 @@ namespace BuildXL.Processes
         /// </summary>
         ProcessDetouringStatus = 5,
 
+        /// <summary>
+        /// Report the content hash of an output computed while it was written.
+        /// </summary>
+        OutputContentHash = 6,
+
         /// <summary>
         /// This is a non-value, but places an upper-bound on the range of the enum
         /// </summary>
-        Max = 6,
+        Max = 7,
     }
 }
@@ -39,13 +39,35 @@ namespace BuildXL.Processes
             /// Callback to invoke in the case of an irrecoverable kernel extension error.
             /// </summary>
             public Sandbox.ManagedFailureCallback FailureCallback;
+
+            /// <summary>
+            /// When set, all received reports are captured into this file (see <see cref="Sandbox.ReplayFileAccessReports"/>).
+            /// </summary>
+            public string ReportCaptureFile;
+
+            /// <summary>
+            /// When greater than 0 (and a power of 2), the reports of each pip are put into a native ring of this many reports
+            /// (see <see cref="Sandbox.EnablePipReportRings"/>), which a thread dedicated to the pip drains.
+            /// </summary>
+            public uint PipReportRingCapacity;
+
+            /// <summary>
+            /// How long (in microseconds) the report listeners keep polling their queue after draining it before they block
+            /// (see <see cref="Sandbox.ConfigureReportListeners"/>); 0 to block right away.
+            /// </summary>
+            public uint ListenerSpinMicroseconds;
+
+            /// <summary>
+            /// QoS class (a <c>qos_class_t</c> value) of the report listener threads; 0 to leave it as it is.
+            /// </summary>
+            public uint ListenerQosClass;
         }
 
         /// <inheritdoc />
         public bool MeasureCpuTimes { get; }
 
         /// <inheritdoc />
-        public ulong MinReportQueueEnqueueTime => Volatile.Read(ref m_reportQueueLastEnqueueTime);
+        public ulong MinReportQueueEnqueueTime => (ulong)Volatile.Read(ref m_reportQueueLastEnqueueTime);
 
         /// <inheritdoc />
         public bool IsInTestMode { get; }
@@ -70,17 +92,31 @@ namespace BuildXL.Processes
         /// </summary>
         private const int MaxVersionNumberLength = 17;
 
+        /// <summary>
+        /// How long a thread draining the report ring of a pip waits for reports at once; the ring being dropped wakes it up anyway.
+        /// </summary>
+        private const int PipReportRingDrainTimeoutMs = 1000;
+
         private readonly ConcurrentDictionary<long, SandboxedProcessMacKext> m_pipProcesses = new ConcurrentDictionary<long, SandboxedProcessMacKext>();
 
+        /// <summary>
+        /// Whether the reports of each pip go to a report ring of its own (see <see cref="Config.PipReportRingCapacity"/>)
+        /// </summary>
+        private readonly bool m_usePipReportRings;
+
         private readonly Sandbox.KextConnectionInfo m_kextConnectionInfo;
-        private readonly Sandbox.KextSharedMemoryInfo m_sharedMemoryInfo;
         private readonly Sandbox.ManagedFailureCallback m_failureCallback;
-        private readonly Thread m_workerThread;
 
         /// <summary>
-        /// Enqueue time of the last received report (or 0 if no reports have been received)
+        /// One shared memory region and one worker thread per kernel extension report queue
         /// </summary>
-        private ulong m_reportQueueLastEnqueueTime;
+        private readonly Sandbox.KextSharedMemoryInfo[] m_sharedMemoryInfos;
+        private readonly Thread[] m_workerThreads;
+
+        /// <summary>
+        /// Latest enqueue time of the received reports across all report queues (or 0 if no reports have been received)
+        /// </summary>
+        private long m_reportQueueLastEnqueueTime;
 
         /// <summary>
         /// The time (in ticks) when the last report was received.
@@ -100,7 +136,16 @@ namespace BuildXL.Processes
         {
             m_reportQueueLastEnqueueTime = 0;
             m_kextConnectionInfo = new Sandbox.KextConnectionInfo() { Error = Sandbox.KextSuccess };
-            m_sharedMemoryInfo = new Sandbox.KextSharedMemoryInfo() { Error = Sandbox.KextSuccess };
+
+            // the kernel extension applies the same bounds; the priority queue, if any, comes after all others
+            var numReportQueues = Math.Max(1u, Math.Min(config?.KextConfig?.NumReportQueues ?? 1u, Sandbox.MaxReportQueues));
+            if (config?.KextConfig?.EnablePriorityReportQueue == true)
+            {
+                numReportQueues++;
+            }
+
+            m_sharedMemoryInfos = new Sandbox.KextSharedMemoryInfo[numReportQueues];
+            m_workerThreads = new Thread[numReportQueues];
 
             MeasureCpuTimes = config.MeasureCpuTimes;
             IsInTestMode = skipDisposingForTests;
@@ -146,11 +191,31 @@ namespace BuildXL.Processes
 
             m_failureCallback = config?.FailureCallback;
 
-            // Initialize the shared memory region
-            Sandbox.InitializeKextSharedMemory(m_kextConnectionInfo, ref m_sharedMemoryInfo);
-            if (m_sharedMemoryInfo.Error != Sandbox.KextSuccess)
+            if (!string.IsNullOrEmpty(config?.ReportCaptureFile) && !Sandbox.StartReportCapture(config.ReportCaptureFile))
+            {
+                throw new BuildXLException($"Unable to capture sandbox kernel extension reports into '{config.ReportCaptureFile}'");
+            }
+
+            var pipReportRingCapacity = config?.PipReportRingCapacity ?? 0;
+            if (pipReportRingCapacity > 0)
+            {
+                if (!Sandbox.EnablePipReportRings(pipReportRingCapacity, Marshal.SizeOf<Sandbox.AccessReport>()))
+                {
+                    throw new BuildXLException($"Unable to use report rings of {pipReportRingCapacity} reports per pip (the capacity must be a power of 2)");
+                }
+
+                m_usePipReportRings = true;
+            }
+
+            // Initialize the shared memory regions; the first one must be initialized first because it attaches this client
+            for (uint i = 0; i < m_sharedMemoryInfos.Length; i++)
             {
-                throw new BuildXLException($"Unable to allocate shared memory region for worker (Code:{m_sharedMemoryInfo.Error})");
+                m_sharedMemoryInfos[i] = new Sandbox.KextSharedMemoryInfo() { Error = Sandbox.KextSuccess, QueueIndex = i };
+                Sandbox.InitializeKextSharedMemory(m_kextConnectionInfo, ref m_sharedMemoryInfos[i]);
+                if (m_sharedMemoryInfos[i].Error != Sandbox.KextSuccess)
+                {
+                    throw new BuildXLException($"Unable to allocate shared memory region {i} for worker (Code:{m_sharedMemoryInfos[i].Error})");
+                }
             }
 
             if (!SetFailureNotificationHandler())
@@ -158,10 +223,16 @@ namespace BuildXL.Processes
                 throw new BuildXLException($"Unable to set sandbox kernel extension failure notification callback handler");
             }
 
-            m_workerThread = new Thread(() => StartReceivingAccessReports(m_sharedMemoryInfo.Address, m_sharedMemoryInfo.Port));
-            m_workerThread.IsBackground = true;
-            m_workerThread.Priority = ThreadPriority.Highest;
-            m_workerThread.Start();
+            Sandbox.ConfigureReportListeners(config?.ListenerSpinMicroseconds ?? 0, config?.ListenerQosClass ?? 0);
+
+            for (int i = 0; i < m_workerThreads.Length; i++)
+            {
+                var memoryInfo = m_sharedMemoryInfos[i];
+                m_workerThreads[i] = new Thread(() => StartReceivingAccessReports(memoryInfo.Address, memoryInfo.Port));
+                m_workerThreads[i].IsBackground = true;
+                m_workerThreads[i].Priority = ThreadPriority.Highest;
+                m_workerThreads[i].Start();
+            }
 
             unsafe bool SetFailureNotificationHandler()
             {
@@ -190,11 +261,20 @@ namespace BuildXL.Processes
         /// </summary>
         public void ReleaseResources()
         {
-            Sandbox.DeinitializeKextSharedMemory(m_sharedMemoryInfo, m_kextConnectionInfo);
+            Sandbox.StopResourceSampler();
 
-            m_workerThread.Join();
+            foreach (var memoryInfo in m_sharedMemoryInfos)
+            {
+                Sandbox.DeinitializeKextSharedMemory(memoryInfo, m_kextConnectionInfo);
+            }
+
+            foreach (var workerThread in m_workerThreads)
+            {
+                workerThread?.Join();
+            }
 
             Sandbox.DeinitializeKextConnection(m_kextConnectionInfo);
+            Sandbox.StopReportCapture();
         }
 
         /// <summary>
@@ -202,7 +282,7 @@ namespace BuildXL.Processes
         /// </summary>
         private void StartReceivingAccessReports(ulong address, uint port)
         {
-            Sandbox.AccessReportCallback callback = (Sandbox.AccessReport report, int code) =>
+            Sandbox.AccessReportBatchCallback callback = (Sandbox.AccessReport[] reports, int count, int code) =>
             {
                 if (code != Sandbox.ReportQueueSuccessCode)
                 {
@@ -210,29 +290,84 @@ namespace BuildXL.Processes
                     throw new BuildXLException(message, ExceptionRootCause.MissingRuntimeDependency);
                 }
 
-                // Update last received timestamp
-                Volatile.Write(ref m_lastReportReceivedTimestampTicks, DateTime.UtcNow.Ticks);
+                for (int i = 0; i < count; i++)
+                {
+                    ProcessAccessReport(reports[i]);
+                }
+            };
 
-                // Remember the latest enqueue time
-                Volatile.Write(ref m_reportQueueLastEnqueueTime, report.Statistics.EnqueueTime);
+            Sandbox.ListenForFileAccessReportsBatched(callback, Sandbox.AccessReportBatchSize, Marshal.SizeOf<Sandbox.AccessReport>(), address, port);
 
+            void ProcessAccessReport(Sandbox.AccessReport report)
+            {
                 // The only way it can happen that no process is found for 'report.PipId' is when that pip is
                 // explicitly terminated (e.g., because it timed out or Ctrl-c was pressed)
-                if (m_pipProcesses.TryGetValue(report.PipId, out var process))
+                m_pipProcesses.TryGetValue(report.PipId, out var process);
+                DeliverAccessReport(report, process);
+            }
+        }
+
+        /// <summary>
+        /// Starts draining the report ring of a pip (see <see cref="Config.PipReportRingCapacity"/>) on a dedicated thread,
+        /// which ends once the ring is dropped by <see cref="NotifyKextProcessFinished"/>.
+        /// </summary>
+        private void StartDrainingPipReportRing(long pipId, SandboxedProcessMacKext process)
+        {
+            var drainThread = new Thread(() =>
+            {
+                var buffer = new Sandbox.AccessReport[Sandbox.AccessReportBatchSize];
+                int count;
+                while ((count = Sandbox.DrainPipReports(pipId, buffer, buffer.Length, PipReportRingDrainTimeoutMs)) >= 0)
                 {
-                    // if the process is found, its ProcessId must match the RootPid of the report.
-                    if (process.ProcessId != report.RootPid)
-                    {
-                        m_failureCallback?.Invoke(-1, $"Unexpected PID for Pip {report.PipId:X}: Expected {process.ProcessId}, Reported {report.RootPid}");
-                    }
-                    else
+                    for (int i = 0; i < count; i++)
                     {
-                        process.PostAccessReport(report);
+                        DeliverAccessReport(buffer[i], process);
                     }
                 }
-            };
+            });
+
+            drainThread.IsBackground = true;
+            drainThread.Priority = ThreadPriority.Highest;
+            drainThread.Start();
+        }
+
+        private void DeliverAccessReport(Sandbox.AccessReport report, SandboxedProcessMacKext process)
+        {
+            // Update last received timestamp
+            Volatile.Write(ref m_lastReportReceivedTimestampTicks, DateTime.UtcNow.Ticks);
+
+            // Remember the latest enqueue time (other queues may have received later reports already)
+            UpdateLastEnqueueTime(report.Statistics.EnqueueTime);
+
+            if (process == null)
+            {
+                return;
+            }
+
+            // the ProcessId of the process of the pip must match the RootPid of the report.
+            if (process.ProcessId != report.RootPid)
+            {
+                m_failureCallback?.Invoke(-1, $"Unexpected PID for Pip {report.PipId:X}: Expected {process.ProcessId}, Reported {report.RootPid}");
+            }
+            else
+            {
+                process.PostAccessReport(report);
+            }
+        }
+
+        private void UpdateLastEnqueueTime(ulong enqueueTime)
+        {
+            long current = Volatile.Read(ref m_reportQueueLastEnqueueTime);
+            while ((ulong)current < enqueueTime)
+            {
+                long previous = Interlocked.CompareExchange(ref m_reportQueueLastEnqueueTime, (long)enqueueTime, current);
+                if (previous == current)
+                {
+                    break;
+                }
 
-            Sandbox.ListenForFileAccessReports(callback, Marshal.SizeOf<Sandbox.AccessReport>(), address, port);
+                current = previous;
+            }
         }
 
         /// <inheritdoc />
@@ -241,6 +376,12 @@ namespace BuildXL.Processes
             return Sandbox.UpdateCurrentResourceUsage(cpuUsage, availableRamMB, m_kextConnectionInfo);
         }
 
+        /// <inheritdoc />
+        public bool StartResourceSampler(uint intervalMs)
+        {
+            return Sandbox.StartResourceSampler(intervalMs, m_kextConnectionInfo);
+        }
+
         /// <inheritdoc />
         public bool NotifyKextPipStarted(FileAccessManifest fam, SandboxedProcessMacKext process)
         {
@@ -277,6 +418,12 @@ namespace BuildXL.Processes
                     famBytesLength: manifestBytes.Count,
                     info: m_kextConnectionInfo);
 
+                // the interop registered the ring of the pip along with it
+                if (result && m_usePipReportRings)
+                {
+                    StartDrainingPipReportRing(fam.PipId, process);
+                }
+
                 return result;
             }
         }
@@ -290,6 +437,11 @@ namespace BuildXL.Processes
         /// <inheritdoc />
         public bool NotifyKextProcessFinished(long pipId, SandboxedProcessMacKext process)
         {
+            if (m_usePipReportRings)
+            {
+                Sandbox.UnregisterPipReportRing(pipId);
+            }
+
             if (m_pipProcesses.TryRemove(pipId, out var proc))
             {
                 Contract.Assert(process == proc);
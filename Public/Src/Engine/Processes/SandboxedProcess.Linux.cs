@@ -0,0 +1,486 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Generic;
+using System.ComponentModel;
+using System.Diagnostics.ContractsLight;
+using System.IO;
+using System.Linq;
+using System.Reflection;
+using System.Runtime.InteropServices;
+using System.Threading;
+using System.Threading.Tasks;
+using System.Threading.Tasks.Dataflow;
+using BuildXL.Interop.MacOS;
+using BuildXL.Native.IO;
+using BuildXL.Processes.Internal;
+using BuildXL.Utilities;
+using BuildXL.Utilities.Tasks;
+using static BuildXL.Interop.MacOS.IO;
+using static BuildXL.Interop.MacOS.Sandbox;
+using static BuildXL.Processes.SandboxedProcessFactory;
+using static BuildXL.Utilities.FormattableStringEx;
+
+namespace BuildXL.Processes
+{
+    /// <summary>
+    /// Implementation of <see cref="ISandboxedProcess"/> that relies on the Linux sandbox: a library (libBxlLinuxSandbox.so) that
+    /// the processes of the pip load through LD_PRELOAD, and that checks and reports their file accesses the way the kernel
+    /// extension does on macOS (see <see cref="SandboxedProcessMacKext"/>).
+    /// </summary>
+    /// <remarks>
+    /// The library reads the manifest from the file named by its environment, and writes its reports to a FIFO, which
+    /// <see cref="LinuxReportReader"/> reads them from. Statically linked tools do not load it, so their accesses are not reported.
+    ///
+    /// With <see cref="SandboxKind.LinuxEbpf"/>, the pip runs under the eBPF observer instead (bxl-ebpf-runner), which sends the
+    /// same reports to the same FIFO, for all the processes of the pip, but cannot deny any access.
+    /// </remarks>
+    public sealed class SandboxedProcessLinux : UnSandboxedProcess
+    {
+        /// <summary>
+        /// File name of the sandbox library, which gets deployed next to this assembly.
+        /// </summary>
+        public const string SandboxLibraryName = "libBxlLinuxSandbox.so";
+
+        /// <summary>
+        /// File names of the runner and of the BPF program of the eBPF observer, which get deployed next to this assembly when built.
+        /// </summary>
+        public const string EbpfRunnerName = "bxl-ebpf-runner";
+
+        /// <nodoc />
+        public const string EbpfProgramName = "BxlObserver.bpf.o";
+
+        // CODESYNC: BxlEnvFamPath and BxlEnvLdPreload in Public/Src/Sandbox/Linux/BxlObserver.hpp
+        private const string FamPathEnvironmentVariable = "__BUILDXL_FAM_PATH";
+        private const string LdPreloadEnvironmentVariable = "LD_PRELOAD";
+
+        private static readonly string s_binDirectory =
+            Path.GetDirectoryName(AssemblyHelper.GetAssemblyLocation(typeof(SandboxedProcessLinux).GetTypeInfo().Assembly));
+
+        private static readonly string s_sandboxLibraryPath = Path.Combine(s_binDirectory, SandboxLibraryName);
+        private static readonly string s_ebpfRunnerPath = Path.Combine(s_binDirectory, EbpfRunnerName);
+        private static readonly string s_ebpfProgramPath = Path.Combine(s_binDirectory, EbpfProgramName);
+
+        private readonly SandboxedProcessReports m_reports;
+
+        private readonly ActionBlock<AccessReport> m_pendingReports;
+
+        private LinuxReportReader m_reportReader;
+
+        /// <summary>
+        /// Directory of the manifest and of the report FIFO of the pip.
+        /// </summary>
+        private string m_sandboxDirectory;
+
+        private IEnumerable<ReportedProcess> m_survivingChildProcesses;
+
+        private long m_processKilledFlag = 0;
+
+        private volatile bool m_hasSandboxFailures = false;
+
+        /// <summary>
+        /// Completes once the exit of the root process has been handled, i.e., once the processes still running are known.
+        /// </summary>
+        private readonly TaskCompletionSource<Unit> m_rootProcessExitHandled = new TaskCompletionSource<Unit>();
+
+        private TimeSpan ChildProcessTimeout => ProcessInfo.NestedProcessTerminationTimeout;
+
+        /// <summary>
+        /// Allowed surviving child process names.
+        /// </summary>
+        private string[] AllowedSurvivingChildProcessNames => ProcessInfo.AllowedSurvivingChildProcessNames;
+
+        private bool IgnoreReportedAccesses { get; }
+
+        /// <summary>
+        /// Whether the pip runs under the eBPF observer rather than with the sandbox library LD_PRELOAD'ed.
+        /// </summary>
+        private bool UseEbpfObserver { get; }
+
+        /// <nodoc />
+        public SandboxedProcessLinux(SandboxedProcessInfo info, bool ignoreReportedAccesses = false, bool useEbpfObserver = false)
+            : base(info)
+        {
+            Contract.Requires(info.FileAccessManifest != null);
+
+            IgnoreReportedAccesses = ignoreReportedAccesses;
+            UseEbpfObserver = useEbpfObserver;
+
+            m_reports = new SandboxedProcessReports(
+                info.FileAccessManifest,
+                info.PathTable,
+                info.PipSemiStableHash,
+                info.PipDescription,
+                info.LoggingContext,
+                info.DetoursEventListener);
+
+            m_pendingReports = new ActionBlock<AccessReport>(
+                HandleReport,
+                new ExecutionDataflowBlockOptions
+                {
+#if FEATURE_CORECLR
+                    EnsureOrdered = true,
+#endif
+                    BoundedCapacity = DataflowBlockOptions.Unbounded,
+                    MaxDegreeOfParallelism = 1, // Must be one, otherwise SandboxedPipExecutor will fail asserting valid reports
+                });
+        }
+
+        /// <inheritdoc />
+        protected override bool HasSandboxFailures => m_hasSandboxFailures;
+
+        /// <inheritdoc />
+        protected override bool Killed => Interlocked.Read(ref m_processKilledFlag) > 0;
+
+        /// <inheritdoc />
+        public override void Start()
+        {
+            Contract.Requires(!Started, "Process was already started.  Cannot start process more than once.");
+
+            foreach (var path in UseEbpfObserver ? new[] { s_ebpfRunnerPath, s_ebpfProgramPath } : new[] { s_sandboxLibraryPath })
+            {
+                if (!File.Exists(path))
+                {
+                    throw new BuildXLException(
+                        "Cannot find file needed to sandbox processes. Did you build all configurations? " + path,
+                        rootCause: ExceptionRootCause.MissingRuntimeDependency);
+                }
+            }
+
+            CreateAndSetUpProcess();
+
+            m_sandboxDirectory = Path.Combine(Path.GetTempPath(), I($"bxl_{ProcessInfo.PipSemiStableHash:X16}_{Guid.NewGuid():N}"));
+            Directory.CreateDirectory(m_sandboxDirectory);
+
+            string fifoPath = Path.Combine(m_sandboxDirectory, "reports.fifo");
+            if (mkfifo(fifoPath, FilePermissions.S_IRUSR | FilePermissions.S_IWUSR) != 0)
+            {
+                ThrowCouldNotStartProcess(I($"failed to create the report FIFO '{fifoPath}'"), new Win32Exception(Marshal.GetLastWin32Error()));
+            }
+
+            string famPath = Path.Combine(m_sandboxDirectory, "manifest.fam");
+            WriteManifest(famPath, fifoPath);
+
+            var startInfo = Process.StartInfo;
+            startInfo.EnvironmentVariables[FamPathEnvironmentVariable] = famPath;
+            if (UseEbpfObserver)
+            {
+                // The runner starts the tool in a cgroup of its own under the one of BuildXL, which the BPF program observes.
+                string cgroup = GetCgroupDirectory();
+                if (cgroup == null)
+                {
+                    ThrowCouldNotStartProcess("the eBPF observer needs cgroup v2, which BuildXL does not run in");
+                }
+
+                startInfo.Arguments = string.Join(" ", new[] { s_ebpfProgramPath, cgroup, startInfo.FileName }.Select(CommandLineEscaping.EscapeAsCommandLineWord))
+                    + " " + startInfo.Arguments;
+                startInfo.FileName = s_ebpfRunnerPath;
+            }
+            else
+            {
+                // The library passes these on to the child processes, even to those started with an environment of their own.
+                string ldPreload = startInfo.EnvironmentVariables[LdPreloadEnvironmentVariable];
+                startInfo.EnvironmentVariables[LdPreloadEnvironmentVariable] = string.IsNullOrEmpty(ldPreload)
+                    ? s_sandboxLibraryPath
+                    : s_sandboxLibraryPath + ":" + ldPreload;
+            }
+
+            // The library reports the start of each process (including the root one) before anything else it does.
+            m_reportReader = LinuxReportReader.Start(fifoPath, report => m_pendingReports.Post(report), ReportReadError);
+            m_reportReader.Completion.ContinueWith(_ => m_pendingReports.Complete(), TaskContinuationOptions.ExecuteSynchronously);
+
+            StartProcess();
+            SetProcessStartedExecuting();
+        }
+
+        private void WriteManifest(string famPath, string fifoPath)
+        {
+            var setup = new FileAccessSetup
+            {
+                DllNameX64 = string.Empty,
+                DllNameX86 = string.Empty,
+                ReportPath = fifoPath,
+            };
+
+            using (var wrapper = Pools.MemoryStreamPool.GetInstance())
+            {
+                var debugFlagsMatch = true;
+                ArraySegment<byte> manifestBytes = ProcessInfo.FileAccessManifest.GetPayloadBytes(
+                    setup,
+                    wrapper.Instance,
+                    timeoutMins: 10, // don't care because on Linux the sandbox does not kill the process once it times out
+                    debugFlagsMatch: ref debugFlagsMatch);
+
+                if (!debugFlagsMatch)
+                {
+                    ThrowCouldNotStartProcess("Mismatching build type for BuildXL and " + SandboxLibraryName);
+                }
+
+                using (var stream = new FileStream(famPath, FileMode.CreateNew, FileAccess.Write))
+                {
+                    stream.Write(manifestBytes.Array, manifestBytes.Offset, manifestBytes.Count);
+                }
+            }
+        }
+
+        /// <summary>
+        /// The directory of the cgroup (v2) of this process, or null if it is not in one.
+        /// </summary>
+        private static string GetCgroupDirectory()
+        {
+            // with cgroup v2 the only line there is "0::<path of the cgroup>"
+            const string Prefix = "0::";
+            string line = File.ReadLines("/proc/self/cgroup").FirstOrDefault(l => l.StartsWith(Prefix, StringComparison.Ordinal));
+            return line == null ? null : "/sys/fs/cgroup" + line.Substring(Prefix.Length);
+        }
+
+        /// <inheritdoc />
+        public override async Task KillAsync()
+        {
+            // Make sure this is done no more than once, and that no more reports get handled from then on.
+            if (Interlocked.Increment(ref m_processKilledFlag) == 1)
+            {
+                m_pendingReports.Complete();
+                KillAllChildProcesses();
+                await base.KillAsync();
+            }
+        }
+
+        /// <inheritdoc />
+        protected override IEnumerable<ReportedProcess> GetSurvivingChildProcesses() => m_survivingChildProcesses;
+
+        /// <summary>
+        /// Waits (up to <see cref="SandboxedProcessInfo.NestedProcessTerminationTimeout"/>) for the child processes that outlive the root
+        /// process to exit, kills the ones that are still running then, and returns the collected reports once they have all been handled.
+        /// </summary>
+        internal override async Task<SandboxedProcessReports> GetReportsAsync()
+        {
+            // The root process has exited: from now on, the reader gets to the end of the reports once its child processes exit too.
+            m_reportReader?.ReleaseWriteEnd();
+
+            if (!Killed && m_reportReader != null && !m_reportReader.Completion.IsCompleted)
+            {
+                // some child processes are still running: find out which ones, and wait for them unless they are all allowed to survive
+                var completion = m_reportReader.Completion;
+                await Task.WhenAny(completion, m_rootProcessExitHandled.Task, Task.Delay(ChildProcessTimeout));
+
+                var timeout = ShouldWaitForSurvivingChildProcesses() ? ChildProcessTimeout : TimeSpan.Zero;
+                if (await Task.WhenAny(completion, Task.Delay(timeout)) != completion)
+                {
+                    LogProcessState("Process timed out because nested process termination timeout limit was reached.");
+                    await KillAsync();
+                }
+            }
+
+            // in any case must wait for pending reports to complete, because we must not freeze m_reports before that happens
+            await m_pendingReports.Completion;
+
+            return IgnoreReportedAccesses ? null : m_reports;
+        }
+
+        /// <inheritdoc />
+        public override void Dispose()
+        {
+            if (!Killed && Started)
+            {
+                // Try to kill all processes once the parent gets disposed, so we clean up all used
+                // system resources appropriately
+                KillAllChildProcesses();
+            }
+
+            m_reportReader?.Dispose();
+            if (m_sandboxDirectory != null)
+            {
+                try
+                {
+                    FileUtilities.DeleteDirectoryContents(m_sandboxDirectory, deleteRootDirectory: true);
+                }
+                catch (BuildXLException e)
+                {
+                    LogProcessState($"Could not delete the sandbox directory '{m_sandboxDirectory}': {e.Message}");
+                }
+            }
+
+            base.Dispose();
+        }
+
+        /// <nodoc />
+        protected override bool ReportsCompleted() => m_pendingReports.Completion.IsCompleted;
+
+        private void KillAllChildProcesses()
+        {
+            m_survivingChildProcesses = CoalesceProcesses(m_reports.GetCurrentlyActiveProcesses());
+            foreach (var processId in new HashSet<uint>(m_survivingChildProcesses.Select(p => p.ProcessId)))
+            {
+                if (processId == ProcessId)
+                {
+                    continue;
+                }
+
+                try
+                {
+                    System.Diagnostics.Process.GetProcessById((int)processId).Kill();
+                }
+                catch (Exception e) when (e is ArgumentException || e is InvalidOperationException || e is Win32Exception)
+                {
+                    // the process has exited in the meantime
+                }
+            }
+        }
+
+        private bool ShouldWaitForSurvivingChildProcesses()
+        {
+            // Wait for surviving child processes if no allowable process names are explicitly specified.
+            if (AllowedSurvivingChildProcessNames == null || AllowedSurvivingChildProcessNames.Length == 0)
+            {
+                return true;
+            }
+
+            // Otherwise, wait if there are any alive processes that are not explicitly allowed to survive
+            return CoalesceProcesses(m_reports.GetCurrentlyActiveProcesses())
+                .Select(p => Path.GetFileName(p.Path))
+                .Except(AllowedSurvivingChildProcessNames)
+                .Any();
+        }
+
+        private void ReportReadError(string message)
+        {
+            m_hasSandboxFailures = true;
+            LogProcessState(message);
+        }
+
+        private void HandleReport(AccessReport report)
+        {
+            if (ProcessInfo.FileAccessManifest.ReportFileAccesses)
+            {
+                LogProcessState("Linux sandbox report received: " + AccessReportToString(report));
+            }
+
+            Counters.IncrementCounter(SandboxedProcessCounters.AccessReportCount);
+            using (Counters.StartStopwatch(SandboxedProcessCounters.HandleAccessReportDuration))
+            {
+                // the sandbox only reports a lookup when the path does not exist (it reports the access that follows otherwise),
+                // and BuildXL expects a 'Probe' for those
+                if (report.Operation == FileOperation.OpMacLookup)
+                {
+                    report.RequestedAccess = (uint)RequestedAccess.Probe;
+                    report.Error = ReportedFileAccess.ERROR_PATH_NOT_FOUND;
+                }
+                else
+                {
+                    // errno values mean nothing to BuildXL, which only checks them for path existence
+                    report.Error = 0;
+
+                    // directory renames: report the files in the renamed directory as writes (see SandboxedProcessMacKext)
+                    if (report.Operation == FileOperation.OpKAuthMoveDest &&
+                        report.Status == (uint)FileAccessStatus.Allowed &&
+                        FileUtilities.DirectoryExistsNoFollow(report.Path))
+                    {
+                        FileUtilities.EnumerateFiles(
+                            directoryPath: report.Path,
+                            recursive: true,
+                            pattern: "*",
+                            (dir, fileName, attrs, length) =>
+                            {
+                                AccessReport reportClone = report;
+                                reportClone.Operation = FileOperation.OpKAuthWriteFile;
+                                reportClone.Path = Path.Combine(dir, fileName);
+                                ReportFileAccess(ref reportClone);
+                            });
+                    }
+                }
+
+                ReportFileAccess(ref report);
+
+                if (report.Operation == FileOperation.OpProcessExit && report.Pid == ProcessId)
+                {
+                    m_rootProcessExitHandled.TrySetResult(Unit.Void);
+                }
+            }
+        }
+
+        private void ReportFileAccess(ref AccessReport report)
+        {
+            if (Killed)
+            {
+                return;
+            }
+
+            if (IgnoreReportedAccesses &&
+                report.Operation != FileOperation.OpProcessStart &&
+                report.Operation != FileOperation.OpProcessExit)
+            {
+                return;
+            }
+
+            m_reports.ReportFileAccess(ref report, ReportProvider);
+        }
+
+        private static readonly int s_maxFileAccessStatus = Enum.GetValues(typeof(FileAccessStatus)).Cast<FileAccessStatus>().Max(e => (int)e);
+        private static readonly int s_maxRequestedAccess = Enum.GetValues(typeof(RequestedAccess)).Cast<RequestedAccess>().Max(e => (int)e);
+
+        private bool ReportProvider(
+            ref AccessReport report, out uint processId, out ReportedFileOperation operation, out RequestedAccess requestedAccess, out FileAccessStatus status,
+            out bool explicitlyReported, out uint error, out Usn usn, out DesiredAccess desiredAccess, out ShareMode shareMode, out CreationDisposition creationDisposition,
+            out FlagsAndAttributes flagsAndAttributes, out AbsolutePath manifestPath, out string path, out string enumeratePattern, out string processArgs, out string errorMessage)
+        {
+            var errorMessages = new List<string>();
+            checked
+            {
+                processId = (uint)report.Pid;
+
+                if (!SandboxedProcessReports.FileAccessReportLine.Operations.TryGetValue(report.DecodeOperation(), out operation))
+                {
+                    errorMessages.Add($"Unknown operation '{report.DecodeOperation()}'");
+                }
+
+                requestedAccess = (RequestedAccess)report.RequestedAccess;
+                if (report.RequestedAccess > s_maxRequestedAccess)
+                {
+                    errorMessages.Add($"Illegal value for 'RequestedAccess': {requestedAccess}; maximum allowed: {(int)RequestedAccess.All}");
+                }
+
+                status = (FileAccessStatus)report.Status;
+                if (report.Status > s_maxFileAccessStatus)
+                {
+                    errorMessages.Add($"Illegal value for 'Status': {status}");
+                }
+
+                bool isWrite = (report.RequestedAccess & (byte)RequestedAccess.Write) != 0;
+
+                explicitlyReported  = report.ExplicitLogging > 0;
+                error               = report.Error;
+                usn                 = ReportedFileAccess.NoUsn;
+                desiredAccess       = isWrite ? DesiredAccess.GENERIC_WRITE : DesiredAccess.GENERIC_READ;
+                shareMode           = ShareMode.FILE_SHARE_READ;
+                creationDisposition = CreationDisposition.OPEN_ALWAYS;
+                flagsAndAttributes  = 0;
+                path                = report.Path;
+                enumeratePattern    = string.Empty;
+                processArgs         = string.Empty;
+
+                AbsolutePath.TryCreate(PathTable, path, out manifestPath);
+
+                errorMessage = errorMessages.Any()
+                    ? $"Illegal access report: '{AccessReportToString(report)}' :: {string.Join(";", errorMessages)}"
+                    : string.Empty;
+
+                return errorMessage == string.Empty;
+            }
+        }
+
+        private static string AccessReportToString(AccessReport report)
+        {
+            var operation       = report.DecodeOperation();
+            var pid             = report.Pid.ToString("X");
+            var requestedAccess = report.RequestedAccess;
+            var status          = report.Status;
+            var explicitLogging = report.ExplicitLogging != 0 ? 1 : 0;
+            var error           = report.Error;
+            var path            = report.Path;
+
+            return I($"{operation}:{pid}|{requestedAccess}|{status}|{explicitLogging}|{error}|{path}");
+        }
+    }
+}
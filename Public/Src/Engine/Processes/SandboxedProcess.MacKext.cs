@@ -55,6 +55,15 @@ namespace BuildXL.Processes
 
         private bool HasProcessExitBeenReceived => m_processExitTimeNs != ulong.MaxValue;
 
+        /// <summary>
+        /// Reports received so far that the kernel extension sends through its priority queue when that is enabled
+        /// (see <see cref="Sandbox.KextConfig.EnablePriorityReportQueue"/>), and how many of them the process tree completion
+        /// said to expect (-1 until it has been received).  These can arrive after the process tree completion, so the
+        /// reports are only completed once both are in.
+        /// </summary>
+        private long m_numPriorityReportsReceived = 0;
+        private long m_numPriorityReportsExpected = -1;
+
         private readonly CancellationTokenSource m_timeoutTaskCancelationSource = new CancellationTokenSource();
 
         private IKextConnection KextConnection => ProcessInfo.SandboxedKextConnection;
@@ -140,6 +149,20 @@ namespace BuildXL.Processes
             Process.BeginOutputReadLine();
             Process.BeginErrorReadLine();
 
+            // The kernel extension cannot set the priority of the processes it tracks, but forked processes inherit the one of their
+            // parent, so the shell gets it before it starts the tool (see FileAccessManifest.PriorityClass).
+            if (ProcessInfo.FileAccessManifest.PriorityClass.HasValue)
+            {
+                try
+                {
+                    Process.PriorityClass = ProcessInfo.FileAccessManifest.PriorityClass.Value;
+                }
+                catch (System.ComponentModel.Win32Exception e)
+                {
+                    LogProcessState($"Could not set the priority class of the process: {e.Message}");
+                }
+            }
+
             // Generate "Process Created" report because the rest of the system expects to see it before any other file access reports
             //
             // IMPORTANT: do this before notifying sandbox kernel extension, because otherwise it can happen that a report
@@ -481,6 +504,33 @@ namespace BuildXL.Processes
         }
 
         private void HandleKextReport(AccessReport report)
+        {
+            if (report.Operation == FileOperation.OpProcessTreeCompleted)
+            {
+                // without a priority queue the kernel extension leaves this at 0
+                m_numPriorityReportsExpected = report.RequestedAccess;
+            }
+            else if (IsPriorityReport(report))
+            {
+                m_numPriorityReportsReceived++;
+            }
+
+            HandleKextReportCore(report);
+
+            if (m_numPriorityReportsExpected >= 0 && m_numPriorityReportsReceived >= m_numPriorityReportsExpected)
+            {
+                m_pendingReports.Complete();
+            }
+        }
+
+        private static bool IsPriorityReport(AccessReport report)
+        {
+            return report.Operation == FileOperation.OpProcessStart
+                || report.Operation == FileOperation.OpProcessExit
+                || report.Status == (uint)FileAccessStatus.Denied;
+        }
+
+        private void HandleKextReportCore(AccessReport report)
         {
             if (ProcessInfo.FileAccessManifest.ReportFileAccesses)
             {
@@ -549,11 +599,7 @@ namespace BuildXL.Processes
                     report.Error = ReportedFileAccess.ERROR_PATH_NOT_FOUND;
                 }
 
-                if (report.Operation == FileOperation.OpProcessTreeCompleted)
-                {
-                    m_pendingReports.Complete();
-                }
-                else
+                if (report.Operation != FileOperation.OpProcessTreeCompleted)
                 {
                     ReportFileAccess(ref report);
                 }
@@ -5,6 +5,7 @@ using System;
 using System.Collections.Generic;
 using System.Diagnostics.CodeAnalysis;
 using System.Diagnostics.ContractsLight;
+using System.Globalization;
 using System.IO;
 using System.Linq;
 using System.Runtime.InteropServices;
@@ -30,7 +31,7 @@ namespace BuildXL.Processes
     /// <summary>
     /// A process abstraction for BuildXL that can monitor environment interactions, in particular file accesses, that ensures
     /// that all file accesses are on a white-list.
-    /// Under the hood, the sandboxed process uses Detours.
+    /// Under the hood, the sandboxed process uses Detours, or the BuildXL minifilter (see <see cref="MinifilterConnection"/>).
     /// </summary>
     /// <remarks>
     /// All public static and instance methods of this class are thread safe.
@@ -61,6 +62,11 @@ namespace BuildXL.Processes
         private SandboxedProcessOutputBuilder m_output;
         private SandboxedProcessReports m_reports;
         private AsyncPipeReader m_reportReader;
+        // Readers of the report channels other than the report pipe, if any (see FileAccessManifest.ReportChannelCount).
+        private AsyncPipeReader[] m_reportChannelReaders;
+        private readonly object m_reportChannelLock = new object();
+        // Reader of the report ring (see FileAccessManifest.UseReportRingBuffer), if any.
+        private ReportRingReader m_reportRingReader;
         private readonly SemaphoreSlim m_reportReaderSemaphore = TaskUtilities.CreateMutex();
         private Dictionary<uint, ReportedProcess> m_survivingChildProcesses;
         private readonly uint m_timeoutMins;
@@ -68,12 +74,20 @@ namespace BuildXL.Processes
         private TaskSourceSlim<bool> m_standardInputTcs;
         private readonly PathTable m_pathTable;
         private readonly string[] m_allowedSurvivingChildProcessNames;
+        private readonly Func<AbsolutePath, Task<bool>> m_materializeOnOpen;
+        private MaterializationServer m_materializationServer;
+
+        // Whether the minifilter sandboxes the processes of the pip instead of Detours, and its connection once started.
+        private readonly bool m_useMinifilter;
+        private MinifilterConnection m_minifilter;
+        private long m_minifilterPipId;
 
         [SuppressMessage("Microsoft.Reliability", "CA2000:Dispose objects before losing scope", Justification = "We own these objects.")]
-        internal SandboxedProcess(SandboxedProcessInfo info)
+        internal SandboxedProcess(SandboxedProcessInfo info, bool useMinifilter = false)
         {
             Contract.Requires(info != null);
             Contract.Requires(!info.Timeout.HasValue || info.Timeout.Value <= Process.MaxTimeout);
+            Contract.Requires(!useMinifilter || info.FileAccessManifest != null);
 
             // there could be a race here, but it just doesn't matter
             if (s_binaryPaths == null)
@@ -93,6 +107,8 @@ namespace BuildXL.Processes
             m_bufferSize = SandboxedProcessInfo.BufferSize;
             m_allowedSurvivingChildProcessNames = info.AllowedSurvivingChildProcessNames;
             m_nestedProcessTerminationTimeout = info.NestedProcessTerminationTimeout;
+            m_materializeOnOpen = info.MaterializeOnOpen;
+            m_useMinifilter = useMinifilter;
 
             Encoding inputEncoding = info.StandardInputEncoding ?? Console.InputEncoding;
             m_standardInputReader = info.StandardInputReader;
@@ -145,7 +161,9 @@ namespace BuildXL.Processes
                     info.DisableConHostSharing,
                     info.LoggingContext,
                     info.TimeoutDumpDirectory,
-                    info.ContainerConfiguration);
+                    info.ContainerConfiguration,
+                    allowProcessBreakaway: m_fileAccessManifest?.ChildProcessesToBreakaway.Count > 0,
+                    priorityClass: m_fileAccessManifest?.PriorityClass);
         }
 
         /// <inheritdoc />
@@ -219,6 +237,7 @@ namespace BuildXL.Processes
         /// </remarks>
         [SuppressMessage("Microsoft.Usage", "CA2213:DisposableFieldsShouldBeDisposed", MessageId = "m_detouredProcess")]
         [SuppressMessage("Microsoft.Usage", "CA2213:DisposableFieldsShouldBeDisposed", MessageId = "m_reportReader")]
+        [SuppressMessage("Microsoft.Usage", "CA2213:DisposableFieldsShouldBeDisposed", MessageId = "m_reportChannelReaders")]
         [SuppressMessage("Microsoft.Usage", "CA2213:DisposableFieldsShouldBeDisposed", MessageId = "m_reportReaderSemaphore")]
         [SuppressMessage("Microsoft.Usage", "CA2213:DisposableFieldsShouldBeDisposed", MessageId = "m_error")]
         [SuppressMessage("Microsoft.Usage", "CA2213:DisposableFieldsShouldBeDisposed", MessageId = "m_output")]
@@ -245,8 +264,18 @@ namespace BuildXL.Processes
             m_error?.Dispose();
             m_error = null;
 
+            // Only left when the process failed to start.
+            m_reportRingReader?.StopAsync().GetAwaiter().GetResult();
+            m_reportRingReader = null;
+
             m_reports = null;
 
+            m_materializationServer?.Dispose();
+            m_materializationServer = null;
+
+            m_minifilter?.Dispose();
+            m_minifilter = null;
+
             m_fileAccessManifestStreamWrapper.Dispose();
         }
 
@@ -285,13 +314,30 @@ namespace BuildXL.Processes
         {
             Contract.Assume(!m_processStarted);
 
+            if (m_useMinifilter)
+            {
+                // The minifilter only writes text reports, and only to the report ring (see BuildXLFilterShared.h).
+                m_fileAccessManifest.UseReportRingBuffer = true;
+                m_fileAccessManifest.UseBinaryReportFormat = false;
+
+                if (!MinifilterConnection.TryConnect(out m_minifilter))
+                {
+                    throw new BuildXLException(
+                        "Cannot sandbox processes with the BuildXL minifilter: it is not loaded.",
+                        rootCause: ExceptionRootCause.MissingRuntimeDependency);
+                }
+            }
+
             Encoding reportEncoding = Encoding.Unicode;
+            bool binaryReports = m_fileAccessManifest?.UseBinaryReportFormat == true;
             SafeFileHandle childHandle = null;
             DetouredProcess detouredProcess = m_detouredProcess;
 
             using (m_reportReaderSemaphore.AcquireSemaphore())
             {
                 SafeFileHandle reportHandle;
+                SafeFileHandle[] reportChannelHandles = null;
+                SafeFileHandle[] childChannelHandles = null;
 
                 try
                 {
@@ -301,6 +347,23 @@ namespace BuildXL.Processes
                         readHandle: out reportHandle,
                         writeHandle: out childHandle);
 
+                    // The report pipe is the first channel; the processes of the pip get one channel each.
+                    int reportChannelCount = m_fileAccessManifest?.ReportChannelCount ?? 1;
+                    if (reportChannelCount > 1)
+                    {
+                        reportChannelHandles = new SafeFileHandle[reportChannelCount - 1];
+                        childChannelHandles = new SafeFileHandle[reportChannelCount];
+                        childChannelHandles[0] = childHandle;
+                        for (int i = 1; i < reportChannelCount; i++)
+                        {
+                            Pipes.CreateInheritablePipe(
+                                Pipes.PipeInheritance.InheritWrite,
+                                Pipes.PipeFlags.ReadSideAsync,
+                                readHandle: out reportChannelHandles[i - 1],
+                                writeHandle: out childChannelHandles[i]);
+                        }
+                    }
+
                     var setup =
                         new FileAccessSetup
                         {
@@ -313,7 +376,21 @@ namespace BuildXL.Processes
                     ArraySegment<byte> manifestBytes = new ArraySegment<byte>();
                     if (m_fileAccessManifest != null)
                     {
+                        // The first detoured process may open a file to materialize right away.
+                        if (m_materializeOnOpen != null && m_fileAccessManifest.MessageCountSemaphoreName != null)
+                        {
+                            m_materializationServer = MaterializationServer.Start(m_fileAccessManifest.MessageCountSemaphoreName, m_materializeOnOpen);
+                        }
+
                         manifestBytes = m_fileAccessManifest.GetPayloadBytes(setup, FileAccessManifestStream, m_timeoutMins, ref debugFlagsMatch);
+
+                        // The ring is created with the payload; it gets drained from before the first detoured process starts.
+                        if (m_reports != null && m_fileAccessManifest.ReportRing != null)
+                        {
+                            m_reportRingReader = binaryReports
+                                ? ReportRingReader.Start(m_fileAccessManifest.ReportRing, ReportChannelRecordReceived)
+                                : ReportRingReader.Start(m_fileAccessManifest.ReportRing, reportEncoding, ReportChannelLineReceived);
+                        }
                     }
 
                     if (!debugFlagsMatch)
@@ -321,13 +398,34 @@ namespace BuildXL.Processes
                         throw new BuildXLException("Mismatching build type for BuildXL and DetoursServices.dll.");
                     }
 
+                    Action<JobObject> sandboxJob = null;
+                    if (m_minifilter != null)
+                    {
+                        ReportRingBuffer ring = m_fileAccessManifest.ReportRing;
+                        if (ring == null)
+                        {
+                            throw new BuildXLException(
+                                "Cannot sandbox processes with the BuildXL minifilter without a report ring, which needs the message count semaphore of the manifest.");
+                        }
+
+                        // The pip is added before its first process starts, in the silo the job becomes.
+                        m_minifilterPipId = m_fileAccessManifest.PipId;
+                        sandboxJob = job =>
+                        {
+                            MinifilterConnection.ConvertToSilo(job);
+                            m_minifilter.AddPip(job, ring, manifestBytes, m_minifilterPipId);
+                        };
+                    }
+
                     m_standardInputTcs = TaskSourceSlim.Create<bool>();
                     detouredProcess.Start(
                         s_payloadGuid,
                         manifestBytes,
                         childHandle,
+                        childChannelHandles,
                         s_binaryPaths.DllNameX64,
-                        s_binaryPaths.DllNameX86);
+                        s_binaryPaths.DllNameX86,
+                        sandboxJob);
 
                     // At this point, we believe calling 'kill' will result in an eventual callback for job teardown.
                     // This knowledge is significant for ensuring correct cleanup if we did vs. did not start a process;
@@ -347,22 +445,66 @@ namespace BuildXL.Processes
                     {
                         childHandle.Dispose();
                     }
+
+                    if (childChannelHandles != null)
+                    {
+                        foreach (var channelHandle in childChannelHandles)
+                        {
+                            if (channelHandle != null && !channelHandle.IsInvalid)
+                            {
+                                channelHandle.Dispose();
+                            }
+                        }
+                    }
                 }
 
-                var reportFile = AsyncFileFactory.CreateAsyncFile(
-                    reportHandle,
-                    FileDesiredAccess.GenericRead,
-                    ownsHandle: true,
-                    kind: FileKind.Pipe);
-                StreamDataReceived reportLineReceivedCallback = m_reports == null ? (StreamDataReceived)null : ReportLineReceived;
-                m_reportReader = new AsyncPipeReader(reportFile, reportLineReceivedCallback, reportEncoding, m_bufferSize);
-                m_reportReader.BeginReadLine();
+                // The channels (and the report ring) are read concurrently, but the reports are handled one at a time.
+                bool singleReportStream = reportChannelHandles == null && m_reportRingReader == null;
+                StreamDataReceived reportLineReceivedCallback = m_reports == null
+                    ? (StreamDataReceived)null
+                    : (singleReportStream ? ReportLineReceived : (StreamDataReceived)ReportChannelLineReceived);
+                RecordReceived reportRecordReceivedCallback = m_reports == null || !binaryReports
+                    ? (RecordReceived)null
+                    : (singleReportStream ? ReportRecordReceived : (RecordReceived)ReportChannelRecordReceived);
+                m_reportReader = CreateReportReader(reportHandle, reportLineReceivedCallback, reportRecordReceivedCallback, reportEncoding);
+
+                if (reportChannelHandles != null)
+                {
+                    m_reportChannelReaders = new AsyncPipeReader[reportChannelHandles.Length];
+                    for (int i = 0; i < reportChannelHandles.Length; i++)
+                    {
+                        m_reportChannelReaders[i] = CreateReportReader(reportChannelHandles[i], reportLineReceivedCallback, reportRecordReceivedCallback, reportEncoding);
+                    }
+                }
             }
 
             // don't wait, we want feeding in of standard input to happen asynchronously
             Analysis.IgnoreResult(FeedStandardInputAsync(detouredProcess, m_standardInputReader, m_standardInputTcs));
         }
 
+        [SuppressMessage("Microsoft.Reliability", "CA2000:Dispose objects before losing scope", Justification = "The reader owns the file.")]
+        private AsyncPipeReader CreateReportReader(SafeFileHandle reportHandle, StreamDataReceived callback, RecordReceived recordCallback, Encoding reportEncoding)
+        {
+            var reportFile = AsyncFileFactory.CreateAsyncFile(
+                reportHandle,
+                FileDesiredAccess.GenericRead,
+                ownsHandle: true,
+                kind: FileKind.Pipe);
+            var reader = recordCallback != null
+                ? new AsyncPipeReader(reportFile, recordCallback, m_bufferSize)
+                : new AsyncPipeReader(reportFile, callback, reportEncoding, m_bufferSize);
+            reader.BeginReadLine();
+            return reader;
+        }
+
+        private bool ReportChannelLineReceived(string data)
+        {
+            lock (m_reportChannelLock)
+            {
+                return ReportLineReceived(data);
+            }
+        }
+
         private bool ReportLineReceived(string data)
         {
             SandboxedProcessFactory.Counters.IncrementCounter(SandboxedProcessFactory.SandboxedProcessCounters.AccessReportCount);
@@ -372,6 +514,23 @@ namespace BuildXL.Processes
             }
         }
 
+        private bool ReportChannelRecordReceived(ArraySegment<byte> record)
+        {
+            lock (m_reportChannelLock)
+            {
+                return ReportRecordReceived(record);
+            }
+        }
+
+        private bool ReportRecordReceived(ArraySegment<byte> record)
+        {
+            SandboxedProcessFactory.Counters.IncrementCounter(SandboxedProcessFactory.SandboxedProcessCounters.AccessReportCount);
+            using (SandboxedProcessFactory.Counters.StartStopwatch(SandboxedProcessFactory.SandboxedProcessCounters.HandleAccessReportDuration))
+            {
+                return m_reports.ReportRecordReceived(record);
+            }
+        }
+
         private static async Task FeedStandardInputAsync(DetouredProcess detouredProcess, TextReader reader, TaskSourceSlim<bool> stdInTcs)
         {
             try
@@ -415,6 +574,36 @@ namespace BuildXL.Processes
                     m_reportReader.Dispose();
                     m_reportReader = null;
                 }
+
+                if (m_reportChannelReaders != null)
+                {
+                    foreach (var reportChannelReader in m_reportChannelReaders)
+                    {
+                        if (!cancel)
+                        {
+                            await reportChannelReader.WaitUntilEofAsync();
+                        }
+
+                        reportChannelReader.Dispose();
+                    }
+
+                    m_reportChannelReaders = null;
+                }
+
+                // Once the pipes are closed, no detoured process is left to write to the ring either.
+                if (m_reportRingReader != null)
+                {
+                    await m_reportRingReader.StopAsync();
+                    if (m_reportRingReader.LostBytes > 0)
+                    {
+                        m_reports?.ReportLostMessages(string.Format(
+                            CultureInfo.InvariantCulture,
+                            "{0} bytes of reports were left uncommitted in the report ring by killed processes",
+                            m_reportRingReader.LostBytes));
+                    }
+
+                    m_reportRingReader = null;
+                }
             }
         }
 
@@ -441,9 +630,21 @@ namespace BuildXL.Processes
 
         private async Task OnProcessExited()
         {
+            if (m_minifilter != null)
+            {
+                RemoveMinifilterPip();
+            }
+
             // Wait until all incoming report messages from the detoured process have been handled.
             await WaitUntilReportEof(m_detouredProcess.Killed);
 
+            // No detoured process is left to request materializations.
+            m_materializationServer?.Dispose();
+            m_materializationServer = null;
+
+            // The accesses recorded in the access bitmaps are only known once no detoured process can set more bits.
+            m_reports?.ReportAccessBitmap();
+
             // Ensure no further modifications to the report
             m_reports?.Freeze();
 
@@ -497,6 +698,9 @@ namespace BuildXL.Processes
                     AllUnexpectedFileAccesses = m_reports?.FileUnexpectedAccesses,
                     FileAccesses = m_reports?.FileAccesses,
                     DetouringStatuses = m_reports?.ProcessDetoursStatuses,
+                    OutputContentHashes = m_reports?.OutputContentHashes,
+                    ManifestLookupProfile = m_fileAccessManifest?.GetManifestLookupProfile(),
+                    ProcessDataCounters = m_reports?.ProcessDataCounters,
                     ExplicitlyReportedFileAccesses = m_reports?.ExplicitlyReportedFileAccesses,
                     Processes = m_reports?.Processes,
                     DumpFileDirectory = m_detouredProcess.DumpFileDirectory,
@@ -510,6 +714,27 @@ namespace BuildXL.Processes
             SetResult(result);
         }
 
+        /// <summary>
+        /// Stops the minifilter from sandboxing the job of the pip, whose processes have all exited, before the report ring is drained for the last time.
+        /// </summary>
+        private void RemoveMinifilterPip()
+        {
+            JobObject jobObject = m_detouredProcess.GetJobObject();
+            if (jobObject == null)
+            {
+                return;
+            }
+
+            try
+            {
+                m_minifilter.RemovePip(jobObject, m_minifilterPipId);
+            }
+            catch (NativeWin32Exception)
+            {
+                // The minifilter drops the pip when its silo goes away anyway.
+            }
+        }
+
         private static Dictionary<uint, ReportedProcess> GetSurvivingChildProcesses(JobObject jobObject)
         {
             if (!jobObject.TryGetProcessIds(out uint[] survivingChildProcessIds) || survivingChildProcessIds.Length == 0)
@@ -116,13 +116,17 @@ namespace BuildXL.Processes
             {
                 return new UnSandboxedProcess(sandboxedProcessInfo);
             }
+            else if (OperatingSystemHelper.IsLinux)
+            {
+                return new SandboxedProcessLinux(sandboxedProcessInfo, useEbpfObserver: sandboxKind == SandboxKind.LinuxEbpf);
+            }
             else if (OperatingSystemHelper.IsUnixOS)
             {
                 return new SandboxedProcessMacKext(sandboxedProcessInfo, ignoreReportedAccesses: sandboxKind == SandboxKind.MacOsKextIgnoreFileAccesses);
             }
             else
             {
-                return new SandboxedProcess(sandboxedProcessInfo);
+                return new SandboxedProcess(sandboxedProcessInfo, useMinifilter: sandboxKind == SandboxKind.WinMinifilter);
             }
         }
 
@@ -6,6 +6,7 @@ using System.Collections.Generic;
 using System.Diagnostics.ContractsLight;
 using System.IO;
 using System.Text;
+using System.Threading.Tasks;
 using BuildXL.Native.Processes;
 using BuildXL.Pips.Operations;
 using BuildXL.Processes.Containers;
@@ -247,6 +248,17 @@ namespace BuildXL.Processes
         /// </summary>
         public Action<string> StandardErrorObserver { get; set; }
 
+        /// <summary>
+        /// Optional handler of the requests to materialize the files whose policy has <see cref="FileAccessPolicy.MaterializeOnOpen"/>,
+        /// which returns whether the file got materialized.
+        /// </summary>
+        /// <remarks>
+        /// Requests are made the first time a detoured process opens such a file, and block the open until the handler completes.
+        /// Requires <see cref="BuildXL.Processes.FileAccessManifest.SetMessageCountSemaphore"/> to be called first, since requests are
+        /// made on a pipe named after the semaphore.
+        /// </remarks>
+        public Func<AbsolutePath, Task<bool>> MaterializeOnOpen { get; set; }
+
         /// <summary>
         /// Allowed surviving child processes.
         /// </summary>
@@ -230,6 +230,12 @@ namespace BuildXL.Processes
                 m_fileAccessManifest.DisableDetours = true;
             }
 
+            if (sandBoxConfig.ProcessAdmissionThresholdPercent > 0 && !OperatingSystemHelper.IsUnixOS)
+            {
+                // The scheduler keeps the gate closed while the machine is above the threshold
+                m_fileAccessManifest.SetProcessAdmissionGate(ProcessAdmissionGate.NameForCurrentProcess, sandBoxConfig.ProcessAdmissionMaxWaitMs);
+            }
+
             m_fileAccessWhitelist = whitelist;
             m_makeInputPrivate = makeInputPrivate;
             m_makeOutputPrivate = makeOutputPrivate;
@@ -1100,6 +1106,26 @@ namespace BuildXL.Processes
             ProcessTimes primaryProcessTimes = result.PrimaryProcessTimes;
             JobObject.AccountingInformation? jobAccounting = result.JobAccountingInformation;
 
+            if (m_sandboxConfig.LogPipProcessData && jobAccounting.HasValue)
+            {
+                // The job rolls up the counters of all processes of the pip, without any message from them.
+                JobObject.AccountingInformation accounting = jobAccounting.Value;
+                Tracing.Logger.Log.LogPipProcessData(
+                    loggingContext,
+                    m_pip.SemiStableHash,
+                    m_pip.GetDescription(m_context),
+                    accounting.NumberOfProcesses,
+                    (long)accounting.UserTime.TotalMilliseconds,
+                    (long)accounting.KernelTime.TotalMilliseconds,
+                    accounting.PeakMemoryUsage,
+                    accounting.IO.ReadCounters.OperationCount,
+                    accounting.IO.ReadCounters.TransferCount,
+                    accounting.IO.WriteCounters.OperationCount,
+                    accounting.IO.WriteCounters.TransferCount,
+                    accounting.IO.OtherCounters.OperationCount,
+                    accounting.IO.OtherCounters.TransferCount);
+            }
+
             TimeSpan time = primaryProcessTimes.TotalWallClockTime;
             if (result.TimedOut)
             {
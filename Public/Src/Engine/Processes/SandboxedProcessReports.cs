@@ -31,10 +31,27 @@ namespace BuildXL.Processes
             .ToDictionary(reportType => ((int)reportType).ToString(), reportType => reportType);
 
         private readonly PathTable m_pathTable;
+
+        // Parser of the records of all the report streams of the pip (see ReportRecordReceived); it keeps the paths interned by each process.
+        private readonly FileAccessReportRecord m_recordParser;
+
         private readonly ConcurrentDictionary<uint, ReportedProcess> m_activeProcesses = new ConcurrentDictionary<uint, ReportedProcess>();
         private readonly ConcurrentDictionary<uint, ReportedProcess> m_processesExits = new ConcurrentDictionary<uint, ReportedProcess>();
 
         private readonly Dictionary<string, string> m_pathCache = new Dictionary<string, string>(StringComparer.OrdinalIgnoreCase);
+
+        /// <summary>
+        /// Command lines of child processes sent in full in process detouring status reports, by reporting process and hash.
+        /// </summary>
+        private readonly Dictionary<(ulong processId, string hash), string> m_detouringStatusCommandLines = new Dictionary<(ulong processId, string hash), string>();
+
+        /// <summary>
+        /// Prefix of a command line sent by hash in a process detouring status report.
+        /// Keep this in sync with COMMAND_LINE_HASH_MARKER declared in DataTypes.h.
+        /// </summary>
+        private const char CommandLineHashMarker = '\x1';
+
+        private const int CommandLineHashLength = 16;
         private readonly IDetoursEventListener m_detoursEventListener;
 
         public readonly List<ReportedProcess> Processes = new List<ReportedProcess>();
@@ -44,14 +61,37 @@ namespace BuildXL.Processes
 
         public readonly List<ProcessDetouringStatusData> ProcessDetoursStatuses = new List<ProcessDetouringStatusData>();
 
+        /// <summary>
+        /// Content hashes of the outputs computed while they were written (see <see cref="FileAccessManifest.HashOutputsWhileWriting"/>).
+        /// </summary>
+        public readonly List<OutputContentHash> OutputContentHashes = new List<OutputContentHash>();
+
+        /// <summary>
+        /// Counters the detoured processes report in their process data (see <see cref="FileAccessManifest.LogProcessData"/>), summed over the
+        /// processes of the pip.
+        /// </summary>
+        public readonly Dictionary<string, ulong> ProcessDataCounters = new Dictionary<string, ulong>();
+
         /// <summary>
         /// The last message count in the semaphore.
         /// </summary>
         public int GetLastMessageCount()
         {
-            return m_manifest.MessageCountSemaphore?.Release() ?? 0;
+            if (m_manifest.MessageCountSemaphore == null)
+            {
+                return 0;
+            }
+
+            // Processes that could not open the shared message count released the semaphore instead.
+            long sentMessageCount = m_manifest.SentMessageCount + m_manifest.MessageCountSemaphore.Release();
+            return (int)(sentMessageCount - Interlocked.Read(ref m_receivedMessageCount));
         }
 
+        /// <summary>
+        /// Number of messages received, to compare with the number of messages sent when the detoured processes are done.
+        /// </summary>
+        private long m_receivedMessageCount;
+
         private bool m_isFrozen;
 
         /// <summary>
@@ -105,6 +145,7 @@ namespace BuildXL.Processes
             PipSemiStableHash = pipSemiStableHash;
             PipDescription = pipDescription;
             m_pathTable = pathTable;
+            m_recordParser = new FileAccessReportRecord(pathTable);
             FileAccesses = manifest.ReportFileAccesses ? new HashSet<ReportedFileAccess>() : null;
             FileUnexpectedAccesses = new HashSet<ReportedFileAccess>();
             m_manifest = manifest;
@@ -159,6 +200,8 @@ namespace BuildXL.Processes
         /// </summary>
         public bool ReportFileAccess<T>(ref T accessReport, FileAccessReportProvider<T> parser)
         {
+            Interlocked.Increment(ref m_receivedMessageCount);
+
             var result = FileAccessReportLineReceived(ref accessReport, parser, out var errorMessage);
             if (!result)
             {
@@ -168,6 +211,85 @@ namespace BuildXL.Processes
             return result;
         }
 
+        /// <summary>
+        /// An alternative to <see cref="ReportLineReceived(string)"/> for process detouring status reports sent as binary records
+        /// (see <see cref="FileAccessReportRecord.TryParseProcessDetouringStatus"/>).
+        /// </summary>
+        public bool ReportProcessDetouringStatus(ArraySegment<byte> record)
+        {
+            Interlocked.Increment(ref m_receivedMessageCount);
+
+            if (!FileAccessReportRecord.TryParseProcessDetouringStatus(
+                    record,
+                    out var processId,
+                    out var reportStatus,
+                    out var processName,
+                    out var startApplicationName,
+                    out var startCommandLine,
+                    out var commandLineHash,
+                    out var commandLineSentBefore,
+                    out var needsInjection,
+                    out var hJob,
+                    out var disableDetours,
+                    out var creationFlags,
+                    out var detoured,
+                    out var error,
+                    out var createProcessStatusReturn,
+                    out var timings,
+                    out var errorMessage)
+                || !TryResolveDetouringStatusCommandLine(processId, commandLineHash, commandLineSentBefore, ref startCommandLine, out errorMessage))
+            {
+                MessageProcessingFailure = CreateMessageProcessingFailure(errorMessage);
+                return false;
+            }
+
+            ProcessDetouringStatusParsed(
+                processId,
+                reportStatus,
+                processName,
+                startApplicationName,
+                startCommandLine,
+                needsInjection,
+                hJob,
+                disableDetours,
+                creationFlags,
+                detoured,
+                error,
+                createProcessStatusReturn,
+                timings);
+
+            return true;
+        }
+
+        /// <summary>
+        /// Callback invoked when a new report record is received from the native monitoring code, when
+        /// <see cref="FileAccessManifest.UseBinaryReportFormat"/> is set. The counterpart of <see cref="ReportLineReceived(string)"/>.
+        /// </summary>
+        /// <remarks>
+        /// The records of all the report streams of the pip have to be passed one at a time: a process may refer to a path it sent
+        /// in an earlier record.
+        /// </remarks>
+        public bool ReportRecordReceived(ArraySegment<byte> record)
+        {
+            if (!FileAccessReportRecord.TryReadHeader(record, out int size, out var reportType) || size != record.Count)
+            {
+                Interlocked.Increment(ref m_receivedMessageCount);
+                MessageProcessingFailure = CreateMessageProcessingFailure(
+                    I($"Malformed report record (potentially due to pipe corruption): size {record.Count}, header size {size}, type {reportType}"));
+                return false;
+            }
+
+            switch (reportType)
+            {
+                case ReportType.FileAccess:
+                    return ReportFileAccess(ref record, m_recordParser.TryParse);
+                case ReportType.ProcessDetouringStatus:
+                    return ReportProcessDetouringStatus(record);
+                default:
+                    return ReportLineReceived(FileAccessReportRecord.GetTextLine(record));
+            }
+        }
+
         /// <summary>
         /// Callback invoked when a new report item is received from the native monitoring code
         /// <returns>true if the processing should continue. Otherwise false, which should cause exiting of the processing of data.</returns>
@@ -181,18 +303,7 @@ namespace BuildXL.Processes
                 return true;
             }
 
-            if (m_manifest.MessageCountSemaphore != null)
-            {
-                try
-                {
-                    m_manifest.MessageCountSemaphore.WaitOne(0);
-                }
-                catch (Exception ex)
-                {
-                    MessageProcessingFailure = CreateMessageProcessingFailure(data, I($"Wait error on semaphore for counting Detours messages: {ex.GetLogEventMessage()}."));
-                    return false;
-                }
-            }
+            Interlocked.Increment(ref m_receivedMessageCount);
 
             int splitIndex = data.IndexOf(',');
 
@@ -260,6 +371,15 @@ namespace BuildXL.Processes
                         return false;
                     }
                     break;
+                case ReportType.OutputContentHash:
+                    if (!OutputContentHashReportLine.TryParse(data, out var outputContentHash, out errorMessage))
+                    {
+                        MessageProcessingFailure = CreateMessageProcessingFailure(data, errorMessage);
+                        return false;
+                    }
+
+                    OutputContentHashes.Add(outputContentHash);
+                    break;
                 default:
                     Contract.Assume(false);
                     break;
@@ -268,6 +388,14 @@ namespace BuildXL.Processes
             return true;
         }
 
+        /// <summary>
+        /// Records that reports were lost on their way from the detoured processes, which makes the accesses of the pip incomplete.
+        /// </summary>
+        internal void ReportLostMessages(string description)
+        {
+            MessageProcessingFailure = MessageProcessingFailure ?? CreateMessageProcessingFailure(description);
+        }
+
         private static Failure<string> CreateMessageProcessingFailure(string message) => new Failure<string>(I($"Error message: {message}"));
         private static Failure<string> CreateMessageProcessingFailure(string rawData, string message) => CreateMessageProcessingFailure(I($"{message} | Raw data: {rawData}"));
 
@@ -287,11 +415,50 @@ namespace BuildXL.Processes
                 out var detoured,
                 out var error,
                 out var createProcessStatusReturn,
+                out var timings,
                 out errorMessage))
             {
                 return false;
             }
 
+            if (!TryResolveDetouringStatusCommandLine(processId, ref startCommandLine, out errorMessage))
+            {
+                return false;
+            }
+
+            ProcessDetouringStatusParsed(
+                processId,
+                reportStatus,
+                processName,
+                startApplicationName,
+                startCommandLine,
+                needsInjection,
+                hJob,
+                disableDetours,
+                creationFlags,
+                detoured,
+                error,
+                createProcessStatusReturn,
+                timings);
+
+            return true;
+        }
+
+        private void ProcessDetouringStatusParsed(
+            ulong processId,
+            uint reportStatus,
+            string processName,
+            string startApplicationName,
+            string startCommandLine,
+            bool needsInjection,
+            ulong hJob,
+            bool disableDetours,
+            uint creationFlags,
+            bool detoured,
+            uint error,
+            uint createProcessStatusReturn,
+            ProcessDetouringTimings timings)
+        {
             // If there is a listener registered and not a process message and notifications allowed, notify over the interface.
             if (m_detoursEventListener != null && (m_detoursEventListener.GetMessageHandlingFlags() & MessageHandlingFlags.ProcessDetoursStatusNotify) != 0)
             {
@@ -313,7 +480,7 @@ namespace BuildXL.Processes
             // If there is a listener registered that disables the collection of data in the collections, just exit.
             if (m_detoursEventListener != null && (m_detoursEventListener.GetMessageHandlingFlags() & MessageHandlingFlags.ProcessDetoursStatusCollect) == 0)
             {
-                return true;
+                return;
             }
 
             ProcessDetoursStatuses.Add(new ProcessDetouringStatusData(
@@ -328,11 +495,133 @@ namespace BuildXL.Processes
                 creationFlags,
                 detoured,
                 error,
-                createProcessStatusReturn));
+                createProcessStatusReturn,
+                timings));
+        }
+
+        /// <summary>
+        /// Replaces a command line sent by hash with the one sent in full before, and remembers the ones sent in full.
+        /// </summary>
+        private bool TryResolveDetouringStatusCommandLine(ulong processId, ref string commandLine, out string errorMessage)
+        {
+            errorMessage = string.Empty;
+
+            if (string.IsNullOrEmpty(commandLine) || commandLine[0] != CommandLineHashMarker)
+            {
+                return true;
+            }
+
+            if (commandLine.Length < 1 + CommandLineHashLength)
+            {
+                errorMessage = I($"Malformed command line hash '{commandLine}'");
+                return false;
+            }
+
+            var key = (processId, commandLine.Substring(1, CommandLineHashLength));
+
+            if (commandLine.Length == 1 + CommandLineHashLength)
+            {
+                if (!m_detouringStatusCommandLines.TryGetValue(key, out var fullCommandLine))
+                {
+                    errorMessage = I($"Unknown command line hash '{key.Item2}' from process {processId}");
+                    return false;
+                }
+
+                commandLine = fullCommandLine;
+                return true;
+            }
+
+            if (commandLine[1 + CommandLineHashLength] != '=')
+            {
+                errorMessage = I($"Malformed command line hash '{commandLine}'");
+                return false;
+            }
+
+            commandLine = commandLine.Substring(2 + CommandLineHashLength);
+            m_detouringStatusCommandLines[key] = commandLine;
+            return true;
+        }
+
+        /// <summary>
+        /// Same as <see cref="TryResolveDetouringStatusCommandLine(ulong, ref string, out string)"/>, for a binary record, which carries
+        /// the hash of the command line separately.
+        /// </summary>
+        private bool TryResolveDetouringStatusCommandLine(ulong processId, ulong commandLineHash, bool sentBefore, ref string commandLine, out string errorMessage)
+        {
+            errorMessage = string.Empty;
+
+            if (commandLineHash == 0)
+            {
+                return true;
+            }
+
+            // Keyed like the hashes of text reports, which a process may send too.
+            var key = (processId, commandLineHash.ToString("x16", CultureInfo.InvariantCulture));
+
+            if (sentBefore)
+            {
+                if (!m_detouringStatusCommandLines.TryGetValue(key, out var fullCommandLine))
+                {
+                    errorMessage = I($"Unknown command line hash '{key.Item2}' from process {processId}");
+                    return false;
+                }
+
+                commandLine = fullCommandLine;
+                return true;
+            }
 
+            m_detouringStatusCommandLines[key] = commandLine;
             return true;
         }
 
+        /// <summary>
+        /// Parses the line of a <see cref="ReportType.OutputContentHash"/> report (see ReportOutputContentHash in SendReport.cpp):
+        /// process id, path id, status, hash, length, last write time and path.
+        /// </summary>
+        private static class OutputContentHashReportLine
+        {
+            /// <summary>
+            /// Keep this in sync with OutputContentHashStatus declared in DataTypes.h.
+            /// </summary>
+            private const uint StatusHashed = 0;
+
+            public static bool TryParse(string line, out OutputContentHash outputContentHash, out string errorMessage)
+            {
+                outputContentHash = null;
+                errorMessage = string.Empty;
+
+                var items = line.Split(new[] { '|' }, 7);
+                if (items.Length != 7)
+                {
+                    errorMessage = I($"Unexpected message items. Message '{line}'. Expected 7 items, Received {items.Length} items");
+                    return false;
+                }
+
+                if (!uint.TryParse(items[0], NumberStyles.None, CultureInfo.InvariantCulture, out var processId)
+                    || !uint.TryParse(items[2], NumberStyles.None, CultureInfo.InvariantCulture, out var status)
+                    || !long.TryParse(items[4], NumberStyles.None, CultureInfo.InvariantCulture, out var length)
+                    || !long.TryParse(items[5], NumberStyles.None, CultureInfo.InvariantCulture, out var lastWriteTime)
+                    || items[3].Length != OutputContentHash.HashLength * 2)
+                {
+                    errorMessage = I($"Unexpected message content. Message '{line}'.");
+                    return false;
+                }
+
+                var hash = new byte[OutputContentHash.HashLength];
+                for (int i = 0; i < hash.Length; i++)
+                {
+                    if (!byte.TryParse(items[3].Substring(2 * i, 2), NumberStyles.AllowHexSpecifier, CultureInfo.InvariantCulture, out hash[i]))
+                    {
+                        errorMessage = I($"Unexpected message content. Message '{line}'.");
+                        return false;
+                    }
+                }
+
+                outputContentHash = new OutputContentHash(processId, items[6], status == StatusHashed, hash, length, lastWriteTime);
+                return true;
+            }
+        }
+
         private static class ProcessDetouringStatusReportLine
         {
             public static bool TryParse(
@@ -349,9 +638,11 @@ namespace BuildXL.Processes
                 out bool detoured,
                 out uint error,
                 out uint createProcessStatusReturn,
+                out ProcessDetouringTimings timings,
                 out string errorMessage)
             {
                 reportStatus = 0;
+                timings = default;
                 needsInjection = false;
                 disableDetours = false;
                 detoured = false;
@@ -367,28 +658,28 @@ namespace BuildXL.Processes
 
                 var items = line.Split('|');
 
-                // A "process data" report is expected to have exactly 14 items. 1 for the process id,
-                // 1 for the command line (last item) and 12 numbers indicating the various counters and
-                // execution times.
+                // A "process detouring status" report is expected to have at least 13 items: the process id, the process and
+                // application names, 8 numbers describing the creation, the step timings and the command line (last item),
+                // which may contain separators itself.
                 // If this assert fires, it indicates that we could not successfully parse (split) the data being
                 // sent from the detour (SendReport.cpp).
                 // Make sure the strings are formatted only when the condition is false.
-                if (items.Length < 12)
+                if (items.Length < 13)
                 {
-                    errorMessage = I($"Unexpected message items (potentially due to pipe corruption). Message '{line}'. Expected >= 12 items, Received {items.Length} items");
+                    errorMessage = I($"Unexpected message items (potentially due to pipe corruption). Message '{line}'. Expected >= 13 items, Received {items.Length} items");
                     return false;
                 }
 
-                if (items.Length == 12)
+                if (items.Length == 13)
                 {
-                    startCommandLine = items[11];
+                    startCommandLine = items[12];
                 }
                 else
                 {
                     System.Text.StringBuilder builder = Pools.GetStringBuilder().Instance;
-                    for (int i = 11; i < items.Length; i++)
+                    for (int i = 12; i < items.Length; i++)
                     {
-                        if (i > 11)
+                        if (i > 12)
                         {
                             builder.Append("|");
                         }
@@ -414,7 +705,8 @@ namespace BuildXL.Processes
                     uint.TryParse(items[7], NumberStyles.None, CultureInfo.InvariantCulture, out creationFlags) &&
                     uint.TryParse(items[8], NumberStyles.None, CultureInfo.InvariantCulture, out uintDetoured) &&
                     uint.TryParse(items[9], NumberStyles.None, CultureInfo.InvariantCulture, out error) &&
-                    uint.TryParse(items[10], NumberStyles.None, CultureInfo.InvariantCulture, out createProcessStatusReturn))
+                    uint.TryParse(items[10], NumberStyles.None, CultureInfo.InvariantCulture, out createProcessStatusReturn) &&
+                    ProcessDetouringTimings.TryParse(items[11], out timings))
                 {
                     needsInjection = uintNeedsInjection == 0 ? false : true;
                     disableDetours = uintDisableDetours == 0 ? false : true;
@@ -426,6 +718,27 @@ namespace BuildXL.Processes
             }
         }
 
+        private void AddProcessDataCounter(string name, ulong value)
+        {
+            ProcessDataCounters.TryGetValue(name, out ulong total);
+            ProcessDataCounters[name] = total + value;
+        }
+
+        /// <summary>
+        /// Adds the feature counters of a process data report: "Name,Value" pairs separated by ';' (see FeatureCounters.h).
+        /// </summary>
+        private void AddFeatureCounters(string featureCounters)
+        {
+            foreach (string counter in featureCounters.Split(new[] { ';' }, StringSplitOptions.RemoveEmptyEntries))
+            {
+                int separator = counter.LastIndexOf(',');
+                if (separator > 0 && ulong.TryParse(counter.Substring(separator + 1), NumberStyles.None, CultureInfo.InvariantCulture, out ulong value))
+                {
+                    AddProcessDataCounter(counter.Substring(0, separator), value);
+                }
+            }
+        }
+
         private bool ProcessDataReportLineReceived(string data, out string errorMessage)
         {
             if (!ProcessDataReportLine.TryParse(
@@ -445,11 +758,49 @@ namespace BuildXL.Processes
                 out var allocatedPoolEntries,
                 out var maxHandleMapEntries,
                 out var handleMapEntries,
+                out var handleMapContendedWrites,
+                out var handleMapContendedReads,
+                out var attachLocateManifestMicroseconds,
+                out var attachParseManifestMicroseconds,
+                out var attachHandleOverlayMicroseconds,
+                out var attachTransactionMicroseconds,
+                out var ntClosePoolExhaustions,
+                out var ntClosePoolRefills,
+                out var canonicalizations,
+                out var fastCanonicalizations,
+                out var injectedProcesses,
+                out var injectionImagesFromPeb,
+                out var injectionFindImageMicroseconds,
+                out var injectionAllocateMicroseconds,
+                out var injectionWriteImportsMicroseconds,
+                out var injectionChecksumMicroseconds,
+                out var attachCachedPrologues,
+                out var injectionApplyMappingMicroseconds,
+                out var injectionInheritedDeviceMaps,
+                out var policyResultCacheHits,
+                out var policyResultCacheMisses,
+                out var policyResultCacheEntries,
+                out var processAdmissionWaits,
+                out var processAdmissionWaitMicroseconds,
+                out var directoryQueriesAvoided,
+                out var fileStatQueries,
+                out var fileStatQueriesSaved,
+                out var sandboxOverheadMicroseconds,
+                out var policyResolutionMicroseconds,
+                out var reparsePointResolutionMicroseconds,
+                out var reportingMicroseconds,
+                out var handleOverlayLockMicroseconds,
+                out var detourStatistics,
+                out var featureCounters,
                 out errorMessage))
             {
                 return false;
             }
 
+            // The overhead is summed over the threads of the process, so it may exceed its lifetime.
+            ulong lifetimeMicroseconds = exitDateTime > creationDateTime ? (ulong)((exitDateTime - creationDateTime).Ticks / 10) : 0;
+            ulong sandboxOverheadPercent = lifetimeMicroseconds > 0 ? sandboxOverheadMicroseconds * 100 / lifetimeMicroseconds : 0;
+
             Tracing.Logger.Log.LogDetoursMaxHeapSize(
                 m_loggingContext,
                 PipSemiStableHash,
@@ -461,7 +812,57 @@ namespace BuildXL.Processes
                 finalDetoursHeapSizeInBytes,
                 allocatedPoolEntries,
                 maxHandleMapEntries,
-                handleMapEntries);
+                handleMapEntries,
+                handleMapContendedWrites,
+                handleMapContendedReads,
+                attachLocateManifestMicroseconds,
+                attachParseManifestMicroseconds,
+                attachHandleOverlayMicroseconds,
+                attachTransactionMicroseconds,
+                ntClosePoolExhaustions,
+                ntClosePoolRefills,
+                canonicalizations,
+                fastCanonicalizations,
+                injectedProcesses,
+                injectionImagesFromPeb,
+                injectionFindImageMicroseconds,
+                injectionAllocateMicroseconds,
+                injectionWriteImportsMicroseconds,
+                injectionChecksumMicroseconds,
+                attachCachedPrologues,
+                injectionApplyMappingMicroseconds,
+                injectionInheritedDeviceMaps,
+                policyResultCacheHits,
+                policyResultCacheMisses,
+                policyResultCacheEntries,
+                processAdmissionWaits,
+                processAdmissionWaitMicroseconds,
+                directoryQueriesAvoided,
+                fileStatQueries,
+                fileStatQueriesSaved,
+                sandboxOverheadMicroseconds,
+                sandboxOverheadPercent,
+                policyResolutionMicroseconds,
+                reparsePointResolutionMicroseconds,
+                reportingMicroseconds,
+                handleOverlayLockMicroseconds,
+                detourStatistics);
+
+            AddProcessDataCounter("InjectedProcesses", injectedProcesses);
+            AddProcessDataCounter("InjectionInheritedDeviceMaps", injectionInheritedDeviceMaps);
+            AddProcessDataCounter("AttachCachedPrologues", attachCachedPrologues);
+            AddProcessDataCounter("NtClosePoolExhaustions", ntClosePoolExhaustions);
+            AddProcessDataCounter("NtClosePoolRefills", ntClosePoolRefills);
+            AddProcessDataCounter("Canonicalizations", canonicalizations);
+            AddProcessDataCounter("FastCanonicalizations", fastCanonicalizations);
+            AddProcessDataCounter("PolicyResultCacheHits", policyResultCacheHits);
+            AddProcessDataCounter("PolicyResultCacheMisses", policyResultCacheMisses);
+            AddProcessDataCounter("ProcessAdmissionWaits", processAdmissionWaits);
+            AddProcessDataCounter("ProcessAdmissionWaitMicroseconds", processAdmissionWaitMicroseconds);
+            AddProcessDataCounter("DirectoryQueriesAvoided", directoryQueriesAvoided);
+            AddProcessDataCounter("FileStatQueries", fileStatQueries);
+            AddProcessDataCounter("FileStatQueriesSaved", fileStatQueriesSaved);
+            AddFeatureCounters(featureCounters);
 
             if (MaxDetoursHeapSize < unchecked((long)detoursMaxMemHeapSizeInBytes))
             {
@@ -668,6 +1069,47 @@ namespace BuildXL.Processes
             return true;
         }
 
+        /// <summary>
+        /// Reports the accesses the detoured processes recorded in the access bitmaps of the manifest (see <see cref="FileAccessManifest.UseAccessBitmap"/>)
+        /// rather than sent, one per path and kind of access. Call it once all the detoured processes are done, before freezing.
+        /// </summary>
+        internal void ReportAccessBitmap()
+        {
+            Contract.Assume(!IsFrozen, "ReportAccessBitmap: !IsFrozen");
+
+            Internal.AccessBitmap bitmap = m_manifest.AccessBitmap;
+            if (bitmap == null)
+            {
+                return;
+            }
+
+            // The bitmaps do not tell which process did the access.
+            ReportedProcess process = Processes.Count > 0 ? Processes[0] : new ReportedProcess(0, string.Empty, string.Empty);
+
+            foreach (bool probes in new[] { false, true })
+            {
+                foreach (uint index in bitmap.GetSetIndices(probes))
+                {
+                    HandleReportedAccess(
+                        new ReportedFileAccess(
+                            operation: probes ? ReportedFileOperation.GetFileAttributes : ReportedFileOperation.CreateFile,
+                            process: process,
+                            requestedAccess: probes ? RequestedAccess.Probe : RequestedAccess.Read,
+                            status: FileAccessStatus.Allowed,
+                            explicitlyReported: true,
+                            error: 0,
+                            usn: ReportedFileAccess.NoUsn,
+                            desiredAccess: probes ? (DesiredAccess)0 : DesiredAccess.GENERIC_READ,
+                            shareMode: ShareMode.FILE_SHARE_READ,
+                            creationDisposition: CreationDisposition.OPEN_EXISTING,
+                            flagsAndAttributes: FlagsAndAttributes.FILE_ATTRIBUTE_NORMAL,
+                            manifestPath: new AbsolutePath(unchecked((int)(index | bitmap.PathIdTag))),
+                            path: null,
+                            enumeratePatttern: null));
+                }
+            }
+        }
+
         private void HandleReportedAccess(ReportedFileAccess access)
         {
             Contract.Assume(!IsFrozen, "HandleReportedAccess: !IsFrozen");
@@ -713,6 +1155,40 @@ namespace BuildXL.Processes
                 out uint allocatedPoolEntries,
                 out ulong maxHandleMapEntries,
                 out ulong handleMapEntries,
+                out ulong handleMapContendedWrites,
+                out ulong handleMapContendedReads,
+                out ulong attachLocateManifestMicroseconds,
+                out ulong attachParseManifestMicroseconds,
+                out ulong attachHandleOverlayMicroseconds,
+                out ulong attachTransactionMicroseconds,
+                out ulong ntClosePoolExhaustions,
+                out ulong ntClosePoolRefills,
+                out ulong canonicalizations,
+                out ulong fastCanonicalizations,
+                out ulong injectedProcesses,
+                out ulong injectionImagesFromPeb,
+                out ulong injectionFindImageMicroseconds,
+                out ulong injectionAllocateMicroseconds,
+                out ulong injectionWriteImportsMicroseconds,
+                out ulong injectionChecksumMicroseconds,
+                out ulong attachCachedPrologues,
+                out ulong injectionApplyMappingMicroseconds,
+                out ulong injectionInheritedDeviceMaps,
+                out ulong policyResultCacheHits,
+                out ulong policyResultCacheMisses,
+                out ulong policyResultCacheEntries,
+                out ulong processAdmissionWaits,
+                out ulong processAdmissionWaitMicroseconds,
+                out ulong directoryQueriesAvoided,
+                out ulong fileStatQueries,
+                out ulong fileStatQueriesSaved,
+                out ulong sandboxOverheadMicroseconds,
+                out ulong policyResolutionMicroseconds,
+                out ulong reparsePointResolutionMicroseconds,
+                out ulong reportingMicroseconds,
+                out ulong handleOverlayLockMicroseconds,
+                out string detourStatistics,
+                out string featureCounters,
                 out string errorMessage)
             {
                 processName = default;
@@ -732,8 +1208,42 @@ namespace BuildXL.Processes
                 allocatedPoolEntries = 0;
                 maxHandleMapEntries = 0L;
                 handleMapEntries = 0L;
-
-                const int NumberOfEntriesInMessage = 24;
+                handleMapContendedWrites = 0L;
+                handleMapContendedReads = 0L;
+                attachLocateManifestMicroseconds = 0L;
+                attachParseManifestMicroseconds = 0L;
+                attachHandleOverlayMicroseconds = 0L;
+                attachTransactionMicroseconds = 0L;
+                ntClosePoolExhaustions = 0L;
+                ntClosePoolRefills = 0L;
+                canonicalizations = 0L;
+                fastCanonicalizations = 0L;
+                injectedProcesses = 0L;
+                injectionImagesFromPeb = 0L;
+                injectionFindImageMicroseconds = 0L;
+                injectionAllocateMicroseconds = 0L;
+                injectionWriteImportsMicroseconds = 0L;
+                injectionChecksumMicroseconds = 0L;
+                attachCachedPrologues = 0L;
+                injectionApplyMappingMicroseconds = 0L;
+                injectionInheritedDeviceMaps = 0L;
+                policyResultCacheHits = 0L;
+                policyResultCacheMisses = 0L;
+                policyResultCacheEntries = 0L;
+                processAdmissionWaits = 0L;
+                processAdmissionWaitMicroseconds = 0L;
+                directoryQueriesAvoided = 0L;
+                fileStatQueries = 0L;
+                fileStatQueriesSaved = 0L;
+                sandboxOverheadMicroseconds = 0L;
+                policyResolutionMicroseconds = 0L;
+                reparsePointResolutionMicroseconds = 0L;
+                reportingMicroseconds = 0L;
+                handleOverlayLockMicroseconds = 0L;
+                detourStatistics = string.Empty;
+                featureCounters = string.Empty;
+
+                const int NumberOfEntriesInMessage = 58;
 
                 var items = line.Split('|');
 
@@ -750,6 +1260,8 @@ namespace BuildXL.Processes
                 }
 
                 processName = items[15];
+                detourStatistics = items[56];
+                featureCounters = items[57];
 
                 if (uint.TryParse(items[0], NumberStyles.None, CultureInfo.InvariantCulture, out processId) &&
                     ulong.TryParse(items[1], NumberStyles.None, CultureInfo.InvariantCulture, out var readOperationCount) &&
@@ -773,7 +1285,39 @@ namespace BuildXL.Processes
                     ulong.TryParse(items[20], NumberStyles.None, CultureInfo.InvariantCulture, out finalDetoursHeapSizeInBytes) &&
                     uint.TryParse(items[21], NumberStyles.None, CultureInfo.InvariantCulture, out allocatedPoolEntries) &&
                     ulong.TryParse(items[22], NumberStyles.None, CultureInfo.InvariantCulture, out maxHandleMapEntries) &&
-                    ulong.TryParse(items[23], NumberStyles.None, CultureInfo.InvariantCulture, out handleMapEntries))
+                    ulong.TryParse(items[23], NumberStyles.None, CultureInfo.InvariantCulture, out handleMapEntries) &&
+                    ulong.TryParse(items[24], NumberStyles.None, CultureInfo.InvariantCulture, out handleMapContendedWrites) &&
+                    ulong.TryParse(items[25], NumberStyles.None, CultureInfo.InvariantCulture, out handleMapContendedReads) &&
+                    ulong.TryParse(items[26], NumberStyles.None, CultureInfo.InvariantCulture, out attachLocateManifestMicroseconds) &&
+                    ulong.TryParse(items[27], NumberStyles.None, CultureInfo.InvariantCulture, out attachParseManifestMicroseconds) &&
+                    ulong.TryParse(items[28], NumberStyles.None, CultureInfo.InvariantCulture, out attachHandleOverlayMicroseconds) &&
+                    ulong.TryParse(items[29], NumberStyles.None, CultureInfo.InvariantCulture, out attachTransactionMicroseconds) &&
+                    ulong.TryParse(items[30], NumberStyles.None, CultureInfo.InvariantCulture, out ntClosePoolExhaustions) &&
+                    ulong.TryParse(items[31], NumberStyles.None, CultureInfo.InvariantCulture, out ntClosePoolRefills) &&
+                    ulong.TryParse(items[32], NumberStyles.None, CultureInfo.InvariantCulture, out canonicalizations) &&
+                    ulong.TryParse(items[33], NumberStyles.None, CultureInfo.InvariantCulture, out fastCanonicalizations) &&
+                    ulong.TryParse(items[34], NumberStyles.None, CultureInfo.InvariantCulture, out injectedProcesses) &&
+                    ulong.TryParse(items[35], NumberStyles.None, CultureInfo.InvariantCulture, out injectionImagesFromPeb) &&
+                    ulong.TryParse(items[36], NumberStyles.None, CultureInfo.InvariantCulture, out injectionFindImageMicroseconds) &&
+                    ulong.TryParse(items[37], NumberStyles.None, CultureInfo.InvariantCulture, out injectionAllocateMicroseconds) &&
+                    ulong.TryParse(items[38], NumberStyles.None, CultureInfo.InvariantCulture, out injectionWriteImportsMicroseconds) &&
+                    ulong.TryParse(items[39], NumberStyles.None, CultureInfo.InvariantCulture, out injectionChecksumMicroseconds) &&
+                    ulong.TryParse(items[40], NumberStyles.None, CultureInfo.InvariantCulture, out attachCachedPrologues) &&
+                    ulong.TryParse(items[41], NumberStyles.None, CultureInfo.InvariantCulture, out injectionApplyMappingMicroseconds) &&
+                    ulong.TryParse(items[42], NumberStyles.None, CultureInfo.InvariantCulture, out injectionInheritedDeviceMaps) &&
+                    ulong.TryParse(items[43], NumberStyles.None, CultureInfo.InvariantCulture, out policyResultCacheHits) &&
+                    ulong.TryParse(items[44], NumberStyles.None, CultureInfo.InvariantCulture, out policyResultCacheMisses) &&
+                    ulong.TryParse(items[45], NumberStyles.None, CultureInfo.InvariantCulture, out policyResultCacheEntries) &&
+                    ulong.TryParse(items[46], NumberStyles.None, CultureInfo.InvariantCulture, out processAdmissionWaits) &&
+                    ulong.TryParse(items[47], NumberStyles.None, CultureInfo.InvariantCulture, out processAdmissionWaitMicroseconds) &&
+                    ulong.TryParse(items[48], NumberStyles.None, CultureInfo.InvariantCulture, out directoryQueriesAvoided) &&
+                    ulong.TryParse(items[49], NumberStyles.None, CultureInfo.InvariantCulture, out fileStatQueries) &&
+                    ulong.TryParse(items[50], NumberStyles.None, CultureInfo.InvariantCulture, out fileStatQueriesSaved) &&
+                    ulong.TryParse(items[51], NumberStyles.None, CultureInfo.InvariantCulture, out sandboxOverheadMicroseconds) &&
+                    ulong.TryParse(items[52], NumberStyles.None, CultureInfo.InvariantCulture, out policyResolutionMicroseconds) &&
+                    ulong.TryParse(items[53], NumberStyles.None, CultureInfo.InvariantCulture, out reparsePointResolutionMicroseconds) &&
+                    ulong.TryParse(items[54], NumberStyles.None, CultureInfo.InvariantCulture, out reportingMicroseconds) &&
+                    ulong.TryParse(items[55], NumberStyles.None, CultureInfo.InvariantCulture, out handleOverlayLockMicroseconds))
                 {
                     long fileTime = creationHighDateTime;
                     fileTime = fileTime << 32;
@@ -1016,5 +1560,354 @@ namespace BuildXL.Processes
                 return false;
             }
         }
+
+        /// <summary>
+        /// Parser for the binary report records sent by Detours when <see cref="FileAccessManifest.UseBinaryReportFormat"/> is set.
+        /// </summary>
+        /// <remarks>
+        /// Keep this in sync with ReportRecordHeader and FileAccessReportRecord declared in DataTypes.h.
+        /// Every record starts with a header of <see cref="HeaderSize"/> bytes: the total record size (uint32), the record version (uint16),
+        /// the <see cref="ReportType"/> (uint16) and the sequence of the record (uint64, see <see cref="GetSequence"/>). File access records continue with fixed-width fields followed by the operation, path,
+        /// filter and command line as length-prefixed, non-null-terminated UTF-16 strings. Process detouring status records are laid out the same way
+        /// (see <see cref="TryParseProcessDetouringStatus"/>). Records of any other type carry a regular text report line.
+        /// </remarks>
+        internal sealed class FileAccessReportRecord
+        {
+            /// <summary>
+            /// Size in bytes of the header that starts every record.
+            /// </summary>
+            public const int HeaderSize = 16;
+
+            /// <summary>
+            /// Size in bytes of the fixed part of a file access record, including the header.
+            /// </summary>
+            public const int FixedSize = 112;
+
+            /// <summary>
+            /// Size in bytes of the fixed part of a process detouring status record, including the header.
+            /// </summary>
+            public const int ProcessDetouringStatusFixedSize = 96;
+
+            /// <summary>
+            /// Record version this parser understands.
+            /// </summary>
+            public const ushort Version = 5;
+
+            private const uint PathIsManifestPath = 0x1;
+            private const uint PathDefinesLocalId = 0x2;
+            private const uint PathUsesLocalId = 0x4;
+
+            private const uint CommandLineSentBefore = 0x1;
+            private const uint NoApplicationName = 0x2;
+
+            private readonly PathTable m_pathTable;
+
+            /// <summary>
+            /// Paths interned by the detoured processes, keyed by process id (high 32 bits) and process-local path id (low 32 bits).
+            /// </summary>
+            private readonly Dictionary<ulong, string> m_localPaths = new Dictionary<ulong, string>();
+
+            /// <summary>
+            /// Creates a parser. A parser keeps the paths interned by the detoured processes, so use one per report stream.
+            /// </summary>
+            public FileAccessReportRecord(PathTable pathTable)
+            {
+                Contract.Requires(pathTable != null);
+                m_pathTable = pathTable;
+            }
+
+            /// <summary>
+            /// Reads a record header, returning false if the header is malformed or not yet complete.
+            /// </summary>
+            public static bool TryReadHeader(ArraySegment<byte> data, out int size, out ReportType reportType)
+            {
+                size = 0;
+                reportType = ReportType.None;
+
+                if (data.Count < HeaderSize)
+                {
+                    return false;
+                }
+
+                size = unchecked((int)BitConverter.ToUInt32(data.Array, data.Offset));
+                var version = BitConverter.ToUInt16(data.Array, data.Offset + 4);
+                reportType = (ReportType)BitConverter.ToUInt16(data.Array, data.Offset + 6);
+
+                return size >= HeaderSize && version == Version && reportType > ReportType.None && reportType < ReportType.Max;
+            }
+
+            /// <summary>
+            /// Gets the position of a record among the records of all the processes of the pip, or 0 if the record is not ordered.
+            /// </summary>
+            /// <remarks>
+            /// Only set with <see cref="FileAccessManifest.SequenceReports"/>. Records buffered by different processes may arrive out of order;
+            /// sorting them by sequence restores the order in which they were produced.
+            /// </remarks>
+            public static ulong GetSequence(ArraySegment<byte> record)
+            {
+                Contract.Requires(record.Count >= HeaderSize);
+                return BitConverter.ToUInt64(record.Array, record.Offset + 8);
+            }
+
+            /// <summary>
+            /// Gets the identity of the file a file access record is about: the serial number of its volume and its 128-bit file id.
+            /// Returns false if Detours did not know it (it only sends it when it got it at no extra cost, e.g. along with the USN).
+            /// </summary>
+            /// <remarks>
+            /// Unlike paths, the identity needs no case-insensitive comparison, so it can key the files of a pip cheaply.
+            /// </remarks>
+            public static bool TryGetFileIdentity(ArraySegment<byte> record, out ulong volumeSerialNumber, out ulong fileIdLow, out ulong fileIdHigh)
+            {
+                Contract.Requires(record.Count >= FixedSize);
+
+                volumeSerialNumber = BitConverter.ToUInt64(record.Array, record.Offset + HeaderSize + 72);
+                fileIdLow = BitConverter.ToUInt64(record.Array, record.Offset + HeaderSize + 80);
+                fileIdHigh = BitConverter.ToUInt64(record.Array, record.Offset + HeaderSize + 88);
+                return volumeSerialNumber != 0 || fileIdLow != 0 || fileIdHigh != 0;
+            }
+
+            /// <summary>
+            /// Decodes the text line carried by a record whose type is not <see cref="ReportType.FileAccess"/>.
+            /// </summary>
+            /// <remarks>
+            /// The returned line can be passed to <see cref="ReportLineReceived(string)"/>.
+            /// </remarks>
+            public static string GetTextLine(ArraySegment<byte> record)
+            {
+                Contract.Requires(record.Count >= HeaderSize);
+                return System.Text.Encoding.Unicode.GetString(record.Array, record.Offset + HeaderSize, record.Count - HeaderSize).TrimEnd('\r', '\n');
+            }
+
+            /// <summary>
+            /// Parses a whole file access record. Matches <see cref="FileAccessReportProvider{T}"/> so that it can be passed to <see cref="ReportFileAccess{T}"/>.
+            /// </summary>
+            public bool TryParse(
+                ref ArraySegment<byte> record,
+                out uint processId,
+                out ReportedFileOperation operation,
+                out RequestedAccess requestedAccess,
+                out FileAccessStatus status,
+                out bool explicitlyReported,
+                out uint error,
+                out Usn usn,
+                out DesiredAccess desiredAccess,
+                out ShareMode shareMode,
+                out CreationDisposition creationDisposition,
+                out FlagsAndAttributes flagsAndAttributes,
+                out AbsolutePath absolutePath,
+                out string path,
+                out string enumeratePattern,
+                out string processArgs,
+                out string errorMessage)
+            {
+                operation = ReportedFileOperation.Unknown;
+                requestedAccess = RequestedAccess.None;
+                status = FileAccessStatus.None;
+                processId = error = 0;
+                usn = default;
+                explicitlyReported = false;
+                desiredAccess = 0;
+                shareMode = ShareMode.FILE_SHARE_NONE;
+                creationDisposition = 0;
+                flagsAndAttributes = 0;
+                absolutePath = AbsolutePath.Invalid;
+                path = null;
+                enumeratePattern = null;
+                processArgs = null;
+                errorMessage = string.Empty;
+
+                if (!TryReadHeader(record, out int size, out var reportType) || reportType != ReportType.FileAccess || size != record.Count || size < FixedSize)
+                {
+                    errorMessage = I($"Malformed file access record (potentially due to pipe corruption): size {record.Count}, header size {size}, type {reportType}");
+                    return false;
+                }
+
+                byte[] bytes = record.Array;
+                int offset = record.Offset + HeaderSize;
+
+                processId = BitConverter.ToUInt32(bytes, offset);
+                uint requestedAccessValue = BitConverter.ToUInt32(bytes, offset + 4);
+                uint statusValue = BitConverter.ToUInt32(bytes, offset + 8);
+                explicitlyReported = BitConverter.ToUInt32(bytes, offset + 12) != 0;
+                error = BitConverter.ToUInt32(bytes, offset + 16);
+                desiredAccess = (DesiredAccess)BitConverter.ToUInt32(bytes, offset + 20);
+                shareMode = (ShareMode)BitConverter.ToUInt32(bytes, offset + 24);
+                creationDisposition = (CreationDisposition)BitConverter.ToUInt32(bytes, offset + 28);
+                flagsAndAttributes = (FlagsAndAttributes)BitConverter.ToUInt32(bytes, offset + 32);
+                absolutePath = new AbsolutePath(unchecked((int)BitConverter.ToUInt32(bytes, offset + 36)));
+                usn = new Usn(BitConverter.ToUInt64(bytes, offset + 40));
+
+                long operationLength = BitConverter.ToUInt32(bytes, offset + 48);
+                long pathLength = BitConverter.ToUInt32(bytes, offset + 52);
+                long filterLength = BitConverter.ToUInt32(bytes, offset + 56);
+                long commandLineLength = BitConverter.ToUInt32(bytes, offset + 60);
+                uint localPathId = BitConverter.ToUInt32(bytes, offset + 64);
+                uint pathFlags = BitConverter.ToUInt32(bytes, offset + 68);
+
+                if (FixedSize + 2 * (operationLength + pathLength + filterLength + commandLineLength) != size)
+                {
+                    errorMessage = I($"Malformed file access record: string lengths ({operationLength}, {pathLength}, {filterLength}, {commandLineLength}) do not match record size {size}");
+                    return false;
+                }
+
+                if (statusValue > (uint)FileAccessStatus.CannotDeterminePolicy)
+                {
+                    errorMessage = I($"Unknown file access status '{statusValue}'");
+                    return false;
+                }
+
+                if (requestedAccessValue > (uint)RequestedAccess.All)
+                {
+                    errorMessage = I($"Unknown requested access '{requestedAccessValue}'");
+                    return false;
+                }
+
+                requestedAccess = (RequestedAccess)requestedAccessValue;
+                status = (FileAccessStatus)statusValue;
+
+                int stringOffset = record.Offset + FixedSize;
+                string operationName = ReadString(bytes, ref stringOffset, operationLength);
+
+                if (!FileAccessReportLine.Operations.TryGetValue(operationName, out operation))
+                {
+                    // Be conservative like the text parser: an unknown operation does not invalidate the rest of the record.
+                    operation = ReportedFileOperation.Unknown;
+                }
+
+                path = ReadString(bytes, ref stringOffset, pathLength);
+
+                if ((pathFlags & PathIsManifestPath) != 0)
+                {
+                    if (!absolutePath.IsValid)
+                    {
+                        errorMessage = "File access record refers to the manifest path but carries no valid path id";
+                        return false;
+                    }
+
+                    path = absolutePath.ToString(m_pathTable);
+                }
+                else if ((pathFlags & PathDefinesLocalId) != 0)
+                {
+                    // A process id may be reused within a pip; the new process redefines its ids before using them.
+                    m_localPaths[((ulong)processId << 32) | localPathId] = path;
+                }
+                else if ((pathFlags & PathUsesLocalId) != 0)
+                {
+                    if (!m_localPaths.TryGetValue(((ulong)processId << 32) | localPathId, out path))
+                    {
+                        errorMessage = I($"File access record refers to unknown path id {localPathId} of process {processId}");
+                        return false;
+                    }
+                }
+
+                enumeratePattern = ReadString(bytes, ref stringOffset, filterLength);
+                processArgs = ReadString(bytes, ref stringOffset, commandLineLength);
+
+                if (requestedAccess != RequestedAccess.Enumerate)
+                {
+                    // If the requested access is not enumeration, enumeratePattern does not matter.
+                    enumeratePattern = null;
+                }
+
+                return true;
+            }
+
+            /// <summary>
+            /// Parses a whole process detouring status record.
+            /// </summary>
+            /// <remarks>
+            /// A process sends the command line of a child in full in the first status it reports for it only. Later records carry
+            /// <paramref name="commandLineHash"/> alone, with <paramref name="commandLineSentBefore"/> set and an empty <paramref name="startCommandLine"/>.
+            /// </remarks>
+            public static bool TryParseProcessDetouringStatus(
+                ArraySegment<byte> record,
+                out ulong processId,
+                out uint reportStatus,
+                out string processName,
+                out string startApplicationName,
+                out string startCommandLine,
+                out ulong commandLineHash,
+                out bool commandLineSentBefore,
+                out bool needsInjection,
+                out ulong hJob,
+                out bool disableDetours,
+                out uint creationFlags,
+                out bool detoured,
+                out uint error,
+                out uint createProcessStatusReturn,
+                out ProcessDetouringTimings timings,
+                out string errorMessage)
+            {
+                timings = default;
+                processId = hJob = commandLineHash = 0;
+                reportStatus = creationFlags = error = createProcessStatusReturn = 0;
+                needsInjection = disableDetours = detoured = commandLineSentBefore = false;
+                processName = startApplicationName = startCommandLine = null;
+                errorMessage = string.Empty;
+
+                if (!TryReadHeader(record, out int size, out var reportType)
+                    || reportType != ReportType.ProcessDetouringStatus
+                    || size != record.Count
+                    || size < ProcessDetouringStatusFixedSize)
+                {
+                    errorMessage = I($"Malformed process detouring status record (potentially due to pipe corruption): size {record.Count}, header size {size}, type {reportType}");
+                    return false;
+                }
+
+                byte[] bytes = record.Array;
+                int offset = record.Offset + HeaderSize;
+
+                processId = BitConverter.ToUInt32(bytes, offset);
+                reportStatus = BitConverter.ToUInt32(bytes, offset + 4);
+                needsInjection = BitConverter.ToUInt32(bytes, offset + 8) != 0;
+                disableDetours = BitConverter.ToUInt32(bytes, offset + 12) != 0;
+                creationFlags = BitConverter.ToUInt32(bytes, offset + 16);
+                detoured = BitConverter.ToUInt32(bytes, offset + 20) != 0;
+                error = BitConverter.ToUInt32(bytes, offset + 24);
+                createProcessStatusReturn = BitConverter.ToUInt32(bytes, offset + 28);
+                hJob = BitConverter.ToUInt64(bytes, offset + 32);
+                commandLineHash = BitConverter.ToUInt64(bytes, offset + 40);
+
+                long processNameLength = BitConverter.ToUInt32(bytes, offset + 48);
+                long applicationNameLength = BitConverter.ToUInt32(bytes, offset + 52);
+                long commandLineLength = BitConverter.ToUInt32(bytes, offset + 56);
+                uint flags = BitConverter.ToUInt32(bytes, offset + 60);
+
+                timings = new ProcessDetouringTimings(
+                    attributesMicroseconds: BitConverter.ToUInt32(bytes, offset + 64),
+                    createProcessMicroseconds: BitConverter.ToUInt32(bytes, offset + 68),
+                    injectionMicroseconds: BitConverter.ToUInt32(bytes, offset + 72),
+                    resumeMicroseconds: BitConverter.ToUInt32(bytes, offset + 76));
+
+                if (ProcessDetouringStatusFixedSize + 2 * (processNameLength + applicationNameLength + commandLineLength) != size)
+                {
+                    errorMessage = I($"Malformed process detouring status record: string lengths ({processNameLength}, {applicationNameLength}, {commandLineLength}) do not match record size {size}");
+                    return false;
+                }
+
+                commandLineSentBefore = (flags & CommandLineSentBefore) != 0;
+
+                int stringOffset = record.Offset + ProcessDetouringStatusFixedSize;
+                processName = ReadString(bytes, ref stringOffset, processNameLength);
+                startApplicationName = ReadString(bytes, ref stringOffset, applicationNameLength);
+                startCommandLine = ReadString(bytes, ref stringOffset, commandLineLength);
+
+                if ((flags & NoApplicationName) != 0)
+                {
+                    // What the text report sends for a missing application name.
+                    startApplicationName = "null";
+                }
+
+                return true;
+            }
+
+            private static string ReadString(byte[] bytes, ref int offset, long length)
+            {
+                int byteCount = (int)(2 * length);
+                string result = byteCount == 0 ? string.Empty : System.Text.Encoding.Unicode.GetString(bytes, offset, byteCount);
+                offset += byteCount;
+                return result;
+            }
+        }
     }
 }
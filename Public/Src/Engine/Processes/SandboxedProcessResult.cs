@@ -91,6 +91,26 @@ namespace BuildXL.Processes
         /// </summary>
         public IReadOnlyList<ProcessDetouringStatusData> DetouringStatuses { get; internal set; }
 
+        /// <summary>
+        /// Optional list of the content hashes of the outputs computed while they were written (see <see cref="FileAccessManifest.HashOutputsWhileWriting"/>).
+        /// </summary>
+        /// <remarks>
+        /// These only cover the writes made through the handle each hash was computed for (see <see cref="OutputContentHash"/>), so they are
+        /// hints for diagnostics and tests: the engine does not store them as the content hashes of the outputs, which it hashes itself.
+        /// </remarks>
+        public IReadOnlyList<OutputContentHash> OutputContentHashes { get; internal set; }
+
+        /// <summary>
+        /// Optional profile of the lookups of the manifest tree (see <see cref="FileAccessManifest.ProfileManifestLookups"/>).
+        /// </summary>
+        public ManifestLookupProfile ManifestLookupProfile { get; internal set; }
+
+        /// <summary>
+        /// Optional counters the detoured processes reported in their process data (see <see cref="FileAccessManifest.LogProcessData"/>), by name
+        /// and summed over the processes, e.g. to tell whether an optional feature of the sandbox engaged.
+        /// </summary>
+        public IReadOnlyDictionary<string, ulong> ProcessDataCounters { get; internal set; }
+
         /// <summary>
         /// Path of the memory dump created if a process times out. This may be null if the process did not time out
         /// or if capturing the dump failed. By default, this will be placed in the process's working directory.
@@ -182,6 +202,9 @@ namespace BuildXL.Processes
             writer.Write(AllUnexpectedFileAccesses, (w, v) => w.WriteReadOnlyList(v.ToList(), (w2, v2) => v2.Serialize(writer, processMap, writePath: null)));
             writer.Write(Processes, (w, v) => w.WriteReadOnlyList(v, (w2, v2) => w2.Write(processMap[v2])));
             writer.Write(DetouringStatuses, (w, v) => w.WriteReadOnlyList(v, (w2, v2) => v2.Serialize(w2)));
+            writer.Write(OutputContentHashes, (w, v) => w.WriteReadOnlyList(v, (w2, v2) => v2.Serialize(w2)));
+            writer.Write(ManifestLookupProfile, (w, v) => v.Serialize(w));
+            writer.Write(ProcessDataCounters, (w, v) => w.WriteReadOnlyList(v.ToList(), (w2, v2) => { w2.Write(v2.Key); w2.Write(v2.Value); }));
             writer.WriteNullableString(DumpFileDirectory);
             writer.WriteNullableString(DumpCreationException?.Message);
             writer.WriteNullableString(StandardInputException?.Message);
@@ -229,6 +252,9 @@ namespace BuildXL.Processes
             IReadOnlyList<ReportedFileAccess> allUnexpectedFileAccesses = reader.ReadNullable(r => r.ReadReadOnlyList(r2 => ReportedFileAccess.Deserialize(r2, allReportedProcesses, readPath: null)));
             IReadOnlyList<ReportedProcess> processes = reader.ReadNullable(r => r.ReadReadOnlyList(r2 => allReportedProcesses[r2.ReadInt32()]));
             IReadOnlyList<ProcessDetouringStatusData> detouringStatuses = reader.ReadNullable(r => r.ReadReadOnlyList(r2 => ProcessDetouringStatusData.Deserialize(r2)));
+            IReadOnlyList<OutputContentHash> outputContentHashes = reader.ReadNullable(r => r.ReadReadOnlyList(r2 => OutputContentHash.Deserialize(r2)));
+            ManifestLookupProfile manifestLookupProfile = reader.ReadNullable(r => ManifestLookupProfile.Deserialize(r));
+            IReadOnlyList<KeyValuePair<string, ulong>> processDataCounters = reader.ReadNullable(r => r.ReadReadOnlyList(r2 => new KeyValuePair<string, ulong>(r2.ReadString(), r2.ReadUInt64())));
             string dumpFileDirectory = reader.ReadNullableString();
             string dumpCreationExceptionMessage = reader.ReadNullableString();
             string standardInputExceptionMessage = reader.ReadNullableString();
@@ -257,6 +283,9 @@ namespace BuildXL.Processes
                 AllUnexpectedFileAccesses = allUnexpectedFileAccesses != null ? new HashSet<ReportedFileAccess>(allUnexpectedFileAccesses) : null,
                 Processes = processes,
                 DetouringStatuses = detouringStatuses,
+                OutputContentHashes = outputContentHashes,
+                ManifestLookupProfile = manifestLookupProfile,
+                ProcessDataCounters = processDataCounters?.ToDictionary(kvp => kvp.Key, kvp => kvp.Value),
                 DumpFileDirectory = dumpFileDirectory,
                 DumpCreationException = dumpCreationExceptionMessage != null ? new Exception(dumpCreationExceptionMessage) : null,
                 StandardInputException = standardInputExceptionMessage != null ? new Exception(standardInputExceptionMessage) : null,
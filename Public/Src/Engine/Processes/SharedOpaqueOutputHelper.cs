@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 using System;
+using System.Collections.Generic;
 using System.Security.AccessControl;
 using BuildXL.Native.IO;
 using BuildXL.Utilities;
@@ -125,5 +126,44 @@ namespace BuildXL.Processes
 #endif
             }
         }
+
+        /// <summary>
+        /// Same as <see cref="EnforceFileIsSharedOpaqueOutput"/> for each of <paramref name="expandedPaths"/>, with the time stamps
+        /// of all the files that need it set in one batch.
+        /// </summary>
+        public static void EnforceFilesAreSharedOpaqueOutputs(IReadOnlyList<string> expandedPaths)
+        {
+#if PLATFORM_OSX
+            var pathsToFlag = new List<string>();
+            foreach (string expandedPath in expandedPaths)
+            {
+                if (!IsSharedOpaqueOutput(expandedPath))
+                {
+                    pathsToFlag.Add(expandedPath);
+                }
+            }
+
+            if (pathsToFlag.Count == 0)
+            {
+                return;
+            }
+
+            bool[] flagged = FileUtilities.TrySetFileTimestamps(pathsToFlag, new FileTimestamps(WellKnownTimestamps.OutputInSharedOpaqueTimestamp));
+            for (int i = 0; i < pathsToFlag.Count; i++)
+            {
+                if (!flagged[i])
+                {
+                    // Gives races a second chance and reports the failure as the individual variant does
+                    SetPathAsSharedOpaqueOutput(pathsToFlag[i]);
+                }
+            }
+#else
+            // Writing attributes may have to be allowed first on each file (see EnforceFileIsSharedOpaqueOutput), which does not batch
+            foreach (string expandedPath in expandedPaths)
+            {
+                EnforceFileIsSharedOpaqueOutput(expandedPath);
+            }
+#endif
+        }
     }
 }
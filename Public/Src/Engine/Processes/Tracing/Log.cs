@@ -403,13 +403,35 @@ namespace BuildXL.Processes.Tracing
             string pipDescription,
             string policyFilePath);
 
+        [GeneratedEvent(
+            (int)EventId.LogPipProcessData,
+            EventGenerators = EventGenerators.LocalOnly,
+            EventLevel = Level.Verbose,
+            Keywords = (int)(Events.Keywords.UserMessage | Events.Keywords.Diagnostics),
+            EventTask = (int)Events.Tasks.PipExecutor,
+            Message = Events.PipPrefix + "The {numberOfProcesses} processes of the pip took {userTimeMs}ms of user time and {kernelTimeMs}ms of kernel time, with a peak memory usage of {peakMemoryUsageInBytes} bytes. They made {readOperationCount} reads of {readTransferCount} bytes, {writeOperationCount} writes of {writeTransferCount} bytes and {otherOperationCount} other operations of {otherTransferCount} bytes.")]
+        public abstract void LogPipProcessData(
+            LoggingContext context,
+            long pipSemiStableHash,
+            string pipDescription,
+            uint numberOfProcesses,
+            long userTimeMs,
+            long kernelTimeMs,
+            ulong peakMemoryUsageInBytes,
+            ulong readOperationCount,
+            ulong readTransferCount,
+            ulong writeOperationCount,
+            ulong writeTransferCount,
+            ulong otherOperationCount,
+            ulong otherTransferCount);
+
         [GeneratedEvent(
             (int)EventId.LogDetoursMaxHeapSize,
             EventGenerators = EventGenerators.LocalOnly,
             EventLevel = Level.Verbose,
             Keywords = (int)(Events.Keywords.UserMessage | Events.Keywords.Diagnostics),
             EventTask = (int)Events.Tasks.PipExecutor,
-            Message = Events.PipPrefix + "Maximum detours heap size for process in the pip is {maxDetoursHeapSizeInBytes} bytes. The processName '{processName}'. The processId is: {processId}. The manifestSize in bytes is: {manifestSizeInBytes}. The finalDetoursHeapSize in bytes is: {finalDetoursHeapSizeInBytes}. The allocatedPoolEntries is: {allocatedPoolEntries}. The maxHandleMapEntries is: {maxHandleMapEntries}. The handleMapEntries is: {handleMapEntries}.")]
+            Message = Events.PipPrefix + "Maximum detours heap size for process in the pip is {maxDetoursHeapSizeInBytes} bytes. The processName '{processName}'. The processId is: {processId}. The manifestSize in bytes is: {manifestSizeInBytes}. The finalDetoursHeapSize in bytes is: {finalDetoursHeapSizeInBytes}. The allocatedPoolEntries is: {allocatedPoolEntries}. The maxHandleMapEntries is: {maxHandleMapEntries}. The handleMapEntries is: {handleMapEntries}. The handleMapContendedWrites is: {handleMapContendedWrites}. The handleMapContendedReads is: {handleMapContendedReads}. DllProcessAttach took {attachLocateManifestMicroseconds}us to locate the manifest, {attachParseManifestMicroseconds}us to parse it, {attachHandleOverlayMicroseconds}us to initialize the handle map and {attachTransactionMicroseconds}us to detour functions, {attachCachedPrologues} of them with the prologue from the parent's cache. The NtClose handle pool ran out {ntClosePoolExhaustions} times and got grown {ntClosePoolRefills} times. {fastCanonicalizations} of the {canonicalizations} canonicalized paths were already canonical. {injectedProcesses} child processes were injected, {injectionImagesFromPeb} of them found from their PEB, taking {injectionFindImageMicroseconds}us to find their image, {injectionAllocateMicroseconds}us to allocate their import tables, {injectionWriteImportsMicroseconds}us to write them and {injectionChecksumMicroseconds}us to checksum. Applying the device map to child processes took {injectionApplyMappingMicroseconds}us, and {injectionInheritedDeviceMaps} child processes inherited it instead. The policy result cache had {policyResultCacheHits} hits and {policyResultCacheMisses} misses, and holds {policyResultCacheEntries} paths. {processAdmissionWaits} child processes waited {processAdmissionWaitMicroseconds}us in total for the process admission gate. {directoryQueriesAvoided} directory checks needed no query of the file system. The attributes of opened files were queried {fileStatQueries} times, and {fileStatQueriesSaved} checks were answered from a query made for another one. The detours spent {sandboxOverheadMicroseconds}us around the real functions ({sandboxOverheadPercent}% of the lifetime of the process): {policyResolutionMicroseconds}us resolving policies, {reparsePointResolutionMicroseconds}us resolving reparse points, {reportingMicroseconds}us reporting and {handleOverlayLockMicroseconds}us in the handle map lock. The detoured function statistics are: '{detourStatistics}'.")]
         public abstract void LogDetoursMaxHeapSize(
             LoggingContext context,
             long pipSemiStableHash,
@@ -421,7 +443,41 @@ namespace BuildXL.Processes.Tracing
             ulong finalDetoursHeapSizeInBytes,
             uint allocatedPoolEntries,
             ulong maxHandleMapEntries,
-            ulong handleMapEntries);
+            ulong handleMapEntries,
+            ulong handleMapContendedWrites,
+            ulong handleMapContendedReads,
+            ulong attachLocateManifestMicroseconds,
+            ulong attachParseManifestMicroseconds,
+            ulong attachHandleOverlayMicroseconds,
+            ulong attachTransactionMicroseconds,
+            ulong ntClosePoolExhaustions,
+            ulong ntClosePoolRefills,
+            ulong canonicalizations,
+            ulong fastCanonicalizations,
+            ulong injectedProcesses,
+            ulong injectionImagesFromPeb,
+            ulong injectionFindImageMicroseconds,
+            ulong injectionAllocateMicroseconds,
+            ulong injectionWriteImportsMicroseconds,
+            ulong injectionChecksumMicroseconds,
+            ulong attachCachedPrologues,
+            ulong injectionApplyMappingMicroseconds,
+            ulong injectionInheritedDeviceMaps,
+            ulong policyResultCacheHits,
+            ulong policyResultCacheMisses,
+            ulong policyResultCacheEntries,
+            ulong processAdmissionWaits,
+            ulong processAdmissionWaitMicroseconds,
+            ulong directoryQueriesAvoided,
+            ulong fileStatQueries,
+            ulong fileStatQueriesSaved,
+            ulong sandboxOverheadMicroseconds,
+            ulong sandboxOverheadPercent,
+            ulong policyResolutionMicroseconds,
+            ulong reparsePointResolutionMicroseconds,
+            ulong reportingMicroseconds,
+            ulong handleOverlayLockMicroseconds,
+            string detourStatistics);
 
         [GeneratedEvent(
             (int)EventId.LogInternalDetoursErrorFileNotEmpty,
@@ -122,11 +122,20 @@ namespace BuildXL.Processes
             Contract.Requires(!Started, "Process was already started.  Cannot start process more than once.");
 
             CreateAndSetUpProcess();
-            m_processExecutor.Start();
+            StartProcess();
 
             SetProcessStartedExecuting();
         }
 
+        /// <summary>
+        /// Starts <see cref="Process"/> once <see cref="CreateAndSetUpProcess"/> has set it up.
+        /// </summary>
+        protected void StartProcess()
+        {
+            Contract.Requires(Process != null);
+            m_processExecutor.Start();
+        }
+
         private int m_processId = -1;
 
         /// <inheritdoc />
@@ -217,6 +226,7 @@ namespace BuildXL.Processes
                 AllUnexpectedFileAccesses           = reports?.FileUnexpectedAccesses ?? s_emptyFileAccessesSet,
                 FileAccesses                        = fileAccesses,
                 DetouringStatuses                   = reports?.ProcessDetoursStatuses,
+                OutputContentHashes                 = reports?.OutputContentHashes,
                 ExplicitlyReportedFileAccesses      = reports?.ExplicitlyReportedFileAccesses,
                 Processes                           = CoalesceProcesses(reports?.Processes),
                 MessageProcessingFailure            = reports?.MessageProcessingFailure,
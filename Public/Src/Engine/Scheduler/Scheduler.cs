@@ -203,7 +203,7 @@ namespace BuildXL.Scheduler
         /// Indicates if processes should be scheduled using the macOS sandbox when BuildXL is executing
         /// </summary>
         protected virtual bool SandboxingWithKextEnabled =>
-            OperatingSystemHelper.IsUnixOS &&
+            OperatingSystemHelper.IsMacOS &&
             m_configuration.Sandbox.UnsafeSandboxConfiguration.SandboxKind != SandboxKind.None;
 
         /// <summary>
@@ -955,6 +955,11 @@ namespace BuildXL.Scheduler
         /// </summary>
         private PerformanceCollector.MachinePerfInfo m_perfInfo;
 
+        /// <summary>
+        /// Gate the detoured processes of the pips wait on before they start a child process, if /processAdmissionThresholdPercent is set.
+        /// </summary>
+        private ProcessAdmissionGate m_processAdmissionGate;
+
         /// <summary>
         /// Samples performance characteristics of the execution phase
         /// </summary>
@@ -3553,13 +3558,16 @@ namespace BuildXL.Scheduler
             {
                 // Directory outputs are reported only when the pip is successful. So we need to rely on the raw shared dynamic write accesses,
                 // since flagging also happens on failed pips
+                var writesInSharedOpaques = new List<string>();
                 foreach (IReadOnlyCollection<AbsolutePath> writesPerSharedOpaque in process.ExecutionResult.SharedDynamicDirectoryWriteAccesses.Values)
                 {
                     foreach (AbsolutePath writeInPath in writesPerSharedOpaque)
                     {
-                        SharedOpaqueOutputHelper.EnforceFileIsSharedOpaqueOutput(writeInPath.ToString(environment.Context.PathTable));
+                        writesInSharedOpaques.Add(writeInPath.ToString(environment.Context.PathTable));
                     }
                 }
+
+                SharedOpaqueOutputHelper.EnforceFilesAreSharedOpaqueOutputs(writesInSharedOpaques);
             }
         }
 
@@ -4580,6 +4588,7 @@ namespace BuildXL.Scheduler
                 m_executePhaseLoggingContext = pm.LoggingContext;
 
                 m_hasFailures = m_hasFailures || InitSandboxedKextConnection(loggingContext, kextConnection);
+                InitProcessAdmissionGate();
 
                 PrioritizeAndSchedule(pm.LoggingContext, nodesToSchedule);
 
@@ -4599,11 +4608,27 @@ namespace BuildXL.Scheduler
                 try
                 {
                     // Setup the kernel extension connection so we can potentially execute pips later
-                    if (kextConnection == null)
+                    if (kextConnection == null && m_configuration.Sandbox.UnsafeSandboxConfiguration.SandboxKind == SandboxKind.MacOsEndpointSecurity)
+                    {
+                        // The Endpoint Security client does not throttle processes, so it needs no resource usage
+                        kextConnection = new EndpointSecurityConnection(new EndpointSecurityConnection.Config
+                        {
+                            MeasureCpuTimes = m_configuration.Sandbox.KextMeasureProcessCpuTimes,
+                            FailureCallback = (int status, string description) =>
+                            {
+                                Logger.Log.KextFailureNotificationReceived(loggingContext, status, description);
+                                RequestTermination();
+                            },
+                        });
+                    }
+                    else if (kextConnection == null)
                     {
                         var config = new KextConnection.Config
                         {
                             MeasureCpuTimes = m_configuration.Sandbox.KextMeasureProcessCpuTimes,
+                            PipReportRingCapacity = m_configuration.Sandbox.KextPipReportRingCapacity,
+                            ListenerSpinMicroseconds = m_configuration.Sandbox.KextListenerSpinUs,
+                            ListenerQosClass = m_configuration.Sandbox.KextListenerQosClass,
                             FailureCallback = (int status, string description) =>
                             {
                                 Logger.Log.KextFailureNotificationReceived(loggingContext, status, description);
@@ -4613,16 +4638,38 @@ namespace BuildXL.Scheduler
                             {
                                 ReportQueueSizeMB = m_configuration.Sandbox.KextReportQueueSizeMb,
                                 EnableReportBatching = m_configuration.Sandbox.KextEnableReportBatching,
+                                EnableCompactReports = true,
+                                NumReportQueues = m_configuration.Sandbox.KextNumReportQueues,
+                                PathCacheBudget = m_configuration.Sandbox.KextPathCacheBudget,
+                                MapPipPayloads = m_configuration.Sandbox.KextMapPipPayloads,
+                                IgnoredOperationClasses = (Sandbox.OperationClasses)m_configuration.Sandbox.KextIgnoredOperationClasses,
+                                ReportCoalescingWindowUs = m_configuration.Sandbox.KextReportCoalescingWindowUs,
+                                EnablePriorityReportQueue = m_configuration.Sandbox.KextEnablePriorityReportQueue,
+                                SummarizeWhenLagging = m_configuration.Sandbox.KextSummarizeReportsWhenLagging,
+                                TimingSampleRate = m_configuration.Sandbox.KextTimingSampleRate,
+                                MaxPipReportRate = m_configuration.Sandbox.KextMaxPipReportRate,
                                 ResourceThresholds = new Sandbox.ResourceThresholds
                                 {
                                     CpuUsageBlockPercent = m_configuration.Sandbox.KextThrottleCpuUsageBlockThresholdPercent,
                                     CpuUsageWakeupPercent = m_configuration.Sandbox.KextThrottleCpuUsageWakeupThresholdPercent,
                                     MinAvailableRamMB = m_configuration.Sandbox.KextThrottleMinAvailableRamMB,
+                                    RamWakeupMarginMB = m_configuration.Sandbox.KextThrottleRamWakeupMarginMB,
+                                    CpuSampleIntervalMs = m_configuration.Sandbox.KextThrottleCpuSampleIntervalMs,
+                                    CacheShrinkRamMB = m_configuration.Sandbox.KextCacheShrinkRamMB,
                                 }
                             }
                         };
                         kextConnection = new KextConnection(config);
-                        if (m_performanceAggregator != null && config.KextConfig.Value.ResourceThresholds.IsProcessThrottlingEnabled())
+                        // Available RAM also decides when the sandbox kernel extension shrinks its caches
+                        bool resourceUsageNeeded = config.KextConfig.Value.ResourceThresholds.IsProcessThrottlingEnabled()
+                            || m_configuration.Sandbox.KextCacheShrinkRamMB > 0;
+
+                        // The native sampler pushes resource usage until the connection is disposed, even while this process is busy or in a GC
+                        bool sampledNatively = resourceUsageNeeded
+                            && m_configuration.Sandbox.KextThrottleResourceSampleIntervalMs > 0
+                            && kextConnection.StartResourceSampler(m_configuration.Sandbox.KextThrottleResourceSampleIntervalMs);
+
+                        if (m_performanceAggregator != null && resourceUsageNeeded && !sampledNatively)
                         {
                             m_performanceAggregator.MachineCpu.OnChange += (aggregator) =>
                             {
@@ -4648,6 +4695,23 @@ namespace BuildXL.Scheduler
             return false;
         }
 
+        /// <summary>
+        /// Creates the machine-wide gate the detoured processes of the pips wait on before they start a child process, when
+        /// /processAdmissionThresholdPercent is set (see <see cref="ProcessAdmissionGate"/>).
+        /// </summary>
+        private void InitProcessAdmissionGate()
+        {
+            uint threshold = m_configuration.Sandbox.ProcessAdmissionThresholdPercent;
+            if (threshold == 0 || OperatingSystemHelper.IsUnixOS || m_processAdmissionGate != null)
+            {
+                return;
+            }
+
+            // The gate opens again once the machine is some margin below the threshold, so the threshold has to leave room for it
+            int thresholdPercent = Math.Max((int)threshold, ProcessAdmissionGate.WakeupMarginPercent + 1);
+            m_processAdmissionGate = new ProcessAdmissionGate(ProcessAdmissionGate.NameForCurrentProcess, thresholdPercent, thresholdPercent);
+        }
+
         private void InitSchedulerRuntimeState(LoggingContext loggingContext, SchedulerState schedulerState)
         {
             using (PipExecutionCounters.StartStopwatch(PipExecutorCounter.InitSchedulerRuntimeStateDuration))
@@ -4830,6 +4894,7 @@ namespace BuildXL.Scheduler
             InitSchedulerRuntimeState(loggingContext, schedulerState: null);
             InitPipStates(loggingContext);
             m_hasFailures = m_hasFailures || InitSandboxedKextConnection(loggingContext);
+            InitProcessAdmissionGate();
 
             Contract.Assert(!HasFailed || loggingContext.ErrorWasLogged, "Scheduler encountered errors during initialization, but none were logged.");
             return !HasFailed;
@@ -6259,6 +6324,7 @@ namespace BuildXL.Scheduler
 
             ExecutionLog?.Dispose();
             SandboxedKextConnection?.Dispose();
+            m_processAdmissionGate?.Dispose();
 
             LocalWorker.Dispose();
             m_allWorker?.Dispose();
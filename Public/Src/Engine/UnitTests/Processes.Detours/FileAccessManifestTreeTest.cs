@@ -551,7 +551,7 @@ namespace Test.BuildXL.Processes.Detours
         /// which has 1 project and 100 C# files. (Access pattern made by csc.exe.)
         /// This is intended to be a stress test.
         /// </summary>
-        private void TestSolutionMockupManifestTest(int numFiles, bool serializeManifest = false)
+        private void TestSolutionMockupManifestTest(int numFiles, bool serializeManifest = false, bool useAlignedManifestTree = false)
         {
             var pt = new PathTable();
             var fam =
@@ -561,7 +561,8 @@ namespace Test.BuildXL.Processes.Detours
                     IgnoreCodeCoverage = false,
                     ReportFileAccesses = false,
                     ReportUnexpectedFileAccesses = false,
-                    MonitorChildProcesses = false
+                    MonitorChildProcesses = false,
+                    UseAlignedManifestTree = useAlignedManifestTree
                 };
 
             var vac = new ValidationDataCreator(fam, pt);
@@ -619,6 +620,31 @@ namespace Test.BuildXL.Processes.Detours
             TestSolutionMockupManifestTest(10000);
         }
 
+        [Theory]
+        [InlineData(true)]
+        [InlineData(false)]
+        public void TestSolution1000AlignedManifestTree(bool serializeManifest)
+        {
+            TestSolutionMockupManifestTest(1000, serializeManifest, useAlignedManifestTree: true);
+        }
+
+        [Fact]
+        public void BatchedNormalizationMatchesSinglePaths()
+        {
+            var paths = new[] { "C:", "Windows", string.Empty, "System32", "cmd.EXE", "\u00C9l\u00E8ve", new string('a', 100) + "B" };
+            var bytes = new byte[paths.Length][];
+            var hashes = new int[paths.Length];
+
+            global::BuildXL.Native.Processes.ProcessUtilities.NormalizeAndHashPaths(paths, bytes, hashes);
+
+            for (int i = 0; i < paths.Length; i++)
+            {
+                int hash = global::BuildXL.Native.Processes.ProcessUtilities.NormalizeAndHashPath(paths[i], out byte[] expectedBytes);
+                XAssert.AreEqual(hash, hashes[i], "Hash of '{0}' did not match", paths[i]);
+                XAssert.IsTrue(expectedBytes.SequenceEqual(bytes[i]), "Normalized '{0}' did not match", paths[i]);
+            }
+        }
+
         private DirectoryTranslator CreateDirectoryTranslator()
         {
             var translator = new DirectoryTranslator();
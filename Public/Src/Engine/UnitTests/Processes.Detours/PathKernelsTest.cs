@@ -0,0 +1,182 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Runtime.InteropServices;
+using BuildXL.Native.Processes;
+using BuildXL.Native.Processes.Windows;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+using Xunit.Abstractions;
+
+namespace Test.BuildXL.Processes.Detours
+{
+    /// <summary>
+    /// Checks the vectorized path kernels of the policy search against a scalar reference, on strings that end right before an
+    /// unreadable page, so that any read past the end of either string faults.
+    /// </summary>
+    public unsafe class PathKernelsTest : XunitBuildXLTest
+    {
+        private const int PageSize = 4096;
+        private const uint MemCommitReserve = 0x3000;
+        private const uint MemRelease = 0x8000;
+        private const uint PageReadWrite = 0x04;
+        private const uint PageNoAccess = 0x01;
+
+        // Longer than a few blocks of the widest kernel, so that every split between vector and scalar code is covered.
+        private const int MaxLength = 80;
+
+        /// <inheritdoc />
+        public PathKernelsTest(ITestOutputHelper output)
+            : base(output)
+        {
+        }
+
+        [Fact]
+        public void HashPathMatchesScalarReference()
+        {
+            using (var page = new GuardedPage())
+            {
+                for (int length = 0; length <= MaxLength; length++)
+                {
+                    string path = CreateMixedCasePath(length);
+                    char* pPath = page.PlaceAtEnd(path, nullTerminated: false);
+
+                    XAssert.AreEqual(ScalarHash(path), ProcessUtilitiesWin.HashPath(pPath, length), "Length {0}", length);
+                }
+            }
+        }
+
+        [Fact]
+        public void ArePathsEqualMatchesScalarReference()
+        {
+            using (var pathPage = new GuardedPage())
+            using (var normalizedPage = new GuardedPage())
+            {
+                for (int length = 0; length <= MaxLength; length++)
+                {
+                    string path = CreateMixedCasePath(length);
+                    string normalized = path.ToUpperInvariant();
+                    char* pPath = pathPage.PlaceAtEnd(path, nullTerminated: false);
+
+                    char* pNormalized = normalizedPage.PlaceAtEnd(normalized, nullTerminated: true);
+                    XAssert.IsTrue(ProcessUtilitiesWin.ArePathsEqual(pPath, pNormalized, length), "Length {0}", length);
+
+                    // Normalized paths shorter than the path end before it does: the kernels must not read past their terminator.
+                    for (int shorter = 0; shorter < length; shorter++)
+                    {
+                        pNormalized = normalizedPage.PlaceAtEnd(normalized.Substring(0, shorter), nullTerminated: true);
+                        XAssert.IsFalse(ProcessUtilitiesWin.ArePathsEqual(pPath, pNormalized, length), "Length {0} against {1}", length, shorter);
+                    }
+
+                    for (int mismatch = 0; mismatch < length; mismatch++)
+                    {
+                        char[] chars = normalized.ToCharArray();
+                        chars[mismatch] = chars[mismatch] == 'X' ? 'Y' : 'X';
+                        pNormalized = normalizedPage.PlaceAtEnd(new string(chars), nullTerminated: true);
+                        XAssert.IsFalse(ProcessUtilitiesWin.ArePathsEqual(pPath, pNormalized, length), "Length {0} mismatch at {1}", length, mismatch);
+                    }
+                }
+            }
+        }
+
+        [Fact]
+        public void NonAsciiCharactersAgreeWithNormalizeAndHashPath()
+        {
+            using (var pathPage = new GuardedPage())
+            using (var normalizedPage = new GuardedPage())
+            {
+                foreach (string path in new[] { "\u00e9", "c:\\caf\u00e9\\na\u00efve.txt", "c:\\some\\longer\\directory\\\u0101\u0103\u0105\\file.cs", "\u00e0bcdefghijklmnopqrstuvwxyz\u00e0" })
+                {
+                    int expectedHash = ProcessUtilities.NormalizeAndHashPath(path, out byte[] normalizedBytes);
+                    string normalized = System.Text.Encoding.Unicode.GetString(normalizedBytes, 0, normalizedBytes.Length - sizeof(char));
+
+                    char* pPath = pathPage.PlaceAtEnd(path, nullTerminated: false);
+                    XAssert.AreEqual(expectedHash, ProcessUtilitiesWin.HashPath(pPath, path.Length), path);
+
+                    char* pNormalized = normalizedPage.PlaceAtEnd(normalized, nullTerminated: true);
+                    XAssert.IsTrue(ProcessUtilitiesWin.ArePathsEqual(pPath, pNormalized, path.Length), path);
+                }
+            }
+        }
+
+        private static string CreateMixedCasePath(int length)
+        {
+            const string Characters = "c:\\Src\\BuildXL\\Engine\\Processes\\FileAccessManifest.cs-_.0123456789@[]`{}";
+            var chars = new char[length];
+            for (int i = 0; i < length; i++)
+            {
+                chars[i] = Characters[(i * 7) % Characters.Length];
+            }
+
+            return new string(chars);
+        }
+
+        /// <summary>
+        /// Character by character version of HashPath for ASCII paths: FNV-1 over both bytes of each uppercased character.
+        /// </summary>
+        private static int ScalarHash(string path)
+        {
+            uint hash = 2166136261;
+            foreach (char c in path)
+            {
+                char normalized = c >= 'a' && c <= 'z' ? (char)(c - ('a' - 'A')) : c;
+                hash = (hash * 16777619) ^ (byte)normalized;
+                hash = (hash * 16777619) ^ (byte)(normalized >> 8);
+            }
+
+            return unchecked((int)hash);
+        }
+
+        /// <summary>
+        /// A readable page followed by an unreadable one.
+        /// </summary>
+        private sealed class GuardedPage : IDisposable
+        {
+            private readonly byte* m_base;
+
+            public GuardedPage()
+            {
+                m_base = (byte*)VirtualAlloc(IntPtr.Zero, new UIntPtr(2 * PageSize), MemCommitReserve, PageReadWrite);
+                XAssert.IsTrue(m_base != null, "VirtualAlloc failed: {0}", Marshal.GetLastWin32Error());
+                XAssert.IsTrue(VirtualProtect((IntPtr)(m_base + PageSize), new UIntPtr(PageSize), PageNoAccess, out _), "VirtualProtect failed: {0}", Marshal.GetLastWin32Error());
+            }
+
+            /// <summary>
+            /// Copies the characters (and the null terminator, if asked) so that they end right before the unreadable page.
+            /// </summary>
+            public char* PlaceAtEnd(string value, bool nullTerminated)
+            {
+                int count = value.Length + (nullTerminated ? 1 : 0);
+                char* start = (char*)(m_base + PageSize) - count;
+                for (int i = 0; i < value.Length; i++)
+                {
+                    start[i] = value[i];
+                }
+
+                if (nullTerminated)
+                {
+                    start[value.Length] = '\0';
+                }
+
+                return start;
+            }
+
+            public void Dispose()
+            {
+                VirtualFree((IntPtr)m_base, UIntPtr.Zero, MemRelease);
+            }
+        }
+
+        [DllImport("kernel32.dll", SetLastError = true)]
+        private static extern IntPtr VirtualAlloc(IntPtr address, UIntPtr size, uint allocationType, uint protect);
+
+        [DllImport("kernel32.dll", SetLastError = true)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        private static extern bool VirtualProtect(IntPtr address, UIntPtr size, uint newProtect, out uint oldProtect);
+
+        [DllImport("kernel32.dll", SetLastError = true)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        private static extern bool VirtualFree(IntPtr address, UIntPtr size, uint freeType);
+    }
+}
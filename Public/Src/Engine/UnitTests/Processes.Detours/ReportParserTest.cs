@@ -0,0 +1,128 @@
+﻿// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.IO;
+using System.Text;
+using BuildXL.Native.Processes.Windows;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+using Xunit.Abstractions;
+
+namespace Test.BuildXL.Processes.Detours
+{
+    public class ReportParserTest : XunitBuildXLTest
+    {
+        /// <inheritdoc />
+        public ReportParserTest(ITestOutputHelper output)
+            : base(output)
+        {
+        }
+
+        [Fact]
+        public void ParseTextLines()
+        {
+            var text =
+                "1,CreateFile:1a4|1|1|0|0|0|80000000|7|3|80|2a|C:\\foo\\bar.txt|\r\n" +
+                "1,Process:1a4|1|1|0|0|0|0|0|0|0|0|C:\\bin\\tool.exe||tool.exe /a|b\r\n" +
+                "3,some debug message\r\n" +
+                "1,CreateFile:1a4|1|1";
+            var buffer = Encoding.Unicode.GetBytes(text);
+
+            var reports = new ProcessUtilitiesWin.ParsedReport[8];
+            var arena = new char[1024];
+            XAssert.IsTrue(ProcessUtilitiesWin.ParseReports(new ArraySegment<byte>(buffer), false, reports, arena, out int count, out _, out int consumed));
+
+            XAssert.AreEqual(3, count);
+            XAssert.AreEqual(buffer.Length - Encoding.Unicode.GetByteCount("1,CreateFile:1a4|1|1"), consumed);
+
+            XAssert.AreEqual(1u, reports[0].Type);
+            XAssert.AreEqual(0x1a4u, reports[0].ProcessId);
+            XAssert.AreEqual(0x80000000u, reports[0].DesiredAccess);
+            XAssert.AreEqual(0x2au, reports[0].PathId);
+            XAssert.AreEqual("CreateFile", GetString(arena, reports[0].OperationOffset, reports[0].OperationLength));
+            XAssert.AreEqual("C:\\foo\\bar.txt", GetString(arena, reports[0].PathOffset, reports[0].PathLength));
+            XAssert.AreEqual(0u, reports[0].CommandLineLength);
+
+            // The command line comes last and may contain the separator
+            XAssert.AreEqual("tool.exe /a|b", GetString(arena, reports[1].CommandLineOffset, reports[1].CommandLineLength));
+
+            XAssert.AreEqual(3u, reports[2].Type);
+            XAssert.AreEqual("3,some debug message", GetString(arena, reports[2].TextOffset, reports[2].TextLength));
+        }
+
+        [Fact]
+        public void ParseMalformedTextLine()
+        {
+            var buffer = Encoding.Unicode.GetBytes("3,fine\r\n1,CreateFile:xyz|1|1|0|0|0|0|0|0|0|0|C:\\a|\r\n");
+
+            var reports = new ProcessUtilitiesWin.ParsedReport[8];
+            var arena = new char[1024];
+            XAssert.IsFalse(ProcessUtilitiesWin.ParseReports(new ArraySegment<byte>(buffer), false, reports, arena, out int count, out _, out int consumed));
+
+            XAssert.AreEqual(1, count);
+            XAssert.AreEqual(Encoding.Unicode.GetByteCount("3,fine\r\n"), consumed);
+        }
+
+        [Fact]
+        public void ParseBinaryRecords()
+        {
+            byte[] record = CreateFileAccessRecord(processId: 42, pathId: 7, operation: "CreateFile", path: "C:\\foo");
+
+            var buffer = new byte[record.Length * 2 - 1];
+            Array.Copy(record, 0, buffer, 0, record.Length);
+            Array.Copy(record, 0, buffer, record.Length, record.Length - 1);
+
+            var reports = new ProcessUtilitiesWin.ParsedReport[8];
+            var arena = new char[1024];
+            XAssert.IsTrue(ProcessUtilitiesWin.ParseReports(new ArraySegment<byte>(buffer), true, reports, arena, out int count, out _, out int consumed));
+
+            XAssert.AreEqual(1, count);
+            XAssert.AreEqual(record.Length, consumed);
+            XAssert.AreEqual(42u, reports[0].ProcessId);
+            XAssert.AreEqual(7u, reports[0].PathId);
+            XAssert.AreEqual("C:\\foo", GetString(arena, reports[0].PathOffset, reports[0].PathLength));
+            XAssert.AreEqual((uint)record.Length, reports[0].RecordSize);
+            XAssert.AreEqual(0x1234UL, reports[0].VolumeSerialNumber);
+            XAssert.AreEqual(0x5678UL, reports[0].FileIdLow);
+        }
+
+        private static string GetString(char[] arena, uint offset, uint length) => new string(arena, (int)offset, (int)length);
+
+        // See FileAccessReportRecord in DataTypes.h
+        private static byte[] CreateFileAccessRecord(uint processId, uint pathId, string operation, string path)
+        {
+            const int FixedSize = 112;
+            const ushort Version = 5;
+
+            using (var stream = new MemoryStream())
+            using (var writer = new BinaryWriter(stream))
+            {
+                writer.Write((uint)(FixedSize + 2 * (operation.Length + path.Length)));
+                writer.Write(Version);
+                writer.Write((ushort)1); // ReportType_FileAccess
+                writer.Write(0UL);       // Sequence
+                writer.Write(processId);
+                for (int i = 0; i < 8; i++)
+                {
+                    writer.Write(0u);
+                }
+
+                writer.Write(pathId);
+                writer.Write(0UL);       // Usn
+                writer.Write((uint)operation.Length);
+                writer.Write((uint)path.Length);
+                writer.Write(0u);        // FilterLength
+                writer.Write(0u);        // CommandLineLength
+                writer.Write(0u);        // LocalPathId
+                writer.Write(0u);        // PathFlags
+                writer.Write(0x1234UL);  // VolumeSerialNumber
+                writer.Write(0x5678UL);  // FileIdLow
+                writer.Write(0UL);       // FileIdHigh
+                writer.Write(Encoding.Unicode.GetBytes(operation));
+                writer.Write(Encoding.Unicode.GetBytes(path));
+                return stream.ToArray();
+            }
+        }
+    }
+}
@@ -38,6 +38,11 @@ namespace Test.BuildXL.Processes.Detours
             vac.AddScope(A("C", "Users", "AppData"), FileAccessPolicy.AllowAll);
             vac.AddPath(A("C", "Source", "source.txt"), FileAccessPolicy.AllowReadAlways);
             vac.AddPath(A("C", "Out", "out.txt"), FileAccessPolicy.AllowAll);
+            fam.AddSuffixPolicy(".pdb", FileAccessPolicy.MaskAll, FileAccessPolicy.AllowAll);
+            fam.AddSuffixPolicy(".g.cs", FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowRead | FileAccessPolicy.ReportAccess);
+            var sourceMetadata = new DeclaredInputMetadata(FileAttributes.ReadOnly, 42, creationTime: 1, lastAccessTime: 2, lastWriteTime: 3);
+            var sourcePath = AbsolutePath.Create(pt, A("C", "Source", "source.txt"));
+            fam.SetDeclaredInputMetadata(sourcePath, sourceMetadata);
 
             var standardFiles = new SandboxedProcessStandardFiles(A("C", "pip", "pip.out"), A("C", "pip", "pip.err"));
             var envVars = new Dictionary<string, string>()
@@ -119,6 +124,19 @@ namespace Test.BuildXL.Processes.Detours
             XAssert.AreEqual(standardFiles.StandardError, readInfo.FileStorage.GetFileName(SandboxedProcessFile.StandardError));
             XAssert.IsFalse(readInfo.ContainerConfiguration.IsIsolationEnabled);
 
+            XAssert.IsTrue(readInfo.FileAccessManifest.TryGetDeclaredInputMetadata(sourcePath, out var readSourceMetadata));
+            XAssert.AreEqual(sourceMetadata.Attributes, readSourceMetadata.Attributes);
+            XAssert.AreEqual(sourceMetadata.Size, readSourceMetadata.Size);
+            XAssert.AreEqual(sourceMetadata.LastWriteTime, readSourceMetadata.LastWriteTime);
+
+            XAssert.IsTrue(readInfo.FileAccessManifest.TryGetSuffixPolicy(".pdb", out var pdbMask, out var pdbValues));
+            XAssert.AreEqual(FileAccessPolicy.MaskAll, pdbMask);
+            XAssert.AreEqual(FileAccessPolicy.AllowAll, pdbValues);
+            XAssert.IsTrue(readInfo.FileAccessManifest.TryGetSuffixPolicy(".g.cs", out var generatedMask, out var generatedValues));
+            XAssert.AreEqual(FileAccessPolicy.MaskNothing, generatedMask);
+            XAssert.AreEqual(FileAccessPolicy.AllowRead | FileAccessPolicy.ReportAccess, generatedValues);
+            XAssert.IsFalse(readInfo.FileAccessManifest.TryGetSuffixPolicy(".cs", out _, out _));
+
             ValidationDataCreator.TestManifestRetrieval(vac.DataItems, readInfo.FileAccessManifest, false);
         }
 
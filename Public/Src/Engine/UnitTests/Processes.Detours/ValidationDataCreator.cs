@@ -182,6 +182,35 @@ namespace Test.BuildXL.Processes.Detours
                     expectedUsn,
                     "Usn for '{0}' did not match", dataItem.Path);
             }
+
+            // The batched search must find the same policies, resuming from shared prefixes of the sorted paths.
+            var sortedData = validationData.OrderBy(data => data.Path, StringComparer.OrdinalIgnoreCase).ToArray();
+            var results = new global::BuildXL.Native.Processes.Windows.ProcessUtilitiesWin.PolicySearchResult[sortedData.Length];
+
+            bool batchSuccess =
+                global::BuildXL.Native.Processes.Windows.ProcessUtilitiesWin.FindFileAccessPoliciesInTree(
+                    manifestTreeBytes,
+                    sortedData.Select(data => data.Path).ToArray(),
+                    results);
+
+            XAssert.IsTrue(batchSuccess, "Unable to find paths in manifest");
+            for (int i = 0; i < sortedData.Length; i++)
+            {
+                ValidationData dataItem = sortedData[i];
+                XAssert.AreEqual(unchecked((uint)dataItem.PathId), results[i].PathId, "PathId for '{0}' did not match (batched)", dataItem.Path);
+
+                if (dataItem.NodePolicy.HasValue)
+                {
+                    XAssert.AreEqual(unchecked((uint)dataItem.NodePolicy.Value), results[i].NodePolicy, "Policy for '{0}' did not match (batched)", dataItem.Path);
+                }
+
+                if (dataItem.ConePolicy.HasValue)
+                {
+                    XAssert.AreEqual(unchecked((uint)dataItem.ConePolicy.Value), results[i].ConePolicy, "Policy for '{0}' did not match (batched)", dataItem.Path);
+                }
+
+                XAssert.AreEqual(dataItem.ExpectedUsn, results[i].ExpectedUsn, "Usn for '{0}' did not match (batched)", dataItem.Path);
+            }
         }
 
         internal struct ValidationData
@@ -0,0 +1,340 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+#include "LoadGenerator.h"
+
+#pragma warning( push )
+#pragma warning( disable : 4350 4668 )
+#include <thread>
+#pragma warning( pop )
+
+enum LoadOperation {
+    LoadOpen,
+    LoadProbe,
+    LoadEnumerate,
+    LoadRename,
+    LoadOperationCount
+};
+
+static wchar_t const* const LoadOperationNames[LoadOperationCount] = { L"open", L"probe", L"enumerate", L"rename" };
+
+static unsigned const DirectoriesPerLevel = 4;
+
+struct LoadSpec {
+    unsigned threads = 1;
+    unsigned files = 100;
+    unsigned depth = 1;
+    unsigned operations = 10000;
+    unsigned weights[LoadOperationCount] = { 1, 1, 1, 1 };
+    unsigned children = 0;
+    unsigned generations = 0;
+    // Set on the command line of the child processes.
+    unsigned generation = 0;
+};
+
+struct LoadThreadResult {
+    unsigned long long operations = 0;
+    unsigned long long failures = 0;
+};
+
+static bool ParseLoadSpec(std::wstring const& spec, LoadSpec& result) {
+    size_t start = 0;
+    while (start < spec.length()) {
+        size_t end = spec.find(L';', start);
+        if (end == std::wstring::npos) {
+            end = spec.length();
+        }
+
+        std::wstring pair(spec, start, end - start);
+        start = end + 1;
+        if (pair.empty()) {
+            continue;
+        }
+
+        size_t separator = pair.find(L'=');
+        if (separator == std::wstring::npos || separator == 0 || separator + 1 == pair.length()) {
+            std::wcerr << L"Bad load spec entry. Expected key=value. Actual: " << pair << std::endl;
+            return false;
+        }
+
+        std::wstring key(pair, 0, separator);
+        wchar_t* valueEnd = nullptr;
+        unsigned long value = wcstoul(pair.c_str() + separator + 1, &valueEnd, 10);
+        if (*valueEnd != L'\0') {
+            std::wcerr << L"Bad load spec value for " << key << L". Expected a number. Actual: " << pair << std::endl;
+            return false;
+        }
+
+        unsigned* target = nullptr;
+        if (key == L"threads") { target = &result.threads; }
+        else if (key == L"files") { target = &result.files; }
+        else if (key == L"depth") { target = &result.depth; }
+        else if (key == L"operations") { target = &result.operations; }
+        else if (key == L"children") { target = &result.children; }
+        else if (key == L"generations") { target = &result.generations; }
+        else if (key == L"generation") { target = &result.generation; }
+        else {
+            for (int op = 0; op < LoadOperationCount; op++) {
+                if (key == LoadOperationNames[op]) {
+                    target = &result.weights[op];
+                }
+            }
+        }
+
+        if (target == nullptr) {
+            std::wcerr << L"Unknown load spec key. Supported: [threads, files, depth, operations, open, probe, enumerate, rename, children, generations]. Actual: " << key << std::endl;
+            return false;
+        }
+
+        *target = static_cast<unsigned>(value);
+    }
+
+    if (result.children > 0 && result.generations == 0) {
+        result.generations = 1;
+    }
+
+    unsigned totalWeight = 0;
+    for (int op = 0; op < LoadOperationCount; op++) {
+        totalWeight += result.weights[op];
+    }
+
+    if (result.threads == 0 || result.files == 0 || totalWeight == 0) {
+        std::wcerr << L"Bad load spec. There must be at least one thread, one file and one operation with a weight: " << spec << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static std::wstring FileDirectory(std::wstring const& root, LoadSpec const& spec, unsigned file) {
+    std::wstring path(root);
+    unsigned index = file;
+    for (unsigned level = 0; level < spec.depth; level++) {
+        path += L"\\d";
+        path += std::to_wstring(index % DirectoriesPerLevel);
+        index /= DirectoriesPerLevel;
+    }
+
+    return path;
+}
+
+static std::wstring FilePath(std::wstring const& root, LoadSpec const& spec, unsigned file) {
+    return FileDirectory(root, spec, file) + L"\\f" + std::to_wstring(file);
+}
+
+static bool EnsureDirectory(std::wstring const& path) {
+    if (CreateDirectoryW(path.c_str(), nullptr) || GetLastError() == ERROR_ALREADY_EXISTS) {
+        return true;
+    }
+
+    if (GetLastError() != ERROR_PATH_NOT_FOUND) {
+        return false;
+    }
+
+    size_t parentEnd = path.find_last_of(L'\\');
+    if (parentEnd == std::wstring::npos || parentEnd == 0) {
+        return false;
+    }
+
+    return EnsureDirectory(path.substr(0, parentEnd))
+        && (CreateDirectoryW(path.c_str(), nullptr) || GetLastError() == ERROR_ALREADY_EXISTS);
+}
+
+static bool CreateLoadTree(std::wstring const& root, LoadSpec const& spec) {
+    for (unsigned file = 0; file < spec.files; file++) {
+        if (!EnsureDirectory(FileDirectory(root, spec, file))) {
+            std::wcerr << L"Could not create the directory of load file " << FilePath(root, spec, file) << L": " << GetLastError() << std::endl;
+            return false;
+        }
+
+        HANDLE handle = CreateFileW(FilePath(root, spec, file).c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            std::wcerr << L"Could not create load file " << FilePath(root, spec, file) << L": " << GetLastError() << std::endl;
+            return false;
+        }
+
+        CloseHandle(handle);
+    }
+
+    return true;
+}
+
+// xorshift32: cheap, and the same sequence everywhere for a given seed.
+static unsigned NextRandom(unsigned& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static bool RunLoadOperation(LoadOperation operation, std::wstring const& root, LoadSpec const& spec, unsigned file) {
+    std::wstring path = FilePath(root, spec, file);
+    switch (operation) {
+    case LoadOpen: {
+        HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        CloseHandle(handle);
+        return true;
+    }
+    case LoadProbe:
+        return GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+    case LoadEnumerate: {
+        WIN32_FIND_DATAW findData{};
+        HANDLE findHandle = FindFirstFileExW((FileDirectory(root, spec, file) + L"\\*").c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, NULL, 0);
+        if (findHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        while (FindNextFileW(findHandle, &findData)) {}
+        DWORD error = GetLastError();
+        FindClose(findHandle);
+        return error == ERROR_NO_MORE_FILES;
+    }
+    case LoadRename: {
+        std::wstring renamed = path + L".renamed";
+        return MoveFileExW(path.c_str(), renamed.c_str(), 0) && MoveFileExW(renamed.c_str(), path.c_str(), 0);
+    }
+    default:
+        assert(false);
+        return false;
+    }
+}
+
+static void RunLoadThread(std::wstring const& root, LoadSpec const& spec, unsigned threadIndex, LoadThreadResult& result) {
+    unsigned totalWeight = 0;
+    for (int op = 0; op < LoadOperationCount; op++) {
+        totalWeight += spec.weights[op];
+    }
+
+    unsigned state = ((spec.generation + 1) * 0x9E3779B9u) ^ ((threadIndex + 1) * 2654435761u);
+    if (state == 0) {
+        state = 1;
+    }
+
+    for (unsigned i = 0; i < spec.operations; i++) {
+        unsigned pick = NextRandom(state) % totalWeight;
+        int operation = 0;
+        while (pick >= spec.weights[operation]) {
+            pick -= spec.weights[operation];
+            operation++;
+        }
+
+        unsigned file = NextRandom(state) % spec.files;
+        if (!RunLoadOperation(static_cast<LoadOperation>(operation), root, spec, file)) {
+            result.failures++;
+        }
+
+        result.operations++;
+    }
+}
+
+// Starts a child process running the load of the next generation.
+static HANDLE StartLoadChild(std::wstring const& root, std::wstring const& spec, LoadSpec const& parsedSpec) {
+    wchar_t exePath[MAX_PATH];
+    DWORD exePathLength = GetModuleFileNameW(NULL, exePath, MAX_PATH);
+    if (exePathLength == 0 || exePathLength == MAX_PATH) {
+        return NULL;
+    }
+
+    // The last value of a key wins, so the generation can just be appended.
+    std::wstring commandLine(L"\"");
+    commandLine += exePath;
+    commandLine += L"\" \"Load,";
+    commandLine += root;
+    commandLine += L",";
+    commandLine += spec;
+    commandLine += L";generation=";
+    commandLine += std::to_wstring(parsedSpec.generation + 1);
+    commandLine += L"\"";
+
+    STARTUPINFOW startupInfo{};
+    startupInfo.cb = sizeof(startupInfo);
+    startupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startupInfo.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    PROCESS_INFORMATION processInfo{};
+    if (!CreateProcessW(nullptr, &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startupInfo, &processInfo)) {
+        return NULL;
+    }
+
+    CloseHandle(processInfo.hThread);
+    return processInfo.hProcess;
+}
+
+bool Load(std::wstring const& root, std::wstring const& spec) {
+    LoadSpec parsedSpec;
+    if (!ParseLoadSpec(spec, parsedSpec)) {
+        return false;
+    }
+
+    if (parsedSpec.generation == 0 && !CreateLoadTree(root, parsedSpec)) {
+        return false;
+    }
+
+    bool succeeded = true;
+    std::vector<HANDLE> children;
+    if (parsedSpec.generation < parsedSpec.generations) {
+        for (unsigned i = 0; i < parsedSpec.children; i++) {
+            HANDLE child = StartLoadChild(root, spec, parsedSpec);
+            if (child == NULL) {
+                std::wcerr << L"Could not start load child process: " << GetLastError() << std::endl;
+                succeeded = false;
+                break;
+            }
+
+            children.push_back(child);
+        }
+    }
+
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    std::vector<LoadThreadResult> results(parsedSpec.threads);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < parsedSpec.threads; i++) {
+        threads.emplace_back(RunLoadThread, std::cref(root), std::cref(parsedSpec), i, std::ref(results[i]));
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    QueryPerformanceCounter(&end);
+
+    unsigned long long operations = 0;
+    unsigned long long failures = 0;
+    for (LoadThreadResult const& result : results) {
+        operations += result.operations;
+        failures += result.failures;
+    }
+
+    double seconds = static_cast<double>(end.QuadPart - start.QuadPart) / static_cast<double>(frequency.QuadPart);
+    std::wcout
+        << L"LoadResult," << parsedSpec.generation
+        << L"," << operations
+        << L"," << failures
+        << L"," << static_cast<unsigned long long>(seconds * 1000)
+        << L"," << static_cast<unsigned long long>(seconds > 0 ? operations / seconds : 0)
+        << std::endl;
+
+    for (HANDLE child : children) {
+        DWORD exitCode = 1;
+        WaitForSingleObject(child, INFINITE);
+        if (!GetExitCodeProcess(child, &exitCode) || exitCode != 0) {
+            succeeded = false;
+        }
+
+        CloseHandle(child);
+    }
+
+    return succeeded;
+}
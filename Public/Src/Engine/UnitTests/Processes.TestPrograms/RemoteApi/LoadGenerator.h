@@ -0,0 +1,30 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Sandbox load generator, behind the Load command of RemoteApi.exe.
+//
+// Load,<root>,<spec> creates a tree of files under <root>, then has threads (and optionally a tree of child processes running
+// the same command) make a random mix of file system calls on them, and prints the rate of the calls, one line per process:
+//   LoadResult,<generation>,<operations>,<failures>,<milliseconds>,<operations per second>
+// Running the same spec in and out of the sandbox gives the overhead of the sandbox. The calls are drawn from a generator
+// seeded by the thread and process generation, so the same spec makes the same calls from one run to the next.
+//
+// The spec is a list of key=value pairs separated by ';' (commas separate the parameters of commands). All are optional:
+//   threads        threads making calls in each process (1)
+//   files          files in the tree (100)
+//   depth          directory levels above the files, with 4 directories per level (1)
+//   operations     calls made by each thread (10000)
+//   open           weight of opening a file for read (1)
+//   probe          weight of getting the attributes of a file (1)
+//   enumerate      weight of enumerating the directory of a file (1)
+//   rename         weight of renaming a file and back (1)
+//   children       child processes started by each process, running the same load (0)
+//   generations    levels of child processes (1 when there are children)
+// e.g. Load,C:\temp\load,threads=8;files=10000;depth=3;probe=10;children=2;generations=2
+//
+// Only the first process creates the tree; its children start once it exists. Renames and opens of a file being renamed by
+// another thread can fail, which is counted rather than treated as an error.
+
+#pragma once
+
+bool Load(std::wstring const& root, std::wstring const& spec);
@@ -6,10 +6,11 @@
 // In the course of testing file system detours, we need to be able to exercise particular APIs in isolation.
 // This program effectively exposes some needed APIs over RPC.
 //
-// Command format (sent over stdin):
+// Command format (sent over stdin, or as the only argument for a single command):
 //   commandName,parameter[,parameter]
 // Response format (sent over stdout):
 //   commandName,result (0 for success or 1 for failure).
+// A command passed as the argument also exits with 6 if it failed.
 //
 // Supported commands:
 //  EnumerateWithFindFirstFileEx: Takes a path parameter to be passed to FindFirstFileEx (e.g. C:\directory\*.h to find files ending in .h under C:\directory)
@@ -22,10 +23,39 @@
 //  EnumerateFileOrDirectoryByHandle: Takes a path parameter to open (e.g. C:\directory\) and enumerates members via NtQueryDirectoryFile.
 //                             Returns 0 on success or 1 on failure (note that success is returned if enumeration proceeded, even if no matches were found or if
 //                             the search path turned out to be a file rather than a directory).
+//  CreateDirectory: Creates the directory at the path parameter with CreateDirectoryW. Returns 0 on success or 1 on failure (including if it already exists).
+//  RenameByHandle: Opens the first parameter (a file or directory) and renames it to the second with SetFileInformationByHandle.
+//  RenameViaNtSetInformationFile: Opens the first parameter (a file or directory) and renames it to the second with NtSetInformationFile.
+//                             The second parameter must be absolute and canonicalized (including a \??\ prefix) as required by NtSetInformationFile.
+//  OpenRelativeToDirectory: Opens the first parameter (a directory) with CreateFileW, then opens the second parameter (a name relative to it)
+//                           for reading with NtCreateFile, passing the directory handle as the RootDirectory.
+//  Load: Takes a root directory and a workload spec, and makes the file system calls of the workload under the root (see LoadGenerator.h).
+//        Returns 0 if the workload ran (even if some of its calls failed; their count is printed instead) or 1 on failure.
+//  RunInChildProcess: Takes the path of a copy of RemoteApi.exe (or an empty path for this executable) and a command whose name and parameters
+//                     are separated by '|', and runs that command in a child process of that executable.
+//                     Returns 0 if the child ran the command successfully or 1 otherwise.
+//  RunCommandLine: Takes an application name (which may be empty) and a command line in which '|' stands for ',', starts a child process
+//                  with CreateProcessW with exactly those, and waits for it. Returns 0 if the child exited with 0 or 1 otherwise.
+//  StartCommandLine: Same as RunCommandLine, without waiting for the child. Returns 0 if the child started or 1 otherwise.
+//  WaitForEvent: Waits (up to 5 minutes) for the named event of the parameter to be set. Returns 0 if it was or 1 otherwise.
+//  JoinJobWithoutBreakaway: Creates a job object with the given name (which may be empty) that does not let its processes break away,
+//                           and assigns this process to it, nested in the job it already is in. Returns 0 on success or 1 on failure.
+//  CopyFile: Copies the first parameter (an existing file) to the second with CopyFileW, failing if the second exists.
+//  GetTempFileName: Creates a temporary file, named by GetTempFileNameW with the prefix "tmp", in the directory of the parameter.
+//  SetCurrentDirectory: Makes the parameter the current directory of the process with SetCurrentDirectoryW, for the commands that follow.
+//  MoveFileEx: Moves the first parameter (a file) to the second with MoveFileExW, without allowing a copy.
+//  CheckFileName: Opens the first parameter and succeeds if GetFileInformationByHandleEx (FileNameInfo) returns the second parameter (a path
+//                 from the root of the volume), both with a buffer too small for it (to check the length) and with a large enough one.
+//  WriteFile: Creates (or truncates) the first parameter and writes the number of bytes of the second parameter to it with WriteFile, in
+//             chunks that do not line up with pages, so that writes straddle page and block boundaries.
+//  CheckFileSize: Probes the first parameter with GetFileAttributesExW and succeeds if it is a file of the number of bytes of the second parameter.
+//  RenameAndCheckFinalPath: Opens the first parameter (a file or directory), renames it to the second with SetFileInformationByHandle, and
+//                           succeeds if GetFinalPathNameByHandleW returns the first parameter before the rename and the second (twice) after it.
 // TODO: These functions should be exposed as a Bond service. For now, we're starting with a trivial text format.
 
 #include "stdafx.h"
 #include "Command.h"
+#include "LoadGenerator.h"
 #pragma warning( disable : 4711) // ... selected for inline expansion
 
 bool EnumerateWithFindFirstFileEx(std::wstring const& path) {
@@ -135,20 +165,463 @@ bool DeleteViaNtCreateFile(std::wstring const& path) {
     }
 }
 
+#undef CreateDirectory
+bool CreateDirectory(std::wstring const& path) {
+    return CreateDirectoryW(path.c_str(), nullptr) == TRUE;
+}
+
+#undef CopyFile
+bool CopyFile(std::wstring const& source, std::wstring const& destination) {
+    return CopyFileW(source.c_str(), destination.c_str(), TRUE) == TRUE;
+}
+
+#undef GetTempFileName
+bool GetTempFileName(std::wstring const& directory) {
+    WCHAR tempFileName[MAX_PATH];
+    return GetTempFileNameW(directory.c_str(), L"tmp", 0, tempFileName) != 0;
+}
+
+#undef SetCurrentDirectory
+bool SetCurrentDirectory(std::wstring const& path) {
+    return SetCurrentDirectoryW(path.c_str()) == TRUE;
+}
+
+#undef MoveFileEx
+bool MoveFileEx(std::wstring const& source, std::wstring const& destination) {
+    return MoveFileExW(source.c_str(), destination.c_str(), 0) == TRUE;
+}
+
+#undef WriteFile
+bool WriteFile(std::wstring const& path, std::wstring const& sizeString) {
+    unsigned long long size = wcstoull(sizeString.c_str(), nullptr, 10);
+
+    HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    // An odd chunk size makes writes straddle the 64KB pages and 2MB blocks of the hash.
+    std::vector<BYTE> chunk(10007);
+    unsigned long long written = 0;
+    bool succeeded = true;
+    while (succeeded && written < size) {
+        DWORD chunkSize = size - written < chunk.size() ? (DWORD)(size - written) : (DWORD)chunk.size();
+        for (DWORD i = 0; i < chunkSize; i++) {
+            unsigned long long position = written + i;
+            chunk[i] = (BYTE)(position * 31 + (position >> 16));
+        }
+
+        DWORD bytesWritten = 0;
+        succeeded = ::WriteFile(handle, chunk.data(), chunkSize, &bytesWritten, nullptr) && bytesWritten == chunkSize;
+        written += chunkSize;
+    }
+
+    return CloseHandle(handle) && succeeded;
+}
+
+bool CheckFileName(std::wstring const& path, std::wstring const& expectedName) {
+    HANDLE handle = CreateFileW(
+        path.c_str(),
+        FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS,
+        NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    FILE_NAME_INFO tooSmall{};
+    BOOL queriedTooSmall = GetFileInformationByHandleEx(handle, FileNameInfo, &tooSmall, sizeof(tooSmall));
+    DWORD tooSmallError = GetLastError();
+
+    std::vector<BYTE> buffer(sizeof(FILE_NAME_INFO) + (expectedName.length() + MAX_PATH) * sizeof(WCHAR));
+    BOOL queried = GetFileInformationByHandleEx(handle, FileNameInfo, buffer.data(), (DWORD)buffer.size());
+    CloseHandle(handle);
+
+    if (queriedTooSmall || tooSmallError != ERROR_MORE_DATA || tooSmall.FileNameLength != expectedName.length() * sizeof(WCHAR) || !queried) {
+        return false;
+    }
+
+    PFILE_NAME_INFO nameInfo = reinterpret_cast<PFILE_NAME_INFO>(buffer.data());
+    std::wstring name(nameInfo->FileName, nameInfo->FileNameLength / sizeof(WCHAR));
+    return _wcsicmp(name.c_str(), expectedName.c_str()) == 0;
+}
+
+bool CheckFileSize(std::wstring const& path, std::wstring const& sizeString) {
+    unsigned long long expectedSize = wcstoull(sizeString.c_str(), nullptr, 10);
+
+    WIN32_FILE_ATTRIBUTE_DATA data{};
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+        return false;
+    }
+
+    return ((unsigned long long)data.nFileSizeHigh << 32 | data.nFileSizeLow) == expectedSize;
+}
+
+static HANDLE OpenForRename(std::wstring const& path) {
+    return CreateFileW(
+        path.c_str(),
+        DELETE | SYNCHRONIZE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS,
+        NULL);
+}
+
+bool RenameByHandle(std::wstring const& path, std::wstring const& newPath) {
+    HANDLE handle = OpenForRename(path);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    size_t bufferSize = sizeof(FILE_RENAME_INFO) + newPath.length() * sizeof(WCHAR);
+    std::vector<char> buffer(bufferSize);
+    PFILE_RENAME_INFO renameInfo = reinterpret_cast<PFILE_RENAME_INFO>(buffer.data());
+    renameInfo->ReplaceIfExists = FALSE;
+    renameInfo->RootDirectory = nullptr;
+    renameInfo->FileNameLength = (DWORD)(newPath.length() * sizeof(WCHAR));
+    wmemcpy(renameInfo->FileName, newPath.c_str(), newPath.length());
+
+    BOOL success = SetFileInformationByHandle(handle, FileRenameInfo, renameInfo, (DWORD)bufferSize);
+    CloseHandle(handle);
+    return success == TRUE;
+}
+
+static bool FinalPathIs(HANDLE handle, std::wstring const& expectedPath) {
+    wchar_t finalPath[MAX_PATH];
+    DWORD length = GetFinalPathNameByHandleW(handle, finalPath, MAX_PATH, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+    return length > 0 && length < MAX_PATH && _wcsicmp(finalPath, (L"\\\\?\\" + expectedPath).c_str()) == 0;
+}
+
+bool RenameAndCheckFinalPath(std::wstring const& path, std::wstring const& newPath) {
+    HANDLE handle = OpenForRename(path);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    size_t bufferSize = sizeof(FILE_RENAME_INFO) + newPath.length() * sizeof(WCHAR);
+    std::vector<char> buffer(bufferSize);
+    PFILE_RENAME_INFO renameInfo = reinterpret_cast<PFILE_RENAME_INFO>(buffer.data());
+    renameInfo->ReplaceIfExists = FALSE;
+    renameInfo->RootDirectory = nullptr;
+    renameInfo->FileNameLength = (DWORD)(newPath.length() * sizeof(WCHAR));
+    wmemcpy(renameInfo->FileName, newPath.c_str(), newPath.length());
+
+    // The second query after the rename asks for a path already resolved for the handle.
+    bool succeeded = FinalPathIs(handle, path)
+        && SetFileInformationByHandle(handle, FileRenameInfo, renameInfo, (DWORD)bufferSize)
+        && FinalPathIs(handle, newPath)
+        && FinalPathIs(handle, newPath);
+
+    CloseHandle(handle);
+    return succeeded;
+}
+
+bool RenameViaNtSetInformationFile(std::wstring const& path, std::wstring const& newPath) {
+    HANDLE handle = OpenForRename(path);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    size_t bufferSize = sizeof(FILE_RENAME_INFORMATION) + newPath.length() * sizeof(WCHAR);
+    std::vector<char> buffer(bufferSize);
+    PFILE_RENAME_INFORMATION renameInfo = reinterpret_cast<PFILE_RENAME_INFORMATION>(buffer.data());
+    renameInfo->ReplaceIfExists = FALSE;
+    renameInfo->RootDirectory = nullptr;
+    renameInfo->FileNameLength = (ULONG)(newPath.length() * sizeof(WCHAR));
+    wmemcpy(renameInfo->FileName, newPath.c_str(), newPath.length());
+
+    IO_STATUS_BLOCK iosb{};
+    NTSTATUS status = NtSetInformationFile(handle, &iosb, renameInfo, (ULONG)bufferSize, FileRenameInformation);
+    CloseHandle(handle);
+    return NT_SUCCESS(status);
+}
+
+bool OpenRelativeToDirectory(std::wstring const& directory, std::wstring const& relativeName) {
+    HANDLE directoryHandle = CreateFileW(
+        directory.c_str(),
+        FILE_LIST_DIRECTORY | FILE_TRAVERSE | SYNCHRONIZE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS,
+        NULL);
+    if (directoryHandle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    UNICODE_STRING usName;
+    RtlInitUnicodeString(&usName, relativeName.c_str());
+
+    OBJECT_ATTRIBUTES attrib;
+    InitializeObjectAttributes(
+        &attrib,
+        &usName,
+        OBJ_CASE_INSENSITIVE,
+        directoryHandle,
+        NULL
+        );
+
+    HANDLE handle{};
+    IO_STATUS_BLOCK iosb{};
+    NTSTATUS status = NtCreateFile(
+        &handle,
+        FILE_GENERIC_READ,
+        &attrib,
+        &iosb,
+        (PLARGE_INTEGER)nullptr, // AllocationSize
+        (ULONG)0, // Attributes,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        FILE_OPEN,
+        FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+        nullptr, // EaBuffer,
+        0 // EaLength
+        );
+
+    if (NT_SUCCESS(status)) {
+        NtClose(handle);
+    }
+
+    CloseHandle(directoryHandle);
+    return NT_SUCCESS(status);
+}
+
+bool RunInChildProcess(std::wstring const& executable, std::wstring const& childCommand) {
+    wchar_t exePath[MAX_PATH];
+    if (executable.empty()) {
+        DWORD exePathLength = GetModuleFileNameW(NULL, exePath, MAX_PATH);
+        if (exePathLength == 0 || exePathLength == MAX_PATH) {
+            return false;
+        }
+    }
+    else if (wcscpy_s(exePath, executable.c_str()) != 0) {
+        return false;
+    }
+
+    std::wstring command = childCommand;
+    for (wchar_t& c : command) {
+        if (c == L'|') {
+            c = L',';
+        }
+    }
+
+    std::wstring commandLine(L"\"");
+    commandLine += exePath;
+    commandLine += L"\" \"";
+    commandLine += command;
+    commandLine += L"\"";
+
+    STARTUPINFOW startupInfo{};
+    startupInfo.cb = sizeof(startupInfo);
+    startupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startupInfo.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    PROCESS_INFORMATION processInfo{};
+    if (!CreateProcessW(nullptr, &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startupInfo, &processInfo)) {
+        return false;
+    }
+
+    DWORD exitCode = 1;
+    WaitForSingleObject(processInfo.hProcess, INFINITE);
+    GetExitCodeProcess(processInfo.hProcess, &exitCode);
+    CloseHandle(processInfo.hThread);
+    CloseHandle(processInfo.hProcess);
+    return exitCode == 0;
+}
+
+static bool CreateProcessForCommandLine(std::wstring const& applicationName, std::wstring const& commandLine, PROCESS_INFORMATION& processInfo) {
+    std::wstring mutableCommandLine = commandLine;
+    for (wchar_t& c : mutableCommandLine) {
+        if (c == L'|') {
+            c = L',';
+        }
+    }
+
+    STARTUPINFOW startupInfo{};
+    startupInfo.cb = sizeof(startupInfo);
+    startupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startupInfo.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    return CreateProcessW(
+        applicationName.empty() ? nullptr : applicationName.c_str(),
+        &mutableCommandLine[0],
+        nullptr,
+        nullptr,
+        TRUE,
+        0,
+        nullptr,
+        nullptr,
+        &startupInfo,
+        &processInfo) == TRUE;
+}
+
+bool RunCommandLine(std::wstring const& applicationName, std::wstring const& commandLine) {
+    PROCESS_INFORMATION processInfo{};
+    if (!CreateProcessForCommandLine(applicationName, commandLine, processInfo)) {
+        return false;
+    }
+
+    DWORD exitCode = 1;
+    WaitForSingleObject(processInfo.hProcess, INFINITE);
+    GetExitCodeProcess(processInfo.hProcess, &exitCode);
+    CloseHandle(processInfo.hThread);
+    CloseHandle(processInfo.hProcess);
+    return exitCode == 0;
+}
+
+bool StartCommandLine(std::wstring const& applicationName, std::wstring const& commandLine) {
+    PROCESS_INFORMATION processInfo{};
+    if (!CreateProcessForCommandLine(applicationName, commandLine, processInfo)) {
+        return false;
+    }
+
+    CloseHandle(processInfo.hThread);
+    CloseHandle(processInfo.hProcess);
+    return true;
+}
+
+bool WaitForEvent(std::wstring const& name) {
+    HANDLE event = OpenEventW(SYNCHRONIZE, FALSE, name.c_str());
+    if (event == NULL) {
+        return false;
+    }
+
+    DWORD waitResult = WaitForSingleObject(event, 5 * 60 * 1000);
+    CloseHandle(event);
+    return waitResult == WAIT_OBJECT_0;
+}
+
+bool JoinJobWithoutBreakaway(std::wstring const& name) {
+    // The handle is left open: the job lives as long as this process.
+    HANDLE job = CreateJobObjectW(nullptr, name.empty() ? nullptr : name.c_str());
+    if (job == NULL) {
+        return false;
+    }
+
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limitInfo{};
+    limitInfo.BasicLimitInformation.LimitFlags = 0;
+    return SetInformationJobObject(job, JobObjectExtendedLimitInformation, &limitInfo, sizeof(limitInfo))
+        && AssignProcessToJobObject(job, GetCurrentProcess());
+}
+
 static CommandBase const* Commands[] = {
     new Command<SingleParam>(L"EnumerateWithFindFirstFileEx", EnumerateWithFindFirstFileEx),
     new Command<SingleParam>(L"EnumerateFileOrDirectoryByHandle", EnumerateFileOrDirectoryByHandle),
     new Command<SingleParam>(L"DeleteViaNtCreateFile", DeleteViaNtCreateFile),
     new Command<DualParam>(L"CreateHardLink", CreateHardLink),
+    new Command<SingleParam>(L"CreateDirectory", CreateDirectory),
+    new Command<DualParam>(L"RenameByHandle", RenameByHandle),
+    new Command<DualParam>(L"RenameViaNtSetInformationFile", RenameViaNtSetInformationFile),
+    new Command<DualParam>(L"OpenRelativeToDirectory", OpenRelativeToDirectory),
+    new Command<DualParam>(L"Load", Load),
+    new Command<DualParam>(L"RunInChildProcess", RunInChildProcess),
+    new Command<DualParam>(L"RunCommandLine", RunCommandLine),
+    new Command<DualParam>(L"StartCommandLine", StartCommandLine),
+    new Command<SingleParam>(L"WaitForEvent", WaitForEvent),
+    new Command<SingleParam>(L"JoinJobWithoutBreakaway", JoinJobWithoutBreakaway),
+    new Command<DualParam>(L"CopyFile", CopyFile),
+    new Command<SingleParam>(L"GetTempFileName", GetTempFileName),
+    new Command<SingleParam>(L"SetCurrentDirectory", SetCurrentDirectory),
+    new Command<DualParam>(L"MoveFileEx", MoveFileEx),
+    new Command<DualParam>(L"CheckFileName", CheckFileName),
+    new Command<DualParam>(L"WriteFile", WriteFile),
+    new Command<DualParam>(L"CheckFileSize", CheckFileSize),
+    new Command<DualParam>(L"RenameAndCheckFinalPath", RenameAndCheckFinalPath),
     nullptr
 };
 
+// Parses and runs one command. Returns 0 if it could run (with its result in 'succeeded') or the exit code of the error that stopped it.
+static int DispatchCommand(std::wstring const& lineBuffer, bool& succeeded)
+{
+    succeeded = false;
+
+    std::vector<std::wstring> parameters;
+    {
+        wchar_t const* tokenStart = lineBuffer.c_str();
+        wchar_t const* tokenEnd = tokenStart;
+
+        for ( ; ; ) {
+            wchar_t c = *tokenEnd;
+            if (c == L',' || c == L'\0') {
+                parameters.push_back(
+                    std::wstring(tokenStart, tokenEnd));
+
+                if (c == L'\0') { break; }
+
+                tokenEnd = tokenStart = tokenEnd + 1;
+            }
+            else {
+                tokenEnd++;
+            }
+        }
+    }
+
+    if (parameters.size() == 0 || parameters[0].length() == 0) {
+        std::wcerr << L"Bad command format. Expected commandName,parameter,parameter ; zero or more parameters separated by commas. Actual: " << lineBuffer << std::endl;
+        return 2;
+    }
+
+    std::wstring const& commandName = parameters[0];
+    for (CommandBase const** c = Commands; ; c++) {
+        CommandBase const* cmd = *c;
+        if (cmd == nullptr) {
+            std::wcerr << L"Unknown command name. Supported: [EnumerateWithFindFirstFileEx, EnumerateFileOrDirectoryByHandle, DeleteViaNtCreateFile, CreateHardLink, CreateDirectory, RenameByHandle, RenameViaNtSetInformationFile, OpenRelativeToDirectory, Load, RunInChildProcess, RunCommandLine, StartCommandLine, WaitForEvent, JoinJobWithoutBreakaway, CopyFile, GetTempFileName, SetCurrentDirectory, MoveFileEx, CheckFileName, WriteFile, CheckFileSize, RenameAndCheckFinalPath]. Actual: " << commandName << std::endl;
+            return 3;
+        } 
+
+        bool handled = false;
+        CommandInvocationResult result = cmd->InvokeIfMatches(parameters);
+        switch (result) {
+        case Success:
+            handled = true;
+            succeeded = true;
+            std::wcout << commandName << L"," << 0;
+            break;
+        case Failure:
+            handled = true;
+            std::wcout << commandName << L"," << 1;
+            break;
+        case IncorrectParameterCount:
+            std::wcerr 
+                << L"Wrong number of parameters for " << commandName
+                << L". Expected: " << cmd->requiredParameters << " Actual: " << (parameters.size() - 1) << std::endl;
+            return 4;
+        case CommandNameDoesNotMatch:
+            handled = false;
+            break;
+        default:
+            assert(false);
+        }
+
+        if (handled) { return 0; }
+    }
+}
+
 int main(int argc, char **argv)
 {
-    (void)argv; // Unused
+    if (argc == 2) {
+        // A single command, e.g. to run a load from the command line (or in the child processes of a load).
+        int length = MultiByteToWideChar(CP_ACP, 0, argv[1], -1, nullptr, 0);
+        std::wstring command(length > 0 ? length - 1 : 0, L'\0');
+        if (length > 1) {
+            MultiByteToWideChar(CP_ACP, 0, argv[1], -1, &command[0], length);
+        }
+
+        // The result of the command is in the exit code as well.
+        bool succeeded;
+        int error = DispatchCommand(command, succeeded);
+        return error != 0 ? error : (succeeded ? 0 : 6);
+    }
 
     if (argc != 1) {
-        std::wcerr << L"No arguments expected. API commands are expected over stdin." << std::endl;
+        std::wcerr << L"At most one argument expected. API commands are expected over stdin, or as the only argument." << std::endl;
         return 1;
     }
 
@@ -169,64 +642,10 @@ int main(int argc, char **argv)
             }
         }
 
-        std::vector<std::wstring> parameters;
-        {
-            wchar_t const* tokenStart = lineBuffer.c_str();
-            wchar_t const* tokenEnd = tokenStart;
-
-            for ( ; ; ) {
-                wchar_t c = *tokenEnd;
-                if (c == L',' || c == L'\0') {
-                    parameters.push_back(
-                        std::wstring(tokenStart, tokenEnd));
-
-                    if (c == L'\0') { break; }
-
-                    tokenEnd = tokenStart = tokenEnd + 1;
-                }
-                else {
-                    tokenEnd++;
-                }
-            }
-        }
-
-        if (parameters.size() == 0 || parameters[0].length() == 0) {
-            std::wcerr << L"Bad command format. Expected commandName,parameter,parameter ; zero or more parameters separated by commas. Actual: " << lineBuffer << std::endl;
-            return 2;
-        }
-
-        std::wstring const& commandName = parameters[0];
-        for (CommandBase const** c = Commands; ; c++) {
-            CommandBase const* cmd = *c;
-            if (cmd == nullptr) {
-                std::wcerr << L"Unknown command name. Supported: [EnumerateWithFindFirstFileEx, DeleteViaNtCreateFile, CreateHardLink]. Actual: " << commandName << std::endl;
-                return 3;
-            } 
-
-            bool handled = false;
-            CommandInvocationResult result = cmd->InvokeIfMatches(parameters);
-            switch (result) {
-            case Success:
-                handled = true;
-                std::wcout << commandName << L"," << 0;
-                break;
-            case Failure:
-                handled = true;
-                std::wcout << commandName << L"," << 1;
-                break;
-            case IncorrectParameterCount:
-                std::wcerr 
-                    << L"Wrong number of parameters for " << commandName
-                    << L". Expected: " << cmd->requiredParameters << " Actual: " << (parameters.size() - 1) << std::endl;
-                return 4;
-            case CommandNameDoesNotMatch:
-                handled = false;
-                break;
-            default:
-                assert(false);
-            }
-
-            if (handled) { break; }
+        bool succeeded;
+        int error = DispatchCommand(lineBuffer, succeeded);
+        if (error != 0) {
+            return error;
         }
     }
 
@@ -67,6 +67,24 @@ extern "C" {
         _In_ BOOLEAN RestartScan
         );
 
+    typedef struct _FILE_RENAME_INFORMATION {
+        BOOLEAN ReplaceIfExists;
+        HANDLE RootDirectory;
+        ULONG FileNameLength;
+        WCHAR FileName[1];
+    } FILE_RENAME_INFORMATION, *PFILE_RENAME_INFORMATION;
+
+    // FILE_INFORMATION_CLASS value of FILE_RENAME_INFORMATION
+    #define FileRenameInformation ((FILE_INFORMATION_CLASS)10)
+
+    NTSTATUS NTAPI NtSetInformationFile(
+        _In_ HANDLE FileHandle,
+        _Out_ PIO_STATUS_BLOCK IoStatusBlock,
+        _In_reads_bytes_(Length) PVOID FileInformation,
+        _In_ ULONG Length,
+        _In_ FILE_INFORMATION_CLASS FileInformationClass
+        );
+
     // From ntstatus.h in the DDK
 
     //
@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the accesses detoured processes merge per path before reporting them (<see cref="FileAccessManifest.SummarizeFileAccesses"/>).
+    /// </summary>
+    public class AccessSummaryDetoursTests : RemoteApiDetoursTestBase
+    {
+        [Fact]
+        public async Task SummarizedAccessesReachTheManagedSide()
+        {
+            var pathTable = new PathTable();
+
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            AbsolutePath filePath = WriteEmptyFile(pathTable, @"D\file.txt");
+            AbsolutePath subdirectoryPath = GetFullPath(pathTable, @"D\Sub");
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.SummarizeFileAccesses = true;
+                    manifest.MonitorNtCreateFile = true;
+                    manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+                },
+                RemoteApi.Command.OpenRelativeToDirectory(dirPath.ToString(pathTable), "file.txt"),
+                RemoteApi.Command.OpenRelativeToDirectory(dirPath.ToString(pathTable), "file.txt"),
+                RemoteApi.Command.CreateDirectory(subdirectoryPath.ToString(pathTable)));
+
+            // Both reads of the file are merged into one report, sent when the process exits.
+            var fileReports = GetReports(pathTable, result, filePath);
+            XAssert.AreEqual(1, fileReports.Length, "Expected the reads of {0} to be summarized in a single report", filePath.ToString(pathTable));
+            XAssert.AreEqual(ReportedFileOperation.MultipleOperations, fileReports[0].Operation);
+            XAssert.AreEqual(FileAccessStatus.Allowed, fileReports[0].Status);
+            XAssert.IsTrue((fileReports[0].RequestedAccess & RequestedAccess.Read) != 0, "Expected a read of {0}", filePath.ToString(pathTable));
+
+            var subdirectoryReports = GetReports(pathTable, result, subdirectoryPath);
+            XAssert.IsTrue(subdirectoryReports.Length > 0, "Expected the creation of {0} to be reported", subdirectoryPath.ToString(pathTable));
+            XAssert.IsTrue(
+                subdirectoryReports.Any(access => (access.RequestedAccess & RequestedAccess.Write) != 0),
+                "Expected a write of {0}",
+                subdirectoryPath.ToString(pathTable));
+        }
+
+        private static ReportedFileAccess[] GetReports(PathTable pathTable, SandboxedProcessResult result, AbsolutePath path)
+        {
+            return result.ExplicitlyReportedFileAccesses
+                .Where(access => string.Equals(access.GetPath(pathTable), path.ToString(pathTable), StringComparison.OrdinalIgnoreCase))
+                .ToArray();
+        }
+    }
+}
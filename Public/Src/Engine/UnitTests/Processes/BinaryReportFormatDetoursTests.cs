@@ -0,0 +1,110 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the reports Detours sends as binary records (<see cref="FileAccessManifest.UseBinaryReportFormat"/>), from the records
+    /// written by the detoured process to the accesses parsed by <see cref="SandboxedProcessReports"/>.
+    /// </summary>
+    public class BinaryReportFormatDetoursTests : RemoteApiDetoursTestBase
+    {
+        [Fact]
+        public async Task BinaryReportsMatchTextReports()
+        {
+            var pathTable = new PathTable();
+
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\file.txt");
+
+            (string[] textExplicit, string[] textUnexpected) = await RunAndGetReportsAsync(pathTable, dirPath, "Text", useBinaryReportFormat: false);
+            (string[] binaryExplicit, string[] binaryUnexpected) = await RunAndGetReportsAsync(pathTable, dirPath, "Binary", useBinaryReportFormat: true);
+
+            XAssert.IsTrue(textExplicit.Length > 0, "Expected accesses under {0} to be reported", dirPath.ToString(pathTable));
+            XAssert.AreEqual(string.Join(Environment.NewLine, textExplicit), string.Join(Environment.NewLine, binaryExplicit));
+            XAssert.AreEqual(string.Join(Environment.NewLine, textUnexpected), string.Join(Environment.NewLine, binaryUnexpected));
+        }
+
+        [Fact]
+        public async Task BinaryReportsThroughTheRingMatchTextReports()
+        {
+            var pathTable = new PathTable();
+
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\file.txt");
+
+            (string[] textExplicit, _) = await RunAndGetReportsAsync(pathTable, dirPath, "Text", useBinaryReportFormat: false);
+            (string[] ringExplicit, _) = await RunAndGetReportsAsync(pathTable, dirPath, "Ring", useBinaryReportFormat: true, useReportRingBuffer: true);
+
+            XAssert.IsTrue(textExplicit.Length > 0, "Expected accesses under {0} to be reported", dirPath.ToString(pathTable));
+            XAssert.AreEqual(string.Join(Environment.NewLine, textExplicit), string.Join(Environment.NewLine, ringExplicit));
+        }
+
+        private async Task<(string[] explicitlyReported, string[] unexpected)> RunAndGetReportsAsync(
+            PathTable pathTable,
+            AbsolutePath dirPath,
+            string name,
+            bool useBinaryReportFormat,
+            bool useReportRingBuffer = false)
+        {
+            string directory = dirPath.ToString(pathTable);
+            string failuresFile = GetFullPath("DetoursFailures" + name + ".txt");
+            FileAccessManifest runManifest = null;
+
+            try
+            {
+                SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                    pathTable,
+                    manifest =>
+                    {
+                        manifest.UseBinaryReportFormat = useBinaryReportFormat;
+                        manifest.UseReportRingBuffer = useReportRingBuffer;
+                        manifest.InternalDetoursErrorNotificationFile = failuresFile;
+                        manifest.SetMessageCountSemaphore(failuresFile.Replace('\\', '_'));
+                        manifest.MonitorNtCreateFile = true;
+                        manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+                        runManifest = manifest;
+                    },
+                    RemoteApi.Command.OpenRelativeToDirectory(directory, "file.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(directory, "missing.txt"),
+                    RemoteApi.Command.CreateDirectory(directory + @"\Sub" + name),
+                    RemoteApi.Command.RenameByHandle(directory + @"\Sub" + name, directory + @"\Renamed" + name));
+
+                return (Describe(result.ExplicitlyReportedFileAccesses, pathTable, name), Describe(result.AllUnexpectedFileAccesses, pathTable, name));
+            }
+            finally
+            {
+                runManifest?.UnsetMessageCountSemaphore();
+            }
+        }
+
+        private static string[] Describe(IEnumerable<ReportedFileAccess> accesses, PathTable pathTable, string name)
+        {
+            return (accesses ?? Enumerable.Empty<ReportedFileAccess>())
+                .Select(access => string.Format(
+                    "{0:G} {1:G} {2:G} {3} {4}",
+                    access.Operation,
+                    access.RequestedAccess,
+                    access.Status,
+                    access.Error,
+                    WithoutRunName(access.GetPath(pathTable), name)))
+                .Distinct(StringComparer.OrdinalIgnoreCase)
+                .OrderBy(report => report, StringComparer.OrdinalIgnoreCase)
+                .ToArray();
+        }
+
+        private static string WithoutRunName(string path, string name)
+        {
+            return path.EndsWith(name, StringComparison.OrdinalIgnoreCase) ? path.Substring(0, path.Length - name.Length) : path;
+        }
+    }
+}
@@ -0,0 +1,216 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Diagnostics;
+using System.IO;
+using System.Linq;
+using System.Threading;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the child processes that break away from the sandbox (<see cref="FileAccessManifest.AddChildProcessToBreakaway"/>).
+    /// </summary>
+    /// <remarks>
+    /// The child is a copy of RemoteApi named <see cref="ServerImage"/> that creates a directory: the directory tells that it ran, and
+    /// the absence of a report for it that it broke away. To outlive the pip, the child instead waits for an event the test only sets
+    /// once the pip is done.
+    /// </remarks>
+    public class BreakawayDetoursTests : RemoteApiDetoursTestBase
+    {
+        private const string ServerName = "Server";
+        private const string ServerImage = ServerName + ".exe";
+
+        [Fact]
+        public async Task QuotedCommandLineBreaksAway()
+        {
+            string server = CopyRemoteApi();
+            await AssertChildBreaksAwayAsync(
+                breakawayName: ServerImage,
+                applicationName: null,
+                commandLine: child => "\"" + server + "\" " + child,
+                expectBreakaway: true);
+        }
+
+        [Fact]
+        public async Task CommandLineWithoutExtensionBreaksAway()
+        {
+            // CreateProcess appends ".exe" to the image of the command line, and finds it in the working directory of RemoteApi.
+            CopyRemoteApi();
+            await AssertChildBreaksAwayAsync(
+                breakawayName: ServerImage,
+                applicationName: null,
+                commandLine: child => ServerName + " " + child,
+                expectBreakaway: true);
+        }
+
+        [Fact]
+        public async Task NameWithoutExtensionMatchesImage()
+        {
+            string server = CopyRemoteApi();
+            await AssertChildBreaksAwayAsync(
+                breakawayName: ServerName,
+                applicationName: null,
+                commandLine: child => "\"" + server + "\" " + child,
+                expectBreakaway: true);
+        }
+
+        [Fact]
+        public async Task ApplicationNameBreaksAway()
+        {
+            string server = CopyRemoteApi();
+            await AssertChildBreaksAwayAsync(
+                breakawayName: ServerImage,
+                applicationName: server,
+                commandLine: child => "child " + child,
+                expectBreakaway: true);
+        }
+
+        [Fact]
+        public async Task ApplicationNameTakesPrecedenceOverCommandLine()
+        {
+            CopyRemoteApi();
+            await AssertChildBreaksAwayAsync(
+                breakawayName: ServerImage,
+                applicationName: RemoteApi.ExecutablePath,
+                commandLine: child => ServerImage + " " + child,
+                expectBreakaway: false);
+        }
+
+        [Fact]
+        public async Task OtherImagesDoNotBreakAway()
+        {
+            CopyRemoteApi();
+            await AssertChildBreaksAwayAsync(
+                breakawayName: ServerImage,
+                applicationName: null,
+                commandLine: child => "\"" + RemoteApi.ExecutablePath + "\" " + child,
+                expectBreakaway: false);
+        }
+
+        [Fact]
+        public async Task ChildIsSandboxedWhenTheJobRefusesBreakaway()
+        {
+            string server = CopyRemoteApi();
+            await AssertChildBreaksAwayAsync(
+                breakawayName: ServerImage,
+                applicationName: null,
+                commandLine: child => "\"" + server + "\" " + child,
+                expectBreakaway: false,
+                joinJobWithoutBreakaway: true);
+        }
+
+        [Fact]
+        public async Task ChildThatBrokeAwayOutlivesThePip()
+        {
+            string server = CopyRemoteApi();
+            string eventName = "BuildXL.Test.Breakaway." + Guid.NewGuid().ToString("N");
+
+            using (var release = new EventWaitHandle(initialState: false, EventResetMode.ManualReset, eventName))
+            {
+                var pathTable = new PathTable();
+                AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+
+                // The child waits for the event, which is only set once the pip is done.
+                SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                    pathTable,
+                    manifest =>
+                    {
+                        manifest.MonitorChildProcesses = true;
+                        manifest.AddChildProcessToBreakaway(ServerImage);
+                        manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+                    },
+                    RemoteApi.Command.StartCommandLine(null, "\"" + server + "\" " + RemoteApi.Command.WaitForEvent(eventName).GetCommandLineArgument()));
+
+                Process[] children = Process.GetProcessesByName(ServerName).Where(process => IsImage(process, server)).ToArray();
+                try
+                {
+                    XAssert.IsFalse(result.Killed, "Expected the pip not to wait for the child process that broke away");
+                    XAssert.IsTrue(
+                        result.SurvivingChildProcesses == null || !result.SurvivingChildProcesses.Any(),
+                        "Expected the child process that broke away not to be tracked by the pip");
+                    XAssert.IsFalse(
+                        result.Processes?.Any(process => string.Equals(process.Path, server, StringComparison.OrdinalIgnoreCase)) ?? false,
+                        "Expected the child process that broke away not to be reported");
+                    XAssert.AreEqual(1, children.Length, "Expected the child process to outlive the pip");
+
+                    release.Set();
+                    XAssert.IsTrue(children[0].WaitForExit(60 * 1000), "Expected the child process to exit once released");
+                    XAssert.AreEqual(0, children[0].ExitCode, "Expected the child process to see the event set");
+                }
+                finally
+                {
+                    foreach (Process child in children)
+                    {
+                        if (!child.HasExited)
+                        {
+                            child.Kill();
+                        }
+
+                        child.Dispose();
+                    }
+                }
+            }
+        }
+
+        private static bool IsImage(Process process, string path)
+        {
+            try
+            {
+                return string.Equals(process.MainModule.FileName, path, StringComparison.OrdinalIgnoreCase);
+            }
+            catch (Exception e) when (e is InvalidOperationException || e is System.ComponentModel.Win32Exception)
+            {
+                // The process exited, or is not ours to look into.
+                return false;
+            }
+        }
+
+        private string CopyRemoteApi()
+        {
+            string path = GetFullPath(ServerImage);
+            File.Copy(RemoteApi.ExecutablePath, path, overwrite: true);
+            return path;
+        }
+
+        private async Task AssertChildBreaksAwayAsync(
+            string breakawayName,
+            string applicationName,
+            Func<string, string> commandLine,
+            bool expectBreakaway,
+            bool joinJobWithoutBreakaway = false)
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            string created = Path.Combine(dirPath.ToString(pathTable), "Created");
+
+            var commands = new[]
+            {
+                RemoteApi.Command.JoinJobWithoutBreakaway(),
+                RemoteApi.Command.RunCommandLine(applicationName, commandLine(RemoteApi.Command.CreateDirectory(created).GetCommandLineArgument())),
+            };
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.MonitorChildProcesses = true;
+                    manifest.AddChildProcessToBreakaway(breakawayName);
+                    manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+                },
+                joinJobWithoutBreakaway ? commands : commands.Skip(1).ToArray());
+
+            XAssert.IsTrue(Directory.Exists(created), "Expected the child process to run and create {0}", created);
+
+            bool reported = result.ExplicitlyReportedFileAccesses.Any(
+                access => string.Equals(access.GetPath(pathTable), created, StringComparison.OrdinalIgnoreCase));
+            XAssert.AreEqual(!expectBreakaway, reported, "Expected the child process to {0}", expectBreakaway ? "break away" : "be sandboxed");
+        }
+    }
+}
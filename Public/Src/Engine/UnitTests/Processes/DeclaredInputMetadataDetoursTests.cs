@@ -0,0 +1,82 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.IO;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the attribute probes the detoured processes answer from the metadata of the declared inputs in the manifest
+    /// (<see cref="FileAccessManifest.SetDeclaredInputMetadata"/>).
+    /// </summary>
+    /// <remarks>
+    /// The metadata gives the file a size it does not have on disk, so the size the probe returns tells where the answer came from.
+    /// </remarks>
+    public class DeclaredInputMetadataDetoursTests : RemoteApiDetoursTestBase
+    {
+        private const string Contents = "on disk";
+        private const long DeclaredSize = 1234;
+
+        [Theory]
+        [InlineData(false)]
+        [InlineData(true)]
+        public async Task ProbesOfDeclaredInputsAreAnsweredFromTheManifest(bool allowWrites)
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            AbsolutePath filePath = dirPath.Combine(pathTable, "input.txt");
+            string file = filePath.ToString(pathTable);
+            File.WriteAllText(file, Contents);
+
+            // The metadata of a file the pip may write is not trusted: the probe then goes to the file system.
+            long expectedSize = allowWrites ? Contents.Length : DeclaredSize;
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.LogProcessData = true;
+                    manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.ReportAccess);
+                    manifest.AddPath(
+                        filePath,
+                        FileAccessPolicy.MaskAll,
+                        (allowWrites ? FileAccessPolicy.AllowAll : FileAccessPolicy.AllowReadAlways) | FileAccessPolicy.ReportAccess);
+
+                    DateTime now = DateTime.UtcNow;
+                    manifest.SetDeclaredInputMetadata(filePath, new DeclaredInputMetadata(FileAttributes.Normal, DeclaredSize, now, now, now));
+                },
+                RemoteApi.Command.CheckFileSize(file, expectedSize));
+
+            string output = await result.StandardOutput.ReadValueAsync();
+            XAssert.IsTrue(
+                output.Contains(RemoteApi.CommandType.CheckFileSize.ToString("G") + ",0"),
+                "Expected the probe of {0} to return a size of {1}. Output: {2}",
+                file,
+                expectedSize,
+                output);
+
+            XAssert.IsTrue(
+                result.ExplicitlyReportedFileAccesses.Any(access =>
+                    string.Equals(access.GetPath(pathTable), file, StringComparison.OrdinalIgnoreCase) && access.Status == FileAccessStatus.Allowed),
+                "Expected the probe of {0} to be reported",
+                file);
+
+            ulong answered = GetProcessDataCounter(result, "ProbesAnsweredFromManifest");
+            if (allowWrites)
+            {
+                XAssert.AreEqual(0UL, answered);
+            }
+            else
+            {
+                XAssert.IsTrue(answered > 0, "Expected the probe of {0} to be answered without the file system", file);
+            }
+        }
+    }
+}
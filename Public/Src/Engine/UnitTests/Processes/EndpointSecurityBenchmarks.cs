@@ -0,0 +1,228 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+using Xunit.Abstractions;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Like-for-like comparison of the two macOS sandboxes: the same workloads run under the kernel extension
+    /// (<see cref="KextConnection"/>) and under the Endpoint Security client (<see cref="EndpointSecurityConnection"/>).
+    /// </summary>
+    /// <remarks>
+    /// The scripts of the workloads run with paths relative to their working directory, so they are free of spaces and quotes.
+    ///
+    /// Each configuration prints one line to the test output, in the format of <see cref="SandboxOverheadBenchmarks"/>:
+    ///   {"benchmark":"macSandbox/&lt;workload&gt;/&lt;configuration&gt;","samples":3,"minMs":...,"medianMs":...,"maxMs":...,"overheadPercent":...,"reports":...}
+    /// followed, for the Endpoint Security client, by its message counters. A sandbox that is not available (the kext is not loaded, or the
+    /// test process is not entitled to create an Endpoint Security client) is skipped with a note in the output. Nothing is asserted on the timings.
+    /// </remarks>
+    [Trait("Category", "Performance")]
+    public sealed class EndpointSecurityBenchmarks : SandboxedProcessTestBase
+    {
+        private const int SampleCount = 3;
+
+        private readonly ITestOutputHelper m_output;
+
+        /// <nodoc />
+        public EndpointSecurityBenchmarks(ITestOutputHelper output)
+            : base(output)
+        {
+            m_output = output;
+        }
+
+        /// <summary>
+        /// Reads and probes of a tree of small files from a single process, as a compiler resolving its includes does.
+        /// </summary>
+        [FactIfSupported(requiresUnixBasedOperatingSystem: true)]
+        public Task ReadHeavy()
+        {
+            return RunWorkloadAsync("readHeavy", files: 2000, script: "cat */* > /dev/null; ls -lR . > /dev/null; for i in 1 2 3; do test -e missing$i; done; true");
+        }
+
+        /// <summary>
+        /// Many short-lived processes making few calls each, as a shell script running tools does.
+        /// </summary>
+        [FactIfSupported(requiresUnixBasedOperatingSystem: true)]
+        public Task ForkHeavy()
+        {
+            return RunWorkloadAsync("forkHeavy", files: 50, script: "for f in */*; do /bin/cat $f > /dev/null; done");
+        }
+
+        /// <summary>
+        /// Writes, renames and deletions of outputs, as a tool writing to a temporary file and moving it in place does.
+        /// </summary>
+        [FactIfSupported(requiresUnixBasedOperatingSystem: true)]
+        public Task WriteHeavy()
+        {
+            return RunWorkloadAsync("writeHeavy", files: 200, script: "mkdir -p out; for f in */*; do cp $f out/tmp; mv out/tmp out/$(basename $f); done; rm -rf out");
+        }
+
+        private async Task RunWorkloadAsync(string workload, int files, string script)
+        {
+            if (!OperatingSystemHelper.IsMacOS)
+            {
+                m_output.WriteLine($"macSandbox/{workload}: skipped, the macOS sandboxes only run on macOS");
+                return;
+            }
+
+            string root = Path.Combine(TemporaryDirectory, workload);
+            for (int i = 0; i < files; i++)
+            {
+                string dir = Path.Combine(root, "d" + (i % 20));
+                Directory.CreateDirectory(dir);
+                File.WriteAllText(Path.Combine(dir, "f" + i), new string('x', 1 + i % 4096));
+            }
+
+            // The first run warms up the file system caches for the measured runs.
+            RunUnsandboxed(root, script);
+
+            var baseline = new List<long>();
+            for (int i = 0; i < SampleCount; i++)
+            {
+                var stopwatch = Stopwatch.StartNew();
+                RunUnsandboxed(root, script);
+                baseline.Add(stopwatch.ElapsedMilliseconds);
+            }
+
+            long baselineMedian = Median(baseline);
+            Report(workload, "unsandboxed", baseline, baselineMedian, reports: 0);
+
+            IKextConnection kext = TryCreate(workload, "kext", () => GetSandboxedKextConnection());
+            if (kext != null)
+            {
+                await RunSandboxedAsync(workload, "kext", kext, root, script, baselineMedian);
+            }
+
+            var endpointSecurity = (EndpointSecurityConnection)TryCreate(
+                workload,
+                "endpointSecurity",
+                () => new EndpointSecurityConnection(new EndpointSecurityConnection.Config { MeasureCpuTimes = true }));
+            if (endpointSecurity != null)
+            {
+                using (endpointSecurity)
+                {
+                    endpointSecurity.GetCounters(reset: true);
+                    await RunSandboxedAsync(workload, "endpointSecurity", endpointSecurity, root, script, baselineMedian);
+
+                    var counters = endpointSecurity.GetCounters();
+                    m_output.WriteLine(string.Format(
+                        CultureInfo.InvariantCulture,
+                        "{{\"benchmark\":\"macSandbox/{0}/endpointSecurity/counters\",\"auth\":{1},\"notify\":{2},\"untracked\":{3},\"reports\":{4},\"batches\":{5},\"dropped\":{6},\"notifyP50Us\":{7},\"notifyP99Us\":{8}}}",
+                        workload,
+                        counters.NumAuthMessages,
+                        counters.NumNotifyMessages,
+                        counters.NumUntrackedMessages,
+                        counters.NumReports,
+                        counters.NumBatches,
+                        counters.NumDroppedMessages,
+                        counters.NotifyLatency.PercentileUs(50),
+                        counters.NotifyLatency.PercentileUs(99)));
+                }
+            }
+        }
+
+        private IKextConnection TryCreate(string workload, string configuration, Func<IKextConnection> create)
+        {
+            try
+            {
+                return create();
+            }
+            catch (BuildXLException e)
+            {
+                m_output.WriteLine($"macSandbox/{workload}/{configuration}: skipped, {e.Message}");
+                return null;
+            }
+        }
+
+        private async Task RunSandboxedAsync(string workload, string configuration, IKextConnection connection, string root, string script, long baselineMedian)
+        {
+            var samples = new List<long>();
+            int reports = 0;
+            for (int i = 0; i < SampleCount; i++)
+            {
+                var info = new SandboxedProcessInfo(
+                    Context.PathTable,
+                    this,
+                    "/bin/sh",
+                    disableConHostSharing: false,
+                    sandboxedKextConnection: connection)
+                {
+                    PipSemiStableHash = 0x1234,
+                    PipDescription = $"{workload}/{configuration}",
+                    WorkingDirectory = root,
+                    Arguments = "-c \"" + script + "\"",
+                    Timeout = TimeSpan.FromMinutes(10),
+                    EnvironmentVariables = BuildParameters.GetFactory().PopulateFromEnvironment(),
+                };
+                info.FileAccessManifest.FailUnexpectedFileAccesses = false;
+                info.FileAccessManifest.ReportFileAccesses = true;
+                info.FileAccessManifest.PipId = GetNextPipId();
+
+                var stopwatch = Stopwatch.StartNew();
+                using (var process = new SandboxedProcessMacKext(info))
+                {
+                    process.Start();
+                    var result = await process.GetResultAsync();
+                    samples.Add(stopwatch.ElapsedMilliseconds);
+
+                    XAssert.AreEqual(0, result.ExitCode, $"The workload failed under {configuration}");
+                    reports = result.FileAccesses?.Count ?? 0;
+                }
+            }
+
+            Report(workload, configuration, samples, baselineMedian, reports);
+        }
+
+        private static void RunUnsandboxed(string root, string script)
+        {
+            var startInfo = new ProcessStartInfo("/bin/sh")
+            {
+                Arguments = "-c \"" + script + "\"",
+                WorkingDirectory = root,
+                UseShellExecute = false,
+            };
+
+            using (var process = Process.Start(startInfo))
+            {
+                process.WaitForExit();
+                XAssert.AreEqual(0, process.ExitCode, "The workload failed unsandboxed");
+            }
+        }
+
+        private void Report(string workload, string configuration, List<long> samples, long baselineMedian, int reports)
+        {
+            long median = Median(samples);
+            double overheadPercent = baselineMedian > 0 ? (median - baselineMedian) * 100.0 / baselineMedian : 0;
+
+            m_output.WriteLine(string.Format(
+                CultureInfo.InvariantCulture,
+                "{{\"benchmark\":\"macSandbox/{0}/{1}\",\"samples\":{2},\"minMs\":{3},\"medianMs\":{4},\"maxMs\":{5},\"overheadPercent\":{6:F1},\"reports\":{7}}}",
+                workload,
+                configuration,
+                samples.Count,
+                samples.Min(),
+                median,
+                samples.Max(),
+                overheadPercent,
+                reports));
+        }
+
+        private static long Median(List<long> samples)
+        {
+            var sorted = samples.OrderBy(sample => sample).ToList();
+            return sorted[sorted.Count / 2];
+        }
+    }
+}
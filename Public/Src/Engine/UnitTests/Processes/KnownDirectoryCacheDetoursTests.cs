@@ -0,0 +1,54 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System.IO;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the directories detoured processes remember to exist (<see cref="FileAccessManifest.CacheKnownDirectories"/>).
+    /// </summary>
+    public class KnownDirectoryCacheDetoursTests : RemoteApiDetoursTestBase
+    {
+        [Theory]
+        [InlineData(false)]
+        [InlineData(true)]
+        public async Task RenamedDirectoryCanBeCreatedAgain(bool renameViaNtSetInformationFile)
+        {
+            var pathTable = new PathTable();
+
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            string directory = GetFullPath(@"D\Sub");
+            string renamedDirectory = GetFullPath(@"D\Renamed");
+
+            await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.CacheKnownDirectories = true;
+
+                    // Renames are neither checked nor reported with these, so the detours of SetFileInformationByHandle and
+                    // ZwSetInformationFile would only call through, if they did not have to forget the known directories.
+                    manifest.OmitPassThroughDetours = true;
+                    manifest.IgnoreSetFileInformationByHandle = true;
+                    manifest.IgnoreZwRenameFileInformation = true;
+                    manifest.IgnoreZwOtherFileInformation = true;
+
+                    manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll);
+                },
+                RemoteApi.Command.CreateDirectory(directory),
+                renameViaNtSetInformationFile
+                    ? RemoteApi.Command.RenameViaNtSetInformationFile(directory, renamedDirectory)
+                    : RemoteApi.Command.RenameByHandle(directory, renamedDirectory),
+                RemoteApi.Command.CreateDirectory(directory));
+
+            XAssert.IsTrue(Directory.Exists(renamedDirectory), "Expected {0} to be renamed to {1}", directory, renamedDirectory);
+            XAssert.IsTrue(Directory.Exists(directory), "Expected {0} to be created again after it was renamed", directory);
+        }
+    }
+}
@@ -0,0 +1,45 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System.IO;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the load generator of <see cref="RemoteApi" /> running in a Detours sandbox.
+    /// </summary>
+    public class LoadGeneratorDetoursTests : RemoteApiDetoursTestBase
+    {
+        [Fact]
+        public async Task LoadWithChildProcessesRunsInSandbox()
+        {
+            var pathTable = new PathTable();
+
+            AbsolutePath loadRoot = CreateDirectory(pathTable, @"load");
+            await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.AddScope(loadRoot, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll);
+                },
+                RemoteApi.Command.Load(loadRoot.ToString(pathTable), "threads=2;files=20;depth=2;operations=100;children=2;generations=1"));
+
+            // Every file of the tree is back in place after the renames.
+            for (int i = 0; i < 20; i++)
+            {
+                AssertFileExistsUnder(GetFullPath("load"), "f" + i);
+            }
+        }
+
+        private static void AssertFileExistsUnder(string root, string fileName)
+        {
+            string[] matches = Directory.GetFiles(root, fileName, SearchOption.AllDirectories);
+            XAssert.AreEqual(1, matches.Length, "Expected one {0} under {1}", fileName, root);
+        }
+    }
+}
@@ -0,0 +1,376 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text.RegularExpressions;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests that the flags of <see cref="FileAccessManifest"/> that only make the detoured processes faster leave the accesses
+    /// they report unchanged.
+    /// </summary>
+    /// <remarks>
+    /// Each test runs the same commands twice, with the flag off and on, each time in a fresh copy of the same tree, and compares
+    /// the accesses reported under the tree and the results of the commands. Each one also checks that the flag took effect with a
+    /// process data counter of the flag, which has to stay at 0 without it and to count something with it.
+    /// </remarks>
+    public class ManifestFlagDetoursTests : RemoteApiDetoursTestBase
+    {
+        private static readonly Regex TempFileName = new Regex(@"\\tmp[0-9A-F]{1,4}\.TMP$", RegexOptions.IgnoreCase);
+        private static readonly Regex LoadResult = new Regex(@"LoadResult,[^\r\n]*\r?\n");
+
+        [Fact]
+        public Task CacheReparsePointProbesKeepsAccesses()
+        {
+            // The same paths are probed again after the process changed them, which has to drop what the cache knew of them.
+            return AssertFlagKeepsAccessesAsync(
+                manifest => manifest.CacheReparsePointProbes = true,
+                root => new[]
+                {
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "file.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "file.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "missing.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root + @"\Sub", "nested.txt"),
+                    RemoteApi.Command.CreateHardlink(root + @"\file.txt", root + @"\missing.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "missing.txt"),
+                    RemoteApi.Command.CreateDirectory(root + @"\New"),
+                    RemoteApi.Command.RenameByHandle(root + @"\New", root + @"\Renamed"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "New"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "Renamed"),
+                    RemoteApi.Command.DeleteViaNtCreateFile(root + @"\missing.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "missing.txt"),
+                },
+                effectCounter: "ReparsePointCacheHits");
+        }
+
+        [Fact]
+        public Task SendReportsAsynchronouslyKeepsAccesses()
+        {
+            // Child processes make the parent wait for its queued reports, and each process drains its queue when it exits. The load runs
+            // on one thread, so that no rename of another thread changes the outcome of its calls.
+            return AssertFlagKeepsAccessesAsync(
+                manifest => manifest.SendReportsAsynchronously = true,
+                root => new[]
+                {
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "file.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "missing.txt"),
+                    RemoteApi.Command.RunInChildProcess(RemoteApi.Command.OpenRelativeToDirectory(root + @"\Sub", "nested.txt")),
+                    RemoteApi.Command.CreateDirectory(root + @"\New"),
+                    RemoteApi.Command.RunInChildProcess(RemoteApi.Command.EnumerateWithFindFirstFileEx(root + @"\Sub")),
+                    RemoteApi.Command.Load(root + @"\Load", "threads=1;files=20;depth=2;operations=200"),
+                },
+                effectCounter: "ReportsQueued");
+        }
+
+        [Fact]
+        public Task CacheFinalPathsOfHandlesKeepsAccesses()
+        {
+            // Opens relative to a directory handle resolve the path of the handle; renaming the directory has to drop the cached path.
+            return AssertFlagKeepsAccessesAsync(
+                manifest => manifest.CacheFinalPathsOfHandles = true,
+                root => new[]
+                {
+                    RemoteApi.Command.OpenRelativeToDirectory(root + @"\Sub", "nested.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root + @"\Sub", "missing.txt"),
+                    RemoteApi.Command.RenameByHandle(root + @"\Sub", root + @"\Moved"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root + @"\Moved", "nested.txt"),
+                    RemoteApi.Command.RenameViaNtSetInformationFile(root + @"\Moved\nested.txt", @"\??\" + root + @"\Moved\renamed.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root + @"\Moved", "renamed.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root + @"\Moved", "nested.txt"),
+                    RemoteApi.Command.EnumerateFileOrDirectoryByHandle(root + @"\Moved"),
+                    RemoteApi.Command.RenameAndCheckFinalPath(root + @"\file.txt", root + @"\Moved\file.txt"),
+                },
+                effectCounter: "FinalPathCacheHits",
+                populateManifest: manifest => manifest.IgnoreGetFinalPathNameByHandle = false);
+        }
+
+        [Fact]
+        public async Task UseBlockCloneForCopiesKeepsAccesses()
+        {
+            // Whether the volume of the test supports block cloning or not, the copy has to report the read of its source and the write
+            // of its destination, and a copy that fails has to be reported as such.
+            SandboxedProcessResult result = await AssertFlagKeepsAccessesAsync(
+                manifest => manifest.UseBlockCloneForCopies = true,
+                root => new[]
+                {
+                    RemoteApi.Command.CopyFile(root + @"\file.txt", root + @"\copy.txt"),
+                    RemoteApi.Command.CopyFile(root + @"\Sub\nested.txt", root + @"\Sub\copy.txt"),
+                    RemoteApi.Command.CopyFile(root + @"\file.txt", root + @"\copy.txt"),
+                    RemoteApi.Command.CopyFile(root + @"\missing.txt", root + @"\missingCopy.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "copy.txt"),
+                },
+                effectCounter: "BlockCloneAttempts");
+
+            // Of the volumes Windows comes with, only ReFS shares clusters between files.
+            bool supportsBlockCloning = string.Equals(new DriveInfo(Path.GetPathRoot(GetFullPath("On"))).DriveFormat, "ReFS", StringComparison.OrdinalIgnoreCase);
+            ulong clonedCopies = GetProcessDataCounter(result, "BlockClonedCopies");
+            if (supportsBlockCloning)
+            {
+                XAssert.IsTrue(clonedCopies > 0, "Expected the copies to be made by block cloning");
+            }
+            else
+            {
+                XAssert.AreEqual(0UL, clonedCopies);
+            }
+        }
+
+        [Fact]
+        public Task FastTempFileNamesKeepsAccesses()
+        {
+            // The detour creates the temporary file itself and reports it under its own name, while the real API is reported through the
+            // creation of the file it makes, so only the operations differ.
+            return AssertFlagKeepsAccessesAsync(
+                manifest => manifest.FastTempFileNames = true,
+                root => new[]
+                {
+                    RemoteApi.Command.GetTempFileName(root),
+                    RemoteApi.Command.GetTempFileName(root + @"\Sub"),
+                    RemoteApi.Command.GetTempFileName(root + @"\Missing"),
+                },
+                effectCounter: "TempFileNamesGenerated",
+                compareOperations: false);
+        }
+
+        [Fact]
+        public Task UseLargeFetchEnumerationsKeepsAccesses()
+        {
+            // Enumerations of directories with more entries than a small fetch returns, of a missing directory, of a file as if it were a
+            // directory, and probes through FindFirstFileEx.
+            return AssertFlagKeepsAccessesAsync(
+                manifest => manifest.UseLargeFetchEnumerations = true,
+                root => new[]
+                {
+                    RemoteApi.Command.Load(root + @"\Load", "files=400;depth=1;open=0;probe=0;rename=0;enumerate=1;operations=20"),
+                    RemoteApi.Command.EnumerateWithFindFirstFileEx(root + @"\*"),
+                    RemoteApi.Command.EnumerateWithFindFirstFileEx(root + @"\Sub\*.txt"),
+                    RemoteApi.Command.EnumerateWithFindFirstFileEx(root + @"\Missing\*"),
+                    RemoteApi.Command.EnumerateWithFindFirstFileEx(root + @"\file.txt\*"),
+                    RemoteApi.Command.EnumerateWithFindFirstFileEx(root + @"\file.txt"),
+                    RemoteApi.Command.EnumerateWithFindFirstFileEx(root + @"\missing.txt"),
+                },
+                effectCounter: "LargeFetchSearches");
+        }
+
+        [Fact]
+        public Task CacheCurrentDirectoryKeepsAccesses()
+        {
+            // Relative paths, before and after changing the current directory (including to a relative path, and a change that fails).
+            return AssertFlagKeepsAccessesAsync(
+                manifest => manifest.CacheCurrentDirectory = true,
+                root => new[]
+                {
+                    RemoteApi.Command.SetCurrentDirectory(root),
+                    RemoteApi.Command.CreateDirectory("New"),
+                    RemoteApi.Command.OpenRelativeToDirectory("Sub", "nested.txt"),
+                    RemoteApi.Command.CopyFile("file.txt", "copy.txt"),
+                    RemoteApi.Command.EnumerateWithFindFirstFileEx("*"),
+                    RemoteApi.Command.SetCurrentDirectory("Sub"),
+                    RemoteApi.Command.CopyFile("nested.txt", "copy.txt"),
+                    RemoteApi.Command.CopyFile(@"..\file.txt", "other.txt"),
+                    RemoteApi.Command.EnumerateWithFindFirstFileEx("*"),
+                    RemoteApi.Command.SetCurrentDirectory(root + @"\New"),
+                    RemoteApi.Command.CreateDirectory("Deeper"),
+                    RemoteApi.Command.SetCurrentDirectory(root + @"\Missing"),
+                    RemoteApi.Command.CreateDirectory("AfterFailure"),
+                },
+                effectCounter: "CurrentDirectoryJoins");
+        }
+
+        [Fact]
+        public async Task DetourNtLayerOnlyKeepsAccesses()
+        {
+            // Only the operations differ: the accesses of the Win32 functions are then reported under the ntdll functions they call.
+            SandboxedProcessResult result = await AssertFlagKeepsAccessesAsync(
+                manifest => manifest.DetourNtLayerOnly = true,
+                root => new[]
+                {
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "file.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "missing.txt"),
+                    RemoteApi.Command.CreateDirectory(root + @"\New"),
+                    RemoteApi.Command.CreateDirectory(root + @"\New"),
+                    RemoteApi.Command.RenameByHandle(root + @"\New", root + @"\Renamed"),
+                    RemoteApi.Command.CreateHardlink(root + @"\file.txt", root + @"\Renamed\link.txt"),
+                    RemoteApi.Command.RenameViaNtSetInformationFile(root + @"\Renamed\link.txt", root + @"\Renamed\moved.txt"),
+                    RemoteApi.Command.DeleteViaNtCreateFile(root + @"\Renamed\moved.txt"),
+                    RemoteApi.Command.EnumerateFileOrDirectoryByHandle(root + @"\Sub"),
+                },
+                populateManifest: manifest =>
+                {
+                    // What the ntdll detours need to enforce the manifest on their own
+                    manifest.MonitorZwCreateOpenQueryFile = true;
+                    manifest.IgnoreZwRenameFileInformation = false;
+                    manifest.IgnoreZwOtherFileInformation = false;
+                },
+                effectCounter: "Win32DetoursLeftOut",
+                compareOperations: false);
+
+            var win32Operations = new[]
+            {
+                ReportedFileOperation.CreateFile,
+                ReportedFileOperation.CreateDirectory,
+                ReportedFileOperation.CreateHardLinkSource,
+                ReportedFileOperation.CreateHardLinkDestination,
+                ReportedFileOperation.DeleteFile,
+                ReportedFileOperation.RemoveDirectory,
+            };
+            XAssert.IsFalse(
+                result.ExplicitlyReportedFileAccesses.Any(access => win32Operations.Contains(access.Operation)),
+                "Expected the accesses to be reported by the ntdll functions only");
+        }
+
+        [Fact]
+        public Task ShrinkCachesUnderMemoryPressureKeepsAccesses()
+        {
+            // The caches the flag shrinks are on in both runs, and get more entries than they keep when shrinking. Whether memory runs
+            // low during the test is up to the machine: the flag has to leave the accesses unchanged either way, and is only seen to
+            // take effect by the monitor it starts.
+            return AssertFlagKeepsAccessesAsync(
+                manifest => manifest.ShrinkCachesUnderMemoryPressure = true,
+                root => new[]
+                {
+                    RemoteApi.Command.Load(root + @"\Load", "files=2000;depth=2;open=1;probe=1;enumerate=1;rename=0;operations=4000"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "file.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "missing.txt"),
+                    RemoteApi.Command.RenameByHandle(root + @"\Sub", root + @"\Moved"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root + @"\Moved", "nested.txt"),
+                },
+                populateManifest: manifest =>
+                {
+                    manifest.CachePolicyResults = true;
+                    manifest.CacheReparsePointProbes = true;
+                    manifest.CacheKnownDirectories = true;
+                },
+                effectCounter: "MemoryPressureMonitorsStarted");
+        }
+
+        [Fact]
+        public Task CachePolicyResultsKeepsAccesses()
+        {
+            // Each path is accessed again, so that its policy comes from the cache, including the path of a file the process creates.
+            return AssertFlagKeepsAccessesAsync(
+                manifest => manifest.CachePolicyResults = true,
+                root => new[]
+                {
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "file.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "file.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "missing.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "missing.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root + @"\Sub", "nested.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root + @"\Sub", "nested.txt"),
+                    RemoteApi.Command.CopyFile(root + @"\file.txt", root + @"\copy.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "copy.txt"),
+                },
+                effectCounter: "PolicyResultCacheHits");
+        }
+
+        [Fact]
+        public Task LowerPrioritiesKeepAccesses()
+        {
+            // The detoured processes lower their own priorities and those of their children, which have to be reported as before. The
+            // processes of the load do not rename, so that none changes the outcome of the calls of another.
+            return AssertFlagKeepsAccessesAsync(
+                manifest =>
+                {
+                    manifest.PriorityClass = System.Diagnostics.ProcessPriorityClass.BelowNormal;
+                    manifest.IoPriority = IoPriorityHint.Low;
+                },
+                root => new[]
+                {
+                    RemoteApi.Command.OpenRelativeToDirectory(root, "file.txt"),
+                    RemoteApi.Command.RunInChildProcess(RemoteApi.Command.OpenRelativeToDirectory(root + @"\Sub", "nested.txt")),
+                    RemoteApi.Command.RunInChildProcess(RemoteApi.Command.CreateDirectory(root + @"\New")),
+                    RemoteApi.Command.CopyFile(root + @"\file.txt", root + @"\New\copy.txt"),
+                    RemoteApi.Command.Load(root + @"\Load", "files=20;depth=1;rename=0;operations=100;children=2;generations=1"),
+                },
+                effectCounter: "PrioritiesLowered");
+        }
+
+        /// <summary>
+        /// Runs the commands made by <paramref name="commands"/> (given the root of the tree) with and without <paramref name="setFlag"/>,
+        /// and asserts that the same accesses are reported under the tree and that the commands have the same results, and that the process
+        /// data counter <paramref name="effectCounter"/> is 0 without the flag and positive with it. Returns the result of the run with the flag.
+        /// </summary>
+        /// <remarks>
+        /// The tree holds file.txt (with some contents) and an empty Sub\nested.txt. Each run gets a tree of its own, so that what the first run changes does
+        /// not change what the second one sees. The names of temporary files, which are drawn anew by each run, are compared as tmp*.TMP.
+        /// </remarks>
+        private async Task<SandboxedProcessResult> AssertFlagKeepsAccessesAsync(
+            Action<FileAccessManifest> setFlag,
+            Func<string, RemoteApi.Command[]> commands,
+            string effectCounter,
+            Action<FileAccessManifest> populateManifest = null,
+            bool compareOperations = true)
+        {
+            var withoutFlag = await RunAndDescribeAccessesAsync("Off", manifest => { }, commands, populateManifest, compareOperations);
+            var withFlag = await RunAndDescribeAccessesAsync("On", setFlag, commands, populateManifest, compareOperations);
+
+            XAssert.IsTrue(withoutFlag.accesses.Length > 0, "Expected accesses to be reported");
+            XAssert.AreEqual(string.Join(Environment.NewLine, withoutFlag.accesses), string.Join(Environment.NewLine, withFlag.accesses));
+            XAssert.AreEqual(withoutFlag.output, withFlag.output);
+
+            XAssert.AreEqual(0UL, GetProcessDataCounter(withoutFlag.result, effectCounter), "Expected no {0} without the flag", effectCounter);
+            XAssert.IsTrue(GetProcessDataCounter(withFlag.result, effectCounter) > 0, "Expected {0} with the flag", effectCounter);
+
+            return withFlag.result;
+        }
+
+        private async Task<(string[] accesses, string output, SandboxedProcessResult result)> RunAndDescribeAccessesAsync(
+            string name,
+            Action<FileAccessManifest> setFlag,
+            Func<string, RemoteApi.Command[]> commands,
+            Action<FileAccessManifest> populateManifest,
+            bool compareOperations)
+        {
+            var pathTable = new PathTable();
+            AbsolutePath rootPath = CreateDirectory(pathTable, name);
+            CreateDirectory(name + @"\Sub");
+            WriteFile(name + @"\file.txt", "Contents to copy or clone");
+            WriteEmptyFile(name + @"\Sub\nested.txt");
+            string root = rootPath.ToString(pathTable);
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.MonitorNtCreateFile = true;
+                    manifest.MonitorChildProcesses = true;
+                    manifest.LogProcessData = true;
+                    manifest.AddScope(rootPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+                    populateManifest?.Invoke(manifest);
+                    setFlag(manifest);
+                },
+                commands(root));
+
+            // The results of the loads tell how long they took, which differs from run to run.
+            string output = LoadResult.Replace(await result.StandardOutput.ReadValueAsync(), string.Empty);
+
+            return (Describe(result.ExplicitlyReportedFileAccesses, pathTable, root, compareOperations), output, result);
+        }
+
+        private static string[] Describe(IEnumerable<ReportedFileAccess> accesses, PathTable pathTable, string root, bool compareOperations)
+        {
+            return (accesses ?? Enumerable.Empty<ReportedFileAccess>())
+                .Select(access => (access, path: access.GetPath(pathTable)))
+                .Where(report => report.path.StartsWith(root, StringComparison.OrdinalIgnoreCase))
+                .Select(report => string.Format(
+                    "{0} {1:G} {2:G} {3} <root>{4}",
+                    compareOperations ? report.access.Operation.ToString("G") : string.Empty,
+                    report.access.RequestedAccess,
+                    report.access.Status,
+                    report.access.Error,
+                    TempFileName.Replace(report.path.Substring(root.Length), @"\tmp*.TMP")))
+                .Distinct(StringComparer.OrdinalIgnoreCase)
+                .OrderBy(report => report, StringComparer.OrdinalIgnoreCase)
+                .ToArray();
+        }
+    }
+}
@@ -0,0 +1,101 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the lookups of the detoured processes in the children of a node of the manifest tree, whose table is a minimal perfect
+    /// hash table when the node has many children.
+    /// </summary>
+    /// <remarks>
+    /// The children of the directory alternately allow and deny reads, and the directory itself denies them, so a read is only allowed if
+    /// its path was found under the right child.
+    /// </remarks>
+    public class ManifestLookupDetoursTests : RemoteApiDetoursTestBase
+    {
+        [Theory]
+        [InlineData(8)]
+        [InlineData(200)]
+        public async Task AccessesAreCheckedUnderTheirChildNode(int childCount)
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            string directory = dirPath.ToString(pathTable);
+
+            int[] accessed = { 0, 1, childCount - 2, childCount - 1 };
+            foreach (int i in accessed)
+            {
+                CreateDirectory(@"D\" + ChildName(i));
+                WriteEmptyFile(@"D\" + ChildName(i) + @"\f");
+            }
+
+            CreateDirectory(@"D\Other");
+            WriteEmptyFile(@"D\Other\f");
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.MonitorNtCreateFile = true;
+                    manifest.LogProcessData = true;
+                    manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.ReportAccess);
+                    for (int i = 0; i < childCount; i++)
+                    {
+                        manifest.AddScope(
+                            dirPath.Combine(pathTable, ChildName(i)),
+                            FileAccessPolicy.MaskNothing,
+                            IsReadAllowed(i) ? FileAccessPolicy.AllowReadAlways | FileAccessPolicy.ReportAccess : FileAccessPolicy.ReportAccess);
+                    }
+                },
+                accessed.Select(i => RemoteApi.Command.OpenRelativeToDirectory(directory + @"\" + ChildName(i), "f"))
+                    .Concat(new[] { RemoteApi.Command.OpenRelativeToDirectory(directory + @"\Other", "f") })
+                    .ToArray());
+
+            foreach (int i in accessed)
+            {
+                AssertRead(pathTable, result, dirPath.Combine(pathTable, ChildName(i)).Combine(pathTable, "f"), IsReadAllowed(i));
+            }
+
+            // Not a child of the manifest: checked under the directory.
+            AssertRead(pathTable, result, dirPath.Combine(pathTable, "Other").Combine(pathTable, "f"), allowed: false);
+
+            ulong perfectHashLookups = GetProcessDataCounter(result, "PerfectHashLookups");
+            if (childCount >= 128)
+            {
+                XAssert.IsTrue(perfectHashLookups > 0, "Expected the children of {0} to be looked up in a perfect hash table", directory);
+            }
+            else
+            {
+                XAssert.AreEqual(0UL, perfectHashLookups);
+            }
+        }
+
+        private static string ChildName(int i) => "C" + i.ToString("D3");
+
+        private static bool IsReadAllowed(int i) => i % 2 == 0;
+
+        private static void AssertRead(PathTable pathTable, SandboxedProcessResult result, AbsolutePath filePath, bool allowed)
+        {
+            string path = filePath.ToString(pathTable);
+            var reads = result.ExplicitlyReportedFileAccesses
+                .Concat(result.AllUnexpectedFileAccesses)
+                .Where(access => (access.RequestedAccess & RequestedAccess.Read) != 0 && string.Equals(access.GetPath(pathTable), path, StringComparison.OrdinalIgnoreCase))
+                .ToList();
+
+            XAssert.IsTrue(reads.Count > 0, "Expected the read of {0} to be reported", path);
+            XAssert.IsTrue(
+                reads.All(access => access.Status == (allowed ? FileAccessStatus.Allowed : FileAccessStatus.Denied)),
+                "Expected the read of {0} to be {1}",
+                path,
+                allowed ? "allowed" : "denied");
+        }
+    }
+}
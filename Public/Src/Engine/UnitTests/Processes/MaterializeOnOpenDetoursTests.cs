@@ -0,0 +1,100 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the files the detoured processes ask BuildXL to materialize the first time they open them
+    /// (<see cref="FileAccessPolicy.MaterializeOnOpen"/> and <see cref="SandboxedProcessInfo.MaterializeOnOpen"/>).
+    /// </summary>
+    /// <remarks>
+    /// The file is not on disk when the process starts: the handler of the test writes it, so an open that finds it was held until
+    /// it got materialized.
+    /// </remarks>
+    public class MaterializeOnOpenDetoursTests : RemoteApiDetoursTestBase
+    {
+        [Theory]
+        [InlineData(true)]
+        [InlineData(false)]
+        public async Task OpensWaitForTheFileToBeMaterialized(bool materializationSucceeds)
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            AbsolutePath filePath = dirPath.Combine(pathTable, "lazy.txt");
+            string directory = dirPath.ToString(pathTable);
+            string file = filePath.ToString(pathTable);
+            string failuresFile = GetFullPath("DetoursFailures.txt");
+            FileAccessManifest materializingManifest = null;
+
+            var requests = new List<AbsolutePath>();
+            Task<bool> Materialize(AbsolutePath path)
+            {
+                lock (requests)
+                {
+                    requests.Add(path);
+                }
+
+                if (materializationSucceeds)
+                {
+                    File.WriteAllText(path.ToString(pathTable), "materialized");
+                }
+
+                return Task.FromResult(materializationSucceeds);
+            }
+
+            try
+            {
+                // Two opens in the parent, which remembers the file once it got materialized, and one in a child process.
+                SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                    pathTable,
+                    Materialize,
+                    manifest =>
+                    {
+                        // Requests are made on a pipe named after the message count semaphore, as in SandboxedProcessPipExecutor.
+                        manifest.InternalDetoursErrorNotificationFile = failuresFile;
+                        manifest.SetMessageCountSemaphore(failuresFile.Replace('\\', '_'));
+                        manifest.MonitorNtCreateFile = true;
+                        manifest.MonitorChildProcesses = true;
+                        manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+                        manifest.AddPath(filePath, FileAccessPolicy.MaskNothing, FileAccessPolicy.MaterializeOnOpen);
+                        materializingManifest = manifest;
+                    },
+                    RemoteApi.Command.OpenRelativeToDirectory(directory, "lazy.txt"),
+                    RemoteApi.Command.OpenRelativeToDirectory(directory, "lazy.txt"),
+                    RemoteApi.Command.RunInChildProcess(RemoteApi.Command.OpenRelativeToDirectory(directory, "lazy.txt")));
+
+                var reads = result.ExplicitlyReportedFileAccesses
+                    .Where(access => (access.RequestedAccess & RequestedAccess.Read) != 0 && string.Equals(access.GetPath(pathTable), file, StringComparison.OrdinalIgnoreCase))
+                    .ToList();
+                XAssert.IsTrue(reads.Count > 0, "Expected the reads of {0} to be reported", file);
+                XAssert.IsTrue(requests.All(path => path == filePath), "Expected requests for {0} only", file);
+
+                if (materializationSucceeds)
+                {
+                    XAssert.IsTrue(reads.All(access => access.Error == 0), "Expected every open of {0} to find it materialized", file);
+                    XAssert.AreEqual(2, requests.Count, "Expected a request from each process");
+                }
+                else
+                {
+                    // The opens go on as they would without the policy, and ask again since the file is still not there.
+                    XAssert.IsTrue(reads.All(access => access.Error != 0), "Expected the opens of {0} to fail", file);
+                    XAssert.AreEqual(3, requests.Count, "Expected a request from each open");
+                }
+            }
+            finally
+            {
+                materializingManifest?.UnsetMessageCountSemaphore();
+            }
+        }
+    }
+}
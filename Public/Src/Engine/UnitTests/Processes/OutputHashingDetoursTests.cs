@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.IO;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Cache.ContentStore.Hashing;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the hashes of the outputs the detoured processes compute while they write them (<see cref="FileAccessManifest.HashOutputsWhileWriting"/>).
+    /// </summary>
+    /// <remarks>
+    /// The detours implement SHA-256 and VSO0 themselves, so the hashes they report are checked against <see cref="VsoHash"/> of the file
+    /// written, for sizes around the 64KB pages and 2MB blocks of VSO0.
+    /// </remarks>
+    public class OutputHashingDetoursTests : RemoteApiDetoursTestBase
+    {
+        private const long BlockSize = 2 * 1024 * 1024;
+
+        [Theory]
+        [InlineData(0L)]
+        [InlineData(1000L)]
+        [InlineData(64L * 1024)]
+        [InlineData(BlockSize)]
+        [InlineData(2 * BlockSize + 12345)]
+        public async Task ReportedHashIsTheVsoHashOfTheFile(long size)
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            string file = Path.Combine(dirPath.ToString(pathTable), "output.bin");
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.HashOutputsWhileWriting = true;
+                    manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll);
+                },
+                RemoteApi.Command.WriteFile(file, size));
+
+            XAssert.AreEqual(size, new FileInfo(file).Length);
+
+            var hashes = result.OutputContentHashes.Where(h => string.Equals(h.Path, file, StringComparison.OrdinalIgnoreCase)).ToList();
+            XAssert.AreEqual(1, hashes.Count, "Expected the hash of {0} to be reported once", file);
+
+            OutputContentHash hash = hashes[0];
+            XAssert.IsTrue(hash.IsValid, "Expected the sequential writes to be hashed");
+            XAssert.AreEqual(size, hash.Length);
+
+            // The reported hash leaves out the trailing algorithm id of the blob identifier.
+            byte[] expected = VsoHash.CalculateBlobIdentifier(File.ReadAllBytes(file)).Bytes.Take(OutputContentHash.HashLength).ToArray();
+            XAssert.AreEqual(BitConverter.ToString(expected), BitConverter.ToString(hash.Hash));
+        }
+    }
+}
@@ -0,0 +1,101 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.IO;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the directory translations of the manifest (<see cref="FileAccessManifest.DirectoryTranslator"/>), under which the detoured
+    /// processes look up the policy of the paths they access.
+    /// </summary>
+    /// <remarks>
+    /// The policies only allow the translated paths, so an access is only allowed if the detours translated its path, and with the
+    /// longest matching translation.
+    /// </remarks>
+    public class PathTranslationDetoursTests : RemoteApiDetoursTestBase
+    {
+        [Fact]
+        public async Task AccessesAreCheckedUnderTheLongestTranslation()
+        {
+            var pathTable = new PathTable();
+            CreateDirectory(@"Src\Deep");
+            string source = WriteEmptyFile(@"Src\Deep\f");
+            AbsolutePath outPath = CreateDirectory(pathTable, "Out");
+            AbsolutePath realPath = GetFullPath(pathTable, "Real");
+            AbsolutePath realDeepPath = GetFullPath(pathTable, "RealDeep");
+
+            var translator = new DirectoryTranslator();
+            translator.AddTranslation(GetFullPath("Src"), realPath.ToString(pathTable));
+            translator.AddTranslation(GetFullPath(@"Src\Deep"), realDeepPath.ToString(pathTable));
+            translator.Seal();
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                translator,
+                manifest =>
+                {
+                    manifest.LogProcessData = true;
+
+                    // Translated with Src alone, the file would be under Real, which denies reads.
+                    manifest.AddScope(realPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.ReportAccess);
+                    manifest.AddScope(realDeepPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowReadAlways | FileAccessPolicy.ReportAccess);
+                    manifest.AddScope(outPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll);
+                },
+                RemoteApi.Command.CopyFile(source, Path.Combine(outPath.ToString(pathTable), "g")));
+
+            string translated = realDeepPath.Combine(pathTable, "f").ToString(pathTable);
+            XAssert.IsTrue(
+                result.ExplicitlyReportedFileAccesses.Any(access => IsReadOf(pathTable, access, translated)),
+                "Expected the read of {0} to be allowed and reported as a read of {1}",
+                source,
+                translated);
+            XAssert.IsFalse(
+                result.AllUnexpectedFileAccesses.Any(access => access.GetPath(pathTable).EndsWith(@"\f", StringComparison.OrdinalIgnoreCase)),
+                "Expected no read of {0} to be denied",
+                source);
+            XAssert.IsTrue(GetProcessDataCounter(result, "PathsTranslated") > 0, "Expected the detours to translate the path");
+        }
+
+        [Fact]
+        public async Task UntranslatedPathsAreLeftAlone()
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            string source = WriteEmptyFile(@"D\f");
+
+            // A translation the accessed paths do not start with, though they share its first characters.
+            var translator = new DirectoryTranslator();
+            translator.AddTranslation(GetFullPath("Dx"), GetFullPath("Elsewhere"));
+            translator.Seal();
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                translator,
+                manifest =>
+                {
+                    manifest.LogProcessData = true;
+                    manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+                },
+                RemoteApi.Command.CopyFile(source, GetFullPath(@"D\g")));
+
+            XAssert.IsTrue(
+                result.ExplicitlyReportedFileAccesses.Any(access => IsReadOf(pathTable, access, source)),
+                "Expected the read of {0} to be reported as is",
+                source);
+            XAssert.AreEqual(0UL, GetProcessDataCounter(result, "PathsTranslated"));
+        }
+
+        private static bool IsReadOf(PathTable pathTable, ReportedFileAccess access, string path)
+        {
+            return (access.RequestedAccess & RequestedAccess.Read) != 0 && string.Equals(access.GetPath(pathTable), path, StringComparison.OrdinalIgnoreCase);
+        }
+    }
+}
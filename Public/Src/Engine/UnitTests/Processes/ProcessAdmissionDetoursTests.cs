@@ -0,0 +1,83 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.IO;
+using System.Threading;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the process admission gate the detoured processes wait on before they start a child process
+    /// (<see cref="FileAccessManifest.SetProcessAdmissionGate"/>).
+    /// </summary>
+    /// <remarks>
+    /// The tests stand in for the <see cref="ProcessAdmissionGate"/> of the scheduler with an event of their own, so that they decide when it
+    /// is closed. The child is RemoteApi creating a directory, which tells when it ran.
+    /// </remarks>
+    public class ProcessAdmissionDetoursTests : RemoteApiDetoursTestBase
+    {
+        private const int GateClosedMs = 2000;
+
+        [Fact]
+        public async Task ClosedGateDelaysChildProcesses()
+        {
+            string gateName = NewGateName();
+            using (var gate = new EventWaitHandle(initialState: false, EventResetMode.ManualReset, gateName))
+            {
+                var pathTable = new PathTable();
+                Task<SandboxedProcessResult> run = RunChildProcessAsync(pathTable, gateName, out string created);
+
+                await Task.Delay(GateClosedMs);
+                XAssert.IsFalse(Directory.Exists(created), "Expected the child process to wait for the gate to open");
+                XAssert.IsFalse(run.IsCompleted, "Expected RemoteApi to wait for the gate to open");
+
+                gate.Set();
+                SandboxedProcessResult result = await run;
+
+                XAssert.IsTrue(Directory.Exists(created), "Expected the child process to run once the gate opened");
+                XAssert.AreEqual(1UL, GetProcessDataCounter(result, "ProcessAdmissionWaits"));
+                XAssert.IsTrue(GetProcessDataCounter(result, "ProcessAdmissionWaitMicroseconds") > 0, "Expected the time spent waiting to be reported");
+            }
+        }
+
+        [Fact]
+        public async Task OpenGateAdmitsChildProcessesRightAway()
+        {
+            string gateName = NewGateName();
+            using (new EventWaitHandle(initialState: true, EventResetMode.ManualReset, gateName))
+            {
+                var pathTable = new PathTable();
+                SandboxedProcessResult result = await RunChildProcessAsync(pathTable, gateName, out string created);
+
+                XAssert.IsTrue(Directory.Exists(created), "Expected the child process to run");
+                XAssert.AreEqual(0UL, GetProcessDataCounter(result, "ProcessAdmissionWaits"));
+            }
+        }
+
+        private Task<SandboxedProcessResult> RunChildProcessAsync(PathTable pathTable, string gateName, out string created)
+        {
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            created = Path.Combine(dirPath.ToString(pathTable), "Created");
+
+            string childCommand = RemoteApi.Command.CreateDirectory(created).GetCommandLineArgument();
+            return RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.MonitorChildProcesses = true;
+                    manifest.LogProcessData = true;
+                    manifest.SetProcessAdmissionGate(gateName, maxWaitMs: 0);
+                    manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll);
+                },
+                RemoteApi.Command.RunCommandLine(applicationName: null, "\"" + RemoteApi.ExecutablePath + "\" " + childCommand));
+        }
+
+        private static string NewGateName() => "BuildXL.Test.ProcessAdmission." + Guid.NewGuid().ToString("N");
+    }
+}
@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 using System;
+using System.Diagnostics;
 using System.Diagnostics.ContractsLight;
 using System.Globalization;
 using System.IO;
@@ -34,6 +35,8 @@ namespace Test.BuildXL.Processes
             string workingDirectory,
             ISandboxedProcessFileStorage sandboxStorage,
             Action<FileAccessManifest> populateManifest,
+            DirectoryTranslator directoryTranslator = null,
+            Func<AbsolutePath, Task<bool>> materializeOnOpen = null,
             params Command[] commands)
         {
             Contract.Requires(!string.IsNullOrEmpty(workingDirectory));
@@ -45,12 +48,18 @@ namespace Test.BuildXL.Processes
             }
 
             var info =
-                new SandboxedProcessInfo(pathTable, sandboxStorage, ExecutablePath, disableConHostSharing: false)
+                new SandboxedProcessInfo(
+                    pathTable,
+                    sandboxStorage,
+                    ExecutablePath,
+                    disableConHostSharing: false,
+                    fileAccessManifest: new FileAccessManifest(pathTable, directoryTranslator))
                 {
                     PipSemiStableHash = 0,
                     PipDescription = "RemoteApi Test",
                     Arguments = string.Empty,
                     WorkingDirectory = workingDirectory,
+                    MaterializeOnOpen = materializeOnOpen,
                 };
 
             info.FileAccessManifest.ReportFileAccesses = false;
@@ -80,6 +89,38 @@ namespace Test.BuildXL.Processes
             }
         }
 
+        /// <summary>
+        /// Runs a single RemoteApi command outside of any sandbox, e.g. to get the baseline of a <see cref="Command.Load" />.
+        /// Returns the standard output of the process.
+        /// </summary>
+        public static async Task<string> RunUnsandboxedAsync(string workingDirectory, Command command)
+        {
+            Contract.Requires(!string.IsNullOrEmpty(workingDirectory));
+            Contract.Requires(command != null);
+
+            if (!File.Exists(ExecutablePath))
+            {
+                throw new BuildXLException("Expected to find RemoteApi.exe at " + ExecutablePath);
+            }
+
+            var info = new ProcessStartInfo(ExecutablePath, "\"" + command.Serialize() + "\"")
+                       {
+                           WorkingDirectory = workingDirectory,
+                           UseShellExecute = false,
+                           RedirectStandardOutput = true,
+                           CreateNoWindow = true,
+                       };
+
+            using (Process process = Process.Start(info))
+            {
+                string output = await process.StandardOutput.ReadToEndAsync();
+                process.WaitForExit();
+                XAssert.AreEqual(0, process.ExitCode, "RemoteApi.exe failed");
+
+                return output;
+            }
+        }
+
         private static TextReader GetCommandReader(Command[] commands)
         {
             var commandBuffer = new StringBuilder();
@@ -125,6 +166,106 @@ namespace Test.BuildXL.Processes
             /// Creates a new hardlink via <c>CreateHardLinkW</c>
             /// </summary>
             CreateHardLink,
+
+            /// <summary>
+            /// Creates a directory via <c>CreateDirectoryW</c>.
+            /// </summary>
+            CreateDirectory,
+
+            /// <summary>
+            /// Renames a file or directory (first parameter) to the second parameter via <c>SetFileInformationByHandle</c>.
+            /// </summary>
+            RenameByHandle,
+
+            /// <summary>
+            /// Renames a file or directory (first parameter) to the second parameter via <c>NtSetInformationFile</c>.
+            /// The second parameter is a canonicalized path.
+            /// </summary>
+            RenameViaNtSetInformationFile,
+
+            /// <summary>
+            /// Opens a directory (first parameter) via <c>CreateFileW</c>, then opens a name relative to it (second parameter) for reading
+            /// via <c>NtCreateFile</c>.
+            /// </summary>
+            OpenRelativeToDirectory,
+
+            /// <summary>
+            /// Makes a random mix of file system calls on a tree of files, and prints their rate (see LoadGenerator.h).
+            /// The parameters are the root of the tree and the spec of the workload.
+            /// </summary>
+            Load,
+
+            /// <summary>
+            /// Runs a command (second parameter, with its name and parameters separated by '|') in a child process of a copy of
+            /// <c>RemoteApi.exe</c> (first parameter), and waits for it.
+            /// </summary>
+            RunInChildProcess,
+
+            /// <summary>
+            /// Starts a child process via <c>CreateProcessW</c> with an application name (first parameter, may be empty) and a command line
+            /// (second parameter, in which '|' stands for ','), and waits for it.
+            /// </summary>
+            RunCommandLine,
+
+            /// <summary>
+            /// Same as <see cref="RunCommandLine"/>, without waiting for the child process.
+            /// </summary>
+            StartCommandLine,
+
+            /// <summary>
+            /// Waits for a named event (the parameter) to be set.
+            /// </summary>
+            WaitForEvent,
+
+            /// <summary>
+            /// Assigns the process to a new job (named after the parameter, which may be empty) that does not let processes break away from it.
+            /// </summary>
+            JoinJobWithoutBreakaway,
+
+            /// <summary>
+            /// Copies a file (first parameter) to a new path (second parameter) via <c>CopyFileW</c>.
+            /// </summary>
+            CopyFile,
+
+            /// <summary>
+            /// Creates a temporary file in a directory (the parameter) via <c>GetTempFileNameW</c>.
+            /// </summary>
+            GetTempFileName,
+
+            /// <summary>
+            /// Sets the current directory of the process (the parameter) via <c>SetCurrentDirectoryW</c>, e.g. to pass relative paths to the
+            /// commands that follow.
+            /// </summary>
+            SetCurrentDirectory,
+
+            /// <summary>
+            /// Moves a file (first parameter) to a new path (second parameter) via <c>MoveFileExW</c>, without <c>MOVEFILE_COPY_ALLOWED</c>.
+            /// </summary>
+            MoveFileEx,
+
+            /// <summary>
+            /// Opens a path (first parameter) and checks that <c>GetFileInformationByHandleEx</c> names it as the second parameter (a path from
+            /// the root of the volume), with a buffer too small for the name and with a large enough one.
+            /// </summary>
+            CheckFileName,
+
+            /// <summary>
+            /// Creates (or truncates) a file (first parameter) and writes the number of bytes of the second parameter to it via <c>WriteFile</c>,
+            /// in chunks that do not line up with pages.
+            /// </summary>
+            WriteFile,
+
+            /// <summary>
+            /// Probes a path (first parameter) via <c>GetFileAttributesExW</c> and checks that it is a file of the number of bytes of the second
+            /// parameter.
+            /// </summary>
+            CheckFileSize,
+
+            /// <summary>
+            /// Renames a file or directory (first parameter) to the second parameter via <c>SetFileInformationByHandle</c>, and checks that
+            /// <c>GetFinalPathNameByHandleW</c> returns the path of the handle before and after the rename.
+            /// </summary>
+            RenameAndCheckFinalPath,
         }
 
         /// <summary>
@@ -191,6 +332,139 @@ namespace Test.BuildXL.Processes
             {
                 return new Command(CommandType.CreateHardLink, existingFile, newLink);
             }
+
+            /// <nodoc />
+            public static Command CreateDirectory(string path)
+            {
+                return new Command(CommandType.CreateDirectory, path);
+            }
+
+            /// <nodoc />
+            public static Command RenameByHandle(string path, string newPath)
+            {
+                return new Command(CommandType.RenameByHandle, path, newPath);
+            }
+
+            /// <nodoc />
+            public static Command RenameViaNtSetInformationFile(string path, string newAbsolutePath)
+            {
+                return new Command(CommandType.RenameViaNtSetInformationFile, path, @"\??\" + newAbsolutePath);
+            }
+
+            /// <nodoc />
+            public static Command OpenRelativeToDirectory(string directory, string relativeName)
+            {
+                return new Command(CommandType.OpenRelativeToDirectory, directory, relativeName);
+            }
+
+            /// <nodoc />
+            public static Command Load(string root, string spec)
+            {
+                return new Command(CommandType.Load, root, spec);
+            }
+
+            /// <summary>
+            /// Runs the command in a child process, of <see cref="ExecutablePath"/> or of a copy of it with another name (e.g. to let it
+            /// break away from the sandbox).
+            /// </summary>
+            public static Command RunInChildProcess(Command command, string executablePath = null)
+            {
+                Contract.Requires(command != null);
+                Contract.Requires(command.CommandType != CommandType.RunInChildProcess);
+
+                string childCommand = command.CommandType.ToString("G") + "|" + command.Parameter1;
+                if (command.Parameter2 != null)
+                {
+                    childCommand += "|" + command.Parameter2;
+                }
+
+                return new Command(CommandType.RunInChildProcess, executablePath ?? ExecutablePath, childCommand);
+            }
+
+            /// <summary>
+            /// Starts a child process with the given application name (or none if null) and command line, e.g. to check how the image of the
+            /// process is found. Use <see cref="GetCommandLineArgument"/> to pass a command to a child RemoteApi process.
+            /// </summary>
+            public static Command RunCommandLine(string applicationName, string commandLine)
+            {
+                Contract.Requires(!string.IsNullOrEmpty(commandLine));
+                return new Command(CommandType.RunCommandLine, applicationName ?? string.Empty, commandLine.Replace(',', '|'));
+            }
+
+            /// <nodoc />
+            public static Command StartCommandLine(string applicationName, string commandLine)
+            {
+                Contract.Requires(!string.IsNullOrEmpty(commandLine));
+                return new Command(CommandType.StartCommandLine, applicationName ?? string.Empty, commandLine.Replace(',', '|'));
+            }
+
+            /// <nodoc />
+            public static Command WaitForEvent(string eventName)
+            {
+                return new Command(CommandType.WaitForEvent, eventName);
+            }
+
+            /// <nodoc />
+            public static Command JoinJobWithoutBreakaway(string jobName = null)
+            {
+                return new Command(CommandType.JoinJobWithoutBreakaway, jobName ?? string.Empty);
+            }
+
+            /// <nodoc />
+            public static Command CopyFile(string source, string destination)
+            {
+                return new Command(CommandType.CopyFile, source, destination);
+            }
+
+            /// <nodoc />
+            public static Command GetTempFileName(string directory)
+            {
+                return new Command(CommandType.GetTempFileName, directory);
+            }
+
+            /// <nodoc />
+            public static Command SetCurrentDirectory(string path)
+            {
+                return new Command(CommandType.SetCurrentDirectory, path);
+            }
+
+            /// <nodoc />
+            public static Command MoveFileEx(string source, string destination)
+            {
+                return new Command(CommandType.MoveFileEx, source, destination);
+            }
+
+            /// <nodoc />
+            public static Command CheckFileName(string path, string expectedName)
+            {
+                return new Command(CommandType.CheckFileName, path, expectedName);
+            }
+
+            /// <nodoc />
+            public static Command WriteFile(string path, long size)
+            {
+                return new Command(CommandType.WriteFile, path, size.ToString(CultureInfo.InvariantCulture));
+            }
+
+            /// <nodoc />
+            public static Command CheckFileSize(string path, long size)
+            {
+                return new Command(CommandType.CheckFileSize, path, size.ToString(CultureInfo.InvariantCulture));
+            }
+
+            /// <nodoc />
+            public static Command RenameAndCheckFinalPath(string path, string newPath)
+            {
+                return new Command(CommandType.RenameAndCheckFinalPath, path, newPath);
+            }
+
+            /// <summary>
+            /// The command as the quoted argument of a RemoteApi command line.
+            /// </summary>
+            public string GetCommandLineArgument()
+            {
+                return "\"" + Serialize() + "\"";
+            }
         }
     }
 }
@@ -10,6 +10,7 @@ using BuildXL.Processes;
 using BuildXL.Utilities;
 using Test.BuildXL.TestUtilities.Xunit;
 using Xunit;
+using Xunit.Abstractions;
 
 namespace Test.BuildXL.Processes
 {
@@ -19,6 +20,17 @@ namespace Test.BuildXL.Processes
     [Trait("Category", "WindowsOSOnly")]
     public abstract class RemoteApiDetoursTestBase : TemporaryStorageTestBase, ISandboxedProcessFileStorage
     {
+        /// <nodoc />
+        protected RemoteApiDetoursTestBase()
+        {
+        }
+
+        /// <nodoc />
+        protected RemoteApiDetoursTestBase(ITestOutputHelper output)
+            : base(output)
+        {
+        }
+
         /// <summary>
         /// Creates a command to run in <see cref="RunRemoteApiInSandboxAsync" />
         /// </summary>
@@ -118,6 +130,16 @@ namespace Test.BuildXL.Processes
             XAssert.IsFalse(File.Exists(path), "Expected path {0} to be absent", path);
         }
 
+        /// <summary>
+        /// Gets a counter the detoured processes reported in their process data (see <see cref="SandboxedProcessResult.ProcessDataCounters"/>),
+        /// or 0 if none of them reported it. Requires <see cref="FileAccessManifest.LogProcessData"/>.
+        /// </summary>
+        protected static ulong GetProcessDataCounter(SandboxedProcessResult result, string name)
+        {
+            XAssert.IsNotNull(result.ProcessDataCounters, "Expected the processes to report their data");
+            return result.ProcessDataCounters.TryGetValue(name, out ulong value) ? value : 0;
+        }
+
         /// <summary>
         /// Runs a list of remote file APIs (e.g. <see cref="EnumerateWithFindFirstFileEx" />) in a Detours sandbox.
         /// Returns a <see cref="SandboxedProcessResult" /> containing reported accesses.
@@ -135,6 +157,43 @@ namespace Test.BuildXL.Processes
                 commands: commands);
         }
 
+        /// <summary>
+        /// Runs a list of remote file APIs in a Detours sandbox whose manifest translates directories with the given translator.
+        /// </summary>
+        protected Task<SandboxedProcessResult> RunRemoteApiInSandboxAsync(
+            PathTable pathTable,
+            DirectoryTranslator directoryTranslator,
+            Action<FileAccessManifest> populateManifest,
+            params RemoteApi.Command[] commands)
+        {
+            return RemoteApi.RunInSandboxAsync(
+                pathTable,
+                workingDirectory: TemporaryDirectory,
+                sandboxStorage: this,
+                populateManifest: populateManifest,
+                directoryTranslator: directoryTranslator,
+                commands: commands);
+        }
+
+        /// <summary>
+        /// Runs a list of remote file APIs in a Detours sandbox that asks <paramref name="materializeOnOpen"/> to materialize the files
+        /// whose policy has <see cref="FileAccessPolicy.MaterializeOnOpen"/>.
+        /// </summary>
+        protected Task<SandboxedProcessResult> RunRemoteApiInSandboxAsync(
+            PathTable pathTable,
+            Func<AbsolutePath, Task<bool>> materializeOnOpen,
+            Action<FileAccessManifest> populateManifest,
+            params RemoteApi.Command[] commands)
+        {
+            return RemoteApi.RunInSandboxAsync(
+                pathTable,
+                workingDirectory: TemporaryDirectory,
+                sandboxStorage: this,
+                populateManifest: populateManifest,
+                materializeOnOpen: materializeOnOpen,
+                commands: commands);
+        }
+
         /// <summary>
         /// Expected reported access from <see cref="RemoteApiDetoursTestBase.RunRemoteApiInSandboxAsync" />.
         /// This is a projection of key fields of <see cref="ReportedFileAccess" />.
@@ -0,0 +1,191 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.IO;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the deduplication of reports by the detoured processes (<see cref="FileAccessManifest.DeduplicateReports"/>).
+    /// </summary>
+    /// <remarks>
+    /// The file whose existence changes is created by a copy of RemoteApi that breaks away from the sandbox, so that its write
+    /// reaches no report cache: only the error of the reads tells that the file appeared.
+    /// </remarks>
+    public class ReportDeduplicationDetoursTests : RemoteApiDetoursTestBase
+    {
+        private const string UntrackedRemoteApi = "UntrackedRemoteApi.exe";
+
+        [Fact]
+        public async Task ReadOfAbsentPathDoesNotHideReadOnceItExists()
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\file.txt");
+            string directory = dirPath.ToString(pathTable);
+            string untrackedRemoteApi = CopyRemoteApi();
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest => PopulateManifest(manifest, dirPath, shareReportCacheAcrossProcesses: false),
+                RemoteApi.Command.OpenRelativeToDirectory(directory, "f"),
+                RemoteApi.Command.RunInChildProcess(RemoteApi.Command.CreateHardlink(directory + @"\file.txt", directory + @"\f"), untrackedRemoteApi),
+                RemoteApi.Command.OpenRelativeToDirectory(directory, "f"));
+
+            AssertReadsOfAbsentAndExistingPath(pathTable, result, dirPath.Combine(pathTable, "f"));
+        }
+
+        [Fact]
+        public async Task ReadOfAbsentPathDoesNotHideReadOnceItExistsAcrossProcesses()
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\file.txt");
+            string directory = dirPath.ToString(pathTable);
+            string untrackedRemoteApi = CopyRemoteApi();
+
+            // Each read is made by a process of its own, so only the table shared by the processes of the pip can drop the second one.
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest => PopulateManifest(manifest, dirPath, shareReportCacheAcrossProcesses: true),
+                RemoteApi.Command.RunInChildProcess(RemoteApi.Command.OpenRelativeToDirectory(directory, "f")),
+                RemoteApi.Command.RunInChildProcess(RemoteApi.Command.CreateHardlink(directory + @"\file.txt", directory + @"\f"), untrackedRemoteApi),
+                RemoteApi.Command.RunInChildProcess(RemoteApi.Command.OpenRelativeToDirectory(directory, "f")));
+
+            AssertReadsOfAbsentAndExistingPath(pathTable, result, dirPath.Combine(pathTable, "f"));
+        }
+
+        [Fact]
+        public async Task RepeatedReadsAreDeduplicated()
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\f");
+            string directory = dirPath.ToString(pathTable);
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest => PopulateManifest(manifest, dirPath, shareReportCacheAcrossProcesses: true),
+                RemoteApi.Command.RunInChildProcess(RemoteApi.Command.OpenRelativeToDirectory(directory, "f")),
+                RemoteApi.Command.RunInChildProcess(RemoteApi.Command.OpenRelativeToDirectory(directory, "f")),
+                RemoteApi.Command.OpenRelativeToDirectory(directory, "f"));
+
+            AbsolutePath filePath = dirPath.Combine(pathTable, "f");
+            int reads = result.ExplicitlyReportedFileAccesses.Count(access => IsReadOf(pathTable, access, filePath.ToString(pathTable)));
+            XAssert.AreEqual(1, reads, "Expected the reads of {0} with the same outcome to be reported once", filePath.ToString(pathTable));
+        }
+
+        [Theory]
+        [InlineData(true)]
+        [InlineData(false)]
+        public async Task RepeatedReadsOfAProcessAreReportedOnce(bool deduplicateReports)
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\f");
+            string directory = dirPath.ToString(pathTable);
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    PopulateManifest(manifest, dirPath, shareReportCacheAcrossProcesses: false);
+                    manifest.DeduplicateReports = deduplicateReports;
+                    manifest.LogProcessData = true;
+                },
+                RemoteApi.Command.OpenRelativeToDirectory(directory, "f"),
+                RemoteApi.Command.OpenRelativeToDirectory(directory, "f"),
+                RemoteApi.Command.OpenRelativeToDirectory(directory, "f"));
+
+            string path = dirPath.Combine(pathTable, "f").ToString(pathTable);
+            int reads = result.ExplicitlyReportedFileAccesses.Count(access => IsReadOf(pathTable, access, path));
+            ulong deduplicated = GetProcessDataCounter(result, "ReportsDeduplicated");
+
+            if (deduplicateReports)
+            {
+                XAssert.AreEqual(1, reads, "Expected the reads of {0} to be reported once", path);
+                XAssert.IsTrue(deduplicated >= 2, "Expected the cache to drop the repeated reads, but it dropped {0} reports", deduplicated);
+            }
+            else
+            {
+                XAssert.AreEqual(3, reads, "Expected each read of {0} to be reported", path);
+                XAssert.AreEqual(0UL, deduplicated);
+            }
+        }
+
+        [Theory]
+        [InlineData(true)]
+        [InlineData(false)]
+        public async Task ReadsOfProcessesOfThePipAreReportedOnceWithASharedTable(bool shareReportCacheAcrossProcesses)
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\f");
+            string directory = dirPath.ToString(pathTable);
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    PopulateManifest(manifest, dirPath, shareReportCacheAcrossProcesses);
+                    manifest.LogProcessData = true;
+                },
+                RemoteApi.Command.RunInChildProcess(RemoteApi.Command.OpenRelativeToDirectory(directory, "f")),
+                RemoteApi.Command.RunInChildProcess(RemoteApi.Command.OpenRelativeToDirectory(directory, "f")));
+
+            string path = dirPath.Combine(pathTable, "f").ToString(pathTable);
+            var reads = result.ExplicitlyReportedFileAccesses.Where(access => IsReadOf(pathTable, access, path)).ToList();
+            ulong deduplicated = GetProcessDataCounter(result, "SharedReportsDeduplicated");
+
+            if (shareReportCacheAcrossProcesses)
+            {
+                XAssert.AreEqual(1, reads.Count, "Expected the reads of {0} by the two processes to be reported once", path);
+                XAssert.IsTrue(deduplicated >= 1, "Expected the shared table to drop the read of the second process");
+            }
+            else
+            {
+                XAssert.AreEqual(2, reads.Count, "Expected each process to report its read of {0}", path);
+                XAssert.AreNotEqual(reads[0].Process.ProcessId, reads[1].Process.ProcessId);
+                XAssert.AreEqual(0UL, deduplicated);
+            }
+        }
+
+        private string CopyRemoteApi()
+        {
+            string path = GetFullPath(UntrackedRemoteApi);
+            File.Copy(RemoteApi.ExecutablePath, path, overwrite: true);
+            return path;
+        }
+
+        private static void PopulateManifest(FileAccessManifest manifest, AbsolutePath dirPath, bool shareReportCacheAcrossProcesses)
+        {
+            manifest.DeduplicateReports = true;
+            manifest.ShareReportCacheAcrossProcesses = shareReportCacheAcrossProcesses;
+            manifest.MonitorNtCreateFile = true;
+            manifest.MonitorChildProcesses = true;
+            manifest.AddChildProcessToBreakaway(UntrackedRemoteApi);
+            manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+        }
+
+        private static void AssertReadsOfAbsentAndExistingPath(PathTable pathTable, SandboxedProcessResult result, AbsolutePath filePath)
+        {
+            string path = filePath.ToString(pathTable);
+            var reads = result.ExplicitlyReportedFileAccesses.Where(access => IsReadOf(pathTable, access, path)).ToList();
+
+            XAssert.IsTrue(reads.Any(access => access.Error != 0), "Expected the read of the absent {0} to be reported", path);
+            XAssert.IsTrue(reads.Any(access => access.Error == 0), "Expected the read of {0} once it exists to be reported", path);
+        }
+
+        private static bool IsReadOf(PathTable pathTable, ReportedFileAccess access, string path)
+        {
+            return access.RequestedAccess == RequestedAccess.Read && string.Equals(access.GetPath(pathTable), path, StringComparison.OrdinalIgnoreCase);
+        }
+    }
+}
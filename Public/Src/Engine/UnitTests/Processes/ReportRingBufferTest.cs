@@ -0,0 +1,115 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Generic;
+using System.IO.MemoryMappedFiles;
+using System.Text;
+using BuildXL.Processes.Internal;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+using Xunit.Abstractions;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for how <see cref="ReportRingBuffer"/> gets past the slots of producers killed before committing them. The producers are
+    /// simulated by writing to the ring the way ReportRing.cpp does.
+    /// </summary>
+    [Trait("Category", "WindowsOSOnly")] // named mappings
+    public sealed class ReportRingBufferTest : XunitBuildXLTest
+    {
+        private const int Capacity = 4096;
+        private const int HeaderSize = 192;
+        private const int ReserveOffsetOffset = 64;
+
+        public ReportRingBufferTest(ITestOutputHelper output)
+            : base(output) { }
+
+        [Fact]
+        public void ProducerKilledBeforeWritingTheSlotSizeDoesNotStallTheRing()
+        {
+            RunWithRing((ring, producer) =>
+            {
+                Produce(producer, "first");
+                long killedSlotSize = Produce(producer, "killed", writeSlotSize: false, commit: false);
+                long hiddenSlotSize = Produce(producer, "hidden behind the killed one");
+
+                var payloads = new List<string>();
+                XAssert.AreEqual(1, ring.Drain(Collect(payloads)));
+                XAssert.AreEqual(0, ring.Drain(Collect(payloads)), "The size of the uncommitted slot is unknown while producers are left");
+                XAssert.IsTrue(ring.HasPendingData);
+
+                XAssert.AreEqual(0, ring.Drain(Collect(payloads), producersExited: true));
+                XAssert.IsFalse(ring.HasPendingData);
+                XAssert.AreEqual(killedSlotSize + hiddenSlotSize, ring.LostBytes);
+
+                // The skipped space is zeroed, so the slots reserved after it get drained
+                Produce(producer, "after");
+                XAssert.AreEqual(1, ring.Drain(Collect(payloads)));
+                XAssert.AreEqual("first|after", string.Join("|", payloads));
+            });
+        }
+
+        [Fact]
+        public void ProducerKilledAfterWritingTheSlotSizeLosesItsSlotOnly()
+        {
+            RunWithRing((ring, producer) =>
+            {
+                long killedSlotSize = Produce(producer, "killed", commit: false);
+                Produce(producer, "second");
+
+                var payloads = new List<string>();
+                XAssert.AreEqual(0, ring.Drain(Collect(payloads)));
+                XAssert.AreEqual(1, ring.Drain(Collect(payloads), producersExited: true));
+                XAssert.IsFalse(ring.HasPendingData);
+                XAssert.AreEqual(killedSlotSize, ring.LostBytes);
+                XAssert.AreEqual("second", string.Join("|", payloads));
+            });
+        }
+
+        private static void RunWithRing(Action<ReportRingBuffer, MemoryMappedViewAccessor> test)
+        {
+            string name = nameof(ReportRingBufferTest) + "_" + Guid.NewGuid().ToString("N");
+            using (var ring = ReportRingBuffer.Create(name, Capacity))
+            using (var file = MemoryMappedFile.OpenExisting(name + ReportRingBuffer.NameSuffix))
+            using (var producer = file.CreateViewAccessor())
+            {
+                test(ring, producer);
+            }
+        }
+
+        /// <summary>
+        /// Reserves a slot for <paramref name="payload"/>, and returns its size. A producer killed right after the reservation
+        /// writes neither the size nor the length of its slot, and one killed before committing does not write the length.
+        /// </summary>
+        private static long Produce(MemoryMappedViewAccessor producer, string payload, bool writeSlotSize = true, bool commit = true)
+        {
+            byte[] bytes = Encoding.Unicode.GetBytes(payload);
+            long slotSize = (8 + bytes.Length + 7) & ~7L;
+
+            long reserve = producer.ReadInt64(ReserveOffsetOffset);
+            XAssert.IsTrue((reserve & (Capacity - 1)) + slotSize <= Capacity, "The tests do not wrap around");
+            producer.Write(ReserveOffsetOffset, reserve + slotSize);
+
+            long position = HeaderSize + (reserve & (Capacity - 1));
+            if (writeSlotSize)
+            {
+                producer.Write(position + 4, (int)slotSize);
+            }
+
+            producer.WriteArray(position + 8, bytes, 0, bytes.Length);
+            if (commit)
+            {
+                producer.Write(position, bytes.Length);
+            }
+
+            return slotSize;
+        }
+
+        private static Action<byte[], int> Collect(List<string> payloads)
+        {
+            return (payload, length) => payloads.Add(Encoding.Unicode.GetString(payload, 0, length));
+        }
+    }
+}
@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the reports detoured processes append to a shared-memory ring (<see cref="FileAccessManifest.UseReportRingBuffer"/>).
+    /// </summary>
+    public class ReportRingDetoursTests : RemoteApiDetoursTestBase
+    {
+        [Fact]
+        public async Task ReportsThroughTheRingMatchReportsThroughThePipe()
+        {
+            var pathTable = new PathTable();
+
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\file.txt");
+
+            string[] throughPipe = await RunAndGetReportsAsync(pathTable, dirPath, "Pipe", useReportRingBuffer: false);
+            string[] throughRing = await RunAndGetReportsAsync(pathTable, dirPath, "Ring", useReportRingBuffer: true);
+
+            XAssert.IsTrue(throughPipe.Length > 0, "Expected accesses under {0} to be reported", dirPath.ToString(pathTable));
+            XAssert.AreEqual(string.Join(Environment.NewLine, throughPipe), string.Join(Environment.NewLine, throughRing));
+        }
+
+        private async Task<string[]> RunAndGetReportsAsync(PathTable pathTable, AbsolutePath dirPath, string name, bool useReportRingBuffer)
+        {
+            string directory = dirPath.ToString(pathTable);
+            string failuresFile = GetFullPath("DetoursFailures" + name + ".txt");
+            FileAccessManifest ringManifest = null;
+
+            try
+            {
+                SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                    pathTable,
+                    manifest =>
+                    {
+                        // The ring is named after the message count semaphore, as in SandboxedProcessPipExecutor.
+                        manifest.UseReportRingBuffer = useReportRingBuffer;
+                        manifest.InternalDetoursErrorNotificationFile = failuresFile;
+                        manifest.SetMessageCountSemaphore(failuresFile.Replace('\\', '_'));
+                        manifest.MonitorNtCreateFile = true;
+                        manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+                        ringManifest = manifest;
+                    },
+                    RemoteApi.Command.OpenRelativeToDirectory(directory, "file.txt"),
+                    RemoteApi.Command.CreateDirectory(directory + @"\Sub" + name),
+                    RemoteApi.Command.RenameByHandle(directory + @"\Sub" + name, directory + @"\Renamed" + name));
+
+                return result.ExplicitlyReportedFileAccesses
+                    .Select(access => string.Format("{0:G} {1:G} {2}", access.Operation, access.RequestedAccess, WithoutRunName(access.GetPath(pathTable), name)))
+                    .Distinct(StringComparer.OrdinalIgnoreCase)
+                    .OrderBy(report => report, StringComparer.OrdinalIgnoreCase)
+                    .ToArray();
+            }
+            finally
+            {
+                ringManifest?.UnsetMessageCountSemaphore();
+            }
+        }
+
+        private static string WithoutRunName(string path, string name)
+        {
+            return path.EndsWith(name, StringComparison.OrdinalIgnoreCase) ? path.Substring(0, path.Length - name.Length) : path;
+        }
+    }
+}
@@ -0,0 +1,423 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Runtime.InteropServices;
+using System.Text;
+using System.Threading.Tasks;
+using BuildXL.Native.Processes;
+using BuildXL.Processes;
+using BuildXL.Processes.Internal;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+using Xunit.Abstractions;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// End-to-end overhead of the Detours sandbox on a fixed set of representative workloads, made by the load generator of
+    /// <see cref="RemoteApi" />.
+    /// </summary>
+    /// <remarks>
+    /// Every workload runs unsandboxed, in the sandbox with the default flags, and in the sandbox with each major flag turned on.
+    /// Each configuration prints one line to the test output, so that the results can be compared from one commit to the next:
+    ///   {"benchmark":"sandboxOverhead/&lt;workload&gt;/&lt;configuration&gt;","samples":3,"minMs":...,"medianMs":...,"maxMs":...,"overheadPercent":...,"reports":...}
+    /// The overhead is that of the median against the median of the unsandboxed runs, and the reports are the distinct file accesses
+    /// of the last sandboxed run. Nothing is asserted on the timings.
+    ///
+    /// When the BuildXL minifilter is loaded, each workload also runs under it instead of Detours (configuration "minifilter",
+    /// see <see cref="MinifilterConnection"/>); otherwise that configuration is skipped with a note in the output.
+    /// </remarks>
+    [Trait("Category", "Performance")]
+    public sealed class SandboxOverheadBenchmarks : RemoteApiDetoursTestBase
+    {
+        private const int SampleCount = 3;
+
+        private readonly ITestOutputHelper m_output;
+
+        /// <nodoc />
+        public SandboxOverheadBenchmarks(ITestOutputHelper output)
+            : base(output)
+        {
+            m_output = output;
+        }
+
+        /// <summary>
+        /// Many opens and probes of a deep tree of headers, with almost no enumeration, as a compiler resolving its includes does.
+        /// </summary>
+        [Fact]
+        public Task HeaderHeavyCompile()
+        {
+            return RunWorkloadAsync("headerHeavyCompile", "threads=4;files=2000;depth=3;operations=5000;open=8;probe=12;enumerate=0;rename=0");
+        }
+
+        /// <summary>
+        /// Enumerations of a wide and deep tree of small directories, as a resolver walking node_modules does.
+        /// </summary>
+        [Fact]
+        public Task NodeModulesEnumeration()
+        {
+            return RunWorkloadAsync("nodeModulesEnumeration", "threads=4;files=5000;depth=4;operations=2000;open=1;probe=2;enumerate=10;rename=0");
+        }
+
+        /// <summary>
+        /// A tree of short-lived processes making few calls each, as a shell script running tools does.
+        /// </summary>
+        [Fact]
+        public Task ForkHeavyScript()
+        {
+            return RunWorkloadAsync("forkHeavyScript", "threads=1;files=50;operations=100;children=4;generations=3");
+        }
+
+        /// <summary>
+        /// Renames of outputs back and forth, as a tool writing to a temporary file and moving it in place does.
+        /// </summary>
+        [Fact]
+        public Task RenameHeavyWriter()
+        {
+            return RunWorkloadAsync("renameHeavyWriter", "threads=4;files=500;depth=2;operations=2000;open=1;probe=1;enumerate=0;rename=10");
+        }
+
+        private static readonly KeyValuePair<string, Action<FileAccessManifest>>[] s_sandboxedConfigurations =
+        {
+            new KeyValuePair<string, Action<FileAccessManifest>>("default", manifest => { }),
+            new KeyValuePair<string, Action<FileAccessManifest>>("monitorNtCreateFile", manifest => manifest.MonitorNtCreateFile = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("reportFileAccesses", manifest => manifest.ReportFileAccesses = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("logProcessData", manifest => manifest.LogProcessData = true),
+
+            // Reporting
+            new KeyValuePair<string, Action<FileAccessManifest>>("bufferReports", manifest => manifest.BufferReports = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("sendReportsAsynchronously", manifest => manifest.SendReportsAsynchronously = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("deduplicateReports", manifest => manifest.DeduplicateReports = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("shareReportCacheAcrossProcesses", manifest =>
+            {
+                manifest.DeduplicateReports = true;
+                manifest.ShareReportCacheAcrossProcesses = true;
+            }),
+            new KeyValuePair<string, Action<FileAccessManifest>>("summarizeFileAccesses", manifest => manifest.SummarizeFileAccesses = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("coalesceOutputWrites", manifest => manifest.CoalesceOutputWrites = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("adaptiveReportBackpressure", manifest => manifest.AdaptiveReportBackpressure = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("reportChannels", manifest => manifest.ReportChannelCount = 4),
+            new KeyValuePair<string, Action<FileAccessManifest>>("binaryReportFormat", manifest => manifest.UseBinaryReportFormat = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("internReportedPaths", manifest =>
+            {
+                manifest.UseBinaryReportFormat = true;
+                manifest.InternReportedPaths = true;
+            }),
+            new KeyValuePair<string, Action<FileAccessManifest>>("reportRingBuffer", manifest =>
+            {
+                manifest.UseReportRingBuffer = true;
+                SetMessageCountSemaphore(manifest);
+            }),
+            new KeyValuePair<string, Action<FileAccessManifest>>("accessBitmap", manifest =>
+            {
+                manifest.UseAccessBitmap = true;
+                SetMessageCountSemaphore(manifest);
+            }),
+            new KeyValuePair<string, Action<FileAccessManifest>>("sequenceReports", manifest =>
+            {
+                manifest.UseBinaryReportFormat = true;
+                manifest.SequenceReports = true;
+                SetMessageCountSemaphore(manifest);
+            }),
+
+            // Caches of the detoured processes
+            new KeyValuePair<string, Action<FileAccessManifest>>("cachePolicyResults", manifest => manifest.CachePolicyResults = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("cacheReparsePointProbes", manifest => manifest.CacheReparsePointProbes = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("cacheFinalPathsOfHandles", manifest => manifest.CacheFinalPathsOfHandles = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("cacheKnownDirectories", manifest => manifest.CacheKnownDirectories = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("cacheCurrentDirectory", manifest => manifest.CacheCurrentDirectory = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("shrinkCachesUnderMemoryPressure", manifest => manifest.ShrinkCachesUnderMemoryPressure = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("alignedManifestTree", manifest => manifest.UseAlignedManifestTree = true),
+
+            // Detours and the calls they make
+            new KeyValuePair<string, Action<FileAccessManifest>>("omitPassThroughDetours", manifest => manifest.OmitPassThroughDetours = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("detourNtLayerOnly", manifest => manifest.DetourNtLayerOnly = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("useLargeFetchEnumerations", manifest => manifest.UseLargeFetchEnumerations = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("fastTempFileNames", manifest => manifest.FastTempFileNames = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("useBlockCloneForCopies", manifest => manifest.UseBlockCloneForCopies = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("inheritDeviceMap", manifest => manifest.InheritDeviceMap = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("prefetchDeclaredInputs", manifest => manifest.PrefetchDeclaredInputs = true),
+            new KeyValuePair<string, Action<FileAccessManifest>>("hashOutputsWhileWriting", manifest => manifest.HashOutputsWhileWriting = true),
+
+            // Everything above that does not change what is reported, together
+            new KeyValuePair<string, Action<FileAccessManifest>>("allPerformanceFlags", manifest =>
+            {
+                manifest.UseBinaryReportFormat = true;
+                manifest.BufferReports = true;
+                manifest.SendReportsAsynchronously = true;
+                manifest.DeduplicateReports = true;
+                manifest.ShareReportCacheAcrossProcesses = true;
+                manifest.CachePolicyResults = true;
+                manifest.CacheReparsePointProbes = true;
+                manifest.CacheFinalPathsOfHandles = true;
+                manifest.CacheKnownDirectories = true;
+                manifest.CacheCurrentDirectory = true;
+                manifest.UseAlignedManifestTree = true;
+                manifest.OmitPassThroughDetours = true;
+                manifest.UseLargeFetchEnumerations = true;
+                manifest.FastTempFileNames = true;
+            }),
+        };
+
+        /// <summary>
+        /// For the configurations whose shared objects are named after the message count semaphore; unset once the run is over.
+        /// </summary>
+        private static void SetMessageCountSemaphore(FileAccessManifest manifest)
+        {
+            manifest.SetMessageCountSemaphore("SandboxOverheadBenchmarks_" + Guid.NewGuid().ToString("N"));
+        }
+
+        private async Task RunWorkloadAsync(string workload, string spec)
+        {
+            var pathTable = new PathTable();
+            AbsolutePath loadRoot = CreateDirectory(pathTable, workload);
+            RemoteApi.Command load = RemoteApi.Command.Load(loadRoot.ToString(pathTable), spec);
+
+            // The first run creates the tree, which the measured runs then find in place (and in the file system caches).
+            await RemoteApi.RunUnsandboxedAsync(TemporaryDirectory, load);
+
+            var baseline = new List<long>();
+            for (int i = 0; i < SampleCount; i++)
+            {
+                var stopwatch = Stopwatch.StartNew();
+                await RemoteApi.RunUnsandboxedAsync(TemporaryDirectory, load);
+                baseline.Add(stopwatch.ElapsedMilliseconds);
+            }
+
+            long baselineMedian = Median(baseline);
+            Report(workload, "unsandboxed", baseline, baselineMedian, reports: 0);
+
+            foreach (var configuration in s_sandboxedConfigurations)
+            {
+                var samples = new List<long>();
+                int reports = 0;
+                for (int i = 0; i < SampleCount; i++)
+                {
+                    FileAccessManifest runManifest = null;
+                    var stopwatch = Stopwatch.StartNew();
+                    SandboxedProcessResult result;
+                    try
+                    {
+                        result = await RunRemoteApiInSandboxAsync(
+                            pathTable,
+                            manifest =>
+                            {
+                                manifest.AddScope(loadRoot, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll);
+                                configuration.Value(manifest);
+                                runManifest = manifest;
+                            },
+                            load);
+                        samples.Add(stopwatch.ElapsedMilliseconds);
+                    }
+                    finally
+                    {
+                        runManifest?.UnsetMessageCountSemaphore();
+                    }
+
+                    reports = result.FileAccesses?.Count ?? result.ExplicitlyReportedFileAccesses?.Count ?? 0;
+                }
+
+                Report(workload, configuration.Key, samples, baselineMedian, reports);
+            }
+
+            if (!MinifilterConnection.TryConnect(out MinifilterConnection minifilter))
+            {
+                m_output.WriteLine($"sandboxOverhead/{workload}/minifilter: skipped, the BuildXL minifilter is not loaded");
+                return;
+            }
+
+            using (minifilter)
+            {
+                var samples = new List<long>();
+                int reports = 0;
+                for (int i = 0; i < SampleCount; i++)
+                {
+                    var stopwatch = Stopwatch.StartNew();
+                    reports = await RunRemoteApiUnderMinifilterAsync(minifilter, pathTable, loadRoot, load);
+                    samples.Add(stopwatch.ElapsedMilliseconds);
+                }
+
+                Report(workload, "minifilter", samples, baselineMedian, reports);
+            }
+        }
+
+        /// <summary>
+        /// Runs RemoteApi.exe in a silo the minifilter sandboxes with the same manifest as the default configuration, and returns the
+        /// number of distinct paths it reported.
+        /// </summary>
+        private async Task<int> RunRemoteApiUnderMinifilterAsync(MinifilterConnection minifilter, PathTable pathTable, AbsolutePath loadRoot, RemoteApi.Command load)
+        {
+            var manifest = new FileAccessManifest(pathTable)
+            {
+                FailUnexpectedFileAccesses = false,
+                ReportFileAccesses = true,
+                UseReportRingBuffer = true,
+                PipId = 1,
+            };
+            manifest.AddScope(loadRoot, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll);
+
+            var paths = new HashSet<string>(StringComparer.OrdinalIgnoreCase);
+            string ringName = "BuildXLMinifilterBenchmark_" + Guid.NewGuid().ToString("N");
+
+            using (var job = new JobObject(null))
+            using (var ring = ReportRingBuffer.Create(ringName, 1 << 22))
+            using (var stream = new MemoryStream())
+            {
+                MinifilterConnection.ConvertToSilo(job);
+
+                bool debugFlagsMatch = true;
+                var setup = new FileAccessSetup { DllNameX64 = string.Empty, DllNameX86 = string.Empty, ReportPath = string.Empty };
+                minifilter.AddPip(job, ring, manifest.GetPayloadBytes(setup, stream, timeoutMins: 10, debugFlagsMatch: ref debugFlagsMatch), manifest.PipId);
+
+                try
+                {
+                    Action<byte[], int> collect = (payload, length) =>
+                    {
+                        // One report line per slot: "<type>,<operation>:<fields>|...|<path>|<filter>\r\n" (see SendReport.cpp)
+                        string[] fields = Encoding.Unicode.GetString(payload, 0, length).Split('|');
+                        if (fields.Length > 11)
+                        {
+                            paths.Add(fields[11]);
+                        }
+                    };
+
+                    using (Process process = StartSuspendedInJob(job, "\"" + RemoteApi.ExecutablePath + "\" \"" + load.Serialize() + "\""))
+                    {
+                        while (!process.HasExited)
+                        {
+                            ring.Drain(collect);
+                            await Task.Delay(10);
+                        }
+
+                        XAssert.AreEqual(0, process.ExitCode, "RemoteApi.exe failed under the minifilter");
+                    }
+
+                    ring.Drain(collect);
+                }
+                finally
+                {
+                    minifilter.RemovePip(job, manifest.PipId);
+                }
+            }
+
+            return paths.Count;
+        }
+
+        /// <summary>
+        /// Starts a process in <paramref name="job"/>, so that it is sandboxed from its first instruction.
+        /// </summary>
+        private static Process StartSuspendedInJob(JobObject job, string commandLine)
+        {
+            var startupInfo = new STARTUPINFO { cb = Marshal.SizeOf<STARTUPINFO>() };
+            if (!CreateProcess(null, new StringBuilder(commandLine), IntPtr.Zero, IntPtr.Zero, false, ProcessUtilities.CREATE_SUSPENDED, IntPtr.Zero, null, ref startupInfo, out PROCESS_INFORMATION processInfo))
+            {
+                throw new BuildXLException("Unable to start RemoteApi.exe: " + Marshal.GetLastWin32Error());
+            }
+
+            try
+            {
+                // Obtained while the process cannot have exited yet, so that its exit code stays available.
+                Process process = Process.GetProcessById(processInfo.dwProcessId);
+                if (!AssignProcessToJobObject(job.DangerousGetHandle(), processInfo.hProcess))
+                {
+                    process.Kill();
+                    process.Dispose();
+                    throw new BuildXLException("Unable to assign RemoteApi.exe to the silo");
+                }
+
+                ResumeThread(processInfo.hThread);
+                return process;
+            }
+            finally
+            {
+                CloseHandle(processInfo.hThread);
+                CloseHandle(processInfo.hProcess);
+            }
+        }
+
+        private void Report(string workload, string configuration, List<long> samples, long baselineMedian, int reports)
+        {
+            long median = Median(samples);
+            double overheadPercent = baselineMedian > 0 ? (median - baselineMedian) * 100.0 / baselineMedian : 0;
+
+            m_output.WriteLine(string.Format(
+                CultureInfo.InvariantCulture,
+                "{{\"benchmark\":\"sandboxOverhead/{0}/{1}\",\"samples\":{2},\"minMs\":{3},\"medianMs\":{4},\"maxMs\":{5},\"overheadPercent\":{6:F1},\"reports\":{7}}}",
+                workload,
+                configuration,
+                samples.Count,
+                samples.Min(),
+                median,
+                samples.Max(),
+                overheadPercent,
+                reports));
+        }
+
+        private static long Median(List<long> samples)
+        {
+            var sorted = samples.OrderBy(sample => sample).ToList();
+            return sorted[sorted.Count / 2];
+        }
+
+        [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Unicode)]
+        private struct STARTUPINFO
+        {
+            public int cb;
+            public string lpReserved;
+            public string lpDesktop;
+            public string lpTitle;
+            public int dwX;
+            public int dwY;
+            public int dwXSize;
+            public int dwYSize;
+            public int dwXCountChars;
+            public int dwYCountChars;
+            public int dwFillAttribute;
+            public int dwFlags;
+            public short wShowWindow;
+            public short cbReserved2;
+            public IntPtr lpReserved2;
+            public IntPtr hStdInput;
+            public IntPtr hStdOutput;
+            public IntPtr hStdError;
+        }
+
+        [StructLayout(LayoutKind.Sequential)]
+        private struct PROCESS_INFORMATION
+        {
+            public IntPtr hProcess;
+            public IntPtr hThread;
+            public int dwProcessId;
+            public int dwThreadId;
+        }
+
+        [DllImport("kernel32.dll", CharSet = CharSet.Unicode, SetLastError = true)]
+        private static extern bool CreateProcess(
+            string lpApplicationName,
+            StringBuilder lpCommandLine,
+            IntPtr lpProcessAttributes,
+            IntPtr lpThreadAttributes,
+            bool bInheritHandles,
+            int dwCreationFlags,
+            IntPtr lpEnvironment,
+            string lpCurrentDirectory,
+            ref STARTUPINFO lpStartupInfo,
+            out PROCESS_INFORMATION lpProcessInformation);
+
+        [DllImport("kernel32.dll", SetLastError = true)]
+        private static extern bool AssignProcessToJobObject(IntPtr hJob, IntPtr hProcess);
+
+        [DllImport("kernel32.dll", SetLastError = true)]
+        private static extern int ResumeThread(IntPtr hThread);
+
+        [DllImport("kernel32.dll", SetLastError = true)]
+        private static extern bool CloseHandle(IntPtr hObject);
+    }
+}
@@ -0,0 +1,184 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading.Tasks;
+using BuildXL.Interop.MacOS;
+using BuildXL.Processes;
+using BuildXL.Processes.Internal;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+using Xunit.Abstractions;
+using static BuildXL.Interop.MacOS.Sandbox;
+
+namespace Test.BuildXL.Processes
+{
+    public class SandboxedProcessLinuxTest : SandboxedProcessTestBase
+    {
+        public SandboxedProcessLinuxTest(ITestOutputHelper output)
+            : base(output) { }
+
+        [Fact]
+        public void TryParseReadsCompactReport()
+        {
+            var bytes = CompactReport(FileOperation.OpKAuthReadFile, pid: 1234, status: FileAccessStatus.Denied, error: 2, path: "/home/üser/a.txt");
+
+            XAssert.IsTrue(LinuxReportReader.TryParse(bytes, bytes.Length, out var report));
+            XAssert.AreEqual(FileOperation.OpKAuthReadFile, report.Operation);
+            XAssert.AreEqual(1234, report.Pid);
+            XAssert.AreEqual(1000, report.RootPid);
+            XAssert.AreEqual((uint)RequestedAccess.Read, report.RequestedAccess);
+            XAssert.AreEqual((uint)FileAccessStatus.Denied, report.Status);
+            XAssert.AreEqual(1u, report.ExplicitLogging);
+            XAssert.AreEqual(2u, report.Error);
+            XAssert.AreEqual(42L, report.PipId);
+            XAssert.AreEqual(7UL, report.Statistics.CreationTime);
+            XAssert.AreEqual(9UL, report.Statistics.DequeueTime);
+            XAssert.AreEqual("/home/üser/a.txt", report.Path);
+        }
+
+        [Fact]
+        public void TryParseRejectsUnterminatedPath()
+        {
+            var bytes = CompactReport(FileOperation.OpKAuthReadFile, pid: 1, status: FileAccessStatus.Allowed, error: 0, path: "/a");
+            bytes[bytes.Length - 1] = (byte)'b';
+
+            XAssert.IsFalse(LinuxReportReader.TryParse(bytes, bytes.Length, out _));
+            XAssert.IsFalse(LinuxReportReader.TryParse(bytes, LinuxReportReader.HeaderSize, out _));
+        }
+
+        [Fact]
+        public void ReadAllReadsEveryReportUntilTheEnd()
+        {
+            var stream = Frame(
+                CompactReport(FileOperation.OpProcessStart, pid: 1, status: FileAccessStatus.Allowed, error: 0, path: "/bin/sh"),
+                CompactReport(FileOperation.OpKAuthCreateDir, pid: 1, status: FileAccessStatus.Allowed, error: 0, path: "/out"),
+                CompactReport(FileOperation.OpProcessExit, pid: 1, status: FileAccessStatus.Allowed, error: 0, path: "/bin/sh"));
+
+            var reports = new List<AccessReport>();
+            var errors = new List<string>();
+            LinuxReportReader.ReadAll(stream, reports.Add, errors.Add);
+
+            XAssert.AreEqual(0, errors.Count, string.Join(Environment.NewLine, errors));
+            XAssert.AreSetsEqual(
+                new[] { FileOperation.OpProcessStart, FileOperation.OpKAuthCreateDir, FileOperation.OpProcessExit },
+                reports.Select(r => r.Operation),
+                expectedResult: true);
+            XAssert.AreEqual("/out", reports[1].Path);
+        }
+
+        [Fact]
+        public void ReadAllStopsAtMalformedOrTruncatedReport()
+        {
+            var good = CompactReport(FileOperation.OpKAuthReadFile, pid: 1, status: FileAccessStatus.Allowed, error: 0, path: "/a");
+
+            // a size that cannot be the one of a report: the reports after it cannot be found
+            var malformed = new MemoryStream(
+                Frame(good).ToArray()
+                    .Concat(BitConverter.GetBytes(3u))
+                    .Concat(Frame(good).ToArray())
+                    .ToArray());
+            AssertReadAll(malformed, expectedReports: 1, expectedErrors: 1);
+
+            // the last report is cut short
+            var truncated = Frame(good, good);
+            truncated.SetLength(truncated.Length - 1);
+            AssertReadAll(truncated, expectedReports: 1, expectedErrors: 1);
+        }
+
+        [FactIfSupported(requiresLinuxBasedOperatingSystem: true)]
+        public async Task SandboxReportsAccessesOfTheWholeProcessTree()
+        {
+            string input = Path.Combine(TemporaryDirectory, "input.txt");
+            string output = Path.Combine(TemporaryDirectory, "output.txt");
+            File.WriteAllText(input, "hi");
+
+            var info = new SandboxedProcessInfo(
+                Context.PathTable,
+                this,
+                "/bin/sh",
+                disableConHostSharing: false)
+            {
+                PipSemiStableHash = 0x1234,
+                PipDescription = nameof(SandboxReportsAccessesOfTheWholeProcessTree),
+                WorkingDirectory = TemporaryDirectory,
+                Arguments = $"-c \"cat '{input}' > '{output}'; ls '{Path.Combine(TemporaryDirectory, "absent")}'\"",
+                Timeout = TimeSpan.FromMinutes(1),
+                EnvironmentVariables = BuildParameters.GetFactory().PopulateFromEnvironment(),
+            };
+            info.FileAccessManifest.FailUnexpectedFileAccesses = false;
+            info.FileAccessManifest.ReportFileAccesses = true;
+            info.FileAccessManifest.PipId = GetNextPipId();
+
+            using (var process = new SandboxedProcessLinux(info))
+            {
+                process.Start();
+                var result = await process.GetResultAsync();
+
+                XAssert.AreEqual(2, result.ExitCode, "'ls' of an absent path must have failed");
+                XAssert.AreEqual("hi", File.ReadAllText(output));
+
+                var accesses = result.FileAccesses.Select(a => (path: a.GetPath(Context.PathTable), access: a.RequestedAccess, error: a.Error)).ToList();
+                XAssert.IsTrue(accesses.Any(a => a.path == input && a.access.HasFlag(RequestedAccess.Read)), $"Expected a read of {input}");
+                XAssert.IsTrue(accesses.Any(a => a.path == output && a.access.HasFlag(RequestedAccess.Write)), $"Expected a write of {output}");
+                XAssert.IsTrue(
+                    accesses.Any(a => a.path == Path.Combine(TemporaryDirectory, "absent") && a.error == ReportedFileAccess.ERROR_PATH_NOT_FOUND),
+                    "Expected a probe of the absent path");
+
+                var processNames = result.Processes.Select(p => Path.GetFileName(p.Path)).ToList();
+                XAssert.IsTrue(processNames.Contains("cat") && processNames.Contains("ls"), $"Unexpected processes: {string.Join(", ", processNames)}");
+                XAssert.IsTrue(result.SurvivingChildProcesses == null || !result.SurvivingChildProcesses.Any());
+            }
+        }
+
+        private static void AssertReadAll(Stream stream, int expectedReports, int expectedErrors)
+        {
+            var reports = new List<AccessReport>();
+            var errors = new List<string>();
+            LinuxReportReader.ReadAll(stream, reports.Add, errors.Add);
+
+            XAssert.AreEqual(expectedReports, reports.Count);
+            XAssert.AreEqual(expectedErrors, errors.Count);
+        }
+
+        /// <summary>
+        /// The bytes of a compact AccessReport, as the Linux sandbox writes them (see SandboxCommon.hpp).
+        /// </summary>
+        private static byte[] CompactReport(FileOperation operation, int pid, FileAccessStatus status, uint error, string path)
+        {
+            var pathBytes = Encoding.UTF8.GetBytes(path);
+            var bytes = new byte[LinuxReportReader.HeaderSize + pathBytes.Length + 1];
+            bytes[0] = (byte)operation;
+            BitConverter.GetBytes(pid).CopyTo(bytes, 4);
+            BitConverter.GetBytes(1000).CopyTo(bytes, 8);
+            BitConverter.GetBytes((uint)RequestedAccess.Read).CopyTo(bytes, 12);
+            BitConverter.GetBytes((uint)status).CopyTo(bytes, 16);
+            BitConverter.GetBytes(1u).CopyTo(bytes, 20);
+            BitConverter.GetBytes(error).CopyTo(bytes, 24);
+            BitConverter.GetBytes(42L).CopyTo(bytes, 32);
+            BitConverter.GetBytes(7UL).CopyTo(bytes, 40);
+            BitConverter.GetBytes(8UL).CopyTo(bytes, 48);
+            BitConverter.GetBytes(9UL).CopyTo(bytes, 56);
+            pathBytes.CopyTo(bytes, LinuxReportReader.HeaderSize);
+            return bytes;
+        }
+
+        private static MemoryStream Frame(params byte[][] reports)
+        {
+            var stream = new MemoryStream();
+            foreach (var report in reports)
+            {
+                stream.Write(BitConverter.GetBytes((uint)report.Length), 0, sizeof(uint));
+                stream.Write(report, 0, report.Length);
+            }
+
+            stream.Position = 0;
+            return stream;
+        }
+    }
+}
@@ -47,6 +47,8 @@ namespace Test.BuildXL.Processes
 
             public bool NotifyUsage(uint cpuUsage, uint availableRamMB) { return true; }
 
+            public bool StartResourceSampler(uint intervalMs) { return true; }
+
             public bool NotifyKextPipStarted(FileAccessManifest fam, SandboxedProcessMacKext process) { return true; }
 
             public void NotifyKextPipProcessTerminated(long pipId, int processId) { }
@@ -12,6 +12,7 @@ using BuildXL.Native.IO.Windows;
 using BuildXL.Pips;
 using BuildXL.Processes;
 using BuildXL.Utilities;
+using BuildXL.Utilities.Configuration;
 using Test.BuildXL.Executables.TestProcess;
 using Test.BuildXL.TestUtilities;
 using Test.BuildXL.TestUtilities.Xunit;
@@ -831,6 +832,47 @@ namespace Test.BuildXL.Processes
             }
         }
 
+        [Fact]
+        [Trait("Category", "WindowsOSOnly")]
+        public async Task MinifilterReportsAccessesOrRefusesToStart()
+        {
+            using (var tempFiles = new TempFileStorage(canGetFileNames: true))
+            {
+                var pt = new PathTable();
+                string tempFileName = tempFiles.GetUniqueFileName();
+                File.WriteAllText(tempFileName, "Success");
+
+                var info =
+                    new SandboxedProcessInfo(pt, tempFiles, CmdHelper.CmdX64, disableConHostSharing: false)
+                    {
+                        PipSemiStableHash = 0,
+                        PipDescription = "SandboxedProcessTest",
+                        Arguments = "/d /c type " + CommandLineEscaping.EscapeAsCommandLineWord(tempFileName),
+                        SandboxKind = SandboxKind.WinMinifilter,
+                    };
+                info.FileAccessManifest.ReportFileAccesses = true;
+                info.FileAccessManifest.FailUnexpectedFileAccesses = false;
+                info.FileAccessManifest.SetMessageCountSemaphore("SandboxedProcessTest_" + Guid.NewGuid().ToString("N"));
+
+                if (!MinifilterConnection.TryConnect(out MinifilterConnection minifilter))
+                {
+                    // The process must not run under Detours instead.
+                    var exception = await Assert.ThrowsAsync<BuildXLException>(() => RunProcess(info));
+                    XAssert.AreEqual(ExceptionRootCause.MissingRuntimeDependency, exception.RootCause);
+                    return;
+                }
+
+                minifilter.Dispose();
+
+                SandboxedProcessResult result = await RunProcess(info);
+                XAssert.AreEqual(0, result.ExitCode);
+                XAssert.AreEqual("Success", (await result.StandardOutput.ReadValueAsync()).Trim());
+                XAssert.IsTrue(
+                    result.FileAccesses.Any(a => string.Equals(a.GetPath(pt), tempFileName, StringComparison.OrdinalIgnoreCase) && a.RequestedAccess.HasFlag(RequestedAccess.Read)),
+                    "Expected the minifilter to report the read of " + tempFileName);
+            }
+        }
+
         [Fact]
         public async Task ReportSingleReadAccessXPlat()
         {
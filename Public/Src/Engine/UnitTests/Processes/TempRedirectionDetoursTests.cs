@@ -0,0 +1,177 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System;
+using System.IO;
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the redirection of the untracked temp directory of a pip (<see cref="FileAccessManifest.RedirectUntrackedTempDirectory"/>).
+    /// </summary>
+    /// <remarks>
+    /// The redirected directory is on the volume of the test, so these tests cover what the tools see, not the copies made when files move
+    /// across volumes.
+    /// </remarks>
+    public class TempRedirectionDetoursTests : RemoteApiDetoursTestBase
+    {
+        [Fact]
+        public async Task FilesWrittenToTempAreRedirected()
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\file.txt");
+            string directory = dirPath.ToString(pathTable);
+            string temp = CreateDirectory("Temp");
+
+            (SandboxedProcessResult result, string redirected) = await RunWithRedirectedTempAsync(
+                pathTable,
+                dirPath,
+                RemoteApi.Command.CopyFile(directory + @"\file.txt", temp + @"\copy.txt"),
+                RemoteApi.Command.CreateDirectory(temp + @"\Sub"),
+                RemoteApi.Command.OpenRelativeToDirectory(temp, "copy.txt"));
+
+            XAssert.IsTrue(File.Exists(Path.Combine(redirected, "copy.txt")), "Expected the copy to be in the redirected directory {0}", redirected);
+            XAssert.IsTrue(Directory.Exists(Path.Combine(redirected, "Sub")), "Expected the directory to be in the redirected directory {0}", redirected);
+            XAssert.IsFalse(File.Exists(Path.Combine(temp, "copy.txt")), "Expected the copy not to be in the temp directory {0}", temp);
+
+            // The accesses are those of the temp directory.
+            string copy = temp + @"\copy.txt";
+            XAssert.IsTrue(
+                result.ExplicitlyReportedFileAccesses.Any(access => string.Equals(access.GetPath(pathTable), copy, StringComparison.OrdinalIgnoreCase)),
+                "Expected an access to {0} to be reported",
+                copy);
+            XAssert.IsFalse(
+                result.ExplicitlyReportedFileAccesses.Any(access => access.GetPath(pathTable).StartsWith(redirected, StringComparison.OrdinalIgnoreCase)),
+                "Expected no access to be reported under {0}",
+                redirected);
+
+            XAssert.IsTrue(GetProcessDataCounter(result, "TempPathsRedirected") > 0, "Expected the paths under {0} to be redirected", temp);
+        }
+
+        [Fact]
+        public async Task FilesOutsideTempAreNotRedirected()
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\file.txt");
+            string directory = dirPath.ToString(pathTable);
+            CreateDirectory("Temp");
+
+            (SandboxedProcessResult result, string redirected) = await RunWithRedirectedTempAsync(
+                pathTable,
+                dirPath,
+                RemoteApi.Command.CopyFile(directory + @"\file.txt", directory + @"\copy.txt"),
+                RemoteApi.Command.CreateDirectory(directory + @"\Sub"));
+
+            XAssert.IsTrue(File.Exists(Path.Combine(directory, "copy.txt")), "Expected the copy to be where it was written");
+            XAssert.IsTrue(Directory.Exists(Path.Combine(directory, "Sub")), "Expected the directory to be where it was created");
+            XAssert.IsFalse(File.Exists(Path.Combine(redirected, "copy.txt")), "Expected nothing in the redirected directory {0}", redirected);
+
+            string copy = directory + @"\copy.txt";
+            XAssert.IsTrue(
+                result.ExplicitlyReportedFileAccesses.Any(access => string.Equals(access.GetPath(pathTable), copy, StringComparison.OrdinalIgnoreCase)),
+                "Expected an access to {0} to be reported",
+                copy);
+            XAssert.AreEqual(0UL, GetProcessDataCounter(result, "TempPathsRedirected"));
+        }
+
+        [Fact]
+        public async Task ProgramsWrittenToTempCanBeStarted()
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            string directory = dirPath.ToString(pathTable);
+            string temp = CreateDirectory("Temp");
+            string tool = temp + @"\Tool.exe";
+
+            await RunWithRedirectedTempAsync(
+                pathTable,
+                dirPath,
+                RemoteApi.Command.CopyFile(RemoteApi.ExecutablePath, tool),
+                RemoteApi.Command.RunCommandLine(null, "\"" + tool + "\" " + RemoteApi.Command.CreateDirectory(directory + @"\Quoted").GetCommandLineArgument()),
+                RemoteApi.Command.RunCommandLine(null, temp + @"\Tool " + RemoteApi.Command.CreateDirectory(directory + @"\WithoutExtension").GetCommandLineArgument()),
+                RemoteApi.Command.RunCommandLine(tool, "Tool " + RemoteApi.Command.CreateDirectory(directory + @"\ApplicationName").GetCommandLineArgument()));
+
+            foreach (string started in new[] { "Quoted", "WithoutExtension", "ApplicationName" })
+            {
+                XAssert.IsTrue(Directory.Exists(Path.Combine(directory, started)), "Expected the program started from the temp directory to run ({0})", started);
+            }
+        }
+
+        [Fact]
+        public async Task FileNamesAreThoseOfTemp()
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\file.txt");
+            string directory = dirPath.ToString(pathTable);
+            string temp = CreateDirectory("Temp");
+
+            // Names from the root of the volume.
+            (SandboxedProcessResult result, _) = await RunWithRedirectedTempAsync(
+                pathTable,
+                dirPath,
+                RemoteApi.Command.CopyFile(directory + @"\file.txt", temp + @"\copy.txt"),
+                RemoteApi.Command.CheckFileName(temp + @"\copy.txt", temp.Substring(2) + @"\copy.txt"),
+                RemoteApi.Command.CheckFileName(temp, temp.Substring(2)),
+                RemoteApi.Command.CheckFileName(directory + @"\file.txt", directory.Substring(2) + @"\file.txt"));
+
+            string output = await result.StandardOutput.ReadValueAsync();
+            XAssert.IsFalse(output.Contains(RemoteApi.CommandType.CheckFileName.ToString("G") + ",1"), "Expected the names of the temp directory. Output: {0}", output);
+        }
+
+        [Fact]
+        public async Task FilesMovedOutOfTempWithoutCopyAllowedAreMoved()
+        {
+            var pathTable = new PathTable();
+            AbsolutePath dirPath = CreateDirectory(pathTable, "D");
+            WriteEmptyFile(@"D\file.txt");
+            string directory = dirPath.ToString(pathTable);
+            string temp = CreateDirectory("Temp");
+
+            (_, string redirected) = await RunWithRedirectedTempAsync(
+                pathTable,
+                dirPath,
+                RemoteApi.Command.CopyFile(directory + @"\file.txt", temp + @"\scratch.txt"),
+                RemoteApi.Command.MoveFileEx(temp + @"\scratch.txt", directory + @"\output.txt"),
+                RemoteApi.Command.MoveFileEx(directory + @"\file.txt", temp + @"\input.txt"));
+
+            XAssert.IsTrue(File.Exists(Path.Combine(directory, "output.txt")), "Expected the file moved out of the temp directory");
+            XAssert.IsFalse(File.Exists(Path.Combine(redirected, "scratch.txt")), "Expected the file moved out of the temp directory to be gone from it");
+            XAssert.IsTrue(File.Exists(Path.Combine(redirected, "input.txt")), "Expected the file moved into the temp directory");
+        }
+
+        private async Task<(SandboxedProcessResult result, string redirected)> RunWithRedirectedTempAsync(
+            PathTable pathTable,
+            AbsolutePath dirPath,
+            params RemoteApi.Command[] commands)
+        {
+            string temp = GetFullPath("Temp");
+            string fastVolumeRoot = CreateDirectory("Fast");
+            string redirected = null;
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.MonitorNtCreateFile = true;
+                    manifest.MonitorChildProcesses = true;
+                    manifest.LogProcessData = true;
+                    manifest.AddScope(dirPath, FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+                    manifest.AddScope(AbsolutePath.Create(pathTable, temp), FileAccessPolicy.MaskNothing, FileAccessPolicy.AllowAll | FileAccessPolicy.ReportAccess);
+                    manifest.RedirectUntrackedTempDirectory(temp, fastVolumeRoot);
+                    redirected = manifest.RedirectedTempDirectory;
+                },
+                commands);
+
+            return (result, redirected);
+        }
+    }
+}
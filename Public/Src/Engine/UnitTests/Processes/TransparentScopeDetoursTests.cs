@@ -0,0 +1,74 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+using System.Linq;
+using System.Threading.Tasks;
+using BuildXL.Native.IO;
+using BuildXL.Processes;
+using BuildXL.Utilities;
+using Test.BuildXL.TestUtilities.Xunit;
+using Xunit;
+
+namespace Test.BuildXL.Processes
+{
+    /// <summary>
+    /// Tests for the opens of paths under scopes that are neither checked nor reported (see PolicyResult::IsTransparent in DetoursServices).
+    /// </summary>
+    public class TransparentScopeDetoursTests : RemoteApiDetoursTestBase
+    {
+        [Fact]
+        public async Task OpenRelativeToTransparentDirectoryIsNotReported()
+        {
+            var pathTable = new PathTable();
+
+            AbsolutePath untrackedPath = CreateDirectory(pathTable, "Untracked");
+            WriteEmptyFile(@"Untracked\file.txt");
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.MonitorNtCreateFile = true;
+                    AddTransparentScope(manifest, untrackedPath);
+                },
+                RemoteApi.Command.OpenRelativeToDirectory(untrackedPath.ToString(pathTable), "file.txt"));
+
+            VerifyReportedAccesses(pathTable, result.AllUnexpectedFileAccesses, allowExtraEnumerations: false);
+        }
+
+        [FactIfSupported(requiresSymlinkPermission: true)]
+        public async Task OpenRelativeToTransparentDirectoryEnforcesTargetOfSymlink()
+        {
+            var pathTable = new PathTable();
+
+            AbsolutePath untrackedPath = CreateDirectory(pathTable, "Untracked");
+            CreateDirectory("Tracked");
+            AbsolutePath secretPath = WriteEmptyFile(pathTable, @"Tracked\secret.txt");
+            XAssert.PossiblySucceeded(FileUtilities.TryCreateSymbolicLink(GetFullPath(@"Untracked\link"), secretPath.ToString(pathTable), isTargetFile: true));
+
+            SandboxedProcessResult result = await RunRemoteApiInSandboxAsync(
+                pathTable,
+                manifest =>
+                {
+                    manifest.MonitorNtCreateFile = true;
+                    manifest.IgnoreReparsePoints = false;
+                    AddTransparentScope(manifest, untrackedPath);
+
+                    // Not readable: only the open through the directory handle and the symlink could get to it.
+                    manifest.AddPath(secretPath, values: FileAccessPolicy.ReportAccess, mask: FileAccessPolicy.MaskNothing);
+                },
+                RemoteApi.Command.OpenRelativeToDirectory(untrackedPath.ToString(pathTable), "link"));
+
+            XAssert.IsTrue(
+                result.AllUnexpectedFileAccesses.Any(access => access.Status == FileAccessStatus.Denied && string.Equals(access.GetPath(pathTable), secretPath.ToString(pathTable), System.StringComparison.OrdinalIgnoreCase)),
+                "Expected the read of {0} through the directory handle of the transparent scope to be denied",
+                secretPath.ToString(pathTable));
+        }
+
+        private static void AddTransparentScope(FileAccessManifest manifest, AbsolutePath path)
+        {
+            // The mask clears the reports of enumerations that RemoteApi.RunInSandboxAsync asks for everywhere.
+            manifest.AddScope(path, FileAccessPolicy.MaskAll, FileAccessPolicy.AllowAll | FileAccessPolicy.AllowRealInputTimestamps);
+        }
+    }
+}
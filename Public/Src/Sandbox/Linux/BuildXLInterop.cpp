@@ -0,0 +1,24 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+#include "StringOperations.h"
+
+/*!
+ * The exports of the Linux libBuildXLInterop.so: the subset of the macOS interop library (see BuildXL.Interop.MacOS.Sandbox)
+ * that does not need the kext, i.e., the path normalization FileAccessManifest.cs serializes the manifest with.
+ *
+ * CODESYNC: Public/Src/Sandbox/MacOs/Interop/Sandbox/Sandbox.cpp
+ */
+extern "C"
+{
+    int NormalizePathAndReturnHash(const BYTE *path, BYTE *buffer, int bufferSize)
+    {
+        return NormalizeAndHashPath((PCPathChar)path, buffer, bufferSize);
+    }
+
+    void NormalizePathsAndReturnHashes(const BYTE *paths, const size_t *lengths, size_t count, BYTE *buffer, int *hashes)
+    {
+        NormalizeAndHashPaths((PCPathChar)paths, lengths, count, (PPathChar)buffer, (DWORD *)hashes);
+    }
+}
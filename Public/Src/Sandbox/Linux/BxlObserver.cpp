@@ -0,0 +1,204 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "BxlObserver.hpp"
+
+static uint64_t Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool StartsWith(const char *str, const char *prefix, size_t prefixLength)
+{
+    return strncmp(str, prefix, prefixLength) == 0;
+}
+
+BxlObserver *BxlObserver::GetInstance()
+{
+    // never destroyed: the library reports the exit of the process from its destructor
+    static BxlObserver *s_instance = new BxlObserver();
+    return s_instance;
+}
+
+BxlObserver::BxlObserver()
+    : fam_(), enabled_(false), rootPid_(0), pipId_(0)
+{
+    Init();
+}
+
+void BxlObserver::Init()
+{
+    const char *famPath = getenv(BxlEnvFamPath);
+    if (famPath == nullptr || *famPath == '\0')
+    {
+        return;
+    }
+
+    if (!LoadManifest(famPath, payload_, fam_))
+    {
+        return;
+    }
+
+    pipId_ = fam_.GetPipId()->PipId;
+
+    // the first process of the pip is its root; it passes itself on to the others
+    const char *rootPid = getenv(BxlEnvRootPid);
+    rootPid_ = rootPid != nullptr ? (pid_t)atoi(rootPid) : getpid();
+    if (rootPid == nullptr)
+    {
+        setenv(BxlEnvRootPid, std::to_string(rootPid_).c_str(), /*overwrite*/ 1);
+    }
+
+    const char *ldPreload = getenv(BxlEnvLdPreload);
+    envFamPath_   = std::string(BxlEnvFamPath "=") + famPath;
+    envRootPid_   = std::string(BxlEnvRootPid "=") + std::to_string(rootPid_);
+    envLdPreload_ = ldPreload != nullptr ? std::string(BxlEnvLdPreload "=") + ldPreload : std::string();
+
+    // the accesses are still checked when they cannot be reported
+    channel_.Open(fam_);
+
+    enabled_ = true;
+}
+
+void BxlObserver::OnForkChild()
+{
+    channel_.OnForkChild();
+}
+
+AccessCheckResult BxlObserver::CheckAndReport(FileOperation operation, const char *path, CheckFunc checker, bool isDirectory, int error)
+{
+    if (!enabled_)
+    {
+        return AccessCheckResult(RequestedAccess::None, ResultAction::Allow, ReportLevel::Ignore);
+    }
+
+    AccessCheckResult result = CheckAccess(fam_, path, checker, isDirectory);
+
+    if (!result.ShouldReport() || !channel_.CheckAndUpdate(path, (DWORD)result.RequestedAccess))
+    {
+        return result;
+    }
+
+    size_t pathLength = strlen(path);
+    if (pathLength >= PATH_MAX)
+    {
+        return result;
+    }
+
+    AccessReport report;
+    report.operation          = operation;
+    report.pid                = getpid();
+    report.rootPid            = rootPid_;
+    report.requestedAccess    = (DWORD)result.RequestedAccess;
+    report.status             = result.GetFileAccessStatus();
+    report.reportExplicitly   = result.ReportLevel == ReportLevel::ReportExplicit;
+    report.error              = error;
+    report.pipId              = pipId_;
+    report.stats              = { .creationTime = Now(), .enqueueTime = 0, .dequeueTime = 0 };
+    report.fileIdentity       = { .volume = 0, .file = 0 };
+    memcpy(report.path, path, pathLength + 1);
+
+    channel_.Send(report);
+    return result;
+}
+
+void BxlObserver::ReportProcess(FileOperation operation)
+{
+    if (!enabled_)
+    {
+        return;
+    }
+
+    AccessReport report;
+    report.operation          = operation;
+    report.pid                = getpid();
+    report.rootPid            = rootPid_;
+    report.requestedAccess    = operation == kOpProcessStart ? (DWORD)RequestedAccess::Read : 0;
+    report.status             = FileAccessStatus::FileAccessStatus_Allowed;
+    report.reportExplicitly   = 0;
+    report.error              = 0;
+    report.pipId              = pipId_;
+    report.stats              = { .creationTime = Now(), .enqueueTime = 0, .dequeueTime = 0 };
+    report.fileIdentity       = { .volume = 0, .file = 0 };
+
+    ssize_t length = REAL(readlink)("/proc/self/exe", report.path, sizeof(report.path) - 1);
+    if (length <= 0)
+    {
+        strcpy(report.path, "/unknown-process");
+    }
+    else
+    {
+        report.path[length] = '\0';
+    }
+
+    channel_.Send(report);
+}
+
+bool BxlObserver::NormalizePath(int dirfd, const char *path, char *buffer, size_t bufferSize) const
+{
+    if (path == nullptr || *path == '\0')
+    {
+        return false;
+    }
+
+    size_t length = 0;
+    if (path[0] != '/')
+    {
+        if (dirfd == AT_FDCWD)
+        {
+            if (getcwd(buffer, bufferSize) == nullptr) return false;
+            length = strlen(buffer);
+        }
+        else
+        {
+            char fdPath[32];
+            snprintf(fdPath, sizeof(fdPath), "/proc/self/fd/%d", dirfd);
+            ssize_t fdPathLength = REAL(readlink)(fdPath, buffer, bufferSize - 1);
+            if (fdPathLength <= 0 || buffer[0] != '/') return false;
+            length = fdPathLength;
+        }
+    }
+
+    return AppendNormalizedPath(buffer, length, path, bufferSize);
+}
+
+char *const *BxlObserver::EnsureEnvironment(char *const envp[], std::vector<char*> &storage) const
+{
+    if (!enabled_ || envp == nullptr)
+    {
+        return envp;
+    }
+
+    bool hasFamPath = false, hasRootPid = false, hasLdPreload = envLdPreload_.empty();
+    for (char *const *var = envp; *var != nullptr; var++)
+    {
+        hasFamPath   |= StartsWith(*var, BxlEnvFamPath "=",   sizeof(BxlEnvFamPath));
+        hasRootPid   |= StartsWith(*var, BxlEnvRootPid "=",   sizeof(BxlEnvRootPid));
+        hasLdPreload |= StartsWith(*var, BxlEnvLdPreload "=", sizeof(BxlEnvLdPreload));
+    }
+
+    if (hasFamPath && hasRootPid && hasLdPreload)
+    {
+        return envp;
+    }
+
+    storage.clear();
+    for (char *const *var = envp; *var != nullptr; var++) storage.push_back(*var);
+    if (!hasFamPath)   storage.push_back(const_cast<char*>(envFamPath_.c_str()));
+    if (!hasRootPid)   storage.push_back(const_cast<char*>(envRootPid_.c_str()));
+    if (!hasLdPreload) storage.push_back(const_cast<char*>(envLdPreload_.c_str()));
+    storage.push_back(nullptr);
+
+    return storage.data();
+}
@@ -0,0 +1,83 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef BxlObserver_hpp
+#define BxlObserver_hpp
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Checkers.hpp"
+#include "ReportChannel.hpp"
+#include "SandboxCommon.hpp"
+
+// Environment variables through which the sandbox is passed on to child processes
+#define BxlEnvFamPath   "__BUILDXL_FAM_PATH"
+#define BxlEnvRootPid   "__BUILDXL_ROOT_PID"
+#define BxlEnvLdPreload "LD_PRELOAD"
+
+/*!
+ * Checks the file accesses of the process it is loaded into (see Interpose.cpp) against the manifest of its pip, and
+ * reports them.
+ *
+ * The manifest is read from the file named by __BUILDXL_FAM_PATH, in the format FileAccessManifest.cs serializes it to,
+ * and the reports go to its channel (see ReportChannel).  They are deduplicated per process: the children of a process
+ * inherit what it has reported before they started.
+ */
+class BxlObserver
+{
+private:
+
+    std::unique_ptr<BYTE[]> payload_;
+    FileAccessManifestParseResult fam_;
+    bool enabled_;
+    pid_t rootPid_;
+    pipid_t pipId_;
+
+    ReportChannel channel_;
+
+    /*! What the children of the process need to be sandboxed too: the name=value strings of the BxlEnv* variables */
+    std::string envFamPath_;
+    std::string envRootPid_;
+    std::string envLdPreload_;
+
+    BxlObserver();
+
+    void Init();
+
+public:
+
+    static BxlObserver *GetInstance();
+
+    /*! Whether the process belongs to a pip, i.e., whether there is a manifest to check its accesses against */
+    bool IsEnabled() const { return enabled_; }
+
+    FileAccessManifestFlag GetFamFlags() const { return fam_.GetFamFlags(); }
+
+    /*!
+     * Checks an access of the absolute, normalized 'path' with 'checker', and reports it unless the policy ignores it
+     * or the process has reported it before.  The caller denies the access if the result says so.
+     */
+    AccessCheckResult CheckAndReport(FileOperation operation, const char *path, CheckFunc checker, bool isDirectory, int error = 0);
+
+    /*! Reports the start or the exit of the calling process */
+    void ReportProcess(FileOperation operation);
+
+    /*!
+     * Writes the absolute form of 'path' to 'buffer', with '.' and '..' resolved lexically; a relative path is
+     * relative to 'dirfd' (or to the working directory for AT_FDCWD).  Returns false if that does not fit or fails.
+     */
+    bool NormalizePath(int dirfd, const char *path, char *buffer, size_t bufferSize) const;
+
+    /*!
+     * Returns 'envp' with the BxlEnv* variables of this process added where they are missing (e.g., because the process
+     * cleared its environment), so that exec'ed children are sandboxed too.  'envp' itself is returned when nothing is missing.
+     */
+    char *const *EnsureEnvironment(char *const envp[], std::vector<char*> &storage) const;
+
+    /*! To be called in the child after a fork, before any other use */
+    void OnForkChild();
+};
+
+#endif /* BxlObserver_hpp */
@@ -0,0 +1,44 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef BxlEbpfEvent_h
+#define BxlEbpfEvent_h
+
+// Shared by the BPF program (BxlObserver.bpf.c) and its user-space side (EbpfObserver.cpp): plain C, fixed-size types only
+
+#define BXL_EBPF_PATH_MAX       512
+#define BXL_EBPF_RING_SIZE      (16 * 1024 * 1024)
+#define BXL_EBPF_MAX_PIPS       1024
+#define BXL_EBPF_AT_FDCWD       -100
+
+// The calls the program observes; user space maps them to FileOperation's (see OpNames.hpp)
+enum bxl_ebpf_kind
+{
+    BXL_EBPF_OPEN = 1,
+    BXL_EBPF_EXEC,
+    BXL_EBPF_RENAME_SOURCE,
+    BXL_EBPF_RENAME_DEST,
+    BXL_EBPF_UNLINK,
+    BXL_EBPF_FORK,
+    BXL_EBPF_EXIT,
+};
+
+/*
+ * One observed call.  'path' is as the process passed it: a relative path is relative to 'dirfd' of 'pid', which user
+ * space resolves through /proc.  Only the used part of 'path' is significant.
+ */
+struct bxl_ebpf_event
+{
+    unsigned int        kind;
+    int                 pid;
+    int                 ppid;
+    int                 dirfd;
+    int                 flags;      // of the openat()/unlinkat()
+    int                 error;      // of the openat(), from its exit
+    unsigned int        pathSize;   // used part of 'path', including its terminating null
+    unsigned long long  pipId;
+    unsigned long long  timestamp;  // CLOCK_MONOTONIC, in ns
+    char                path[BXL_EBPF_PATH_MAX];
+};
+
+#endif /* BxlEbpfEvent_h */
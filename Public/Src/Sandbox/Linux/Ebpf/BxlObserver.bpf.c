@@ -0,0 +1,231 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Built with clang -target bpf against the vmlinux.h bpftool dumps from the BTF of the kernel (/sys/kernel/btf/vmlinux)
+#include "vmlinux.h"
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+
+#include "BxlEbpfEvent.h"
+
+/*
+ * Observes the file accesses of the processes of the pips whose cgroups are in 'pip_cgroups', and streams them to
+ * user space (see EbpfObserver.cpp) through 'events'.  Nothing is checked or denied here: the policies are applied
+ * in user space, which makes this an observer for report-only pips.
+ */
+
+char LICENSE[] SEC("license") = "GPL";
+
+// The observed cgroups, by id, with the pip each one belongs to
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, BXL_EBPF_MAX_PIPS);
+    __type(key, __u64);
+    __type(value, __u64);
+} pip_cgroups SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, BXL_EBPF_RING_SIZE);
+} events SEC(".maps");
+
+// How many events did not fit in 'events'
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u64);
+} dropped SEC(".maps");
+
+// The openat()'s between their entry and their exit, by thread: only the exit tells whether the path exists
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 8192);
+    __type(key, __u32);
+    __type(value, struct bxl_ebpf_event);
+} pending_opens SEC(".maps");
+
+// Where events are made: they do not fit in the 512 bytes of BPF stack
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct bxl_ebpf_event);
+} scratch SEC(".maps");
+
+static __always_inline struct bxl_ebpf_event *new_event(unsigned int kind, int pid)
+{
+    __u64 cgroup = bpf_get_current_cgroup_id();
+    __u64 *pipId = bpf_map_lookup_elem(&pip_cgroups, &cgroup);
+    if (!pipId)
+    {
+        return NULL;
+    }
+
+    __u32 zero = 0;
+    struct bxl_ebpf_event *e = bpf_map_lookup_elem(&scratch, &zero);
+    if (!e)
+    {
+        return NULL;
+    }
+
+    struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+
+    e->kind      = kind;
+    e->pid       = pid;
+    e->ppid      = BPF_CORE_READ(task, real_parent, tgid);
+    e->dirfd     = BXL_EBPF_AT_FDCWD;
+    e->flags     = 0;
+    e->error     = 0;
+    e->pathSize  = 1;
+    e->pipId     = *pipId;
+    e->timestamp = bpf_ktime_get_ns();
+    e->path[0]   = '\0';
+    return e;
+}
+
+static __always_inline struct bxl_ebpf_event *new_path_event(unsigned int kind, int dirfd, const char *path)
+{
+    struct bxl_ebpf_event *e = new_event(kind, bpf_get_current_pid_tgid() >> 32);
+    if (e)
+    {
+        e->dirfd = dirfd;
+        long size = bpf_probe_read_user_str(e->path, sizeof(e->path), path);
+        e->pathSize = size > 0 ? (unsigned int)size : 1;
+    }
+
+    return e;
+}
+
+/* Sends 'e' with only the used part of its path */
+static __always_inline void submit(struct bxl_ebpf_event *e)
+{
+    __u64 size = __builtin_offsetof(struct bxl_ebpf_event, path) + e->pathSize;
+    if (size > sizeof(*e))
+    {
+        size = sizeof(*e);
+    }
+
+    if (bpf_ringbuf_output(&events, e, size, 0) != 0)
+    {
+        __u32 zero = 0;
+        __u64 *count = bpf_map_lookup_elem(&dropped, &zero);
+        if (count)
+        {
+            __sync_fetch_and_add(count, 1);
+        }
+    }
+}
+
+SEC("tracepoint/syscalls/sys_enter_openat")
+int bxl_enter_openat(struct trace_event_raw_sys_enter *ctx)
+{
+    struct bxl_ebpf_event *e = new_path_event(BXL_EBPF_OPEN, (int)ctx->args[0], (const char *)ctx->args[1]);
+    if (e)
+    {
+        __u32 tid = (__u32)bpf_get_current_pid_tgid();
+        e->flags = (int)ctx->args[2];
+        bpf_map_update_elem(&pending_opens, &tid, e, BPF_ANY);
+    }
+
+    return 0;
+}
+
+SEC("tracepoint/syscalls/sys_exit_openat")
+int bxl_exit_openat(struct trace_event_raw_sys_exit *ctx)
+{
+    __u32 tid = (__u32)bpf_get_current_pid_tgid();
+    struct bxl_ebpf_event *e = bpf_map_lookup_elem(&pending_opens, &tid);
+    if (e)
+    {
+        e->error = ctx->ret < 0 ? (int)-ctx->ret : 0;
+        submit(e);
+        bpf_map_delete_elem(&pending_opens, &tid);
+    }
+
+    return 0;
+}
+
+SEC("tracepoint/syscalls/sys_enter_execve")
+int bxl_enter_execve(struct trace_event_raw_sys_enter *ctx)
+{
+    struct bxl_ebpf_event *e = new_path_event(BXL_EBPF_EXEC, BXL_EBPF_AT_FDCWD, (const char *)ctx->args[0]);
+    if (e)
+    {
+        submit(e);
+    }
+
+    return 0;
+}
+
+SEC("tracepoint/syscalls/sys_enter_renameat2")
+int bxl_enter_renameat2(struct trace_event_raw_sys_enter *ctx)
+{
+    struct bxl_ebpf_event *e = new_path_event(BXL_EBPF_RENAME_SOURCE, (int)ctx->args[0], (const char *)ctx->args[1]);
+    if (e)
+    {
+        submit(e);
+    }
+
+    e = new_path_event(BXL_EBPF_RENAME_DEST, (int)ctx->args[2], (const char *)ctx->args[3]);
+    if (e)
+    {
+        submit(e);
+    }
+
+    return 0;
+}
+
+SEC("tracepoint/syscalls/sys_enter_unlinkat")
+int bxl_enter_unlinkat(struct trace_event_raw_sys_enter *ctx)
+{
+    struct bxl_ebpf_event *e = new_path_event(BXL_EBPF_UNLINK, (int)ctx->args[0], (const char *)ctx->args[1]);
+    if (e)
+    {
+        e->flags = (int)ctx->args[2];
+        submit(e);
+    }
+
+    return 0;
+}
+
+// The forked child is in the cgroup of its parent, which is the current task here
+SEC("tp_btf/sched_process_fork")
+int BPF_PROG(bxl_process_fork, struct task_struct *parent, struct task_struct *child)
+{
+    // new threads are not new processes
+    if (BPF_CORE_READ(child, pid) != BPF_CORE_READ(child, tgid))
+    {
+        return 0;
+    }
+
+    struct bxl_ebpf_event *e = new_event(BXL_EBPF_FORK, BPF_CORE_READ(child, tgid));
+    if (e)
+    {
+        e->ppid = BPF_CORE_READ(parent, tgid);
+        submit(e);
+    }
+
+    return 0;
+}
+
+SEC("tp_btf/sched_process_exit")
+int BPF_PROG(bxl_process_exit, struct task_struct *task)
+{
+    __u64 pidTgid = bpf_get_current_pid_tgid();
+
+    // the exit of the leader thread stands for that of the process
+    if ((__u32)pidTgid != (pidTgid >> 32))
+    {
+        return 0;
+    }
+
+    struct bxl_ebpf_event *e = new_event(BXL_EBPF_EXIT, pidTgid >> 32);
+    if (e)
+    {
+        submit(e);
+    }
+
+    return 0;
+}
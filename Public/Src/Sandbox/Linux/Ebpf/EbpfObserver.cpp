@@ -0,0 +1,299 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "EbpfObserver.hpp"
+
+#define BXL_EBPF_AT_REMOVEDIR 0x200
+
+EbpfObserver *EbpfObserver::Create(const char *objectPath, const char *famPath)
+{
+    std::unique_ptr<EbpfObserver> observer(new EbpfObserver());
+    if (!LoadManifest(famPath, observer->payload_, observer->fam_))
+    {
+        return nullptr;
+    }
+
+    observer->pipId_ = observer->fam_.GetPipId()->PipId;
+
+    // report-only: the channel is all there is to the pip
+    if (!observer->channel_.Open(observer->fam_))
+    {
+        return nullptr;
+    }
+
+    observer->object_ = bpf_object__open_file(objectPath, nullptr);
+    if (observer->object_ == nullptr || bpf_object__load(observer->object_) != 0)
+    {
+        fprintf(stderr, "[BuildXL] Could not load the BPF program '%s': %s\n", objectPath, strerror(errno));
+        return nullptr;
+    }
+
+    struct bpf_program *program;
+    bpf_object__for_each_program(program, observer->object_)
+    {
+        // the links are destroyed with the object
+        if (bpf_program__attach(program) == nullptr)
+        {
+            fprintf(stderr, "[BuildXL] Could not attach '%s': %s\n", bpf_program__name(program), strerror(errno));
+            return nullptr;
+        }
+    }
+
+    observer->pipCgroupsFd_ = bpf_object__find_map_fd_by_name(observer->object_, "pip_cgroups");
+    observer->droppedFd_    = bpf_object__find_map_fd_by_name(observer->object_, "dropped");
+    observer->events_       = ring_buffer__new(bpf_object__find_map_fd_by_name(observer->object_, "events"),
+                                               &EbpfObserver::OnEvent, observer.get(), nullptr);
+    if (observer->pipCgroupsFd_ < 0 || observer->droppedFd_ < 0 || observer->events_ == nullptr)
+    {
+        fprintf(stderr, "[BuildXL] The BPF program '%s' does not have the maps of BxlObserver.bpf.c\n", objectPath);
+        return nullptr;
+    }
+
+    return observer.release();
+}
+
+EbpfObserver::~EbpfObserver()
+{
+    if (events_ != nullptr)
+    {
+        ring_buffer__free(events_);
+    }
+
+    if (object_ != nullptr)
+    {
+        bpf_object__close(object_);
+    }
+}
+
+bool EbpfObserver::Observe(unsigned long long cgroupId, pid_t rootPid, const char *rootImage)
+{
+    rootPid_  = rootPid;
+    cgroupId_ = cgroupId;
+    images_[rootPid] = rootImage;
+
+    unsigned long long pipId = (unsigned long long)pipId_;
+    if (bpf_map_update_elem(pipCgroupsFd_, &cgroupId_, &pipId, BPF_ANY) != 0)
+    {
+        fprintf(stderr, "[BuildXL] Could not observe cgroup %llu: %s\n", cgroupId, strerror(errno));
+        return false;
+    }
+
+    // the fork of the root happened outside of the cgroup, so the program did not see it
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    bxl_ebpf_event start;
+    memset(&start, 0, sizeof(start));
+    start.kind      = BXL_EBPF_FORK;
+    start.pid       = rootPid;
+    start.ppid      = getpid();
+    start.dirfd     = BXL_EBPF_AT_FDCWD;
+    start.timestamp = (unsigned long long)now.tv_sec * 1000000000ull + now.tv_nsec;
+    Handle(start);
+    return true;
+}
+
+int EbpfObserver::Poll(int timeoutMs)
+{
+    return ring_buffer__poll(events_, timeoutMs);
+}
+
+unsigned long long EbpfObserver::DroppedEvents() const
+{
+    unsigned int zero = 0;
+    unsigned long long dropped = 0;
+    bpf_map_lookup_elem(droppedFd_, &zero, &dropped);
+    return dropped;
+}
+
+int EbpfObserver::OnEvent(void *context, void *data, size_t size)
+{
+    if (size < offsetof(bxl_ebpf_event, path) + 1)
+    {
+        return 0;
+    }
+
+    // the path of the event is only as long as it needs to be
+    bxl_ebpf_event event;
+    memcpy(&event, data, std::min(size, sizeof(event)));
+    event.path[std::min(size - offsetof(bxl_ebpf_event, path), sizeof(event.path)) - 1] = '\0';
+
+    static_cast<EbpfObserver*>(context)->Handle(event);
+    return 0;
+}
+
+bool EbpfObserver::ResolvePath(const bxl_ebpf_event &event, char *buffer, size_t bufferSize) const
+{
+    if (event.path[0] == '\0')
+    {
+        return false;
+    }
+
+    ssize_t length = 0;
+    if (event.path[0] != '/')
+    {
+        char base[64];
+        if (event.dirfd == BXL_EBPF_AT_FDCWD)
+        {
+            snprintf(base, sizeof(base), "/proc/%d/cwd", event.pid);
+        }
+        else
+        {
+            snprintf(base, sizeof(base), "/proc/%d/fd/%d", event.pid, event.dirfd);
+        }
+
+        // fails if the process is gone by now, in which case the access goes unreported
+        length = readlink(base, buffer, bufferSize - 1);
+        if (length <= 0 || buffer[0] != '/')
+        {
+            return false;
+        }
+    }
+
+    return AppendNormalizedPath(buffer, length, event.path, bufferSize);
+}
+
+static bool IsDirectory(const char *path)
+{
+    struct stat st;
+    return lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void EbpfObserver::Handle(const bxl_ebpf_event &event)
+{
+    if (event.kind == BXL_EBPF_FORK || event.kind == BXL_EBPF_EXIT)
+    {
+        bool start = event.kind == BXL_EBPF_FORK;
+        std::string &image = images_[event.pid];
+        if (start && image.empty())
+        {
+            auto parent = images_.find(event.ppid);
+            if (parent != images_.end())
+            {
+                image = parent->second;
+            }
+            else
+            {
+                char exe[64], path[PATH_MAX];
+                snprintf(exe, sizeof(exe), "/proc/%d/exe", event.pid);
+                ssize_t length = readlink(exe, path, sizeof(path) - 1);
+                image.assign(path, length > 0 ? length : 0);
+            }
+        }
+
+        AccessCheckResult allowed(start ? RequestedAccess::Read : RequestedAccess::None, ResultAction::Allow, ReportLevel::Report);
+        Report(start ? kOpProcessStart : kOpProcessExit, event, image.c_str(), allowed);
+
+        if (!start)
+        {
+            images_.erase(event.pid);
+        }
+
+        return;
+    }
+
+    char path[PATH_MAX];
+    if (!ResolvePath(event, path, sizeof(path)))
+    {
+        return;
+    }
+
+    switch (event.kind)
+    {
+        case BXL_EBPF_OPEN:
+            if ((event.flags & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC | O_APPEND)) != 0)
+            {
+                CheckAndReport(kOpKAuthVNodeWrite, event, path, Checkers::CheckWrite, false);
+            }
+            else if (event.error == ENOENT || event.error == ENOTDIR)
+            {
+                CheckAndReport(kOpMacLookup, event, path, Checkers::CheckLookup, false);
+            }
+            else if (event.error == 0)
+            {
+                bool isDirectory = (event.flags & O_DIRECTORY) != 0 || IsDirectory(path);
+                if (isDirectory)
+                {
+                    CheckAndReport(kOpKAuthOpenDir, event, path, Checkers::CheckEnumerateDir, true);
+                }
+                else
+                {
+                    CheckAndReport(kOpKAuthReadFile, event, path, Checkers::CheckRead, false);
+                }
+            }
+            break;
+
+        case BXL_EBPF_EXEC:
+            images_[event.pid] = path;
+            CheckAndReport(kOpKAuthVNodeExecute, event, path, Checkers::CheckExecute, false);
+            break;
+
+        case BXL_EBPF_RENAME_SOURCE:
+            CheckAndReport(kOpKAuthMoveSource, event, path, Checkers::CheckRead, IsDirectory(path));
+            break;
+
+        case BXL_EBPF_RENAME_DEST:
+            CheckAndReport(kOpKAuthMoveDest, event, path, Checkers::CheckWrite, IsDirectory(path));
+            break;
+
+        case BXL_EBPF_UNLINK:
+            if ((event.flags & BXL_EBPF_AT_REMOVEDIR) != 0)
+            {
+                CheckAndReport(kOpKAuthDeleteDir, event, path, Checkers::CheckWrite, true);
+            }
+            else
+            {
+                CheckAndReport(kOpKAuthDeleteFile, event, path, Checkers::CheckWrite, false);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+void EbpfObserver::CheckAndReport(FileOperation operation, const bxl_ebpf_event &event, const char *path, CheckFunc checker, bool isDirectory)
+{
+    AccessCheckResult result = CheckAccess(fam_, path, checker, isDirectory);
+    if (result.ShouldReport() && channel_.CheckAndUpdate(path, (DWORD)result.RequestedAccess))
+    {
+        Report(operation, event, path, result);
+    }
+}
+
+void EbpfObserver::Report(FileOperation operation, const bxl_ebpf_event &event, const char *path, const AccessCheckResult &result)
+{
+    size_t pathLength = strlen(path);
+    if (pathLength >= PATH_MAX)
+    {
+        return;
+    }
+
+    AccessReport report;
+    report.operation          = operation;
+    report.pid                = event.pid;
+    report.rootPid            = rootPid_;
+    report.requestedAccess    = (DWORD)result.RequestedAccess;
+    report.status             = result.GetFileAccessStatus();
+    report.reportExplicitly   = result.ReportLevel == ReportLevel::ReportExplicit;
+    report.error              = event.error;
+    report.pipId              = pipId_;
+    report.stats              = { .creationTime = event.timestamp, .enqueueTime = 0, .dequeueTime = 0 };
+    report.fileIdentity       = { .volume = 0, .file = 0 };
+    memcpy(report.path, path, pathLength + 1);
+
+    channel_.Send(report);
+}
@@ -0,0 +1,73 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef EbpfObserver_hpp
+#define EbpfObserver_hpp
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "BxlEbpfEvent.h"
+#include "ReportChannel.hpp"
+#include "SandboxCommon.hpp"
+
+struct bpf_object;
+struct ring_buffer;
+
+/*!
+ * The user-space side of the eBPF observer (see BxlObserver.bpf.c): turns the calls of the processes in the cgroup
+ * of a pip into checked AccessReport's, sent to the same channel the interposing sandbox sends them to.
+ *
+ * Unlike the interposing sandbox this sees statically linked tools too, but it cannot deny anything: it is for
+ * report-only pips.  Paths are resolved against the working directory and descriptors of a process when its calls
+ * are handled, i.e., slightly after they are made, and the reports are deduplicated per pip rather than per process.
+ */
+class EbpfObserver
+{
+private:
+
+    std::unique_ptr<BYTE[]> payload_;
+    FileAccessManifestParseResult fam_;
+    pipid_t pipId_;
+    pid_t rootPid_;
+    ReportChannel channel_;
+
+    struct bpf_object *object_;
+    struct ring_buffer *events_;
+    int pipCgroupsFd_;
+    int droppedFd_;
+    unsigned long long cgroupId_;
+
+    /*! The image each process of the pip runs, by pid, for the reports of its exit */
+    std::unordered_map<pid_t, std::string> images_;
+
+    EbpfObserver() : pipId_(0), rootPid_(0), object_(nullptr), events_(nullptr), pipCgroupsFd_(-1), droppedFd_(-1), cgroupId_(0) {}
+
+    static int OnEvent(void *context, void *data, size_t size);
+    void Handle(const bxl_ebpf_event &event);
+    bool ResolvePath(const bxl_ebpf_event &event, char *buffer, size_t bufferSize) const;
+    void CheckAndReport(FileOperation operation, const bxl_ebpf_event &event, const char *path, CheckFunc checker, bool isDirectory);
+    void Report(FileOperation operation, const bxl_ebpf_event &event, const char *path, const AccessCheckResult &result);
+
+public:
+
+    ~EbpfObserver();
+
+    /*!
+     * Loads and attaches the BPF program in 'objectPath' for the pip whose manifest is in 'famPath'.  Returns nullptr
+     * (printing why) if that fails, e.g., for want of privileges (CAP_BPF and CAP_PERFMON).
+     */
+    static EbpfObserver *Create(const char *objectPath, const char *famPath);
+
+    /*! Starts observing the processes in the cgroup 'cgroupId', the first of which is 'rootPid' running 'rootImage' */
+    bool Observe(unsigned long long cgroupId, pid_t rootPid, const char *rootImage);
+
+    /*! Handles the events that arrive within 'timeoutMs'. Returns the number handled, or a negative errno. */
+    int Poll(int timeoutMs);
+
+    /*! How many events the kernel could not hand over because the ring was full */
+    unsigned long long DroppedEvents() const;
+};
+
+#endif /* EbpfObserver_hpp */
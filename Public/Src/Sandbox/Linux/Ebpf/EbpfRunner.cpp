@@ -0,0 +1,137 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <string>
+
+#include "EbpfObserver.hpp"
+
+/*
+ * Runs a report-only pip under the eBPF observer:
+ *
+ *     bxl-ebpf-runner <BPF object> <parent cgroup> <program> [<arguments>...]
+ *
+ * with the manifest of the pip in __BUILDXL_FAM_PATH, like for the interposing sandbox.  The program runs in a cgroup
+ * of its own under <parent cgroup> (a cgroup v2 directory the runner may create cgroups in), which its children stay
+ * in: that is what the BPF program filters on.  The runner exits like the program does, once the cgroup is empty.
+ */
+
+#define BxlEnvFamPath "__BUILDXL_FAM_PATH"
+
+static bool WriteFile(const std::string &path, const char *content)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    bool written = fd >= 0 && write(fd, content, strlen(content)) == (ssize_t)strlen(content);
+    if (fd >= 0) close(fd);
+    return written;
+}
+
+static bool IsPopulated(const std::string &cgroup)
+{
+    char events[256] = { 0 };
+    int fd = open((cgroup + "/cgroup.events").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    ssize_t length = read(fd, events, sizeof(events) - 1);
+    close(fd);
+    return length > 0 && strstr(events, "populated 1") != nullptr;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "Usage: %s <BPF object> <parent cgroup> <program> [<arguments>...]\n", argv[0]);
+        return 2;
+    }
+
+    const char *famPath = getenv(BxlEnvFamPath);
+    if (famPath == nullptr)
+    {
+        fprintf(stderr, "[BuildXL] %s is not set\n", BxlEnvFamPath);
+        return 2;
+    }
+
+    std::unique_ptr<EbpfObserver> observer(EbpfObserver::Create(argv[1], famPath));
+    if (observer == nullptr)
+    {
+        return 3;
+    }
+
+    // the id of a cgroup v2 is the inode number of its directory
+    std::string cgroup = std::string(argv[2]) + "/bxl-" + std::to_string(getpid());
+    struct stat st;
+    if (mkdir(cgroup.c_str(), 0755) != 0 || stat(cgroup.c_str(), &st) != 0)
+    {
+        fprintf(stderr, "[BuildXL] Could not create the cgroup '%s': %s\n", cgroup.c_str(), strerror(errno));
+        return 3;
+    }
+
+    // the child waits for the observer to know about its cgroup before it runs anything
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) != 0)
+    {
+        return 3;
+    }
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        char go;
+        close(ready[1]);
+        if (!WriteFile(cgroup + "/cgroup.procs", "0") || read(ready[0], &go, 1) != 1)
+        {
+            _exit(127);
+        }
+
+        execvp(argv[3], argv + 3);
+        fprintf(stderr, "[BuildXL] Could not run '%s': %s\n", argv[3], strerror(errno));
+        _exit(127);
+    }
+
+    close(ready[0]);
+    if (child < 0 || !observer->Observe(st.st_ino, child, argv[3]))
+    {
+        if (child > 0) kill(child, SIGKILL);
+        rmdir(cgroup.c_str());
+        return 3;
+    }
+
+    write(ready[1], "g", 1);
+    close(ready[1]);
+
+    int status = 0;
+    bool exited = false;
+    while (!exited || IsPopulated(cgroup))
+    {
+        observer->Poll(/*timeoutMs*/ 100);
+        if (!exited && waitpid(child, &status, WNOHANG) == child)
+        {
+            exited = true;
+        }
+    }
+
+    // what the last processes did before the cgroup emptied
+    while (observer->Poll(/*timeoutMs*/ 0) > 0);
+
+    unsigned long long dropped = observer->DroppedEvents();
+    if (dropped > 0)
+    {
+        fprintf(stderr, "[BuildXL] %llu events did not fit in the ring of the BPF program: the reports are incomplete\n", dropped);
+    }
+
+    rmdir(cgroup.c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
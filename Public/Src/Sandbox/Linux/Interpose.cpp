@@ -0,0 +1,636 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// the fortified wrappers of open() and friends are inline definitions, which the ones below would clash with
+#undef _FORTIFY_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "BxlObserver.hpp"
+
+/*
+ * The libc functions the sandbox interposes when it is LD_PRELOAD'ed, modeled on the operations the macOS sandbox
+ * observes (see EndpointSecurity.cpp):
+ *
+ *   - calls that only read (opens for reading, probes, readlink, opendir) are made first and checked after, since their
+ *     outcome tells whether the path exists and what it is; a denied one is undone and fails with EPERM,
+ *   - calls that change the file system are checked first, and not made at all if denied,
+ *   - exec's are reported as executions of their image, with the sandbox passed on in the environment,
+ *   - the start of a process is reported when the library is loaded into it, and when it forks; its exit when it
+ *     exits normally (not when it is killed).
+ *
+ * Calls glibc makes internally (e.g., the spawn of system()) do not go through these.
+ */
+
+extern "C" {
+    // stat() and friends of the binaries linked against a glibc older than 2.33
+    int __xstat(int ver, const char *path, struct stat *buf);
+    int __lxstat(int ver, const char *path, struct stat *buf);
+    int __fxstatat(int ver, int dirfd, const char *path, struct stat *buf, int flags);
+    int __xstat64(int ver, const char *path, struct stat64 *buf);
+    int __lxstat64(int ver, const char *path, struct stat64 *buf);
+    int __fxstatat64(int ver, int dirfd, const char *path, struct stat64 *buf, int flags);
+
+    // what _FORTIFY_SOURCE makes open() and friends call
+    int __open_2(const char *path, int flags);
+    int __open64_2(const char *path, int flags);
+    int __openat_2(int dirfd, const char *path, int flags);
+    int __openat64_2(int dirfd, const char *path, int flags);
+}
+
+#pragma mark Checks
+
+/*!
+ * Checks and reports an access of 'path' (relative to 'dirfd').  Returns false, with errno set, if it has to be denied.
+ */
+static bool Check(FileOperation operation, int dirfd, const char *path, CheckFunc checker, bool isDirectory, int error = 0)
+{
+    BxlObserver *observer = BxlObserver::GetInstance();
+    char normalized[PATH_MAX];
+    if (!observer->IsEnabled() || !observer->NormalizePath(dirfd, path, normalized, sizeof(normalized)))
+    {
+        return true;
+    }
+
+    if (observer->CheckAndReport(operation, normalized, checker, isDirectory, error).ShouldDenyAccess())
+    {
+        errno = EPERM;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * Checks a call that only read 'path' and succeeded ('failed' is false) or failed with 'error'.  A failure because
+ * the path does not exist is checked as a lookup; other failures are not checked.
+ */
+static bool CheckAfter(FileOperation operation, int dirfd, const char *path, CheckFunc checker, bool isDirectory, bool failed, int error)
+{
+    if (!failed)
+    {
+        return Check(operation, dirfd, path, checker, isDirectory);
+    }
+
+    if (error == ENOENT || error == ENOTDIR)
+    {
+        return Check(kOpMacLookup, dirfd, path, Checkers::CheckLookup, false, error);
+    }
+
+    return true;
+}
+
+static bool IsDirectoryAt(int dirfd, const char *path)
+{
+    struct stat st;
+    return BxlObserver::GetInstance()->IsEnabled()
+        && REAL(fstatat)(dirfd, path, &st, AT_SYMLINK_NOFOLLOW) == 0
+        && S_ISDIR(st.st_mode);
+}
+
+static bool OpensForWrite(int flags)
+{
+    return (flags & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC | O_APPEND)) != 0;
+}
+
+static CheckFunc DirectoryCreationChecker()
+{
+    BxlObserver *observer = BxlObserver::GetInstance();
+    return observer->IsEnabled() && CheckDirectoryCreationAccessEnforcement(observer->GetFamFlags())
+        ? Checkers::CheckCreateDirectory
+        : Checkers::CheckProbe;
+}
+
+static void CloseDescriptor(int fd)
+{
+    REAL(close)(fd);
+}
+
+/*!
+ * An open of 'path' with 'flags', made by 'open' if allowed: checked before if it may write, and after otherwise, in
+ * which case 'close' undoes a denied one.
+ */
+template <typename OpenFunc, typename CloseFunc = void (*)(int)>
+static int CheckedOpen(int dirfd, const char *path, int flags, OpenFunc open, CloseFunc close = CloseDescriptor)
+{
+    if (OpensForWrite(flags))
+    {
+        // O_TMPFILE names the directory an unnamed file is made in, which becomes visible only when linked
+        bool unnamed = (flags & O_TMPFILE) == O_TMPFILE;
+        if (!unnamed && !Check(kOpKAuthVNodeWrite, dirfd, path, Checkers::CheckWrite, false))
+        {
+            return -1;
+        }
+
+        return open();
+    }
+
+    int fd = open();
+    int error = errno;
+
+    bool isDirectory = false;
+    if (fd >= 0 && BxlObserver::GetInstance()->IsEnabled())
+    {
+        struct stat st;
+        isDirectory = fstat(fd, &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    bool allowed = isDirectory
+        ? CheckAfter(kOpKAuthOpenDir, dirfd, path, Checkers::CheckEnumerateDir, true, fd < 0, error)
+        : CheckAfter(kOpKAuthReadFile, dirfd, path, Checkers::CheckRead, false, fd < 0, error);
+
+    if (!allowed)
+    {
+        if (fd >= 0) close(fd);
+        errno = EPERM;
+        return -1;
+    }
+
+    errno = error;
+    return fd;
+}
+
+static mode_t ModeOf(const struct stat *st)    { return st->st_mode; }
+static mode_t ModeOf(const struct stat64 *st)  { return st->st_mode; }
+static mode_t ModeOf(const struct statx *st)   { return st->stx_mode; }
+
+/*!
+ * A probe of 'path' made by 'probe', which fills in 'st' (when not null) on success.
+ */
+template <typename ProbeFunc, typename Stat>
+static int CheckedProbe(int dirfd, const char *path, Stat *st, ProbeFunc probe)
+{
+    int result = probe();
+    int error = errno;
+
+    bool isDirectory = result == 0 && st != nullptr && S_ISDIR(ModeOf(st));
+    if (!CheckAfter(kOpKAuthVNodeProbe, dirfd, path, Checkers::CheckProbe, isDirectory, result != 0, error))
+    {
+        return -1;
+    }
+
+    errno = error;
+    return result;
+}
+
+#pragma mark Opens
+
+static int ModeArgument(int flags, va_list args)
+{
+    return (flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE ? va_arg(args, int) : 0;
+}
+
+#define DEFINE_OPEN(name) \
+    int name(const char *path, int flags, ...) \
+    { \
+        va_list args; va_start(args, flags); int mode = ModeArgument(flags, args); va_end(args); \
+        return CheckedOpen(AT_FDCWD, path, flags, [&]() { return REAL(name)(path, flags, mode); }); \
+    }
+
+#define DEFINE_OPENAT(name) \
+    int name(int dirfd, const char *path, int flags, ...) \
+    { \
+        va_list args; va_start(args, flags); int mode = ModeArgument(flags, args); va_end(args); \
+        return CheckedOpen(dirfd, path, flags, [&]() { return REAL(name)(dirfd, path, flags, mode); }); \
+    }
+
+#define DEFINE_OPEN_2(name) \
+    int name(const char *path, int flags) \
+    { \
+        return CheckedOpen(AT_FDCWD, path, flags, [&]() { return REAL(name)(path, flags); }); \
+    }
+
+#define DEFINE_OPENAT_2(name) \
+    int name(int dirfd, const char *path, int flags) \
+    { \
+        return CheckedOpen(dirfd, path, flags, [&]() { return REAL(name)(dirfd, path, flags); }); \
+    }
+
+#define DEFINE_CREAT(name, openName) \
+    int name(const char *path, mode_t mode) \
+    { \
+        return CheckedOpen(AT_FDCWD, path, O_CREAT | O_WRONLY | O_TRUNC, [&]() { return REAL(openName)(path, O_CREAT | O_WRONLY | O_TRUNC, mode); }); \
+    }
+
+static int FopenFlags(const char *mode)
+{
+    return mode[0] == 'r' && strchr(mode, '+') == nullptr ? O_RDONLY : O_WRONLY;
+}
+
+#define DEFINE_FOPEN(name) \
+    FILE *name(const char *path, const char *mode) \
+    { \
+        FILE *file = nullptr; \
+        int fd = CheckedOpen(AT_FDCWD, path, FopenFlags(mode), [&]() \
+        { \
+            file = REAL(name)(path, mode); \
+            return file != nullptr ? fileno(file) : -1; \
+        }, [&](int) { REAL(fclose)(file); }); \
+        return fd < 0 ? nullptr : file; \
+    }
+
+extern "C" {
+
+DEFINE_OPEN(open)
+DEFINE_OPEN(open64)
+DEFINE_OPENAT(openat)
+DEFINE_OPENAT(openat64)
+DEFINE_OPEN_2(__open_2)
+DEFINE_OPEN_2(__open64_2)
+DEFINE_OPENAT_2(__openat_2)
+DEFINE_OPENAT_2(__openat64_2)
+DEFINE_CREAT(creat, open)
+DEFINE_CREAT(creat64, open64)
+DEFINE_FOPEN(fopen)
+DEFINE_FOPEN(fopen64)
+
+DIR *opendir(const char *path)
+{
+    DIR *dir = REAL(opendir)(path);
+    int error = errno;
+
+    if (!CheckAfter(kOpKAuthOpenDir, AT_FDCWD, path, Checkers::CheckEnumerateDir, true, dir == nullptr, error))
+    {
+        if (dir != nullptr) REAL(closedir)(dir);
+        errno = EPERM;
+        return nullptr;
+    }
+
+    errno = error;
+    return dir;
+}
+
+#pragma mark Probes
+
+int stat(const char *path, struct stat *buf) noexcept
+{
+    return CheckedProbe(AT_FDCWD, path, buf, [&]() { return REAL(stat)(path, buf); });
+}
+
+int lstat(const char *path, struct stat *buf) noexcept
+{
+    return CheckedProbe(AT_FDCWD, path, buf, [&]() { return REAL(lstat)(path, buf); });
+}
+
+int stat64(const char *path, struct stat64 *buf) noexcept
+{
+    return CheckedProbe(AT_FDCWD, path, buf, [&]() { return REAL(stat64)(path, buf); });
+}
+
+int lstat64(const char *path, struct stat64 *buf) noexcept
+{
+    return CheckedProbe(AT_FDCWD, path, buf, [&]() { return REAL(lstat64)(path, buf); });
+}
+
+int fstatat(int dirfd, const char *path, struct stat *buf, int flags) noexcept
+{
+    return CheckedProbe(dirfd, path, buf, [&]() { return REAL(fstatat)(dirfd, path, buf, flags); });
+}
+
+int fstatat64(int dirfd, const char *path, struct stat64 *buf, int flags) noexcept
+{
+    return CheckedProbe(dirfd, path, buf, [&]() { return REAL(fstatat64)(dirfd, path, buf, flags); });
+}
+
+int __xstat(int ver, const char *path, struct stat *buf)
+{
+    return CheckedProbe(AT_FDCWD, path, buf, [&]() { return REAL(__xstat)(ver, path, buf); });
+}
+
+int __lxstat(int ver, const char *path, struct stat *buf)
+{
+    return CheckedProbe(AT_FDCWD, path, buf, [&]() { return REAL(__lxstat)(ver, path, buf); });
+}
+
+int __fxstatat(int ver, int dirfd, const char *path, struct stat *buf, int flags)
+{
+    return CheckedProbe(dirfd, path, buf, [&]() { return REAL(__fxstatat)(ver, dirfd, path, buf, flags); });
+}
+
+int __xstat64(int ver, const char *path, struct stat64 *buf)
+{
+    return CheckedProbe(AT_FDCWD, path, buf, [&]() { return REAL(__xstat64)(ver, path, buf); });
+}
+
+int __lxstat64(int ver, const char *path, struct stat64 *buf)
+{
+    return CheckedProbe(AT_FDCWD, path, buf, [&]() { return REAL(__lxstat64)(ver, path, buf); });
+}
+
+int __fxstatat64(int ver, int dirfd, const char *path, struct stat64 *buf, int flags)
+{
+    return CheckedProbe(dirfd, path, buf, [&]() { return REAL(__fxstatat64)(ver, dirfd, path, buf, flags); });
+}
+
+// what the stat() and friends of coreutils (and of glibc itself, since 2.33) call when the kernel has it
+int statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *buf) noexcept
+{
+    return CheckedProbe(dirfd, path, buf, [&]() { return REAL(statx)(dirfd, path, flags, mask, buf); });
+}
+
+int access(const char *path, int mode) noexcept
+{
+    return CheckedProbe(AT_FDCWD, path, (struct stat *)nullptr, [&]() { return REAL(access)(path, mode); });
+}
+
+int faccessat(int dirfd, const char *path, int mode, int flags) noexcept
+{
+    return CheckedProbe(dirfd, path, (struct stat *)nullptr, [&]() { return REAL(faccessat)(dirfd, path, mode, flags); });
+}
+
+ssize_t readlinkat(int dirfd, const char *path, char *buf, size_t bufsize) noexcept
+{
+    ssize_t result = REAL(readlinkat)(dirfd, path, buf, bufsize);
+    int error = errno;
+
+    if (!CheckAfter(kOpMacReadlink, dirfd, path, Checkers::CheckRead, false, result < 0, error))
+    {
+        return -1;
+    }
+
+    errno = error;
+    return result;
+}
+
+ssize_t readlink(const char *path, char *buf, size_t bufsize) noexcept
+{
+    return readlinkat(AT_FDCWD, path, buf, bufsize);
+}
+
+#pragma mark Writes
+
+int truncate(const char *path, off_t length) noexcept
+{
+    return Check(kOpKAuthVNodeWrite, AT_FDCWD, path, Checkers::CheckWrite, false) ? REAL(truncate)(path, length) : -1;
+}
+
+int truncate64(const char *path, off64_t length) noexcept
+{
+    return Check(kOpKAuthVNodeWrite, AT_FDCWD, path, Checkers::CheckWrite, false) ? REAL(truncate64)(path, length) : -1;
+}
+
+int mkdirat(int dirfd, const char *path, mode_t mode) noexcept
+{
+    return Check(kOpMacVNodeCreate, dirfd, path, DirectoryCreationChecker(), true) ? REAL(mkdirat)(dirfd, path, mode) : -1;
+}
+
+int mkdir(const char *path, mode_t mode) noexcept
+{
+    return Check(kOpMacVNodeCreate, AT_FDCWD, path, DirectoryCreationChecker(), true) ? REAL(mkdir)(path, mode) : -1;
+}
+
+int unlinkat(int dirfd, const char *path, int flags) noexcept
+{
+    bool isDirectory = (flags & AT_REMOVEDIR) != 0;
+    return Check(isDirectory ? kOpKAuthDeleteDir : kOpKAuthDeleteFile, dirfd, path, Checkers::CheckWrite, isDirectory)
+        ? REAL(unlinkat)(dirfd, path, flags)
+        : -1;
+}
+
+int unlink(const char *path) noexcept
+{
+    return Check(kOpKAuthDeleteFile, AT_FDCWD, path, Checkers::CheckWrite, false) ? REAL(unlink)(path) : -1;
+}
+
+int rmdir(const char *path) noexcept
+{
+    return Check(kOpKAuthDeleteDir, AT_FDCWD, path, Checkers::CheckWrite, true) ? REAL(rmdir)(path) : -1;
+}
+
+static bool CheckMove(int olddirfd, const char *oldpath, int newdirfd, const char *newpath)
+{
+    bool isDirectory = IsDirectoryAt(olddirfd, oldpath);
+    return Check(kOpKAuthMoveSource, olddirfd, oldpath, Checkers::CheckRead, isDirectory)
+        && Check(kOpKAuthMoveDest, newdirfd, newpath, Checkers::CheckWrite, isDirectory);
+}
+
+int renameat2(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags) noexcept
+{
+    return CheckMove(olddirfd, oldpath, newdirfd, newpath) ? REAL(renameat2)(olddirfd, oldpath, newdirfd, newpath, flags) : -1;
+}
+
+int renameat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath) noexcept
+{
+    return CheckMove(olddirfd, oldpath, newdirfd, newpath) ? REAL(renameat)(olddirfd, oldpath, newdirfd, newpath) : -1;
+}
+
+int rename(const char *oldpath, const char *newpath) noexcept
+{
+    return CheckMove(AT_FDCWD, oldpath, AT_FDCWD, newpath) ? REAL(rename)(oldpath, newpath) : -1;
+}
+
+static bool CheckLink(int olddirfd, const char *oldpath, int newdirfd, const char *newpath)
+{
+    return Check(kOpKAuthCreateHardlinkSource, olddirfd, oldpath, Checkers::CheckRead, false)
+        && Check(kOpKAuthCreateHardlinkDest, newdirfd, newpath, Checkers::CheckWrite, false);
+}
+
+int linkat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags) noexcept
+{
+    return CheckLink(olddirfd, oldpath, newdirfd, newpath) ? REAL(linkat)(olddirfd, oldpath, newdirfd, newpath, flags) : -1;
+}
+
+int link(const char *oldpath, const char *newpath) noexcept
+{
+    return CheckLink(AT_FDCWD, oldpath, AT_FDCWD, newpath) ? REAL(link)(oldpath, newpath) : -1;
+}
+
+int symlinkat(const char *target, int newdirfd, const char *linkpath) noexcept
+{
+    return Check(kOpMacVNodeCreate, newdirfd, linkpath, Checkers::CheckCreateSymlink, false)
+        ? REAL(symlinkat)(target, newdirfd, linkpath)
+        : -1;
+}
+
+int symlink(const char *target, const char *linkpath) noexcept
+{
+    return Check(kOpMacVNodeCreate, AT_FDCWD, linkpath, Checkers::CheckCreateSymlink, false)
+        ? REAL(symlink)(target, linkpath)
+        : -1;
+}
+
+#pragma mark Processes
+
+/*!
+ * Resolves 'file' against PATH the way execvp() does, so that the execution is reported for the image that runs.
+ */
+static const char *ResolveExecutable(const char *file, char *buffer, size_t bufferSize)
+{
+    if (strchr(file, '/') != nullptr || !BxlObserver::GetInstance()->IsEnabled())
+    {
+        return file;
+    }
+
+    const char *path = getenv("PATH");
+    for (const char *dir = path != nullptr ? path : "/bin:/usr/bin"; *dir != '\0'; )
+    {
+        const char *end = strchrnul(dir, ':');
+        int length = snprintf(buffer, bufferSize, "%.*s/%s", (int)(end - dir), dir, file);
+        if (length > 0 && (size_t)length < bufferSize && REAL(access)(buffer, X_OK) == 0)
+        {
+            return buffer;
+        }
+
+        dir = *end == ':' ? end + 1 : end;
+    }
+
+    return file;
+}
+
+int execve(const char *file, char *const argv[], char *const envp[]) noexcept
+{
+    if (!Check(kOpKAuthVNodeExecute, AT_FDCWD, file, Checkers::CheckExecute, false))
+    {
+        return -1;
+    }
+
+    std::vector<char*> env;
+    return REAL(execve)(file, argv, BxlObserver::GetInstance()->EnsureEnvironment(envp, env));
+}
+
+int execvpe(const char *file, char *const argv[], char *const envp[]) noexcept
+{
+    char resolved[PATH_MAX];
+    if (!Check(kOpKAuthVNodeExecute, AT_FDCWD, ResolveExecutable(file, resolved, sizeof(resolved)), Checkers::CheckExecute, false))
+    {
+        return -1;
+    }
+
+    std::vector<char*> env;
+    return REAL(execvpe)(file, argv, BxlObserver::GetInstance()->EnsureEnvironment(envp, env));
+}
+
+int execv(const char *file, char *const argv[]) noexcept
+{
+    return execve(file, argv, environ);
+}
+
+int execvp(const char *file, char *const argv[]) noexcept
+{
+    return execvpe(file, argv, environ);
+}
+
+/*! The arguments of an execl*() after 'arg0', up to and including the terminating null (and the environment after it if 'envp') */
+static std::vector<char*> VariadicArguments(const char *arg0, va_list args, char *const **envp)
+{
+    std::vector<char*> argv { const_cast<char*>(arg0) };
+    while (argv.back() != nullptr)
+    {
+        argv.push_back(va_arg(args, char*));
+    }
+
+    if (envp != nullptr)
+    {
+        *envp = va_arg(args, char *const *);
+    }
+
+    return argv;
+}
+
+int execl(const char *file, const char *arg0, ...) noexcept
+{
+    va_list args; va_start(args, arg0);
+    std::vector<char*> argv = VariadicArguments(arg0, args, nullptr);
+    va_end(args);
+    return execve(file, argv.data(), environ);
+}
+
+int execlp(const char *file, const char *arg0, ...) noexcept
+{
+    va_list args; va_start(args, arg0);
+    std::vector<char*> argv = VariadicArguments(arg0, args, nullptr);
+    va_end(args);
+    return execvpe(file, argv.data(), environ);
+}
+
+int execle(const char *file, const char *arg0, ...) noexcept
+{
+    char *const *envp;
+    va_list args; va_start(args, arg0);
+    std::vector<char*> argv = VariadicArguments(arg0, args, &envp);
+    va_end(args);
+    return execve(file, argv.data(), envp);
+}
+
+int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *fileActions,
+                const posix_spawnattr_t *attributes, char *const argv[], char *const envp[])
+{
+    if (!Check(kOpKAuthVNodeExecute, AT_FDCWD, path, Checkers::CheckExecute, false))
+    {
+        return EPERM;
+    }
+
+    std::vector<char*> env;
+    return REAL(posix_spawn)(pid, path, fileActions, attributes, argv, BxlObserver::GetInstance()->EnsureEnvironment(envp, env));
+}
+
+int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *fileActions,
+                 const posix_spawnattr_t *attributes, char *const argv[], char *const envp[])
+{
+    char resolved[PATH_MAX];
+    if (!Check(kOpKAuthVNodeExecute, AT_FDCWD, ResolveExecutable(file, resolved, sizeof(resolved)), Checkers::CheckExecute, false))
+    {
+        return EPERM;
+    }
+
+    std::vector<char*> env;
+    return REAL(posix_spawnp)(pid, file, fileActions, attributes, argv, BxlObserver::GetInstance()->EnsureEnvironment(envp, env));
+}
+
+pid_t fork(void) noexcept
+{
+    pid_t pid = REAL(fork)();
+    if (pid == 0)
+    {
+        BxlObserver::GetInstance()->ReportProcess(kOpProcessStart);
+    }
+
+    return pid;
+}
+
+// the child of a vfork() may only exec or _exit, which a forked child can do just as well
+pid_t vfork(void) noexcept
+{
+    return fork();
+}
+
+void _exit(int status)
+{
+    BxlObserver::GetInstance()->ReportProcess(kOpProcessExit);
+    REAL(_exit)(status);
+    __builtin_unreachable();
+}
+
+} // extern "C"
+
+#pragma mark Library lifetime
+
+static void OnForkChild()
+{
+    BxlObserver::GetInstance()->OnForkChild();
+}
+
+__attribute__((constructor)) static void OnLoad()
+{
+    BxlObserver *observer = BxlObserver::GetInstance();
+    if (observer->IsEnabled())
+    {
+        pthread_atfork(nullptr, nullptr, OnForkChild);
+        observer->ReportProcess(kOpProcessStart);
+    }
+}
+
+__attribute__((destructor)) static void OnUnload()
+{
+    BxlObserver::GetInstance()->ReportProcess(kOpProcessExit);
+}
@@ -0,0 +1,107 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+
+#include "ReportChannel.hpp"
+
+bool ReportChannel::Open(const FileAccessManifestParseResult &fam)
+{
+    int reportPathLength;
+    const char *reportPathChars = fam.GetProcessPath(&reportPathLength);
+    std::string reportPath(reportPathChars, strnlen(reportPathChars, std::max(reportPathLength, 0)));
+
+    if (reportPath.empty())
+    {
+        fprintf(stderr, "[BuildXL] The file access manifest has no report path\n");
+        return false;
+    }
+
+    if (CheckUseReportRingBuffer(fam.GetFamExtraFlags()))
+    {
+        // shared memory object names have a single, leading '/'
+        std::string ringName = reportPath;
+        std::replace(ringName.begin(), ringName.end(), '/', '_');
+        ringName.insert(0, "/");
+        ringName.append(REPORT_RING_NAME_SUFFIX);
+
+        ring_ = ReportRing::Open(ringName.c_str());
+    }
+
+    // when the report file is the FIFO of SandboxedProcessLinux, a process that starts after the reader got to the end of
+    // the reports (i.e., after all other processes of the pip exited) must not block here; its reports are lost (ENXIO)
+    fd_ = REAL(open)(reportPath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC | O_NONBLOCK);
+    if (fd_ >= 0)
+    {
+        // reports are not dropped when the FIFO is full
+        fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_NONBLOCK);
+    }
+
+    if (fd_ < 0 && ring_ == nullptr)
+    {
+        fprintf(stderr, "[BuildXL] Could not open the report file '%s': %s\n", reportPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+void ReportChannel::OnForkChild()
+{
+    // the lock may have been held by a thread that does not exist in the child
+    new (&reportedLock_) std::mutex();
+}
+
+/*!
+ * CODESYNC: CacheRecord::Check and CacheRecord::Update
+ */
+bool ReportChannel::CheckAndUpdate(const char *path, DWORD requestedAccess)
+{
+    const DWORD LookupProbe     = (DWORD)(RequestedAccess::Lookup | RequestedAccess::Probe);
+    const DWORD LookupProbeRead = LookupProbe | (DWORD)RequestedAccess::Read;
+
+    DWORD implied = 0;
+    if (HasAllFlags(requestedAccess, (DWORD)RequestedAccess::Probe)) implied |= (DWORD)RequestedAccess::Lookup;
+    if (HasAllFlags(requestedAccess, (DWORD)RequestedAccess::Read))  implied |= LookupProbe;
+    if (HasAllFlags(requestedAccess, (DWORD)RequestedAccess::Write)) implied |= LookupProbeRead;
+
+    std::lock_guard<std::mutex> lock(reportedLock_);
+    DWORD &cached = reported_[path];
+    if (HasAllFlags(cached, requestedAccess))
+    {
+        return false;
+    }
+
+    cached |= requestedAccess | implied;
+    return true;
+}
+
+void ReportChannel::Send(const AccessReport &report)
+{
+    int savedErrno = errno;
+    size_t size = kAccessReportHeaderSize + strlen(report.path) + 1;
+
+    if (ring_ == nullptr || !ring_->TryWrite(&report, size))
+    {
+        if (fd_ >= 0)
+        {
+            // one write per report so that the reports of the processes of the pip do not interleave (writes of up to
+            // PIPE_BUF bytes to a FIFO are atomic, and so are appends to a file on local file systems)
+            char buffer[sizeof(uint32_t) + sizeof(AccessReport)];
+            uint32_t length = (uint32_t)size;
+            memcpy(buffer, &length, sizeof(length));
+            memcpy(buffer + sizeof(length), &report, size);
+
+            while (write(fd_, buffer, sizeof(length) + size) < 0 && errno == EINTR);
+        }
+    }
+
+    errno = savedErrno;
+}
@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef ReportChannel_hpp
+#define ReportChannel_hpp
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "ReportRing.hpp"
+#include "SandboxCommon.hpp"
+
+/*!
+ * Where the reports of a pip go: its report ring when the manifest asks for one (FileAccessManifestExtraFlag::UseReportRingBuffer)
+ * and it has room, and otherwise its report file, each report after its 4-byte length.
+ *
+ * Reports are deduplicated the way the kext's CacheRecord does it, over the lifetime of the channel.
+ */
+class ReportChannel
+{
+private:
+
+    ReportRing *ring_;
+    int fd_;
+
+    /*! The accesses reported so far, by path; guarded by 'reportedLock_' */
+    std::unordered_map<std::string, DWORD> reported_;
+    std::mutex reportedLock_;
+
+public:
+
+    ReportChannel() : ring_(nullptr), fd_(-1) {}
+
+    /*! Opens the report ring and the report file of 'fam'.  Returns false (printing why) if neither can be opened. */
+    bool Open(const FileAccessManifestParseResult &fam);
+
+    /*! Indicates if an access of 'path' with 'requestedAccess' has not been reported yet, and remembers it if so */
+    bool CheckAndUpdate(const char *path, DWORD requestedAccess);
+
+    /*! Sends 'report'; errno is preserved */
+    void Send(const AccessReport &report);
+
+    /*! To be called in the child after a fork, before any other use */
+    void OnForkChild();
+};
+
+#endif /* ReportChannel_hpp */
@@ -0,0 +1,164 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ReportRing.hpp"
+
+// How many times a producer retries reserving space in a full ring before falling back (same as on Windows)
+#define REPORT_RING_FULL_RETRY_COUNT 64
+
+// Records larger than this fraction of the ring are not written to it, so that a single record cannot starve the ring
+#define REPORT_RING_MAX_RECORD_FRACTION 4
+
+// Longest time a process that falls back to its other channel waits for the consumer to drain what it wrote to the ring
+#define REPORT_RING_DRAIN_WAIT_MS 5000
+
+static inline int64_t AlignSlotSize(size_t size)
+{
+    return (int64_t)((size + REPORT_RING_SLOT_ALIGNMENT - 1) & ~((size_t)REPORT_RING_SLOT_ALIGNMENT - 1));
+}
+
+ReportRing *ReportRing::Open(const char *name)
+{
+    // shm_open does not go through the interposed open(), so this is not reported
+    int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size <= sizeof(ReportRingHeader))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void *view = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // the mapping keeps the object alive
+    close(fd);
+
+    if (view == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    ReportRingHeader *header = reinterpret_cast<ReportRingHeader*>(view);
+    if (header->Magic != REPORT_RING_MAGIC
+        || header->Version != REPORT_RING_VERSION
+        || header->Capacity == 0
+        || header->Capacity > REPORT_RING_SKIP_SLOT
+        || (header->Capacity & (header->Capacity - 1)) != 0
+        || header->Capacity > (uint64_t)st.st_size - sizeof(ReportRingHeader))
+    {
+        munmap(view, st.st_size);
+        return nullptr;
+    }
+
+    return new ReportRing(header);
+}
+
+void ReportRing::Abandon()
+{
+    if (__atomic_exchange_n(&abandoned_, true, __ATOMIC_ACQ_REL))
+    {
+        return;
+    }
+
+    int64_t reservedEnd = __atomic_load_n(&reservedEnd_, __ATOMIC_ACQUIRE);
+    for (int waitedMs = 0;
+         __atomic_load_n(&header_->ReadOffset, __ATOMIC_ACQUIRE) < reservedEnd && waitedMs < REPORT_RING_DRAIN_WAIT_MS;
+         waitedMs++)
+    {
+        usleep(1000);
+    }
+}
+
+bool ReportRing::TryWrite(const void *data, size_t size)
+{
+    if (__atomic_load_n(&abandoned_, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+
+    int64_t capacity = (int64_t)header_->Capacity;
+    int64_t slotSize = AlignSlotSize(sizeof(ReportRingSlot) + size);
+
+    if (slotSize > capacity / REPORT_RING_MAX_RECORD_FRACTION)
+    {
+        Abandon();
+        return false;
+    }
+
+    int64_t reserve    = 0;
+    int64_t needed     = 0;
+    int64_t contiguous = 0;
+    bool reserved      = false;
+
+    for (int attempt = 0; attempt < REPORT_RING_FULL_RETRY_COUNT && !reserved; attempt++)
+    {
+        reserve    = __atomic_load_n(&header_->ReserveOffset, __ATOMIC_RELAXED);
+        contiguous = capacity - (reserve & (capacity - 1));
+
+        // a slot never wraps around: pad to the end of the data area first if it would
+        needed = slotSize <= contiguous ? slotSize : contiguous + slotSize;
+
+        if (reserve + needed - __atomic_load_n(&header_->ReadOffset, __ATOMIC_ACQUIRE) > capacity)
+        {
+            // full: give the consumer a chance to catch up
+            if (attempt >= REPORT_RING_FULL_RETRY_COUNT / 2)
+            {
+                sched_yield();
+            }
+
+            continue;
+        }
+
+        reserved = __atomic_compare_exchange_n(&header_->ReserveOffset, &reserve, reserve + needed,
+                                               /*weak*/ false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+
+    if (!reserved)
+    {
+        Abandon();
+        return false;
+    }
+
+    int64_t end = reserve + needed;
+    int64_t current = __atomic_load_n(&reservedEnd_, __ATOMIC_RELAXED);
+    while (current < end
+           && !__atomic_compare_exchange_n(&reservedEnd_, &current, end, /*weak*/ false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    int64_t position = reserve & (capacity - 1);
+
+    if (needed != slotSize)
+    {
+        ReportRingSlot *skip = reinterpret_cast<ReportRingSlot*>(data_ + position);
+        __atomic_store_n(&skip->SlotSize, (int32_t)contiguous, __ATOMIC_RELEASE);
+        __atomic_store_n(&skip->Length, (int32_t)(REPORT_RING_SKIP_SLOT | (uint32_t)contiguous), __ATOMIC_RELEASE);
+        position = 0;
+    }
+
+    // the size lets the consumer skip the slot if this process gets killed before committing it
+    ReportRingSlot *slot = reinterpret_cast<ReportRingSlot*>(data_ + position);
+    __atomic_store_n(&slot->SlotSize, (int32_t)slotSize, __ATOMIC_RELEASE);
+    memcpy(data_ + position + sizeof(ReportRingSlot), data, size);
+
+    // publishing the length commits the slot; the release makes the payload visible first. The consumer skipped the slot
+    // if this took too long, in which case the record goes to the other channel.
+    int32_t uncommitted = 0;
+    if (!__atomic_compare_exchange_n(&slot->Length, &uncommitted, (int32_t)size, /*weak*/ false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        Abandon();
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef ReportRing_hpp
+#define ReportRing_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*!
+ * Producer side of the shared-memory report transport of the Windows sandbox, over a POSIX shared memory object
+ * instead of a named file mapping.  The layout of the ring and the way slots are reserved, committed and padded are
+ * the same (see ReportRing.h in DetoursServices), so the consumer (see ReportRingBuffer.cs) only needs to map
+ * /dev/shm/<name> instead of opening a named mapping.
+ *
+ * As on Windows, once a record of a process does not go to the ring, the process waits for the consumer to drain what it
+ * wrote to the ring and sends all its later records to its other channel, so that they stay in order.
+ *
+ * CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/ReportRing.h
+ */
+
+#define REPORT_RING_MAGIC           0x474E4952 // "RING"
+#define REPORT_RING_VERSION         2
+#define REPORT_RING_NAME_SUFFIX     "_ReportRing"
+#define REPORT_RING_SLOT_ALIGNMENT  8
+#define REPORT_RING_SKIP_SLOT       0x80000000
+
+typedef struct ReportRingHeader_t
+{
+    uint32_t         Magic;
+    uint32_t         Version;
+    uint64_t         Capacity;
+    uint8_t          Padding0[48];
+
+    volatile int64_t ReserveOffset;
+    uint8_t          Padding1[56];
+
+    volatile int64_t ReadOffset;
+    uint8_t          Padding2[56];
+} ReportRingHeader;
+
+typedef struct ReportRingSlot_t
+{
+    volatile int32_t Length;
+    volatile int32_t SlotSize;
+} ReportRingSlot;
+
+static_assert(sizeof(ReportRingHeader) == 192, "ReportRingHeader layout is shared with the consumer");
+static_assert(sizeof(ReportRingSlot) == REPORT_RING_SLOT_ALIGNMENT, "ReportRingSlot layout is shared with the consumer");
+
+class ReportRing
+{
+private:
+
+    ReportRingHeader *header_;
+    char *data_;
+
+    // set once a record did not go to the ring; all later ones go to the other channel then
+    volatile bool abandoned_;
+
+    // end of the last slot this process reserved, which the consumer has to get past before the process uses its other channel
+    volatile int64_t reservedEnd_;
+
+    ReportRing(ReportRingHeader *header)
+        : header_(header), data_(reinterpret_cast<char*>(header) + sizeof(ReportRingHeader)), abandoned_(false), reservedEnd_(0) {}
+
+    void Abandon();
+
+public:
+
+    /*!
+     * Maps the ring the consumer created as the shared memory object 'name'.  Returns nullptr if there is none or
+     * its header is not that of a ring, in which case reports have to go elsewhere.
+     */
+    static ReportRing *Open(const char *name);
+
+    /*!
+     * Appends one record to the ring.  Returns false if the record is too large for the ring, if the ring stays full, or
+     * if the process already fell back, in which case the caller uses its other channel (and so does the process from then on).
+     */
+    bool TryWrite(const void *data, size_t size);
+};
+
+#endif /* ReportRing_hpp */
@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "PolicySearch.h"
+#include "SandboxCommon.hpp"
+
+bool LoadManifest(const char *famPath, std::unique_ptr<BYTE[]> &payload, FileAccessManifestParseResult &fam)
+{
+    int fd = REAL(open)(famPath, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "[BuildXL] Could not read the file access manifest '%s': %s\n", famPath, strerror(errno));
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    payload.reset(new BYTE[st.st_size]);
+    ssize_t total = 0;
+    while (total < st.st_size)
+    {
+        ssize_t n = read(fd, payload.get() + total, st.st_size - total);
+        if (n <= 0 && errno != EINTR) break;
+        if (n > 0) total += n;
+    }
+
+    close(fd);
+
+    if (total != st.st_size || !fam.init(payload.get(), st.st_size) || fam.HasErrors())
+    {
+        fprintf(stderr, "[BuildXL] Could not parse the file access manifest '%s': %s\n", famPath,
+                total != st.st_size ? "truncated" : fam.Error());
+        return false;
+    }
+
+    return true;
+}
+
+AccessCheckResult CheckAccess(const FileAccessManifestParseResult &fam, const char *path, CheckFunc checker, bool isDirectory)
+{
+    PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(fam.GetUnixRootNode(), path + 1, strlen(path + 1));
+    PolicyResult policy = PolicyResult(fam.GetFamFlags(), path, cursor, fam.GetSuffixPolicies());
+
+    AccessCheckResult result = AccessCheckResult::Invalid();
+    checker(policy, isDirectory, &result);
+    return result;
+}
+
+bool AppendNormalizedPath(char *buffer, size_t length, const char *path, size_t bufferSize)
+{
+    if (bufferSize < 2)
+    {
+        return false;
+    }
+
+    if (path[0] == '/')
+    {
+        length = 0;
+    }
+
+    // components are appended after a '/' of their own
+    while (length > 0 && buffer[length - 1] == '/') length--;
+
+    for (const char *component = path; *component != '\0'; )
+    {
+        while (*component == '/') component++;
+        if (*component == '\0') break;
+
+        const char *end = strchrnul(component, '/');
+        size_t componentLength = end - component;
+
+        if (componentLength == 1 && component[0] == '.')
+        {
+            // stays in the same directory
+        }
+        else if (componentLength == 2 && component[0] == '.' && component[1] == '.')
+        {
+            while (length > 0 && buffer[length - 1] != '/') length--;
+            if (length > 0) length--;
+        }
+        else
+        {
+            if (length + 1 + componentLength >= bufferSize) return false;
+            buffer[length++] = '/';
+            memcpy(buffer + length, component, componentLength);
+            length += componentLength;
+        }
+
+        component = end;
+    }
+
+    if (length == 0)
+    {
+        buffer[length++] = '/';
+    }
+
+    buffer[length] = '\0';
+    return true;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef SandboxCommon_hpp
+#define SandboxCommon_hpp
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <memory>
+
+#include "Checkers.hpp"
+#include "FileAccessManifestParser.hpp"
+#include "OpNames.hpp"
+
+/*!
+ * The function 'name' the interposed one hides, i.e., the next definition of it after this library (normally libc's).
+ * The sandbox uses these for all of its own file system calls, so that they are neither reported nor reentrant.
+ */
+#define REAL(name) \
+    ([]() { static auto s_real = reinterpret_cast<decltype(&::name)>(dlsym(RTLD_NEXT, #name)); return s_real; }())
+
+typedef long long pipid_t;
+
+/*!
+ * The Linux counterpart of the 'AccessReport' of the macOS sandbox, with the same fields and operations (see OpNames.hpp),
+ * so that the consumer can handle the reports of both the same way.  Only the used part of 'path' is sent.
+ *
+ * CODESYNC: AccessReport in Public/Src/Sandbox/MacOs/Sandbox/Src/BuildXLSandboxShared.hpp
+ */
+typedef struct {
+    uint64_t creationTime;
+    uint64_t enqueueTime;
+    uint64_t dequeueTime;
+} AccessReportStatistics;
+
+/*! The identity of a reported file; the Linux sandbox does not get it at no extra cost, so it always sends 0s */
+typedef struct {
+    uint64_t volume;
+    uint64_t file;
+} FileIdentity;
+
+typedef struct {
+    FileOperation operation;
+    pid_t pid;
+    pid_t rootPid;
+    DWORD requestedAccess;
+    DWORD status;
+    uint reportExplicitly;
+    DWORD error;
+    pipid_t pipId;
+    AccessReportStatistics stats;
+    FileIdentity fileIdentity;
+    // must be the last field: reports only carry the used part of it
+    char path[PATH_MAX];
+} AccessReport;
+
+// Size of the fixed part of an AccessReport, i.e., everything but its path
+#define kAccessReportHeaderSize offsetof(AccessReport, path)
+
+// CODESYNC: HasAllFlags in BuildXLSandboxShared.hpp, which does not build outside of macOS
+inline bool HasAllFlags(DWORD source, DWORD bitMask)
+{
+    return (source & bitMask) == bitMask;
+}
+
+/*!
+ * Appends the components of 'path' to the absolute path in the first 'length' characters of 'buffer' (all of 'path'
+ * if it is absolute), resolving '.' and '..' lexically, and terminates it.  Returns false if that does not fit.
+ */
+bool AppendNormalizedPath(char *buffer, size_t length, const char *path, size_t bufferSize);
+
+/*!
+ * Reads the manifest in the file 'famPath' into 'payload' and parses it into 'fam', which points into 'payload' from
+ * then on.  Returns false (printing why) if it cannot be read or parsed.
+ */
+bool LoadManifest(const char *famPath, std::unique_ptr<BYTE[]> &payload, FileAccessManifestParseResult &fam);
+
+/*! Checks an access of the absolute, normalized 'path' with 'checker' against the policy 'fam' has for it */
+AccessCheckResult CheckAccess(const FileAccessManifestParseResult &fam, const char *path, CheckFunc checker, bool isDirectory);
+
+#endif /* SandboxCommon_hpp */
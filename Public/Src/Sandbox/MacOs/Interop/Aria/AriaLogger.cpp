@@ -1,10 +1,62 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <string.h>
+
 #include "AriaLogger.hpp"
 
 #ifdef MICROSOFT_INTERNAL // Only needed for internal builds
 
+// Size of the fixed part of a packed event: length, priority, and property count
+#define PACKED_EVENT_HEADER_SIZE (sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint16_t))
+
+#pragma mark Packed event reader
+
+class PackedEventReader
+{
+private:
+
+    const char *cursor_;
+    const char *end_;
+    bool valid_;
+
+public:
+
+    PackedEventReader(const char *start, const char *end) : cursor_(start), end_(end), valid_(true) { }
+
+    bool IsValid() const { return valid_; }
+
+    template <typename T> T Read()
+    {
+        T value = T();
+        if (valid_ && (size_t)(end_ - cursor_) >= sizeof(T))
+        {
+            memcpy(&value, cursor_, sizeof(T));
+            cursor_ += sizeof(T);
+        }
+        else
+        {
+            valid_ = false;
+        }
+
+        return value;
+    }
+
+    const char *ReadString()
+    {
+        const char *terminator = valid_ ? (const char *)memchr(cursor_, '\0', end_ - cursor_) : nullptr;
+        if (terminator == nullptr)
+        {
+            valid_ = false;
+            return "";
+        }
+
+        const char *value = cursor_;
+        cursor_ = terminator + 1;
+        return value;
+    }
+};
+
 #pragma mark Aria logger class definition
 
 AriaLogger::AriaLogger(const char* token, const char *dbPath)
@@ -21,10 +73,23 @@ AriaLogger::AriaLogger(const char* token, const char *dbPath)
 
     // We use this on full sized build machines only
     logManager_->SetTransmitProfile(TransmitProfile_RealTime);
+
+    queuedBytes_ = 0;
+    stopping_ = false;
+    worker_ = std::thread(&AriaLogger::ProcessQueuedEvents, this);
 }
 
 AriaLogger::~AriaLogger()
 {
+    {
+        std::lock_guard<std::mutex> lock(queueLock_);
+        stopping_ = true;
+    }
+
+    // the worker drains the queued events before exiting
+    queueChanged_.notify_one();
+    worker_.join();
+
     logManager_->FlushAndTeardown();
 }
 
@@ -33,6 +98,120 @@ ILogger *AriaLogger::GetLogger() const
     return logManager_->GetLogger(token_);
 };
 
+int AriaLogger::EnqueuePackedEvent(const char *event, uint32_t length, uint8_t priority)
+{
+    if (priority >= ARIA_EVENT_PRIORITY_COUNT)
+    {
+        priority = ARIA_EVENT_PRIORITY_COUNT - 1;
+    }
+
+    int numDropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(queueLock_);
+
+        // make room by dropping the oldest events of lower priorities first
+        for (int p = 0; p < priority && queuedBytes_ + length > ARIA_MAX_QUEUED_BYTES; p++)
+        {
+            while (!queues_[p].empty() && queuedBytes_ + length > ARIA_MAX_QUEUED_BYTES)
+            {
+                queuedBytes_ -= queues_[p].front().size();
+                queues_[p].pop_front();
+                numDropped++;
+            }
+        }
+
+        if (queuedBytes_ + length > ARIA_MAX_QUEUED_BYTES)
+        {
+            return numDropped + 1;
+        }
+
+        queues_[priority].emplace_back(event, event + length);
+        queuedBytes_ += length;
+    }
+
+    queueChanged_.notify_one();
+    return numDropped;
+}
+
+void AriaLogger::ProcessQueuedEvents()
+{
+    std::unique_lock<std::mutex> lock(queueLock_);
+    while (true)
+    {
+        queueChanged_.wait(lock, [this] { return stopping_ || queuedBytes_ > 0; });
+        if (queuedBytes_ == 0)
+        {
+            // stopping and nothing left to log
+            return;
+        }
+
+        // log the most important events first
+        std::vector<char> packedEvent;
+        for (int p = ARIA_EVENT_PRIORITY_COUNT - 1; p >= 0; p--)
+        {
+            if (!queues_[p].empty())
+            {
+                packedEvent.swap(queues_[p].front());
+                queues_[p].pop_front();
+                break;
+            }
+        }
+
+        queuedBytes_ -= packedEvent.size();
+
+        lock.unlock();
+        LogPackedEvent(packedEvent);
+        lock.lock();
+    }
+}
+
+void AriaLogger::LogPackedEvent(const std::vector<char> &packedEvent) const
+{
+    PackedEventReader reader(packedEvent.data(), packedEvent.data() + packedEvent.size());
+    reader.Read<uint32_t>(); // length
+    reader.Read<uint8_t>();  // priority
+    uint16_t propertyCount = reader.Read<uint16_t>();
+    EventProperties event(reader.ReadString());
+
+    for (uint16_t i = 0; i < propertyCount && reader.IsValid(); i++)
+    {
+        uint8_t type = reader.Read<uint8_t>();
+        const char *name = reader.ReadString();
+        switch (type)
+        {
+            case ARIA_PROPERTY_STRING:
+            {
+                const char *value = reader.ReadString();
+                event.SetProperty(name, value);
+                break;
+            }
+            case ARIA_PROPERTY_STRING_WITH_PII:
+            {
+                int32_t kind = reader.Read<int32_t>();
+                const char *value = reader.ReadString();
+                event.SetProperty(name, value, static_cast<PiiKind>(kind));
+                break;
+            }
+            case ARIA_PROPERTY_INT64:
+            {
+                int64_t value = reader.Read<int64_t>();
+                event.SetProperty(name, value);
+                break;
+            }
+            default:
+            {
+                return;
+            }
+        }
+    }
+
+    // partially decoded events are dropped rather than logged with missing properties
+    if (reader.IsValid())
+    {
+        GetLogger()->LogEvent(event);
+    }
+}
+
 #pragma mark External Interface
 
 AriaLogger* CreateAriaLogger(const char *token, const char *dbPath)
@@ -96,4 +275,31 @@ void LogEvent(const AriaLogger *logger, const EventProperties *event)
     }
 }
 
+int LogEventBatch(AriaLogger *logger, const char *batch, uint32_t length)
+{
+    if (logger == nullptr || batch == nullptr)
+    {
+        return 0;
+    }
+
+    int numDropped = 0;
+    const char *end = batch + length;
+    while (batch < end)
+    {
+        PackedEventReader reader(batch, end);
+        uint32_t eventLength = reader.Read<uint32_t>();
+        uint8_t priority = reader.Read<uint8_t>();
+        if (!reader.IsValid() || eventLength < PACKED_EVENT_HEADER_SIZE || eventLength > (uint32_t)(end - batch))
+        {
+            // the length of the remaining events can't be trusted either
+            return numDropped + 1;
+        }
+
+        numDropped += logger->EnqueuePackedEvent(batch, eventLength, priority);
+        batch += eventLength;
+    }
+
+    return numDropped;
+}
+
 #endif
@@ -8,11 +8,28 @@
 
 #ifdef MICROSOFT_INTERNAL // Only needed for internal builds
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "ILogger.hpp"
 #include "LogManager.hpp"
 
 using namespace Microsoft::Applications::Telemetry;
 
+// Number of priorities events of a batch can have (see 'LogEventBatch'); higher priorities are dropped last
+#define ARIA_EVENT_PRIORITY_COUNT 4
+
+// Upper bound of the memory taken by events queued for the background thread
+#define ARIA_MAX_QUEUED_BYTES (8 * 1024 * 1024)
+
+// Property types of a packed event (see 'LogEventBatch')
+#define ARIA_PROPERTY_STRING          0
+#define ARIA_PROPERTY_STRING_WITH_PII 1
+#define ARIA_PROPERTY_INT64           2
+
 class AriaLogger
 {
 
@@ -24,6 +41,17 @@ private:
     LogConfiguration config_;
     LogManager *logManager_;
 
+    // Packed events waiting for the background thread, one queue per priority
+    std::deque<std::vector<char>> queues_[ARIA_EVENT_PRIORITY_COUNT];
+    size_t queuedBytes_;
+    bool stopping_;
+    std::mutex queueLock_;
+    std::condition_variable queueChanged_;
+    std::thread worker_;
+
+    void ProcessQueuedEvents();
+    void LogPackedEvent(const std::vector<char> &packedEvent) const;
+
 public:
 
     AriaLogger() = delete;
@@ -32,6 +60,15 @@ public:
     ~AriaLogger();
 
     ILogger *GetLogger() const;
+
+    /*!
+     * Queues one packed event for the background thread without ever blocking on it.  When the queued events would
+     * take more than ARIA_MAX_QUEUED_BYTES, the oldest events of lower priorities are dropped to make room, or the
+     * event itself if there are none.
+     *
+     * @result Number of events dropped.
+     */
+    int EnqueuePackedEvent(const char *event, uint32_t length, uint8_t priority);
 };
 
 extern "C"
@@ -46,6 +83,21 @@ extern "C"
     extern __cdecl void SetStringPropertyWithPiiKind(EventProperties *, const char *, const char *, int);
     extern __cdecl void SetInt64Property(EventProperties *, const char *, const int64_t);
     extern __cdecl void LogEvent(const AriaLogger *, const EventProperties *);
+
+    /*!
+     * Logs a batch of packed events on a background thread (see 'AriaLogger::EnqueuePackedEvent').
+     *
+     * Each event is laid out as
+     *   [uint32 length of the event, including this field][uint8 priority][uint16 property count][event name\0]
+     * followed by its properties, each laid out as one of
+     *   [uint8 ARIA_PROPERTY_STRING][name\0][value\0]
+     *   [uint8 ARIA_PROPERTY_STRING_WITH_PII][name\0][int32 PII kind][value\0]
+     *   [uint8 ARIA_PROPERTY_INT64][name\0][int64 value]
+     * with all integers in native byte order and without padding.
+     *
+     * @result Number of events dropped, either because they were malformed or because of memory pressure.
+     */
+    extern __cdecl int LogEventBatch(AriaLogger *, const char *, uint32_t);
 }
 
 #pragma GCC visibility pop
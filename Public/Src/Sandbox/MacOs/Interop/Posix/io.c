@@ -2,10 +2,15 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/attr.h>
 #include <sys/errno.h>
 #include <sys/mount.h>
+#include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/vnode.h>
 #include <unistd.h>
 
 #include "io.h"
@@ -88,6 +93,271 @@ int StatFileDescriptor(intptr_t fd, StatBuffer *statBuffer, long bufferSize)
     return result;
 }
 
+// Size of the buffer each 'getattrlistbulk' call fills with as many entries as fit
+#define BULK_ATTR_BUFFER_SIZE (256 * 1024)
+
+// Minimum number of paths a 'StatFiles' (or 'SetTimeStampsForFilePaths') thread gets, below which spawning it costs more than it saves
+#define STAT_FILES_MIN_PATHS_PER_THREAD 64
+
+// Reads an attribute of type 'type' at 'cursor' into 'dest' and advances 'cursor'; attributes are only 4-byte aligned
+#define READ_ATTR(cursor, type, dest) do { memcpy(&(dest), (cursor), sizeof(type)); (cursor) += sizeof(type); } while (0)
+
+// Same as 'READ_ATTR', if the file system returned the attribute (not all of them support every attribute)
+#define READ_ATTR_IF_RETURNED(returnedSet, attr, cursor, type, dest) do { if ((returnedSet) & (attr)) READ_ATTR(cursor, type, dest); } while (0)
+
+static mode_t ObjectTypeToMode(fsobj_type_t type)
+{
+    switch (type)
+    {
+        case VREG:  return S_IFREG;
+        case VDIR:  return S_IFDIR;
+        case VLNK:  return S_IFLNK;
+        case VBLK:  return S_IFBLK;
+        case VCHR:  return S_IFCHR;
+        case VFIFO: return S_IFIFO;
+        case VSOCK: return S_IFSOCK;
+        default:    return 0;
+    }
+}
+
+// Converts one entry returned by 'getattrlistbulk' for the attributes requested in 'StatDirectoryEntries';
+// the attributes are laid out in the order of their bits, common ones first, then directory and file ones
+static int ConvertBulkEntry(char *entry, DirectoryEntryStatBuffer *result)
+{
+    char *cursor = entry + sizeof(uint32_t); // skip the entry length
+
+    attribute_set_t returned;
+    READ_ATTR(cursor, attribute_set_t, returned);
+
+    uint32_t error = 0;
+    if (returned.commonattr & ATTR_CMN_ERROR)
+    {
+        READ_ATTR(cursor, uint32_t, error);
+    }
+
+    if (error != 0)
+    {
+        return error;
+    }
+
+    if (!(returned.commonattr & ATTR_CMN_NAME))
+    {
+        return EIO;
+    }
+
+    attrreference_t nameRef;
+    char *nameStart = cursor;
+    READ_ATTR(cursor, attrreference_t, nameRef);
+    strlcpy(result->name, nameStart + nameRef.attr_dataoffset, MIN(sizeof(result->name), nameRef.attr_length));
+
+    dev_t device = 0;
+    fsobj_type_t type = VNON;
+    struct timespec crtime = {0}, mtime = {0}, ctime = {0}, atime = {0};
+    uid_t uid = 0;
+    gid_t gid = 0;
+    uint32_t accessMask = 0;
+    uint64_t fileId = 0;
+    uint32_t linkCount = 1;
+    off_t size = 0;
+
+    READ_ATTR_IF_RETURNED(returned.commonattr, ATTR_CMN_DEVID,      cursor, dev_t,           device);
+    READ_ATTR_IF_RETURNED(returned.commonattr, ATTR_CMN_OBJTYPE,    cursor, fsobj_type_t,    type);
+    READ_ATTR_IF_RETURNED(returned.commonattr, ATTR_CMN_CRTIME,     cursor, struct timespec, crtime);
+    READ_ATTR_IF_RETURNED(returned.commonattr, ATTR_CMN_MODTIME,    cursor, struct timespec, mtime);
+    READ_ATTR_IF_RETURNED(returned.commonattr, ATTR_CMN_CHGTIME,    cursor, struct timespec, ctime);
+    READ_ATTR_IF_RETURNED(returned.commonattr, ATTR_CMN_ACCTIME,    cursor, struct timespec, atime);
+    READ_ATTR_IF_RETURNED(returned.commonattr, ATTR_CMN_OWNERID,    cursor, uid_t,           uid);
+    READ_ATTR_IF_RETURNED(returned.commonattr, ATTR_CMN_GRPID,      cursor, gid_t,           gid);
+    READ_ATTR_IF_RETURNED(returned.commonattr, ATTR_CMN_ACCESSMASK, cursor, uint32_t,        accessMask);
+    READ_ATTR_IF_RETURNED(returned.commonattr, ATTR_CMN_FILEID,     cursor, uint64_t,        fileId);
+    READ_ATTR_IF_RETURNED(returned.dirattr,    ATTR_DIR_LINKCOUNT,  cursor, uint32_t,        linkCount);
+    READ_ATTR_IF_RETURNED(returned.fileattr,   ATTR_FILE_LINKCOUNT, cursor, uint32_t,        linkCount);
+    READ_ATTR_IF_RETURNED(returned.fileattr,   ATTR_FILE_DATALENGTH, cursor, off_t,          size);
+
+    StatBuffer *statBuffer            = &result->stat;
+    statBuffer->st_dev                = (int64_t)device;
+    statBuffer->st_ino                = (int64_t)fileId;
+    statBuffer->st_mode               = (int32_t)(ObjectTypeToMode(type) | (accessMask & ~S_IFMT));
+    statBuffer->st_nlink              = linkCount;
+    statBuffer->st_uid                = uid;
+    statBuffer->st_gid                = gid;
+    statBuffer->st_size               = size;
+    statBuffer->st_atimespec          = atime.tv_sec;
+    statBuffer->st_atimespec_nsec     = atime.tv_nsec;
+    statBuffer->st_mtimespec          = mtime.tv_sec;
+    statBuffer->st_mtimespec_nsec     = mtime.tv_nsec;
+    statBuffer->st_ctimespec          = ctime.tv_sec;
+    statBuffer->st_ctimespec_nsec     = ctime.tv_nsec;
+    statBuffer->st_birthtimespec      = crtime.tv_sec;
+    statBuffer->st_birthtimespec_nsec = crtime.tv_nsec;
+
+    return 0;
+}
+
+int StatDirectoryEntries(const char *path, DirectoryEntryStatBuffer *entries, int entryCapacity, long entrySize, int *entryCount)
+{
+    if (sizeof(DirectoryEntryStatBuffer) != entrySize)
+    {
+        printf("ERROR: Wrong size of DirectoryEntryStatBuffer buffer; expected %ld, received %ld\n", sizeof(DirectoryEntryStatBuffer), entrySize);
+        return 1;
+    }
+
+    if (path == NULL || entries == NULL || entryCount == NULL)
+    {
+        return EINVAL;
+    }
+
+    *entryCount = 0;
+
+    int fd;
+    while ((fd = open(path, O_RDONLY | O_DIRECTORY)) < 0 && errno == EINTR);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    char *buffer = malloc(BULK_ATTR_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        close(fd);
+        return ENOMEM;
+    }
+
+    struct attrlist attributes = {0};
+    attributes.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attributes.commonattr  =
+        ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_ERROR | ATTR_CMN_NAME | ATTR_CMN_DEVID | ATTR_CMN_OBJTYPE |
+        ATTR_CMN_CRTIME | ATTR_CMN_MODTIME | ATTR_CMN_CHGTIME | ATTR_CMN_ACCTIME |
+        ATTR_CMN_OWNERID | ATTR_CMN_GRPID | ATTR_CMN_ACCESSMASK | ATTR_CMN_FILEID;
+    attributes.dirattr     = ATTR_DIR_LINKCOUNT;
+    attributes.fileattr    = ATTR_FILE_LINKCOUNT | ATTR_FILE_DATALENGTH;
+
+    int result = 0;
+    int count  = 0;
+    while (result == 0)
+    {
+        int numEntries;
+        while ((numEntries = getattrlistbulk(fd, &attributes, buffer, BULK_ATTR_BUFFER_SIZE, 0)) < 0 && errno == EINTR);
+        if (numEntries <= 0)
+        {
+            result = numEntries < 0 ? errno : 0;
+            break;
+        }
+
+        char *entry = buffer;
+        for (int i = 0; i < numEntries; i++)
+        {
+            uint32_t length;
+            memcpy(&length, entry, sizeof(length));
+
+            // keep counting past the capacity so that the caller knows how many entries to make room for
+            if (count < entryCapacity)
+            {
+                int error = ConvertBulkEntry(entry, &entries[count]);
+                if (error != 0)
+                {
+                    result = error;
+                    break;
+                }
+            }
+
+            count++;
+            entry += length;
+        }
+    }
+
+    free(buffer);
+    close(fd);
+
+    *entryCount = count;
+    return result == 0 && count > entryCapacity ? ENOBUFS : result;
+}
+
+/*!
+ * Runs 'worker' on 'work' from the calling thread and from up to 'maxThreads' - 1 additional ones (fewer when there are
+ * not enough items to make it worthwhile), and returns once they are all done.  The workers pick items off 'work' themselves.
+ */
+static void RunWorkers(void *(*worker)(void *), void *work, int itemCount, int maxThreads)
+{
+    // the calling thread is one of the workers, so only spawn the additional ones
+    int numThreads = MIN(MIN(maxThreads, STAT_FILES_MAX_THREADS), itemCount / STAT_FILES_MIN_PATHS_PER_THREAD);
+    pthread_t threads[STAT_FILES_MAX_THREADS];
+    int numSpawned = 0;
+    for (; numSpawned < numThreads - 1; numSpawned++)
+    {
+        if (pthread_create(&threads[numSpawned], NULL, worker, work) != 0)
+        {
+            // fewer threads only means less parallelism
+            break;
+        }
+    }
+
+    worker(work);
+
+    for (int i = 0; i < numSpawned; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+typedef struct {
+    const char **paths;
+    int pathCount;
+    bool followSymlink;
+    StatBuffer *statBuffers;
+    int *results;
+    volatile int nextIndex;
+} StatFilesWork;
+
+static void* StatFilesWorker(void *arg)
+{
+    StatFilesWork *work = (StatFilesWork *)arg;
+
+    int index;
+    while ((index = __sync_fetch_and_add(&work->nextIndex, 1)) < work->pathCount)
+    {
+        struct stat fileStat;
+        if (CallStat(work->paths[index], work->followSymlink, &fileStat) == 0)
+        {
+            ConvertStatToStatBuffer(&fileStat, &work->statBuffers[index]);
+            work->results[index] = 0;
+        }
+        else
+        {
+            work->results[index] = errno;
+        }
+    }
+
+    return NULL;
+}
+
+int StatFiles(const char **paths, int pathCount, bool followSymlink, StatBuffer *statBuffers, int *results, long bufferSize, int maxThreads)
+{
+    if (sizeof(StatBuffer) != bufferSize)
+    {
+        printf("ERROR: Wrong size of StatBuffer buffer; expected %ld, received %ld\n", sizeof(StatBuffer), bufferSize);
+        return 1;
+    }
+
+    if (paths == NULL || statBuffers == NULL || results == NULL || pathCount < 0)
+    {
+        return EINVAL;
+    }
+
+    StatFilesWork work =
+    {
+        .paths         = paths,
+        .pathCount     = pathCount,
+        .followSymlink = followSymlink,
+        .statBuffers   = statBuffers,
+        .results       = results,
+        .nextIndex     = 0,
+    };
+
+    RunWorkers(StatFilesWorker, &work, pathCount, maxThreads);
+    return 0;
+}
+
 intptr_t Open(const char *path, int32_t flags, int32_t mode)
 {
     int result;
@@ -105,6 +375,88 @@ int SetAttributeList(const char *path, uint commonAttr, struct timespec spec, bo
         path, &attributes, (void*)&spec, sizeof(struct timespec), followSymLink ? 0 : FSOPT_NOFOLLOW);
 }
 
+// Attribute buffer of 'SetTimeStamps'; the attributes are laid out in the order of their bits in 'attrlist.commonattr'
+typedef struct {
+    struct timespec birthTime;  // ATTR_CMN_CRTIME
+    struct timespec mTime;      // ATTR_CMN_MODTIME
+    struct timespec cTime;      // ATTR_CMN_CHGTIME
+    struct timespec aTime;      // ATTR_CMN_ACCTIME
+} TimeStampAttributes;
+
+/*! Like 'SetTimeStampsForFilePath', but with a single 'setattrlist' call; returns 0 or the error code */
+static int SetTimeStamps(const char *path, bool followSymlink, const StatBuffer *buffer)
+{
+    struct attrlist attributes = {0};
+    attributes.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attributes.commonattr = ATTR_CMN_CRTIME | ATTR_CMN_MODTIME | ATTR_CMN_CHGTIME | ATTR_CMN_ACCTIME;
+
+    TimeStampAttributes times =
+    {
+        .birthTime = { .tv_sec = buffer->st_birthtimespec, .tv_nsec = buffer->st_birthtimespec_nsec },
+        .mTime     = { .tv_sec = buffer->st_mtimespec,     .tv_nsec = buffer->st_mtimespec_nsec },
+        .cTime     = { .tv_sec = buffer->st_ctimespec,     .tv_nsec = buffer->st_ctimespec_nsec },
+        .aTime     = { .tv_sec = buffer->st_atimespec,     .tv_nsec = buffer->st_atimespec_nsec },
+    };
+
+    int ret;
+    while ((ret = setattrlist(path, &attributes, &times, sizeof(times), followSymlink ? 0 : FSOPT_NOFOLLOW)) < 0 && errno == EINTR);
+    return ret == 0 ? 0 : errno;
+}
+
+typedef struct {
+    const char **paths;
+    int pathCount;
+    bool followSymlink;
+    const StatBuffer *statBuffers;
+    int statBufferCount;
+    int *results;
+    volatile int nextIndex;
+} SetTimeStampsWork;
+
+static void* SetTimeStampsWorker(void *arg)
+{
+    SetTimeStampsWork *work = (SetTimeStampsWork *)arg;
+
+    int index;
+    while ((index = __sync_fetch_and_add(&work->nextIndex, 1)) < work->pathCount)
+    {
+        // a single buffer applies to every path
+        const StatBuffer *times = work->statBufferCount == 1 ? &work->statBuffers[0] : &work->statBuffers[index];
+        work->results[index] = SetTimeStamps(work->paths[index], work->followSymlink, times);
+    }
+
+    return NULL;
+}
+
+int SetTimeStampsForFilePaths(const char **paths, int pathCount, bool followSymlink, const StatBuffer *statBuffers, int statBufferCount,
+                              int *results, long bufferSize, int maxThreads)
+{
+    if (sizeof(StatBuffer) != bufferSize)
+    {
+        printf("ERROR: Wrong size of StatBuffer buffer; expected %ld, received %ld\n", sizeof(StatBuffer), bufferSize);
+        return 1;
+    }
+
+    if (paths == NULL || statBuffers == NULL || results == NULL || pathCount < 0 || (statBufferCount != 1 && statBufferCount != pathCount))
+    {
+        return EINVAL;
+    }
+
+    SetTimeStampsWork work =
+    {
+        .paths           = paths,
+        .pathCount       = pathCount,
+        .followSymlink   = followSymlink,
+        .statBuffers     = statBuffers,
+        .statBufferCount = statBufferCount,
+        .results         = results,
+        .nextIndex       = 0,
+    };
+
+    RunWorkers(SetTimeStampsWorker, &work, pathCount, maxThreads);
+    return 0;
+}
+
 int SetTimeStampsForFilePath(const char *path, bool followSymlink, StatBuffer buffer)
 {
     struct timespec birthTime;
@@ -38,6 +38,44 @@ typedef struct {
 */
 int StatFile(const char *path, bool followSymlink, StatBuffer *statBuffer, long bufferSize);
 
+// Maximum length of an entry name returned by 'StatDirectoryEntries' (names are UTF-8 encoded, up to 255 characters)
+#define DIRECTORY_ENTRY_NAME_MAX 768
+
+// Upper bound of the 'maxThreads' argument of 'StatFiles' and 'SetTimeStampsForFilePaths'
+#define STAT_FILES_MAX_THREADS 16
+
+typedef struct {
+    StatBuffer stat;                          /* Same information as 'StatFile' with 'followSymlink' set to false */
+    char name[DIRECTORY_ENTRY_NAME_MAX];      /* Name of the entry, relative to the enumerated directory */
+} DirectoryEntryStatBuffer;
+
+/*!
+ * Returns information about all entries of a directory, using a single 'getattrlistbulk' call per batch of entries
+ * instead of one stat call per entry.  Entries are not followed if they are symlinks (same as 'lstat') and the
+ * size reported for directories is 0.
+ * @param path Location of the directory
+ * @param entries Array where the entry information is stored
+ * @param entryCapacity Number of elements in 'entries'
+ * @param entrySize Allocated size of each 'DirectoryEntryStatBuffer' element
+ * @param entryCount Set to the number of entries in the directory, even when they don't all fit into 'entries'
+ * @result 0 on success, ENOBUFS if 'entryCapacity' is smaller than '*entryCount', error code otherwise
+ *         (including when the attributes of an entry could not be read, in which case callers should fall back to 'StatFile').
+*/
+int StatDirectoryEntries(const char *path, DirectoryEntryStatBuffer *entries, int entryCapacity, long entrySize, int *entryCount);
+
+/*!
+ * Returns information about many files at once, spreading the stat calls over a few threads.
+ * @param paths Locations of the files
+ * @param pathCount Number of elements in 'paths', 'statBuffers', and 'results'
+ * @param followSymlink Whether to follow symlink, if true, then use 'stat', otherwise use 'lstat'
+ * @param statBuffers Array where the file information is stored
+ * @param results Array where 0 or the error code of each file is stored
+ * @param bufferSize Allocated size of each 'StatBuffer' element
+ * @param maxThreads Maximum number of threads to use; at most 'STAT_FILES_MAX_THREADS'
+ * @result 0 if every file was processed (see 'results' for the individual outcomes), error code otherwise.
+*/
+int StatFiles(const char **paths, int pathCount, bool followSymlink, StatBuffer *statBuffers, int *results, long bufferSize, int maxThreads);
+
 /*!
  * Returns information about a file specified by the given file descriptor.
  * @param fd File descriptor
@@ -60,6 +98,22 @@ ssize_t SafeReadLink(const char *path, char *buffer, size_t bufferSize);
 
 int SetTimeStampsForFilePath(const char *path, bool followSymlink, StatBuffer buffer);
 
+/*!
+ * Sets the creation, modification, change and access time of many files at once, with one 'setattrlist' call per file,
+ * spreading the calls over a few threads (see 'StatFiles').
+ * @param paths Locations of the files
+ * @param pathCount Number of elements in 'paths' and 'results'
+ * @param followSymlink Whether to set the time stamps of the target of a symlink rather than those of the symlink itself
+ * @param statBuffers Time stamps to set: either one per path, or a single one for all of them
+ * @param statBufferCount Number of elements in 'statBuffers': 'pathCount' or 1
+ * @param results Array where 0 or the error code of each file is stored
+ * @param bufferSize Allocated size of each 'StatBuffer' element
+ * @param maxThreads Maximum number of threads to use; at most 'STAT_FILES_MAX_THREADS'
+ * @result 0 if every file was processed (see 'results' for the individual outcomes), error code otherwise.
+*/
+int SetTimeStampsForFilePaths(const char **paths, int pathCount, bool followSymlink, const StatBuffer *statBuffers, int statBufferCount,
+                              int *results, long bufferSize, int maxThreads);
+
 int GetFilePermissionsForFilePath(const char *path, bool followSymlink);
 int SetFilePermissionsForFilePath(const char *path, mode_t permissions, bool followSymlink);
 
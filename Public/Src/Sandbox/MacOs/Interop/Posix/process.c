@@ -5,6 +5,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/sysctl.h>
 #include <unistd.h>
 
@@ -54,6 +55,84 @@ int GetProcessTimes(pid_t pid, ProcessTimesInfo *buffer, long bufferSize, bool i
     return KERN_SUCCESS;
 }
 
+// Initial capacity of the pid list of 'GetProcessTreeResourceUsage'; grows as needed
+#define PROCESS_TREE_INITIAL_CAPACITY 256
+
+static bool AddProcessUsage(pid_t pid, ProcessTreeResourceUsage *buffer)
+{
+    rusage_info_current rusage;
+    if (proc_pid_rusage(pid, RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
+    {
+        // the process exited since it was listed
+        return false;
+    }
+
+    buffer->numProcesses++;
+    buffer->systemTime       += rusage.ri_system_time + rusage.ri_child_system_time;
+    buffer->userTime         += rusage.ri_user_time + rusage.ri_child_user_time;
+    buffer->residentSize     += rusage.ri_phys_footprint;
+    buffer->peakResidentSize += rusage.ri_lifetime_max_phys_footprint;
+    buffer->diskBytesRead    += rusage.ri_diskio_bytesread;
+    buffer->diskBytesWritten += rusage.ri_diskio_byteswritten;
+    return true;
+}
+
+int GetProcessTreeResourceUsage(pid_t rootPid, ProcessTreeResourceUsage *buffer, long bufferSize)
+{
+    if (sizeof(ProcessTreeResourceUsage) != bufferSize)
+    {
+        printf("ERROR: Wrong size of ProcessTreeResourceUsage buffer; expected %ld, received %ld\n", sizeof(ProcessTreeResourceUsage), bufferSize);
+        return GET_RUSAGE_ERROR;
+    }
+
+    memset(buffer, 0, sizeof(ProcessTreeResourceUsage));
+    if (!AddProcessUsage(rootPid, buffer))
+    {
+        return GET_RUSAGE_ERROR;
+    }
+
+    // breadth-first walk over the tree: 'pids[next..count)' are the processes whose children haven't been listed yet
+    int capacity = PROCESS_TREE_INITIAL_CAPACITY;
+    pid_t *pids = malloc(capacity * sizeof(pid_t));
+    if (pids == NULL)
+    {
+        return GET_RUSAGE_ERROR;
+    }
+
+    int count = 0;
+    pids[count++] = rootPid;
+    for (int next = 0; next < count; next++)
+    {
+        int numChildren;
+        while ((numChildren = proc_listchildpids(pids[next], pids + count, (capacity - count) * sizeof(pid_t))) >= capacity - count)
+        {
+            // the list may have been truncated, so make room and list again
+            pid_t *grown = realloc(pids, 2 * capacity * sizeof(pid_t));
+            if (grown == NULL)
+            {
+                free(pids);
+                return GET_RUSAGE_ERROR;
+            }
+
+            pids = grown;
+            capacity *= 2;
+        }
+
+        // children that exited in the meantime are dropped from the walk
+        int end = count + (numChildren > 0 ? numChildren : 0);
+        for (int i = count; i < end; i++)
+        {
+            if (AddProcessUsage(pids[i], buffer))
+            {
+                pids[count++] = pids[i];
+            }
+        }
+    }
+
+    free(pids);
+    return KERN_SUCCESS;
+}
+
 static CoreDumpConfiguration *dump_config = NULL;
 
 static bool AdjustCoreDumpSizeResourceLimit(unsigned long long limit)
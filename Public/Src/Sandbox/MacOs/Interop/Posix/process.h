@@ -15,6 +15,24 @@ typedef struct {
 
 int GetProcessTimes(pid_t pid, ProcessTimesInfo *buffer, long bufferSize, bool includeChildProcesses);
 
+// Aggregated resource usage of a process and all its live descendants; times in nanoseconds, sizes in bytes
+typedef struct {
+    uint32_t numProcesses;
+    uint64_t systemTime;
+    uint64_t userTime;
+    uint64_t residentSize;
+    uint64_t peakResidentSize;
+    uint64_t diskBytesRead;
+    uint64_t diskBytesWritten;
+} ProcessTreeResourceUsage;
+
+/*!
+ * Takes one snapshot of the process tree rooted at 'rootPid' and sums up the resource usage of all its processes.
+ * CPU times include the already exited (and reaped) descendants, memory sizes only the live processes.
+ * @result KERN_SUCCESS on success, GET_RUSAGE_ERROR if the root process could not be sampled.
+*/
+int GetProcessTreeResourceUsage(pid_t rootPid, ProcessTreeResourceUsage *buffer, long bufferSize);
+
 typedef struct {
     char *outputPath;
 } CoreDumpConfiguration;
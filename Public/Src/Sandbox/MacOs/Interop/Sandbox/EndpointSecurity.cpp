@@ -0,0 +1,865 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <EndpointSecurity/EndpointSecurity.h>
+#include <bsm/libbsm.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+
+#include "EndpointSecurity.h"
+#include "Checkers.hpp"
+#include "FileAccessManifestParser.hpp"
+#include "PolicySearch.h"
+
+/*! How many batches of reports may be waiting for the callback before handling messages is held back */
+#define kMaxPendingBatches 64
+
+static Timespan MachTimeToTimespan(uint64_t machTime)
+{
+    static mach_timebase_info_data_t s_timebase;
+    if (s_timebase.denom == 0)
+    {
+        mach_timebase_info(&s_timebase);
+    }
+
+    return Timespan::fromNanoseconds(machTime * s_timebase.numer / s_timebase.denom);
+}
+
+static void Increment(uint64_t *counter, uint64_t value = 1)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+#pragma mark Pips
+
+/*! A pip whose processes are tracked by an 'EndpointSecuritySandbox' */
+typedef struct EsPip
+{
+    pipid_t pipId;
+    pid_t rootPid;
+    std::unique_ptr<BYTE[]> payload;
+    FileAccessManifestParseResult fam;
+
+    /*! Whether the pip fails unexpected file accesses, i.e., whether its accesses need to be authorized */
+    bool canDeny;
+
+    /*! Number of processes of the pip that are still alive; guarded by the lock of the sandbox */
+    int processTreeCount;
+
+    /*!
+     * The accesses reported so far, by path, so that each access is reported only once (see 'CacheRecord').
+     * Guarded by 'reportedLock'.
+     */
+    std::unordered_map<std::string, DWORD> reported;
+    std::mutex reportedLock;
+
+    /*!
+     * Indicates if 'checkResult' is an access of 'path' that has not been reported yet, and remembers it if so.
+     *
+     * CODESYNC: CacheRecord::Check and CacheRecord::Update
+     */
+    bool CheckAndUpdate(const char *path, const AccessCheckResult &checkResult)
+    {
+        const DWORD LookupProbe     = (DWORD)(RequestedAccess::Lookup | RequestedAccess::Probe);
+        const DWORD LookupProbeRead = LookupProbe | (DWORD)RequestedAccess::Read;
+
+        DWORD access  = (DWORD)checkResult.RequestedAccess;
+        DWORD implied = 0;
+        if (HasAllFlags(access, (DWORD)RequestedAccess::Probe)) implied |= (DWORD)RequestedAccess::Lookup;
+        if (HasAllFlags(access, (DWORD)RequestedAccess::Read))  implied |= LookupProbe;
+        if (HasAllFlags(access, (DWORD)RequestedAccess::Write)) implied |= LookupProbeRead;
+
+        std::lock_guard<std::mutex> lock(reportedLock);
+        DWORD &cached = reported[path];
+        if (HasAllFlags(cached, access))
+        {
+            return false;
+        }
+
+        cached |= access | implied;
+        return true;
+    }
+} EsPip;
+
+/*! An access of a file carried by an ES message, checked against the policy of a pip with 'checker' */
+typedef struct {
+    FileOperation operation;
+    CheckFunc checker;
+    bool isDirectory;
+    /*! From the stat of the file the message carries, if it carries one (i.e., not for a path yet to be created) */
+    FileIdentity identity;
+    char path[MAXPATHLEN];
+} EsAccess;
+
+#pragma mark EndpointSecuritySandbox
+
+class EndpointSecuritySandbox
+{
+private:
+
+    es_client_t *client_;
+    AccessReportBatchCallback callback_;
+    size_t batchSize_;
+    std::chrono::milliseconds flushInterval_;
+
+    /*! The pip of every tracked process */
+    std::unordered_map<pid_t, std::shared_ptr<EsPip>> processes_;
+
+    /*! Number of tracked pips that can deny accesses; the AUTH events are subscribed to only while it is not 0 */
+    int numDenyingPips_;
+    std::mutex trackingLock_;
+
+    /*! Reports waiting to be handed to the callback, and the time the first of them was added */
+    std::vector<AccessReport> pending_;
+    std::chrono::steady_clock::time_point pendingSince_;
+    bool stopping_;
+    std::mutex batchLock_;
+    std::condition_variable reportsAdded_;
+    std::condition_variable reportsTaken_;
+    std::thread consumer_;
+
+    EndpointSecurityCounters counters_;
+
+    std::shared_ptr<EsPip> findPip(pid_t pid)
+    {
+        std::lock_guard<std::mutex> lock(trackingLock_);
+        auto it = processes_.find(pid);
+        return it == processes_.end() ? nullptr : it->second;
+    }
+
+    /*! Subscribes to the AUTH events when the first pip that can deny accesses is tracked.  Requires 'trackingLock_'. */
+    bool addDenyingPip();
+
+    /*! Unsubscribes from the AUTH events when the last pip that can deny accesses is gone.  Requires 'trackingLock_'. */
+    void removeDenyingPip();
+
+    /*! Stops tracking 'pid'; stops tracking its pip too (and returns true) if it was the last process of the pip. */
+    bool untrackProcess(pid_t pid, const std::shared_ptr<EsPip> &pip);
+
+    void handleMessage(const es_message_t *msg);
+    void handleFork(const es_message_t *msg, const std::shared_ptr<EsPip> &pip);
+    void handleExit(const es_message_t *msg, const std::shared_ptr<EsPip> &pip);
+    void handleFileAccess(const es_message_t *msg, const std::shared_ptr<EsPip> &pip);
+
+    void respond(const es_message_t *msg, bool deny);
+
+    void reportProcess(FileOperation operation, pid_t pid, const std::shared_ptr<EsPip> &pip,
+                       const es_process_t *process, uint64_t creationTime);
+    void enqueueReport(AccessReport &report);
+    void drainReports();
+
+public:
+
+    EndpointSecuritySandbox(AccessReportBatchCallback callback, int batchSize, uint flushIntervalMs)
+        : client_(nullptr), callback_(callback), batchSize_(batchSize > 0 ? batchSize : 1),
+          flushInterval_(flushIntervalMs), numDenyingPips_(0), stopping_(false), counters_()
+    {
+        pending_.reserve(batchSize_);
+    }
+
+    /*! Creates the ES client and subscribes to the NOTIFY events; returns 0 or one of the 'ES_*' error codes. */
+    int start();
+    void stop();
+
+    bool trackPip(pid_t processId, pipid_t pipId, const char *famBytes, int famBytesLength);
+    bool untrackPip(pipid_t pipId, pid_t processId);
+
+    void getCounters(EndpointSecurityCounters *result, bool reset);
+};
+
+// Events that are only observed: the accesses of pips that cannot deny any, and the process lifetime events
+static const es_event_type_t s_notifyEvents[] =
+{
+    ES_EVENT_TYPE_NOTIFY_FORK,
+    ES_EVENT_TYPE_NOTIFY_EXEC,
+    ES_EVENT_TYPE_NOTIFY_EXIT,
+    ES_EVENT_TYPE_NOTIFY_OPEN,
+    ES_EVENT_TYPE_NOTIFY_CLOSE,
+    ES_EVENT_TYPE_NOTIFY_CREATE,
+    ES_EVENT_TYPE_NOTIFY_UNLINK,
+    ES_EVENT_TYPE_NOTIFY_RENAME,
+    ES_EVENT_TYPE_NOTIFY_LINK,
+    ES_EVENT_TYPE_NOTIFY_READLINK,
+    ES_EVENT_TYPE_NOTIFY_LOOKUP,
+    ES_EVENT_TYPE_NOTIFY_STAT,
+    ES_EVENT_TYPE_NOTIFY_ACCESS,
+    ES_EVENT_TYPE_NOTIFY_READDIR,
+};
+
+// Events that have to be authorized for pips that can deny accesses (their NOTIFY counterparts are then ignored)
+static const es_event_type_t s_authEvents[] =
+{
+    ES_EVENT_TYPE_AUTH_EXEC,
+    ES_EVENT_TYPE_AUTH_OPEN,
+    ES_EVENT_TYPE_AUTH_CREATE,
+    ES_EVENT_TYPE_AUTH_UNLINK,
+    ES_EVENT_TYPE_AUTH_RENAME,
+    ES_EVENT_TYPE_AUTH_LINK,
+};
+
+static bool HasAuthCounterpart(es_event_type_t type)
+{
+    switch (type)
+    {
+        case ES_EVENT_TYPE_NOTIFY_EXEC:
+        case ES_EVENT_TYPE_NOTIFY_OPEN:
+        case ES_EVENT_TYPE_NOTIFY_CREATE:
+        case ES_EVENT_TYPE_NOTIFY_UNLINK:
+        case ES_EVENT_TYPE_NOTIFY_RENAME:
+        case ES_EVENT_TYPE_NOTIFY_LINK:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+int EndpointSecuritySandbox::start()
+{
+    es_new_client_result_t result = es_new_client(&client_, ^(es_client_t *client, const es_message_t *msg)
+    {
+        handleMessage(msg);
+    });
+
+    switch (result)
+    {
+        case ES_NEW_CLIENT_RESULT_SUCCESS:            break;
+        case ES_NEW_CLIENT_RESULT_ERR_NOT_ENTITLED:   return ES_CLIENT_NOT_ENTITLED;
+        case ES_NEW_CLIENT_RESULT_ERR_NOT_PERMITTED:
+        case ES_NEW_CLIENT_RESULT_ERR_NOT_PRIVILEGED: return ES_CLIENT_NOT_PERMITTED;
+        default:                                      return ES_CLIENT_CREATION_ERROR;
+    }
+
+    // everything this process does is known to it already
+    audit_token_t self;
+    mach_msg_type_number_t size = TASK_AUDIT_TOKEN_COUNT;
+    if (task_info(mach_task_self(), TASK_AUDIT_TOKEN, (task_info_t)&self, &size) == KERN_SUCCESS)
+    {
+        es_mute_process(client_, &self);
+    }
+
+    consumer_ = std::thread(&EndpointSecuritySandbox::drainReports, this);
+
+    if (es_subscribe(client_, s_notifyEvents, sizeof(s_notifyEvents) / sizeof(s_notifyEvents[0])) != ES_RETURN_SUCCESS)
+    {
+        stop();
+        return ES_SUBSCRIPTION_ERROR;
+    }
+
+    return 0;
+}
+
+void EndpointSecuritySandbox::stop()
+{
+    // let handlers that are held back by 'enqueueReport' go first, deleting the client waits for them
+    {
+        std::lock_guard<std::mutex> lock(batchLock_);
+        stopping_ = true;
+    }
+
+    reportsAdded_.notify_all();
+    reportsTaken_.notify_all();
+
+    if (client_ != nullptr)
+    {
+        es_unsubscribe_all(client_);
+        es_delete_client(client_);
+        client_ = nullptr;
+    }
+
+    if (consumer_.joinable())
+    {
+        consumer_.join();
+    }
+}
+
+bool EndpointSecuritySandbox::addDenyingPip()
+{
+    if (numDenyingPips_++ > 0)
+    {
+        return true;
+    }
+
+    if (es_subscribe(client_, s_authEvents, sizeof(s_authEvents) / sizeof(s_authEvents[0])) != ES_RETURN_SUCCESS)
+    {
+        log_error("Failed to subscribe to %s", "AUTH events");
+        numDenyingPips_--;
+        return false;
+    }
+
+    return true;
+}
+
+void EndpointSecuritySandbox::removeDenyingPip()
+{
+    if (--numDenyingPips_ == 0)
+    {
+        es_unsubscribe(client_, s_authEvents, sizeof(s_authEvents) / sizeof(s_authEvents[0]));
+    }
+}
+
+bool EndpointSecuritySandbox::trackPip(pid_t processId, pipid_t pipId, const char *famBytes, int famBytesLength)
+{
+    if (famBytes == NULL || famBytesLength <= 0)
+    {
+        return false;
+    }
+
+    // the caller reuses its buffer as soon as this returns, and the manifest points into the payload
+    std::shared_ptr<EsPip> pip = std::make_shared<EsPip>();
+    pip->payload.reset(new BYTE[famBytesLength]);
+    memcpy(pip->payload.get(), famBytes, famBytesLength);
+
+    if (!pip->fam.init(pip->payload.get(), famBytesLength) || pip->fam.HasErrors())
+    {
+        log_error("Could not parse FileAccessManifest: %s", pip->fam.Error());
+        return false;
+    }
+
+    pip->pipId            = pipId;
+    pip->rootPid          = processId;
+    pip->canDeny          = CheckFailUnexpectedFileAccesses(pip->fam.GetFamFlags());
+    pip->processTreeCount = 1;
+
+    std::lock_guard<std::mutex> lock(trackingLock_);
+    if (processes_.find(processId) != processes_.end() || (pip->canDeny && !addDenyingPip()))
+    {
+        return false;
+    }
+
+    processes_[processId] = pip;
+    return true;
+}
+
+bool EndpointSecuritySandbox::untrackPip(pipid_t pipId, pid_t processId)
+{
+    std::lock_guard<std::mutex> lock(trackingLock_);
+
+    std::shared_ptr<EsPip> pip;
+    for (auto it = processes_.begin(); it != processes_.end();)
+    {
+        if (it->second->pipId == pipId && it->second->rootPid == processId)
+        {
+            pip = it->second;
+            it = processes_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    if (!pip)
+    {
+        return false;
+    }
+
+    // exits of its processes that are still being handled find nothing left to untrack (see 'untrackProcess')
+    pip->processTreeCount = 0;
+    if (pip->canDeny)
+    {
+        removeDenyingPip();
+    }
+
+    return true;
+}
+
+bool EndpointSecuritySandbox::untrackProcess(pid_t pid, const std::shared_ptr<EsPip> &pip)
+{
+    std::lock_guard<std::mutex> lock(trackingLock_);
+
+    auto it = processes_.find(pid);
+    if (it == processes_.end() || it->second != pip)
+    {
+        return false;
+    }
+
+    processes_.erase(it);
+    if (--pip->processTreeCount > 0)
+    {
+        return false;
+    }
+
+    if (pip->canDeny)
+    {
+        removeDenyingPip();
+    }
+
+    return true;
+}
+
+void EndpointSecuritySandbox::handleMessage(const es_message_t *msg)
+{
+    bool isAuth = msg->action_type == ES_ACTION_TYPE_AUTH;
+    Increment(isAuth ? &counters_.numAuthMessages : &counters_.numNotifyMessages);
+
+    pid_t pid = audit_token_to_pid(msg->process->audit_token);
+    std::shared_ptr<EsPip> pip = findPip(pid);
+    if (!pip)
+    {
+        Increment(&counters_.numUntrackedMessages);
+        if (isAuth)
+        {
+            respond(msg, /*deny*/ false);
+        }
+
+        return;
+    }
+
+    switch (msg->event_type)
+    {
+        case ES_EVENT_TYPE_NOTIFY_FORK:
+            handleFork(msg, pip);
+            break;
+
+        case ES_EVENT_TYPE_NOTIFY_EXIT:
+            handleExit(msg, pip);
+            break;
+
+        default:
+            handleFileAccess(msg, pip);
+            break;
+    }
+
+    Timespan latency = MachTimeToTimespan(GetMachAbsoluteTime() - msg->mach_time);
+    if (isAuth)
+    {
+        counters_.authLatency += latency;
+    }
+    else
+    {
+        counters_.notifyLatency += latency;
+    }
+}
+
+void EndpointSecuritySandbox::handleFork(const es_message_t *msg, const std::shared_ptr<EsPip> &pip)
+{
+    pid_t childPid = audit_token_to_pid(msg->event.fork.child->audit_token);
+    {
+        std::lock_guard<std::mutex> lock(trackingLock_);
+        if (!processes_.emplace(childPid, pip).second)
+        {
+            return;
+        }
+
+        pip->processTreeCount++;
+    }
+
+    reportProcess(kOpProcessStart, childPid, pip, msg->event.fork.child, msg->mach_time);
+}
+
+void EndpointSecuritySandbox::handleExit(const es_message_t *msg, const std::shared_ptr<EsPip> &pip)
+{
+    pid_t pid = audit_token_to_pid(msg->process->audit_token);
+    reportProcess(kOpProcessExit, pid, pip, msg->process, msg->mach_time);
+
+    if (untrackProcess(pid, pip))
+    {
+        reportProcess(kOpProcessTreeCompleted, pid, pip, nullptr, msg->mach_time);
+    }
+}
+
+/*! Copies 'dir' (followed by a '/' and 'name', if given) to 'buffer'; returns false if the path does not fit. */
+static bool CopyPath(char *buffer, const es_string_token_t &dir, const es_string_token_t *name = nullptr)
+{
+    size_t length = dir.length + (name != nullptr ? 1 + name->length : 0);
+    if (length >= MAXPATHLEN)
+    {
+        return false;
+    }
+
+    memcpy(buffer, dir.data, dir.length);
+    if (name != nullptr)
+    {
+        buffer[dir.length] = '/';
+        memcpy(buffer + dir.length + 1, name->data, name->length);
+    }
+
+    buffer[length] = '\0';
+    return buffer[0] == '/';
+}
+
+static bool AddAccess(EsAccess *access, FileOperation operation, CheckFunc checker, const es_file_t *file)
+{
+    *access =
+    {
+        .operation   = operation,
+        .checker     = checker,
+        .isDirectory = S_ISDIR(file->stat.st_mode),
+        .identity    = { .volume = (uint64_t)(uint32_t)file->stat.st_dev, .file = (uint64_t)file->stat.st_ino },
+    };
+    return !file->path_truncated && CopyPath(access->path, file->path);
+}
+
+static bool AddAccess(EsAccess *access, FileOperation operation, CheckFunc checker, const es_file_t *dir,
+                      const es_string_token_t &name, bool isDirectory)
+{
+    *access = { .operation = operation, .checker = checker, .isDirectory = isDirectory };
+    return !dir->path_truncated && CopyPath(access->path, dir->path, &name);
+}
+
+/*!
+ * Translates a message into the accesses the kext would report for the same operation (see 'FileOpHandler',
+ * 'VNodeHandler' and 'TrustedBsdHandler').  Returns the number of accesses written to 'accesses' (at most 2).
+ */
+static int GetAccesses(const es_message_t *msg, FileAccessManifestFlag famFlags, EsAccess accesses[2])
+{
+    const es_event_create_t *create;
+    const es_event_rename_t *rename;
+    bool isDir, isSymlink;
+    CheckFunc checker;
+
+    switch (msg->event_type)
+    {
+        case ES_EVENT_TYPE_AUTH_EXEC:
+        case ES_EVENT_TYPE_NOTIFY_EXEC:
+            return AddAccess(&accesses[0], kOpKAuthVNodeExecute, Checkers::CheckExecute, msg->event.exec.target->executable);
+
+        case ES_EVENT_TYPE_AUTH_OPEN:
+        case ES_EVENT_TYPE_NOTIFY_OPEN:
+            isDir = S_ISDIR(msg->event.open.file->stat.st_mode);
+            return
+                isDir                              ? AddAccess(&accesses[0], kOpKAuthOpenDir, Checkers::CheckEnumerateDir, msg->event.open.file) :
+                (msg->event.open.fflag & FWRITE)   ? AddAccess(&accesses[0], kOpKAuthVNodeWrite, Checkers::CheckWrite, msg->event.open.file) :
+                                                     AddAccess(&accesses[0], kOpKAuthReadFile, Checkers::CheckRead, msg->event.open.file);
+
+        case ES_EVENT_TYPE_NOTIFY_CLOSE:
+            return msg->event.close.modified &&
+                AddAccess(&accesses[0], kOpKAuthCloseModified, Checkers::CheckWrite, msg->event.close.target);
+
+        case ES_EVENT_TYPE_AUTH_CREATE:
+        case ES_EVENT_TYPE_NOTIFY_CREATE:
+            create = &msg->event.create;
+            if (create->destination_type == ES_DESTINATION_TYPE_EXISTING_FILE)
+            {
+                return AddAccess(&accesses[0], kOpMacVNodeCreate, Checkers::CheckWrite, create->destination.existing_file);
+            }
+
+            isDir     = S_ISDIR(create->destination.new_path.mode);
+            isSymlink = S_ISLNK(create->destination.new_path.mode);
+            checker   =
+                isSymlink                                              ? Checkers::CheckCreateSymlink :
+                !isDir                                                 ? Checkers::CheckWrite :
+                CheckDirectoryCreationAccessEnforcement(famFlags)      ? Checkers::CheckCreateDirectory :
+                                                                         Checkers::CheckProbe;
+            return AddAccess(&accesses[0], kOpMacVNodeCreate, checker, create->destination.new_path.dir,
+                             create->destination.new_path.filename, isDir);
+
+        case ES_EVENT_TYPE_AUTH_UNLINK:
+        case ES_EVENT_TYPE_NOTIFY_UNLINK:
+            isDir = S_ISDIR(msg->event.unlink.target->stat.st_mode);
+            return AddAccess(&accesses[0], isDir ? kOpKAuthDeleteDir : kOpKAuthDeleteFile, Checkers::CheckWrite,
+                             msg->event.unlink.target);
+
+        case ES_EVENT_TYPE_AUTH_RENAME:
+        case ES_EVENT_TYPE_NOTIFY_RENAME:
+            rename = &msg->event.rename;
+            if (!AddAccess(&accesses[0], kOpKAuthMoveSource, Checkers::CheckRead, rename->source))
+            {
+                return 0;
+            }
+
+            isDir = S_ISDIR(rename->source->stat.st_mode);
+            return 1 + (rename->destination_type == ES_DESTINATION_TYPE_EXISTING_FILE
+                ? AddAccess(&accesses[1], kOpKAuthMoveDest, Checkers::CheckWrite, rename->destination.existing_file)
+                : AddAccess(&accesses[1], kOpKAuthMoveDest, Checkers::CheckWrite, rename->destination.new_path.dir,
+                            rename->destination.new_path.filename, isDir));
+
+        case ES_EVENT_TYPE_AUTH_LINK:
+        case ES_EVENT_TYPE_NOTIFY_LINK:
+            if (!AddAccess(&accesses[0], kOpKAuthCreateHardlinkSource, Checkers::CheckRead, msg->event.link.source))
+            {
+                return 0;
+            }
+
+            return 1 + AddAccess(&accesses[1], kOpKAuthCreateHardlinkDest, Checkers::CheckWrite, msg->event.link.target_dir,
+                                 msg->event.link.target_filename, /*isDirectory*/ false);
+
+        case ES_EVENT_TYPE_NOTIFY_READLINK:
+            return AddAccess(&accesses[0], kOpMacReadlink, Checkers::CheckRead, msg->event.readlink.source);
+
+        case ES_EVENT_TYPE_NOTIFY_LOOKUP:
+            return AddAccess(&accesses[0], kOpMacLookup, Checkers::CheckLookup, msg->event.lookup.source_dir,
+                             msg->event.lookup.relative_target, /*isDirectory*/ false);
+
+        case ES_EVENT_TYPE_NOTIFY_STAT:
+            return AddAccess(&accesses[0], kOpKAuthVNodeProbe, Checkers::CheckProbe, msg->event.stat.target);
+
+        case ES_EVENT_TYPE_NOTIFY_ACCESS:
+            return AddAccess(&accesses[0], kOpKAuthVNodeProbe, Checkers::CheckProbe, msg->event.access.target);
+
+        case ES_EVENT_TYPE_NOTIFY_READDIR:
+            return AddAccess(&accesses[0], kOpKAuthOpenDir, Checkers::CheckEnumerateDir, msg->event.readdir.target);
+
+        default:
+            return 0;
+    }
+}
+
+void EndpointSecuritySandbox::handleFileAccess(const es_message_t *msg, const std::shared_ptr<EsPip> &pip)
+{
+    bool isAuth = msg->action_type == ES_ACTION_TYPE_AUTH;
+
+    // pips that cannot deny accesses only need to be told about them, and those of pips that can were handled when they
+    // were authorized (the AUTH events are subscribed to for as long as such pips are tracked)
+    if (isAuth && !pip->canDeny)
+    {
+        respond(msg, /*deny*/ false);
+        return;
+    }
+
+    if (!isAuth && pip->canDeny && HasAuthCounterpart(msg->event_type))
+    {
+        return;
+    }
+
+    EsAccess accesses[2];
+    int count = GetAccesses(msg, pip->fam.GetFamFlags(), accesses);
+
+    bool deny = false;
+    AccessCheckResult results[2] = { AccessCheckResult::Invalid(), AccessCheckResult::Invalid() };
+    for (int i = 0; i < count; i++)
+    {
+        const char *path = accesses[i].path;
+        PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(pip->fam.GetUnixRootNode(), path + 1, strlen(path + 1));
+        if (!cursor.IsValid())
+        {
+            log_error("Invalid policy cursor for path '%s'", path);
+        }
+
+        PolicyResult policy = PolicyResult(pip->fam.GetFamFlags(), path, cursor, pip->fam.GetSuffixPolicies());
+        accesses[i].checker(policy, accesses[i].isDirectory, &results[i]);
+        deny |= results[i].ShouldDenyAccess();
+    }
+
+    // answer before reporting: the process is blocked until then
+    if (isAuth)
+    {
+        respond(msg, deny);
+        if (deny) Increment(&counters_.numDenied);
+    }
+
+    pid_t pid = audit_token_to_pid(msg->process->audit_token);
+    for (int i = 0; i < count; i++)
+    {
+        if (!results[i].ShouldReport() || !pip->CheckAndUpdate(accesses[i].path, results[i]))
+        {
+            continue;
+        }
+
+        AccessReport report =
+        {
+            .operation          = accesses[i].operation,
+            .pid                = pid,
+            .rootPid            = pip->rootPid,
+            .requestedAccess    = (DWORD)results[i].RequestedAccess,
+            .status             = results[i].GetFileAccessStatus(),
+            .reportExplicitly   = results[i].ReportLevel == ReportLevel::ReportExplicit,
+            .error              = 0,
+            .pipId              = pip->pipId,
+            .path               = {0},
+            .stats              = { .creationTime = msg->mach_time },
+            .fileIdentity       = accesses[i].identity,
+        };
+
+        strlcpy(report.path, accesses[i].path, sizeof(report.path));
+        enqueueReport(report);
+    }
+}
+
+void EndpointSecuritySandbox::respond(const es_message_t *msg, bool deny)
+{
+    // the results are never cached: the same process and file may be subject to the policy of another pip later
+    if (msg->event_type == ES_EVENT_TYPE_AUTH_OPEN)
+    {
+        es_respond_flags_result(client_, msg, deny ? 0 : UINT32_MAX, /*cache*/ false);
+    }
+    else
+    {
+        es_respond_auth_result(client_, msg, deny ? ES_AUTH_RESULT_DENY : ES_AUTH_RESULT_ALLOW, /*cache*/ false);
+    }
+}
+
+void EndpointSecuritySandbox::reportProcess(FileOperation operation, pid_t pid, const std::shared_ptr<EsPip> &pip,
+                                            const es_process_t *process, uint64_t creationTime)
+{
+    AccessReport report =
+    {
+        .operation          = operation,
+        .pid                = pid,
+        .rootPid            = pip->rootPid,
+        .requestedAccess    = operation == kOpProcessStart ? (DWORD)RequestedAccess::Read : 0,
+        .status             = FileAccessStatus::FileAccessStatus_Allowed,
+        .reportExplicitly   = 0,
+        .error              = 0,
+        .pipId              = pip->pipId,
+        .path               = {0},
+        .stats              = { .creationTime = creationTime }
+    };
+
+    if (process != nullptr && !CopyPath(report.path, process->executable->path))
+    {
+        strlcpy(report.path, "/unknown-process", sizeof(report.path));
+    }
+
+    enqueueReport(report);
+}
+
+void EndpointSecuritySandbox::enqueueReport(AccessReport &report)
+{
+    std::unique_lock<std::mutex> lock(batchLock_);
+
+    // hold the process back (the same way the kext does when its queues are full) until the callback catches up
+    reportsTaken_.wait(lock, [&]{ return stopping_ || pending_.size() < batchSize_ * kMaxPendingBatches; });
+    if (stopping_)
+    {
+        return;
+    }
+
+    report.stats.enqueueTime = GetMachAbsoluteTime();
+    pending_.push_back(report);
+
+    if (pending_.size() == 1)
+    {
+        pendingSince_ = std::chrono::steady_clock::now();
+        reportsAdded_.notify_one();
+    }
+    else if (pending_.size() == batchSize_)
+    {
+        reportsAdded_.notify_one();
+    }
+}
+
+void EndpointSecuritySandbox::drainReports()
+{
+    std::vector<AccessReport> batch;
+    batch.reserve(batchSize_);
+
+    std::unique_lock<std::mutex> lock(batchLock_);
+    while (true)
+    {
+        reportsAdded_.wait(lock, [&]{ return stopping_ || !pending_.empty(); });
+        if (stopping_)
+        {
+            break;
+        }
+
+        // give the batch some time to fill up
+        reportsAdded_.wait_until(lock, pendingSince_ + flushInterval_, [&]{ return stopping_ || pending_.size() >= batchSize_; });
+
+        batch.swap(pending_);
+        pendingSince_ = std::chrono::steady_clock::now();
+        lock.unlock();
+        reportsTaken_.notify_all();
+
+        uint64_t dequeueTime = GetMachAbsoluteTime();
+        for (size_t offset = 0; offset < batch.size(); offset += batchSize_)
+        {
+            int count = (int)std::min(batchSize_, batch.size() - offset);
+            for (int i = 0; i < count; i++)
+            {
+                batch[offset + i].stats.dequeueTime = dequeueTime;
+            }
+
+            callback_(batch.data() + offset, count, REPORT_QUEUE_SUCCESS);
+            Increment(&counters_.numBatches);
+        }
+
+        Increment(&counters_.numReports, batch.size());
+        batch.clear();
+        lock.lock();
+    }
+}
+
+void EndpointSecuritySandbox::getCounters(EndpointSecurityCounters *result, bool reset)
+{
+    *result = counters_;
+    if (reset)
+    {
+        counters_ = {};
+    }
+}
+
+#pragma mark Exported functions
+
+extern "C"
+{
+    void StartEndpointSecuritySandbox(AccessReportBatchCallback callback, int batchSize, uint flushIntervalMs,
+                                      EndpointSecurityInfo *info, long infoSize)
+    {
+        if (sizeof(EndpointSecurityInfo) != infoSize)
+        {
+            log_error("Wrong size of the EndpointSecurityInfo buffer: expected %ld, received %ld",
+                      sizeof(EndpointSecurityInfo), infoSize);
+            return;
+        }
+
+        info->sandbox = nullptr;
+
+        // the framework is weak-linked, so that the library still loads on systems that don't have it
+        if (callback == NULL || !__builtin_available(macOS 10.15, *))
+        {
+            info->error = ES_CLIENT_CREATION_ERROR;
+            return;
+        }
+
+        EndpointSecuritySandbox *sandbox = new EndpointSecuritySandbox(callback, batchSize, flushIntervalMs);
+        info->error = sandbox->start();
+        if (info->error != 0)
+        {
+            log_error("Failed to start the Endpoint Security client, error: %#X", info->error);
+            delete sandbox;
+            return;
+        }
+
+        info->sandbox = sandbox;
+    }
+
+    void StopEndpointSecuritySandbox(EndpointSecurityInfo info)
+    {
+        EndpointSecuritySandbox *sandbox = (EndpointSecuritySandbox *)info.sandbox;
+        if (sandbox != nullptr)
+        {
+            sandbox->stop();
+            delete sandbox;
+        }
+    }
+
+    bool EndpointSecuritySendPipStarted(const pid_t processId, pipid_t pipId, const char *const famBytes, int famBytesLength,
+                                        EndpointSecurityInfo info)
+    {
+        EndpointSecuritySandbox *sandbox = (EndpointSecuritySandbox *)info.sandbox;
+        return sandbox != nullptr && sandbox->trackPip(processId, pipId, famBytes, famBytesLength);
+    }
+
+    bool EndpointSecuritySendPipProcessTerminated(pipid_t pipId, pid_t processId, EndpointSecurityInfo info)
+    {
+        EndpointSecuritySandbox *sandbox = (EndpointSecuritySandbox *)info.sandbox;
+        return sandbox != nullptr && sandbox->untrackPip(pipId, processId);
+    }
+
+    void GetEndpointSecurityCounters(EndpointSecurityInfo info, EndpointSecurityCounters *result, bool reset)
+    {
+        EndpointSecuritySandbox *sandbox = (EndpointSecuritySandbox *)info.sandbox;
+        if (sandbox != nullptr)
+        {
+            sandbox->getCounters(result, reset);
+        }
+        else
+        {
+            *result = {};
+        }
+    }
+}
@@ -0,0 +1,63 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef EndpointSecurity_h
+#define EndpointSecurity_h
+
+#import "Sandbox.h"
+
+// Error codes of 'StartEndpointSecuritySandbox' (see 'EndpointSecurityInfo::error')
+#define ES_CLIENT_CREATION_ERROR                   0x200
+#define ES_CLIENT_NOT_ENTITLED                     0x400
+#define ES_CLIENT_NOT_PERMITTED                    0x800
+#define ES_SUBSCRIPTION_ERROR                      0x2000
+
+/*!
+ * A user-space alternative to the kernel extension, built on the Endpoint Security framework (macOS 10.15+).
+ *
+ * It shares the policy code with the kext (FileAccessManifestParser, PolicySearch, the Checkers) and hands the
+ * callback the same AccessReports the kext sends, so that clients can switch between the two (and compare them).
+ * Only the accesses a policy may deny, i.e., those of pips that fail unexpected file accesses, are authorized
+ * synchronously; everything else is observed through notifications, which are reported in batches.
+ */
+extern "C"
+{
+    typedef struct {
+        int error;
+        void *sandbox;
+    } EndpointSecurityInfo;
+
+    typedef struct {
+        uint64_t numAuthMessages;
+        uint64_t numNotifyMessages;
+        uint64_t numUntrackedMessages;
+        uint64_t numDenied;
+        uint64_t numReports;
+        uint64_t numBatches;
+        uint64_t numDroppedMessages;
+        LatencyHistogram authLatency;
+        LatencyHistogram notifyLatency;
+    } EndpointSecurityCounters;
+
+    /*!
+     * Creates an Endpoint Security client and starts delivering reports to 'callback', in batches of up to 'batchSize'
+     * reports from a thread of its own.  A batch is flushed as soon as it is full, or 'flushIntervalMs' after its first
+     * report was added (and right away if that is 0).
+     *
+     * The process must have the 'com.apple.developer.endpoint-security.client' entitlement and run as root.
+     */
+    void StartEndpointSecuritySandbox(AccessReportBatchCallback callback, int batchSize, uint flushIntervalMs,
+                                      EndpointSecurityInfo *info, long infoSize);
+    void StopEndpointSecuritySandbox(EndpointSecurityInfo info);
+
+    bool EndpointSecuritySendPipStarted(const pid_t processId, pipid_t pipId, const char *const famBytes, int famBytesLength,
+                                        EndpointSecurityInfo info);
+    bool EndpointSecuritySendPipProcessTerminated(pipid_t pipId, pid_t processId, EndpointSecurityInfo info);
+
+    /**
+     * Copies the counters of the client, and optionally resets them.
+     */
+    void GetEndpointSecurityCounters(EndpointSecurityInfo info, EndpointSecurityCounters *result, bool reset);
+}
+
+#endif /* EndpointSecurity_h */
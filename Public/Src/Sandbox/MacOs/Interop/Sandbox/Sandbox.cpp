@@ -5,14 +5,115 @@
 #include <IOKit/IODataQueueClient.h>
 #include <IOKit/kext/KextManager.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/sysctl.h>
+#include <unistd.h>
 #include <mach/mach_time.h>
+#include <pthread/qos.h>
 
 #include "Sandbox.h"
 #include "StringOperations.h"
 
 os_log_t logger = os_log_create(kBuildXLBundleIdentifier, "Logger");
 
+/*! Latencies of all reports received by this process since the last reset (see 'GetReportLatencies') */
+static ReportLatencies g_reportLatencies;
+
+/*! How the listeners wait for reports (see 'ConfigureReportListeners') */
+static uint g_listenerSpinMicroseconds = 0;
+static uint g_listenerQosClass = 0;
+
+/*! Counters of all listeners since 'g_listenerCountersStart' (see 'GetReportListenerCounters') */
+static std::atomic<uint64_t> g_listenerWakeups(0);
+static std::atomic<uint64_t> g_listenerSpinHits(0);
+static std::atomic<uint64_t> g_listenerCountersStart(0);
+
+/*! Whether the kext was configured with 'mapPipPayloads' (see 'SendPipStarted') */
+static bool g_mapPipPayloads = false;
+
+static Timespan MachTimeToTimespan(uint64_t machTime)
+{
+    static mach_timebase_info_data_t s_timebase;
+    if (s_timebase.denom == 0)
+    {
+        mach_timebase_info(&s_timebase);
+    }
+
+    return Timespan::fromNanoseconds(machTime * s_timebase.numer / s_timebase.denom);
+}
+
+static void RecordDuration(LatencyHistogram *histogram, uint64_t from, uint64_t to)
+{
+    // reports created in user space (e.g., by tests) may not carry all time stamps
+    if (from != 0 && to >= from)
+    {
+        *histogram += MachTimeToTimespan(to - from);
+    }
+}
+
+/*! Records the latencies of a report that has been handled by the callback (at 'callbackTime') */
+static void RecordReportLatencies(const AccessReport &report, uint64_t callbackTime)
+{
+    RecordDuration(&g_reportLatencies.creationToEnqueue, report.stats.creationTime, report.stats.enqueueTime);
+    RecordDuration(&g_reportLatencies.enqueueToDequeue,  report.stats.enqueueTime,  report.stats.dequeueTime);
+    RecordDuration(&g_reportLatencies.dequeueToCallback, report.stats.dequeueTime,  callbackTime);
+}
+
+#pragma mark Report capture
+
+// File format written by 'StartReportCapture': a 'ReportCaptureHeader' followed by one 'ReportCaptureRecord'
+// per report, each directly followed by the first 'size' bytes of the report (its fixed part and its path)
+#define kReportCaptureMagic   0x524C5842 // "BXLR"
+#define kReportCaptureVersion 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t reportSize;     // sizeof(AccessReport) of the writer; captures with a different layout are rejected
+    uint32_t timebaseNumer;  // mach timebase of the writer, for converting 'dequeueTime' to nanoseconds
+    uint32_t timebaseDenom;
+} ReportCaptureHeader;
+
+typedef struct {
+    uint64_t dequeueTime;
+    uint32_t size;
+} ReportCaptureRecord;
+
+/*! File the listeners append every received report to (see 'StartReportCapture'), or NULL */
+static FILE *g_reportCaptureFile = NULL;
+static std::mutex g_reportCaptureLock;
+
+static void CaptureReports(const AccessReport *reports, uint32_t count)
+{
+    std::lock_guard<std::mutex> lock(g_reportCaptureLock);
+    if (g_reportCaptureFile == NULL)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // compact, the same way the kext sends reports (see 'GetAccessReportSize')
+        ReportCaptureRecord record =
+        {
+            .dequeueTime = reports[i].stats.dequeueTime,
+            .size        = GetAccessReportSize(reports[i], /*compact*/ true),
+        };
+
+        fwrite(&record, sizeof(record), 1, g_reportCaptureFile);
+        fwrite(&reports[i], record.size, 1, g_reportCaptureFile);
+    }
+}
+
 class AutoRelease
 {
 private:
@@ -115,9 +216,10 @@ extern "C"
             return;
         }
 
+        uint32_t memoryType = MakeReportQueueMemoryType(FileAccessReporting, memoryInfo->queueIndex);
         do
         {
-            if (!SendClientAttached(info))
+            if (memoryInfo->queueIndex == 0 && !SendClientAttached(info))
             {
                 log_error("%s", "Failed sending BuildXL launch signal to kernel extension");
                 memoryInfo->error = KEXT_BUILDXL_LAUNCH_SIGNAL_FAIL;
@@ -133,7 +235,7 @@ extern "C"
             }
             memoryInfo->port = port;
 
-            kern_return_t result = IOConnectSetNotificationPort(info.connection, FileAccessReporting, port, 0);
+            kern_return_t result = IOConnectSetNotificationPort(info.connection, memoryType, port, 0);
             if (result != KERN_SUCCESS)
             {
                 log_error("%s", "Failed allocating notification port for shared memory region");
@@ -143,7 +245,7 @@ extern "C"
 
             mach_vm_size_t size = 0;
             mach_vm_address_t address = 0;
-            result = IOConnectMapMemory(info.connection, FileAccessReporting, mach_task_self(), &address, &size, kIOMapAnywhere);
+            result = IOConnectMapMemory(info.connection, memoryType, mach_task_self(), &address, &size, kIOMapAnywhere);
             if (result != KERN_SUCCESS)
             {
                 log_error("%s", "Failed mapping shared memory region");
@@ -164,6 +266,9 @@ extern "C"
     {
         log_debug("%s", "Freeing and closing service connection");
 
+        // the sampler pushes through this connection
+        StopResourceSampler();
+
         if (info.port != NULL) IONotificationPortDestroy(info.port);
         if (info.connection != IO_OBJECT_NULL) IOServiceClose(info.connection);
     }
@@ -178,7 +283,8 @@ extern "C"
         log_debug("%s", "Freeing mapped memory, mach port for shared data queue");
         if (memoryInfo.address != 0)
         {
-            IOConnectUnmapMemory(info.connection, FileAccessReporting, memoryInfo.port, memoryInfo.address);
+            IOConnectUnmapMemory(info.connection, MakeReportQueueMemoryType(FileAccessReporting, memoryInfo.queueIndex),
+                                 memoryInfo.port, memoryInfo.address);
         }
 
         if (MACH_PORT_VALID(memoryInfo.port))
@@ -248,6 +354,11 @@ extern "C"
         return NormalizeAndHashPath((PCPathChar)path, buffer, bufferSize);
     }
 
+    void NormalizePathsAndReturnHashes(const BYTE *paths, const size_t *lengths, size_t count, BYTE *buffer, int *hashes)
+    {
+        NormalizeAndHashPaths((PCPathChar)paths, lengths, count, (PPathChar)buffer, (DWORD *)hashes);
+    }
+
 #pragma mark SendPipStatus functions
 
     static bool SendPipStatus(const pid_t processId, pipid_t pipId, const char *const payload, int payloadLength,
@@ -279,9 +390,163 @@ extern "C"
         return true;
     }
 
+    static void RegisterPipReportRing(pipid_t pipId);
+
+    /*! A pip start waiting to be sent to the kext (see 'SendPipStartCombined') */
+    typedef struct {
+        PipStateChangedRequest request;
+        KextConnectionInfo info;
+        bool done;
+        bool result;
+    } PendingPipStart;
+
+    static std::mutex g_pipStartLock;
+    static std::condition_variable g_pipStartDone;
+    static std::deque<PendingPipStart*> g_pendingPipStarts;
+    static bool g_pipStartInFlight = false;
+
+    /*! Sends up to 'kMaxPipStartBatchSize' pip starts of the same connection in one call, setting the result of each */
+    static void SendPipStartBatch(PendingPipStart **batch, size_t count)
+    {
+        KextConnectionInfo info = batch[0]->info;
+        if (count == 1)
+        {
+            kern_return_t result = IOConnectCallStructMethod(info.connection, kIpcActionPipStateChanged,
+                                                             &batch[0]->request, sizeof(PipStateChangedRequest), NULL, NULL);
+            if (result != KERN_SUCCESS)
+            {
+                log_error("Failed calling SendPipStatus through IPC interface with error code: %#X for action: %d", result, batch[0]->request.action);
+            }
+
+            batch[0]->result = result == KERN_SUCCESS;
+            return;
+        }
+
+        PipStateChangedRequest requests[kMaxPipStartBatchSize];
+        IOReturn results[kMaxPipStartBatchSize];
+        for (size_t i = 0; i < count; i++)
+        {
+            requests[i] = batch[i]->request;
+        }
+
+        size_t resultsSize = count * sizeof(IOReturn);
+        kern_return_t result = IOConnectCallStructMethod(info.connection, kIpcActionPipsStarted,
+                                                         requests, count * sizeof(PipStateChangedRequest), results, &resultsSize);
+        if (result != KERN_SUCCESS)
+        {
+            log_error("Failed starting a batch of %zu pips through IPC interface with error code: %#X", count, result);
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            batch[i]->result = result == KERN_SUCCESS && results[i] == kIOReturnSuccess;
+        }
+
+        log_debug("Started a batch of %zu pips", count);
+    }
+
+    /*!
+     * Sends a pip start to the kext.  When other threads start pips while one is sending, their requests queue up, and
+     * the sending thread then hands all of them to the kext in a single (batched) call once its own returns, so that
+     * a burst of pip starts costs a few round trips instead of one per pip.  A pip start without contention is sent
+     * right away, on its own.
+     */
+    static bool SendPipStartCombined(const pid_t processId, pipid_t pipId, const char *const payload, int payloadLength, KextConnectionInfo info)
+    {
+        if (info.connection == IO_OBJECT_NULL)
+        {
+            return false;
+        }
+
+        PendingPipStart pending =
+        {
+            .request =
+            {
+                .pipId         = pipId,
+                .processId     = processId,
+                .clientPid     = getpid(),
+                .payload       = payload != NULL ? (uintptr_t) payload : 0,
+                .payloadLength = (uint64_t) payloadLength,
+                .action        = kBuildXLSandboxActionSendPipStarted
+            },
+            .info   = info,
+            .done   = false,
+            .result = false,
+        };
+
+        std::unique_lock<std::mutex> lock(g_pipStartLock);
+        g_pendingPipStarts.push_back(&pending);
+
+        if (g_pipStartInFlight)
+        {
+            // the sending thread picks this one up
+            g_pipStartDone.wait(lock, [&pending] { return pending.done; });
+            return pending.result;
+        }
+
+        g_pipStartInFlight = true;
+        while (!g_pendingPipStarts.empty())
+        {
+            PendingPipStart *batch[kMaxPipStartBatchSize];
+            size_t count = 0;
+            while (count < kMaxPipStartBatchSize && !g_pendingPipStarts.empty() &&
+                   (count == 0 || g_pendingPipStarts.front()->info.connection == batch[0]->info.connection))
+            {
+                batch[count++] = g_pendingPipStarts.front();
+                g_pendingPipStarts.pop_front();
+            }
+
+            lock.unlock();
+            SendPipStartBatch(batch, count);
+            lock.lock();
+
+            for (size_t i = 0; i < count; i++)
+            {
+                batch[i]->done = true;
+            }
+
+            g_pipStartDone.notify_all();
+        }
+
+        g_pipStartInFlight = false;
+        return pending.result;
+    }
+
+    static bool SendPipStartedToKext(const pid_t processId, pipid_t pipId, const char *const famBytes, int famBytesLength, KextConnectionInfo info)
+    {
+        if (!g_mapPipPayloads || famBytes == NULL || famBytesLength <= 0)
+        {
+            return SendPipStartCombined(processId, pipId, famBytes, famBytesLength, info);
+        }
+
+        // The kext maps the payload for the lifetime of the pip, and the caller's buffer is reused (or moved by the GC)
+        // as soon as this returns, so the payload goes into pages of its own.  Unmapping them right after the call is
+        // fine: the kext keeps them wired, and nothing in this process can write to them anymore.
+        void *pages = mmap(NULL, famBytesLength, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (pages == MAP_FAILED)
+        {
+            log_error("Failed to allocate %d bytes for the pip payload", famBytesLength);
+            return false;
+        }
+
+        memcpy(pages, famBytes, famBytesLength);
+        bool result = SendPipStartCombined(processId, pipId, (const char*)pages, famBytesLength, info);
+        munmap(pages, famBytesLength);
+        return result;
+    }
+
     bool SendPipStarted(const pid_t processId, pipid_t pipId, const char *const famBytes, int famBytesLength, KextConnectionInfo info)
     {
-        return SendPipStatus(processId, pipId, famBytes, famBytesLength, kBuildXLSandboxActionSendPipStarted, info);
+        // the ring has to be there before the first report of the pip can arrive
+        RegisterPipReportRing(pipId);
+
+        bool result = SendPipStartedToKext(processId, pipId, famBytes, famBytesLength, info);
+        if (!result)
+        {
+            UnregisterPipReportRing(pipId);
+        }
+
+        return result;
     }
 
     bool SendPipProcessTerminated(pipid_t pipId, pid_t processId, KextConnectionInfo info)
@@ -321,6 +586,11 @@ extern "C"
 
         kern_return_t status = IOConnectCallStructMethod(info.connection, kIpcActionConfigure,
                                                          &config, sizeof(KextConfig), NULL, NULL);
+        if (status == KERN_SUCCESS)
+        {
+            g_mapPipPayloads = config.mapPipPayloads;
+        }
+
         return status == KERN_SUCCESS;
     }
 
@@ -334,9 +604,44 @@ extern "C"
         uint64_t usages[2] = { cpuUsageBasisPoints, ramUsageBasisPoints };
         kern_return_t status = IOConnectCallScalarMethod(info.connection, kIpcActionUpdateResourceUsage,
                                                          usages, 2, NULL, NULL);
+
+        // piggyback on this periodic update to let the kext know the report latencies (for SandboxMonitor)
+        ReportLatencies latencies;
+        GetReportLatencies(&latencies, false);
+        IOConnectCallStructMethod(info.connection, kIpcActionUpdateReportLatencies,
+                                  &latencies, sizeof(ReportLatencies), NULL, NULL);
+
         return status == KERN_SUCCESS;
     }
 
+    void ConfigureReportListeners(uint spinMicroseconds, uint qosClass)
+    {
+        g_listenerSpinMicroseconds = spinMicroseconds;
+        g_listenerQosClass         = qosClass;
+    }
+
+    __cdecl void GetReportListenerCounters(ReportListenerCounters *result, bool reset)
+    {
+        uint64_t now   = GetMachAbsoluteTime();
+        uint64_t start = reset ? g_listenerCountersStart.exchange(now) : g_listenerCountersStart.load();
+        double seconds = start != 0 && now > start ? MachTimeToTimespan(now - start).micros() / 1000000.0 : 0;
+
+        result->numWakeups            = reset ? g_listenerWakeups.exchange(0) : g_listenerWakeups.load();
+        result->numSpinHits           = reset ? g_listenerSpinHits.exchange(0) : g_listenerSpinHits.load();
+        result->wakeupsPerSecond      = seconds > 0 ? result->numWakeups / seconds : 0;
+        result->p99EnqueueToDequeueUs = g_reportLatencies.enqueueToDequeue.percentileUs(99);
+    }
+
+    __cdecl void GetReportLatencies(ReportLatencies *result, bool reset)
+    {
+        *result = g_reportLatencies;
+        if (reset)
+        {
+            // reports recorded between the copy and the reset are lost, which is fine for rolling statistics
+            bzero(&g_reportLatencies, sizeof(g_reportLatencies));
+        }
+    }
+
     bool SendClientAttached(KextConnectionInfo info)
     {
         log_debug("Indicating client launching with PID (%d)", getpid());
@@ -360,8 +665,455 @@ extern "C"
         return status == KERN_SUCCESS;
     }
 
+    bool IntrospectKernelExtensionLatencies(KextConnectionInfo info, LatencyHistograms *result)
+    {
+        if (info.connection == IO_OBJECT_NULL)
+        {
+            return false;
+        }
+
+        IntrospectRequest request;
+        size_t resultSize = sizeof(LatencyHistograms);
+        kern_return_t status = IOConnectCallStructMethod(info.connection, kIpcActionIntrospectLatencies,
+                                                         &request, sizeof(IntrospectRequest),
+                                                         result, &resultSize);
+        return status == KERN_SUCCESS;
+    }
+
+    bool IntrospectKernelExtensionProcesses(KextConnectionInfo info, pid_t cursor, IntrospectProcessesResponse *result)
+    {
+        if (info.connection == IO_OBJECT_NULL)
+        {
+            return false;
+        }
+
+        IntrospectProcessesRequest request = { .cursor = cursor };
+        size_t resultSize = sizeof(IntrospectProcessesResponse);
+        kern_return_t status = IOConnectCallStructMethod(info.connection, kIpcActionIntrospectProcesses,
+                                                         &request, sizeof(IntrospectProcessesRequest),
+                                                         result, &resultSize);
+        return status == KERN_SUCCESS;
+    }
+
+    bool DumpKernelExtensionEventTrace(KextConnectionInfo info, uint ring, EventTraceDumpResponse *result)
+    {
+        if (info.connection == IO_OBJECT_NULL)
+        {
+            return false;
+        }
+
+        EventTraceDumpRequest request = { .ring = ring };
+        size_t resultSize = sizeof(EventTraceDumpResponse);
+        kern_return_t status = IOConnectCallStructMethod(info.connection, kIpcActionDumpEventTrace,
+                                                         &request, sizeof(EventTraceDumpRequest),
+                                                         result, &resultSize);
+        return status == KERN_SUCCESS;
+    }
+
+#pragma mark Resource sampler
+
+    /*! Sampler thread started by 'StartResourceSampler', and what it waits on between samples */
+    static std::thread g_resourceSampler;
+    static std::mutex g_resourceSamplerLock;
+    static std::condition_variable g_resourceSamplerWakeup;
+    static bool g_resourceSamplerStopRequested = false;
+
+    /*!
+     * Computes the available RAM the same way PerformanceCollector.cs does on macOS (the physical memory minus app memory,
+     * wired and compressed pages), so that the kext sees the same numbers whichever side pushes them.
+     */
+    static bool GetAvailableRamMB(host_t host, uint64_t physicalMemory, uint *availableRamMB)
+    {
+        vm_size_t pageSize;
+        struct vm_statistics64 stats;
+        mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+
+        if (host_page_size(host, &pageSize) != KERN_SUCCESS ||
+            host_statistics64(host, HOST_VM_INFO64, (host_info64_t)&stats, &count) != KERN_SUCCESS)
+        {
+            return false;
+        }
+
+        uint64_t appMemory = (uint64_t)(stats.internal_page_count - stats.purgeable_count) * pageSize;
+        uint64_t used      = appMemory + (uint64_t)(stats.wire_count + stats.compressor_page_count) * pageSize;
+
+        *availableRamMB = used < physicalMemory ? (uint)((physicalMemory - used) >> 20) : 0;
+        return true;
+    }
+
+    static void RunResourceSampler(uint intervalMs, KextConnectionInfo info)
+    {
+        // HOST_CPU_LOAD_INFO aggregates the ticks of all cores into a fixed-size struct, so unlike the per-core
+        // 'host_processor_info' (see GetCpuLoadInfo) nothing is allocated per sample
+        host_t host = mach_host_self();
+
+        uint64_t physicalMemory = 0;
+        size_t physicalMemorySize = sizeof(physicalMemory);
+        sysctlbyname("hw.memsize", &physicalMemory, &physicalMemorySize, NULL, 0);
+
+        host_cpu_load_info_data_t previous = { 0 };
+        mach_msg_type_number_t count = HOST_CPU_LOAD_INFO_COUNT;
+        bool hasPrevious = host_statistics(host, HOST_CPU_LOAD_INFO, (host_info_t)&previous, &count) == KERN_SUCCESS;
+
+        std::unique_lock<std::mutex> lock(g_resourceSamplerLock);
+        while (!g_resourceSamplerWakeup.wait_for(lock, std::chrono::milliseconds(intervalMs), [] { return g_resourceSamplerStopRequested; }))
+        {
+            host_cpu_load_info_data_t current;
+            count = HOST_CPU_LOAD_INFO_COUNT;
+            if (host_statistics(host, HOST_CPU_LOAD_INFO, (host_info_t)&current, &count) != KERN_SUCCESS)
+            {
+                continue;
+            }
+
+            if (hasPrevious)
+            {
+                // tick counters are 32-bit and wrap around, which unsigned subtraction takes care of
+                natural_t user   = (current.cpu_ticks[CPU_STATE_USER] - previous.cpu_ticks[CPU_STATE_USER]) +
+                                   (current.cpu_ticks[CPU_STATE_NICE] - previous.cpu_ticks[CPU_STATE_NICE]);
+                natural_t system = current.cpu_ticks[CPU_STATE_SYSTEM] - previous.cpu_ticks[CPU_STATE_SYSTEM];
+                natural_t idle   = current.cpu_ticks[CPU_STATE_IDLE] - previous.cpu_ticks[CPU_STATE_IDLE];
+                uint64_t total   = (uint64_t)user + system + idle;
+
+                uint availableRamMB;
+                if (total > 0 && GetAvailableRamMB(host, physicalMemory, &availableRamMB))
+                {
+                    uint cpuUsageBasisPoints = (uint)(((uint64_t)user + system) * 10000 / total);
+                    UpdateCurrentResourceUsage(cpuUsageBasisPoints, availableRamMB, info);
+                }
+            }
+
+            previous = current;
+            hasPrevious = true;
+        }
+
+        mach_port_deallocate(mach_task_self(), host);
+    }
+
+    bool StartResourceSampler(uint intervalMs, KextConnectionInfo info)
+    {
+        if (info.connection == IO_OBJECT_NULL || intervalMs == 0)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(g_resourceSamplerLock);
+        if (g_resourceSampler.joinable())
+        {
+            return false;
+        }
+
+        g_resourceSamplerStopRequested = false;
+        g_resourceSampler = std::thread(RunResourceSampler, intervalMs, info);
+        return true;
+    }
+
+    void StopResourceSampler(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(g_resourceSamplerLock);
+            if (!g_resourceSampler.joinable())
+            {
+                return;
+            }
+
+            g_resourceSamplerStopRequested = true;
+        }
+
+        g_resourceSamplerWakeup.notify_all();
+        g_resourceSampler.join();
+    }
+
+#pragma mark Per-pip report rings
+
+    /*!
+     * Reports of one pip.  They are written by the listener of the report queue the pip belongs to (all reports of a pip go
+     * through the same queue, see 'getQueueForPip' in the kext) and read by the executor of the pip: a single producer and a
+     * single consumer.  When the ring is full the listener does not wait for the consumer, which would hold up the other pips
+     * of the queue; it appends to 'overflow' instead, and keeps doing so until the consumer has taken all of it, so that the
+     * reports are read in the order they were received.
+     */
+    struct PipReportRing
+    {
+        PipReportRing(uint capacity) : slots(new AccessReport[capacity]), capacity(capacity) { }
+
+        std::unique_ptr<AccessReport[]> slots;
+        const uint capacity;                        // a power of 2
+        std::atomic<uint64_t> head { 0 };           // next slot to read, only advanced by the consumer
+        std::atomic<uint64_t> tail { 0 };           // next slot to write, only advanced by the producer
+        std::atomic<bool> overflowed { false };     // whether 'overflow' has reports; only cleared by the consumer
+        std::atomic<bool> consumerWaiting { false };
+        std::atomic<bool> closed { false };
+        std::mutex lock;                            // guards 'overflow' and the waits of the consumer
+        std::condition_variable available;
+        std::deque<AccessReport> overflow;
+    };
+
+    /*! Capacity of the rings 'SendPipStarted' registers, or 0 if the reports are not demultiplexed (see 'EnablePipReportRings') */
+    static uint g_pipReportRingCapacity = 0;
+    static std::mutex g_pipReportRingsLock;
+    static std::unordered_map<pipid_t, std::shared_ptr<PipReportRing>> g_pipReportRings;
+
+    bool EnablePipReportRings(uint capacity, long accessReportSize)
+    {
+        if (sizeof(AccessReport) != accessReportSize)
+        {
+            log_error("Wrong size of the AccessReport buffer: expected %ld, received %ld", sizeof(AccessReport), accessReportSize);
+            return false;
+        }
+
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+        {
+            return false;
+        }
+
+        g_pipReportRingCapacity = capacity;
+        return true;
+    }
+
+    static void RegisterPipReportRing(pipid_t pipId)
+    {
+        if (g_pipReportRingCapacity == 0)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(g_pipReportRingsLock);
+        g_pipReportRings[pipId] = std::make_shared<PipReportRing>(g_pipReportRingCapacity);
+    }
+
+    void UnregisterPipReportRing(pipid_t pipId)
+    {
+        std::shared_ptr<PipReportRing> ring;
+        {
+            std::lock_guard<std::mutex> lock(g_pipReportRingsLock);
+            auto it = g_pipReportRings.find(pipId);
+            if (it == g_pipReportRings.end())
+            {
+                return;
+            }
+
+            ring = std::move(it->second);
+            g_pipReportRings.erase(it);
+        }
+
+        ring->closed.store(true);
+
+        std::lock_guard<std::mutex> lock(ring->lock);
+        ring->available.notify_all();
+    }
+
+    static std::shared_ptr<PipReportRing> FindPipReportRing(pipid_t pipId)
+    {
+        std::lock_guard<std::mutex> lock(g_pipReportRingsLock);
+        auto it = g_pipReportRings.find(pipId);
+        return it != g_pipReportRings.end() ? it->second : nullptr;
+    }
+
+    static void PostToPipReportRing(PipReportRing *ring, const AccessReport &report)
+    {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        if (!ring->overflowed.load() && tail - ring->head.load(std::memory_order_acquire) < ring->capacity)
+        {
+            // only the used part of the path, like the kext sends it
+            memcpy(&ring->slots[tail & (ring->capacity - 1)], &report, GetAccessReportSize(report, /*compact*/ true));
+
+            // sequentially consistent, like the load of 'consumerWaiting' below and the stores of the consumer before it
+            // waits: either the consumer sees this report, or this sees that the consumer waits
+            ring->tail.store(tail + 1);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(ring->lock);
+            ring->overflow.push_back(report);
+            ring->overflowed.store(true);
+        }
+
+        if (ring->consumerWaiting.load())
+        {
+            std::lock_guard<std::mutex> lock(ring->lock);
+            ring->available.notify_one();
+        }
+    }
+
+    /*!
+     * Moves the reports of the pips that have a ring from 'reports' to their rings, and compacts the others (which the
+     * managed side routes itself) to the front.  Returns how many are left in 'reports'.
+     */
+    static uint32_t PostToPipReportRings(AccessReport *reports, uint32_t count)
+    {
+        uint32_t numLeft = 0;
+        std::shared_ptr<PipReportRing> ring;
+        pipid_t ringPipId = 0;
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            // the reports of a pip mostly come in runs
+            if (!ring || ringPipId != reports[i].pipId)
+            {
+                ringPipId = reports[i].pipId;
+                ring = FindPipReportRing(ringPipId);
+            }
+
+            if (ring)
+            {
+                PostToPipReportRing(ring.get(), reports[i]);
+            }
+            else if (numLeft++ != i)
+            {
+                reports[numLeft - 1] = reports[i];
+            }
+        }
+
+        return numLeft;
+    }
+
+    static bool HasReports(PipReportRing *ring)
+    {
+        return ring->tail.load() != ring->head.load(std::memory_order_relaxed) || ring->overflowed.load();
+    }
+
+    static int TakeReports(PipReportRing *ring, AccessReport *buffer, int capacity)
+    {
+        int count = 0;
+
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        for (; head != tail && count < capacity; head++)
+        {
+            buffer[count++] = ring->slots[head & (ring->capacity - 1)];
+        }
+
+        ring->head.store(head, std::memory_order_release);
+
+        if (count < capacity && ring->overflowed.load())
+        {
+            std::lock_guard<std::mutex> lock(ring->lock);
+
+            // while there is an overflow the producer leaves the ring alone, and what is still in it came first
+            tail = ring->tail.load(std::memory_order_acquire);
+            for (; head != tail && count < capacity; head++)
+            {
+                buffer[count++] = ring->slots[head & (ring->capacity - 1)];
+            }
+
+            ring->head.store(head, std::memory_order_release);
+
+            while (head == tail && count < capacity && !ring->overflow.empty())
+            {
+                buffer[count++] = ring->overflow.front();
+                ring->overflow.pop_front();
+            }
+
+            if (head == tail && ring->overflow.empty())
+            {
+                ring->overflowed.store(false);
+            }
+        }
+
+        return count;
+    }
+
+    int DrainPipReports(pipid_t pipId, AccessReport *buffer, int capacity, int timeoutMs)
+    {
+        std::shared_ptr<PipReportRing> ring = FindPipReportRing(pipId);
+        if (!ring || buffer == NULL || capacity <= 0)
+        {
+            return -1;
+        }
+
+        int count = TakeReports(ring.get(), buffer, capacity);
+        if (count == 0 && timeoutMs > 0)
+        {
+            std::unique_lock<std::mutex> lock(ring->lock);
+            ring->consumerWaiting.store(true);
+            ring->available.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&ring]
+            {
+                return ring->closed.load() || HasReports(ring.get());
+            });
+            ring->consumerWaiting.store(false);
+            lock.unlock();
+
+            count = TakeReports(ring.get(), buffer, capacity);
+        }
+
+        if (count == 0 && ring->closed.load())
+        {
+            return -1;
+        }
+
+        uint64_t callbackTime = GetMachAbsoluteTime();
+        for (int i = 0; i < count; i++)
+        {
+            RecordReportLatencies(buffer[i], callbackTime);
+        }
+
+        return count;
+    }
+
 #pragma mark IOSharedDataQueue consumer code
 
+    static inline void CpuRelax()
+    {
+#if defined(__x86_64__)
+        __builtin_ia32_pause();
+#elif defined(__arm64__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    /**
+     * Applies the configuration of 'ConfigureReportListeners' to the calling listener thread.
+     */
+    static void SetUpListenerThread()
+    {
+        uint64_t none = 0;
+        g_listenerCountersStart.compare_exchange_strong(none, GetMachAbsoluteTime());
+
+        if (g_listenerQosClass != 0)
+        {
+            int error = pthread_set_qos_class_self_np((qos_class_t)g_listenerQosClass, 0);
+            if (error != 0)
+            {
+                log_error("Could not set the QoS class of the listener to %#x: %d", g_listenerQosClass, error);
+            }
+        }
+    }
+
+    /**
+     * Waits until 'queue' has data: bursts of reports often come right after another, so the listener first keeps polling
+     * the queue for a while (if so configured), and only then blocks on 'port', which costs a mach message and a wakeup.
+     *
+     * @result False if waiting on 'port' failed (e.g., because the queue is going away).
+     */
+    static bool WaitForReports(IODataQueueMemory *queue, mach_port_t port)
+    {
+        if (g_listenerSpinMicroseconds > 0)
+        {
+            static mach_timebase_info_data_t s_timebase;
+            if (s_timebase.denom == 0)
+            {
+                mach_timebase_info(&s_timebase);
+            }
+
+            uint64_t spinMachTime = (uint64_t)g_listenerSpinMicroseconds * 1000 * s_timebase.denom / s_timebase.numer;
+            uint64_t deadline = GetMachAbsoluteTime() + spinMachTime;
+            do
+            {
+                if (IODataQueueDataAvailable(queue))
+                {
+                    g_listenerSpinHits.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+
+                CpuRelax();
+            }
+            while (GetMachAbsoluteTime() < deadline);
+        }
+
+        g_listenerWakeups.fetch_add(1, std::memory_order_relaxed);
+        return IODataQueueWaitForAvailableData(queue, port) == kIOReturnSuccess;
+    }
+
     /**
      * Call this function once only from a dedicated thread and pass a valid C# delegate callback, the address to
      * the shared memory region and a valid mach port.
@@ -386,12 +1138,15 @@ extern "C"
         }
 
         log_debug("Listening for data on shared queue from process: %d", getpid());
+        SetUpListenerThread();
 
         IODataQueueMemory *queue = (IODataQueueMemory *)address;
         do
         {
             while (IODataQueueDataAvailable(queue))
             {
+                // the kext sends either whole reports or, if configured with 'enableCompactReports', only their
+                // fixed part followed by the used part of their path
                 AccessReport report;
                 uint32_t reportSize = sizeof(report);
 
@@ -404,22 +1159,320 @@ extern "C"
                     return;
                 }
 
-                if (reportSize != sizeof(report))
+                if (reportSize <= kAccessReportHeaderSize || reportSize > sizeof(report))
                 {
-                    log_error("AccessReport size mismatch :: reported: %d, expected: %ld", reportSize, sizeof(report));
+                    log_error("AccessReport size mismatch :: reported: %d, expected: %ld to %ld", reportSize, kAccessReportHeaderSize + 1, sizeof(report));
                     callback(AccessReport{}, REPORT_QUEUE_DEQUEUE_ERROR);
                     continue;
                 }
 
+                // the last received byte is the terminating null character of the path
+                ((char *)&report)[reportSize - 1] = '\0';
+
                 report.stats.dequeueTime = GetMachAbsoluteTime();
+                CaptureReports(&report, 1);
                 callback(report, REPORT_QUEUE_SUCCESS);
+                RecordReportLatencies(report, GetMachAbsoluteTime());
             }
         }
-        while (IODataQueueWaitForAvailableData(queue, port) == kIOReturnSuccess);
+        while (WaitForReports(queue, port));
 
         log_debug("Exiting ListenForFileAccessReports for PID (%d)", getpid());
     }
 
+    /**
+     * Copies up to 'capacity' reports from the head of 'queue' into 'buffer' and then advances the head once, past all
+     * of them.  Walks the entries the same way (and with the same bounds checks) as IODataQueueDequeue.  Entries that
+     * are not of a valid report size are skipped and counted in '*numSkipped'.
+     *
+     * @result kIOReturnSuccess, or kIOReturnError if the queue is corrupted.
+     */
+    static IOReturn DequeueReports(IODataQueueMemory *queue, AccessReport *buffer, uint32_t capacity,
+                                   uint32_t *count, uint32_t *numSkipped)
+    {
+        *count      = 0;
+        *numSkipped = 0;
+
+        uint32_t queueSize  = queue->queueSize;
+        uint32_t headOffset = __c11_atomic_load((_Atomic uint32_t *)&queue->head, __ATOMIC_RELAXED);
+        uint32_t tailOffset = __c11_atomic_load((_Atomic uint32_t *)&queue->tail, __ATOMIC_ACQUIRE);
+
+        while (headOffset != tailOffset && *count < capacity)
+        {
+            if (headOffset > queueSize)
+            {
+                return kIOReturnError;
+            }
+
+            // an entry that does not fit at the end of the queue (not even its header) was enqueued at its beginning
+            IODataQueueEntry *entry = (IODataQueueEntry *)((char *)queue->queue + headOffset);
+            if (queueSize - headOffset < DATA_QUEUE_ENTRY_HEADER_SIZE ||
+                queueSize - headOffset - DATA_QUEUE_ENTRY_HEADER_SIZE < entry->size)
+            {
+                entry      = queue->queue;
+                headOffset = 0;
+            }
+
+            uint32_t entrySize = entry->size;
+            if (queueSize - headOffset < DATA_QUEUE_ENTRY_HEADER_SIZE ||
+                queueSize - headOffset - DATA_QUEUE_ENTRY_HEADER_SIZE < entrySize)
+            {
+                return kIOReturnError;
+            }
+
+            headOffset += DATA_QUEUE_ENTRY_HEADER_SIZE + entrySize;
+
+            if (entrySize <= kAccessReportHeaderSize || entrySize > sizeof(AccessReport))
+            {
+                log_error("AccessReport size mismatch :: reported: %d, expected: %ld to %ld", entrySize, kAccessReportHeaderSize + 1, sizeof(AccessReport));
+                ++*numSkipped;
+                continue;
+            }
+
+            AccessReport *report = &buffer[(*count)++];
+            memcpy(report, &entry->data, entrySize);
+
+            // the last received byte is the terminating null character of the path
+            ((char *)report)[entrySize - 1] = '\0';
+        }
+
+        __c11_atomic_store((_Atomic uint32_t *)&queue->head, headOffset, __ATOMIC_RELEASE);
+
+        if (headOffset == tailOffset)
+        {
+            // same as IODataQueueDequeue: when making the queue empty, make sure that either the enqueuer notices
+            // or we notice the enqueue that raced with it
+            __c11_atomic_thread_fence(__ATOMIC_SEQ_CST);
+        }
+
+        uint64_t dequeueTime = GetMachAbsoluteTime();
+        for (uint32_t i = 0; i < *count; i++)
+        {
+            buffer[i].stats.dequeueTime = dequeueTime;
+        }
+
+        return kIOReturnSuccess;
+    }
+
+    __cdecl void ListenForFileAccessReportsBatched(AccessReportBatchCallback callback, int batchSize, long accessReportSize,
+                                                   mach_vm_address_t address, mach_port_t port)
+    {
+        if (sizeof(AccessReport) != accessReportSize)
+        {
+            log_error("Wrong size of the AccessReport buffer: expected %ld, received %ld",
+                      sizeof(AccessReport), accessReportSize);
+            if (callback != NULL) callback(NULL, 0, KEXT_WRONG_BUFFER_SIZE);
+            return;
+        }
+
+        if (callback == NULL || batchSize <= 0 || address == 0 || !MACH_PORT_VALID(port))
+        {
+            if (callback != NULL)
+            {
+                callback(NULL, 0, REPORT_QUEUE_CONNECTION_ERROR);
+            }
+            return;
+        }
+
+        std::unique_ptr<AccessReport[]> buffer(new AccessReport[batchSize]);
+
+        log_debug("Listening for data on shared queue from process: %d (batches of %d)", getpid(), batchSize);
+        SetUpListenerThread();
+
+        IODataQueueMemory *queue = (IODataQueueMemory *)address;
+        do
+        {
+            while (IODataQueueDataAvailable(queue))
+            {
+                uint32_t count, numSkipped;
+                IOReturn result = DequeueReports(queue, buffer.get(), batchSize, &count, &numSkipped);
+
+                if (result != kIOReturnSuccess)
+                {
+                    log_error("Received bogus access report batch: Error Code: %#X", result);
+                    callback(NULL, 0, REPORT_QUEUE_DEQUEUE_ERROR);
+                    return;
+                }
+
+                if (count > 0)
+                {
+                    CaptureReports(buffer.get(), count);
+                }
+
+                if (count > 0 && g_pipReportRingCapacity > 0)
+                {
+                    count = PostToPipReportRings(buffer.get(), count);
+                }
+
+                if (count > 0)
+                {
+                    callback(buffer.get(), count, REPORT_QUEUE_SUCCESS);
+
+                    uint64_t callbackTime = GetMachAbsoluteTime();
+                    for (uint32_t i = 0; i < count; i++)
+                    {
+                        RecordReportLatencies(buffer[i], callbackTime);
+                    }
+                }
+
+                if (numSkipped > 0)
+                {
+                    callback(NULL, 0, REPORT_QUEUE_DEQUEUE_ERROR);
+                }
+            }
+        }
+        while (WaitForReports(queue, port));
+
+        log_debug("Exiting ListenForFileAccessReportsBatched for PID (%d)", getpid());
+    }
+
+#pragma mark Report capture and replay
+
+    bool StartReportCapture(const char *path)
+    {
+        std::lock_guard<std::mutex> lock(g_reportCaptureLock);
+        if (g_reportCaptureFile != NULL || path == NULL)
+        {
+            return false;
+        }
+
+        FILE *file = fopen(path, "wb");
+        if (file == NULL)
+        {
+            log_error("Could not open report capture file '%s'", path);
+            return false;
+        }
+
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        ReportCaptureHeader header =
+        {
+            .magic         = kReportCaptureMagic,
+            .version       = kReportCaptureVersion,
+            .reportSize    = sizeof(AccessReport),
+            .timebaseNumer = timebase.numer,
+            .timebaseDenom = timebase.denom,
+        };
+
+        if (fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            fclose(file);
+            return false;
+        }
+
+        g_reportCaptureFile = file;
+        return true;
+    }
+
+    void StopReportCapture()
+    {
+        std::lock_guard<std::mutex> lock(g_reportCaptureLock);
+        if (g_reportCaptureFile != NULL)
+        {
+            fclose(g_reportCaptureFile);
+            g_reportCaptureFile = NULL;
+        }
+    }
+
+    __cdecl int ReplayFileAccessReports(const char *path, AccessReportBatchCallback callback, int batchSize,
+                                        long accessReportSize, bool realTime)
+    {
+        if (sizeof(AccessReport) != accessReportSize)
+        {
+            log_error("Wrong size of the AccessReport buffer: expected %ld, received %ld",
+                      sizeof(AccessReport), accessReportSize);
+            return -1;
+        }
+
+        if (path == NULL || callback == NULL || batchSize <= 0)
+        {
+            return -1;
+        }
+
+        FILE *file = fopen(path, "rb");
+        if (file == NULL)
+        {
+            log_error("Could not open report capture file '%s'", path);
+            return -1;
+        }
+
+        ReportCaptureHeader header;
+        if (fread(&header, sizeof(header), 1, file) != 1 ||
+            header.magic != kReportCaptureMagic ||
+            header.version != kReportCaptureVersion ||
+            header.reportSize != sizeof(AccessReport) ||
+            header.timebaseDenom == 0)
+        {
+            log_error("'%s' is not a report capture of this version", path);
+            fclose(file);
+            return -1;
+        }
+
+        std::unique_ptr<AccessReport[]> buffer(new AccessReport[batchSize]);
+        uint32_t count = 0;
+        int numReplayed = 0;
+
+        uint64_t firstCaptureTime = 0;
+        uint64_t startTime = GetMachAbsoluteTime();
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+
+        ReportCaptureRecord record;
+        while (fread(&record, sizeof(record), 1, file) == 1)
+        {
+            if (record.size <= kAccessReportHeaderSize || record.size > sizeof(AccessReport))
+            {
+                log_error("Corrupted report capture '%s'", path);
+                numReplayed = -1;
+                break;
+            }
+
+            if (realTime)
+            {
+                // wait until the report is due at the recorded pace, after handing over the reports that already are
+                if (firstCaptureTime == 0) firstCaptureTime = record.dequeueTime;
+                uint64_t offsetNs = (record.dequeueTime - firstCaptureTime) * header.timebaseNumer / header.timebaseDenom;
+                uint64_t dueTime  = startTime + offsetNs * timebase.denom / timebase.numer;
+                if (dueTime > GetMachAbsoluteTime())
+                {
+                    if (count > 0)
+                    {
+                        callback(buffer.get(), count, REPORT_QUEUE_SUCCESS);
+                        count = 0;
+                    }
+
+                    mach_wait_until(dueTime);
+                }
+            }
+
+            AccessReport *report = &buffer[count];
+            if (fread(report, record.size, 1, file) != 1)
+            {
+                log_error("Truncated report capture '%s'", path);
+                break;
+            }
+
+            // the last captured byte is the terminating null character of the path
+            ((char *)report)[record.size - 1] = '\0';
+            report->stats.dequeueTime = GetMachAbsoluteTime();
+            numReplayed++;
+
+            if (++count == (uint32_t)batchSize)
+            {
+                callback(buffer.get(), count, REPORT_QUEUE_SUCCESS);
+                count = 0;
+            }
+        }
+
+        if (count > 0 && numReplayed >= 0)
+        {
+            callback(buffer.get(), count, REPORT_QUEUE_SUCCESS);
+        }
+
+        fclose(file);
+        return numReplayed;
+    }
+
     uint64_t GetMachAbsoluteTime()
     {
         return mach_absolute_time();
@@ -34,6 +34,16 @@ extern "C"
      */
     int NormalizePathAndReturnHash(const BYTE *path, BYTE *buffer, int bufferSize);
 
+    /*!
+     * Batch variant of 'NormalizePathAndReturnHash'.
+     *
+     * @param paths The 'count' paths to normalize and hash, back to back (not null-terminated).
+     * @param lengths The length of each path in bytes.
+     * @param buffer Buffer where the normalized paths are stored back to back, each followed by a null character.
+     * @param hashes Buffer where the hash of each normalized path is stored.
+     */
+    void NormalizePathsAndReturnHashes(const BYTE *paths, const size_t *lengths, size_t count, BYTE *buffer, int *hashes);
+
     typedef struct {
         int error;
         uint connection;
@@ -44,9 +54,16 @@ extern "C"
         int error;
         mach_vm_address_t address;
         mach_port_t port;
+        // Index of the report queue the memory belongs to; set by the caller, see 'KextConfig::numReportQueues'
+        uint queueIndex;
     } KextSharedMemoryInfo;
 
     void InitializeKextConnection(KextConnectionInfo *info, long infoSize);
+
+    /*!
+     * Maps the shared memory of the report queue with index 'memoryInfo->queueIndex' and allocates its notification port.
+     * The client is attached to the kernel extension when queue 0 is initialized, so that one must be initialized first.
+     */
     void InitializeKextSharedMemory(KextSharedMemoryInfo *memoryInfo, long memoryInfoSize, KextConnectionInfo info);
 
     void DeinitializeKextConnection(KextConnectionInfo info);
@@ -66,16 +83,106 @@ extern "C"
      */
     bool UpdateCurrentResourceUsage(uint cpuUsageBasisPoints, uint ramUsageBasisPoints, KextConnectionInfo info);
 
+    /*!
+     * Starts a thread that samples the CPU usage and available RAM of the machine every 'intervalMs' milliseconds and pushes
+     * them with 'UpdateCurrentResourceUsage', so that the kext gets fresh numbers even while the managed side is busy (e.g.,
+     * in a GC).  Returns false if a sampler is already running.  Stop it with 'StopResourceSampler' before deinitializing
+     * the connection.
+     */
+    bool StartResourceSampler(uint intervalMs, KextConnectionInfo info);
+    void StopResourceSampler(void);
+
     typedef void (__cdecl *FailureNotificationCallback)(void *, IOReturn);
     bool SetFailureNotificationHandler(FailureNotificationCallback callback, KextConnectionInfo info);
 
+    /*!
+     * Makes the listeners (see 'ListenForFileAccessReports[Batched]') started from now on keep polling their queue for up to
+     * 'spinMicroseconds' after draining it before they block on its notification port (0 to block right away), and run at
+     * QoS class 'qosClass' (a 'qos_class_t'; 0 to leave the QoS class of the calling thread as it is).
+     */
+    void ConfigureReportListeners(uint spinMicroseconds, uint qosClass);
+
+    typedef struct {
+        /*! Number of times a listener blocked on the notification port of its queue, i.e., was woken up */
+        uint64_t numWakeups;
+        /*! Number of times a listener found new reports while spinning, and so did not need to block */
+        uint64_t numSpinHits;
+        /*! Wakeups per second since the last reset */
+        double wakeupsPerSecond;
+        /*! 99th percentile of the time from enqueuing a report in the kext until a listener dequeued it */
+        uint32_t p99EnqueueToDequeueUs;
+    } ReportListenerCounters;
+
+    /**
+     * Copies the counters of all listeners since the last reset, and optionally resets them.
+     */
+    __cdecl void GetReportListenerCounters(ReportListenerCounters *result, bool reset);
+
     typedef void (__cdecl *AccessReportCallback)(AccessReport, int);
     __cdecl void ListenForFileAccessReports(AccessReportCallback callback, long accessReportSize, mach_vm_address_t address, mach_port_t port);
 
+    /*!
+     * Like 'ListenForFileAccessReports', except that reports are handed to 'callback' in batches of up to 'batchSize'
+     * reports (copied into a buffer owned by this function), and that the head of the queue is advanced once per batch.
+     */
+    typedef void (__cdecl *AccessReportBatchCallback)(const AccessReport *, int, int);
+    __cdecl void ListenForFileAccessReportsBatched(AccessReportBatchCallback callback, int batchSize, long accessReportSize,
+                                                   mach_vm_address_t address, mach_port_t port);
+
+    /*!
+     * Makes 'SendPipStarted' register a ring of 'capacity' reports (a power of 2) for each pip, which
+     * 'ListenForFileAccessReportsBatched' writes the reports of the pip into instead of handing them to its callback, so that
+     * the executor of each pip can drain its own reports with 'DrainPipReports'.  The callback still gets the reports of pips
+     * that have no ring.  To be called before any pip is started.
+     */
+    bool EnablePipReportRings(uint capacity, long accessReportSize);
+
+    /*!
+     * Copies up to 'capacity' reports of pip 'pipId', in the order they were received, into 'buffer', waiting up to
+     * 'timeoutMs' milliseconds for one when there are none.  Only one thread may drain a pip.
+     *
+     * @result The number of reports copied (0 on timeout), or -1 if the pip has no ring (anymore).
+     */
+    int DrainPipReports(pipid_t pipId, AccessReport *buffer, int capacity, int timeoutMs);
+
+    /*!
+     * Drops the ring of pip 'pipId' and the reports still in it, and makes a 'DrainPipReports' that waits for it return.
+     * Reports of the pip received later go to the callback of the listener.
+     */
+    void UnregisterPipReportRing(pipid_t pipId);
+
+    /*!
+     * Starts appending every report received by 'ListenForFileAccessReports[Batched]' to the file at 'path',
+     * so that it can later be replayed with 'ReplayFileAccessReports'.  Returns false if a capture is already running
+     * or the file can't be created.
+     */
+    bool StartReportCapture(const char *path);
+    void StopReportCapture(void);
+
+    /*!
+     * Hands the reports captured in the file at 'path' (see 'StartReportCapture') to 'callback', in batches of up to
+     * 'batchSize' reports, either as fast as possible or, if 'realTime' is set, at the pace they were received.
+     * Returns the number of reports replayed, or -1 if the file is not a valid capture.
+     */
+    __cdecl int ReplayFileAccessReports(const char *path, AccessReportBatchCallback callback, int batchSize,
+                                        long accessReportSize, bool realTime);
+
     uint64_t GetMachAbsoluteTime(void);
+
+    /**
+     * Copies the latencies of all reports received by this process since the last reset, and optionally resets them.
+     */
+    __cdecl void GetReportLatencies(ReportLatencies *result, bool reset);
     __cdecl void KextVersionString(char *version, int size);
 
     bool IntrospectKernelExtension(KextConnectionInfo info, IntrospectResponse *result);
+    bool IntrospectKernelExtensionLatencies(KextConnectionInfo info, LatencyHistograms *result);
+    bool IntrospectKernelExtensionProcesses(KextConnectionInfo info, pid_t cursor, IntrospectProcessesResponse *result);
+
+    /**
+     * Copies the records of one ring (0 to kEventTraceRingCount - 1) of the event trace of the kernel extension.
+     */
+    bool DumpKernelExtensionEventTrace(KextConnectionInfo info, uint ring, EventTraceDumpResponse *result);
 }
 
 #endif /* sandbox_h */
@@ -0,0 +1,751 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Multithreaded stress benchmarks of the core data structures of the kext, built for user mode against the stand-ins
+// for the kernel APIs in UserMode/ (see UserMode/IOKit/IOLib.h): the path cache of a pip ('Trie::getOrAdd' and
+// 'CacheRecord::CheckAndUpdate'), thread locals, and the report queue ('ConcurrentSharedDataQueue'), drained the way
+// the interop library drains it (see ListenForFileAccessReports in Interop/Sandbox/Sandbox.cpp).
+//
+// The accessed paths are replayed from a file (one path per line, e.g., the paths a build reported) or generated to
+// look like those of a build: source and output trees, SDK headers, system libraries and temporary files, accessed
+// with a Zipf distribution.
+//
+// Each benchmark runs an untimed warm-up sample followed by BENCHMARK_SAMPLES timed samples, and prints its result as
+// one JSON object per line on stdout, in the format of the Detours benchmarks (see DetoursBenchmarks/Benchmark.h) plus
+// the number of threads:
+//
+//   {"benchmark":"<name>","threads":T,"operationsPerSample":N,"samples":S,"minNs":x,"medianNs":y,"maxNs":z}
+//
+// where the times are the wall-clock nanoseconds per operation (of all threads together) of the fastest, median, and
+// slowest sample. Diagnostics, like trie node counts and report counters, go to stderr.
+//
+// Before benchmarking, the path cache is checked on paths that split the edges of its trie (see
+// CheckEdgeCompressedPathTrie); the benchmarks exit with 3, without running, if it does not hold.
+//
+// Built and run by scripts/kext-benchmarks.sh.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <mach/mach.h>
+#include <IOKit/IODataQueueClient.h>
+
+#include "CacheRecord.hpp"
+#include "ConcurrentSharedDataQueue.hpp"
+#include "ThreadLocal.hpp"
+#include "Trie.hpp"
+
+// Number of timed samples of each benchmark.
+#define BENCHMARK_SAMPLES 15
+
+// Size of the report queues, as the kext allocates them by default in release builds (see kSharedDataQueueSizeDefault).
+#define kReportQueueSizeMB 256
+
+#pragma mark Kext globals
+
+// Defined in BuildXLSandbox.cpp and SysCtl.cpp, which are not part of the benchmarks.
+os_log_t logger = os_log_create(kBuildXLBundleIdentifier, "KextBenchmarks");
+
+int g_bxl_enable_counters    = 0;
+int g_bxl_verbose_logging    = 0;
+int g_bxl_enable_event_trace = 0;
+int g_bxl_enable_full_timing = 0;
+
+#pragma mark Options
+
+typedef struct {
+    uint threads;
+    size_t operations;
+    uint distinctPaths;
+    double zipfExponent;
+    const char *pathsFile;
+} Options;
+
+static bool ParseOptions(int argc, char **argv, Options *options)
+{
+    *options =
+    {
+        .threads       = std::max(1u, std::thread::hardware_concurrency()),
+        .operations    = 1 << 20,
+        .distinctPaths = 50000,
+        .zipfExponent  = 1.0,
+        .pathsFile     = nullptr,
+    };
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg   = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (strcmp(arg, "--counters") == 0)
+        {
+            g_bxl_enable_counters = 1;
+            continue;
+        }
+
+        if (value == nullptr)
+        {
+            fprintf(stderr, "Missing value of '%s'\n", arg);
+            return false;
+        }
+
+        if      (strcmp(arg, "--threads") == 0)    options->threads       = (uint)std::max(1, atoi(value));
+        else if (strcmp(arg, "--operations") == 0) options->operations    = (size_t)std::max(1ll, atoll(value));
+        else if (strcmp(arg, "--distinct") == 0)   options->distinctPaths = (uint)std::max(1, atoi(value));
+        else if (strcmp(arg, "--zipf") == 0)       options->zipfExponent  = atof(value);
+        else if (strcmp(arg, "--paths") == 0)      options->pathsFile     = value;
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'\n", arg);
+            return false;
+        }
+
+        i++;
+    }
+
+    return true;
+}
+
+static void PrintUsage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--threads N] [--operations N] [--distinct N] [--zipf S] [--paths FILE] [--counters]\n"
+            "  --threads     threads accessing the data structures concurrently (default: number of cores)\n"
+            "  --operations  operations per sample, over all threads (default: 1048576)\n"
+            "  --distinct    number of distinct generated paths (default: 50000)\n"
+            "  --zipf        exponent of the Zipf distribution of the accesses to the generated paths (default: 1.0)\n"
+            "  --paths       file to replay the accessed paths from, one per line, instead of generating them\n"
+            "  --counters    enable the counters of the kext (off by default, like in the kext)\n",
+            program);
+}
+
+#pragma mark Accessed paths
+
+static const char *s_sourceExtensions[] = { ".cs", ".cpp", ".h", ".hpp", ".json", ".dsc", ".props" };
+static const char *s_sdkIncludeDirs[]   = { "", "sys/", "mach/", "c++/v1/", "c++/v1/__functional/", "os/", "dispatch/", "netinet/" };
+static const char *s_libraryNames[]     = { "libSystem.B.dylib", "libc++.1.dylib", "libobjc.A.dylib", "libz.1.dylib", "libsqlite3.dylib" };
+
+/*!
+ * Distinct paths that look like the ones a build accesses: mostly sources (in a deep tree of modules), then outputs
+ * (in content-addressed object directories), SDK headers, system libraries and temporary files.
+ */
+static std::vector<std::string> GeneratePaths(uint count, std::mt19937_64 &random)
+{
+    const std::string repo = "/Users/builder/src/BuildXL";
+    const std::string sdk  = "/Applications/Xcode.app/Contents/Developer/Platforms/MacOSX.platform/Developer/SDKs/MacOSX.sdk";
+
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> paths;
+    paths.reserve(count);
+
+    char buffer[MAXPATHLEN];
+    while (paths.size() < count)
+    {
+        uint kind = random() % 100;
+        if (kind < 55)
+        {
+            snprintf(buffer, sizeof(buffer), "%s/Public/Src/Module%03u/Component%02u/%s/File%04u%s",
+                     repo.c_str(), (uint)(random() % 200), (uint)(random() % 12),
+                     random() % 3 == 0 ? "Tests" : "Src", (uint)(random() % 400),
+                     s_sourceExtensions[random() % (sizeof(s_sourceExtensions) / sizeof(s_sourceExtensions[0]))]);
+        }
+        else if (kind < 80)
+        {
+            snprintf(buffer, sizeof(buffer), "%s/Out/Objects/%02x/%016llx%014llx/bin/Module%03u.%s",
+                     repo.c_str(), (uint)(random() % 256), (unsigned long long)random(),
+                     (unsigned long long)(random() & 0xFFFFFFFFFFFFFFull), (uint)(random() % 200),
+                     random() % 2 == 0 ? "dll" : "pdb");
+        }
+        else if (kind < 92)
+        {
+            snprintf(buffer, sizeof(buffer), "%s/usr/include/%sheader%03u.h",
+                     sdk.c_str(), s_sdkIncludeDirs[random() % (sizeof(s_sdkIncludeDirs) / sizeof(s_sdkIncludeDirs[0]))],
+                     (uint)(random() % 300));
+        }
+        else if (kind < 96)
+        {
+            snprintf(buffer, sizeof(buffer), "/usr/lib/%s%s", random() % 4 == 0 ? "system/" : "",
+                     s_libraryNames[random() % (sizeof(s_libraryNames) / sizeof(s_libraryNames[0]))]);
+        }
+        else
+        {
+            snprintf(buffer, sizeof(buffer), "/private/var/folders/%02llx/%016llx/T/tmp%08llx.tmp",
+                     (unsigned long long)(random() % 256), (unsigned long long)random(), (unsigned long long)(random() % 0xFFFFFFFF));
+        }
+
+        if (seen.insert(buffer).second)
+        {
+            paths.push_back(buffer);
+        }
+    }
+
+    // the ranks of the Zipf distribution are the positions in this vector, so that the popular paths are of all kinds
+    std::shuffle(paths.begin(), paths.end(), random);
+    return paths;
+}
+
+/*! Indices into 'count' paths, drawn from a Zipf distribution with the given exponent. */
+static std::vector<uint> GenerateAccesses(uint count, double exponent, size_t numAccesses, std::mt19937_64 &random)
+{
+    std::vector<double> cumulative(count);
+    double sum = 0;
+    for (uint rank = 0; rank < count; rank++)
+    {
+        sum += 1.0 / pow(rank + 1, exponent);
+        cumulative[rank] = sum;
+    }
+
+    std::uniform_real_distribution<double> uniform(0, sum);
+    std::vector<uint> accesses(numAccesses);
+    for (size_t i = 0; i < numAccesses; i++)
+    {
+        auto it = std::lower_bound(cumulative.begin(), cumulative.end(), uniform(random));
+        accesses[i] = (uint)std::min<size_t>(it - cumulative.begin(), count - 1);
+    }
+
+    return accesses;
+}
+
+static bool ReadPaths(const char *file, std::vector<std::string> &paths)
+{
+    std::ifstream stream(file);
+    if (!stream)
+    {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        if (!line.empty() && line.size() < MAXPATHLEN)
+        {
+            paths.push_back(line);
+        }
+    }
+
+    return !paths.empty();
+}
+
+#pragma mark Harness
+
+static std::atomic<size_t> s_benchmarkSink(0);
+
+static void ReportBenchmarkResult(const char *name, const Options &options, std::vector<double> &nanosecondsPerOperation)
+{
+    std::sort(nanosecondsPerOperation.begin(), nanosecondsPerOperation.end());
+
+    printf("{\"benchmark\":\"%s\",\"threads\":%u,\"operationsPerSample\":%llu,\"samples\":%llu,\"minNs\":%.1f,\"medianNs\":%.1f,\"maxNs\":%.1f}\n",
+           name,
+           options.threads,
+           (unsigned long long)options.operations,
+           (unsigned long long)nanosecondsPerOperation.size(),
+           nanosecondsPerOperation.front(),
+           nanosecondsPerOperation[nanosecondsPerOperation.size() / 2],
+           nanosecondsPerOperation.back());
+    fflush(stdout);
+}
+
+/*!
+ * Runs operation(thread, i) for i in [0, options.operations), split in contiguous ranges over 'options.threads'
+ * threads, over the samples of a benchmark, then prints its result.
+ *
+ * For each sample, setUp() and tearDown() are called (untimed) before and after, and finish() (timed) once all
+ * threads are done, for work the operations leave to other threads (e.g., draining a queue).
+ */
+template <typename TSetUp, typename TOperation, typename TFinish, typename TTearDown>
+static void RunParallelBenchmark(const char *name, const Options &options,
+                                 TSetUp setUp, TOperation operation, TFinish finish, TTearDown tearDown)
+{
+    std::vector<double> nanosecondsPerOperation;
+    nanosecondsPerOperation.reserve(BENCHMARK_SAMPLES);
+
+    // Sample -1 is the warm-up.
+    for (int sample = -1; sample < BENCHMARK_SAMPLES; sample++)
+    {
+        setUp();
+
+        std::atomic<uint> numReady(0);
+        std::atomic<bool> started(false);
+        std::vector<std::thread> threads;
+        for (uint t = 0; t < options.threads; t++)
+        {
+            threads.emplace_back([&, t]()
+            {
+                size_t begin = options.operations * t / options.threads;
+                size_t end   = options.operations * (t + 1) / options.threads;
+
+                numReady++;
+                while (!started.load(std::memory_order_acquire))
+                {
+                    std::this_thread::yield();
+                }
+
+                size_t sink = 0;
+                for (size_t i = begin; i < end; i++)
+                {
+                    sink += operation(t, i);
+                }
+
+                s_benchmarkSink += sink;
+            });
+        }
+
+        while (numReady.load() < options.threads)
+        {
+            std::this_thread::yield();
+        }
+
+        uint64_t start = mach_absolute_time();
+        started.store(true, std::memory_order_release);
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        finish();
+        uint64_t elapsedNs;
+        absolutetime_to_nanoseconds(mach_absolute_time() - start, &elapsedNs);
+
+        tearDown();
+
+        if (sample >= 0)
+        {
+            nanosecondsPerOperation.push_back((double)elapsedNs / (double)options.operations);
+        }
+    }
+
+    ReportBenchmarkResult(name, options, nanosecondsPerOperation);
+}
+
+static void Nothing() {}
+
+#pragma mark Path cache
+
+static OSObject* CacheRecordFactory(void *)
+{
+    return CacheRecord::create();
+}
+
+static void PrintTrieNodeCounts(const char *benchmark)
+{
+    uint count;
+    double sizeMB, savedMB;
+    Trie::getPathNodeCounts(&count, &sizeMB, &savedMB);
+    fprintf(stderr, "%s: %u path trie nodes (%.2f MB, %.2f MB saved by adaptive children tables)\n", benchmark, count, sizeMB, savedMB);
+}
+
+static void BenchmarkGetOrAdd(const Options &options, const std::vector<const char*> &accesses)
+{
+    Trie *trie = nullptr;
+
+    auto getOrAdd = [&](uint, size_t i)
+    {
+        return (size_t)(trie->getOrAddTyped<CacheRecord>(accesses[i], nullptr, CacheRecordFactory) != nullptr);
+    };
+
+    // every sample starts from an empty cache, as a pip does
+    RunParallelBenchmark("trie/getOrAdd/cold", options,
+                         [&]() { trie = Trie::createPathTrie(OSTypeID(CacheRecord)); },
+                         getOrAdd,
+                         Nothing,
+                         [&]() { OSSafeReleaseNULL(trie); });
+
+    // all samples share the cache the warm-up populated
+    trie = Trie::createPathTrie(OSTypeID(CacheRecord));
+    RunParallelBenchmark("trie/getOrAdd/warm", options, Nothing, getOrAdd, Nothing, Nothing);
+    PrintTrieNodeCounts("trie/getOrAdd/warm");
+    OSSafeReleaseNULL(trie);
+}
+
+/*!
+ * The same as 'trie/getOrAdd/cold', for the paths that make the trie deepest: each path of MAXPATHLEN repeated
+ * characters or less is the prefix of the next one, so each adds a node below the previous one.  The paths deeper than
+ * 'Node::s_maxPathNodeDepth' are not cached, which keeps their cost per operation close to that of the typical paths.
+ */
+static void BenchmarkAdversarialGetOrAdd(const Options &options)
+{
+    std::vector<std::string> paths;
+    for (size_t length = 2; length < MAXPATHLEN; length++)
+    {
+        paths.push_back("/" + std::string(length - 1, 'a'));
+    }
+
+    Trie *trie = nullptr;
+    std::atomic<size_t> numUncached(0);
+
+    RunParallelBenchmark("trie/getOrAdd/adversarial", options,
+                         [&]() { trie = Trie::createPathTrie(OSTypeID(CacheRecord)); numUncached = 0; },
+                         [&](uint, size_t i)
+                         {
+                             bool cached = trie->getOrAddTyped<CacheRecord>(paths[i % paths.size()].c_str(), nullptr, CacheRecordFactory) != nullptr;
+                             numUncached += cached ? 0 : 1;
+                             return (size_t)cached;
+                         },
+                         Nothing,
+                         [&]() { OSSafeReleaseNULL(trie); });
+
+    fprintf(stderr, "trie/getOrAdd/adversarial: %zu of %zu operations not cached\n", numUncached.load(), options.operations);
+}
+
+/*!
+ * Checks the path cache of a pip on paths that end and diverge in the middle of the edges of the trie: each path gets
+ * a record of its own, which later lookups find again and which caches only its own accesses, and the trie has one
+ * node per edge rather than one per character.  The benchmarks are run only if this holds.
+ */
+static bool CheckEdgeCompressedPathTrie()
+{
+    // each path, added in this order, adds the given number of nodes: a leaf for the rest of the path, plus a node
+    // splitting the edge the path ends or diverges in
+    const struct { const char *path; uint addedNodes; } checks[] =
+    {
+        { "/Users/bxl/src/app/main.c",  1 }, // a single edge from the root
+        { "/Users/bxl/src/app/main.h",  2 }, // diverges after "main."
+        { "/Users/bxl/src/app",         1 }, // ends in the edge to "main."
+        { "/Users/bxl/src/lib/util.c",  2 }, // diverges after "src/"
+        { "/Users/bxl/src/app/main.c",  0 }, // already there
+    };
+
+    const AccessCheckResult read(RequestedAccess::Read, ResultAction::Allow, ReportLevel::Report);
+    bool ok = true;
+    auto check = [&](bool condition, const char *what, const char *path)
+    {
+        if (!condition) fprintf(stderr, "trie/edges: %s for '%s'\n", what, path);
+        ok = ok && condition;
+    };
+
+    Trie *trie = Trie::createPathTrie(OSTypeID(CacheRecord));
+    std::vector<CacheRecord*> records;
+    for (const auto &c : checks)
+    {
+        uint countBefore, countAfter;
+        double sizeMB, savedMB;
+        Trie::getPathNodeCounts(&countBefore, &sizeMB, &savedMB);
+
+        Trie::TrieResult result;
+        CacheRecord *record = trie->getOrAddTyped<CacheRecord>(c.path, nullptr, CacheRecordFactory, &result);
+        Trie::getPathNodeCounts(&countAfter, &sizeMB, &savedMB);
+
+        bool isNew = std::find(records.begin(), records.end(), record) == records.end();
+        check(record != nullptr, "no record", c.path);
+        check(countAfter - countBefore == c.addedNodes, "unexpected number of added nodes", c.path);
+        check(isNew == (c.addedNodes > 0), "record shared with another path", c.path);
+        check((result == Trie::kTrieResultInserted) == isNew, "unexpected result", c.path);
+
+        // only the first read of a path is reported, whichever other paths were read before
+        if (record != nullptr && isNew)
+        {
+            check(!record->CheckAndUpdate(&read), "first read deemed a cache hit", c.path);
+            records.push_back(record);
+        }
+
+        check(record == nullptr || record->CheckAndUpdate(&read), "repeated read not deemed a cache hit", c.path);
+    }
+
+    // prefixes that only end in the middle of an edge have no record
+    for (const char *path : { "/Users/bxl/src/ap", "/Users/bxl/src/app/main", "/Users/bxl/src/" })
+    {
+        check(trie->get(path) == nullptr, "record of a path never added", path);
+    }
+
+    check(trie->getCount() == (uint)records.size(), "unexpected number of records", "(all)");
+    OSSafeReleaseNULL(trie);
+    return ok;
+}
+
+static void BenchmarkCheckAndUpdate(const Options &options, const std::vector<const char*> &accesses)
+{
+    // roughly the mix of requested accesses of a build
+    const AccessCheckResult checkResults[] =
+    {
+        AccessCheckResult(RequestedAccess::Lookup, ResultAction::Allow, ReportLevel::Report),
+        AccessCheckResult(RequestedAccess::Lookup, ResultAction::Allow, ReportLevel::Report),
+        AccessCheckResult(RequestedAccess::Probe,  ResultAction::Allow, ReportLevel::Report),
+        AccessCheckResult(RequestedAccess::Probe,  ResultAction::Allow, ReportLevel::Report),
+        AccessCheckResult(RequestedAccess::Read,   ResultAction::Allow, ReportLevel::Report),
+        AccessCheckResult(RequestedAccess::Read,   ResultAction::Allow, ReportLevel::Report),
+        AccessCheckResult(RequestedAccess::Read,   ResultAction::Allow, ReportLevel::Report),
+        AccessCheckResult(RequestedAccess::Write,  ResultAction::Allow, ReportLevel::Report),
+    };
+    const size_t numCheckResults = sizeof(checkResults) / sizeof(checkResults[0]);
+
+    Trie *trie = nullptr;
+    std::vector<CacheRecord*> records(accesses.size());
+
+    // the records are looked up (untimed) in a fresh cache for every sample, so that each sample sees the first
+    // (updating) accesses of the paths as well as the (checking) ones after
+    RunParallelBenchmark("cacheRecord/checkAndUpdate", options,
+                         [&]()
+                         {
+                             trie = Trie::createPathTrie(OSTypeID(CacheRecord));
+                             for (size_t i = 0; i < accesses.size(); i++)
+                             {
+                                 records[i] = trie->getOrAddTyped<CacheRecord>(accesses[i], nullptr, CacheRecordFactory);
+                             }
+                         },
+                         [&](uint, size_t i)
+                         {
+                             return (size_t)records[i]->CheckAndUpdate(&checkResults[(i * 7) % numCheckResults]);
+                         },
+                         Nothing,
+                         [&]() { OSSafeReleaseNULL(trie); });
+
+    // the whole lookup path of an access: find the record of the path, then check and update it
+    trie = Trie::createPathTrie(OSTypeID(CacheRecord));
+    RunParallelBenchmark("cacheRecord/getOrAddCheckAndUpdate", options,
+                         Nothing,
+                         [&](uint, size_t i)
+                         {
+                             CacheRecord *record = trie->getOrAddTyped<CacheRecord>(accesses[i], nullptr, CacheRecordFactory);
+                             return (size_t)(record != nullptr && record->CheckAndUpdate(&checkResults[(i * 7) % numCheckResults]));
+                         },
+                         Nothing,
+                         Nothing);
+    OSSafeReleaseNULL(trie);
+}
+
+static void BenchmarkThreadLocal(const Options &options)
+{
+    ThreadLocal *threadLocal = ThreadLocal::create();
+    CacheRecord *value = CacheRecord::create();
+    if (threadLocal == nullptr || value == nullptr)
+    {
+        fprintf(stderr, "Could not create the thread local\n");
+        OSSafeReleaseNULL(threadLocal);
+        OSSafeReleaseNULL(value);
+        return;
+    }
+
+    // what the kext does around each callback it handles
+    RunParallelBenchmark("threadLocal/insertGetRemove", options,
+                         Nothing,
+                         [&](uint, size_t)
+                         {
+                             threadLocal->insert(value);
+                             size_t found = threadLocal->get() == value;
+                             threadLocal->remove();
+                             return found;
+                         },
+                         Nothing,
+                         Nothing);
+
+    OSSafeReleaseNULL(threadLocal);
+    OSSafeReleaseNULL(value);
+}
+
+#pragma mark Report queue
+
+static FileOperation s_reportedOperations[] = { kOpMacLookup, kOpKAuthVNodeProbe, kOpKAuthReadFile, kOpKAuthVNodeRead, kOpKAuthWriteFile };
+static DWORD s_reportedAccesses[]           = { (DWORD)RequestedAccess::Lookup, (DWORD)RequestedAccess::Probe, (DWORD)RequestedAccess::Read,
+                                                (DWORD)RequestedAccess::Read, (DWORD)RequestedAccess::Write };
+
+/*!
+ * The client side of a report queue: a thread that dequeues reports the way ListenForFileAccessReports does, until
+ * 'stop' destroys the notification port it waits on.
+ */
+class ReportListener
+{
+private:
+
+    IOMemoryDescriptor *descriptor_;
+    IOMemoryMap *map_;
+    mach_port_t port_;
+    std::thread thread_;
+
+    void listen()
+    {
+        IODataQueueMemory *queue = (IODataQueueMemory *)map_->getVirtualAddress();
+        do
+        {
+            while (IODataQueueDataAvailable(queue))
+            {
+                AccessReport report;
+                uint32_t reportSize = sizeof(report);
+                if (IODataQueueDequeue(queue, &report, &reportSize) != kIOReturnSuccess)
+                {
+                    fprintf(stderr, "Could not dequeue a report\n");
+                    return;
+                }
+
+                ((char *)&report)[reportSize - 1] = '\0';
+                numReceived++;
+            }
+        }
+        while (IODataQueueWaitForAvailableData(queue, port_) == kIOReturnSuccess);
+    }
+
+public:
+
+    std::atomic<size_t> numReceived;
+
+    ReportListener(ConcurrentSharedDataQueue *queue) : numReceived(0)
+    {
+        descriptor_ = queue->getMemoryDescriptor();
+        map_        = descriptor_->map();
+        port_       = IODataQueueAllocateNotificationPort();
+        queue->setNotificationPort(port_);
+        thread_     = std::thread([this]() { listen(); });
+    }
+
+    void stop()
+    {
+        mach_port_mod_refs(mach_task_self(), port_, MACH_PORT_RIGHT_RECEIVE, -1);
+        thread_.join();
+        OSSafeReleaseNULL(map_);
+        OSSafeReleaseNULL(descriptor_);
+    }
+};
+
+static void BenchmarkReportQueue(const Options &options, const std::vector<const char*> &accesses,
+                                 bool enableBatching, bool enableCompactReports)
+{
+    char name[128];
+    snprintf(name, sizeof(name), "queue/enqueueDrain/%s%s",
+             enableBatching ? "batching" : "locking", enableCompactReports ? "/compact" : "");
+
+    ReportCounters counters;
+    bzero(&counters, sizeof(counters));
+
+    ConcurrentSharedDataQueue::InitArgs args =
+    {
+        .entryCount           = (kReportQueueSizeMB * 1024 * 1024) / sizeof(AccessReport),
+        .entrySize            = sizeof(AccessReport),
+        .enableBatching       = enableBatching,
+        .enableCompactReports = enableCompactReports,
+        .coalescingWindowUs   = 0,
+        .counters             = &counters,
+    };
+
+    ConcurrentSharedDataQueue *queue = nullptr;
+    ReportListener *listener = nullptr;
+    std::atomic<size_t> numFailed(0);
+
+    RunParallelBenchmark(name, options,
+                         [&]()
+                         {
+                             queue = ConcurrentSharedDataQueue::create(args);
+                             if (queue == nullptr)
+                             {
+                                 fprintf(stderr, "Could not create the report queue\n");
+                                 exit(1);
+                             }
+
+                             listener  = new ReportListener(queue);
+                             numFailed = 0;
+                         },
+                         [&](uint thread, size_t i)
+                         {
+                             uint kind = (uint)(i % (sizeof(s_reportedOperations) / sizeof(s_reportedOperations[0])));
+                             AccessReport report =
+                             {
+                                 .operation        = s_reportedOperations[kind],
+                                 .pid              = (pid_t)(1000 + thread),
+                                 .rootPid          = 1000,
+                                 .requestedAccess  = s_reportedAccesses[kind],
+                                 .status           = FileAccessStatus::FileAccessStatus_Allowed,
+                                 .reportExplicitly = 0,
+                                 .error            = 0,
+                                 .pipId            = 0x1234,
+                                 .stats            = { .creationTime = mach_absolute_time() },
+                                 .path             = {0},
+                             };
+
+                             strlcpy(report.path, accesses[i], sizeof(report.path));
+                             bool sent = queue->enqueueReport({ .report = report, .cacheRecord = nullptr });
+                             if (!sent) numFailed++;
+                             return (size_t)sent;
+                         },
+                         [&]()
+                         {
+                             // done once the listener received every report that was enqueued
+                             while (listener->numReceived.load() + numFailed.load() < options.operations)
+                             {
+                                 std::this_thread::yield();
+                             }
+                         },
+                         [&]()
+                         {
+                             listener->stop();
+                             delete listener;
+                             OSSafeReleaseNULL(queue);
+                         });
+
+    if (numFailed > 0)
+    {
+        fprintf(stderr, "%s: %zu reports could not be enqueued in the last sample\n", name, numFailed.load());
+    }
+
+    if (g_bxl_enable_counters)
+    {
+        fprintf(stderr, "%s: %u sent, %u spilled, %u backpressure stalls (over all samples)\n",
+                name, counters.totalNumSent.count(), counters.numSpilledReports.count(), counters.numBackpressureStalls.count());
+    }
+}
+
+#pragma mark Main
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> paths;
+    std::vector<const char*> accesses(options.operations);
+
+    if (options.pathsFile != nullptr)
+    {
+        if (!ReadPaths(options.pathsFile, paths))
+        {
+            fprintf(stderr, "Could not read any paths from '%s'\n", options.pathsFile);
+            return 1;
+        }
+
+        // replayed in order, as often as needed
+        for (size_t i = 0; i < options.operations; i++)
+        {
+            accesses[i] = paths[i % paths.size()].c_str();
+        }
+    }
+    else
+    {
+        std::mt19937_64 random(42);
+        paths = GeneratePaths(options.distinctPaths, random);
+
+        std::vector<uint> ranks = GenerateAccesses(options.distinctPaths, options.zipfExponent, options.operations, random);
+        for (size_t i = 0; i < options.operations; i++)
+        {
+            accesses[i] = paths[ranks[i]].c_str();
+        }
+    }
+
+    fprintf(stderr, "%zu accesses to %zu distinct paths on %u threads\n", accesses.size(), paths.size(), options.threads);
+
+    if (!CheckEdgeCompressedPathTrie())
+    {
+        return 3;
+    }
+
+    BenchmarkGetOrAdd(options, accesses);
+    BenchmarkAdversarialGetOrAdd(options);
+    BenchmarkCheckAndUpdate(options, accesses);
+    BenchmarkThreadLocal(options);
+
+    for (bool enableBatching : { false, true })
+    {
+        for (bool enableCompactReports : { false, true })
+        {
+            BenchmarkReportQueue(options, accesses, enableBatching, enableCompactReports);
+        }
+    }
+
+    return s_benchmarkSink.load() == 0 ? 2 : 0;
+}
@@ -0,0 +1,114 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef UserMode_IOLib_h
+#define UserMode_IOLib_h
+
+/*
+ * User-mode stand-ins for the kernel APIs the core data structures of the kext use (memory, locks, sleeping, time and
+ * threads), so that Trie.cpp, CacheRecord.cpp, ConcurrentSharedDataQueue.cpp, etc. build unchanged into a regular process
+ * (see KextBenchmarks.cpp).  Everything is implemented in UserModeShim.cpp on top of pthreads and the Mach time base,
+ * with the semantics the kext relies on.
+ *
+ * Like the lfds sources including it, this header has to stay valid C.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <mach/mach_types.h>
+#include <mach/mach_time.h>
+#include <libkern/OSTypes.h>
+#include <libkern/libkern.h>
+#include <IOKit/IOReturn.h>
+#include <IOKit/IOTypes.h>
+
+__BEGIN_DECLS
+
+#pragma mark Memory
+
+void* IOMalloc(vm_size_t size);
+void  IOFree(void *address, vm_size_t size);
+void* IOMallocAligned(vm_size_t size, vm_offset_t alignment);
+void  IOFreeAligned(void *address, vm_size_t size);
+void* IOMallocPageable(vm_size_t size, vm_size_t alignment);
+void  IOFreePageable(void *address, vm_size_t size);
+
+#define IONew(type, number)         ((type *)IOMalloc(sizeof(type) * (number)))
+#define IODelete(ptr, type, number) IOFree((ptr), sizeof(type) * (number))
+
+#pragma mark Locks
+
+typedef struct _IOLock          IOLock;
+typedef struct _IORecursiveLock IORecursiveLock;
+typedef struct _IORWLock        IORWLock;
+
+typedef void *event_t;
+typedef int wait_result_t;
+
+#define THREAD_UNINT         0
+#define THREAD_INTERRUPTIBLE 1
+
+#define THREAD_AWAKENED  0
+#define THREAD_TIMED_OUT 1
+
+IOLock* IOLockAlloc(void);
+void    IOLockFree(IOLock *lock);
+void    IOLockLock(IOLock *lock);
+void    IOLockUnlock(IOLock *lock);
+
+/*!
+ * Releases 'lock' and waits for 'IOLockWakeup' to be called for 'event', then reacquires it.  Since all events of a
+ * lock share its condition variable, spurious wakeups are more frequent than in the kernel; callers have to (and the
+ * kext always does) check their condition again anyway.
+ */
+int  IOLockSleep(IOLock *lock, void *event, UInt32 interType);
+int  IOLockSleepDeadline(IOLock *lock, void *event, uint64_t deadline, UInt32 interType);
+void IOLockWakeup(IOLock *lock, void *event, bool oneThread);
+
+IORecursiveLock* IORecursiveLockAlloc(void);
+void             IORecursiveLockFree(IORecursiveLock *lock);
+void             IORecursiveLockLock(IORecursiveLock *lock);
+void             IORecursiveLockUnlock(IORecursiveLock *lock);
+
+IORWLock* IORWLockAlloc(void);
+void      IORWLockFree(IORWLock *lock);
+void      IORWLockRead(IORWLock *lock);
+void      IORWLockWrite(IORWLock *lock);
+void      IORWLockUnlock(IORWLock *lock);
+
+void IOSleep(unsigned milliseconds);
+
+#pragma mark Time
+
+enum {
+    kNanosecondScale  = 1,
+    kMicrosecondScale = 1000,
+    kMillisecondScale = 1000 * 1000,
+    kSecondScale      = 1000 * 1000 * 1000,
+};
+
+void clock_interval_to_deadline(uint32_t interval, uint32_t scaleFactor, uint64_t *result);
+void clock_interval_to_absolutetime_interval(uint32_t interval, uint32_t scaleFactor, uint64_t *result);
+void absolutetime_to_nanoseconds(uint64_t absoluteTime, uint64_t *result);
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t *result);
+
+#pragma mark Threads
+
+typedef void (*thread_continue_t)(void *parameter, wait_result_t waitResult);
+
+/*! Runs 'continuation' on a new (detached) pthread; 'newThread' is its Mach port, which needs no deallocation. */
+kern_return_t kernel_thread_start(thread_continue_t continuation, void *parameter, thread_t *newThread);
+void          thread_deallocate(thread_t thread);
+thread_t      current_thread(void);
+uint64_t      thread_tid(thread_t thread);
+
+__END_DECLS
+
+#ifdef __cplusplus
+#include <libkern/c++/OSObject.h>
+#endif
+
+#endif /* UserMode_IOLib_h */
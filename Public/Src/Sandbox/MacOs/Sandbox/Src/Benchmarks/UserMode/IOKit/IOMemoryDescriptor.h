@@ -0,0 +1,43 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef UserMode_IOMemoryDescriptor_h
+#define UserMode_IOMemoryDescriptor_h
+
+// In user mode, the memory of a shared data queue is mapped by simply handing out its address.
+
+#include <IOKit/IOLib.h>
+
+class IOMemoryMap : public OSObject
+{
+    OSDeclareDefaultStructors(IOMemoryMap);
+
+    IOVirtualAddress address_;
+    IOByteCount length_;
+
+    friend class IOMemoryDescriptor;
+
+public:
+
+    IOVirtualAddress getVirtualAddress() { return address_; }
+    IOByteCount getLength()              { return length_; }
+};
+
+class IOMemoryDescriptor : public OSObject
+{
+    OSDeclareDefaultStructors(IOMemoryDescriptor);
+
+    void *address_;
+    IOByteCount length_;
+
+public:
+
+    IOByteCount getLength() const { return length_; }
+
+    /*! The (retained) mapping of the memory into the current "task", i.e., the benchmark process itself. */
+    IOMemoryMap* map(IOOptionBits options = 0);
+
+    static IOMemoryDescriptor* withAddress(void *address, IOByteCount length, IOOptionBits direction);
+};
+
+#endif /* UserMode_IOMemoryDescriptor_h */
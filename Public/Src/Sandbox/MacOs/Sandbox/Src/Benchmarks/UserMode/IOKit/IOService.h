@@ -0,0 +1,12 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef UserMode_IOService_h
+#define UserMode_IOService_h
+
+// The kext sources built into the benchmarks only include <IOKit/IOService.h> for OSObject.
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSObject.h>
+
+#endif /* UserMode_IOService_h */
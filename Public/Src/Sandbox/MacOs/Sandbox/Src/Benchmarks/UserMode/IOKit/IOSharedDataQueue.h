@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef UserMode_IOSharedDataQueue_h
+#define UserMode_IOSharedDataQueue_h
+
+/*
+ * A user-mode IOSharedDataQueue: the same enqueue algorithm as the kernel's, over the memory layout user mode dequeues
+ * from (see <IOKit/IODataQueueShared.h>), so that the reports can be drained with IODataQueueDequeue and
+ * IODataQueueWaitForAvailableData exactly like the interop library drains them (see ListenForFileAccessReports).
+ */
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/IODataQueueShared.h>
+
+class IOSharedDataQueue : public OSObject
+{
+    OSDeclareDefaultStructors(IOSharedDataQueue);
+
+    IODataQueueMemory *dataQueue_;
+    vm_size_t allocatedSize_;
+    mach_msg_header_t notifyMsg_;
+
+    bool initWithCapacity(UInt32 size);
+    void sendDataAvailableNotification();
+
+public:
+
+    void free() override;
+
+    /*!
+     * Copies 'data' to the tail of the queue, unless it is full.  Sends a message to the notification port when the
+     * queue was empty.  Not thread-safe, like the kernel's.
+     */
+    Boolean enqueue(void *data, UInt32 dataSize);
+
+    void setNotificationPort(mach_port_t port);
+
+    /*! A (retained) descriptor of the memory of the queue, including its header and appendix. */
+    IOMemoryDescriptor* getMemoryDescriptor();
+
+    UInt32 getQueueSize() const { return dataQueue_->queueSize; }
+
+    static IOSharedDataQueue* withCapacity(UInt32 size);
+};
+
+#endif /* UserMode_IOSharedDataQueue_h */
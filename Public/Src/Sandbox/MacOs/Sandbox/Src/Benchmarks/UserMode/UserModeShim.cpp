@@ -0,0 +1,541 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <mach/mach.h>
+#include <IOKit/IOLib.h>
+#include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/IOSharedDataQueue.h>
+
+#pragma mark Memory
+
+// Allocations of at least this size are aligned to it, as they are when the kernel's size-class zones (kalloc) serve
+// them; the lfds structures assert that their atomic fields are isolated on their own cache line pairs.
+#define kMallocAlignment 128
+
+void* IOMalloc(vm_size_t size)
+{
+    return size >= kMallocAlignment ? IOMallocAligned(size, kMallocAlignment) : malloc(size);
+}
+
+void IOFree(void *address, vm_size_t size)
+{
+    free(address);
+}
+
+void* IOMallocAligned(vm_size_t size, vm_offset_t alignment)
+{
+    void *address = nullptr;
+    return posix_memalign(&address, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) == 0 ? address : nullptr;
+}
+
+void IOFreeAligned(void *address, vm_size_t size)
+{
+    free(address);
+}
+
+void* IOMallocPageable(vm_size_t size, vm_size_t alignment)
+{
+    return IOMallocAligned(size, alignment < vm_page_size ? vm_page_size : alignment);
+}
+
+void IOFreePageable(void *address, vm_size_t size)
+{
+    free(address);
+}
+
+#pragma mark Locks
+
+struct _IOLock
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+};
+
+struct _IORecursiveLock
+{
+    pthread_mutex_t mutex;
+};
+
+struct _IORWLock
+{
+    pthread_rwlock_t rwlock;
+};
+
+IOLock* IOLockAlloc()
+{
+    IOLock *lock = IONew(IOLock, 1);
+    if (lock != nullptr)
+    {
+        pthread_mutex_init(&lock->mutex, nullptr);
+        pthread_cond_init(&lock->condition, nullptr);
+    }
+
+    return lock;
+}
+
+void IOLockFree(IOLock *lock)
+{
+    pthread_cond_destroy(&lock->condition);
+    pthread_mutex_destroy(&lock->mutex);
+    IODelete(lock, IOLock, 1);
+}
+
+void IOLockLock(IOLock *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+}
+
+void IOLockUnlock(IOLock *lock)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+int IOLockSleep(IOLock *lock, void *event, UInt32 interType)
+{
+    pthread_cond_wait(&lock->condition, &lock->mutex);
+    return THREAD_AWAKENED;
+}
+
+int IOLockSleepDeadline(IOLock *lock, void *event, uint64_t deadline, UInt32 interType)
+{
+    uint64_t now = mach_absolute_time();
+    if (deadline <= now)
+    {
+        return THREAD_TIMED_OUT;
+    }
+
+    uint64_t timeoutNs;
+    absolutetime_to_nanoseconds(deadline - now, &timeoutNs);
+
+    struct timespec timeout = { (time_t)(timeoutNs / kSecondScale), (long)(timeoutNs % kSecondScale) };
+    return pthread_cond_timedwait_relative_np(&lock->condition, &lock->mutex, &timeout) == ETIMEDOUT
+        ? THREAD_TIMED_OUT
+        : THREAD_AWAKENED;
+}
+
+void IOLockWakeup(IOLock *lock, void *event, bool oneThread)
+{
+    // All events of a lock share its condition variable, so waking a single thread up could miss the one waiting for 'event'.
+    pthread_cond_broadcast(&lock->condition);
+}
+
+IORecursiveLock* IORecursiveLockAlloc()
+{
+    IORecursiveLock *lock = IONew(IORecursiveLock, 1);
+    if (lock != nullptr)
+    {
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&lock->mutex, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+    }
+
+    return lock;
+}
+
+void IORecursiveLockFree(IORecursiveLock *lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+    IODelete(lock, IORecursiveLock, 1);
+}
+
+void IORecursiveLockLock(IORecursiveLock *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+}
+
+void IORecursiveLockUnlock(IORecursiveLock *lock)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+IORWLock* IORWLockAlloc()
+{
+    IORWLock *lock = IONew(IORWLock, 1);
+    if (lock != nullptr)
+    {
+        pthread_rwlock_init(&lock->rwlock, nullptr);
+    }
+
+    return lock;
+}
+
+void IORWLockFree(IORWLock *lock)
+{
+    pthread_rwlock_destroy(&lock->rwlock);
+    IODelete(lock, IORWLock, 1);
+}
+
+void IORWLockRead(IORWLock *lock)
+{
+    pthread_rwlock_rdlock(&lock->rwlock);
+}
+
+void IORWLockWrite(IORWLock *lock)
+{
+    pthread_rwlock_wrlock(&lock->rwlock);
+}
+
+void IORWLockUnlock(IORWLock *lock)
+{
+    pthread_rwlock_unlock(&lock->rwlock);
+}
+
+void IOSleep(unsigned milliseconds)
+{
+    usleep(milliseconds * 1000);
+}
+
+#pragma mark Time
+
+static mach_timebase_info_data_t GetTimebase()
+{
+    static mach_timebase_info_data_t s_timebase;
+    if (s_timebase.denom == 0)
+    {
+        mach_timebase_info(&s_timebase);
+    }
+
+    return s_timebase;
+}
+
+void absolutetime_to_nanoseconds(uint64_t absoluteTime, uint64_t *result)
+{
+    mach_timebase_info_data_t timebase = GetTimebase();
+    *result = absoluteTime * timebase.numer / timebase.denom;
+}
+
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t *result)
+{
+    mach_timebase_info_data_t timebase = GetTimebase();
+    *result = nanoseconds * timebase.denom / timebase.numer;
+}
+
+void clock_interval_to_absolutetime_interval(uint32_t interval, uint32_t scaleFactor, uint64_t *result)
+{
+    nanoseconds_to_absolutetime((uint64_t)interval * scaleFactor, result);
+}
+
+void clock_interval_to_deadline(uint32_t interval, uint32_t scaleFactor, uint64_t *result)
+{
+    uint64_t absoluteInterval;
+    clock_interval_to_absolutetime_interval(interval, scaleFactor, &absoluteInterval);
+    *result = mach_absolute_time() + absoluteInterval;
+}
+
+#pragma mark Threads
+
+typedef struct {
+    thread_continue_t continuation;
+    void *parameter;
+} ThreadStart;
+
+static void* RunThread(void *arg)
+{
+    ThreadStart start = *(ThreadStart*)arg;
+    IODelete((ThreadStart*)arg, ThreadStart, 1);
+
+    start.continuation(start.parameter, THREAD_AWAKENED);
+    return nullptr;
+}
+
+kern_return_t kernel_thread_start(thread_continue_t continuation, void *parameter, thread_t *newThread)
+{
+    ThreadStart *start = IONew(ThreadStart, 1);
+    if (start == nullptr)
+    {
+        return KERN_RESOURCE_SHORTAGE;
+    }
+
+    start->continuation = continuation;
+    start->parameter    = parameter;
+
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, RunThread, start) != 0)
+    {
+        IODelete(start, ThreadStart, 1);
+        return KERN_FAILURE;
+    }
+
+    *newThread = pthread_mach_thread_np(thread);
+    pthread_detach(thread);
+    return KERN_SUCCESS;
+}
+
+void thread_deallocate(thread_t thread)
+{
+    // 'pthread_mach_thread_np' does not add a reference to the port it returns.
+}
+
+thread_t current_thread()
+{
+    return pthread_mach_thread_np(pthread_self());
+}
+
+uint64_t thread_tid(thread_t thread)
+{
+    pthread_t pthread = thread == current_thread() ? pthread_self() : pthread_from_mach_thread_np(thread);
+
+    uint64_t tid = 0;
+    if (pthread != nullptr)
+    {
+        pthread_threadid_np(pthread, &tid);
+    }
+
+    return tid;
+}
+
+#pragma mark OSObject
+
+OSMetaClassBase* OSMetaClassBase::safeMetaCast(const OSMetaClassBase *object, const OSMetaClass *toType)
+{
+    if (object == nullptr || toType == nullptr)
+    {
+        return nullptr;
+    }
+
+    for (const OSMetaClass *metaClass = object->getMetaClass(); metaClass != nullptr; metaClass = metaClass->getSuperClass())
+    {
+        if (metaClass == toType)
+        {
+            return const_cast<OSMetaClassBase*>(object);
+        }
+    }
+
+    return nullptr;
+}
+
+const OSMetaClass OSObject::gMetaClass("OSObject", nullptr);
+const OSMetaClass * const OSObject::metaClass = &OSObject::gMetaClass;
+
+const OSMetaClass* OSObject::getMetaClass() const
+{
+    return &gMetaClass;
+}
+
+OSObject::OSObject() : retainCount_(1) {}
+
+OSObject::~OSObject() {}
+
+void* OSObject::operator new(size_t size) noexcept
+{
+    // Like the kernel's, objects start out zero-filled (the kext relies on it, e.g., in 'free' after a failed 'init').
+    return calloc(1, size);
+}
+
+void OSObject::operator delete(void *memory, size_t size)
+{
+    ::free(memory);
+}
+
+bool OSObject::init()
+{
+    return true;
+}
+
+void OSObject::free()
+{
+    delete this;
+}
+
+void OSObject::retain() const
+{
+    OSIncrementAtomic(&retainCount_);
+}
+
+void OSObject::release() const
+{
+    if (OSDecrementAtomic(&retainCount_) == 1)
+    {
+        const_cast<OSObject*>(this)->free();
+    }
+}
+
+int OSObject::getRetainCount() const
+{
+    return retainCount_;
+}
+
+#pragma mark IOMemoryDescriptor
+
+OSDefineMetaClassAndStructors(IOMemoryMap, OSObject)
+OSDefineMetaClassAndStructors(IOMemoryDescriptor, OSObject)
+
+IOMemoryDescriptor* IOMemoryDescriptor::withAddress(void *address, IOByteCount length, IOOptionBits direction)
+{
+    IOMemoryDescriptor *descriptor = new IOMemoryDescriptor;
+    if (descriptor != nullptr)
+    {
+        descriptor->address_ = address;
+        descriptor->length_  = length;
+    }
+
+    return descriptor;
+}
+
+IOMemoryMap* IOMemoryDescriptor::map(IOOptionBits options)
+{
+    IOMemoryMap *map = new IOMemoryMap;
+    if (map != nullptr)
+    {
+        map->address_ = (IOVirtualAddress)address_;
+        map->length_  = length_;
+    }
+
+    return map;
+}
+
+#pragma mark IOSharedDataQueue
+
+OSDefineMetaClassAndStructors(IOSharedDataQueue, OSObject)
+
+IOSharedDataQueue* IOSharedDataQueue::withCapacity(UInt32 size)
+{
+    IOSharedDataQueue *queue = new IOSharedDataQueue;
+    if (queue != nullptr && !queue->initWithCapacity(size))
+    {
+        OSSafeReleaseNULL(queue);
+    }
+
+    return queue;
+}
+
+bool IOSharedDataQueue::initWithCapacity(UInt32 size)
+{
+    if (!OSObject::init())
+    {
+        return false;
+    }
+
+    if (size > UINT32_MAX - DATA_QUEUE_MEMORY_HEADER_SIZE - DATA_QUEUE_MEMORY_APPENDIX_SIZE)
+    {
+        return false;
+    }
+
+    allocatedSize_ = size + DATA_QUEUE_MEMORY_HEADER_SIZE + DATA_QUEUE_MEMORY_APPENDIX_SIZE;
+    allocatedSize_ = (allocatedSize_ + vm_page_size - 1) & ~(vm_size_t)(vm_page_size - 1);
+
+    dataQueue_ = (IODataQueueMemory*)IOMallocAligned(allocatedSize_, vm_page_size);
+    if (dataQueue_ == nullptr)
+    {
+        return false;
+    }
+
+    bzero(dataQueue_, allocatedSize_);
+    dataQueue_->queueSize = size;
+    return true;
+}
+
+void IOSharedDataQueue::free()
+{
+    if (dataQueue_ != nullptr)
+    {
+        IOFreeAligned(dataQueue_, allocatedSize_);
+        dataQueue_ = nullptr;
+    }
+
+    OSObject::free();
+}
+
+void IOSharedDataQueue::setNotificationPort(mach_port_t port)
+{
+    // The kernel holds a send right for the port; here, the benchmark holds its receive right and the message makes one.
+    notifyMsg_.msgh_bits        = MACH_MSGH_BITS(MACH_MSG_TYPE_MAKE_SEND, 0);
+    notifyMsg_.msgh_size        = sizeof(mach_msg_header_t);
+    notifyMsg_.msgh_remote_port = port;
+    notifyMsg_.msgh_local_port  = MACH_PORT_NULL;
+    notifyMsg_.msgh_id          = 0;
+}
+
+void IOSharedDataQueue::sendDataAvailableNotification()
+{
+    if (notifyMsg_.msgh_remote_port == MACH_PORT_NULL)
+    {
+        return;
+    }
+
+    // Like the kernel's, this does not wait when the port already has a message queued (its queue limit is 1).
+    mach_msg_header_t msgh = notifyMsg_;
+    mach_msg(&msgh, MACH_SEND_MSG | MACH_SEND_TIMEOUT, msgh.msgh_size, 0, MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+}
+
+IOMemoryDescriptor* IOSharedDataQueue::getMemoryDescriptor()
+{
+    return IOMemoryDescriptor::withAddress(dataQueue_,
+                                           getQueueSize() + DATA_QUEUE_MEMORY_HEADER_SIZE + DATA_QUEUE_MEMORY_APPENDIX_SIZE,
+                                           0);
+}
+
+Boolean IOSharedDataQueue::enqueue(void *data, UInt32 dataSize)
+{
+    const UInt32 entrySize = dataSize + DATA_QUEUE_ENTRY_HEADER_SIZE;
+    const UInt32 queueSize = getQueueSize();
+
+    UInt32 head = __atomic_load_n(&dataQueue_->head, __ATOMIC_RELAXED);
+    UInt32 tail = __atomic_load_n(&dataQueue_->tail, __ATOMIC_RELAXED);
+    UInt32 newTail;
+
+    if (dataSize > UINT32_MAX - DATA_QUEUE_ENTRY_HEADER_SIZE || queueSize < tail || queueSize < head)
+    {
+        return false;
+    }
+
+    if (tail >= head)
+    {
+        if (entrySize <= UINT32_MAX - tail && tail + entrySize <= queueSize)
+        {
+            IODataQueueEntry *entry = (IODataQueueEntry*)((UInt8*)dataQueue_->queue + tail);
+            entry->size = dataSize;
+            memcpy(&entry->data, data, dataSize);
+            newTail = tail + entrySize;
+        }
+        else if (head > entrySize)
+        {
+            // Wrap around, leaving the size at the end too if it fits (that's where the dequeuer looks for it first).
+            dataQueue_->queue->size = dataSize;
+            if (queueSize - tail >= DATA_QUEUE_ENTRY_HEADER_SIZE)
+            {
+                ((IODataQueueEntry*)((UInt8*)dataQueue_->queue + tail))->size = dataSize;
+            }
+
+            memcpy(&dataQueue_->queue->data, data, dataSize);
+            newTail = entrySize;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else if (head - tail > entrySize)
+    {
+        // The tail must not catch up with the head, hence '>'.
+        IODataQueueEntry *entry = (IODataQueueEntry*)((UInt8*)dataQueue_->queue + tail);
+        entry->size = dataSize;
+        memcpy(&entry->data, data, dataSize);
+        newTail = tail + entrySize;
+    }
+    else
+    {
+        return false;
+    }
+
+    __atomic_store_n(&dataQueue_->tail, newTail, __ATOMIC_RELEASE);
+
+    if (tail != head)
+    {
+        // Pairs with the barrier in IODataQueueDequeue: either the dequeuer sees the new tail, or this sees the queue it emptied.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&dataQueue_->head, __ATOMIC_RELAXED);
+    }
+
+    if (tail == head)
+    {
+        sendDataAvailableNotification();
+    }
+
+    return true;
+}
@@ -0,0 +1,41 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef UserMode_OSAtomic_h
+#define UserMode_OSAtomic_h
+
+/*
+ * The atomic operations of the kernel's <libkern/OSAtomic.h> (which user mode only has under other, deprecated names),
+ * on top of the compiler's builtins.  Like the kernel's, all of them are full barriers and the arithmetic ones return
+ * the value before the operation.  Unlike the kernel's, the arithmetic ones accept integers of any width, which only
+ * matters for code that does not build for the kernel anyway.
+ */
+
+#include <stdbool.h>
+#include <libkern/OSTypes.h>
+
+#define OSAddAtomic(amount, address)    __atomic_fetch_add((address), (amount), __ATOMIC_SEQ_CST)
+#define OSAddAtomic64(amount, address)  __atomic_fetch_add((address), (amount), __ATOMIC_SEQ_CST)
+#define OSIncrementAtomic(address)      __atomic_fetch_add((address), 1, __ATOMIC_SEQ_CST)
+#define OSIncrementAtomic64(address)    __atomic_fetch_add((address), 1, __ATOMIC_SEQ_CST)
+#define OSDecrementAtomic(address)      __atomic_fetch_sub((address), 1, __ATOMIC_SEQ_CST)
+#define OSDecrementAtomic64(address)    __atomic_fetch_sub((address), 1, __ATOMIC_SEQ_CST)
+#define OSMemoryBarrier()               __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static inline bool UserMode_OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32 *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline bool UserMode_OSCompareAndSwapPtr(void *oldValue, void *newValue, void * volatile *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Like the kernel's, these cast the address, so that they can be used with any 32-bit (resp. pointer) location.
+#define OSCompareAndSwap(oldValue, newValue, address) \
+    UserMode_OSCompareAndSwap((UInt32)(oldValue), (UInt32)(newValue), (volatile UInt32 *)(address))
+#define OSCompareAndSwapPtr(oldValue, newValue, address) \
+    UserMode_OSCompareAndSwapPtr((void *)(oldValue), (void *)(newValue), (void * volatile *)(address))
+
+#endif /* UserMode_OSAtomic_h */
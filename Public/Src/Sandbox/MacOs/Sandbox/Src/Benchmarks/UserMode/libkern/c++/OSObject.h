@@ -0,0 +1,100 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef UserMode_OSObject_h
+#define UserMode_OSObject_h
+
+/*
+ * A user-mode OSObject: reference counting, the init/free pattern and enough of the run-time type information of the
+ * kernel's OSMetaClass for 'OSTypeID' and 'OSDynamicCast'.  As in the kernel, objects are zero-filled when allocated.
+ */
+
+#include <stddef.h>
+#include <libkern/OSTypes.h>
+
+class OSMetaClass;
+
+class OSMetaClassBase
+{
+public:
+
+    virtual const OSMetaClass* getMetaClass() const = 0;
+
+    /*! 'object' if it is an instance of 'toType' (or of a subclass of it), nullptr otherwise. */
+    static OSMetaClassBase* safeMetaCast(const OSMetaClassBase *object, const OSMetaClass *toType);
+
+protected:
+
+    virtual ~OSMetaClassBase() {}
+};
+
+class OSMetaClass
+{
+private:
+
+    const char *className_;
+    const OSMetaClass *superClass_;
+
+public:
+
+    constexpr OSMetaClass(const char *className, const OSMetaClass *superClass)
+        : className_(className), superClass_(superClass) {}
+
+    const char* getClassName() const          { return className_; }
+    const OSMetaClass* getSuperClass() const  { return superClass_; }
+};
+
+#define OSTypeID(type)                  (type::metaClass)
+#define OSDynamicCast(type, instance)   ((type *)OSMetaClassBase::safeMetaCast((instance), OSTypeID(type)))
+#define OSSafeReleaseNULL(instance)     do { if ((instance) != nullptr) (instance)->release(); (instance) = nullptr; } while (0)
+
+#define OSDeclareCommonStructors(className)                             \
+    public:                                                             \
+        static const OSMetaClass gMetaClass;                            \
+        static const OSMetaClass * const metaClass;                     \
+        const OSMetaClass* getMetaClass() const override
+
+#define OSDeclareDefaultStructors(className)                            \
+    OSDeclareCommonStructors(className);                                \
+    public:                                                             \
+        className();                                                    \
+    protected:                                                          \
+        virtual ~className();                                           \
+    private:
+
+#define OSDefineMetaClassAndStructors(className, superclassName)                        \
+    const OSMetaClass className::gMetaClass(#className, &superclassName::gMetaClass);   \
+    const OSMetaClass * const className::metaClass = &className::gMetaClass;            \
+    const OSMetaClass* className::getMetaClass() const { return &gMetaClass; }          \
+    className::className() {}                                                           \
+    className::~className() {}
+
+class OSObject : public OSMetaClassBase
+{
+    OSDeclareCommonStructors(OSObject);
+
+private:
+
+    mutable volatile SInt32 retainCount_;
+
+protected:
+
+    OSObject();
+    virtual ~OSObject();
+
+    /*! Called when the last reference is released; subclasses release what they hold and then call 'super::free'. */
+    virtual void free();
+
+public:
+
+    static void* operator new(size_t size) noexcept;
+    static void operator delete(void *memory, size_t size);
+
+    virtual bool init();
+
+    void retain() const;
+    void release() const;
+    int getRetainCount() const;
+};
+
+#endif /* UserMode_OSObject_h */
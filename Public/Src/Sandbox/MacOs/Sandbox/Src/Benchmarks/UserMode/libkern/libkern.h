@@ -0,0 +1,17 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef UserMode_libkern_h
+#define UserMode_libkern_h
+
+// The parts of the C library the kernel's <libkern/libkern.h> provides.  <wchar.h> has to come before stdafx-mac-kext.h,
+// which stubs 'wprintf' out with a macro.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <wchar.h>
+#include <libkern/OSAtomic.h>
+
+#endif /* UserMode_libkern_h */
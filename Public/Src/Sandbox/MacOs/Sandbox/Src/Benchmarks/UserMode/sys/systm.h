@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef UserMode_systm_h
+#define UserMode_systm_h
+
+// Nothing the kext sources built into the benchmarks use from the kernel's <sys/systm.h> is missing in user mode.
+
+#include <sys/types.h>
+
+#endif /* UserMode_systm_h */
@@ -5,10 +5,12 @@
 
 #include "BuildXLSandbox.hpp"
 #include "CacheRecord.hpp"
+#include "EventTrace.hpp"
 #include "Listeners.hpp"
 #include "Stopwatch.hpp"
 #include "SysCtl.hpp"
 #include "TrustedBsdHandler.hpp"
+#include "VNodeHandler.hpp"
 
 #define LogVerbose(format, ...) log_verbose(g_bxl_verbose_logging, format, __VA_ARGS__)
 #define super IOService
@@ -19,13 +21,25 @@ os_log_t logger = os_log_create(kBuildXLBundleIdentifier, "Logger");
 
 static KextConfig sDefaultConfig =
 {
-    .reportQueueSizeMB    = kSharedDataQueueSizeDefault,
-    .enableReportBatching = false,
-    .resourceThresholds   =
+    .reportQueueSizeMB        = kSharedDataQueueSizeDefault,
+    .enableReportBatching     = false,
+    .enableCompactReports     = false,
+    .numReportQueues          = 1,
+    .pathCacheBudget          = 0,
+    .mapPipPayloads           = false,
+    .ignoredOperationClasses  = 0,
+    .reportCoalescingWindowUs = 0,
+    .enablePriorityReportQueue = false,
+    .summarizeWhenLagging     = false,
+    .timingSampleRate         = 1,
+    .maxPipReportRate         = 0,
+    .resourceThresholds       =
     {
-        .cpuUsageBlock     = 0,
-        .cpuUsageWakeup    = 0,
-        .minAvailableRamMB = 0
+        .cpuUsageBlock       = 0,
+        .cpuUsageWakeup      = 0,
+        .minAvailableRamMB   = 0,
+        .ramWakeupMarginMB   = 0,
+        .cpuSampleIntervalMs = 0
     }
 };
 
@@ -42,6 +56,17 @@ bool BuildXLSandbox::init(OSDictionary *dictionary)
 
     bxl_sysctl_register();
     InitializePolicyStructures();
+    if (!EventTrace::Initialize())
+    {
+        log_error("%s", "Could not allocate the event trace; no events will be recorded");
+    }
+
+    VNodeHandler::InitializeDispatchTable();
+
+    if (!SandboxedPip::InitializeManifestTrees())
+    {
+        return false;
+    }
 
     lock_ = IORecursiveLockAlloc();
     if (!lock_)
@@ -49,6 +74,12 @@ bool BuildXLSandbox::init(OSDictionary *dictionary)
         return false;
     }
 
+    counterSlabs_ = (CounterSlab*)IOMallocAligned(kCounterSlabCount * sizeof(CounterSlab), sizeof(CounterSlab));
+    if (!counterSlabs_)
+    {
+        return false;
+    }
+
     ResetCounters();
     resourceManager_ = ResourceManager::create(&counters_.resourceCounters);
     if (!resourceManager_)
@@ -62,12 +93,80 @@ bool BuildXLSandbox::init(OSDictionary *dictionary)
         return false;
     }
 
+    trackedProcessesByPid_ = IONewZero(SandboxedProcess*, kPidTableSize);
+    if (!trackedProcessesByPid_)
+    {
+        return false;
+    }
+
+    pendingPipTeardownHead_  = 0;
+    pendingPipTeardownCount_ = 0;
+    pipTeardownDone_         = false;
+    pipTeardownLock_         = IOLockAlloc();
+    if (!pipTeardownLock_)
+    {
+        return false;
+    }
+
+    pipTeardownThread_ = Thread::create(this, [](void *me, wait_result_t result)
+                                        {
+                                            static_cast<BuildXLSandbox*>(me)->DrainPipTeardowns();
+                                        });
+    if (!pipTeardownThread_)
+    {
+        return false;
+    }
+
+    pipTeardownThread_->start();
+
+    listenersRegistered_     = false;
+    listenersIdleRequests_   = 0;
+    listenersIdleThreadDone_ = false;
+    inFlightKauthCallbacks_  = 0;
+    listenersLock_           = IOLockAlloc();
+    listenersIdleLock_       = IOLockAlloc();
+    if (!listenersLock_ || !listenersIdleLock_)
+    {
+        return false;
+    }
+
+    listenersIdleThread_ = Thread::create(this, [](void *me, wait_result_t result)
+                                          {
+                                              static_cast<BuildXLSandbox*>(me)->UnregisterIdleListeners();
+                                          });
+    if (!listenersIdleThread_)
+    {
+        return false;
+    }
+
+    listenersIdleThread_->start();
+
+    bxl_sysctl_register_stats([](void *me, bxl_stats *stats)
+                              {
+                                  static_cast<const BuildXLSandbox*>(me)->GetStats(stats);
+                              }, this);
+
     return true;
 }
 
 void BuildXLSandbox::free(void)
 {
+    bxl_sysctl_unregister_stats();
+    StopListenersIdleThread();
     UninitializeListeners();
+    StopPipTeardownThread();
+
+    if (listenersLock_)
+    {
+        IOLockFree(listenersLock_);
+        listenersLock_ = nullptr;
+    }
+
+    if (listenersIdleLock_)
+    {
+        IOLockFree(listenersIdleLock_);
+        listenersIdleLock_ = nullptr;
+    }
 
     if (lock_)
     {
@@ -79,11 +178,130 @@ void BuildXLSandbox::free(void)
     OSSafeReleaseNULL(trackedProcesses_);
     OSSafeReleaseNULL(connectedClients_);
 
+    if (trackedProcessesByPid_)
+    {
+        IODelete(trackedProcessesByPid_, SandboxedProcess*, kPidTableSize);
+        trackedProcessesByPid_ = nullptr;
+    }
+
+    if (counterSlabs_)
+    {
+        IOFreeAligned(counterSlabs_, kCounterSlabCount * sizeof(CounterSlab));
+        counterSlabs_ = nullptr;
+    }
+
+    // after all tracked processes (and thus pips) have been released
+    SandboxedPip::FreeManifestTrees();
+
     bxl_sysctl_unregister();
+    EventTrace::Free();
 
     super::free();
 }
 
+void BuildXLSandbox::ReleasePipDeferred(SandboxedPip *pip)
+{
+    if (pip == nullptr)
+    {
+        return;
+    }
+
+    bool queued = false;
+    IOLockLock(pipTeardownLock_);
+    {
+        if (!pipTeardownDone_ && pendingPipTeardownCount_ < kMaxPendingPipTeardowns)
+        {
+            uint tail = (pendingPipTeardownHead_ + pendingPipTeardownCount_) % kMaxPendingPipTeardowns;
+            pendingPipTeardowns_[tail] = pip;
+            pendingPipTeardownCount_++;
+            queued = true;
+            IOLockWakeup(pipTeardownLock_, &pendingPipTeardownCount_, /*oneThread*/ true);
+        }
+    }
+    IOLockUnlock(pipTeardownLock_);
+
+    if (!queued)
+    {
+        // the teardown thread is behind (or gone) --> release it here rather than keep an unbounded backlog
+        OSSafeReleaseNULL(pip);
+    }
+}
+
+void BuildXLSandbox::DrainPipTeardowns()
+{
+    SandboxedPip *batch[kMaxPendingPipTeardowns];
+    while (true)
+    {
+        uint count = 0;
+        IOLockLock(pipTeardownLock_);
+        {
+            while (pendingPipTeardownCount_ == 0 && !pipTeardownDone_)
+            {
+                IOLockSleep(pipTeardownLock_, &pendingPipTeardownCount_, THREAD_UNINT);
+            }
+
+            // take the whole backlog, so that the lock is not held while pips are being freed
+            for (; count < pendingPipTeardownCount_; count++)
+            {
+                batch[count] = pendingPipTeardowns_[(pendingPipTeardownHead_ + count) % kMaxPendingPipTeardowns];
+            }
+        }
+        IOLockUnlock(pipTeardownLock_);
+
+        if (count == 0)
+        {
+            // done, and nothing is pending anymore
+            return;
+        }
+
+        for (uint i = 0; i < count; i++)
+        {
+            OSSafeReleaseNULL(batch[i]);
+        }
+
+        // the count only goes down once the pips are freed, so that it counts the teardowns not done yet
+        IOLockLock(pipTeardownLock_);
+        {
+            pendingPipTeardownHead_   = (pendingPipTeardownHead_ + count) % kMaxPendingPipTeardowns;
+            pendingPipTeardownCount_ -= count;
+        }
+        IOLockUnlock(pipTeardownLock_);
+    }
+}
+
+void BuildXLSandbox::StopPipTeardownThread()
+{
+    if (pipTeardownLock_ == nullptr)
+    {
+        return;
+    }
+
+    IOLockLock(pipTeardownLock_);
+    {
+        pipTeardownDone_ = true;
+        IOLockWakeup(pipTeardownLock_, &pendingPipTeardownCount_, /*oneThread*/ false);
+    }
+    IOLockUnlock(pipTeardownLock_);
+
+    // the thread drains what is pending before it exits
+    if (pipTeardownThread_ != nullptr)
+    {
+        pipTeardownThread_->join();
+        OSSafeReleaseNULL(pipTeardownThread_);
+    }
+
+    // left behind only if the thread never started
+    while (pendingPipTeardownCount_ > 0)
+    {
+        OSSafeReleaseNULL(pendingPipTeardowns_[pendingPipTeardownHead_]);
+        pendingPipTeardownHead_ = (pendingPipTeardownHead_ + 1) % kMaxPendingPipTeardowns;
+        pendingPipTeardownCount_--;
+    }
+
+    IOLockFree(pipTeardownLock_);
+    pipTeardownLock_ = nullptr;
+}
+
 bool BuildXLSandbox::start(IOService *provider)
 {
     bool success = super::start(provider);
@@ -152,7 +370,7 @@ bool BuildXLSandbox::InitializeTries()
         return false;
     }
 
-    trackedProcesses_ = Trie::createUintTrie();
+    trackedProcesses_ = Trie::createUintTrie(OSTypeID(SandboxedProcess));
     if (!trackedProcesses_)
     {
         return false;
@@ -165,6 +383,17 @@ bool BuildXLSandbox::InitializeTries()
         {
             me->resourceManager_->UpdateNumTrackedProcesses(newCount);
         }
+
+        // Only root processes (tracked on behalf of a client) bring the count up from 0, since child processes are only
+        // tracked while their parent is; the listeners are thus never registered from within one of their callbacks.
+        if (oldCount == 0)
+        {
+            me->EnsureListenersRegistered();
+        }
+        else if (newCount == 0)
+        {
+            me->RequestIdleListenersUnregistration();
+        }
     });
 
     if (!callbackInstalled)
@@ -173,8 +402,8 @@ bool BuildXLSandbox::InitializeTries()
         return false;
     }
 
-    // Install an 'onChange' callback, which uninitializes (initializes) listeners
-    // whenever the number of attached clients drops to (moves from) 0.
+    // Install an 'onChange' callback, which cleans up (and uninitializes listeners, in case some process is still
+    // tracked) whenever the number of attached clients drops to 0.  Listeners are initialized once a process is tracked.
     callbackInstalled = connectedClients_->onChange(this, [](void *data, int oldCount, int newCount)
     {
         BuildXLSandbox *me = (BuildXLSandbox*)data;
@@ -192,11 +421,6 @@ bool BuildXLSandbox::InitializeTries()
                                 }, me, &once);
             thread_deallocate(once);
         }
-        else if (oldCount == 0)
-        {
-            LogVerbose("Number of attached clients jumped from 0 to %d --> initializing listeners", newCount);
-            me->InitializeListeners();
-        }
     });
 
     if (!callbackInstalled)
@@ -222,6 +446,7 @@ kern_return_t BuildXLSandbox::InitializeListeners()
     if (buildxlVnodeListener_ == nullptr)
     {
         log_error("%s", "Registering callback for KAUTH_SCOPE_VNODE scope failed!");
+        UninitializeListeners();
         return KERN_FAILURE;
     }
 
@@ -229,16 +454,18 @@ kern_return_t BuildXLSandbox::InitializeListeners()
     if (buildxlFileOpListener_ == nullptr)
     {
         log_error("%s", "Registering callback for KAUTH_SCOPE_FILEOP scope failed!");
+        UninitializeListeners();
         return KERN_FAILURE;
     }
 
+    listenersRegistered_ = true;
     LogVerbose("%s", "Successfully registered listeners");
     return KERN_SUCCESS;
 }
 
 void BuildXLSandbox::UninitializeListeners()
 {
-    counters_ = {0};
+    listenersRegistered_ = false;
 
     if (buildxlVnodeListener_ != nullptr)
     {
@@ -254,6 +481,12 @@ void BuildXLSandbox::UninitializeListeners()
         buildxlFileOpListener_ = nullptr;
     }
 
+    // kauth_unlisten_scope does not wait for the callbacks already running (unlike mac_policy_unregister, which does)
+    while (inFlightKauthCallbacks_ > 0)
+    {
+        IOSleep(1);
+    }
+
     if (policyHandle_ != 0)
     {
         mac_policy_unregister(policyHandle_);
@@ -262,18 +495,108 @@ void BuildXLSandbox::UninitializeListeners()
     }
 }
 
+void BuildXLSandbox::EnsureListenersRegistered()
+{
+    IOLockLock(listenersLock_);
+    {
+        if (!listenersRegistered_)
+        {
+            LogVerbose("%s", "First process tracked --> initializing listeners");
+            InitializeListeners();
+        }
+    }
+    IOLockUnlock(listenersLock_);
+}
+
+void BuildXLSandbox::RequestIdleListenersUnregistration()
+{
+    IOLockLock(listenersIdleLock_);
+    {
+        listenersIdleRequests_++;
+        IOLockWakeup(listenersIdleLock_, &listenersIdleRequests_, /*oneThread*/ true);
+    }
+    IOLockUnlock(listenersIdleLock_);
+}
+
+void BuildXLSandbox::UnregisterIdleListeners()
+{
+    IOLockLock(listenersIdleLock_);
+    while (!listenersIdleThreadDone_)
+    {
+        if (listenersIdleRequests_ == 0)
+        {
+            IOLockSleep(listenersIdleLock_, &listenersIdleRequests_, THREAD_UNINT);
+            continue;
+        }
+
+        // a request coming in during the wait starts it over
+        listenersIdleRequests_ = 0;
+        uint64_t deadline;
+        clock_interval_to_deadline(kListenersIdleUnregisterMs, kMillisecondScale, &deadline);
+        IOLockSleepDeadline(listenersIdleLock_, &listenersIdleRequests_, deadline, THREAD_UNINT);
+        if (listenersIdleRequests_ != 0 || listenersIdleThreadDone_)
+        {
+            continue;
+        }
+
+        IOLockUnlock(listenersIdleLock_);
+
+        // the count is checked again under 'listenersLock_', which a process tracked from now on waits for
+        IOLockLock(listenersLock_);
+        {
+            if (listenersRegistered_ && trackedProcesses_->getCount() == 0)
+            {
+                LogVerbose("No process tracked for %d ms --> uninitializing listeners", kListenersIdleUnregisterMs);
+                UninitializeListeners();
+            }
+        }
+        IOLockUnlock(listenersLock_);
+
+        IOLockLock(listenersIdleLock_);
+    }
+    IOLockUnlock(listenersIdleLock_);
+}
+
+void BuildXLSandbox::StopListenersIdleThread()
+{
+    if (listenersIdleLock_ == nullptr)
+    {
+        return;
+    }
+
+    IOLockLock(listenersIdleLock_);
+    {
+        listenersIdleThreadDone_ = true;
+        IOLockWakeup(listenersIdleLock_, &listenersIdleRequests_, /*oneThread*/ false);
+    }
+    IOLockUnlock(listenersIdleLock_);
+
+    if (listenersIdleThread_ != nullptr)
+    {
+        listenersIdleThread_->join();
+        OSSafeReleaseNULL(listenersIdleThread_);
+    }
+}
+
 void BuildXLSandbox::OnLastClientDisconnected()
 {
     EnterMonitor
 
     Configure(&sDefaultConfig);
     ResetCounters();
-    UninitializeListeners();
 
-    // re-initialize tries to force deallocation of trie nodes
-    OSSafeReleaseNULL(trackedProcesses_);
-    OSSafeReleaseNULL(connectedClients_);
-    InitializeTries();
+    // 'listenersIdleThread_' reads 'trackedProcesses_' under 'listenersLock_'
+    IOLockLock(listenersLock_);
+    {
+        UninitializeListeners();
+
+        // re-initialize tries to force deallocation of trie nodes
+        bzero((void*)trackedProcessesByPid_, kPidTableSize * sizeof(trackedProcessesByPid_[0]));
+        OSSafeReleaseNULL(trackedProcesses_);
+        OSSafeReleaseNULL(connectedClients_);
+        InitializeTries();
+    }
+    IOLockUnlock(listenersLock_);
 }
 
 void BuildXLSandbox::Configure(const KextConfig *config)
@@ -292,6 +615,22 @@ void BuildXLSandbox::Configure(const KextConfig *config)
     {
         config_.reportQueueSizeMB = kSharedDataQueueSizeDefault;
     }
+
+    if (config_.numReportQueues == 0)
+    {
+        config_.numReportQueues = 1;
+    }
+    else if (config_.numReportQueues > kMaxReportQueues)
+    {
+        config_.numReportQueues = kMaxReportQueues;
+    }
+
+    if (config_.timingSampleRate == 0)
+    {
+        config_.timingSampleRate = 1;
+    }
+
+    Stopwatch::SetSampleRate(config_.timingSampleRate);
 }
 
 UInt32 BuildXLSandbox::GetReportQueueEntryCount()
@@ -313,8 +652,11 @@ IOReturn BuildXLSandbox::AllocateNewClient(pid_t clientPid)
         .entryCount     = GetReportQueueEntryCount(),
         .entrySize      = sizeof(AccessReport),
         .enableBatching = config_.enableReportBatching,
+        .enableCompactReports = config_.enableCompactReports,
+        .coalescingWindowUs = config_.reportCoalescingWindowUs,
+        .summarizeWhenLagging = config_.summarizeWhenLagging,
         .counters       = &counters_.reportCounters
-    });
+    }, config_.numReportQueues, config_.enablePriorityReportQueue);
     AutoRelease _(client);
 
     if (client == nullptr)
@@ -361,6 +703,15 @@ IOReturn BuildXLSandbox::DeallocateClient(pid_t clientPid)
 
         // Make sure to also cleanup any remaining tracked process objects as the client could have exited abnormally (crashed)
         // and we don't want those objects to stay around any longer
+        for (pid_t pid = 0; pid < kPidTableSize; pid++)
+        {
+            SandboxedProcess *process = trackedProcessesByPid_[pid];
+            if (process != nullptr && process->getPip()->getClientPid() == clientPid)
+            {
+                ClearTrackedProcessEntry(pid, process);
+            }
+        }
+
         trackedProcesses_->removeMatching(&clientPid, [](void *data, const OSObject *value)
         {
             pid_t cid = *static_cast<pid_t*>(data);
@@ -375,34 +726,39 @@ IOReturn BuildXLSandbox::DeallocateClient(pid_t clientPid)
     return kIOReturnError;
 }
 
-IOReturn BuildXLSandbox::SetReportQueueNotificationPort(mach_port_t port, pid_t clientPid)
+IOReturn BuildXLSandbox::SetReportQueueNotificationPort(mach_port_t port, pid_t clientPid, uint queueIndex)
 {
     EnterMonitor
 
     ClientInfo *client = GetClientInfo(clientPid);
     bool success =
         client != nullptr &&
-        client->setNotifactonPort(port);
+        client->setNotifactonPort(queueIndex, port);
 
     return success ? kIOReturnSuccess : kIOReturnError;
 }
 
-IOMemoryDescriptor* const BuildXLSandbox::GetReportQueueMemoryDescriptor(pid_t clientPid)
+IOMemoryDescriptor* const BuildXLSandbox::GetReportQueueMemoryDescriptor(pid_t clientPid, uint queueIndex)
 {
     EnterMonitor
 
     ClientInfo *client = GetClientInfo(clientPid);
     return client != nullptr
-        ? client->getMemoryDescriptor()
+        ? client->getMemoryDescriptor(queueIndex)
         : nullptr;
 }
 
-bool const BuildXLSandbox::SendAccessReport(AccessReport &report, SandboxedPip *pip, const CacheRecord *cacheRecord)
+bool const BuildXLSandbox::SendAccessReport(AccessReport &report, SandboxedPip *pip, const CacheRecord *cacheRecord, uint32_t timingWeight)
 {
-    Stopwatch stopwatch;
+    Stopwatch stopwatch(timingWeight);
 
+    // the client is normally cached on the pip when it starts, so that no lookup is needed here
     pid_t clientPid = pip->getClientPid();
-    ClientInfo *client = GetClientInfo(clientPid);
+    ClientInfo *client = pip->getClientInfo();
+    if (client == nullptr)
+    {
+        client = GetClientInfo(clientPid);
+    }
 
     Timespan getClientInfoDuration      = stopwatch.lap();
     Counters()->getClientInfo          += getClientInfoDuration;
@@ -414,18 +770,55 @@ bool const BuildXLSandbox::SendAccessReport(AccessReport &report, SandboxedPip *
         return false;
     }
 
-    AddTimeStampToAccessReport(&report, enqueueTime);
+    if (stopwatch.isTiming())
+    {
+        AddTimeStampToAccessReport(&report, enqueueTime);
+    }
 
-    bool success = client->enqueueReport({.report = report, .cacheRecord = cacheRecord});
+    // the client may only consider the pip done once it has also received all of its priority reports
+    if (report.operation == kOpProcessTreeCompleted && client->hasPriorityQueue())
+    {
+        report.requestedAccess = pip->getPriorityReportCount();
+    }
+
+    // a pip reporting faster than its share only gets the room the other pips leave in the queue it shares with them
+    bool summarize = false;
+    if (config_.maxPipReportRate > 0 &&
+        ConcurrentSharedDataQueue::isSummarizable(report) &&
+        !pip->takeReportToken(config_.maxPipReportRate))
+    {
+        summarize = true;
+        GetReportCounters()->numThrottledReports++;
+        pip->Counters()->reportCounters.numThrottledReports++;
+        if (pip->markReportRateExceeded())
+        {
+            log("PIP(%#llX) of ClientPID(%d) reports more than %u accesses per second; its reports are summarized",
+                pip->getPipId(), clientPid, config_.maxPipReportRate);
+        }
+    }
+
+    bool sentToPriorityQueue = false;
+    bool success = client->enqueueReport({.report = report, .cacheRecord = cacheRecord, .summarize = summarize}, &sentToPriorityQueue);
+    if (sentToPriorityQueue)
+    {
+        pip->incrementPriorityReportCount();
+        Counters()->numPriorityReports++;
+    }
 
     Timespan reportFileAccessDuration  = stopwatch.lap();
     Counters()->reportFileAccess      += reportFileAccessDuration;
+    Latencies()->reportFileAccess     += reportFileAccessDuration;
     pip->Counters()->reportFileAccess += reportFileAccessDuration;
 
-    log_error_or_debug(
-        g_bxl_verbose_logging, !success,
-        "Enqueued ClientPID(%d), PID(%d), Root PID(%d), PIP(%#llX), Operation: %s, Path: %s, Status: %d, Sent: %d",
-        clientPid, report.pid, report.rootPid, report.pipId, OpNames[report.operation], report.path, report.status, success);
+    // this is done for every single report, so successes only go to the event trace
+    if (!success)
+    {
+        log_error("Could not enqueue ClientPID(%d), PID(%d), Root PID(%d), PIP(%#llX), Operation: %s, Path: %s, Status: %d",
+                  clientPid, report.pid, report.rootPid, report.pipId, OpNames[report.operation], report.path, report.status);
+    }
+
+    bxl_trace(kTraceEventReportEnqueued, report.pid,
+              (uint64_t)report.operation | ((uint64_t)report.status << 8) | ((uint64_t)success << 16), report.pipId);
 
     return success;
 }
@@ -434,7 +827,30 @@ SandboxedProcess* BuildXLSandbox::FindTrackedProcess(pid_t pid)
 {
     // NOTE: this has to be very fast when we are not tracking any processes (i.e., trackedProcesses_ is empty)
     //       because this is called on every single file access any process makes
-    return trackedProcesses_->getAs<SandboxedProcess>(pid);
+    if (trackedProcesses_->getCount() == 0)
+    {
+        return nullptr;
+    }
+
+    return pid >= 0 && pid < kPidTableSize
+        ? trackedProcessesByPid_[pid]
+        : trackedProcesses_->getTyped<SandboxedProcess>(pid);
+}
+
+void BuildXLSandbox::ClearTrackedProcessEntry(pid_t pid, SandboxedProcess *process)
+{
+    if (pid >= 0 && pid < kPidTableSize)
+    {
+        OSCompareAndSwapPtr(process, nullptr, (void * volatile *)&trackedProcessesByPid_[pid]);
+    }
+}
+
+static void SetTrackedProcessEntry(SandboxedProcess * volatile *table, pid_t pid, SandboxedProcess *process)
+{
+    if (pid >= 0 && pid < kPidTableSize)
+    {
+        table[pid] = process;
+    }
 }
 
 bool BuildXLSandbox::TrackRootProcess(SandboxedPip *pip)
@@ -473,6 +889,12 @@ bool BuildXLSandbox::TrackRootProcess(SandboxedPip *pip)
         else
         {
             bool insertedNew = result == Trie::TrieResult::kTrieResultInserted;
+            if (insertedNew)
+            {
+                SetTrackedProcessEntry(trackedProcessesByPid_, pid, process);
+                bxl_trace(kTraceEventRootProcessTracked, pid, pip->getClientPid(), pip->getPipId());
+            }
+
             log_error_or_debug(g_bxl_verbose_logging,
                                !insertedNew,
                                "Tracking root process PID(%d) for ClientId(%d), PipId: %#llX, tree size: %d, path: %s, code: %d",
@@ -496,10 +918,40 @@ static OSObject* ProcessFactory(void *data)
     return process;
 }
 
+static void LogChildAlreadyTracked(pid_t childPid, SandboxedPip *pip, SandboxedProcess *existingProcess)
+{
+    if (existingProcess->getPip() == pip)
+    {
+        LogVerbose("Child process PID(%d) already tracked by the same Root PID(%d) for ClientId(%d)",
+                   childPid, pip->getProcessId(), pip->getClientPid());
+    }
+    else if (existingProcess->getPip()->getProcessId() == childPid)
+    {
+        LogVerbose("Child process PID(%d) cannot be added to Root PID(%d) for ClientId(%d) "
+                   "because it has already been promoted to root itself",
+                   childPid, pip->getProcessId(), pip->getClientPid());
+    }
+    else
+    {
+        log_error("Child process PID(%d) already tracked by a different Root PID(%d)/ClientId(%d); "
+                  "intended new: Root PID(%d)/ClientId(%d)",
+                  childPid, existingProcess->getPip()->getProcessId(), existingProcess->getPip()->getClientPid(),
+                  pip->getProcessId(), pip->getClientPid());
+    }
+}
+
 bool BuildXLSandbox::TrackChildProcess(pid_t childPid, SandboxedProcess *parentProcess)
 {
     SandboxedPip *pip = parentProcess->getPip();
 
+    // fast path: don't bother creating a process object if 'childPid' is already tracked
+    SandboxedProcess *trackedProcess = FindTrackedProcess(childPid);
+    if (trackedProcess != nullptr)
+    {
+        LogChildAlreadyTracked(childPid, pip, trackedProcess);
+        return false;
+    }
+
     SandboxedProcess *childProcess = SandboxedProcess::create(childPid, pip);
     AutoRelease _(childProcess);
 
@@ -509,8 +961,7 @@ bool BuildXLSandbox::TrackChildProcess(pid_t childPid, SandboxedProcess *parentP
     }
 
     Trie::TrieResult getOrAddResult;
-    OSObject *newValue = trackedProcesses_->getOrAdd(childPid, childProcess, ProcessFactory, &getOrAddResult);
-    SandboxedProcess *existingProcess = OSDynamicCast(SandboxedProcess, newValue);
+    SandboxedProcess *existingProcess = trackedProcesses_->getOrAddTyped<SandboxedProcess>(childPid, childProcess, ProcessFactory, &getOrAddResult);
 
     // Operation getOrAdd failed:
     //   -> skip everything and return error (should not happen under normal circumstances)
@@ -523,24 +974,7 @@ bool BuildXLSandbox::TrackChildProcess(pid_t childPid, SandboxedProcess *parentP
     //   -> log an appropriate message and return false to indicate that no new process has been tracked
     if (getOrAddResult == Trie::TrieResult::kTrieResultAlreadyExists)
     {
-        if (existingProcess->getPip() == pip)
-        {
-            LogVerbose("Child process PID(%d) already tracked by the same Root PID(%d) for ClientId(%d)",
-                       childPid, pip->getProcessId(), pip->getClientPid());
-        }
-        else if (existingProcess->getPip()->getProcessId() == childPid)
-        {
-            LogVerbose("Child process PID(%d) cannot be added to Root PID(%d) for ClientId(%d) "
-                       "because it has already been promoted to root itself",
-                       childPid, pip->getProcessId(), pip->getClientPid());
-        }
-        else
-        {
-            log_error("Child process PID(%d) already tracked by a different Root PID(%d)/ClientId(%d); "
-                      "intended new: Root PID(%d)/ClientId(%d) (Code: %d)",
-                      childPid, existingProcess->getPip()->getProcessId(), existingProcess->getPip()->getClientPid(),
-                      pip->getProcessId(), pip->getClientPid(), getOrAddResult);
-        }
+        LogChildAlreadyTracked(childPid, pip, existingProcess);
         return false;
     }
 
@@ -549,8 +983,10 @@ bool BuildXLSandbox::TrackChildProcess(pid_t childPid, SandboxedProcess *parentP
     if (getOrAddResult == Trie::TrieResult::kTrieResultInserted)
     {
         // copy the path from the parent process (because the child process always starts out as a fork of the parent)
-        childProcess->setPath(parentProcess->getPath());
+        childProcess->setPath(parentProcess->getSharedPath());
         pip->incrementProcessTreeCount();
+        SetTrackedProcessEntry(trackedProcessesByPid_, childPid, childProcess);
+        bxl_trace(kTraceEventChildProcessTracked, childPid, pip->getProcessId(), pip->getPipId());
         LogVerbose("Track entry %d -> %d :: ClientId: %d, PipId: %#llX, New tree size: %d",
                    childPid, pip->getProcessId(), pip->getClientPid(),
                    pip->getPipId(), pip->getTreeSize());
@@ -567,7 +1003,8 @@ error:
 
 bool BuildXLSandbox::UntrackProcess(pid_t pid, SandboxedProcess *process)
 {
-    // remove the mapping for 'pid'
+    // remove the mapping for 'pid' (from the flat table first, so that it is never left pointing to a released process)
+    ClearTrackedProcessEntry(pid, process);
     auto removeResult = trackedProcesses_->remove(pid);
     bool removedExisting = removeResult == Trie::TrieResult::kTrieResultRemoved;
     if (removedExisting)
@@ -575,6 +1012,7 @@ bool BuildXLSandbox::UntrackProcess(pid_t pid, SandboxedProcess *process)
         process->getPip()->decrementProcessTreeCount();
     }
     SandboxedPip *pip = process->getPip();
+    bxl_trace(kTraceEventProcessUntracked, pid, pip->getProcessId(), pip->getPipId());
     log_error_or_debug(g_bxl_verbose_logging,
                        !removedExisting,
                        "Untrack entry %d -> %d :: ClientId: %d, PipId: %#llX, New tree size: %d, Code: %d",
@@ -590,6 +1028,170 @@ typedef struct {
 
 static int BytesInAMegabyte = 1024 * 1024;
 
+// CODESYNC: keep in sync with the fields of 'AllCounters' updated through 'BuildXLSandbox::Counters()'
+static void AddAccessCounters(AllCounters *sum, const AllCounters &slab)
+{
+    sum->findTrackedProcess.add(slab.findTrackedProcess);
+    sum->setLastLookedUpPath.add(slab.setLastLookedUpPath);
+    sum->checkPolicy.add(slab.checkPolicy);
+    sum->cacheLookup.add(slab.cacheLookup);
+    sum->getClientInfo.add(slab.getClientInfo);
+    sum->reportFileAccess.add(slab.reportFileAccess);
+    sum->accessHandler.add(slab.accessHandler);
+    sum->numHardLinkRetries.add(slab.numHardLinkRetries);
+    sum->numHardLinkCacheHits.add(slab.numHardLinkCacheHits);
+    sum->numFilteredLookups.add(slab.numFilteredLookups);
+    sum->numForks.add(slab.numForks);
+    sum->numCacheHits.add(slab.numCacheHits);
+    sum->numCacheMisses.add(slab.numCacheMisses);
+    sum->numCacheIneligiblePaths.add(slab.numCacheIneligiblePaths);
+    sum->numIgnoredOperations.add(slab.numIgnoredOperations);
+    sum->numVNodePathCacheHits.add(slab.numVNodePathCacheHits);
+    sum->numVNodePathCacheMisses.add(slab.numVNodePathCacheMisses);
+    sum->numDirCursorCacheHits.add(slab.numDirCursorCacheHits);
+    sum->numDirCursorCacheMisses.add(slab.numDirCursorCacheMisses);
+    sum->numReadlinkCacheHits.add(slab.numReadlinkCacheHits);
+    sum->numExecImageCacheHits.add(slab.numExecImageCacheHits);
+    sum->numExecImageCacheMisses.add(slab.numExecImageCacheMisses);
+    sum->numPriorityReports.add(slab.numPriorityReports);
+}
+
+void BuildXLSandbox::UpdateReportLatencies(const ReportLatencies *latencies)
+{
+    EnterMonitor
+
+    reportLatencies_ = *latencies;
+}
+
+LatencyHistograms BuildXLSandbox::IntrospectLatencies() const
+{
+    EnterMonitor
+
+    LatencyHistograms result = {0};
+    result.reportLatencies = reportLatencies_;
+    for (int i = 0; i < kCounterSlabCount; i++)
+    {
+        const LatencyHistograms &slab = counterSlabs_[i].latencies;
+        result.findTrackedProcess.add(slab.findTrackedProcess);
+        result.checkPolicy.add(slab.checkPolicy);
+        result.cacheLookup.add(slab.cacheLookup);
+        result.reportFileAccess.add(slab.reportFileAccess);
+        result.accessHandler.add(slab.accessHandler);
+    }
+
+    return result;
+}
+
+void BuildXLSandbox::IntrospectProcesses(pid_t cursor, IntrospectProcessesResponse *response) const
+{
+    EnterMonitor
+
+    response->nextCursor   = 0;
+    response->numProcesses = 0;
+    response->numPips      = 0;
+
+    for (pid_t pid = cursor > 0 ? cursor : 0; pid < kPidTableSize; pid++)
+    {
+        // the flat table only serves to skip untracked pids quickly, the trie is what keeps processes alive
+        if (trackedProcessesByPid_[pid] == nullptr)
+        {
+            continue;
+        }
+
+        SandboxedProcess *proc = trackedProcesses_->getTyped<SandboxedProcess>(pid);
+        if (proc == nullptr)
+        {
+            continue;
+        }
+
+        proc->retain();
+        AutoRelease _(proc);
+
+        bool isRoot = proc->getPip()->getProcessId() == pid;
+        if (response->numProcesses == kMaxIntrospectedProcessesPerCall ||
+            (isRoot && response->numPips == kMaxIntrospectedPipsPerCall))
+        {
+            // page full --> the client continues from here
+            response->nextCursor = pid;
+            return;
+        }
+
+        response->processes[response->numProcesses++] =
+        {
+            .pid     = pid,
+            .rootPid = proc->getPip()->getProcessId()
+        };
+
+        if (isRoot)
+        {
+            response->pips[response->numPips++] = proc->getPip()->introspect();
+        }
+    }
+}
+
+void BuildXLSandbox::ShrinkCaches()
+{
+    EnterMonitor
+
+    uint numPips = 0;
+    uint64_t numShed = 0;
+    for (pid_t pid = 0; pid < kPidTableSize; pid++)
+    {
+        // the flat table only serves to skip untracked pids quickly, the trie is what keeps processes alive
+        if (trackedProcessesByPid_[pid] == nullptr)
+        {
+            continue;
+        }
+
+        SandboxedProcess *proc = trackedProcesses_->getTyped<SandboxedProcess>(pid);
+        if (proc == nullptr || proc->getPip()->getProcessId() != pid)
+        {
+            continue;
+        }
+
+        proc->retain();
+        AutoRelease _(proc);
+
+        numShed += proc->getPip()->shrinkPathCache(kPathCacheShrinkFloor);
+        numPips++;
+    }
+
+    counters_.numCacheShrinks++;
+    counters_.numShrunkPaths += numShed;
+
+    log("Available RAM (%u MB) is below %u MB: shed %llu cached paths of %u pips",
+        counters_.resourceCounters.availableRamMB, config_.resourceThresholds.cacheShrinkRamMB, numShed, numPips);
+}
+
+void BuildXLSandbox::GetStats(bxl_stats *stats) const
+{
+    uint64_t cacheHits = 0, cacheMisses = 0;
+    if (counterSlabs_)
+    {
+        for (int i = 0; i < kCounterSlabCount; i++)
+        {
+            cacheHits   += counterSlabs_[i].counters.numCacheHits.count();
+            cacheMisses += counterSlabs_[i].counters.numCacheMisses.count();
+        }
+    }
+
+    uint numUintNodes, numPathNodes;
+    double uintTrieSizeMB, pathTrieSizeMB, pathTrieSavedMB;
+    Trie::getUintNodeCounts(&numUintNodes, &uintTrieSizeMB);
+    Trie::getPathNodeCounts(&numPathNodes, &pathTrieSizeMB, &pathTrieSavedMB);
+
+    ReportCounters reportCounters = counters_.reportCounters;
+    stats->reportsSent      = reportCounters.totalNumSent.count();
+    stats->reportsQueued    = reportCounters.numQueued.count();
+    stats->reportsSpilled   = reportCounters.numPendingSpilledReports.count();
+    stats->cacheHits        = cacheHits;
+    stats->cacheMisses      = cacheMisses;
+    stats->cacheHitRate     = cacheHits + cacheMisses > 0 ? cacheHits * 10000 / (cacheHits + cacheMisses) : 0;
+    stats->trackedProcesses = counters_.resourceCounters.numTrackedProcesses;
+    stats->blockedProcesses = counters_.resourceCounters.numBlockedProcesses;
+    stats->trieSizeKB       = (uint64_t)((uintTrieSizeMB + pathTrieSizeMB) * 1024);
+}
+
 IntrospectResponse BuildXLSandbox::Introspect() const
 {
     EnterMonitor
@@ -603,12 +1205,20 @@ IntrospectResponse BuildXLSandbox::Introspect() const
         .pips                = {0}
     };
 
+    for (int i = 0; i < kCounterSlabCount; i++)
+    {
+        AddAccessCounters(&result.counters, counterSlabs_[i].counters);
+    }
+
+    result.counters.numPendingPipTeardowns = Counter(pendingPipTeardownCount_);
+
     Trie::getUintNodeCounts(&result.counters.numUintTrieNodes, &result.counters.uintTrieSizeMB);
-    Trie::getPathNodeCounts(&result.counters.numPathTrieNodes, &result.counters.pathTrieSizeMB);
+    Trie::getPathNodeCounts(&result.counters.numPathTrieNodes, &result.counters.pathTrieSizeMB, &result.counters.pathTrieSavedMB);
 
     ReportCounters *reportCounters = &result.counters.reportCounters;
     reportCounters->freeListSizeMB =
         (sizeof(ConcurrentSharedDataQueue::ElemPayload)) * reportCounters->freeListNodeCount.count() * 1.0 / BytesInAMegabyte;
+    reportCounters->spillSizeMB = kSpillChunkSize * reportCounters->numSpillChunks.count() * 1.0 / BytesInAMegabyte;
 
     Trie *proc2children = Trie::createUintTrie();
     AutoRelease _(proc2children);
@@ -14,6 +14,7 @@
 #include "ClientInfo.hpp"
 #include "ResourceManager.hpp"
 #include "SandboxedProcess.hpp"
+#include "Thread.hpp"
 
 #if RELEASE
     #define kSharedDataQueueSizeDefault 256
@@ -23,6 +24,18 @@
 
 #define kSharedDataQueueSizeMax 2048
 
+// macOS never assigns pids greater than PID_MAX (99999, see bsd/sys/proc_internal.h), whatever 'kern.maxproc' is
+#define kPidTableSize (99999 + 1)
+
+// Number of copies of the per-access counters, see 'counterSlabs_'
+#define kCounterSlabCount 64
+
+// Maximum number of terminated pips waiting for their final release, see 'pendingPipTeardowns_'
+#define kMaxPendingPipTeardowns 64
+
+// How long no process has to be tracked before the listeners are unregistered, see 'listenersIdleThread_'
+#define kListenersIdleUnregisterMs 5000
+
 #define AddTimeStampToAccessReport(report, struct_property)\
 do { (report)->stats.struct_property = mach_absolute_time(); }while(0);
 
@@ -39,8 +52,59 @@ private:
     struct mac_policy_ops buildxlPolicyOps_;
     struct mac_policy_conf policyConfiguration_;
 
+    /*!
+     * The kauth listeners and the TrustedBSD policy are only registered while processes are tracked, so that the
+     * processes of the machine do not pay for the callbacks when no pip runs (between builds, or while a client is
+     * attached but idle).  They are registered (synchronously) when the first process is tracked, and unregistered
+     * by 'listenersIdleThread_' once no process has been tracked for kListenersIdleUnregisterMs, so that pips
+     * running one after the other do not register and unregister them each time.
+     *
+     * 'listenersLock_' guards 'listenersRegistered_' and serializes registering with unregistering; it is never taken
+     * by the callbacks, which unregistering waits for.  'listenersIdleLock_' only guards the wakeups of the thread.
+     */
+    IOLock *listenersLock_;
+    bool listenersRegistered_;
+    IOLock *listenersIdleLock_;
+    uint listenersIdleRequests_;
+    bool listenersIdleThreadDone_;
+    Thread *listenersIdleThread_;
+
+    /*! Number of kauth callbacks running, see 'UninitializeListeners' */
+    volatile SInt32 inFlightKauthCallbacks_;
+
+    /*! Registers the listeners unless they are registered already */
+    void EnsureListenersRegistered();
+
+    /*! Wakes up 'listenersIdleThread_' to unregister the listeners if no process is tracked for a while */
+    void RequestIdleListenersUnregistration();
+
+    /*! Body of 'listenersIdleThread_' */
+    void UnregisterIdleListeners();
+
+    /*! Stops 'listenersIdleThread_' */
+    void StopListenersIdleThread();
+
     AllCounters counters_;
 
+    /*!
+     * Copies of the counters updated on every file access (durations and hit/miss counts), so that threads
+     * updating them do not all contend for the same cache lines.  A thread always updates the slab its id maps
+     * to; the slabs are only summed up (into a copy of 'counters_') by 'Introspect'.
+     *
+     * Resource and report counters are not updated per access and are kept in 'counters_' only.
+     */
+    typedef struct {
+        AllCounters counters;
+        LatencyHistograms latencies;
+    } __attribute__((aligned(64))) CounterSlab;
+
+    CounterSlab *counterSlabs_;
+
+    /*! The report latencies last sent by a client, only kept for introspection */
+    ReportLatencies reportLatencies_;
+
+    CounterSlab* CurrentCounterSlab() { return &counterSlabs_[thread_tid(current_thread()) % kCounterSlabCount]; }
+
     /*!
      * A dictionary (PID -> ClientInfo*) keeping track of connected clients.
      * The key in the dictionary is the process id of the connected client.
@@ -82,6 +146,38 @@ private:
      */
     Trie *trackedProcesses_;
 
+    /*!
+     * A flat mirror of 'trackedProcesses_' indexed by pid, so that 'FindTrackedProcess' costs a single load
+     * (of the size of 'trackedProcesses_') for untracked processes when no process is tracked, and just one
+     * more load (plus a compare) otherwise.
+     *
+     * Entries don't hold references: an entry is set after its process is added to 'trackedProcesses_' and
+     * cleared (with a compare-and-swap) before the process is removed from it.
+     */
+    SandboxedProcess * volatile *trackedProcessesByPid_;
+
+    /*! Clears the entry of 'pid' in 'trackedProcessesByPid_' if it still points to 'process' */
+    void ClearTrackedProcessEntry(pid_t pid, SandboxedProcess *process);
+
+    /*!
+     * References to terminated pips, released by 'pipTeardownThread_' so that freeing a pip (its path cache in
+     * particular) does not hold up the client that reported the pip terminated.
+     *
+     * A ring of 'pendingPipTeardownCount_' entries starting at 'pendingPipTeardownHead_', guarded by 'pipTeardownLock_'.
+     */
+    SandboxedPip *pendingPipTeardowns_[kMaxPendingPipTeardowns];
+    uint pendingPipTeardownHead_;
+    uint pendingPipTeardownCount_;
+    IOLock *pipTeardownLock_;
+    Thread *pipTeardownThread_;
+    bool pipTeardownDone_;
+
+    /*! Body of 'pipTeardownThread_': releases pending pips until 'pipTeardownDone_' is set */
+    void DrainPipTeardowns();
+
+    /*! Stops 'pipTeardownThread_' and releases the pips it left behind */
+    void StopPipTeardownThread();
+
     ClientInfo* GetClientInfo(pid_t clientPid);
 
     void InitializePolicyStructures();
@@ -100,38 +196,63 @@ public:
     void stop(IOService *provider) override;
 
     void Configure(const KextConfig *config);
+    const KextConfig& GetConfig() const { return config_; }
     UInt32 GetReportQueueEntryCount();
 
     IOReturn AllocateNewClient(pid_t clientPid);
     IOReturn DeallocateClient(pid_t clientPid);
 
+    /*!
+     * Registers the kauth listeners and the TrustedBSD policy, or nothing if any of them fails.
+     * The caller holds 'listenersLock_' (unless the sandbox is being freed).
+     */
     IOReturn InitializeListeners();
+
+    /*!
+     * Unregisters the listeners, and waits for the callbacks in flight to return.
+     * The caller holds 'listenersLock_' (unless the sandbox is being freed) and must not be in a callback.
+     */
     void UninitializeListeners();
 
-    AllCounters* Counters()           { return &counters_; }
+    /*! Bracket every kauth callback, so that 'UninitializeListeners' can wait for the ones in flight */
+    void EnterKauthCallback() { OSIncrementAtomic(&inFlightKauthCallbacks_); }
+    void ExitKauthCallback()  { OSDecrementAtomic(&inFlightKauthCallbacks_); }
+
+    /*! The counters of the slab of the current thread, see 'counterSlabs_'. */
+    AllCounters* Counters()           { return &CurrentCounterSlab()->counters; }
+
+    /*! The latency histograms of the slab of the current thread, see 'counterSlabs_'. */
+    LatencyHistograms* Latencies()    { return &CurrentCounterSlab()->latencies; }
     ResourceManager* ResourceManger() { return resourceManager_; }
 
+    /*! The report counters of all clients (not sharded, see 'counterSlabs_'). */
+    ReportCounters* GetReportCounters() { return &counters_.reportCounters; }
+
     inline void ResetCounters()
     {
         counters_ = {0};
+        reportLatencies_ = {0};
+        if (counterSlabs_) bzero(counterSlabs_, kCounterSlabCount * sizeof(CounterSlab));
     }
 
     /*!
-     * Sets the notification port for the shared data queue for the client process 'pid'.
+     * Sets the notification port for the 'queueIndex'-th shared data queue for the client process 'pid'.
      */
-    IOReturn SetReportQueueNotificationPort(mach_port_t port, pid_t pid);
+    IOReturn SetReportQueueNotificationPort(mach_port_t port, pid_t pid, uint queueIndex);
 
     /*!
-     * Returns a newly allocated memory descriptor of the shared data queue for the client process 'pid'.
+     * Returns a newly allocated memory descriptor of the 'queueIndex'-th shared data queue for the client process 'pid'.
      *
      * NOTE: the caller is responsible for releasing the returned object.
      */
-    IOMemoryDescriptor* const GetReportQueueMemoryDescriptor(pid_t pid);
+    IOMemoryDescriptor* const GetReportQueueMemoryDescriptor(pid_t pid, uint queueIndex);
 
     /*!
-     * Send the access report to only one queue using the round robin strategy
+     * Sends the access report to the queue of the client that is assigned to the report's pip.
+     * The report is only stamped with its enqueue time (and the sending timed) if 'timingWeight' is not 0,
+     * i.e., if the event it reports is timed (see 'Stopwatch::SampleEvent').
      */
-    bool const SendAccessReport(AccessReport &report, SandboxedPip *pip, const CacheRecord *cacheRecord);
+    bool const SendAccessReport(AccessReport &report, SandboxedPip *pip, const CacheRecord *cacheRecord, uint32_t timingWeight);
 
 #pragma mark Client Failure Notification Mapping
 
@@ -175,6 +296,12 @@ public:
      */
     bool UntrackProcess(pid_t pid, SandboxedProcess *process);
 
+    /*!
+     * Takes over a reference to 'pip' and releases it on the pip teardown thread, so that the caller does not pay for
+     * freeing the pip if that is its last reference.  Releases it right away when too many pips are already pending.
+     */
+    void ReleasePipDeferred(SandboxedPip *pip);
+
     /*!
      * Returns a SandboxedProcess pointer corresponding to 'pid' if such process is being tracked.
      */
@@ -184,6 +311,33 @@ public:
      * Introspect the current state of the sandbox.
      */
     IntrospectResponse Introspect() const;
+
+    /*!
+     * Reads the aggregate counters published through sysctl (see 'bxl_stats').  Unlike 'Introspect', takes no lock and
+     * visits no pip, so that it can be scraped every few seconds.
+     */
+    void GetStats(bxl_stats *stats) const;
+
+    /*!
+     * Sums up the latency histograms of all threads.
+     */
+    LatencyHistograms IntrospectLatencies() const;
+
+    /*!
+     * Fills 'response' with the next page of tracked processes starting at pid 'cursor'.
+     */
+    void IntrospectProcesses(pid_t cursor, IntrospectProcessesResponse *response) const;
+
+    /*!
+     * Sheds the cold entries of the path caches of all tracked pips (see 'SandboxedPip::shrinkPathCache'), because
+     * available RAM is low.  Called on every resource usage update while it stays low.
+     */
+    void ShrinkCaches();
+
+    /*!
+     * Remembers the report latencies measured by a client, so that 'IntrospectLatencies' can return them.
+     */
+    void UpdateReportLatencies(const ReportLatencies *latencies);
 };
 
 #endif /* BuildXLSandbox_hpp */
@@ -5,6 +5,7 @@
 
 #include "AccessHandler.hpp"
 #include "Buffer.hpp"
+#include "EventTrace.hpp"
 #include "TrustedBsdHandler.hpp"
 #include "BuildXLSandboxClient.hpp"
 #include "SandboxedPip.hpp"
@@ -86,12 +87,12 @@ IOReturn BuildXLSandboxClient::registerNotificationPort(mach_port_t port, UInt32
     }
 
     // Extend this to add additional shared data queues later, e.g. logging
-    switch(type)
+    switch(GetReportQueueType(type))
     {
         case FileAccessReporting:
         {
             pid_t pid = proc_selfpid();
-            IOReturn result = sandbox_->SetReportQueueNotificationPort(port, pid);
+            IOReturn result = sandbox_->SetReportQueueNotificationPort(port, pid, GetReportQueueIndex(type));
             if (result != kIOReturnSuccess)
             {
                 log_error("%s", "Failed setting the notifacation port!");
@@ -111,7 +112,7 @@ IOReturn BuildXLSandboxClient::registerNotificationPort(mach_port_t port, UInt32
 // Called in response to IOConnectMapMemory from user space
 IOReturn BuildXLSandboxClient::clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory)
 {
-    switch (type)
+    switch (GetReportQueueType(type))
     {
         case FileAccessReporting:
         {
@@ -121,7 +122,7 @@ IOReturn BuildXLSandboxClient::clientMemoryForType(UInt32 type, IOOptionBits *op
             //       here we are assigning that value to '*memory' which is as an "out argument",
             //       so the caller is responsible for releasing it.  Concretely, the caller is
             //       the super class IOUserClient, which indeed releases this object appropriately.
-            *memory = sandbox_->GetReportQueueMemoryDescriptor(pid);
+            *memory = sandbox_->GetReportQueueMemoryDescriptor(pid, GetReportQueueIndex(type));
             if (*memory == nullptr)
             {
                 log_error("%s", "Descriptor creation failed!");
@@ -188,6 +189,46 @@ IOExternalMethodDispatch BuildXLSandboxClient::ipcMethods[kSandboxMethodCount] =
         .checkScalarOutputCount   = 0,
         .checkStructureOutputSize = sizeof(IntrospectResponse)
     },
+    // kIpcActionIntrospectLatencies
+    {
+        .function                 = (IOExternalMethodAction) &BuildXLSandboxClient::sIntrospectLatenciesHandler,
+        .checkScalarInputCount    = 0,
+        .checkStructureInputSize  = sizeof(IntrospectRequest),
+        .checkScalarOutputCount   = 0,
+        .checkStructureOutputSize = sizeof(LatencyHistograms)
+    },
+    // kIpcActionIntrospectProcesses
+    {
+        .function                 = (IOExternalMethodAction) &BuildXLSandboxClient::sIntrospectProcessesHandler,
+        .checkScalarInputCount    = 0,
+        .checkStructureInputSize  = sizeof(IntrospectProcessesRequest),
+        .checkScalarOutputCount   = 0,
+        .checkStructureOutputSize = sizeof(IntrospectProcessesResponse)
+    },
+    // kIpcActionUpdateReportLatencies
+    {
+        .function                 = (IOExternalMethodAction) &BuildXLSandboxClient::sUpdateReportLatencies,
+        .checkScalarInputCount    = 0,
+        .checkStructureInputSize  = sizeof(ReportLatencies),
+        .checkScalarOutputCount   = 0,
+        .checkStructureOutputSize = 0
+    },
+    // kIpcActionDumpEventTrace
+    {
+        .function                 = (IOExternalMethodAction) &BuildXLSandboxClient::sDumpEventTraceHandler,
+        .checkScalarInputCount    = 0,
+        .checkStructureInputSize  = sizeof(EventTraceDumpRequest),
+        .checkScalarOutputCount   = 0,
+        .checkStructureOutputSize = sizeof(EventTraceDumpResponse)
+    },
+    // kIpcActionPipsStarted
+    {
+        .function                 = (IOExternalMethodAction) &BuildXLSandboxClient::sPipsStarted,
+        .checkScalarInputCount    = 0,
+        .checkStructureInputSize  = kIOUCVariableStructureSize,
+        .checkScalarOutputCount   = 0,
+        .checkStructureOutputSize = kIOUCVariableStructureSize
+    },
 };
 
 IOReturn BuildXLSandboxClient::externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
@@ -229,8 +270,23 @@ IOReturn BuildXLSandboxClient::sConfigure(BuildXLSandboxClient *target, void *re
 
 IOReturn BuildXLSandboxClient::sUpdateResourceUsage(BuildXLSandboxClient *target, void *reference, IOExternalMethodArguments *arguments)
 {
-    target->sandbox_->ResourceManger()->UpdateCpuUsage({ .value = (uint)arguments->scalarInput[0] });
+    if (target->sandbox_->ResourceManger()->GetThresholds().cpuSampleIntervalMs == 0)
+    {
+        // CPU usage is only taken from the client when the kext doesn't sample it itself
+        target->sandbox_->ResourceManger()->UpdateCpuUsage({ .value = (uint)arguments->scalarInput[0] });
+    }
     target->sandbox_->ResourceManger()->UpdateAvailableRam((uint)arguments->scalarInput[1]);
+    if (target->sandbox_->ResourceManger()->ShouldShrinkCaches())
+    {
+        target->sandbox_->ShrinkCaches();
+    }
+
+    return kIOReturnSuccess;
+}
+
+IOReturn BuildXLSandboxClient::sUpdateReportLatencies(BuildXLSandboxClient *target, void *reference, IOExternalMethodArguments *arguments)
+{
+    target->sandbox_->UpdateReportLatencies((const ReportLatencies*)arguments->structureInput);
     return kIOReturnSuccess;
 }
 
@@ -257,6 +313,73 @@ IOReturn BuildXLSandboxClient::sIntrospectHandler(BuildXLSandboxClient *target,
     return bytesWritten == sizeof(result) ? kIOReturnSuccess : kIOReturnError;
 }
 
+IOReturn BuildXLSandboxClient::sIntrospectLatenciesHandler(BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args)
+{
+    // unlike 'IntrospectResponse', the histograms are small enough to be passed in the inline output buffer
+    LatencyHistograms *result = (LatencyHistograms*)args->structureOutput;
+    *result = target->sandbox_->IntrospectLatencies();
+    return kIOReturnSuccess;
+}
+
+IOReturn BuildXLSandboxClient::sIntrospectProcessesHandler(BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args)
+{
+    IntrospectProcessesRequest *request = (IntrospectProcessesRequest*)args->structureInput;
+    IOMemoryDescriptor *outMemDesc = args->structureOutputDescriptor;
+
+    IntrospectProcessesResponse *result = IONew(IntrospectProcessesResponse, 1);
+    if (result == nullptr)
+    {
+        return kIOReturnNoMemory;
+    }
+
+    IOReturn prepared = outMemDesc->prepare();
+    if (prepared != kIOReturnSuccess)
+    {
+        IODelete(result, IntrospectProcessesResponse, 1);
+        return kIOReturnNoMemory;
+    }
+
+    target->sandbox_->IntrospectProcesses(request->cursor, result);
+    IOByteCount bytesWritten = outMemDesc->writeBytes(0, result, sizeof(*result));
+
+    outMemDesc->complete();
+    IODelete(result, IntrospectProcessesResponse, 1);
+
+    return bytesWritten == sizeof(*result) ? kIOReturnSuccess : kIOReturnError;
+}
+
+IOReturn BuildXLSandboxClient::sDumpEventTraceHandler(BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args)
+{
+    EventTraceDumpRequest *request = (EventTraceDumpRequest*)args->structureInput;
+    IOMemoryDescriptor *outMemDesc = args->structureOutputDescriptor;
+
+    EventTraceDumpResponse *result = IONew(EventTraceDumpResponse, 1);
+    if (result == nullptr)
+    {
+        return kIOReturnNoMemory;
+    }
+
+    if (!EventTrace::Dump(request->ring, result))
+    {
+        IODelete(result, EventTraceDumpResponse, 1);
+        return kIOReturnBadArgument;
+    }
+
+    IOReturn prepared = outMemDesc->prepare();
+    if (prepared != kIOReturnSuccess)
+    {
+        IODelete(result, EventTraceDumpResponse, 1);
+        return kIOReturnNoMemory;
+    }
+
+    IOByteCount bytesWritten = outMemDesc->writeBytes(0, result, sizeof(*result));
+
+    outMemDesc->complete();
+    IODelete(result, EventTraceDumpResponse, 1);
+
+    return bytesWritten == sizeof(*result) ? kIOReturnSuccess : kIOReturnError;
+}
+
 IOReturn BuildXLSandboxClient::sPipStateChanged(BuildXLSandboxClient *target, void *reference, IOExternalMethodArguments *arguments)
 {
     return target->PipStateChanged((PipStateChangedRequest *)arguments->structureInput);
@@ -295,18 +418,16 @@ IOReturn BuildXLSandboxClient::PipStateChanged(PipStateChangedRequest *data)
     return error;
 }
 
-IOReturn BuildXLSandboxClient::ProcessPipStarted(PipStateChangedRequest *data)
+Buffer* BuildXLSandboxClient::CopyPipPayload(mach_vm_address_t clientAddr, mach_vm_size_t size, IOReturn *error)
 {
-    mach_vm_address_t clientAddr = data->payload;
-    mach_vm_size_t size = data->payloadLength;
-
     // Allocate buffer for storing the pip payload
     Buffer *ioBuffer = Buffer::create(size);
     AutoRelease _b(ioBuffer);
     if (ioBuffer == nullptr)
     {
         log_error("%s", "Failed to allocate IOBuffer for storing the pip payload");
-        return kIOReturnNoMemory;
+        *error = kIOReturnNoMemory;
+        return nullptr;
     }
 
     // Create memory descriptor
@@ -315,7 +436,8 @@ IOReturn BuildXLSandboxClient::ProcessPipStarted(PipStateChangedRequest *data)
     if (!memDesc)
     {
         log_error("%s", "IOMemoryDescriptor::withAddressRange failed");
-        return kIOReturnVMError;
+        *error = kIOReturnVMError;
+        return nullptr;
     }
 
     // Prepare the descriptor for reading. Must call complete() if prepare() succeeds (we do it right after readBytes).
@@ -323,7 +445,8 @@ IOReturn BuildXLSandboxClient::ProcessPipStarted(PipStateChangedRequest *data)
     if (status != kIOReturnSuccess)
     {
         log_error("IOMemoryDescriptor::prepare failed, returning %#x", status);
-        return status;
+        *error = status;
+        return nullptr;
     }
 
     // Copy the bytes over
@@ -332,18 +455,204 @@ IOReturn BuildXLSandboxClient::ProcessPipStarted(PipStateChangedRequest *data)
     if (bytesRead != size)
     {
         log_error("Couldn't read %lld bytes from memory descriptor; bytes read: %lld", size, bytesRead);
-        return kIOReturnVMError;
+        *error = kIOReturnVMError;
+        return nullptr;
     }
 
-    // Create a SandboxedPip
-    SandboxedPip *pip = SandboxedPip::create(data->clientPid, data->processId, ioBuffer);
+    ioBuffer->retain();
+    return ioBuffer;
+}
+
+Buffer* BuildXLSandboxClient::MapPipPayload(mach_vm_address_t clientAddr, mach_vm_size_t size)
+{
+    IOMemoryDescriptor *memDesc = IOMemoryDescriptor::withAddressRange(clientAddr, size, kIODirectionOut, task_);
+    AutoRelease _m(memDesc);
+    if (!memDesc)
+    {
+        log_error("%s", "IOMemoryDescriptor::withAddressRange failed");
+        return nullptr;
+    }
+
+    // the buffer keeps the descriptor prepared (and its pages wired) for as long as it lives
+    return Buffer::createMapped(memDesc, size);
+}
+
+IOReturn BuildXLSandboxClient::sPipsStarted(BuildXLSandboxClient *target, void *reference, IOExternalMethodArguments *arguments)
+{
+    uint32_t inputSize = arguments->structureInputSize;
+    if (inputSize == 0 || inputSize % sizeof(PipStateChangedRequest) != 0)
+    {
+        return kIOReturnBadArgument;
+    }
+
+    uint count = inputSize / sizeof(PipStateChangedRequest);
+    if (count > kMaxPipStartBatchSize || arguments->structureOutputSize != count * sizeof(IOReturn))
+    {
+        return kIOReturnBadArgument;
+    }
+
+    return target->ProcessPipsStarted((PipStateChangedRequest *)arguments->structureInput, count, (IOReturn *)arguments->structureOutput);
+}
+
+// Fewer pips than this are created on the client's thread alone
+#define kMinPipsForParallelCreation 4
+
+// Most threads (besides the client's) creating the pips of a batch
+#define kMaxPipCreationWorkers 3
+
+typedef struct {
+    BuildXLSandboxClient *client;
+    PipStateChangedRequest *requests;
+    SandboxedPip **pips;
+    IOReturn *results;
+    uint count;
+    volatile SInt32 next;
+} PipCreationBatch;
+
+void BuildXLSandboxClient::CreatePipsOfBatch(void *args)
+{
+    PipCreationBatch *batch = (PipCreationBatch *)args;
+    for (;;)
+    {
+        SInt32 i = OSIncrementAtomic(&batch->next);
+        if (i >= (SInt32)batch->count)
+        {
+            return;
+        }
+
+        if (batch->requests[i].action != kBuildXLSandboxActionSendPipStarted)
+        {
+            batch->results[i] = kIOReturnBadArgument;
+            continue;
+        }
+
+        batch->results[i] = kIOReturnSuccess;
+        batch->pips[i] = batch->client->CreatePip(&batch->requests[i], &batch->results[i]);
+    }
+}
+
+IOReturn BuildXLSandboxClient::ProcessPipsStarted(PipStateChangedRequest *requests, uint count, IOReturn *results)
+{
+    SandboxedPip **pips = IONew(SandboxedPip*, count);
+    if (pips == nullptr)
+    {
+        return kIOReturnNoMemory;
+    }
+
+    bzero(pips, count * sizeof(SandboxedPip*));
+
+    PipCreationBatch batch =
+    {
+        .client   = this,
+        .requests = requests,
+        .pips     = pips,
+        .results  = results,
+        .count    = count,
+        .next     = 0,
+    };
+
+    // Reading and parsing the payloads is most of the work of starting a pip, and needs no lock
+    Thread *workers[kMaxPipCreationWorkers] = { nullptr };
+    uint numWorkers = count < kMinPipsForParallelCreation ? 0 : min(count - 1, (uint)kMaxPipCreationWorkers);
+    for (uint w = 0; w < numWorkers; w++)
+    {
+        workers[w] = Thread::create(&batch, [](void *args, wait_result_t result)
+                                    {
+                                        CreatePipsOfBatch(args);
+                                    });
+        if (workers[w] != nullptr)
+        {
+            workers[w]->start();
+        }
+    }
+
+    CreatePipsOfBatch(&batch);
+
+    for (uint w = 0; w < numWorkers; w++)
+    {
+        if (workers[w] != nullptr)
+        {
+            workers[w]->join();
+            OSSafeReleaseNULL(workers[w]);
+        }
+    }
+
+    // Only now do the pips become visible, in the order they were requested
+    for (uint i = 0; i < count; i++)
+    {
+        if (pips[i] != nullptr)
+        {
+            results[i] = TrackPip(pips[i]);
+            pips[i]->release();
+        }
+    }
+
+    IODelete(pips, SandboxedPip*, count);
+
+    LogVerbose("Started a batch of %d pips", count);
+    return kIOReturnSuccess;
+}
+
+IOReturn BuildXLSandboxClient::ProcessPipStarted(PipStateChangedRequest *data)
+{
+    IOReturn status = kIOReturnSuccess;
+    SandboxedPip *pip = CreatePip(data, &status);
     AutoRelease _p(pip);
     if (pip == nullptr)
+    {
+        return status;
+    }
+
+    return TrackPip(pip);
+}
+
+SandboxedPip* BuildXLSandboxClient::CreatePip(PipStateChangedRequest *data, IOReturn *error)
+{
+    mach_vm_address_t clientAddr = data->payload;
+    mach_vm_size_t size = data->payloadLength;
+
+    Buffer *ioBuffer = nullptr;
+    if (sandbox_->GetConfig().mapPipPayloads)
+    {
+        ioBuffer = MapPipPayload(clientAddr, size);
+        if (ioBuffer == nullptr)
+        {
+            log_error("%s", "Failed to map the pip payload, copying it instead");
+        }
+    }
+
+    IOReturn status = kIOReturnSuccess;
+    if (ioBuffer == nullptr)
+    {
+        ioBuffer = CopyPipPayload(clientAddr, size, &status);
+    }
+
+    AutoRelease _b(ioBuffer);
+    if (ioBuffer == nullptr)
+    {
+        *error = status;
+        return nullptr;
+    }
+
+    // Create a SandboxedPip
+    SandboxedPip *pip = SandboxedPip::create(data->clientPid, data->processId, ioBuffer, sandbox_->GetConfig().pathCacheBudget);
+    if (pip == nullptr)
     {
         log_error("%s", "Could not create SandboxedPip (either FAM is invalid or we're out of memory)");
-        return kIOReturnInvalid;
+        *error = kIOReturnInvalid;
+        return nullptr;
     }
 
+    pip->setClientInfo(sandbox_->GetClientInfo(pip->getClientPid()));
+
+    // preallocate the process objects of the first forks so they don't have to be allocated inside the fork hook
+    SandboxedProcess::refillSpares(pip);
+
+    return pip;
+}
+
+IOReturn BuildXLSandboxClient::TrackPip(SandboxedPip *pip)
+{
     bool success = sandbox_->TrackRootProcess(pip);
 
     log_error_or_debug(g_bxl_verbose_logging, !success,
@@ -358,18 +667,29 @@ IOReturn BuildXLSandboxClient::ProcessPipTerminated(PipStateChangedRequest *data
     pid_t pid = data->processId;
     pipid_t pipId = data->pipId;
     LogVerbose("Pip with PipId = %#llX, PID = %d terminated", pipId, pid);
-    TrustedBsdHandler handler = TrustedBsdHandler(sandbox_);
-    if (handler.TryInitializeWithTrackedProcess(pid) && handler.GetPipId() == pipId)
+    bxl_trace(kTraceEventPipTerminated, pid, data->clientPid, pipId);
+
+    // Untracking the process may drop the last references to the pip, which would then be freed (with its whole path
+    // cache) before this call returns.  Holding on to the pip until the handler is gone, and leaving the final release
+    // to the teardown thread, keeps that off the client's thread.
+    SandboxedPip *pip = nullptr;
     {
+        TrustedBsdHandler handler = TrustedBsdHandler(sandbox_);
+        if (handler.TryInitializeWithTrackedProcess(pid) && handler.GetPipId() == pipId)
+        {
 #if DEBUG
-        char name[kProcessNameBufferSize];
-        proc_name(data->processId, name, sizeof(name));
-        log_debug("Killing process %s(%d)", name, pid);
+            char name[kProcessNameBufferSize];
+            proc_name(data->processId, name, sizeof(name));
+            log_debug("Killing process %s(%d)", name, pid);
 #endif
-        handler.HandleProcessUntracked(pid);
-        proc_signal(pid, SIGTERM);
+            pip = handler.GetPip();
+            pip->retain();
+            handler.HandleProcessUntracked(pid);
+            proc_signal(pid, SIGTERM);
+        }
     }
 
+    sandbox_->ReleasePipDeferred(pip);
     return kIOReturnSuccess;
 }
 
@@ -61,9 +61,35 @@ protected:
     static IOReturn sUpdateResourceUsage          (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
     static IOReturn sSetFailureNotificationHandler(BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
     static IOReturn sIntrospectHandler            (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
+    static IOReturn sIntrospectLatenciesHandler   (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
+    static IOReturn sIntrospectProcessesHandler   (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
+    static IOReturn sUpdateReportLatencies        (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
+    static IOReturn sDumpEventTraceHandler        (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
+    static IOReturn sPipsStarted                  (BuildXLSandboxClient *target, void *ref, IOExternalMethodArguments *args);
 
     IOReturn PipStateChanged(PipStateChangedRequest *data);
     IOReturn ProcessPipStarted(PipStateChangedRequest *data);
+
+    /*!
+     * Starts 'count' pips, writing the result of starting each into 'results'.  The payloads of the pips are read and
+     * parsed in parallel (see 'CreatePip'), and each pip is only tracked once all are parsed.
+     */
+    IOReturn ProcessPipsStarted(PipStateChangedRequest *requests, uint count, IOReturn *results);
+
+    /*! Reads the payload of a started pip and creates its 'SandboxedPip' (which the caller releases), or returns NULL with 'error' set */
+    SandboxedPip* CreatePip(PipStateChangedRequest *data, IOReturn *error);
+
+    /*! Makes the root process of a pip created by 'CreatePip' tracked */
+    IOReturn TrackPip(SandboxedPip *pip);
+
+    /*! Creates pips of a batch of 'ProcessPipsStarted' until there are none left; run by the client's thread and by each worker */
+    static void CreatePipsOfBatch(void *batch);
+
+    /*! Returns a buffer with a copy of the pip payload at 'clientAddr', or NULL (with 'error' set) if it can't be read */
+    Buffer* CopyPipPayload(mach_vm_address_t clientAddr, mach_vm_size_t size, IOReturn *error);
+
+    /*! Returns a buffer mapping the pip payload at 'clientAddr' read-only, or NULL if it can't be mapped */
+    Buffer* MapPipPayload(mach_vm_address_t clientAddr, mach_vm_size_t size);
     IOReturn ProcessPipTerminated(PipStateChangedRequest *data);
     IOReturn ProcessClientLaunched(PipStateChangedRequest *data);
     IOReturn SetFailureNotificationHandler(OSAsyncReference64 ref);
@@ -48,15 +48,25 @@ typedef enum {
     kIpcActionUpdateResourceUsage,
     kIpcActionSetupFailureNotificationHandler,
     kIpcActionIntrospect,
+    kIpcActionIntrospectLatencies,
+    kIpcActionIntrospectProcesses,
+    kIpcActionUpdateReportLatencies,
+    kIpcActionDumpEventTrace,
+    kIpcActionPipsStarted,
     kSandboxMethodCount
 } IpcAction;
 
+/*!
+ * A duration, along with its weight: when only some events are timed (see 'KextConfig::timingSampleRate'), the number
+ * of events the duration of a timed one stands for.  Durations that were not measured at all have a weight of 0.
+ */
 class Timespan
 {
 private:
     const uint64_t nanos_;
+    const uint32_t weight_;
 
-    Timespan(uint64_t nanoseconds) : nanos_(nanoseconds) {}
+    Timespan(uint64_t nanoseconds, uint32_t weight) : nanos_(nanoseconds), weight_(weight) {}
 
 public:
 
@@ -64,8 +74,12 @@ public:
     uint64_t micros() { return nanos() / 1000; }
     uint64_t millis() { return micros() / 1000; }
 
-    static Timespan fromNanoseconds(uint64_t nanoseconds)   { return Timespan(nanoseconds); }
-    static Timespan fromMicroseconds(uint64_t microseconds) { return Timespan(microseconds * 1000); }
+    uint32_t weight()     { return weight_; }
+    bool     isMeasured() { return weight_ > 0; }
+
+    static Timespan fromNanoseconds(uint64_t nanoseconds, uint32_t weight = 1) { return Timespan(nanoseconds, weight); }
+    static Timespan fromMicroseconds(uint64_t microseconds)                     { return Timespan(microseconds * 1000, 1); }
+    static Timespan unmeasured()                                                { return Timespan(0, 0); }
 };
 
 typedef struct Counter {
@@ -100,6 +114,12 @@ public:
         --count_;
 #endif
     }
+
+    /*! Not atomic: only meant for summing up counters into a private copy. */
+    void add(Counter other)
+    {
+        count_ += other.count_;
+    }
 } Counter;
 
 typedef struct DurationCounter {
@@ -109,9 +129,17 @@ typedef struct DurationCounter {
     uint32_t count()    { return count_; }
     Timespan duration() { return Timespan::fromMicroseconds(durationUs_); }
 
+    /*! Counts every event, timed or not, and scales the duration of a timed one by its weight. */
     void operator+= (Timespan timespan)
     {
-        AddMicroseconds(timespan.micros());
+        AddMicroseconds(timespan.micros() * timespan.weight());
+    }
+
+    /*! Not atomic: only meant for summing up counters into a private copy. */
+    void add(const DurationCounter &other)
+    {
+        count_      += other.count_;
+        durationUs_ += other.durationUs_;
     }
 
 private:
@@ -131,6 +159,80 @@ private:
     }
 } DurationCounter;
 
+#define kLatencyHistogramBucketCount 32
+
+/*!
+ * Durations bucketed by their order of magnitude: bucket 0 counts durations under 1us, and bucket i > 0 counts
+ * durations in [2^(i-1), 2^i) us (the last bucket also counts all longer durations).
+ */
+typedef struct LatencyHistogram {
+    uint32_t buckets_[kLatencyHistogramBucketCount];
+    uint32_t maxUs_;
+
+    uint32_t maxUs() const { return maxUs_; }
+
+    uint32_t count() const
+    {
+        uint32_t count = 0;
+        for (int i = 0; i < kLatencyHistogramBucketCount; i++) count += buckets_[i];
+        return count;
+    }
+
+    /*!
+     * Returns an upper bound for the duration (in microseconds) that 'percent'% of the recorded durations do not exceed.
+     */
+    uint32_t percentileUs(double percent) const
+    {
+        uint32_t total = count();
+        if (total == 0) return 0;
+
+        uint32_t rank = (uint32_t)(total * percent / 100.0);
+        uint32_t seen = 0;
+        for (int i = 0; i < kLatencyHistogramBucketCount; i++)
+        {
+            seen += buckets_[i];
+            if (seen > rank)
+            {
+                uint32_t bucketUpperBound = i == 0 ? 1 : (1u << i);
+                return bucketUpperBound < maxUs_ ? bucketUpperBound : maxUs_;
+            }
+        }
+
+        return maxUs_;
+    }
+
+    /*! Only records measured durations, once each: the distribution of the timed events stands for all of them. */
+    void operator+= (Timespan timespan)
+    {
+        if (!timespan.isMeasured()) return;
+
+        uint64_t durationUs = timespan.micros();
+        uint32_t us = durationUs > UINT32_MAX ? UINT32_MAX : (uint32_t)durationUs;
+        int bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+        if (bucket >= kLatencyHistogramBucketCount) bucket = kLatencyHistogramBucketCount - 1;
+#if MAC_OS_SANDBOX
+        if (g_bxl_enable_counters)
+        {
+            OSIncrementAtomic(&buckets_[bucket]);
+            uint32_t max;
+            while (us > (max = maxUs_) && !OSCompareAndSwap(max, us, &maxUs_));
+        }
+#else
+        // the interop library records reports from several listener threads
+        __atomic_fetch_add(&buckets_[bucket], 1, __ATOMIC_RELAXED);
+        uint32_t max = __atomic_load_n(&maxUs_, __ATOMIC_RELAXED);
+        while (us > max && !__atomic_compare_exchange_n(&maxUs_, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#endif
+    }
+
+    /*! Not atomic: only meant for summing up histograms into a private copy. */
+    void add(const LatencyHistogram &other)
+    {
+        for (int i = 0; i < kLatencyHistogramBucketCount; i++) buckets_[i] += other.buckets_[i];
+        if (other.maxUs_ > maxUs_) maxUs_ = other.maxUs_;
+    }
+} LatencyHistogram;
+
 typedef struct {
     pipid_t pipId;
     pid_t processId;
@@ -140,11 +242,19 @@ typedef struct {
     SandboxAction action;
 } PipStateChangedRequest;
 
+/*!
+ * Most pips 'kIpcActionPipsStarted' takes at once: its input is an array of up to this many 'PipStateChangedRequest's
+ * (all with action 'kBuildXLSandboxActionSendPipStarted'), and its output the 'IOReturn' of starting each pip.
+ */
+#define kMaxPipStartBatchSize 64
+
 typedef struct {
     basis_points cpuUsage;
     uint availableRamMB;
     uint numTrackedProcesses;
     uint numBlockedProcesses;
+    /*! Estimated RAM footprint of a tracked process (see 'ResourceManager::UpdateAvailableRam') */
+    uint ramPerProcessMB;
 } ResourceCounters;
 
 typedef struct {
@@ -152,7 +262,19 @@ typedef struct {
     Counter numQueued;
     Counter freeListNodeCount;
     double freeListSizeMB;
+    /*! Reports that found the free list of their queue (and its elimination array) empty and allocated a new element */
+    Counter numFreeListMisses;
     Counter numCoalescedReports;
+    Counter numSpilledReports;
+    Counter numPendingSpilledReports;
+    Counter numSpillChunks;
+    double spillSizeMB;
+    Counter numBackpressureStalls;
+    /*! Reports merged into the summary of their queue while the client lagged behind (see 'KextConfig::summarizeWhenLagging') */
+    Counter numSummarizedReports;
+    Counter numSummaryModeChanges;
+    /*! Reports of pips reporting faster than 'KextConfig::maxPipReportRate', sent through the summary of their queue */
+    Counter numThrottledReports;
 } ReportCounters;
 
 typedef struct {
@@ -166,32 +288,130 @@ typedef struct {
     ResourceCounters resourceCounters;
     ReportCounters reportCounters;
     Counter numHardLinkRetries;
+    /*! Hard link retries that found the link already verified (see 'SandboxedPip::isKnownHardLink') */
+    Counter numHardLinkCacheHits;
+    Counter numFilteredLookups;
     Counter numForks;
     Counter numCacheHits;
     Counter numCacheMisses;
+    /*! Accesses that could not be looked up in the path cache of their pip (and were thus reported without deduplication) */
+    Counter numCacheIneligiblePaths;
+    /*! Allowed accesses not reported because the client ignores their class of operations */
+    Counter numIgnoredOperations;
+    Counter numVNodePathCacheHits;
+    Counter numVNodePathCacheMisses;
+    /*! Policy searches that started below the cached search of their directory (see 'SandboxedPip::getCachedDirectoryCursor') */
+    Counter numDirCursorCacheHits;
+    Counter numDirCursorCacheMisses;
+    /*! Readlinks allowed without being checked again (see 'SandboxedPip::isReadlinkAllowed') */
+    Counter numReadlinkCacheHits;
+    /*! Execs whose image path (and policy) were found in the cache of their pip (see 'SandboxedPip::getCachedExecImage') */
+    Counter numExecImageCacheHits;
+    Counter numExecImageCacheMisses;
+    /*! Reports sent through the priority queues of clients (see 'KextConfig::enablePriorityReportQueue') */
+    Counter numPriorityReports;
     uint numUintTrieNodes;
     uint numPathTrieNodes;
     double uintTrieSizeMB;
     double pathTrieSizeMB;
+    double pathTrieSavedMB;
+    /*! Terminated pips whose final release has not been done by the teardown thread yet */
+    Counter numPendingPipTeardowns;
+    /*! Times the path caches were shrunk because of low available RAM (see 'ResourceThresholds::cacheShrinkRamMB'), and the paths they shed */
+    Counter numCacheShrinks;
+    uint64_t numShrunkPaths;
 } AllCounters;
 
 typedef struct {
     percent cpuUsageBlock;
     percent cpuUsageWakeup;
     uint minAvailableRamMB;
+    /*! Blocked processes are awakened only when available RAM is at least 'minAvailableRamMB' plus this margin */
+    uint ramWakeupMarginMB;
+    /*! If greater than 0, the kext samples CPU usage itself at most this often instead of relying on the client */
+    uint cpuSampleIntervalMs;
+    /*!
+     * If greater than 0, the pips shed the cold entries of their path caches whenever available RAM is sampled below this
+     * (see 'BuildXLSandbox::ShrinkCaches'), down to 'kPathCacheShrinkFloor' paths each
+     */
+    uint cacheShrinkRamMB;
 
     percent GetCpuUsageForWakeup() const
     {
         return cpuUsageWakeup.value > 0 ? cpuUsageWakeup : cpuUsageBlock;
     }
+
+    uint GetMinAvailableRamForWakeup() const
+    {
+        return minAvailableRamMB > 0 ? minAvailableRamMB + ramWakeupMarginMB : 0;
+    }
 } ResourceThresholds;
 
+typedef enum {
+    kOpClassLookup   = 1 << 0,  // MAC_LOOKUP
+    kOpClassReadlink = 1 << 1,  // MAC_READLINK
+    kOpClassProbe    = 1 << 2,  // VNODE_PROBE, FILEOP_OPEN_DIR
+    kOpClassRead     = 1 << 3,  // VNODE_READ, FILEOP_OPEN_FILE, sources of links and exchanges
+    kOpClassWrite    = 1 << 4,  // VNODE_WRITE, MAC_VNODE_CREATE, and the other FILEOP_ operations
+    kOpClassExecute  = 1 << 5,  // VNODE_EXECUTE
+    kOpClassProcess  = 1 << 6,  // Process (i.e., process starts)
+} OperationClass;
+
 typedef struct {
     uint reportQueueSizeMB;
     bool enableReportBatching;
+    bool enableCompactReports;
+    uint numReportQueues;
+    /*! Maximum number of paths cached per pip (see 'SandboxedPip::pathCache_'); no limit if 0 */
+    uint pathCacheBudget;
+    /*!
+     * When set, the kext maps the FAM payload of a started pip from the client (read-only, for the lifetime of the pip)
+     * instead of copying it.  The client must then never write to a payload it has sent.
+     */
+    bool mapPipPayloads;
+    /*!
+     * Classes of operations (see 'OperationClass') whose allowed accesses the client does not want reported; 0 to get
+     * all of them.  Denied accesses, process exits and process tree completions are reported regardless.
+     */
+    uint ignoredOperationClasses;
+    /*!
+     * When greater than 0 (and report batching is enabled), consecutive reports of the same process for the same path,
+     * created at most this many microseconds apart, are merged into one report carrying all of their requested accesses.
+     */
+    uint reportCoalescingWindowUs;
+    /*!
+     * When set, each client gets one more report queue (with index 'numReportQueues') for access denials and process
+     * starts and exits, so that they don't wait behind the bulk of the access reports.  Process tree completions stay in
+     * the queue of their pip, after all of its other reports, and carry the number of reports the pip has sent through
+     * the priority queue in their 'requestedAccess' (see 'IsPriorityReport').
+     */
+    bool enablePriorityReportQueue;
+    /*!
+     * When set (and report batching is enabled), a report queue that the client lags behind on, i.e., that has spilled a
+     * good part of what it may spill, merges the allowed accesses of each process to each path into one report until the
+     * client has caught up, instead of eventually holding processes back and failing.
+     */
+    bool summarizeWhenLagging;
+    /*!
+     * When counters are enabled, only 1 in every this many events (per slot of threads) is timed, and the durations of
+     * the timed events are scaled accordingly; access reports of events that are not timed carry no creation and enqueue
+     * time stamps (unless reports are coalesced, which needs the creation times).  Every event is timed if 0 or 1, or
+     * if 'kern.bxl_enable_full_timing' is set.
+     */
+    uint timingSampleRate;
+    /*!
+     * When greater than 0 (and report batching is enabled), the allowed accesses a pip reports beyond this many per second
+     * (in bursts of up to a second's worth) go through the summary of its report queue, which merges those of each process
+     * to each path and sends them once the queue has nothing else to send, so that a pip flooding a queue shared with
+     * others does not hold their reports up.  These reports are counted in the 'numThrottledReports' of the pip.
+     */
+    uint maxPipReportRate;
     ResourceThresholds resourceThresholds;
 } KextConfig;
 
+// Maximum number of report queues a client can have (see 'KextConfig::numReportQueues')
+#define kMaxReportQueues 16
+
 #define kMaxReportedPips 30
 #define kMaxReportedChildProcesses 20
 
@@ -208,6 +428,9 @@ typedef struct {
     pid_t clientPid;
     pipid_t pipId;
     uint64_t cacheSize;
+    /*! Number of times the oldest generation of the pip's path cache was evicted, and the paths it held */
+    uint32_t numCacheEvictions;
+    uint64_t numEvictedPaths;
     int32_t treeSize;
     AllCounters counters;
     int8_t numReportedChildren;
@@ -223,16 +446,142 @@ typedef struct {
     PipInfo pips[kMaxReportedPips];
 } IntrospectResponse;
 
+#define kMaxIntrospectedPipsPerCall 16
+#define kMaxIntrospectedProcessesPerCall 512
+
+typedef struct {
+    /*! The pid to resume from ('nextCursor' of the previous response), or 0 to start from the beginning */
+    pid_t cursor;
+} IntrospectProcessesRequest;
+
+typedef struct {
+    pid_t pid;
+    /*! Pid of the root process of the pip this process belongs to */
+    pid_t rootPid;
+} ProcessRecord;
+
+/*!
+ * One page of tracked processes, in the order of their pids, along with the pips whose root processes are on
+ * that page (without their 'children', which are all in 'processes').  A client keeps passing 'nextCursor'
+ * back until it is 0, so any number of pips and processes can be introspected.
+ */
+typedef struct {
+    pid_t nextCursor;
+    uint numProcesses;
+    ProcessRecord processes[kMaxIntrospectedProcessesPerCall];
+    uint numPips;
+    PipInfo pips[kMaxIntrospectedPipsPerCall];
+} IntrospectProcessesResponse;
+
+/*!
+ * Latencies of access reports, computed from their 'AccessReportStatistics' by the client receiving them:
+ * from creation to enqueuing in the kext, from enqueuing to dequeuing by the client, and from dequeuing
+ * until the client's callback has handled the report.
+ */
+typedef struct {
+    LatencyHistogram creationToEnqueue;
+    LatencyHistogram enqueueToDequeue;
+    LatencyHistogram dequeueToCallback;
+} ReportLatencies;
+
+// Sandbox-wide latency histograms; not part of 'IntrospectResponse' because of its size limit
+typedef struct {
+    LatencyHistogram findTrackedProcess;
+    LatencyHistogram checkPolicy;
+    LatencyHistogram cacheLookup;
+    LatencyHistogram reportFileAccess;
+    LatencyHistogram accessHandler;
+
+    /*! The report latencies last sent by a client (see 'kIpcActionUpdateReportLatencies') */
+    ReportLatencies reportLatencies;
+} LatencyHistograms;
+
+// Number of rings of the event trace (see 'EventTrace'), and the number of records each one holds (a power of 2)
+#define kEventTraceRingCount    16
+#define kEventTraceRingCapacity 1024
+
+/*!
+ * Events of the event trace, along with what the pid and the two arguments of their records are:
+ *   ReportEnqueued      -- reporting pid; operation | status << 8 | sent << 16, pip id
+ *   ReportSpilled       -- reporting pid; number of pending spilled reports, pip id
+ *   BackpressureStall   -- reporting pid; 0, pip id
+ *   SummaryModeChanged  -- 0; whether the queue summarizes now, number of pending spilled reports
+ *   RootProcessTracked  -- root pid; client pid, pip id
+ *   ChildProcessTracked -- child pid; root pid, pip id
+ *   ProcessUntracked    -- pid; root pid, pip id
+ *   PipTerminated       -- root pid; client pid, pip id
+ */
+#define FOR_ALL_TRACE_EVENTS(macro_to_apply)                          \
+  macro_to_apply(TraceEventReportEnqueued,      "ReportEnqueued")      \
+  macro_to_apply(TraceEventReportSpilled,       "ReportSpilled")       \
+  macro_to_apply(TraceEventBackpressureStall,   "BackpressureStall")   \
+  macro_to_apply(TraceEventSummaryModeChanged,  "SummaryModeChanged")  \
+  macro_to_apply(TraceEventRootProcessTracked,  "RootProcessTracked")  \
+  macro_to_apply(TraceEventChildProcessTracked, "ChildProcessTracked") \
+  macro_to_apply(TraceEventProcessUntracked,    "ProcessUntracked")    \
+  macro_to_apply(TraceEventPipTerminated,       "PipTerminated")
+
+#define GEN_TRACE_EVENT_CONST(name, value) k ## name,
+typedef enum {
+    kTraceEventNone,
+    FOR_ALL_TRACE_EVENTS(GEN_TRACE_EVENT_CONST)
+    kTraceEventMax
+} TraceEvent;
+
+typedef struct {
+    /*! 1 + the position of the record in its ring; 0 while the record is being written */
+    uint64_t sequence;
+    /*! mach_absolute_time() when the event occurred */
+    uint64_t timestamp;
+    pid_t pid;
+    uint16_t event;
+    uint16_t reserved;
+    uint64_t args[2];
+} EventTraceRecord;
+
+typedef struct {
+    uint ring;
+} EventTraceDumpRequest;
+
+/*!
+ * The records of one ring of the event trace, oldest first.  Records that were being written while the ring was
+ * dumped are left out.
+ */
+typedef struct {
+    /*! Number of records written to the ring since the kext was loaded, including those overwritten since */
+    uint64_t numWritten;
+    uint numRecords;
+    EventTraceRecord records[kEventTraceRingCapacity];
+} EventTraceDumpResponse;
+
 typedef enum {
     FileAccessReporting,
 } ReportQueueType;
 
+// The memory/notification port type through which user space selects the 'index'-th queue of a given type
+inline uint32_t MakeReportQueueMemoryType(ReportQueueType type, uint index)
+{
+    return (index << 16) | type;
+}
+
+inline ReportQueueType GetReportQueueType(uint32_t memoryType)   { return (ReportQueueType)(memoryType & 0xFFFF); }
+inline uint GetReportQueueIndex(uint32_t memoryType)             { return memoryType >> 16; }
+
 typedef struct {
     uint64_t creationTime;
     uint64_t enqueueTime;
     uint64_t dequeueTime;
 } AccessReportStatistics;
 
+/*!
+ * Identity of a reported file (the 'st_dev' and 'st_ino' of its stat), which consumers can key files by instead of paths.
+ * Only set when the sandbox got it at no extra cost; both are 0 otherwise (see 'HasFileIdentity').
+ */
+typedef struct {
+    uint64_t volume;
+    uint64_t file;
+} FileIdentity;
+
 typedef struct {
     FileOperation operation;
     pid_t pid;
@@ -242,10 +591,37 @@ typedef struct {
     uint reportExplicitly;
     DWORD error;
     pipid_t pipId;
-    char path[MAXPATHLEN];
     AccessReportStatistics stats;
+    FileIdentity fileIdentity;
+    // must be the last field: compact reports only carry the used part of it (see GetAccessReportSize)
+    char path[MAXPATHLEN];
 } AccessReport;
 
+inline bool HasFileIdentity(const AccessReport &report)
+{
+    return report.fileIdentity.volume != 0 || report.fileIdentity.file != 0;
+}
+
+// Reports that go through the priority queue of a client when 'KextConfig::enablePriorityReportQueue' is set
+inline bool IsPriorityReport(const AccessReport &report)
+{
+    return report.operation == kOpProcessStart ||
+           report.operation == kOpProcessExit ||
+           report.status == FileAccessStatus_Denied;
+}
+
+// Size of the fixed part of an AccessReport, i.e., everything but its path
+#define kAccessReportHeaderSize offsetof(AccessReport, path)
+
+// Number of bytes of a report that go through the report queue: all of it, or, when compact, its fixed part and
+// its path up to and including the terminating null character
+inline uint32_t GetAccessReportSize(const AccessReport &report, bool compact)
+{
+    return compact
+        ? (uint32_t)(kAccessReportHeaderSize + strnlen(report.path, sizeof(report.path) - 1) + 1)
+        : (uint32_t)sizeof(AccessReport);
+}
+
 inline bool HasAnyFlags(const int source, const int bitMask)
 {
     return (source & bitMask) != 0;
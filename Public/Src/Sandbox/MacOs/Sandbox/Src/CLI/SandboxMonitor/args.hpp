@@ -11,7 +11,12 @@
   m(stacked,     bool,   false)                \
   m(no_header,   bool,   false)                \
   m(interactive, bool,   false)                \
-  m(ps_fmt,      string, "%cpu,%mem,ucomm")
+  m(ps_fmt,      string, "%cpu,%mem,ucomm")     \
+  m(record,      string, "")                   \
+  m(sample_ms,   int,    100)                  \
+  m(export_file, string, "")                   \
+  m(export_fmt,  string, "csv")                 \
+  m(dump_events, bool,   false)
 
 GEN_CONFIG_DECL(ALL_ARGS)
 
@@ -50,6 +55,31 @@ void ConfigureArgs() {
         ->LongName("ps-fmt")
         ->ShortName("f")
         ->Description("Process info to display. The format is the same as for the '-o' option of the 'ps' program.");
+
+    Config::argMeta(kArg_record)
+        ->LongName("record")
+        ->ShortName("r")
+        ->Description("Samples the sandbox counters into the given binary trace file until interrupted, instead of rendering them.");
+
+    Config::argMeta(kArg_sample_ms)
+        ->LongName("sample-ms")
+        ->ShortName("ms")
+        ->Description("Delay between samples in milliseconds when recording.");
+
+    Config::argMeta(kArg_export_file)
+        ->LongName("export")
+        ->ShortName("e")
+        ->Description("Prints the samples of the given binary trace file (see --record) and exits.");
+
+    Config::argMeta(kArg_export_fmt)
+        ->LongName("export-format")
+        ->ShortName("ef")
+        ->Description("Format of --export: 'csv' or 'json' (one object per sample).");
+
+    Config::argMeta(kArg_dump_events)
+        ->LongName("dump-events")
+        ->ShortName("de")
+        ->Description("Prints the records of the event trace of the sandbox (see sysctl kern.bxl_enable_event_trace) as CSV, oldest first, and exits.");
 }
 
 
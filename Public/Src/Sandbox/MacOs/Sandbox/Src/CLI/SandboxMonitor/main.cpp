@@ -12,6 +12,8 @@
 #include <string>
 #include <sstream>
 #include <ncurses.h>
+#include <sys/time.h>
+#include <mach/mach_time.h>
 
 #import "args.hpp"
 #import "ps.hpp"
@@ -68,6 +70,13 @@ string renderCounter(DurationCounter cnt)
     return str.str();
 }
 
+string renderHistogram(const LatencyHistogram &histogram)
+{
+    stringstream str;
+    str << histogram.percentileUs(50) << "/" << histogram.percentileUs(99) << "/" << histogram.maxUs() << "us";
+    return str.str();
+}
+
 string to_string(Counter cnt)         { return to_string(cnt.count()); }
 string to_string(DurationCounter cnt) { return renderCounterMicros(cnt); }
 string to_string(string str)          { return str; }
@@ -89,6 +98,8 @@ vector<vector<HeaderColumn<Tuple>>> getStackedHeaders(const Config &cfg)
             {   8, "#C+",     to_getter(t.pip.counters.numCacheHits) },
             {   8, "#C-",     to_getter(t.pip.counters.numCacheMisses) },
             {   8, "#C",      to_getter(t.pip.cacheSize) },
+            {   8, "#CE",     to_getter(t.pip.numEvictedPaths) },
+            {   8, "#RT",     to_getter(t.pip.counters.reportCounters.numThrottledReports) },
             {   4, "C%",      to_getter((int)floor(PERCENT(t.pip.counters.numCacheHits.count(), t.pip.counters.numCacheMisses.count()))) },
             {   8, "avg(FP)", to_getter(t.pip.counters.findTrackedProcess) },
             {   8, "avg(SP)", to_getter(t.pip.counters.setLastLookedUpPath) },
@@ -106,14 +117,52 @@ vector<vector<HeaderColumn<Tuple>>> getStackedHeaders(const Config &cfg)
     });
 }
 
-static vector<PipInfo> GetPips(const IntrospectResponse *response)
+typedef struct {
+    vector<PipInfo> pips;
+    map<pid_t, vector<ProcessInfo>> children; // root pid -> all processes of the pip
+} ProcessTree;
+
+/*!
+ * Pages through all tracked processes.  Falls back to the (size-limited) pips of 'response' if that fails.
+ */
+static ProcessTree GetProcessTree(KextConnectionInfo info, const IntrospectResponse *response)
 {
-    return vector<PipInfo>(response->pips, response->pips + response->numReportedPips);
+    ProcessTree tree;
+
+    static IntrospectProcessesResponse page;
+    pid_t cursor = 0;
+    do
+    {
+        if (!IntrospectKernelExtensionProcesses(info, cursor, &page))
+        {
+            tree.pips.clear();
+            tree.children.clear();
+            for (int i = 0; i < response->numReportedPips; i++)
+            {
+                const PipInfo &pip = response->pips[i];
+                tree.pips.push_back(pip);
+                tree.children[pip.pid] = vector<ProcessInfo>(pip.children, pip.children + pip.numReportedChildren);
+            }
+
+            return tree;
+        }
+
+        tree.pips.insert(tree.pips.end(), page.pips, page.pips + page.numPips);
+        for (int i = 0; i < page.numProcesses; i++)
+        {
+            tree.children[page.processes[i].rootPid].push_back({ .pid = page.processes[i].pid });
+        }
+
+        cursor = page.nextCursor;
+    } while (cursor != 0);
+
+    return tree;
 }
 
-static vector<ProcessInfo> GetPipChildren(const PipInfo &pip)
+static vector<ProcessInfo> GetPipChildren(const ProcessTree &tree, const PipInfo &pip)
 {
-    auto vec = vector<ProcessInfo>(pip.children, pip.children + pip.numReportedChildren);
+    auto it = tree.children.find(pip.pid);
+    auto vec = it != tree.children.end() ? it->second : vector<ProcessInfo>();
     // make sure the root process goes first
     sort(vec.begin(), vec.end(), [&pip](ProcessInfo p1, ProcessInfo p2)
          {
@@ -140,11 +189,11 @@ void signalHandler(int signum)
     }
 }
 
-void renderProcesses(const Config *cfg, const Renderer<Tuple> *renderer, const IntrospectResponse *response, stringstream *output)
+void renderProcesses(const Config *cfg, const Renderer<Tuple> *renderer, const ProcessTree *tree, stringstream *output)
 {
     // group by clients
     function<pid_t(PipInfo)> select_clientId = [](PipInfo p) { return p.clientPid; };
-    vector<PipInfo> pips = GetPips(response);
+    vector<PipInfo> pips = tree->pips;
     map<pid_t, vector<PipInfo>> client2proc = group_by(&pips, select_clientId);
     
     // render processes
@@ -157,7 +206,7 @@ void renderProcesses(const Config *cfg, const Renderer<Tuple> *renderer, const I
         for (auto iPip = pips.begin(); iPip != pips.end(); ++iPip)
         {
             newPip = true;
-            auto procs = GetPipChildren(*iPip);
+            auto procs = GetPipChildren(*tree, *iPip);
             for (auto iProc = procs.begin(); iProc != procs.end(); ++iProc)
             {
                 string procInfo = ps(iProc->pid, cfg->ps_fmt);
@@ -170,6 +219,263 @@ void renderProcesses(const Config *cfg, const Renderer<Tuple> *renderer, const I
     }
 }
 
+#pragma mark Recording
+
+// Binary trace file written by '--record': a 'TraceHeader' followed by 'TraceSample's until the end of the file
+#define kTraceMagic   0x4D4C5842 // "BXLM"
+#define kTraceVersion 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sampleSize;       // sizeof(TraceSample) of the writer; traces with a different layout are rejected
+    uint32_t sampleIntervalMs;
+    KextConfig kextConfig;
+} TraceHeader;
+
+typedef struct {
+    uint64_t timestampUs;      // since the epoch
+    uint32_t numAttachedClients;
+    uint32_t numReportedPips;  // at most kMaxReportedPips
+    AllCounters counters;
+} TraceSample;
+
+static uint64_t nowMicros()
+{
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+/*!
+ * Samples 'IntrospectKernelExtension' every 'cfg.sample_ms' milliseconds into 'cfg.record' until interrupted.
+ * Processes are not inspected at all, so that recording doesn't perturb the load being measured.
+ */
+static int recordTrace(KextConnectionInfo info, const Config &cfg)
+{
+    FILE *file = fopen(cfg.record.c_str(), "wb");
+    if (file == nullptr)
+    {
+        error("Could not open '%s' for writing", cfg.record.c_str());
+        return 1;
+    }
+
+    int exitCode = 0;
+    IntrospectResponse response;
+    for (int i = 0; !g_interrupted; i++)
+    {
+        if (!IntrospectKernelExtension(info, &response))
+        {
+            error("%s", "Failed to introspect sandbox kernel extension");
+            exitCode = 1;
+            break;
+        }
+
+        if (i == 0)
+        {
+            TraceHeader header =
+            {
+                .magic            = kTraceMagic,
+                .version          = kTraceVersion,
+                .sampleSize       = sizeof(TraceSample),
+                .sampleIntervalMs = (uint32_t)cfg.sample_ms,
+                .kextConfig       = response.kextConfig,
+            };
+            fwrite(&header, sizeof(header), 1, file);
+        }
+
+        TraceSample sample =
+        {
+            .timestampUs        = nowMicros(),
+            .numAttachedClients = (uint32_t)response.numAttachedClients,
+            .numReportedPips    = (uint32_t)response.numReportedPips,
+            .counters           = response.counters,
+        };
+
+        if (fwrite(&sample, sizeof(sample), 1, file) != 1)
+        {
+            error("Could not write to '%s'", cfg.record.c_str());
+            exitCode = 1;
+            break;
+        }
+
+        usleep(cfg.sample_ms * 1000);
+    }
+
+    fclose(file);
+    return exitCode;
+}
+
+typedef struct {
+    string name;
+    function<string(TraceSample &)> getter;
+} TraceColumn;
+
+#define to_trace_getter(x) [](TraceSample &s) { return to_string(x); }
+
+static vector<TraceColumn> getTraceColumns()
+{
+    return vector<TraceColumn>(
+    {
+        { "timestampUs",          to_trace_getter(s.timestampUs) },
+        { "numClients",           to_trace_getter(s.numAttachedClients) },
+        { "numPips",              to_trace_getter(s.numReportedPips) },
+        { "cpuUsagePercent",      [](TraceSample &s) { return renderDouble(s.counters.resourceCounters.cpuUsage.value / 100.0); } },
+        { "availableRamMB",       to_trace_getter(s.counters.resourceCounters.availableRamMB) },
+        { "numTrackedProcesses",  to_trace_getter(s.counters.resourceCounters.numTrackedProcesses) },
+        { "numBlockedProcesses",  to_trace_getter(s.counters.resourceCounters.numBlockedProcesses) },
+        { "ramPerProcessMB",      to_trace_getter(s.counters.resourceCounters.ramPerProcessMB) },
+        { "totalNumSent",         to_trace_getter(s.counters.reportCounters.totalNumSent) },
+        { "numQueued",            to_trace_getter(s.counters.reportCounters.numQueued) },
+        { "numCoalescedReports",  to_trace_getter(s.counters.reportCounters.numCoalescedReports) },
+        { "numSpilledReports",    to_trace_getter(s.counters.reportCounters.numSpilledReports) },
+        { "numBackpressureStalls", to_trace_getter(s.counters.reportCounters.numBackpressureStalls) },
+        { "numSummarizedReports", to_trace_getter(s.counters.reportCounters.numSummarizedReports) },
+        { "numThrottledReports",  to_trace_getter(s.counters.reportCounters.numThrottledReports) },
+        { "numForks",             to_trace_getter(s.counters.numForks) },
+        { "numCacheHits",         to_trace_getter(s.counters.numCacheHits) },
+        { "numCacheMisses",       to_trace_getter(s.counters.numCacheMisses) },
+        { "numCacheIneligiblePaths", to_trace_getter(s.counters.numCacheIneligiblePaths) },
+        { "numFilteredLookups",   to_trace_getter(s.counters.numFilteredLookups) },
+        { "numHardLinkRetries",   to_trace_getter(s.counters.numHardLinkRetries) },
+        { "numHardLinkCacheHits", to_trace_getter(s.counters.numHardLinkCacheHits) },
+        { "numVNodePathCacheHits", to_trace_getter(s.counters.numVNodePathCacheHits) },
+        { "numVNodePathCacheMisses", to_trace_getter(s.counters.numVNodePathCacheMisses) },
+        { "numDirCursorCacheHits", to_trace_getter(s.counters.numDirCursorCacheHits) },
+        { "numDirCursorCacheMisses", to_trace_getter(s.counters.numDirCursorCacheMisses) },
+        { "numReadlinkCacheHits", to_trace_getter(s.counters.numReadlinkCacheHits) },
+        { "numExecImageCacheHits", to_trace_getter(s.counters.numExecImageCacheHits) },
+        { "numExecImageCacheMisses", to_trace_getter(s.counters.numExecImageCacheMisses) },
+        { "numPriorityReports",   to_trace_getter(s.counters.numPriorityReports) },
+        { "numCacheShrinks",      to_trace_getter(s.counters.numCacheShrinks) },
+        { "numShrunkPaths",       to_trace_getter(s.counters.numShrunkPaths) },
+        { "numUintTrieNodes",     to_trace_getter(s.counters.numUintTrieNodes) },
+        { "numPathTrieNodes",     to_trace_getter(s.counters.numPathTrieNodes) },
+        { "avgFindProcessUs",     to_trace_getter(s.counters.findTrackedProcess) },
+        { "avgSetLastPathUs",     to_trace_getter(s.counters.setLastLookedUpPath) },
+        { "avgPolicyCheckUs",     to_trace_getter(s.counters.checkPolicy) },
+        { "avgCacheLookupUs",     to_trace_getter(s.counters.cacheLookup) },
+        { "avgGetClientUs",       to_trace_getter(s.counters.getClientInfo) },
+        { "avgReportFileAccessUs", to_trace_getter(s.counters.reportFileAccess) },
+        { "avgAccessHandlerUs",   to_trace_getter(s.counters.accessHandler) },
+    });
+}
+
+/*!
+ * Prints the samples of the trace file 'cfg.export_file' as CSV or JSON lines.
+ */
+static int exportTrace(const Config &cfg)
+{
+    bool json = cfg.export_fmt == "json";
+    if (!json && cfg.export_fmt != "csv")
+    {
+        error("Unknown export format '%s'; expected 'csv' or 'json'", cfg.export_fmt.c_str());
+        return 1;
+    }
+
+    FILE *file = fopen(cfg.export_file.c_str(), "rb");
+    if (file == nullptr)
+    {
+        error("Could not open '%s' for reading", cfg.export_file.c_str());
+        return 1;
+    }
+
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != kTraceMagic ||
+        header.version != kTraceVersion ||
+        header.sampleSize != sizeof(TraceSample))
+    {
+        error("'%s' is not a trace file recorded by this version of the monitor", cfg.export_file.c_str());
+        fclose(file);
+        return 1;
+    }
+
+    vector<TraceColumn> columns = getTraceColumns();
+    if (!json)
+    {
+        for (size_t i = 0; i < columns.size(); i++)
+            cout << (i > 0 ? "," : "") << columns[i].name;
+        cout << endl;
+    }
+
+    TraceSample sample;
+    while (fread(&sample, sizeof(sample), 1, file) == 1)
+    {
+        if (json) cout << "{";
+        for (size_t i = 0; i < columns.size(); i++)
+        {
+            if (i > 0) cout << ",";
+            if (json) cout << "\"" << columns[i].name << "\":";
+            cout << columns[i].getter(sample);
+        }
+        if (json) cout << "}";
+        cout << endl;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+#pragma mark Event trace
+
+#define GEN_TRACE_EVENT_NAME(name, value) value,
+static const char *kTraceEventNames[] =
+{
+    "None",
+    FOR_ALL_TRACE_EVENTS(GEN_TRACE_EVENT_NAME)
+};
+
+typedef struct {
+    uint ring;
+    EventTraceRecord record;
+} RingRecord;
+
+/*!
+ * Dumps all rings of the event trace and prints their records, merged by time stamp, as CSV.
+ */
+static int dumpEventTrace(KextConnectionInfo info)
+{
+    static EventTraceDumpResponse response;
+    vector<RingRecord> records;
+    uint64_t numWritten = 0;
+    for (uint ring = 0; ring < kEventTraceRingCount; ring++)
+    {
+        if (!DumpKernelExtensionEventTrace(info, ring, &response))
+        {
+            error("Failed to dump ring %d of the event trace", ring);
+            return 1;
+        }
+
+        numWritten += response.numWritten;
+        for (uint i = 0; i < response.numRecords; i++)
+        {
+            records.push_back({ .ring = ring, .record = response.records[i] });
+        }
+    }
+
+    sort(records.begin(), records.end(), [](const RingRecord &r1, const RingRecord &r2)
+         {
+             return r1.record.timestamp < r2.record.timestamp;
+         });
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    uint64_t start = records.empty() ? 0 : records.front().record.timestamp;
+
+    cout << "# " << records.size() << " of " << numWritten << " recorded events" << endl;
+    cout << "timeUs,ring,event,pid,arg0,arg1" << endl;
+    for (const RingRecord &r : records)
+    {
+        uint64_t nanos = (r.record.timestamp - start) * timebase.numer / timebase.denom;
+        const char *name = r.record.event < kTraceEventMax ? kTraceEventNames[r.record.event] : "Unknown";
+        cout << nanos / 1000 << "," << r.ring << "," << name << "," << r.record.pid
+             << ",0x" << hex << r.record.args[0] << ",0x" << r.record.args[1] << dec << endl;
+    }
+
+    return 0;
+}
+
 void printValidPsKeywords()
 {
     cout << "Valid keywords: ";
@@ -246,6 +552,11 @@ int main(int argc, const char * argv[])
         exit(1);
     }
 
+    if (!cfg.export_file.empty())
+    {
+        return exportTrace(cfg);
+    }
+
     KextConnectionInfo info;
     InitializeKextConnection(&info, sizeof(info));
     
@@ -262,6 +573,20 @@ int main(int argc, const char * argv[])
         return 1;
     }
     
+    if (!cfg.record.empty())
+    {
+        int exitCode = recordTrace(info, cfg);
+        DeinitializeKextConnection(info);
+        return exitCode;
+    }
+
+    if (cfg.dump_events)
+    {
+        int exitCode = dumpEventTrace(info);
+        DeinitializeKextConnection(info);
+        return exitCode;
+    }
+
     char version[10];
     KextVersionString(version, 10);
     
@@ -301,6 +626,8 @@ int main(int argc, const char * argv[])
             break;
         }
 
+        ProcessTree tree = GetProcessTree(info, &response);
+
         // render header
         if (!cfg.no_header)
         {
@@ -321,10 +648,22 @@ int main(int argc, const char * argv[])
                    << endl;
             output << "Config     :: "
                    << "Report Queue Size: " << kextCfg->reportQueueSizeMB << " MB"
+                   << (kextCfg->enableCompactReports ? " (compact reports)" : "")
+                   << ", Report Queues: " << kextCfg->numReportQueues
+                   << (kextCfg->enablePriorityReportQueue ? " (+1 priority)" : "")
+                   << ", Path Cache Budget: " << kextCfg->pathCacheBudget
+                   << (kextCfg->mapPipPayloads ? " (mapped pip payloads)" : "")
+                   << ", Ignored Operation Classes: " << kextCfg->ignoredOperationClasses
+                   << ", Report Coalescing Window: " << kextCfg->reportCoalescingWindowUs << " us"
+                   << (kextCfg->summarizeWhenLagging ? ", Summarize When Lagging" : "")
+                   << ", Timing Sample Rate: 1/" << kextCfg->timingSampleRate
+                   << ", Max Pip Report Rate: " << kextCfg->maxPipReportRate << "/s"
                    << endl;
             output << "Thresholds :: "
                    << "Min Available RAM: " << thresholds->minAvailableRamMB << " MB"
+                   << " (wakeup: " << thresholds->GetMinAvailableRamForWakeup() << " MB)"
                    << ", CPU usage: [" << thresholds->GetCpuUsageForWakeup().value << "..." << thresholds->cpuUsageBlock.value << "]%"
+                   << (thresholds->cpuSampleIntervalMs > 0 ? " (sampled every " + to_string(thresholds->cpuSampleIntervalMs) + " ms)" : "")
                    << endl;
             output << "Counters   :: "
                    << "Avg(FindProcess/SetLastPath/PolicyCheck/CacheLookup/GetClient/ReportFileAccess/AccessHandler): "
@@ -336,30 +675,74 @@ int main(int argc, const char * argv[])
                    << renderCounter(response.counters.reportFileAccess) << " / "
                    << renderCounter(response.counters.accessHandler)
                    << endl;
+
+            LatencyHistograms latencies;
+            if (IntrospectKernelExtensionLatencies(info, &latencies))
+            {
+                output << "Latencies  :: "
+                       << "P50/P99/Max(FindProcess/PolicyCheck/CacheLookup/ReportFileAccess/AccessHandler): "
+                       << renderHistogram(latencies.findTrackedProcess) << " / "
+                       << renderHistogram(latencies.checkPolicy) << " / "
+                       << renderHistogram(latencies.cacheLookup) << " / "
+                       << renderHistogram(latencies.reportFileAccess) << " / "
+                       << renderHistogram(latencies.accessHandler)
+                       << endl;
+                output << "           :: "
+                       << "P50/P99/Max(ReportCreation->Enqueue/Enqueue->Dequeue/Dequeue->Callback): "
+                       << renderHistogram(latencies.reportLatencies.creationToEnqueue) << " / "
+                       << renderHistogram(latencies.reportLatencies.enqueueToDequeue) << " / "
+                       << renderHistogram(latencies.reportLatencies.dequeueToCallback)
+                       << endl;
+            }
+
             output << "Reports    :: "
                    << "#Queued: " << to_string(response.counters.reportCounters.numQueued)
                    << ", Total: " << to_string(response.counters.reportCounters.totalNumSent)
                    << ", #HardLink retries: " << to_string(response.counters.numHardLinkRetries)
+                   << " (cached: " << to_string(response.counters.numHardLinkCacheHits) << ")"
+                   << ", #Filtered lookups: " << to_string(response.counters.numFilteredLookups)
+                   << ", #Cache-ineligible paths: " << to_string(response.counters.numCacheIneligiblePaths)
+                   << ", #Ignored operations: " << to_string(response.counters.numIgnoredOperations)
+                   << ", #VNodePath cache hits: " << to_string(response.counters.numVNodePathCacheHits)
+                   << " (" << renderDouble(PERCENT(response.counters.numVNodePathCacheHits.count(), response.counters.numVNodePathCacheMisses.count())) << "%)"
+                   << ", #DirCursor cache hits: " << to_string(response.counters.numDirCursorCacheHits)
+                   << " (" << renderDouble(PERCENT(response.counters.numDirCursorCacheHits.count(), response.counters.numDirCursorCacheMisses.count())) << "%)"
+                   << ", #Readlink cache hits: " << to_string(response.counters.numReadlinkCacheHits)
+                   << ", #ExecImage cache hits: " << to_string(response.counters.numExecImageCacheHits)
+                   << " (" << renderDouble(PERCENT(response.counters.numExecImageCacheHits.count(), response.counters.numExecImageCacheMisses.count())) << "%)"
+                   << ", #PriorityReports: " << to_string(response.counters.numPriorityReports)
+                   << ", #CacheShrinks: " << to_string(response.counters.numCacheShrinks) << " (" << response.counters.numShrunkPaths << " paths)"
                    << ", #CoalescedReports: " << to_string(response.counters.reportCounters.numCoalescedReports)
                    << " (" << renderDouble(PERCENT(response.counters.reportCounters.numCoalescedReports.count(), response.counters.reportCounters.totalNumSent.count())) << "%)"
                    << ", #UintTrieNodes: " << to_string(response.counters.numUintTrieNodes) << " (" << renderDouble(response.counters.uintTrieSizeMB) << " MB)"
-                   << ", #PathTrieNodes: " << to_string(response.counters.numPathTrieNodes) << " (" << renderDouble(response.counters.pathTrieSizeMB) << " MB)"
+                   << ", #PathTrieNodes: " << to_string(response.counters.numPathTrieNodes) << " (" << renderDouble(response.counters.pathTrieSizeMB) << " MB, " << renderDouble(response.counters.pathTrieSavedMB) << " MB saved)"
                    << ", #FreeListNodes: " << to_string(response.counters.reportCounters.freeListNodeCount)
-                   << " (" << renderDouble(response.counters.reportCounters.freeListSizeMB) << " MB)"
+                   << " (" << renderDouble(response.counters.reportCounters.freeListSizeMB) << " MB, "
+                   << to_string(response.counters.reportCounters.numFreeListMisses) << " misses)"
+                   << ", #Spilled: " << to_string(response.counters.reportCounters.numSpilledReports)
+                   << " [pending: " << to_string(response.counters.reportCounters.numPendingSpilledReports)
+                   << ", " << to_string(response.counters.reportCounters.numSpillChunks) << " chunks, "
+                   << renderDouble(response.counters.reportCounters.spillSizeMB) << " MB]"
+                   << ", #BackpressureStalls: " << to_string(response.counters.reportCounters.numBackpressureStalls)
+                   << ", #Summarized: " << to_string(response.counters.reportCounters.numSummarizedReports)
+                   << " (" << to_string(response.counters.reportCounters.numSummaryModeChanges) << " mode changes)"
+                   << ", #Throttled: " << to_string(response.counters.reportCounters.numThrottledReports)
+                   << ", #PendingPipTeardowns: " << to_string(response.counters.numPendingPipTeardowns)
                    << endl;
             output << "Processes  :: #Client: " << response.numAttachedClients
-                   << ", #Pips: " << response.numReportedPips
+                   << ", #Pips: " << tree.pips.size()
                    << ", Available RAM: " << counters->availableRamMB << " MB"
                    << ", CPU usage: " << renderDouble(counters->cpuUsage.value / 100.0) << "%"
                    << ", #Processes [active: " << to_string(counters->numTrackedProcesses)
                    << ", blocked: " << to_string(counters->numBlockedProcesses) << "]"
+                   << ", Est. RAM/process: " << counters->ramPerProcessMB << " MB"
                    << endl
                    << endl;
             output << renderer.RenderHeader() << endl;
         }
 
         // render processes
-        renderProcesses(&cfg, &renderer, &response, &output);
+        renderProcesses(&cfg, &renderer, &tree, &output);
 
         // print to stdout
         if (cfg.interactive)
@@ -2,37 +2,151 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "ps.hpp"
-#include <array>
+#include <iomanip>
+#include <map>
 #include <sstream>
-#include <regex>
+#include <libproc.h>
+#include <mach/mach_time.h>
+#include <sys/proc.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
 
+// Keywords of the '-o' option of 'ps' that are rendered (from 'proc_pidinfo', without running 'ps')
 set<string> ps_keywords =
 {
-    "%cpu", "%mem", "acflag", "args", "comm", "command", "cpu", "etime", "flags", "gid", "inblk", "jobc", "ktrace",
-    "ktracep", "lim", "logname", "lstart", "majflt", "minflt", "msgrcv", "msgsnd", "nice", "nivcsw", "nsigs", "nswap",
-    "nvcsw", "nwchan", "oublk", "p_ru",  "paddr", "pagein", "pgid", "pid", "ppid", "pri", "re", "rgid", "rss", "ruid",
-    "ruser", "sess", "sig", "sigmask", "sl", "start", "state", "svgid", "svuid", "tdev", "time", "tpgid", "tsess",
-    "tsiz", "tt", "tty", "ucomm", "uid", "upr", "user", "utime", "vsz", "wchan", "wq", "wqb", "wqr", "wql", "xstat"
+    "%cpu", "%mem", "comm", "gid", "nice", "pgid", "pid", "ppid", "pri", "rss", "state", "stime", "time", "ucomm",
+    "uid", "utime", "vsz"
 };
 
-string exec(const char *cmd)
+static uint64_t machTimeToNanos(uint64_t machTime)
 {
-    array<char, 128> buffer;
-    string result;
-    shared_ptr<FILE> pipe(popen(cmd, "r"), pclose);
-    if (!pipe) return "";
-    while (!feof(pipe.get()))
+    static mach_timebase_info_data_t timebase = { 0, 0 };
+    if (timebase.denom == 0)
     {
-        if (fgets(buffer.data(), 128, pipe.get()) != nullptr)
-            result += buffer.data();
+        mach_timebase_info(&timebase);
     }
-    return result;
+
+    return machTime * timebase.numer / timebase.denom;
 }
 
-string ps(pid_t pid, const string &cols)
+static uint64_t nowNanos()
+{
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    return (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_usec * NSEC_PER_USEC;
+}
+
+static uint64_t physicalMemoryBytes()
+{
+    static uint64_t memsize = 0;
+    if (memsize == 0)
+    {
+        size_t len = sizeof(memsize);
+        sysctlbyname("hw.memsize", &memsize, &len, nullptr, 0);
+    }
+
+    return memsize;
+}
+
+static string renderCpuTime(uint64_t nanos)
+{
+    uint64_t hundredths = nanos / (NSEC_PER_SEC / 100);
+    stringstream str;
+    str << hundredths / 6000 << ":" << setfill('0') << setw(2) << (hundredths / 100) % 60 << "." << setw(2) << hundredths % 100;
+    return str.str();
+}
+
+static string renderState(uint32_t status)
+{
+    switch (status)
+    {
+        case SIDL:   return "I";
+        case SRUN:   return "R";
+        case SSLEEP: return "S";
+        case SSTOP:  return "T";
+        case SZOMB:  return "Z";
+        default:     return "?";
+    }
+}
+
+/*!
+ * Returns the CPU usage of 'pid' since the previous call for the same process (or since the process started).
+ */
+static double cpuPercent(pid_t pid, const proc_taskallinfo &info)
+{
+    // pid -> (cpu time, wall time) at the previous call
+    static map<pid_t, pair<uint64_t, uint64_t>> s_previousSamples;
+
+    uint64_t cpuNanos = machTimeToNanos(info.ptinfo.pti_total_user + info.ptinfo.pti_total_system);
+    uint64_t wallNanos = nowNanos();
+
+    auto it = s_previousSamples.find(pid);
+    uint64_t previousCpuNanos = it != s_previousSamples.end() ? it->second.first : 0;
+    uint64_t previousWallNanos = it != s_previousSamples.end()
+        ? it->second.second
+        : (uint64_t)info.pbsd.pbi_start_tvsec * NSEC_PER_SEC + (uint64_t)info.pbsd.pbi_start_tvusec * NSEC_PER_USEC;
+
+    s_previousSamples[pid] = make_pair(cpuNanos, wallNanos);
+
+    return wallNanos > previousWallNanos && cpuNanos >= previousCpuNanos
+        ? 100.0 * (cpuNanos - previousCpuNanos) / (wallNanos - previousWallNanos)
+        : 0.0;
+}
+
+static string renderKeyword(pid_t pid, const string &keyword, const proc_taskallinfo &info)
 {
     stringstream str;
-    str << "ps -p " << pid << " -o " << cols;
-    string stdout = exec(str.str().c_str());
-    return regex_replace(stdout, regex("\\s*\n$"), "");
+    str << fixed << setprecision(1);
+
+    if      (keyword == "%cpu")  str << cpuPercent(pid, info);
+    else if (keyword == "%mem")  str << (physicalMemoryBytes() == 0 ? 0.0 : 100.0 * info.ptinfo.pti_resident_size / physicalMemoryBytes());
+    else if (keyword == "comm")
+    {
+        char path[PROC_PIDPATHINFO_MAXSIZE];
+        str << (proc_pidpath(pid, path, sizeof(path)) > 0 ? path : info.pbsd.pbi_comm);
+    }
+    else if (keyword == "gid")   str << info.pbsd.pbi_gid;
+    else if (keyword == "nice")  str << info.pbsd.pbi_nice;
+    else if (keyword == "pgid")  str << info.pbsd.pbi_pgid;
+    else if (keyword == "pid")   str << pid;
+    else if (keyword == "ppid")  str << info.pbsd.pbi_ppid;
+    else if (keyword == "pri")   str << info.ptinfo.pti_priority;
+    else if (keyword == "rss")   str << info.ptinfo.pti_resident_size / 1024;
+    else if (keyword == "state") str << renderState(info.pbsd.pbi_status);
+    else if (keyword == "stime") str << renderCpuTime(machTimeToNanos(info.ptinfo.pti_total_system));
+    else if (keyword == "time")  str << renderCpuTime(machTimeToNanos(info.ptinfo.pti_total_user + info.ptinfo.pti_total_system));
+    else if (keyword == "ucomm") str << info.pbsd.pbi_comm;
+    else if (keyword == "uid")   str << info.pbsd.pbi_uid;
+    else if (keyword == "utime") str << renderCpuTime(machTimeToNanos(info.ptinfo.pti_total_user));
+    else if (keyword == "vsz")   str << info.ptinfo.pti_virtual_size / 1024;
+
+    return str.str();
+}
+
+string ps(pid_t pid, const string &cols)
+{
+    proc_taskallinfo info;
+    if (proc_pidinfo(pid, PROC_PIDTASKALLINFO, 0, &info, sizeof(info)) != sizeof(info))
+    {
+        // same as 'ps' for a process that doesn't exist (any longer)
+        return "";
+    }
+
+    // 'cols' is a comma separated list of keywords, each followed by '=' (see 'sanitizePsFormat')
+    stringstream result;
+    stringstream colStream(cols);
+    string keyword;
+    while (getline(colStream, keyword, ','))
+    {
+        if (!keyword.empty() && keyword.back() == '=')
+        {
+            keyword.pop_back();
+        }
+
+        if (result.tellp() > 0)
+            result << " ";
+        result << renderKeyword(pid, keyword, info);
+    }
+
+    return result.str();
 }
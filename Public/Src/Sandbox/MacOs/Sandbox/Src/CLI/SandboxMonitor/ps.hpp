@@ -10,7 +10,11 @@
 using namespace std;
 
 extern set<string> ps_keywords;
-string exec(const char *cmd);
+
+/*!
+ * Renders the same information about 'pid' as 'ps -p <pid> -o <cols>' for the keywords in 'ps_keywords',
+ * by querying the process directly instead of running 'ps'.
+ */
 string ps(pid_t pid, const string &cols);
 
 #endif /* ps_hpp */
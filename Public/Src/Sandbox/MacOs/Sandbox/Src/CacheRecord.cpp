@@ -2,7 +2,6 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "CacheRecord.hpp"
-#include "Monitor.hpp"
 
 #define super OSObject
 
@@ -29,31 +28,15 @@ bool CacheRecord::init()
         return false;
     }
 
-    lock_ = IOLockAlloc();
-    if (lock_ == nullptr)
-    {
-        return false;
-    }
-
-    requestedAccess_ = RequestedAccess::None;
+    requestedAccess_ = (UInt32)RequestedAccess::None;
+    policyCursor_    = 0;
     return true;
 }
 
-void CacheRecord::free()
-{
-    if (lock_ != nullptr)
-    {
-        IOLockFree(lock_);
-        lock_ = nullptr;
-    }
-
-    super::free();
-}
-
-bool CacheRecord::Check(const AccessCheckResult *result) const
+bool CacheRecord::Check(RequestedAccess cachedAccess, const AccessCheckResult *result)
 {
     // It's a cache hit if we've previously seen all the requested accesses.
-    return HasAllFlags(requestedAccess_, result->RequestedAccess);
+    return HasAllFlags(cachedAccess, result->RequestedAccess);
 }
 
 static const RequestedAccess LookupProbe     = RequestedAccess::Lookup | RequestedAccess::Probe;
@@ -114,34 +97,64 @@ inline static RequestedAccess impliedBy(RequestedAccess access)
 bool CacheRecord::HasStrongerRequestedAccess(RequestedAccess access, int *outCacheAccess) const
 {
     RequestedAccess accessesThatImplyGiveAccess = impliedBy(access);
-    int cachedAccess = (int)requestedAccess_;
+    int cachedAccess = (int)Access();
     if (outCacheAccess) *outCacheAccess = cachedAccess;
     return
         accessesThatImplyGiveAccess != RequestedAccess::None &&
         HasAnyFlags(cachedAccess, (int)accessesThatImplyGiveAccess);
 }
 
-void CacheRecord::Update(const AccessCheckResult *result)
+RequestedAccess CacheRecord::Update(RequestedAccess cachedAccess, const AccessCheckResult *result)
 {
     // Update requested access:
     //   - whenever Probe is seen, add Lookup as well;
     //   - whenever Read is seen, add Probe and Lookup as well;
     //   - whenever Write is seen, add Read, Probe, and Lookup as well.
     RequestedAccess access = result->RequestedAccess;
-    requestedAccess_ |= access | implies(access);
+    return cachedAccess | access | implies(access);
 }
 
 bool CacheRecord::CheckAndUpdate(const AccessCheckResult *checkResult)
 {
-    bool isHit;
-    IOLockLock(lock_);
+    while (true)
     {
-        isHit = Check(checkResult);
-        if (!isHit)
+        UInt32 cachedAccess = requestedAccess_;
+        if (Check((RequestedAccess)cachedAccess, checkResult))
         {
-            Update(checkResult);
+            return true;
         }
+
+        UInt32 updatedAccess = (UInt32)Update((RequestedAccess)cachedAccess, checkResult);
+        if (OSCompareAndSwap(cachedAccess, updatedAccess, &requestedAccess_))
+        {
+            return false;
+        }
+
+        // someone else updated this record in the meantime --> check again against what it has now
     }
-    IOLockUnlock(lock_);
-    return isHit;
+}
+
+bool CacheRecord::GetPolicyCursor(PolicySearchCursor *cursor) const
+{
+    uintptr_t value = policyCursor_;
+    if (value == 0)
+    {
+        return false;
+    }
+
+    cursor->Record             = (ManifestRecord const *)(value & ~(uintptr_t)1);
+    cursor->SearchWasTruncated = (value & 1) != 0;
+    return true;
+}
+
+void CacheRecord::SetPolicyCursor(const PolicySearchCursor &cursor)
+{
+    if (!cursor.IsValid())
+    {
+        return;
+    }
+
+    uintptr_t record = (uintptr_t)cursor.Record;
+    assert((record & 1) == 0);
+    policyCursor_ = record | (cursor.SearchWasTruncated ? 1 : 0);
 }
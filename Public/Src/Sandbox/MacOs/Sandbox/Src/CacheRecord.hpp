@@ -8,6 +8,7 @@
 #include <IOKit/IOLib.h>
 #include "BuildXLSandboxShared.hpp"
 #include "FileAccessHelpers.h"
+#include "PolicySearch.h"
 
 #define CacheRecord BXL_CLASS(CacheRecord)
 
@@ -20,35 +21,42 @@ private:
 
     OSDeclareDefaultStructors(CacheRecord)
 
-    IOLock *lock_;
+    /*!
+     * A bitwise disjunction of reported accesses (see 'RequestedAccess').
+     *
+     * Only ever changed with a compare-and-swap, so records need no lock.
+     */
+    volatile UInt32 requestedAccess_;
 
     /*!
-     * A bitwise disjunction of reported accesses.
+     * The manifest record the policy search for this path resolved to, or 0 if not known yet.
+     *
+     * The lowest bit holds the 'SearchWasTruncated' flag of the cursor (manifest records are 4-byte aligned).
+     * A cursor is a pure function of the path and the pip's manifest, so racing writers always store the same value.
      */
-    RequestedAccess requestedAccess_;
+    volatile uintptr_t policyCursor_;
     
     /*!
      * Determines if the given 'checkResult' should be deemed a cache hit (and thus not reported).
      *
-     * It is a cache hit if this cache record's 'Access' property already contains all the
+     * It is a cache hit if the 'cachedAccess' of this record already contains all the
      * requested accesses contained in the given 'checkResult' ('checkResult.RequestedAccess' field).
      */
-    bool Check(const AccessCheckResult *checkResult) const;
+    static bool Check(RequestedAccess cachedAccess, const AccessCheckResult *checkResult);
     
     /*!
-     * Updates this record w.r.t. a given 'checkResult' (so that subsequently, given the same
-     * 'checkResult', 'Check' returns True)
+     * Returns the 'cachedAccess' of this record updated w.r.t. a given 'checkResult' (so that subsequently,
+     * given the same 'checkResult', 'Check' returns True)
      */
-    void Update(const AccessCheckResult *checkResult);
+    static RequestedAccess Update(RequestedAccess cachedAccess, const AccessCheckResult *checkResult);
 
 protected:
 
     bool init() override;
-    void free() override;
 
 public:
     
-    inline RequestedAccess Access() const  { return requestedAccess_; }
+    inline RequestedAccess Access() const  { return (RequestedAccess)requestedAccess_; }
 
     bool HasStrongerRequestedAccess(RequestedAccess access, int *outCacheAccess = nullptr) const;
     
@@ -60,6 +68,19 @@ public:
      * @return Whether 'checkResult' was a cache hit.
      */
     bool CheckAndUpdate(const AccessCheckResult *checkResult);
+
+    /*!
+     * Retrieves the policy search cursor memoized with 'SetPolicyCursor'.
+     *
+     * @return Whether a cursor was memoized.
+     */
+    bool GetPolicyCursor(PolicySearchCursor *cursor) const;
+
+    /*!
+     * Memoizes the result of the policy search for this path, so that subsequent accesses need not search the manifest again.
+     * Invalid cursors are not memoized.
+     */
+    void SetPolicyCursor(const PolicySearchCursor &cursor);
     
 #pragma mark Static Methods
     
@@ -5,14 +5,18 @@
 
 #define super OSObject
 
+// The priority queue only gets the few reports that must not wait, so it gets a fraction of the size of the others
+#define kPriorityQueueSizeDivisor 16
+#define kPriorityQueueMinEntryCount 1024u
+
 OSDefineMetaClassAndStructors(ClientInfo, OSObject)
 
-ClientInfo* ClientInfo::create(const InitArgs& args)
+ClientInfo* ClientInfo::create(const InitArgs& args, uint numQueues, bool enablePriorityQueue)
 {
     auto *instance = new ClientInfo;
     if (instance)
     {
-        bool initialized = instance->init(args);
+        bool initialized = instance->init(args, numQueues, enablePriorityQueue);
         if (!initialized)
         {
             instance->release();
@@ -28,7 +32,7 @@ ClientInfo* ClientInfo::create(const InitArgs& args)
     return instance;
 }
 
-bool ClientInfo::init(const InitArgs& args)
+bool ClientInfo::init(const InitArgs& args, uint numQueues, bool enablePriorityQueue)
 {
     if (!super::init())
     {
@@ -37,13 +41,43 @@ bool ClientInfo::init(const InitArgs& args)
 
     frozen_          = false;
     reportCounters_  = args.counters;
+    priorityQueue_   = nullptr;
+
+    if (numQueues == 0)
+    {
+        return false;
+    }
 
-    queue_ = ConcurrentSharedDataQueue::create(args);
-    if (queue_ == nullptr)
+    // zero-filled, so that 'free' can tell which queues were created
+    queues_ = IONewZero(ConcurrentSharedDataQueue*, numQueues);
+    if (queues_ == nullptr)
     {
         return false;
     }
 
+    numQueues_ = numQueues;
+    for (uint i = 0; i < numQueues_; i++)
+    {
+        queues_[i] = ConcurrentSharedDataQueue::create(args);
+        if (queues_[i] == nullptr)
+        {
+            return false;
+        }
+    }
+
+    if (enablePriorityQueue)
+    {
+        // each report in it must reach the client on its own, see 'SandboxedPip::getPriorityReportCount'
+        InitArgs priorityArgs = args;
+        priorityArgs.coalescingWindowUs = 0;
+        priorityArgs.entryCount = max(args.entryCount / kPriorityQueueSizeDivisor, min(args.entryCount, kPriorityQueueMinEntryCount));
+        priorityQueue_ = ConcurrentSharedDataQueue::create(priorityArgs);
+        if (priorityQueue_ == nullptr)
+        {
+            return false;
+        }
+    }
+
     lock_ = IORecursiveLockAlloc();
     if (lock_ == nullptr)
     {
@@ -55,7 +89,18 @@ bool ClientInfo::init(const InitArgs& args)
 
 void ClientInfo::free()
 {
-    OSSafeReleaseNULL(queue_);
+    if (queues_ != nullptr)
+    {
+        for (uint i = 0; i < numQueues_; i++)
+        {
+            OSSafeReleaseNULL(queues_[i]);
+        }
+
+        IODelete(queues_, ConcurrentSharedDataQueue*, numQueues_);
+        queues_ = nullptr;
+    }
+
+    OSSafeReleaseNULL(priorityQueue_);
 
     if (lock_)
     {
@@ -66,39 +111,24 @@ void ClientInfo::free()
     super::free();
 }
 
-bool ClientInfo::createQueue(uint32_t entryCount, uint32_t entrySize, bool enableBatching)
-{
-    EnterMonitor
-
-    if (frozen_ || queue_ != nullptr) return false;
-
-    queue_ = ConcurrentSharedDataQueue::create(
-    {
-        .entryCount = entryCount,
-        .entrySize  = entrySize,
-        .enableBatching = enableBatching,
-        .counters = reportCounters_
-    });
-
-    return queue_ != nullptr;
-}
-
-bool ClientInfo::setNotifactonPort(mach_port_t port)
+bool ClientInfo::setNotifactonPort(uint queueIndex, mach_port_t port)
 {
     EnterMonitor
 
-    if (frozen_ || queue_ == nullptr) return false;
+    ConcurrentSharedDataQueue *queue = getQueue(queueIndex);
+    if (frozen_ || queue == nullptr) return false;
 
-    queue_->setNotificationPort(port);
+    queue->setNotificationPort(port);
     return true;
 }
 
-IOMemoryDescriptor* ClientInfo::getMemoryDescriptor()
+IOMemoryDescriptor* ClientInfo::getMemoryDescriptor(uint queueIndex)
 {
     EnterMonitor
 
-    return !frozen_ && queue_
-        ? queue_->getMemoryDescriptor()
+    ConcurrentSharedDataQueue *queue = getQueue(queueIndex);
+    return !frozen_ && queue
+        ? queue->getMemoryDescriptor()
         : nullptr;
 }
 
@@ -106,15 +136,33 @@ bool ClientInfo::setFailureNotificationHandler(OSAsyncReference64 ref, OSObject
 {
     EnterMonitor
 
-    if (frozen_ || queue_ == nullptr) return false;
+    if (frozen_ || queues_ == nullptr) return false;
+
+    for (uint i = 0; i < numQueues_; i++)
+    {
+        queues_[i]->setClientAsyncFailureHandle(ref, client);
+    }
+
+    if (priorityQueue_ != nullptr)
+    {
+        priorityQueue_->setClientAsyncFailureHandle(ref, client);
+    }
 
-    queue_->setClientAsyncFailureHandle(ref, client);
     return true;
 }
 
-bool ClientInfo::enqueueReport(const EnqueueArgs &args)
+bool ClientInfo::enqueueReport(const EnqueueArgs &args, bool *sentToPriorityQueue)
 {
     frozen_ = true;
 
-    return queue_ && queue_->enqueueReport(args);
+    bool toPriorityQueue = priorityQueue_ != nullptr && IsPriorityReport(args.report);
+    ConcurrentSharedDataQueue *queue = toPriorityQueue ? priorityQueue_ : getQueueForPip(args.report.pipId);
+    bool success = queue && queue->enqueueReport(args);
+
+    if (sentToPriorityQueue != nullptr)
+    {
+        *sentToPriorityQueue = success && toPriorityQueue;
+    }
+
+    return success;
 }
@@ -34,9 +34,21 @@ private:
     ReportCounters *reportCounters_;
 
     /*!
-     * A wrapper around IOSharedDataQueue.
+     * Wrappers around IOSharedDataQueue.  Each has its own shared memory and its own listener in user space.
+     *
+     * All reports of a pip go to the same queue (see 'getQueueForPip'), which preserves their order.
+     */
+    ConcurrentSharedDataQueue **queues_;
+
+    /*! Number of elements in 'queues_' */
+    uint numQueues_;
+
+    /*!
+     * Smaller queue for the reports the client wants to see as soon as possible (see 'IsPriorityReport'), or nullptr.
+     *
+     * User space addresses it with index 'numQueues_'.
      */
-    ConcurrentSharedDataQueue *queue_;
+    ConcurrentSharedDataQueue *priorityQueue_;
 
     /*!
      * A client becomes frozen after the first call to 'enqueueData'.
@@ -50,7 +62,21 @@ private:
      *
      * @result indicates success.
      */
-    bool init(const InitArgs& args);
+    bool init(const InitArgs& args, uint numQueues, bool enablePriorityQueue);
+
+    /*! Returns the queue at 'index' (the priority queue comes after all others), or nullptr if there is no such queue */
+    ConcurrentSharedDataQueue* getQueue(uint index) const
+    {
+        if (index == numQueues_) return priorityQueue_;
+        return queues_ != nullptr && index < numQueues_ ? queues_[index] : nullptr;
+    }
+
+    /*! Returns the queue all reports of pip 'pipId' go to */
+    ConcurrentSharedDataQueue* getQueueForPip(pipid_t pipId) const
+    {
+        uint64_t hash = (uint64_t)pipId;
+        return numQueues_ > 0 ? getQueue((uint)((hash ^ (hash >> 32)) % numQueues_)) : nullptr;
+    }
 
 public:
 
@@ -60,46 +86,48 @@ public:
     void free() override;
 
     /*!
-     * Creates a shared data queue for this client.  May only be called once.
-     *
-     * @result indicates success (it's False, e.g., if a queue had already been created).
-     */
-    bool createQueue(uint32_t entryCount, uint32_t entrySize, bool enableBatching);
-
-    /*!
-     * Sets the notification port for the underlying shared data queue.
+     * Sets the notification port for the 'queueIndex'-th shared data queue.
      *
-     * 'createQueue' must be called prior to calling this method.
-     *
-     * @result indicates success (it's False, e.g., if 'createQueue' hadn't been called first).
+     * @result indicates success (it's False, e.g., if there is no such queue).
      */
-    bool setNotifactonPort(mach_port_t port);
+    bool setNotifactonPort(uint queueIndex, mach_port_t port);
 
     /*!
-     * Returns the memory descriptor of the underlying shared data queue.
+     * Returns the memory descriptor of the 'queueIndex'-th shared data queue.
      *
      * @result a newly allocated memory descriptor.  The caller is responsible for releasing it.
      */
-    IOMemoryDescriptor* getMemoryDescriptor();
+    IOMemoryDescriptor* getMemoryDescriptor(uint queueIndex);
 
     /*!
-     * Sets the failure notification async callback handle for the underlying shared data queue.
+     * Sets the failure notification async callback handle for all shared data queues.
      *
      * @result indicates success.
      */
     bool setFailureNotificationHandler(OSAsyncReference64 ref, OSObject *client);
 
+    /*! Whether this client has a priority queue */
+    bool hasPriorityQueue() const { return priorityQueue_ != nullptr; }
+
     /*!
-     * Enqueues a report into the underlying shared data queue.
+     * Enqueues a report into the priority queue if there is one and the report belongs there, or else into the shared
+     * data queue assigned to the report's pip.
+     *
+     * @param sentToPriorityQueue Set to true when the report has been enqueued into the priority queue.
      *
      * @result indicates success.
      */
-    bool enqueueReport(const EnqueueArgs &args);
+    bool enqueueReport(const EnqueueArgs &args, bool *sentToPriorityQueue = nullptr);
 
 #pragma mark Static Methods
 
-    /*! Static factory method, following the OSObject pattern */
-    static ClientInfo* create(const InitArgs& args);
+    /*!
+     * Static factory method, following the OSObject pattern.
+     *
+     * Creates 'numQueues' shared data queues, each initialized with 'args', plus a smaller priority queue when
+     * 'enablePriorityQueue' is set.
+     */
+    static ClientInfo* create(const InitArgs& args, uint numQueues = 1, bool enablePriorityQueue = false);
 };
 
 #endif /* ClientInfo_hpp */
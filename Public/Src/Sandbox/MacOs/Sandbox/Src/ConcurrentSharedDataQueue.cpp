@@ -3,8 +3,12 @@
 
 #include <IOKit/IOMemoryDescriptor.h>
 #include <IOKit/IODataQueueShared.h>
+#if !MAC_OS_SANDBOX_USER_MODE
 #include "BuildXLSandboxClient.hpp"
+#endif
 #include "ConcurrentSharedDataQueue.hpp"
+#include "EventTrace.hpp"
+#include "Monitor.hpp"
 
 #define super OSObject
 
@@ -18,6 +22,13 @@ static void setValue(QueueElem *e, ElemPayload *p)    { LFDS711_QUEUE_UMM_SET_VA
 static ElemPayload* getValue(FreeListElem *e)         { return (ElemPayload*)LFDS711_FREELIST_GET_VALUE_FROM_ELEMENT(*e); }
 static void setValue(FreeListElem *e, ElemPayload *p) { LFDS711_FREELIST_SET_VALUE_IN_ELEMENT(*e, p); }
 
+static const uint kSpillChunkCapacity = kSpillChunkSize - sizeof(ConcurrentSharedDataQueue::SpillChunk);
+
+static char* getSpillData(ConcurrentSharedDataQueue::SpillChunk *chunk) { return (char*)(chunk + 1); }
+
+/*! Spilled reports are prefixed by their size and kept 4-byte aligned */
+static uint getSpillEntrySize(uint reportSize) { return sizeof(uint32_t) + ((reportSize + 3) & ~3u); }
+
 static void deallocateFreeListElem(FreeListElem *elem)
 {
     ElemPayload *payload = getValue(elem);
@@ -25,9 +36,29 @@ static void deallocateFreeListElem(FreeListElem *elem)
     IODelete(payload, ElemPayload, 1);
 }
 
+static ElemPayload* allocatePayload()
+{
+    ElemPayload *payload = IONew(ElemPayload, 1);
+    if (payload == nullptr)
+    {
+        return nullptr;
+    }
+
+    payload->queueElem = IONew(QueueElem, 1);
+    if (payload->queueElem == nullptr)
+    {
+        IODelete(payload, ElemPayload, 1);
+        return nullptr;
+    }
+
+    payload->cacheRecord = nullptr;
+    setValue(&payload->freeListElem, payload);
+    return payload;
+}
+
 QueueElem* ConcurrentSharedDataQueue::allocateElem(const EnqueueArgs &args)
 {
-    // try and get an element from the free list
+    // try and get an element from the free list (the PRNG state may be NULL, liblfds then hashes the element address)
     ElemPayload *payload = nullptr;
 
     FreeListElem *elem = nullptr;
@@ -38,21 +69,14 @@ QueueElem* ConcurrentSharedDataQueue::allocateElem(const EnqueueArgs &args)
     }
     else
     {
-        reportCounters_->freeListNodeCount++;
-        payload = IONew(ElemPayload, 1);
+        reportCounters_->numFreeListMisses++;
+        payload = allocatePayload();
         if (payload == nullptr)
         {
             return nullptr;
         }
 
-        payload->queueElem = IONew(QueueElem, 1);
-        if (payload->queueElem == nullptr)
-        {
-            IODelete(payload, ElemPayload, 1);
-            return nullptr;
-        }
-
-        setValue(&payload->freeListElem, payload);
+        reportCounters_->freeListNodeCount++;
     }
 
     // make sure the queue element is pointing to this payload
@@ -61,6 +85,7 @@ QueueElem* ConcurrentSharedDataQueue::allocateElem(const EnqueueArgs &args)
     // set the actual payload bytes
     payload->report = args.report;
     payload->cacheRecord = args.cacheRecord;
+    payload->summarize = args.summarize;
     if (payload->cacheRecord)
     {
         payload->cacheRecord->retain();
@@ -77,6 +102,30 @@ void ConcurrentSharedDataQueue::releaseElem(QueueElem *elem)
     lfds711_freelist_push(freeList_, &payload->freeListElem, nullptr);
 }
 
+bool ConcurrentSharedDataQueue::prefillFreeList(uint count)
+{
+    lfds711_pal_uint_t eliminationExtra = 0;
+    lfds711_freelist_query(freeList_,
+                           LFDS711_FREELIST_QUERY_GET_ELIMINATION_ARRAY_EXTRA_ELEMENTS_IN_FREELIST_ELEMENTS,
+                           nullptr,
+                           &eliminationExtra);
+
+    lfds711_pal_uint_t total = count + eliminationExtra;
+    for (lfds711_pal_uint_t i = 0; i < total; i++)
+    {
+        ElemPayload *payload = allocatePayload();
+        if (payload == nullptr)
+        {
+            return false;
+        }
+
+        reportCounters_->freeListNodeCount++;
+        lfds711_freelist_push(freeList_, &payload->freeListElem, nullptr);
+    }
+
+    return true;
+}
+
 ConcurrentSharedDataQueue* ConcurrentSharedDataQueue::create(const InitArgs& args)
 {
     auto *instance = new ConcurrentSharedDataQueue;
@@ -106,9 +155,26 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
     }
 
     drainingDone_                 = false;
+    pendingCount_                 = 0;
+    spillHead_                    = nullptr;
+    spillTail_                    = nullptr;
+    numSpillChunks_               = 0;
+    backpressureActive_           = false;
     unrecoverableFailureOccurred_ = false;
     reportCounters_               = args.counters;
     enableBatching_               = args.enableBatching;
+    enableCompactReports_         = args.enableCompactReports;
+    coalescingWindow_             = 0;
+    hasHeldReport_                = false;
+    summarizeWhenLagging_         = args.enableBatching && args.summarizeWhenLagging;
+    summaryMode_                  = false;
+    summary_                      = nullptr;
+    summaryCount_                 = 0;
+
+    if (args.enableBatching && args.coalescingWindowUs > 0)
+    {
+        clock_interval_to_absolutetime_interval(args.coalescingWindowUs, kMicrosecondScale, &coalescingWindow_);
+    }
 
     lock_ = IORecursiveLockAlloc();
     if (lock_ == nullptr)
@@ -116,6 +182,12 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
         return false;
     }
 
+    wakeupLock_ = IOLockAlloc();
+    if (wakeupLock_ == nullptr)
+    {
+        return false;
+    }
+
     queue_ = IOSharedDataQueue::withCapacity((args.entrySize + DATA_QUEUE_ENTRY_HEADER_SIZE) * args.entryCount);
     if (queue_ == nullptr)
     {
@@ -128,6 +200,13 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
         return false;
     }
 
+    eliminationArray_ = (EliminationArrayLine*)IOMallocAligned(sizeof(EliminationArrayLine) * kFreeListEliminationArrayLines,
+                                                                LFDS711_PAL_ATOMIC_ISOLATION_IN_BYTES);
+    if (eliminationArray_ == nullptr)
+    {
+        return false;
+    }
+
     pendingReports_  = IONew(Queue, 1);
     if (pendingReports_ == nullptr)
     {
@@ -142,7 +221,13 @@ bool ConcurrentSharedDataQueue::init(const InitArgs& args)
 
     // init lock-free queue and free list
     lfds711_queue_umm_init_valid_on_current_logical_core(pendingReports_, dummy, nullptr);
-    lfds711_freelist_init_valid_on_current_logical_core(freeList_, nullptr, 0, nullptr);
+    lfds711_freelist_init_valid_on_current_logical_core(freeList_, eliminationArray_, kFreeListEliminationArrayLines, nullptr);
+
+    // the shared IO queue never holds more than 'entryCount' reports, so that many elements are reused over and over
+    if (!prefillFreeList(min(args.entryCount, (uint)kFreeListMaxPrefillCount)))
+    {
+        return false;
+    }
 
     // init consumer thread
     consumerThread_ = Thread::create(this, [](void *me, wait_result_t result)
@@ -170,6 +255,7 @@ void ConcurrentSharedDataQueue::free()
     // wait for consumer thread to finish
     if (consumerThread_ != nullptr)
     {
+        wakeupConsumer();
         consumerThread_->join();
     }
 
@@ -201,6 +287,34 @@ void ConcurrentSharedDataQueue::free()
         freeList_ = nullptr;
     }
 
+    if (eliminationArray_ != nullptr)
+    {
+        IOFreeAligned(eliminationArray_, sizeof(EliminationArrayLine) * kFreeListEliminationArrayLines);
+        eliminationArray_ = nullptr;
+    }
+
+    // drop any spilled reports the client never received
+    while (spillHead_ != nullptr)
+    {
+        SpillChunk *chunk = spillHead_;
+        for (uint offset = chunk->readOffset; offset < chunk->writeOffset; )
+        {
+            offset += getSpillEntrySize(*(uint32_t*)(getSpillData(chunk) + offset));
+            reportCounters_->numPendingSpilledReports--;
+        }
+
+        spillHead_ = chunk->next;
+        freeSpillChunk(chunk);
+    }
+
+    spillTail_ = nullptr;
+
+    if (summary_ != nullptr)
+    {
+        IOFreePageable(summary_, sizeof(AccessReport) * kSummarySize);
+        summary_ = nullptr;
+    }
+
     if (asyncFailureHandle_ != nullptr)
     {
         asyncFailureHandle_->userClient = nullptr;
@@ -214,6 +328,12 @@ void ConcurrentSharedDataQueue::free()
         lock_ = nullptr;
     }
 
+    if (wakeupLock_ != nullptr)
+    {
+        IOLockFree(wakeupLock_);
+        wakeupLock_ = nullptr;
+    }
+
     OSSafeReleaseNULL(consumerThread_);
     OSSafeReleaseNULL(queue_);
 
@@ -259,11 +379,14 @@ IOReturn ConcurrentSharedDataQueue::InvokeAsyncFailureHandle(IOReturn status)
 {
     EnterMonitor
 
+#if !MAC_OS_SANDBOX_USER_MODE
+    // The user-mode build (see Benchmarks/KextBenchmarks.cpp) has no user clients to notify.
     if (asyncFailureHandle_ != nullptr)
     {
         BuildXLSandboxClient *client = OSDynamicCast(BuildXLSandboxClient, asyncFailureHandle_->userClient);
         return client->SendAsyncResult(asyncFailureHandle_->ref, status);
     }
+#endif
 
     return kIOReturnError;
 }
@@ -289,79 +412,431 @@ bool ConcurrentSharedDataQueue::enqueueWithLocking(const EnqueueArgs &args)
 
 bool ConcurrentSharedDataQueue::sendReport(const AccessReport &report)
 {
-    bool sent = queue_->enqueue((void*)&report, sizeof(AccessReport));
-    if (!sent)
+    uint size = GetAccessReportSize(report, enableCompactReports_);
+
+    // spilled reports must be sent first, so that the client receives all reports in order
+    if (flushSpill() && queue_->enqueue((void*)&report, size))
     {
-        log_error("Could not send data to shared queue from TID(%lld)", thread_tid(current_thread()));
-        drainingDone_ = true;
-        unrecoverableFailureOccurred_ = true;
-        InvokeAsyncFailureHandle(kIOReturnNoMemory);
+        reportCounters_->totalNumSent++;
+        return true;
     }
-    else
+
+    bool wasSpillEmpty = spillHead_ == nullptr;
+    if (spillReport(report, size) || spillReportWithBackpressure(report, size))
     {
-        reportCounters_->totalNumSent++;
+        if (wasSpillEmpty)
+        {
+            // let the consumer thread know that there is something to flush, even if no more reports come
+            wakeupConsumer();
+        }
+
+        return true;
+    }
+
+    log_error("Could not send data to shared queue from TID(%lld)", thread_tid(current_thread()));
+    drainingDone_ = true;
+    unrecoverableFailureOccurred_ = true;
+    InvokeAsyncFailureHandle(kIOReturnNoMemory);
+    return false;
+}
+
+void ConcurrentSharedDataQueue::freeSpillChunk(SpillChunk *chunk)
+{
+    IOFreePageable(chunk, kSpillChunkSize);
+    numSpillChunks_--;
+    reportCounters_->numSpillChunks--;
+}
+
+bool ConcurrentSharedDataQueue::spillReport(const AccessReport &report, uint size)
+{
+    uint entrySize = getSpillEntrySize(size);
+    if (spillTail_ == nullptr || spillTail_->writeOffset + entrySize > kSpillChunkCapacity)
+    {
+        if (numSpillChunks_ >= kMaxSpillChunks)
+        {
+            return false;
+        }
+
+        SpillChunk *chunk = (SpillChunk*)IOMallocPageable(kSpillChunkSize, sizeof(void*));
+        if (chunk == nullptr)
+        {
+            return false;
+        }
+
+        chunk->next        = nullptr;
+        chunk->readOffset  = 0;
+        chunk->writeOffset = 0;
+        numSpillChunks_++;
+        reportCounters_->numSpillChunks++;
+
+        if (spillTail_ == nullptr)
+        {
+            spillHead_ = chunk;
+        }
+        else
+        {
+            spillTail_->next = chunk;
+        }
+
+        spillTail_ = chunk;
+    }
+
+    char *entry = getSpillData(spillTail_) + spillTail_->writeOffset;
+    *(uint32_t*)entry = size;
+    memcpy(entry + sizeof(uint32_t), &report, size);
+    spillTail_->writeOffset += entrySize;
+
+    reportCounters_->numSpilledReports++;
+    reportCounters_->numPendingSpilledReports++;
+    bxl_trace(kTraceEventReportSpilled, report.pid, reportCounters_->numPendingSpilledReports.count(), report.pipId);
+    return true;
+}
+
+bool ConcurrentSharedDataQueue::spillReportWithBackpressure(const AccessReport &report, uint size)
+{
+    reportCounters_->numBackpressureStalls++;
+    backpressureActive_ = true;
+    bxl_trace(kTraceEventBackpressureStall, report.pid, 0, report.pipId);
+
+    bool spilled = false;
+    for (uint waitedMs = 0; !spilled && !drainingDone_ && waitedMs < kBackpressureTimeoutMs; waitedMs += kSpillFlushIntervalMs)
+    {
+        IOSleep(kSpillFlushIntervalMs);
+        flushSpill();
+        spilled = spillReport(report, size);
+    }
+
+    backpressureActive_ = false;
+    return spilled;
+}
+
+bool ConcurrentSharedDataQueue::flushSpill()
+{
+    while (spillHead_ != nullptr)
+    {
+        SpillChunk *chunk = spillHead_;
+        while (chunk->readOffset < chunk->writeOffset)
+        {
+            char *entry = getSpillData(chunk) + chunk->readOffset;
+            uint32_t size = *(uint32_t*)entry;
+            if (!queue_->enqueue(entry + sizeof(uint32_t), size))
+            {
+                return false;
+            }
+
+            chunk->readOffset += getSpillEntrySize(size);
+            reportCounters_->numPendingSpilledReports--;
+            reportCounters_->totalNumSent++;
+        }
+
+        spillHead_ = chunk->next;
+        if (spillHead_ == nullptr)
+        {
+            spillTail_ = nullptr;
+        }
+
+        freeSpillChunk(chunk);
+    }
+
+    return true;
+}
+
+bool ConcurrentSharedDataQueue::flushSpillSynchronized()
+{
+    if (enableBatching_)
+    {
+        // only the consumer thread sends reports
+        return flushSpill();
     }
 
-    return sent;
+    EnterMonitor
+
+    return flushSpill();
 }
 
 bool ConcurrentSharedDataQueue::enqueueWithBatching(const EnqueueArgs &args)
 {
     LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
 
+    // last resort when the client cannot keep up: hold the producing process back until reports can be spilled again
+    for (uint waitedMs = 0; backpressureActive_ && waitedMs < kBackpressureTimeoutMs; waitedMs += kSpillFlushIntervalMs)
+    {
+        IOSleep(kSpillFlushIntervalMs);
+    }
+
     QueueElem *elem = allocateElem(args);
     if (elem == nullptr)
     {
         return false;
     }
 
+    // count first, so that the consumer never goes to sleep while this report is being enqueued
+    bool wasEmpty = OSIncrementAtomic(&pendingCount_) == 0;
+
     lfds711_queue_umm_enqueue(pendingReports_, elem);
     reportCounters_->numQueued++;
 
+    if (wasEmpty)
+    {
+        wakeupConsumer();
+    }
+
     return true;
 }
 
-static uint s_backoffIntervalsMs[] = {1, 2, 4, 8, 16, 32, 64};
-static uint s_backoffIntervalsLen = sizeof(s_backoffIntervalsMs) / sizeof(s_backoffIntervalsMs[0]);
+void ConcurrentSharedDataQueue::wakeupConsumer()
+{
+    IOLockLock(wakeupLock_);
+    IOLockWakeup(wakeupLock_, (event_t)&pendingCount_, /*oneThread*/ true);
+    IOLockUnlock(wakeupLock_);
+}
 
-void ConcurrentSharedDataQueue::drainQueue()
+bool ConcurrentSharedDataQueue::canCoalesce(const AccessReport &held, const AccessReport &next) const
 {
-    if (!enableBatching_)
+    if (next.pid != held.pid ||
+        next.pipId != held.pipId ||
+        next.status != held.status ||
+        next.error != held.error ||
+        next.reportExplicitly != held.reportExplicitly ||
+        next.stats.creationTime - held.stats.creationTime > coalescingWindow_)
+    {
+        return false;
+    }
+
+    // the client gives these a meaning beyond their requested accesses (e.g., it checks if looked up paths exist,
+    // enumerates renamed directories, and tracks processes), so they must reach it as they are
+    for (FileOperation operation : { held.operation, next.operation })
+    {
+        switch (operation)
+        {
+            case kOpProcessStart:
+            case kOpProcessExit:
+            case kOpProcessTreeCompleted:
+            case kOpMacLookup:
+            case kOpKAuthMoveDest:
+                return false;
+            default:
+                break;
+        }
+    }
+
+    return strncmp(next.path, held.path, sizeof(held.path)) == 0;
+}
+
+void ConcurrentSharedDataQueue::sendHeldReport()
+{
+    if (hasHeldReport_)
+    {
+        hasHeldReport_ = false;
+        sendReport(heldReport_);
+    }
+}
+
+bool ConcurrentSharedDataQueue::ensureSummary()
+{
+    if (summary_ == nullptr)
+    {
+        summary_ = (AccessReport*)IOMallocPageable(sizeof(AccessReport) * kSummarySize, sizeof(void*));
+        if (summary_ == nullptr)
+        {
+            return false;
+        }
+
+        bzero(summary_, sizeof(AccessReport) * kSummarySize);
+    }
+
+    return true;
+}
+
+void ConcurrentSharedDataQueue::updateSummaryMode()
+{
+    if (!summarizeWhenLagging_)
     {
         return;
     }
 
+    bool lagging = summaryMode_ ? spillHead_ != nullptr : numSpillChunks_ >= kSummaryModeSpillChunks;
+    if (lagging == summaryMode_)
+    {
+        return;
+    }
+
+    if (lagging && !ensureSummary())
+    {
+        return;
+    }
+
+    summaryMode_ = lagging;
+    if (!summaryMode_)
+    {
+        sendHeldReport();
+        sendSummary();
+    }
+
+    reportCounters_->numSummaryModeChanges++;
+    bxl_trace(kTraceEventSummaryModeChanged, 0, (uint64_t)summaryMode_, reportCounters_->numPendingSpilledReports.count());
+}
+
+bool ConcurrentSharedDataQueue::isSummarizable(const AccessReport &report)
+{
+    if (report.status != FileAccessStatus_Allowed || report.path[0] == '\0')
+    {
+        return false;
+    }
+
+    // same as for coalescing (see 'canCoalesce')
+    switch (report.operation)
+    {
+        case kOpProcessStart:
+        case kOpProcessExit:
+        case kOpProcessTreeCompleted:
+        case kOpMacLookup:
+        case kOpKAuthMoveDest:
+            return false;
+        default:
+            return true;
+    }
+}
+
+bool ConcurrentSharedDataQueue::summarize(const AccessReport &report)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char *c = report.path; *c != '\0'; c++)
+    {
+        hash ^= (unsigned char)*c;
+        hash *= 16777619u;
+    }
+
+    hash ^= (uint32_t)report.pid;
+
+    for (uint probe = 0; probe < kSummaryMaxProbes; probe++)
+    {
+        AccessReport &slot = summary_[(hash + probe) & (kSummarySize - 1)];
+        if (slot.path[0] == '\0')
+        {
+            memcpy(&slot, &report, GetAccessReportSize(report, /*compact*/ true));
+            summaryCount_++;
+            return true;
+        }
+
+        if (slot.pid == report.pid &&
+            slot.pipId == report.pipId &&
+            slot.error == report.error &&
+            slot.reportExplicitly == report.reportExplicitly &&
+            strncmp(slot.path, report.path, sizeof(slot.path)) == 0)
+        {
+            slot.requestedAccess |= report.requestedAccess;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ConcurrentSharedDataQueue::sendSummary()
+{
+    for (uint i = 0; summaryCount_ > 0 && i < kSummarySize; i++)
+    {
+        if (summary_[i].path[0] != '\0')
+        {
+            sendReport(summary_[i]);
+            summary_[i].path[0] = '\0';
+            summaryCount_--;
+        }
+    }
+}
+
+void ConcurrentSharedDataQueue::drainQueue()
+{
     LFDS711_MISC_MAKE_VALID_ON_CURRENT_LOGICAL_CORE_INITS_COMPLETED_BEFORE_NOW_ON_ANY_OTHER_LOGICAL_CORE;
 
-    uint backoffCounter = 0;
     while (!drainingDone_)
     {
         QueueElem *elem;
-        if (!lfds711_queue_umm_dequeue(pendingReports_, &elem) || elem == nullptr)
+        if (!enableBatching_ || !lfds711_queue_umm_dequeue(pendingReports_, &elem) || elem == nullptr)
         {
-            uint backoffIndex = backoffCounter < s_backoffIntervalsLen ? backoffCounter : s_backoffIntervalsLen - 1;
-            IOSleep(/*milliseconds*/ s_backoffIntervalsMs[backoffIndex]);
-            ++backoffCounter;
+            // nothing to merge the held report with right now, so don't hold it back any longer
+            sendHeldReport();
+
+            // the reports of pips reporting too fast only had to wait for those of the other pips
+            if (summaryCount_ > 0 && !summaryMode_)
+            {
+                sendSummary();
+            }
+
+            // while there are spilled reports, keep flushing them as the client frees up space in the shared IO queue
+            if (!flushSpillSynchronized())
+            {
+                IOLockLock(wakeupLock_);
+                if (pendingCount_ == 0 && !drainingDone_)
+                {
+                    uint64_t deadline;
+                    clock_interval_to_deadline(kSpillFlushIntervalMs, kMillisecondScale, &deadline);
+                    IOLockSleepDeadline(wakeupLock_, (event_t)&pendingCount_, deadline, THREAD_UNINT);
+                }
+                IOLockUnlock(wakeupLock_);
+                continue;
+            }
+
+            // sleep until a producer makes the queue non-empty or spills a report (a non-zero count with an empty
+            // queue means that a report is being enqueued right now, so just try again)
+            IOLockLock(wakeupLock_);
+            while (pendingCount_ == 0 && spillHead_ == nullptr && !drainingDone_)
+            {
+                IOLockSleep(wakeupLock_, (event_t)&pendingCount_, THREAD_UNINT);
+            }
+            IOLockUnlock(wakeupLock_);
             continue;
         }
 
-        backoffCounter = 0;
+        OSDecrementAtomic(&pendingCount_);
         reportCounters_->numQueued--;
         ElemPayload *payload = getValue(elem);
 
-        if (payload->cacheRecord == nullptr)
+        updateSummaryMode();
+        bool summarizable = (summaryCount_ > 0 || summaryMode_ || payload->summarize) && isSummarizable(payload->report);
+        if (summaryCount_ > 0 && !summarizable)
+        {
+            // everything that came before this report has to reach the client first
+            sendHeldReport();
+            sendSummary();
+        }
+
+        if (payload->cacheRecord != nullptr &&
+            payload->cacheRecord->HasStrongerRequestedAccess((RequestedAccess)payload->report.requestedAccess))
+        {
+            reportCounters_->numCoalescedReports++;
+        }
+        else if ((summaryMode_ || payload->summarize) && summarizable && ensureSummary() && summarize(payload->report))
+        {
+            reportCounters_->numSummarizedReports++;
+        }
+        else if (coalescingWindow_ == 0)
         {
             sendReport(payload->report);
         }
-        else if (payload->cacheRecord->HasStrongerRequestedAccess((RequestedAccess)payload->report.requestedAccess))
+        else if (hasHeldReport_ && canCoalesce(heldReport_, payload->report))
         {
+            heldReport_.requestedAccess |= payload->report.requestedAccess;
             reportCounters_->numCoalescedReports++;
         }
         else
         {
-            sendReport(payload->report);
+            sendHeldReport();
+            heldReport_    = payload->report;
+            hasHeldReport_ = true;
         }
 
         releaseElem(elem);
     }
+
+    if (!unrecoverableFailureOccurred_)
+    {
+        sendHeldReport();
+        if (summaryCount_ > 0)
+        {
+            sendSummary();
+        }
+    }
 }
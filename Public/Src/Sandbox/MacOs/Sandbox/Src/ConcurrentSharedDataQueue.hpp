@@ -8,6 +8,7 @@
 #include <IOKit/IOSharedDataQueue.h>
 #include <IOKit/OSMessageNotification.h>
 #include "BuildXLSandboxShared.hpp"
+#include "CacheRecord.hpp"
 #include "Thread.hpp"
 
 extern "C" {
@@ -21,6 +22,36 @@ typedef lfds711_freelist_element  FreeListElem;
 
 #define MAX_DATA_SIZE sizeof(AccessReport)
 
+/*! Size of a chunk of spilled reports (see 'SpillChunk') */
+#define kSpillChunkSize (256 * 1024)
+
+/*! The maximum number of chunks of spilled reports a queue may have at any time */
+#define kMaxSpillChunks 64
+
+/*! How often spilled reports are flushed while the shared IO queue is full */
+#define kSpillFlushIntervalMs 1
+
+/*! How long a producer is held back when no more reports can be spilled, before the queue gives up */
+#define kBackpressureTimeoutMs 5000
+
+/*! Number of spill chunks in use from which on a queue summarizes reports (see 'ConcurrentSharedDataQueue::summary_') */
+#define kSummaryModeSpillChunks (kMaxSpillChunks / 4)
+
+/*! Number of reports the summary of a queue holds at most (a power of 2), and how many slots are probed for a report */
+#define kSummarySize 512
+#define kSummaryMaxProbes 8
+
+/*!
+ * Number of cache lines of the elimination array of the free list of a queue (a power of 2).  Producers that push and
+ * pop at the same time meet in a random slot of the array instead of all contending for the head of the free list.
+ */
+#define kFreeListEliminationArrayLines 16
+
+/*! The maximum number of elements the free list of a queue is prefilled with (see 'ConcurrentSharedDataQueue::prefillFreeList') */
+#define kFreeListMaxPrefillCount 1024
+
+typedef lfds711_freelist_element * volatile EliminationArrayLine[LFDS711_FREELIST_ELIMINATION_ARRAY_ELEMENT_SIZE_IN_FREELIST_ELEMENTS];
+
 typedef struct{
     OSObject* userClient;
     OSAsyncReference64 ref;
@@ -41,6 +72,9 @@ public:
         uint entryCount;
         uint entrySize;
         bool enableBatching;
+        bool enableCompactReports;
+        uint coalescingWindowUs;
+        bool summarizeWhenLagging;
         ReportCounters *counters;
     } InitArgs;
 
@@ -50,6 +84,12 @@ public:
 
         /*! May be NULL */
         const CacheRecord *cacheRecord;
+
+        /*!
+         * Whether the report goes through the summary even while the queue is not in summary mode, because its pip
+         * reports too fast (see 'KextConfig::maxPipReportRate').  Only honored when batching is enabled.
+         */
+        bool summarize;
     } EnqueueArgs;
 
     typedef struct {
@@ -57,8 +97,19 @@ public:
         FreeListElem freeListElem;
         AccessReport report;
         const CacheRecord *cacheRecord;
+        bool summarize;
     } ElemPayload;
 
+    /*!
+     * A chunk of reports that did not fit into the shared IO queue.  The reports are stored right after this
+     * header, each one prefixed by its size.
+     */
+    typedef struct SpillChunk {
+        struct SpillChunk *next;
+        uint readOffset;
+        uint writeOffset;
+    } SpillChunk;
+
 private:
 
     /*! Backing queue */
@@ -88,6 +139,65 @@ private:
      */
     bool enableBatching_;
 
+    /*!
+     * Whether reports are sent in their variable-length layout (the fixed part of a report followed by only the
+     * used part of its path) instead of as whole AccessReport structs.  The capacity of the shared IO queue stays
+     * the same, so it holds many more (typically short-path) reports.
+     */
+    bool enableCompactReports_;
+
+    /*!
+     * How far apart (in absolute time units) the creation times of two consecutive reports may be for 'consumerThread_'
+     * to merge them (see 'canCoalesce'); 0 if reports are never merged.
+     */
+    uint64_t coalescingWindow_;
+
+    /*!
+     * The report 'consumerThread_' has dequeued but not sent yet, because the next one may be merged into it.
+     * It is sent as soon as a report that cannot be merged into it comes, or 'pendingReports_' becomes empty.
+     */
+    AccessReport heldReport_;
+    bool hasHeldReport_;
+
+    /*!
+     * Indicates if 'next' may be merged into 'held' (which came right before it), i.e., if the client would handle
+     * a single report carrying the requested accesses of both the same way it handles the two of them.
+     */
+    bool canCoalesce(const AccessReport &held, const AccessReport &next) const;
+
+    /*! Sends 'heldReport_' if there is one. */
+    void sendHeldReport();
+
+    /*!
+     * Whether 'consumerThread_' falls back to summarizing reports while the client lags behind (i.e., while at least
+     * 'kSummaryModeSpillChunks' chunks of reports are spilled), until all spilled reports have been flushed.
+     */
+    bool summarizeWhenLagging_;
+    bool summaryMode_;
+
+    /*!
+     * Allowed accesses merged by 'consumerThread_' while in summary mode (or reported by pips that report too fast, see
+     * 'EnqueueArgs::summarize'), one per process, path and outcome, carrying the requested accesses of all of them; a
+     * slot is free when its path is empty.  Allocated the first time a report is summarized.
+     *
+     * The summary is sent when the queue leaves summary mode, when the queue is empty outside of summary mode, and right
+     * before any report that may not overtake the accesses that came before it (see 'isSummarizable'), e.g., a process exit.
+     */
+    AccessReport *summary_;
+    uint summaryCount_;
+
+    /*! Allocates 'summary_' if it is not allocated yet; returns false if it cannot be allocated. */
+    bool ensureSummary();
+
+    /*! Enters or leaves summary mode depending on how many reports are spilled. */
+    void updateSummaryMode();
+
+    /*! Merges 'report' into the summary; returns false if there is no room for it. */
+    bool summarize(const AccessReport &report);
+
+    /*! Sends and clears the summary. */
+    void sendSummary();
+
     /*!
      * A free list for keeping/reusing Queue elements.  The main reason for using this is
      * because Queue elements must not be deallocated before the Queue is freed (even
@@ -96,6 +206,19 @@ private:
      */
     FreeList *freeList_;
 
+    /*!
+     * The elimination array of 'freeList_' ('kFreeListEliminationArrayLines' lines, aligned to the atomic isolation
+     * granule of liblfds).  Elements may sit in it instead of in the free list proper, which is why the free list is
+     * prefilled with as many extra elements as the array can hold.
+     */
+    EliminationArrayLine *eliminationArray_;
+
+    /*!
+     * Pushes 'count' newly allocated elements (plus the ones the elimination array may hold) to 'freeList_',
+     * so that the first reports sent through this queue do not allocate.
+     */
+    bool prefillFreeList(uint count);
+
     /*!
      * A lock-free queue where reports are batched before being sent to the client.
      * This is used only if batching is enabled (see 'enableBatching_').
@@ -103,8 +226,8 @@ private:
     Queue *pendingReports_;
 
     /*!
-     * A dedicated thread for draining 'pendingReports_'.
-     * If batching is not enabled, this thread immediately finished without doing any work.
+     * A dedicated thread for draining 'pendingReports_' and flushing spilled reports.
+     * If batching is not enabled, this thread only flushes spilled reports.
      */
     Thread *consumerThread_;
 
@@ -113,14 +236,73 @@ private:
      */
     volatile bool drainingDone_;
 
+    /*!
+     * The number of reports enqueued to 'pendingReports_' and not yet dequeued by 'consumerThread_'.
+     * Producers increment it before enqueuing, so it is never less than the actual number of queued reports.
+     */
+    volatile SInt32 pendingCount_;
+
+    /*!
+     * The lock 'consumerThread_' sleeps on while 'pendingReports_' is empty.  Producers only take it
+     * (to wake the consumer up) when 'pendingCount_' goes from 0 to 1.
+     */
+    IOLock *wakeupLock_;
+
+    /*! Wakes 'consumerThread_' up if it is sleeping. */
+    void wakeupConsumer();
+
     void drainQueue();
 
+    /*!
+     * Reports that did not fit into the shared IO queue, oldest first.  Chunks are allocated from pageable
+     * memory on demand (at most 'kMaxSpillChunks' of them) and freed as soon as they have been flushed.
+     *
+     * While there are spilled reports, new reports are spilled too, so that the client still receives all
+     * reports in order.  'consumerThread_' keeps flushing the spilled reports as the client frees up space.
+     *
+     * Like 'queue_', these are only accessed by 'consumerThread_' when batching is enabled, and only
+     * while holding 'lock_' otherwise.
+     */
+    SpillChunk *spillHead_;
+    SpillChunk *spillTail_;
+    uint numSpillChunks_;
+
+    /*!
+     * Set while no more reports can be spilled.  Producers then wait (for up to 'kBackpressureTimeoutMs')
+     * before enqueuing more reports, holding the processes they report for back until the client catches up.
+     */
+    volatile bool backpressureActive_;
+
+    /*!
+     * Appends a report to the spilled reports.
+     *
+     * @result False if 'kMaxSpillChunks' are already used up or no memory could be allocated.
+     */
+    bool spillReport(const AccessReport &report, uint size);
+
+    /*!
+     * Keeps trying to spill a report, while flushing spilled reports, for up to 'kBackpressureTimeoutMs'.
+     */
+    bool spillReportWithBackpressure(const AccessReport &report, uint size);
+
+    /*!
+     * Moves as many spilled reports to the shared IO queue as fit.
+     *
+     * @result True if no spilled reports are left.
+     */
+    bool flushSpill();
+
+    /*! Frees a chunk of spilled reports that has been flushed. */
+    void freeSpillChunk(SpillChunk *chunk);
+
+    /*! Same as 'flushSpill', except that it also does the synchronization 'flushSpill' requires. */
+    bool flushSpillSynchronized();
+
     /*!
      * Indicates if an unrecoverable error has occured. This happens when the sandbox was not able to successfully
-     * enqueue an access report message. There is no logic to recover from this and mostly indicates that either a)
-     * the report queue size is to small for the amount of transfered reports or b) the number of connections to the
-     * sandbox kernel connection and with it the number of threads draining the report queues in user space are not
-     * sufficient. After this occures, the extension has to be reloaded!
+     * enqueue an access report message even after spilling and holding producers back, which mostly indicates that
+     * the client stopped draining the report queue. There is no logic to recover from this; after this occures,
+     * the extension has to be reloaded!
      */
     volatile bool unrecoverableFailureOccurred_;
 
@@ -198,6 +380,9 @@ public:
      * object and nullptr is returned.
      */
     static ConcurrentSharedDataQueue* create(const InitArgs& args);
+
+    /*! Indicates if 'report' may be merged into the summary. */
+    static bool isSummarizable(const AccessReport &report);
 };
 
 #endif /* ConcurrentSharedDataQueue_hpp */
@@ -57,14 +57,14 @@ void SkipOverCharArray(const BYTE *&cursor)
 const char *CheckValidUnixManifestTreeRoot(PCManifestRecord node)
 {
     // empty manifest is ok
-    if (node->BucketCount == 0)
+    if (node->GetBucketCount() == 0)
     {
         return nullptr;
     }
 
     // otherwise, there must be exactly one root node corresponding to the unix root sentinel '/'
     // (see UnixPathRootSentinel from HierarchicalNameTable.cs)
-    if (node->BucketCount != 1)
+    if (node->GetBucketCount() != 1)
     {
         return "Root manifest node is expected to have exactly one child (corresponding to the unix root sentinel: '/')";
     }
@@ -77,7 +77,7 @@ const char *CheckValidUnixManifestTreeRoot(PCManifestRecord node)
     return nullptr;
 }
 
-bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize)
+bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize, const BYTE *tree)
 {
     if (payloadSize == 0 || payload == nullptr) return true;
 
@@ -123,7 +123,35 @@ bool FileAccessManifestParseResult::init(const BYTE *payload, size_t payloadSize
         dllBlock_ = ParseAndAdvancePointer<PCManifestDllBlock>(payloadCursor);
         if (HasErrors()) continue;
 
-        root_ = Parse<PCManifestRecord>(payloadCursor);
+        suffixPolicies_ = ParseAndAdvancePointer<PCManifestSuffixPolicies>(payloadCursor);
+        if (HasErrors()) continue;
+
+        // Only the Windows sandbox answers attribute probes from the file metadata
+        ParseAndAdvancePointer<PCManifestFileMetadata>(payloadCursor);
+        if (HasErrors()) continue;
+
+        // Child processes only break away from the job of a pip on Windows
+        ParseAndAdvancePointer<PCManifestBreakawayChildProcesses>(payloadCursor);
+        if (HasErrors()) continue;
+
+        // Forks are throttled by the ResourceManager of the kext instead of the process admission gate
+        ParseAndAdvancePointer<PCManifestProcessAdmission>(payloadCursor);
+        if (HasErrors()) continue;
+
+        // The temp directory is only redirected by the Windows detours
+        ParseAndAdvancePointer<PCManifestTempRedirection>(payloadCursor);
+        if (HasErrors()) continue;
+
+        // The lookups of the manifest tree are only profiled by the Windows detours
+        ParseAndAdvancePointer<PCManifestLookupProfile>(payloadCursor);
+        if (HasErrors()) continue;
+
+        // The priorities are set on the root process by SandboxedProcessMacKext.cs, and inherited by the processes it forks
+        ParseAndAdvancePointer<PCManifestProcessPriority>(payloadCursor);
+        if (HasErrors()) continue;
+
+        const BYTE *treeCursor = tree != nullptr ? tree : payloadCursor;
+        root_ = Parse<PCManifestRecord>(treeCursor);
         error_ = root_->CheckValid();
         if (HasErrors()) continue;
 
@@ -149,7 +177,7 @@ void FileAccessManifestParseResult::PrintManifestTree(PCManifestRecord node,
            node->GetConePolicy() & FileAccessPolicy_ReportAccess, 
            node->GetNodePolicy() & FileAccessPolicy_ReportAccess);
 
-    for (int i = 0; i < node->BucketCount; i++)
+    for (int i = 0; i < node->GetBucketCount(); i++)
     {
         PCManifestRecord child = node->GetChildRecord(i);
         if (child == nullptr) continue;
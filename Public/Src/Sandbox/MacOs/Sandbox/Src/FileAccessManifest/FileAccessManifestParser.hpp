@@ -19,6 +19,7 @@ private:
     PCManifestPipId pipId_;
     PCManifestReport report_;
     PCManifestDllBlock dllBlock_;
+    PCManifestSuffixPolicies suffixPolicies_;
     PCManifestRecord root_;
     const char *error_;
 
@@ -40,15 +41,21 @@ public:
 
     FileAccessManifestParseResult() {}
 
-    bool init(const BYTE *payload, size_t payloadSize);
+    /*!
+     * Parses a FAM payload.  If 'tree' is not null, the manifest tree is parsed from there instead of from right
+     * after the header in 'payload' (which then only needs to hold the header).
+     */
+    bool init(const BYTE *payload, size_t payloadSize, const BYTE *tree = nullptr);
 
     inline bool IsValid() const                         { return error_ == nullptr; }
     inline bool HasErrors() const                       { return !IsValid(); }
     inline const char* Error() const                    { return error_; }
     inline PCManifestRecord GetManifestRootNode() const { return root_; }
-    inline PCManifestRecord GetUnixRootNode() const     { return root_->BucketCount > 0 ? root_->GetChildRecord(0) : root_; }
+    inline PCManifestRecord GetUnixRootNode() const     { return root_->GetBucketCount() > 0 ? root_->GetChildRecord(0) : root_; }
     inline PCManifestPipId GetPipId() const             { return pipId_; }
+    inline PCManifestSuffixPolicies GetSuffixPolicies() const { return suffixPolicies_; }
     inline FileAccessManifestFlag GetFamFlags() const   { return static_cast<FileAccessManifestFlag>(flags_->Flags); }
+    inline FileAccessManifestExtraFlag GetFamExtraFlags() const { return static_cast<FileAccessManifestExtraFlag>(extraFlags_->ExtraFlags); }
     inline const char* GetProcessPath(int *length) const
     {
         *length = report_->Size;
@@ -7,11 +7,12 @@
 
 bool AccessHandler::TryInitializeWithTrackedProcess(pid_t pid)
 {
-    Stopwatch stopwatch;
+    Stopwatch stopwatch(timingWeight_);
     SandboxedProcess *process = sandbox_->FindTrackedProcess(pid);
     Timespan duration = stopwatch.lap();
 
     sandbox_->Counters()->findTrackedProcess += duration;
+    sandbox_->Latencies()->findTrackedProcess += duration;
 
     if (process == nullptr || CheckDisableDetours(process->getPip()->getFamFlags()))
     {
@@ -23,6 +24,30 @@ bool AccessHandler::TryInitializeWithTrackedProcess(pid_t pid)
     return true;
 }
 
+int AccessHandler::GetDirectoryPath(vnode_t vp, char *buffer, int *length)
+{
+    SandboxedPip *pip = GetPip();
+    if (pip->getCachedVNodePath(vp, buffer, length))
+    {
+        sandbox_->Counters()->numVNodePathCacheHits++;
+        pip->Counters()->numVNodePathCacheHits++;
+        return 0;
+    }
+
+    sandbox_->Counters()->numVNodePathCacheMisses++;
+    pip->Counters()->numVNodePathCacheMisses++;
+
+    // read the generation first, so that a path computed concurrently with a rename is never considered valid
+    UInt32 generation = SandboxedPip::currentVNodePathGeneration();
+    int err = vn_getpath(vp, buffer, length);
+    if (err == 0)
+    {
+        pip->cacheVNodePath(vp, buffer, *length, generation);
+    }
+
+    return err;
+}
+
 PolicySearchCursor AccessHandler::FindManifestRecord(const char *absolutePath, size_t pathLength)
 {
     assert(absolutePath[0] == '/');
@@ -32,6 +57,39 @@ PolicySearchCursor AccessHandler::FindManifestRecord(const char *absolutePath, s
     return FindFileAccessPolicyInTreeEx(GetPip()->getManifestRecord(), pathWithoutRootSentinel, len);
 }
 
+PolicySearchCursor AccessHandler::FindManifestRecordBelow(const char *absolutePath, const ParentDirectory &parent)
+{
+    SandboxedPip *pip = GetPip();
+    PolicySearchCursor directoryCursor;
+    if (pip->getCachedDirectoryCursor(parent.vnode, &directoryCursor))
+    {
+        sandbox_->Counters()->numDirCursorCacheHits++;
+        pip->Counters()->numDirCursorCacheHits++;
+    }
+    else
+    {
+        sandbox_->Counters()->numDirCursorCacheMisses++;
+        pip->Counters()->numDirCursorCacheMisses++;
+
+        // the path of the root directory is "/", which is all root sentinel
+        directoryCursor = FindManifestRecord(absolutePath, parent.pathLength > 1 ? parent.pathLength - 1 : 0);
+        pip->cacheDirectoryCursor(parent.vnode, directoryCursor, parent.generation);
+    }
+
+    if (!directoryCursor.IsValid())
+    {
+        return directoryCursor;
+    }
+
+    const char *name = absolutePath + parent.pathLength;
+    while (*name == '/')
+    {
+        name++;
+    }
+
+    return FindFileAccessPolicyInTreeEx(directoryCursor, name, strlen(name));
+}
+
 void AccessHandler::SetProcessPath(AccessReport *report)
 {
     const char *procName = process_->hasPath()
@@ -40,10 +98,14 @@ void AccessHandler::SetProcessPath(AccessReport *report)
     strlcpy(report->path, procName, sizeof(report->path));
 }
 
+static int GetUniqueFileId(const vnode_t vp, const vfs_context_t ctx, uint64_t *result);
+
 ReportResult AccessHandler::ReportFileOpAccess(FileOperation operation,
                                                PolicyResult policyResult,
                                                AccessCheckResult checkResult,
-                                               CacheRecord *cacheRecord)
+                                               CacheRecord *cacheRecord,
+                                               vnode_t vp,
+                                               vfs_context_t ctx)
 {
     AccessReport report =
     {
@@ -61,7 +123,18 @@ ReportResult AccessHandler::ReportFileOpAccess(FileOperation operation,
 
     strlcpy(report.path, policyResult.Path(), sizeof(report.path));
 
-    bool sendSucceeded = sandbox_->SendAccessReport(report, GetPip(), cacheRecord);
+    // only accesses the pip has not reported yet get here, so this costs one attribute lookup per reported path
+    uint64_t fileId;
+    if (vp != nullptr && ctx != nullptr && GetUniqueFileId(vp, ctx, &fileId) == 0)
+    {
+        report.fileIdentity =
+        {
+            .volume = (uint64_t)(uint32_t)vfs_statfs(vnode_mount(vp))->f_fsid.val[0],
+            .file   = fileId,
+        };
+    }
+
+    bool sendSucceeded = sandbox_->SendAccessReport(report, GetPip(), cacheRecord, timingWeight_);
     ReportResult status = sendSucceeded ? kReported : kFailed;
 
     if (status == kFailed)
@@ -74,6 +147,38 @@ ReportResult AccessHandler::ReportFileOpAccess(FileOperation operation,
     return status;
 }
 
+uint AccessHandler::OperationClassOf(FileOperation operation)
+{
+    switch (operation)
+    {
+        case kOpMacLookup:                  return kOpClassLookup;
+        case kOpMacReadlink:                return kOpClassReadlink;
+        case kOpKAuthVNodeProbe:
+        case kOpKAuthOpenDir:               return kOpClassProbe;
+        case kOpKAuthVNodeRead:
+        case kOpKAuthReadFile:
+        case kOpKAuthCreateHardlinkSource:
+        case kOpKAuthCopySource:            return kOpClassRead;
+        case kOpMacVNodeCreate:
+        case kOpKAuthMoveSource:
+        case kOpKAuthMoveDest:
+        case kOpKAuthCreateHardlinkDest:
+        case kOpKAuthCopyDest:
+        case kOpKAuthDeleteDir:
+        case kOpKAuthDeleteFile:
+        case kOpKAuthCreateDir:
+        case kOpKAuthWriteFile:
+        case kOpKAuthClose:
+        case kOpKAuthCloseModified:
+        case kOpKAuthVNodeWrite:            return kOpClassWrite;
+        case kOpKAuthVNodeExecute:          return kOpClassExecute;
+        case kOpProcessStart:               return kOpClassProcess;
+
+        // the client relies on these to know when processes are done
+        default:                            return 0;
+    }
+}
+
 bool AccessHandler::ReportProcessTreeCompleted()
 {
     AccessReport report =
@@ -85,7 +190,7 @@ bool AccessHandler::ReportProcessTreeCompleted()
         .stats     = { .creationTime = creationTimestamp_ }
     };
 
-    return sandbox_->SendAccessReport(report, GetPip(), /*cacheRecord*/ nullptr);
+    return sandbox_->SendAccessReport(report, GetPip(), /*cacheRecord*/ nullptr, timingWeight_);
 }
 
 bool AccessHandler::ReportProcessExited(pid_t childPid)
@@ -104,11 +209,16 @@ bool AccessHandler::ReportProcessExited(pid_t childPid)
 
     SetProcessPath(&report);
 
-    return sandbox_->SendAccessReport(report, GetPip(), nullptr);
+    return sandbox_->SendAccessReport(report, GetPip(), nullptr, timingWeight_);
 }
 
 bool AccessHandler::ReportChildProcessSpawned(pid_t childPid)
 {
+    if (IsIgnored(kOpProcessStart))
+    {
+        return true;
+    }
+
     AccessReport report =
     {
         .operation          = kOpProcessStart,
@@ -125,7 +235,7 @@ bool AccessHandler::ReportChildProcessSpawned(pid_t childPid)
 
     SetProcessPath(&report);
 
-    return sandbox_->SendAccessReport(report, GetPip(), nullptr);
+    return sandbox_->SendAccessReport(report, GetPip(), nullptr, timingWeight_);
 }
 
 void AccessHandler::LogAccessDenied(const char *path,
@@ -144,7 +254,7 @@ PolicyResult AccessHandler::PolicyForPath(const char *absolutePath)
         log_error("Invalid policy cursor for path '%s'", absolutePath);
     }
 
-    return PolicyResult(GetPip()->getFamFlags(), absolutePath, cursor);
+    return PolicyResult(GetPip()->getFamFlags(), absolutePath, cursor, GetPip()->getSuffixPolicies());
 }
 
 #define VATTR_GET(vp, ctx, vap, attr, errno, result) \
@@ -205,6 +315,26 @@ static bool VNodeMatchesPath(vnode_t vp, vfs_context_t ctx, const char *path)
     return result;
 }
 
+bool AccessHandler::IsHardLink(vnode_t vp, vfs_context_t ctx, const char *path)
+{
+    SandboxedPip *pip = GetPip();
+    if (pip->isKnownHardLink(vp, path))
+    {
+        sandbox_->Counters()->numHardLinkCacheHits++;
+        return true;
+    }
+
+    // read the generation first, so that a match found concurrently with a rename is never cached
+    UInt32 generation = SandboxedPip::currentVNodePathGeneration();
+    if (!VNodeMatchesPath(vp, ctx, path))
+    {
+        return false;
+    }
+
+    pip->cacheHardLink(vp, path, generation);
+    return true;
+}
+
 bool AccessHandler::CheckAccess(vnode_t vp,
                                 vfs_context_t ctx,
                                 CheckFunc checker,
@@ -215,13 +345,13 @@ bool AccessHandler::CheckAccess(vnode_t vp,
     checker(*policy, isDir, result);
 
     bool notAllowed = result->GetFileAccessStatus() != FileAccessStatus_Allowed;
-    const char *lastLookupPath;
+    char lastLookupPath[MAXPATHLEN];
     // special handling for denied accesses to files with multiple hard links
     if (
-        notAllowed &&                                               // access is denied for current policy
-        (lastLookupPath = GetPip()->getLastLookedUpPath()) &&       // we remembered a path that was last looked up
-        strncmp(lastLookupPath, policy->Path(), MAXPATHLEN) != 0 && // that path is different from the policy path
-        VNodeMatchesPath(vp, ctx, lastLookupPath))                  // both paths point to the same vnode
+        notAllowed &&                                                            // access is denied for current policy
+        GetPip()->getLastLookedUpPath(lastLookupPath, sizeof(lastLookupPath)) && // we remembered a path that was last looked up
+        strncmp(lastLookupPath, policy->Path(), MAXPATHLEN) != 0 &&              // that path is different from the policy path
+        IsHardLink(vp, ctx, lastLookupPath))                                     // both paths point to the same vnode
     {
         // update policy and check again
         sandbox_->Counters()->numHardLinkRetries++;
@@ -240,12 +370,26 @@ AccessCheckResult AccessHandler::CheckAndReportInternal(FileOperation operation,
                                                         CheckFunc checker,
                                                         vfs_context_t ctx,
                                                         vnode_t vp,
-                                                        bool isDir)
+                                                        bool isDir,
+                                                        const ParentDirectory *parent)
 {    
-    Stopwatch stopwatch;
+    Stopwatch stopwatch(timingWeight_);
+    SandboxedPip::PathCacheScope cacheScope(GetPip());
+
+    // 1: check operation against given policy (reusing the policy search of a previous access to the same path, if any)
+    CacheRecord *cacheRecord = GetPip()->cacheGet(path);
+    PolicySearchCursor cursor;
+    bool cursorCached = cacheRecord != nullptr && cacheRecord->GetPolicyCursor(&cursor);
+    if (!cursorCached)
+    {
+        cursor = parent != nullptr ? FindManifestRecordBelow(path, *parent) : FindManifestRecord(path);
+        if (!cursor.IsValid())
+        {
+            log_error("Invalid policy cursor for path '%s'", path);
+        }
+    }
 
-    // 1: check operation against given policy
-    PolicyResult policy = PolicyForPath(path);
+    PolicyResult policy = PolicyResult(GetPip()->getFamFlags(), path, cursor, GetPip()->getSuffixPolicies());
     AccessCheckResult result = AccessCheckResult::Invalid();
     if (vp != nullptr && ctx != nullptr)
     {
@@ -256,28 +400,43 @@ AccessCheckResult AccessHandler::CheckAndReportInternal(FileOperation operation,
         checker(policy, isDir, &result);
     }
 
-    Timespan checkPolicyDuration       = stopwatch.lap();
-    GetPip()->Counters()->checkPolicy += checkPolicyDuration;
-    sandbox_->Counters()->checkPolicy += checkPolicyDuration;
+    Timespan checkPolicyDuration        = stopwatch.lap();
+    GetPip()->Counters()->checkPolicy  += checkPolicyDuration;
+    sandbox_->Counters()->checkPolicy  += checkPolicyDuration;
+    sandbox_->Latencies()->checkPolicy += checkPolicyDuration;
     
-    // 2: skip if this access should not be reported
-    if (!result.ShouldReport())
+    // 2: skip if this access should not be reported (allowed accesses the client ignores included)
+    if (!result.ShouldReport() || (!result.ShouldDenyAccess() && IsIgnored(operation)))
     {
         return result;
     }
 
     // 3: check cache to see if the same access has already been reported
-    CacheRecord *cacheRecord = GetPip()->cacheLookup(path);
+    if (cacheRecord == nullptr)
+    {
+        cacheRecord = GetPip()->cacheLookup(path);
+        if (cacheRecord == nullptr)
+        {
+            sandbox_->Counters()->numCacheIneligiblePaths++;
+        }
+    }
+
+    if (cacheRecord != nullptr && !cursorCached)
+    {
+        cacheRecord->SetPolicyCursor(cursor);
+    }
+
     bool cacheHit = cacheRecord != nullptr && cacheRecord->CheckAndUpdate(&result);
 
-    Timespan cacheLookupDuration       = stopwatch.lap();
-    sandbox_->Counters()->cacheLookup += cacheLookupDuration;
-    GetPip()->Counters()->cacheLookup += cacheLookupDuration;
+    Timespan cacheLookupDuration        = stopwatch.lap();
+    sandbox_->Counters()->cacheLookup  += cacheLookupDuration;
+    sandbox_->Latencies()->cacheLookup += cacheLookupDuration;
+    GetPip()->Counters()->cacheLookup  += cacheLookupDuration;
 
     if (!cacheHit)
     {
         GetPip()->Counters()->numCacheMisses++;
-        ReportFileOpAccess(operation, policy, result, cacheRecord);
+        ReportFileOpAccess(operation, policy, result, cacheRecord, vp, ctx);
     }
     else
     {
@@ -286,3 +445,106 @@ AccessCheckResult AccessHandler::CheckAndReportInternal(FileOperation operation,
 
     return result;
 }
+
+AccessCheckResult AccessHandler::CheckAndReportMultiple(const OperationCheck *checks,
+                                                        int count,
+                                                        const char *path,
+                                                        vfs_context_t ctx,
+                                                        vnode_t vp,
+                                                        const PolicySearchCursor *knownCursor)
+{
+    assert(count > 0);
+
+    Stopwatch stopwatch(timingWeight_);
+    SandboxedPip::PathCacheScope cacheScope(GetPip());
+
+    // 1: resolve the policy once (see 'CheckAndReportInternal') and apply all checkers to it
+    CacheRecord *cacheRecord = GetPip()->cacheGet(path);
+    PolicySearchCursor cursor;
+    bool cursorCached = cacheRecord != nullptr && cacheRecord->GetPolicyCursor(&cursor);
+    if (!cursorCached && knownCursor != nullptr && knownCursor->IsValid())
+    {
+        cursor = *knownCursor;
+    }
+    else if (!cursorCached)
+    {
+        cursor = FindManifestRecord(path);
+        if (!cursor.IsValid())
+        {
+            log_error("Invalid policy cursor for path '%s'", path);
+        }
+    }
+
+    PolicyResult policy = PolicyResult(GetPip()->getFamFlags(), path, cursor, GetPip()->getSuffixPolicies());
+    AccessCheckResult combined = AccessCheckResult::Invalid();
+    bool cacheRecordResolved = false;
+    bool reportedAny = false;
+
+    // 2: check (and report) the strongest accesses first
+    for (int i = count - 1; i >= 0; i--)
+    {
+        // 'CheckAccess' may switch to the policy of another path (hard links), hence a copy per check
+        PolicyResult checkedPolicy = policy;
+        AccessCheckResult result = AccessCheckResult::Invalid();
+        CheckAccess(vp, ctx, checks[i].checker, &checkedPolicy, &result);
+        combined = i == count - 1 ? result : AccessCheckResult::Combine(combined, result);
+
+        Timespan checkPolicyDuration        = stopwatch.lap();
+        GetPip()->Counters()->checkPolicy  += checkPolicyDuration;
+        sandbox_->Counters()->checkPolicy  += checkPolicyDuration;
+        sandbox_->Latencies()->checkPolicy += checkPolicyDuration;
+
+        if (!result.ShouldReport() || (!result.ShouldDenyAccess() && IsIgnored(checks[i].operation)))
+        {
+            continue;
+        }
+
+        // 3: look up the cache record (only once for all checks)
+        if (!cacheRecordResolved)
+        {
+            if (cacheRecord == nullptr)
+            {
+                cacheRecord = GetPip()->cacheLookup(path);
+                if (cacheRecord == nullptr)
+                {
+                    sandbox_->Counters()->numCacheIneligiblePaths++;
+                }
+            }
+
+            if (cacheRecord != nullptr && !cursorCached)
+            {
+                cacheRecord->SetPolicyCursor(cursor);
+            }
+
+            cacheRecordResolved = true;
+        }
+
+        bool cacheHit = cacheRecord != nullptr && cacheRecord->CheckAndUpdate(&result);
+
+        Timespan cacheLookupDuration        = stopwatch.lap();
+        sandbox_->Counters()->cacheLookup  += cacheLookupDuration;
+        sandbox_->Latencies()->cacheLookup += cacheLookupDuration;
+        GetPip()->Counters()->cacheLookup  += cacheLookupDuration;
+
+        if (!cacheHit)
+        {
+            GetPip()->Counters()->numCacheMisses++;
+            ReportFileOpAccess(checks[i].operation, checkedPolicy, result, cacheRecord, vp, ctx);
+            reportedAny = true;
+        }
+        else if (reportedAny)
+        {
+            // subsumed by a stronger access reported for this very event
+            sandbox_->GetReportCounters()->numCoalescedReports++;
+        }
+        else
+        {
+            GetPip()->Counters()->numCacheHits++;
+        }
+
+        // don't count the time spent reporting towards checking the next policy
+        stopwatch.lap();
+    }
+
+    return combined;
+}
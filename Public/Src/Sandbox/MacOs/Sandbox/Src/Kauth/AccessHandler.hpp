@@ -19,6 +19,27 @@ enum ReportResult
 
 typedef bool (Handler)(void *data);
 
+/*! An operation along with the checker to apply to the policy of a path on which the operation is performed */
+typedef struct
+{
+    FileOperation operation;
+    CheckFunc checker;
+} OperationCheck;
+
+/*!
+ * The directory in which an access happens, for accesses whose paths are built from a directory vnode and a
+ * name relative to it (see 'AccessHandler::FindManifestRecordBelow').
+ */
+typedef struct
+{
+    vnode_t vnode;
+    /*! Length of the path of 'vnode' at the beginning of the path of the access (not counting the separator after it) */
+    size_t pathLength;
+    /*! The value 'SandboxedPip::currentVNodePathGeneration' returned before the path of 'vnode' was computed */
+    UInt32 generation;
+} ParentDirectory;
+
+
 class AccessHandler
 {
 private:
@@ -30,13 +51,29 @@ private:
 
     uint64_t creationTimestamp_;
 
+    /*! The weight of the measured durations of the handled event, 0 if the event is not timed (see 'Stopwatch::SampleEvent') */
+    uint32_t timingWeight_;
+
+    /*!
+     * Reports an access to the path of 'policy'.  When the vnode of the accessed file is given, the report carries the
+     * identity of the file as well (see 'FileIdentity').
+     */
     ReportResult ReportFileOpAccess(FileOperation operation,
                                     PolicyResult policy,
                                     AccessCheckResult accessCheckResult,
-                                    CacheRecord *cacheRecord = nullptr);
+                                    CacheRecord *cacheRecord = nullptr,
+                                    vnode_t vp = nullptr,
+                                    vfs_context_t ctx = nullptr);
 
     inline void SetProcess(SandboxedProcess *process)
     {
+        // the handler keeps its own reference, because the process can get untracked while an event is handled;
+        // re-initializing with the same process (as some listeners do) must not cost another release/retain pair
+        if (process == process_)
+        {
+            return;
+        }
+
         OSSafeReleaseNULL(process_);
         process_ = process;
         if (process_)
@@ -48,13 +85,39 @@ private:
 protected:
 
     BuildXLSandbox* GetSandbox()   const { return sandbox_; }
+    uint32_t GetTimingWeight()     const { return timingWeight_; }
     SandboxedProcess* GetProcess() const { return process_; }
     SandboxedPip* GetPip()         const { return process_->getPip(); }
 
     PolicySearchCursor FindManifestRecord(const char *absolutePath, size_t pathLength = -1);
 
+    /*!
+     * Same as 'FindManifestRecord', for an 'absolutePath' in directory 'parent': the search for the path of the
+     * directory is remembered by the pip (see 'SandboxedPip::getCachedDirectoryCursor'), so only the rest of
+     * 'absolutePath' is searched below it.
+     */
+    PolicySearchCursor FindManifestRecordBelow(const char *absolutePath, const ParentDirectory &parent);
+
     void LogAccessDenied(const char *path, kauth_action_t action, const char *errorMessage = "");
 
+    /*! The class of 'operation' (see 'OperationClass'), or 0 for the operations that are always reported. */
+    static uint OperationClassOf(FileOperation operation);
+
+    /*!
+     * Whether the client ignores allowed accesses of 'operation' (see 'KextConfig::ignoredOperationClasses').
+     * Counts them as ignored operations if so.
+     */
+    bool IsIgnored(FileOperation operation) const
+    {
+        if ((sandbox_->GetConfig().ignoredOperationClasses & OperationClassOf(operation)) == 0)
+        {
+            return false;
+        }
+
+        sandbox_->Counters()->numIgnoredOperations++;
+        return true;
+    }
+
     /*!
      * Copies 'process_->getPath()' into 'report->path'.
      */
@@ -83,6 +146,12 @@ protected:
      */
     bool CheckAccess(vnode_t vp, vfs_context_t ctx, CheckFunc checker, PolicyResult *policy, AccessCheckResult *result);
 
+    /*!
+     * Indicates if 'path' resolves to 'vp'.  Verified matches are remembered by the pip (see
+     * 'SandboxedPip::isKnownHardLink'), so repeated accesses through the same link skip the lookup and getattrs.
+     */
+    bool IsHardLink(vnode_t vp, vfs_context_t ctx, const char *path);
+
     /*!
      * Template for checking and reporting file accesses.
      *
@@ -97,6 +166,9 @@ protected:
      * If the operation has not been reported, 'CheckAccess' and 'ReportFileOpAccess' are called and the result
      * is added to the cache if the returned AccessCheckResult object indicates that the operation should not be denied.
      *
+     * The cache record of a path also remembers where the policy search for that path ended in the manifest, so
+     * subsequent accesses to the same path skip the search and only apply 'checker' to the remembered policy.
+     *
      * @param operation Operation to be executed
      * @param path Absolute path against which the operation is to be executed
      * @param checker Checker function to apply to policy
@@ -104,38 +176,68 @@ protected:
      *            a fallback logic for files with multiple hard links), 'checker' is called directly.
      * @param vp (Can be NULL) Vnode corresponding to 'policy->Path()'; if NULL, instead of delegating to 'CheckAccess'
      *           (which implements a fallback logic for files with multiple hard links), 'checker' is called directly.
+     * @param parent (Can be NULL) The directory 'path' is in, if known; the policy of 'path' is then searched below
+     *               the one of the directory (see 'FindManifestRecordBelow').
      */
     AccessCheckResult CheckAndReportInternal(FileOperation operation,
                                      const char *path,
                                      CheckFunc checker,
                                      vfs_context_t ctx,
                                      vnode_t vp,
-                                     bool isDir);
+                                     bool isDir,
+                                     const ParentDirectory *parent = nullptr);
+
+    /*!
+     * Same as 'CheckAndReportInternal' for several operations on the same vnode (e.g., the ones a single kauth
+     * action implies), except that the policy of 'path' and its 'CacheRecord' are resolved only once.
+     *
+     * 'checks' must be ordered from the weakest to the strongest access: reports are sent strongest first, so that
+     * the reports of weaker accesses (which the consumer would drop anyway, see 'CacheRecord::HasStrongerRequestedAccess')
+     * become cache hits and are never enqueued.  Those are counted as coalesced reports.
+     *
+     * If given, 'knownCursor' is the result of the policy search for 'path', which is then not searched again.
+     *
+     * @result The combination of the results of all checks (see 'AccessCheckResult::Combine').
+     */
+    AccessCheckResult CheckAndReportMultiple(const OperationCheck *checks,
+                                             int count,
+                                             const char *path,
+                                             vfs_context_t ctx,
+                                             vnode_t vp,
+                                             const PolicySearchCursor *knownCursor = nullptr);
 
     AccessCheckResult CheckAndReport(FileOperation operation, const char *path, CheckFunc checker, vfs_context_t ctx, vnode_t vp)
     {
         return CheckAndReportInternal(operation, path, checker, ctx, vp, false);
     }
 
-    AccessCheckResult CheckAndReport(FileOperation operation, const char *path, CheckFunc checker, bool isDir)
+    AccessCheckResult CheckAndReport(FileOperation operation, const char *path, CheckFunc checker, bool isDir,
+                                     const ParentDirectory *parent = nullptr)
     {
-        return CheckAndReportInternal(operation, path, checker, nullptr, nullptr, isDir);
+        return CheckAndReportInternal(operation, path, checker, nullptr, nullptr, isDir, parent);
     }
 
 public:
 
     AccessHandler(BuildXLSandbox *sandbox)
     {
-        creationTimestamp_ = mach_absolute_time();
+        timingWeight_      = Stopwatch::SampleEvent();
         sandbox_           = sandbox;
         process_           = nullptr;
+
+        // reports are coalesced by their creation times, so events that are not timed need those too then
+        bool needsCreationTime = sandbox != nullptr && sandbox->GetConfig().reportCoalescingWindowUs > 0;
+        creationTimestamp_ = timingWeight_ > 0 || needsCreationTime ? mach_absolute_time() : 0;
     }
 
     ~AccessHandler()
     {
-        Timespan duration = Timespan::fromNanoseconds(mach_absolute_time() - creationTimestamp_);
+        Timespan duration = timingWeight_ > 0
+            ? Timespan::fromNanoseconds(mach_absolute_time() - creationTimestamp_, timingWeight_)
+            : Timespan::unmeasured();
         if (process_) GetPip()->Counters()->accessHandler += duration;
         if (sandbox_) sandbox_->Counters()->accessHandler += duration;
+        if (sandbox_) sandbox_->Latencies()->accessHandler += duration;
         OSSafeReleaseNULL(process_);
     }
 
@@ -160,6 +262,12 @@ public:
 
     PolicyResult PolicyForPath(const char *absolutePath);
 
+    /*!
+     * Same as 'vn_getpath' for directory 'vp', except that the path comes from (and goes into) the directory
+     * path cache of the current pip.
+     */
+    int GetDirectoryPath(vnode_t vp, char *buffer, int *length);
+
     bool ReportProcessTreeCompleted();
     bool ReportProcessExited(pid_t childPid);
     bool ReportChildProcessSpawned(pid_t childPid);
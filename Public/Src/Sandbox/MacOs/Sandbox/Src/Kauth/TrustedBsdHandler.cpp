@@ -4,24 +4,47 @@
 #include "TrustedBsdHandler.hpp"
 #include "OpNames.hpp"
 
-int TrustedBsdHandler::HandleLookup(const char *path)
+int TrustedBsdHandler::HandleLookup(const char *path, const ParentDirectory *parent)
 {
     // set last looked up path
-    Stopwatch stopwatch;
+    Stopwatch stopwatch(GetTimingWeight());
     GetPip()->setLastLookedUpPath(path);
 
     Timespan duration = stopwatch.lap();
     GetSandbox()->Counters()->setLastLookedUpPath += duration;
     GetPip()->Counters()->setLastLookedUpPath += duration;
 
+    // lookups are never denied, so the ones the client ignores need no policy search at all
+    if (IsIgnored(kOpMacLookup))
+    {
+        return KERN_SUCCESS;
+    }
+
+    // skip lookups which the manifest would never report (e.g., the ones dyld does in system frameworks)
+    if (!GetPip()->mayReportLookup(path))
+    {
+        GetSandbox()->Counters()->numFilteredLookups++;
+        GetPip()->Counters()->numFilteredLookups++;
+        return KERN_SUCCESS;
+    }
+
     // Check, report, but never deny lookups
-    CheckAndReport(kOpMacLookup, path, Checkers::CheckLookup, /*isDir*/ false);
+    CheckAndReport(kOpMacLookup, path, Checkers::CheckLookup, /*isDir*/ false, parent);
     return KERN_SUCCESS;
 }
 
 int TrustedBsdHandler::HandleReadlink(vnode_t symlinkVNode)
 {
-    // get symlink path
+    // toolchains readlink the same symlinks over and over again, and the outcome only changes with their paths
+    if (GetPip()->isReadlinkAllowed(symlinkVNode))
+    {
+        GetSandbox()->Counters()->numReadlinkCacheHits++;
+        GetPip()->Counters()->numReadlinkCacheHits++;
+        return KERN_SUCCESS;
+    }
+
+    // get symlink path (reading the generation first, so that a path computed concurrently with a rename is never cached)
+    UInt32 generation = SandboxedPip::currentVNodePathGeneration();
     char path[MAXPATHLEN];
     int len = MAXPATHLEN;
     int err = vn_getpath(symlinkVNode, path, &len);
@@ -41,13 +64,15 @@ int TrustedBsdHandler::HandleReadlink(vnode_t symlinkVNode)
     }
     else
     {
+        GetPip()->cacheAllowedReadlink(symlinkVNode, generation);
         return KERN_SUCCESS;
     }
 }
 
 int TrustedBsdHandler::HandleVNodeCreateEvent(const char *fullPath,
                                               const bool isDir,
-                                              const bool isSymlink)
+                                              const bool isSymlink,
+                                              const ParentDirectory *parent)
 {
     bool enforceDirectoryCreation = CheckDirectoryCreationAccessEnforcement(GetFamFlags());
     CheckFunc checker =
@@ -55,7 +80,7 @@ int TrustedBsdHandler::HandleVNodeCreateEvent(const char *fullPath,
         !isDir                             ? Checkers::CheckWrite :
         enforceDirectoryCreation           ? Checkers::CheckCreateDirectory :
                                              Checkers::CheckProbe;
-    AccessCheckResult result = CheckAndReport(kOpMacVNodeCreate, fullPath, checker, isDir);
+    AccessCheckResult result = CheckAndReport(kOpMacVNodeCreate, fullPath, checker, isDir, parent);
 
     if (result.ShouldDenyAccess())
     {
@@ -91,12 +116,56 @@ void TrustedBsdHandler::HandleProcessFork(const pid_t childProcessPid)
 
 void TrustedBsdHandler::HandleProcessExec(const vnode_t vp)
 {
-    // get the full path to 'vp' and save it to process->processName_
-    int len = MAXPATHLEN;
-    vn_getpath(vp, GetProcess()->getPathBuffer(), &len);
+    // get the full path to 'vp' (from the exec image cache of the pip, if it has exec'd 'vp' before) and make it the process path
+    SandboxedPip *pip = GetPip();
+    PolicySearchCursor cursor;
+    Buffer *path = pip->getCachedExecImage(vp, &cursor);
+    if (path != nullptr)
+    {
+        GetSandbox()->Counters()->numExecImageCacheHits++;
+        pip->Counters()->numExecImageCacheHits++;
+    }
+    else
+    {
+        GetSandbox()->Counters()->numExecImageCacheMisses++;
+        pip->Counters()->numExecImageCacheMisses++;
+
+        // read the generation first, so that a path computed concurrently with a rename is never considered valid
+        UInt32 generation = SandboxedPip::currentVNodePathGeneration();
+        char buffer[MAXPATHLEN];
+        int len = MAXPATHLEN;
+        if (vn_getpath(vp, buffer, &len) == 0 && len > 0)
+        {
+            path = Buffer::create(len);
+            if (path != nullptr)
+            {
+                memcpy(path->getBytes(), buffer, len);
+                path->getBytes()[len - 1] = '\0';
+
+                // the kauth check of the exec has usually resolved the policy of the image already
+                SandboxedPip::PathCacheScope cacheScope(pip);
+                CacheRecord *cacheRecord = pip->cacheGet(buffer);
+                if (cacheRecord == nullptr || !cacheRecord->GetPolicyCursor(&cursor))
+                {
+                    cursor = FindManifestRecord(buffer);
+                }
+
+                pip->cacheExecImage(vp, path, cursor, generation);
+            }
+        }
+    }
+
+    if (path != nullptr)
+    {
+        GetProcess()->setPath(path);
+        path->release();
+    }
 
     // report child process to clients only (tracking happens on 'fork's not 'exec's)
     ReportChildProcessSpawned(GetProcess()->getPid());
+
+    // top up the spare process objects consumed by the forks of this pip
+    SandboxedProcess::refillSpares(GetPip());
 }
 
 void TrustedBsdHandler::HandleProcessExit(const pid_t pid)
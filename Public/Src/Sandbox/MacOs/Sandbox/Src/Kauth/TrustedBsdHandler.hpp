@@ -13,11 +13,12 @@ public:
     TrustedBsdHandler(BuildXLSandbox *sandbox)
         : AccessHandler(sandbox) { }
 
-    int HandleLookup(const char *path);
+    int HandleLookup(const char *path, const ParentDirectory *parent = nullptr);
 
     int HandleReadlink(vnode_t symlinkVNode);
 
-    int HandleVNodeCreateEvent(const char *fullPath, const bool isDir, const bool isSymlink);
+    int HandleVNodeCreateEvent(const char *fullPath, const bool isDir, const bool isSymlink,
+                               const ParentDirectory *parent = nullptr);
 
     void HandleProcessWantsToFork(const pid_t parentProcessPid);
 
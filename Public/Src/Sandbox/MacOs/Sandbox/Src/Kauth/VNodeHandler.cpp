@@ -84,43 +84,29 @@ bool ConstructVNodeActionString(kauth_action_t action,
 {
     int numActions = sizeof(g_allActions)/sizeof(g_allActions[0]);
 
-    // pass 1: discover matches, store them in an array, compute total string size
-    int numMatches = 0;
-    int sumOfPresentFlagNameLengths = 0;
-    struct Match { char *name; size_t len; } matches[numActions];
+    // single pass: append the name of every matching flag (strlcpy/strlcat report the length they needed)
+    size_t length = 0;
+    size_t capacity = *resultLength;
+    if (capacity == 0) return false;
+
+    result[0] = '\0';
     for (int i = 0; i < numActions; i++) {
         if (HasAnyFlags(action, g_allActions[i].action)) {
-            char *name = GetName(g_allActions[i], isDir);
-            size_t nameLength = strlen(name);
-            matches[numMatches++] = { name, nameLength };
-            sumOfPresentFlagNameLengths += nameLength;
+            if (length > 0) {
+                length = strlcat(result, separator, capacity);
+            }
+            length = strlcat(result, GetName(g_allActions[i], isDir), capacity);
+            if (length >= capacity) return false;
         }
     }
 
-    // pass 2: construct the final string by iterating through matches
-    int sepLength = (int)strlen(separator);
-
-    int realResultLen = sumOfPresentFlagNameLengths + MAX(numMatches - 1, 0)*sepLength + 1;
-    if (realResultLen > *resultLength) return false;
-
-    *resultLength = realResultLen;
-    result[*resultLength - 1] = '\0';
-
-    char *dest = result;
-    for (int i = 0; i < numMatches; i++) {
-        if (i > 0) {
-            memcpy(dest, separator, sepLength);
-            dest += sepLength;
-        }
-        memcpy(dest, matches[i].name, matches[i].len);
-        dest += matches[i].len;
-    }
-
+    *resultLength = (int)length + 1;
     return true;
 }
 
 static kauth_action_t KAUTH_VNODE_PROBE_FLAGS = KAUTH_VNODE_READ_ATTRIBUTES | KAUTH_VNODE_READ_EXTATTRIBUTES | KAUTH_VNODE_READ_SECURITY;
 
+// ordered from the weakest to the strongest access (see 'AccessHandler::CheckAndReportMultiple')
 static FlagsToCheckFunc s_handlers[]
 {
     {
@@ -145,7 +131,50 @@ static FlagsToCheckFunc s_handlers[]
     }
 };
 
-static int s_handlersCount = sizeof(s_handlers)/sizeof(s_handlers[0]);
+#define kVNodeHandlerCount ((int)(sizeof(s_handlers)/sizeof(s_handlers[0])))
+
+/*!
+ * The handlers of 's_handlers' that apply to an action, indexed by the set of handlers (bit 'i' corresponds to
+ * 's_handlers[i]') whose flags the action has.  Filled in by 'VNodeHandler::InitializeDispatchTable', so that an
+ * event only needs to compute that set instead of scanning 's_handlers'.
+ */
+typedef struct {
+    int count;
+    OperationCheck checks[kVNodeHandlerCount];
+} VNodeDispatchEntry;
+
+static VNodeDispatchEntry s_dispatchTable[1 << kVNodeHandlerCount];
+
+void VNodeHandler::InitializeDispatchTable()
+{
+    for (int mask = 0; mask < (1 << kVNodeHandlerCount); mask++)
+    {
+        VNodeDispatchEntry *entry = &s_dispatchTable[mask];
+        entry->count = 0;
+        for (int i = 0; i < kVNodeHandlerCount; i++)
+        {
+            if (mask & (1 << i))
+            {
+                entry->checks[entry->count++] =
+                {
+                    .operation = s_handlers[i].operation,
+                    .checker   = s_handlers[i].checker
+                };
+            }
+        }
+    }
+}
+
+static inline const VNodeDispatchEntry* GetDispatchEntry(kauth_action_t action)
+{
+    int mask = 0;
+    for (int i = 0; i < kVNodeHandlerCount; i++)
+    {
+        mask |= HasAnyFlags(action, s_handlers[i].flags) ? (1 << i) : 0;
+    }
+
+    return &s_dispatchTable[mask];
+}
 
 int VNodeHandler::HandleVNodeEvent(const kauth_cred_t credential,
                                    const void *idata,
@@ -156,35 +185,45 @@ int VNodeHandler::HandleVNodeEvent(const kauth_cred_t credential,
                                    const uintptr_t arg3)
 {
     int len = MAXPATHLEN;
-    char path[MAXPATHLEN] = {0};
+    char pathBuffer[MAXPATHLEN] = {0};
+    const char *path = pathBuffer;
+
+    // an execute of an image the pip exec'd before: its path and policy are cached
+    PolicySearchCursor execImageCursor;
+    Buffer *execImagePath = HasAnyFlags(action, KAUTH_VNODE_EXECUTE) && !vnode_isdir(vp)
+        ? GetPip()->getCachedExecImage(vp, &execImageCursor)
+        : nullptr;
+    AutoRelease _(execImagePath);
 
-    int errno = vn_getpath(vp, path, &len);
-    if (errno != 0)
+    if (execImagePath != nullptr)
     {
-        return KAUTH_RESULT_DEFER;
+        path = execImagePath->getBytes();
     }
-
-    bool shouldDeny = false;
-
-    // even after the first match we have to continue looping because multiple flags can be set in a single action
-    for (int i = 0; i < s_handlersCount; i++)
+    else
     {
-        // skip over handlers that don't apply
-        if (!HasAnyFlags(action, s_handlers[i].flags))
+        int errno = vn_getpath(vp, pathBuffer, &len);
+        if (errno != 0)
         {
-            continue;
+            return KAUTH_RESULT_DEFER;
         }
-
-        AccessCheckResult checkResult = CheckAndReport(s_handlers[i].operation,
-                                                       path, s_handlers[i].checker,
-                                                       ctx, vp);
-
-        shouldDeny = shouldDeny || checkResult.ShouldDenyAccess();
     }
 
+    // multiple flags can be set in a single action, so multiple handlers may apply; they all share one policy lookup
+    const VNodeDispatchEntry *entry = GetDispatchEntry(action);
+    bool shouldDeny =
+        entry->count > 0 &&
+        CheckAndReportMultiple(entry->checks, entry->count, path, ctx, vp,
+                               execImagePath != nullptr ? &execImageCursor : nullptr).ShouldDenyAccess();
+
     if (shouldDeny)
     {
-        LogAccessDenied(path, action);
+        char actionString[256];
+        int actionStringLength = sizeof(actionString);
+        bool describeAction =
+            g_bxl_verbose_logging &&
+            ConstructVNodeActionString(action, vnode_isdir(vp), "|", actionString, &actionStringLength);
+
+        LogAccessDenied(path, action, describeAction ? actionString : "");
         return KAUTH_RESULT_DENY;
     }
     else
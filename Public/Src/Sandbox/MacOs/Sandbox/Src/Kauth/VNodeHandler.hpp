@@ -29,6 +29,9 @@ public:
 
     VNodeHandler(BuildXLSandbox *sandbox) : AccessHandler(sandbox) { }
 
+    /*! Precomputes which handlers apply to which actions; must be called once before any event is handled. */
+    static void InitializeDispatchTable();
+
     int HandleVNodeEvent(const kauth_cred_t credential,
                          const void *idata,
                          const kauth_action_t action,
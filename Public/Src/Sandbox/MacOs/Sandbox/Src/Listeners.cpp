@@ -16,7 +16,8 @@ int RELEVANT_KAUTH_VNODE_BITS =
 
 void *Listeners::g_dispatcher = nullptr;
 
-static int ComputeAbsolutePath(struct vnode *vp, const char *const relPath, size_t relPathLen, char *resultBuf, int resultBufLen)
+static int ComputeAbsolutePath(AccessHandler &handler, struct vnode *vp, const char *const relPath, size_t relPathLen, char *resultBuf, int resultBufLen,
+                               ParentDirectory *parent = nullptr)
 {
     assert(vp != nullptr);
     assert(relPath != nullptr);
@@ -27,7 +28,8 @@ static int ComputeAbsolutePath(struct vnode *vp, const char *const relPath, size
     // compute full path by getting the absolute path of 'vp' and appending the relative path 'relPath'
     int len = resultBufLen;
     int err = 0;
-    if ((err = vn_getpath(vp, resultBuf, &len)) != 0)
+    UInt32 generation = SandboxedPip::currentVNodePathGeneration();
+    if ((err = handler.GetDirectoryPath(vp, resultBuf, &len)) != 0)
     {
         return err;
     }
@@ -53,9 +55,26 @@ static int ComputeAbsolutePath(struct vnode *vp, const char *const relPath, size
     }
 
     resultBuf[len + relPathLen] = '\0';
+
+    if (parent != nullptr)
+    {
+        *parent = { .vnode = vp, .pathLength = (size_t)(len - 1), .generation = generation };
+    }
+
     return 0;
 }
 
+/*! Counts a kauth callback as in flight for as long as it is in scope, see 'BuildXLSandbox::UninitializeListeners' */
+class KauthCallbackScope
+{
+public:
+    KauthCallbackScope(BuildXLSandbox *sandbox) : sandbox_(sandbox) { sandbox_->EnterKauthCallback(); }
+    ~KauthCallbackScope()                                          { sandbox_->ExitKauthCallback(); }
+
+private:
+    BuildXLSandbox *sandbox_;
+};
+
 int Listeners::buildxl_file_op_listener(kauth_cred_t credential,
                                        void *idata,
                                        kauth_action_t action,
@@ -65,6 +84,13 @@ int Listeners::buildxl_file_op_listener(kauth_cred_t credential,
                                        uintptr_t arg3)
 {
     BuildXLSandbox *sandbox = OSDynamicCast(BuildXLSandbox, reinterpret_cast<OSObject *>(idata));
+    KauthCallbackScope inFlight(sandbox);
+
+    // renames and deletes (by any process) can change the paths of cached directories
+    if (action == KAUTH_FILEOP_RENAME || action == KAUTH_FILEOP_DELETE)
+    {
+        SandboxedPip::invalidateVNodePaths();
+    }
 
     FileOpHandler fileOpHandler = FileOpHandler(sandbox);
     if (!fileOpHandler.TryInitializeWithTrackedProcess(proc_selfpid()))
@@ -100,6 +126,7 @@ int Listeners::buildxl_vnode_listener(kauth_cred_t credential,
     }
 
     BuildXLSandbox *sandbox = OSDynamicCast(BuildXLSandbox, reinterpret_cast<OSObject *>(idata));
+    KauthCallbackScope inFlight(sandbox);
 
     VNodeHandler handler = VNodeHandler(sandbox);
     if (!handler.TryInitializeWithTrackedProcess(proc_selfpid()))
@@ -129,14 +156,15 @@ int Listeners::mpo_vnode_check_lookup_pre(kauth_cred_t cred,
 
         size_t pathlen = strnlen(path, MAXPATHLEN);
         char fullpath[MAXPATHLEN] = {0};
-        int errorCode = ComputeAbsolutePath(dvp, path, pathlen, fullpath, sizeof(fullpath));
+        ParentDirectory parent;
+        int errorCode = ComputeAbsolutePath(handler, dvp, path, pathlen, fullpath, sizeof(fullpath), &parent);
         if (errorCode != 0)
         {
             log_error("Could not get vnode path, error code: %#X", errorCode);
             break;
         }
 
-        handler.HandleLookup(fullpath);
+        handler.HandleLookup(fullpath, &parent);
     } while(false);
 
     return KERN_SUCCESS;
@@ -236,11 +264,12 @@ int Listeners::mpo_vnode_check_create(kauth_cred_t cred,
     {
         // compute full path by getting the absolute path of 'dvp' and appending the component name provided by 'cnp'
         char path[MAXPATHLEN] = {0};
-        ComputeAbsolutePath(dvp, cnp->cn_nameptr, cnp->cn_namelen, path, sizeof(path));
+        ParentDirectory parent;
+        int err = ComputeAbsolutePath(handler, dvp, cnp->cn_nameptr, cnp->cn_namelen, path, sizeof(path), &parent);
 
         bool isDir = vap->va_type == VDIR;
         bool isSymlink = vap->va_type == VLNK;
-        return handler.HandleVNodeCreateEvent(path, isDir, isSymlink);
+        return handler.HandleVNodeCreateEvent(path, isDir, isSymlink, err == 0 ? &parent : nullptr);
     }
 
     return KERN_SUCCESS;
@@ -1,8 +1,12 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <kern/clock.h>
+#include <mach/mach_host.h>
 #include "ResourceManager.hpp"
 
+extern "C" host_priv_t host_priv_self(void);
+
 #define super OSObject
 
 OSDefineMetaClassAndStructors(ResourceManager, OSObject)
@@ -30,12 +34,15 @@ bool ResourceManager::init(ResourceCounters *counters)
 
     thresholds_ =
     {
-        .cpuUsageBlock     = {0},
-        .cpuUsageWakeup    = {0},
-        .minAvailableRamMB = 0,
+        .cpuUsageBlock       = {0},
+        .cpuUsageWakeup      = {0},
+        .minAvailableRamMB   = 0,
+        .ramWakeupMarginMB   = 0,
+        .cpuSampleIntervalMs = 0,
     };
 
     counters_ = counters;
+    counters_->ramPerProcessMB = kInitialRamPerProcessMB;
 
     procBarrier_ = IOLockAlloc();
     if (procBarrier_ == nullptr)
@@ -73,11 +80,44 @@ static bool shouldThrottle(basis_points value, percent threshold)
     return isThresholdValid(threshold) && !isBelowThreshold(value, threshold);
 }
 
-inline bool ResourceManager::shouldThrottleProcesses() const
+bool ResourceManager::shouldThrottleProcesses(bool forWakeup) const
 {
+    uint minAvailableRamMB = forWakeup ? thresholds_.GetMinAvailableRamForWakeup() : thresholds_.minAvailableRamMB;
+    percent cpuUsageThreshold = forWakeup ? thresholds_.GetCpuUsageForWakeup() : thresholds_.cpuUsageBlock;
     return
-        counters_->availableRamMB < thresholds_.minAvailableRamMB ||
-        shouldThrottle(counters_->cpuUsage, thresholds_.cpuUsageBlock);
+        counters_->availableRamMB < minAvailableRamMB ||
+        shouldThrottle(counters_->cpuUsage, cpuUsageThreshold);
+}
+
+uint ResourceManager::getFreeCapacity() const
+{
+    if (shouldThrottleProcesses(/* forWakeup */ true))
+    {
+        return 0;
+    }
+
+    uint numProcesses = counters_->numTrackedProcesses > 0 ? counters_->numTrackedProcesses : 1;
+    uint capacity     = UINT_MAX;
+
+    percent cpuUsageWakeup = thresholds_.GetCpuUsageForWakeup();
+    if (isThresholdValid(thresholds_.cpuUsageBlock) && isThresholdValid(cpuUsageWakeup))
+    {
+        uint cpuUsage      = counters_->cpuUsage.value;
+        uint cpuPerProcess = cpuUsage / numProcesses > 0 ? cpuUsage / numProcesses : 1;
+        capacity = min(capacity, (cpuUsageWakeup.value * 100 - cpuUsage) / cpuPerProcess);
+    }
+
+    uint minAvailableRamMB = thresholds_.GetMinAvailableRamForWakeup();
+    if (minAvailableRamMB > 0)
+    {
+        uint ramPerProcessMB = counters_->ramPerProcessMB > 0 ? counters_->ramPerProcessMB : 1;
+        capacity = min(capacity, (counters_->availableRamMB - minAvailableRamMB) / ramPerProcessMB);
+    }
+
+    // neither resource is above its wakeup threshold, so there is always room for at least one more process
+    capacity = max(capacity, 1u);
+
+    return capacity > numAdmittedSinceSample_ ? capacity - numAdmittedSinceSample_ : 0;
 }
 
 inline bool ResourceManager::IsProcessThrottlingEnabled() const
@@ -87,13 +127,19 @@ inline bool ResourceManager::IsProcessThrottlingEnabled() const
         isThresholdValid(thresholds_.cpuUsageBlock);
 }
 
+void ResourceManager::SetThresholds(ResourceThresholds thresholds)
+{
+    thresholds_ = thresholds;
+    lastCpuSampleTime_ = 0;
+}
+
 void ResourceManager::UpdateNumTrackedProcesses(uint newCount)
 {
     uint oldCount = counters_->numTrackedProcesses;
     OSCompareAndSwap(oldCount, newCount, &counters_->numTrackedProcesses);
     if (newCount < oldCount)
     {
-        wakeupBlockedProcesses(/* justOne */ newCount == oldCount - 1);
+        wakeupBlockedProcesses();
     }
 }
 
@@ -101,20 +147,97 @@ void ResourceManager::UpdateCpuUsage(basis_points cpuUsage)
 {
     basis_points oldCpuUsage = counters_->cpuUsage;
     OSCompareAndSwap(oldCpuUsage.value, cpuUsage.value, &counters_->cpuUsage.value);
-    if (isBelowThreshold(cpuUsage, thresholds_.GetCpuUsageForWakeup()))
-    {
-        wakeupBlockedProcesses(/* justOne */ true);
-    }
+
+    // processes admitted so far are now reflected in the current usage; a racing admission is
+    // at worst counted towards the next sample instead of this one
+    numAdmittedSinceSample_ = 0;
+    wakeupBlockedProcesses();
 }
 
 void ResourceManager::UpdateAvailableRam(uint availableRamMB)
 {
     uint oldRam = counters_->availableRamMB;
     OSCompareAndSwap(oldRam, availableRamMB, &counters_->availableRamMB);
-    if (availableRamMB > oldRam)
+
+    // RAM is only ever updated by the client, one sample at a time, so the estimate needs no synchronization:
+    // whenever the number of tracked processes grew and available RAM dropped, attribute the drop to the new processes
+    uint numProcesses = counters_->numTrackedProcesses;
+    if (numProcesses > lastSampleNumProcesses_ && availableRamMB < lastSampleRamMB_)
+    {
+        uint ramPerNewProcessMB = (lastSampleRamMB_ - availableRamMB) / (numProcesses - lastSampleNumProcesses_);
+        counters_->ramPerProcessMB = (3 * counters_->ramPerProcessMB + ramPerNewProcessMB) / 4;
+    }
+
+    lastSampleRamMB_        = availableRamMB;
+    lastSampleNumProcesses_ = numProcesses;
+
+    numAdmittedSinceSample_ = 0;
+    wakeupBlockedProcesses();
+}
+
+bool ResourceManager::ShouldShrinkCaches() const
+{
+    return thresholds_.cacheShrinkRamMB > 0 && counters_->availableRamMB < thresholds_.cacheShrinkRamMB;
+}
+
+void ResourceManager::sampleCpuUsageIfDue()
+{
+    if (thresholds_.cpuSampleIntervalMs == 0)
+    {
+        return;
+    }
+
+    uint64_t interval;
+    clock_interval_to_absolutetime_interval(thresholds_.cpuSampleIntervalMs, kMillisecondScale, &interval);
+
+    UInt64 now  = mach_absolute_time();
+    UInt64 last = lastCpuSampleTime_;
+    if (now - last < interval || !OSCompareAndSwap64(last, now, &lastCpuSampleTime_))
+    {
+        // either the last sample is recent enough or another thread is taking a new one right now
+        return;
+    }
+
+    host_cpu_load_info_data_t load;
+    mach_msg_type_number_t count = HOST_CPU_LOAD_INFO_COUNT;
+    if (host_statistics(host_priv_self(), HOST_CPU_LOAD_INFO, (host_info_t)&load, &count) != KERN_SUCCESS)
+    {
+        return;
+    }
+
+    uint64_t busyTicks =
+        load.cpu_ticks[CPU_STATE_USER] +
+        load.cpu_ticks[CPU_STATE_SYSTEM] +
+        load.cpu_ticks[CPU_STATE_NICE];
+    uint64_t totalTicks = busyTicks + load.cpu_ticks[CPU_STATE_IDLE];
+
+    uint64_t elapsedTicks = totalTicks - lastCpuTotalTicks_;
+    uint64_t elapsedBusyTicks = busyTicks - lastCpuBusyTicks_;
+    lastCpuBusyTicks_  = busyTicks;
+    lastCpuTotalTicks_ = totalTicks;
+
+    if (elapsedTicks > 0)
+    {
+        UpdateCpuUsage({ .value = (uint)(elapsedBusyTicks * 10000 / elapsedTicks) });
+    }
+}
+
+bool ResourceManager::tryAdmitProcess()
+{
+    if (getFreeCapacity() == 0)
+    {
+        return false;
+    }
+
+    numAdmittedSinceSample_++;
+
+    // stop throttling once nobody is waiting any longer and both resources are within their wakeup thresholds
+    if (counters_->numBlockedProcesses == 0 && !shouldThrottleProcesses(/* forWakeup */ true))
     {
-        wakeupBlockedProcesses(/* justOne */ true);
+        throttling_ = false;
     }
+
+    return true;
 }
 
 void ResourceManager::WaitForCpu()
@@ -123,24 +246,65 @@ void ResourceManager::WaitForCpu()
     {
         return;
     }
-    
-    if (shouldThrottleProcesses())
+
+    sampleCpuUsageIfDue();
+
+    if (!throttling_ && !shouldThrottleProcesses(/* forWakeup */ false))
+    {
+        return;
+    }
+
+    IOLockLock(procBarrier_);
+    throttling_ = true;
+    while (!tryAdmitProcess())
     {
-        IOLockLock(procBarrier_);
-        while (shouldThrottleProcesses())
+        OSIncrementAtomic(&counters_->numBlockedProcesses);
+        if (thresholds_.cpuSampleIntervalMs > 0)
+        {
+            // nobody pushes CPU usage updates, so wake up periodically to take a new sample
+            uint64_t deadline;
+            clock_interval_to_deadline(thresholds_.cpuSampleIntervalMs, kMillisecondScale, &deadline);
+            IOLockSleepDeadline(procBarrier_, this, deadline, THREAD_INTERRUPTIBLE);
+        }
+        else
         {
-            OSIncrementAtomic(&counters_->numBlockedProcesses);
             IOLockSleep(procBarrier_, this, THREAD_INTERRUPTIBLE);
-            OSDecrementAtomic(&counters_->numBlockedProcesses);
         }
-        IOLockUnlock(procBarrier_);
+        OSDecrementAtomic(&counters_->numBlockedProcesses);
+
+        if (thresholds_.cpuSampleIntervalMs > 0)
+        {
+            // sampling wakes up blocked processes, which requires the lock
+            IOLockUnlock(procBarrier_);
+            sampleCpuUsageIfDue();
+            IOLockLock(procBarrier_);
+        }
     }
+    IOLockUnlock(procBarrier_);
 }
 
-void ResourceManager::wakeupBlockedProcesses(bool justOne)
+void ResourceManager::wakeupBlockedProcesses()
 {
-    if (procBarrier_ != nullptr && counters_->numBlockedProcesses > 0 && !shouldThrottleProcesses())
+    if (procBarrier_ == nullptr || counters_->numBlockedProcesses == 0)
+    {
+        return;
+    }
+
+    // admit blocked processes in proportion to the free capacity instead of one at a time; the awakened processes
+    // claim their admission in 'tryAdmitProcess', so waking up too many only costs them going back to sleep
+    IOLockLock(procBarrier_);
+    uint numBlocked = counters_->numBlockedProcesses;
+    uint capacity   = getFreeCapacity();
+    if (capacity >= numBlocked)
     {
-        IOLockWakeup(procBarrier_, this, justOne);
+        IOLockWakeup(procBarrier_, this, /*oneThread*/ false);
+    }
+    else
+    {
+        for (uint i = 0; i < capacity; i++)
+        {
+            IOLockWakeup(procBarrier_, this, /*oneThread*/ true);
+        }
     }
+    IOLockUnlock(procBarrier_);
 }
@@ -10,13 +10,22 @@
 
 #define ResourceManager BXL_CLASS(ResourceManager)
 
+// RAM footprint assumed for a tracked process until one has been observed (see 'ResourceManager::UpdateAvailableRam')
+#define kInitialRamPerProcessMB 64
+
 /*!
  * This class is where resource usage information is collected and where all the decisions are made
  * regarding any throttling due to insufficient available resources.
  *
  * This class relies on being externally notified whenever
  *   - number of tracked processes changed (see 'UpdateNumTrackedProcesses')
- *   - CPU/RAM usage changed (see 'Update{Cpu|Ram}Usage')
+ *   - CPU/RAM usage changed (see 'Update{Cpu|Ram}Usage'); CPU usage can instead be sampled
+ *     by this class itself (see 'ResourceThresholds::cpuSampleIntervalMs').
+ *
+ * Throttling starts when either resource crosses its blocking threshold and lasts until both resources
+ * are back within their (stricter) wakeup thresholds.  While throttling, forking processes are admitted
+ * in proportion to the free capacity left until the wakeup thresholds, estimated from the per-process
+ * CPU/RAM usage observed so far, minus the processes already admitted since the last resource sample.
  */
 class ResourceManager : public OSObject
 {
@@ -27,6 +36,21 @@ private:
     IOLock *procBarrier_;
     ResourceThresholds thresholds_;
 
+    /*! Whether processes are currently being throttled; cleared once no process is blocked and there is capacity */
+    volatile bool throttling_;
+
+    /*! Number of processes admitted since the last resource sample (their usage isn't reflected in it yet) */
+    uint numAdmittedSinceSample_;
+
+    /*! Available RAM and number of tracked processes at the last RAM sample */
+    uint lastSampleRamMB_;
+    uint lastSampleNumProcesses_;
+
+    /*! State of the in-kext CPU sampling (see 'sampleCpuUsageIfDue') */
+    volatile UInt64 lastCpuSampleTime_;
+    uint64_t lastCpuBusyTicks_;
+    uint64_t lastCpuTotalTicks_;
+
     /*!
      * Shared counters (with all other clients) for counting the number of active/pending/blocked processes.
      *
@@ -35,19 +59,34 @@ private:
     ResourceCounters *counters_;
 
     /*!
-     * Wakes up one or more blocked processes if the throttling condition
-     * (see 'shouldThrottleProcesses') is not met any longer.
-     *
-     * @param justOne Whether to wake up one or all blocked processes.
+     * Wakes up as many blocked processes as there is free capacity for (see 'getFreeCapacity').
      */
-    void wakeupBlockedProcesses(bool justOne);
+    void wakeupBlockedProcesses();
 
     /*!
      * Returns whether the condition for throttling processes is met, which is:
-     *   - current CPU usage is greater or equal than the cpu usage threshold, AND
-     *   - current number of tracked processes is greater or equal than the tracked processes threshold.
+     *   - current available RAM is below the minimum available RAM threshold, OR
+     *   - current CPU usage is greater or equal than the cpu usage threshold.
+     *
+     * @param forWakeup Whether to use the wakeup thresholds instead of the blocking thresholds.
+     */
+    bool shouldThrottleProcesses(bool forWakeup) const;
+
+    /*!
+     * Returns how many more processes can be started before the wakeup thresholds are reached,
+     * not counting the processes already admitted since the last resource sample.
+     */
+    uint getFreeCapacity() const;
+
+    /*!
+     * Admits the current process if there is free capacity.  Must be called with 'procBarrier_' held.
+     */
+    bool tryAdmitProcess();
+
+    /*!
+     * Samples CPU usage if in-kext sampling is enabled and the last sample is older than the sampling interval.
      */
-    bool shouldThrottleProcesses() const;
+    void sampleCpuUsageIfDue();
 
 protected:
 
@@ -69,7 +108,7 @@ public:
      * Should be called once upon creation to set the thresholds.
      * If not called at all, the default threasholds amount to no throttling.
      */
-    void SetThresholds(ResourceThresholds thresholds) { thresholds_ = thresholds; }
+    void SetThresholds(ResourceThresholds thresholds);
 
     /*!
      * Should be called whenever the number of tracked processes changed.
@@ -87,9 +126,15 @@ public:
     void UpdateAvailableRam(uint availableRamMB);
 
     /*!
-     * Blocks the current thread if 'IsProcessThrottlingEnabled()' and 'ShouldThrottleProcesses()' are both true.
+     * Returns whether available RAM, as last updated, is below 'ResourceThresholds::cacheShrinkRamMB', in which case
+     * the caches of the pips should shed their cold entries.
+     */
+    bool ShouldShrinkCaches() const;
+
+    /*!
+     * Blocks the current thread if 'IsProcessThrottlingEnabled()' and processes are being throttled.
      *
-     * The blocked thread will be awakened whenever that condition changes.
+     * The blocked thread will be awakened and admitted once there is free capacity for it.
      *
      * NOTE: should not be called from an interrupt routine, or everything will grind to a halt.
      */
@@ -7,7 +7,12 @@
 
 OSDefineMetaClassAndStructors(SandboxedPip, OSObject)
 
-bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
+volatile UInt32 SandboxedPip::s_vnodePathGeneration = 0;
+
+Trie *SandboxedPip::s_manifestTrees       = nullptr;
+IOLock *SandboxedPip::s_manifestTreesLock = nullptr;
+
+bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload, uint pathCacheBudget)
 {
     if (!super::init())
     {
@@ -18,6 +23,10 @@ bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
     payload_          = payload;
     processId_        = processPid;
     processTreeCount_ = 1;
+    numPriorityReports_ = 0;
+    reportTokens_     = 0;
+    reportTokensRefilledAt_ = 0;
+    reportRateExceeded_ = 0;
     counters_         = {0};
 
     payload_->retain();
@@ -29,14 +38,54 @@ bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
         return false;
     }
 
-    pathCache_ = Trie::createPathTrie();
+    shareManifestTree();
+    computeLookupReportPrefixes();
+
+    pathCacheBudget_ = pathCacheBudget;
+    pathCache_       = Trie::createPathTrie(OSTypeID(CacheRecord));
     if (!pathCache_)
     {
         return false;
     }
     
-    lastPathLookup_ = ThreadLocal::create();
-    if (!lastPathLookup_)
+    lastLookupSlots_ = IONewZero(LastLookupSlot, kLastLookupSlotCount);
+    if (!lastLookupSlots_)
+    {
+        return false;
+    }
+
+    vnodePathCache_ = IONewZero(VNodePathEntry, kVNodePathCacheSize);
+    if (!vnodePathCache_)
+    {
+        return false;
+    }
+
+    dirCursorCache_ = IONewZero(DirCursorEntry, kDirCursorCacheSize);
+    if (!dirCursorCache_)
+    {
+        return false;
+    }
+
+    readlinkCache_ = IONewZero(ReadlinkEntry, kReadlinkCacheSize);
+    if (!readlinkCache_)
+    {
+        return false;
+    }
+
+    hardLinkCache_ = IONewZero(VNodePathEntry, kHardLinkCacheSize);
+    if (!hardLinkCache_)
+    {
+        return false;
+    }
+
+    execImageCache_ = IONewZero(ExecImageEntry, kExecImageCacheSize);
+    if (!execImageCache_)
+    {
+        return false;
+    }
+
+    execImageCacheLock_ = IOLockAlloc();
+    if (!execImageCacheLock_)
     {
         return false;
     }
@@ -46,22 +95,804 @@ bool SandboxedPip::init(pid_t clientPid, pid_t processPid, Buffer *payload)
 
 void SandboxedPip::free()
 {
-    if (pathCache_ != nullptr && lastPathLookup_ != nullptr)
+    if (pathCache_ != nullptr)
     {
         log_verbose(
             g_bxl_verbose_logging,
-           "Process Stats PID(%d) :: #cache hits = %d, #cache misses = %d, cache size = %d, thread local size = %d",
+           "Process Stats PID(%d) :: #cache hits = %d, #cache misses = %d, cache size = %d, #cache evictions = %d",
             processId_, counters_.numCacheHits.count(), counters_.numCacheMisses.count(),
-            pathCache_->getCount(), lastPathLookup_->getCount());
+            getCacheSize(), numCacheEvictions_);
+    }
+
+    if (lastLookupSlots_ != nullptr)
+    {
+        IODelete(lastLookupSlots_, LastLookupSlot, kLastLookupSlotCount);
+        lastLookupSlots_ = nullptr;
+    }
+
+    if (vnodePathCache_ != nullptr)
+    {
+        IODelete(vnodePathCache_, VNodePathEntry, kVNodePathCacheSize);
+        vnodePathCache_ = nullptr;
+    }
+
+    if (dirCursorCache_ != nullptr)
+    {
+        IODelete(dirCursorCache_, DirCursorEntry, kDirCursorCacheSize);
+        dirCursorCache_ = nullptr;
     }
 
+    if (readlinkCache_ != nullptr)
+    {
+        IODelete(readlinkCache_, ReadlinkEntry, kReadlinkCacheSize);
+        readlinkCache_ = nullptr;
+    }
+
+    if (hardLinkCache_ != nullptr)
+    {
+        IODelete(hardLinkCache_, VNodePathEntry, kHardLinkCacheSize);
+        hardLinkCache_ = nullptr;
+    }
+
+    if (execImageCache_ != nullptr)
+    {
+        for (int i = 0; i < kExecImageCacheSize; i++)
+        {
+            OSSafeReleaseNULL(execImageCache_[i].path);
+        }
+
+        IODelete(execImageCache_, ExecImageEntry, kExecImageCacheSize);
+        execImageCache_ = nullptr;
+    }
+
+    if (execImageCacheLock_ != nullptr)
+    {
+        IOLockFree(execImageCacheLock_);
+        execImageCacheLock_ = nullptr;
+    }
+
+    if (manifestTree_ != nullptr)
+    {
+        releaseManifestTree(manifestTree_, manifestTreeHash_);
+        manifestTree_ = nullptr;
+    }
+
+    for (int i = 0; i < kSpareProcessCount; i++)
+    {
+        OSObject *spare = spareProcesses_[i];
+        OSSafeReleaseNULL(spare);
+        spareProcesses_[i] = nullptr;
+    }
+
+    OSSafeReleaseNULL(client_);
     OSSafeReleaseNULL(payload_);
-    OSSafeReleaseNULL(lastPathLookup_);
     OSSafeReleaseNULL(pathCache_);
+    OSSafeReleaseNULL(oldPathCache_);
+    OSSafeReleaseNULL(retiredPathCache_);
     super::free();
 }
 
-SandboxedPip* SandboxedPip::create(pid_t clientPid, pid_t processPid, Buffer *payload)
+/*! A lookup is checked as a probe of a nonexistent file (see 'Checkers::CheckLookup') */
+static bool PolicyMayReportLookup(FileAccessPolicy policy, bool reportUnexpectedAccesses)
+{
+    return
+        (policy & FileAccessPolicy_ReportAccessIfNonExistent) != 0 ||
+        (reportUnexpectedAccesses && (policy & FileAccessPolicy_AllowReadIfNonExistent) == 0);
+}
+
+/*! Size of the explicit stack used to walk a subtree; subtrees too big to walk are conservatively considered relevant */
+#define kLookupFilterStackSize 512
+
+static bool SubtreeMayReportLookup(PCManifestRecord root, bool reportUnexpectedAccesses, PCManifestRecord *stack)
+{
+    int top = 0;
+    stack[top++] = root;
+    while (top > 0)
+    {
+        PCManifestRecord node = stack[--top];
+        if (PolicyMayReportLookup(node->GetConePolicy(), reportUnexpectedAccesses) ||
+            PolicyMayReportLookup(node->GetNodePolicy(), reportUnexpectedAccesses))
+        {
+            return true;
+        }
+
+        for (uint32_t i = 0; i < node->GetBucketCount(); i++)
+        {
+            PCManifestRecord child = node->GetChildRecord(i);
+            if (child == nullptr)
+            {
+                continue;
+            }
+
+            if (top == kLookupFilterStackSize)
+            {
+                return true;
+            }
+
+            stack[top++] = child;
+        }
+    }
+
+    return false;
+}
+
+void SandboxedPip::computeLookupReportPrefixes()
+{
+    numLookupReportPrefixes_ = -1;
+
+    FileAccessManifestFlag flags = getFamFlags();
+    PCManifestRecord unixRoot    = getManifestRecord();
+    bool reportUnexpected        = CheckReportAllFileUnexpectedAccesses(flags);
+    if (unixRoot == nullptr ||
+        CheckReportAllFileAccesses(flags) ||
+        PolicyMayReportLookup(unixRoot->GetConePolicy(), reportUnexpected) ||
+        PolicyMayReportLookup(unixRoot->GetNodePolicy(), reportUnexpected))
+    {
+        return;
+    }
+
+    PCManifestRecord *stack = IONew(PCManifestRecord, kLookupFilterStackSize);
+    if (stack == nullptr)
+    {
+        return;
+    }
+
+    int count = 0;
+    for (uint32_t i = 0; i < unixRoot->GetBucketCount(); i++)
+    {
+        PCManifestRecord child = unixRoot->GetChildRecord(i);
+        if (child == nullptr || !SubtreeMayReportLookup(child, reportUnexpected, stack))
+        {
+            continue;
+        }
+
+        if (count == kMaxLookupReportPrefixes)
+        {
+            // too many relevant prefixes for the filter to pay off
+            count = -1;
+            break;
+        }
+
+        lookupReportPrefixes_[count++] = child;
+    }
+
+    IODelete(stack, PCManifestRecord, kLookupFilterStackSize);
+    numLookupReportPrefixes_ = count;
+}
+
+bool SandboxedPip::mayReportLookup(const char *absolutePath) const
+{
+    if (numLookupReportPrefixes_ < 0 || absolutePath[0] != '/')
+    {
+        return true;
+    }
+
+    const char *component = absolutePath + 1;
+    const char *end       = strchr(component, '/');
+    size_t length         = end != nullptr ? end - component : strlen(component);
+    if (length == 0)
+    {
+        // the root itself (whose policies were checked in 'computeLookupReportPrefixes')
+        return false;
+    }
+
+    PCManifestRecord child;
+    if (!getManifestRecord()->FindChild(component, length, child))
+    {
+        // the path falls under the policy of the root
+        return false;
+    }
+
+    for (int i = 0; i < numLookupReportPrefixes_; i++)
+    {
+        if (lookupReportPrefixes_[i] == child)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+OSObject* SandboxedPip::takeSpareProcess()
+{
+    for (int i = 0; i < kSpareProcessCount; i++)
+    {
+        OSObject *spare = spareProcesses_[i];
+        if (spare != nullptr && OSCompareAndSwapPtr(spare, nullptr, (void * volatile *)&spareProcesses_[i]))
+        {
+            return spare;
+        }
+    }
+
+    return nullptr;
+}
+
+bool SandboxedPip::addSpareProcess(OSObject *process)
+{
+    for (int i = 0; i < kSpareProcessCount; i++)
+    {
+        if (spareProcesses_[i] == nullptr && OSCompareAndSwapPtr(nullptr, process, (void * volatile *)&spareProcesses_[i]))
+        {
+            process->retain();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int SandboxedPip::getMissingSpareProcessCount() const
+{
+    int count = 0;
+    for (int i = 0; i < kSpareProcessCount; i++)
+    {
+        count += spareProcesses_[i] == nullptr ? 1 : 0;
+    }
+
+    return count;
+}
+
+void SandboxedPip::setClientInfo(ClientInfo *client)
+{
+    if (client != nullptr)
+    {
+        client->retain();
+    }
+
+    OSSafeReleaseNULL(client_);
+    client_ = client;
+}
+
+UInt32 SandboxedPip::enterPathCache() const
+{
+    while (true)
+    {
+        UInt32 generation = pathCacheGeneration_;
+        OSIncrementAtomic(&pathCacheReaders_[generation & 1]);
+        OSMemoryBarrier();
+
+        // a new generation started in the meantime: register with that one instead
+        if (pathCacheGeneration_ == generation)
+        {
+            return generation;
+        }
+
+        OSDecrementAtomic(&pathCacheReaders_[generation & 1]);
+    }
+}
+
+void SandboxedPip::exitPathCache(UInt32 generation) const
+{
+    OSDecrementAtomic(&pathCacheReaders_[generation & 1]);
+}
+
+CacheRecord* SandboxedPip::cacheGet(const char *path)
+{
+    Trie *current = pathCache_;
+    CacheRecord *record = current->getExistingTyped<CacheRecord>(path);
+    if (record != nullptr)
+    {
+        return record;
+    }
+
+    Trie *old = oldPathCache_;
+    record = old != nullptr ? old->getExistingTyped<CacheRecord>(path) : nullptr;
+    if (record != nullptr)
+    {
+        // the path is still in use: move it into the current generation (if someone else already did, use theirs)
+        if (current->insert(path, record) == Trie::TrieResult::kTrieResultAlreadyExists)
+        {
+            record = current->getExistingTyped<CacheRecord>(path);
+        }
+
+        evictPathCacheIfNeeded();
+    }
+
+    return record;
+}
+
+CacheRecord* SandboxedPip::cacheLookup(const char *path)
+{
+    CacheRecord *record = cacheGet(path);
+    if (record != nullptr)
+    {
+        return record;
+    }
+
+    record = pathCache_->getOrAddTyped<CacheRecord>(path, nullptr, CacheRecordFactory);
+    evictPathCacheIfNeeded();
+    return record;
+}
+
+uint SandboxedPip::getCacheSize() const
+{
+    PathCacheScope scope(this);
+    Trie *old = oldPathCache_;
+    return pathCache_->getCount() + (old != nullptr ? old->getCount() : 0);
+}
+
+bool SandboxedPip::releaseRetiredPathCache()
+{
+    Trie *retired = retiredPathCache_;
+    if (retired == nullptr)
+    {
+        return true;
+    }
+
+    // readers that may still see 'retired' are registered with the generation before the current one
+    if (pathCacheReaders_[(pathCacheGeneration_ - 1) & 1] != 0)
+    {
+        return false;
+    }
+
+    retiredPathCache_ = nullptr;
+    retired->release();
+    return true;
+}
+
+void SandboxedPip::evictPathCacheIfNeeded()
+{
+    if (pathCacheBudget_ == 0 || (retiredPathCache_ == nullptr && pathCache_->getCount() < pathCacheBudget_ / 2))
+    {
+        return;
+    }
+
+    if (!OSCompareAndSwap(0, 1, &pathCacheEvicting_))
+    {
+        return;
+    }
+
+    if (releaseRetiredPathCache() && pathCache_->getCount() >= pathCacheBudget_ / 2)
+    {
+        startPathCacheGeneration();
+    }
+
+    OSMemoryBarrier();
+    pathCacheEvicting_ = 0;
+}
+
+uint SandboxedPip::startPathCacheGeneration()
+{
+    Trie *fresh = Trie::createPathTrie(OSTypeID(CacheRecord));
+    if (fresh == nullptr)
+    {
+        return 0;
+    }
+
+    Trie *evicted = oldPathCache_;
+
+    oldPathCache_      = pathCache_;
+    pathCache_         = fresh;
+    retiredPathCache_  = evicted;
+    OSMemoryBarrier();
+    OSIncrementAtomic((volatile SInt32*)&pathCacheGeneration_);
+
+    if (evicted == nullptr)
+    {
+        return 0;
+    }
+
+    uint numEvicted = evicted->getCount();
+    OSIncrementAtomic(&numCacheEvictions_);
+    OSAddAtomic64(numEvicted, &numEvictedPaths_);
+    return numEvicted;
+}
+
+uint SandboxedPip::shrinkPathCache(uint floor)
+{
+    if (!OSCompareAndSwap(0, 1, &pathCacheEvicting_))
+    {
+        // an eviction is under way already
+        return 0;
+    }
+
+    uint numShed = 0;
+    if (releaseRetiredPathCache() && getCacheSize() > floor)
+    {
+        numShed = startPathCacheGeneration();
+
+        // the readers of the evicted generation are usually gone by now; free it right away rather than on the next eviction
+        releaseRetiredPathCache();
+    }
+
+    OSMemoryBarrier();
+    pathCacheEvicting_ = 0;
+    return numShed;
+}
+
+bool SandboxedPip::InitializeManifestTrees()
+{
+    s_manifestTreesLock = IOLockAlloc();
+    s_manifestTrees     = Trie::createUintTrie();
+    return s_manifestTreesLock != nullptr && s_manifestTrees != nullptr;
+}
+
+void SandboxedPip::FreeManifestTrees()
+{
+    OSSafeReleaseNULL(s_manifestTrees);
+    if (s_manifestTreesLock != nullptr)
+    {
+        IOLockFree(s_manifestTreesLock);
+        s_manifestTreesLock = nullptr;
+    }
+}
+
+static uint32_t HashManifestTree(const BYTE *tree, size_t size)
+{
+    // FNV-1a, folded to 32 bits to keep the uint trie shallow (collisions are checked for)
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ tree[i]) * 0x100000001b3ull;
+    }
+
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+Buffer* SandboxedPip::internManifestTree(const BYTE *tree, size_t size, uint32_t hash)
+{
+    IOLockLock(s_manifestTreesLock);
+
+    Buffer *shared = s_manifestTrees->getAs<Buffer>(hash);
+    if (shared != nullptr)
+    {
+        // on a hash collision, the second tree is simply not shared
+        shared = shared->getSize() == size && memcmp(shared->getBytes(), tree, size) == 0 ? shared : nullptr;
+        if (shared != nullptr)
+        {
+            shared->retain();
+        }
+    }
+    else
+    {
+        shared = Buffer::create(size);
+        if (shared != nullptr)
+        {
+            memcpy(shared->getBytes(), tree, size);
+            if (s_manifestTrees->insert(hash, shared) != Trie::TrieResult::kTrieResultInserted)
+            {
+                OSSafeReleaseNULL(shared);
+            }
+        }
+    }
+
+    IOLockUnlock(s_manifestTreesLock);
+    return shared;
+}
+
+void SandboxedPip::releaseManifestTree(Buffer *tree, uint32_t hash)
+{
+    if (s_manifestTreesLock == nullptr)
+    {
+        // the table is already gone (and has released its references)
+        tree->release();
+        return;
+    }
+
+    IOLockLock(s_manifestTreesLock);
+
+    // the table and the calling pip hold the last two references --> no other pip uses this tree
+    if (tree->getRetainCount() == 2 && s_manifestTrees->getAs<Buffer>(hash) == tree)
+    {
+        s_manifestTrees->remove(hash);
+    }
+
+    tree->release();
+
+    IOLockUnlock(s_manifestTreesLock);
+}
+
+void SandboxedPip::shareManifestTree()
+{
+    const BYTE *bytes = (const BYTE*)payload_->getBytes();
+    if (s_manifestTrees == nullptr || fam_.GetManifestRootNode() == nullptr)
+    {
+        return;
+    }
+
+    size_t headerSize = (const BYTE*)fam_.GetManifestRootNode() - bytes;
+    size_t treeSize   = payload_->getSize() - headerSize;
+    uint32_t hash     = HashManifestTree(bytes + headerSize, treeSize);
+
+    Buffer *tree = internManifestTree(bytes + headerSize, treeSize, hash);
+    if (tree == nullptr)
+    {
+        return;
+    }
+
+    Buffer *header = Buffer::create(headerSize);
+    if (header != nullptr)
+    {
+        memcpy(header->getBytes(), bytes, headerSize);
+    }
+
+    FileAccessManifestParseResult fam;
+    if (header == nullptr || !fam.init((const BYTE*)header->getBytes(), headerSize, (const BYTE*)tree->getBytes()))
+    {
+        OSSafeReleaseNULL(header);
+        releaseManifestTree(tree, hash);
+        return;
+    }
+
+    fam_              = fam;
+    manifestTree_     = tree;
+    manifestTreeHash_ = hash;
+    payload_->release();
+    payload_          = header;
+}
+
+void SandboxedPip::setLastLookedUpPath(const char *path)
+{
+    uint64_t tid = self_tid();
+    LastLookupSlot *slot = &lastLookupSlots_[tid % kLastLookupSlotCount];
+
+    // if another thread is writing to this slot right now, let it win
+    UInt32 generation = slot->generation;
+    if ((generation & 1) != 0 || !OSCompareAndSwap(generation, generation + 1, &slot->generation))
+    {
+        return;
+    }
+
+    slot->tid = tid;
+    strlcpy(slot->path, path, sizeof(slot->path));
+
+    OSMemoryBarrier();
+    slot->generation = generation + 2;
+}
+
+bool SandboxedPip::getLastLookedUpPath(char *buffer, size_t bufferSize) const
+{
+    uint64_t tid = self_tid();
+    const LastLookupSlot *slot = &lastLookupSlots_[tid % kLastLookupSlotCount];
+
+    UInt32 generation = slot->generation;
+    if ((generation & 1) != 0 || slot->tid != tid)
+    {
+        return false;
+    }
+
+    OSMemoryBarrier();
+    strlcpy(buffer, slot->path, bufferSize);
+    OSMemoryBarrier();
+
+    return slot->generation == generation;
+}
+
+bool SandboxedPip::getCachedVNodePath(vnode_t vp, char *buffer, int *length) const
+{
+    const VNodePathEntry *entry = &vnodePathCache_[vnodePathCacheIndex(vp)];
+
+    UInt32 seq = entry->seq;
+    if ((seq & 1) != 0 ||
+        entry->vnode != vp ||
+        entry->vid != vnode_vid(vp) ||
+        entry->generation != s_vnodePathGeneration ||
+        entry->length > *length)
+    {
+        return false;
+    }
+
+    OSMemoryBarrier();
+    int entryLength = entry->length;
+    memcpy(buffer, entry->path, entryLength);
+    OSMemoryBarrier();
+
+    if (entry->seq != seq)
+    {
+        return false;
+    }
+
+    buffer[entryLength - 1] = '\0';
+    *length = entryLength;
+    return true;
+}
+
+void SandboxedPip::cacheVNodePath(vnode_t vp, const char *path, int length, UInt32 generation)
+{
+    if (length <= 0 || length > MAXPATHLEN)
+    {
+        return;
+    }
+
+    VNodePathEntry *entry = &vnodePathCache_[vnodePathCacheIndex(vp)];
+
+    // if another thread is writing to this entry right now, let it win
+    UInt32 seq = entry->seq;
+    if ((seq & 1) != 0 || !OSCompareAndSwap(seq, seq + 1, &entry->seq))
+    {
+        return;
+    }
+
+    entry->generation = generation;
+    entry->vnode      = vp;
+    entry->vid        = vnode_vid(vp);
+    entry->length     = length;
+    memcpy(entry->path, path, length);
+
+    OSMemoryBarrier();
+    entry->seq = seq + 2;
+}
+
+bool SandboxedPip::getCachedDirectoryCursor(vnode_t vp, PolicySearchCursor *cursor) const
+{
+    const DirCursorEntry *entry = &dirCursorCache_[dirCursorCacheIndex(vp)];
+
+    UInt32 seq = entry->seq;
+    if ((seq & 1) != 0 ||
+        entry->vnode != vp ||
+        entry->vid != vnode_vid(vp) ||
+        entry->generation != s_vnodePathGeneration)
+    {
+        return false;
+    }
+
+    OSMemoryBarrier();
+    PCManifestRecord record = entry->cursorRecord;
+    bool truncated = entry->cursorTruncated;
+    OSMemoryBarrier();
+
+    if (entry->seq != seq || record == nullptr)
+    {
+        return false;
+    }
+
+    *cursor = PolicySearchCursor(record, truncated);
+    return true;
+}
+
+void SandboxedPip::cacheDirectoryCursor(vnode_t vp, const PolicySearchCursor &cursor, UInt32 generation)
+{
+    if (!cursor.IsValid())
+    {
+        return;
+    }
+
+    DirCursorEntry *entry = &dirCursorCache_[dirCursorCacheIndex(vp)];
+
+    // if another thread is writing to this entry right now, let it win
+    UInt32 seq = entry->seq;
+    if ((seq & 1) != 0 || !OSCompareAndSwap(seq, seq + 1, &entry->seq))
+    {
+        return;
+    }
+
+    entry->generation      = generation;
+    entry->vnode           = vp;
+    entry->vid             = vnode_vid(vp);
+    entry->cursorRecord    = cursor.Record;
+    entry->cursorTruncated = cursor.SearchWasTruncated;
+
+    OSMemoryBarrier();
+    entry->seq = seq + 2;
+}
+
+bool SandboxedPip::isReadlinkAllowed(vnode_t vp) const
+{
+    const ReadlinkEntry *entry = &readlinkCache_[readlinkCacheIndex(vp)];
+
+    UInt32 seq = entry->seq;
+    if ((seq & 1) != 0)
+    {
+        return false;
+    }
+
+    OSMemoryBarrier();
+    bool matches =
+        entry->vnode == vp &&
+        entry->vid == vnode_vid(vp) &&
+        entry->generation == s_vnodePathGeneration;
+    OSMemoryBarrier();
+
+    return matches && entry->seq == seq;
+}
+
+void SandboxedPip::cacheAllowedReadlink(vnode_t vp, UInt32 generation)
+{
+    ReadlinkEntry *entry = &readlinkCache_[readlinkCacheIndex(vp)];
+
+    // if another thread is writing to this entry right now, let it win
+    UInt32 seq = entry->seq;
+    if ((seq & 1) != 0 || !OSCompareAndSwap(seq, seq + 1, &entry->seq))
+    {
+        return;
+    }
+
+    entry->generation = generation;
+    entry->vnode      = vp;
+    entry->vid        = vnode_vid(vp);
+
+    OSMemoryBarrier();
+    entry->seq = seq + 2;
+}
+
+bool SandboxedPip::isKnownHardLink(vnode_t vp, const char *path) const
+{
+    const VNodePathEntry *entry = &hardLinkCache_[hardLinkCacheIndex(vp)];
+
+    UInt32 seq = entry->seq;
+    if ((seq & 1) != 0 ||
+        entry->vnode != vp ||
+        entry->vid != vnode_vid(vp) ||
+        entry->generation != s_vnodePathGeneration)
+    {
+        return false;
+    }
+
+    OSMemoryBarrier();
+    bool matches = strncmp(entry->path, path, sizeof(entry->path)) == 0;
+    OSMemoryBarrier();
+
+    return matches && entry->seq == seq;
+}
+
+void SandboxedPip::cacheHardLink(vnode_t vp, const char *path, UInt32 generation)
+{
+    VNodePathEntry *entry = &hardLinkCache_[hardLinkCacheIndex(vp)];
+
+    // if another thread is writing to this entry right now, let it win
+    UInt32 seq = entry->seq;
+    if ((seq & 1) != 0 || !OSCompareAndSwap(seq, seq + 1, &entry->seq))
+    {
+        return;
+    }
+
+    entry->generation = generation;
+    entry->vnode      = vp;
+    entry->vid        = vnode_vid(vp);
+    entry->length     = (int)strlcpy(entry->path, path, sizeof(entry->path)) + 1;
+
+    OSMemoryBarrier();
+    entry->seq = seq + 2;
+}
+
+Buffer* SandboxedPip::getCachedExecImage(vnode_t vp, PolicySearchCursor *cursor) const
+{
+    const ExecImageEntry *entry = &execImageCache_[execImageCacheIndex(vp)];
+    Buffer *path = nullptr;
+
+    IOLockLock(execImageCacheLock_);
+
+    if (entry->path != nullptr &&
+        entry->vnode == vp &&
+        entry->vid == vnode_vid(vp) &&
+        entry->generation == s_vnodePathGeneration)
+    {
+        path = entry->path;
+        path->retain();
+        *cursor = PolicySearchCursor(entry->cursorRecord, entry->cursorTruncated);
+    }
+
+    IOLockUnlock(execImageCacheLock_);
+    return path;
+}
+
+void SandboxedPip::cacheExecImage(vnode_t vp, Buffer *path, const PolicySearchCursor &cursor, UInt32 generation)
+{
+    if (path == nullptr || !cursor.IsValid())
+    {
+        return;
+    }
+
+    ExecImageEntry *entry = &execImageCache_[execImageCacheIndex(vp)];
+    path->retain();
+
+    IOLockLock(execImageCacheLock_);
+
+    Buffer *evicted        = entry->path;
+    entry->vnode           = vp;
+    entry->vid             = vnode_vid(vp);
+    entry->generation      = generation;
+    entry->path            = path;
+    entry->cursorRecord    = cursor.Record;
+    entry->cursorTruncated = cursor.SearchWasTruncated;
+
+    IOLockUnlock(execImageCacheLock_);
+
+    OSSafeReleaseNULL(evicted);
+}
+
+SandboxedPip* SandboxedPip::create(pid_t clientPid, pid_t processPid, Buffer *payload, uint pathCacheBudget)
 {
     SandboxedPip *instance = new SandboxedPip;
     if (instance == nullptr)
@@ -70,7 +901,7 @@ SandboxedPip* SandboxedPip::create(pid_t clientPid, pid_t processPid, Buffer *pa
         return nullptr;
     }
     
-    bool initialized = instance->init(clientPid, processPid, payload);
+    bool initialized = instance->init(clientPid, processPid, payload, pathCacheBudget);
     if (!initialized)
     {
         // init already logged an error message describing what failed
@@ -81,6 +912,41 @@ SandboxedPip* SandboxedPip::create(pid_t clientPid, pid_t processPid, Buffer *pa
     return instance;
 }
 
+bool SandboxedPip::takeReportToken(uint maxReportsPerSecond)
+{
+    uint64_t now = mach_absolute_time();
+    UInt64 refilledAt = reportTokensRefilledAt_;
+
+    uint64_t elapsedNs;
+    absolutetime_to_nanoseconds(now - refilledAt, &elapsedNs);
+    uint64_t earned = elapsedNs >= NSEC_PER_SEC
+        ? maxReportsPerSecond
+        : elapsedNs * maxReportsPerSecond / NSEC_PER_SEC;
+
+    // whoever moves the refill time forward adds the tokens earned since, so that they are added only once
+    if (earned > 0 && OSCompareAndSwap64(refilledAt, now, &reportTokensRefilledAt_))
+    {
+        UInt32 tokens, refilled;
+        do
+        {
+            tokens   = reportTokens_;
+            refilled = tokens + earned > maxReportsPerSecond ? maxReportsPerSecond : (UInt32)(tokens + earned);
+        } while (!OSCompareAndSwap(tokens, refilled, &reportTokens_));
+    }
+
+    UInt32 tokens;
+    do
+    {
+        tokens = reportTokens_;
+        if (tokens == 0)
+        {
+            return false;
+        }
+    } while (!OSCompareAndSwap(tokens, tokens - 1, &reportTokens_));
+
+    return true;
+}
+
 PipInfo SandboxedPip::introspect() const
 {
     return
@@ -88,7 +954,9 @@ PipInfo SandboxedPip::introspect() const
         .pid                 = getProcessId(),
         .clientPid           = getClientPid(),
         .pipId               = getPipId(),
-        .cacheSize           = pathCache_->getCount(),
+        .cacheSize           = getCacheSize(),
+        .numCacheEvictions   = (uint)numCacheEvictions_,
+        .numEvictedPaths     = (uint64_t)numEvictedPaths_,
         .treeSize            = getTreeSize(),
         .counters            = counters_,
         .numReportedChildren = 0,
@@ -12,14 +12,41 @@
 
 #include "BuildXLSandboxShared.hpp"
 #include "CacheRecord.hpp"
+#include "ClientInfo.hpp"
 #include "FileAccessManifestParser.hpp"
 #include "Buffer.hpp"
 #include "PolicyResult.h"
-#include "ThreadLocal.hpp"
 #include "Trie.hpp"
 
 #define SandboxedPip BXL_CLASS(SandboxedPip)
 
+/*! Number of slots for remembering last looked up paths (see 'SandboxedPip::setLastLookedUpPath') */
+#define kLastLookupSlotCount 32
+
+/*! Number of entries of the directory path cache (see 'SandboxedPip::getCachedVNodePath') */
+#define kVNodePathCacheSize 64
+
+/*! Number of entries of the cache of directory policy cursors (see 'SandboxedPip::getCachedDirectoryCursor') */
+#define kDirCursorCacheSize 64
+
+/*! Number of entries of the cache of readlinks already allowed (see 'SandboxedPip::isReadlinkAllowed') */
+#define kReadlinkCacheSize 128
+
+/*! Number of entries of the cache of exec'd images (see 'SandboxedPip::getCachedExecImage') */
+#define kExecImageCacheSize 16
+
+/*! Number of entries of the cache of verified hard links (see 'SandboxedPip::isKnownHardLink') */
+#define kHardLinkCacheSize 32
+
+/*! Maximum number of top-level manifest records a pip can report lookups under (see 'SandboxedPip::mayReportLookup') */
+#define kMaxLookupReportPrefixes 32
+
+/*! Number of paths below which the path cache of a pip is not shrunk because of low available RAM (see 'SandboxedPip::shrinkPathCache') */
+#define kPathCacheShrinkFloor 256
+
+/*! Number of preallocated process objects a pip keeps for its forks (see 'SandboxedPip::takeSpareProcess') */
+#define kSpareProcessCount 16
+
 /*!
  * Represents the root of the process tree being tracked.
  *
@@ -42,20 +69,252 @@ private:
     /*! Process id of the root process of this pip. */
     pid_t processId_;
 
-    /*! File access manifest payload bytes */
+    /*!
+     * The client tracking this pip, looked up once when the pip starts so that reporting an access does not
+     * need to look it up again.  Retained, so it stays valid even if the client disconnects in the meantime.
+     */
+    ClientInfo *client_;
+
+    /*! File access manifest payload bytes (only the header of the payload if 'manifestTree_' is set) */
     Buffer *payload_;
 
+    /*! The manifest tree of this pip, if shared with other pips (see 's_manifestTrees') */
+    Buffer *manifestTree_;
+    uint32_t manifestTreeHash_;
+
+    /*!
+     * Kext-wide table of manifest trees (content hash -> Buffer), so that pips whose manifests only differ in their
+     * headers (pip id, flags, etc.) share one copy of the manifest tree.  A tree is removed from the table when the
+     * last pip using it goes away.  Guarded by 's_manifestTreesLock'.
+     */
+    static Trie *s_manifestTrees;
+    static IOLock *s_manifestTreesLock;
+
+    /*!
+     * Returns a retained shared copy of the given manifest tree, or NULL if it cannot be shared.
+     */
+    static Buffer* internManifestTree(const BYTE *tree, size_t size, uint32_t hash);
+
+    /*! Releases a tree returned by 'internManifestTree'. */
+    static void releaseManifestTree(Buffer *tree, uint32_t hash);
+
+    /*!
+     * Replaces 'payload_' with a copy of its header and a shared manifest tree.  The pip keeps using its
+     * whole payload if that fails.
+     */
+    void shareManifestTree();
+
     /*! File access manifest (contains pointers into the 'payload_' byte array */
     FileAccessManifestParseResult fam_;
 
+    /*!
+     * The children of the manifest's unix root ("top-level" path components) whose subtrees have a policy under
+     * which a lookup could be reported.  Lookups of paths outside of these subtrees are never reported.
+     * If 'numLookupReportPrefixes_' is -1, any lookup may be reported (e.g., because the pip reports all accesses).
+     */
+    PCManifestRecord lookupReportPrefixes_[kMaxLookupReportPrefixes];
+    int numLookupReportPrefixes_;
+
+    /*! Computes 'lookupReportPrefixes_' from 'fam_' */
+    void computeLookupReportPrefixes();
+
+    /*!
+     * Preallocated, not yet initialized 'SandboxedProcess' objects, so that tracking a forked child does not
+     * allocate.  Slots are taken and filled with compare-and-swap; spares don't reference this pip.
+     */
+    OSObject * volatile spareProcesses_[kSpareProcessCount];
+
     /*! Number of processses in this pip's process tree */
     int processTreeCount_;
 
-    /*! Maps every accessed path to a 'CacheRecord' object (which contains caching information regarding that path) */
-    Trie *pathCache_;
+    /*! Number of reports of this pip enqueued into the priority queue of its client (see 'ClientInfo::enqueueReport') */
+    SInt32 numPriorityReports_;
+
+    /*!
+     * Token bucket of the reports of this pip (see 'KextConfig::maxPipReportRate'): the reports it may still send
+     * right away, and when tokens were last added (in absolute time units; 0 before the first report).
+     */
+    volatile UInt32 reportTokens_;
+    volatile UInt64 reportTokensRefilledAt_;
+
+    /*! Set the first time this pip runs out of report tokens, so that it is logged once */
+    volatile UInt32 reportRateExceeded_;
+
+    /*!
+     * Maps accessed paths to 'CacheRecord' objects (which contain caching information regarding those paths).
+     *
+     * To bound its size, the cache is split into generations: 'pathCache_' is the current one, and 'oldPathCache_'
+     * the previous one.  Lookups fall back to the previous generation and move the records they find there into
+     * the current one.  Once the current generation holds half of 'pathCacheBudget_' paths, the previous one is
+     * evicted whole (taking the paths which were not accessed during the current generation with it), and the
+     * current one becomes the previous one.
+     *
+     * Tries are only ever accessed in a 'PathCacheScope', which registers the reader with the generation it
+     * started in ('pathCacheReaders_' is indexed by its parity).  An evicted generation ('retiredPathCache_')
+     * is released only once all readers from the generation that evicted it are gone, and no further generation
+     * is started until then.
+     */
+    Trie * volatile pathCache_;
+    Trie * volatile oldPathCache_;
+    Trie * volatile retiredPathCache_;
+
+    volatile UInt32 pathCacheGeneration_;
+    mutable volatile SInt32 pathCacheReaders_[2];
+
+    /*! Set while a thread is starting a new generation or releasing 'retiredPathCache_' */
+    volatile UInt32 pathCacheEvicting_;
+
+    /*! Maximum number of paths in the current and the previous generation together; no limit if 0 */
+    uint pathCacheBudget_;
+
+    /*! Number of evicted generations, and the number of paths they held */
+    volatile SInt32 numCacheEvictions_;
+    volatile SInt64 numEvictedPaths_;
+
+    /*! Starts a new generation of the path cache if the current one is full */
+    void evictPathCacheIfNeeded();
+
+    /*!
+     * Makes the current generation of the path cache the previous one, and retires the previous one.  Must be called
+     * while holding 'pathCacheEvicting_', with no retired generation.  Returns the number of paths retired.
+     */
+    uint startPathCacheGeneration();
+
+    /*! Releases 'retiredPathCache_' if possible.  Returns whether there is no retired generation anymore. */
+    bool releaseRetiredPathCache();
+
+    UInt32 enterPathCache() const;
+    void exitPathCache(UInt32 generation) const;
+
+    /*!
+     * The last path looked up by a thread, remembered in the slot at index 'tid % kLastLookupSlotCount'.
+     *
+     * Writers and readers synchronize through 'generation' like a sequence lock: it is odd while the slot is
+     * being written to, and a reader only accepts a path if it saw the same even generation before and after
+     * copying it.  Threads whose ids map to the same slot simply overwrite each other's paths: a remembered path
+     * is only a hint, so losing one merely costs a missed hard link retry.
+     */
+    typedef struct {
+        volatile UInt32 generation;
+        uint64_t tid;
+        char path[MAXPATHLEN];
+    } LastLookupSlot;
+
+    /*! Preallocated in 'init', so that remembering a path never allocates. */
+    LastLookupSlot *lastLookupSlots_;
+
+    /*!
+     * A bounded, direct-mapped cache of the absolute paths of directory vnodes, keyed by the vnode and its vid
+     * (which changes whenever the vnode is recycled).  Entries are synchronized through 'seq' the same way
+     * 'lastLookupSlots_' are, and are preallocated in 'init'.
+     *
+     * A rename or a delete may change the paths of a whole subtree, so instead of finding the affected entries,
+     * every rename or delete the kext observes bumps 's_vnodePathGeneration', which invalidates all entries.
+     */
+    typedef struct {
+        volatile UInt32 seq;
+        UInt32 generation;
+        vnode_t vnode;
+        uint32_t vid;
+        int length;
+        char path[MAXPATHLEN];
+    } VNodePathEntry;
+
+    VNodePathEntry *vnodePathCache_;
+
+    /*!
+     * A bounded, direct-mapped cache of the results of the policy searches for the paths of directory vnodes,
+     * keyed like 'vnodePathCache_' (and invalidated and synchronized the same way).  The MAC_LOOKUP and
+     * MAC_VNODE_CREATE handlers get a directory vnode and a leaf name, so with the cursor of the directory at hand
+     * the policy of the leaf is found by searching only the name below it instead of the whole path from the root.
+     *
+     * This is kept apart from 'vnodePathCache_' because an entry is only worth its search when the directory is
+     * the parent of a checked access, which is not the case for most of the directories whose paths are cached.
+     */
+    typedef struct {
+        volatile UInt32 seq;
+        UInt32 generation;
+        vnode_t vnode;
+        uint32_t vid;
+        PCManifestRecord cursorRecord;
+        bool cursorTruncated;
+    } DirCursorEntry;
+
+    DirCursorEntry *dirCursorCache_;
+
+    /*!
+     * A bounded, direct-mapped cache of the symlink vnodes (and their vids) whose readlinks have been checked,
+     * reported, and allowed.  Since the manifest of a pip never changes, a readlink of the same symlink (i.e., of
+     * the same path) has the same outcome until the path does; so like 'vnodePathCache_', entries are invalidated
+     * by 's_vnodePathGeneration' and synchronized through 'seq'.  Readlinks that were denied are not cached.
+     */
+    typedef struct {
+        volatile UInt32 seq;
+        UInt32 generation;
+        vnode_t vnode;
+        uint32_t vid;
+    } ReadlinkEntry;
+
+    ReadlinkEntry *readlinkCache_;
+
+    /*!
+     * A bounded, direct-mapped cache of the vnodes (and their vids) verified to be reachable through a path other
+     * than the one an access was checked against (i.e., a hard link, see 'AccessHandler::CheckAccess'), along
+     * with that path.  Only verified matches are cached: a path can only stop resolving to a vnode through a
+     * rename or a delete, which invalidate all entries through 's_vnodePathGeneration' as for 'vnodePathCache_'.
+     */
+    VNodePathEntry *hardLinkCache_;
+
+    /*!
+     * A bounded, direct-mapped cache of the images (vnodes and their vids) the processes of this pip have exec'd,
+     * with their shared path strings and the results of their policy searches.  Compile-heavy pips exec the same
+     * few binaries over and over, and a cached exec neither calls 'vn_getpath', nor searches the manifest, nor
+     * allocates.  Entries are invalidated by 's_vnodePathGeneration' like the other vnode caches; since they hold
+     * references to their paths, they are guarded by 'execImageCacheLock_' instead of a sequence number.
+     */
+    typedef struct {
+        vnode_t vnode;
+        uint32_t vid;
+        UInt32 generation;
+        Buffer *path;
+        PCManifestRecord cursorRecord;
+        bool cursorTruncated;
+    } ExecImageEntry;
+
+    ExecImageEntry *execImageCache_;
+    IOLock *execImageCacheLock_;
+
+    static volatile UInt32 s_vnodePathGeneration;
+
+    static uint vnodePathCacheIndex(vnode_t vp)
+    {
+        return (uint)((((uint64_t)(uintptr_t)vp) * 0x9E3779B97F4A7C15ull) >> 32) % kVNodePathCacheSize;
+    }
+
+    static uint dirCursorCacheIndex(vnode_t vp)
+    {
+        return (uint)((((uint64_t)(uintptr_t)vp) * 0x9E3779B97F4A7C15ull) >> 32) % kDirCursorCacheSize;
+    }
+
+    static uint readlinkCacheIndex(vnode_t vp)
+    {
+        return (uint)((((uint64_t)(uintptr_t)vp) * 0x9E3779B97F4A7C15ull) >> 32) % kReadlinkCacheSize;
+    }
+
+    static uint hardLinkCacheIndex(vnode_t vp)
+    {
+        return (uint)((((uint64_t)(uintptr_t)vp) * 0x9E3779B97F4A7C15ull) >> 32) % kHardLinkCacheSize;
+    }
 
-    /*! A thread-local storage for remembering the last looked up path by every thread. */
-    ThreadLocal *lastPathLookup_;
+    static uint execImageCacheIndex(vnode_t vp)
+    {
+        return (uint)((((uint64_t)(uintptr_t)vp) * 0x9E3779B97F4A7C15ull) >> 32) % kExecImageCacheSize;
+    }
+
+    static uint64_t self_tid()
+    {
+        return thread_tid(current_thread());
+    }
 
     /*! Various counters.  IMPORTANT: counters may be globally disabled so no logic may rely on their values. */
     AllCounters counters_;
@@ -65,7 +324,7 @@ private:
         return CacheRecord::create();
     };
 
-    bool init(pid_t clientPid, pid_t processPid, Buffer *payload);
+    bool init(pid_t clientPid, pid_t processPid, Buffer *payload, uint pathCacheBudget);
 
 protected:
 
@@ -79,6 +338,12 @@ public:
     /*! Process id of the root process of this pip. */
     pid_t getProcessId() const { return processId_; }
 
+    /*! The client tracking this pip (see 'setClientInfo'), or NULL if none was set. */
+    ClientInfo* getClientInfo() const { return client_; }
+
+    /*! Sets (and retains) the client tracking this pip; may only be called once, before the pip is tracked. */
+    void setClientInfo(ClientInfo *client);
+
     /*! A unique identifier of this pip. */
     pipid_t getPipId() const   { return fam_.GetPipId()->PipId; }
 
@@ -88,6 +353,15 @@ public:
     /*! File access manifest flags */
     FileAccessManifestFlag getFamFlags() const    { return fam_.GetFamFlags(); }
 
+    /*! Policies of the files with given suffixes, applied on top of the manifest records */
+    PCManifestSuffixPolicies getSuffixPolicies() const { return fam_.GetSuffixPolicies(); }
+
+    /*!
+     * Returns false if a lookup of 'absolutePath' can certainly not be reported according to this pip's manifest
+     * (i.e., no policy in the top-level scope of the path reports lookups), so the lookup need not be checked.
+     */
+    bool mayReportLookup(const char *absolutePath) const;
+
     /*!
      * Returns the full path of the root process of this pip.
      * The lenght of the path is stored in the 'length' argument because the path is not necessarily 0-terminated.
@@ -98,29 +372,104 @@ public:
     AllCounters* Counters() { return &counters_; }
 
     /*!
-     * Uses a thread-local storage to save a given path as the last path that was looked up on the current thread.
+     * Saves a given path as the last path that was looked up on the current thread.  Never allocates or blocks.
      */
-    void setLastLookedUpPath(const char *path)
-    {
-        const OSSymbol *pathSym = OSSymbol::withCString(path);
-        lastPathLookup_->insert(pathSym);
-        OSSafeReleaseNULL(pathSym);
-    }
+    void setLastLookedUpPath(const char *path);
 
     /*!
-     * Returns the last path saved by the current thread by calling the 'setLastLookedUpPath' method.
+     * Copies the last path saved by the current thread by calling the 'setLastLookedUpPath' method into 'buffer'.
      *
      * (In practice, this is the path associated with the last MAC_LOOKUP event that happened on the current thread).
+     *
+     * @result False if there is no such path (including when it has since been overwritten by another thread).
      */
-    const char* getLastLookedUpPath()
-    {
-        OSSymbol *value = OSDynamicCast(OSSymbol, lastPathLookup_->get());
-        return value != nullptr ? value->getCStringNoCopy() : nullptr;
-    }
+    bool getLastLookedUpPath(char *buffer, size_t bufferSize) const;
+
+    /*!
+     * Copies the cached absolute path of directory 'vp' into 'buffer' and sets '*length' to its length
+     * including the terminating null character (i.e., the way 'vn_getpath' does).
+     *
+     * @result False if the path is not cached (or no longer valid).
+     */
+    bool getCachedVNodePath(vnode_t vp, char *buffer, int *length) const;
+
+    /*!
+     * Caches 'path' (of length 'length', including the terminating null character) as the path of directory 'vp'.
+     *
+     * 'generation' must be the value 'currentVNodePathGeneration' returned before 'path' was computed, so that
+     * a path computed concurrently with a rename or a delete is never considered valid.
+     */
+    void cacheVNodePath(vnode_t vp, const char *path, int length, UInt32 generation);
+
+    static UInt32 currentVNodePathGeneration() { return s_vnodePathGeneration; }
+
+    /*!
+     * Sets 'cursor' to the cached result of the policy search for the path of directory 'vp'.
+     *
+     * @result False if the cursor is not cached (or the path of 'vp' may have changed since).
+     */
+    bool getCachedDirectoryCursor(vnode_t vp, PolicySearchCursor *cursor) const;
+
+    /*!
+     * Caches the valid 'cursor' found for the path of directory 'vp'.  'generation' must be the value
+     * 'currentVNodePathGeneration' returned before the path of 'vp' was computed.
+     */
+    void cacheDirectoryCursor(vnode_t vp, const PolicySearchCursor &cursor, UInt32 generation);
+
+    /*!
+     * Returns true if a readlink of symlink 'vp' has already been checked, reported, and allowed, and the path
+     * of 'vp' cannot have changed since, so that the readlink needs neither be checked nor reported again.
+     */
+    bool isReadlinkAllowed(vnode_t vp) const;
+
+    /*!
+     * Remembers that a readlink of symlink 'vp' has been checked, reported, and allowed.  'generation' must be
+     * the value 'currentVNodePathGeneration' returned before the path of 'vp' was computed.
+     */
+    void cacheAllowedReadlink(vnode_t vp, UInt32 generation);
+
+    /*!
+     * Returns true if 'path' has already been verified to resolve to 'vp' (and cannot have stopped doing so since).
+     */
+    bool isKnownHardLink(vnode_t vp, const char *path) const;
+
+    /*!
+     * Remembers that 'path' resolves to 'vp'.  'generation' must be the value 'currentVNodePathGeneration'
+     * returned before 'path' was resolved.
+     */
+    void cacheHardLink(vnode_t vp, const char *path, UInt32 generation);
+
+    /*!
+     * Returns the cached (0-terminated) path of exec'd image 'vp', retained for the caller, and sets 'cursor' to the
+     * result of the policy search for that path.
+     *
+     * @result NULL if 'vp' is not cached (or its path may have changed since).
+     */
+    Buffer* getCachedExecImage(vnode_t vp, PolicySearchCursor *cursor) const;
+
+    /*!
+     * Caches 'path' (a 0-terminated string, retained by the cache) and the valid 'cursor' found for it as the
+     * image of 'vp'.  'generation' must be the value 'currentVNodePathGeneration' returned before 'path' was computed.
+     */
+    void cacheExecImage(vnode_t vp, Buffer *path, const PolicySearchCursor &cursor, UInt32 generation);
+
+    /*! Invalidates the cached directory paths of all pips (to be called on every rename/delete). */
+    static void invalidateVNodePaths() { OSIncrementAtomic((volatile SInt32*)&s_vnodePathGeneration); }
 
     /*! Information about this pip that can be queried from user space */
     PipInfo introspect() const;
 
+#pragma mark Spare Processes
+
+    /*! Takes a spare process object (see 'SandboxedProcess::create'), or returns NULL if there is none left. */
+    OSObject* takeSpareProcess();
+
+    /*! Adds a spare process object; returns false (without retaining 'process') if all slots are taken. */
+    bool addSpareProcess(OSObject *process);
+
+    /*! Number of free slots in the spare process pool */
+    int getMissingSpareProcessCount() const;
+
 #pragma mark Process Tree Tracking
 
     /*! Number of currently active processes in this pip's process tree */
@@ -132,23 +481,72 @@ public:
     /*! Atomically dencrements this pip's process tree size and returns the size before decrement. */
     int decrementProcessTreeCount() { return OSDecrementAtomic(&processTreeCount_); }
 
+#pragma mark Priority Reports
+
+    /*! Number of reports of this pip that went through the priority queue of its client so far */
+    uint getPriorityReportCount() const     { return (uint)numPriorityReports_; }
+
+    /*! Atomically accounts for one more report of this pip having gone through the priority queue of its client. */
+    void incrementPriorityReportCount()    { OSIncrementAtomic(&numPriorityReports_); }
+
+#pragma mark Report Rate
+
+    /*!
+     * Takes a token from the report bucket of this pip, which gets 'maxReportsPerSecond' tokens per second and holds at
+     * most one second's worth of them.  Returns false if the bucket is empty, i.e., if the pip reports faster than that.
+     */
+    bool takeReportToken(uint maxReportsPerSecond);
+
+    /*! Returns true only the first time it is called, for logging that this pip reports too fast once. */
+    bool markReportRateExceeded() { return OSCompareAndSwap(0, 1, &reportRateExceeded_); }
+
 #pragma mark Report Caching
 
+    /*!
+     * Keeps the records returned by 'cacheGet' and 'cacheLookup' alive (even if their generation of the
+     * cache gets evicted) until it goes out of scope.  Cache lookups may only be done in such a scope.
+     */
+    class PathCacheScope
+    {
+    private:
+        const SandboxedPip *pip_;
+        UInt32 generation_;
+
+    public:
+        PathCacheScope(const SandboxedPip *pip) : pip_(pip), generation_(pip->enterPathCache()) {}
+        ~PathCacheScope() { pip_->exitPathCache(generation_); }
+    };
+
+    /*!
+     * Returns the 'CacheRecord' associated with a given path, or NULL if no such record exists.
+     */
+    CacheRecord* cacheGet(const char *path);
+
     /*!
      * Looks up a 'CacheRecord' associated with a given path.
      * If no such record exists, a new one is created and associated with the path.
      * Return value of NULL indicates that there is an inherent reason why the path cannot be added to cache.
      */
-    inline CacheRecord* cacheLookup(const char *path)
-    {
-        OSObject *value = pathCache_->getOrAdd(path, nullptr, CacheRecordFactory);
-        return OSDynamicCast(CacheRecord, value);
-    }
+    CacheRecord* cacheLookup(const char *path);
+
+    /*! Number of paths currently in the cache (including the previous generation) */
+    uint getCacheSize() const;
+
+    /*!
+     * Sheds the paths which were not accessed during the current generation of the cache (i.e., evicts the previous
+     * generation and starts a new one), unless the cache holds no more than 'floor' paths.  Paths still in use move back
+     * into the new generation as they are accessed.  Called when available RAM runs low; returns the number of paths shed.
+     */
+    uint shrinkPathCache(uint floor);
 
 #pragma mark Static Methods
 
     /*! Factory method. The caller is responsible for releasing the returned object. */
-    static SandboxedPip* create(pid_t clientPid, pid_t processPid, Buffer *payload);
+    static SandboxedPip* create(pid_t clientPid, pid_t processPid, Buffer *payload, uint pathCacheBudget);
+
+    /*! Sets up the kext-wide table of shared manifest trees; pips do not share their trees without it. */
+    static bool InitializeManifestTrees();
+    static void FreeManifestTrees();
 };
 
 #endif /* SandboxedPip_hpp */
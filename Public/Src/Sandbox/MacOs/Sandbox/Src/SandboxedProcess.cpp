@@ -9,7 +9,16 @@ OSDefineMetaClassAndStructors(SandboxedProcess, OSObject)
 
 SandboxedProcess* SandboxedProcess::create(pid_t processId, SandboxedPip *pip)
 {
-    SandboxedProcess *instance = new SandboxedProcess;
+    // only 'refillSpares' adds spares, so they are all SandboxedProcess instances
+    SandboxedProcess *instance = pip != nullptr ? static_cast<SandboxedProcess*>(pip->takeSpareProcess()) : nullptr;
+    if (instance != nullptr)
+    {
+        // the reference the pool held is now the caller's
+        instance->bind(processId, pip);
+        return instance;
+    }
+
+    instance = new SandboxedProcess;
     if (instance != nullptr)
     {
         if (!instance->init(processId, pip))
@@ -31,8 +40,8 @@ bool SandboxedProcess::init(pid_t processId, SandboxedPip *pip)
     pip_ = pip;
     id_  = processId;
 
-    bzero(path_, sizeof(path_));
-    pathLength_ = 0;
+    path_         = nullptr;
+    previousPath_ = nullptr;
 
     if (pip_ == nullptr)
     {
@@ -43,8 +52,86 @@ bool SandboxedProcess::init(pid_t processId, SandboxedPip *pip)
     return true;
 }
 
+void SandboxedProcess::refillSpares(SandboxedPip *pip)
+{
+    for (int missing = pip->getMissingSpareProcessCount(); missing > 0; missing--)
+    {
+        SandboxedProcess *spare = new SandboxedProcess;
+        if (spare != nullptr && !spare->initSpare())
+        {
+            OSSafeReleaseNULL(spare);
+        }
+
+        if (spare == nullptr)
+        {
+            return;
+        }
+
+        bool added = pip->addSpareProcess(spare);
+        spare->release();
+        if (!added)
+        {
+            return;
+        }
+    }
+}
+
+bool SandboxedProcess::initSpare()
+{
+    if (!super::init())
+    {
+        return false;
+    }
+
+    pip_          = nullptr;
+    id_           = 0;
+    path_         = nullptr;
+    previousPath_ = nullptr;
+    return true;
+}
+
+void SandboxedProcess::bind(pid_t processId, SandboxedPip *pip)
+{
+    pip_ = pip;
+    pip_->retain();
+    id_  = processId;
+}
+
+void SandboxedProcess::setPath(const char *path, int len)
+{
+    // what 'strlcpy(buffer, path, len)' would copy
+    size_t length = len > 0 ? strnlen(path, len - 1) : 0;
+    Buffer *copy = Buffer::create(length + 1);
+    if (copy == nullptr)
+    {
+        return;
+    }
+
+    memcpy(copy->getBytes(), path, length);
+    copy->getBytes()[length] = '\0';
+
+    setPath(copy);
+    copy->release();
+}
+
+void SandboxedProcess::setPath(Buffer *path)
+{
+    if (path != nullptr)
+    {
+        path->retain();
+    }
+
+    Buffer *replaced = path_;
+    path_ = path;
+
+    OSSafeReleaseNULL(previousPath_);
+    previousPath_ = replaced;
+}
+
 void SandboxedProcess::free()
 {
+    OSSafeReleaseNULL(path_);
+    OSSafeReleaseNULL(previousPath_);
     OSSafeReleaseNULL(pip_);
     super::free();
 }
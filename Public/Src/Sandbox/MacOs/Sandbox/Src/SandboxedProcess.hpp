@@ -16,6 +16,10 @@
  *
  * Process path is updated every time the process performs the 'exec' system call.
  * When a process forks, the child process inherits the path from its parent.
+ *
+ * Paths are shared, reference-counted strings: a forked child shares the path of its parent, and an exec of
+ * an image the pip has exec'd before shares the path in the exec image cache of the pip (see
+ * 'SandboxedPip::getCachedExecImage'), so neither copies nor allocates.
  */
 class SandboxedProcess : public OSObject
 {
@@ -29,14 +33,23 @@ private:
     /*! PID */
     pid_t id_;
 
-    /*! Full path to this process' executable */
-    char path_[MAXPATHLEN];
+    /*! Full (0-terminated) path to this process' executable, or NULL if none has been set */
+    Buffer * volatile path_;
 
-    /*! The length of the path stored in 'path_' */
-    int pathLength_;
+    /*!
+     * The path 'path_' replaced.  Reports may still be reading it (an exec can happen while other threads of the
+     * process report accesses), so it is only released when it gets replaced in turn, or with this object.
+     */
+    Buffer *previousPath_;
 
     bool init(pid_t processId, SandboxedPip *pip);
 
+    /*! Initializes a spare object, which 'bind' later turns into a process of a pip. */
+    bool initSpare();
+
+    /*! Makes a spare object the process 'processId' of 'pip'. */
+    void bind(pid_t processId, SandboxedPip *pip);
+
 protected:
 
     void free() override;
@@ -50,16 +63,19 @@ public:
     pid_t getPid() const                                 { return id_; }
 
     /*! Returns whether a full path has been set */
-    bool hasPath() const                                 { return path_[0] == '/'; }
+    bool hasPath() const                                 { Buffer *path = path_; return path != nullptr && path->getBytes()[0] == '/'; }
 
     /*! 0-terminated full path to the executable file of this process */
-    const char* getPath() const                          { return path_; }
+    const char* getPath() const                          { Buffer *path = path_; return path != nullptr ? path->getBytes() : ""; }
 
-    /*! Copies the 0-terminated string in 'path' to its own path buffer. */
-    void setPath(const char *path, int len = MAXPATHLEN) { strlcpy(path_, path, len); }
+    /*! The shared path of this process (not retained), or NULL if none has been set */
+    Buffer* getSharedPath() const                        { return path_; }
 
-    /*! An alternative to 'setPath': returns a buffer to which the caller can set the path. */
-    char* getPathBuffer()                                { return path_; }
+    /*! Copies the 0-terminated string in 'path' (up to 'len' - 1 characters) into a new shared path.  Allocates. */
+    void setPath(const char *path, int len = MAXPATHLEN);
+
+    /*! Makes this process share 'path' (a 0-terminated string, retained by this process), or clears its path if NULL. */
+    void setPath(Buffer *path);
 
 #pragma mark Static Methods
 
@@ -69,8 +85,16 @@ public:
      * First creates an object (by calling 'new'), then invokes 'init' on the newly create object.
      *
      * If new object cannot not be created, nullptr is returned.
+     *
+     * Takes one of the spare objects of 'pip' if it has any left, so that no allocation is needed.
      */
     static SandboxedProcess* create(pid_t processId, SandboxedPip *pip);
+
+    /*!
+     * Tops up the spare objects of 'pip' (see 'SandboxedPip::takeSpareProcess').  This allocates, so it
+     * should be called outside of hot paths like the fork handler.
+     */
+    static void refillSpares(SandboxedPip *pip);
 };
 
 #endif /* SandboxedProcess_hpp */
@@ -1,6 +1,8 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <stddef.h>
+
 #include "SysCtl.hpp"
 
 #if DEBUG
@@ -11,6 +13,9 @@ int g_bxl_enable_counters = 0;
 int g_bxl_verbose_logging = 0;
 #endif
 
+int g_bxl_enable_event_trace = 0;
+int g_bxl_enable_full_timing = 0;
+
 SYSCTL_INT(_kern,                               // parent
            OID_AUTO,                            // oid
            bxl_enable_counters,                 // name
@@ -27,14 +32,121 @@ SYSCTL_INT(_kern,
            0,
            "Enable/Disable verbose logging");
 
+SYSCTL_INT(_kern,
+           OID_AUTO,
+           bxl_enable_event_trace,
+           CTLFLAG_RW,
+           &g_bxl_enable_event_trace,
+           0,
+           "Enable/Disable the binary event trace");
+
+SYSCTL_INT(_kern,
+           OID_AUTO,
+           bxl_enable_full_timing,
+           CTLFLAG_RW,
+           &g_bxl_enable_full_timing,
+           0,
+           "Enable/Disable timing every event (instead of the configured sample) when counters are enabled");
+
+static bxl_stats_fn g_bxl_stats_fn = nullptr;
+static void *g_bxl_stats_data = nullptr;
+
+/*! Reads all the stats, and returns the one at offset 'arg2' of 'bxl_stats'. */
+static int bxl_sysctl_stat SYSCTL_HANDLER_ARGS
+{
+    bxl_stats stats = {0};
+    if (g_bxl_stats_fn != nullptr)
+    {
+        g_bxl_stats_fn(g_bxl_stats_data, &stats);
+    }
+
+    uint64_t value = *(uint64_t*)((char*)&stats + arg2);
+    return SYSCTL_OUT(req, &value, sizeof(value));
+}
+
+SYSCTL_NODE(_kern,
+            OID_AUTO,
+            bxl_stats,
+            CTLFLAG_RD | CTLFLAG_LOCKED,
+            0,
+            "Counters of the BuildXL sandbox");
+
+#define BXL_SYSCTL_STAT(name, field, description)                  \
+    SYSCTL_PROC(_kern_bxl_stats,                                    \
+                OID_AUTO,                                           \
+                name,                                               \
+                CTLTYPE_QUAD | CTLFLAG_RD | CTLFLAG_LOCKED,         \
+                nullptr,                                            \
+                offsetof(bxl_stats, field),                         \
+                bxl_sysctl_stat,                                    \
+                "QU",                                               \
+                description)
+
+BXL_SYSCTL_STAT(reports_sent,      reportsSent,      "Reports sent to the clients");
+BXL_SYSCTL_STAT(reports_queued,    reportsQueued,    "Reports in the report queues of the clients");
+BXL_SYSCTL_STAT(reports_spilled,   reportsSpilled,   "Reports spilled out of full report queues and not sent yet");
+BXL_SYSCTL_STAT(cache_hits,        cacheHits,        "Accesses found in the path caches of their pips");
+BXL_SYSCTL_STAT(cache_misses,      cacheMisses,      "Accesses not found in the path caches of their pips");
+BXL_SYSCTL_STAT(cache_hit_rate,    cacheHitRate,     "Hit rate of the path caches, in basis points");
+BXL_SYSCTL_STAT(tracked_processes, trackedProcesses, "Processes tracked by the sandbox");
+BXL_SYSCTL_STAT(blocked_processes, blockedProcesses, "Processes blocked because of resource usage");
+BXL_SYSCTL_STAT(trie_size_kb,      trieSizeKB,       "Memory of the nodes of all tries, in KB");
+
+static struct sysctl_oid *g_bxl_stats_oids[] = {
+    &sysctl__kern_bxl_stats_reports_sent,
+    &sysctl__kern_bxl_stats_reports_queued,
+    &sysctl__kern_bxl_stats_reports_spilled,
+    &sysctl__kern_bxl_stats_cache_hits,
+    &sysctl__kern_bxl_stats_cache_misses,
+    &sysctl__kern_bxl_stats_cache_hit_rate,
+    &sysctl__kern_bxl_stats_tracked_processes,
+    &sysctl__kern_bxl_stats_blocked_processes,
+    &sysctl__kern_bxl_stats_trie_size_kb,
+};
+
+void bxl_sysctl_register_stats(bxl_stats_fn fn, void *data)
+{
+    g_bxl_stats_data = data;
+    g_bxl_stats_fn   = fn;
+
+    sysctl_register_oid(&sysctl__kern_bxl_stats);
+    for (struct sysctl_oid *oid : g_bxl_stats_oids)
+    {
+        sysctl_register_oid(oid);
+    }
+}
+
+void bxl_sysctl_unregister_stats()
+{
+    if (g_bxl_stats_fn == nullptr)
+    {
+        return;
+    }
+
+    // unregistering an oid waits for the handlers running on it, so none reads from 'g_bxl_stats_data' afterwards
+    for (struct sysctl_oid *oid : g_bxl_stats_oids)
+    {
+        sysctl_unregister_oid(oid);
+    }
+
+    sysctl_unregister_oid(&sysctl__kern_bxl_stats);
+
+    g_bxl_stats_fn   = nullptr;
+    g_bxl_stats_data = nullptr;
+}
+
 void bxl_sysctl_register()
 {
     sysctl_register_oid(&sysctl__kern_bxl_enable_counters);
     sysctl_register_oid(&sysctl__kern_bxl_verbose_logging);
+    sysctl_register_oid(&sysctl__kern_bxl_enable_event_trace);
+    sysctl_register_oid(&sysctl__kern_bxl_enable_full_timing);
 }
 
 void bxl_sysctl_unregister()
 {
     sysctl_unregister_oid(&sysctl__kern_bxl_enable_counters);
     sysctl_unregister_oid(&sysctl__kern_bxl_verbose_logging);
+    sysctl_unregister_oid(&sysctl__kern_bxl_enable_event_trace);
+    sysctl_unregister_oid(&sysctl__kern_bxl_enable_full_timing);
 }
@@ -11,8 +11,37 @@
 
 extern int g_bxl_enable_counters;
 extern int g_bxl_verbose_logging;
+extern int g_bxl_enable_event_trace;
+extern int g_bxl_enable_full_timing;
 
 void bxl_sysctl_register();
 void bxl_sysctl_unregister();
 
+/*!
+ * The aggregate counters published as the read-only 'kern.bxl_stats.*' nodes, so that a monitoring agent can scrape
+ * them with 'sysctl' instead of introspecting the kext through a user client.  The counters of accesses and reports
+ * are only counted while 'kern.bxl_enable_counters' is set.
+ */
+typedef struct {
+    uint64_t reportsSent;
+    uint64_t reportsQueued;
+    uint64_t reportsSpilled;
+    uint64_t cacheHits;
+    uint64_t cacheMisses;
+    /*! Of the accesses looked up in the path caches, in basis points */
+    uint64_t cacheHitRate;
+    uint64_t trackedProcesses;
+    uint64_t blockedProcesses;
+    uint64_t trieSizeKB;
+} bxl_stats;
+
+typedef void (*bxl_stats_fn)(void *data, bxl_stats *stats);
+
+/*!
+ * Registers the 'kern.bxl_stats.*' nodes, which read their values from 'fn' whenever they are read.
+ * 'bxl_sysctl_unregister_stats' must be called before 'data' goes away; it waits for the reads in progress.
+ */
+void bxl_sysctl_register_stats(bxl_stats_fn fn, void *data);
+void bxl_sysctl_unregister_stats();
+
 #endif /* SysCtl_hpp */
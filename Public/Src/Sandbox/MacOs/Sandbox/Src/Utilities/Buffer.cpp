@@ -24,6 +24,22 @@ Buffer* Buffer::create(size_t size)
     return instance;
 }
 
+Buffer* Buffer::createMapped(IOMemoryDescriptor *descriptor, size_t size)
+{
+    Buffer *instance = new Buffer;
+    if (instance)
+    {
+        bool initialized = instance->initMapped(descriptor, size);
+        if (!initialized)
+        {
+            instance->release();
+            instance = nullptr;
+        }
+    }
+
+    return instance;
+}
+
 bool Buffer::init(size_t size)
 {
     if (!super::init())
@@ -31,15 +47,62 @@ bool Buffer::init(size_t size)
         return false;
     }
 
-    size_   = size;
-    buffer_ = IONew(char, size);
+    descriptor_ = nullptr;
+    map_        = nullptr;
+    size_       = size;
+    buffer_     = IONew(char, size);
 
     return buffer_ != nullptr;
 }
 
+bool Buffer::initMapped(IOMemoryDescriptor *descriptor, size_t size)
+{
+    if (!super::init())
+    {
+        return false;
+    }
+
+    descriptor_ = nullptr;
+    map_        = nullptr;
+    buffer_     = nullptr;
+    size_       = size;
+
+    if (descriptor == nullptr || descriptor->getLength() < size)
+    {
+        return false;
+    }
+
+    IOReturn status = descriptor->prepare(kIODirectionOut);
+    if (status != kIOReturnSuccess)
+    {
+        log_error("IOMemoryDescriptor::prepare failed, returning %#x", status);
+        return false;
+    }
+
+    // set only once prepared, so that 'free' knows to call 'complete'
+    descriptor->retain();
+    descriptor_ = descriptor;
+
+    map_ = descriptor->createMappingInTask(kernel_task, 0, kIOMapAnywhere | kIOMapReadOnly, 0, size);
+    if (map_ == nullptr)
+    {
+        log_error("%s", "IOMemoryDescriptor::createMappingInTask failed");
+        return false;
+    }
+
+    buffer_ = (char*)map_->getVirtualAddress();
+    return buffer_ != nullptr;
+}
+
 void Buffer::free()
 {
-    if (buffer_ != nullptr)
+    if (descriptor_ != nullptr)
+    {
+        OSSafeReleaseNULL(map_);
+        descriptor_->complete();
+        OSSafeReleaseNULL(descriptor_);
+    }
+    else if (buffer_ != nullptr)
     {
         IODelete(buffer_, char, size_);
     }
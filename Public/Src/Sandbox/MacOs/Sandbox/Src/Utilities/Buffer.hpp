@@ -11,7 +11,7 @@
 #define Buffer BXL_CLASS(Buffer)
 
 /*!
- * A reference-counted buffer
+ * A reference-counted buffer, either allocated by the kext or mapping memory of another task read-only.
  */
 class Buffer : public OSObject
 {
@@ -22,6 +22,10 @@ private:
     char *buffer_;
     size_t size_;
 
+    /*! When mapping memory of another task: the (prepared) descriptor of that memory, and its mapping into the kernel */
+    IOMemoryDescriptor *descriptor_;
+    IOMemoryMap *map_;
+
     /*!
      * Initializes this object, following the OSObject pattern.
      *
@@ -29,6 +33,9 @@ private:
      */
     bool init(size_t size);
 
+    /*! Same as 'init', but maps the memory of 'descriptor' instead of allocating some. */
+    bool initMapped(IOMemoryDescriptor *descriptor, size_t size);
+
 protected:
 
     /*!
@@ -54,6 +61,12 @@ public:
      * object and nullptr is returned.
      */
     static Buffer* create(size_t size);
+
+    /*!
+     * Same as 'create', except that the buffer maps the first 'size' bytes of 'descriptor' read-only instead of
+     * allocating memory.  The descriptor is prepared (which wires its pages) until the buffer is freed.
+     */
+    static Buffer* createMapped(IOMemoryDescriptor *descriptor, size_t size);
 };
 
 #endif /* Buffer_hpp */
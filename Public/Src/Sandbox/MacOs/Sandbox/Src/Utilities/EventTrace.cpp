@@ -0,0 +1,96 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <libkern/OSAtomic.h>
+#include "EventTrace.hpp"
+
+static const uint64_t kRingMask = kEventTraceRingCapacity - 1;
+
+EventTrace::Ring *EventTrace::s_rings = nullptr;
+
+bool EventTrace::Initialize()
+{
+    Ring *rings = (Ring*)IOMallocAligned(kEventTraceRingCount * sizeof(Ring), sizeof(void*));
+    if (rings == nullptr)
+    {
+        return false;
+    }
+
+    bzero(rings, kEventTraceRingCount * sizeof(Ring));
+    s_rings = rings;
+    return true;
+}
+
+void EventTrace::Free()
+{
+    Ring *rings = s_rings;
+    s_rings = nullptr;
+
+    if (rings != nullptr)
+    {
+        IOFreeAligned(rings, kEventTraceRingCount * sizeof(Ring));
+    }
+}
+
+void EventTrace::Record(TraceEvent event, pid_t pid, uint64_t arg0, uint64_t arg1)
+{
+    Ring *rings = s_rings;
+    if (rings == nullptr)
+    {
+        return;
+    }
+
+    // the CPU number is not part of the KPI, so threads are spread over the rings by their ids instead
+    Ring *ring = &rings[thread_tid(current_thread()) % kEventTraceRingCount];
+    uint64_t position = (uint64_t)OSIncrementAtomic64(&ring->head);
+    EventTraceRecord *record = &ring->records[position & kRingMask];
+
+    // readers skip the record until its sequence is set again, after all of its other fields
+    record->sequence = 0;
+    OSMemoryBarrier();
+
+    record->timestamp = mach_absolute_time();
+    record->pid       = pid;
+    record->event     = (uint16_t)event;
+    record->reserved  = 0;
+    record->args[0]   = arg0;
+    record->args[1]   = arg1;
+
+    OSMemoryBarrier();
+    record->sequence = position + 1;
+}
+
+bool EventTrace::Dump(uint ring, EventTraceDumpResponse *response)
+{
+    response->numWritten = 0;
+    response->numRecords = 0;
+
+    Ring *rings = s_rings;
+    if (rings == nullptr || ring >= kEventTraceRingCount)
+    {
+        return false;
+    }
+
+    const Ring *source = &rings[ring];
+    uint64_t head = (uint64_t)source->head;
+    uint64_t first = head > kEventTraceRingCapacity ? head - kEventTraceRingCapacity : 0;
+
+    for (uint64_t position = first; position < head; position++)
+    {
+        const EventTraceRecord *record = &source->records[position & kRingMask];
+        uint64_t sequence = record->sequence;
+        OSMemoryBarrier();
+
+        EventTraceRecord copy = *record;
+
+        // the record is left out if it was being written, or was overwritten, while being copied
+        OSMemoryBarrier();
+        if (sequence == position + 1 && record->sequence == sequence)
+        {
+            response->records[response->numRecords++] = copy;
+        }
+    }
+
+    response->numWritten = head;
+    return true;
+}
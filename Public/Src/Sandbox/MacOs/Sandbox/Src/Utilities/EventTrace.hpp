@@ -0,0 +1,54 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef EventTrace_hpp
+#define EventTrace_hpp
+
+#include <IOKit/IOLib.h>
+#include "BuildXLSandboxShared.hpp"
+
+#define EventTrace BXL_CLASS(EventTrace)
+
+/*!
+ * A kext-wide trace of binary event records (see 'EventTraceRecord'), cheap enough to be left on in production
+ * (see 'g_bxl_enable_event_trace') where formatting 'os_log' messages is not.
+ *
+ * Records go into 'kEventTraceRingCount' rings of 'kEventTraceRingCapacity' records each, picked by the id of the
+ * recording thread.  A ring is written without locks: a writer claims the next position by atomically incrementing
+ * the ring's head and overwrites whatever record was there.  Clients dump the rings (see 'kIpcActionDumpEventTrace')
+ * and merge them by time stamp.
+ */
+class EventTrace
+{
+private:
+
+    typedef struct {
+        volatile SInt64 head;
+        EventTraceRecord records[kEventTraceRingCapacity];
+    } Ring;
+
+    static Ring *s_rings;
+
+public:
+
+    /*! Allocates the rings; nothing is recorded until this succeeds. */
+    static bool Initialize();
+    static void Free();
+
+    /*! Adds a record to the ring of the current thread. */
+    static void Record(TraceEvent event, pid_t pid, uint64_t arg0, uint64_t arg1);
+
+    /*!
+     * Copies the records of ring 'ring' into 'response'.
+     *
+     * @result False if there is no such ring.
+     */
+    static bool Dump(uint ring, EventTraceDumpResponse *response);
+};
+
+#define bxl_trace(event, pid, arg0, arg1) \
+do {                                      \
+    if (g_bxl_enable_event_trace) EventTrace::Record(event, pid, (uint64_t)(arg0), (uint64_t)(arg1)); \
+} while(0)
+
+#endif /* EventTrace_hpp */
@@ -3,6 +3,37 @@
 
 #include "Stopwatch.hpp"
 
+typedef struct {
+    uint32_t ticks;
+} __attribute__((aligned(64))) TimingSampleSlot;
+
+static TimingSampleSlot s_sampleSlots[kTimingSampleSlotCount];
+static uint s_sampleRate = 1;
+
+void Stopwatch::SetSampleRate(uint rate)
+{
+    s_sampleRate = rate > 1 ? rate : 1;
+}
+
+uint32_t Stopwatch::SampleEvent()
+{
+    if (!g_bxl_enable_counters)
+    {
+        return 0;
+    }
+
+    uint rate = s_sampleRate;
+    if (rate <= 1 || g_bxl_enable_full_timing)
+    {
+        return 1;
+    }
+
+    // the CPU number is not part of the KPI, so threads are spread over the slots by their ids instead; threads
+    // sharing a slot may lose ticks, which only shifts which of their events get timed
+    TimingSampleSlot *slot = &s_sampleSlots[thread_tid(current_thread()) % kTimingSampleSlotCount];
+    return (++slot->ticks % rate) == 0 ? rate : 0;
+}
+
 void Stopwatch::reset()
 {
     start_ = lastLap_ = time();
@@ -10,8 +41,13 @@ void Stopwatch::reset()
 
 Timespan Stopwatch::lap()
 {
+    if (weight_ == 0)
+    {
+        return Timespan::unmeasured();
+    }
+
     uint64_t newLap = time();
-    Timespan duration = Timespan::fromNanoseconds(newLap - lastLap_);
+    Timespan duration = Timespan::fromNanoseconds(newLap - lastLap_, weight_);
     lastLap_ = newLap;
     return duration;
 }
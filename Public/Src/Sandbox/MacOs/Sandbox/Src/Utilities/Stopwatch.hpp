@@ -7,26 +7,46 @@
 #include <IOKit/IOLib.h>
 #include "BuildXLSandboxShared.hpp"
 
+// Number of event tick counters used to decide which events to time, see 'Stopwatch::SampleEvent'
+#define kTimingSampleSlotCount 64
+
 class Stopwatch
 {
 private:
-    bool enabled_;
+    uint32_t weight_;
     uint64_t start_;
     uint64_t lastLap_;
 
     uint64_t time()
     {
-        return enabled_ ? mach_absolute_time() : 0;
+        return weight_ > 0 ? mach_absolute_time() : 0;
     }
 
 public:
 
-    Stopwatch(bool enabled = g_bxl_enable_counters) : enabled_(enabled)
+    /*!
+     * Decides whether the current event is to be timed.  Only 1 in every 'timingSampleRate' events (see 'KextConfig')
+     * of a thread slot is, unless 'g_bxl_enable_full_timing' is set; no event is when counters are disabled.
+     *
+     * @return The weight of the durations measured for the event (i.e., the number of events it stands for),
+     *         or 0 if the event is not to be timed.
+     */
+    static uint32_t SampleEvent();
+
+    /*! Sets the rate at which 'SampleEvent' picks events to time (0 and 1 mean every event). */
+    static void SetSampleRate(uint rate);
+
+    Stopwatch(uint32_t weight = SampleEvent()) : weight_(weight)
     {
         reset();
     }
 
+    uint32_t weight() const { return weight_; }
+    bool isTiming()   const { return weight_ > 0; }
+
     void reset();
+
+    /*! The time since the last lap (carrying the weight of this stopwatch), 'Timespan::unmeasured' if not timing. */
     Timespan lap();
 };
 
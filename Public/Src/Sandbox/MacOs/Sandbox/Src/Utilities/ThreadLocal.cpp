@@ -3,7 +3,6 @@
 
 #include "ThreadLocal.hpp"
 #include "BuildXLSandboxShared.hpp"
-#include "SandboxedPip.hpp"
 
 #define super OSObject
 
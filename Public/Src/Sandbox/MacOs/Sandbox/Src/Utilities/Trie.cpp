@@ -5,77 +5,377 @@
 
 #define super OSObject
 
-// ================================== class Node ==================================
+// ================================== class NodeArena ==================================
+
+#define ChunkHeaderSize offsetof(NodeArena::Chunk, bytes)
+#define AlignedSize(size) (((size) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+void NodeArena::init(uint objectSize)
+{
+    objects_    = nullptr;
+    bytes_      = nullptr;
+    objectSize_ = AlignedSize(objectSize);
+}
+
+void* NodeArena::allocate(Chunk * volatile *head, uint size)
+{
+    size = AlignedSize(size);
+    while (true)
+    {
+        Chunk *chunk = *head;
+        if (chunk != nullptr)
+        {
+            SInt32 offset = OSAddAtomic(size, &chunk->used);
+            if (offset + size <= chunk->capacity)
+            {
+                return (uint8_t*)chunk->bytes + offset;
+            }
+
+            // the chunk is full --> whatever is left of it is lost
+        }
+
+        uint capacity = size > s_chunkSize ? size : s_chunkSize;
+        Chunk *fresh = (Chunk*)IOMalloc(ChunkHeaderSize + capacity);
+        if (fresh == nullptr)
+        {
+            return nullptr;
+        }
+
+        bzero(fresh, ChunkHeaderSize + capacity);
+        fresh->next     = chunk;
+        fresh->capacity = capacity;
+
+        // the allocation is taken from the new chunk before anyone else can see it
+        fresh->used     = size;
+
+        if (OSCompareAndSwapPtr(chunk, fresh, head))
+        {
+            return fresh->bytes;
+        }
+
+        // someone else added a chunk first --> release 'fresh' that we created for nothing and retry with theirs
+        IOFree(fresh, ChunkHeaderSize + capacity);
+    }
+}
+
+void NodeArena::forEachObject(void (*callback)(void *object)) const
+{
+    for (Chunk *chunk = objects_; chunk != nullptr; chunk = chunk->next)
+    {
+        uint used = (uint)chunk->used < chunk->capacity ? (uint)chunk->used : chunk->capacity;
+        for (uint offset = 0; offset + objectSize_ <= used; offset += objectSize_)
+        {
+            callback((uint8_t*)chunk->bytes + offset);
+        }
+    }
+}
+
+void NodeArena::freeAll()
+{
+    Chunk *lists[] = { objects_, bytes_ };
+    for (Chunk *chunk : lists)
+    {
+        while (chunk != nullptr)
+        {
+            Chunk *next = chunk->next;
+            IOFree(chunk, ChunkHeaderSize + chunk->capacity);
+            chunk = next;
+        }
+    }
+
+    objects_ = nullptr;
+    bytes_   = nullptr;
+}
 
-OSDefineMetaClassAndStructors(Node, OSObject)
+// ================================== class Node ==================================
 
 uint Node::s_numUintNodes = 0;
 uint Node::s_numPathNodes = 0;
 
-Node* Node::create(uint numChildren)
+SInt64 Node::s_uintChildrenBytes = 0;
+SInt64 Node::s_pathChildrenBytes = 0;
+SInt64 Node::s_pathLabelBytes = 0;
+
+#define ChildrenTableSize(capacity) (sizeof(Node::Children) + ((capacity) - 1) * sizeof(Node*))
+
+Node* Node::create(NodeArena *arena, uint numChildren, uint capacity, uint labelLength)
 {
-    Node *instance = new Node;
+    Node *instance = (Node*)arena->allocateObject();
     if (instance != nullptr)
     {
         if (numChildren == s_uintNodeChildrenCount)      OSIncrementAtomic(&s_numUintNodes);
         else if (numChildren == s_pathNodeChildrenCount) OSIncrementAtomic(&s_numPathNodes);
 
-        if (!instance->init(numChildren))
+        // a node that fails to initialize stays in the arena, where 'release' finds it when the trie is freed
+        if (!instance->init(arena, numChildren, capacity, labelLength))
         {
-            OSSafeReleaseNULL(instance);
+            instance = nullptr;
         }
     }
 
     return instance;
 }
 
-bool Node::init(uint numChildren)
+bool Node::init(NodeArena *arena, uint numChildren, uint capacity, uint labelLength)
 {
-    if (!super::init())
+    // set before anything can fail, so that 'release' finds a consistent node
+    record_ = nullptr;
+    childrenLength_ = numChildren;
+    label_ = nullptr;
+    labelLength_ = 0;
+    children_ = nullptr;
+
+    if (labelLength > 0)
+    {
+        label_ = (uint8_t*)arena->allocateBytes(labelLength);
+        if (label_ == nullptr)
+        {
+            return false;
+        }
+
+        labelLength_ = labelLength;
+        OSAddAtomic64(labelLength, &s_pathLabelBytes);
+    }
+
+    children_ = createChildren(arena, capacity);
+    return children_ != nullptr;
+}
+
+Node::Children* Node::createChildren(NodeArena *arena, uint capacity) const
+{
+    // zero-filled by the arena, so all the slots start empty
+    Children *table = (Children*)arena->allocateBytes(ChildrenTableSize(capacity));
+    if (table == nullptr)
+    {
+        return nullptr;
+    }
+
+    table->capacity = capacity;
+
+    OSAddAtomic64(ChildrenTableSize(capacity),
+                  length() == s_pathNodeChildrenCount ? &s_pathChildrenBytes : &s_uintChildrenBytes);
+    return table;
+}
+
+void Node::freeChildren(Children *table) const
+{
+    OSAddAtomic64(-(SInt64)ChildrenTableSize(table->capacity),
+                  length() == s_pathNodeChildrenCount ? &s_pathChildrenBytes : &s_uintChildrenBytes);
+}
+
+Node* Node::findChild(uint idx) const
+{
+    Children *table = children_;
+    if (table->capacity == length())
+    {
+        return unfreeze(table->slots[idx]);
+    }
+
+    for (int i = 0; i < table->capacity; i++)
+    {
+        Node *child = unfreeze(table->slots[i]);
+
+        // children fill the slots from the start --> the first empty slot ends the search
+        if (child == nullptr)
+        {
+            break;
+        }
+
+        if (keyOf(child) == idx)
+        {
+            return child;
+        }
+    }
+
+    return nullptr;
+}
+
+Node* Node::addChild(NodeArena *arena, uint idx, Node *child)
+{
+    while (true)
+    {
+        Children *table = children_;
+        if (table->capacity == length())
+        {
+            // full tables never get replaced, so their slots are never frozen
+            if (OSCompareAndSwapPtr(nullptr, child, &table->slots[idx]))
+            {
+                return child;
+            }
+
+            // someone else added a child for this key first
+            return table->slots[idx];
+        }
+
+        for (int i = 0; i < table->capacity; i++)
+        {
+            Node *existing = table->slots[i];
+            if (existing == nullptr)
+            {
+                if (OSCompareAndSwapPtr(nullptr, child, &table->slots[i]))
+                {
+                    return child;
+                }
+
+                // someone else filled or froze this slot first --> look at what is there now
+                existing = table->slots[i];
+            }
+
+            if (isFrozen(existing))
+            {
+                existing = unfreeze(existing);
+                if (existing == nullptr)
+                {
+                    break;
+                }
+            }
+
+            if (keyOf(existing) == idx)
+            {
+                return existing;
+            }
+        }
+
+        // the table is full or being replaced --> grow it (or help whoever is replacing it) and retry
+        if (!grow(arena, table))
+        {
+            return nullptr;
+        }
+    }
+}
+
+bool Node::replaceChild(NodeArena *arena, uint idx, Node *oldChild, Node *newChild)
+{
+    while (true)
+    {
+        Children *table = children_;
+        Node **slot = nullptr;
+        if (table->capacity == length())
+        {
+            slot = &table->slots[idx];
+        }
+        else
+        {
+            for (int i = 0; i < table->capacity && slot == nullptr; i++)
+            {
+                if (unfreeze(table->slots[i]) == oldChild)
+                {
+                    slot = &table->slots[i];
+                }
+            }
+        }
+
+        if (slot == nullptr || unfreeze(*slot) != oldChild)
+        {
+            // someone else replaced 'oldChild' first
+            return false;
+        }
+
+        if (OSCompareAndSwapPtr(oldChild, newChild, slot))
+        {
+            return true;
+        }
+
+        // the slot either got replaced (caught above on retry) or frozen --> help whoever is replacing the table and retry
+        if (isFrozen(*slot) && !grow(arena, table))
+        {
+            return false;
+        }
+    }
+}
+
+bool Node::grow(NodeArena *arena, Children *table)
+{
+    // freeze the table first so that none of its slots changes after it is copied
+    for (int i = 0; i < table->capacity; i++)
+    {
+        Node *slot;
+        do
+        {
+            slot = table->slots[i];
+        } while (!isFrozen(slot) && !OSCompareAndSwapPtr(slot, freeze(slot), &table->slots[i]));
+    }
+
+    if (children_ != table)
+    {
+        // someone else already replaced it
+        return true;
+    }
+
+    uint capacity = table->capacity < s_pathNodeGrownCapacity ? s_pathNodeGrownCapacity :
+                    table->capacity < s_pathNodeLargeCapacity ? s_pathNodeLargeCapacity :
+                    length();
+    Children *bigger = createChildren(arena, capacity);
+    if (bigger == nullptr)
     {
         return false;
     }
 
-    record_ = nullptr;
-    childrenLength_ = numChildren;
-    children_ = IONew(Node*, numChildren);
+    uint count = 0;
+    for (int i = 0; i < table->capacity; i++)
+    {
+        Node *child = unfreeze(table->slots[i]);
+        if (child == nullptr)
+        {
+            break;
+        }
+
+        if (capacity == length()) bigger->slots[keyOf(child)] = child;
+        else                      bigger->slots[count++]      = child;
+    }
 
-    for (int i = 0; i < childrenLength_; i++)
+    bigger->retired = table;
+    if (!OSCompareAndSwapPtr(table, bigger, &children_))
     {
-        children_[i] = nullptr;
+        // someone else came first with the same copy --> release 'bigger' that we created for nothing
+        freeChildren(bigger);
     }
 
     return true;
 }
 
-void Node::free()
+void Node::release(void *object)
 {
-    for (int i = 0; i < childrenLength_; i++)
+    Node *node = (Node*)object;
+    if (node->length() == 0)
     {
-        children_[i] = nullptr;
+        // allocated by a thread that stopped before initializing it
+        return;
     }
 
-    IODelete(children_, Node*, childrenLength_);
-    children_ = nullptr;
+    // the memory of the children tables and of the label is freed with the arena
+    Children *table = node->children_;
+    while (table != nullptr)
+    {
+        Children *retired = table->retired;
+        node->freeChildren(table);
+        table = retired;
+    }
 
-    OSSafeReleaseNULL(record_);
+    node->children_ = nullptr;
 
-    if (length() == s_uintNodeChildrenCount)      OSDecrementAtomic(&s_numUintNodes);
-    else if (length() == s_pathNodeChildrenCount) OSDecrementAtomic(&s_numPathNodes);
+    if (node->label_ != nullptr)
+    {
+        OSAddAtomic64(-(SInt64)node->labelLength_, &s_pathLabelBytes);
+        node->label_ = nullptr;
+    }
 
-    super::free();
+    OSSafeReleaseNULL(node->record_);
+
+    if (node->length() == s_uintNodeChildrenCount)      OSDecrementAtomic(&s_numUintNodes);
+    else if (node->length() == s_pathNodeChildrenCount) OSDecrementAtomic(&s_numPathNodes);
 }
 
 // ================================== class Trie ==================================
 
 OSDefineMetaClassAndStructors(Trie, OSObject)
 
-Trie* Trie::create(TrieKind kind)
+Trie* Trie::create(TrieKind kind, const OSMetaClass *valueClass)
 {
     Trie *instance = new Trie;
     if (instance != nullptr)
     {
-        if (!instance->init(kind))
+        if (!instance->init(kind, valueClass))
         {
             OSSafeReleaseNULL(instance);
         }
@@ -84,15 +384,19 @@ Trie* Trie::create(TrieKind kind)
     return instance;
 }
 
-bool Trie::init(TrieKind kind)
+bool Trie::init(TrieKind kind, const OSMetaClass *valueClass)
 {
+    // set before anything can fail, so that 'free' finds an empty arena
+    arena_.init(sizeof(Node));
+
     if (!super::init())
     {
         return false;
     }
 
     kind_ = kind;
-    root_ = createNode();
+    valueClass_ = valueClass;
+    root_ = createRootNode();
     if (root_ == nullptr)
     {
         return false;
@@ -103,10 +407,9 @@ bool Trie::init(TrieKind kind)
 
 void Trie::free()
 {
-    traverse(/*computeKey*/ false, /*callbackArgs*/ nullptr, [](Trie*, void*, uint64_t, Node *n)
-             {
-                 OSSafeReleaseNULL(n);
-             });
+    // walking the node chunks visits every node (including the ones lost in races) without following the children tables
+    arena_.forEachObject(Node::release);
+    arena_.freeAll();
 
     root_ = nullptr;
     size_ = 0;
@@ -114,31 +417,29 @@ void Trie::free()
     super::free();
 }
 
-bool Trie::ensureChildNodeExists(Node *node, int idx)
+Node* Trie::ensureChildNodeExists(Node *node, int idx)
 {
     if (idx < 0 || idx >= node->length())
     {
-        return false;
+        return nullptr;
     }
 
-    if (node->children()[idx] == nullptr)
+    Node *child = node->findChild(idx);
+    if (child == nullptr)
     {
-        Node* newNode = createNode();
+        Node* newNode = Node::createUintNode(&arena_);
 
         // This should never happen except if we run out of memory.
         if (newNode == nullptr)
         {
-            return false;
+            return nullptr;
         }
 
-        if (!OSCompareAndSwapPtr(nullptr, newNode, &node->children()[idx]))
-        {
-            // someone else created this child node before us --> release 'newNode' that we created for nothing
-            OSSafeReleaseNULL(newNode);
-        }
+        // if someone else created this child node before us (or we ran out of memory), 'newNode' stays unused in the arena
+        child = node->addChild(&arena_, idx, newNode);
     }
 
-    return true;
+    return child;
 }
 
 Trie::TrieResult Trie::makeSentinel(Node *node, void *factoryArgs, factory_fn factory)
@@ -155,6 +456,12 @@ Trie::TrieResult Trie::makeSentinel(Node *node, void *factoryArgs, factory_fn fa
         return kTrieResultAlreadyExists;
     }
 
+    if (!acceptsValue(newRecord))
+    {
+        OSSafeReleaseNULL(newRecord);
+        return kTrieResultFailure;
+    }
+
     if (OSCompareAndSwapPtr(nullptr, newRecord, &node->record_))
     {
         // we updated 'record_' --> retain (by not releasing created newRecord) and increase trie size
@@ -185,7 +492,7 @@ OSObject* Trie::getOrAdd(Node *node, void *factoryArgs, factory_fn factory, Trie
 
 Trie::TrieResult Trie::replace(Node *node, const OSObject *value)
 {
-    if (node == nullptr || value == nullptr)
+    if (node == nullptr || value == nullptr || !acceptsValue(value))
     {
         return kTrieResultFailure;
     }
@@ -219,7 +526,7 @@ Trie::TrieResult Trie::replace(Node *node, const OSObject *value)
 
 Trie::TrieResult Trie::insert(Node *node, const OSObject *value)
 {
-    if (node == nullptr || value == nullptr)
+    if (node == nullptr || value == nullptr || !acceptsValue(value))
     {
         return kTrieResultFailure;
     }
@@ -272,10 +579,12 @@ Trie::TrieResult Trie::remove(Node *node)
 
  printf("static int s_char2idx[] = \n");
  printf("{\n");
+ int next = 65;
  for (int ch = 0; ch < 256; ch++)
  {
      int idx = toupper(ch) - 32;
-     if (idx < 0 || idx >= 65) idx = -1;
+     if (ch == 0) idx = -1;
+     else if (ch < 32 || ch > 122) idx = next++;
      printf("    %2d, // '%c' (\\%2d)\n", idx, ch < 32 || ch > 126 ? 0 : ch, ch);
  }
  printf("};\n");
@@ -283,47 +592,47 @@ Trie::TrieResult Trie::remove(Node *node)
 static int s_char2idx[256] =
 {
     -1, // '' (\0)
-    -1, // '' (\1)
-    -1, // '' (\2)
-    -1, // '' (\3)
-    -1, // '' (\4)
-    -1, // '' (\5)
-    -1, // '' (\6)
-    -1, // '' (\7)
-    -1, // '' (\8)
-    -1, // '' (\9)
-    -1, // '' (\10)
-    -1, // '' (\11)
-    -1, // '' (\12)
-    -1, // '' (\13)
-    -1, // '' (\14)
-    -1, // '' (\15)
-    -1, // '' (\16)
-    -1, // '' (\17)
-    -1, // '' (\18)
-    -1, // '' (\19)
-    -1, // '' (\20)
-    -1, // '' (\21)
-    -1, // '' (\22)
-    -1, // '' (\23)
-    -1, // '' (\24)
-    -1, // '' (\25)
-    -1, // '' (\26)
-    -1, // '' (\27)
-    -1, // '' (\28)
-    -1, // '' (\29)
-    -1, // '' (\30)
-    -1, // '' (\31)
-    0, // ' ' (\32)
-    1, // '!' (\33)
-    2, // '"' (\34)
-    3, // '#' (\35)
-    4, // '$' (\36)
-    5, // '%' (\37)
-    6, // '&' (\38)
-    7, // ''' (\39)
-    8, // '(' (\40)
-    9, // ')' (\41)
+    65, // '' (\1)
+    66, // '' (\2)
+    67, // '' (\3)
+    68, // '' (\4)
+    69, // '' (\5)
+    70, // '' (\6)
+    71, // '' (\7)
+    72, // '' (\8)
+    73, // '' (\9)
+    74, // '' (\10)
+    75, // '' (\11)
+    76, // '' (\12)
+    77, // '' (\13)
+    78, // '' (\14)
+    79, // '' (\15)
+    80, // '' (\16)
+    81, // '' (\17)
+    82, // '' (\18)
+    83, // '' (\19)
+    84, // '' (\20)
+    85, // '' (\21)
+    86, // '' (\22)
+    87, // '' (\23)
+    88, // '' (\24)
+    89, // '' (\25)
+    90, // '' (\26)
+    91, // '' (\27)
+    92, // '' (\28)
+    93, // '' (\29)
+    94, // '' (\30)
+    95, // '' (\31)
+     0, // ' ' (\32)
+     1, // '!' (\33)
+     2, // '"' (\34)
+     3, // '#' (\35)
+     4, // '$' (\36)
+     5, // '%' (\37)
+     6, // '&' (\38)
+     7, // ''' (\39)
+     8, // '(' (\40)
+     9, // ')' (\41)
     10, // '*' (\42)
     11, // '+' (\43)
     12, // ',' (\44)
@@ -405,156 +714,279 @@ static int s_char2idx[256] =
     56, // 'x' (\120)
     57, // 'y' (\121)
     58, // 'z' (\122)
-    -1, // '{' (\123)
-    -1, // '|' (\124)
-    -1, // '}' (\125)
-    -1, // '~' (\126)
-    -1, // '' (\127)
-    -1, // '' (\128)
-    -1, // '' (\129)
-    -1, // '' (\130)
-    -1, // '' (\131)
-    -1, // '' (\132)
-    -1, // '' (\133)
-    -1, // '' (\134)
-    -1, // '' (\135)
-    -1, // '' (\136)
-    -1, // '' (\137)
-    -1, // '' (\138)
-    -1, // '' (\139)
-    -1, // '' (\140)
-    -1, // '' (\141)
-    -1, // '' (\142)
-    -1, // '' (\143)
-    -1, // '' (\144)
-    -1, // '' (\145)
-    -1, // '' (\146)
-    -1, // '' (\147)
-    -1, // '' (\148)
-    -1, // '' (\149)
-    -1, // '' (\150)
-    -1, // '' (\151)
-    -1, // '' (\152)
-    -1, // '' (\153)
-    -1, // '' (\154)
-    -1, // '' (\155)
-    -1, // '' (\156)
-    -1, // '' (\157)
-    -1, // '' (\158)
-    -1, // '' (\159)
-    -1, // '' (\160)
-    -1, // '' (\161)
-    -1, // '' (\162)
-    -1, // '' (\163)
-    -1, // '' (\164)
-    -1, // '' (\165)
-    -1, // '' (\166)
-    -1, // '' (\167)
-    -1, // '' (\168)
-    -1, // '' (\169)
-    -1, // '' (\170)
-    -1, // '' (\171)
-    -1, // '' (\172)
-    -1, // '' (\173)
-    -1, // '' (\174)
-    -1, // '' (\175)
-    -1, // '' (\176)
-    -1, // '' (\177)
-    -1, // '' (\178)
-    -1, // '' (\179)
-    -1, // '' (\180)
-    -1, // '' (\181)
-    -1, // '' (\182)
-    -1, // '' (\183)
-    -1, // '' (\184)
-    -1, // '' (\185)
-    -1, // '' (\186)
-    -1, // '' (\187)
-    -1, // '' (\188)
-    -1, // '' (\189)
-    -1, // '' (\190)
-    -1, // '' (\191)
-    -1, // '' (\192)
-    -1, // '' (\193)
-    -1, // '' (\194)
-    -1, // '' (\195)
-    -1, // '' (\196)
-    -1, // '' (\197)
-    -1, // '' (\198)
-    -1, // '' (\199)
-    -1, // '' (\200)
-    -1, // '' (\201)
-    -1, // '' (\202)
-    -1, // '' (\203)
-    -1, // '' (\204)
-    -1, // '' (\205)
-    -1, // '' (\206)
-    -1, // '' (\207)
-    -1, // '' (\208)
-    -1, // '' (\209)
-    -1, // '' (\210)
-    -1, // '' (\211)
-    -1, // '' (\212)
-    -1, // '' (\213)
-    -1, // '' (\214)
-    -1, // '' (\215)
-    -1, // '' (\216)
-    -1, // '' (\217)
-    -1, // '' (\218)
-    -1, // '' (\219)
-    -1, // '' (\220)
-    -1, // '' (\221)
-    -1, // '' (\222)
-    -1, // '' (\223)
-    -1, // '' (\224)
-    -1, // '' (\225)
-    -1, // '' (\226)
-    -1, // '' (\227)
-    -1, // '' (\228)
-    -1, // '' (\229)
-    -1, // '' (\230)
-    -1, // '' (\231)
-    -1, // '' (\232)
-    -1, // '' (\233)
-    -1, // '' (\234)
-    -1, // '' (\235)
-    -1, // '' (\236)
-    -1, // '' (\237)
-    -1, // '' (\238)
-    -1, // '' (\239)
-    -1, // '' (\240)
-    -1, // '' (\241)
-    -1, // '' (\242)
-    -1, // '' (\243)
-    -1, // '' (\244)
-    -1, // '' (\245)
-    -1, // '' (\246)
-    -1, // '' (\247)
-    -1, // '' (\248)
-    -1, // '' (\249)
-    -1, // '' (\250)
-    -1, // '' (\251)
-    -1, // '' (\252)
-    -1, // '' (\253)
-    -1, // '' (\254)
-    -1, // '' (\255)
+    96, // '{' (\123)
+    97, // '|' (\124)
+    98, // '}' (\125)
+    99, // '~' (\126)
+    100, // '' (\127)
+    101, // '' (\128)
+    102, // '' (\129)
+    103, // '' (\130)
+    104, // '' (\131)
+    105, // '' (\132)
+    106, // '' (\133)
+    107, // '' (\134)
+    108, // '' (\135)
+    109, // '' (\136)
+    110, // '' (\137)
+    111, // '' (\138)
+    112, // '' (\139)
+    113, // '' (\140)
+    114, // '' (\141)
+    115, // '' (\142)
+    116, // '' (\143)
+    117, // '' (\144)
+    118, // '' (\145)
+    119, // '' (\146)
+    120, // '' (\147)
+    121, // '' (\148)
+    122, // '' (\149)
+    123, // '' (\150)
+    124, // '' (\151)
+    125, // '' (\152)
+    126, // '' (\153)
+    127, // '' (\154)
+    128, // '' (\155)
+    129, // '' (\156)
+    130, // '' (\157)
+    131, // '' (\158)
+    132, // '' (\159)
+    133, // '' (\160)
+    134, // '' (\161)
+    135, // '' (\162)
+    136, // '' (\163)
+    137, // '' (\164)
+    138, // '' (\165)
+    139, // '' (\166)
+    140, // '' (\167)
+    141, // '' (\168)
+    142, // '' (\169)
+    143, // '' (\170)
+    144, // '' (\171)
+    145, // '' (\172)
+    146, // '' (\173)
+    147, // '' (\174)
+    148, // '' (\175)
+    149, // '' (\176)
+    150, // '' (\177)
+    151, // '' (\178)
+    152, // '' (\179)
+    153, // '' (\180)
+    154, // '' (\181)
+    155, // '' (\182)
+    156, // '' (\183)
+    157, // '' (\184)
+    158, // '' (\185)
+    159, // '' (\186)
+    160, // '' (\187)
+    161, // '' (\188)
+    162, // '' (\189)
+    163, // '' (\190)
+    164, // '' (\191)
+    165, // '' (\192)
+    166, // '' (\193)
+    167, // '' (\194)
+    168, // '' (\195)
+    169, // '' (\196)
+    170, // '' (\197)
+    171, // '' (\198)
+    172, // '' (\199)
+    173, // '' (\200)
+    174, // '' (\201)
+    175, // '' (\202)
+    176, // '' (\203)
+    177, // '' (\204)
+    178, // '' (\205)
+    179, // '' (\206)
+    180, // '' (\207)
+    181, // '' (\208)
+    182, // '' (\209)
+    183, // '' (\210)
+    184, // '' (\211)
+    185, // '' (\212)
+    186, // '' (\213)
+    187, // '' (\214)
+    188, // '' (\215)
+    189, // '' (\216)
+    190, // '' (\217)
+    191, // '' (\218)
+    192, // '' (\219)
+    193, // '' (\220)
+    194, // '' (\221)
+    195, // '' (\222)
+    196, // '' (\223)
+    197, // '' (\224)
+    198, // '' (\225)
+    199, // '' (\226)
+    200, // '' (\227)
+    201, // '' (\228)
+    202, // '' (\229)
+    203, // '' (\230)
+    204, // '' (\231)
+    205, // '' (\232)
+    206, // '' (\233)
+    207, // '' (\234)
+    208, // '' (\235)
+    209, // '' (\236)
+    210, // '' (\237)
+    211, // '' (\238)
+    212, // '' (\239)
+    213, // '' (\240)
+    214, // '' (\241)
+    215, // '' (\242)
+    216, // '' (\243)
+    217, // '' (\244)
+    218, // '' (\245)
+    219, // '' (\246)
+    220, // '' (\247)
+    221, // '' (\248)
+    222, // '' (\249)
+    223, // '' (\250)
+    224, // '' (\251)
+    225, // '' (\252)
+    226, // '' (\253)
+    227, // '' (\254)
+    228, // '' (\255)
 };
 
 static_assert(CHAR_BIT == 8, "char is not 8 bits long");
 static_assert(UCHAR_MAX == 255, "max unsigned char is not 255");
 
+Node* Trie::splitEdge(Node *parent, Node *child, uint labelLength)
+{
+    Node *middle = Node::createPathNode(&arena_, labelLength);
+    if (middle == nullptr)
+    {
+        return nullptr;
+    }
+
+    memcpy(middle->label_, child->label_, labelLength);
+    middle->children_->slots[0] = child;
+
+    if (!parent->replaceChild(&arena_, parent->keyOf(child), child, middle))
+    {
+        // someone else split this edge (or the system is out of memory) --> 'middle' stays unused in the arena
+        middle->children_->slots[0] = nullptr;
+        return nullptr;
+    }
+
+    return middle;
+}
+
 Node* Trie::findPathNode(const char *path)
 {
     Node *currNode = root_;
-    unsigned char ch;
-    while ((ch = *path++) != '\0')
+    uint depth = 0; // == currNode->labelLength_
+    uint nodeDepth = 0;
+    while (path[depth] != '\0')
     {
-        int idx = s_char2idx[ch];
-        if (!ensureChildNodeExists(currNode, idx))
+        int idx = s_char2idx[(unsigned char)path[depth]];
+        if (idx < 0 || ++nodeDepth > Node::s_maxPathNodeDepth)
         {
             return nullptr;
         }
-        currNode = currNode->children()[idx];
+
+        Node *child = currNode->findChild(idx);
+        if (child == nullptr)
+        {
+            // new leaf for all the remaining characters, which are checked first: a node that is not used stays in the
+            // arena until the trie is freed, so none is created for a path that cannot be added
+            uint pathLength = depth + strlen(path + depth);
+            for (uint i = depth + 1; i < pathLength; i++)
+            {
+                if (s_char2idx[(unsigned char)path[i]] < 0)
+                {
+                    return nullptr;
+                }
+            }
+
+            Node *newNode = Node::createPathNode(&arena_, pathLength);
+            if (newNode == nullptr)
+            {
+                return nullptr;
+            }
+
+            for (uint i = 0; i < pathLength; i++)
+            {
+                newNode->label_[i] = (uint8_t)s_char2idx[(unsigned char)path[i]];
+            }
+
+            // if someone else created this child node before us (or we ran out of memory), 'newNode' stays unused in the arena
+            child = currNode->addChild(&arena_, idx, newNode);
+            if (child == nullptr)
+            {
+                return nullptr;
+            }
+        }
+
+        // follow the edge as far as it matches
+        uint matched = depth + 1;
+        while (matched < child->labelLength_ &&
+               path[matched] != '\0' &&
+               s_char2idx[(unsigned char)path[matched]] == child->label_[matched])
+        {
+            matched++;
+        }
+
+        if (matched == child->labelLength_)
+        {
+            currNode = child;
+            depth = matched;
+            continue;
+        }
+
+        // the path ends or diverges in the middle of the edge --> split it there (on a race, just look again)
+        Node *middle = splitEdge(currNode, child, matched);
+        if (middle != nullptr)
+        {
+            currNode = middle;
+            depth = matched;
+        }
+        else if (currNode->findChild(idx) == child)
+        {
+            // nobody else split the edge either --> the split failed because we ran out of memory
+            return nullptr;
+        }
+    }
+
+    return currNode;
+}
+
+Node* Trie::findExistingPathNode(const char *path) const
+{
+    Node *currNode = root_;
+    uint depth = 0; // == currNode->labelLength_
+    uint nodeDepth = 0;
+    while (path[depth] != '\0')
+    {
+        int idx = s_char2idx[(unsigned char)path[depth]];
+        if (idx < 0 || ++nodeDepth > Node::s_maxPathNodeDepth)
+        {
+            return nullptr;
+        }
+
+        Node *child = currNode->findChild(idx);
+        if (child == nullptr)
+        {
+            return nullptr;
+        }
+
+        // the whole edge must match, otherwise there is no node for this path
+        uint matched = depth + 1;
+        while (matched < child->labelLength_ &&
+               path[matched] != '\0' &&
+               s_char2idx[(unsigned char)path[matched]] == child->label_[matched])
+        {
+            matched++;
+        }
+
+        if (matched != child->labelLength_)
+        {
+            return nullptr;
+        }
+
+        currNode = child;
+        depth = matched;
     }
 
     return currNode;
@@ -569,13 +1001,12 @@ Node* Trie::findUintNode(uint64_t key)
 
         int lsd = key % 10;
 
-        if (!ensureChildNodeExists(currNode, lsd))
+        currNode = ensureChildNodeExists(currNode, lsd);
+        if (currNode == nullptr)
         {
             return nullptr;
         }
 
-        currNode = currNode->children()[lsd];
-
         if (key < 10)
         {
             break;
@@ -706,9 +1137,12 @@ void Trie::traverse(bool computeKey, void *callbackArgs, traverse_fn callback)
         uint32_t depth = stack->depth;
 
         Node *curr = pop(&stack);
-        for (int i = 0; i < curr->length(); ++i)
+        Node::Children *table = curr->children_;
+        for (int i = 0; i < table->capacity; ++i)
         {
-            push(&stack, curr->children()[i], computeKey ? (i * pow10(depth) + key) : 0, depth + 1);
+            // uint nodes have full tables, so a child's position is its digit
+            Node *child = Node::unfreeze(table->slots[i]);
+            push(&stack, child, computeKey ? (i * pow10(depth) + key) : 0, depth + 1);
         }
 
         // the callback may deallocate 'curr' node, hence this must be the last statement in this loop
@@ -8,17 +8,76 @@
 #include <IOKit/IOService.h>
 #include "BuildXLSandboxShared.hpp"
 
+#define NodeArena BXL_CLASS(NodeArena)
 #define Node BXL_CLASS(Node)
 #define Trie BXL_CLASS(Trie)
 
+/*!
+ * The memory of the nodes of a Trie, handed out by bumping an offset in fixed-size chunks and only ever freed all at
+ * once, with the trie.  Nodes never leave a trie before it is freed, so nothing is lost by not freeing them one by one,
+ * and freeing a trie with millions of nodes takes a few hundred frees instead of millions.
+ *
+ * Nodes and their variable-sized parts (children tables and labels) come from separate chunks, so that the nodes can
+ * be visited by walking the node chunks (see 'forEachObject') rather than by following pointers.
+ *
+ * Only accessible to the classes Node and Trie.
+ *
+ * Thread-safe.  Non-blocking.
+ */
+class NodeArena
+{
+private:
+
+    friend class Node;
+    friend class Trie;
+
+    /*! Size of a chunk, unless one allocation alone needs more */
+    static const uint s_chunkSize = 16 * 1024;
+
+    typedef struct Chunk {
+        struct Chunk *next;
+
+        /*! Bytes handed out, which may exceed 'capacity' after threads raced for the last bytes of the chunk */
+        volatile SInt32 used;
+        uint32_t capacity;
+
+        /*! Zero-filled when the chunk is created */
+        uint64_t bytes[1];
+    } Chunk;
+
+    /*! The chunks of fixed-size objects and of variable-sized ones, the one allocations are made from first */
+    Chunk * volatile objects_;
+    Chunk * volatile bytes_;
+
+    /*! The size of the fixed-size objects, rounded up to keep them aligned */
+    uint objectSize_;
+
+    void init(uint objectSize);
+
+    /*! Returns 'size' bytes (zero-filled) from the chunks at 'head', or NULL if the system is out of memory. */
+    static void* allocate(Chunk * volatile *head, uint size);
+
+    void* allocateObject()         { return allocate(&objects_, objectSize_); }
+    void* allocateBytes(uint size) { return allocate(&bytes_, size); }
+
+    /*!
+     * Calls 'callback' for every object handed out so far (including the ones never used by whoever allocated them,
+     * which are still zero-filled).  Must not be called while objects are still being allocated.
+     */
+    void forEachObject(void (*callback)(void *object)) const;
+
+    /*! Frees all the chunks at once. */
+    void freeAll();
+};
+
 /*!
  * A node in a Trie.
  * Only accessible to its friend class Trie.
+ *
+ * Nodes live in the 'NodeArena' of their trie and are never freed one by one.
  */
-class Node : public OSObject
+class Node
 {
-    OSDeclareDefaultStructors(Node);
-
 private:
 
     friend class Trie;
@@ -26,39 +85,131 @@ private:
     static uint s_numUintNodes;
     static uint s_numPathNodes;
 
+    /*! Bytes currently allocated for the children tables of uint and path nodes, and for the labels of path nodes */
+    static SInt64 s_uintChildrenBytes;
+    static SInt64 s_pathChildrenBytes;
+    static SInt64 s_pathLabelBytes;
+
     /*!
-     * The value 65 is chosen so that all ASCII characters between 32 (' ') and 122 ('z')
-     * get a unique entry in the 'children_' array.  The formula for mapping a character
-     * ch to an array index is:
+     * The value 229 is chosen so that every byte but '\0' gets an entry in the 'children_' array, with lower and
+     * upper case ASCII letters sharing theirs.  The formula for mapping a character ch between 32 (' ') and
+     * 122 ('z') to an array index is:
      *
      *   toupper(ch) - 32
+     *
+     * and the other bytes (control characters, '{' to '~', and the bytes of non-ASCII UTF-8 sequences) get the
+     * indices from 65 up, in order.  Non-ASCII characters are thus compared byte by byte, i.e., case-sensitively.
      */
-    static const uint s_pathNodeChildrenCount = 65;
+    static const uint s_pathNodeChildrenCount = 229;
+
+    /*!
+     * Most path nodes have very few children (typically one), so path nodes start with a table of 4 children and
+     * grow it to 16, then 48, and then to a full table of 'length()' entries, as the nodes of an Adaptive Radix Tree do.
+     */
+    static const uint s_pathNodeInitialCapacity = 4;
+    static const uint s_pathNodeGrownCapacity = 16;
+    static const uint s_pathNodeLargeCapacity = 48;
 
     /*! For 10 digits */
     static const uint s_uintNodeChildrenCount = 10;
 
+    /*!
+     * Most nodes a path is looked up through.  A path usually ends a few dozen nodes below the root, but each node of a
+     * path branching at every character stores a label as long as the path, so such a path would cost its length squared
+     * in memory.  Paths deeper than this are not stored at all, which callers treat as a path that cannot be cached.
+     */
+    static const uint s_maxPathNodeDepth = 256;
+
+    /*!
+     * A table of children nodes.
+     *
+     * When 'capacity' is the length of the node, the child for key 'idx' is at slot 'idx'.  Otherwise children fill
+     * the slots from the start, in no particular order, and are identified by their key (see 'keyOf').
+     *
+     * A slot only ever changes from empty to a child, or from a child to a node splitting the edge to that child.
+     * A table that is too small gets replaced by a bigger copy (see 'grow'), after all its slots are frozen so that
+     * they cannot change anymore.  Lookups may still be reading the replaced table, so it is kept (linked from
+     * 'retired') until the node is freed.
+     */
+    typedef struct Children {
+        uint capacity;
+        struct Children *retired;
+        Node *slots[1];
+    } Children;
+
+    /*! Frozen slots have their lowest bit set (nodes are at least 2-byte aligned) */
+    static bool  isFrozen(Node *slot) { return ((uintptr_t)slot & 1) != 0; }
+    static Node* freeze(Node *slot)   { return (Node*)((uintptr_t)slot | 1); }
+    static Node* unfreeze(Node *slot) { return (Node*)((uintptr_t)slot & ~(uintptr_t)1); }
+
     /*! Arbitrary value */
     OSObject *record_;
 
-    /*! The length of the 'children_' array (i.e., the the number of allocated nodes) */
+    /*! The number of possible children keys (i.e., the length of a full 'children_' table) */
     uint childrenLength_;
 
-    /*! Pre-allocated pointers to all possible children nodes. */
-    Node **children_;
+    /*!
+     * Path nodes only: the keys (see 's_char2idx') of the whole path from the root to this node.  The edge from this
+     * node's parent is the part past the parent's 'labelLength_', so a path node stands for as many characters as
+     * that edge has rather than for a single one.
+     *
+     * A label never changes: splitting the edge to this node puts a new node between it and its parent, which the
+     * part of the label past the new node's 'labelLength_' then belongs to.
+     */
+    uint8_t *label_;
+    uint labelLength_;
 
-    uint length()     const { return childrenLength_; }
-    Node** children() const { return children_; }
+    /*! The current table of children */
+    Children *children_;
 
-    bool init(uint numChildren);
-    static Node* create(uint numChildren);
+    uint length() const { return childrenLength_; }
 
-    static Node* createUintNode() { return create(s_uintNodeChildrenCount); }
-    static Node* createPathNode() { return create(s_pathNodeChildrenCount); }
+    bool init(NodeArena *arena, uint numChildren, uint capacity, uint labelLength);
+    static Node* create(NodeArena *arena, uint numChildren, uint capacity, uint labelLength);
 
-protected:
+    static Node* createUintNode(NodeArena *arena) { return create(arena, s_uintNodeChildrenCount, s_uintNodeChildrenCount, 0); }
 
-    void free() override;
+    /*! The label has to be filled in by the caller, before the node gets added to the trie. */
+    static Node* createPathNode(NodeArena *arena, uint labelLength) { return create(arena, s_pathNodeChildrenCount, s_pathNodeInitialCapacity, labelLength); }
+
+    Children* createChildren(NodeArena *arena, uint capacity) const;
+
+    /*! Only updates the counters: the memory of 'table' stays in the arena until the trie is freed. */
+    void freeChildren(Children *table) const;
+
+    /*! The key under which a (path node) child is stored in this node. */
+    uint keyOf(const Node *child) const { return child->label_[labelLength_]; }
+
+    /*! Returns the child for key 'idx' or NULL if there is none yet. */
+    Node* findChild(uint idx) const;
+
+    /*!
+     * Adds 'child' to the children of this node for key 'idx', unless a child for the same key already exists.
+     *
+     * @result The child now associated with the key ('child' unless someone else added one first), or NULL if
+     *         the system is out of memory.
+     */
+    Node* addChild(NodeArena *arena, uint idx, Node *child);
+
+    /*!
+     * Replaces the child 'oldChild' for key 'idx' with 'newChild'.
+     *
+     * @result False if the child for key 'idx' is not 'oldChild' anymore (someone else replaced it first), or if the
+     *         system is out of memory.
+     */
+    bool replaceChild(NodeArena *arena, uint idx, Node *oldChild, Node *newChild);
+
+    /*!
+     * Replaces 'table' with a bigger table containing the same children, unless someone else already replaced it.
+     * Returns false if the system is out of memory.
+     */
+    bool grow(NodeArena *arena, Children *table);
+
+    /*!
+     * Releases the record of a node whose trie is being freed, and removes the node from the counters.
+     * Nodes allocated but never used (still zero-filled) are ignored.
+     */
+    static void release(void *node);
 };
 
 // ================================== class Trie ==================================
@@ -66,14 +217,17 @@ protected:
 /*!
  * A thread-safe, lock-free, dictionary implementation.
  *
- * Only 2 types of keys are allowed: (1) an unsigned integer, and (2) an ascii path.
+ * Only 2 types of keys are allowed: (1) an unsigned integer, and (2) a (UTF-8) path.
  *
  * A value must be a pointer to an arbitrary OSObject.  Once an OSObject is added
  * to this trie, it is automatically retained by this trie; once it is removed, it is
  * automatically released by this trie; this is analogous to how OSDictionary works.
  *
- * Paths are considered case-insensitive.  Attempting to add a path with a non-ascii
- * character will fail gracefully by returning 'kTrieResultFailure'.
+ * Paths are considered case-insensitive as far as ASCII letters go; other characters are compared byte by byte.
+ *
+ * A trie can be restricted to values of a single class (see the static factory methods).  Adding a value of a
+ * different class then fails with 'kTrieResultFailure', so the 'Typed' accessors can return values as that class
+ * without paying for an 'OSDynamicCast' on every lookup.
  *
  * Thread-safe.  Non-blocking.
  */
@@ -100,33 +254,44 @@ public:
 
     static void getUintNodeCounts(uint *count, double *sizeMB)
     {
-        getNodeCounts(Node::s_numUintNodes, Node::s_uintNodeChildrenCount, count, sizeMB);
+        getNodeCounts(Node::s_numUintNodes, Node::s_uintChildrenBytes, count, sizeMB);
     }
 
-    static void getPathNodeCounts(uint *count, double *sizeMB)
+    /*!
+     * Besides the count and size of path nodes, returns how much memory their adaptive children tables save
+     * compared to each node having a full table.
+     */
+    static void getPathNodeCounts(uint *count, double *sizeMB, double *savedMB)
     {
-        getNodeCounts(Node::s_numPathNodes, Node::s_pathNodeChildrenCount, count, sizeMB);
+        getNodeCounts(Node::s_numPathNodes, Node::s_pathChildrenBytes + Node::s_pathLabelBytes, count, sizeMB);
+        *savedMB = (1.0 * *count * Node::s_pathNodeChildrenCount * sizeof(Node*) - Node::s_pathChildrenBytes) / BytesInAMegabyte;
     }
 
 private:
 
     static const uint BytesInAMegabyte = 1 << 20;
 
-    static void getNodeCounts(uint count, uint numChildren, uint *outCount, double *outSizeMB)
+    static void getNodeCounts(uint count, SInt64 childrenBytes, uint *outCount, double *outSizeMB)
     {
         *outCount = count;
-        *outSizeMB = (1.0 * count * (sizeof(Node) + numChildren * sizeof(Node*))) / BytesInAMegabyte;
+        *outSizeMB = (1.0 * count * sizeof(Node) + childrenBytes) / BytesInAMegabyte;
     }
 
     typedef enum { kUintTrie, kPathTrie } TrieKind;
     typedef void (*traverse_fn)(Trie*, void*, uint64_t key, Node*);
 
+    /*! The memory of all the nodes of the tree */
+    NodeArena arena_;
+
     /*! The root of the tree. */
     Node *root_;
 
     /*! The kind of keys this tree accepts */
     TrieKind kind_;
 
+    /*! When not null, the only class (including its subclasses) of values this tree accepts */
+    const OSMetaClass *valueClass_;
+
     /*! This is the size of the tree (i.e., number of values stored) and not the number of nodes in the tree. */
     uint size_;
 
@@ -137,19 +302,35 @@ private:
     void *onChangeData_;
 
     /*! Creates and initialized a new Trie.  The return value indicates the success of the operation. */
-    bool init(TrieKind kind);
+    bool init(TrieKind kind, const OSMetaClass *valueClass);
+
+    /*! Whether 'value' may be stored in this tree (see 'valueClass_').  Only checked when values are added. */
+    bool acceptsValue(const OSObject *value) const
+    {
+        return valueClass_ == nullptr || OSMetaClassBase::safeMetaCast(value, valueClass_) != nullptr;
+    }
+
+    /*!
+     * Returns 'value' as a T without checking its class, which is safe because all values of this tree are of class
+     * 'valueClass_'.  Returns NULL (as 'getAs' would for a value of another class) if T is not that class.
+     */
+    template<typename T>
+    T* asTyped(OSObject *value) const
+    {
+        return valueClass_ == OSTypeID(T) ? static_cast<T*>(value) : nullptr;
+    }
 
     /*! Invokes the 'onChangeCallback_' if it's set and 'newCount' is different from 'oldCount' */
     void triggerOnChange(int oldCount, int newCount) const;
 
     /*!
-     * Creates a child node of 'node' at position 'idx' if such a child node doesn't already exist.
+     * Returns the child node of (uint) node 'node' for key 'idx', creating it if it doesn't already exist.
      *
-     * @param node The node which must contain a child at position 'idx'.  Must not be null.
-     * @param idx Must be between 0 (inclusive) and 'node.length()' (exclusive); otherwise this method returns false.
-     * @result Indicates the success of the operation (it's true IFF 'node' has a child at position 'idx').
+     * @param node The node which must contain a child for key 'idx'.  Must not be null.
+     * @param idx Must be between 0 (inclusive) and 'node.length()' (exclusive); otherwise this method returns NULL.
+     * @result The child node, or NULL if 'idx' is out of range or the system is out of memory.
      */
-    bool ensureChildNodeExists(Node *node, int idx);
+    Node* ensureChildNodeExists(Node *node, int idx);
 
     /*!
      * Ensures that 'node' has its 'record_' field set to a non-null value.
@@ -184,7 +365,7 @@ private:
     /*!
      * Attempts to associate 'value' with 'node', even if there is already a value associated with 'node'.
      *
-     * If either 'node' or 'value' is NULL, the result is 'kTrieResultFailure'.
+     * If either 'node' or 'value' is NULL, or 'value' is not of class 'valueClass_', the result is 'kTrieResultFailure'.
      *
      * If 'value' has been associated with 'node' and there wasn't a record previously associated with 'node':
      * retains 'value', increments size, and returns 'kTrieResultInserted'.
@@ -203,7 +384,7 @@ private:
     /*!
      * Attempts to associate 'value' with 'node', ONLY if no value is already associated with 'node'.
      *
-     * If either 'node' or 'value' is NULL, the result is 'kTrieResultFailure'.
+     * If either 'node' or 'value' is NULL, or 'value' is not of class 'valueClass_', the result is 'kTrieResultFailure'.
      *
      * @result kTrieResultInserted, kTrieResultAlreadyExists, or kTrieResultFailure
      */
@@ -235,23 +416,39 @@ private:
     Node* findUintNode(uint64_t key);
 
     /*!
-     * Traverses the trie until it gets to the node corresponding to the given 'key', creating new nodes as necessary.
-     * Returning NULL indicates that either the key is invalid (e.g., contains non-ascii characters) or the system is out of memory.
+     * Traverses the trie until it gets to the node corresponding to the given 'key', creating new nodes (and splitting
+     * edges) as necessary.
+     * Returning NULL indicates that the system is out of memory, or that the node would be deeper than
+     * 'Node::s_maxPathNodeDepth'.
      */
     Node* findPathNode(const char *key);
 
-    /*! Creates either a Uint or a Path node, based on the kind of this trie. */
-    Node* createNode()
+    /*!
+     * Same as 'findPathNode', except that it never creates nodes.
+     * Returning NULL indicates that there is no node for the given 'key'.
+     */
+    Node* findExistingPathNode(const char *key) const;
+
+    /*!
+     * Puts a new node for the first 'labelLength' characters of the label of 'child' between 'parent' and 'child'.
+     *
+     * @result The new node, or NULL if the system is out of memory or someone else changed the child of 'parent' first
+     *         (in which case the caller should look up that child again).
+     */
+    Node* splitEdge(Node *parent, Node *child, uint labelLength);
+
+    /*! Creates either a Uint or a Path root node, based on the kind of this trie. */
+    Node* createRootNode()
     {
-        return kind_ == kUintTrie ? Node::createUintNode() :
-               kind_ == kPathTrie ? Node::createPathNode() :
+        return kind_ == kUintTrie ? Node::createUintNode(&arena_) :
+               kind_ == kPathTrie ? Node::createPathNode(&arena_, /*labelLength*/ 0) :
                nullptr;
     }
 
     /*!
      * Static factory method.  The caller is responsible for releasing it by calling 'release()'.
      */
-    static Trie* create(TrieKind kind);
+    static Trie* create(TrieKind kind, const OSMetaClass *valueClass);
 
 protected:
     void free() override;
@@ -296,15 +493,36 @@ public:
         return OSDynamicCast(T, get(key));
     }
 
+    /*! Same as 'getAs', for a trie created for values of class T (see 'createPathTrie'). */
+    template<typename T>
+    T* getTyped(const char *key)
+    {
+        return asTyped<T>(get(key));
+    }
+
+    /*!
+     * Same as 'get', except that it never adds nodes to the trie (and is therefore cheaper for paths not seen before).
+     */
+    OSObject* getExisting(const char *path) const
+    {
+        if (kind_ != kPathTrie) return nullptr;
+        Node *node = findExistingPathNode(path);
+        return node != nullptr ? node->record_ : nullptr;
+    }
+
+    /*! Same as 'getExisting', for a trie created for values of class T. */
+    template<typename T>
+    T* getExistingTyped(const char *path) const
+    {
+        return asTyped<T>(getExisting(path));
+    }
+
     /*!
      * If 'path' hasn't been seen before: creates a new value (using the supplied factory function),
      * associates it with 'path', and returns it; otherwise, returns the 'OSObject' object previously
      * associated with 'path'.
      *
-     * Paths are considered case-insensitive.
-     *
-     * NOTE: The current implementation only paths containig only ASCII characters; for all other paths
-     *       nullptr is returned indicating that the path couldn't be added.
+     * Paths are considered case-insensitive (for ASCII letters only).
      */
     OSObject* getOrAdd(const char *path, void *factoryArgs, factory_fn factory, TrieResult *result = nullptr)
     {
@@ -312,6 +530,13 @@ public:
         return getOrAdd(findPathNode(path), factoryArgs, factory, result);
     }
 
+    /*! Same as 'getOrAdd', for a trie created for values of class T. */
+    template<typename T>
+    T* getOrAddTyped(const char *path, void *factoryArgs, factory_fn factory, TrieResult *result = nullptr)
+    {
+        return asTyped<T>(getOrAdd(path, factoryArgs, factory, result));
+    }
+
     TrieResult replace(const char *path, const OSObject *value)
     {
         if (kind_ != kPathTrie) return kTrieResultFailure;
@@ -345,12 +570,26 @@ public:
         return OSDynamicCast(T, get(key));
     }
 
+    /*! Same as 'getAs', for a trie created for values of class T (see 'createUintTrie'). */
+    template<typename T>
+    T* getTyped(uint64_t key)
+    {
+        return asTyped<T>(get(key));
+    }
+
     OSObject* getOrAdd(uint64_t key, void *factoryArgs, factory_fn factory, TrieResult *result = nullptr)
     {
         if (kind_ != kUintTrie) return nullptr;
         return getOrAdd(findUintNode(key), factoryArgs, factory, result);
     }
 
+    /*! Same as 'getOrAdd', for a trie created for values of class T. */
+    template<typename T>
+    T* getOrAddTyped(uint64_t key, void *factoryArgs, factory_fn factory, TrieResult *result = nullptr)
+    {
+        return asTyped<T>(getOrAdd(key, factoryArgs, factory, result));
+    }
+
     TrieResult replace(uint64_t key, const OSObject *value)
     {
         if (kind_ != kUintTrie) return kTrieResultFailure;
@@ -371,8 +610,12 @@ public:
 
 #pragma mark Static factory methods
 
-    static Trie* createUintTrie() { return create(kUintTrie); }
-    static Trie* createPathTrie() { return create(kPathTrie); }
+    /*!
+     * When 'valueClass' is given (e.g., 'OSTypeID(CacheRecord)'), the trie only accepts values of that class and
+     * its 'Typed' accessors can be used with it.
+     */
+    static Trie* createUintTrie(const OSMetaClass *valueClass = nullptr) { return create(kUintTrie, valueClass); }
+    static Trie* createPathTrie(const OSMetaClass *valueClass = nullptr) { return create(kPathTrie, valueClass); }
 };
 
 #endif /* PathCache_hpp */
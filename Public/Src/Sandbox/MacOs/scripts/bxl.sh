@@ -20,6 +20,7 @@ declare arg_MainConfig=""
 declare arg_SymlinkSdksInto=""
 declare arg_checkKextLogInterval=""
 declare arg_loadKext=""
+declare arg_signEndpointSecurity=""
 
 declare g_bxlCmdArgs=()
 
@@ -134,6 +135,21 @@ function build {
         fi
     fi
 
+    # sign bxl with the Endpoint Security client entitlement if arg_signEndpointSecurity is not empty
+    if [[ -n "$arg_signEndpointSecurity" ]]; then
+        readonly entitlementsPath="${MY_DIR}/BuildXLEndpointSecurity.entitlements"
+        if [[ ! -f "$entitlementsPath" ]]; then
+            print_error "Entitlements not found at '$entitlementsPath'"
+            exit 1
+        fi
+        print_info "Signing '$arg_BuildXLBin/bxl' with the Endpoint Security client entitlement"
+        codesign --force --options runtime --sign "$arg_signEndpointSecurity" --entitlements "$entitlementsPath" "$arg_BuildXLBin/bxl"
+        if [[ "$?" != 0 ]]; then
+            print_error "Could not sign '$arg_BuildXLBin/bxl'"
+            exit 1
+        fi
+    fi
+
     # Create symlinks for Sdk.Transformers dirs
     if [[ -n "$arg_SymlinkSdksInto" ]]; then
         for bxlSdkDir in "$arg_BuildXLBin/Sdk/Sdk.Transformers"; do
@@ -155,7 +171,7 @@ function build {
     fi
 
     if [[ -z "$arg_MainConfig" ]]; then
-        if [[ -z $arg_loadKext ]]; then
+        if [[ -z $arg_loadKext && -z $arg_signEndpointSecurity ]]; then
             print_warning "Switch --config not specified --> no BuildXL build to run"
         fi
         return 0
@@ -237,6 +253,11 @@ function parseArgs {
                 arg_loadKext=""
                 shift
                 ;;
+            --sign-endpoint-security)
+                arg_signEndpointSecurity="$2"
+                shift
+                shift
+                ;;
             *)
                 arg_Positional+=("$1")
                 shift
@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# Builds the user-mode benchmarks of the kext data structures (see Sandbox/Src/Benchmarks/KextBenchmarks.cpp) with the
+# clang of the command line tools, and runs them with the given arguments (e.g., --help).
+#
+# The benchmarks compile a handful of kext sources against the stand-ins for the kernel APIs in Benchmarks/UserMode,
+# so they are kept out of Sandbox.xcodeproj, whose targets all build against the kernel framework.
+
+set -e
+
+MY_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+
+source "$MY_DIR/env.sh"
+
+readonly SRC_DIR="$MY_DIR/../Sandbox/Src"
+readonly LFDS_DIR="$(cd "$MY_DIR/../../../../../third_party/liblfds711@da3494fef10df4681e267d8b2b8cce2c90d5a9fa" && pwd)"
+readonly OUT_DIR="${KEXT_BENCHMARKS_OUT_DIR:-${TMPDIR:-/tmp}/KextBenchmarks}"
+
+readonly CXX_SOURCES=(
+    "$SRC_DIR/Benchmarks/KextBenchmarks.cpp"
+    "$SRC_DIR/Benchmarks/UserMode/UserModeShim.cpp"
+    "$SRC_DIR/CacheRecord.cpp"
+    "$SRC_DIR/ConcurrentSharedDataQueue.cpp"
+    "$SRC_DIR/Utilities/EventTrace.cpp"
+    "$SRC_DIR/Utilities/Thread.cpp"
+    "$SRC_DIR/Utilities/ThreadLocal.cpp"
+    "$SRC_DIR/Utilities/Trie.cpp"
+)
+
+readonly C_SOURCES=(
+    "$LFDS_DIR"/src/lfds711_freelist/lfds711_freelist_*.c
+    "$LFDS_DIR"/src/lfds711_misc/lfds711_misc_globals.c
+    "$LFDS_DIR"/src/lfds711_misc/lfds711_misc_internal_backoff_init.c
+    "$LFDS_DIR"/src/lfds711_misc/lfds711_misc_query.c
+    "$LFDS_DIR"/src/lfds711_prng/lfds711_prng_init.c
+    "$LFDS_DIR"/src/lfds711_queue_unbounded_manyproducer_manyconsumer/lfds711_queue_unbounded_manyproducer_manyconsumer_*.c
+)
+
+# The stand-ins come first, so that they hide the kernel headers of the same names
+readonly INCLUDES=(
+    -I"$SRC_DIR/Benchmarks/UserMode"
+    -I"$SRC_DIR"
+    -I"$SRC_DIR/Utilities"
+    -I"$MY_DIR/../../Windows/DetoursServices"
+    -I"$LFDS_DIR/inc"
+)
+
+readonly DEFINES=(
+    -DMAC_OS_SANDBOX=1
+    -DMAC_OS_SANDBOX_USER_MODE=1
+)
+
+mkdir -p "$OUT_DIR/obj"
+
+objects=()
+for src in "${C_SOURCES[@]}"; do
+    obj="$OUT_DIR/obj/$(basename "$src" .c).o"
+    clang -std=gnu11 -O2 -c "${INCLUDES[@]}" "${DEFINES[@]}" "$src" -o "$obj"
+    objects+=("$obj")
+done
+
+for src in "${CXX_SOURCES[@]}"; do
+    obj="$OUT_DIR/obj/$(basename "$src" .cpp).o"
+    clang++ -std=gnu++14 -O2 -c "${INCLUDES[@]}" "${DEFINES[@]}" "$src" -o "$obj"
+    objects+=("$obj")
+done
+
+clang++ "${objects[@]}" -framework IOKit -o "$OUT_DIR/KextBenchmarks"
+print_info "Built $OUT_DIR/KextBenchmarks"
+
+"$OUT_DIR/KextBenchmarks" "$@"
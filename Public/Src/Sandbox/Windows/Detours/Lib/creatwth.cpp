@@ -35,6 +35,13 @@
 #define CLR_DIRECTORY OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_COM_DESCRIPTOR]
 #define IAT_DIRECTORY OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IAT]
 
+static inline LONGLONG DetourTicks()
+{
+    LARGE_INTEGER li;
+    QueryPerformanceCounter(&li);
+    return li.QuadPart;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 #if IGNORE_CHECKSUMS
@@ -125,6 +132,16 @@ static WORD ComputeChkSum(HANDLE hProcess, PBYTE pbModule, PIMAGE_NT_HEADERS pin
 
     return detour_sum_final(wSum, pinh);
 }
+
+static WORD TimedComputeChkSum(HANDLE hProcess, PBYTE pbModule, PIMAGE_NT_HEADERS pinh, PDETOUR_UPDATE_TIMINGS pTimings)
+{
+    LONGLONG llStart = DetourTicks();
+    WORD wSum = ComputeChkSum(hProcess, pbModule, pinh);
+    if (pTimings != NULL) {
+        pTimings->llChecksum += DetourTicks() - llStart;
+    }
+    return wSum;
+}
 #endif // IGNORE_CHECKSUMS
 
 //////////////////////////////////////////////////////////////////////////////
@@ -216,6 +233,96 @@ static HMODULE WINAPI EnumerateModulesInProcess(HANDLE hProcess,
     return NULL;
 }
 
+#if BUILDXL_DETOURS && DETOURS_64BIT
+//////////////////////////////////////////////////////////////////////////////
+//
+// Find the EXE image of the target process from the image base in its PEB, instead of walking its whole address
+// space with EnumerateModulesInProcess. For a process created suspended, the PEB already has the image base.
+// The bitness that the module walk infers from the loaded DLLs comes from IsWow64Process instead: a WOW64 process
+// runs 32-bit code, any other process the native 64-bit code of this one.
+//
+// Returns NULL if any of it fails, so that the caller falls back to the module walk.
+//
+typedef LONG (NTAPI *PF_NtQueryInformationProcess)(HANDLE, ULONG, PVOID, ULONG, PULONG);
+
+// PROCESS_BASIC_INFORMATION of winternl.h.
+typedef struct _DETOUR_PROCESS_BASIC_INFORMATION
+{
+    LONG_PTR    ExitStatus;
+    PBYTE       PebBaseAddress;
+    ULONG_PTR   AffinityMask;
+    LONG_PTR    BasePriority;
+    ULONG_PTR   UniqueProcessId;
+    ULONG_PTR   InheritedFromUniqueProcessId;
+} DETOUR_PROCESS_BASIC_INFORMATION;
+
+// ProcessBasicInformation of PROCESSINFOCLASS.
+#define DETOUR_PROCESS_BASIC_INFORMATION_CLASS 0
+
+// Offset of ImageBaseAddress in the (64-bit) PEB: after 4 flag bytes, padding and the Mutant handle.
+#define DETOUR_PEB_IMAGE_BASE_OFFSET (2 * sizeof(PVOID))
+
+#pragma warning( push )
+#pragma warning( disable: 4191 ) // casting from FARPROC
+static PF_NtQueryInformationProcess s_pfNtQueryInformationProcess =
+    (PF_NtQueryInformationProcess)GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtQueryInformationProcess");
+#pragma warning( pop )
+
+static HMODULE FindExeImageFromPeb(HANDLE hProcess, WORD *pExe32Bit, WORD *pMach32Bit, WORD *pMach64Bit)
+{
+    if (s_pfNtQueryInformationProcess == NULL) {
+        return NULL;
+    }
+
+    DETOUR_PROCESS_BASIC_INFORMATION pbi;
+    ZeroMemory(&pbi, sizeof(pbi));
+    if (s_pfNtQueryInformationProcess(hProcess, DETOUR_PROCESS_BASIC_INFORMATION_CLASS, &pbi, sizeof(pbi), NULL) < 0 ||
+        pbi.PebBaseAddress == NULL) {
+        DETOUR_TRACE(("NtQueryInformationProcess(%p) failed\n", hProcess));
+        return NULL;
+    }
+
+    PBYTE pbImage = NULL;
+    if (!ReadProcessMemory(hProcess, pbi.PebBaseAddress + DETOUR_PEB_IMAGE_BASE_OFFSET, &pbImage, sizeof(pbImage), NULL) ||
+        pbImage == NULL) {
+        DETOUR_TRACE(("ReadProcessMemory(%p, peb%p) failed: %d\n", hProcess, pbi.PebBaseAddress, GetLastError()));
+        return NULL;
+    }
+
+    // Same checks as EnumerateModulesInProcess.
+    IMAGE_DOS_HEADER idh;
+    IMAGE_NT_HEADERS32 inh;
+    if (!ReadProcessMemory(hProcess, pbImage, &idh, sizeof(idh), NULL) ||
+        idh.e_magic != IMAGE_DOS_SIGNATURE ||
+        (DWORD)idh.e_lfanew < sizeof(idh) ||
+        !ReadProcessMemory(hProcess, pbImage + idh.e_lfanew, &inh, sizeof(inh), NULL) ||
+        inh.Signature != IMAGE_NT_SIGNATURE ||
+        (inh.FileHeader.Characteristics & IMAGE_FILE_DLL) != 0) {
+        DETOUR_TRACE(("%p  Not an EXE image\n", pbImage));
+        return NULL;
+    }
+
+    BOOL fIsWow64 = FALSE;
+    if (!IsWow64Process(hProcess, &fIsWow64)) {
+        return NULL;
+    }
+
+    // The machine of the native 64-bit code is the one of the ntdll of this (64-bit) process.
+    PBYTE pbNtdll = (PBYTE)GetModuleHandleW(L"ntdll.dll");
+    if (pbNtdll == NULL) {
+        return NULL;
+    }
+    PIMAGE_NT_HEADERS pinhNtdll = (PIMAGE_NT_HEADERS)(pbNtdll + ((PIMAGE_DOS_HEADER)pbNtdll)->e_lfanew);
+
+    *pExe32Bit = inh.OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC ? inh.FileHeader.Machine : 0;
+    *pMach32Bit = fIsWow64 ? IMAGE_FILE_MACHINE_I386 : 0;
+    *pMach64Bit = fIsWow64 ? 0 : pinhNtdll->FileHeader.Machine;
+
+    DETOUR_TRACE(("%p  Found EXE from PEB\n", pbImage));
+    return (HMODULE)pbImage;
+}
+#endif // BUILDXL_DETOURS && DETOURS_64BIT
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Find a region of memory in which we can create a replacement import table.
@@ -543,6 +650,14 @@ static BOOL UpdateFrom32To64(HANDLE hProcess, HANDLE hModule, WORD machine)
 //////////////////////////////////////////////////////////////////////////////
 //
 BOOL WINAPI DetourUpdateProcessWithDll(HANDLE hProcess, __in_ecount(nDlls) LPCSTR *plpDlls, DWORD nDlls)
+{
+    return DetourUpdateProcessWithDllTimed(hProcess, plpDlls, nDlls, NULL);
+}
+
+BOOL WINAPI DetourUpdateProcessWithDllTimed(HANDLE hProcess,
+                                            __in_ecount(nDlls) LPCSTR *plpDlls,
+                                            DWORD nDlls,
+                                            PDETOUR_UPDATE_TIMINGS pTimings)
 {
     // Find memory regions that contain mapped PE images to determine if the target process is 32-bit or 64-bit.
     //
@@ -575,7 +690,15 @@ BOOL WINAPI DetourUpdateProcessWithDll(HANDLE hProcess, __in_ecount(nDlls) LPCST
     // process. Thus, if the target process is 64-bit, and the launching process is 32-bit, then enumerating
     // the modules will fail to find PE image corresponding to an executable. This is the reason
     // why Detours launches a 64-bit UpdImports process to detour 64-bit process from 32-bit process.
-    for (;;) {
+    //
+    // The walk reads every region of the target, so the PEB is tried first (see FindExeImageFromPeb).
+    LONGLONG llFindImageStart = DetourTicks();
+#if BUILDXL_DETOURS && DETOURS_64BIT
+    hModule = FindExeImageFromPeb(hProcess, &exe32Bit, &mach32Bit, &mach64Bit);
+#endif
+    BOOL fImageFromPeb = hModule != NULL;
+
+    while (!fImageFromPeb) {
         IMAGE_NT_HEADERS32 inh;
 
         if ((hLast = EnumerateModulesInProcess(hProcess, hLast, &inh)) == NULL) {
@@ -602,6 +725,11 @@ BOOL WINAPI DetourUpdateProcessWithDll(HANDLE hProcess, __in_ecount(nDlls) LPCST
         }
     }
     DETOUR_TRACE(("    exe32Bit=%04x mach32Bit=%04x mach64Bit=%04x\n", exe32Bit, mach32Bit, mach64Bit));
+
+    if (pTimings != NULL) {
+        pTimings->llFindImage += DetourTicks() - llFindImageStart;
+        pTimings->fImageFromPeb = fImageFromPeb;
+    }
     
     if (hModule == NULL) {
         DETOUR_TRACE_ERROR(L"hModule == NULL\n");
@@ -790,7 +918,7 @@ BOOL WINAPI DetourUpdateProcessWithDll(HANDLE hProcess, __in_ecount(nDlls) LPCST
     }
     else if (mach32Bit) {
         // 32-bit native or 32-bit managed process on any platform.
-        if (!UpdateImports32(hProcess, hModule, plpDlls, nDlls, &(der.pclr))) {
+        if (!UpdateImports32(hProcess, hModule, plpDlls, nDlls, &(der.pclr), pTimings)) {
             DETOUR_TRACE_ERROR(L"UpdateImports32(%p, %p) failed: %d\n", 
                 hProcess, hModule, GetLastError());
             return FALSE;
@@ -810,7 +938,7 @@ BOOL WINAPI DetourUpdateProcessWithDll(HANDLE hProcess, __in_ecount(nDlls) LPCST
 #if BUILDXL_DETOURS
 
         // 32-bit native or 32-bit managed process on any platform.
-        if (!UpdateImports32(hProcess, hModule, plpDlls, nDlls, &(der.pclr))) {
+        if (!UpdateImports32(hProcess, hModule, plpDlls, nDlls, &(der.pclr), pTimings)) {
             DETOUR_TRACE_ERROR(L"UpdateImports32(%p, %p) failed: %d\n", 
                 hProcess, hModule, GetLastError());
             return FALSE;
@@ -838,7 +966,7 @@ BOOL WINAPI DetourUpdateProcessWithDll(HANDLE hProcess, __in_ecount(nDlls) LPCST
         }
 
         // 64-bit process from 32-bit managed binary.
-        if (!UpdateImports64(hProcess, hModule, plpDlls, nDlls, &(der.pclr))) {
+        if (!UpdateImports64(hProcess, hModule, plpDlls, nDlls, &(der.pclr), pTimings)) {
             DETOUR_TRACE_ERROR(L"UpdateImports64(%p, %p) failed: %d\n", 
                 hProcess, hModule, GetLastError());
             return FALSE;
@@ -846,7 +974,7 @@ BOOL WINAPI DetourUpdateProcessWithDll(HANDLE hProcess, __in_ecount(nDlls) LPCST
     }
     else if (mach64Bit) {
         // 64-bit native or 64-bit managed process on any platform.
-        if (!UpdateImports64(hProcess, hModule, plpDlls, nDlls, &(der.pclr))) {
+        if (!UpdateImports64(hProcess, hModule, plpDlls, nDlls, &(der.pclr), pTimings)) {
             DETOUR_TRACE_ERROR(L"UpdateImports64(%p, %p) failed: %d\n", 
                 hProcess, hModule, GetLastError());
             return FALSE;
@@ -1515,12 +1643,26 @@ BOOL WINAPI DetourCopyPayloadToProcess(HANDLE hProcess,
                                        PVOID pData,
                                        DWORD cbData)
 {
-    DWORD cbTotal = (sizeof(IMAGE_DOS_HEADER) +
-                     sizeof(IMAGE_NT_HEADERS) +
-                     sizeof(IMAGE_SECTION_HEADER) +
-                     sizeof(DETOUR_SECTION_HEADER) +
-                     sizeof(DETOUR_SECTION_RECORD) +
-                     cbData);
+    DETOUR_PAYLOAD_PART part = { pData, cbData };
+    return DetourCopyPayloadPartsToProcess(hProcess, rguid, &part, 1);
+}
+
+BOOL WINAPI DetourCopyPayloadPartsToProcess(HANDLE hProcess,
+                                            REFGUID rguid,
+                                            const DETOUR_PAYLOAD_PART *pParts,
+                                            DWORD cParts)
+{
+    DWORD cbData = 0;
+    for (DWORD i = 0; i < cParts; i++) {
+        cbData += pParts[i].cbData;
+    }
+
+    const DWORD cbHeaders = (sizeof(IMAGE_DOS_HEADER) +
+                             sizeof(IMAGE_NT_HEADERS) +
+                             sizeof(IMAGE_SECTION_HEADER) +
+                             sizeof(DETOUR_SECTION_HEADER) +
+                             sizeof(DETOUR_SECTION_RECORD));
+    DWORD cbTotal = cbHeaders + cbData;
 
     PBYTE pbBase = (PBYTE)VirtualAllocEx(hProcess, NULL, cbTotal,
                                          MEM_COMMIT, PAGE_READWRITE);
@@ -1530,7 +1672,9 @@ BOOL WINAPI DetourCopyPayloadToProcess(HANDLE hProcess,
         return FALSE;
     }
 
-    PBYTE pbTarget = pbBase;
+    // All the headers go in with a single write.
+    BYTE rbHeaders[cbHeaders];
+    PBYTE pbHeader = rbHeaders;
     IMAGE_DOS_HEADER idh;
     IMAGE_NT_HEADERS inh;
     IMAGE_SECTION_HEADER ish;
@@ -1541,13 +1685,8 @@ BOOL WINAPI DetourCopyPayloadToProcess(HANDLE hProcess,
     ZeroMemory(&idh, sizeof(idh));
     idh.e_magic = IMAGE_DOS_SIGNATURE;
     idh.e_lfanew = sizeof(idh);
-    if (!WriteProcessMemory(hProcess, pbTarget, &idh, sizeof(idh), &cbWrote) ||
-        cbWrote != sizeof(idh)) {
-        DETOUR_TRACE_ERROR(L"WriteProcessMemory(%p, idh%p) failed: %d\n", 
-            hProcess, pbTarget, GetLastError());
-        return FALSE;
-    }
-    pbTarget += sizeof(idh);
+    CopyMemory(pbHeader, &idh, sizeof(idh));
+    pbHeader += sizeof(idh);
 
     ZeroMemory(&inh, sizeof(inh));
     inh.Signature = IMAGE_NT_SIGNATURE;
@@ -1555,27 +1694,17 @@ BOOL WINAPI DetourCopyPayloadToProcess(HANDLE hProcess,
     inh.FileHeader.Characteristics = IMAGE_FILE_DLL;
     inh.FileHeader.NumberOfSections = 1;
     inh.OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR_MAGIC;
-    if (!WriteProcessMemory(hProcess, pbTarget, &inh, sizeof(inh), &cbWrote) ||
-        cbWrote != sizeof(inh)) {
-        DETOUR_TRACE_ERROR(L"WriteProcessMemory(%p, inh%p) failed: %d\n", 
-            hProcess, pbTarget, GetLastError());
-        return FALSE;
-    }
-    pbTarget += sizeof(inh);
+    CopyMemory(pbHeader, &inh, sizeof(inh));
+    pbHeader += sizeof(inh);
 
     ZeroMemory(&ish, sizeof(ish));
     memcpy(ish.Name, ".detour", sizeof(ish.Name));
-    ish.VirtualAddress = (DWORD)((pbTarget + sizeof(ish)) - pbBase);
+    ish.VirtualAddress = (DWORD)((pbHeader + sizeof(ish)) - rbHeaders);
     ish.SizeOfRawData = (sizeof(DETOUR_SECTION_HEADER) +
                          sizeof(DETOUR_SECTION_RECORD) +
                          cbData);
-    if (!WriteProcessMemory(hProcess, pbTarget, &ish, sizeof(ish), &cbWrote) ||
-        cbWrote != sizeof(ish)) {
-        DETOUR_TRACE_ERROR(L"WriteProcessMemory(%p, ish%p) failed: %d\n", 
-            hProcess, pbTarget, GetLastError());
-        return FALSE;
-    }
-    pbTarget += sizeof(ish);
+    CopyMemory(pbHeader, &ish, sizeof(ish));
+    pbHeader += sizeof(ish);
 
     ZeroMemory(&dsh, sizeof(dsh));
     dsh.cbHeaderSize = sizeof(dsh);
@@ -1584,33 +1713,37 @@ BOOL WINAPI DetourCopyPayloadToProcess(HANDLE hProcess,
     dsh.cbDataSize = (sizeof(DETOUR_SECTION_HEADER) +
                       sizeof(DETOUR_SECTION_RECORD) +
                       cbData);
-    if (!WriteProcessMemory(hProcess, pbTarget, &dsh, sizeof(dsh), &cbWrote) ||
-        cbWrote != sizeof(dsh)) {
-        DETOUR_TRACE_ERROR(L"WriteProcessMemory(%p, dsh%p) failed: %d\n", 
-            hProcess, pbTarget, GetLastError());
-        return FALSE;
-    }
-    pbTarget += sizeof(dsh);
+    CopyMemory(pbHeader, &dsh, sizeof(dsh));
+    pbHeader += sizeof(dsh);
 
     ZeroMemory(&dsr, sizeof(dsr));
     dsr.cbBytes = cbData + sizeof(DETOUR_SECTION_RECORD);
     dsr.nReserved = 0;
     dsr.guid = rguid;
-    if (!WriteProcessMemory(hProcess, pbTarget, &dsr, sizeof(dsr), &cbWrote) ||
-        cbWrote != sizeof(dsr)) {
-        DETOUR_TRACE_ERROR(L"WriteProcessMemory(%p, dsr%p) failed: %d\n", 
+    CopyMemory(pbHeader, &dsr, sizeof(dsr));
+
+    PBYTE pbTarget = pbBase;
+    if (!WriteProcessMemory(hProcess, pbTarget, rbHeaders, cbHeaders, &cbWrote) ||
+        cbWrote != cbHeaders) {
+        DETOUR_TRACE_ERROR(L"WriteProcessMemory(%p, headers%p) failed: %d\n", 
             hProcess, pbTarget, GetLastError());
         return FALSE;
     }
-    pbTarget += sizeof(dsr);
+    pbTarget += cbHeaders;
 
-    if (!WriteProcessMemory(hProcess, pbTarget, pData, cbData, &cbWrote) ||
-        cbWrote != cbData) {
-        DETOUR_TRACE_ERROR(L"WriteProcessMemory(%p, pData%p) failed: %d\n", 
-            hProcess, pbTarget, GetLastError());
-        return FALSE;
+    for (DWORD i = 0; i < cParts; i++) {
+        if (pParts[i].cbData == 0) {
+            continue;
+        }
+
+        if (!WriteProcessMemory(hProcess, pbTarget, pParts[i].pvData, pParts[i].cbData, &cbWrote) ||
+            cbWrote != pParts[i].cbData) {
+            DETOUR_TRACE_ERROR(L"WriteProcessMemory(%p, pData%p) failed: %d\n", 
+                hProcess, pbTarget, GetLastError());
+            return FALSE;
+        }
+        pbTarget += pParts[i].cbData;
     }
-    pbTarget += cbData;
 
     DETOUR_TRACE(("Copied %d byte payload into target process at %p\n",
                   cbTotal, pbTarget - cbTotal));
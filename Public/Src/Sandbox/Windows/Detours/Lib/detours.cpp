@@ -9,6 +9,7 @@
 // BuildXL-specific changes (forked from MSR version):
 //  - Support for detouring 32-bit from 64-bit (without UpdImports)
 //  - ETW tracing (see tracing.cpp).
+//  - Prologue cache, so that processes attaching the same targets skip disassembling them (see DetourSetPrologueCache).
 
 #include "target.h"
 #include <windows.h>
@@ -964,6 +965,59 @@ static PVOID *              s_ppPendingError        = NULL;
 static DetourThread *       s_pPendingThreads       = NULL;
 static DetourOperation *    s_pPendingOperations    = NULL;
 
+static const DETOUR_PROLOGUE_CACHE_ENTRY *  s_pPrologueCache     = NULL;
+static DWORD                                s_cPrologueCache     = 0;
+static DWORD                                s_cPrologueCacheHits = 0;
+static DETOUR_PROLOGUE_CACHE_ENTRY          s_rMovedPrologues[DETOUR_PROLOGUE_CACHE_MAX_ENTRIES];
+static DWORD                                s_cMovedPrologues    = 0;
+
+// Only the x86 and x64 prologues are cached: their instructions without relative operands move unchanged.
+#if defined(DETOURS_X64)
+#define DETOUR_PROLOGUE_MACHINE IMAGE_FILE_MACHINE_AMD64
+#elif defined(DETOURS_X86)
+#define DETOUR_PROLOGUE_MACHINE IMAGE_FILE_MACHINE_I386
+#endif
+
+#ifdef DETOUR_PROLOGUE_MACHINE
+static const DETOUR_PROLOGUE_CACHE_ENTRY * detour_find_cached_prologue(PBYTE pbTarget,
+                                                                        ULONG cbJump,
+                                                                        ULONG cbMax)
+{
+    for (DWORD n = 0; n < s_cPrologueCache; n++) {
+        const DETOUR_PROLOGUE_CACHE_ENTRY *pEntry = &s_pPrologueCache[n];
+
+        // The same bytes decode to the same instructions, so the bytes are all there is to check.
+        if (pEntry->ullTarget == (ULONG_PTR)pbTarget &&
+            pEntry->wMachine == DETOUR_PROLOGUE_MACHINE &&
+            pEntry->cbCode > 0 &&
+            pEntry->cbCode <= pEntry->cbTarget &&
+            pEntry->cbTarget >= cbJump &&
+            pEntry->cbTarget <= cbMax &&
+            pEntry->cbTarget <= sizeof(pEntry->rbTarget) &&
+            memcmp(pbTarget, pEntry->rbTarget, pEntry->cbTarget) == 0) {
+            return pEntry;
+        }
+    }
+    return NULL;
+}
+
+static void detour_record_moved_prologue(PBYTE pbTarget, ULONG cbCode, ULONG cbTarget)
+{
+    if (s_cMovedPrologues >= ARRAYSIZE(s_rMovedPrologues) ||
+        cbTarget > sizeof(s_rMovedPrologues[0].rbTarget)) {
+        return;
+    }
+
+    PDETOUR_PROLOGUE_CACHE_ENTRY pEntry = &s_rMovedPrologues[s_cMovedPrologues++];
+    ZeroMemory(pEntry, sizeof(*pEntry));
+    pEntry->ullTarget = (ULONG_PTR)pbTarget;
+    pEntry->cbCode = (BYTE)cbCode;
+    pEntry->cbTarget = (BYTE)cbTarget;
+    pEntry->wMachine = DETOUR_PROLOGUE_MACHINE;
+    CopyMemory(pEntry->rbTarget, pbTarget, cbTarget);
+}
+#endif // DETOUR_PROLOGUE_MACHINE
+
 //////////////////////////////////////////////////////////////////////////////
 //
 
@@ -993,6 +1047,26 @@ BOOL WINAPI DetourSetRetainRegions(BOOL fRetain)
     return fPrevious;
 }
 
+VOID WINAPI DetourSetPrologueCache(const DETOUR_PROLOGUE_CACHE_ENTRY *pEntries, DWORD cEntries)
+{
+    s_pPrologueCache = pEntries;
+    s_cPrologueCache = pEntries != NULL ? cEntries : 0;
+}
+
+DWORD WINAPI DetourGetPrologueCache(PDETOUR_PROLOGUE_CACHE_ENTRY pEntries, DWORD cEntries)
+{
+    DWORD cCopied = cEntries < s_cMovedPrologues ? cEntries : s_cMovedPrologues;
+    if (pEntries != NULL && cCopied > 0) {
+        CopyMemory(pEntries, s_rMovedPrologues, cCopied * sizeof(DETOUR_PROLOGUE_CACHE_ENTRY));
+    }
+    return s_cMovedPrologues;
+}
+
+DWORD WINAPI DetourGetPrologueCacheHits()
+{
+    return s_cPrologueCacheHits;
+}
+
 LONG WINAPI DetourTransactionBegin()
 {
     // Only one transaction is allowed at a time.
@@ -1549,6 +1623,21 @@ LONG WINAPI DetourAttachEx(PVOID *ppPointer,
     }
 #endif
 
+#ifdef DETOUR_PROLOGUE_MACHINE
+    // A cached prologue was moved unchanged, which its identical bytes are again: copy them and skip both loops below.
+    const DETOUR_PROLOGUE_CACHE_ENTRY *pCachedPrologue =
+        detour_find_cached_prologue(pbSrc, cbJump, sizeof(pTrampoline->rbCode) - cbJump);
+    if (pCachedPrologue != NULL) {
+        CopyMemory(pbTrampoline, pbSrc, pCachedPrologue->cbCode);
+        pbTrampoline += pCachedPrologue->cbCode;
+        pTrampoline->rAlign[nAlign].obTarget = pCachedPrologue->cbCode;
+        pTrampoline->rAlign[nAlign].obTrampoline = pCachedPrologue->cbCode;
+        pbSrc += pCachedPrologue->cbTarget;
+        cbTarget = pCachedPrologue->cbTarget;
+        s_cPrologueCacheHits++;
+    }
+#endif // DETOUR_PROLOGUE_MACHINE
+
     while (cbTarget < cbJump) {
         PBYTE pbOp = pbSrc;
         LONG lExtra = 0;
@@ -1569,6 +1658,14 @@ LONG WINAPI DetourAttachEx(PVOID *ppPointer,
         }
     }
 
+    // Bytes of the target moved to the trampoline, not counting the filler consumed below.
+    ULONG cbMoved = cbTarget;
+#ifdef DETOUR_PROLOGUE_MACHINE
+    if (pCachedPrologue != NULL) {
+        cbMoved = pCachedPrologue->cbCode;
+    }
+#endif // DETOUR_PROLOGUE_MACHINE
+
     // Consume, but don't duplicate padding if it is needed and available.
     while (cbTarget < cbJump) {
         LONG cFiller = detour_is_code_filler(pbSrc);
@@ -1724,6 +1821,16 @@ LONG WINAPI DetourAttachEx(PVOID *ppPointer,
                   pTrampoline->rbCode[8], pTrampoline->rbCode[9],
                   pTrampoline->rbCode[10], pTrampoline->rbCode[11]));
 
+#ifdef DETOUR_PROLOGUE_MACHINE
+    // Only a prologue moved byte for byte (no operand fixed up, nothing put in the pool) can be moved again from its bytes.
+    if (pbPool == pTrampoline->rbCode + sizeof(pTrampoline->rbCode) &&
+        pTrampoline->cbCode == cbMoved &&
+        cbMoved <= cbTarget &&
+        memcmp(pTrampoline->rbCode, pTrampoline->rbRestore, cbMoved) == 0) {
+        detour_record_moved_prologue(pbTarget, cbMoved, cbTarget);
+    }
+#endif // DETOUR_PROLOGUE_MACHINE
+
     o->fIsRemove = FALSE;
     o->ppbPointer = (PBYTE*)ppPointer;
     o->pTrampoline = pTrampoline;
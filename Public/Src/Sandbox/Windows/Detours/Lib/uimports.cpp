@@ -18,7 +18,8 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
                               HMODULE hModule,
                               __in_ecount(nDlls) LPCSTR *plpDlls,
                               DWORD nDlls,
-							  PBYTE* pbClr)
+							  PBYTE* pbClr,
+                              PDETOUR_UPDATE_TIMINGS pTimings)
 {
     BOOL fSucceeded = FALSE;
     BYTE * pbNew = NULL;
@@ -115,7 +116,7 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
 
 #if IGNORE_CHECKSUMS
     // Find the current checksum.
-    WORD wBefore = ComputeChkSum(hProcess, pbModule, &inh);
+    WORD wBefore = TimedComputeChkSum(hProcess, pbModule, &inh, pTimings);
     DETOUR_TRACE(("ChkSum: %04x + %08x => %08x\n", wBefore, dwFileSize, wBefore + dwFileSize));
 #endif
 
@@ -167,7 +168,11 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
     DETOUR_TRACE(("pbBase = %p\n", pbBase));
 
 	// Allocate space in the PE file for moving the IIDs.
+    LONGLONG llStart = DetourTicks();
 	PBYTE pbNewIid = FindAndAllocateNearBase(hProcess, pbBase, cbNew);
+    if (pTimings != NULL) {
+        pTimings->llAllocateNearBase += DetourTicks() - llStart;
+    }
     if (pbNewIid == NULL) {
         DETOUR_TRACE(("FindAndAllocateNearBase failed.\n"));
         goto finish;
@@ -252,6 +257,9 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
     }
 
 	// Write the IIDs in the in-memory buffer to the allocated space in the PE file.
+    // The checksum computed in between is not part of the time spent writing.
+    llStart = DetourTicks();
+    LONGLONG llChecksumStart = pTimings != NULL ? pTimings->llChecksum : 0;
     if (!WriteProcessMemory(hProcess, pbNewIid, pbNew, obStr, NULL)) {
         DETOUR_TRACE_ERROR(L"WriteProcessMemory(iid) failed: %d\n", GetLastError());
         goto finish;
@@ -318,7 +326,7 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
                   pbModule + idh.e_lfanew + sizeof(inh)));
 
 #if IGNORE_CHECKSUMS
-    WORD wDuring = ComputeChkSum(hProcess, pbModule, &inh);
+    WORD wDuring = TimedComputeChkSum(hProcess, pbModule, &inh, pTimings);
     DETOUR_TRACE(("ChkSum: %04x + %08x => %08x\n", wDuring, dwFileSize, wDuring + dwFileSize));
 
     idh.e_res[0] = detour_sum_minus(idh.e_res[0], detour_sum_minus(wDuring, wBefore));
@@ -335,8 +343,12 @@ static BOOL UPDATE_IMPORTS_XX(HANDLE hProcess,
         goto finish;
     }
 
+    if (pTimings != NULL) {
+        pTimings->llWriteImports += DetourTicks() - llStart - (pTimings->llChecksum - llChecksumStart);
+    }
+
 #if IGNORE_CHECKSUMS
-    WORD wAfter = ComputeChkSum(hProcess, pbModule, &inh);
+    WORD wAfter = TimedComputeChkSum(hProcess, pbModule, &inh, pTimings);
     DETOUR_TRACE(("ChkSum: %04x + %08x => %08x\n", wAfter, dwFileSize, wAfter + dwFileSize));
     DETOUR_TRACE(("Before: %08x, After: %08x\n", wBefore + dwFileSize, wAfter + dwFileSize));
 
@@ -113,6 +113,27 @@ typedef struct _DETOUR_SECTION_RECORD
     GUID        guid;
 } DETOUR_SECTION_RECORD, *PDETOUR_SECTION_RECORD;
 
+// One of the consecutive parts of a payload written by DetourCopyPayloadPartsToProcess.
+typedef struct _DETOUR_PAYLOAD_PART
+{
+    const VOID *pvData;
+    DWORD       cbData;
+} DETOUR_PAYLOAD_PART, *PDETOUR_PAYLOAD_PART;
+
+#define DETOUR_PROLOGUE_CACHE_MAX_ENTRIES   128
+
+// The prologue of a target function that DetourAttach moved to its trampoline unchanged (as it has no relative operand to
+// fix up), so that another process finding the same bytes at the same address can move it again without disassembling it.
+typedef struct _DETOUR_PROLOGUE_CACHE_ENTRY
+{
+    ULONGLONG   ullTarget;          // Address of the target code (with jumps to it skipped).
+    BYTE        cbCode;             // Bytes of whole instructions moved to the trampoline.
+    BYTE        cbTarget;           // Bytes overwritten at the target: cbCode and the filler consumed after it.
+    WORD        wMachine;           // IMAGE_FILE_MACHINE_* the instructions were decoded for.
+    DWORD       dwReserved;
+    BYTE        rbTarget[32];       // The first cbTarget bytes of the target when it was decoded.
+} DETOUR_PROLOGUE_CACHE_ENTRY, *PDETOUR_PROLOGUE_CACHE_ENTRY;
+
 typedef struct _DETOUR_CLR_HEADER
 {
     // Header versioning
@@ -236,6 +257,15 @@ LONG WINAPI DetourDetach(PVOID *ppPointer,
 BOOL WINAPI DetourSetIgnoreTooSmall(BOOL fIgnore);
 BOOL WINAPI DetourSetRetainRegions(BOOL fRetain);
 
+// Lets later attaches take the prologue of a target from 'pEntries' instead of disassembling it, when an entry for the
+// target holds the bytes currently there. The entries are not copied and must stay valid until the transaction commits.
+VOID WINAPI DetourSetPrologueCache(const DETOUR_PROLOGUE_CACHE_ENTRY *pEntries, DWORD cEntries);
+// Copies (up to cEntries of) the prologues moved by the attaches so far that another process can take from its cache
+// to pEntries, and returns their number.
+DWORD WINAPI DetourGetPrologueCache(PDETOUR_PROLOGUE_CACHE_ENTRY pEntries, DWORD cEntries);
+// Number of attaches that took the prologue from the cache set with DetourSetPrologueCache.
+DWORD WINAPI DetourGetPrologueCacheHits();
+
 ////////////////////////////////////////////////////////////// Code Functions.
 //
 PVOID WINAPI DetourFindFunction(__in_z PCSTR pszModule, __in_z PCSTR pszFunction);
@@ -355,6 +385,22 @@ BOOL WINAPI DetourUpdateProcessWithDll(HANDLE hProcess,
                                        __in_ecount(nDlls) LPCSTR *plpDlls,
                                        DWORD nDlls);
 
+// Time spent in the steps of DetourUpdateProcessWithDllTimed, in QueryPerformanceCounter ticks.
+typedef struct _DETOUR_UPDATE_TIMINGS
+{
+    LONGLONG    llFindImage;        // Finding the EXE image of the process.
+    LONGLONG    llAllocateNearBase; // Allocating the new import table near the image.
+    LONGLONG    llWriteImports;     // Writing the import table and the updated headers.
+    LONGLONG    llChecksum;         // Computing the image checksum (only with IGNORE_CHECKSUMS).
+    BOOL        fImageFromPeb;      // Whether the image was found from the PEB rather than by walking the address space.
+} DETOUR_UPDATE_TIMINGS, *PDETOUR_UPDATE_TIMINGS;
+
+// Same as DetourUpdateProcessWithDll, adding the time spent in each step to 'pTimings' (if not NULL).
+BOOL WINAPI DetourUpdateProcessWithDllTimed(HANDLE hProcess,
+                                            __in_ecount(nDlls) LPCSTR *plpDlls,
+                                            DWORD nDlls,
+                                            PDETOUR_UPDATE_TIMINGS pTimings);
+
 #ifdef DETOURS_X86_X64
 void WINAPI DetourCreateProcessWithDllx86x64A(
                           LPCSTR lpApplicationName,
@@ -406,6 +452,12 @@ BOOL WINAPI DetourCopyPayloadToProcess(HANDLE hProcess,
                                        REFGUID rguid,
                                        PVOID pvData,
                                        DWORD cbData);
+// Same as DetourCopyPayloadToProcess for a payload made of the concatenation of 'pParts',
+// which saves callers from assembling the payload in one buffer first.
+BOOL WINAPI DetourCopyPayloadPartsToProcess(HANDLE hProcess,
+                                            REFGUID rguid,
+                                            const DETOUR_PAYLOAD_PART *pParts,
+                                            DWORD cParts);
 BOOL WINAPI DetourRestoreAfterWith();
 BOOL WINAPI DetourRestoreAfterWithEx(PVOID pvData, DWORD cbData);
 
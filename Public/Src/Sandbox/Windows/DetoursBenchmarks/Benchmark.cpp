@@ -0,0 +1,86 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <algorithm>
+
+#if MAC_OS_LIBRARY
+#include <mach/mach_time.h>
+#include <wchar.h>
+#endif
+
+#include "Benchmark.h"
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+volatile size_t g_benchmarkSink = 0;
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+#if !(MAC_OS_LIBRARY)
+
+int64_t QueryPerformanceTicks()
+{
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return ticks.QuadPart;
+}
+
+double TicksToNanoseconds(int64_t ticks)
+{
+    static int64_t s_frequency = 0;
+    if (s_frequency == 0)
+    {
+        LARGE_INTEGER frequency;
+        s_frequency = QueryPerformanceFrequency(&frequency) && frequency.QuadPart > 0 ? frequency.QuadPart : 1;
+    }
+
+    return (double)ticks * 1000000000.0 / (double)s_frequency;
+}
+
+#else // !(MAC_OS_LIBRARY)
+
+int64_t QueryPerformanceTicks()
+{
+    return (int64_t)mach_absolute_time();
+}
+
+double TicksToNanoseconds(int64_t ticks)
+{
+    static mach_timebase_info_data_t s_timebase = { 0, 0 };
+    if (s_timebase.denom == 0)
+    {
+        mach_timebase_info(&s_timebase);
+    }
+
+    return (double)ticks * (double)s_timebase.numer / (double)s_timebase.denom;
+}
+
+#endif // !(MAC_OS_LIBRARY)
+
+double ReportBenchmarkResult(wchar_t const* name, size_t operationsPerSample, std::vector<double>& nanosecondsPerOperation)
+{
+    if (nanosecondsPerOperation.empty())
+    {
+        return 0;
+    }
+
+    std::sort(nanosecondsPerOperation.begin(), nanosecondsPerOperation.end());
+
+    wprintf(
+        L"{\"benchmark\":\"%ls\",\"operationsPerSample\":%llu,\"samples\":%llu,\"minNs\":%.1f,\"medianNs\":%.1f,\"maxNs\":%.1f}\n",
+        name,
+        (unsigned long long)operationsPerSample,
+        (unsigned long long)nanosecondsPerOperation.size(),
+        nanosecondsPerOperation.front(),
+        nanosecondsPerOperation[nanosecondsPerOperation.size() / 2],
+        nanosecondsPerOperation.back());
+    fflush(stdout);
+
+    return nanosecondsPerOperation[nanosecondsPerOperation.size() / 2];
+}
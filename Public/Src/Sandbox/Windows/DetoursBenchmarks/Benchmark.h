@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Timing harness of the Detours benchmarks.
+//
+// Each benchmark runs an untimed warm-up sample followed by BENCHMARK_SAMPLES timed samples of a fixed number of
+// operations, and prints its result as one JSON object per line on stdout:
+//
+//   {"benchmark":"<name>","operationsPerSample":N,"samples":S,"minNs":x,"medianNs":y,"maxNs":z}
+//
+// where the times are the nanoseconds per operation of the fastest, median, and slowest sample. Only JSON lines go to
+// stdout, so the output of a run can be collected as is to track the results per commit.
+//
+// The harness builds for the macOS user mode as well, for the benchmarks that only need the policy search sources.
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Number of timed samples of each benchmark.
+#define BENCHMARK_SAMPLES 15
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+// The operations add their results here, so that the compiler cannot optimize them away.
+extern volatile size_t g_benchmarkSink;
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+int64_t QueryPerformanceTicks();
+
+double TicksToNanoseconds(int64_t ticks);
+
+/// Prints the result line of a benchmark. Sorts the samples. Returns the median nanoseconds per operation.
+double ReportBenchmarkResult(wchar_t const* name, size_t operationsPerSample, std::vector<double>& nanosecondsPerOperation);
+
+/// Times operation(i) for i in [0, operationsPerSample) over the samples of a benchmark, then prints its result.
+/// Returns the median nanoseconds per operation.
+template <typename TOperation>
+double RunBenchmark(wchar_t const* name, size_t operationsPerSample, TOperation operation)
+{
+    std::vector<double> nanosecondsPerOperation;
+    nanosecondsPerOperation.reserve(BENCHMARK_SAMPLES);
+
+    // Sample -1 is the warm-up.
+    for (int sample = -1; sample < BENCHMARK_SAMPLES; sample++)
+    {
+        size_t sink = 0;
+        int64_t start = QueryPerformanceTicks();
+        for (size_t i = 0; i < operationsPerSample; i++)
+        {
+            sink += operation(i);
+        }
+
+        int64_t elapsed = QueryPerformanceTicks() - start;
+        g_benchmarkSink += sink;
+
+        if (sample >= 0)
+        {
+            nanosecondsPerOperation.push_back(TicksToNanoseconds(elapsed) / (double)operationsPerSample);
+        }
+    }
+
+    return ReportBenchmarkResult(name, operationsPerSample, nanosecondsPerOperation);
+}
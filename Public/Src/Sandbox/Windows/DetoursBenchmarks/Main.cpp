@@ -0,0 +1,543 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Main.cpp : Defines the entry point of the Detours benchmarks.
+//
+// Usage: DetoursBenchmarks.exe [benchmark...]
+//
+// Runs the given benchmarks, or all of them. The hot paths of DetoursServices are compiled into this executable and
+// timed in isolation against a synthetic manifest the size of a typical pip's:
+//   Canonicalize                   CanonicalizedPath::Canonicalize of Win32, \\?\, relative-component, and '/' paths
+//   FindFileAccessPolicyInTreeEx   policy search of declared, undeclared, scoped, and output paths
+//   ReportFileAccess               formatting and writing (to NUL) of text and binary reports
+//   HandleOverlay                  register / lookup / close cycle of a handle, with other handles open
+//   SpecializedDetours             Detoured_CreateFileW and its variant specialized for the default FAM flags, called
+//                                  directly on existing files (the real CreateFileW still opens them)
+//   PathKernels                    NormalizeAndHashPath and ArePathsEqual (of equal paths) with the scalar loops, and with the
+//                                  SSE2 and AVX2 kernels where the processor has them (see SelectPathKernels)
+// The round trips call the real APIs. They go through the detours when the benchmarks run in a sandboxed process,
+// and measure the undetoured baseline otherwise:
+//   CreateFileW                    CreateFileW and CloseHandle of existing files
+//   GetFileAttributesW             GetFileAttributesW of existing files
+// The result lines (see Benchmark.h) follow a line describing the synthetic manifest.
+
+#include "stdafx.h"
+
+#include "Benchmark.h"
+#include "CanonicalizedPath.h"
+#include "DetouredFunctions.h"
+#include "HandleOverlay.h"
+#include "PolicyResult.h"
+#include "PolicySearch.h"
+#include "SendReport.h"
+#include "StringOperations.h"
+#include "SyntheticManifest.h"
+#include "globals.h"
+
+// ----------------------------------------------------------------------------
+// DEFINES
+// ----------------------------------------------------------------------------
+
+#define ERROR_INVALID_COMMAND   2
+#define ERROR_SETUP_FAILED      3
+
+// Shape of the declared inputs of the synthetic pip: components x directories x files.
+#define SYNTHETIC_COMPONENTS    64
+#define SYNTHETIC_DIRECTORIES   8
+#define SYNTHETIC_FILES         12
+
+// Declared outputs per component.
+#define SYNTHETIC_OUTPUTS       4
+
+// Number of distinct paths reported, and of handles kept open besides the one cycled.
+#define REPORTED_PATHS          1024
+#define RESIDENT_HANDLES        1024
+
+// Number of files the round trips go through.
+#define ROUND_TRIP_FILES        64
+
+// Handle values of the overlays. Never real handles: the overlay map does not look at them.
+#define RESIDENT_HANDLE_BASE    0x10000000
+#define CYCLED_HANDLE_BASE      0x20000000
+
+// ----------------------------------------------------------------------------
+// STRUCTS
+// ----------------------------------------------------------------------------
+
+struct BenchmarkContext
+{
+    SyntheticManifest Manifest;
+
+    // Canonical paths without type prefix, in lookup order.
+    std::vector<std::wstring> LookupPaths;
+
+    // Variations of the lookup paths that canonicalization has to do work for.
+    std::vector<std::wstring> NoncanonicalPaths;
+
+    // Policies of the first REPORTED_PATHS lookup paths.
+    std::vector<PolicyResult> Policies;
+
+    // Files the round trips go through, and the directory they are in.
+    std::wstring RoundTripDirectory;
+    std::vector<std::wstring> RoundTripFiles;
+};
+
+typedef void (*BenchmarkFunction)(BenchmarkContext& context);
+
+struct BenchmarkDefinition
+{
+    char const* Name;
+    BenchmarkFunction Run;
+};
+
+// ----------------------------------------------------------------------------
+// SETUP
+// ----------------------------------------------------------------------------
+
+/// Deterministic shuffle, so that every run looks up the paths in the same order.
+static void Shuffle(std::vector<std::wstring>& paths)
+{
+    uint32_t state = 0x2545F491;
+    for (size_t i = paths.size(); i > 1; i--)
+    {
+        state = state * 1664525 + 1013904223;
+        std::swap(paths[i - 1], paths[state % i]);
+    }
+}
+
+/// Adds the policies of a mid-sized pip: read-only tool and system scopes, a writable object and temp directory,
+/// and declared inputs and outputs. Fills in the paths to look up, covering each kind of match.
+static void AddSyntheticPipPolicies(BenchmarkContext& context)
+{
+    FileAccessPolicy const readPolicy = (FileAccessPolicy)(FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent);
+    FileAccessPolicy const reportedReadPolicy = (FileAccessPolicy)(readPolicy | FileAccessPolicy_ReportAccess);
+    FileAccessPolicy const writePolicy = (FileAccessPolicy)(FileAccessPolicy_AllowAll | FileAccessPolicy_ReportAccess);
+
+    context.Manifest.AddScope(L"C:\\Windows", readPolicy);
+    context.Manifest.AddScope(L"C:\\Program Files (x86)\\Microsoft Visual Studio", readPolicy);
+    context.Manifest.AddScope(L"C:\\Program Files\\dotnet", readPolicy);
+    context.Manifest.AddScope(L"D:\\out\\obj\\Pip0123456789ABCDEF", writePolicy);
+    context.Manifest.AddScope(L"C:\\Users\\Builder\\AppData\\Local\\Temp\\bxl\\Pip0123456789ABCDEF", FileAccessPolicy_AllowAll);
+
+    // The files the round trips and the detours called directly go through are declared inputs too.
+    context.Manifest.AddScope(context.RoundTripDirectory, readPolicy);
+
+    for (int component = 0; component < SYNTHETIC_COMPONENTS; component++)
+    {
+        std::wstring componentPath = L"D:\\src\\repo\\Component" + std::to_wstring(component);
+
+        for (int directory = 0; directory < SYNTHETIC_DIRECTORIES; directory++)
+        {
+            std::wstring directoryPath = componentPath + L"\\Directory" + std::to_wstring(directory);
+
+            for (int file = 0; file < SYNTHETIC_FILES; file++)
+            {
+                std::wstring path = directoryPath + L"\\File" + std::to_wstring(file) + L".cpp";
+                context.Manifest.AddPath(path, reportedReadPolicy);
+                context.LookupPaths.push_back(path);
+            }
+
+            // Undeclared files next to the declared ones, e.g., probes for headers.
+            context.LookupPaths.push_back(directoryPath + L"\\Undeclared" + std::to_wstring(directory) + L".h");
+        }
+
+        for (int output = 0; output < SYNTHETIC_OUTPUTS; output++)
+        {
+            std::wstring path = L"D:\\out\\bin\\Component" + std::to_wstring(component) + L"\\Output" + std::to_wstring(output) + L".dll";
+            context.Manifest.AddPath(path, writePolicy);
+            context.LookupPaths.push_back(path);
+        }
+
+        // Paths below the scopes.
+        context.LookupPaths.push_back(L"C:\\Windows\\System32\\Module" + std::to_wstring(component) + L".dll");
+        context.LookupPaths.push_back(L"C:\\Program Files (x86)\\Microsoft Visual Studio\\2017\\Enterprise\\VC\\Tools\\MSVC\\include\\Header" + std::to_wstring(component) + L".h");
+        context.LookupPaths.push_back(L"D:\\out\\obj\\Pip0123456789ABCDEF\\Component" + std::to_wstring(component) + L".obj");
+    }
+
+    Shuffle(context.LookupPaths);
+}
+
+static void AddNoncanonicalPaths(BenchmarkContext& context)
+{
+    for (size_t i = 0; i < context.LookupPaths.size(); i++)
+    {
+        std::wstring path = context.LookupPaths[i];
+        switch (i % 4)
+        {
+        case 0:
+            break;
+        case 1:
+            path = L"\\\\?\\" + path;
+            break;
+        case 2:
+            // D:\src\..\src\repo\...
+            path.insert(path.find(L'\\', 3), L"\\..\\" + path.substr(3, path.find(L'\\', 3) - 3));
+            break;
+        case 3:
+            for (wchar_t& c : path)
+            {
+                if (c == L'\\')
+                {
+                    c = L'/';
+                }
+            }
+            break;
+        }
+
+        context.NoncanonicalPaths.push_back(path);
+    }
+}
+
+static bool CreateRoundTripFiles(BenchmarkContext& context)
+{
+    wchar_t tempPath[MAX_PATH];
+    DWORD length = GetTempPathW(MAX_PATH, tempPath);
+    if (length == 0 || length >= MAX_PATH)
+    {
+        return false;
+    }
+
+    context.RoundTripDirectory = std::wstring(tempPath) + L"DetoursBenchmarks" + std::to_wstring(GetCurrentProcessId());
+    if (!CreateDirectoryW(context.RoundTripDirectory.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < ROUND_TRIP_FILES; i++)
+    {
+        std::wstring path = context.RoundTripDirectory + L"\\File" + std::to_wstring(i) + L".txt";
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        CloseHandle(file);
+        context.RoundTripFiles.push_back(path);
+    }
+
+    return true;
+}
+
+static void DeleteRoundTripFiles(BenchmarkContext const& context)
+{
+    for (std::wstring const& path : context.RoundTripFiles)
+    {
+        DeleteFileW(path.c_str());
+    }
+
+    if (!context.RoundTripDirectory.empty())
+    {
+        RemoveDirectoryW(context.RoundTripDirectory.c_str());
+    }
+}
+
+/// Sets up the state DllProcessAttach would, without detouring anything.
+static bool InitializeDetoursState(BenchmarkContext& context)
+{
+    g_currentProcessId = GetCurrentProcessId();
+    g_invariantLocale = _wcreate_locale(LC_CTYPE, L"");
+    g_pManifestTranslatePathTuples = new vector<TranslatePathTuple*>();
+
+    // Nothing is detoured: the detours called directly call through to the real functions.
+    Real_CreateFileW = ::CreateFileW;
+
+    AddSyntheticPipPolicies(context);
+    AddNoncanonicalPaths(context);
+    g_manifestTreeRoot = context.Manifest.Serialize();
+
+    InitializeHandleOverlay();
+
+    // The reports are written to NUL, so the benchmarks measure the detours and not the reader of the pipe.
+    g_reportFileHandle = CreateFileW(L"NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (g_reportFileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < REPORTED_PATHS && i < context.LookupPaths.size(); i++)
+    {
+        PolicyResult policy;
+        if (!policy.Initialize(context.LookupPaths[i].c_str()))
+        {
+            return false;
+        }
+
+        context.Policies.push_back(std::move(policy));
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// BENCHMARKS
+// ----------------------------------------------------------------------------
+
+static void BenchmarkCanonicalize(BenchmarkContext& context)
+{
+    RunBenchmark(L"CanonicalizedPath::Canonicalize", context.NoncanonicalPaths.size(), [&](size_t i)
+    {
+        CanonicalizedPath path = CanonicalizedPath::Canonicalize(context.NoncanonicalPaths[i].c_str());
+        return (size_t)path.Type;
+    });
+}
+
+static void BenchmarkFindFileAccessPolicyInTreeEx(BenchmarkContext& context)
+{
+    RunBenchmark(L"FindFileAccessPolicyInTreeEx", context.LookupPaths.size(), [&](size_t i)
+    {
+        std::wstring const& path = context.LookupPaths[i];
+        PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(PolicySearchCursor(g_manifestTreeRoot), path.c_str(), path.length());
+        return (size_t)cursor.Record->GetPathId();
+    });
+}
+
+static void RunReportFileAccessBenchmark(BenchmarkContext& context, wchar_t const* name)
+{
+    AccessCheckResult const accessCheck(RequestedAccess::Read, ResultAction::Allow, ReportLevel::Report);
+
+    RunBenchmark(name, context.Policies.size(), [&](size_t i)
+    {
+        FileOperationContext operationContext(
+            L"CreateFile",
+            GENERIC_READ,
+            FILE_SHARE_READ,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            context.LookupPaths[i].c_str());
+
+        ReportFileAccess(operationContext, FileAccessStatus_Allowed, context.Policies[i], accessCheck, ERROR_SUCCESS, -1);
+        return i;
+    });
+}
+
+static void BenchmarkReportFileAccess(BenchmarkContext& context)
+{
+    FileAccessManifestExtraFlag const extraFlags = g_fileAccessManifestExtraFlags;
+
+    RunReportFileAccessBenchmark(context, L"ReportFileAccess/Text");
+
+    g_fileAccessManifestExtraFlags = extraFlags | FileAccessManifestExtraFlag::UseBinaryReportFormat;
+    RunReportFileAccessBenchmark(context, L"ReportFileAccess/Binary");
+
+    g_fileAccessManifestExtraFlags = extraFlags;
+}
+
+static void BenchmarkHandleOverlay(BenchmarkContext& context)
+{
+    AccessCheckResult const accessCheck(RequestedAccess::Read, ResultAction::Allow, ReportLevel::Report);
+
+    for (size_t i = 0; i < RESIDENT_HANDLES; i++)
+    {
+        HANDLE handle = (HANDLE)(ULONG_PTR)(RESIDENT_HANDLE_BASE + i * 4);
+        RegisterHandleOverlay(handle, accessCheck, context.Policies[i % context.Policies.size()], HandleType::File);
+    }
+
+    RunBenchmark(L"HandleOverlay/RegisterLookupClose", context.Policies.size(), [&](size_t i)
+    {
+        HANDLE handle = (HANDLE)(ULONG_PTR)(CYCLED_HANDLE_BASE + i * 4);
+        RegisterHandleOverlay(handle, accessCheck, context.Policies[i], HandleType::File);
+        HandleOverlayRef overlay = TryLookupHandleOverlay(handle);
+        CloseHandleOverlay(handle);
+        return overlay != nullptr ? (size_t)1 : (size_t)0;
+    });
+
+    for (size_t i = 0; i < RESIDENT_HANDLES; i++)
+    {
+        CloseHandleOverlay((HANDLE)(ULONG_PTR)(RESIDENT_HANDLE_BASE + i * 4));
+    }
+}
+
+static void BenchmarkCreateFileW(BenchmarkContext& context)
+{
+    RunBenchmark(L"CreateFileW/OpenExisting", context.RoundTripFiles.size() * 16, [&](size_t i)
+    {
+        HANDLE file = CreateFileW(
+            context.RoundTripFiles[i % context.RoundTripFiles.size()].c_str(),
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            nullptr);
+
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return (size_t)0;
+        }
+
+        CloseHandle(file);
+        return (size_t)1;
+    });
+}
+
+static void BenchmarkGetFileAttributesW(BenchmarkContext& context)
+{
+    RunBenchmark(L"GetFileAttributesW/Existing", context.RoundTripFiles.size() * 16, [&](size_t i)
+    {
+        return (size_t)GetFileAttributesW(context.RoundTripFiles[i % context.RoundTripFiles.size()].c_str());
+    });
+}
+
+static void RunDetouredCreateFileWBenchmark(BenchmarkContext& context, wchar_t const* name, CreateFileW_t detour)
+{
+    RunBenchmark(name, context.RoundTripFiles.size() * 16, [&](size_t i)
+    {
+        HANDLE file = detour(
+            context.RoundTripFiles[i % context.RoundTripFiles.size()].c_str(),
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            nullptr);
+
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return (size_t)0;
+        }
+
+        CloseHandleOverlay(file);
+        CloseHandle(file);
+        return (size_t)1;
+    });
+}
+
+static void BenchmarkSpecializedDetours(BenchmarkContext& context)
+{
+    FileAccessManifestFlag const flags = g_fileAccessManifestFlags;
+
+    // The default flags of a build, the ones DefaultFamFlags folds.
+    g_fileAccessManifestFlags = (FileAccessManifestFlag)(((DWORD)flags & ~DETOURS_SPECIALIZED_FAM_FLAGS) | (DWORD)FileAccessManifestFlag::MonitorNtCreateFile);
+
+    RunDetouredCreateFileWBenchmark(context, L"DetouredCreateFileW/Generic", Detoured_CreateFileW);
+    RunDetouredCreateFileWBenchmark(context, L"DetouredCreateFileW/Specialized", SelectDetoured_CreateFileW());
+
+    g_fileAccessManifestFlags = flags;
+}
+
+static void RunPathKernelsBenchmark(
+    BenchmarkContext& context,
+    std::vector<std::wstring> const& normalizedPaths,
+    PathKernels kernels,
+    wchar_t const* normalizeName,
+    wchar_t const* compareName)
+{
+    // Kernels the processor (or the build) does not have get no result lines.
+    if (!SelectPathKernels(kernels))
+    {
+        return;
+    }
+
+    size_t maxLength = 0;
+    for (std::wstring const& path : context.LookupPaths)
+    {
+        maxLength = path.length() > maxLength ? path.length() : maxLength;
+    }
+
+    std::vector<PathChar> buffer(maxLength + 1);
+
+    RunBenchmark(normalizeName, context.LookupPaths.size(), [&](size_t i)
+    {
+        std::wstring const& path = context.LookupPaths[i];
+        return (size_t)NormalizeAndHashPath(path.c_str(), (PBYTE)buffer.data(), (DWORD)((path.length() + 1) * sizeof(PathChar)));
+    });
+
+    RunBenchmark(compareName, context.LookupPaths.size(), [&](size_t i)
+    {
+        std::wstring const& path = context.LookupPaths[i];
+        return (size_t)ArePathsEqual(path.c_str(), normalizedPaths[i].c_str(), path.length());
+    });
+}
+
+static void BenchmarkPathKernels(BenchmarkContext& context)
+{
+    std::vector<std::wstring> normalizedPaths;
+    for (std::wstring const& path : context.LookupPaths)
+    {
+        std::wstring normalized(path.length(), L'\0');
+        NormalizeAndHashPath(path.c_str(), (PBYTE)&normalized[0], (DWORD)((path.length() + 1) * sizeof(PathChar)));
+        normalizedPaths.push_back(std::move(normalized));
+    }
+
+    RunPathKernelsBenchmark(context, normalizedPaths, PathKernels::Scalar, L"NormalizeAndHashPath/Scalar", L"ArePathsEqual/Scalar");
+    RunPathKernelsBenchmark(context, normalizedPaths, PathKernels::Sse2, L"NormalizeAndHashPath/Sse2", L"ArePathsEqual/Sse2");
+    RunPathKernelsBenchmark(context, normalizedPaths, PathKernels::Avx2, L"NormalizeAndHashPath/Avx2", L"ArePathsEqual/Avx2");
+
+    // Back to the default: the widest kernels there are.
+    if (!SelectPathKernels(PathKernels::Avx2) && !SelectPathKernels(PathKernels::Sse2))
+    {
+        SelectPathKernels(PathKernels::Scalar);
+    }
+}
+
+static BenchmarkDefinition const s_benchmarks[] = {
+    { "Canonicalize", BenchmarkCanonicalize },
+    { "FindFileAccessPolicyInTreeEx", BenchmarkFindFileAccessPolicyInTreeEx },
+    { "ReportFileAccess", BenchmarkReportFileAccess },
+    { "HandleOverlay", BenchmarkHandleOverlay },
+    { "SpecializedDetours", BenchmarkSpecializedDetours },
+    { "PathKernels", BenchmarkPathKernels },
+    { "CreateFileW", BenchmarkCreateFileW },
+    { "GetFileAttributesW", BenchmarkGetFileAttributesW },
+};
+
+// ----------------------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        bool found = false;
+        for (BenchmarkDefinition const& benchmark : s_benchmarks)
+        {
+            found = found || _stricmp(argv[i], benchmark.Name) == 0;
+        }
+
+        if (!found)
+        {
+            fprintf(stderr, "Unknown benchmark '%s'.\n", argv[i]);
+            return ERROR_INVALID_COMMAND;
+        }
+    }
+
+    // Everything allocated with new goes to the private heap of the detours (see buildXL_mem.h), so it comes first.
+    g_hPrivateHeap = HeapCreate(0, 40960, 0);
+    if (g_hPrivateHeap == nullptr)
+    {
+        return ERROR_SETUP_FAILED;
+    }
+
+    BenchmarkContext* context = new BenchmarkContext();
+    if (!CreateRoundTripFiles(*context) || !InitializeDetoursState(*context))
+    {
+        fwprintf(stderr, L"Failed to set up the benchmarks: %d.\n", (int)GetLastError());
+        DeleteRoundTripFiles(*context);
+        return ERROR_SETUP_FAILED;
+    }
+
+    wprintf(
+        L"{\"manifest\":\"SyntheticPip\",\"records\":%llu,\"bytes\":%llu,\"lookupPaths\":%llu}\n",
+        (unsigned long long)context->Manifest.GetRecordCount(),
+        (unsigned long long)context->Manifest.GetSize(),
+        (unsigned long long)context->LookupPaths.size());
+
+    for (BenchmarkDefinition const& benchmark : s_benchmarks)
+    {
+        bool selected = argc == 1;
+        for (int i = 1; i < argc; i++)
+        {
+            selected = selected || _stricmp(argv[i], benchmark.Name) == 0;
+        }
+
+        if (selected)
+        {
+            benchmark.Run(*context);
+        }
+    }
+
+    DeleteRoundTripFiles(*context);
+    return 0;
+}
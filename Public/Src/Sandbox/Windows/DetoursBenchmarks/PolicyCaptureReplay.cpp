@@ -0,0 +1,432 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// PolicyCaptureReplay.cpp : Defines the entry point of the replay of captured policy inputs.
+//
+// Usage: PolicyCaptureReplay CAPTURE [--decisions FILE] [--baseline FILE]
+//
+// Replays a capture written by a detoured process with FileAccessManifestExtraFlag::CapturePolicyInputs (see
+// PolicyInputCapture.h) through the policy evaluation compiled into this executable, so that a change to the policy
+// search (cursor caches, perfect hashing, manifest layouts) can be evaluated against real traffic without running a build:
+//   --decisions                writes the decision for each captured operation, one per line, in capture order
+//   --baseline                 compares the decisions with a file written by --decisions, typically by the replay
+//                              compiled from the sources before the change, and reports the operations that differ
+//
+// The manifest of the capture is set up as the process had it, flags included, so that the policy result cache and
+// the report deduplication behave as they did. An operation is evaluated as the detours do once the file is known to
+// exist: PolicyResult::Initialize of the captured path, then a write check if the desired access writes and a read
+// (or probe) check otherwise. Its decision is the policy found, the result and report level of the check, and whether
+// the deduplication of reports would drop its report.
+//
+// Two result lines (see Benchmark.h) follow a line describing the capture: the time per operation of the policy
+// evaluation alone (repeated over the samples, so the policy result cache is warm), and of a single pass of the decisions,
+// deduplication included (the report cache only starts out empty once). With --baseline, a last line gives the number of
+// operations that differ.
+
+#include "stdafx.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Benchmark.h"
+#include "DetoursHelpers.h"
+#include "FileAccessHelpers.h"
+#include "PolicyInputCapture.h"
+#include "PolicyResult.h"
+#include "ReportCache.h"
+#include "globals.h"
+
+// ----------------------------------------------------------------------------
+// DEFINES
+// ----------------------------------------------------------------------------
+
+#define ERROR_INVALID_COMMAND   2
+#define ERROR_SETUP_FAILED      3
+#define ERROR_DECISIONS_DIFFER  4
+
+// Number of differing operations printed with --baseline.
+#define MAX_PRINTED_DIFFERENCES 20
+
+// ----------------------------------------------------------------------------
+// STRUCTS
+// ----------------------------------------------------------------------------
+
+struct ReplayOptions
+{
+    char const* CaptureFile = nullptr;
+    char const* DecisionsFile = nullptr;
+    char const* BaselineFile = nullptr;
+};
+
+struct CapturedOperation
+{
+    std::wstring Operation;
+    std::wstring Path;
+    DWORD DesiredAccess;
+    DWORD ShareMode;
+    DWORD CreationDisposition;
+    DWORD FlagsAndAttributes;
+};
+
+struct Decision
+{
+    bool Determinate;
+    FileAccessPolicy Policy;
+    ResultAction Action;
+    ReportLevel Level;
+    bool Deduplicated;
+
+    bool operator==(Decision const& other) const
+    {
+        return Determinate == other.Determinate
+            && Policy == other.Policy
+            && Action == other.Action
+            && Level == other.Level
+            && Deduplicated == other.Deduplicated;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// LOADING
+// ----------------------------------------------------------------------------
+
+static bool ReadFileBytes(char const* file, std::vector<BYTE>& bytes)
+{
+    std::ifstream stream(file, std::ios::binary | std::ios::ate);
+    if (!stream)
+    {
+        fprintf(stderr, "Cannot open '%s'.\n", file);
+        return false;
+    }
+
+    bytes.resize((size_t)stream.tellg());
+    stream.seekg(0);
+    return (bool)stream.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+}
+
+/// Splits a capture into its manifest and its operations. The manifest is copied out, as the tree needs its own alignment.
+static bool ParseCapture(std::vector<BYTE> const& capture, std::vector<BYTE>& manifest, std::vector<CapturedOperation>& operations)
+{
+    if (capture.size() < sizeof(PolicyCaptureHeader))
+    {
+        return false;
+    }
+
+    PolicyCaptureHeader const* header = reinterpret_cast<PolicyCaptureHeader const*>(capture.data());
+    if (header->Magic != POLICY_CAPTURE_MAGIC
+        || header->Version != POLICY_CAPTURE_VERSION
+        || capture.size() - sizeof(PolicyCaptureHeader) < header->ManifestSize)
+    {
+        return false;
+    }
+
+    size_t offset = sizeof(PolicyCaptureHeader);
+    manifest.assign(capture.begin() + offset, capture.begin() + offset + header->ManifestSize);
+    offset += header->ManifestSize;
+
+    // A capture cut short (the process was killed) ends with a partial record, which is left out.
+    while (offset + sizeof(PolicyCaptureRecord) <= capture.size())
+    {
+        PolicyCaptureRecord record;
+        memcpy(&record, &capture[offset], sizeof(record));
+        size_t size = sizeof(record) + ((size_t)record.OperationLength + record.PathLength) * sizeof(wchar_t);
+        if (offset + size > capture.size())
+        {
+            break;
+        }
+
+        wchar_t const* strings = reinterpret_cast<wchar_t const*>(&capture[offset + sizeof(record)]);
+        offset += size;
+
+        // Contexts without a path (e.g. the process itself, when its name cannot be read) have no policy to evaluate.
+        if (record.PathLength == 0)
+        {
+            continue;
+        }
+
+        CapturedOperation operation;
+        operation.Operation.assign(strings, record.OperationLength);
+        operation.Path.assign(strings + record.OperationLength, record.PathLength);
+        operation.DesiredAccess = record.DesiredAccess;
+        operation.ShareMode = record.ShareMode;
+        operation.CreationDisposition = record.CreationDisposition;
+        operation.FlagsAndAttributes = record.FlagsAndAttributes;
+        operations.push_back(std::move(operation));
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// REPLAY
+// ----------------------------------------------------------------------------
+
+static AccessCheckResult CheckAccess(PolicyResult const& policy, CapturedOperation const& operation)
+{
+    if (WantsWriteAccess(operation.DesiredAccess))
+    {
+        return policy.CheckWriteAccess();
+    }
+
+    FileReadContext readContext(FileExistence::Existent);
+    return policy.CheckReadAccess(
+        WantsProbeOnlyAccess(operation.DesiredAccess) ? RequestedReadAccess::Probe : RequestedReadAccess::Read,
+        readContext);
+}
+
+/// Evaluates an operation as the detours do, deduplication of its report included (see ReportFileAccess).
+static Decision Decide(CapturedOperation const& operation)
+{
+    Decision decision = {};
+    PolicyResult policy;
+    if (!policy.Initialize(operation.Path.c_str()))
+    {
+        return decision;
+    }
+
+    AccessCheckResult check = CheckAccess(policy, operation);
+    decision.Determinate = true;
+    decision.Policy = policy.GetPolicy();
+    decision.Action = check.ResultAction;
+    decision.Level = check.ReportLevel;
+
+    bool isWrite = (check.RequestedAccess & RequestedAccess::Write) != RequestedAccess::None;
+    if (check.ShouldReport()
+        && check.GetFileAccessStatus() == FileAccessStatus_Allowed
+        && (DeduplicateReports() || (CoalesceOutputWrites() && isWrite))
+        && _wcsicmp(operation.Operation.c_str(), L"Process") != 0)
+    {
+        PCWSTR path = policy.GetCanonicalizedPath().GetPathString();
+        decision.Deduplicated = CheckAndUpdateReportCache(path, wcslen(path), check.RequestedAccess);
+    }
+
+    return decision;
+}
+
+static void FormatDecision(Decision const& decision, std::string& line)
+{
+    char buffer[64];
+    if (!decision.Determinate)
+    {
+        snprintf(buffer, sizeof(buffer), "indeterminate");
+    }
+    else
+    {
+        snprintf(buffer, sizeof(buffer), "%08x %d %d %d",
+            (unsigned int)decision.Policy, (int)decision.Action, (int)decision.Level, decision.Deduplicated ? 1 : 0);
+    }
+
+    line.assign(buffer);
+}
+
+static bool WriteDecisions(char const* file, std::vector<CapturedOperation> const& operations, std::vector<Decision> const& decisions)
+{
+    FILE* stream = fopen(file, "w");
+    if (stream == nullptr)
+    {
+        fprintf(stderr, "Cannot create '%s'.\n", file);
+        return false;
+    }
+
+    std::string line;
+    for (size_t i = 0; i < decisions.size(); i++)
+    {
+        FormatDecision(decisions[i], line);
+
+        // The operation and the path only help reading the file; the comparison is on the decision.
+        fprintf(stream, "%s\t%ls\t%ls\n", line.c_str(), operations[i].Operation.c_str(), operations[i].Path.c_str());
+    }
+
+    fclose(stream);
+    return true;
+}
+
+/// Compares the decisions with a file written by --decisions, line by line. Returns the number of differences, counting
+/// the operations missing from either side.
+static size_t CompareWithBaseline(char const* file, std::vector<CapturedOperation> const& operations, std::vector<Decision> const& decisions)
+{
+    std::ifstream stream(file);
+    if (!stream)
+    {
+        fprintf(stderr, "Cannot open '%s'.\n", file);
+        return decisions.size();
+    }
+
+    size_t differences = 0;
+    size_t index = 0;
+    std::string baselineLine;
+    std::string line;
+    while (std::getline(stream, baselineLine))
+    {
+        std::string baseline = baselineLine.substr(0, baselineLine.find('\t'));
+        if (index >= decisions.size())
+        {
+            differences++;
+            index++;
+            continue;
+        }
+
+        FormatDecision(decisions[index], line);
+        if (line != baseline)
+        {
+            if (differences < MAX_PRINTED_DIFFERENCES)
+            {
+                fwprintf(stderr, L"Operation %llu (%ls '%ls'): %S instead of %S.\n",
+                    (unsigned long long)index, operations[index].Operation.c_str(), operations[index].Path.c_str(), line.c_str(), baseline.c_str());
+            }
+
+            differences++;
+        }
+
+        index++;
+    }
+
+    if (index < decisions.size())
+    {
+        differences += decisions.size() - index;
+    }
+
+    return differences;
+}
+
+// ----------------------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------------------
+
+static bool ParseOptions(int argc, char **argv, ReplayOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option.compare(0, 2, "--") != 0)
+        {
+            if (options.CaptureFile != nullptr)
+            {
+                fprintf(stderr, "Only one capture can be replayed at a time.\n");
+                return false;
+            }
+
+            options.CaptureFile = argv[i];
+            continue;
+        }
+
+        if (i + 1 == argc)
+        {
+            fprintf(stderr, "Missing value of '%s'.\n", argv[i]);
+            return false;
+        }
+
+        char const* value = argv[++i];
+        if (option == "--decisions")
+        {
+            options.DecisionsFile = value;
+        }
+        else if (option == "--baseline")
+        {
+            options.BaselineFile = value;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'.\n", argv[i - 1]);
+            return false;
+        }
+    }
+
+    if (options.CaptureFile == nullptr)
+    {
+        fprintf(stderr, "Expected a capture to replay.\n");
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    ReplayOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        return ERROR_INVALID_COMMAND;
+    }
+
+    // Everything allocated with new goes to the private heap of the detours (see buildXL_mem.h), so it comes first.
+    g_hPrivateHeap = HeapCreate(0, 40960, 0);
+    if (g_hPrivateHeap == nullptr)
+    {
+        return ERROR_SETUP_FAILED;
+    }
+
+    g_currentProcessId = GetCurrentProcessId();
+    g_invariantLocale = _wcreate_locale(LC_CTYPE, L"");
+    g_pManifestTranslatePathTuples = new vector<TranslatePathTuple*>();
+
+    std::vector<BYTE> capture;
+    std::vector<BYTE>* manifest = new std::vector<BYTE>();
+    std::vector<CapturedOperation> operations;
+    if (!ReadFileBytes(options.CaptureFile, capture)
+        || !ParseCapture(capture, *manifest, operations)
+        || !ParseFileAccessManifestPolicies(manifest->data(), (DWORD)manifest->size()))
+    {
+        fprintf(stderr, "'%s' is not a capture of policy inputs.\n", options.CaptureFile);
+        return ERROR_SETUP_FAILED;
+    }
+
+    // Nothing is reported, and the caches shared with the other processes of the pip do not exist here.
+    g_fileAccessManifestExtraFlags = (FileAccessManifestExtraFlag)((DWORD)g_fileAccessManifestExtraFlags
+        & ~((DWORD)FileAccessManifestExtraFlag::ShareReportCacheAcrossProcesses | (DWORD)FileAccessManifestExtraFlag::CapturePolicyInputs));
+
+    wprintf(
+        L"{\"capture\":\"%S\",\"pipId\":\"%016llX\",\"manifestBytes\":%llu,\"operations\":%llu}\n",
+        options.CaptureFile,
+        (unsigned long long)g_FileAccessManifestPipId,
+        (unsigned long long)manifest->size(),
+        (unsigned long long)operations.size());
+
+    if (operations.empty())
+    {
+        return 0;
+    }
+
+    RunBenchmark(L"PolicyCaptureReplay/Policy", operations.size(), [&](size_t i)
+    {
+        PolicyResult policy;
+        if (!policy.Initialize(operations[i].Path.c_str()))
+        {
+            return (size_t)0;
+        }
+
+        return (size_t)policy.GetPolicy() + (size_t)CheckAccess(policy, operations[i]).ResultAction;
+    });
+
+    std::vector<Decision> decisions;
+    decisions.reserve(operations.size());
+
+    int64_t start = QueryPerformanceTicks();
+    for (CapturedOperation const& operation : operations)
+    {
+        decisions.push_back(Decide(operation));
+    }
+
+    std::vector<double> nanosecondsPerOperation = { TicksToNanoseconds(QueryPerformanceTicks() - start) / (double)operations.size() };
+    ReportBenchmarkResult(L"PolicyCaptureReplay/Decisions", operations.size(), nanosecondsPerOperation);
+
+    if (options.DecisionsFile != nullptr && !WriteDecisions(options.DecisionsFile, operations, decisions))
+    {
+        return ERROR_SETUP_FAILED;
+    }
+
+    if (options.BaselineFile != nullptr)
+    {
+        size_t differences = CompareWithBaseline(options.BaselineFile, operations, decisions);
+        wprintf(L"{\"baseline\":\"%S\",\"operations\":%llu,\"differences\":%llu}\n",
+            options.BaselineFile, (unsigned long long)operations.size(), (unsigned long long)differences);
+
+        if (differences != 0)
+        {
+            return ERROR_DECISIONS_DIFFER;
+        }
+    }
+
+    return 0;
+}
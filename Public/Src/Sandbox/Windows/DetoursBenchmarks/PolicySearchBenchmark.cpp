@@ -0,0 +1,897 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// PolicySearchBenchmark.cpp : Defines the entry point of the policy search benchmark.
+//
+// Usage: PolicySearchBenchmark [--depth D] [--fanout F] [--chain C] [--name-length N] [--lookups L]
+//                              [--manifest FILE [--paths FILE] [--anonymize]] [--guard [--max-ratio R]]
+//
+// Measures how FindFileAccessPolicyInTreeEx (and ManifestRecord::FindChild under it) scales with the shape of the
+// manifest tree, in isolation from the rest of the sandbox. It only needs the policy search sources, so it builds for
+// Windows and for the macOS user mode.
+//
+// The tree is either generated or built from the policies of a real pip:
+//   --depth, --fanout          a tree of 'fanout' children per directory, 'depth' levels below its root directory, with
+//                              a policy for each file at the bottom (default 4 and 16)
+//   --chain                    children of a directory sharing the same bucket in the hash table of their parent, i.e.,
+//                              the length of the collision chains (default 1: as the hashes fall)
+//   --name-length              length of the generated names (default 8)
+//   --manifest                 one policy per line: 'S' (scope) or 'P' (path), the policy in hexadecimal, and the path,
+//                              separated by single spaces (UTF-8; '#' starts a comment line)
+//   --paths                    the paths to look up, one per line, instead of a stream generated from the tree
+//   --anonymize                replaces each name of the manifest and of the paths by another one of the same length,
+//                              consistently, so that the files can be shared; the shape of the tree stays the same
+//   --lookups                  length of the generated stream (default 65536)
+//   --guard                    also times adversarial inputs against the generated tree (see RunGuardBenchmarks), and
+//                              fails if one of them costs more than 'max-ratio' times a typical lookup (default 8)
+//
+// The generated stream looks up declared files (a few of them much more often than the others, as pips do with
+// headers), undeclared files next to them, paths below them (the search stops at a leaf), and paths outside the tree.
+//
+// For each layout of the tree (see ManifestTreeLayout, with and without perfect hash tables), a line describes the
+// tree and the memory the lookups touch, then a result line (see Benchmark.h) gives their time. The memory is counted in
+// distinct cache lines of the tree read per lookup, by walking the tree as FindChild does: a model of the cache misses
+// of a cold lookup, comparable across machines, where the hardware counters need a profiler.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cwchar>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+#include "Benchmark.h"
+#include "PolicySearch.h"
+#include "StringOperations.h"
+#include "SyntheticManifest.h"
+
+#if !(MAC_OS_LIBRARY)
+#include "globals.h"
+#endif
+
+// ----------------------------------------------------------------------------
+// DEFINES
+// ----------------------------------------------------------------------------
+
+#define ERROR_INVALID_COMMAND   2
+#define ERROR_SETUP_FAILED      3
+#define ERROR_LAYOUT_MISMATCH   4
+#define ERROR_GUARD_EXCEEDED    5
+
+// Largest generated tree, in files.
+#define MAX_GENERATED_FILES     (1 << 20)
+
+#define CACHE_LINE_SIZE         64
+
+// Adversarial inputs of --guard: the length of the deeply nested path (MAXPATHLEN on macOS), the number of children of
+// a directory sharing one bucket, the length of a file name made of dots, and the number of lookups per sample.
+#define GUARD_PATH_LENGTH       1024
+#define GUARD_COLLIDING_NAMES   256
+#define GUARD_NAME_LENGTH       255
+#define GUARD_LOOKUPS           4096
+
+#if MAC_OS_LIBRARY
+#define PATH_LITERAL(s)         s
+#define PATH_SEPARATOR          '/'
+#else
+#define PATH_LITERAL(s)         L##s
+#define PATH_SEPARATOR          L'\\'
+#endif
+
+// ----------------------------------------------------------------------------
+// STRUCTS
+// ----------------------------------------------------------------------------
+
+struct BenchmarkOptions
+{
+    size_t Depth = 4;
+    size_t Fanout = 16;
+    size_t Chain = 1;
+    size_t NameLength = 8;
+    size_t Lookups = 65536;
+    char const* ManifestFile = nullptr;
+    char const* PathsFile = nullptr;
+    bool Anonymize = false;
+    bool Guard = false;
+    size_t MaxRatio = 8;
+};
+
+struct LayoutDefinition
+{
+    wchar_t const* Name;
+    ManifestTreeLayout Layout;
+    bool PerfectHash;
+};
+
+// An adversarial input of --guard, and the paths that look it up.
+struct AdversarialInput
+{
+    wchar_t const* Name;
+    std::vector<PathString> LookupPaths;
+};
+
+// Replaces names by others of the same length, the same way for every occurrence (see --anonymize).
+class Anonymizer
+{
+public:
+    PathString AnonymizePath(PathString const& path);
+
+private:
+    PathString AnonymizeName(PathString const& name);
+
+    std::unordered_map<PathString, PathString> m_names;
+    std::unordered_map<size_t, size_t> m_nextByLength;
+};
+
+// ----------------------------------------------------------------------------
+// HELPERS
+// ----------------------------------------------------------------------------
+
+static uint32_t s_randomState = 0x2545F491;
+
+/// Deterministic pseudo-random numbers, so that every run looks up the same paths.
+static uint32_t NextRandom()
+{
+    s_randomState = s_randomState * 1664525 + 1013904223;
+    return s_randomState >> 8;
+}
+
+static PathString ToPathString(std::string const& utf8)
+{
+#if MAC_OS_LIBRARY
+    return utf8;
+#else
+    if (utf8.empty())
+    {
+        return PathString();
+    }
+
+    int length = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.length(), nullptr, 0);
+    PathString result(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.length(), &result[0], length);
+    return result;
+#endif
+}
+
+/// Base 36 digits of n, padded with leading '0's to 'length' characters (or longer if it takes more digits).
+static PathString FormatName(PathChar first, size_t n, size_t length)
+{
+    PathString digits;
+    do
+    {
+        size_t digit = n % 36;
+        digits.insert(digits.begin(), (PathChar)(digit < 10 ? '0' + digit : 'a' + digit - 10));
+        n /= 36;
+    } while (n > 0);
+
+    PathString name(1, first);
+    if (digits.length() + 1 < length)
+    {
+        name.append(length - digits.length() - 1, (PathChar)'0');
+    }
+
+    return name + digits;
+}
+
+PathString Anonymizer::AnonymizeName(PathString const& name)
+{
+    // Drives (C:) and the like stay, as they are not worth hiding and the paths need them.
+    if (name.empty() || name.back() == ':')
+    {
+        return name;
+    }
+
+    PathString key;
+    for (PathChar c : name)
+    {
+        key.push_back(NormalizePathChar(c));
+    }
+
+    auto existing = m_names.find(key);
+    if (existing != m_names.end())
+    {
+        return existing->second;
+    }
+
+    PathString replacement = FormatName('n', m_nextByLength[name.length()]++, name.length());
+    m_names.emplace(key, replacement);
+    return replacement;
+}
+
+PathString Anonymizer::AnonymizePath(PathString const& path)
+{
+    PathString result;
+    size_t start = 0;
+    while (start <= path.length())
+    {
+        size_t end = start;
+        while (end < path.length() && !IsDirectorySeparator(path[end]))
+        {
+            end++;
+        }
+
+        result += AnonymizeName(path.substr(start, end - start));
+        if (end < path.length())
+        {
+            result.push_back(path[end]);
+        }
+
+        start = end + 1;
+    }
+
+    return result;
+}
+
+/// Reads the non-empty lines of a UTF-8 file, without the ones starting with '#'.
+static bool ReadLines(char const* file, std::vector<std::string>& lines)
+{
+    std::ifstream stream(file, std::ios::binary);
+    if (!stream)
+    {
+        fprintf(stderr, "Cannot open '%s'.\n", file);
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        if (!line.empty() && line[0] != '#')
+        {
+            lines.push_back(line);
+        }
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// SETUP
+// ----------------------------------------------------------------------------
+
+/// The names of the children of a generated directory. With chains longer than 1, the names are picked so that groups
+/// of 'chain' of them land in the same bucket of a regular hash table of their parent (see SyntheticManifest).
+static std::vector<PathString> GenerateNames(BenchmarkOptions const& options)
+{
+    std::vector<PathString> names;
+    if (options.Chain <= 1)
+    {
+        for (size_t i = 0; i < options.Fanout; i++)
+        {
+            names.push_back(FormatName('d', i, options.NameLength));
+        }
+
+        return names;
+    }
+
+    uint32_t bucketCount = (uint32_t)(options.Fanout / 0.7);
+    size_t groupCount = (options.Fanout + options.Chain - 1) / options.Chain;
+    std::unordered_map<uint32_t, size_t> groups;
+    for (size_t candidate = 0; names.size() < options.Fanout; candidate++)
+    {
+        PathString name = FormatName('d', candidate, options.NameLength);
+        uint32_t bucket = HashPath(name.c_str(), name.length()) % bucketCount;
+
+        auto group = groups.find(bucket);
+        if (group == groups.end() && groups.size() < groupCount)
+        {
+            group = groups.emplace(bucket, 0).first;
+        }
+
+        if (group != groups.end() && group->second < options.Chain)
+        {
+            group->second++;
+            names.push_back(name);
+        }
+    }
+
+    return names;
+}
+
+/// Adds the policies of the generated tree. Returns the declared files.
+static bool GenerateManifest(BenchmarkOptions const& options, SyntheticManifest& manifest, std::vector<PathString>& declaredFiles)
+{
+    double fileCount = 1;
+    for (size_t i = 0; i < options.Depth; i++)
+    {
+        fileCount *= (double)options.Fanout;
+    }
+
+    if (options.Depth == 0 || options.Fanout == 0 || fileCount > MAX_GENERATED_FILES)
+    {
+        fprintf(stderr, "The tree must have between 1 and %d files.\n", MAX_GENERATED_FILES);
+        return false;
+    }
+
+    FileAccessPolicy const readPolicy = (FileAccessPolicy)(FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent);
+    FileAccessPolicy const reportedReadPolicy = (FileAccessPolicy)(readPolicy | FileAccessPolicy_ReportAccess);
+    FileAccessPolicy const writePolicy = (FileAccessPolicy)(FileAccessPolicy_AllowAll | FileAccessPolicy_ReportAccess);
+
+    std::vector<PathString> names = GenerateNames(options);
+    std::vector<PathString> level;
+#if MAC_OS_LIBRARY
+    level.push_back(PATH_LITERAL("/Users/builder/src"));
+#else
+    level.push_back(PATH_LITERAL("D:\\src"));
+#endif
+    manifest.AddScope(level[0], readPolicy);
+
+    for (size_t depth = 1; depth <= options.Depth; depth++)
+    {
+        std::vector<PathString> next;
+        next.reserve(level.size() * names.size());
+        for (PathString const& parent : level)
+        {
+            for (size_t i = 0; i < names.size(); i++)
+            {
+                PathString path = parent + PATH_SEPARATOR + names[i];
+                if (depth == options.Depth)
+                {
+                    manifest.AddPath(path, reportedReadPolicy);
+                }
+                else if (depth == 1 && i % 4 == 3)
+                {
+                    // Some of the top directories are outputs.
+                    manifest.AddScope(path, writePolicy);
+                }
+
+                next.push_back(path);
+            }
+        }
+
+        level.swap(next);
+    }
+
+    declaredFiles.swap(level);
+    return true;
+}
+
+/// Adds the policies of a --manifest file. Returns the declared paths.
+static bool LoadManifest(BenchmarkOptions const& options, Anonymizer& anonymizer, SyntheticManifest& manifest, std::vector<PathString>& declaredPaths)
+{
+    std::vector<std::string> lines;
+    if (!ReadLines(options.ManifestFile, lines))
+    {
+        return false;
+    }
+
+    for (std::string const& line : lines)
+    {
+        size_t policyEnd = line.find(' ', 2);
+        if (line.length() < 5 || (line[0] != 'S' && line[0] != 'P') || line[1] != ' ' || policyEnd == std::string::npos)
+        {
+            fprintf(stderr, "Malformed policy line '%s'.\n", line.c_str());
+            return false;
+        }
+
+        FileAccessPolicy policy = (FileAccessPolicy)strtoul(line.substr(2, policyEnd - 2).c_str(), nullptr, 16);
+        PathString path = ToPathString(line.substr(policyEnd + 1));
+        if (options.Anonymize)
+        {
+            path = anonymizer.AnonymizePath(path);
+        }
+
+        if (line[0] == 'S')
+        {
+            manifest.AddScope(path, policy);
+        }
+        else
+        {
+            manifest.AddPath(path, policy);
+        }
+
+        declaredPaths.push_back(path);
+    }
+
+    return !declaredPaths.empty();
+}
+
+/// Generates the stream of paths to look up from the declared paths of the tree.
+static void GenerateLookupPaths(BenchmarkOptions const& options, std::vector<PathString> const& declaredPaths, std::vector<PathString>& lookupPaths)
+{
+    for (size_t i = 0; i < options.Lookups; i++)
+    {
+        // Skewed towards the first paths: u^3 puts half of the lookups on the first eighth of them.
+        double u = (double)NextRandom() / (double)(1 << 24);
+        PathString path = declaredPaths[(size_t)(u * u * u * (double)declaredPaths.size())];
+
+        switch (NextRandom() % 10)
+        {
+        case 6:
+        case 7:
+            // An undeclared file next to a declared one, e.g., a probe for a header.
+            path = path.substr(0, path.find_last_of(PATH_SEPARATOR) + 1) + PATH_LITERAL("Undeclared") + FormatName('u', NextRandom() % 64, 2);
+            break;
+        case 8:
+            // Below a declared path: the search ends at a leaf.
+            path = path + PATH_SEPARATOR + PATH_LITERAL("obj") + PATH_SEPARATOR + PATH_LITERAL("Output.tmp");
+            break;
+        case 9:
+            // Outside of the tree.
+#if MAC_OS_LIBRARY
+            path = PATH_LITERAL("/usr/lib/lib") + FormatName('s', NextRandom() % 256, 4) + PATH_LITERAL(".dylib");
+#else
+            path = PATH_LITERAL("C:\\Windows\\System32\\") + FormatName('s', NextRandom() % 256, 4) + PATH_LITERAL(".dll");
+#endif
+            break;
+        default:
+            break;
+        }
+
+        lookupPaths.push_back(path);
+    }
+}
+
+static bool LoadLookupPaths(BenchmarkOptions const& options, Anonymizer& anonymizer, std::vector<PathString>& lookupPaths)
+{
+    std::vector<std::string> lines;
+    if (!ReadLines(options.PathsFile, lines))
+    {
+        return false;
+    }
+
+    for (std::string const& line : lines)
+    {
+        PathString path = ToPathString(line);
+        lookupPaths.push_back(options.Anonymize ? anonymizer.AnonymizePath(path) : path);
+    }
+
+    return !lookupPaths.empty();
+}
+
+// ----------------------------------------------------------------------------
+// CACHE LINE MODEL
+// ----------------------------------------------------------------------------
+
+/// Adds the cache lines that [address, address + size) spans, counted from the root of the tree, to 'lines'.
+static void TouchBytes(PCManifestRecord root, void const* address, size_t size, std::vector<size_t>& lines)
+{
+    size_t start = reinterpret_cast<BYTE const*>(address) - reinterpret_cast<BYTE const*>(root);
+    for (size_t line = start / CACHE_LINE_SIZE; line <= (start + size - 1) / CACHE_LINE_SIZE; line++)
+    {
+        if (std::find(lines.begin(), lines.end(), line) == lines.end())
+        {
+            lines.push_back(line);
+        }
+    }
+}
+
+static void TouchRecordHeader(PCManifestRecord root, PCManifestRecord record, std::vector<size_t>& lines)
+{
+    TouchBytes(root, record, reinterpret_cast<BYTE const*>(&record->Buckets[0]) - reinterpret_cast<BYTE const*>(record), lines);
+}
+
+/// Reads the bucket of a record the way IsChildInBucket does. Returns the child if it has the given partial path.
+static PCManifestRecord ProbeBucket(
+    PCManifestRecord root,
+    PCManifestRecord record,
+    ManifestRecord::BucketCountType index,
+    DWORD hash,
+    PCPathChar target,
+    size_t targetLength,
+    std::vector<size_t>& lines,
+    size_t& recordsRead)
+{
+    TouchBytes(root, &record->Buckets[index * record->GetBucketStride()], record->GetBucketStride() * sizeof(ManifestRecord::ChildOffsetType), lines);
+    if (record->GetChildOffset(index) == 0 || (record->HasInlineChildHashes() && record->GetInlineChildHash(index) != hash))
+    {
+        return nullptr;
+    }
+
+    PCManifestRecord child = record->GetChildRecord(index);
+    TouchRecordHeader(root, child, lines);
+    recordsRead++;
+    if (child->Hash != hash)
+    {
+        return nullptr;
+    }
+
+    TouchBytes(root, child->GetPartialPath(), (targetLength + 1) * sizeof(PathChar), lines);
+    return ArePathsEqual(target, child->GetPartialPath(), targetLength) ? child : nullptr;
+}
+
+/// Walks the tree for a path as FindFileAccessPolicyInTreeEx and ManifestRecord::FindChild do, collecting the cache lines
+/// they read. Keep in sync with PolicySearch.cpp.
+static void CollectTouchedCacheLines(PCManifestRecord root, PathString const& path, std::vector<size_t>& lines, size_t& recordsRead)
+{
+    PCManifestRecord record = root;
+    size_t position = 0;
+    for (;;)
+    {
+        TouchRecordHeader(root, record, lines);
+        ManifestRecord::BucketCountType bucketCount = record->GetBucketCount();
+
+        while (position < path.length() && IsDirectorySeparator(path[position]))
+        {
+            position++;
+        }
+
+        size_t end = position;
+        while (end < path.length() && !IsDirectorySeparator(path[end]))
+        {
+            end++;
+        }
+
+        if (bucketCount == 0 || end == position)
+        {
+            return;
+        }
+
+        PCPathChar component = path.c_str() + position;
+        size_t length = end - position;
+        DWORD hash = HashPath(component, length);
+
+        PCManifestRecord child = nullptr;
+        if (record->HasPerfectHash())
+        {
+            ManifestRecord::BucketCountType seeds = bucketCount * record->GetBucketStride();
+            TouchBytes(root, &record->Buckets[seeds + hash % record->GetPerfectHashSeedCount()], sizeof(ManifestRecord::ChildOffsetType), lines);
+            child = ProbeBucket(root, record, record->GetPerfectHashBucket(hash), hash, component, length, lines, recordsRead);
+        }
+        else
+        {
+            ManifestRecord::BucketCountType index = hash % bucketCount;
+            child = ProbeBucket(root, record, index, hash, component, length, lines, recordsRead);
+            if (child == nullptr && record->GetChildOffset(index) != 0 && record->IsCollisionChainStart(index))
+            {
+                ManifestRecord::BucketCountType probes = 1;
+                do
+                {
+                    index = (index + 1) % bucketCount;
+                    child = ProbeBucket(root, record, index, hash, component, length, lines, recordsRead);
+                    probes++;
+                } while (child == nullptr && probes < bucketCount && record->IsCollisionChainContinuation(index));
+            }
+        }
+
+        if (child == nullptr)
+        {
+            return;
+        }
+
+        record = child;
+        position = end;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// BENCHMARKS
+// ----------------------------------------------------------------------------
+
+// All layouts have to resolve a path to the same record, or the layout that was serialized wrongly would look fast.
+static bool RunLayoutBenchmark(
+    LayoutDefinition const& layout,
+    wchar_t const* manifestName,
+    SyntheticManifest& manifest,
+    std::vector<PathString> const& lookupPaths,
+    std::vector<DWORD>& expectedPathIds)
+{
+    PCManifestRecord root = manifest.Serialize(layout.Layout, layout.PerfectHash);
+
+    bool firstLayout = expectedPathIds.empty();
+    for (size_t i = 0; i < lookupPaths.size(); i++)
+    {
+        PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(PolicySearchCursor(root), lookupPaths[i].c_str(), lookupPaths[i].length());
+        DWORD pathId = cursor.Record->GetPathId();
+        if (firstLayout)
+        {
+            expectedPathIds.push_back(pathId);
+        }
+        else if (expectedPathIds[i] != pathId)
+        {
+            fwprintf(stderr, L"Layout %ls resolves lookup path %llu to path id %lu instead of %lu.\n",
+                layout.Name, (unsigned long long)i, (unsigned long)pathId, (unsigned long)expectedPathIds[i]);
+            return false;
+        }
+    }
+
+    size_t cacheLines = 0;
+    size_t recordsRead = 0;
+    std::vector<size_t> lines;
+    for (PathString const& path : lookupPaths)
+    {
+        lines.clear();
+        CollectTouchedCacheLines(root, path, lines, recordsRead);
+        cacheLines += lines.size();
+    }
+
+    wprintf(
+        L"{\"manifest\":\"%ls\",\"layout\":\"%ls\",\"records\":%llu,\"perfectHashRecords\":%llu,\"bytes\":%llu,\"lookupPaths\":%llu,\"cacheLinesPerLookup\":%.2f,\"recordsReadPerLookup\":%.2f}\n",
+        manifestName,
+        layout.Name,
+        (unsigned long long)manifest.GetRecordCount(),
+        (unsigned long long)manifest.GetPerfectHashRecordCount(),
+        (unsigned long long)manifest.GetSize(),
+        (unsigned long long)lookupPaths.size(),
+        (double)cacheLines / (double)lookupPaths.size(),
+        (double)recordsRead / (double)lookupPaths.size());
+
+    std::wstring name = std::wstring(L"FindFileAccessPolicyInTreeEx/") + layout.Name;
+    RunBenchmark(name.c_str(), lookupPaths.size(), [&](size_t i)
+    {
+        PathString const& path = lookupPaths[i];
+        PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(PolicySearchCursor(root), path.c_str(), path.length());
+        return (size_t)cursor.Record->GetPathId();
+    });
+
+    return true;
+}
+
+static LayoutDefinition const s_layouts[] = {
+    { L"Plain", ManifestTreeLayout::Plain, false },
+    { L"Plain+PerfectHash", ManifestTreeLayout::Plain, true },
+    { L"Aligned", ManifestTreeLayout::Aligned, false },
+    { L"Aligned+PerfectHash", ManifestTreeLayout::Aligned, true },
+};
+
+// ----------------------------------------------------------------------------
+// GUARD
+// ----------------------------------------------------------------------------
+
+/// Adds inputs crafted to make the policy search slow to a generated tree: a path nested as deeply as a path can be,
+/// a directory whose children all land in the same bucket of its hash table, and a file name made of dots (the suffix
+/// policies are looked up by the dots of the name, but SyntheticManifest has no suffix table, so this one only times
+/// the search of the tree).
+static void AddAdversarialInputs(SyntheticManifest& manifest, std::vector<AdversarialInput>& inputs)
+{
+    FileAccessPolicy const readPolicy = (FileAccessPolicy)(FileAccessPolicy_AllowRead | FileAccessPolicy_ReportAccess);
+#if MAC_OS_LIBRARY
+    PathString const base = PATH_LITERAL("/Users/builder/src/adversarial");
+#else
+    PathString const base = PATH_LITERAL("D:\\src\\adversarial");
+#endif
+
+    AdversarialInput deep = { L"DeepNesting", {} };
+    PathString deepPath = base;
+    while (deepPath.length() + 2 < GUARD_PATH_LENGTH)
+    {
+        deepPath = deepPath + PATH_SEPARATOR + PATH_LITERAL("a");
+    }
+
+    manifest.AddPath(deepPath, readPolicy);
+    deep.LookupPaths.push_back(deepPath);
+    deep.LookupPaths.push_back(deepPath.substr(0, deepPath.length() - 1) + PATH_LITERAL("b"));
+
+    AdversarialInput colliding = { L"CollidingNames", {} };
+    BenchmarkOptions collidingOptions;
+    collidingOptions.Fanout = GUARD_COLLIDING_NAMES;
+    collidingOptions.Chain = GUARD_COLLIDING_NAMES;
+    for (PathString const& name : GenerateNames(collidingOptions))
+    {
+        PathString path = base + PATH_SEPARATOR + PATH_LITERAL("colliding") + PATH_SEPARATOR + name;
+        manifest.AddPath(path, readPolicy);
+        colliding.LookupPaths.push_back(path);
+    }
+
+    AdversarialInput dots = { L"ManyDots", {} };
+    PathString dotsPath = base + PATH_SEPARATOR + PATH_LITERAL("dots") + PATH_SEPARATOR;
+    for (size_t i = 0; i < GUARD_NAME_LENGTH; i++)
+    {
+        dotsPath.push_back(i % 2 == 0 ? 'a' : '.');
+    }
+
+    manifest.AddPath(dotsPath, readPolicy);
+    dots.LookupPaths.push_back(dotsPath);
+
+    inputs.push_back(deep);
+    inputs.push_back(colliding);
+    inputs.push_back(dots);
+}
+
+/// Times the lookups of the given paths, cycling through them. Returns the median nanoseconds per character looked up,
+/// which is what a lookup costs in proportion to its path when nothing in the tree is adversarial.
+static double TimeLookupsPerCharacter(std::wstring const& name, PCManifestRecord root, std::vector<PathString> const& paths)
+{
+    size_t characters = 0;
+    for (size_t i = 0; i < GUARD_LOOKUPS; i++)
+    {
+        characters += paths[i % paths.size()].length();
+    }
+
+    double nanosecondsPerLookup = RunBenchmark(name.c_str(), GUARD_LOOKUPS, [&](size_t i)
+    {
+        PathString const& path = paths[i % paths.size()];
+        PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(PolicySearchCursor(root), path.c_str(), path.length());
+        return (size_t)cursor.Record->GetPathId();
+    });
+
+    return nanosecondsPerLookup * GUARD_LOOKUPS / (double)characters;
+}
+
+/// Times each adversarial input against the typical lookups of the generated tree, per character looked up, and prints
+/// the ratios. Only the layouts with perfect hash tables are held to --max-ratio, as FileAccessManifest.cs always builds
+/// them where the collision chains get long; the others show what the fallback saves.
+static bool RunGuardBenchmarks(BenchmarkOptions const& options, std::vector<PathString> const& typicalPaths)
+{
+    SyntheticManifest* manifest = new SyntheticManifest();
+    std::vector<PathString> declaredPaths;
+    std::vector<AdversarialInput> inputs;
+    if (!GenerateManifest(options, *manifest, declaredPaths))
+    {
+        delete manifest;
+        return false;
+    }
+
+    AddAdversarialInputs(*manifest, inputs);
+
+    bool withinBounds = true;
+    for (LayoutDefinition const& layout : s_layouts)
+    {
+        PCManifestRecord root = manifest->Serialize(layout.Layout, layout.PerfectHash);
+        double typical = TimeLookupsPerCharacter(std::wstring(L"Guard/Typical/") + layout.Name, root, typicalPaths);
+
+        for (AdversarialInput const& input : inputs)
+        {
+            double adversarial = TimeLookupsPerCharacter(std::wstring(L"Guard/") + input.Name + L"/" + layout.Name, root, input.LookupPaths);
+            double ratio = typical > 0 ? adversarial / typical : 0;
+            bool exceeded = layout.PerfectHash && ratio > (double)options.MaxRatio;
+
+            wprintf(
+                L"{\"guard\":\"%ls\",\"layout\":\"%ls\",\"nsPerCharacter\":%.3f,\"typicalNsPerCharacter\":%.3f,\"ratio\":%.2f,\"maxRatio\":%llu,\"exceeded\":%ls}\n",
+                input.Name,
+                layout.Name,
+                adversarial,
+                typical,
+                ratio,
+                (unsigned long long)options.MaxRatio,
+                exceeded ? L"true" : L"false");
+
+            if (exceeded)
+            {
+                fwprintf(stderr, L"Input %ls costs %.2f times a typical lookup with layout %ls.\n", input.Name, ratio, layout.Name);
+                withinBounds = false;
+            }
+        }
+    }
+
+    delete manifest;
+    return withinBounds;
+}
+
+// ----------------------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------------------
+
+static bool ParseOptions(int argc, char **argv, BenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--anonymize")
+        {
+            options.Anonymize = true;
+            continue;
+        }
+
+        if (option == "--guard")
+        {
+            options.Guard = true;
+            continue;
+        }
+
+        if (i + 1 == argc)
+        {
+            fprintf(stderr, "Missing value of '%s'.\n", argv[i]);
+            return false;
+        }
+
+        char const* value = argv[++i];
+        size_t* number =
+            option == "--depth" ? &options.Depth :
+            option == "--fanout" ? &options.Fanout :
+            option == "--chain" ? &options.Chain :
+            option == "--name-length" ? &options.NameLength :
+            option == "--lookups" ? &options.Lookups :
+            option == "--max-ratio" ? &options.MaxRatio :
+            nullptr;
+
+        if (number != nullptr)
+        {
+            *number = (size_t)strtoull(value, nullptr, 10);
+        }
+        else if (option == "--manifest")
+        {
+            options.ManifestFile = value;
+        }
+        else if (option == "--paths")
+        {
+            options.PathsFile = value;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'.\n", argv[i - 1]);
+            return false;
+        }
+    }
+
+    if (options.Lookups == 0 || (options.PathsFile != nullptr && options.ManifestFile == nullptr))
+    {
+        fprintf(stderr, "Expected a number of lookups, and --paths only along with --manifest.\n");
+        return false;
+    }
+
+    if (options.Guard && (options.ManifestFile != nullptr || options.MaxRatio == 0))
+    {
+        fprintf(stderr, "Expected a generated tree and a positive ratio along with --guard.\n");
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    BenchmarkOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        return ERROR_INVALID_COMMAND;
+    }
+
+#if !(MAC_OS_LIBRARY)
+    // Everything allocated with new goes to the private heap of the detours (see buildXL_mem.h), so it comes first.
+    g_hPrivateHeap = HeapCreate(0, 40960, 0);
+    if (g_hPrivateHeap == nullptr)
+    {
+        return ERROR_SETUP_FAILED;
+    }
+
+    g_invariantLocale = _wcreate_locale(LC_CTYPE, L"");
+#endif
+
+    SyntheticManifest* manifest = new SyntheticManifest();
+    Anonymizer anonymizer;
+    std::vector<PathString> declaredPaths;
+    std::vector<PathString> lookupPaths;
+
+    bool loaded = options.ManifestFile != nullptr
+        ? LoadManifest(options, anonymizer, *manifest, declaredPaths)
+        : GenerateManifest(options, *manifest, declaredPaths);
+
+    if (loaded && options.PathsFile != nullptr)
+    {
+        loaded = LoadLookupPaths(options, anonymizer, lookupPaths);
+    }
+    else if (loaded)
+    {
+        GenerateLookupPaths(options, declaredPaths, lookupPaths);
+    }
+
+    if (!loaded)
+    {
+        fprintf(stderr, "Failed to set up the benchmark.\n");
+        return ERROR_SETUP_FAILED;
+    }
+
+    wchar_t manifestName[128];
+    if (options.ManifestFile != nullptr)
+    {
+        swprintf(manifestName, 128, L"File");
+    }
+    else
+    {
+        swprintf(manifestName, 128, L"Generated/%llu/%llu/%llu",
+            (unsigned long long)options.Depth, (unsigned long long)options.Fanout, (unsigned long long)options.Chain);
+    }
+
+    std::vector<DWORD> expectedPathIds;
+    for (LayoutDefinition const& layout : s_layouts)
+    {
+        if (!RunLayoutBenchmark(layout, manifestName, *manifest, lookupPaths, expectedPathIds))
+        {
+            return ERROR_LAYOUT_MISMATCH;
+        }
+    }
+
+    if (options.Guard && !RunGuardBenchmarks(options, lookupPaths))
+    {
+        return ERROR_GUARD_EXCEEDED;
+    }
+
+    return 0;
+}
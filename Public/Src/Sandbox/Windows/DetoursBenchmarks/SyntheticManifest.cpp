@@ -0,0 +1,442 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+#include "SyntheticManifest.h"
+#include "StringOperations.h"
+
+// ----------------------------------------------------------------------------
+// DEFINES
+// ----------------------------------------------------------------------------
+
+// Tag written in front of each record of a debug manifest, see GENERATE_TAG.
+#define MANIFEST_RECORD_TAG 0xF00DCAFE
+
+// Same settings as FileAccessManifest.Node. Keep in sync with FileAccessManifest.cs.
+#define PERFECT_HASH_CHILD_THRESHOLD            128
+#define PERFECT_HASH_SEED_ATTEMPTS_PER_CHILD    16
+#define ALIGNED_RECORD_BOUNDARY                 64
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+static DWORD NormalizeName(PathString const& name, PathString& normalized)
+{
+    std::vector<PathChar> buffer(name.length() + 1, (PathChar)0);
+    DWORD hash = NormalizeAndHashPath(name.c_str(), reinterpret_cast<PBYTE>(buffer.data()), (DWORD)(buffer.size() * sizeof(PathChar)));
+    normalized.assign(buffer.data(), name.length());
+    return hash;
+}
+
+/// The bucket of a child in a perfect hash table, given the seed of its group. Keep in sync with ManifestRecord::GetPerfectHashBucket.
+static uint32_t GetPerfectHashBucket(uint32_t hash, uint32_t seed, uint32_t bucketCount)
+{
+    uint32_t mixed = (hash ^ seed) * 0x85EBCA6Bu;
+    mixed ^= mixed >> 13;
+    return mixed % bucketCount;
+}
+
+/// Most buckets FindChild probes for a child of a node in its regular table. Mirrors FileAccessManifest.Node.GetLongestCollisionChain.
+template <typename Children>
+static uint32_t GetLongestCollisionChain(Children const& children)
+{
+    uint32_t bucketCount = (uint32_t)(children.size() / 0.7);
+    std::vector<uint32_t> flags(bucketCount, 0);
+    std::vector<bool> occupied(bucketCount, false);
+    for (auto const& child : children)
+    {
+        uint32_t index = child->Hash % bucketCount;
+        if (occupied[index])
+        {
+            flags[index] |= FileAccessBucketOffsetFlag::ChainStart;
+            index = (index + 1) % bucketCount;
+            while (occupied[index])
+            {
+                flags[index] |= FileAccessBucketOffsetFlag::ChainContinuation;
+                index = (index + 1) % bucketCount;
+            }
+        }
+
+        occupied[index] = true;
+    }
+
+    uint32_t longest = 1;
+    for (uint32_t i = 0; i < bucketCount; i++)
+    {
+        if ((flags[i] & FileAccessBucketOffsetFlag::ChainStart) == 0)
+        {
+            continue;
+        }
+
+        uint32_t probes = 2;
+        for (uint32_t next = (i + 1) % bucketCount; probes < bucketCount && (flags[next] & FileAccessBucketOffsetFlag::ChainContinuation) != 0; next = (next + 1) % bucketCount)
+        {
+            probes++;
+        }
+
+        if (probes > longest)
+        {
+            longest = probes;
+        }
+    }
+
+    return longest;
+}
+
+SyntheticManifest::SyntheticManifest()
+    : m_nextPathId(1), m_recordCount(0), m_perfectHashRecordCount(0)
+{
+    m_root.Hash = 0;
+    m_root.PathId = 0;
+    m_root.HasConePolicy = false;
+    m_root.HasNodePolicy = false;
+    m_root.ConePolicy = (FileAccessPolicy)0;
+    m_root.NodePolicy = (FileAccessPolicy)0;
+}
+
+void SyntheticManifest::AddScope(PathString const& path, FileAccessPolicy policy)
+{
+    Node* node = GetOrAddNode(path);
+    node->HasConePolicy = true;
+    node->ConePolicy = policy;
+}
+
+void SyntheticManifest::AddPath(PathString const& path, FileAccessPolicy policy)
+{
+    Node* node = GetOrAddNode(path);
+    node->HasNodePolicy = true;
+    node->NodePolicy = policy;
+}
+
+SyntheticManifest::Node* SyntheticManifest::GetOrAddNode(PathString const& path)
+{
+    Node* node = &m_root;
+    size_t start = 0;
+    while (start < path.length())
+    {
+        size_t end = start;
+        while (end < path.length() && !IsDirectorySeparator(path[end]))
+        {
+            end++;
+        }
+
+        if (end > start)
+        {
+            PathString name = path.substr(start, end - start);
+            PathString normalized;
+            DWORD hash = NormalizeName(name, normalized);
+
+            auto existing = node->ChildrenByName.find(normalized);
+            Node* child;
+            if (existing != node->ChildrenByName.end())
+            {
+                child = existing->second;
+            }
+            else
+            {
+                std::unique_ptr<Node> added(new Node());
+                added->Name = name;
+                added->NormalizedName = normalized;
+                added->Hash = hash;
+                added->PathId = m_nextPathId++;
+                added->HasConePolicy = false;
+                added->HasNodePolicy = false;
+                added->ConePolicy = (FileAccessPolicy)0;
+                added->NodePolicy = (FileAccessPolicy)0;
+                child = added.get();
+                node->ChildrenByName.emplace(normalized, child);
+                node->Children.push_back(std::move(added));
+            }
+
+            node = child;
+        }
+
+        start = end + 1;
+    }
+
+    return node;
+}
+
+PCManifestRecord SyntheticManifest::Serialize(ManifestTreeLayout layout, bool perfectHash)
+{
+    m_tree.clear();
+    m_recordCount = 0;
+    m_perfectHashRecordCount = 0;
+
+    if (layout == ManifestTreeLayout::Aligned)
+    {
+        SerializeAligned(perfectHash);
+    }
+    else
+    {
+        SerializeNode(m_root, (FileAccessPolicy)0, perfectHash, /*isRoot*/ true);
+    }
+
+    return reinterpret_cast<PCManifestRecord>(m_tree.data());
+}
+
+void SyntheticManifest::Append(uint32_t value)
+{
+    BYTE const* bytes = reinterpret_cast<BYTE const*>(&value);
+    m_tree.insert(m_tree.end(), bytes, bytes + sizeof(value));
+}
+
+void SyntheticManifest::Patch(size_t position, uint32_t value)
+{
+    assert(position + sizeof(value) <= m_tree.size());
+    memcpy(m_tree.data() + position, &value, sizeof(value));
+}
+
+/// <summary>
+/// Places the children of a node in the buckets of its hash table. Returns whether that is a perfect hash table.
+/// </summary>
+/// <remarks>
+/// Mirrors FileAccessManifest.Node.TryBuildPerfectHashTable and the linear probing of InternalSerialize, marking the
+/// collision chains the same way.
+/// </remarks>
+bool SyntheticManifest::BuildBucketTable(Node const& node, bool perfectHash, BucketTable& table) const
+{
+    uint32_t childCount = (uint32_t)node.Children.size();
+
+    if (perfectHash
+        && childCount > 0
+        && (childCount >= PERFECT_HASH_CHILD_THRESHOLD || GetLongestCollisionChain(node.Children) > ManifestRecord::MaxCollisionChainProbes))
+    {
+        uint32_t seedCount = (childCount + ManifestRecord::PerfectHashChildrenPerSeed - 1) / ManifestRecord::PerfectHashChildrenPerSeed;
+        std::vector<std::vector<Node const*>> groups(seedCount);
+        std::unordered_set<DWORD> hashes;
+        bool distinctHashes = true;
+        for (auto const& child : node.Children)
+        {
+            distinctHashes = distinctHashes && hashes.insert(child->Hash).second;
+            groups[child->Hash % seedCount].push_back(child.get());
+        }
+
+        std::vector<uint32_t> order(seedCount);
+        for (uint32_t i = 0; i < seedCount; i++)
+        {
+            order[i] = i;
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return groups[a].size() > groups[b].size(); });
+
+        table.Children.assign(childCount, nullptr);
+        table.Flags.assign(childCount, 0);
+        table.PerfectHashSeeds.assign(seedCount, 0);
+
+        uint32_t maxAttempts = PERFECT_HASH_SEED_ATTEMPTS_PER_CHILD * childCount;
+        std::vector<uint32_t> groupBuckets;
+        bool placedAll = distinctHashes;
+        for (size_t g = 0; placedAll && g < order.size() && !groups[order[g]].empty(); g++)
+        {
+            std::vector<Node const*> const& group = groups[order[g]];
+            bool placed = false;
+            for (uint32_t seed = 0; !placed && seed < maxAttempts; seed++)
+            {
+                groupBuckets.clear();
+                for (Node const* child : group)
+                {
+                    uint32_t bucket = GetPerfectHashBucket(child->Hash, seed, childCount);
+                    if (table.Children[bucket] != nullptr || std::find(groupBuckets.begin(), groupBuckets.end(), bucket) != groupBuckets.end())
+                    {
+                        break;
+                    }
+
+                    groupBuckets.push_back(bucket);
+                }
+
+                if (groupBuckets.size() == group.size())
+                {
+                    for (size_t i = 0; i < groupBuckets.size(); i++)
+                    {
+                        table.Children[groupBuckets[i]] = group[i];
+                    }
+
+                    table.PerfectHashSeeds[order[g]] = seed;
+                    placed = true;
+                }
+            }
+
+            placedAll = placed;
+        }
+
+        if (placedAll)
+        {
+            return true;
+        }
+
+        table.PerfectHashSeeds.clear();
+    }
+
+    // Same load factor as the C# serializer.
+    uint32_t bucketCount = childCount == 0 ? 0 : (uint32_t)(childCount / 0.7);
+    table.Children.assign(bucketCount, nullptr);
+    table.Flags.assign(bucketCount, 0);
+
+    for (auto const& child : node.Children)
+    {
+        uint32_t index = child->Hash % bucketCount;
+
+        if (table.Children[index] != nullptr)
+        {
+            table.Flags[index] |= FileAccessBucketOffsetFlag::ChainStart;
+            index = (index + 1) % bucketCount;
+
+            while (table.Children[index] != nullptr)
+            {
+                table.Flags[index] |= FileAccessBucketOffsetFlag::ChainContinuation;
+                index = (index + 1) % bucketCount;
+            }
+        }
+
+        table.Children[index] = child.get();
+    }
+
+    return false;
+}
+
+/// Writes a record up to and including its partial path, with empty buckets. Returns the position of the buckets.
+size_t SyntheticManifest::WriteRecordHeader(Node const& node, FileAccessPolicy conePolicy, FileAccessPolicy nodePolicy, BucketTable const& table, bool aligned, bool isRoot)
+{
+    m_recordCount++;
+
+    uint32_t bucketCount = (uint32_t)table.Children.size();
+    uint32_t bucketFlags = table.PerfectHashSeeds.empty() ? 0 : ManifestRecord::PerfectHashFlag;
+    if (aligned && bucketCount != 0)
+    {
+        bucketFlags |= ManifestRecord::InlineChildHashesFlag;
+    }
+
+    if (!table.PerfectHashSeeds.empty())
+    {
+        m_perfectHashRecordCount++;
+    }
+
+#ifdef _DEBUG
+    Append(MANIFEST_RECORD_TAG);
+#endif
+    Append(isRoot ? 0 : node.Hash);
+    Append((uint32_t)conePolicy);
+    Append((uint32_t)nodePolicy);
+    Append(node.PathId);
+    // No expected USN.
+    Append(0xFFFFFFFF);
+    Append(0xFFFFFFFF);
+    Append(bucketCount | bucketFlags);
+
+    size_t bucketsStart = m_tree.size();
+    for (uint32_t i = 0; i < bucketCount * (aligned ? 2 : 1); i++)
+    {
+        Append(0);
+    }
+
+    for (uint32_t seed : table.PerfectHashSeeds)
+    {
+        Append(seed);
+    }
+
+    if (isRoot)
+    {
+        Append(0);
+    }
+    else
+    {
+        // The partial path is stored normalized, with its terminator, padded to a 4 byte boundary.
+        size_t pathBytes = (node.NormalizedName.length() + 1) * sizeof(PathChar);
+        BYTE const* bytes = reinterpret_cast<BYTE const*>(node.NormalizedName.c_str());
+        m_tree.insert(m_tree.end(), bytes, bytes + pathBytes);
+        m_tree.insert(m_tree.end(), (4 - (pathBytes & 0x3)) & 0x3, (BYTE)0);
+    }
+
+    return bucketsStart;
+}
+
+/// <summary>
+/// Writes a record and, after it, the records of its children. Returns the offset of the record.
+/// </summary>
+/// <remarks>
+/// Mirrors FileAccessManifest.Node.InternalSerialize. Policies replace the ones inherited from above rather than being
+/// composed through masks, which is all the benchmarks need.
+/// </remarks>
+size_t SyntheticManifest::SerializeNode(Node const& node, FileAccessPolicy parentConePolicy, bool perfectHash, bool isRoot)
+{
+    size_t start = m_tree.size();
+
+    FileAccessPolicy conePolicy = node.HasConePolicy ? node.ConePolicy : parentConePolicy;
+    FileAccessPolicy nodePolicy = node.HasNodePolicy ? node.NodePolicy : conePolicy;
+
+    BucketTable table;
+    bool isPerfectHash = BuildBucketTable(node, perfectHash, table);
+    size_t bucketsStart = WriteRecordHeader(node, conePolicy, nodePolicy, table, /*aligned*/ false, isRoot);
+
+    // The children of a perfect hash table are written in the order of their buckets, the others in the order they
+    // were added.
+    std::unordered_map<Node const*, size_t> buckets;
+    for (size_t i = 0; i < table.Children.size(); i++)
+    {
+        if (table.Children[i] != nullptr)
+        {
+            buckets.emplace(table.Children[i], i);
+        }
+    }
+
+    for (size_t i = 0; i < node.Children.size(); i++)
+    {
+        Node const* child = isPerfectHash ? table.Children[i] : node.Children[i].get();
+        size_t index = buckets[child];
+        size_t childStart = SerializeNode(*child, conePolicy, perfectHash, /*isRoot*/ false);
+        assert(((childStart - start) & FileAccessBucketOffsetFlag::ChainMask) == 0);
+        Patch(bucketsStart + index * sizeof(uint32_t), (uint32_t)(childStart - start) | table.Flags[index]);
+    }
+
+    return start;
+}
+
+/// <summary>
+/// Writes the tree in the format v2, breadth-first, so that the children of each record follow each other.
+/// </summary>
+/// <remarks>
+/// Mirrors FileAccessManifest.Node.InternalSerializeAligned: a record only learns where its children are once they are
+/// written, so their buckets get patched then.
+/// </remarks>
+void SyntheticManifest::SerializeAligned(bool perfectHash)
+{
+    std::vector<PendingRecord> pending;
+    pending.push_back({ &m_root, (FileAccessPolicy)0, 0, SIZE_MAX, 0 });
+
+    for (size_t next = 0; next < pending.size(); next++)
+    {
+        PendingRecord record = pending[next];
+        Node const& node = *record.Record;
+
+        m_tree.insert(m_tree.end(), (ALIGNED_RECORD_BOUNDARY - (m_tree.size() % ALIGNED_RECORD_BOUNDARY)) % ALIGNED_RECORD_BOUNDARY, (BYTE)0);
+
+        size_t start = m_tree.size();
+        if (record.BucketPosition != SIZE_MAX)
+        {
+            Patch(record.BucketPosition, (uint32_t)(start - record.ParentStart) | record.BucketFlags);
+            Patch(record.BucketPosition + sizeof(uint32_t), node.Hash);
+        }
+
+        FileAccessPolicy conePolicy = node.HasConePolicy ? node.ConePolicy : record.ParentConePolicy;
+        FileAccessPolicy nodePolicy = node.HasNodePolicy ? node.NodePolicy : conePolicy;
+
+        BucketTable table;
+        BuildBucketTable(node, perfectHash, table);
+        size_t bucketsStart = WriteRecordHeader(node, conePolicy, nodePolicy, table, /*aligned*/ true, /*isRoot*/ next == 0);
+
+        for (size_t i = 0; i < table.Children.size(); i++)
+        {
+            if (table.Children[i] != nullptr)
+            {
+                pending.push_back({ table.Children[i], conePolicy, start, bucketsStart + i * 2 * sizeof(uint32_t), table.Flags[i] });
+            }
+        }
+    }
+}
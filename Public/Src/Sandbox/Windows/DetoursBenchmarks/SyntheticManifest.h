@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Builds manifest policy trees in the binary format FileAccessManifest.cs serializes them to, so that the policy search
+// can be benchmarked without a BuildXL process creating the manifest. Only depends on the policy search sources, so that
+// it builds for the macOS user mode as well (where paths are UTF-8 and separated by '/').
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DataTypes.h"
+
+// ----------------------------------------------------------------------------
+// TYPE DEFINITIONS
+// ----------------------------------------------------------------------------
+
+typedef std::basic_string<PathChar> PathString;
+
+// Formats of the serialized tree, see ManifestRecord in DataTypes.h.
+enum class ManifestTreeLayout
+{
+    // Records written depth-first, with bare child offsets in the buckets (FileAccessManifest.Node.InternalSerialize).
+    Plain,
+
+    // Format v2: records written breadth-first on cache line boundaries, with the hash of each child next to its offset
+    // (FileAccessManifest.Node.InternalSerializeAligned).
+    Aligned,
+};
+
+// ----------------------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------------------
+
+class SyntheticManifest
+{
+public:
+    SyntheticManifest();
+
+    /// Adds a policy for an absolute path without type prefix, e.g. C:\foo\bar (or /foo/bar on macOS).
+    /// A cone policy applies to the path and everything below it, a node policy to the path only.
+    void AddScope(PathString const& path, FileAccessPolicy policy);
+    void AddPath(PathString const& path, FileAccessPolicy policy);
+
+    /// Serializes the tree. The returned root stays valid as long as this object, and until the next call.
+    /// With 'perfectHash', the records with many children get a minimal perfect hash table, as FileAccessManifest.cs does.
+    PCManifestRecord Serialize(ManifestTreeLayout layout = ManifestTreeLayout::Plain, bool perfectHash = false);
+
+    /// Number of records in the serialized tree.
+    size_t GetRecordCount() const { return m_recordCount; }
+
+    /// Number of records of the last serialization that got a perfect hash table.
+    size_t GetPerfectHashRecordCount() const { return m_perfectHashRecordCount; }
+
+    /// Size in bytes of the serialized tree.
+    size_t GetSize() const { return m_tree.size(); }
+
+private:
+    struct Node
+    {
+        PathString Name;
+        PathString NormalizedName;
+        DWORD Hash;
+        DWORD PathId;
+        bool HasConePolicy;
+        bool HasNodePolicy;
+        FileAccessPolicy ConePolicy;
+        FileAccessPolicy NodePolicy;
+
+        // In the order they were added, which decides the collision chains of the hash table of the node.
+        std::vector<std::unique_ptr<Node>> Children;
+        std::unordered_map<PathString, Node*> ChildrenByName;
+    };
+
+    // The buckets of the hash table of a node, from which both layouts write the same table.
+    struct BucketTable
+    {
+        std::vector<Node const*> Children;
+        std::vector<uint32_t> Flags;
+        std::vector<uint32_t> PerfectHashSeeds;
+    };
+
+    // A record waiting to be written by SerializeAligned, and the bucket of its parent to point at it.
+    struct PendingRecord
+    {
+        Node const* Record;
+        FileAccessPolicy ParentConePolicy;
+        size_t ParentStart;
+        size_t BucketPosition;
+        uint32_t BucketFlags;
+    };
+
+    Node* GetOrAddNode(PathString const& path);
+    bool BuildBucketTable(Node const& node, bool perfectHash, BucketTable& table) const;
+    size_t WriteRecordHeader(Node const& node, FileAccessPolicy conePolicy, FileAccessPolicy nodePolicy, BucketTable const& table, bool aligned, bool isRoot);
+    size_t SerializeNode(Node const& node, FileAccessPolicy parentConePolicy, bool perfectHash, bool isRoot);
+    void SerializeAligned(bool perfectHash);
+    void Append(uint32_t value);
+    void Patch(size_t position, uint32_t value);
+
+    Node m_root;
+    DWORD m_nextPathId;
+    size_t m_recordCount;
+    size_t m_perfectHashRecordCount;
+    std::vector<BYTE> m_tree;
+
+    SyntheticManifest(const SyntheticManifest&) = delete;
+    SyntheticManifest& operator=(const SyntheticManifest&) = delete;
+};
@@ -0,0 +1,496 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Main.cpp : Defines the entry point of the Detours monitor.
+//
+// Usage: DetoursMonitor [--delay-ms D] [--count N] [--pip PIPID] [--processes] [--csv FILE]
+//
+// Shows the counters the detoured processes of the running pips publish while they run (see LiveCounters.h and
+// FileAccessManifest.PublishLiveCounters), the Windows counterpart of SandboxMonitor on macOS. The pips are found by
+// the names of their mappings in the object directories of the session and of the machine; no BuildXL process needs
+// to be asked.
+//   --delay-ms                 delay between samples in milliseconds (default 1000)
+//   --count                    number of samples to take (default 0: until interrupted)
+//   --pip                      only the pip with this id (hexadecimal, as printed)
+//   --processes                a line for each process of a pip, below the line of the pip
+//   --csv                      appends the samples to FILE as CSV instead of rendering them, one row per pip (and per
+//                              process with --processes), so that they can be recorded along with a build
+//
+// The line of a pip sums the cumulative counters of all its processes, including the ones that exited, and the gauges
+// (handle overlays, private heap bytes) of its running processes. Rates are per second over the last sample.
+
+#include <windows.h>
+#include <winternl.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <wchar.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "LiveCounters.h"
+
+#define ERROR_INVALID_COMMAND 1
+#define ERROR_CANNOT_WRITE_CSV 2
+
+// ----------------------------------------------------------------------------
+// OBJECT DIRECTORY ENUMERATION
+// ----------------------------------------------------------------------------
+
+#define DIRECTORY_QUERY 0x0001
+#define STATUS_MORE_ENTRIES ((NTSTATUS)0x00000105L)
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+#endif
+
+typedef struct _OBJECT_DIRECTORY_INFORMATION {
+    UNICODE_STRING Name;
+    UNICODE_STRING TypeName;
+} OBJECT_DIRECTORY_INFORMATION, *POBJECT_DIRECTORY_INFORMATION;
+
+typedef NTSTATUS(NTAPI* NtOpenDirectoryObject_t)(PHANDLE DirectoryHandle, ACCESS_MASK DesiredAccess, POBJECT_ATTRIBUTES ObjectAttributes);
+typedef NTSTATUS(NTAPI* NtQueryDirectoryObject_t)(HANDLE DirectoryHandle, PVOID Buffer, ULONG Length, BOOLEAN ReturnSingleEntry, BOOLEAN RestartScan, PULONG Context, PULONG ReturnLength);
+typedef VOID(NTAPI* RtlInitUnicodeString_t)(PUNICODE_STRING DestinationString, PCWSTR SourceString);
+
+static NtOpenDirectoryObject_t s_ntOpenDirectoryObject = nullptr;
+static NtQueryDirectoryObject_t s_ntQueryDirectoryObject = nullptr;
+static RtlInitUnicodeString_t s_rtlInitUnicodeString = nullptr;
+
+static bool LoadNtFunctions()
+{
+    HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+    if (ntdll == NULL)
+    {
+        return false;
+    }
+
+    s_ntOpenDirectoryObject = (NtOpenDirectoryObject_t)GetProcAddress(ntdll, "NtOpenDirectoryObject");
+    s_ntQueryDirectoryObject = (NtQueryDirectoryObject_t)GetProcAddress(ntdll, "NtQueryDirectoryObject");
+    s_rtlInitUnicodeString = (RtlInitUnicodeString_t)GetProcAddress(ntdll, "RtlInitUnicodeString");
+    return s_ntOpenDirectoryObject != nullptr && s_ntQueryDirectoryObject != nullptr && s_rtlInitUnicodeString != nullptr;
+}
+
+static bool EndsWith(std::wstring const& name, wchar_t const* suffix)
+{
+    size_t length = wcslen(suffix);
+    return name.length() > length && name.compare(name.length() - length, length, suffix) == 0;
+}
+
+/// Adds the names of the sections of an object directory that hold live counters, prefixed for OpenFileMappingW.
+static void FindLiveCounters(wchar_t const* directory, wchar_t const* namePrefix, std::vector<std::wstring>& names)
+{
+    UNICODE_STRING directoryName;
+    s_rtlInitUnicodeString(&directoryName, directory);
+
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(&attributes, &directoryName, 0, NULL, NULL);
+
+    HANDLE hDirectory;
+    if (!NT_SUCCESS(s_ntOpenDirectoryObject(&hDirectory, DIRECTORY_QUERY, &attributes)))
+    {
+        return;
+    }
+
+    std::vector<BYTE> buffer(64 * 1024);
+    ULONG context = 0;
+    bool restart = true;
+    while (true)
+    {
+        ULONG returned = 0;
+        NTSTATUS status = s_ntQueryDirectoryObject(hDirectory, buffer.data(), (ULONG)buffer.size(), FALSE, restart, &context, &returned);
+        restart = false;
+        if (!NT_SUCCESS(status))
+        {
+            break;
+        }
+
+        // The entries end with an empty one.
+        for (POBJECT_DIRECTORY_INFORMATION entry = (POBJECT_DIRECTORY_INFORMATION)buffer.data(); entry->Name.Buffer != nullptr; entry++)
+        {
+            std::wstring name(entry->Name.Buffer, entry->Name.Length / sizeof(wchar_t));
+            std::wstring type(entry->TypeName.Buffer, entry->TypeName.Length / sizeof(wchar_t));
+            if (type == L"Section" && EndsWith(name, LIVE_COUNTERS_NAME_SUFFIX))
+            {
+                names.push_back(namePrefix + name);
+            }
+        }
+
+        // The buffer was filled up: continue from the context.
+        if (status != STATUS_MORE_ENTRIES)
+        {
+            break;
+        }
+    }
+
+    CloseHandle(hDirectory);
+}
+
+// ----------------------------------------------------------------------------
+// SAMPLES
+// ----------------------------------------------------------------------------
+
+struct ProcessSample
+{
+    DWORD ProcessId;
+    LONG State;
+    LONG64 Counters[(int)LiveCounter::Count];
+};
+
+struct PipSample
+{
+    uint64_t PipId;
+    DWORD ConsumerProcessId;
+    LONG Processes;
+    LONG ProcessesWithoutSlot;
+    LONG RunningProcesses;
+    LONG64 Counters[(int)LiveCounter::Count];
+    std::vector<ProcessSample> ProcessSamples;
+};
+
+#define GEN_LIVE_COUNTER_CUMULATIVE(name, cumulative) cumulative,
+static bool const s_liveCounterIsCumulative[] = {
+    FOR_ALL_LIVE_COUNTERS(GEN_LIVE_COUNTER_CUMULATIVE)
+};
+#undef GEN_LIVE_COUNTER_CUMULATIVE
+
+#define GEN_LIVE_COUNTER_NAME(name, cumulative) #name,
+static char const* const s_liveCounterNames[] = {
+    FOR_ALL_LIVE_COUNTERS(GEN_LIVE_COUNTER_NAME)
+};
+#undef GEN_LIVE_COUNTER_NAME
+
+/// Reads the counters of a pip. The processes write them concurrently, so a sample is only consistent per counter.
+static bool TrySamplePip(std::wstring const& name, PipSample& sample)
+{
+    HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ, FALSE, name.c_str());
+    if (hMapping == NULL)
+    {
+        // The pip ended since its mapping was listed.
+        return false;
+    }
+
+    void const* view = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping);
+    if (view == nullptr)
+    {
+        return false;
+    }
+
+    LiveCountersHeader const* header = reinterpret_cast<LiveCountersHeader const*>(view);
+    MEMORY_BASIC_INFORMATION info;
+    bool valid = header->Version == LIVE_COUNTERS_VERSION
+        && VirtualQuery(view, &info, sizeof(info)) != 0
+        && info.RegionSize >= sizeof(LiveCountersHeader) + (size_t)header->SlotCount * sizeof(ProcessLiveCounters);
+
+    if (valid)
+    {
+        sample.PipId = header->PipId;
+        sample.ConsumerProcessId = header->ConsumerProcessId;
+        sample.Processes = header->Processes;
+        sample.ProcessesWithoutSlot = header->ProcessesWithoutSlot;
+        sample.RunningProcesses = 0;
+        for (int i = 0; i < (int)LiveCounter::Count; i++)
+        {
+            sample.Counters[i] = s_liveCounterIsCumulative[i] ? header->ExitedTotals[i] : 0;
+        }
+
+        ProcessLiveCounters const* slots = reinterpret_cast<ProcessLiveCounters const*>(header + 1);
+        for (uint32_t slot = 0; slot < header->SlotCount; slot++)
+        {
+            LONG state = slots[slot].State;
+            if (state != LiveCountersSlotState_Running && state != LiveCountersSlotState_Exited)
+            {
+                continue;
+            }
+
+            ProcessSample process;
+            process.ProcessId = slots[slot].ProcessId;
+            process.State = state;
+            for (int i = 0; i < (int)LiveCounter::Count; i++)
+            {
+                process.Counters[i] = slots[slot].Counters[i];
+            }
+
+            // Exited processes are in the totals already.
+            if (state == LiveCountersSlotState_Running)
+            {
+                sample.RunningProcesses++;
+                for (int i = 0; i < (int)LiveCounter::Count; i++)
+                {
+                    sample.Counters[i] += process.Counters[i];
+                }
+            }
+
+            sample.ProcessSamples.push_back(process);
+        }
+    }
+
+    UnmapViewOfFile(view);
+    return valid;
+}
+
+static std::vector<PipSample> SamplePips(DWORD sessionId, uint64_t pipFilter)
+{
+    std::vector<std::wstring> names;
+    wchar_t sessionDirectory[64];
+    swprintf_s(sessionDirectory, L"\\Sessions\\%lu\\BaseNamedObjects", sessionId);
+    FindLiveCounters(sessionDirectory, L"", names);
+    FindLiveCounters(L"\\BaseNamedObjects", L"Global\\", names);
+
+    std::vector<PipSample> samples;
+    for (std::wstring const& name : names)
+    {
+        PipSample sample;
+        if (TrySamplePip(name, sample) && (pipFilter == 0 || sample.PipId == pipFilter))
+        {
+            samples.push_back(std::move(sample));
+        }
+    }
+
+    return samples;
+}
+
+// ----------------------------------------------------------------------------
+// OUTPUT
+// ----------------------------------------------------------------------------
+
+struct MonitorOptions
+{
+    DWORD DelayMs = 1000;
+    uint64_t Count = 0;
+    uint64_t PipFilter = 0;
+    bool Processes = false;
+    char const* CsvFile = nullptr;
+};
+
+static double PerSecond(LONG64 current, LONG64 previous, double seconds)
+{
+    return seconds > 0 && current >= previous ? (current - previous) / seconds : 0;
+}
+
+static void RenderSamples(std::vector<PipSample> const& samples, std::map<uint64_t, PipSample> const& previous, double seconds, MonitorOptions const& options)
+{
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    printf("%02u:%02u:%02u.%03u, %zu pip(s)\n", now.wHour, now.wMinute, now.wSecond, now.wMilliseconds, samples.size());
+    printf("%-18s %8s %12s %10s %14s %10s %10s %8s %12s %12s\n",
+        "Pip", "Procs", "Reports", "Reports/s", "ReportBytes", "Overlays", "CacheHits", "Hit%", "DetourMs", "HeapKB");
+
+    for (PipSample const& sample : samples)
+    {
+        auto before = previous.find(sample.PipId);
+        LONG64 previousReports = before != previous.end() ? before->second.Counters[(int)LiveCounter::ReportsSent] : sample.Counters[(int)LiveCounter::ReportsSent];
+        LONG64 hits = sample.Counters[(int)LiveCounter::PolicyCacheHits];
+        LONG64 lookups = hits + sample.Counters[(int)LiveCounter::PolicyCacheMisses];
+
+        printf("Pip%016llX %3ld/%-4ld %12lld %10.0f %14lld %10lld %10lld %7.1f%% %12.1f %12lld\n",
+            (unsigned long long)sample.PipId,
+            sample.RunningProcesses,
+            sample.Processes,
+            sample.Counters[(int)LiveCounter::ReportsSent],
+            PerSecond(sample.Counters[(int)LiveCounter::ReportsSent], previousReports, seconds),
+            sample.Counters[(int)LiveCounter::ReportBytes],
+            sample.Counters[(int)LiveCounter::HandleOverlays],
+            hits,
+            lookups == 0 ? 0.0 : 100.0 * hits / lookups,
+            sample.Counters[(int)LiveCounter::DetourMicroseconds] / 1000.0,
+            sample.Counters[(int)LiveCounter::PrivateHeapBytes] / 1024);
+
+        if (sample.ProcessesWithoutSlot > 0)
+        {
+            printf("  (%ld process(es) found no free slot and are not counted)\n", sample.ProcessesWithoutSlot);
+        }
+
+        if (!options.Processes)
+        {
+            continue;
+        }
+
+        for (ProcessSample const& process : sample.ProcessSamples)
+        {
+            printf("  %-16lu %8s %12lld %10s %14lld %10lld %10lld %8s %12.1f %12lld\n",
+                process.ProcessId,
+                process.State == LiveCountersSlotState_Running ? "running" : "exited",
+                process.Counters[(int)LiveCounter::ReportsSent],
+                "",
+                process.Counters[(int)LiveCounter::ReportBytes],
+                process.Counters[(int)LiveCounter::HandleOverlays],
+                process.Counters[(int)LiveCounter::PolicyCacheHits],
+                "",
+                process.Counters[(int)LiveCounter::DetourMicroseconds] / 1000.0,
+                process.Counters[(int)LiveCounter::PrivateHeapBytes] / 1024);
+        }
+    }
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void WriteCsvHeader(FILE* csv)
+{
+    fprintf(csv, "Time,PipId,ProcessId,State,Processes");
+    for (int i = 0; i < (int)LiveCounter::Count; i++)
+    {
+        fprintf(csv, ",%s", s_liveCounterNames[i]);
+    }
+
+    fprintf(csv, "\n");
+}
+
+static void WriteCsvRow(FILE* csv, ULONG64 time, uint64_t pipId, char const* processId, char const* state, LONG processes, LONG64 const* counters)
+{
+    fprintf(csv, "%llu,%016llX,%s,%s,%ld", time, (unsigned long long)pipId, processId, state, processes);
+    for (int i = 0; i < (int)LiveCounter::Count; i++)
+    {
+        fprintf(csv, ",%lld", counters[i]);
+    }
+
+    fprintf(csv, "\n");
+}
+
+/// Appends a sample to the CSV file; the time is the system time as a FILETIME, in UTC.
+static void WriteCsvSamples(FILE* csv, std::vector<PipSample> const& samples, MonitorOptions const& options)
+{
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    ULONG64 time = ((ULONG64)now.dwHighDateTime << 32) | now.dwLowDateTime;
+
+    for (PipSample const& sample : samples)
+    {
+        WriteCsvRow(csv, time, sample.PipId, "*", "pip", sample.RunningProcesses, sample.Counters);
+
+        if (!options.Processes)
+        {
+            continue;
+        }
+
+        for (ProcessSample const& process : sample.ProcessSamples)
+        {
+            char processId[16];
+            sprintf_s(processId, "%lu", process.ProcessId);
+            WriteCsvRow(csv, time, sample.PipId, processId, process.State == LiveCountersSlotState_Running ? "running" : "exited", 1, process.Counters);
+        }
+    }
+
+    fflush(csv);
+}
+
+static bool ParseOptions(int argc, char **argv, MonitorOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--processes")
+        {
+            options.Processes = true;
+            continue;
+        }
+
+        if (i + 1 == argc)
+        {
+            fprintf(stderr, "Missing value of '%s'.\n", argv[i]);
+            return false;
+        }
+
+        char const* value = argv[++i];
+        if (option == "--delay-ms")
+        {
+            options.DelayMs = (DWORD)strtoul(value, nullptr, 10);
+        }
+        else if (option == "--count")
+        {
+            options.Count = strtoull(value, nullptr, 10);
+        }
+        else if (option == "--pip")
+        {
+            // Accepts the id as printed, with or without the 'Pip' prefix.
+            options.PipFilter = strtoull(_strnicmp(value, "Pip", 3) == 0 ? value + 3 : value, nullptr, 16);
+        }
+        else if (option == "--csv")
+        {
+            options.CsvFile = value;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'.\n", argv[i - 1]);
+            return false;
+        }
+    }
+
+    if (options.DelayMs == 0)
+    {
+        fprintf(stderr, "Expected a delay of at least 1 ms.\n");
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    MonitorOptions options;
+    if (!ParseOptions(argc, argv, options) || !LoadNtFunctions())
+    {
+        fprintf(stderr, "Usage: DetoursMonitor [--delay-ms D] [--count N] [--pip PIPID] [--processes] [--csv FILE]\n");
+        return ERROR_INVALID_COMMAND;
+    }
+
+    FILE* csv = nullptr;
+    if (options.CsvFile != nullptr)
+    {
+        if (fopen_s(&csv, options.CsvFile, "a") != 0 || csv == nullptr)
+        {
+            fprintf(stderr, "Cannot open '%s' for writing.\n", options.CsvFile);
+            return ERROR_CANNOT_WRITE_CSV;
+        }
+
+        if (_ftelli64(csv) == 0)
+        {
+            WriteCsvHeader(csv);
+        }
+    }
+
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+
+    std::map<uint64_t, PipSample> previous;
+    ULONGLONG previousTick = GetTickCount64();
+
+    for (uint64_t sampleCount = 0; options.Count == 0 || sampleCount < options.Count; sampleCount++)
+    {
+        if (sampleCount > 0)
+        {
+            Sleep(options.DelayMs);
+        }
+
+        std::vector<PipSample> samples = SamplePips(sessionId, options.PipFilter);
+        ULONGLONG tick = GetTickCount64();
+
+        if (csv != nullptr)
+        {
+            WriteCsvSamples(csv, samples, options);
+        }
+        else
+        {
+            RenderSamples(samples, previous, (tick - previousTick) / 1000.0, options);
+        }
+
+        previous.clear();
+        for (PipSample const& sample : samples)
+        {
+            previous[sample.PipId] = sample;
+        }
+
+        previousTick = tick;
+    }
+
+    if (csv != nullptr)
+    {
+        fclose(csv);
+    }
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <winioctl.h>
+
+#include "BlockClone.h"
+#include "FeatureCounters.h"
+#include "UniqueHandle.h"
+#include "VolumeCache.h"
+
+// FSCTL_DUPLICATE_EXTENTS_TO_FILE clones less than 4GB per call; this is a multiple of any cluster size.
+#define BLOCK_CLONE_MAX_CHUNK_SIZE (1ull << 31)
+
+// The attributes of the source the copy gets, as with CopyFileExW (which also marks the copy for archiving).
+#define BLOCK_CLONE_COPIED_ATTRIBUTES (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE \
+    | FILE_ATTRIBUTE_TEMPORARY | FILE_ATTRIBUTE_NOT_CONTENT_INDEXED)
+
+// Whether the file has streams other than its unnamed data stream, which CopyFileExW copies as well. Errs on the side of yes.
+static bool HasAlternateDataStreams(LPCWSTR path)
+{
+    WIN32_FIND_STREAM_DATA streamData;
+    HANDLE find = FindFirstStreamW(path, FindStreamInfoStandard, &streamData, 0);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return true;
+    }
+
+    bool hasMore = FindNextStreamW(find, &streamData) != FALSE || GetLastError() != ERROR_HANDLE_EOF;
+    FindClose(find);
+    return hasMore;
+}
+
+// Makes 'destination' (on the volume of 'source') a clone of 'source': same integrity settings, sparseness and length, then
+// shared extents, then the attributes and last write time of the source.
+static bool CloneExtents(
+    HANDLE source,
+    HANDLE destination,
+    FILE_BASIC_INFO const& basicInfo,
+    FILE_STANDARD_INFO const& standardInfo,
+    FSCTL_GET_INTEGRITY_INFORMATION_BUFFER const& integrity)
+{
+    DWORD bytesReturned;
+
+    // Extents can only be shared between files with the same integrity settings.
+    FSCTL_SET_INTEGRITY_INFORMATION_BUFFER setIntegrity = { integrity.ChecksumAlgorithm, 0, integrity.Flags };
+    if (!DeviceIoControl(destination, FSCTL_SET_INTEGRITY_INFORMATION, &setIntegrity, sizeof(setIntegrity), nullptr, 0, &bytesReturned, nullptr))
+    {
+        return false;
+    }
+
+    if ((basicInfo.FileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0
+        && !DeviceIoControl(destination, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytesReturned, nullptr))
+    {
+        return false;
+    }
+
+    FILE_END_OF_FILE_INFO endOfFile = { standardInfo.EndOfFile };
+    if (!SetFileInformationByHandle(destination, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)))
+    {
+        return false;
+    }
+
+    // The cloned range has to end on a cluster boundary; past the end of the file is fine.
+    uint64_t clusterSize = integrity.ClusterSizeInBytes;
+    uint64_t length = ((uint64_t)standardInfo.EndOfFile.QuadPart + clusterSize - 1) & ~(clusterSize - 1);
+
+    for (uint64_t offset = 0; offset < length; offset += BLOCK_CLONE_MAX_CHUNK_SIZE)
+    {
+        DUPLICATE_EXTENTS_DATA extents;
+        extents.FileHandle = source;
+        extents.SourceFileOffset.QuadPart = (LONGLONG)offset;
+        extents.TargetFileOffset.QuadPart = (LONGLONG)offset;
+        extents.ByteCount.QuadPart = (LONGLONG)min(length - offset, BLOCK_CLONE_MAX_CHUNK_SIZE);
+
+        if (!DeviceIoControl(destination, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents, sizeof(extents), nullptr, 0, &bytesReturned, nullptr))
+        {
+            return false;
+        }
+    }
+
+    // Zero times are left as they are: the copy is new, but carries the last write time of its source.
+    FILE_BASIC_INFO copiedInfo = { 0 };
+    copiedInfo.LastWriteTime = basicInfo.LastWriteTime;
+    copiedInfo.FileAttributes = (basicInfo.FileAttributes & BLOCK_CLONE_COPIED_ATTRIBUTES) | FILE_ATTRIBUTE_ARCHIVE;
+
+    return SetFileInformationByHandle(destination, FileBasicInfo, &copiedInfo, sizeof(copiedInfo)) != FALSE;
+}
+
+bool TryBlockCloneFile(CanonicalizedPath const& sourcePath, CanonicalizedPath const& destinationPath, DWORD copyFlags)
+{
+    IncrementFeatureCounter(FeatureCounter::BlockCloneAttempts);
+
+    if ((copyFlags & ~COPY_FILE_FAIL_IF_EXISTS) != 0)
+    {
+        return false;
+    }
+
+    VolumeInformation sourceVolume;
+    VolumeInformation destinationVolume;
+    if (!TryGetVolumeInformation(sourcePath, sourceVolume)
+        || !sourceVolume.SupportsBlockRefcounting()
+        || !TryGetVolumeInformation(destinationPath, destinationVolume)
+        || destinationVolume.SerialNumber != sourceVolume.SerialNumber)
+    {
+        return false;
+    }
+
+    unique_handle<INVALID_HANDLE_VALUE> source(CreateFileW(
+        sourcePath.GetPathString(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr));
+    if (!source)
+    {
+        return false;
+    }
+
+    FILE_BASIC_INFO basicInfo;
+    FILE_STANDARD_INFO standardInfo;
+    if (!GetFileInformationByHandleEx(source.get(), FileBasicInfo, &basicInfo, sizeof(basicInfo))
+        || !GetFileInformationByHandleEx(source.get(), FileStandardInfo, &standardInfo, sizeof(standardInfo)))
+    {
+        return false;
+    }
+
+    // Encrypted and compressed files cannot be cloned, and CopyFileExW copies the other streams of a file too.
+    if (standardInfo.Directory
+        || (basicInfo.FileAttributes & (FILE_ATTRIBUTE_ENCRYPTED | FILE_ATTRIBUTE_COMPRESSED)) != 0
+        || HasAlternateDataStreams(sourcePath.GetPathString()))
+    {
+        return false;
+    }
+
+    FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrity;
+    DWORD bytesReturned;
+    if (!DeviceIoControl(source.get(), FSCTL_GET_INTEGRITY_INFORMATION, nullptr, 0, &integrity, sizeof(integrity), &bytesReturned, nullptr)
+        || integrity.ClusterSizeInBytes == 0)
+    {
+        return false;
+    }
+
+    unique_handle<INVALID_HANDLE_VALUE> destination(CreateFileW(
+        destinationPath.GetPathString(),
+        GENERIC_READ | GENERIC_WRITE | DELETE,
+        0,
+        nullptr,
+        (copyFlags & COPY_FILE_FAIL_IF_EXISTS) != 0 ? CREATE_NEW : CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr));
+    if (!destination)
+    {
+        return false;
+    }
+
+    if (!CloneExtents(source.get(), destination.get(), basicInfo, standardInfo, integrity))
+    {
+        // Leaves the destination to the real copy.
+        FILE_DISPOSITION_INFO disposition = { TRUE };
+        SetFileInformationByHandle(destination.get(), FileDispositionInfo, &disposition, sizeof(disposition));
+        return false;
+    }
+
+    IncrementFeatureCounter(FeatureCounter::BlockClonedCopies);
+    return true;
+}
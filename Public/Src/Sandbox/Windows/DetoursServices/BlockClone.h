@@ -0,0 +1,25 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Copies by block cloning, with FileAccessManifestExtraFlag::UseBlockCloneForCopies.
+//
+// On a volume that supports block cloning (ReFS, Dev Drive), a copy to the same volume can share the clusters of the source
+// file (FSCTL_DUPLICATE_EXTENTS_TO_FILE) instead of reading and writing every byte. The copy is attempted that way first when
+// the destination is writable by policy; whenever the file or the volume does not lend itself to cloning, the real CopyFileExW
+// does the copy instead. The accesses reported are the same either way.
+
+#pragma once
+
+#include "CanonicalizedPath.h"
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Copies a file the way CopyFileExW without a progress routine would (data, attributes and last write time), by cloning its
+/// extents. Only the COPY_FILE_FAIL_IF_EXISTS flag is supported. Returns false, with no file left at the destination, if the
+/// copy could not be made that way, in which case the caller makes the real copy; an existing destination may have been
+/// replaced already, which the real copy does too. Volumes that cannot clone, or a destination on another volume than the
+/// source, are told apart from the volume cache before any file is opened.
+/// Must be called in a DetouredScope, so that the accesses made to clone the file are not reported.
+bool TryBlockCloneFile(CanonicalizedPath const& sourcePath, CanonicalizedPath const& destinationPath, DWORD copyFlags);
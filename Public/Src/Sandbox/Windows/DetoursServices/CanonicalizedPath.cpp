@@ -2,9 +2,60 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "CanonicalizedPath.h"
+#include "FeatureCounters.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define CANONICAL_PATH_SCAN_SIMD 1
+#include <intrin.h>
+#include <emmintrin.h>
+#else
+#define CANONICAL_PATH_SCAN_SIMD 0
+#endif
+
+// How many paths got canonicalized, and how many of them were already canonical (see IsAlreadyCanonical).
+extern volatile LONG64 g_detoursCanonicalizations;
+extern volatile LONG64 g_detoursFastCanonicalizations;
+
+CanonicalizedPathBuffer* CanonicalizedPathBuffer::Allocate(size_t length) {
+    // Chars already has room for the terminating null.
+    CanonicalizedPathBuffer* buffer = reinterpret_cast<CanonicalizedPathBuffer*>(
+        new char[sizeof(CanonicalizedPathBuffer) + sizeof(wchar_t) * length]);
+    assert(buffer);
+
+    buffer->RefCount = 1;
+    buffer->Length = length;
+    buffer->Components = nullptr;
+    buffer->Chars[length] = L'\0';
+    return buffer;
+}
+
+PathComponentIndex* PathComponentIndex::Allocate(size_t count) {
+    // Components already has room for one component.
+    PathComponentIndex* index = reinterpret_cast<PathComponentIndex*>(
+        new char[sizeof(PathComponentIndex) + sizeof(PathComponent) * (count > 0 ? count - 1 : 0)]);
+    assert(index);
+
+    index->Count = count;
+    return index;
+}
+
+// Length of the type prefix (\\?\, \??\, or \\.\) that GetPathStringWithoutTypePrefix omits.
+static size_t GetTypePrefixLength(PathType type) {
+    return type == PathType::Win32Nt || type == PathType::LocalDevice ? 4 : 0;
+}
+
+// Returns a new index for the components of the given path.
+static PathComponentIndex* BuildComponentIndex(wchar_t const* path, size_t length) {
+    // Counting first only scans the path; the hashes are computed once, when filling in the index.
+    size_t count = TokenizePathComponents(path, length, nullptr, 0);
+    PathComponentIndex* index = PathComponentIndex::Allocate(count);
+    TokenizePathComponents(path, length, index->Components, count);
+    return index;
+}
 
 // Applies GetFullPathnameW to 'path'. This function should not be used on \\?\ or \??\ style paths.
-static DWORD GetFullPath(__in PCWSTR path, std::wstring& fullPath)
+// On success, fullPath holds a new buffer with a single reference.
+static DWORD GetFullPath(__in PCWSTR path, CanonicalizedPathBuffer*& fullPath)
 {
     // First, we try with a fixed-sized buffer, which should be good enough for all practical cases
 
@@ -22,7 +73,8 @@ static DWORD GetFullPath(__in PCWSTR path, std::wstring& fullPath)
     {
         // The buffer was big enough. The return value indicates the length of the full path, NOT INCLUDING the terminating null character.
         // http://msdn.microsoft.com/en-us/library/windows/desktop/aa364963(v=vs.85).aspx
-        fullPath = std::wstring(wszBuffer, static_cast<size_t>(result));
+        fullPath = CanonicalizedPathBuffer::Allocate(static_cast<size_t>(result));
+        wmemcpy(fullPath->Chars, wszBuffer, static_cast<size_t>(result));
     }
     else
     {
@@ -30,22 +82,26 @@ static DWORD GetFullPath(__in PCWSTR path, std::wstring& fullPath)
 
         // Note that in this case, the return value indicates the required buffer length, INCLUDING the terminating null character.
         // http://msdn.microsoft.com/en-us/library/windows/desktop/aa364963(v=vs.85).aspx
-        unique_ptr<wchar_t[]> buffer(new wchar_t[result]);
-        assert(buffer.get());
+        // The result is written straight into the path buffer, which is sized for that length.
+        CanonicalizedPathBuffer* buffer = CanonicalizedPathBuffer::Allocate(static_cast<size_t>(result) - 1);
 
-        DWORD result2 = GetFullPathNameW(path, result, buffer.get(), NULL);
+        DWORD result2 = GetFullPathNameW(path, result, buffer->Chars, NULL);
 
         if (result2 == 0)
         {
-            return GetLastError();
+            DWORD error = GetLastError();
+            buffer->Release();
+            return error;
         }
 
         if (result2 < result)
         {
-            fullPath = std::wstring(buffer.get(), result2);
+            buffer->Length = result2;
+            fullPath = buffer;
         }
         else
         {
+            buffer->Release();
             return ERROR_NOT_ENOUGH_MEMORY;
         }
     }
@@ -53,9 +109,230 @@ static DWORD GetFullPath(__in PCWSTR path, std::wstring& fullPath)
     return ERROR_SUCCESS;
 }
 
+// Indicates if a final path component is a DOS device name (CON, NUL, COM1, etc., possibly with an extension),
+// which GetFullPathNameW turns into a local device path: C:\foo\nul.txt becomes \\.\nul.
+static bool IsDosDeviceName(wchar_t const* component, size_t length) {
+    size_t baseLength = 0;
+    while (baseLength < length && component[baseLength] != L'.' && component[baseLength] != L':') {
+        baseLength++;
+    }
+
+    while (baseLength > 0 && component[baseLength - 1] == L' ') {
+        baseLength--;
+    }
+
+    if (baseLength == 3) {
+        return _wcsnicmp(component, L"CON", 3) == 0
+            || _wcsnicmp(component, L"PRN", 3) == 0
+            || _wcsnicmp(component, L"AUX", 3) == 0
+            || _wcsnicmp(component, L"NUL", 3) == 0;
+    }
+
+    if (baseLength == 4) {
+        // Also matches a few names that are not devices (e.g. COM0), which only means those take the slow path.
+        return _wcsnicmp(component, L"COM", 3) == 0 || _wcsnicmp(component, L"LPT", 3) == 0;
+    }
+
+    return (baseLength == 6 && _wcsnicmp(component, L"CONIN$", 6) == 0)
+        || (baseLength == 7 && _wcsnicmp(component, L"CONOUT$", 7) == 0);
+}
+
+// Checks the rules of IsAlreadyCanonical that involve the separator, slash, or dot at index i (which is at least 2).
+static inline bool IsCanonicalAround(wchar_t const* path, size_t length, size_t i) {
+    switch (path[i]) {
+    case L'/':
+        return false;
+    case L'\\':
+        // No empty component, and no component ending in a dot or a space (which GetFullPathNameW trims).
+        return path[i - 1] != L'\\' && path[i - 1] != L'.' && path[i - 1] != L' ';
+    case L'.':
+        // No . or .. component.
+        if (path[i - 1] != L'\\') {
+            return true;
+        }
+
+        if (i + 1 == length || path[i + 1] == L'\\') {
+            return false;
+        }
+
+        return !(path[i + 1] == L'.' && (i + 2 == length || path[i + 2] == L'\\'));
+    default:
+        return true;
+    }
+}
+
+// Checks the rules of IsAlreadyCanonical from index i (which is at least 1) to the end of the path.
+static bool IsCanonicalFrom(wchar_t const* path, size_t length, size_t i) {
+
+#if CANONICAL_PATH_SCAN_SIMD
+    // Separators and dots are rare, so 8 characters at a time are skipped unless they contain one.
+    __m128i const separator = _mm_set1_epi16(L'\\');
+    __m128i const slash = _mm_set1_epi16(L'/');
+    __m128i const dot = _mm_set1_epi16(L'.');
+
+    for (; i + 8 <= length; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(path + i));
+        __m128i interesting = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi16(v, separator), _mm_cmpeq_epi16(v, slash)),
+            _mm_cmpeq_epi16(v, dot));
+
+        // Two bits per character.
+        unsigned long mask = (unsigned long)_mm_movemask_epi8(interesting);
+        while (mask != 0) {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            if (!IsCanonicalAround(path, length, i + bit / 2)) {
+                return false;
+            }
+
+            mask &= ~(3ul << bit);
+        }
+    }
+#endif
+
+    for (; i < length; i++) {
+        if (!IsCanonicalAround(path, length, i)) {
+            return false;
+        }
+    }
+
+    size_t lastSeparator = FindFinalPathSeparator(path);
+    return !IsDosDeviceName(path + lastSeparator + 1, length - lastSeparator - 1);
+}
+
+// Indicates if GetFullPathNameW would return the path unchanged: it is drive-absolute (X:\...), only uses backslashes,
+// has no empty, . or .. components, no component ending in a dot or a space, and does not name a DOS device.
+// Most paths passed in by tools (compilers, MSBuild) are like this, and skipping GetFullPathNameW for them saves a copy
+// of the path and the PEB lock it takes.
+static bool IsAlreadyCanonical(wchar_t const* path, size_t length) {
+    if (length < 3 || length >= 0x7FFF
+        || !((path[0] >= L'A' && path[0] <= L'Z') || (path[0] >= L'a' && path[0] <= L'z'))
+        || path[1] != L':'
+        || path[2] != L'\\') {
+        return false;
+    }
+
+    if (path[length - 1] == L'.' || path[length - 1] == L' ') {
+        return false;
+    }
+
+    return IsCanonicalFrom(path, length, 3);
+}
+
+// Indicates if GetFullPathNameW would return the current directory, a separator, and the path: it is relative to the
+// current directory (rather than rooted or drive-relative), and follows the rules of IsAlreadyCanonical otherwise.
+static bool IsCanonicalRelative(wchar_t const* path, size_t length) {
+    if (length == 0 || length >= 0x7FFF
+        || path[0] == L'\\' || path[0] == L'/'
+        || (length >= 2 && path[1] == L':')) {
+        return false;
+    }
+
+    if (path[length - 1] == L'.' || path[length - 1] == L' ') {
+        return false;
+    }
+
+    // A leading . or .. component.
+    if (path[0] == L'.' && (path[1] == L'\\' || (path[1] == L'.' && (length == 2 || path[2] == L'\\')))) {
+        return false;
+    }
+
+    return IsCanonicalFrom(path, length, 1);
+}
+
+// With FileAccessManifestExtraFlag::CacheCurrentDirectory, the current directory is only read from the process (which takes
+// the PEB lock, like GetFullPathNameW) when it is first needed after a detoured SetCurrentDirectory changed it, so that
+// canonicalizing a plain relative path comes down to a concatenation. Only a drive-absolute current directory is kept.
+static SRWLOCK g_currentDirectoryLock = SRWLOCK_INIT;
+static CanonicalizedPathBuffer* g_currentDirectory = nullptr;
+static LONG g_currentDirectoryGeneration = 0;
+
+// Returns a reference to the current directory, which the caller releases, or nullptr if it can't be cached.
+static CanonicalizedPathBuffer* AcquireCurrentDirectory() {
+    AcquireSRWLockShared(&g_currentDirectoryLock);
+    CanonicalizedPathBuffer* currentDirectory = g_currentDirectory;
+    LONG generation = g_currentDirectoryGeneration;
+    if (currentDirectory != nullptr) {
+        currentDirectory->AddRef();
+    }
+
+    ReleaseSRWLockShared(&g_currentDirectoryLock);
+
+    if (currentDirectory != nullptr) {
+        return currentDirectory;
+    }
+
+    // The required length includes the terminating null.
+    DWORD required = GetCurrentDirectoryW(0, NULL);
+    if (required == 0) {
+        return nullptr;
+    }
+
+    currentDirectory = CanonicalizedPathBuffer::Allocate(static_cast<size_t>(required) - 1);
+    DWORD length = GetCurrentDirectoryW(required, currentDirectory->Chars);
+    if (length == 0 || length >= required || !IsAlreadyCanonical(currentDirectory->Chars, length)) {
+        // Changed in between, or a UNC or long path that is left to GetFullPathNameW.
+        currentDirectory->Release();
+        return nullptr;
+    }
+
+    currentDirectory->Length = length;
+
+    AcquireSRWLockExclusive(&g_currentDirectoryLock);
+
+    // Not kept if the directory changed while it was being read.
+    if (g_currentDirectory == nullptr && generation == g_currentDirectoryGeneration) {
+        currentDirectory->AddRef();
+        g_currentDirectory = currentDirectory;
+    }
+
+    ReleaseSRWLockExclusive(&g_currentDirectoryLock);
+
+    return currentDirectory;
+}
+
+// Returns the current directory joined with a relative path for which IsCanonicalRelative holds, or nullptr if the
+// current directory can't be cached.
+static CanonicalizedPathBuffer* CombineWithCurrentDirectory(wchar_t const* path, size_t length) {
+    CanonicalizedPathBuffer* currentDirectory = AcquireCurrentDirectory();
+    if (currentDirectory == nullptr) {
+        return nullptr;
+    }
+
+    size_t directoryLength = currentDirectory->Length;
+    size_t separatorLength = IsDirectorySeparator(currentDirectory->Chars[directoryLength - 1]) ? 0 : 1;
+
+    CanonicalizedPathBuffer* fullPath = CanonicalizedPathBuffer::Allocate(directoryLength + separatorLength + length);
+    wmemcpy(fullPath->Chars, currentDirectory->Chars, directoryLength);
+    if (separatorLength != 0) {
+        fullPath->Chars[directoryLength] = L'\\';
+    }
+
+    wmemcpy(fullPath->Chars + directoryLength + separatorLength, path, length);
+
+    currentDirectory->Release();
+    return fullPath;
+}
+
+void InvalidateCachedCurrentDirectory() {
+    AcquireSRWLockExclusive(&g_currentDirectoryLock);
+
+    CanonicalizedPathBuffer* currentDirectory = g_currentDirectory;
+    g_currentDirectory = nullptr;
+    g_currentDirectoryGeneration++;
+
+    ReleaseSRWLockExclusive(&g_currentDirectoryLock);
+
+    if (currentDirectory != nullptr) {
+        currentDirectory->Release();
+    }
+}
+
 CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPath) {
+    InterlockedIncrement64(&g_detoursCanonicalizations);
+
     PathType pathType;
-    std::wstring fullPath;
+    CanonicalizedPathBuffer* fullPath = nullptr;
     if (IsWin32NtPathName(noncanonicalPath)) {
         // Caller is using escape syntax to avoid Win32 interpretation of path.
         // That's actually really good for us.  The text after the prefix is
@@ -64,7 +341,9 @@ CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPat
         //    IsWin32NtPathName(path) ? path : GetFullPathName(path),
         // and in fact GetFullPathName(path) and path aren't always equivalent if IsWin32NtPathName(path).
         pathType = PathType::Win32Nt;
-        fullPath = std::wstring(noncanonicalPath);
+        size_t length = wcslen(noncanonicalPath);
+        fullPath = CanonicalizedPathBuffer::Allocate(length);
+        wmemcpy(fullPath->Chars, noncanonicalPath, length);
     }
     else {
         // The path is not a Win32-NT pathname so it is subject to GetFullPathName canonicalization by the kernel.
@@ -74,16 +353,31 @@ CanonicalizedPath CanonicalizedPath::Canonicalize(wchar_t const* noncanonicalPat
         // Note that even non-drive-letter devices like \\.\nul, \\.\Harddisk0Partition1, etc. can safely become nul and Harddisk0Partition1 respectively; 
         // imagine the manifest tree root as implicitly \??\ (the session's DosDevices namespace).
 
+        size_t length = wcslen(noncanonicalPath);
+        if (IsAlreadyCanonical(noncanonicalPath, length)) {
+            InterlockedIncrement64(&g_detoursFastCanonicalizations);
+            return CanonicalizedPath(PathType::Win32, noncanonicalPath, length);
+        }
+
+        if (CacheCurrentDirectory() && IsCanonicalRelative(noncanonicalPath, length)) {
+            fullPath = CombineWithCurrentDirectory(noncanonicalPath, length);
+            if (fullPath != nullptr) {
+                InterlockedIncrement64(&g_detoursFastCanonicalizations);
+                IncrementFeatureCounter(FeatureCounter::CurrentDirectoryJoins);
+                return CanonicalizedPath(PathType::Win32, fullPath);
+            }
+        }
+
         DWORD error = GetFullPath(noncanonicalPath, fullPath);
         if (error != ERROR_SUCCESS) {
             return CanonicalizedPath();
         }
 
         // Note that GetFullPath("nul") == "\\.\nul" (similar for other classic devices), so we check for the local device type after that step.
-        pathType = IsLocalDevicePathName(fullPath.c_str()) ? PathType::LocalDevice : PathType::Win32;
+        pathType = IsLocalDevicePathName(fullPath->Chars) ? PathType::LocalDevice : PathType::Win32;
     }
 
-    return CanonicalizedPath(pathType, std::move(fullPath));
+    return CanonicalizedPath(pathType, fullPath);
 }
 
 CanonicalizedPath CanonicalizedPath::Extend(wchar_t const* additionalComponents, size_t* extensionStartIndex) const {
@@ -93,21 +387,71 @@ CanonicalizedPath CanonicalizedPath::Extend(wchar_t const* additionalComponents,
         additionalComponents++;
     }
 
-    std::wstring extended{};
-    extended.reserve(wcslen(additionalComponents) + Length() + 1);
-    extended.append(*m_value);
+    size_t length = Length();
+    size_t additionalLength = wcslen(additionalComponents);
+    bool needsSeparator = length > 0 && !IsDirectorySeparator(m_value->Chars[length - 1]);
+    size_t extensionStart = length + (needsSeparator ? 1 : 0);
+
+    CanonicalizedPathBuffer* extended = CanonicalizedPathBuffer::Allocate(extensionStart + additionalLength);
+    wmemcpy(extended->Chars, m_value->Chars, length);
 
-    if (!extended.empty() && !IsDirectorySeparator(extended.back())) {
-        extended.push_back(NT_DIRECTORY_SEPARATOR);
+    if (needsSeparator) {
+        extended->Chars[length] = NT_DIRECTORY_SEPARATOR;
     }
 
     if (extensionStartIndex != nullptr) {
-        *extensionStartIndex = extended.size();
+        *extensionStartIndex = extensionStart;
     }
 
-    extended.append(additionalComponents);
+    wmemcpy(extended->Chars + extensionStart, additionalComponents, additionalLength);
 
-    return CanonicalizedPath(Type, std::move(extended));
+    // The components of this path are also the first ones of the extended path when a separator gets inserted between
+    // them and the extension, so only the extension needs tokenizing.
+    size_t prefixLength = GetTypePrefixLength(Type);
+    PathComponentIndex const* index = m_value->Components;
+    if (index != nullptr && needsSeparator && length >= prefixLength) {
+        size_t extensionOffset = extensionStart - prefixLength;
+        size_t extensionCount = TokenizePathComponents(extended->Chars + extensionStart, additionalLength, nullptr, 0);
+
+        PathComponentIndex* extendedIndex = PathComponentIndex::Allocate(index->Count + extensionCount);
+        memcpy(extendedIndex->Components, index->Components, sizeof(PathComponent) * index->Count);
+        TokenizePathComponents(extended->Chars + extensionStart, additionalLength, extendedIndex->Components + index->Count, extensionCount);
+        for (size_t i = index->Count; i < extendedIndex->Count; i++) {
+            extendedIndex->Components[i].Offset += static_cast<DWORD>(extensionOffset);
+        }
+
+        extended->Components = extendedIndex;
+    }
+
+    return CanonicalizedPath(Type, extended);
+}
+
+PathComponentIndex const* CanonicalizedPath::GetComponentIndex() const {
+    if (IsNull() || m_value == nullptr) {
+        return nullptr;
+    }
+
+    PathComponentIndex const* index = m_value->Components;
+    if (index != nullptr) {
+        return index;
+    }
+
+    // A path that is shorter than its type prefix (left by removing components) has no components.
+    size_t prefixLength = GetTypePrefixLength(Type);
+    return m_value->Length > prefixLength
+        ? PublishComponentIndex(BuildComponentIndex(m_value->Chars + prefixLength, m_value->Length - prefixLength))
+        : PublishComponentIndex(PathComponentIndex::Allocate(0));
+}
+
+PathComponentIndex const* CanonicalizedPath::PublishComponentIndex(PathComponentIndex* index) const {
+    PathComponentIndex* existing = reinterpret_cast<PathComponentIndex*>(
+        InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&m_value->Components), index, nullptr));
+    if (existing != nullptr) {
+        index->Free();
+        return existing;
+    }
+
+    return index;
 }
 
 wchar_t const* CanonicalizedPath::GetLastComponent() const {
@@ -132,6 +476,24 @@ CanonicalizedPath CanonicalizedPath::RemoveLastComponent() const {
 
     // If the last path separator is at zero-based index N, we want the preceding N characters.
     // If there are no path separators (or a path separator at index 0), we want a zero length string.
-    size_t lastSeparatorIndex = FindFinalPathSeparator(m_value->c_str());
-    return CanonicalizedPath(Type, m_value->substr(0, lastSeparatorIndex));
+    size_t lastSeparatorIndex = FindFinalPathSeparator(m_value->Chars);
+    CanonicalizedPath parent(Type, m_value->Chars, lastSeparatorIndex);
+
+    // The parent ends where a separator ended a component of this path, so its components are the ones of this path that
+    // end there or before.
+    size_t prefixLength = GetTypePrefixLength(Type);
+    PathComponentIndex const* index = m_value->Components;
+    if (index != nullptr && lastSeparatorIndex >= prefixLength) {
+        size_t parentLength = lastSeparatorIndex - prefixLength;
+        size_t count = 0;
+        while (count < index->Count && index->Components[count].Offset + index->Components[count].Length <= parentLength) {
+            count++;
+        }
+
+        PathComponentIndex* parentIndex = PathComponentIndex::Allocate(count);
+        memcpy(parentIndex->Components, index->Components, sizeof(PathComponent) * count);
+        parent.m_value->Components = parentIndex;
+    }
+
+    return parent;
 }
@@ -5,6 +5,45 @@
 
 #include "FileAccessHelpers.h"
 
+// The components of a canonicalized path (without its type prefix) as the policy search consumes them (see TokenizePathComponents).
+struct PathComponentIndex {
+    size_t Count;
+    PathComponent Components[1];
+
+    // Allocates an index with room for count components.
+    static PathComponentIndex* Allocate(size_t count);
+
+    void Free() {
+        delete[] reinterpret_cast<char*>(this);
+    }
+};
+
+// Reference-counted, null-terminated path string. The characters are stored inline, so a path takes a single allocation.
+struct CanonicalizedPathBuffer {
+    volatile LONG RefCount;
+    size_t Length;
+    // Built on first use and shared by all the paths referencing the buffer; nullptr until then.
+    PathComponentIndex* volatile Components;
+    wchar_t Chars[1];
+
+    // Allocates a buffer with a reference count of 1 and room for length characters plus the terminating null.
+    static CanonicalizedPathBuffer* Allocate(size_t length);
+
+    void AddRef() {
+        InterlockedIncrement(&RefCount);
+    }
+
+    void Release() {
+        if (InterlockedDecrement(&RefCount) == 0) {
+            if (Components != nullptr) {
+                Components->Free();
+            }
+
+            delete[] reinterpret_cast<char*>(this);
+        }
+    }
+};
+
 // Immutable, typed, and canonical path string. The represented path is absolute, free of .. and . traversals, redundant path separators, etc.
 // A canonicalized path is indepenent of the current directory (which is mutable and process global).
 // Since the path is immutable, the underlying storage for the path string is shared among instances under copy construction and assignment.
@@ -14,17 +53,60 @@ struct CanonicalizedPath {
     { }
 
     CanonicalizedPath(PathType type, wchar_t const* value, size_t valuePrefixLength)
-        : Type(type), m_value(std::make_shared<std::wstring>(value, valuePrefixLength))
-    { }
+        : Type(type), m_value(CanonicalizedPathBuffer::Allocate(valuePrefixLength))
+    {
+        wmemcpy(m_value->Chars, value, valuePrefixLength);
+    }
 
     CanonicalizedPath(CanonicalizedPath&& other)
-        : Type(other.Type), m_value(std::move(other.m_value))
+        : Type(other.Type), m_value(other.m_value)
     {
         other.Type = PathType::Null;
+        other.m_value = nullptr;
     }
 
-    CanonicalizedPath(const CanonicalizedPath& other) = default;
-    CanonicalizedPath& operator=(const CanonicalizedPath&) = default;
+    CanonicalizedPath(const CanonicalizedPath& other)
+        : Type(other.Type), m_value(other.m_value)
+    {
+        if (m_value != nullptr) {
+            m_value->AddRef();
+        }
+    }
+
+    CanonicalizedPath& operator=(const CanonicalizedPath& other) {
+        if (other.m_value != nullptr) {
+            other.m_value->AddRef();
+        }
+
+        if (m_value != nullptr) {
+            m_value->Release();
+        }
+
+        Type = other.Type;
+        m_value = other.m_value;
+        return *this;
+    }
+
+    CanonicalizedPath& operator=(CanonicalizedPath&& other) {
+        if (this != &other) {
+            if (m_value != nullptr) {
+                m_value->Release();
+            }
+
+            Type = other.Type;
+            m_value = other.m_value;
+            other.Type = PathType::Null;
+            other.m_value = nullptr;
+        }
+
+        return *this;
+    }
+
+    ~CanonicalizedPath() {
+        if (m_value != nullptr) {
+            m_value->Release();
+        }
+    }
 
     CanonicalizedPath Extend(wchar_t const* additionalComponents, size_t* extensionStartIndex = nullptr) const;
     CanonicalizedPath RemoveLastComponent() const;
@@ -32,11 +114,11 @@ struct CanonicalizedPath {
     bool IsNull() const { return Type == PathType::Null; }
 
     size_t Length() const {
-        return m_value ? m_value->length() : 0;
+        return m_value ? m_value->Length : 0;
     }
 
     wchar_t const* GetPathString() const {
-        return m_value ? m_value->c_str() : nullptr;
+        return m_value ? m_value->Chars : nullptr;
     }
 
     // Returns the path string with the type prefix (\\?\, \??\, or \\.\) omitted if present.
@@ -58,17 +140,27 @@ struct CanonicalizedPath {
     // Returns the suffix of the path string corresponding to the last component in the path.
     wchar_t const* GetLastComponent() const;
 
+    // Returns the components of the path string without type prefix, with their offsets relative to it and their hashes,
+    // so that searching the policy tree for the path doesn't scan and hash it again. Returns nullptr for a null path.
+    PathComponentIndex const* GetComponentIndex() const;
+
     // Attempts to canonicalize the given path. On failure, returns a path with IsNull() == true.
     static CanonicalizedPath Canonicalize(wchar_t const* noncanonicalPath);
 
     PathType Type;
 
 private:
-    // Private constructor for Canonicalize, which creates a wstring for m_value.
-    // This constructor allocates a new shared_ptr managed string but moves the contents rather than copying them.
-    CanonicalizedPath(PathType type, std::wstring&& value)
-        : Type(type), m_value(std::make_shared<std::wstring>(std::move(value)))
+    // Private constructor taking ownership of an already filled in buffer.
+    CanonicalizedPath(PathType type, CanonicalizedPathBuffer* value)
+        : Type(type), m_value(value)
     { }
 
-    std::shared_ptr<std::wstring> m_value;
+    // Publishes an index for the buffer unless another thread did first, and returns the one in use.
+    PathComponentIndex const* PublishComponentIndex(PathComponentIndex* index) const;
+
+    CanonicalizedPathBuffer* m_value;
 };
+
+// Forgets the current directory that relative paths are canonicalized against with FileAccessManifestExtraFlag::CacheCurrentDirectory.
+// To be called whenever the current directory of the process may have changed.
+void InvalidateCachedCurrentDirectory();
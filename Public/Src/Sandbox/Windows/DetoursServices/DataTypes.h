@@ -6,10 +6,10 @@
 #include "stdafx.h"
 #include "StringOperations.h"
 
-#if !(MAC_OS_SANDBOX)
+#if !(MAC_OS_SANDBOX) && !(BUILDXL_MINIFILTER)
 #include <string>
 #include "DebuggingHelpers.h"
-#endif // !(MAC_OS_SANDBOX)
+#endif // !(MAC_OS_SANDBOX) && !(BUILDXL_MINIFILTER)
 
 #define NoUsn -1
 
@@ -85,12 +85,62 @@ inline bool CheckReportAnyAccess(FileAccessManifestFlag flags, bool accessDenied
 }
 
 //
-// Keep this in sync with the C# version declared in FileAccessManifest.cs
+// Higher-order macro that enumerates all FileAccessManifestExtraFlag name/value pairs.
+// Follows the same scheme as FOR_ALL_FAM_FLAGS, except that 'None' is declared directly
+// in the enum so the generated global accessors do not collide with the FileAccessManifestFlag ones.
+//
+// IMPORTANT: Keep this in sync with the C# version declared in FileAccessManifest.cs
+//
+#define FOR_ALL_FAM_EXTRA_FLAGS(m) \
+    m(UseBinaryReportFormat,              0x1)            \
+    m(BufferReports,                      0x2)            \
+    m(UseReportRingBuffer,                0x4)            \
+    m(InternReportedPaths,                0x8)            \
+    m(DeduplicateReports,                 0x10)           \
+    m(CacheReparsePointProbes,            0x20)           \
+    m(OmitPassThroughDetours,             0x40)           \
+    m(SendReportsAsynchronously,          0x80)           \
+    m(CollectDetourStatistics,            0x100)          \
+    m(ReportUsnsAfterOpen,                0x200)          \
+    m(CacheFinalPathsOfHandles,           0x400)          \
+    m(ShareReportCacheAcrossProcesses,    0x800)          \
+    m(SummarizeFileAccesses,              0x1000)         \
+    m(InheritDeviceMap,                   0x2000)         \
+    m(CachePolicyResults,                 0x4000)         \
+    m(SequenceReports,                    0x8000)         \
+    m(UseAccessBitmap,                    0x10000)        \
+    m(HashOutputsWhileWriting,            0x20000)        \
+    m(LogDebugMessagesAsynchronously,     0x40000)        \
+    m(CoalesceOutputWrites,               0x80000)        \
+    m(UseBlockCloneForCopies,             0x100000)       \
+    m(FastTempFileNames,                  0x200000)       \
+    m(CacheKnownDirectories,              0x400000)       \
+    m(UseLargeFetchEnumerations,          0x800000)       \
+    m(CacheCurrentDirectory,              0x1000000)      \
+    m(AdaptiveReportBackpressure,         0x2000000)      \
+    m(PrefetchDeclaredInputs,             0x4000000)      \
+    m(PublishLiveCounters,                0x8000000)      \
+    m(CapturePolicyInputs,                0x10000000)     \
+    m(DetourNtLayerOnly,                  0x20000000)     \
+    m(ShrinkCachesUnderMemoryPressure,    0x40000000)
+
+//
+// FileAccessManifestExtraFlag enum definition
 //
 enum class FileAccessManifestExtraFlag {
     None = 0x0,
+    FOR_ALL_FAM_EXTRA_FLAGS(GEN_FAM_FLAG_ENUM_NAME_VALUE)
 };
 
+DEFINE_ENUM_FLAG_OPERATORS(FileAccessManifestExtraFlag)
+
+//
+// Checker function for FileAccessManifestExtraFlag enums.
+//
+#define GEN_FAM_EXTRA_FLAG_CHECKER(flag_name, flag_value) \
+  inline bool Check##flag_name(FileAccessManifestExtraFlag flags) { return (flags & FileAccessManifestExtraFlag::flag_name) != FileAccessManifestExtraFlag::None; }
+FOR_ALL_FAM_EXTRA_FLAGS(GEN_FAM_EXTRA_FLAG_CHECKER)
+
 //
 // Keep this in sync with the C# version declared in FileAccessPolicy.cs
 //
@@ -128,6 +178,10 @@ enum FileAccessPolicy
     // this flag is specified
     FileAccessPolicy_AllowRealInputTimestamps = 0x200,
 
+    // The file has not been placed on disk yet: its first open in a process asks BuildXL to materialize it, and waits until
+    // it has (see Materialization.h). Only applies to a path matched exactly by the manifest.
+    FileAccessPolicy_MaterializeOnOpen = 0x400,
+
     // If set, then we will report all attempts to access files under this scope (whether existent or not).
     // BuildXL uses this information to discover dynamic dependencies, such as #include-ed files.
     FileAccessPolicy_ReportAccess = FileAccessPolicy_ReportAccessIfNonExistent | FileAccessPolicy_ReportAccessIfExistent,
@@ -135,6 +189,16 @@ enum FileAccessPolicy
     FileAccessPolicy_AllowAll = FileAccessPolicy_AllowRead | FileAccessPolicy_AllowReadIfNonExistent | FileAccessPolicy_AllowWrite | FileAccessPolicy_AllowCreateDirectory,
 };
 
+// Indicates if a policy allows every access, with real timestamps, and reports none; untracked scopes have such a policy.
+// Accesses under it need no access check, report, USN, or metadata override.
+inline bool IsTransparentPolicy(FileAccessPolicy policy)
+{
+    const int allowEverything = FileAccessPolicy_AllowAll | FileAccessPolicy_AllowSymlinkCreation | FileAccessPolicy_AllowRealInputTimestamps;
+    const int reportAnything = FileAccessPolicy_ReportAccess | FileAccessPolicy_ReportUsnAfterOpen | FileAccessPolicy_ReportDirectoryEnumerationAccess;
+
+    return (policy & allowEverything) == allowEverything && (policy & reportAnything) == 0 && (policy & FileAccessPolicy_MaterializeOnOpen) == 0;
+}
+
 // Keep this in sync with the C# version declared in FileAccessStatus.cs
 enum FileAccessStatus
 {
@@ -153,11 +217,26 @@ enum ProcessDetouringStatus
     ProcessDetouringStatus_Injecting = 3,
     ProcessDetouringStatus_Resuming = 4,
     ProcessDetouringStatus_Resumed = 5,
+    ProcessDetouringStatus_Retrying = 6,
     ProcessDetouringStatus_Cleanup = 7,
     ProcessDetouringStatus_Done = 8,
     ProcessDetouringStatus_Max = 9,
 };
 
+// Time (in microseconds) InternalCreateDetouredProcess spent in each step of creating a child, reported with
+// ProcessDetouringStatus_Done. Steps that did not run are 0.
+typedef struct ProcessDetouringTimings_t
+{
+    // Building the PROC_THREAD_ATTRIBUTE_LIST for the child (only when BuildXL starts the process itself).
+    uint32_t AttributesMicroseconds;
+    // The real CreateProcessW, including the retries on ERROR_ACCESS_DENIED.
+    uint32_t CreateProcessMicroseconds;
+    // Injecting detours and the payload into the child.
+    uint32_t InjectionMicroseconds;
+    // Assigning the child to the job and resuming its main thread.
+    uint32_t ResumeMicroseconds;
+} ProcessDetouringTimings;
+
 // Keep this in sync with the C# version declared in ReportType.cs
 enum ReportType
 {
@@ -167,9 +246,153 @@ enum ReportType
     ReportType_DebugMessage = 3,
     ReportType_ProcessData = 4,
     ReportType_ProcessDetouringStatus = 5,
-    ReportType_Max = 6,
+    ReportType_OutputContentHash = 6,
+    ReportType_Max = 7,
+};
+
+// Status of a ReportType_OutputContentHash report, which is sent as
+//   <report type>,<process id>|<path id>|<status>|<64 hex digits of the VSO0 hash>|<length>|<last write time>|<path>
+//
+// Keep this in sync with the C# version declared in SandboxedProcessReports.cs
+enum OutputContentHashStatus
+{
+    OutputContentHashStatus_Hashed = 0,
+    OutputContentHashStatus_Invalidated = 1,
 };
 
+// A ProcessDetouringStatus report carries the command line of the child process as
+//   COMMAND_LINE_HASH_MARKER <16 hex digits of its hash> '=' <command line>
+// the first time the reporting process sends it, and as just
+//   COMMAND_LINE_HASH_MARKER <16 hex digits of its hash>
+// afterwards. Without the marker, the field is the command line itself.
+//
+// Keep this in sync with the C# version declared in SandboxedProcessReports.cs
+#define COMMAND_LINE_HASH_MARKER L'\x1'
+
+// ==========================================================================
+// == Binary report records
+// ==========================================================================
+//
+// When FileAccessManifestExtraFlag::UseBinaryReportFormat is set, every message written to the report
+// file is a ReportRecordHeader followed by (Size - sizeof(ReportRecordHeader)) bytes of body.
+// File access reports use the fixed-layout FileAccessReportRecord below, and process detouring status reports the
+// ProcessDetouringStatusRecord. All other report types carry their regular text line (including the report type prefix
+// and the trailing "\r\n") as UTF-16 code units, so the consumer can hand them to the existing line parser.
+//
+// With FileAccessManifestExtraFlag::SequenceReports, every record carries a number taken from a counter shared by all the
+// detoured processes of the pip, in the order the reports were produced. Buffered or queued reports of several processes
+// may reach the consumer out of order; sorting them by sequence restores it. A sequence of 0 means the record is not
+// ordered (e.g. debug messages, or the shared counter could not be opened).
+//
+// Keep this in sync with the C# version declared in SandboxedProcessReports.cs
+//
+#define REPORT_RECORD_VERSION 5
+
+// FileAccessReportRecord::PathFlags
+//
+// With FileAccessManifestExtraFlag::InternReportedPaths, a path is sent only the first time a process reports it.
+// That record carries the string and defines a process-local id for it; later records carry just the id.
+// Paths that exactly match a manifest node are not sent at all; the consumer uses the path of the node named by PathId.
+#define REPORT_RECORD_PATH_IS_MANIFEST_PATH   0x1
+#define REPORT_RECORD_PATH_DEFINES_LOCAL_ID   0x2
+#define REPORT_RECORD_PATH_USES_LOCAL_ID      0x4
+
+typedef struct ReportRecordHeader_t
+{
+    // Total size of the record in bytes, including this header.
+    uint32_t Size;
+    // REPORT_RECORD_VERSION
+    uint16_t Version;
+    // ReportType
+    uint16_t Type;
+    // Position of the report among the reports of the pip, or 0.
+    uint64_t Sequence;
+} ReportRecordHeader;
+
+typedef struct FileAccessReportRecord_t
+{
+    ReportRecordHeader  Header;
+    uint32_t            ProcessId;
+    uint32_t            RequestedAccess;
+    uint32_t            Status;
+    uint32_t            ExplicitlyReported;
+    uint32_t            Error;
+    uint32_t            DesiredAccess;
+    uint32_t            ShareMode;
+    uint32_t            CreationDisposition;
+    uint32_t            FlagsAndAttributes;
+    uint32_t            PathId;
+    uint64_t            Usn;
+
+    // Lengths (in UTF-16 code units) of the strings following the record.
+    // The strings are laid out in this order and are not null-terminated.
+    uint32_t            OperationLength;
+    uint32_t            PathLength;
+    uint32_t            FilterLength;
+    uint32_t            CommandLineLength;
+
+    // Process-local id of the path (see REPORT_RECORD_PATH_* flags), or 0.
+    uint32_t            LocalPathId;
+    uint32_t            PathFlags;
+
+    // Identity of the accessed file (the volume serial number and the 128-bit file id of FILE_ID_INFO), when Detours got it at
+    // no extra cost, e.g. along with the USN of the file. Consumers can key files by it instead of by path. All zeros if unknown.
+    uint64_t            VolumeSerialNumber;
+    uint64_t            FileIdLow;
+    uint64_t            FileIdHigh;
+} FileAccessReportRecord;
+
+// ProcessDetouringStatusRecord::Flags
+//
+// The command line of the child is only sent in full in the first status a process reports for it, and by CommandLineHash alone
+// afterwards (the same scheme as COMMAND_LINE_HASH_MARKER for text reports).
+#define REPORT_RECORD_COMMAND_LINE_SENT_BEFORE  0x1
+#define REPORT_RECORD_NO_APPLICATION_NAME       0x2
+
+typedef struct ProcessDetouringStatusRecord_t
+{
+    ReportRecordHeader  Header;
+    uint32_t            ProcessId;
+    uint32_t            Status;
+    uint32_t            NeedsInjection;
+    uint32_t            DisableDetours;
+    uint32_t            CreationFlags;
+    uint32_t            Detoured;
+    uint32_t            Error;
+    uint32_t            CreateProcessStatus;
+    uint64_t            Job;
+
+    // FNV-1a hash of the command line of the child over its UTF-16 code units, or 0 if the command line is not hashed.
+    uint64_t            CommandLineHash;
+
+    // Lengths (in UTF-16 code units) of the strings following the record.
+    // The strings are laid out in this order and are not null-terminated.
+    uint32_t            ProcessNameLength;
+    uint32_t            ApplicationNameLength;
+    uint32_t            CommandLineLength;
+
+    // REPORT_RECORD_COMMAND_LINE_SENT_BEFORE, REPORT_RECORD_NO_APPLICATION_NAME
+    uint32_t            Flags;
+
+    // Time spent in each step of creating the child, see ProcessDetouringTimings. Only set for ProcessDetouringStatus_Done.
+    uint32_t            AttributesMicroseconds;
+    uint32_t            CreateProcessMicroseconds;
+    uint32_t            InjectionMicroseconds;
+    uint32_t            ResumeMicroseconds;
+} ProcessDetouringStatusRecord;
+
+static_assert(sizeof(ReportRecordHeader) == 16, "ReportRecordHeader layout is part of the report protocol");
+static_assert(sizeof(FileAccessReportRecord) == 112, "FileAccessReportRecord layout is part of the report protocol");
+static_assert(sizeof(ProcessDetouringStatusRecord) == 96, "ProcessDetouringStatusRecord layout is part of the report protocol");
+
+inline void InitializeReportRecordHeader(ReportRecordHeader& header, ReportType type, size_t size, uint64_t sequence = 0)
+{
+    header.Size = static_cast<uint32_t>(size);
+    header.Version = REPORT_RECORD_VERSION;
+    header.Type = static_cast<uint16_t>(type);
+    header.Sequence = sequence;
+}
+
 // Keep this in sync with the C# version declared in FileAccessManifest.cs
 enum FileAccessBucketOffsetFlag
 {
@@ -539,6 +762,299 @@ typedef struct ManifestDllBlock_t
 } ManifestDllBlock;
 typedef const ManifestDllBlock * PCManifestDllBlock;
 
+// ==========================================================================
+// == ManifestSuffixPolicies
+// ==========================================================================
+// Policies of the files whose name ends with a suffix starting with a dot (an extension, such as ".pdb", or a longer
+// suffix, such as ".g.cs"), which would otherwise each need a record in the manifest tree. The policy of such a file
+// is the one the tree gives it, masked and extended as by a scope (policy & Mask | Values), using the longest suffix
+// of its name in the table.
+//
+// The table is built by FileAccessManifest.cs: a hash table of the normalized suffixes with linear probing, which
+// always has an empty bucket.
+typedef struct ManifestSuffixPolicies_t
+{
+    GENERATE_TAG("ManifestSuffixPolicies", 0x5FF1C5B1)
+
+    typedef uint32_t    OffsetType;
+    typedef uint32_t    HashType;
+    typedef uint32_t    PolicyType;
+
+    // Longest suffix the table holds (enforced by FileAccessManifest.cs). Only the suffixes of a name up to that length are
+    // looked up, so that a name with many dots costs no more than one with a few. Keep in sync with FileAccessManifest.cs.
+    static const size_t MaxSuffixLength = 32;
+
+    struct Entry
+    {
+        HashType        Hash;
+        PolicyType      Mask;
+        PolicyType      Values;
+        OffsetType      SuffixOffset; // in bytes, from the start of Buckets; 0 for an empty bucket
+    };
+
+    OffsetType          StringBlockSize;
+    OffsetType          BucketCount;
+    Entry               Buckets[ANYSIZE_ARRAY];
+    // The normalized suffixes (NUL-terminated, and padded to 4 bytes) follow the buckets
+    // PathChar            StringBlock[ANYSIZE_ARRAY];
+
+    inline PCPathChar GetSuffix(Entry const& entry) const
+    {
+        assert(entry.SuffixOffset != 0);
+        return reinterpret_cast<PCPathChar>(reinterpret_cast<const BYTE *>(Buckets) + entry.SuffixOffset);
+    }
+
+    size_t GetSize() const
+    {
+        size_t size = 0;
+
+#ifdef _DEBUG
+        size += sizeof(TagType);
+#endif
+        // Two count values + variable number of buckets
+        size += sizeof(OffsetType) * 2 + sizeof(Entry) * BucketCount;
+        size += StringBlockSize;
+
+        return size;
+    }
+
+    // Finds the longest suffix of a file name (the final component of a path) in the table. Defined in PolicySearch.cpp.
+    __success(return)
+    bool TryFindSuffixPolicy(
+        __in  PCPathChar fileName,
+        __in  size_t fileNameLength,
+        __out PolicyType& mask,
+        __out PolicyType& values) const;
+} ManifestSuffixPolicies;
+typedef const ManifestSuffixPolicies * PCManifestSuffixPolicies;
+
+// ==========================================================================
+// == ManifestFileMetadata
+// ==========================================================================
+// Attributes, size and timestamps of declared inputs, which BuildXL already knows (their content is hashed), so that probing
+// the attributes of such a file can be answered without querying the file system. An entry applies to the manifest record with
+// its PathId, and only when that record matches the probed path exactly.
+//
+// The entries are written by FileAccessManifest.cs, sorted by PathId. Timestamps are FILETIMEs, split as in FILETIME.
+typedef struct ManifestFileMetadata_t
+{
+    GENERATE_TAG("ManifestFileMetadata", 0xF11EDA7A)
+
+    struct Timestamp
+    {
+        DWORD           LowDateTime;
+        DWORD           HighDateTime;
+    };
+
+    struct Entry
+    {
+        DWORD           PathId;
+        DWORD           FileAttributes;
+        Timestamp       CreationTime;
+        Timestamp       LastAccessTime;
+        Timestamp       LastWriteTime;
+        DWORD           FileSizeHigh;
+        DWORD           FileSizeLow;
+    };
+
+    uint32_t            EntryCount;
+    Entry               Entries[ANYSIZE_ARRAY];
+
+    size_t GetSize() const
+    {
+        size_t size = 0;
+
+#ifdef _DEBUG
+        size += sizeof(TagType);
+#endif
+        size += sizeof(uint32_t) + sizeof(Entry) * EntryCount;
+
+        return size;
+    }
+
+    // Finds the entry of a manifest record by its PathId, or returns nullptr.
+    const Entry* FindEntry(DWORD pathId) const
+    {
+        uint32_t low = 0;
+        uint32_t high = EntryCount;
+        while (low < high)
+        {
+            uint32_t middle = low + (high - low) / 2;
+            if (Entries[middle].PathId < pathId)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        return low < EntryCount && Entries[low].PathId == pathId ? &Entries[low] : nullptr;
+    }
+} ManifestFileMetadata;
+typedef const ManifestFileMetadata * PCManifestFileMetadata;
+
+// ==========================================================================
+// == ManifestBreakawayChildProcesses
+// ==========================================================================
+// Image names of the child processes that are started outside of the job of the pip and without detours, such as compiler
+// servers meant to outlive the pip.
+//
+// The names are written by FileAccessManifest.cs as null-terminated UTF-16 strings, one after the other. CharCount is kept even
+// (with an extra null if needed) so that the next block stays 4-byte aligned.
+typedef struct ManifestBreakawayChildProcesses_t
+{
+    GENERATE_TAG("ManifestBreakawayChildProcesses", 0xB4EA4A7E)
+
+    uint32_t            CharCount;
+    uint16_t            Names[ANYSIZE_ARRAY];
+
+    size_t GetSize() const
+    {
+        size_t size = 0;
+
+#ifdef _DEBUG
+        size += sizeof(TagType);
+#endif
+        size += sizeof(uint32_t) + sizeof(uint16_t) * CharCount;
+
+        return size;
+    }
+
+    bool IsEmpty() const { return CharCount == 0; }
+} ManifestBreakawayChildProcesses;
+typedef const ManifestBreakawayChildProcesses * PCManifestBreakawayChildProcesses;
+
+// ==========================================================================
+// == ManifestProcessAdmission
+// ==========================================================================
+// The machine-wide event (ProcessAdmissionGate.cs) detoured processes wait on, for at most MaxWaitMs milliseconds (0 for no
+// limit), before they start a child process. BuildXL resets it while the commit charge or the CPU usage is too high.
+//
+// The name is written by FileAccessManifest.cs as a null-terminated UTF-16 string, or not at all (CharCount is 0) when there
+// is no gate. CharCount is kept even (with an extra null if needed) so that the next block stays 4-byte aligned.
+typedef struct ManifestProcessAdmission_t
+{
+    GENERATE_TAG("ManifestProcessAdmission", 0xAD317ED0)
+
+    uint32_t            MaxWaitMs;
+    uint32_t            CharCount;
+    uint16_t            GateName[ANYSIZE_ARRAY];
+
+    size_t GetSize() const
+    {
+        size_t size = 0;
+
+#ifdef _DEBUG
+        size += sizeof(TagType);
+#endif
+        size += sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint16_t) * CharCount;
+
+        return size;
+    }
+
+    bool IsEnabled() const { return CharCount != 0; }
+} ManifestProcessAdmission;
+typedef const ManifestProcessAdmission * PCManifestProcessAdmission;
+
+// ==========================================================================
+// == ManifestTempRedirection
+// ==========================================================================
+// The untracked temp directory of the pip, and the directory, on another (faster) volume, its contents are redirected to
+// (see TempRedirection.h).
+//
+// Both are written by FileAccessManifest.cs as null-terminated UTF-16 Win32 paths without trailing separator, the temp
+// directory first, or not at all (both counts are 0) when there is no redirection. RedirectedCharCount is kept so that the
+// sum of the counts is even (with an extra null if needed), so that the next block stays 4-byte aligned.
+typedef struct ManifestTempRedirection_t
+{
+    GENERATE_TAG("ManifestTempRedirection", 0x7E3D1EC7)
+
+    uint32_t            TempCharCount;
+    uint32_t            RedirectedCharCount;
+    uint16_t            Paths[ANYSIZE_ARRAY];
+
+    size_t GetSize() const
+    {
+        size_t size = 0;
+
+#ifdef _DEBUG
+        size += sizeof(TagType);
+#endif
+        size += sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint16_t) * (TempCharCount + RedirectedCharCount);
+
+        return size;
+    }
+
+    bool IsEnabled() const { return TempCharCount != 0 && RedirectedCharCount != 0; }
+
+    const uint16_t* GetTempDirectory() const { return Paths; }
+
+    const uint16_t* GetRedirectedDirectory() const { return Paths + TempCharCount; }
+} ManifestTempRedirection;
+typedef const ManifestTempRedirection * PCManifestTempRedirection;
+
+// ==========================================================================
+// == ManifestLookupProfile
+// ==========================================================================
+// Whether the detoured processes count the lookups of the manifest tree that find a node, per node and per number of probes, in the
+// mapping FileAccessManifest.cs creates for the pip (see LookupProfile.h).
+typedef struct ManifestLookupProfile_t
+{
+    GENERATE_TAG("ManifestLookupProfile", 0x10C0C0DE)
+
+    uint32_t            Enabled;
+
+    size_t GetSize() const
+    {
+        size_t size = 0;
+
+#ifdef _DEBUG
+        size += sizeof(TagType);
+#endif
+        size += sizeof(uint32_t);
+
+        return size;
+    }
+
+    bool IsEnabled() const { return Enabled != 0; }
+} ManifestLookupProfile;
+typedef const ManifestLookupProfile * PCManifestLookupProfile;
+
+// ==========================================================================
+// == ManifestProcessPriority
+// ==========================================================================
+// The priorities of the processes of the pip (see ProcessPriority.h): the priority class, as the flag CreateProcess takes for it
+// (IDLE_PRIORITY_CLASS, BELOW_NORMAL_PRIORITY_CLASS, ...), and the I/O priority, as 1 + its IO_PRIORITY_HINT. 0 leaves either
+// to the processes.
+typedef struct ManifestProcessPriority_t
+{
+    GENERATE_TAG("ManifestProcessPriority", 0x9A1057ED)
+
+    uint32_t            PriorityClass;
+    uint32_t            IoPriority;
+
+    size_t GetSize() const
+    {
+        size_t size = 0;
+
+#ifdef _DEBUG
+        size += sizeof(TagType);
+#endif
+        size += sizeof(uint32_t) + sizeof(uint32_t);
+
+        return size;
+    }
+
+    bool HasPriorityClass() const { return PriorityClass != 0; }
+
+    bool HasIoPriority() const { return IoPriority != 0; }
+
+    uint32_t GetIoPriorityHint() const { return IoPriority - 1; }
+} ManifestProcessPriority;
+typedef const ManifestProcessPriority * PCManifestProcessPriority;
+
 // ==========================================================================
 // == ManifestRecord
 // ==========================================================================
@@ -556,14 +1072,79 @@ typedef struct ManifestRecord_t
     typedef uint32_t    ChildOffsetType;
     typedef PCPathChar  PartialPathType;
 
+    // The high bits of BucketCount tell how the record is laid out; the number of buckets is in the other bits.
+    static const BucketCountType BucketCountMask = 0x0FFFFFFF;
+
+    // Manifest tree format v2: each bucket holds the hash of the partial path of its child next to its offset, so that
+    // FindChild rejects most mismatching children without reading their record. The records start on cache line
+    // boundaries (counting from the root record), and the children of a record follow each other.
+    static const BucketCountType InlineChildHashesFlag = 0x80000000;
+
+    // The buckets are a minimal perfect hash table of the children (built for records with many children, or with long
+    // collision chains, by FileAccessManifest.cs): there is one bucket per child, no collision chain, and GetPerfectHashBucket tells the only
+    // bucket a partial path can be in. The seeds of the table follow the buckets.
+    static const BucketCountType PerfectHashFlag = 0x40000000;
+
+    // Children per seed of a perfect hash table. Keep in sync with FileAccessManifest.cs.
+    static const BucketCountType PerfectHashChildrenPerSeed = 4;
+
+    // Most buckets FindChild probes in a regular table: FileAccessManifest.cs gives a perfect hash table to the records whose
+    // children would otherwise make longer collision chains (unless some of them have the same hash, which no table separates).
+    // Keep in sync with FileAccessManifest.cs.
+    static const BucketCountType MaxCollisionChainProbes = 16;
+
     HashType            Hash;
     PolicyType          ConePolicy;
     PolicyType          NodePolicy;
     PathIdType          PathId;
     ExpectedUsnPartType ExpectedUsnLo, ExpectedUsnHi; // we split this value up as we don't want to introduce 64-bit alignment here (USN is a 64-bit integer)
-    BucketCountType     BucketCount;
-    ChildOffsetType     Buckets[ANYSIZE_ARRAY];
-    // PartialPathType PartialPath (after the end of the Buckets array)
+    BucketCountType     BucketCount; // use GetBucketCount()
+    ChildOffsetType     Buckets[ANYSIZE_ARRAY]; // (offset, hash) pairs with InlineChildHashesFlag
+    // ChildOffsetType PerfectHashSeeds[GetPerfectHashSeedCount()] (after the end of the Buckets array, with PerfectHashFlag)
+    // PartialPathType PartialPath (after the end of the Buckets array, or of the seeds)
+
+    inline BucketCountType GetBucketCount() const {
+        return this->BucketCount & BucketCountMask;
+    }
+
+    inline bool HasInlineChildHashes() const {
+        return (this->BucketCount & InlineChildHashesFlag) != 0;
+    }
+
+    // Number of ChildOffsetType values per bucket.
+    inline BucketCountType GetBucketStride() const {
+        return HasInlineChildHashes() ? 2 : 1;
+    }
+
+    inline ChildOffsetType GetChildOffset(BucketCountType index) const {
+        assert(index < GetBucketCount());
+        return this->Buckets[index * GetBucketStride()];
+    }
+
+    inline bool HasPerfectHash() const {
+        return (this->BucketCount & PerfectHashFlag) != 0;
+    }
+
+    inline BucketCountType GetPerfectHashSeedCount() const {
+        return HasPerfectHash() ? (GetBucketCount() + PerfectHashChildrenPerSeed - 1) / PerfectHashChildrenPerSeed : 0;
+    }
+
+    // The only bucket the child with the given hash can be in, with PerfectHashFlag only. Keep in sync with
+    // FileAccessManifest.cs.
+    inline BucketCountType GetPerfectHashBucket(HashType hash) const {
+        assert(HasPerfectHash());
+        const ChildOffsetType *seeds = &(this->Buckets[GetBucketCount() * GetBucketStride()]);
+        uint32_t mixed = (static_cast<uint32_t>(hash) ^ seeds[hash % GetPerfectHashSeedCount()]) * 0x85EBCA6Bu;
+        mixed ^= mixed >> 13;
+        return mixed % GetBucketCount();
+    }
+
+    // The hash of the partial path of the child in a bucket, with InlineChildHashesFlag only.
+    inline HashType GetInlineChildHash(BucketCountType index) const {
+        assert(index < GetBucketCount());
+        assert(HasInlineChildHashes());
+        return static_cast<HashType>(this->Buckets[index * 2 + 1]);
+    }
 
     inline USN GetExpectedUsn() const {
         return (((USN)this->ExpectedUsnHi) << 32) | this->ExpectedUsnLo;
@@ -583,11 +1164,15 @@ typedef struct ManifestRecord_t
         return static_cast<FileAccessPolicy>(this->NodePolicy);
     }
 
+    // Indicates if this record and everything below it is transparent (see IsTransparentPolicy): there are no records
+    // below it that could refine its transparent policies.
+    inline bool IsTransparentScope() const {
+        return GetBucketCount() == 0 && IsTransparentPolicy(GetConePolicy()) && IsTransparentPolicy(GetNodePolicy());
+    }
+
     PCManifestRecord GetChildRecord(BucketCountType index) const
     {
-        assert(index < this->BucketCount);
-
-        ChildOffsetType childOffset = this->Buckets[index];
+        ChildOffsetType childOffset = GetChildOffset(index);
         if (childOffset == 0)
         {
             return nullptr;
@@ -601,24 +1186,20 @@ typedef struct ManifestRecord_t
 
     bool IsCollisionChainStart(BucketCountType index) const
     {
-        assert(index < this->BucketCount);
-
-        ChildOffsetType childOffset = this->Buckets[index];
+        ChildOffsetType childOffset = GetChildOffset(index);
         return (childOffset & FileAccessBucketOffsetFlag::ChainStart) != 0;
     }
 
     bool IsCollisionChainContinuation(BucketCountType index) const
     {
-        assert(index < this->BucketCount);
-
-        ChildOffsetType childOffset = this->Buckets[index];
+        ChildOffsetType childOffset = GetChildOffset(index);
         return (childOffset & FileAccessBucketOffsetFlag::ChainContinuation) != 0;
     }
 
     PartialPathType GetPartialPath() const
     {
-        BucketCountType numBuckets = this->BucketCount;
-        PartialPathType path = reinterpret_cast<PartialPathType>(&(this->Buckets[numBuckets]));
+        BucketCountType numBuckets = GetBucketCount();
+        PartialPathType path = reinterpret_cast<PartialPathType>(&(this->Buckets[numBuckets * GetBucketStride() + GetPerfectHashSeedCount()]));
 
         return path;
     }
@@ -628,6 +1209,14 @@ typedef struct ManifestRecord_t
         __in  PCPathChar target,
         __in  size_t targetLength,
         __out PCManifestRecord& child) const;
+
+    // Same as above, for a target whose HashPath hash is already known.
+    __success(return)
+    bool FindChild(
+        __in  PCPathChar target,
+        __in  size_t targetLength,
+        __in  DWORD hash,
+        __out PCManifestRecord& child) const;
 } ManifestRecord;
 typedef const ManifestRecord * PCManifestRecord; // duplicated for use in scopes outside of the struct
 
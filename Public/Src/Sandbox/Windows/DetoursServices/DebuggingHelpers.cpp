@@ -8,6 +8,7 @@
 #include "FileAccessHelpers.h"
 #include "DetoursServices.h"
 #include "DetoursHelpers.h"
+#include "DetouredScope.h"
 #include "buildXL_mem.h"
 
 using std::unique_ptr;
@@ -18,12 +19,50 @@ using std::unique_ptr;
 
 #define SUPER_VERBOSE 0
 
+// Debug messages queued with FileAccessManifestExtraFlag::LogDebugMessagesAsynchronously (a power of two), the length they are
+// truncated to, and how many messages a single Dbg call site may queue per second.
+#define DEBUG_MESSAGE_RING_SLOTS 256
+#define DEBUG_MESSAGE_MAX_LENGTH 512
+#define DEBUG_MESSAGE_CALLSITE_SLOTS 64
+#define DEBUG_MESSAGES_PER_CALLSITE_PER_SECOND 32
+
 // ----------------------------------------------------------------------------
 // STATIC FUNCTIONS
 // ----------------------------------------------------------------------------
 
 #ifdef DETOURS_SERVICES_NATIVES_LIBRARY
 
+// A slot of the ring of debug messages. Sequence tells the slot's state relative to the position that writes or reads it next:
+// equal to it when the slot is free to be written, one past it once the message is ready to be read.
+struct DebugMessageSlot
+{
+    volatile LONG64 Sequence;
+    wchar_t Text[DEBUG_MESSAGE_MAX_LENGTH];
+};
+
+// The call sites (format strings) debug messages were queued from in the current one-second window, hashed by address.
+// Call sites colliding in the table reset each other's window, which only lets more messages through.
+struct DebugMessageCallsite
+{
+    PCWSTR volatile Format;
+    volatile ULONGLONG WindowStart;
+    volatile LONG Count;
+};
+
+static DebugMessageSlot* g_debugMessageRing = nullptr;
+static DebugMessageCallsite g_debugMessageCallsites[DEBUG_MESSAGE_CALLSITE_SLOTS];
+static volatile LONG64 g_debugMessageRingHead = 0;
+static LONG64 g_debugMessageRingTail = 0;
+static volatile LONG64 g_debugMessagesDropped = 0;
+static LONG64 g_debugMessagesDroppedReported = 0;
+static bool g_debugMessageRingEnabled = false;
+static HANDLE g_debugMessageEvent = NULL;
+static volatile LONG g_debugMessageWriterStarted = 0;
+static volatile LONG g_debugMessageWriterIdle = 0;
+static CRITICAL_SECTION g_debugMessageDrainLock;
+
+static void WriteDebugMessageLine(std::wstring const& text);
+
 std::wstring DebugStringFormatArgs(PCWSTR formattedString, va_list args) {
     std::wstring failed = std::wstring(L"Failed DebuggingHelpers::DebugStringFormatArgs");
     int neededLength = _vscwprintf(formattedString, args);
@@ -123,15 +162,244 @@ void HandleDetoursInjectionAndCommunicationErrors(int errorCode, LPCWSTR eventLo
     }
 }
 
+/// <summary>
+/// Whether a call site has queued its share of debug messages for the current second already.
+/// </summary>
+static bool IsDebugMessageRateLimited(PCWSTR format)
+{
+    uint64_t hash = (uint64_t)(uintptr_t)format * 0x9E3779B97F4A7C15ull;
+    DebugMessageCallsite& callsite = g_debugMessageCallsites[hash >> 58];
+    static_assert(DEBUG_MESSAGE_CALLSITE_SLOTS == 64, "The call site table is indexed by the top 6 bits of the hash");
+
+    ULONGLONG now = GetTickCount64();
+    if (callsite.Format != format || now - callsite.WindowStart >= 1000)
+    {
+        callsite.Format = format;
+        callsite.WindowStart = now;
+        callsite.Count = 1;
+        return false;
+    }
+
+    return InterlockedIncrement(&callsite.Count) > DEBUG_MESSAGES_PER_CALLSITE_PER_SECOND;
+}
+
+/// <summary>
+/// Writes the ready messages of the ring, oldest first. Must be called with g_debugMessageDrainLock held (or from DllProcessDetach).
+/// </summary>
+static void DrainDebugMessageRingLocked()
+{
+    while (true)
+    {
+        DebugMessageSlot& slot = g_debugMessageRing[g_debugMessageRingTail & (DEBUG_MESSAGE_RING_SLOTS - 1)];
+        if (slot.Sequence != g_debugMessageRingTail + 1)
+        {
+            break;
+        }
+
+        MemoryBarrier();
+        std::wstring text(slot.Text);
+
+        // Free the slot for the writer that wraps around to it.
+        InterlockedExchange64(&slot.Sequence, g_debugMessageRingTail + DEBUG_MESSAGE_RING_SLOTS);
+        g_debugMessageRingTail++;
+
+        WriteDebugMessageLine(text);
+    }
+
+    LONG64 dropped = g_debugMessagesDropped;
+    if (dropped != g_debugMessagesDroppedReported)
+    {
+        WriteDebugMessageLine(DebugStringFormat(L"%I64d debug messages were dropped (%I64d in total).", dropped - g_debugMessagesDroppedReported, dropped));
+        g_debugMessagesDroppedReported = dropped;
+    }
+}
+
+static DWORD WINAPI DebugMessageWriter(LPVOID lpParam)
+{
+    UNREFERENCED_PARAMETER(lpParam);
+
+    // Whatever this thread does is on behalf of the messages it writes, so keep its own calls out of the reports.
+    DetouredScope scope;
+
+    while (true)
+    {
+        InterlockedExchange(&g_debugMessageWriterIdle, 1);
+        WaitForSingleObject(g_debugMessageEvent, INFINITE);
+        FlushDebugMessages(false);
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Starts the debug message writer on first use after DllProcessAttach, to stay clear of the loader lock.
+/// Messages queued before then wait for it (or for DllProcessDetach).
+/// </summary>
+static void EnsureDebugMessageWriterStarted()
+{
+    extern bool g_isAttached;
+    if (!g_isAttached || g_debugMessageWriterStarted != 0 || InterlockedCompareExchange(&g_debugMessageWriterStarted, 1, 0) != 0)
+    {
+        return;
+    }
+
+    HANDLE threadHandle = CreateThread(NULL, 0, DebugMessageWriter, nullptr, 0, nullptr);
+    if (threadHandle == NULL)
+    {
+        // Fall back to writing messages synchronously; the queued ones go out with the next flush.
+        g_debugMessageRingEnabled = false;
+        return;
+    }
+
+    CloseHandle(threadHandle);
+}
+
+/// <summary>
+/// Formats a debug message into the ring for the writer thread. Returns false if the caller has to write it itself.
+/// </summary>
+static bool TryQueueDebugMessage(PCWSTR format, va_list args)
+{
+    if (!g_debugMessageRingEnabled)
+    {
+        return false;
+    }
+
+    if (IsDebugMessageRateLimited(format))
+    {
+        InterlockedIncrement64(&g_debugMessagesDropped);
+        return true;
+    }
+
+    LONG64 position = g_debugMessageRingHead;
+    DebugMessageSlot* slot;
+    while (true)
+    {
+        slot = &g_debugMessageRing[position & (DEBUG_MESSAGE_RING_SLOTS - 1)];
+        LONG64 sequence = slot->Sequence;
+        if (sequence == position)
+        {
+            LONG64 observed = InterlockedCompareExchange64(&g_debugMessageRingHead, position + 1, position);
+            if (observed == position)
+            {
+                break;
+            }
+
+            position = observed;
+        }
+        else if (sequence < position)
+        {
+            // The ring is full.
+            InterlockedIncrement64(&g_debugMessagesDropped);
+            return true;
+        }
+        else
+        {
+            position = g_debugMessageRingHead;
+        }
+    }
+
+    if (_vsnwprintf_s(slot->Text, DEBUG_MESSAGE_MAX_LENGTH, _TRUNCATE, format, args) < 0 && slot->Text[0] == L'\0')
+    {
+        wcscpy_s(slot->Text, L"Failed DebuggingHelpers::TryQueueDebugMessage");
+    }
+
+    DebuggerOutputDebugString(slot->Text, false);
+
+    // Publish the message.
+    InterlockedExchange64(&slot->Sequence, position + 1);
+
+    EnsureDebugMessageWriterStarted();
+    if (g_debugMessageWriterIdle != 0 && InterlockedExchange(&g_debugMessageWriterIdle, 0) != 0)
+    {
+        SetEvent(g_debugMessageEvent);
+    }
+
+    return true;
+}
+
+void InitializeDebugMessageRing()
+{
+    if (!LogDebugMessagesAsynchronously() || g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    g_debugMessageEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (g_debugMessageEvent == NULL)
+    {
+        return;
+    }
+
+    g_debugMessageRing = new (std::nothrow) DebugMessageSlot[DEBUG_MESSAGE_RING_SLOTS];
+    if (g_debugMessageRing == nullptr)
+    {
+        CloseHandle(g_debugMessageEvent);
+        g_debugMessageEvent = NULL;
+        return;
+    }
+
+    for (LONG64 i = 0; i < DEBUG_MESSAGE_RING_SLOTS; i++)
+    {
+        g_debugMessageRing[i].Sequence = i;
+    }
+
+    InitializeCriticalSection(&g_debugMessageDrainLock);
+    g_debugMessageRingEnabled = true;
+}
+
+void FlushDebugMessages(bool processDetach)
+{
+    if (g_debugMessageRing == nullptr)
+    {
+        return;
+    }
+
+    if (processDetach)
+    {
+        // On process exit all other threads are already gone, and the writer may have been holding the lock.
+        // Queueing is turned off afterwards so that messages logged while detaching are written directly.
+        g_debugMessageRingEnabled = false;
+        bool acquired = TryEnterCriticalSection(&g_debugMessageDrainLock) != FALSE;
+        DrainDebugMessageRingLocked();
+
+        if (acquired)
+        {
+            LeaveCriticalSection(&g_debugMessageDrainLock);
+        }
+
+        return;
+    }
+
+    EnterCriticalSection(&g_debugMessageDrainLock);
+    DrainDebugMessageRingLocked();
+    LeaveCriticalSection(&g_debugMessageDrainLock);
+}
+
 void Dbg(PCWSTR format, ...)
 {
     va_list args;
+    va_start(args, format);
+    bool queued = TryQueueDebugMessage(format, args);
+    va_end(args);
+
+    if (queued)
+    {
+        return;
+    }
+
     va_start(args, format);
     std::wstring resultArgs = DebugStringFormatArgs(format, args);
     va_end(args);
 
     DebuggerOutputDebugString(resultArgs.c_str(), false);
+    WriteDebugMessageLine(resultArgs);
+}
 
+/// <summary>
+/// Sends a debug message to the report channel as a ReportType_DebugMessage line.
+/// </summary>
+static void WriteDebugMessageLine(std::wstring const& resultArgs)
+{
     if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
         return;
     }
@@ -153,6 +421,17 @@ void Dbg(PCWSTR format, ...)
     overlapped.OffsetHigh = 0xFFFFFFFF;
 
     size_t bufferLength = sizeof(wchar_t) * report.length(); // The size should be in bytes.
+
+    std::vector<char> record;
+    if (CheckUseBinaryReportFormat(g_fileAccessManifestExtraFlags)) {
+        // Frame the text line as a binary report record so that it can share the stream with binary file access reports.
+        record.resize(sizeof(ReportRecordHeader) + bufferLength);
+        InitializeReportRecordHeader(*reinterpret_cast<ReportRecordHeader*>(record.data()), ReportType_DebugMessage, record.size());
+        memcpy(record.data() + sizeof(ReportRecordHeader), buffer, bufferLength);
+        buffer = reinterpret_cast<PCWSTR>(record.data());
+        bufferLength = record.size();
+    }
+
     DWORD bytesWritten;
     DWORD lastError = GetLastError();
     if (!WriteFile(g_reportFileHandle, buffer, (DWORD)bufferLength, &bytesWritten, &overlapped))
@@ -12,13 +12,20 @@
 std::wstring DebugStringFormatArgs(PCWSTR formattedString, va_list args);
 std::wstring DebugStringFormat(PCWSTR formattedString, ...);
 
-#if MAC_OS_LIBRARY || MAC_OS_SANDBOX
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wmissing-declarations"
-#endif
-
 void DebuggerOutputDebugString(PCWSTR text, bool shouldBreak);
+
+// Dbg, WriteWarningOrErrorF and MaybeBreakOnAccessDenied are no-op macros outside of Windows (see stdafx-mac-common.h).
+#if !(MAC_OS_LIBRARY || MAC_OS_SANDBOX)
 void Dbg(PCWSTR format, ...);
+#endif
+
+/// Sets up the ring of debug messages written by a background thread when FileAccessManifestExtraFlag::LogDebugMessagesAsynchronously
+/// is set. Must be called after the file access manifest has been parsed.
+void InitializeDebugMessageRing();
+
+/// Writes out the debug messages queued so far from the calling thread. Pass processDetach when called from DllProcessDetach,
+/// which also turns queueing off.
+void FlushDebugMessages(bool processDetach);
 
 /*
 
@@ -40,10 +47,8 @@ contain characters outside of ASCII, most tools will simply pass the encoded for
 mangling it, so UTF-8 is a good "pass-through" encoding.
 
 */
+#if !(MAC_OS_LIBRARY || MAC_OS_SANDBOX)
 void WriteWarningOrErrorF(PCWSTR format, ...);
 
 void MaybeBreakOnAccessDenied();
-
-#if MAC_OS_LIBRARY || MAC_OS_SANDBOX
-#pragma clang diagnostic pop
 #endif
@@ -0,0 +1,198 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "DeclaredInputPrefetch.h"
+#include "DebuggingHelpers.h"
+#include "DetouredScope.h"
+#include "DetoursServices.h"
+#include "FileAccessHelpers.h"
+#include "globals.h"
+
+// Appended to the message count semaphore name to form the name of the event marking the pip's inputs as prefetched.
+#define PREFETCH_NAME_SUFFIX L"_DeclaredInputPrefetch"
+
+// Bounds of the prefetch: threads reading at once, files read, and bytes read from each file.
+#define PREFETCH_MAX_THREADS 4
+#define PREFETCH_MAX_FILES 4096
+#define PREFETCH_MAX_BYTES_PER_FILE (16 * 1024 * 1024)
+
+// Size of the reads of the prefetch threads.
+#define PREFETCH_READ_SIZE (256 * 1024)
+
+static volatile LONG g_declaredInputPrefetchStarted = 0;
+
+// Paths of the declared inputs, filled in before the prefetch threads start and immutable afterwards.
+static std::vector<std::wstring>* g_declaredInputs = nullptr;
+
+// Index of the next declared input for a prefetch thread to read.
+static volatile LONG g_nextDeclaredInput = 0;
+
+// Indicates if a manifest record stands for a declared input: a file (leaf) the pip may read but not write, that is already on disk.
+static bool IsDeclaredInput(PCManifestRecord record)
+{
+    FileAccessPolicy policy = record->GetNodePolicy();
+    return record->GetBucketCount() == 0
+        && (policy & FileAccessPolicy_AllowRead) != 0
+        && (policy & (FileAccessPolicy_AllowWrite | FileAccessPolicy_MaterializeOnOpen)) == 0
+        && !IsTransparentPolicy(policy);
+}
+
+/// Collects the paths of the declared inputs below a record, whose path is in 'path', depth first.
+static void CollectDeclaredInputs(PCManifestRecord record, std::wstring& path, std::vector<std::wstring>& inputs)
+{
+    if (IsDeclaredInput(record))
+    {
+        inputs.push_back(path);
+        return;
+    }
+
+    ManifestRecord::BucketCountType numBuckets = record->GetBucketCount();
+    for (ManifestRecord::BucketCountType i = 0; i < numBuckets && inputs.size() < PREFETCH_MAX_FILES; i++)
+    {
+        PCManifestRecord child = record->GetChildRecord(i);
+        if (child == nullptr)
+        {
+            continue;
+        }
+
+        size_t length = path.length();
+        if (length > 0)
+        {
+            path.push_back(L'\\');
+        }
+
+        path.append(child->GetPartialPath());
+        CollectDeclaredInputs(child, path, inputs);
+        path.resize(length);
+    }
+}
+
+static void PrefetchFile(std::wstring const& path, BYTE* buffer)
+{
+    HANDLE file = Real_CreateFileW(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    DWORD bytesRead;
+    for (size_t total = 0; total < PREFETCH_MAX_BYTES_PER_FILE; total += bytesRead)
+    {
+        if (!ReadFile(file, buffer, PREFETCH_READ_SIZE, &bytesRead, NULL) || bytesRead == 0)
+        {
+            break;
+        }
+    }
+
+    Real_CloseHandle(file);
+}
+
+static DWORD WINAPI DeclaredInputPrefetcher(LPVOID lpParam)
+{
+    UNREFERENCED_PARAMETER(lpParam);
+
+    // The prefetch makes no file accesses of the pip: nothing in here gets detoured (and hence reported).
+    DetouredScope scope;
+
+    BYTE* buffer = (BYTE*)VirtualAlloc(NULL, PREFETCH_READ_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (buffer == nullptr)
+    {
+        return 0;
+    }
+
+    LONG count = (LONG)g_declaredInputs->size();
+    for (LONG i = InterlockedIncrement(&g_nextDeclaredInput) - 1; i < count; i = InterlockedIncrement(&g_nextDeclaredInput) - 1)
+    {
+        PrefetchFile((*g_declaredInputs)[i], buffer);
+    }
+
+    VirtualFree(buffer, 0, MEM_RELEASE);
+    return 0;
+}
+
+/// Indicates if this is the first process of the pip to prefetch its inputs; the processes of a pip share its manifest.
+static bool ClaimDeclaredInputPrefetch()
+{
+    if (g_internalDetoursErrorNotificationFile == nullptr)
+    {
+        return true;
+    }
+
+    // Object names don't allow '\\'; use the same derivation as for the message count semaphore.
+    std::wstring name(g_internalDetoursErrorNotificationFile);
+    std::replace(name.begin(), name.end(), L'\\', L'_');
+    name.append(PREFETCH_NAME_SUFFIX);
+
+    // The event stays open for the lifetime of the process, marking the inputs as prefetched while it runs.
+    HANDLE hEvent = CreateEventW(NULL, TRUE, FALSE, name.c_str());
+    if (hEvent == NULL)
+    {
+        return false;
+    }
+
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        CloseHandle(hEvent);
+        return false;
+    }
+
+    return true;
+}
+
+void EnsureDeclaredInputPrefetchStarted()
+{
+    extern bool g_isAttached;
+    if (!PrefetchDeclaredInputs() || !g_isAttached || g_declaredInputPrefetchStarted != 0
+        || InterlockedCompareExchange(&g_declaredInputPrefetchStarted, 1, 0) != 0)
+    {
+        return;
+    }
+
+    if (g_manifestTreeRoot == nullptr || !ClaimDeclaredInputPrefetch())
+    {
+        return;
+    }
+
+    DetouredScope scope;
+
+    std::vector<std::wstring>* inputs = new std::vector<std::wstring>();
+    std::wstring path;
+    CollectDeclaredInputs(g_manifestTreeRoot, path, *inputs);
+    Dbg(L"Prefetching %d declared inputs", (int)inputs->size());
+
+    if (inputs->empty())
+    {
+        delete inputs;
+        return;
+    }
+
+    g_declaredInputs = inputs;
+
+    size_t numThreads = std::min<size_t>(PREFETCH_MAX_THREADS, inputs->size());
+    for (size_t i = 0; i < numThreads; i++)
+    {
+        HANDLE threadHandle = CreateThread(NULL, 0, DeclaredInputPrefetcher, nullptr, 0, nullptr);
+        if (threadHandle == NULL)
+        {
+            // The inputs just get read when the tool gets to them.
+            Dbg(L"Warning: Could not create a declared input prefetch thread. Last Error: %d", (int)GetLastError());
+            break;
+        }
+
+        SetThreadPriority(threadHandle, THREAD_PRIORITY_BELOW_NORMAL);
+        CloseHandle(threadHandle);
+    }
+}
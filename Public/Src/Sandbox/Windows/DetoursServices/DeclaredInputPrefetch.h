@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Read-ahead of the inputs a pip declares in its manifest.
+//
+// With FileAccessManifestExtraFlag::PrefetchDeclaredInputs, the first process of a pip walks the manifest tree once the
+// pip starts accessing files, and a few background threads read the files the manifest declares as inputs (leaves that
+// only allow reads) sequentially, so that the serial reads of the tool find them in the file system cache. The prefetch
+// reads are not reported, and are bounded in the number of threads, of files and of bytes per file. They stop when the
+// process exits.
+
+#pragma once
+
+#include "DataTypes.h"
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Starts prefetching the declared inputs on first call after DllProcessAttach (to stay clear of the loader lock), if enabled
+/// and if no other process of the pip did so already.
+void EnsureDeclaredInputPrefetchStarted();
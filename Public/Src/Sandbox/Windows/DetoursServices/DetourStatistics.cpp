@@ -0,0 +1,354 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DetourStatistics.h"
+#include "DetouredScope.h"
+
+// Number of buckets of the log2 latency histograms.
+#define DETOUR_STATISTICS_HISTOGRAM_BUCKETS 16
+
+// Marks that no detoured call is in progress on the thread.
+#define NO_DETOURED_FUNCTION DetouredFunctionId::Count
+
+// Marks that no region of detour logic is being timed on the thread.
+#define NO_DETOUR_OVERHEAD DetourOverheadCategory::Count
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+struct DetouredFunctionStatistics
+{
+    ULONG64 Calls;
+    ULONG64 RealTicks;
+    ULONG64 DetourTicks;
+    ULONG RealHistogram[DETOUR_STATISTICS_HISTOGRAM_BUCKETS];
+    ULONG DetourHistogram[DETOUR_STATISTICS_HISTOGRAM_BUCKETS];
+};
+
+// The statistics of one thread. The SLIST_ENTRY must come first: blocks are page aligned.
+struct ThreadDetourStatistics
+{
+    SLIST_ENTRY ItemEntry;
+    DetouredFunctionStatistics Functions[(int)DetouredFunctionId::Count];
+    ULONG64 OverheadTicks[(int)DetourOverheadCategory::Count];
+};
+
+// Blocks of all threads that ever recorded a call, including the ones that have exited since.
+// A zeroed SLIST_HEADER is an empty list.
+static SLIST_HEADER g_threadDetourStatistics;
+
+static __declspec(thread) ThreadDetourStatistics* t_detourStatistics = nullptr;
+
+// Depth of the detoured calls in progress on the thread.
+static __declspec(thread) ULONG t_detouredCallDepth = 0;
+
+// The detoured function the real calls made from now on are made for.
+static __declspec(thread) DetouredFunctionId t_realCallFunction = NO_DETOURED_FUNCTION;
+
+// Time spent in the real function during the outermost detoured call in progress.
+static __declspec(thread) LONGLONG t_realTicks = 0;
+
+// The category of detour logic being timed on the thread, and when the thread last entered (or returned to) it.
+static __declspec(thread) DetourOverheadCategory t_overheadCategory = NO_DETOUR_OVERHEAD;
+static __declspec(thread) LONGLONG t_overheadStart = 0;
+
+// ----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+// ----------------------------------------------------------------------------
+
+static LONGLONG PerformanceFrequency()
+{
+    static LONGLONG s_frequency = 0;
+    if (s_frequency == 0)
+    {
+        LARGE_INTEGER frequency;
+        s_frequency = QueryPerformanceFrequency(&frequency) && frequency.QuadPart > 0 ? frequency.QuadPart : 1;
+    }
+
+    return s_frequency;
+}
+
+static inline ULONG64 TicksToMicroseconds(ULONG64 ticks)
+{
+    ULONG64 frequency = (ULONG64)PerformanceFrequency();
+    return (ticks / frequency) * 1000000 + ((ticks % frequency) * 1000000) / frequency;
+}
+
+static inline unsigned HistogramBucket(ULONG64 ticks)
+{
+    unsigned bucket = 0;
+    for (ULONG64 microseconds = TicksToMicroseconds(ticks); microseconds != 0 && bucket < DETOUR_STATISTICS_HISTOGRAM_BUCKETS - 1; microseconds >>= 1)
+    {
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/// <summary>
+/// Returns the block of the calling thread, creating it on first use.
+/// </summary>
+/// <remarks>
+/// The block comes straight from VirtualAlloc: this may run inside NtClose, where taking a heap lock can deadlock.
+/// </remarks>
+static ThreadDetourStatistics* GetThreadDetourStatistics()
+{
+    if (t_detourStatistics == nullptr)
+    {
+        ThreadDetourStatistics* statistics = (ThreadDetourStatistics*)VirtualAlloc(nullptr, sizeof(ThreadDetourStatistics), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (statistics != nullptr)
+        {
+            InterlockedPushEntrySList(&g_threadDetourStatistics, &statistics->ItemEntry);
+            t_detourStatistics = statistics;
+        }
+    }
+
+    return t_detourStatistics;
+}
+
+/// <summary>
+/// Accounts the time since t_overheadStart to the category being timed, if any, and restarts the clock.
+/// </summary>
+static void AccountDetourOverhead(LONGLONG now)
+{
+    if (t_overheadCategory != NO_DETOUR_OVERHEAD && now > t_overheadStart)
+    {
+        ThreadDetourStatistics* statistics = GetThreadDetourStatistics();
+        if (statistics != nullptr)
+        {
+            statistics->OverheadTicks[(int)t_overheadCategory] += (ULONG64)(now - t_overheadStart);
+        }
+    }
+
+    t_overheadStart = now;
+}
+
+static void AppendHistogram(std::wstring& field, ULONG const (&histogram)[DETOUR_STATISTICS_HISTOGRAM_BUCKETS])
+{
+    // Trailing empty buckets are left out.
+    int last = DETOUR_STATISTICS_HISTOGRAM_BUCKETS - 1;
+    while (last > 0 && histogram[last] == 0)
+    {
+        last--;
+    }
+
+    for (int i = 0; i <= last; i++)
+    {
+        if (i > 0)
+        {
+            field.push_back(L'/');
+        }
+
+        field.append(std::to_wstring(histogram[i]));
+    }
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+bool EnterDetouredFunction(DetouredFunctionId function, _Out_ bool& outermost, _Out_ DetouredFunctionId& previousFunction)
+{
+    outermost = t_detouredCallDepth == 0;
+    previousFunction = t_realCallFunction;
+
+    // Detoured functions called while a DetouredScope is active are called by the detours themselves.
+    // Only the ones called by the process (or forwarded to, like the W variants from the A variants) have a real call.
+    bool calledByDetours = DetouredScope::IsActive();
+    if (outermost && calledByDetours)
+    {
+        // E.g., a thread of the detours library calling a detoured function. Not a call of the process.
+        outermost = false;
+        return false;
+    }
+
+    if (!calledByDetours)
+    {
+        t_realCallFunction = function;
+    }
+
+    if (outermost)
+    {
+        t_realTicks = 0;
+    }
+
+    t_detouredCallDepth++;
+    return true;
+}
+
+void LeaveDetouredFunction(DetouredFunctionId function, bool outermost, DetouredFunctionId previousFunction, LARGE_INTEGER const& start)
+{
+    t_detouredCallDepth--;
+    t_realCallFunction = previousFunction;
+
+    if (!outermost)
+    {
+        return;
+    }
+
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+
+    ThreadDetourStatistics* statistics = GetThreadDetourStatistics();
+    if (statistics == nullptr)
+    {
+        return;
+    }
+
+    ULONG64 totalTicks = end.QuadPart > start.QuadPart ? (ULONG64)(end.QuadPart - start.QuadPart) : 0;
+    ULONG64 realTicks = (ULONG64)t_realTicks < totalTicks ? (ULONG64)t_realTicks : totalTicks;
+    ULONG64 detourTicks = totalTicks - realTicks;
+
+    DetouredFunctionStatistics& functionStatistics = statistics->Functions[(int)function];
+    functionStatistics.Calls++;
+    functionStatistics.RealTicks += realTicks;
+    functionStatistics.DetourTicks += detourTicks;
+    functionStatistics.RealHistogram[HistogramBucket(realTicks)]++;
+    functionStatistics.DetourHistogram[HistogramBucket(detourTicks)]++;
+}
+
+bool IsRealCallOfDetouredFunction(DetouredFunctionId function)
+{
+    return t_detouredCallDepth > 0 && t_realCallFunction == function;
+}
+
+void AddRealFunctionTime(LONGLONG ticks)
+{
+    if (ticks > 0)
+    {
+        t_realTicks += ticks;
+    }
+}
+
+bool EnterDetourOverhead(DetourOverheadCategory category, _Out_ DetourOverheadCategory& previousCategory)
+{
+    previousCategory = t_overheadCategory;
+
+    // Threads of the detours library, and detours called by the detours themselves, are not timed.
+    if (t_detouredCallDepth == 0)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+    AccountDetourOverhead(start.QuadPart);
+    t_overheadCategory = category;
+    return true;
+}
+
+void LeaveDetourOverhead(DetourOverheadCategory category, DetourOverheadCategory previousCategory)
+{
+    assert(t_overheadCategory == category);
+
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    AccountDetourOverhead(end.QuadPart);
+    t_overheadCategory = previousCategory;
+}
+
+DetourOverhead GetDetourOverhead()
+{
+    DetourOverhead overhead;
+    ZeroMemory(&overhead, sizeof(overhead));
+
+    if (!CollectDetourStatistics())
+    {
+        return overhead;
+    }
+
+    ULONG64 detourTicks = 0;
+    ULONG64 categoryTicks[(int)DetourOverheadCategory::Count] = {};
+
+    for (PSLIST_ENTRY entry = RtlFirstEntrySList(&g_threadDetourStatistics); entry != nullptr; entry = entry->Next)
+    {
+        ThreadDetourStatistics* statistics = CONTAINING_RECORD(entry, ThreadDetourStatistics, ItemEntry);
+        for (int i = 0; i < (int)DetouredFunctionId::Count; i++)
+        {
+            detourTicks += statistics->Functions[i].DetourTicks;
+        }
+
+        for (int i = 0; i < (int)DetourOverheadCategory::Count; i++)
+        {
+            categoryTicks[i] += statistics->OverheadTicks[i];
+        }
+    }
+
+    overhead.TotalMicroseconds = TicksToMicroseconds(detourTicks);
+    for (int i = 0; i < (int)DetourOverheadCategory::Count; i++)
+    {
+        overhead.CategoryMicroseconds[i] = TicksToMicroseconds(categoryTicks[i]);
+    }
+
+    return overhead;
+}
+
+std::wstring FormatDetourStatistics()
+{
+    static wchar_t const* const s_functionNames[] = {
+#define GEN_DETOURED_FUNCTION_NAME(name) L#name,
+        FOR_ALL_STATISTICS_DETOURED_FUNCTIONS(GEN_DETOURED_FUNCTION_NAME)
+#undef GEN_DETOURED_FUNCTION_NAME
+    };
+
+    static_assert(_countof(s_functionNames) == (size_t)DetouredFunctionId::Count, "Every detoured function needs a name");
+
+    std::wstring field;
+
+    if (!CollectDetourStatistics())
+    {
+        return field;
+    }
+
+    DetouredFunctionStatistics merged[(int)DetouredFunctionId::Count];
+    ZeroMemory(merged, sizeof(merged));
+
+    // Walk the list without popping, the blocks are never freed.
+    for (PSLIST_ENTRY entry = RtlFirstEntrySList(&g_threadDetourStatistics); entry != nullptr; entry = entry->Next)
+    {
+        ThreadDetourStatistics* statistics = CONTAINING_RECORD(entry, ThreadDetourStatistics, ItemEntry);
+        for (int i = 0; i < (int)DetouredFunctionId::Count; i++)
+        {
+            DetouredFunctionStatistics const& source = statistics->Functions[i];
+            merged[i].Calls += source.Calls;
+            merged[i].RealTicks += source.RealTicks;
+            merged[i].DetourTicks += source.DetourTicks;
+
+            for (int bucket = 0; bucket < DETOUR_STATISTICS_HISTOGRAM_BUCKETS; bucket++)
+            {
+                merged[i].RealHistogram[bucket] += source.RealHistogram[bucket];
+                merged[i].DetourHistogram[bucket] += source.DetourHistogram[bucket];
+            }
+        }
+    }
+
+    for (int i = 0; i < (int)DetouredFunctionId::Count; i++)
+    {
+        if (merged[i].Calls == 0)
+        {
+            continue;
+        }
+
+        if (!field.empty())
+        {
+            field.push_back(L';');
+        }
+
+        field.append(s_functionNames[i]);
+        field.push_back(L',');
+        field.append(std::to_wstring(merged[i].Calls));
+        field.push_back(L',');
+        field.append(std::to_wstring(TicksToMicroseconds(merged[i].RealTicks)));
+        field.push_back(L',');
+        field.append(std::to_wstring(TicksToMicroseconds(merged[i].DetourTicks)));
+        field.push_back(L',');
+        AppendHistogram(field, merged[i].RealHistogram);
+        field.push_back(L',');
+        AppendHistogram(field, merged[i].DetourHistogram);
+    }
+
+    return field;
+}
@@ -0,0 +1,266 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Per-function call counts and latency histograms of the detoured functions.
+//
+// With FileAccessManifestExtraFlag::CollectDetourStatistics, every call a process makes to a detoured function is
+// timed, and its time is split between the real function (calls made through TIMED_REAL) and everything the detour does
+// around it (policy lookup, probes, reporting). Calls the detours make themselves, and the A variants forwarding to
+// the W variants, are accounted to the detoured call they are made for.
+//
+// Each thread collects into its own block, so recording takes no lock. The blocks are merged when the process reports
+// its data on exit.
+//
+// The time detours spend around the real functions is further split by what it is spent on (see DetourOverheadScope), so that
+// the overhead of the sandbox for a pip can be broken down. Each category gets the time spent in it minus the time spent in
+// nested categories; whatever is left of the detour time is spent elsewhere (e.g., in the bookkeeping of the detours themselves).
+
+#pragma once
+
+#include <string>
+
+#include "DataTypes.h"
+#include "DetouredFunctionTypes.h"
+#include "FileAccessHelpers.h"
+#include "globals.h"
+
+// Higher-order macro that enumerates the detoured functions with statistics.
+#define FOR_ALL_STATISTICS_DETOURED_FUNCTIONS(m) \
+    m(CreateProcessW)               \
+    m(CreateProcessA)               \
+    m(CreateFileW)                  \
+    m(CreateFileA)                  \
+    m(GetVolumePathNameW)           \
+    m(GetFileAttributesA)           \
+    m(GetFileAttributesW)           \
+    m(GetFileAttributesExW)         \
+    m(GetFileAttributesExA)         \
+    m(GetFileInformationByHandle)   \
+    m(GetFileInformationByHandleEx) \
+    m(SetFileInformationByHandle)   \
+    m(CopyFileW)                    \
+    m(CopyFileA)                    \
+    m(CopyFileExW)                  \
+    m(CopyFileExA)                  \
+    m(MoveFileW)                    \
+    m(MoveFileA)                    \
+    m(MoveFileExW)                  \
+    m(MoveFileExA)                  \
+    m(MoveFileWithProgressW)        \
+    m(MoveFileWithProgressA)        \
+    m(ReplaceFileW)                 \
+    m(ReplaceFileA)                 \
+    m(DeleteFileA)                  \
+    m(DeleteFileW)                  \
+    m(CreateHardLinkW)              \
+    m(CreateHardLinkA)              \
+    m(CreateSymbolicLinkW)          \
+    m(CreateSymbolicLinkA)          \
+    m(FindFirstFileW)               \
+    m(FindFirstFileA)               \
+    m(FindFirstFileExW)             \
+    m(FindFirstFileExA)             \
+    m(FindNextFileW)                \
+    m(FindNextFileA)                \
+    m(FindClose)                    \
+    m(OpenFileMappingW)             \
+    m(OpenFileMappingA)             \
+    m(GetTempFileNameW)             \
+    m(GetTempFileNameA)             \
+    m(CreateDirectoryW)             \
+    m(CreateDirectoryA)             \
+    m(CreateDirectoryExW)           \
+    m(CreateDirectoryExA)           \
+    m(RemoveDirectoryW)             \
+    m(RemoveDirectoryA)             \
+    m(SetCurrentDirectoryW)         \
+    m(SetCurrentDirectoryA)         \
+    m(DecryptFileW)                 \
+    m(DecryptFileA)                 \
+    m(EncryptFileW)                 \
+    m(EncryptFileA)                 \
+    m(OpenEncryptedFileRawW)        \
+    m(OpenEncryptedFileRawA)        \
+    m(OpenFileById)                 \
+    m(GetFinalPathNameByHandleW)    \
+    m(GetFinalPathNameByHandleA)    \
+    m(NtCreateFile)                 \
+    m(NtOpenFile)                   \
+    m(ZwCreateFile)                 \
+    m(ZwOpenFile)                   \
+    m(NtQueryDirectoryFile)         \
+    m(ZwQueryDirectoryFile)         \
+    m(ZwSetInformationFile)         \
+    m(NtWriteFile)                  \
+    m(NtDuplicateObject)
+
+// NtClose is left out: it can be called while the TLS of the thread is not set up, so it must not touch thread locals.
+
+#define GEN_DETOURED_FUNCTION_ID(name) name,
+enum class DetouredFunctionId {
+    FOR_ALL_STATISTICS_DETOURED_FUNCTIONS(GEN_DETOURED_FUNCTION_ID)
+    Count
+};
+#undef GEN_DETOURED_FUNCTION_ID
+
+// Higher-order macro that enumerates what the time detours spend around the real functions is accounted to.
+#define FOR_ALL_DETOUR_OVERHEAD_CATEGORIES(m) \
+    m(PolicyResolution)             \
+    m(ReparsePointResolution)       \
+    m(Reporting)                    \
+    m(HandleOverlayLock)
+
+#define GEN_DETOUR_OVERHEAD_CATEGORY(name) name,
+enum class DetourOverheadCategory {
+    FOR_ALL_DETOUR_OVERHEAD_CATEGORIES(GEN_DETOUR_OVERHEAD_CATEGORY)
+    Count
+};
+#undef GEN_DETOUR_OVERHEAD_CATEGORY
+
+// Time spent by detours around the real functions, over all threads.
+struct DetourOverhead
+{
+    ULONG64 TotalMicroseconds;
+    ULONG64 CategoryMicroseconds[(int)DetourOverheadCategory::Count];
+};
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Called when a detoured call starts. Returns false if it is not to be timed.
+bool EnterDetouredFunction(DetouredFunctionId function, _Out_ bool& outermost, _Out_ DetouredFunctionId& previousFunction);
+
+/// Called when a detoured call for which EnterDetouredFunction returned true ends.
+void LeaveDetouredFunction(DetouredFunctionId function, bool outermost, DetouredFunctionId previousFunction, LARGE_INTEGER const& start);
+
+/// Indicates if a call to the real function is made for the detoured call in progress on this thread.
+bool IsRealCallOfDetouredFunction(DetouredFunctionId function);
+
+/// Accounts time spent in the real function to the detoured call in progress on this thread.
+void AddRealFunctionTime(LONGLONG ticks);
+
+/// Called when a region of detour logic of the given category starts. Returns false if it is not to be timed, i.e., outside of a
+/// timed detoured call. Otherwise 'previousCategory' is set to the category it interrupts, which is resumed when it ends.
+bool EnterDetourOverhead(DetourOverheadCategory category, _Out_ DetourOverheadCategory& previousCategory);
+
+/// Called when a region for which EnterDetourOverhead returned true ends.
+void LeaveDetourOverhead(DetourOverheadCategory category, DetourOverheadCategory previousCategory);
+
+/// Merges the time detours spent around the real functions of all threads. All zeros when no statistics were collected.
+/// Only to be called once all other threads are gone.
+DetourOverhead GetDetourOverhead();
+
+/// Merges the statistics of all threads into a report field: one ';' separated entry per called function, each
+/// "Name,Calls,RealMicroseconds,DetourMicroseconds,RealHistogram,DetourHistogram", where a histogram lists its '/'
+/// separated bucket counts. Bucket 0 counts calls under 1us, bucket i calls in [2^(i-1), 2^i) us, the last one the rest.
+/// Empty when no statistics were collected. Only to be called once all other threads are gone.
+std::wstring FormatDetourStatistics();
+
+// ----------------------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------------------
+
+/// Times the detoured call it is declared in. Declare it first thing in the detoured function.
+class DetourStatisticsScope
+{
+public:
+    DetourStatisticsScope(DetouredFunctionId function)
+        : m_function(function)
+    {
+        m_active = CollectDetourStatistics() && EnterDetouredFunction(function, m_outermost, m_previousFunction);
+        if (m_active)
+        {
+            QueryPerformanceCounter(&m_start);
+        }
+    }
+
+    ~DetourStatisticsScope()
+    {
+        if (m_active)
+        {
+            DWORD lastError = GetLastError();
+            LeaveDetouredFunction(m_function, m_outermost, m_previousFunction, m_start);
+            SetLastError(lastError);
+        }
+    }
+
+private:
+    DetouredFunctionId m_function;
+    DetouredFunctionId m_previousFunction;
+    LARGE_INTEGER m_start;
+    bool m_outermost;
+    bool m_active;
+
+    DetourStatisticsScope(const DetourStatisticsScope&) = delete;
+    DetourStatisticsScope& operator=(const DetourStatisticsScope&) = delete;
+};
+
+/// Accounts the time until the end of the scope it is declared in to a category of detour logic.
+class DetourOverheadScope
+{
+public:
+    DetourOverheadScope(DetourOverheadCategory category)
+        : m_category(category)
+    {
+        m_active = CollectDetourStatistics() && EnterDetourOverhead(category, m_previousCategory);
+    }
+
+    ~DetourOverheadScope()
+    {
+        if (m_active)
+        {
+            DWORD lastError = GetLastError();
+            LeaveDetourOverhead(m_category, m_previousCategory);
+            SetLastError(lastError);
+        }
+    }
+
+private:
+    DetourOverheadCategory m_category;
+    DetourOverheadCategory m_previousCategory;
+    bool m_active;
+
+    DetourOverheadScope(const DetourOverheadScope&) = delete;
+    DetourOverheadScope& operator=(const DetourOverheadScope&) = delete;
+};
+
+template <typename TFunction>
+class TimedRealFunction;
+
+/// Calls a real function, accounting the time spent in it to the detoured call in progress. Use it through TIMED_REAL.
+template <typename TResult, typename... TArgs>
+class TimedRealFunction<TResult (WINAPI *)(TArgs...)>
+{
+public:
+    TimedRealFunction(TResult (WINAPI *function)(TArgs...), DetouredFunctionId id)
+        : m_function(function), m_id(id)
+    {
+    }
+
+    TResult operator()(TArgs... args) const
+    {
+        if (!CollectDetourStatistics() || !IsRealCallOfDetouredFunction(m_id))
+        {
+            return m_function(args...);
+        }
+
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        QueryPerformanceCounter(&start);
+        TResult result = m_function(args...);
+        DWORD lastError = GetLastError();
+        QueryPerformanceCounter(&end);
+        AddRealFunctionTime(end.QuadPart - start.QuadPart);
+        SetLastError(lastError);
+
+        return result;
+    }
+
+private:
+    TResult (WINAPI *m_function)(TArgs...);
+    DetouredFunctionId m_id;
+};
+
+// Calls Real_<Name>, timing it when it is the real function of the detoured call in progress.
+#define TIMED_REAL(Name) TimedRealFunction<Name##_t>(Real_##Name, DetouredFunctionId::Name)
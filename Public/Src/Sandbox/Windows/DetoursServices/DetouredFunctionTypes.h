@@ -348,6 +348,14 @@ typedef BOOL (WINAPI *RemoveDirectoryA_t)(
     __in  LPCSTR lpPathName
     );
 
+typedef BOOL (WINAPI *SetCurrentDirectoryW_t)(
+    __in  LPCWSTR lpPathName
+    );
+
+typedef BOOL (WINAPI *SetCurrentDirectoryA_t)(
+    __in  LPCSTR lpPathName
+    );
+
 typedef BOOL (WINAPI *DecryptFileW_t)(
     __in        LPCWSTR lpFileName,
     __reserved  DWORD dwReserved
@@ -429,6 +437,18 @@ typedef NTSTATUS(NTAPI *ZwQueryDirectoryFile_t)(
     __in BOOLEAN RestartScan
     );
 
+typedef NTSTATUS(NTAPI *NtWriteFile_t)(
+    __in HANDLE FileHandle,
+    __in_opt HANDLE Event,
+    __in_opt PIO_APC_ROUTINE ApcRoutine,
+    __in_opt PVOID ApcContext,
+    __out PIO_STATUS_BLOCK IoStatusBlock,
+    __in_bcount(Length) PVOID Buffer,
+    __in ULONG Length,
+    __in_opt PLARGE_INTEGER ByteOffset,
+    __in_opt PULONG Key
+    );
+
 typedef NTSTATUS(NTAPI *NtCreateFile_t)(
     __out PHANDLE FileHandle,
     __in ACCESS_MASK DesiredAccess,
@@ -483,6 +503,26 @@ typedef NTSTATUS(NTAPI *ZwSetInformationFile_t)(
     _In_  FILE_INFORMATION_CLASS FileInformationClass
     );
 
+typedef NTSTATUS(NTAPI *NtQueryAttributesFile_t)(
+    __in POBJECT_ATTRIBUTES ObjectAttributes,
+    __out PVOID FileInformation
+    );
+
+typedef NTSTATUS(NTAPI *NtQueryFullAttributesFile_t)(
+    __in POBJECT_ATTRIBUTES ObjectAttributes,
+    __out PVOID FileInformation
+    );
+
 typedef NTSTATUS(NTAPI *NtClose_t)(
     __in HANDLE Handle
     );
+
+typedef NTSTATUS(NTAPI *NtDuplicateObject_t)(
+    __in HANDLE SourceProcessHandle,
+    __in HANDLE SourceHandle,
+    __in_opt HANDLE TargetProcessHandle,
+    __out_opt PHANDLE TargetHandle,
+    __in ACCESS_MASK DesiredAccess,
+    __in ULONG HandleAttributes,
+    __in ULONG Options
+    );
@@ -11,22 +11,39 @@
 #include "DetoursServices.h"
 #include "FileAccessHelpers.h"
 #include "DetouredScope.h"
+#include "DetourStatistics.h"
+#include "FeatureCounters.h"
 #include "SendReport.h"
 #include "StringOperations.h"
 #include "UnicodeConverter.h"
 #include "MetadataOverrides.h"
 #include "HandleOverlay.h"
+#include "Materialization.h"
+#include "ReparsePointCache.h"
+#include "BlockClone.h"
+#include "KnownDirectoryCache.h"
+#include "VolumeCache.h"
+#include "FileStat.h"
+#include "TempRedirection.h"
+#include "ProcessPriority.h"
 
 using std::wstring;
 using std::unique_ptr;
 using std::vector;
 
+extern volatile LONG64 g_detoursProcessAdmissionWaits;
+extern volatile LONG64 g_detoursProcessAdmissionWaitMicroseconds;
+extern volatile LONG64 g_detoursDirectoryQueriesAvoided;
+extern volatile LONG64 g_detoursFileStatQueriesSaved;
+
 // ----------------------------------------------------------------------------
 // FUNCTION DEFINITIONS
 // ----------------------------------------------------------------------------
 
 #define IMPLEMENTED(x) // bookeeping to remember which functions have been fully implemented and which still need to be done
-#define RETRY_DETOURING_PROCESS_COUNT 5 // How many times to retry detouring a process.
+#define RETRY_DETOURING_PROCESS_COUNT 16 // How many times to retry detouring a process.
+#define RETRY_DETOURING_PROCESS_INITIAL_BACKOFF_US 500 // How long to wait before the first retry; each retry waits about twice as long as the previous one.
+#define RETRY_DETOURING_PROCESS_MAX_TOTAL_BACKOFF_US 5000000 // How long to wait in total before giving up on detouring a process.
 #define DETOURS_STATUS_ACCESS_DENIED (NTSTATUS)0xC0000022L;
 #define INITIAL_REPARSE_DATA_BUILDXL_DETOURS_BUFFER_SIZE_FOR_FILE_NAMES 1024
 #define SYMLINK_FLAG_RELATIVE 0x00000001
@@ -34,22 +51,98 @@ using std::vector;
 /// <summary>
 /// Checks if a file is a reparse point by calling <code>GetFileAttributesW</code>.
 /// </summary>
+/// <remarks>
+/// With <code>CacheReparsePointProbes</code>, the attributes come from the reparse point cache if the path was already probed.
+/// </remarks>
 static bool IsReparsePoint(_In_ LPCWSTR lpFileName)
 {
-    if (IgnoreReparsePoints())
+    DetourOverheadScope overhead(DetourOverheadCategory::ReparsePointResolution);
+
+    if (IgnoreReparsePoints() || lpFileName == nullptr)
     {
         return false;
     }
 
-    DWORD lastError = GetLastError();
-    DWORD attributes;
-    bool result = lpFileName != nullptr
-        && ((attributes = GetFileAttributesW(lpFileName)) != INVALID_FILE_ATTRIBUTES)
-        && ((attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0);
+    ReparsePointCacheEntry cacheEntry;
+    if (!TryGetReparsePointCacheEntry(lpFileName, cacheEntry))
+    {
+        DWORD lastError = GetLastError();
+        LONG generation = GetReparsePointCacheGeneration();
 
-    SetLastError(lastError);
+        cacheEntry.Attributes = GetFileAttributesW(lpFileName);
+        cacheEntry.ReparseTag = 0;
+        cacheEntry.HasReparseTag = false;
 
-    return result;
+        // Not a reparse point, so there is no tag to look up later.
+        if (cacheEntry.Attributes == INVALID_FILE_ATTRIBUTES || (cacheEntry.Attributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0)
+        {
+            cacheEntry.HasReparseTag = true;
+        }
+
+        SetReparsePointCacheEntry(lpFileName, generation, cacheEntry);
+        SetLastError(lastError);
+    }
+
+    return cacheEntry.Attributes != INVALID_FILE_ATTRIBUTES
+        && (cacheEntry.Attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+}
+
+/// <summary>
+/// Checks if a path just opened is a reparse point, from the attributes of the handle when it is of the path itself.
+/// </summary>
+/// <remarks>
+/// A handle opened with <code>FILE_FLAG_OPEN_REPARSE_POINT</code> (or <code>FILE_OPEN_REPARSE_POINT</code>) has the attributes
+/// <code>GetFileAttributesW</code> would find for the path; they also go to the reparse point cache, so that later probes of the path
+/// need no query either. Otherwise this falls back to <code>IsReparsePoint</code>.
+/// </remarks>
+static bool IsOpenedReparsePoint(_In_ LPCWSTR lpFileName, _Inout_ OpenedFileStat& openedFileStat)
+{
+    if (IgnoreReparsePoints() || lpFileName == nullptr)
+    {
+        return false;
+    }
+
+    bool isReparsePoint;
+    if (!openedFileStat.TryCheckReparsePoint(isReparsePoint))
+    {
+        return IsReparsePoint(lpFileName);
+    }
+
+    FileStat const* stat = openedFileStat.GetIfQueried();
+    ReparsePointCacheEntry cacheEntry;
+    cacheEntry.Attributes = stat->FileAttributes;
+    cacheEntry.ReparseTag = stat->ReparseTag;
+    cacheEntry.HasReparseTag = !isReparsePoint || stat->HasReparseTag;
+    SetReparsePointCacheEntry(lpFileName, openedFileStat.GetGeneration(), cacheEntry);
+
+    return isReparsePoint;
+}
+
+/// <summary>
+/// Gets the attributes of a path by calling <code>GetFileAttributesW</code>, and the error if it fails.
+/// </summary>
+/// <remarks>
+/// With <code>CacheReparsePointProbes</code>, the attributes come from the reparse point cache if the path was already found there,
+/// and are added to it otherwise. The cache does not remember why a path could not be probed, so absent paths are probed again.
+/// </remarks>
+static DWORD GetFileAttributesThroughReparsePointCache(_In_ LPCWSTR lpFileName, _Out_ DWORD& error)
+{
+    ReparsePointCacheEntry cacheEntry;
+    if (TryGetReparsePointCacheEntry(lpFileName, cacheEntry) && cacheEntry.Attributes != INVALID_FILE_ATTRIBUTES)
+    {
+        error = ERROR_SUCCESS;
+        return cacheEntry.Attributes;
+    }
+
+    LONG generation = GetReparsePointCacheGeneration();
+
+    cacheEntry.Attributes = GetFileAttributesW(lpFileName);
+    error = cacheEntry.Attributes == INVALID_FILE_ATTRIBUTES ? GetLastError() : ERROR_SUCCESS;
+    cacheEntry.ReparseTag = 0;
+    cacheEntry.HasReparseTag = cacheEntry.Attributes == INVALID_FILE_ATTRIBUTES || (cacheEntry.Attributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0;
+
+    SetReparsePointCacheEntry(lpFileName, generation, cacheEntry);
+    return cacheEntry.Attributes;
 }
 
 /// <summary>
@@ -57,11 +150,20 @@ static bool IsReparsePoint(_In_ LPCWSTR lpFileName)
 /// </summary>
 static DWORD GetReparsePointType(_In_ LPCWSTR lpFileName)
 {
+    DetourOverheadScope overhead(DetourOverheadCategory::ReparsePointResolution);
+
     DWORD ret = 0;
 
     if (!IgnoreReparsePoints())
     {
+        ReparsePointCacheEntry cacheEntry;
+        if (TryGetReparsePointCacheEntry(lpFileName, cacheEntry) && cacheEntry.HasReparseTag)
+        {
+            return cacheEntry.ReparseTag;
+        }
+
         DWORD lastError = GetLastError();
+        LONG generation = GetReparsePointCacheGeneration();
 
         if (IsReparsePoint(lpFileName))
         {
@@ -72,6 +174,11 @@ static DWORD GetReparsePointType(_In_ LPCWSTR lpFileName)
             {
                 ret = findData.dwReserved0;
                 FindClose(findDataHandle);
+
+                cacheEntry.Attributes = findData.dwFileAttributes;
+                cacheEntry.ReparseTag = ret;
+                cacheEntry.HasReparseTag = true;
+                SetReparsePointCacheEntry(lpFileName, generation, cacheEntry);
             }
         }
 
@@ -81,6 +188,26 @@ static DWORD GetReparsePointType(_In_ LPCWSTR lpFileName)
     return ret;
 }
 
+/// <summary>
+/// Checks if a <code>CreateFileW</code> call may create, replace, or delete a file, which invalidates the reparse point cache.
+/// </summary>
+static bool MayCreateOrDeleteOnCreateFile(DWORD dwDesiredAccess, DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes)
+{
+    return dwCreationDisposition != OPEN_EXISTING
+        || (dwDesiredAccess & DELETE) != 0
+        || (dwFlagsAndAttributes & FILE_FLAG_DELETE_ON_CLOSE) != 0;
+}
+
+/// <summary>
+/// Checks if an <code>NtCreateFile</code> call may create, replace, or delete a file, which invalidates the reparse point cache.
+/// </summary>
+static bool MayCreateOrDeleteOnNtCreateFile(ACCESS_MASK desiredAccess, ULONG createDisposition, ULONG createOptions)
+{
+    return createDisposition != FILE_OPEN
+        || (desiredAccess & DELETE) != 0
+        || (createOptions & FILE_DELETE_ON_CLOSE) != 0;
+}
+
 /// <summary>
 /// Checks if a reparse point type is actionable, i.e., it is either <code>IO_REPARSE_TAG_SYMLINK</code> or <code>IO_REPARSE_TAG_MOUNT_POINT</code>.
 /// </summary>
@@ -90,12 +217,12 @@ static bool IsActionableReparsePointType(_In_ const DWORD reparsePointType)
 }
 
 /// <summary>
-/// Gets the final full path by handle.
+/// Gets the final full path by handle, without looking at the handle overlay.
 /// </summary>
 /// <remarks>
 /// This function encapsulates calls to <code>GetFinalPathNameByHandleW</code> and allocates memory as needed.
 /// </remarks>
-static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
+static DWORD QueryFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
 {
     // First, we try with a fixed-sized buffer, which should be good enough for all practical cases.
 
@@ -146,6 +273,39 @@ static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& full
     return ERROR_SUCCESS;
 }
 
+/// <summary>
+/// Gets the final full path by handle.
+/// </summary>
+/// <remarks>
+/// With <code>CacheFinalPathsOfHandles</code>, the path of a handle with an overlay is resolved once, and then only again after
+/// this process moved, linked, or deleted files (see <code>GetReparsePointCacheGeneration</code>).
+/// </remarks>
+static DWORD DetourGetFinalPathByHandle(_In_ HANDLE hFile, _Inout_ wstring& fullPath)
+{
+    if (!CacheFinalPathsOfHandles())
+    {
+        return QueryFinalPathByHandle(hFile, fullPath);
+    }
+
+    HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
+    LONG generation = GetReparsePointCacheGeneration();
+
+    if (overlay != nullptr && overlay->TryGetFinalPath(generation, fullPath))
+    {
+        IncrementFeatureCounter(FeatureCounter::FinalPathCacheHits);
+        return ERROR_SUCCESS;
+    }
+
+    DWORD error = QueryFinalPathByHandle(hFile, fullPath);
+
+    if (error == ERROR_SUCCESS && overlay != nullptr)
+    {
+        overlay->SetFinalPath(generation, fullPath);
+    }
+
+    return error;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////// Symlink traversal utilities /////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -619,21 +779,20 @@ static bool IsPathToDirectory(_In_ LPCWSTR lpFileName, _In_ bool treatReparsePoi
 /// <summary>
 /// Checks if a a handle is a handle of a directory.
 /// </summary>
+/// <remarks>
+/// This takes a single query of the handle (see TryQueryFileStat), where GetFileInformationByHandle takes two.
+/// </remarks>
 static bool TryCheckHandleOfDirectory(_In_ HANDLE hFile, _In_ bool treatReparsePointAsFile, _Out_ bool& isHandleOfDirectory)
 {
-    DWORD lastError = GetLastError();
-    BY_HANDLE_FILE_INFORMATION fileInfo;
-    BOOL res = GetFileInformationByHandle(hFile, &fileInfo);
-    SetLastError(lastError);
-
-    isHandleOfDirectory = res ? (fileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 : false;
-
-    if (isHandleOfDirectory && treatReparsePointAsFile)
+    FileStat stat;
+    if (!TryQueryFileStat(hFile, stat))
     {
-        isHandleOfDirectory = (fileInfo.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0;
+        isHandleOfDirectory = false;
+        return false;
     }
 
-    return res ? true : false;
+    isHandleOfDirectory = stat.IsDirectory(treatReparsePointAsFile);
+    return true;
 }
 
 
@@ -653,6 +812,90 @@ static bool IsHandleOrPathToDirectory(_In_ HANDLE hFile, _In_ LPCWSTR lpFileName
         : isHandleOfDirectory;
 }
 
+/// <summary>
+/// Checks if a handle just opened or its path points to a directory, like IsHandleOrPathToDirectory, sharing the query of the handle
+/// with the other checks following the open.
+/// </summary>
+static bool IsHandleOrPathToDirectory(_Inout_ OpenedFileStat& openedFileStat, _In_ LPCWSTR lpFileName, bool treatReparsePointAsFile)
+{
+    bool isHandleOfDirectory;
+
+    return !openedFileStat.TryCheckDirectory(treatReparsePointAsFile, isHandleOfDirectory)
+        ? IsPathToDirectory(lpFileName, treatReparsePointAsFile)
+        : isHandleOfDirectory;
+}
+
+/// <summary>
+/// Checks if a handle is a handle of a directory from the type of its overlay, without querying the file system.
+/// </summary>
+/// <remarks>
+/// The type of the overlay was established when the handle was opened. A directory handle is only known not to be a
+/// directory reparse point if the handle was opened following reparse points (see HandleOverlay::FollowedReparsePoints),
+/// or from the attributes queried after the open if they are still current (see HandleOverlay::Stat), so this fails for the
+/// other directory handles when reparse points are treated as files. It also fails for handles without an overlay.
+/// </remarks>
+static bool TryCheckHandleOfDirectoryFromOverlay(_In_ HANDLE hFile, _In_ bool treatReparsePointAsFile, _Out_ bool& isHandleOfDirectory)
+{
+    isHandleOfDirectory = false;
+
+    HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
+    if (!overlay || overlay->Type == HandleType::Find)
+    {
+        return false;
+    }
+
+    if (overlay->Type == HandleType::Directory && treatReparsePointAsFile && !overlay->FollowedReparsePoints)
+    {
+        if (!overlay->HasStat || overlay->StatGeneration != GetReparsePointCacheGeneration())
+        {
+            return false;
+        }
+
+        isHandleOfDirectory = overlay->Stat.IsDirectory(treatReparsePointAsFile);
+        InterlockedIncrement64(&g_detoursFileStatQueriesSaved);
+        return true;
+    }
+
+    isHandleOfDirectory = overlay->Type == HandleType::Directory;
+    InterlockedIncrement64(&g_detoursDirectoryQueriesAvoided);
+    return true;
+}
+
+/// <summary>
+/// Registers an overlay for a handle just opened on a transparent path (see PolicyResult::IsTransparent), if it is a handle of a directory.
+/// </summary>
+/// <remarks>
+/// Nothing done through such a handle is checked or reported, but opens relative to a directory handle find their path through its
+/// overlay (see PathFromObjectAttributes). Without one, they would be passed through unchecked, even when their names lead out of the
+/// transparent scope through a reparse point. Only opens that may have opened a directory (mayBeDirectory) are queried;
+/// isDirectory tells when the options of the open already say it did.
+/// </remarks>
+static void RegisterTransparentDirectoryOverlay(
+    HANDLE              handle,
+    PolicyResult const& policyResult,
+    bool                mayBeDirectory,
+    bool                isDirectory,
+    bool                followedReparsePoints)
+{
+    if (!mayBeDirectory || handle == INVALID_HANDLE_VALUE || handle == nullptr)
+    {
+        return;
+    }
+
+    if (!isDirectory && !IsHandleOrPathToDirectory(handle, policyResult.GetCanonicalizedPath().GetPathString(), false))
+    {
+        return;
+    }
+
+    RegisterHandleOverlay(
+        handle,
+        AccessCheckResult(RequestedAccess::None, ResultAction::Allow, ReportLevel::Ignore),
+        policyResult,
+        HandleType::Directory,
+        nullptr,
+        followedReparsePoints);
+}
+
 /// <summary>
 /// Enforces allowed access for a particular path that leads to the target of a reparse point.
 /// </summary>
@@ -759,6 +1002,7 @@ static bool EnforceReparsePointAccess(
 /// <remarks>
 /// This function calls <code>DetourGetFinalPaths</code> to get the sequence of paths leading to and including the target of a reparse point.
 /// Having the sequence, this function calls <code>EnforceReparsePointAccess</code> on each path to check that access to that path is allowed.
+/// With <code>CacheReparsePointProbes</code>, the sequence comes from the reparse point cache if it was already resolved.
 /// </remarks>
 static bool EnforceChainOfReparsePointAccesses(
     const CanonicalizedPath& path,
@@ -777,8 +1021,15 @@ static bool EnforceChainOfReparsePointAccesses(
         return true;
     }
 
+    DetourOverheadScope overhead(DetourOverheadCategory::ReparsePointResolution);
+
     vector<wstring> fullPaths;
-    DetourGetFinalPaths(path, reparsePointHandle, fullPaths);
+    if (!TryGetResolvedReparsePointChain(path.GetPathString(), fullPaths))
+    {
+        LONG generation = GetReparsePointCacheGeneration();
+        DetourGetFinalPaths(path, reparsePointHandle, fullPaths);
+        SetResolvedReparsePointChain(path.GetPathString(), generation, fullPaths);
+    }
 
     bool success = true;
 
@@ -803,6 +1054,7 @@ static bool EnforceChainOfReparsePointAccessesForNonCreateFile(
 {
     if (!IgnoreNonCreateFileReparsePoints() && !IgnoreReparsePoints())
     {
+        DetourOverheadScope overhead(DetourOverheadCategory::ReparsePointResolution);
         CanonicalizedPath canonicalPath = CanonicalizedPath::Canonicalize(fileOperationContext.NoncanonicalPath);
  
         if (IsReparsePoint(canonicalPath.GetPathString()))
@@ -829,6 +1081,68 @@ static bool EnforceChainOfReparsePointAccessesForNonCreateFile(
     return true;
 }
 
+/// <summary>
+/// Returns the position of the last component of a path, or nullptr if that component may not be kept as is by canonicalization
+/// (empty, a relative component, a stream, or ending with the dots and spaces Win32 paths drop).
+/// </summary>
+static PCWSTR FindPlainLastComponent(PCWSTR path)
+{
+    PCWSTR lastComponent = path;
+    for (PCWSTR p = path; *p != L'\0'; p++)
+    {
+        if (IsDirectorySeparator(*p))
+        {
+            lastComponent = p + 1;
+        }
+    }
+
+    if (lastComponent == path || *lastComponent == L'\0' || wcscmp(lastComponent, L".") == 0 || wcscmp(lastComponent, L"..") == 0
+        || wcschr(lastComponent, L':') != nullptr)
+    {
+        return nullptr;
+    }
+
+    wchar_t last = lastComponent[wcslen(lastComponent) - 1];
+    return last == L'.' || last == L' ' ? nullptr : lastComponent;
+}
+
+/// <summary>
+/// Determines the policy for the destination of a rename from the one of its source when the destination is in the same directory,
+/// as when a tool writes 'foo.tmp' and renames it to 'foo'. The directory has to be spelled the same way in both paths, so that it
+/// canonicalizes the same way; the destination path is then not canonicalized again (see PolicyResult::GetPolicyForSibling).
+/// Returns false if the destination is not known to be a sibling of the source, in which case its policy has to be determined from its path.
+/// </summary>
+static bool TryGetPolicyForSameDirectoryRename(PCWSTR sourcePath, PolicyResult const& sourcePolicyResult, PCWSTR destinationPath, _Out_ PolicyResult& destPolicyResult)
+{
+    PCWSTR sourceName = FindPlainLastComponent(sourcePath);
+    PCWSTR destinationName = FindPlainLastComponent(destinationPath);
+    if (sourceName == nullptr
+        || destinationName == nullptr
+        || sourceName - sourcePath != destinationName - destinationPath
+        || wcsncmp(sourcePath, destinationPath, sourceName - sourcePath) != 0
+        || sourcePolicyResult.IsIndeterminate())
+    {
+        return false;
+    }
+
+    destPolicyResult = sourcePolicyResult.GetPolicyForSibling(destinationName);
+    return true;
+}
+
+/// <summary>
+/// Resets what the report cache knows of the source and the destination of a successful rename, and of what was moved along with a directory.
+/// </summary>
+static void InvalidateRenamedAccesses(PolicyResult const& sourcePolicyResult, PolicyResult const& destPolicyResult, vector<ReportData> const& movedFilesAndDirectories)
+{
+    InvalidateReportedAccesses(sourcePolicyResult);
+    InvalidateReportedAccesses(destPolicyResult);
+
+    for (vector<ReportData>::const_iterator it = movedFilesAndDirectories.cbegin(); it != movedFilesAndDirectories.cend(); ++it)
+    {
+        InvalidateReportedAccesses(it->GetPolicyResult());
+    }
+}
+
 /// <summary>
 /// Validates move directory by validating proper deletion for all source files and proper creation for all target files.
 /// </summary>
@@ -841,13 +1155,6 @@ static bool ValidateMoveDirectory(
 {
     DWORD error = GetLastError();
 
-    vector<std::pair<wstring, DWORD>> filesAndDirectories;
-
-    if (!EnumerateDirectory(lpExistingFileName, L"*", true, true, filesAndDirectories))
-    {
-        return false;
-    }
-
     wstring sourceDirectory(lpExistingFileName);
 
     if (sourceDirectory.back() != L'\\')
@@ -867,12 +1174,11 @@ static bool ValidateMoveDirectory(
         }
     }
 
-    for (vector<std::pair<wstring, DWORD>>::const_iterator it = filesAndDirectories.cbegin(); it != filesAndDirectories.cend(); ++it)
-    {
-        const std::pair<wstring, DWORD>& elem = *it;
-        wstring file = elem.first;
-        const DWORD& fileAttributes = elem.second;
+    wstring targetFile;
 
+    // The entries are checked as they are enumerated, so that a big tree is neither held in memory nor walked twice.
+    bool enumerated = EnumerateDirectory(lpExistingFileName, L"*", true, true, [&](const wstring& file, DWORD fileAttributes)
+    {
         // Validate deletion of source.
 
         FileOperationContext sourceOpContext = FileOperationContext(
@@ -906,7 +1212,8 @@ static bool ValidateMoveDirectory(
 
         if (lpNewFileName != NULL)
         {
-            file.replace(0, sourceDirectory.length(), targetDirectory);
+            targetFile.assign(targetDirectory);
+            targetFile.append(file, sourceDirectory.length(), wstring::npos);
 
             FileOperationContext destinationOpContext = FileOperationContext(
                 destinationContext,
@@ -914,11 +1221,11 @@ static bool ValidateMoveDirectory(
                 0,
                 CREATE_ALWAYS,
                 FILE_ATTRIBUTE_NORMAL,
-                file.c_str());
+                targetFile.c_str());
 
             PolicyResult destPolicyResult;
 
-            if (!destPolicyResult.Initialize(file.c_str()))
+            if (!destPolicyResult.Initialize(targetFile.c_str()))
             {
                 destPolicyResult.ReportIndeterminatePolicyAndSetLastError(destinationOpContext);
                 return false;
@@ -939,6 +1246,13 @@ static bool ValidateMoveDirectory(
 
             filesAndDirectoriesToReport.push_back(ReportData(destAccessCheck, destinationOpContext, destPolicyResult));
         }
+
+        return true;
+    });
+
+    if (!enumerated)
+    {
+        return false;
     }
 
     SetLastError(error);
@@ -1067,6 +1381,75 @@ typedef struct _FILE_MODE_INFORMATION {
     ULONG Mode;
 } FILE_MODE_INFORMATION, *PFILE_MODE_INFORMATION;
 
+// Directory entries returned by NtQueryDirectoryFile / ZwQueryDirectoryFile that have timestamps or short names.
+// FILE_DIRECTORY_INFORMATION is in DetoursHelpers.h, since EnumerateDirectory uses it too.
+
+typedef struct _FILE_FULL_DIR_INFORMATION {
+    ULONG         NextEntryOffset;
+    ULONG         FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG         FileAttributes;
+    ULONG         FileNameLength;
+    ULONG         EaSize;
+    WCHAR         FileName[1];
+} FILE_FULL_DIR_INFORMATION, *PFILE_FULL_DIR_INFORMATION;
+
+typedef struct _FILE_BOTH_DIR_INFORMATION {
+    ULONG         NextEntryOffset;
+    ULONG         FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG         FileAttributes;
+    ULONG         FileNameLength;
+    ULONG         EaSize;
+    CCHAR         ShortNameLength;
+    WCHAR         ShortName[12];
+    WCHAR         FileName[1];
+} FILE_BOTH_DIR_INFORMATION, *PFILE_BOTH_DIR_INFORMATION;
+
+typedef struct _FILE_ID_FULL_DIR_INFORMATION {
+    ULONG         NextEntryOffset;
+    ULONG         FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG         FileAttributes;
+    ULONG         FileNameLength;
+    ULONG         EaSize;
+    LARGE_INTEGER FileId;
+    WCHAR         FileName[1];
+} FILE_ID_FULL_DIR_INFORMATION, *PFILE_ID_FULL_DIR_INFORMATION;
+
+typedef struct _FILE_ID_BOTH_DIR_INFORMATION {
+    ULONG         NextEntryOffset;
+    ULONG         FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG         FileAttributes;
+    ULONG         FileNameLength;
+    ULONG         EaSize;
+    CCHAR         ShortNameLength;
+    WCHAR         ShortName[12];
+    LARGE_INTEGER FileId;
+    WCHAR         FileName[1];
+} FILE_ID_BOTH_DIR_INFORMATION, *PFILE_ID_BOTH_DIR_INFORMATION;
+
 static bool TryGetFileNameFromFileInformation(
     _In_  PWCHAR   fileName,
     _In_  ULONG    fileNameLength,
@@ -1119,7 +1502,7 @@ NTSTATUS HandleFileRenameInformation(
     DetouredScope scope;
     if (scope.Detoured_IsDisabled())
     {
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1140,7 +1523,7 @@ NTSTATUS HandleFileRenameInformation(
 
         SetLastError(lastError);
 
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1161,7 +1544,7 @@ NTSTATUS HandleFileRenameInformation(
     {
         SetLastError(lastError);
 
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1195,7 +1578,8 @@ NTSTATUS HandleFileRenameInformation(
 
     PolicyResult destPolicyResult;
 
-    if (!destPolicyResult.Initialize(targetPath.c_str()))
+    if (!TryGetPolicyForSameDirectoryRename(sourcePath.c_str(), sourcePolicyResult, targetPath.c_str(), destPolicyResult)
+        && !destPolicyResult.Initialize(targetPath.c_str()))
     {
         destPolicyResult.ReportIndeterminatePolicyAndSetLastError(destinationOpContext);
         return DETOURS_STATUS_ACCESS_DENIED;
@@ -1224,7 +1608,8 @@ NTSTATUS HandleFileRenameInformation(
     bool renameDirectory = false;
     vector<ReportData> filesAndDirectoriesToReport;
 
-    if (TryCheckHandleOfDirectory(FileHandle, true, isHandleOfDirectory) && isHandleOfDirectory)
+    if ((TryCheckHandleOfDirectoryFromOverlay(FileHandle, true, isHandleOfDirectory) || TryCheckHandleOfDirectory(FileHandle, true, isHandleOfDirectory))
+        && isHandleOfDirectory)
     {
         renameDirectory = true;
 
@@ -1241,7 +1626,7 @@ NTSTATUS HandleFileRenameInformation(
 
     SetLastError(lastError);
 
-    NTSTATUS result = Real_ZwSetInformationFile(
+    NTSTATUS result = TIMED_REAL(ZwSetInformationFile)(
         FileHandle,
         IoStatusBlock,
         FileInformation,
@@ -1266,6 +1651,11 @@ NTSTATUS HandleFileRenameInformation(
         }
     }
 
+    if (NT_SUCCESS(result))
+    {
+        InvalidateRenamedAccesses(sourcePolicyResult, destPolicyResult, filesAndDirectoriesToReport);
+    }
+
     SetLastError(lastError);
 
     return result;
@@ -1285,7 +1675,7 @@ NTSTATUS HandleFileLinkInformation(
     DetouredScope scope;
     if (scope.Detoured_IsDisabled())
     {
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1322,7 +1712,7 @@ NTSTATUS HandleFileLinkInformation(
     {
         SetLastError(lastError);
 
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1358,7 +1748,7 @@ NTSTATUS HandleFileLinkInformation(
 
     SetLastError(lastError);
 
-    NTSTATUS result = Real_ZwSetInformationFile(
+    NTSTATUS result = TIMED_REAL(ZwSetInformationFile)(
         FileHandle,
         IoStatusBlock,
         FileInformation,
@@ -1391,7 +1781,7 @@ NTSTATUS HandleFileDispositionInformation(
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() || !pDispositionInfo->DeleteFile)
     {
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1412,7 +1802,7 @@ NTSTATUS HandleFileDispositionInformation(
 
         SetLastError(lastError);
 
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1447,7 +1837,7 @@ NTSTATUS HandleFileDispositionInformation(
 
     SetLastError(lastError);
 
-    NTSTATUS result = Real_ZwSetInformationFile(
+    NTSTATUS result = TIMED_REAL(ZwSetInformationFile)(
         FileHandle,
         IoStatusBlock,
         FileInformation,
@@ -1460,6 +1850,12 @@ NTSTATUS HandleFileDispositionInformation(
     }
     
     ReportIfNeeded(sourceAccessCheck, sourceOpContext, sourcePolicyResult, RtlNtStatusToDosError(result));
+
+    if (NT_SUCCESS(result))
+    {
+        // The file goes away once its last handle is closed; whatever gets written at the path from then on is new.
+        InvalidateReportedAccesses(sourcePolicyResult);
+    }
     
     SetLastError(lastError);
 
@@ -1480,7 +1876,7 @@ NTSTATUS HandleFileModeInformation(
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() || ((pModeInfo->Mode & FILE_DELETE_ON_CLOSE) == 0))
     {
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1501,7 +1897,7 @@ NTSTATUS HandleFileModeInformation(
 
         SetLastError(lastError);
 
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1536,7 +1932,7 @@ NTSTATUS HandleFileModeInformation(
 
     SetLastError(lastError);
 
-    NTSTATUS result = Real_ZwSetInformationFile(
+    NTSTATUS result = TIMED_REAL(ZwSetInformationFile)(
         FileHandle,
         IoStatusBlock,
         FileInformation,
@@ -1567,7 +1963,7 @@ NTSTATUS HandleFileNameInformation(
     DetouredScope scope;
     if (scope.Detoured_IsDisabled())
     {
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1588,7 +1984,7 @@ NTSTATUS HandleFileNameInformation(
 
         SetLastError(lastError);
 
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1609,7 +2005,7 @@ NTSTATUS HandleFileNameInformation(
     {
         SetLastError(lastError);
 
-        return Real_ZwSetInformationFile(
+        return TIMED_REAL(ZwSetInformationFile)(
             FileHandle,
             IoStatusBlock,
             FileInformation,
@@ -1643,7 +2039,8 @@ NTSTATUS HandleFileNameInformation(
 
     PolicyResult destPolicyResult;
 
-    if (!destPolicyResult.Initialize(targetPath.c_str()))
+    if (!TryGetPolicyForSameDirectoryRename(sourcePath.c_str(), sourcePolicyResult, targetPath.c_str(), destPolicyResult)
+        && !destPolicyResult.Initialize(targetPath.c_str()))
     {
         destPolicyResult.ReportIndeterminatePolicyAndSetLastError(destinationOpContext);
         return DETOURS_STATUS_ACCESS_DENIED;
@@ -1672,7 +2069,8 @@ NTSTATUS HandleFileNameInformation(
     bool renameDirectory = false;
     vector<ReportData> filesAndDirectoriesToReport;
 
-    if (TryCheckHandleOfDirectory(FileHandle, true, isHandleOfDirectory) && isHandleOfDirectory)
+    if ((TryCheckHandleOfDirectoryFromOverlay(FileHandle, true, isHandleOfDirectory) || TryCheckHandleOfDirectory(FileHandle, true, isHandleOfDirectory))
+        && isHandleOfDirectory)
     {
         renameDirectory = true;
 
@@ -1689,7 +2087,7 @@ NTSTATUS HandleFileNameInformation(
 
     SetLastError(lastError);
 
-    NTSTATUS result = Real_ZwSetInformationFile(
+    NTSTATUS result = TIMED_REAL(ZwSetInformationFile)(
         FileHandle,
         IoStatusBlock,
         FileInformation,
@@ -1714,6 +2112,11 @@ NTSTATUS HandleFileNameInformation(
         }
     }
 
+    if (NT_SUCCESS(result))
+    {
+        InvalidateRenamedAccesses(sourcePolicyResult, destPolicyResult, filesAndDirectoriesToReport);
+    }
+
     SetLastError(lastError);
 
     return result;
@@ -1727,9 +2130,35 @@ NTSTATUS NTAPI Detoured_ZwSetInformationFile(
     _In_  ULONG                  Length,
     _In_  FILE_INFORMATION_CLASS FileInformationClass)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::ZwSetInformationFile);
+
     // if this is not an enabled case that we are covering, just call the Real_Function.
     FILE_INFORMATION_CLASS_EXTRA fileInformationClassExtra = (FILE_INFORMATION_CLASS_EXTRA)FileInformationClass;
 
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache(
+        fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileRenameInformation
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileLinkInformation
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileLinkInformationEx
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileDispositionInformation);
+
+    KnownDirectoryCacheInvalidationScope invalidateKnownDirectories(
+        fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileRenameInformation
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileRenameInformationEx
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileDispositionInformation
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileDispositionInformationEx);
+
+    // Renames and hard links into the temp directory target the redirected one. Unlike for opens, the handlers below check the
+    // redirected target, like they check the source found from the handle: both translate back to the temp directory.
+    RedirectedTargetInformation redirectedInformation(
+        FileInformation,
+        Length,
+        fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileRenameInformation
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileRenameInformationEx
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileLinkInformation
+        || fileInformationClassExtra == FILE_INFORMATION_CLASS_EXTRA::FileLinkInformationEx);
+    FileInformation = redirectedInformation.Get();
+    Length = redirectedInformation.GetLength();
+
     switch (fileInformationClassExtra)
     {
         case FILE_INFORMATION_CLASS_EXTRA::FileRenameInformation:
@@ -1770,7 +2199,7 @@ NTSTATUS NTAPI Detoured_ZwSetInformationFile(
 #pragma warning(suppress: 4061)
     }
 
-    return Real_ZwSetInformationFile(
+    return TIMED_REAL(ZwSetInformationFile)(
         FileHandle,
         IoStatusBlock,
         FileInformation,
@@ -1778,73 +2207,403 @@ NTSTATUS NTAPI Detoured_ZwSetInformationFile(
         FileInformationClass);
 }
 
-IMPLEMENTED(Detoured_CreateProcessW)
-BOOL WINAPI Detoured_CreateProcessW(
-    _In_opt_    LPCWSTR               lpApplicationName,
-    _Inout_opt_ LPWSTR                lpCommandLine,
-    _In_opt_    LPSECURITY_ATTRIBUTES lpProcessAttributes,
-    _In_opt_    LPSECURITY_ATTRIBUTES lpThreadAttributes,
-    _In_        BOOL                  bInheritHandles,
-    _In_        DWORD                 dwCreationFlags,
-    _In_opt_    LPVOID                lpEnvironment,
-    _In_opt_    LPCWSTR               lpCurrentDirectory,
-    _In_        LPSTARTUPINFOW        lpStartupInfo,
-    _Out_       LPPROCESS_INFORMATION lpProcessInformation)
+// Waits, for at most ManifestProcessAdmission::MaxWaitMs, until the process admission gate is open, i.e., until BuildXL finds the commit
+// charge and the CPU usage of the machine low enough for another process to start. Waits that time out let the process start anyway.
+static void WaitForProcessAdmission()
 {
-    if (!MonitorChildProcesses())
+    if (g_processAdmissionGate == NULL || WaitForSingleObject(g_processAdmissionGate, 0) != WAIT_TIMEOUT)
     {
-        return Real_CreateProcessW(
-            lpApplicationName,
-            lpCommandLine,
-            lpProcessAttributes,
-            lpThreadAttributes,
-            bInheritHandles,
-            dwCreationFlags,
-            lpEnvironment,
-            lpCurrentDirectory,
-            lpStartupInfo,
-            lpProcessInformation);
+        return;
     }
 
-    bool retryCreateProcess = true;
-    unsigned retryCount = 0;
+    DWORD lastError = GetLastError();
 
-    while (retryCreateProcess)
+    LARGE_INTEGER waitStart;
+    QueryPerformanceCounter(&waitStart);
+
+    DWORD maxWaitMs = g_manifestProcessAdmission->MaxWaitMs;
+    DWORD result = WaitForSingleObject(g_processAdmissionGate, maxWaitMs == 0 ? INFINITE : maxWaitMs);
+
+    InterlockedIncrement64(&g_detoursProcessAdmissionWaits);
+    InterlockedAdd64(&g_detoursProcessAdmissionWaitMicroseconds, (LONG64)MicrosecondsSince(waitStart));
+
+    if (result != WAIT_OBJECT_0)
     {
-        retryCreateProcess = false;
-        // Make sure we pass the Real_CreateProcessW such that it calls into the prior entry point
-        CreateDetouredProcessStatus status = InternalCreateDetouredProcess(
-            lpApplicationName,
-            lpCommandLine,
-            lpProcessAttributes,
-            lpThreadAttributes,
-            bInheritHandles,
-            dwCreationFlags,
-            lpEnvironment,
-            lpCurrentDirectory,
-            lpStartupInfo,
-            (HANDLE)0,
-            g_pDetouredProcessInjector,
-            lpProcessInformation,
-            Real_CreateProcessW);
+        Dbg(L"A child process was admitted without the process admission gate opening (wait result %d).", (int)result);
+    }
 
-        if (status == CreateDetouredProcessStatus::Succeeded) 
+    SetLastError(lastError);
+}
+
+// Finds the image of a process to start (not null-terminated): lpApplicationName or, without one, the first token of lpCommandLine.
+static bool TryGetImageOfNewProcess(
+    _In_opt_ LPCWSTR lpApplicationName,
+    _In_opt_ LPCWSTR lpCommandLine,
+    _Out_    LPCWSTR& image,
+    _Out_    size_t& imageLength,
+    _Out_    bool& imageFromCommandLine)
+{
+    image = nullptr;
+    imageLength = 0;
+    imageFromCommandLine = false;
+    if (lpApplicationName != nullptr)
+    {
+        image = lpApplicationName;
+        imageLength = wcslen(lpApplicationName);
+    }
+    else if (lpCommandLine != nullptr)
+    {
+        imageFromCommandLine = true;
+        image = lpCommandLine;
+        while (*image == L' ' || *image == L'\t')
         {
-            return TRUE;
+            image++;
         }
-        else if (status == CreateDetouredProcessStatus::ProcessCreationFailed) 
+
+        if (*image == L'"')
         {
-            // Process creation failure is something normally visible to the caller. Preserve last error information.
+            image++;
+            LPCWSTR end = wcschr(image, L'"');
+            imageLength = end != nullptr ? (size_t)(end - image) : wcslen(image);
+        }
+        else
+        {
+            imageLength = wcscspn(image, L" \t");
+        }
+    }
+
+    return imageLength > 0;
+}
+
+// Indicates if a process started from the given image is one of the child processes that break away from the sandbox (see
+// ManifestBreakawayChildProcesses). The image is lpApplicationName or, without one, the first token of lpCommandLine.
+static bool ShouldBreakAwayFromSandbox(_In_opt_ LPCWSTR lpApplicationName, _In_opt_ LPCWSTR lpCommandLine)
+{
+    if (g_manifestBreakawayChildProcesses == nullptr || g_manifestBreakawayChildProcesses->IsEmpty())
+    {
+        return false;
+    }
+
+    LPCWSTR image;
+    size_t imageLength;
+    bool imageFromCommandLine;
+    if (!TryGetImageOfNewProcess(lpApplicationName, lpCommandLine, image, imageLength, imageFromCommandLine))
+    {
+        return false;
+    }
+
+    size_t nameStart = imageLength;
+    while (nameStart > 0 && image[nameStart - 1] != L'\\' && image[nameStart - 1] != L'/')
+    {
+        nameStart--;
+    }
+
+    LPCWSTR name = image + nameStart;
+    size_t nameLength = imageLength - nameStart;
+
+    // A name without an extension matches the ".exe" image as well. So does an image without an extension taken from the command
+    // line, as CreateProcess appends ".exe" to it (it does not for lpApplicationName).
+    static const wchar_t ExeExtension[] = L".exe";
+    const size_t exeExtensionLength = _countof(ExeExtension) - 1;
+    bool imageHasExtension = false;
+    for (size_t i = 0; i < nameLength; i++)
+    {
+        if (name[i] == L'.')
+        {
+            imageHasExtension = true;
+            break;
+        }
+    }
+
+    LPCWSTR breakawayName = reinterpret_cast<LPCWSTR>(g_manifestBreakawayChildProcesses->Names);
+    LPCWSTR breakawayNamesEnd = breakawayName + g_manifestBreakawayChildProcesses->CharCount;
+    while (breakawayName < breakawayNamesEnd && *breakawayName != L'\0')
+    {
+        size_t length = wcsnlen(breakawayName, breakawayNamesEnd - breakawayName);
+        if ((length == nameLength && _wcsnicmp(breakawayName, name, nameLength) == 0)
+            || (length + exeExtensionLength == nameLength
+                && _wcsnicmp(breakawayName, name, length) == 0
+                && _wcsnicmp(name + length, ExeExtension, exeExtensionLength) == 0)
+            || (imageFromCommandLine
+                && !imageHasExtension
+                && nameLength + exeExtensionLength == length
+                && _wcsnicmp(breakawayName, name, nameLength) == 0
+                && _wcsnicmp(breakawayName + nameLength, ExeExtension, exeExtensionLength) == 0))
+        {
+            return true;
+        }
+
+        breakawayName += length + 1;
+    }
+
+    return false;
+}
+
+// Finds the image of a process to start from the redirected temp directory (see TempRedirection.h), in the directory it is redirected to:
+// process creation opens the image with a system call that is not redirected. Only images given by path are redirected; as CreateProcess
+// does, ".exe" is appended to an image of the command line without an extension. Returns false if the image is not a file of the
+// redirected temp directory.
+static bool TryGetRedirectedImageOfNewProcess(
+    _In_opt_ LPCWSTR       lpApplicationName,
+    _In_opt_ LPCWSTR       lpCommandLine,
+    _Out_    std::wstring& redirectedImage)
+{
+    redirectedImage.clear();
+
+    LPCWSTR image;
+    size_t imageLength;
+    bool imageFromCommandLine;
+    if (!RedirectsTempDirectory() || !TryGetImageOfNewProcess(lpApplicationName, lpCommandLine, image, imageLength, imageFromCommandLine))
+    {
+        return false;
+    }
+
+    std::wstring imagePath(image, imageLength);
+    size_t nameStart = imagePath.find_last_of(L"\\/");
+    if (nameStart == std::wstring::npos)
+    {
+        return false;
+    }
+
+    if (imageFromCommandLine && imagePath.find(L'.', nameStart) == std::wstring::npos)
+    {
+        imagePath.append(L".exe");
+    }
+
+    CanonicalizedPath canonicalizedImage = CanonicalizedPath::Canonicalize(imagePath.c_str());
+    if (canonicalizedImage.IsNull()
+        || !TryRedirectPath(canonicalizedImage.GetPathStringWithoutTypePrefix(), redirectedImage))
+    {
+        return false;
+    }
+
+    DWORD attributes = Real_GetFileAttributesW(redirectedImage.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) == 0;
+}
+
+// Starts a child process that breaks away from the sandbox (see ShouldBreakAwayFromSandbox), outside of the job of the pip and
+// without detours. The process inherits no handle, whatever bInheritHandles and the standard handles of lpStartupInfo say: BuildXL
+// waits for every write handle of the report pipe and of the standard output and error of the pip to be closed before it completes
+// the pip, and a server that outlives the pip (which is why it breaks away) would otherwise hold those open.
+static BOOL CreateProcessBreakingAway(
+    _In_opt_    LPCWSTR               lpApplicationName,
+    _Inout_opt_ LPWSTR                lpCommandLine,
+    _In_opt_    LPSECURITY_ATTRIBUTES lpProcessAttributes,
+    _In_opt_    LPSECURITY_ATTRIBUTES lpThreadAttributes,
+    _In_        DWORD                 dwCreationFlags,
+    _In_opt_    LPVOID                lpEnvironment,
+    _In_opt_    LPCWSTR               lpCurrentDirectory,
+    _In_        LPSTARTUPINFOW        lpStartupInfo,
+    _Out_       LPPROCESS_INFORMATION lpProcessInformation)
+{
+    // An extended startup info carries an attribute list after the regular fields; it is passed on as is.
+    STARTUPINFOEXW startupInfo;
+    ZeroMemory(&startupInfo, sizeof(startupInfo));
+    DWORD startupInfoSize = (dwCreationFlags & EXTENDED_STARTUPINFO_PRESENT) != 0 ? sizeof(STARTUPINFOEXW) : sizeof(STARTUPINFOW);
+    memcpy(&startupInfo, lpStartupInfo, min(startupInfoSize, lpStartupInfo->cb));
+    startupInfo.StartupInfo.cb = startupInfoSize;
+
+    if ((startupInfo.StartupInfo.dwFlags & STARTF_USESTDHANDLES) != 0)
+    {
+        startupInfo.StartupInfo.dwFlags &= ~STARTF_USESTDHANDLES;
+        startupInfo.StartupInfo.hStdInput = NULL;
+        startupInfo.StartupInfo.hStdOutput = NULL;
+        startupInfo.StartupInfo.hStdError = NULL;
+    }
+
+    return TIMED_REAL(CreateProcessW)(
+        lpApplicationName,
+        lpCommandLine,
+        lpProcessAttributes,
+        lpThreadAttributes,
+        FALSE,
+        dwCreationFlags | CREATE_BREAKAWAY_FROM_JOB,
+        lpEnvironment,
+        lpCurrentDirectory,
+        &startupInfo.StartupInfo,
+        lpProcessInformation);
+}
+
+// Waits before retrying to detour a process, for a backoff that starts at RETRY_DETOURING_PROCESS_INITIAL_BACKOFF_US and doubles
+// with every retry. Half of each backoff is jittered, so that the processes whose detouring failed at the same time (failures
+// cluster under load) do not all retry at once. Returns false, without waiting, once the retries would wait for more than
+// RETRY_DETOURING_PROCESS_MAX_TOTAL_BACKOFF_US in total.
+static bool BackOffBeforeDetouringRetry(unsigned retryCount, ULONG64& totalBackoffMicroseconds)
+{
+    ULONG64 backoffMicroseconds = (ULONG64)RETRY_DETOURING_PROCESS_INITIAL_BACKOFF_US << retryCount;
+
+    // xorshift, seeded per retry from the clock and the thread.
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    ULONG64 random = (ULONG64)now.QuadPart ^ ((ULONG64)GetCurrentThreadId() * 0x9E3779B97F4A7C15ull);
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+
+    backoffMicroseconds = backoffMicroseconds / 2 + random % (backoffMicroseconds / 2 + 1);
+
+    if (totalBackoffMicroseconds + backoffMicroseconds > RETRY_DETOURING_PROCESS_MAX_TOTAL_BACKOFF_US)
+    {
+        return false;
+    }
+
+    totalBackoffMicroseconds += backoffMicroseconds;
+
+    if (backoffMicroseconds >= 1000)
+    {
+        Sleep((DWORD)(backoffMicroseconds / 1000));
+    }
+    else
+    {
+        // Sleep cannot wait for less than a millisecond (and usually waits for a whole timer tick), so shorter backoffs yield instead.
+        while (MicrosecondsSince(now) < backoffMicroseconds)
+        {
+            SwitchToThread();
+        }
+    }
+
+    return true;
+}
+
+IMPLEMENTED(Detoured_CreateProcessW)
+BOOL WINAPI Detoured_CreateProcessW(
+    _In_opt_    LPCWSTR               lpApplicationName,
+    _Inout_opt_ LPWSTR                lpCommandLine,
+    _In_opt_    LPSECURITY_ATTRIBUTES lpProcessAttributes,
+    _In_opt_    LPSECURITY_ATTRIBUTES lpThreadAttributes,
+    _In_        BOOL                  bInheritHandles,
+    _In_        DWORD                 dwCreationFlags,
+    _In_opt_    LPVOID                lpEnvironment,
+    _In_opt_    LPCWSTR               lpCurrentDirectory,
+    _In_        LPSTARTUPINFOW        lpStartupInfo,
+    _Out_       LPPROCESS_INFORMATION lpProcessInformation)
+{
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateProcessW);
+
+    // A program written to the redirected temp directory is started from where it actually is. The command line is left as it is.
+    std::wstring redirectedImage;
+    if (TryGetRedirectedImageOfNewProcess(lpApplicationName, lpCommandLine, redirectedImage))
+    {
+        lpApplicationName = redirectedImage.c_str();
+    }
+
+    // The reports of the child must not overtake the ones this process queued (or summarized) before starting it.
+    // The queue and the summary go to the report buffer, so flush it last.
+    DrainReportQueue(false);
+    FlushAccessSummary(false);
+    FlushReportBuffer(false);
+
+    WaitForProcessAdmission();
+
+    if (ShouldBreakAwayFromSandbox(lpApplicationName, lpCommandLine))
+    {
+        // Started outside of the job of the pip and without detours, so that the process can outlive the pip. If the job (or a job
+        // nested in it) does not allow it, the process is started in the sandbox as any other.
+        BOOL created = CreateProcessBreakingAway(
+            lpApplicationName,
+            lpCommandLine,
+            lpProcessAttributes,
+            lpThreadAttributes,
+            dwCreationFlags,
+            lpEnvironment,
+            lpCurrentDirectory,
+            lpStartupInfo,
+            lpProcessInformation);
+
+        if (created || GetLastError() != ERROR_ACCESS_DENIED)
+        {
+            return created;
+        }
+
+        Dbg(L"A child process could not break away from the job of the pip. It is started in the sandbox.");
+        SetLastError(ERROR_SUCCESS);
+    }
+
+    if (!MonitorChildProcesses())
+    {
+        // Unmonitored children are still processes of the pip, with its priorities.
+        BOOL created = TIMED_REAL(CreateProcessW)(
+            lpApplicationName,
+            lpCommandLine,
+            lpProcessAttributes,
+            lpThreadAttributes,
+            bInheritHandles,
+            ApplyPriorityClassToCreationFlags(dwCreationFlags),
+            lpEnvironment,
+            lpCurrentDirectory,
+            lpStartupInfo,
+            lpProcessInformation);
+
+        if (created)
+        {
+            ApplyIoPriorityToProcess(lpProcessInformation->hProcess);
+        }
+
+        return created;
+    }
+
+    bool retryCreateProcess = true;
+    unsigned retryCount = 0;
+    ULONG64 totalBackoffMicroseconds = 0;
+
+    while (retryCreateProcess)
+    {
+        retryCreateProcess = false;
+        // Make sure we pass the Real_CreateProcessW such that it calls into the prior entry point
+        CreateDetouredProcessStatus status = InternalCreateDetouredProcess(
+            lpApplicationName,
+            lpCommandLine,
+            lpProcessAttributes,
+            lpThreadAttributes,
+            bInheritHandles,
+            dwCreationFlags,
+            lpEnvironment,
+            lpCurrentDirectory,
+            lpStartupInfo,
+            (HANDLE)0,
+            g_pDetouredProcessInjector,
+            lpProcessInformation,
+            Real_CreateProcessW);
+
+        if (status == CreateDetouredProcessStatus::Succeeded) 
+        {
+            return TRUE;
+        }
+        else if (status == CreateDetouredProcessStatus::ProcessCreationFailed) 
+        {
+            // Process creation failure is something normally visible to the caller. Preserve last error information.
             return FALSE;
         }
         else 
         {
-            Dbg(L"Failure Detouring the process - Error: 0x%08X.", GetLastError());
+            DWORD error = GetLastError();
+            Dbg(L"Failure Detouring the process - Error: 0x%08X.", error);
             
-            if (GetLastError() == ERROR_INVALID_FUNCTION &&
+            if (error == ERROR_INVALID_FUNCTION &&
                 retryCount < RETRY_DETOURING_PROCESS_COUNT)
             {
-                Sleep(1000); // Wait a second and try again.
+                if (LogProcessDetouringStatus())
+                {
+                    ReportProcessDetouringStatus(
+                        ProcessDetouringStatus_Retrying,
+                        lpApplicationName,
+                        lpCommandLine,
+                        1,
+                        (HANDLE)0,
+                        0,
+                        dwCreationFlags,
+                        false,
+                        error,
+                        status);
+                }
+
+                if (!BackOffBeforeDetouringRetry(retryCount, totalBackoffMicroseconds))
+                {
+                    Dbg(L"Giving up on starting process %s after %d retries.", lpCommandLine, retryCount);
+                    SetLastError(ERROR_ACCESS_DENIED);
+                    return FALSE;
+                }
+
                 retryCount++;
                 Dbg(L"Retrying to start process %s for %d time.", lpCommandLine, retryCount);
                 retryCreateProcess = true;
@@ -1875,12 +2634,14 @@ BOOL WINAPI Detoured_CreateProcessA(
     _In_        LPSTARTUPINFOA        lpStartupInfo,
     _Out_       LPPROCESS_INFORMATION lpProcessInformation)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateProcessA);
+
     // Note that we only do Real_CreateProcessA
     // for the case of not doing child processes.
     // Otherwise this converts to CreateProcessW
     if (!MonitorChildProcesses())
     {
-        return Real_CreateProcessA(
+        return TIMED_REAL(CreateProcessA)(
             lpApplicationName,
             lpCommandLine,
             lpProcessAttributes,
@@ -1935,11 +2696,20 @@ BOOL WINAPI Detoured_CreateProcessA(
     return result;
 }
 
+// The volume of the file, if known, saves the query on volumes without a change journal, which would fail it anyway.
 static bool TryGetUsn(
-    _In_    HANDLE handle, 
-    _Inout_ USN&   usn,
-    _Inout_ DWORD& error)
+    _In_      HANDLE                   handle, 
+    _Inout_   USN&                     usn,
+    _Inout_   DWORD&                   error,
+    _In_opt_  VolumeInformation const* volume = nullptr,
+    _Out_opt_ DWORDLONG*               fileReferenceNumber = nullptr)
 {
+    if (volume != nullptr && !volume->SupportsUsnJournal())
+    {
+        error = ERROR_INVALID_FUNCTION;
+        return false;
+    }
+
     // TODO: http://msdn.microsoft.com/en-us/library/windows/desktop/aa364993(v=vs.85).aspx says to call GetVolumeInformation to get maximum component length. 
     const size_t MaximumComponentLength = 255;
     const size_t MaximumChangeJournalRecordSize =
@@ -1967,14 +2737,84 @@ static bool TryGetUsn(
     assert(bytesReturned == usnRecord.RecordLength);
     assert(2 == usnRecord.MajorVersion);
     usn = usnRecord.Usn;
+    if (fileReferenceNumber != nullptr)
+    {
+        *fileReferenceNumber = usnRecord.FileReferenceNumber;
+    }
+
     return true;
 }
 
+// Values of IO_STATUS_BLOCK::Information after NtCreateFile, and of the byte offset of NtWriteFile, from wdm.h.
+#ifndef FILE_SUPERSEDED
+#define FILE_SUPERSEDED 0x00000000
+#define FILE_CREATED 0x00000002
+#define FILE_OVERWRITTEN 0x00000003
+#endif
+
+#ifndef FILE_WRITE_TO_END_OF_FILE
+#define FILE_WRITE_TO_END_OF_FILE 0xffffffff
+#endif
+
+#ifndef FILE_USE_FILE_POINTER_POSITION
+#define FILE_USE_FILE_POINTER_POSITION 0xfffffffe
+#endif
+
+// Creates the hasher of the writes through a new file handle with FileAccessManifestExtraFlag::HashOutputsWhileWriting, if the file
+// is empty once opened (it was created, truncated or superseded) and the handle may write it. A hash of the writes to a file that
+// had content already would miss that content, and handles opened only to append write at an end the detours do not track.
+static std::shared_ptr<OutputHasher> TryCreateOutputHasher(PolicyResult const& policyResult, DWORD desiredAccess, bool fileIsEmpty)
+{
+    if (!HashOutputsWhileWriting() || !fileIsEmpty || !policyResult.AllowWrite()
+        || (desiredAccess & (FILE_WRITE_DATA | GENERIC_WRITE | GENERIC_ALL)) == 0)
+    {
+        return nullptr;
+    }
+
+    return std::make_shared<OutputHasher>();
+}
+
+// Reports the hash of the writes through a handle about to be closed, if they were hashed.
+static void ReportOutputHashOnClose(HANDLE handle)
+{
+    HandleOverlayRef overlay = TryLookupHandleOverlay(handle);
+    if (!overlay || !overlay->Hasher)
+    {
+        return;
+    }
+
+    OutputHasher& hasher = *overlay->Hasher;
+    BYTE hash[OUTPUT_HASH_SIZE];
+    FILETIME lastWriteTime = { 0 };
+
+    hasher.Lock();
+
+    // Writes that do not go through NtWriteFile on this handle (a mapped view, say) are not hashed; the ones that change the size
+    // of the file are caught here.
+    LARGE_INTEGER size;
+    BY_HANDLE_FILE_INFORMATION information;
+    if (!GetFileSizeEx(handle, &size) || (uint64_t)size.QuadPart != hasher.GetLength() || !GetFileInformationByHandle(handle, &information))
+    {
+        hasher.Invalidate();
+    }
+    else
+    {
+        lastWriteTime = information.ftLastWriteTime;
+    }
+
+    uint64_t length = hasher.GetLength();
+    bool hashed = hasher.TryFinalize(hash);
+    hasher.Unlock();
+
+    ReportOutputContentHash(*overlay->Policy, hashed ? hash : nullptr, length, lastWriteTime);
+}
+
 // If we are not attached this is not App use of RAM but the OS proess startup side of the world.
 extern bool g_isAttached;
 
 IMPLEMENTED(Detoured_CreateFileW)
-HANDLE WINAPI Detoured_CreateFileW(
+template <typename TFamFlags>
+static HANDLE WINAPI Detoured_CreateFileWSpecialized(
     _In_     LPCWSTR               lpFileName,
     _In_     DWORD                 dwDesiredAccess,
     _In_     DWORD                 dwShareMode,
@@ -1983,13 +2823,18 @@ HANDLE WINAPI Detoured_CreateFileW(
     _In_     DWORD                 dwFlagsAndAttributes,
     _In_opt_ HANDLE                hTemplateFile)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateFileW);
+
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache(MayCreateOrDeleteOnCreateFile(dwDesiredAccess, dwCreationDisposition, dwFlagsAndAttributes));
+    KnownDirectoryCacheInvalidationScope invalidateKnownDirectories((dwFlagsAndAttributes & FILE_FLAG_DELETE_ON_CLOSE) != 0);
+
     DetouredScope scope;
 
     // The are potential complication here: How to handle a call to CreateFile with the FILE_FLAG_OPEN_REPARSE_POINT? 
     // Is it a real file access. Some code in Windows (urlmon.dll) inspects reparse points when mapping a path to a particular security "Zone".
     if (scope.Detoured_IsDisabled() || IsNullOrEmptyW(lpFileName) || IsSpecialDeviceName(lpFileName))
     {
-        return Real_CreateFileW(
+        return TIMED_REAL(CreateFileW)(
             lpFileName,
             dwDesiredAccess,
             dwShareMode,
@@ -2016,6 +2861,56 @@ HANDLE WINAPI Detoured_CreateFileW(
         return INVALID_HANDLE_VALUE;
     }
 
+    if (policyResult.IsTransparent())
+    {
+        // Whatever the access turns out to be, it is allowed and not reported. Only the sharing (see below), the accesses to the targets of
+        // reparse points and the overlays of directory handles (for the opens relative to them) remain to be taken care of.
+        DWORD transparentSharedAccess = dwShareMode | FILE_SHARE_DELETE;
+
+        HANDLE transparentHandle = TIMED_REAL(CreateFileW)(
+            lpFileName,
+            dwDesiredAccess,
+            transparentSharedAccess,
+            lpSecurityAttributes,
+            dwCreationDisposition,
+            dwFlagsAndAttributes,
+            hTemplateFile);
+
+        error = GetLastError();
+
+        if (!TFamFlags::IgnoreReparsePoints() && !WantsProbeOnlyAccess(dwDesiredAccess) && IsReparsePoint(lpFileName)
+            && !EnforceChainOfReparsePointAccesses(
+                policyResult.GetCanonicalizedPath(),
+                (dwFlagsAndAttributes & FILE_FLAG_OPEN_REPARSE_POINT) != 0 ? transparentHandle : INVALID_HANDLE_VALUE,
+                dwDesiredAccess,
+                transparentSharedAccess,
+                dwCreationDisposition,
+                dwFlagsAndAttributes,
+                false))
+        {
+            // The handle may be invalid (e.g. for a symlink whose target does not exist); the error is the denial of the target.
+            error = GetLastError();
+            if (transparentHandle != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(transparentHandle);
+            }
+
+            SetLastError(error);
+            return INVALID_HANDLE_VALUE;
+        }
+
+        // Only FILE_FLAG_BACKUP_SEMANTICS opens directories.
+        RegisterTransparentDirectoryOverlay(
+            transparentHandle,
+            policyResult,
+            (dwFlagsAndAttributes & FILE_FLAG_BACKUP_SEMANTICS) != 0,
+            false,
+            (dwFlagsAndAttributes & FILE_FLAG_OPEN_REPARSE_POINT) == 0);
+
+        SetLastError(error);
+        return transparentHandle;
+    }
+
     // We start with allow / ignore (no access requested) and then restrict based on read / write (maybe both, maybe neither!)
     AccessCheckResult accessCheck(RequestedAccess::None, ResultAction::Allow, ReportLevel::Ignore);
     bool forceReadOnlyForRequestedRWAccess = false;
@@ -2024,7 +2919,7 @@ HANDLE WINAPI Detoured_CreateFileW(
         error = GetLastError();
         accessCheck = policyResult.CheckWriteAccess();
 
-        if (ForceReadOnlyForRequestedReadWrite() && accessCheck.ResultAction != ResultAction::Allow) 
+        if (TFamFlags::ForceReadOnlyForRequestedReadWrite() && accessCheck.ResultAction != ResultAction::Allow) 
         {
             // If ForceReadOnlyForRequestedReadWrite() is true, then we allow read for requested read-write access so long as the tool is allowed to read.
             // In such a case, we change the desired access to read only (see the call to Real_CreateFileW below).
@@ -2078,9 +2973,11 @@ HANDLE WINAPI Detoured_CreateFileW(
     DWORD desiredAccess = !forceReadOnlyForRequestedRWAccess ? dwDesiredAccess : (dwDesiredAccess & FILE_GENERIC_READ);
     DWORD sharedAccess = !forceReadOnlyForRequestedRWAccess ? (dwShareMode | FILE_SHARE_DELETE | readSharingIfNeeded) : FILE_SHARE_READ | FILE_SHARE_DELETE;
     
+    MaterializeIfNeeded(policyResult);
+
     error = ERROR_SUCCESS;
 
-    HANDLE handle = Real_CreateFileW(
+    HANDLE handle = TIMED_REAL(CreateFileW)(
         lpFileName,
         desiredAccess,
         sharedAccess,
@@ -2091,7 +2988,10 @@ HANDLE WINAPI Detoured_CreateFileW(
 
     error = GetLastError();
 
-    if (!IgnoreReparsePoints() && IsReparsePoint(lpFileName) && !WantsProbeOnlyAccess(dwDesiredAccess))
+    // The checks following the open share a single query of the handle.
+    OpenedFileStat openedFileStat(handle, (dwFlagsAndAttributes & FILE_FLAG_OPEN_REPARSE_POINT) != 0);
+
+    if (!TFamFlags::IgnoreReparsePoints() && IsOpenedReparsePoint(lpFileName, openedFileStat) && !WantsProbeOnlyAccess(dwDesiredAccess))
     {
         // (1) Reparse point should not be ignored.
         // (2) File/Directory is a reparse point.
@@ -2127,7 +3027,20 @@ HANDLE WINAPI Detoured_CreateFileW(
     // FILE_FLAG_BACKUP_SEMANTICS and so get INVALID_HANDLE_VALUE / ERROR_ACCESS_DENIED. In that kind of
     // case we have a fallback to re-probe. See function remarks.
     // We skip this to avoid the fallback probe if we don't believe the path exists, since increasing failed-probe volume is dangerous for perf.
-    readContext.OpenedDirectory = (readContext.FileExistence == FileExistence::Existent) && IsHandleOrPathToDirectory(handle, lpFileName, false);
+    // CreateFileW cannot create directories, nor truncate them, so a handle to a file it created or truncated needs no check either.
+    bool fileIsEmpty =
+        handle != INVALID_HANDLE_VALUE
+        && (dwCreationDisposition == CREATE_NEW
+            || dwCreationDisposition == CREATE_ALWAYS
+            || dwCreationDisposition == TRUNCATE_EXISTING
+            || (dwCreationDisposition == OPEN_ALWAYS && error != ERROR_ALREADY_EXISTS));
+
+    if (fileIsEmpty)
+    {
+        InterlockedIncrement64(&g_detoursDirectoryQueriesAvoided);
+    }
+
+    readContext.OpenedDirectory = (readContext.FileExistence == FileExistence::Existent) && !fileIsEmpty && IsHandleOrPathToDirectory(openedFileStat, lpFileName, false);
 
     if (WantsReadAccess(dwDesiredAccess)) 
     {
@@ -2141,16 +3054,23 @@ HANDLE WINAPI Detoured_CreateFileW(
     }
 
     // Additionally, for files (not directories) we can enforce a USN match (or report).
+    // Reading the USN costs an FSCTL per open, so it is only read when there is an expected USN or a report of it is requested.
     bool unexpectedUsn = false;
     bool reportUsn = false;
     USN usn = -1; // -1, or 0xFFFFFFFFFFFFFFFF indicates that USN could/was not obtained
     if (!readContext.OpenedDirectory) // We do not want to report accesses to directories.
     {
-        reportUsn = handle != INVALID_HANDLE_VALUE && policyResult.ReportUsnAfterOpen();
+        reportUsn = handle != INVALID_HANDLE_VALUE && policyResult.ShouldReportUsnAfterOpen();
         bool checkUsn = handle != INVALID_HANDLE_VALUE && policyResult.GetExpectedUsn() != -1;
 
+        // The volume is looked up by the directory of the file, once per directory.
+        VolumeInformation volume;
+        bool volumeKnown = (reportUsn || checkUsn) && TryGetVolumeInformation(policyResult.GetCanonicalizedPath(), volume);
+
         DWORD getUsnError = ERROR_SUCCESS;
-        if ((reportUsn || checkUsn) && !TryGetUsn(handle, /* inout */ usn, /* inout */ getUsnError))
+        DWORDLONG fileReferenceNumber = 0;
+        if ((reportUsn || checkUsn)
+            && !TryGetUsn(handle, /* inout */ usn, /* inout */ getUsnError, volumeKnown ? &volume : nullptr, &fileReferenceNumber))
         {
             WriteWarningOrErrorF(L"Could not obtain USN for file path '%s'. Error: %d",
                 policyResult.GetCanonicalizedPath().GetPathString(), getUsnError);
@@ -2173,6 +3093,13 @@ HANDLE WINAPI Detoured_CreateFileW(
             return INVALID_HANDLE_VALUE;
         }
 
+        // The USN record names the file as well, so reports of this open can carry its identity.
+        if (fileReferenceNumber != 0 && volumeKnown)
+        {
+            opContext.VolumeSerialNumber = volume.SerialNumber;
+            opContext.FileIdLow = fileReferenceNumber;
+        }
+
         if (checkUsn && usn != policyResult.GetExpectedUsn())
         {
             WriteWarningOrErrorF(L"USN mismatch.  Actual USN: 0x%08x, expected USN: 0x%08x.",
@@ -2216,7 +3143,9 @@ HANDLE WINAPI Detoured_CreateFileW(
     else if (handle != INVALID_HANDLE_VALUE) 
     {
         HandleType handleType = readContext.OpenedDirectory ? HandleType::Directory : HandleType::File;
-        RegisterHandleOverlay(handle, accessCheck, policyResult, handleType);
+        RegisterHandleOverlay(handle, accessCheck, policyResult, handleType,
+            handleType == HandleType::File ? TryCreateOutputHasher(policyResult, desiredAccess, fileIsEmpty) : nullptr,
+            (dwFlagsAndAttributes & FILE_FLAG_OPEN_REPARSE_POINT) == 0, openedFileStat.GetIfQueried(), openedFileStat.GetGeneration());
     }
 
     // Propagate the correct error code to the caller.
@@ -2224,6 +3153,26 @@ HANDLE WINAPI Detoured_CreateFileW(
     return handle;
 }
 
+// The variant of the detour reading every FAM flag from the manifest, and the one the other detours call.
+HANDLE WINAPI Detoured_CreateFileW(
+    _In_     LPCWSTR               lpFileName,
+    _In_     DWORD                 dwDesiredAccess,
+    _In_     DWORD                 dwShareMode,
+    _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes,
+    _In_     DWORD                 dwCreationDisposition,
+    _In_     DWORD                 dwFlagsAndAttributes,
+    _In_opt_ HANDLE                hTemplateFile)
+{
+    return Detoured_CreateFileWSpecialized<GenericFamFlags>(
+        lpFileName,
+        dwDesiredAccess,
+        dwShareMode,
+        lpSecurityAttributes,
+        dwCreationDisposition,
+        dwFlagsAndAttributes,
+        hTemplateFile);
+}
+
 IMPLEMENTED(Detoured_CloseHandle)
 BOOL WINAPI Detoured_CloseHandle(_In_ HANDLE handle)
 {
@@ -2234,9 +3183,14 @@ BOOL WINAPI Detoured_CloseHandle(_In_ HANDLE handle)
         return Real_CloseHandle(handle);
     }
 
+    if (HashOutputsWhileWriting())
+    {
+        ReportOutputHashOnClose(handle);
+    }
+
     // Make sure the handle is closed after the object is removed from the map.
     // This way the handle will never be assigned to a another object before removed from the table.
-    CloseHandleOverlay(handle , true); 
+    CloseHandleOverlay(handle);
 
     return Real_CloseHandle(handle);
 }
@@ -2251,11 +3205,13 @@ HANDLE WINAPI Detoured_CreateFileA(
     _In_     DWORD                 dwFlagsAndAttributes,
     _In_opt_ HANDLE                hTemplateFile)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
         {
-            return Real_CreateFileA(
+            return TIMED_REAL(CreateFileA)(
                 lpFileName,
                 dwDesiredAccess,
                 dwShareMode,
@@ -2292,22 +3248,58 @@ BOOL WINAPI Detoured_GetVolumePathNameW(
     _In_  DWORD   cchBufferLength
     )
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::GetVolumePathNameW);
+
     // The reason for this scope check is that GetVolumePathNameW calls many other detoured APIs.
     // We do not need to have any reports for file accesses from these APIs, because thay are not what the application called.
     // (It was purely inserted by us.)
 
     DetouredScope scope;
-    return Real_GetVolumePathNameW(lpszFileName, lpszVolumePathName, cchBufferLength);
+    return TIMED_REAL(GetVolumePathNameW)(lpszFileName, lpszVolumePathName, cchBufferLength);
+}
+
+// Finds the metadata the manifest carries for a declared input (see ManifestFileMetadata), from which the attribute probes
+// of the file are then answered instead of from the file system. Files the pip may write do not qualify, since their
+// metadata may have changed in the meantime.
+static const ManifestFileMetadata::Entry* TryFindManifestFileMetadata(PolicyResult const& policyResult)
+{
+    if (g_manifestFileMetadata == nullptr
+        || g_manifestFileMetadata->EntryCount == 0
+        || !policyResult.IsExactManifestMatch()
+        || policyResult.AllowWrite())
+    {
+        return nullptr;
+    }
+
+    const ManifestFileMetadata::Entry* metadata = g_manifestFileMetadata->FindEntry(policyResult.GetPathId());
+    if (metadata != nullptr)
+    {
+        IncrementFeatureCounter(FeatureCounter::ProbesAnsweredFromManifest);
+    }
+
+    return metadata;
+}
+
+static void CopyManifestFileMetadata(ManifestFileMetadata::Entry const& metadata, WIN32_FILE_ATTRIBUTE_DATA* result)
+{
+    result->dwFileAttributes = metadata.FileAttributes;
+    result->ftCreationTime = { metadata.CreationTime.LowDateTime, metadata.CreationTime.HighDateTime };
+    result->ftLastAccessTime = { metadata.LastAccessTime.LowDateTime, metadata.LastAccessTime.HighDateTime };
+    result->ftLastWriteTime = { metadata.LastWriteTime.LowDateTime, metadata.LastWriteTime.HighDateTime };
+    result->nFileSizeHigh = metadata.FileSizeHigh;
+    result->nFileSizeLow = metadata.FileSizeLow;
 }
 
 IMPLEMENTED(Detoured_GetFileAttributesW)
 DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::GetFileAttributesW);
+
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() || IsNullOrEmptyW(lpFileName) || IsSpecialDeviceName(lpFileName))
     {
 #pragma warning(suppress: 6387)
-        return Real_GetFileAttributesW(lpFileName);
+        return TIMED_REAL(GetFileAttributesW)(lpFileName);
     }
 
     FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"GetFileAttributes", lpFileName);
@@ -2322,11 +3314,19 @@ DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
     DWORD attributes = INVALID_FILE_ATTRIBUTES;
     DWORD error = ERROR_SUCCESS;
     
-    attributes = Real_GetFileAttributesW(lpFileName);
-
-    if (attributes == INVALID_FILE_ATTRIBUTES) 
+    const ManifestFileMetadata::Entry* metadata = TryFindManifestFileMetadata(policyResult);
+    if (metadata != nullptr)
     {
-        error = GetLastError();
+        attributes = metadata->FileAttributes;
+    }
+    else
+    {
+        attributes = TIMED_REAL(GetFileAttributesW)(lpFileName);
+
+        if (attributes == INVALID_FILE_ATTRIBUTES) 
+        {
+            error = GetLastError();
+        }
     }
 
     // Now we can make decisions based on the file's existence and type.
@@ -2352,12 +3352,14 @@ DWORD WINAPI Detoured_GetFileAttributesW(_In_  LPCWSTR lpFileName)
 IMPLEMENTED(Detoured_GetFileAttributesA)
 DWORD WINAPI Detoured_GetFileAttributesA(_In_  LPCSTR lpFileName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::GetFileAttributesA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
         {
 #pragma warning(suppress: 6387)
-            return Real_GetFileAttributesA(lpFileName);
+            return TIMED_REAL(GetFileAttributesA)(lpFileName);
         }
     }
 
@@ -2371,10 +3373,12 @@ BOOL WINAPI Detoured_GetFileAttributesExW(
     _In_  GET_FILEEX_INFO_LEVELS fInfoLevelId,
     _Out_ LPVOID                 lpFileInformation)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::GetFileAttributesExW);
+
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() || IsNullOrEmptyW(lpFileName) || IsSpecialDeviceName(lpFileName))
     {
-        return Real_GetFileAttributesExW(lpFileName, fInfoLevelId, lpFileInformation);
+        return TIMED_REAL(GetFileAttributesExW)(lpFileName, fInfoLevelId, lpFileInformation);
     }
 
     FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"GetFileAttributesEx", lpFileName);
@@ -2393,15 +3397,24 @@ BOOL WINAPI Detoured_GetFileAttributesExW(
     // We could be clever and avoid calling this when already doomed to failure. However:
     // - Unlike CreateFile, this query can't interfere with other processes
     // - We want lpFileInformation to be zeroed according to whatever policy GetFileAttributesEx has.
-    querySucceeded = Real_GetFileAttributesExW(lpFileName, fInfoLevelId, lpFileInformation);
-    if (!querySucceeded) 
-    {
-        error = GetLastError();
-    }
-
+    // Declared inputs whose metadata the manifest carries are the exception: the query would only tell what BuildXL knows already.
     WIN32_FILE_ATTRIBUTE_DATA* fileStandardInfo = (fInfoLevelId == GetFileExInfoStandard && lpFileInformation != nullptr) ?
         (WIN32_FILE_ATTRIBUTE_DATA*)lpFileInformation : nullptr;
 
+    const ManifestFileMetadata::Entry* metadata = fileStandardInfo != nullptr ? TryFindManifestFileMetadata(policyResult) : nullptr;
+    if (metadata != nullptr)
+    {
+        CopyManifestFileMetadata(*metadata, fileStandardInfo);
+    }
+    else
+    {
+        querySucceeded = TIMED_REAL(GetFileAttributesExW)(lpFileName, fInfoLevelId, lpFileInformation);
+        if (!querySucceeded) 
+        {
+            error = GetLastError();
+        }
+    }
+
     // Now we can make decisions based on existence and type.
     FileReadContext fileReadContext;
     fileReadContext.InferExistenceFromError(error);
@@ -2437,11 +3450,13 @@ BOOL WINAPI Detoured_GetFileAttributesExA(
     _In_  GET_FILEEX_INFO_LEVELS fInfoLevelId,
     _Out_ LPVOID                 lpFileInformation)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::GetFileAttributesExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
         {
-            return Real_GetFileAttributesExA(
+            return TIMED_REAL(GetFileAttributesExA)(
                 lpFileName,
                 fInfoLevelId,
                 lpFileInformation);
@@ -2471,6 +3486,8 @@ BOOL WINAPI Detoured_CopyFileW(
     _In_ BOOL bFailIfExists
     )
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CopyFileW);
+
     // Don't duplicate complex access-policy logic between CopyFileEx and CopyFile.
     // This forwarder is identical to the internal implementation of CopyFileExW
     // so it should be safe to always forward at our level.
@@ -2489,11 +3506,13 @@ BOOL WINAPI Detoured_CopyFileA(
     _In_ LPCSTR lpNewFileName,
     _In_ BOOL   bFailIfExists)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CopyFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName))
         {
-            return Real_CopyFileA(
+            return TIMED_REAL(CopyFileA)(
                 lpExistingFileName,
                 lpNewFileName,
                 bFailIfExists);
@@ -2517,6 +3536,11 @@ BOOL WINAPI Detoured_CopyFileExW(
     _In_opt_ LPBOOL             pbCancel,
     _In_     DWORD              dwCopyFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CopyFileExW);
+
+    // Invalidates after the real operation, which may create, move, or delete reparse points.
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache;
+
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() || 
         IsNullOrEmptyW(lpExistingFileName) || 
@@ -2524,7 +3548,7 @@ BOOL WINAPI Detoured_CopyFileExW(
         IsSpecialDeviceName(lpExistingFileName) ||
         IsSpecialDeviceName(lpNewFileName))
     {
-        return Real_CopyFileExW(
+        return TIMED_REAL(CopyFileExW)(
             lpExistingFileName,
             lpNewFileName,
             lpProgressRoutine,
@@ -2575,15 +3599,24 @@ BOOL WINAPI Detoured_CopyFileExW(
 
     // Now we can safely try to copy, but note that the corresponding read of the source file may end up disallowed
     // (maybe the source file exists, as CopyFileW requires, but we only allow non-existence probes for this path).
+    // A copy that can be made by sharing the clusters of the source is made that way; progress routines need the real copy.
 
     DWORD error = ERROR_SUCCESS;
-    BOOL result = Real_CopyFileExW(
-        lpExistingFileName,
-        lpNewFileName,
-        lpProgressRoutine,
-        lpData,
-        pbCancel,
-        dwCopyFlags);
+    BOOL result = UseBlockCloneForCopies()
+        && lpProgressRoutine == NULL
+        && pbCancel == NULL
+        && TryBlockCloneFile(sourcePolicyResult.GetCanonicalizedPath(), destPolicyResult.GetCanonicalizedPath(), dwCopyFlags);
+
+    if (!result)
+    {
+        result = TIMED_REAL(CopyFileExW)(
+            lpExistingFileName,
+            lpNewFileName,
+            lpProgressRoutine,
+            lpData,
+            pbCancel,
+            dwCopyFlags);
+    }
 
     if (!result) 
     {
@@ -2618,11 +3651,13 @@ BOOL WINAPI Detoured_CopyFileExA(
     _In_opt_ LPBOOL             pbCancel,
     _In_     DWORD              dwCopyFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CopyFileExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName))
         {
-            return Real_CopyFileExA(
+            return TIMED_REAL(CopyFileExA)(
                 lpExistingFileName,
                 lpNewFileName,
                 lpProgressRoutine,
@@ -2655,6 +3690,8 @@ BOOL WINAPI Detoured_MoveFileW(
     _In_ LPCWSTR lpExistingFileName,
     _In_ LPCWSTR lpNewFileName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::MoveFileW);
+
     return Detoured_MoveFileWithProgressW(
         lpExistingFileName,
         lpNewFileName,
@@ -2668,11 +3705,13 @@ BOOL WINAPI Detoured_MoveFileA(
     _In_ LPCSTR lpExistingFileName,
     _In_ LPCSTR lpNewFileName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::MoveFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName)) 
         {
-            return Real_MoveFileA(
+            return TIMED_REAL(MoveFileA)(
                 lpExistingFileName,
                 lpNewFileName);
         }
@@ -2695,6 +3734,8 @@ BOOL WINAPI Detoured_MoveFileExW(
     _In_opt_ LPCWSTR lpNewFileName,
     _In_     DWORD   dwFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::MoveFileExW);
+
     return Detoured_MoveFileWithProgressW(
         lpExistingFileName,
         lpNewFileName,
@@ -2709,11 +3750,13 @@ BOOL WINAPI Detoured_MoveFileExA(
     _In_opt_  LPCSTR lpNewFileName,
     _In_      DWORD  dwFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::MoveFileExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName) || IsNullOrEmptyA(lpNewFileName)) 
         {
-            return Real_MoveFileExA(
+            return TIMED_REAL(MoveFileExA)(
                 lpExistingFileName,
                 lpNewFileName,
                 dwFlags);
@@ -2750,6 +3793,14 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
     _In_opt_  LPVOID             lpData,
     _In_      DWORD              dwFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::MoveFileWithProgressW);
+
+    // Invalidates after the real operation, which may create, move, or delete reparse points.
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache;
+
+    // The moved file may be a directory (or contain some).
+    KnownDirectoryCacheInvalidationScope invalidateKnownDirectories;
+
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() 
         || IsNullOrEmptyW(lpExistingFileName) 
@@ -2757,7 +3808,7 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
         || IsSpecialDeviceName(lpExistingFileName) 
         || IsSpecialDeviceName(lpNewFileName)) 
     {
-        return Real_MoveFileWithProgressW(
+        return TIMED_REAL(MoveFileWithProgressW)(
             lpExistingFileName,
             lpNewFileName,
             lpProgressRoutine,
@@ -2795,7 +3846,9 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
 
     PolicyResult destPolicyResult;
 
-    if (lpNewFileName != NULL && !destPolicyResult.Initialize(lpNewFileName)) 
+    if (lpNewFileName != NULL
+        && !TryGetPolicyForSameDirectoryRename(lpExistingFileName, sourcePolicyResult, lpNewFileName, destPolicyResult)
+        && !destPolicyResult.Initialize(lpNewFileName)) 
     {
         destPolicyResult.ReportIndeterminatePolicyAndSetLastError(destinationOpContext);
         return FALSE;
@@ -2851,8 +3904,15 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
             return FALSE;
         }
     }
-    else if ((dwFlags & MOVEFILE_COPY_ALLOWED) != 0)
+    else if ((dwFlags & MOVEFILE_COPY_ALLOWED) != 0
+        || ((dwFlags & MOVEFILE_DELAY_UNTIL_REBOOT) == 0
+            && IsInRedirectedTempDirectory(sourcePolicyResult.GetCanonicalizedPath().GetPathStringWithoutTypePrefix())
+                != IsInRedirectedTempDirectory(destPolicyResult.GetCanonicalizedPath().GetPathStringWithoutTypePrefix())))
     {
+        // Files moved between the redirected temp directory and the rest of the build cross volumes: they are copied, whether or not
+        // the caller allows it, as the caller does not know (see TempRedirection.h).
+        dwFlags |= MOVEFILE_COPY_ALLOWED;
+
         // Copy can be performed, and thus file will be read, but copy cannot be moving directory.
         sourceAccessCheck = AccessCheckResult::Combine(
             sourceAccessCheck,
@@ -2870,7 +3930,7 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
     // It's now safe to perform the move, which should tell us the existence of the source side (and so, if it may be read or not).
 
     DWORD error = ERROR_SUCCESS;
-    BOOL result = Real_MoveFileWithProgressW(
+    BOOL result = TIMED_REAL(MoveFileWithProgressW)(
         lpExistingFileName,
         lpNewFileName,
         lpProgressRoutine,
@@ -2892,6 +3952,11 @@ BOOL WINAPI Detoured_MoveFileWithProgressW(
             ReportIfNeeded(it->GetAccessCheckResult(), it->GetFileOperationContext(), it->GetPolicyResult(), error);
         }
     }
+
+    if (result)
+    {
+        InvalidateRenamedAccesses(sourcePolicyResult, destPolicyResult, filesAndDirectoriesToReport);
+    }
     
     SetLastError(error);
 
@@ -2906,11 +3971,13 @@ BOOL WINAPI Detoured_MoveFileWithProgressA(
     _In_opt_ LPVOID             lpData,
     _In_     DWORD              dwFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::MoveFileWithProgressA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpExistingFileName))
         {
-            return Real_MoveFileWithProgressA(
+            return TIMED_REAL(MoveFileWithProgressA)(
                 lpExistingFileName,
                 lpNewFileName,
                 lpProgressRoutine,
@@ -2937,8 +4004,12 @@ BOOL WINAPI Detoured_ReplaceFileW(
     __reserved LPVOID  lpExclude,
     __reserved LPVOID  lpReserved)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::ReplaceFileW);
+
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache;
+
     // TODO:implement detours logic
-    return Real_ReplaceFileW(
+    return TIMED_REAL(ReplaceFileW)(
         lpReplacedFileName,
         lpReplacementFileName,
         lpBackupFileName,
@@ -2955,13 +4026,15 @@ BOOL WINAPI Detoured_ReplaceFileA(
     __reserved  LPVOID lpExclude,
     __reserved  LPVOID lpReserved)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::ReplaceFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() 
             || IsNullOrEmptyA(lpReplacedFileName) 
             || IsNullOrEmptyA(lpReplacementFileName))
         {
-            return Real_ReplaceFileA(
+            return TIMED_REAL(ReplaceFileA)(
                 lpReplacedFileName,
                 lpReplacementFileName,
                 lpBackupFileName,
@@ -2998,15 +4071,21 @@ BOOL WINAPI Detoured_ReplaceFileA(
 /// }
 /// </code>
 /// (but we want to report one access, i.e., the Write if it happens otherwise the probe).
+///
+/// If DeleteFile was attempted and failed because the path does not exist (deleteError), that failure is the probe. Otherwise
+/// the path is probed, through the reparse point cache.
 /// </remarks>
-static AccessCheckResult DeleteFileSafeProbe(AccessCheckResult writeAccessCheck, FileOperationContext const& opContext, PolicyResult const& policyResult, DWORD* probeError) 
+static AccessCheckResult DeleteFileSafeProbe(AccessCheckResult writeAccessCheck, FileOperationContext const& opContext, PolicyResult const& policyResult, DWORD deleteError, DWORD* probeError) 
 {
-    
-    DWORD attributes = GetFileAttributesW(opContext.NoncanonicalPath);
-    *probeError = ERROR_SUCCESS;
-    if (attributes == INVALID_FILE_ATTRIBUTES) 
+    DWORD attributes;
+    if (deleteError == ERROR_FILE_NOT_FOUND || deleteError == ERROR_PATH_NOT_FOUND || deleteError == ERROR_INVALID_NAME)
     {
-        *probeError = GetLastError();
+        attributes = INVALID_FILE_ATTRIBUTES;
+        *probeError = deleteError;
+    }
+    else
+    {
+        attributes = GetFileAttributesThroughReparsePointCache(opContext.NoncanonicalPath, *probeError);
     }
 
     FileReadContext probeContext;
@@ -3046,12 +4125,17 @@ static AccessCheckResult DeleteFileSafeProbe(AccessCheckResult writeAccessCheck,
 IMPLEMENTED(Detoured_DeleteFileW)
 BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::DeleteFileW);
+
+    // Invalidates after the real operation, which may create, move, or delete reparse points.
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache;
+
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpFileName) ||
         IsSpecialDeviceName(lpFileName)) 
     {
-        return Real_DeleteFileW(lpFileName);
+        return TIMED_REAL(DeleteFileW)(lpFileName);
     }
 
     FileOperationContext opContext = FileOperationContext(
@@ -3075,14 +4159,14 @@ BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
     {
         // Maybe we can re-phrase this as an absent-file or directory probe?
         DWORD probeError;
-        AccessCheckResult readAccessCheck = DeleteFileSafeProbe(accessCheck, opContext, policyResult, /*out*/ &probeError);
+        AccessCheckResult readAccessCheck = DeleteFileSafeProbe(accessCheck, opContext, policyResult, ERROR_SUCCESS, /*out*/ &probeError);
         ReportIfNeeded(readAccessCheck, opContext, policyResult, probeError);
         SetLastError(probeError);
         return FALSE;
     }
 
     DWORD error = ERROR_SUCCESS;
-    BOOL result = Real_DeleteFileW(lpFileName);
+    BOOL result = TIMED_REAL(DeleteFileW)(lpFileName);
     if (!result) 
     {
         error = GetLastError();
@@ -3092,7 +4176,7 @@ BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
     {
         // On error, we didn't delete anything.
         // We retry as a read just like above; this ensures ResultAction::Warn acts like ResultAction::Deny.
-        AccessCheckResult readAccessCheck = DeleteFileSafeProbe(accessCheck, opContext, policyResult, /*out*/ &error);
+        AccessCheckResult readAccessCheck = DeleteFileSafeProbe(accessCheck, opContext, policyResult, error, /*out*/ &error);
         ReportIfNeeded(readAccessCheck, opContext, policyResult, error);
     }
     else 
@@ -3100,6 +4184,11 @@ BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
         ReportIfNeeded(accessCheck, opContext, policyResult, error);
     }
 
+    if (result)
+    {
+        InvalidateReportedAccesses(policyResult);
+    }
+
     SetLastError(error);
     return result;
 }
@@ -3107,11 +4196,13 @@ BOOL WINAPI Detoured_DeleteFileW(_In_ LPCWSTR lpFileName)
 IMPLEMENTED(Detoured_DeleteFileA)
 BOOL WINAPI Detoured_DeleteFileA(_In_ LPCSTR lpFileName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::DeleteFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
         {
-            return Real_DeleteFileA(lpFileName);
+            return TIMED_REAL(DeleteFileA)(lpFileName);
         }
     }
 
@@ -3125,6 +4216,11 @@ BOOL WINAPI Detoured_CreateHardLinkW(
     _In_       LPCWSTR               lpExistingFileName,
     __reserved LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateHardLinkW);
+
+    // Invalidates after the real operation, which may create, move, or delete reparse points.
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache;
+
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpFileName) ||
@@ -3132,7 +4228,7 @@ BOOL WINAPI Detoured_CreateHardLinkW(
         IsSpecialDeviceName(lpFileName) ||
         IsSpecialDeviceName(lpExistingFileName))
     {
-        return Real_CreateHardLinkW(
+        return TIMED_REAL(CreateHardLinkW)(
             lpFileName,
             lpExistingFileName,
             lpSecurityAttributes);
@@ -3178,7 +4274,7 @@ BOOL WINAPI Detoured_CreateHardLinkW(
 
     DWORD error = ERROR_SUCCESS;
 
-    BOOL result = Real_CreateHardLinkW(
+    BOOL result = TIMED_REAL(CreateHardLinkW)(
         lpFileName,
         lpExistingFileName,
         lpSecurityAttributes);
@@ -3214,11 +4310,13 @@ BOOL WINAPI Detoured_CreateHardLinkA(
     __reserved LPSECURITY_ATTRIBUTES lpSecurityAttributes
     )
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateHardLinkA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName) || IsNullOrEmptyA(lpExistingFileName))
         {
-            return Real_CreateHardLinkA(
+            return TIMED_REAL(CreateHardLinkA)(
                 lpFileName,
                 lpExistingFileName,
                 lpSecurityAttributes);
@@ -3239,6 +4337,11 @@ BOOLEAN WINAPI Detoured_CreateSymbolicLinkW(
     _In_ LPCWSTR lpTargetFileName,
     _In_ DWORD   dwFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateSymbolicLinkW);
+
+    // Invalidates after the real operation, which may create, move, or delete reparse points.
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache;
+
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IgnoreReparsePoints() ||
@@ -3247,7 +4350,7 @@ BOOLEAN WINAPI Detoured_CreateSymbolicLinkW(
         IsSpecialDeviceName(lpSymlinkFileName) ||
         IsSpecialDeviceName(lpTargetFileName))
     {
-        return Real_CreateSymbolicLinkW(
+        return TIMED_REAL(CreateSymbolicLinkW)(
             lpSymlinkFileName,
             lpTargetFileName,
             dwFlags);
@@ -3284,7 +4387,7 @@ BOOLEAN WINAPI Detoured_CreateSymbolicLinkW(
     }
 
     DWORD error = ERROR_SUCCESS;
-    BOOLEAN result = Real_CreateSymbolicLinkW(
+    BOOLEAN result = TIMED_REAL(CreateSymbolicLinkW)(
         lpSymlinkFileName,
         lpTargetFileName,
         dwFlags);
@@ -3303,11 +4406,13 @@ BOOLEAN WINAPI Detoured_CreateSymbolicLinkA(
     _In_ LPCSTR lpTargetFileName,
     _In_ DWORD  dwFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateSymbolicLinkA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpSymlinkFileName) || IsNullOrEmptyA(lpTargetFileName))
         {
-            return Real_CreateSymbolicLinkA(
+            return TIMED_REAL(CreateSymbolicLinkA)(
                 lpSymlinkFileName,
                 lpTargetFileName,
                 dwFlags);
@@ -3327,6 +4432,8 @@ HANDLE WINAPI Detoured_FindFirstFileW(
     _In_  LPCWSTR            lpFileName,
     _Out_ LPWIN32_FIND_DATAW lpFindFileData)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::FindFirstFileW);
+
     // FindFirstFileExW is a strict superset. This line is essentially the same as the FindFirstFileW thunk in \minkernel\kernelbase\filefind.c
     return Detoured_FindFirstFileExW(lpFileName, FindExInfoStandard, lpFindFileData, FindExSearchNameMatch, NULL, 0);
 }
@@ -3336,8 +4443,10 @@ HANDLE WINAPI Detoured_FindFirstFileA(
     _In_   LPCSTR             lpFileName,
     _Out_  LPWIN32_FIND_DATAA lpFindFileData)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::FindFirstFileA);
+
     // TODO:replace with Detoured_FindFirstFileW below
-    return Real_FindFirstFileA(
+    return TIMED_REAL(FindFirstFileA)(
         lpFileName,
         lpFindFileData);
 
@@ -3354,13 +4463,15 @@ HANDLE WINAPI Detoured_FindFirstFileExW(
     __reserved LPVOID             lpSearchFilter,
     _In_       DWORD              dwAdditionalFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::FindFirstFileExW);
+
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() || IsNullOrEmptyW(lpFileName) || lpFindFileData == NULL ||
         lpSearchFilter != NULL ||
         (fInfoLevelId != FindExInfoStandard && fInfoLevelId != FindExInfoBasic) ||
         IsSpecialDeviceName(lpFileName)) 
     {
-        return Real_FindFirstFileExW(lpFileName, fInfoLevelId, lpFindFileData, fSearchOp, lpSearchFilter, dwAdditionalFlags);
+        return TIMED_REAL(FindFirstFileExW)(lpFileName, fInfoLevelId, lpFindFileData, fSearchOp, lpSearchFilter, dwAdditionalFlags);
     }
 
     FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"FindFirstFileEx", lpFileName);
@@ -3380,15 +4491,26 @@ HANDLE WINAPI Detoured_FindFirstFileExW(
     {
         // TODO: This really shouldn't have failure cases. Maybe just failfast on allocation failure, etc.
         Dbg(L"FindFirstFileEx: Failed to canonicalize the search path; passing through.");
-        return Real_FindFirstFileExW(lpFileName, fInfoLevelId, lpFindFileData, fSearchOp, lpSearchFilter, dwAdditionalFlags);
+        return TIMED_REAL(FindFirstFileExW)(lpFileName, fInfoLevelId, lpFindFileData, fSearchOp, lpSearchFilter, dwAdditionalFlags);
     }
 
     // First, get the policy for the directory itself; this entails removing the last component.
     PolicyResult directoryPolicyResult;
     directoryPolicyResult.Initialize(canonicalizedPathIncludingFilter.RemoveLastComponent());
 
+    // Most callers go through FindFirstFileW, which asks for short names and the default (small) buffer, so that the real
+    // FindNextFileW goes to the kernel every few entries. The search handle keeps the upgraded level and flags for the whole enumeration.
+    FINDEX_INFO_LEVELS infoLevel = fInfoLevelId;
+    DWORD additionalFlags = dwAdditionalFlags;
+    if (UseLargeFetchEnumerations())
+    {
+        infoLevel = FindExInfoBasic;
+        additionalFlags |= FIND_FIRST_EX_LARGE_FETCH;
+        IncrementFeatureCounter(FeatureCounter::LargeFetchSearches);
+    }
+
     DWORD error = ERROR_SUCCESS;
-    HANDLE searchHandle = Real_FindFirstFileExW(lpFileName, fInfoLevelId, lpFindFileData, fSearchOp, lpSearchFilter, dwAdditionalFlags);
+    HANDLE searchHandle = TIMED_REAL(FindFirstFileExW)(lpFileName, infoLevel, lpFindFileData, fSearchOp, lpSearchFilter, additionalFlags);
     error = GetLastError();
 
     // Note that we check success via the returned handle. This function does not call SetLastError(ERROR_SUCCESS) on success. We stash
@@ -3535,10 +4657,12 @@ HANDLE WINAPI Detoured_FindFirstFileExA(
     __reserved LPVOID             lpSearchFilter,
     _In_       DWORD              dwAdditionalFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::FindFirstFileExA);
+
     // TODO: Note that we can't simply forward to FindFirstFileW here after a unicode conversion.
     // The output value differs too - WIN32_FIND_DATA{A, W}
 
-    return Real_FindFirstFileExA(
+    return TIMED_REAL(FindFirstFileExA)(
         lpFileName,
         fInfoLevelId,
         lpFindFileData,
@@ -3552,9 +4676,11 @@ BOOL WINAPI Detoured_FindNextFileW(
     _In_  HANDLE             hFindFile,
     _Out_ LPWIN32_FIND_DATAW lpFindFileData)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::FindNextFileW);
+
     DetouredScope scope;
     DWORD error = ERROR_SUCCESS; 
-    BOOL result = Real_FindNextFileW(hFindFile, lpFindFileData);
+    BOOL result = TIMED_REAL(FindNextFileW)(hFindFile, lpFindFileData);
     error = GetLastError();
 
     if (scope.Detoured_IsDisabled() || IsNullOrInvalidHandle(hFindFile) || lpFindFileData == nullptr)
@@ -3571,10 +4697,10 @@ BOOL WINAPI Detoured_FindNextFileW(
     HandleOverlayRef overlay = TryLookupHandleOverlay(hFindFile);
     if (overlay != nullptr) 
     {
-        FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"FindNextFile", overlay->Policy.GetCanonicalizedPath().GetPathString());
+        FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"FindNextFile", overlay->Policy->GetCanonicalizedPath().GetPathString());
         
         wchar_t const* enumeratedComponent = &lpFindFileData->cFileName[0];
-        PolicyResult filePolicyResult = overlay->Policy.GetPolicyForSubpath(enumeratedComponent);
+        PolicyResult filePolicyResult = overlay->Policy->GetPolicyForSubpath(enumeratedComponent);
 
         FileReadContext readContext;
         readContext.FileExistence = FileExistence::Existent;
@@ -3616,10 +4742,12 @@ BOOL WINAPI Detoured_FindNextFileA(
     _In_  HANDLE             hFindFile,
     _Out_ LPWIN32_FIND_DATAA lpFindFileData)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::FindNextFileA);
+
     // TODO:replace with the same logic as Detoured_FindNextFileW
     // Note that we can't simply forward to FindFirstFileW here after a unicode conversion.
     // The output value differs too - WIN32_FIND_DATA{A, W}
-    return Real_FindNextFileA(
+    return TIMED_REAL(FindNextFileA)(
         hFindFile,
         lpFindFileData);
 }
@@ -3631,10 +4759,12 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
     _Out_ LPVOID                    lpFileInformation,
     _In_  DWORD                     dwBufferSize)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::GetFileInformationByHandleEx);
+
     DetouredScope scope;
 
     DWORD error = ERROR_SUCCESS;
-    BOOL result = Real_GetFileInformationByHandleEx(
+    BOOL result = TIMED_REAL(GetFileInformationByHandleEx)(
             hFile,
             fileInformationClass,
             lpFileInformation,
@@ -3642,6 +4772,14 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
 
     error = GetLastError();
 
+    // Names of files in the redirected temp directory are returned as names in the temp directory (see TempRedirection.h).
+    if (!IsNullOrInvalidHandle(hFile)
+        && TryTranslateRedirectedFileName(hFile, fileInformationClass, lpFileInformation, dwBufferSize, result, error))
+    {
+        SetLastError(error);
+        return result;
+    }
+
     if (scope.Detoured_IsDisabled() || IsNullOrInvalidHandle(hFile) || fileInformationClass != FileBasicInfo || lpFileInformation == nullptr)
     {
         return result;
@@ -3653,10 +4791,10 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
     HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
     if (overlay != nullptr) 
     {
-        if (overlay->Policy.ShouldOverrideTimestamps(overlay->AccessCheck)) 
+        if (overlay->Policy->ShouldOverrideTimestamps(overlay->AccessCheck)) 
         {
 #if SUPER_VERBOSE
-            Dbg(L"GetFileInformationByHandleEx: Overriding timestamps for %s", overlay->Policy.GetCanonicalizedPath().GetPathString());
+            Dbg(L"GetFileInformationByHandleEx: Overriding timestamps for %s", overlay->Policy->GetCanonicalizedPath().GetPathString());
 #endif // SUPER_VERBOSE
             OverrideTimestampsForInputFile(fileBasicInfo);
         }
@@ -3675,15 +4813,17 @@ BOOL WINAPI Detoured_GetFileInformationByHandleEx(
 IMPLEMENTED(Detoured_FindClose)
 BOOL WINAPI Detoured_FindClose(_In_ HANDLE handle)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::FindClose);
+
     DetouredScope scope;
 
     DWORD error = ERROR_SUCCESS;
 
     // Make sure the handle is closed after the object is removed from the map.
     // This way the handle will never be assigned to a another object before removed from the table.
-    CloseHandleOverlay(handle, true);
+    CloseHandleOverlay(handle);
 
-    BOOL result = Real_FindClose(handle);
+    BOOL result = TIMED_REAL(FindClose)(handle);
     error = GetLastError();
 
     if (scope.Detoured_IsDisabled() || IsNullOrInvalidHandle(handle))
@@ -3700,10 +4840,12 @@ BOOL WINAPI Detoured_GetFileInformationByHandle(
     _In_  HANDLE                       hFile,
     _Out_ LPBY_HANDLE_FILE_INFORMATION lpFileInformation)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::GetFileInformationByHandle);
+
     DetouredScope scope;
 
     DWORD error = ERROR_SUCCESS;
-    BOOL result = Real_GetFileInformationByHandle(hFile, lpFileInformation);
+    BOOL result = TIMED_REAL(GetFileInformationByHandle)(hFile, lpFileInformation);
     error = GetLastError();
 
     if (scope.Detoured_IsDisabled() || IsNullOrInvalidHandle(hFile) || lpFileInformation == nullptr)
@@ -3714,10 +4856,10 @@ BOOL WINAPI Detoured_GetFileInformationByHandle(
     HandleOverlayRef overlay = TryLookupHandleOverlay(hFile);
     if (overlay != nullptr) 
     {
-        if (overlay->Policy.ShouldOverrideTimestamps(overlay->AccessCheck)) 
+        if (overlay->Policy->ShouldOverrideTimestamps(overlay->AccessCheck)) 
         {
 #if SUPER_VERBOSE
-            Dbg(L"GetFileInformationByHandle: Overriding timestamps for %s", overlay->Policy.GetCanonicalizedPath().GetPathString());
+            Dbg(L"GetFileInformationByHandle: Overriding timestamps for %s", overlay->Policy->GetCanonicalizedPath().GetPathString());
 #endif // SUPER_VERBOSE
             OverrideTimestampsForInputFile(lpFileInformation);
         }
@@ -3768,7 +4910,7 @@ static BOOL DeleteUsingSetFileInformationByHandle(
 
     DWORD error = ERROR_SUCCESS;
 
-    BOOL result = Real_SetFileInformationByHandle(
+    BOOL result = TIMED_REAL(SetFileInformationByHandle)(
         hFile,
         FileInformationClass,
         lpFileInformation,
@@ -3834,7 +4976,7 @@ static BOOL RenameUsingSetFileInformationByHandle(
     {
         SetLastError(lastError);
 
-        return Real_SetFileInformationByHandle(
+        return TIMED_REAL(SetFileInformationByHandle)(
             hFile,
             FileInformationClass,
             lpFileInformation,
@@ -3875,7 +5017,8 @@ static BOOL RenameUsingSetFileInformationByHandle(
     bool renameDirectory = false;
     vector<ReportData> filesAndDirectoriesToReport;
 
-    if (TryCheckHandleOfDirectory(hFile, true, isHandleOfDirectory) && isHandleOfDirectory)
+    if ((TryCheckHandleOfDirectoryFromOverlay(hFile, true, isHandleOfDirectory) || TryCheckHandleOfDirectory(hFile, true, isHandleOfDirectory))
+        && isHandleOfDirectory)
     {
         renameDirectory = true;
 
@@ -3892,7 +5035,7 @@ static BOOL RenameUsingSetFileInformationByHandle(
 
     DWORD error = ERROR_SUCCESS;
 
-    BOOL result = Real_SetFileInformationByHandle(
+    BOOL result = TIMED_REAL(SetFileInformationByHandle)(
         hFile,
         FileInformationClass,
         lpFileInformation,
@@ -3926,6 +5069,8 @@ BOOL WINAPI Detoured_SetFileInformationByHandle(
     _In_ LPVOID                    lpFileInformation,
     _In_ DWORD                     dwBufferSize)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::SetFileInformationByHandle);
+
     bool isDisposition =
         FileInformationClass == FILE_INFO_BY_HANDLE_CLASS::FileDispositionInfo
         || FileInformationClass == FILE_INFO_BY_HANDLE_CLASS::FileDispositionInfoEx;
@@ -3934,13 +5079,16 @@ BOOL WINAPI Detoured_SetFileInformationByHandle(
         FileInformationClass == FILE_INFO_BY_HANDLE_CLASS::FileRenameInfo
         || FileInformationClass == FILE_INFO_BY_HANDLE_CLASS::FileRenameInfoEx;
 
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache(isDisposition || isRename);
+    KnownDirectoryCacheInvalidationScope invalidateKnownDirectories(isDisposition || isRename);
+
     if ((!isDisposition && !isRename) || IgnoreSetFileInformationByHandle()) 
     {
 
         // We ignore the use of SetFileInformationByHandle when it is not file renaming or file deletion. 
         // However, since SetInformationByHandle may call other APIs, and those APIs may be detoured,
         // we don't check for DetouredScope yet.
-        return Real_SetFileInformationByHandle(
+        return TIMED_REAL(SetFileInformationByHandle)(
             hFile,
             FileInformationClass,
             lpFileInformation,
@@ -3950,7 +5098,7 @@ BOOL WINAPI Detoured_SetFileInformationByHandle(
     DetouredScope scope;
     if (scope.Detoured_IsDisabled()) 
     {
-        return Real_SetFileInformationByHandle(
+        return TIMED_REAL(SetFileInformationByHandle)(
             hFile,
             FileInformationClass,
             lpFileInformation,
@@ -3980,7 +5128,7 @@ BOOL WINAPI Detoured_SetFileInformationByHandle(
         if (!isDeletion) 
         {
             // Not a deletion, don't detour.
-            return Real_SetFileInformationByHandle(
+            return TIMED_REAL(SetFileInformationByHandle)(
                 hFile,
                 FileInformationClass,
                 lpFileInformation,
@@ -4002,7 +5150,7 @@ BOOL WINAPI Detoured_SetFileInformationByHandle(
 
         SetLastError(lastError);
 
-        return Real_SetFileInformationByHandle(
+        return TIMED_REAL(SetFileInformationByHandle)(
             hFile,
             FileInformationClass,
             lpFileInformation,
@@ -4029,8 +5177,10 @@ HANDLE WINAPI Detoured_OpenFileMappingW(
     _In_ BOOL    bInheritHandle,
     _In_ LPCWSTR lpName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::OpenFileMappingW);
+
     // TODO:implement detours logic
-    return Real_OpenFileMappingW(
+    return TIMED_REAL(OpenFileMappingW)(
         dwDesiredAccess,
         bInheritHandle,
         lpName);
@@ -4041,11 +5191,13 @@ HANDLE WINAPI Detoured_OpenFileMappingA(
     _In_  BOOL   bInheritHandle,
     _In_  LPCSTR lpName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::OpenFileMappingA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpName))
         {
-            return Real_OpenFileMappingA(
+            return TIMED_REAL(OpenFileMappingA)(
                 dwDesiredAccess,
                 bInheritHandle,
                 lpName);
@@ -4059,22 +5211,123 @@ HANDLE WINAPI Detoured_OpenFileMappingA(
         name);
 }
 
+// Unique numbers (see Detoured_GetTempFileNameW) handed out by this process so far.
+static volatile LONG g_tempFileNameCounter = 0;
+
+// Returns the next unique number for a temporary file name: 16 bits, never 0. The sequence of a process starts at a point derived
+// from its id, so that the processes sharing a temp directory rarely try the same names.
+static UINT NextTempFileNameUnique()
+{
+    UINT start = (GetCurrentProcessId() * 0x9E3779B1u) >> 16;
+    UINT unique = (start + (UINT)InterlockedIncrement(&g_tempFileNameCounter)) & 0xFFFF;
+    return unique == 0 ? 1 : unique;
+}
+
 // Detoured_GetTempFileNameW
 //
 // lpPathName is typically "." or result of GetTempPath (which doesn't need to be detoured, itself)
 // lpPrefixString is allowed to be empty.
+//
+// With FileAccessManifestExtraFlag::FastTempFileNames, a call that has to create the file (uUnique == 0) tries the names of the
+// sequence of this process (see NextTempFileNameUnique) instead of the one the real API derives from the time, so that the first
+// name tried is almost always free, and reports the creation of the file it returns once. Names have the same format either way.
 UINT WINAPI Detoured_GetTempFileNameW(
     _In_  LPCWSTR lpPathName,
     _In_  LPCWSTR lpPrefixString,
     _In_  UINT    uUnique,
     _Out_ LPTSTR  lpTempFileName)
 {
-    // TODO:implement detours logic
-    return Real_GetTempFileNameW(
-        lpPathName,
-        lpPrefixString,
-        uUnique,
-        lpTempFileName);
+    DetourStatisticsScope statistics(DetouredFunctionId::GetTempFileNameW);
+
+    // Outside of the scope below, so that the detours of the functions the real API creates the file with report it
+    if (!FastTempFileNames()
+        || uUnique != 0
+        || IsNullOrEmptyW(lpPathName)
+        || lpTempFileName == nullptr)
+    {
+        return TIMED_REAL(GetTempFileNameW)(
+            lpPathName,
+            lpPrefixString,
+            uUnique,
+            lpTempFileName);
+    }
+
+    DetouredScope scope;
+    if (scope.Detoured_IsDisabled())
+    {
+        return TIMED_REAL(GetTempFileNameW)(
+            lpPathName,
+            lpPrefixString,
+            uUnique,
+            lpTempFileName);
+    }
+
+    // Same limit as the real API: room for a separator, three prefix characters, four digits and the extension
+    size_t pathLength = wcslen(lpPathName);
+    if (pathLength > MAX_PATH - 14)
+    {
+        SetLastError(ERROR_BUFFER_OVERFLOW);
+        return 0;
+    }
+
+    std::wstring directory(lpPathName, pathLength);
+    if (directory.back() != L'\\' && directory.back() != L'/')
+    {
+        directory.push_back(L'\\');
+    }
+
+    std::wstring prefix = lpPrefixString != nullptr ? std::wstring(lpPrefixString).substr(0, 3) : std::wstring();
+
+    // Every name is tried at most once, as with the real API
+    for (UINT attempt = 0; attempt < 0xFFFF; attempt++)
+    {
+        UINT unique = NextTempFileNameUnique();
+        WCHAR name[MAX_PATH];
+        swprintf_s(name, L"%s%s%X.TMP", directory.c_str(), prefix.c_str(), unique);
+
+        FileOperationContext opContext(L"GetTempFileName", GENERIC_WRITE, 0, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, name);
+        PolicyResult policyResult;
+        if (!policyResult.Initialize(name))
+        {
+            policyResult.ReportIndeterminatePolicyAndSetLastError(opContext);
+            return 0;
+        }
+
+        AccessCheckResult accessCheck = policyResult.CheckWriteAccess();
+        if (accessCheck.ShouldDenyAccess())
+        {
+            DWORD denyError = accessCheck.DenialError();
+            ReportIfNeeded(accessCheck, opContext, policyResult, denyError);
+            accessCheck.SetLastErrorToDenialError();
+            return 0;
+        }
+
+        HANDLE handle = CreateFileW(name, GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+        DWORD error = handle == INVALID_HANDLE_VALUE ? GetLastError() : ERROR_SUCCESS;
+
+        // A taken name is the only reason to try another one
+        if (error == ERROR_FILE_EXISTS || error == ERROR_ALREADY_EXISTS)
+        {
+            continue;
+        }
+
+        ReportIfNeeded(accessCheck, opContext, policyResult, error);
+
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            SetLastError(error);
+            return 0;
+        }
+
+        CloseHandle(handle);
+        wcscpy_s(lpTempFileName, MAX_PATH, name);
+        IncrementFeatureCounter(FeatureCounter::TempFileNamesGenerated);
+        SetLastError(ERROR_SUCCESS);
+        return unique;
+    }
+
+    SetLastError(ERROR_FILE_EXISTS);
+    return 0;
 }
 
 UINT WINAPI Detoured_GetTempFileNameA(
@@ -4083,8 +5336,10 @@ UINT WINAPI Detoured_GetTempFileNameA(
     _In_  UINT   uUnique,
     _Out_ LPSTR  lpTempFileName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::GetTempFileNameA);
+
     // TODO:implement detours logic
-    return Real_GetTempFileNameA(
+    return TIMED_REAL(GetTempFileNameA)(
         lpPathName,
         lpPrefixString,
         uUnique,
@@ -4163,6 +5418,39 @@ static AccessCheckResult CreateDirectorySafeProbe(
     return probeAccessCheck;
 }
 
+/// <summary>
+/// Records the directory of a <code>CreateDirectoryW</code> call as known to exist if the call created it, or failed because
+/// a directory (rather than a file) is already there.
+/// </summary>
+static void RememberKnownDirectory(
+    _In_ LPCWSTR pathName,
+    PolicyResult const& policyResult,
+    LONG knownDirectoryCacheGeneration,
+    BOOL created,
+    DWORD error)
+{
+    if (!CacheKnownDirectories())
+    {
+        return;
+    }
+
+    if (!created)
+    {
+        if (error != ERROR_ALREADY_EXISTS)
+        {
+            return;
+        }
+
+        DWORD attributes = GetFileAttributesW(pathName);
+        if (attributes == INVALID_FILE_ATTRIBUTES || (attributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+        {
+            return;
+        }
+    }
+
+    AddKnownDirectory(policyResult.GetCanonicalizedPath().GetPathString(), knownDirectoryCacheGeneration);
+}
+
 // Detoured_CreateDirectoryW
 //
 // The value of lpSecurityAttributes is not important to our access policy,
@@ -4172,12 +5460,17 @@ BOOL WINAPI Detoured_CreateDirectoryW(
     _In_     LPCWSTR               lpPathName,
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateDirectoryW);
+
+    // Invalidates after the real operation, which may create, move, or delete reparse points.
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache;
+
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpPathName) ||
         IsSpecialDeviceName(lpPathName))
     {
-        return Real_CreateDirectoryW(
+        return TIMED_REAL(CreateDirectoryW)(
             lpPathName,
             lpSecurityAttributes);
     }
@@ -4198,6 +5491,16 @@ BOOL WINAPI Detoured_CreateDirectoryW(
         return FALSE;
     }
 
+    // Callers that 'ensure' every ancestor of every output exists ask for the same directories over and over; once this process
+    // has seen a directory exist, the answer is ERROR_ALREADY_EXISTS and the first call already reported what a new one would.
+    if (IsKnownDirectory(policyResult.GetCanonicalizedPath().GetPathString()))
+    {
+        SetLastError(ERROR_ALREADY_EXISTS);
+        return FALSE;
+    }
+
+    LONG knownDirectoryCacheGeneration = GetKnownDirectoryCacheGeneration();
+
     AccessCheckResult accessCheck = policyResult.CheckCreateDirectoryAccess();
 
     if (accessCheck.ShouldDenyAccess()) 
@@ -4208,11 +5511,12 @@ BOOL WINAPI Detoured_CreateDirectoryW(
         DWORD probeError;
         AccessCheckResult probeAccessCheck = CreateDirectorySafeProbe(accessCheck, opContext, policyResult, /*out*/ &probeError);
         ReportIfNeeded(probeAccessCheck, opContext, policyResult, probeError);
+        RememberKnownDirectory(lpPathName, policyResult, knownDirectoryCacheGeneration, /*created*/ FALSE, probeError);
         SetLastError(probeError);
         return FALSE; // Still a kind of failure; didn't create a directory.
     }
 
-    BOOL result = Real_CreateDirectoryW(
+    BOOL result = TIMED_REAL(CreateDirectoryW)(
         lpPathName,
         lpSecurityAttributes);
     DWORD error = ERROR_SUCCESS;
@@ -4234,6 +5538,8 @@ BOOL WINAPI Detoured_CreateDirectoryW(
         ReportIfNeeded(accessCheck, opContext, policyResult, error);
     }
 
+    RememberKnownDirectory(lpPathName, policyResult, knownDirectoryCacheGeneration, result, error);
+
     SetLastError(error);
     return result;
 }
@@ -4242,11 +5548,13 @@ BOOL WINAPI Detoured_CreateDirectoryA(
     _In_     LPCSTR                lpPathName,
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateDirectoryA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpPathName))
         {
-            return Real_CreateDirectoryA(
+            return TIMED_REAL(CreateDirectoryA)(
                 lpPathName,
                 lpSecurityAttributes);
         }
@@ -4263,8 +5571,10 @@ BOOL WINAPI Detoured_CreateDirectoryExW(
     _In_     LPCWSTR               lpNewDirectory,
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateDirectoryExW);
+
     // TODO:implement detours logic
-    return Real_CreateDirectoryExW(
+    return TIMED_REAL(CreateDirectoryExW)(
         lpTemplateDirectory,
         lpNewDirectory,
         lpSecurityAttributes);
@@ -4275,12 +5585,14 @@ BOOL WINAPI Detoured_CreateDirectoryExA(
     _In_     LPCSTR                lpNewDirectory,
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::CreateDirectoryExA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() ||
             IsNullOrEmptyA(lpTemplateDirectory))
         {
-            return Real_CreateDirectoryExA(
+            return TIMED_REAL(CreateDirectoryExA)(
                 lpTemplateDirectory,
                 lpNewDirectory,
                 lpSecurityAttributes);
@@ -4298,12 +5610,18 @@ BOOL WINAPI Detoured_CreateDirectoryExA(
 IMPLEMENTED(Detoured_RemoveDirectoryW)
 BOOL WINAPI Detoured_RemoveDirectoryW(_In_ LPCWSTR lpPathName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::RemoveDirectoryW);
+
+    // Invalidates after the real operation, which may create, move, or delete reparse points.
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache;
+    KnownDirectoryCacheInvalidationScope invalidateKnownDirectories;
+
     DetouredScope scope;
     if (scope.Detoured_IsDisabled() ||
         IsNullOrEmptyW(lpPathName) ||
         IsSpecialDeviceName(lpPathName))
     {
-        return Real_RemoveDirectoryW(lpPathName);
+        return TIMED_REAL(RemoveDirectoryW)(lpPathName);
     }
 
     FileOperationContext opContext(
@@ -4332,7 +5650,7 @@ BOOL WINAPI Detoured_RemoveDirectoryW(_In_ LPCWSTR lpPathName)
         return FALSE;
     }
 
-    BOOL result = Real_RemoveDirectoryW(lpPathName);
+    BOOL result = TIMED_REAL(RemoveDirectoryW)(lpPathName);
     DWORD error = ERROR_SUCCESS;
     if (!result) 
     {
@@ -4347,11 +5665,13 @@ BOOL WINAPI Detoured_RemoveDirectoryW(_In_ LPCWSTR lpPathName)
 IMPLEMENTED(Detoured_RemoveDirectoryA)
 BOOL WINAPI Detoured_RemoveDirectoryA(_In_ LPCSTR lpPathName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::RemoveDirectoryA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpPathName))
         {
-            return Real_RemoveDirectoryA(lpPathName);
+            return TIMED_REAL(RemoveDirectoryA)(lpPathName);
         }
     }
 
@@ -4359,12 +5679,45 @@ BOOL WINAPI Detoured_RemoveDirectoryA(_In_ LPCSTR lpPathName)
     return Detoured_RemoveDirectoryW(pathName);
 }
 
+// Changing the current directory is not a file access; it is only detoured (with FileAccessManifestExtraFlag::CacheCurrentDirectory)
+// to forget the current directory that relative paths get canonicalized against.
+IMPLEMENTED(Detoured_SetCurrentDirectoryW)
+BOOL WINAPI Detoured_SetCurrentDirectoryW(_In_ LPCWSTR lpPathName)
+{
+    DetourStatisticsScope statistics(DetouredFunctionId::SetCurrentDirectoryW);
+
+    BOOL result = TIMED_REAL(SetCurrentDirectoryW)(lpPathName);
+    DWORD error = GetLastError();
+
+    InvalidateCachedCurrentDirectory();
+
+    SetLastError(error);
+    return result;
+}
+
+// Does not forward to Detoured_SetCurrentDirectoryW: the real SetCurrentDirectoryA does not go through SetCurrentDirectoryW either.
+IMPLEMENTED(Detoured_SetCurrentDirectoryA)
+BOOL WINAPI Detoured_SetCurrentDirectoryA(_In_ LPCSTR lpPathName)
+{
+    DetourStatisticsScope statistics(DetouredFunctionId::SetCurrentDirectoryA);
+
+    BOOL result = TIMED_REAL(SetCurrentDirectoryA)(lpPathName);
+    DWORD error = GetLastError();
+
+    InvalidateCachedCurrentDirectory();
+
+    SetLastError(error);
+    return result;
+}
+
 BOOL WINAPI Detoured_DecryptFileW(
     _In_       LPCWSTR lpFileName,
     __reserved DWORD dwReserved)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::DecryptFileW);
+
     // TODO:implement detours logic
-    return Real_DecryptFileW(
+    return TIMED_REAL(DecryptFileW)(
         lpFileName,
         dwReserved);
 }
@@ -4373,11 +5726,13 @@ BOOL WINAPI Detoured_DecryptFileA(
     _In_       LPCSTR lpFileName,
     __reserved DWORD dwReserved)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::DecryptFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
         {
-            return Real_DecryptFileA(
+            return TIMED_REAL(DecryptFileA)(
                 lpFileName,
                 dwReserved);
         }
@@ -4391,17 +5746,21 @@ BOOL WINAPI Detoured_DecryptFileA(
 
 BOOL WINAPI Detoured_EncryptFileW(_In_ LPCWSTR lpFileName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::EncryptFileW);
+
     // TODO:implement detours logic
-    return Real_EncryptFileW(lpFileName);
+    return TIMED_REAL(EncryptFileW)(lpFileName);
 }
 
 BOOL WINAPI Detoured_EncryptFileA(_In_ LPCSTR lpFileName)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::EncryptFileA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
         {
-            return Real_EncryptFileA(lpFileName);
+            return TIMED_REAL(EncryptFileA)(lpFileName);
         }
     }
 
@@ -4414,8 +5773,10 @@ DWORD WINAPI Detoured_OpenEncryptedFileRawW(
     _In_  ULONG   ulFlags,
     _Out_ PVOID*  pvContext)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::OpenEncryptedFileRawW);
+
     // TODO:implement detours logic
-    return Real_OpenEncryptedFileRawW(
+    return TIMED_REAL(OpenEncryptedFileRawW)(
         lpFileName,
         ulFlags,
         pvContext);
@@ -4426,11 +5787,13 @@ DWORD WINAPI Detoured_OpenEncryptedFileRawA(
     _In_  ULONG  ulFlags,
     _Out_ PVOID* pvContext)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::OpenEncryptedFileRawA);
+
     {
         DetouredScope scope;
         if (scope.Detoured_IsDisabled() || IsNullOrEmptyA(lpFileName))
         {
-            return Real_OpenEncryptedFileRawA(
+            return TIMED_REAL(OpenEncryptedFileRawA)(
                 lpFileName,
                 ulFlags,
                 pvContext);
@@ -4457,8 +5820,10 @@ HANDLE WINAPI Detoured_OpenFileById(
     _In_opt_ LPSECURITY_ATTRIBUTES lpSecurityAttributes,
     _In_     DWORD                 dwFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::OpenFileById);
+
     // TODO:implement detours logic
-    return Real_OpenFileById(
+    return TIMED_REAL(OpenFileById)(
         hFile,
         lpFileID,
         dwDesiredAccess,
@@ -4474,6 +5839,8 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleA(
     _In_  DWORD cchFilePath,
     _In_  DWORD dwFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::GetFinalPathNameByHandleA);
+
     unique_ptr<wchar_t[]> wideFilePathBuffer(new wchar_t[cchFilePath]);
     DWORD err = Detoured_GetFinalPathNameByHandleW(hFile, wideFilePathBuffer.get(), cchFilePath, dwFlags);
 
@@ -4535,14 +5902,37 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleW(
     _In_  DWORD  cchFilePath,
     _In_  DWORD  dwFlags)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::GetFinalPathNameByHandleW);
+
     DetouredScope scope;
 
     if (scope.Detoured_IsDisabled() || IgnoreGetFinalPathNameByHandle())
     {
-        return Real_GetFinalPathNameByHandleW(hFile, lpszFilePath, cchFilePath, dwFlags);
+        return TIMED_REAL(GetFinalPathNameByHandleW)(hFile, lpszFilePath, cchFilePath, dwFlags);
     }
 
-    DWORD err = Real_GetFinalPathNameByHandleW(hFile, lpszFilePath, cchFilePath, dwFlags);
+    DWORD err;
+    wstring finalPath;
+
+    // DetourGetFinalPathByHandle resolves the same normalized DOS path, so it can come from the handle overlay.
+    if (CacheFinalPathsOfHandles() && dwFlags == (FILE_NAME_NORMALIZED | VOLUME_NAME_DOS) && DetourGetFinalPathByHandle(hFile, finalPath) == ERROR_SUCCESS)
+    {
+        // Same results as GetFinalPathNameByHandleW: the length without the terminating null character if the path fits,
+        // and otherwise the required buffer length, including it.
+        if (finalPath.length() < cchFilePath)
+        {
+            wcscpy_s(lpszFilePath, cchFilePath, finalPath.c_str());
+            err = (DWORD)finalPath.length();
+        }
+        else
+        {
+            err = (DWORD)finalPath.length() + 1;
+        }
+    }
+    else
+    {
+        err = TIMED_REAL(GetFinalPathNameByHandleW)(hFile, lpszFilePath, cchFilePath, dwFlags);
+    }
 
     if (err == 0)
     {
@@ -4550,6 +5940,13 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleW(
     }
     else if (err < cchFilePath)
     {
+        size_t translatedLength;
+        if (TryTranslateFilePathInBuffer(lpszFilePath, (size_t)err, (size_t)cchFilePath, translatedLength))
+        {
+            // Like GetFinalPathNameByHandleW, the required buffer length (including the terminating null) if the path doesn't fit.
+            return translatedLength < cchFilePath ? (DWORD)translatedLength : (DWORD)translatedLength + 1;
+        }
+
         wstring normalizedPath;
         TranslateFilePath(wstring(lpszFilePath), normalizedPath, false);
 
@@ -4564,6 +5961,119 @@ DWORD WINAPI Detoured_GetFinalPathNameByHandleW(
     return err;
 }
 
+template<typename TEntry>
+static void ScrubShortFileNameOfDirectoryEntryIfPresent(TEntry*)
+{
+}
+
+static void ScrubShortFileNameOfDirectoryEntryIfPresent(PFILE_BOTH_DIR_INFORMATION entry)
+{
+    ScrubShortFileNameOfDirectoryEntry(entry);
+}
+
+static void ScrubShortFileNameOfDirectoryEntryIfPresent(PFILE_ID_BOTH_DIR_INFORMATION entry)
+{
+    ScrubShortFileNameOfDirectoryEntry(entry);
+}
+
+/// <summary>
+/// Applies the metadata overrides FindFirstFileEx and FindNextFile apply to their single entry to all the entries of a buffer.
+/// </summary>
+/// <remarks>
+/// The policy of each entry is found by resuming the policy search of the directory with just the entry name,
+/// so that a large enumeration costs one search step per entry rather than a canonicalization and full search each.
+/// </remarks>
+template<typename TEntry>
+static void OverrideMetadataForDirectoryEntries(PolicyResult const& directoryPolicy, PVOID buffer, ULONG_PTR length)
+{
+    wstring childName;
+    ULONG_PTR offset = 0;
+
+    while (offset + FIELD_OFFSET(TEntry, FileName) <= length)
+    {
+        TEntry* entry = reinterpret_cast<TEntry*>(reinterpret_cast<PBYTE>(buffer) + offset);
+        if (offset + FIELD_OFFSET(TEntry, FileName) + entry->FileNameLength > length)
+        {
+            break;
+        }
+
+        size_t childNameLength = (size_t)(entry->FileNameLength / sizeof(WCHAR));
+        bool isSelf = childNameLength == 1 && entry->FileName[0] == L'.';
+        bool isParent = childNameLength == 2 && entry->FileName[0] == L'.' && entry->FileName[1] == L'.';
+
+        // The parent directory is not under the policy of the enumerated one; FindFirstFile leaves its timestamps alone too.
+        if (!isParent)
+        {
+            FileAccessPolicy policy = directoryPolicy.GetPolicy();
+            if (!isSelf)
+            {
+                childName.assign(entry->FileName, childNameLength);
+                if (!directoryPolicy.TryGetPolicyForChild(childName.c_str(), childNameLength, /*out*/ policy))
+                {
+                    policy = directoryPolicy.GetPolicyForSubpath(childName.c_str()).GetPolicy();
+                }
+            }
+
+            // Enumeration probes are always allowed, so this is PolicyResult::ShouldOverrideTimestamps.
+            if ((policy & FileAccessPolicy_AllowRealInputTimestamps) == 0)
+            {
+                OverrideTimestampsForInputFileInformation(entry);
+            }
+        }
+
+        // See usage in FindFirstFileExW
+        ScrubShortFileNameOfDirectoryEntryIfPresent(entry);
+
+        if (entry->NextEntryOffset == 0)
+        {
+            break;
+        }
+
+        offset += entry->NextEntryOffset;
+    }
+}
+
+/// <summary>
+/// Applies the metadata overrides to the entries a successful NtQueryDirectoryFile / ZwQueryDirectoryFile call returned.
+/// </summary>
+static void OverrideMetadataForDirectoryEntries(
+    PolicyResult const&    directoryPolicy,
+    FILE_INFORMATION_CLASS fileInformationClass,
+    PVOID                  fileInformation,
+    ULONG                  length,
+    PIO_STATUS_BLOCK       ioStatusBlock)
+{
+    if (directoryPolicy.IsIndeterminate() || fileInformation == nullptr || ioStatusBlock == nullptr)
+    {
+        return;
+    }
+
+    ULONG_PTR returnedLength = ioStatusBlock->Information < length ? ioStatusBlock->Information : length;
+
+    switch ((FILE_INFORMATION_CLASS_EXTRA)fileInformationClass)
+    {
+        case FileFullDirectoryInformation:
+            OverrideMetadataForDirectoryEntries<FILE_FULL_DIR_INFORMATION>(directoryPolicy, fileInformation, returnedLength);
+            break;
+        case FileBothDirectoryInformation:
+            OverrideMetadataForDirectoryEntries<FILE_BOTH_DIR_INFORMATION>(directoryPolicy, fileInformation, returnedLength);
+            break;
+        case FileIdFullDirectoryInformation:
+            OverrideMetadataForDirectoryEntries<FILE_ID_FULL_DIR_INFORMATION>(directoryPolicy, fileInformation, returnedLength);
+            break;
+        case FileIdBothDirectoryInformation:
+            OverrideMetadataForDirectoryEntries<FILE_ID_BOTH_DIR_INFORMATION>(directoryPolicy, fileInformation, returnedLength);
+            break;
+        default:
+            if (fileInformationClass == FileDirectoryInformation)
+            {
+                OverrideMetadataForDirectoryEntries<FILE_DIRECTORY_INFORMATION>(directoryPolicy, fileInformation, returnedLength);
+            }
+
+            break;
+    }
+}
+
 // Detoured_NtQueryDirectoryFile
 //
 // FileHandle            - a handle for the file object that represents the directory for which information is being requested.
@@ -4603,6 +6113,8 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
     _In_opt_ PUNICODE_STRING        FileName,
     _In_     BOOLEAN                RestartScan)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::NtQueryDirectoryFile);
+
     DetouredScope scope;
     LPCWSTR directoryName = nullptr;
     wstring filter;
@@ -4623,15 +6135,15 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
             isEnumeration = PathContainsWildcard(filter.c_str());
         }
 
-        // See if the handle is known
+        // See if the handle is known. Once the enumeration has been reported, later calls still get their entries' metadata overridden.
         overlay = TryLookupHandleOverlay(FileHandle);
-        if (overlay == nullptr || overlay->EnumerationHasBeenReported)
+        if (overlay == nullptr)
         {
             noDetour = true;
         }
         else 
         {
-            canonicalizedDirectoryPath = overlay->Policy.GetCanonicalizedPath();
+            canonicalizedDirectoryPath = overlay->Policy->GetCanonicalizedPath();
             directoryName = canonicalizedDirectoryPath.GetPathString();
 
             if (_wcsicmp(directoryName, L"\\\\.\\MountPointManager") == 0 ||
@@ -4642,7 +6154,7 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
         }
     }
 
-    NTSTATUS result = Real_NtQueryDirectoryFile(
+    NTSTATUS result = TIMED_REAL(NtQueryDirectoryFile)(
             FileHandle,
             Event,
             ApcRoutine,
@@ -4675,37 +6187,45 @@ NTSTATUS NTAPI Detoured_NtQueryDirectoryFile(
         // in CreateFile or NtCreateFile in order to get the (non)directory handle.
         if (overlay->Type == HandleType::Directory) 
         {
-            
-            // TODO: Perhaps should have a specific access check for enumeration.
-            //       For now, we always allow enumeration and report it.
-            //       Since enumeration has historically not been understood or reported at all, this is a fine incremental move -
-            //       given a policy flag for allowing enumeration, we'd apply it globally anyway.
-            // TODO: Should include the wildcard in enumeration reports, so that directory enumeration assertions can be more precise.
+            if (!overlay->EnumerationHasBeenReported)
+            {
+                // TODO: Perhaps should have a specific access check for enumeration.
+                //       For now, we always allow enumeration and report it.
+                //       Since enumeration has historically not been understood or reported at all, this is a fine incremental move -
+                //       given a policy flag for allowing enumeration, we'd apply it globally anyway.
+                // TODO: Should include the wildcard in enumeration reports, so that directory enumeration assertions can be more precise.
 
-            PolicyResult directoryPolicyResult = overlay->Policy;
-            
-            // Only report the enumeration if specified by the policy
-            bool reportDirectoryEnumeration = directoryPolicyResult.ReportDirectoryEnumeration();
-            bool explicitlyReportDirectoryEnumeration = isEnumeration && reportDirectoryEnumeration;
+                PolicyResult directoryPolicyResult = *overlay->Policy;
 
-            AccessCheckResult directoryAccessCheck(
-                isEnumeration ? RequestedAccess::Enumerate : RequestedAccess::Probe,
-                ResultAction::Allow,
-                explicitlyReportDirectoryEnumeration ? ReportLevel::ReportExplicit : ReportLevel::Ignore);
+                // Only report the enumeration if specified by the policy
+                bool reportDirectoryEnumeration = directoryPolicyResult.ReportDirectoryEnumeration();
+                bool explicitlyReportDirectoryEnumeration = isEnumeration && reportDirectoryEnumeration;
 
-            if (!explicitlyReportDirectoryEnumeration && ReportAnyAccess(false))
-            {
-                // Ensure access is reported (not explicit) when report all accesses is specified
-                directoryAccessCheck.ReportLevel = ReportLevel::Report;
-            }
+                AccessCheckResult directoryAccessCheck(
+                    isEnumeration ? RequestedAccess::Enumerate : RequestedAccess::Probe,
+                    ResultAction::Allow,
+                    explicitlyReportDirectoryEnumeration ? ReportLevel::ReportExplicit : ReportLevel::Ignore);
+
+                if (!explicitlyReportDirectoryEnumeration && ReportAnyAccess(false))
+                {
+                    // Ensure access is reported (not explicit) when report all accesses is specified
+                    directoryAccessCheck.ReportLevel = ReportLevel::Report;
+                }
 
-            FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"NtQueryDirectoryFile", directoryName);
+                FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"NtQueryDirectoryFile", directoryName);
 
-            // Remember that we already enumerated this directory if successful
-            overlay->EnumerationHasBeenReported = NT_SUCCESS(result) && directoryAccessCheck.ShouldReport();
+                // Remember that we already enumerated this directory if successful
+                overlay->EnumerationHasBeenReported = NT_SUCCESS(result) && directoryAccessCheck.ShouldReport();
 
-            // We can report the status for directory now.
-            ReportIfNeeded(directoryAccessCheck, fileOperationContext, overlay->Policy, (DWORD)(NT_SUCCESS(result) ? ERROR_SUCCESS : result), -1, filter.c_str());
+                // We can report the status for directory now.
+                ReportIfNeeded(directoryAccessCheck, fileOperationContext, *overlay->Policy, (DWORD)(NT_SUCCESS(result) ? ERROR_SUCCESS : result), -1, filter.c_str());
+            }
+
+            // Only a synchronously completed call has its entries in the buffer by now.
+            if (NT_SUCCESS(result) && result != STATUS_PENDING)
+            {
+                OverrideMetadataForDirectoryEntries(*overlay->Policy, FileInformationClass, FileInformation, Length, IoStatusBlock);
+            }
         }
     }
 
@@ -4728,6 +6248,8 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
     _In_opt_ PUNICODE_STRING        FileName,
     _In_     BOOLEAN                RestartScan)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::ZwQueryDirectoryFile);
+
     DetouredScope scope;
     LPCWSTR directoryName = nullptr;
     wstring filter;
@@ -4749,15 +6271,15 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
             isEnumeration = PathContainsWildcard(filter.c_str());
         }
 
-        // See if the handle is known
+        // See if the handle is known. Once the enumeration has been reported, later calls still get their entries' metadata overridden.
         overlay = TryLookupHandleOverlay(FileHandle);
-        if (overlay == nullptr || overlay->EnumerationHasBeenReported)
+        if (overlay == nullptr)
         {
             noDetour = true;
         }
         else
         {
-            canonicalizedDirectoryPath = overlay->Policy.GetCanonicalizedPath();
+            canonicalizedDirectoryPath = overlay->Policy->GetCanonicalizedPath();
             directoryName = canonicalizedDirectoryPath.GetPathString();
 
             if (_wcsicmp(directoryName, L"\\\\.\\MountPointManager") == 0 ||
@@ -4768,7 +6290,7 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
         }
     }
 
-    NTSTATUS result = Real_ZwQueryDirectoryFile(
+    NTSTATUS result = TIMED_REAL(ZwQueryDirectoryFile)(
         FileHandle,
         Event,
         ApcRoutine,
@@ -4801,35 +6323,44 @@ NTSTATUS NTAPI Detoured_ZwQueryDirectoryFile(
         // in CreateFile or ZtCreateFile in order to get the (non)directory handle.
         if (overlay->Type == HandleType::Directory) 
         {
-            // TODO: Perhaps should have a specific access check for enumeration.
-            //       For now, we always allow enumeration and report it.
-            //       Since enumeration has historically not been understood or reported at all, this is a fine incremental move -
-            //       given a policy flag for allowing enumeration, we'd apply it globally anyway.
-            // TODO: Should include the wildcard in enumeration reports, so that directory enumeration assertions can be more precise.
-            PolicyResult directoryPolicyResult = overlay->Policy;
+            if (!overlay->EnumerationHasBeenReported)
+            {
+                // TODO: Perhaps should have a specific access check for enumeration.
+                //       For now, we always allow enumeration and report it.
+                //       Since enumeration has historically not been understood or reported at all, this is a fine incremental move -
+                //       given a policy flag for allowing enumeration, we'd apply it globally anyway.
+                // TODO: Should include the wildcard in enumeration reports, so that directory enumeration assertions can be more precise.
+                PolicyResult directoryPolicyResult = *overlay->Policy;
+
+                // Only report the enumeration if specified by the policy
+                bool reportDirectoryEnumeration = directoryPolicyResult.ReportDirectoryEnumeration();
+                bool explicitlyReportDirectoryEnumeration = isEnumeration && reportDirectoryEnumeration;
+
+                AccessCheckResult directoryAccessCheck(
+                    isEnumeration ? RequestedAccess::Enumerate : RequestedAccess::Probe,
+                    ResultAction::Allow,
+                    explicitlyReportDirectoryEnumeration ? ReportLevel::ReportExplicit : ReportLevel::Ignore);
+
+                if (!explicitlyReportDirectoryEnumeration && ReportAnyAccess(false))
+                {
+                    // Ensure access is reported (not explicit) when report all accesses is specified
+                    directoryAccessCheck.ReportLevel = ReportLevel::Report;
+                }
 
-            // Only report the enumeration if specified by the policy
-            bool reportDirectoryEnumeration = directoryPolicyResult.ReportDirectoryEnumeration();
-            bool explicitlyReportDirectoryEnumeration = isEnumeration && reportDirectoryEnumeration;
+                FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"ZwQueryDirectoryFile", directoryName);
 
-            AccessCheckResult directoryAccessCheck(
-                isEnumeration ? RequestedAccess::Enumerate : RequestedAccess::Probe,
-                ResultAction::Allow,
-                explicitlyReportDirectoryEnumeration ? ReportLevel::ReportExplicit : ReportLevel::Ignore);
+                // Remember that we already enumerated this directory if successful
+                overlay->EnumerationHasBeenReported = NT_SUCCESS(result) && directoryAccessCheck.ShouldReport();
 
-            if (!explicitlyReportDirectoryEnumeration && ReportAnyAccess(false))
-            {
-                // Ensure access is reported (not explicit) when report all accesses is specified
-                directoryAccessCheck.ReportLevel = ReportLevel::Report;
+                // We can report the status for directory now.
+                ReportIfNeeded(directoryAccessCheck, fileOperationContext, *overlay->Policy, (DWORD)(NT_SUCCESS(result) ? ERROR_SUCCESS : result));
             }
 
-            FileOperationContext fileOperationContext = FileOperationContext::CreateForRead(L"ZwQueryDirectoryFile", directoryName);
-
-            // Remember that we already enumerated this directory if successful
-            overlay->EnumerationHasBeenReported = NT_SUCCESS(result) && directoryAccessCheck.ShouldReport();
-
-            // We can report the status for directory now.
-            ReportIfNeeded(directoryAccessCheck, fileOperationContext, overlay->Policy, (DWORD)(NT_SUCCESS(result) ? ERROR_SUCCESS : result));
+            // Only a synchronously completed call has its entries in the buffer by now.
+            if (NT_SUCCESS(result) && result != STATUS_PENDING)
+            {
+                OverrideMetadataForDirectoryEntries(*overlay->Policy, FileInformationClass, FileInformation, Length, IoStatusBlock);
+            }
         }
     }
 
@@ -4886,8 +6417,11 @@ static bool PathFromObjectAttributesViaId(POBJECT_ATTRIBUTES attributes, Canonic
     return true;
 }
 
-// Helper function converts OBJECT_ATTRIBUTES into CanonicalizedPath
-static bool PathFromObjectAttributes(POBJECT_ATTRIBUTES attributes, CanonicalizedPath &path, ULONG createOptions)
+// Helper function converts OBJECT_ATTRIBUTES into CanonicalizedPath.
+// For a name relative to a RootDirectory whose handle overlay has a policy, it also resolves the policy of the path (into
+// policyResult) by resuming the search of the overlay's policy, rather than searching the manifest from its root again.
+// policyResult is left indeterminate otherwise, for the caller to initialize from the path.
+static bool PathFromObjectAttributes(POBJECT_ATTRIBUTES attributes, CanonicalizedPath &path, ULONG createOptions, PolicyResult& policyResult)
 {
     if ((createOptions & FILE_OPEN_BY_FILE_ID) != 0)
     {
@@ -4906,7 +6440,7 @@ static bool PathFromObjectAttributes(POBJECT_ATTRIBUTES attributes, Canonicalize
     {
         overlay = TryLookupHandleOverlay(attributes->RootDirectory);
         // If root directory is specified, we better know about it by know -- ignore unknown relative paths
-        if (overlay == nullptr || overlay->Policy.GetCanonicalizedPath().IsNull())
+        if (overlay == nullptr || overlay->Policy->GetCanonicalizedPath().IsNull())
         {
             return false;
         }
@@ -4917,9 +6451,30 @@ static bool PathFromObjectAttributes(POBJECT_ATTRIBUTES attributes, Canonicalize
 
     if (overlay != nullptr)
     {
+        PolicyResult const& rootPolicy = *overlay->Policy;
+
+        // A translation may apply to the path below the root directory but not to the root directory itself (see TryGetPolicyForChild).
+        bool canResumeSearch = !rootPolicy.IsIndeterminate() && (g_pManifestTranslatePathTuples == nullptr || g_pManifestTranslatePathTuples->empty());
+
         // If there is no 'name' set (name is empty), just use the canonicalized path. Otherwise need to extend,
         // so '\' is appended to the canonicalized path and then the name is appended.
-        path = name.empty() ? overlay->Policy.GetCanonicalizedPath() : overlay->Policy.GetCanonicalizedPath().Extend(name.c_str());
+        if (name.empty())
+        {
+            path = rootPolicy.GetCanonicalizedPath();
+            if (canResumeSearch)
+            {
+                policyResult = rootPolicy;
+            }
+        }
+        else if (canResumeSearch)
+        {
+            policyResult = rootPolicy.GetPolicyForSubpath(name.c_str());
+            path = policyResult.GetCanonicalizedPath();
+        }
+        else
+        {
+            path = rootPolicy.GetCanonicalizedPath().Extend(name.c_str());
+        }
     }
     else
     {
@@ -4991,6 +6546,100 @@ static bool CheckIfNtCreateFileOptionsExcludeOpeningFiles(ULONG createOptions)
     return (createOptions & FILE_DIRECTORY_FILE) != 0;
 }
 
+/// <summary>
+/// Completes an NtCreateFile, ZwCreateFile, or ZwOpenFile call on a transparent path (see PolicyResult::IsTransparent).
+/// </summary>
+/// <remarks>
+/// Whatever the access turns out to be, it is allowed and not reported. Only the accesses to the targets of reparse points remain to be
+/// enforced, as the complete detours do, and directory handles get an overlay for the opens relative to them.
+/// </remarks>
+static NTSTATUS CompleteTransparentNtCreateFile(
+    NTSTATUS                  result,
+    CanonicalizedPath const&  path,
+    PolicyResult const&       policyResult,
+    PHANDLE                   fileHandle,
+    DWORD                     desiredAccess,
+    DWORD                     sharedAccess,
+    ULONG                     createDisposition,
+    ULONG                     fileAttributes,
+    ULONG                     createOptions)
+{
+    if (!NT_SUCCESS(result))
+    {
+        return result;
+    }
+
+    NTSTATUS ntStatus;
+    if (!IgnoreReparsePoints()
+        // EnforceChainOfReparsePointAccesses does nothing for NtCreateFile-like calls otherwise, so save probing the path.
+        && MonitorNtCreateFile()
+        && !WantsProbeOnlyAccess(desiredAccess)
+        && IsReparsePoint(path.GetPathString())
+        && !EnforceChainOfReparsePointAccesses(
+            policyResult.GetCanonicalizedPath(),
+            (createOptions & FILE_OPEN_REPARSE_POINT) != 0 ? *fileHandle : INVALID_HANDLE_VALUE,
+            desiredAccess,
+            sharedAccess,
+            createDisposition,
+            fileAttributes,
+            true,
+            &ntStatus))
+    {
+        NtClose(*fileHandle);
+        *fileHandle = INVALID_HANDLE_VALUE;
+        return DETOURS_STATUS_ACCESS_DENIED;
+    }
+
+    RegisterTransparentDirectoryOverlay(
+        *fileHandle,
+        policyResult,
+        (createOptions & FILE_NON_DIRECTORY_FILE) == 0,
+        (createOptions & FILE_DIRECTORY_FILE) != 0,
+        (createOptions & FILE_OPEN_REPARSE_POINT) == 0);
+
+    return result;
+}
+
+#ifndef STATUS_FILE_IS_A_DIRECTORY
+#define STATUS_FILE_IS_A_DIRECTORY ((NTSTATUS)0xC00000BAL)
+#endif
+
+/// <summary>
+/// Checks if an NtCreateFile, ZwCreateFile or ZwOpenFile call opened (or failed to open) a directory.
+/// </summary>
+/// <remarks>
+/// The options and the result of the call answer this without querying the file system when they are decisive: FILE_DIRECTORY_FILE
+/// only opens directories, while FILE_NON_DIRECTORY_FILE only opens files and fails with STATUS_FILE_IS_A_DIRECTORY on directories,
+/// and a file the call created, overwrote or superseded without FILE_DIRECTORY_FILE is not a directory. Otherwise this falls back to
+/// IsHandleOrPathToDirectory.
+/// </remarks>
+static bool IsNtOpenOfDirectory(
+    _In_ ULONG options,
+    _In_ NTSTATUS result,
+    _In_ PIO_STATUS_BLOCK ioStatusBlock,
+    _Inout_ OpenedFileStat& openedFileStat,
+    _In_ LPCWSTR path)
+{
+    ULONG directoryOptions = options & (FILE_DIRECTORY_FILE | FILE_NON_DIRECTORY_FILE);
+    if (directoryOptions == FILE_DIRECTORY_FILE || result == STATUS_FILE_IS_A_DIRECTORY)
+    {
+        InterlockedIncrement64(&g_detoursDirectoryQueriesAvoided);
+        return true;
+    }
+
+    if (NT_SUCCESS(result)
+        && (directoryOptions == FILE_NON_DIRECTORY_FILE
+            || ioStatusBlock->Information == FILE_CREATED
+            || ioStatusBlock->Information == FILE_OVERWRITTEN
+            || ioStatusBlock->Information == FILE_SUPERSEDED))
+    {
+        InterlockedIncrement64(&g_detoursDirectoryQueriesAvoided);
+        return false;
+    }
+
+    return IsHandleOrPathToDirectory(openedFileStat, path, false);
+}
+
 IMPLEMENTED(Detoured_ZwCreateFile)
 NTSTATUS NTAPI Detoured_ZwCreateFile(
     _Out_    PHANDLE            FileHandle,
@@ -5005,6 +6654,14 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
     _In_opt_ PVOID              EaBuffer,
     _In_     ULONG              EaLength)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::ZwCreateFile);
+
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache(MayCreateOrDeleteOnNtCreateFile(DesiredAccess, CreateDisposition, CreateOptions));
+    KnownDirectoryCacheInvalidationScope invalidateKnownDirectories((CreateOptions & FILE_DELETE_ON_CLOSE) != 0);
+
+    // The policy is that of the name given; the real function opens the redirected one (even if Detoured_IsDisabled()).
+    RedirectedObjectAttributes redirectedObjectAttributes(ObjectAttributes);
+
     DetouredScope scope;
 
     // As a performance workaround, neuter the FILE_RANDOM_ACCESS hint (even if Detoured_IsDisabled() and there's another detoured API higher on the stack).
@@ -5013,17 +6670,18 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
     CreateOptions &= ~FILE_RANDOM_ACCESS;
 
     CanonicalizedPath path;
+    PolicyResult policyResult;
 
     if (scope.Detoured_IsDisabled() ||
         !MonitorZwCreateOpenQueryFile() ||
         ObjectAttributes == nullptr ||
-        !PathFromObjectAttributes(ObjectAttributes, path, CreateOptions) ||
+        !PathFromObjectAttributes(ObjectAttributes, path, CreateOptions, policyResult) ||
         IsSpecialDeviceName(path.GetPathString()))
     {
-        return Real_ZwCreateFile(
+        return TIMED_REAL(ZwCreateFile)(
             FileHandle,
             DesiredAccess,
-            ObjectAttributes,
+            redirectedObjectAttributes.Get(),
             IoStatusBlock,
             AllocationSize,
             FileAttributes,
@@ -5042,13 +6700,47 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
         MapNtCreateOptionsToWin32FileFlags(CreateOptions),
         path.GetPathString());
 
-    PolicyResult policyResult;
-    if (!policyResult.Initialize(path.GetPathString())) 
+    if (policyResult.IsIndeterminate() && !policyResult.Initialize(path.GetPathString())) 
     {
         policyResult.ReportIndeterminatePolicyAndSetLastError(opContext);
         return DETOURS_STATUS_ACCESS_DENIED;
     }
 
+    if (policyResult.IsTransparent())
+    {
+        // See the sharing below.
+        DWORD transparentSharedAccess = ShareAccess | FILE_SHARE_DELETE;
+
+        NTSTATUS transparentResult = TIMED_REAL(ZwCreateFile)(
+            FileHandle,
+            DesiredAccess,
+            redirectedObjectAttributes.Get(),
+            IoStatusBlock,
+            AllocationSize,
+            FileAttributes,
+            transparentSharedAccess,
+            CreateDisposition,
+            CreateOptions,
+            EaBuffer,
+            EaLength);
+
+        DWORD lastError = GetLastError();
+
+        transparentResult = CompleteTransparentNtCreateFile(
+            transparentResult,
+            path,
+            policyResult,
+            FileHandle,
+            DesiredAccess,
+            transparentSharedAccess,
+            CreateDisposition,
+            FileAttributes,
+            CreateOptions);
+
+        SetLastError(lastError);
+        return transparentResult;
+    }
+
     // We start with allow / ignore (no access requested) and then restrict based on read / write (maybe both, maybe neither!)
     AccessCheckResult accessCheck(RequestedAccess::None, ResultAction::Allow, ReportLevel::Ignore);
     bool forceReadOnlyForRequestedRWAccess = false;
@@ -5138,12 +6830,14 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
     DWORD desiredAccess = !forceReadOnlyForRequestedRWAccess ? DesiredAccess : (DesiredAccess & FILE_GENERIC_READ);
     DWORD sharedAccess = !forceReadOnlyForRequestedRWAccess ? (ShareAccess | FILE_SHARE_DELETE | readSharingIfNeeded) : FILE_SHARE_READ | FILE_SHARE_DELETE;
     
+    MaterializeIfNeeded(policyResult);
+
     error = ERROR_SUCCESS;
 
-    NTSTATUS result = Real_ZwCreateFile(
+    NTSTATUS result = TIMED_REAL(ZwCreateFile)(
         FileHandle,
         desiredAccess,
-        ObjectAttributes,
+        redirectedObjectAttributes.Get(),
         IoStatusBlock,
         AllocationSize,
         FileAttributes,
@@ -5161,14 +6855,16 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
         FileReadContext readContext;
         readContext.InferExistenceFromNtStatus(result);
 
+        // The handle is not valid after a failed open; the check can only fall back to the path.
+        OpenedFileStat failedOpenStat(INVALID_HANDLE_VALUE, false);
+
         // Note that 'handle' is allowed invalid for this check. Some tools poke at directories without
         // FILE_FLAG_BACKUP_SEMANTICS and so get INVALID_HANDLE_VALUE / ERROR_ACCESS_DENIED. In that kind of
         // case we have a fallback to re-probe.
         // We skip this to avoid the fallback probe if we don't believe the path exists, since increasing failed-probe volume is dangerous for perf.
         readContext.OpenedDirectory = 
             (readContext.FileExistence == FileExistence::Existent) 
-            && ((CreateOptions & (FILE_DIRECTORY_FILE | FILE_NON_DIRECTORY_FILE)) == FILE_DIRECTORY_FILE 
-                || IsHandleOrPathToDirectory(*FileHandle, path.GetPathString(), false));
+            && IsNtOpenOfDirectory(CreateOptions, result, IoStatusBlock, failedOpenStat, path.GetPathString());
 
         // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
         if (MonitorNtCreateFile()) 
@@ -5191,7 +6887,10 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
         return result;
     }
 
-    if (!IgnoreReparsePoints() && IsReparsePoint(path.GetPathString()) && !WantsProbeOnlyAccess(opContext.DesiredAccess))
+    // The checks following the open share a single query of the handle.
+    OpenedFileStat openedFileStat(*FileHandle, (CreateOptions & FILE_OPEN_REPARSE_POINT) != 0);
+
+    if (!IgnoreReparsePoints() && IsOpenedReparsePoint(path.GetPathString(), openedFileStat) && !WantsProbeOnlyAccess(opContext.DesiredAccess))
     {
         // (1) Reparse point should not be ignored.
         // (2) File/Directory is a reparse point.
@@ -5231,8 +6930,7 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
     // We skip this to avoid the fallback probe if we don't believe the path exists, since increasing failed-probe volume is dangerous for perf.
     readContext.OpenedDirectory = 
         (readContext.FileExistence == FileExistence::Existent) 
-        && ((CreateOptions & (FILE_DIRECTORY_FILE | FILE_NON_DIRECTORY_FILE)) == FILE_DIRECTORY_FILE 
-            || IsHandleOrPathToDirectory(*FileHandle, path.GetPathString(), false));
+        && IsNtOpenOfDirectory(CreateOptions, result, IoStatusBlock, openedFileStat, path.GetPathString());
 
     // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
     if (MonitorNtCreateFile()) 
@@ -5267,7 +6965,10 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
     else if (hasValidHandle)
     {
         HandleType handleType = readContext.OpenedDirectory ? HandleType::Directory : HandleType::File;
-        RegisterHandleOverlay(*FileHandle, accessCheck, policyResult, handleType);
+        bool fileIsEmpty = IoStatusBlock->Information == FILE_CREATED || IoStatusBlock->Information == FILE_OVERWRITTEN || IoStatusBlock->Information == FILE_SUPERSEDED;
+        RegisterHandleOverlay(*FileHandle, accessCheck, policyResult, handleType,
+            handleType == HandleType::File ? TryCreateOutputHasher(policyResult, DesiredAccess, fileIsEmpty) : nullptr,
+            (CreateOptions & FILE_OPEN_REPARSE_POINT) == 0, openedFileStat.GetIfQueried(), openedFileStat.GetGeneration());
     }
 
     SetLastError(error);
@@ -5275,7 +6976,8 @@ NTSTATUS NTAPI Detoured_ZwCreateFile(
 }
 
 IMPLEMENTED(Detoured_NtCreateFile)
-NTSTATUS NTAPI Detoured_NtCreateFile(
+template <typename TFamFlags>
+static NTSTATUS NTAPI Detoured_NtCreateFileSpecialized(
     _Out_    PHANDLE            FileHandle,
     _In_     ACCESS_MASK        DesiredAccess,
     _In_     POBJECT_ATTRIBUTES ObjectAttributes,
@@ -5288,6 +6990,14 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     _In_opt_ PVOID              EaBuffer,
     _In_     ULONG              EaLength)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::NtCreateFile);
+
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache(MayCreateOrDeleteOnNtCreateFile(DesiredAccess, CreateDisposition, CreateOptions));
+    KnownDirectoryCacheInvalidationScope invalidateKnownDirectories((CreateOptions & FILE_DELETE_ON_CLOSE) != 0);
+
+    // See Detoured_ZwCreateFile.
+    RedirectedObjectAttributes redirectedObjectAttributes(ObjectAttributes);
+
     DetouredScope scope;
 
     // As a performance workaround, neuter the FILE_RANDOM_ACCESS hint (even if Detoured_IsDisabled() and there's another detoured API higher on the stack).
@@ -5296,16 +7006,17 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     CreateOptions &= ~FILE_RANDOM_ACCESS;
 
     CanonicalizedPath path;
+    PolicyResult policyResult;
     
     if (scope.Detoured_IsDisabled() ||
         ObjectAttributes == nullptr ||
-        !PathFromObjectAttributes(ObjectAttributes, path, CreateOptions) ||
+        !PathFromObjectAttributes(ObjectAttributes, path, CreateOptions, policyResult) ||
         IsSpecialDeviceName(path.GetPathString()))
     {
-        return Real_NtCreateFile(
+        return TIMED_REAL(NtCreateFile)(
             FileHandle,
             DesiredAccess,
-            ObjectAttributes,
+            redirectedObjectAttributes.Get(),
             IoStatusBlock,
             AllocationSize,
             FileAttributes,
@@ -5326,13 +7037,47 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
         MapNtCreateOptionsToWin32FileFlags(CreateOptions),
         path.GetPathString());
 
-    PolicyResult policyResult;
-    if (!policyResult.Initialize(path.GetPathString())) 
+    if (policyResult.IsIndeterminate() && !policyResult.Initialize(path.GetPathString())) 
     {
         policyResult.ReportIndeterminatePolicyAndSetLastError(opContext);
         return DETOURS_STATUS_ACCESS_DENIED;
     }
 
+    if (policyResult.IsTransparent())
+    {
+        // See the sharing below.
+        DWORD transparentSharedAccess = ShareAccess | FILE_SHARE_DELETE;
+
+        NTSTATUS transparentResult = TIMED_REAL(NtCreateFile)(
+            FileHandle,
+            DesiredAccess,
+            redirectedObjectAttributes.Get(),
+            IoStatusBlock,
+            AllocationSize,
+            FileAttributes,
+            transparentSharedAccess,
+            CreateDisposition,
+            CreateOptions,
+            EaBuffer,
+            EaLength);
+
+        DWORD lastError = GetLastError();
+
+        transparentResult = CompleteTransparentNtCreateFile(
+            transparentResult,
+            path,
+            policyResult,
+            FileHandle,
+            DesiredAccess,
+            transparentSharedAccess,
+            CreateDisposition,
+            FileAttributes,
+            CreateOptions);
+
+        SetLastError(lastError);
+        return transparentResult;
+    }
+
     // We start with allow / ignore (no access requested) and then restrict based on read / write (maybe both, maybe neither!)
     AccessCheckResult accessCheck(RequestedAccess::None, ResultAction::Allow, ReportLevel::Ignore);
     bool forceReadOnlyForRequestedRWAccess = false;
@@ -5354,7 +7099,7 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
         accessCheck = policyResult.CheckWriteAccess();
 
         // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
-        if (accessCheck.ResultAction != ResultAction::Allow && !MonitorNtCreateFile()) 
+        if (accessCheck.ResultAction != ResultAction::Allow && !TFamFlags::MonitorNtCreateFile()) 
         {
             // TODO: As part of gradually turning on NtCreateFile detour reports, we currently only enforce deletes (some cmd builtins delete this way),
             //       and we ignore potential deletes on *directories* (specifically, robocopy likes to open target directories with delete access, without actually deleting them).
@@ -5374,7 +7119,7 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
             }
         }
 
-        if (ForceReadOnlyForRequestedReadWrite() && accessCheck.ResultAction != ResultAction::Allow)
+        if (TFamFlags::ForceReadOnlyForRequestedReadWrite() && accessCheck.ResultAction != ResultAction::Allow)
         {
             // If ForceReadOnlyForRequestedReadWrite() is true, then we allow read for requested read-write access so long as the tool is allowed to read.
             // In such a case, we change the desired access to read only (see the call to Real_CreateFileW below).
@@ -5425,12 +7170,14 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     DWORD desiredAccess = !forceReadOnlyForRequestedRWAccess ? DesiredAccess : (DesiredAccess & FILE_GENERIC_READ);
     DWORD sharedAccess = !forceReadOnlyForRequestedRWAccess ? (ShareAccess | FILE_SHARE_DELETE | readSharingIfNeeded) : FILE_SHARE_READ | FILE_SHARE_DELETE;
     
+    MaterializeIfNeeded(policyResult);
+
     error = ERROR_SUCCESS;
 
-    NTSTATUS result = Real_NtCreateFile(
+    NTSTATUS result = TIMED_REAL(NtCreateFile)(
         FileHandle,
         desiredAccess,
-        ObjectAttributes,
+        redirectedObjectAttributes.Get(),
         IoStatusBlock,
         AllocationSize,
         FileAttributes,
@@ -5448,17 +7195,19 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
         FileReadContext readContext;
         readContext.InferExistenceFromNtStatus(result);
 
+        // The handle is not valid after a failed open; the check can only fall back to the path.
+        OpenedFileStat failedOpenStat(INVALID_HANDLE_VALUE, false);
+
         // Note that 'handle' is allowed invalid for this check. Some tools poke at directories without
         // FILE_FLAG_BACKUP_SEMANTICS and so get INVALID_HANDLE_VALUE / ERROR_ACCESS_DENIED. In that kind of
         // case we have a fallback to re-probe.
         // We skip this to avoid the fallback probe if we don't believe the path exists, since increasing failed-probe volume is dangerous for perf.
         readContext.OpenedDirectory = 
             (readContext.FileExistence == FileExistence::Existent) 
-            && ((CreateOptions & (FILE_DIRECTORY_FILE | FILE_NON_DIRECTORY_FILE)) == FILE_DIRECTORY_FILE 
-                || IsHandleOrPathToDirectory(*FileHandle, path.GetPathString(), false));
+            && IsNtOpenOfDirectory(CreateOptions, result, IoStatusBlock, failedOpenStat, path.GetPathString());
 
         // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
-        if (MonitorNtCreateFile())
+        if (TFamFlags::MonitorNtCreateFile())
         {
             if (WantsReadAccess(opContext.DesiredAccess))
             {
@@ -5479,7 +7228,10 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
         return result;
     }
 
-    if (!IgnoreReparsePoints() && IsReparsePoint(path.GetPathString()) && !WantsProbeOnlyAccess(opContext.DesiredAccess))
+    // The checks following the open share a single query of the handle.
+    OpenedFileStat openedFileStat(*FileHandle, (CreateOptions & FILE_OPEN_REPARSE_POINT) != 0);
+
+    if (!TFamFlags::IgnoreReparsePoints() && IsOpenedReparsePoint(path.GetPathString(), openedFileStat) && !WantsProbeOnlyAccess(opContext.DesiredAccess))
     {
         // (1) Reparse point should not be ignored.
         // (2) File/Directory is a reparse point.
@@ -5520,11 +7272,10 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     // We skip this to avoid the fallback probe if we don't believe the path exists, since increasing failed-probe volume is dangerous for perf.
     readContext.OpenedDirectory = 
         (readContext.FileExistence == FileExistence::Existent) 
-        && ((CreateOptions & (FILE_DIRECTORY_FILE | FILE_NON_DIRECTORY_FILE)) == FILE_DIRECTORY_FILE 
-            || IsHandleOrPathToDirectory(*FileHandle, path.GetPathString(), false));
+        && IsNtOpenOfDirectory(CreateOptions, result, IoStatusBlock, openedFileStat, path.GetPathString());
 
     // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
-    if (MonitorNtCreateFile())
+    if (TFamFlags::MonitorNtCreateFile())
     {
         if (WantsReadAccess(opContext.DesiredAccess))
         {
@@ -5557,7 +7308,10 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     else if (hasValidHandle)
     {
         HandleType handleType = readContext.OpenedDirectory ? HandleType::Directory : HandleType::File;
-        RegisterHandleOverlay(*FileHandle, accessCheck, policyResult, handleType);
+        bool fileIsEmpty = IoStatusBlock->Information == FILE_CREATED || IoStatusBlock->Information == FILE_OVERWRITTEN || IoStatusBlock->Information == FILE_SUPERSEDED;
+        RegisterHandleOverlay(*FileHandle, accessCheck, policyResult, handleType,
+            handleType == HandleType::File ? TryCreateOutputHasher(policyResult, DesiredAccess, fileIsEmpty) : nullptr,
+            (CreateOptions & FILE_OPEN_REPARSE_POINT) == 0, openedFileStat.GetIfQueried(), openedFileStat.GetGeneration());
     }
 
     SetLastError(error);
@@ -5565,6 +7319,64 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     return result;
 }
 
+// The variant of the detour reading every FAM flag from the manifest, and the one the other detours call.
+NTSTATUS NTAPI Detoured_NtCreateFile(
+    _Out_    PHANDLE            FileHandle,
+    _In_     ACCESS_MASK        DesiredAccess,
+    _In_     POBJECT_ATTRIBUTES ObjectAttributes,
+    _Out_    PIO_STATUS_BLOCK   IoStatusBlock,
+    _In_opt_ PLARGE_INTEGER     AllocationSize,
+    _In_     ULONG              FileAttributes,
+    _In_     ULONG              ShareAccess,
+    _In_     ULONG              CreateDisposition,
+    _In_     ULONG              CreateOptions,
+    _In_opt_ PVOID              EaBuffer,
+    _In_     ULONG              EaLength)
+{
+    return Detoured_NtCreateFileSpecialized<GenericFamFlags>(
+        FileHandle,
+        DesiredAccess,
+        ObjectAttributes,
+        IoStatusBlock,
+        AllocationSize,
+        FileAttributes,
+        ShareAccess,
+        CreateDisposition,
+        CreateOptions,
+        EaBuffer,
+        EaLength);
+}
+
+CreateFileW_t SelectDetoured_CreateFileW()
+{
+    if (DefaultFamFlags::Matches())
+    {
+        return Detoured_CreateFileWSpecialized<DefaultFamFlags>;
+    }
+
+    if (IgnoreReparsePointsFamFlags::Matches())
+    {
+        return Detoured_CreateFileWSpecialized<IgnoreReparsePointsFamFlags>;
+    }
+
+    return Detoured_CreateFileW;
+}
+
+NtCreateFile_t SelectDetoured_NtCreateFile()
+{
+    if (DefaultFamFlags::Matches())
+    {
+        return Detoured_NtCreateFileSpecialized<DefaultFamFlags>;
+    }
+
+    if (IgnoreReparsePointsFamFlags::Matches())
+    {
+        return Detoured_NtCreateFileSpecialized<IgnoreReparsePointsFamFlags>;
+    }
+
+    return Detoured_NtCreateFile;
+}
+
 // TODO: Why do we not simply call ZwCreateFile, just like NtOpenFile?
 IMPLEMENTED(Detoured_ZwOpenFile)
 NTSTATUS NTAPI Detoured_ZwOpenFile(
@@ -5575,20 +7387,29 @@ NTSTATUS NTAPI Detoured_ZwOpenFile(
     _In_  ULONG              ShareAccess,
     _In_  ULONG              OpenOptions)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::ZwOpenFile);
+
+    ReparsePointCacheInvalidationScope invalidateReparsePointCache(MayCreateOrDeleteOnNtCreateFile(DesiredAccess, FILE_OPEN, OpenOptions));
+    KnownDirectoryCacheInvalidationScope invalidateKnownDirectories((OpenOptions & FILE_DELETE_ON_CLOSE) != 0);
+
+    // See Detoured_ZwCreateFile.
+    RedirectedObjectAttributes redirectedObjectAttributes(ObjectAttributes);
+
     DetouredScope scope;
 
     CanonicalizedPath path;
+    PolicyResult policyResult;
 
     if (scope.Detoured_IsDisabled() ||
         !MonitorZwCreateOpenQueryFile() ||
         ObjectAttributes == nullptr ||
-        !PathFromObjectAttributes(ObjectAttributes, path, OpenOptions) ||
+        !PathFromObjectAttributes(ObjectAttributes, path, OpenOptions, policyResult) ||
         IsSpecialDeviceName(path.GetPathString()))
     {
-        return Real_ZwOpenFile(
+        return TIMED_REAL(ZwOpenFile)(
             FileHandle,
             DesiredAccess,
-            ObjectAttributes,
+            redirectedObjectAttributes.Get(),
             IoStatusBlock,
             ShareAccess,
             OpenOptions);
@@ -5602,13 +7423,42 @@ NTSTATUS NTAPI Detoured_ZwOpenFile(
         MapNtCreateOptionsToWin32FileFlags(OpenOptions),
         path.GetPathString());
 
-    PolicyResult policyResult;
-    if (!policyResult.Initialize(path.GetPathString()))
+    if (policyResult.IsIndeterminate() && !policyResult.Initialize(path.GetPathString()))
     {
         policyResult.ReportIndeterminatePolicyAndSetLastError(opContext);
         return DETOURS_STATUS_ACCESS_DENIED;
     }
 
+    if (policyResult.IsTransparent())
+    {
+        // See the sharing below.
+        DWORD transparentSharedAccess = ShareAccess;
+
+        NTSTATUS transparentResult = TIMED_REAL(ZwOpenFile)(
+            FileHandle,
+            DesiredAccess,
+            redirectedObjectAttributes.Get(),
+            IoStatusBlock,
+            ShareAccess,
+            OpenOptions);
+
+        DWORD lastError = GetLastError();
+
+        transparentResult = CompleteTransparentNtCreateFile(
+            transparentResult,
+            path,
+            policyResult,
+            FileHandle,
+            DesiredAccess,
+            transparentSharedAccess,
+            FILE_OPEN,
+            0L,
+            OpenOptions);
+
+        SetLastError(lastError);
+        return transparentResult;
+    }
+
     // We start with allow / ignore (no access requested) and then restrict based on read / write (maybe both, maybe neither!)
     AccessCheckResult accessCheck(RequestedAccess::None, ResultAction::Allow, ReportLevel::Ignore);
     bool forceReadOnlyForRequestedRWAccess = false;
@@ -5694,10 +7544,10 @@ NTSTATUS NTAPI Detoured_ZwOpenFile(
     DWORD sharedAccess = !forceReadOnlyForRequestedRWAccess ? (ShareAccess | FILE_SHARE_DELETE | readSharingIfNeeded) : FILE_SHARE_READ | FILE_SHARE_DELETE;
     DWORD error = ERROR_SUCCESS;
 
-    NTSTATUS result = Real_ZwOpenFile(
+    NTSTATUS result = TIMED_REAL(ZwOpenFile)(
         FileHandle,
         DesiredAccess,
-        ObjectAttributes,
+        redirectedObjectAttributes.Get(),
         IoStatusBlock,
         ShareAccess,
         OpenOptions);
@@ -5710,14 +7560,16 @@ NTSTATUS NTAPI Detoured_ZwOpenFile(
         FileReadContext readContext;
         readContext.InferExistenceFromNtStatus(result);
 
+        // The handle is not valid after a failed open; the check can only fall back to the path.
+        OpenedFileStat failedOpenStat(INVALID_HANDLE_VALUE, false);
+
         // Note that 'handle' is allowed invalid for this check. Some tools poke at directories without
         // FILE_FLAG_BACKUP_SEMANTICS and so get INVALID_HANDLE_VALUE / ERROR_ACCESS_DENIED. In that kind of
         // case we have a fallback to re-probe.
         // We skip this to avoid the fallback probe if we don't believe the path exists, since increasing failed-probe volume is dangerous for perf.
         readContext.OpenedDirectory = 
             (readContext.FileExistence == FileExistence::Existent) 
-            && ((OpenOptions & (FILE_DIRECTORY_FILE | FILE_NON_DIRECTORY_FILE)) == FILE_DIRECTORY_FILE 
-                || IsHandleOrPathToDirectory(*FileHandle, path.GetPathString(), false));
+            && IsNtOpenOfDirectory(OpenOptions, result, IoStatusBlock, failedOpenStat, path.GetPathString());
 
         // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
         if (MonitorZwCreateOpenQueryFile())
@@ -5740,7 +7592,10 @@ NTSTATUS NTAPI Detoured_ZwOpenFile(
         return result;
     }
 
-    if (!IgnoreReparsePoints() && IsReparsePoint(path.GetPathString()) && !WantsProbeOnlyAccess(opContext.DesiredAccess))
+    // The checks following the open share a single query of the handle.
+    OpenedFileStat openedFileStat(*FileHandle, (OpenOptions & FILE_OPEN_REPARSE_POINT) != 0);
+
+    if (!IgnoreReparsePoints() && IsOpenedReparsePoint(path.GetPathString(), openedFileStat) && !WantsProbeOnlyAccess(opContext.DesiredAccess))
     {
         // (1) Reparse point should not be ignored.
         // (2) File/Directory is a reparse point.
@@ -5780,8 +7635,7 @@ NTSTATUS NTAPI Detoured_ZwOpenFile(
     // We skip this to avoid the fallback probe if we don't believe the path exists, since increasing failed-probe volume is dangerous for perf.
     readContext.OpenedDirectory = 
         (readContext.FileExistence == FileExistence::Existent) 
-        && ((OpenOptions & (FILE_DIRECTORY_FILE | FILE_NON_DIRECTORY_FILE)) == FILE_DIRECTORY_FILE 
-            || IsHandleOrPathToDirectory(*FileHandle, path.GetPathString(), false));
+        && IsNtOpenOfDirectory(OpenOptions, result, IoStatusBlock, openedFileStat, path.GetPathString());
 
     // Note: The MonitorNtCreateFile() flag is temporary until OSG (we too) fixes all newly discovered dependencies.
     if (MonitorZwCreateOpenQueryFile())
@@ -5816,7 +7670,8 @@ NTSTATUS NTAPI Detoured_ZwOpenFile(
     else if (hasValidHandle)
     {
         HandleType handleType = readContext.OpenedDirectory ? HandleType::Directory : HandleType::File;
-        RegisterHandleOverlay(*FileHandle, accessCheck, policyResult, handleType);
+        RegisterHandleOverlay(*FileHandle, accessCheck, policyResult, handleType, nullptr, (OpenOptions & FILE_OPEN_REPARSE_POINT) == 0,
+            openedFileStat.GetIfQueried(), openedFileStat.GetGeneration());
     }
 
     SetLastError(error);
@@ -5833,6 +7688,8 @@ NTSTATUS NTAPI Detoured_NtOpenFile(
     _In_  ULONG              ShareAccess,
     _In_  ULONG              OpenOptions)
 {
+    DetourStatisticsScope statistics(DetouredFunctionId::NtOpenFile);
+
     // We don't EnterLoggingScope for NtOpenFile or NtCreateFile for two reasons:
     // - Of course these get called.
     // - It's hard to predict library loads (e.g. even by a statically linked CRT), which complicates testing of other call logging.
@@ -5855,6 +7712,93 @@ NTSTATUS NTAPI Detoured_NtOpenFile(
         );
 }
 
+// Only attached when the temp directory is redirected. The attribute probes are checked and reported by the detours of the
+// Win32 functions making them (GetFileAttributes and the like), with the names they are given.
+IMPLEMENTED(Detoured_NtQueryAttributesFile)
+NTSTATUS NTAPI Detoured_NtQueryAttributesFile(
+    _In_  POBJECT_ATTRIBUTES ObjectAttributes,
+    _Out_ PVOID              FileInformation)
+{
+    RedirectedObjectAttributes redirectedObjectAttributes(ObjectAttributes);
+    return Real_NtQueryAttributesFile(redirectedObjectAttributes.Get(), FileInformation);
+}
+
+// See Detoured_NtQueryAttributesFile.
+IMPLEMENTED(Detoured_NtQueryFullAttributesFile)
+NTSTATUS NTAPI Detoured_NtQueryFullAttributesFile(
+    _In_  POBJECT_ATTRIBUTES ObjectAttributes,
+    _Out_ PVOID              FileInformation)
+{
+    RedirectedObjectAttributes redirectedObjectAttributes(ObjectAttributes);
+    return Real_NtQueryFullAttributesFile(redirectedObjectAttributes.Get(), FileInformation);
+}
+
+IMPLEMENTED(Detoured_NtWriteFile)
+NTSTATUS NTAPI Detoured_NtWriteFile(
+    _In_     HANDLE           FileHandle,
+    _In_opt_ HANDLE           Event,
+    _In_opt_ PIO_APC_ROUTINE  ApcRoutine,
+    _In_opt_ PVOID            ApcContext,
+    _Out_    PIO_STATUS_BLOCK IoStatusBlock,
+    _In_     PVOID            Buffer,
+    _In_     ULONG            Length,
+    _In_opt_ PLARGE_INTEGER   ByteOffset,
+    _In_opt_ PULONG           Key)
+{
+    DetourStatisticsScope statistics(DetouredFunctionId::NtWriteFile);
+
+    DetouredScope scope;
+    HandleOverlayRef overlay;
+    if (scope.Detoured_IsDisabled()
+        || IsNullOrInvalidHandle(FileHandle)
+        || !(overlay = TryLookupHandleOverlay(FileHandle))
+        || !overlay->Hasher
+        || !overlay->Hasher->IsValid())
+    {
+        return TIMED_REAL(NtWriteFile)(FileHandle, Event, ApcRoutine, ApcContext, IoStatusBlock, Buffer, Length, ByteOffset, Key);
+    }
+
+    OutputHasher& hasher = *overlay->Hasher;
+
+    // The hasher stays locked until the write is hashed, so that concurrent writes to the handle are hashed in the order they were made.
+    hasher.Lock();
+
+    // Without an explicit offset, the write starts at the file pointer (synchronous handles only; others fail the call).
+    bool offsetKnown;
+    LARGE_INTEGER offset;
+    if (ByteOffset == nullptr || (ByteOffset->HighPart == -1 && ByteOffset->LowPart == FILE_USE_FILE_POINTER_POSITION))
+    {
+        LARGE_INTEGER zero;
+        zero.QuadPart = 0;
+        offsetKnown = SetFilePointerEx(FileHandle, zero, &offset, FILE_CURRENT) != FALSE;
+    }
+    else if (ByteOffset->HighPart == -1 && ByteOffset->LowPart == FILE_WRITE_TO_END_OF_FILE)
+    {
+        offsetKnown = GetFileSizeEx(FileHandle, &offset) != FALSE;
+    }
+    else
+    {
+        offset = *ByteOffset;
+        offsetKnown = offset.QuadPart >= 0;
+    }
+
+    NTSTATUS result = TIMED_REAL(NtWriteFile)(FileHandle, Event, ApcRoutine, ApcContext, IoStatusBlock, Buffer, Length, ByteOffset, Key);
+
+    // A pending write may complete out of order with the next ones, and a failed one may have written part of the buffer.
+    if (!offsetKnown || result == STATUS_PENDING || !NT_SUCCESS(result))
+    {
+        hasher.Invalidate();
+    }
+    else
+    {
+        hasher.Write((uint64_t)offset.QuadPart, reinterpret_cast<BYTE const*>(Buffer), (size_t)IoStatusBlock->Information);
+    }
+
+    hasher.Unlock();
+
+    return result;
+}
+
 IMPLEMENTED(Detoured_NtClose)
 NTSTATUS NTAPI Detoured_NtClose(_In_ HANDLE handle)
 {
@@ -5870,8 +7814,7 @@ NTSTATUS NTAPI Detoured_NtClose(_In_ HANDLE handle)
     // dropping a handle overlay when trying to close the handle, anyway).
     //
     // Make sure the handle is closed after the object is marked for removal from the map.
-    // This way the handle will never be assigned to a another object before removed from the map 
-    // (whenever the map is accessed, the closed handle list is drained).
+    // This way the handle will never be assigned to a another object before removed from the map.
 
     if (!IsNullOrInvalidHandle(handle)) 
     {
@@ -5881,20 +7824,62 @@ NTSTATUS NTAPI Detoured_NtClose(_In_ HANDLE handle)
             // This is to make sure the behaviour for Windows builds is not altered.
             // Also if the NtCreateFile is no monitored, the map should not grow significantly. The other cases where it is updated -
             // for example CreateFileW, the map is updated by the CloseFile detoured API.
-            if (UseExtraThreadToDrainNtClose())
-            {
-                AddClosedHandle(handle);
-            }
-            else
-            {
-                // Just remove the handle from the table directly.
-                // Pass true for recursiveCall, since we don't have anything in the handle drain list and call to drain it is not needed.
-                CloseHandleOverlay(handle, true);
-            }
+            MarkHandleOverlayClosed(handle);
         }
     }
 
     return Real_NtClose(handle);
 }
 
+// Whether a process handle refers to the current process, either as the pseudo-handle or as a real handle to it.
+static bool IsCurrentProcessHandle(HANDLE process)
+{
+    return process == GetCurrentProcess() || GetProcessId(process) == GetCurrentProcessId();
+}
+
+NTSTATUS NTAPI Detoured_NtDuplicateObject(
+    _In_      HANDLE      SourceProcessHandle,
+    _In_      HANDLE      SourceHandle,
+    _In_opt_  HANDLE      TargetProcessHandle,
+    _Out_opt_ PHANDLE     TargetHandle,
+    _In_      ACCESS_MASK DesiredAccess,
+    _In_      ULONG       HandleAttributes,
+    _In_      ULONG       Options)
+{
+    DetourStatisticsScope statistics(DetouredFunctionId::NtDuplicateObject);
+
+    // Only duplicates of handles of this process with an overlay are of interest; the overlay lookup comes first,
+    // as it is cheaper than finding out which process a process handle refers to.
+    DetouredScope scope;
+    HandleOverlayRef overlay;
+    if (scope.Detoured_IsDisabled()
+        || IsNullOrInvalidHandle(SourceHandle)
+        || !(overlay = TryLookupHandleOverlay(SourceHandle))
+        || !IsCurrentProcessHandle(SourceProcessHandle))
+    {
+        return TIMED_REAL(NtDuplicateObject)(SourceProcessHandle, SourceHandle, TargetProcessHandle, TargetHandle, DesiredAccess, HandleAttributes, Options);
+    }
+
+    // DUPLICATE_CLOSE_SOURCE closes the source handle even if the duplication fails. As for CloseHandle, the overlay is removed
+    // before the handle is closed, so that the handle value is not reused by another object while it still maps to the overlay.
+    if ((Options & DUPLICATE_CLOSE_SOURCE) != 0)
+    {
+        CloseHandleOverlay(SourceHandle);
+    }
+
+    NTSTATUS status = TIMED_REAL(NtDuplicateObject)(SourceProcessHandle, SourceHandle, TargetProcessHandle, TargetHandle, DesiredAccess, HandleAttributes, Options);
+
+    // Duplicates into other processes are looked up there on use, as any handle without an overlay.
+    if (NT_SUCCESS(status)
+        && TargetHandle != nullptr
+        && TargetProcessHandle != nullptr
+        && !IsNullOrInvalidHandle(*TargetHandle)
+        && IsCurrentProcessHandle(TargetProcessHandle))
+    {
+        RegisterDuplicatedHandleOverlay(*TargetHandle, overlay);
+    }
+
+    return status;
+}
+
 #undef IMPLEMENTED
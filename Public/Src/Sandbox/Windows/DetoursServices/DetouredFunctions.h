@@ -92,6 +92,23 @@ HANDLE WINAPI Detoured_CreateFileA(
     __in_opt HANDLE hTemplateFile
     );
 
+// The FAM flags that the specialized variants of Detoured_CreateFileW and Detoured_NtCreateFile fold (see SpecializedFamFlags),
+// and the combinations of their values the variants exist for.
+#define DETOURS_SPECIALIZED_FAM_FLAGS \
+    ((DWORD)FileAccessManifestFlag::MonitorNtCreateFile | (DWORD)FileAccessManifestFlag::IgnoreReparsePoints | (DWORD)FileAccessManifestFlag::ForceReadOnlyForRequestedReadWrite)
+
+// The default of a build: NtCreateFile is monitored, reparse points are followed, and read-write opens are left as they are.
+typedef SpecializedFamFlags<DETOURS_SPECIALIZED_FAM_FLAGS, (DWORD)FileAccessManifestFlag::MonitorNtCreateFile> DefaultFamFlags;
+
+// The same, ignoring reparse points.
+typedef SpecializedFamFlags<
+    DETOURS_SPECIALIZED_FAM_FLAGS,
+    (DWORD)FileAccessManifestFlag::MonitorNtCreateFile | (DWORD)FileAccessManifestFlag::IgnoreReparsePoints> IgnoreReparsePointsFamFlags;
+
+/// Returns the variant of Detoured_CreateFileW specialized for the FAM flags of this process, or Detoured_CreateFileW itself.
+/// The flags must not change afterwards, which holds once the manifest has been parsed.
+CreateFileW_t SelectDetoured_CreateFileW();
+
 // See CloseHandle on MSDN: https://msdn.microsoft.com/en-us/library/windows/desktop/ms724211%28v=vs.85%29.aspx
 BOOL WINAPI Detoured_CloseHandle(
     __in    HANDLE handle
@@ -404,6 +421,16 @@ BOOL WINAPI Detoured_RemoveDirectoryA(
     __in  LPCSTR lpPathName
     );
 
+// See SetCurrentDirectory on MSDN: https://docs.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-setcurrentdirectory
+BOOL WINAPI Detoured_SetCurrentDirectoryW(
+    __in  LPCWSTR lpPathName
+    );
+
+// See SetCurrentDirectory on MSDN: https://docs.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-setcurrentdirectory
+BOOL WINAPI Detoured_SetCurrentDirectoryA(
+    __in  LPCSTR lpPathName
+    );
+
 // See DecryptFile on MSDN: http://msdn.microsoft.com/en-us/library/windows/desktop/aa363903(v=vs.85).aspx
 BOOL WINAPI Detoured_DecryptFileW(
     __in        LPCWSTR lpFileName,
@@ -506,6 +533,20 @@ NTSTATUS NTAPI Detoured_ZwSetInformationFile(
     _In_  FILE_INFORMATION_CLASS FileInformationClass
     );
 
+// See NtWriteFile on MSDN: https://docs.microsoft.com/en-us/windows-hardware/drivers/ddi/ntifs/nf-ntifs-ntwritefile
+// Only detoured with FileAccessManifestExtraFlag::HashOutputsWhileWriting.
+NTSTATUS NTAPI Detoured_NtWriteFile(
+    __in HANDLE FileHandle,
+    __in_opt HANDLE Event,
+    __in_opt PIO_APC_ROUTINE ApcRoutine,
+    __in_opt PVOID ApcContext,
+    __out PIO_STATUS_BLOCK IoStatusBlock,
+    __in_bcount(Length) PVOID Buffer,
+    __in ULONG Length,
+    __in_opt PLARGE_INTEGER ByteOffset,
+    __in_opt PULONG Key
+    );
+
 // See NtCreateFile on MSDN: https://msdn.microsoft.com/en-us/library/bb432380(v=vs.85).aspx
 NTSTATUS NTAPI Detoured_NtCreateFile(
     __out PHANDLE FileHandle,
@@ -521,6 +562,9 @@ NTSTATUS NTAPI Detoured_NtCreateFile(
     __in ULONG EaLength
     );
 
+/// Returns the variant of Detoured_NtCreateFile specialized for the FAM flags of this process, or Detoured_NtCreateFile itself.
+NtCreateFile_t SelectDetoured_NtCreateFile();
+
 // See NtOpenFile on MSDN: https://msdn.microsoft.com/en-us/library/bb432381(v=vs.85).aspx
 NTSTATUS NTAPI Detoured_NtOpenFile(
     __out PHANDLE FileHandle,
@@ -556,11 +600,34 @@ NTSTATUS NTAPI Detoured_ZwOpenFile(
     __in ULONG OpenOptions
 );
 
+// NtQueryAttributesFile (FILE_BASIC_INFORMATION) and NtQueryFullAttributesFile (FILE_NETWORK_OPEN_INFORMATION) back GetFileAttributes(Ex).
+NTSTATUS NTAPI Detoured_NtQueryAttributesFile(
+    __in POBJECT_ATTRIBUTES ObjectAttributes,
+    __out PVOID FileInformation
+);
+
+NTSTATUS NTAPI Detoured_NtQueryFullAttributesFile(
+    __in POBJECT_ATTRIBUTES ObjectAttributes,
+    __out PVOID FileInformation
+);
+
 // See NtClose on MSDN: https://msdn.microsoft.com/en-us/library/ms648410(v=vs.85).aspx
 NTSTATUS NTAPI Detoured_NtClose(
     __in HANDLE Handle
     );
 
+// See NtDuplicateObject on MSDN: https://docs.microsoft.com/en-us/windows-hardware/drivers/ddi/ntifs/nf-ntifs-zwduplicateobject
+// DuplicateHandle calls it as well.
+NTSTATUS NTAPI Detoured_NtDuplicateObject(
+    __in HANDLE SourceProcessHandle,
+    __in HANDLE SourceHandle,
+    __in_opt HANDLE TargetProcessHandle,
+    __out_opt PHANDLE TargetHandle,
+    __in ACCESS_MASK DesiredAccess,
+    __in ULONG HandleAttributes,
+    __in ULONG Options
+    );
+
 BOOLEAN NTAPI Detoured_RtlFreeHeap(
     _In_     PVOID HeapHandle,
     _In_opt_ ULONG Flags,
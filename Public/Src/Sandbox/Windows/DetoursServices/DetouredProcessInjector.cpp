@@ -6,6 +6,7 @@ using namespace std;
 #include "DetouredProcessInjector.h"
 #include "DetoursHelpers.h"
 #include "DeviceMap.h"
+#include "DetoursEvents.h"
 #include <iomanip>
 #include "buildXL_mem.h"
 
@@ -14,6 +15,41 @@ bool DetouredProcessInjector::s_is64BitProcess = sizeof(void *) == 8;
 
 unsigned long g_injectionTimeoutInMinutes = 0;
 
+extern volatile LONG64 g_detoursInjectedProcesses;
+extern volatile LONG64 g_detoursInjectionImagesFromPeb;
+extern volatile LONG64 g_detoursInjectionFindImageMicroseconds;
+extern volatile LONG64 g_detoursInjectionAllocateMicroseconds;
+extern volatile LONG64 g_detoursInjectionWriteImportsMicroseconds;
+extern volatile LONG64 g_detoursInjectionChecksumMicroseconds;
+extern volatile LONG64 g_detoursInjectionApplyMappingMicroseconds;
+extern volatile LONG64 g_detoursInjectionInheritedDeviceMaps;
+
+static LONG64 TicksToMicroseconds(LONGLONG ticks)
+{
+    static LARGE_INTEGER s_frequency = { 0 };
+    if (s_frequency.QuadPart == 0 && !QueryPerformanceFrequency(&s_frequency))
+    {
+        return 0;
+    }
+
+    return (LONG64)((ticks / s_frequency.QuadPart) * 1000000 + ((ticks % s_frequency.QuadPart) * 1000000) / s_frequency.QuadPart);
+}
+
+// Adds the time each step of updating the imports of a child took to the totals reported with the process data.
+static void AccountInjectionTimings(DETOUR_UPDATE_TIMINGS const& timings)
+{
+    InterlockedIncrement64(&g_detoursInjectedProcesses);
+    if (timings.fImageFromPeb)
+    {
+        InterlockedIncrement64(&g_detoursInjectionImagesFromPeb);
+    }
+
+    InterlockedAdd64(&g_detoursInjectionFindImageMicroseconds, TicksToMicroseconds(timings.llFindImage));
+    InterlockedAdd64(&g_detoursInjectionAllocateMicroseconds, TicksToMicroseconds(timings.llAllocateNearBase));
+    InterlockedAdd64(&g_detoursInjectionWriteImportsMicroseconds, TicksToMicroseconds(timings.llWriteImports));
+    InterlockedAdd64(&g_detoursInjectionChecksumMicroseconds, TicksToMicroseconds(timings.llChecksum));
+}
+
 // Address of the function that checks if a process is a Wow64 process. Not all
 // versions of Windows have this function, so this value could be null. Casting
 // from FARPROC causes warning, disable
@@ -37,13 +73,26 @@ bool DetouredProcessInjector::isWow64Process(HANDLE processHandle)
 
 void DetouredProcessInjector::Clear()
 {
+    LockGuard lock(_injectorLock);
+
     _initialized = false;
     _mapDirectory.reset();
     _remoteInjectorPipe.reset();
     _reportPipe.reset();
     _payload.reset(nullptr);
     _payloadSize = 0;
-    _otherHandles.clear();
+    if (_sharedPayloadView != nullptr)
+    {
+        UnmapViewOfFile(_sharedPayloadView - sizeof(SharedPayloadHeader));
+        _sharedPayloadView = nullptr;
+    }
+    _payloadSection.reset();
+    _payloadChecksum = 0;
+    _wrapperPrefix.clear();
+    _wrapperTemplateReady = 0;
+    _reportCacheSection.reset();
+    _prologueCache.clear();
+    CloseReportChannels();
     _dllX64.clear();
     _dllX86.clear();
 }
@@ -52,8 +101,11 @@ void DetouredProcessInjector::Clear()
 // uint32_t size - the size of the block
 // uint32_t handleCount - the number of handles
 // uint64_t handles - handles passed from the parent.
-//                    There must be c_minHandleCount handles there.
-// payload
+//                    There must be c_minHandleCount handles there, followed by the report channels if c_reportChannelsFlag is set.
+// uint64_t section - the shared report cache section, only if c_sharedReportCacheFlag is set in handleCount.
+// uint64_t count   - the number of prologue cache entries, only if c_prologueCacheFlag is set in handleCount,
+// entries          - followed by the entries.
+// payload          - or a SharedPayloadReference if c_sharedPayloadFlag is set in handleCount.
 bool DetouredProcessInjector::Init(const byte *payloadWrapper, std::wstring& errorMessage)
 {
     errorMessage = L"";
@@ -93,6 +145,12 @@ bool DetouredProcessInjector::Init(const byte *payloadWrapper, std::wstring& err
     uint32_t handleCount = *data;
     data++;
 
+    bool isSharedPayload = (handleCount & c_sharedPayloadFlag) != 0;
+    bool hasReportCacheSection = (handleCount & c_sharedReportCacheFlag) != 0;
+    bool hasPrologueCache = (handleCount & c_prologueCacheFlag) != 0;
+    _reportChannels = (handleCount & c_reportChannelsFlag) != 0;
+    handleCount &= ~(c_sharedPayloadFlag | c_sharedReportCacheFlag | c_prologueCacheFlag | c_reportChannelsFlag);
+
     if (!(handleCount >= c_minHandleCount && size >= handleCount * sizeof(uint64_t)))
     {
         errorMessage = L"Payload has incorrect handle count or size: (handleCount: ";
@@ -127,6 +185,58 @@ bool DetouredProcessInjector::Init(const byte *payloadWrapper, std::wstring& err
         }
     }
 
+    if (hasReportCacheSection)
+    {
+        if (size < sizeof(uint64_t))
+        {
+            errorMessage = L"Payload has incorrect report cache section size: ";
+            errorMessage += std::to_wstring(size);
+
+            return false;
+        }
+
+        _reportCacheSection.reset(Uint64ToHandle(*handles++));
+        size -= sizeof(uint64_t);
+    }
+
+    if (hasPrologueCache)
+    {
+        uint64_t entryCount = size >= sizeof(uint64_t) ? *handles : 0;
+        if (size < sizeof(uint64_t) || (size - sizeof(uint64_t)) / sizeof(DETOUR_PROLOGUE_CACHE_ENTRY) < entryCount)
+        {
+            errorMessage = L"Payload has incorrect prologue cache size: ";
+            errorMessage += std::to_wstring(size);
+
+            return false;
+        }
+
+        const DETOUR_PROLOGUE_CACHE_ENTRY *entries = reinterpret_cast<const DETOUR_PROLOGUE_CACHE_ENTRY *>(handles + 1);
+        _prologueCache.assign(entries, entries + entryCount);
+
+        size_t prologueCacheSize = sizeof(uint64_t) + static_cast<size_t>(entryCount) * sizeof(DETOUR_PROLOGUE_CACHE_ENTRY);
+        handles = reinterpret_cast<const uint64_t *>(reinterpret_cast<const byte *>(handles) + prologueCacheSize);
+        size -= static_cast<uint32_t>(prologueCacheSize);
+    }
+
+    if (isSharedPayload)
+    {
+        if (size < sizeof(SharedPayloadReference))
+        {
+            errorMessage = L"Payload has incorrect shared payload reference size: ";
+            errorMessage += std::to_wstring(size);
+
+            return false;
+        }
+
+        if (!MapSharedPayload(*reinterpret_cast<const SharedPayloadReference *>(handles), errorMessage))
+        {
+            return false;
+        }
+
+        _initialized = true;
+        return true;
+    }
+
     // Copy payload
     _payloadSize = size;
     _payload = make_unique<byte[]>(size);
@@ -177,8 +287,173 @@ void DetouredProcessInjector::Init(
 }
 
 
+uint64_t DetouredProcessInjector::ComputePayloadChecksum(const byte *payload, uint32_t payloadSize)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t i = 0; i < payloadSize; i++)
+    {
+        hash ^= payload[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+void DetouredProcessInjector::EnsureWrapperTemplate()
+{
+    // Volatile reads have acquire semantics, so the template is visible once the flag is.
+    if (_wrapperTemplateReady != 0)
+    {
+        return;
+    }
+
+    LockGuard lock(_injectorLock);
+    if (_wrapperTemplateReady != 0)
+    {
+        return;
+    }
+
+    CreateSharedPayloadSection();
+    bool isSharedPayload = _payloadSection.isValid();
+    bool hasReportCacheSection = _reportCacheSection.isValid();
+    bool hasPrologueCache = !_prologueCache.empty();
+
+    uint32_t size = WrapperSize();
+    _wrapperPrefix.assign(isSharedPayload ? size : size - _payloadSize, 0);
+
+    // Write sizes
+    uint32_t *sizes = reinterpret_cast<uint32_t *>(_wrapperPrefix.data());
+    *sizes++ = size;
+    *sizes++ = static_cast<uint32_t>(c_minHandleCount + _otherHandles.size())
+        | (isSharedPayload ? c_sharedPayloadFlag : 0)
+        | (hasReportCacheSection ? c_sharedReportCacheFlag : 0)
+        | (hasPrologueCache ? c_prologueCacheFlag : 0)
+        | (_reportChannels ? c_reportChannelsFlag : 0);
+
+    // Write the handles, as children inheriting them get them
+    uint64_t *handles = reinterpret_cast<uint64_t *>(sizes);
+    *handles++ = HandleToUint64(_mapDirectory.get());
+    *handles++ = HandleToUint64(_remoteInjectorPipe.get());
+    *handles++ = HandleToUint64(_reportPipe.get());
+    for (auto i : _otherHandles)
+    {
+        *handles++ = HandleToUint64(i);
+    }
+
+    // The report cache section handle is always duplicated, so its slot is left for each injection to fill in.
+    if (hasReportCacheSection)
+    {
+        handles++;
+    }
+
+    // The prologue cache is the same for every child (children of another bitness ignore it).
+    if (hasPrologueCache)
+    {
+        *handles++ = _prologueCache.size();
+        size_t entriesSize = _prologueCache.size() * sizeof(DETOUR_PROLOGUE_CACHE_ENTRY);
+        memcpy_s(handles, entriesSize, _prologueCache.data(), entriesSize);
+        handles = reinterpret_cast<uint64_t *>(reinterpret_cast<byte *>(handles) + entriesSize);
+    }
+
+    if (isSharedPayload)
+    {
+        // Same for the section handle, but the rest of the reference is the same for every child.
+        SharedPayloadReference *reference = reinterpret_cast<SharedPayloadReference *>(handles);
+        reference->PayloadSize = _payloadSize;
+        reference->Reserved = 0;
+        reference->Checksum = _payloadChecksum;
+    }
+
+    InterlockedExchange(&_wrapperTemplateReady, 1);
+}
+
+void DetouredProcessInjector::CreateSharedPayloadSection()
+{
+    if (_payloadSection.isValid() || _payloadSize < c_sharedPayloadMinSize)
+    {
+        return;
+    }
+
+    // Pagefile-backed and unnamed: children get read-only duplicates of the handle through their payload wrapper.
+    uint64_t sectionSize = sizeof(SharedPayloadHeader) + static_cast<uint64_t>(_payloadSize);
+    unique_handle<nullptr> section(CreateFileMappingW(
+        INVALID_HANDLE_VALUE,
+        nullptr,
+        PAGE_READWRITE,
+        static_cast<DWORD>(sectionSize >> 32),
+        static_cast<DWORD>(sectionSize & UINT32_MAX),
+        nullptr));
+
+    if (!section.isValid())
+    {
+        Dbg(L"DetouredProcessInjector::CreateSharedPayloadSection - Failed to create section, the payload will be copied: 0x%08x", (int)GetLastError());
+        return;
+    }
+
+    byte *view = reinterpret_cast<byte *>(MapViewOfFile(section.get(), FILE_MAP_WRITE, 0, 0, 0));
+    if (view == nullptr)
+    {
+        Dbg(L"DetouredProcessInjector::CreateSharedPayloadSection - Failed to map section, the payload will be copied: 0x%08x", (int)GetLastError());
+        return;
+    }
+
+    _payloadChecksum = ComputePayloadChecksum(Payload(), _payloadSize);
+
+    SharedPayloadHeader *header = reinterpret_cast<SharedPayloadHeader *>(view);
+    header->Tag = c_sharedPayloadTag;
+    header->PayloadSize = _payloadSize;
+    header->Checksum = _payloadChecksum;
+    memcpy_s(view + sizeof(SharedPayloadHeader), _payloadSize, Payload(), _payloadSize);
+
+    UnmapViewOfFile(view);
+    _payloadSection.reset(section.release());
+}
+
+bool DetouredProcessInjector::MapSharedPayload(const SharedPayloadReference &reference, std::wstring& errorMessage)
+{
+    unique_handle<nullptr> section(Uint64ToHandle(reference.SectionHandle));
+
+    const byte *view = reinterpret_cast<const byte *>(MapViewOfFile(section.get(), FILE_MAP_READ, 0, 0, 0));
+    if (view == nullptr)
+    {
+        errorMessage = L"Failed to map shared payload: ";
+        errorMessage += std::to_wstring(GetLastError());
+
+        return false;
+    }
+
+    MEMORY_BASIC_INFORMATION viewInfo;
+    const SharedPayloadHeader *header = reinterpret_cast<const SharedPayloadHeader *>(view);
+
+    // The section never changes after its creator filled it, and the creator computed the checksum over the payload then.
+    // So a header agreeing with the reference is enough to trust the payload without reading (or verifying) all of it.
+    if (VirtualQuery(view, &viewInfo, sizeof(viewInfo)) == 0
+        || viewInfo.RegionSize < sizeof(SharedPayloadHeader)
+        || header->Tag != c_sharedPayloadTag
+        || header->PayloadSize != reference.PayloadSize
+        || header->Checksum != reference.Checksum
+        || viewInfo.RegionSize - sizeof(SharedPayloadHeader) < header->PayloadSize)
+    {
+        UnmapViewOfFile(view);
+        errorMessage = L"Shared payload does not match its reference";
+
+        return false;
+    }
+
+    _payloadSection.reset(section.release());
+    _sharedPayloadView = view + sizeof(SharedPayloadHeader);
+    _payload.reset(nullptr);
+    _payloadSize = header->PayloadSize;
+    _payloadChecksum = header->Checksum;
+
+    return true;
+}
+
 void DetouredProcessInjector::SetHandles(uint32_t otherHandleCount, PHANDLE otherHandles)
 {
+    LockGuard lock(_injectorLock);
+
+    CloseReportChannels();
     if (otherHandleCount == 0)
     {
         _otherHandles.clear();
@@ -188,13 +463,115 @@ void DetouredProcessInjector::SetHandles(uint32_t otherHandleCount, PHANDLE othe
     }
 }
 
-DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inheritedHandles)
+void DetouredProcessInjector::SetReportChannels(uint32_t channelCount, const HANDLE *channels)
+{
+    LockGuard lock(_injectorLock);
+
+    CloseReportChannels();
+    for (uint32_t i = 0; i < channelCount; i++)
+    {
+        HANDLE channel;
+        HANDLE currentProcess = GetCurrentProcess();
+        if (!DuplicateHandle(currentProcess, channels[i], currentProcess, &channel, 0, TRUE, DUPLICATE_SAME_ACCESS))
+        {
+            // The processes that would have got the channel get one of the others instead.
+            Dbg(L"DetouredProcessInjector::SetReportChannels - Failed to duplicate report channel %d: 0x%08x", (int)i, (int)GetLastError());
+            continue;
+        }
+
+        _otherHandles.push_back(channel);
+    }
+
+    _reportChannels = !_otherHandles.empty();
+    _ownsReportChannels = _reportChannels;
+    // The template (if already built) has neither the handles nor the flag.
+    _wrapperTemplateReady = 0;
+}
+
+void DetouredProcessInjector::CloseReportChannels()
+{
+    if (_ownsReportChannels)
+    {
+        for (auto i : _otherHandles)
+        {
+            CloseHandle(i);
+        }
+    }
+
+    _otherHandles.clear();
+    _reportChannels = false;
+    _ownsReportChannels = false;
+}
+
+HANDLE DetouredProcessInjector::NextReportChannel()
+{
+    if (!_reportChannels)
+    {
+        return _reportPipe.get();
+    }
+
+    // The first process injected by the top of the tree (the main process of the pip) gets the first channel.
+    LONG next = InterlockedIncrement(&_nextReportChannel) - 1;
+    return _otherHandles[static_cast<ULONG>(next) % _otherHandles.size()];
+}
+
+void DetouredProcessInjector::SetReportCacheSection(HANDLE section)
+{
+    LockGuard lock(_injectorLock);
+    _reportCacheSection.reset(section);
+    // The template (if already built) does not have a slot for the section.
+    _wrapperTemplateReady = 0;
+}
+
+void DetouredProcessInjector::SetPrologueCache(const DETOUR_PROLOGUE_CACHE_ENTRY *entries, uint32_t entryCount)
+{
+    LockGuard lock(_injectorLock);
+    _prologueCache.assign(entries, entries + entryCount);
+    _wrapperTemplateReady = 0;
+}
+
+void DetouredProcessInjector::SetDeviceMapInherited(bool inherited)
 {
     LockGuard lock(_injectorLock);
+    _deviceMapInherited = inherited;
+}
+
+DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inheritedHandles)
+{
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    DETOUR_UPDATE_TIMINGS timings;
+    ZeroMemory(&timings, sizeof(timings));
+    DWORD error = LocalInjectProcessSteps(processHandle, inheritedHandles, timings);
+
+    if (IsDetoursEventEnabled(DetoursEvent_ProcessInjected))
+    {
+        LARGE_INTEGER end;
+        QueryPerformanceCounter(&end);
+        WriteProcessInjectedEvent(
+            GetProcessId(processHandle),
+            false,
+            error,
+            (ULONGLONG)TicksToMicroseconds(timings.llFindImage),
+            (ULONGLONG)TicksToMicroseconds(timings.llAllocateNearBase),
+            (ULONGLONG)TicksToMicroseconds(timings.llWriteImports),
+            (ULONGLONG)TicksToMicroseconds(timings.llChecksum),
+            (ULONGLONG)TicksToMicroseconds(end.QuadPart - start.QuadPart));
+    }
+
+    return error;
+}
+
+DWORD DetouredProcessInjector::LocalInjectProcessSteps(HANDLE processHandle, bool inheritedHandles, DETOUR_UPDATE_TIMINGS& timings)
+{
+    // No lock: all of the state read here is immutable once the injector is initialized (see _injectorLock).
 
     // Install detours
     LPCSTR dll = isWow64Process(processHandle) ? _dllX86.data() : _dllX64.data();
-    if (!DetourUpdateProcessWithDll(processHandle, &dll, 1))
+    BOOL updated = DetourUpdateProcessWithDllTimed(processHandle, &dll, 1, &timings);
+    AccountInjectionTimings(timings);
+    if (!updated)
     {
         DWORD err = GetLastError();
         Dbg(L"DetouredProcessInjector::LocalInjectProcess - Failed to inject %S from %s process into %s process: 0x%08x",
@@ -202,48 +579,102 @@ DWORD DetouredProcessInjector::LocalInjectProcess(HANDLE processHandle, bool inh
         return err;
     }
 
-    if (_mapDirectory.isValid() && !ApplyMapping(processHandle, _mapDirectory.get()))
+    if (_mapDirectory.isValid())
     {
-        DWORD err = GetLastError();
-        Dbg(L"DetouredProcessInjector::LocalInjectProcess - Failed to apply mapping handle %d from %s to %s process: 0x%08x",
-            (uint32_t)((intptr_t)_mapDirectory.get() & UINT32_MAX),
-            s_isWow64Process ? L"WOW64" : L"Native",
-            isWow64Process(processHandle) ? L"WOW64" : L"Native", (int)err);
-        return err;
+        if (_deviceMapInherited)
+        {
+            // The child got the device map of this process when it was created.
+            InterlockedIncrement64(&g_detoursInjectionInheritedDeviceMaps);
+        }
+        else
+        {
+            LARGE_INTEGER mappingStart;
+            QueryPerformanceCounter(&mappingStart);
+            bool applied = ApplyMapping(processHandle, _mapDirectory.get());
+            InterlockedAdd64(&g_detoursInjectionApplyMappingMicroseconds, (LONG64)MicrosecondsSince(mappingStart));
+
+            if (!applied)
+            {
+                DWORD err = GetLastError();
+                Dbg(L"DetouredProcessInjector::LocalInjectProcess - Failed to apply mapping handle %d from %s to %s process: 0x%08x",
+                    (uint32_t)((intptr_t)_mapDirectory.get() & UINT32_MAX),
+                    s_isWow64Process ? L"WOW64" : L"Native",
+                    isWow64Process(processHandle) ? L"WOW64" : L"Native", (int)err);
+                return err;
+            }
+        }
     }
 
-    // Allocate space for the payload wrapper.
-    uint32_t size = WrapperSize();
-    std::unique_ptr<byte[]> payloadWrapper = make_unique<byte[]>(size);
+    EnsureWrapperTemplate();
+    bool isSharedPayload = _payloadSection.isValid();
+    bool hasReportCacheSection = _reportCacheSection.isValid();
 
-    // Write sizes
-    uint32_t *sizes = reinterpret_cast<uint32_t *>(payloadWrapper.get());
-    *sizes++ = size;
-    *sizes++ = static_cast<uint32_t>(c_minHandleCount + _otherHandles.size());
-
-    // Write handles
-    uint64_t *handles = reinterpret_cast<uint64_t *>(sizes);
-    *handles++ = inheritedHandles ? HandleToUint64(_mapDirectory.get()) : DuplicateHandleToUint64(processHandle, _mapDirectory.get());
-    *handles++ = inheritedHandles ? HandleToUint64(_remoteInjectorPipe.get()) : DuplicateHandleToUint64(processHandle, _remoteInjectorPipe.get());
-    *handles++ = inheritedHandles ? HandleToUint64(_reportPipe.get()) : DuplicateHandleToUint64(processHandle, _reportPipe.get());
+    // Only the handle slots of the (small) template change per child; the payload is written from where it is.
+    const uint32_t prefixSize = static_cast<uint32_t>(_wrapperPrefix.size());
+    std::unique_ptr<byte[]> prefix = make_unique<byte[]>(prefixSize);
+    memcpy_s(prefix.get(), prefixSize, _wrapperPrefix.data(), prefixSize);
 
-    if (!_otherHandles.empty())
+    uint64_t *handles = reinterpret_cast<uint64_t *>(prefix.get() + 2 * sizeof(uint32_t));
+    HANDLE reportPipe = NextReportChannel();
+    if (inheritedHandles)
     {
+        // The channels are inheritable, so the child knows its channel by the same value.
+        handles[2] = HandleToUint64(reportPipe);
+        handles += c_minHandleCount + _otherHandles.size();
+    }
+    else
+    {
+        *handles++ = DuplicateHandleToUint64(processHandle, _mapDirectory.get());
+        *handles++ = DuplicateHandleToUint64(processHandle, _remoteInjectorPipe.get());
+        *handles++ = DuplicateHandleToUint64(processHandle, reportPipe);
         for (auto i : _otherHandles)
         {
-            *handles++ = inheritedHandles ? HandleToUint64(i) : DuplicateHandleToUint64(processHandle, i);
+            *handles++ = DuplicateHandleToUint64(processHandle, i);
         }
     }
 
-    // Copy payload
-    errno_t memcpyerror = memcpy_s(handles, _payloadSize, _payload.get(), _payloadSize);
-    if (memcpyerror != 0)
+    if (hasReportCacheSection)
     {
-        Dbg(L"DetouredProcessInjector::LocalInjectProcess - Failed to do memcpy: 0x%08x", (int)memcpyerror);
-        return ERROR_PARTIAL_COPY;
+        // The section handle is not inheritable, so it is always duplicated. The child updates the table and passes it on.
+        HANDLE targetSection;
+        if (!DuplicateHandle(GetCurrentProcess(), _reportCacheSection.get(), processHandle, &targetSection, 0, FALSE, DUPLICATE_SAME_ACCESS))
+        {
+            DWORD err = GetLastError();
+            Dbg(L"DetouredProcessInjector::LocalInjectProcess - Failed to duplicate the shared report cache section: 0x%08x", (int)err);
+            return err;
+        }
+
+        *handles++ = HandleToUint64(targetSection);
     }
 
-    if (!DetourCopyPayloadToProcess(processHandle, _payloadGuid, payloadWrapper.get(), size))
+    if (!_prologueCache.empty())
+    {
+        // Nothing to patch in the prologue cache.
+        handles = reinterpret_cast<uint64_t *>(reinterpret_cast<byte *>(handles) + sizeof(uint64_t) + _prologueCache.size() * sizeof(DETOUR_PROLOGUE_CACHE_ENTRY));
+    }
+
+    if (isSharedPayload)
+    {
+        // The child only gets to read the section, whose handle it passes on to its own children.
+        HANDLE targetSection;
+        if (!DuplicateHandle(GetCurrentProcess(), _payloadSection.get(), processHandle, &targetSection, FILE_MAP_READ, FALSE, 0))
+        {
+            DWORD err = GetLastError();
+            Dbg(L"DetouredProcessInjector::LocalInjectProcess - Failed to duplicate the shared payload section: 0x%08x", (int)err);
+            return err;
+        }
+
+        SharedPayloadReference *reference = reinterpret_cast<SharedPayloadReference *>(handles);
+        reference->SectionHandle = HandleToUint64(targetSection);
+    }
+
+    DETOUR_PAYLOAD_PART parts[2] =
+    {
+        { prefix.get(), prefixSize },
+        { Payload(), isSharedPayload ? 0 : _payloadSize },
+    };
+
+    if (!DetourCopyPayloadPartsToProcess(processHandle, _payloadGuid, parts, 2))
     {
         DWORD err = GetLastError();
         Dbg(L"DetouredProcessInjector::LocalInjectProcess - Failed to copy payload to process: 0x%08x", (int)err);
@@ -369,7 +800,12 @@ DWORD DetouredProcessInjector::RemoteInjectProcess(HANDLE processHandle, bool in
         Dbg(L"DetouredProcessInjector::RemoteInjectProcess - Failed waiting for request for process injection for process id %d: 0x%08x", (int)processId, (int)result);
     }
     else {
-        return ERROR_SUCCESS;
+        result = ERROR_SUCCESS;
+    }
+
+    if (IsDetoursEventEnabled(DetoursEvent_ProcessInjected))
+    {
+        WriteProcessInjectedEvent(processId, true, result, 0, 0, 0, 0, (endWait - startWait) * 1000);
     }
 
     return result;
@@ -386,6 +822,17 @@ DetouredProcessInjector *WINAPI DetouredProcessInjector_Create(const GUID &paylo
     return injector;
 }
 
+void WINAPI DetouredProcessInjector_SetReportChannels(DetouredProcessInjector *injector, uint32_t channelCount, const HANDLE *channels)
+{
+    if (injector == nullptr || !injector->IsValid())
+    {
+        Dbg(L"DetouredProcessInjector_SetReportChannels: injector is not valid");
+        return;
+    }
+
+    injector->SetReportChannels(channelCount, channels);
+}
+
 void WINAPI DetouredProcessInjector_Destroy(DetouredProcessInjector *injector)
 {
     if (injector != nullptr && injector->IsValid())
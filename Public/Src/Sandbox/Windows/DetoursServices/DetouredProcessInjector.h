@@ -34,18 +34,81 @@ private:
 
     static const uint32_t c_buildxlInjectorTag = 0xD031B09E;      // DOMIno BONE
 
+    // Set in the handle count of a payload wrapper when the wrapper carries a SharedPayloadReference
+    // to a section holding the payload rather than the payload itself.
+    static const uint32_t c_sharedPayloadFlag = 0x80000000;
+
+    // Set in the handle count of a payload wrapper when the handles are followed by the handle of the section holding the
+    // report deduplication table shared by the process tree.
+    static const uint32_t c_sharedReportCacheFlag = 0x40000000;
+
+    // Set in the handle count of a payload wrapper when the report cache section (if any) is followed by the prologue cache:
+    // its entry count (padded to 64 bits) and its entries.
+    static const uint32_t c_prologueCacheFlag = 0x20000000;
+
+    // Set in the handle count of a payload wrapper when the other handles are the report channels of the pip (see SetReportChannels).
+    static const uint32_t c_reportChannelsFlag = 0x10000000;
+
+    // Payloads at least this large are put in a section shared by the whole process tree instead of being copied into each child.
+    static const uint32_t c_sharedPayloadMinSize = 64 * 1024;
+
+    static const uint32_t c_sharedPayloadTag = 0x5AFEFA11;
+
+    // Header of a shared payload section; the payload follows it.
+    struct SharedPayloadHeader
+    {
+        uint32_t Tag;
+        uint32_t PayloadSize;
+        uint64_t Checksum;
+    };
+
+    // What a payload wrapper carries after the handles in place of a shared payload.
+    struct SharedPayloadReference
+    {
+        uint64_t SectionHandle;
+        uint32_t PayloadSize;
+        uint32_t Reserved;
+        uint64_t Checksum;
+    };
+
     // We own these handles
     unique_handle<INVALID_HANDLE_VALUE> _mapDirectory;
     unique_handle<INVALID_HANDLE_VALUE> _remoteInjectorPipe;
     unique_handle<INVALID_HANDLE_VALUE> _reportPipe;
     unique_ptr<byte[]> _payload = nullptr;
     uint32_t _payloadSize = 0;
+    // Read-only section holding the payload, shared with every process injected from this one (and their children).
+    unique_handle<nullptr> _payloadSection;
+    // View of _payloadSection, if the payload was received through it rather than copied (in which case _payload is null).
+    const byte *_sharedPayloadView = nullptr;
+    uint64_t _payloadChecksum = 0;
+    // Read-write section holding the report deduplication table of the process tree, see ReportCache.h.
+    unique_handle<nullptr> _reportCacheSection;
+    // Prologues of the functions detoured in this process (or received from the parent), see DetourSetPrologueCache.
+    vector<DETOUR_PROLOGUE_CACHE_ENTRY> _prologueCache;
+    // Whether the children get the device map of this process by inheriting it, rather than having _mapDirectory applied.
+    bool _deviceMapInherited = false;
     vector<HANDLE> _otherHandles;
+    // Whether _otherHandles are the report channels of the pip, one of which each injected process gets as its report pipe.
+    bool _reportChannels = false;
+    // Whether the report channels are duplicates this injector closes (rather than handles inherited from the parent).
+    bool _ownsReportChannels = false;
+    // Incremented by each injection to pick the report channel of the child; the channels are handed out round-robin.
+    volatile LONG _nextReportChannel = 0;
     string _dllX86;
     string _dllX64;
     GUID _payloadGuid;
     bool _initialized = false;
+    // The part of the payload wrapper in front of the payload (sizes, handles, report cache section and shared payload
+    // reference), holding the handles of this process. Each injection patches a copy with the handles of the child,
+    // and writes the payload itself straight from Payload().
+    vector<byte> _wrapperPrefix;
+    // Set once _wrapperPrefix is built (and the shared payload section created, if needed), after which neither
+    // _wrapperPrefix, _payloadSection nor _payloadChecksum change.
+    volatile LONG _wrapperTemplateReady = 0;
 
+    // Only taken to change the state of the injector. Injections read state that is immutable once the injector is
+    // initialized, so that the children of a process get injected in parallel.
     CRITICAL_SECTION _injectorLock;
 
     class LockGuard
@@ -115,7 +178,7 @@ private:
 #pragma warning( disable: 4100 )
     inline bool NeedRemoteInjection(HANDLE processHandle)
     {
-        return s_isWow64Process && (_mapDirectory.isValid() || !isWow64Process(processHandle));
+        return s_isWow64Process && ((_mapDirectory.isValid() && !_deviceMapInherited) || !isWow64Process(processHandle));
         //// return s_isWow64Process && !isWow64Process(processHandle);
     }
 #pragma warning( pop )
@@ -123,14 +186,40 @@ private:
     // Given all data, compute the size of the wrapped payload
     uint32_t inline WrapperSize() const
     {
-        // The data must contain the size, handle count, the handles, and the payload
-        return static_cast<uint32_t>(2 * sizeof(uint32_t) + (c_minHandleCount + _otherHandles.size()) * sizeof(uint64_t) + _payloadSize);
+        // The data must contain the size, handle count, the handles, the report cache section if any, the prologue cache if any,
+        // and the payload (or the reference to its section)
+        size_t payloadSize = _payloadSection.isValid() ? sizeof(SharedPayloadReference) : _payloadSize;
+        size_t reportCacheSize = _reportCacheSection.isValid() ? sizeof(uint64_t) : 0;
+        size_t prologueCacheSize = _prologueCache.empty() ? 0 : sizeof(uint64_t) + _prologueCache.size() * sizeof(DETOUR_PROLOGUE_CACHE_ENTRY);
+        return static_cast<uint32_t>(2 * sizeof(uint32_t) + (c_minHandleCount + _otherHandles.size()) * sizeof(uint64_t) + reportCacheSize + prologueCacheSize + payloadSize);
     }
 
+    // Create the shared payload section if the payload is large enough and there is none yet, then build
+    // _wrapperPrefix. Thread-safe.
+    void EnsureWrapperTemplate();
+
+    // Create the shared payload section if the payload is large enough. Must be called under _injectorLock.
+    void CreateSharedPayloadSection();
+
+    // Map the section a payload wrapper refers to. Returns false if it does not hold the expected payload.
+    bool MapSharedPayload(const SharedPayloadReference &reference, std::wstring& errorMessage);
+
+    // FNV-1a over the payload
+    static uint64_t ComputePayloadChecksum(const byte *payload, uint32_t payloadSize);
+
 
     // Clear the object (free memory, etc.)
     void Clear();
 
+    // Close the report channels if this injector duplicated them, and forget them.
+    void CloseReportChannels();
+
+    // The report channel of the next injected process, or the report pipe if there are no report channels.
+    HANDLE NextReportChannel();
+
+    // The steps of LocalInjectProcess, adding the time spent updating the imports of the process to 'timings'.
+    DWORD LocalInjectProcessSteps(HANDLE processHandle, bool inheritedHandles, DETOUR_UPDATE_TIMINGS& timings);
+
 public:
     // Check if the process is wow64
     static bool isWow64Process(HANDLE processHandle);
@@ -142,6 +231,12 @@ public:
 
     ~DetouredProcessInjector()
     {
+        if (_sharedPayloadView != nullptr)
+        {
+            UnmapViewOfFile(_sharedPayloadView - sizeof(SharedPayloadHeader));
+        }
+
+        CloseReportChannels();
         DeleteCriticalSection(&_injectorLock);
     }
 
@@ -159,8 +254,27 @@ public:
     }
 
     // Set "other" handles. These are duplicated if needed.
+    // Like the dlls, they must be set before the first process is injected, as injections do not take _injectorLock.
     void SetHandles(uint32_t otherHandleCount, PHANDLE otherHandles);
 
+    // Pass the section of the shared report deduplication table on to every process injected from now on.
+    // The injector takes ownership of the handle. Must be called before the first process is injected.
+    void SetReportCacheSection(HANDLE section);
+
+    // Pass the prologues of the functions detoured in this process on to every process injected from now on, for their
+    // attach to skip disassembling the same functions. Must be called before the first process is injected.
+    void SetPrologueCache(const DETOUR_PROLOGUE_CACHE_ENTRY *entries, uint32_t entryCount);
+
+    // Give each process injected from now on one of the given pipes as its report pipe, round-robin, instead of the report pipe of
+    // this process; each of them passes all the channels on to its own children. The pipes are read concurrently by the consumer,
+    // so that the processes of a pip do not all serialize on the same pipe. The handles are duplicated (as inheritable), and
+    // replace the other handles. Must be called before the first process is injected.
+    void SetReportChannels(uint32_t channelCount, const HANDLE *channels);
+
+    // Let the processes injected from now on inherit the device map of this process (the one of the pip, which its parent
+    // applied) instead of applying _mapDirectory to each of them. Must be called before the first process is injected.
+    void SetDeviceMapInherited(bool inherited);
+
     inline bool IsValid() const
     {
 #ifdef _DEBUG
@@ -173,13 +287,24 @@ public:
     HANDLE MapDirectory() const { return _mapDirectory.get(); }
     HANDLE RemoteInjectorPipe() const { return _remoteInjectorPipe.get(); }
     HANDLE ReportPipe() const { return _reportPipe.get(); }
-    LPCBYTE Payload() const { return _payload.get(); }
+    LPCBYTE Payload() const { return _sharedPayloadView != nullptr ? _sharedPayloadView : _payload.get(); }
+    // Indicates if the payload is a read-only view shared with the rest of the process tree, which need not be copied again.
+    bool IsPayloadShared() const { return _sharedPayloadView != nullptr; }
     uint32_t PayloadSize() const { return _payloadSize; }
+    // The section of the shared report deduplication table received from the parent or set with SetReportCacheSection, or null.
+    HANDLE ReportCacheSection() const { return _reportCacheSection.get(); }
+    // The prologue cache received from the parent or set with SetPrologueCache.
+    const DETOUR_PROLOGUE_CACHE_ENTRY *PrologueCache() const { return _prologueCache.data(); }
+    uint32_t PrologueCacheSize() const { return static_cast<uint32_t>(_prologueCache.size()); }
+    bool IsDeviceMapInherited() const { return _deviceMapInherited; }
+    // Indicates if the other handles are the report channels of the pip.
+    bool HasReportChannels() const { return _reportChannels; }
     uint32_t OtherHandleCount() const { return static_cast<uint32_t>(_otherHandles.size()); }
     const HANDLE *OtherHandles() const { return _otherHandles.data(); }
     bool IsInitialized() { return _initialized; }
 
     // This method will inject the data stored in the object into the specified process.
+    // Several processes can be injected concurrently.
     //   processHandle - the process to inject
     //   inheritedHandles - when true, all handles are inherited.
     //                      When false, none or only some handles
@@ -37,6 +37,9 @@ public:
     // NOTE: This function is not static to ensure we always declare a scope.
     inline bool Detoured_IsDisabled() { return gt_DetouredCount != 1; }
 
+    // Indicates if the calling thread is inside any scope, i.e., whether a detoured function is being called by the detours.
+    static inline bool IsActive() { return gt_DetouredCount != 0; }
+
 private:
     // make copy-safe by explicitly deleting copy constructors
     DetouredScope(const DetouredScope &) = delete;
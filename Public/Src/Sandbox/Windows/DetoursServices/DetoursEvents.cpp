@@ -0,0 +1,183 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DetoursEvents.h"
+
+// Levels of the events, as in the manifest.
+#define DETOURS_EVENTS_LEVEL_INFORMATIONAL  4
+#define DETOURS_EVENTS_LEVEL_VERBOSE        5
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+// {5C3B7E1A-92D4-4F0B-8E61-2A9D4C7F3B58}
+static const GUID DetoursEventsProvider =
+    { 0x5c3b7e1a, 0x92d4, 0x4f0b, { 0x8e, 0x61, 0x2a, 0x9d, 0x4c, 0x7f, 0x3b, 0x58 } };
+
+REGHANDLE g_detoursEventsHandle = 0;
+volatile UCHAR g_detoursEventsLevel = 0;
+volatile ULONGLONG g_detoursEventsKeywords = 0;
+
+//                                                              Id  Version Channel Level                               Opcode  Task    Keyword
+const EVENT_DESCRIPTOR DetoursEvent_PolicyDecision =            { 1, 0,     0,      DETOURS_EVENTS_LEVEL_VERBOSE,       0,      0,      DETOURS_EVENTS_KEYWORD_POLICY };
+const EVENT_DESCRIPTOR DetoursEvent_ReportQueued =              { 2, 0,     0,      DETOURS_EVENTS_LEVEL_VERBOSE,       0,      0,      DETOURS_EVENTS_KEYWORD_REPORTS };
+const EVENT_DESCRIPTOR DetoursEvent_ReportsWritten =            { 3, 0,     0,      DETOURS_EVENTS_LEVEL_INFORMATIONAL, 0,      0,      DETOURS_EVENTS_KEYWORD_REPORTS };
+const EVENT_DESCRIPTOR DetoursEvent_HandleOverlayRegistered =   { 4, 0,     0,      DETOURS_EVENTS_LEVEL_VERBOSE,       0,      0,      DETOURS_EVENTS_KEYWORD_HANDLE_OVERLAY };
+const EVENT_DESCRIPTOR DetoursEvent_HandleOverlayClosed =       { 5, 0,     0,      DETOURS_EVENTS_LEVEL_VERBOSE,       0,      0,      DETOURS_EVENTS_KEYWORD_HANDLE_OVERLAY };
+const EVENT_DESCRIPTOR DetoursEvent_ProcessInjected =           { 6, 0,     0,      DETOURS_EVENTS_LEVEL_INFORMATIONAL, 0,      0,      DETOURS_EVENTS_KEYWORD_INJECTION };
+
+// ----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+// ----------------------------------------------------------------------------
+
+static void NTAPI DetoursEventsEnableCallback(
+    LPCGUID sourceId,
+    ULONG isEnabled,
+    UCHAR level,
+    ULONGLONG matchAnyKeyword,
+    ULONGLONG matchAllKeyword,
+    PEVENT_FILTER_DESCRIPTOR filterData,
+    PVOID callbackContext)
+{
+    UNREFERENCED_PARAMETER(sourceId);
+    UNREFERENCED_PARAMETER(matchAllKeyword);
+    UNREFERENCED_PARAMETER(filterData);
+    UNREFERENCED_PARAMETER(callbackContext);
+
+    if (isEnabled == EVENT_CONTROL_CODE_ENABLE_PROVIDER)
+    {
+        // Several sessions can listen: the cached state lets through what any of them wants, EventEnabled does the rest.
+        UCHAR sessionLevel = level == 0 ? 0xFF : level;
+        if (sessionLevel > g_detoursEventsLevel)
+        {
+            g_detoursEventsLevel = sessionLevel;
+        }
+
+        g_detoursEventsKeywords |= matchAnyKeyword == 0 ? ~0ULL : matchAnyKeyword;
+    }
+    else if (isEnabled == EVENT_CONTROL_CODE_DISABLE_PROVIDER)
+    {
+        // What the remaining sessions want is not known here, so let EventEnabled decide as long as there are any.
+        bool anySession = g_detoursEventsHandle != 0 && EventProviderEnabled(g_detoursEventsHandle, 0, 0);
+        g_detoursEventsLevel = anySession ? 0xFF : 0;
+        g_detoursEventsKeywords = anySession ? ~0ULL : 0;
+    }
+}
+
+static inline void CreateStringData(EVENT_DATA_DESCRIPTOR& data, PCWSTR string)
+{
+    PCWSTR value = string != nullptr ? string : L"";
+    EventDataDescCreate(&data, value, (ULONG)((wcslen(value) + 1) * sizeof(wchar_t)));
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+void InitializeDetoursEvents()
+{
+    // Never unregistered: the provider goes away with the process, and threads may still be writing events until then.
+    if (EventRegister(&DetoursEventsProvider, DetoursEventsEnableCallback, nullptr, &g_detoursEventsHandle) != ERROR_SUCCESS)
+    {
+        g_detoursEventsHandle = 0;
+        g_detoursEventsLevel = 0;
+        g_detoursEventsKeywords = 0;
+    }
+}
+
+void WritePolicyDecisionEvent(
+    PCWSTR operation,
+    PCWSTR path,
+    DWORD requestedAccess,
+    FileAccessStatus status,
+    bool report,
+    DWORD error)
+{
+    DWORD statusValue = (DWORD)status;
+    BOOL reportValue = report ? TRUE : FALSE;
+
+    EVENT_DATA_DESCRIPTOR data[6];
+    CreateStringData(data[0], operation);
+    CreateStringData(data[1], path);
+    EventDataDescCreate(&data[2], &requestedAccess, sizeof(requestedAccess));
+    EventDataDescCreate(&data[3], &statusValue, sizeof(statusValue));
+    EventDataDescCreate(&data[4], &reportValue, sizeof(reportValue));
+    EventDataDescCreate(&data[5], &error, sizeof(error));
+
+    EventWrite(g_detoursEventsHandle, &DetoursEvent_PolicyDecision, ARRAYSIZE(data), data);
+}
+
+void WriteReportQueuedEvent(PCWSTR operation, PCWSTR path, LONG queuedReports)
+{
+    EVENT_DATA_DESCRIPTOR data[3];
+    CreateStringData(data[0], operation);
+    CreateStringData(data[1], path);
+    EventDataDescCreate(&data[2], &queuedReports, sizeof(queuedReports));
+
+    EventWrite(g_detoursEventsHandle, &DetoursEvent_ReportQueued, ARRAYSIZE(data), data);
+}
+
+void WriteReportsWrittenEvent(LONG messageCount, size_t size, bool toRing)
+{
+    ULONGLONG sizeValue = (ULONGLONG)size;
+    BOOL toRingValue = toRing ? TRUE : FALSE;
+
+    EVENT_DATA_DESCRIPTOR data[3];
+    EventDataDescCreate(&data[0], &messageCount, sizeof(messageCount));
+    EventDataDescCreate(&data[1], &sizeValue, sizeof(sizeValue));
+    EventDataDescCreate(&data[2], &toRingValue, sizeof(toRingValue));
+
+    EventWrite(g_detoursEventsHandle, &DetoursEvent_ReportsWritten, ARRAYSIZE(data), data);
+}
+
+void WriteHandleOverlayRegisteredEvent(HANDLE handle, DWORD type, PCWSTR path)
+{
+    ULONGLONG handleValue = (ULONGLONG)(ULONG_PTR)handle;
+
+    EVENT_DATA_DESCRIPTOR data[3];
+    EventDataDescCreate(&data[0], &handleValue, sizeof(handleValue));
+    EventDataDescCreate(&data[1], &type, sizeof(type));
+    CreateStringData(data[2], path);
+
+    EventWrite(g_detoursEventsHandle, &DetoursEvent_HandleOverlayRegistered, ARRAYSIZE(data), data);
+}
+
+void WriteHandleOverlayClosedEvent(HANDLE handle, bool found)
+{
+    ULONGLONG handleValue = (ULONGLONG)(ULONG_PTR)handle;
+    BOOL foundValue = found ? TRUE : FALSE;
+
+    EVENT_DATA_DESCRIPTOR data[2];
+    EventDataDescCreate(&data[0], &handleValue, sizeof(handleValue));
+    EventDataDescCreate(&data[1], &foundValue, sizeof(foundValue));
+
+    EventWrite(g_detoursEventsHandle, &DetoursEvent_HandleOverlayClosed, ARRAYSIZE(data), data);
+}
+
+void WriteProcessInjectedEvent(
+    DWORD processId,
+    bool remote,
+    DWORD error,
+    ULONGLONG findImageMicroseconds,
+    ULONGLONG allocateMicroseconds,
+    ULONGLONG writeImportsMicroseconds,
+    ULONGLONG checksumMicroseconds,
+    ULONGLONG totalMicroseconds)
+{
+    BOOL remoteValue = remote ? TRUE : FALSE;
+
+    EVENT_DATA_DESCRIPTOR data[8];
+    EventDataDescCreate(&data[0], &processId, sizeof(processId));
+    EventDataDescCreate(&data[1], &remoteValue, sizeof(remoteValue));
+    EventDataDescCreate(&data[2], &error, sizeof(error));
+    EventDataDescCreate(&data[3], &findImageMicroseconds, sizeof(findImageMicroseconds));
+    EventDataDescCreate(&data[4], &allocateMicroseconds, sizeof(allocateMicroseconds));
+    EventDataDescCreate(&data[5], &writeImportsMicroseconds, sizeof(writeImportsMicroseconds));
+    EventDataDescCreate(&data[6], &checksumMicroseconds, sizeof(checksumMicroseconds));
+    EventDataDescCreate(&data[7], &totalMicroseconds, sizeof(totalMicroseconds));
+
+    EventWrite(g_detoursEventsHandle, &DetoursEvent_ProcessInjected, ARRAYSIZE(data), data);
+}
@@ -0,0 +1,85 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// ETW events of the detoured processes, to profile builds (e.g. with WPA, next to a kernel trace) without rebuilding with
+// debug output. The provider is BuildXL-DetoursServices; DetoursServices.man describes its events (register it with
+// 'wevtutil im' for tools to decode the fields).
+//
+// The provider keeps the level and keywords of the sessions listening to it up to date from its enable callback, so an
+// event nobody listens to costs a load and a compare. Only then is EventEnabled asked, and the event data assembled.
+
+#pragma once
+
+#include <evntprov.h>
+
+#include "DataTypes.h"
+
+// Keywords, to pick the kinds of events to collect.
+#define DETOURS_EVENTS_KEYWORD_POLICY           0x1
+#define DETOURS_EVENTS_KEYWORD_REPORTS          0x2
+#define DETOURS_EVENTS_KEYWORD_HANDLE_OVERLAY   0x4
+#define DETOURS_EVENTS_KEYWORD_INJECTION        0x8
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+extern REGHANDLE g_detoursEventsHandle;
+
+// Maximum level and keywords of the listening sessions, both 0 when there is none.
+extern volatile UCHAR g_detoursEventsLevel;
+extern volatile ULONGLONG g_detoursEventsKeywords;
+
+extern const EVENT_DESCRIPTOR DetoursEvent_PolicyDecision;
+extern const EVENT_DESCRIPTOR DetoursEvent_ReportQueued;
+extern const EVENT_DESCRIPTOR DetoursEvent_ReportsWritten;
+extern const EVENT_DESCRIPTOR DetoursEvent_HandleOverlayRegistered;
+extern const EVENT_DESCRIPTOR DetoursEvent_HandleOverlayClosed;
+extern const EVENT_DESCRIPTOR DetoursEvent_ProcessInjected;
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Registers the provider. Events are dropped until it is called, or if it fails.
+void InitializeDetoursEvents();
+
+/// Indicates if a session listens to the event.
+inline bool IsDetoursEventEnabled(EVENT_DESCRIPTOR const& descriptor)
+{
+    return descriptor.Level <= g_detoursEventsLevel
+        && (descriptor.Keyword & g_detoursEventsKeywords) != 0
+        && EventEnabled(g_detoursEventsHandle, &descriptor);
+}
+
+/// An access check made by a detoured function, and whether it is to be reported.
+void WritePolicyDecisionEvent(
+    PCWSTR operation,
+    PCWSTR path,
+    DWORD requestedAccess,
+    FileAccessStatus status,
+    bool report,
+    DWORD error);
+
+/// A file access report put on the queue the writer thread sends from, with the number of reports queued now.
+void WriteReportQueuedEvent(PCWSTR operation, PCWSTR path, LONG queuedReports);
+
+/// Reports written to the report file or ring at once.
+void WriteReportsWrittenEvent(LONG messageCount, size_t size, bool toRing);
+
+/// A handle whose access BuildXL tracks, opened on 'path'.
+void WriteHandleOverlayRegisteredEvent(HANDLE handle, DWORD type, PCWSTR path);
+
+/// A tracked handle closed, and whether its overlay was found.
+void WriteHandleOverlayClosedEvent(HANDLE handle, bool found);
+
+/// A child process injected, with the time spent in each step. A remote injection only has the total time.
+void WriteProcessInjectedEvent(
+    DWORD processId,
+    bool remote,
+    DWORD error,
+    ULONGLONG findImageMicroseconds,
+    ULONGLONG allocateMicroseconds,
+    ULONGLONG writeImportsMicroseconds,
+    ULONGLONG checksumMicroseconds,
+    ULONGLONG totalMicroseconds);
@@ -4,8 +4,10 @@
 #include "stdafx.h"
 
 #include "DebuggingHelpers.h"
+#include "DetoursEvents.h"
 #include "DetoursHelpers.h"
 #include "DetoursServices.h"
+#include "FeatureCounters.h"
 #include "globals.h"
 #include "buildXL_mem.h"
 #include "SendReport.h"
@@ -13,7 +15,8 @@
 #include "DeviceMap.h"
 #include "CanonicalizedPath.h"
 #include "PolicyResult.h"
-#include <list>
+#include "TempRedirection.h"
+#include <vector>
 #include <string>
 #include <stdio.h>
 #include <stack>
@@ -21,156 +24,423 @@
 using std::unique_ptr;
 using std::basic_string;
 
+extern volatile LONG64 g_detoursAttachLocateManifestMicroseconds;
+extern volatile LONG64 g_detoursAttachParseManifestMicroseconds;
+
+// Appended to the message count semaphore name to form the name of the mapping holding g_messageCount.
+#define MESSAGE_COUNT_NAME_SUFFIX L"_MessageCount"
+
 // ----------------------------------------------------------------------------
 // FUNCTION DEFINITIONS
 // ----------------------------------------------------------------------------
 
+// ----------------------------------------------------------------------------
+// PATH TRANSLATION
+// ----------------------------------------------------------------------------
+
+// Node of the prefix trie over the (lower-cased) from paths of g_pManifestTranslatePathTuples.
+// Node 0 is the root, which is nobody's child, so 0 also stands for 'no node'.
+struct TranslatePathTrieNode
+{
+    wchar_t Char;
+    uint32_t FirstChild;
+    uint32_t NextSibling;
+    // Index of the first tuple whose from path ends at this node, or -1.
+    int32_t FirstTuple;
+};
+
+// Built once the manifest is parsed and immutable afterwards.
+static std::vector<TranslatePathTrieNode> g_translatePathTrie;
+
+// For each tuple, the index of the next tuple with the same from path, or -1.
+static std::vector<int32_t> g_translatePathTrieNextTuple;
+
+static uint32_t FindTranslatePathTrieChild(uint32_t node, wchar_t lowerCaseChar)
+{
+    for (uint32_t child = g_translatePathTrie[node].FirstChild; child != 0; child = g_translatePathTrie[child].NextSibling)
+    {
+        if (g_translatePathTrie[child].Char == lowerCaseChar)
+        {
+            return child;
+        }
+    }
+
+    return 0;
+}
+
+// The few tuples a translation done in a caller's buffer (see TryTranslateFilePathInBuffer) has used, indexable like the vector<bool> of TryTranslateFilePath.
+struct UsedTranslatePathTuples
+{
+    static const size_t Capacity = 8;
+
+    int32_t Tuples[Capacity];
+    size_t Count;
+
+    bool operator[](int32_t tuple) const
+    {
+        for (size_t i = 0; i < Count; i++)
+        {
+            if (Tuples[i] == tuple)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+template <typename TUsedTuples>
+static int32_t FirstUnusedTranslatePathTuple(uint32_t node, TUsedTuples const* usedTuples)
+{
+    int32_t tuple = g_translatePathTrie[node].FirstTuple;
+    while (tuple != -1 && usedTuples != nullptr && (*usedTuples)[tuple])
+    {
+        tuple = g_translatePathTrieNextTuple[tuple];
+    }
+
+    return tuple;
+}
+
 /// <summary>
-/// Gets the normalized (or subst'ed) path from a full path.
+/// Builds the prefix trie used by TranslateFilePath from g_pManifestTranslatePathTuples.
+/// </summary>
+static void BuildTranslatePathTrie()
+{
+    TranslatePathTrieNode root = { L'\0', 0, 0, -1 };
+    g_translatePathTrie.assign(1, root);
+    g_translatePathTrieNextTuple.assign(g_pManifestTranslatePathTuples->size(), -1);
+
+    for (size_t i = 0; i < g_pManifestTranslatePathTuples->size(); i++)
+    {
+        // From paths are lower-cased when the manifest is parsed.
+        const std::wstring& fromPath = (*g_pManifestTranslatePathTuples)[i]->GetFromPath();
+        uint32_t node = 0;
+
+        for (wchar_t c : fromPath)
+        {
+            uint32_t child = FindTranslatePathTrieChild(node, c);
+            if (child == 0)
+            {
+                child = (uint32_t)g_translatePathTrie.size();
+                TranslatePathTrieNode newNode = { c, 0, g_translatePathTrie[node].FirstChild, -1 };
+                g_translatePathTrie.push_back(newNode);
+                g_translatePathTrie[node].FirstChild = child;
+            }
+
+            node = child;
+        }
+
+        // Among tuples with the same from path, the first one in the manifest is used first.
+        int32_t* last = &g_translatePathTrie[node].FirstTuple;
+        while (*last != -1)
+        {
+            last = &g_translatePathTrieNextTuple[*last];
+        }
+
+        *last = (int32_t)i;
+    }
+}
+
+/// <summary>
+/// Finds the tuple, not used yet, with the longest from path that is a prefix of the given path.
 /// </summary>
 /// <remarks>
-/// The debug parameter is temporary to catch non-deterministic bug 1027027
+/// A path to a directory without trailing '\\' also matches a from path with it.
+/// The path is given as a head followed by a tail, so that a path being translated need not be put together to be searched for.
+/// Returns -1 if no tuple matches; otherwise, matchLength is the length of the prefix of the path to replace.
 /// </remarks>
-void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring& outFileName, _In_ bool debug)
+template <typename TUsedTuples>
+static int32_t FindLongestTranslatePathTuple(
+    PCWSTR head,
+    size_t headLength,
+    PCWSTR tail,
+    size_t tailLength,
+    TUsedTuples const* usedTuples,
+    size_t& matchLength)
 {
-    outFileName.assign(inFileName);
-
-    if (g_pManifestTranslatePathTuples->empty()) 
+    if (g_translatePathTrie.empty())
     {
-        // Nothing to translate.
-        return;
+        return -1;
     }
 
-    // If the string coming in is null or empty, just return. No need to do anything.
-    if (inFileName.empty() || inFileName.c_str() == nullptr)
+    int32_t longestTuple = -1;
+    uint32_t node = 0;
+    size_t pathLength = headLength + tailLength;
+
+    for (size_t i = 0; ; i++)
     {
-        return;
+        int32_t tuple = FirstUnusedTranslatePathTuple(node, usedTuples);
+        if (tuple != -1)
+        {
+            longestTuple = tuple;
+            matchLength = i;
+        }
+
+        if (i == pathLength)
+        {
+            break;
+        }
+
+        node = FindTranslatePathTrieChild(node, towlower(i < headLength ? head[i] : tail[i - headLength]));
+        if (node == 0)
+        {
+            return longestTuple;
+        }
     }
 
-    CanonicalizedPath canonicalizedPath = CanonicalizedPath::Canonicalize(inFileName.c_str());
-    std::wstring tempStr(canonicalizedPath.GetPathString());
-    
-    // If the canonicalized string is null or empty, just return. No need to do anything.
-    if (tempStr.empty() || tempStr.c_str() == nullptr)
+    wchar_t lastChar = tailLength > 0 ? tail[tailLength - 1] : (headLength > 0 ? head[headLength - 1] : L'\0');
+    if (pathLength > 0 && lastChar != L'\\')
     {
-        return;
+        uint32_t child = FindTranslatePathTrieChild(node, L'\\');
+        int32_t tuple = child != 0 ? FirstUnusedTranslatePathTuple(child, usedTuples) : -1;
+        if (tuple != -1)
+        {
+            longestTuple = tuple;
+            matchLength = pathLength;
+        }
     }
 
-    const std::wstring prefix(L"\\??\\");
-    bool hasPrefix = !tempStr.compare(0, prefix.size(), prefix);
+    return longestTuple;
+}
+
+static int32_t FindLongestTranslatePathTuple(PCWSTR path, size_t pathLength, std::vector<bool> const* usedTuples, size_t& matchLength)
+{
+    return FindLongestTranslatePathTuple(path, pathLength, L"", 0, usedTuples, matchLength);
+}
 
-    const std::wstring prefixNt(L"\\\\?\\");
-    bool hasPrefixNt = !tempStr.compare(0, prefixNt.size(), prefixNt);
+/// <summary>
+/// Gets the normalized (or subst'ed) path from an already canonicalized path.
+/// </summary>
+/// <remarks>
+/// Translations are applied repeatedly, each time using the longest matching from path, but each tuple at most once.
+/// Returns false, without touching outFileName, if no translation applies; this costs a single walk of the trie and no allocation.
+/// </remarks>
+bool TryTranslateFilePath(_In_ const CanonicalizedPath& path, _Inout_ std::wstring& outFileName, _In_ bool debug)
+{
+    if (path.IsNull() || g_pManifestTranslatePathTuples->empty())
+    {
+        return false;
+    }
 
-    tempStr.assign(canonicalizedPath.GetPathStringWithoutTypePrefix());
+    PCWSTR pathWithoutTypePrefix = path.GetPathStringWithoutTypePrefix();
+    size_t matchLength = 0;
+    int32_t tuple = FindLongestTranslatePathTuple(pathWithoutTypePrefix, wcslen(pathWithoutTypePrefix), nullptr, matchLength);
+    if (tuple == -1)
+    {
+        return false;
+    }
 
-    bool translated = false;
-    bool needsTranslation = true;
+    std::wstring tempStr(pathWithoutTypePrefix);
+    std::vector<bool> usedTuples(g_pManifestTranslatePathTuples->size(), false);
 
     if (debug)
     {
         Dbg(L"TranslateFilePath-0: initial: '%s'", tempStr.c_str());
     }
 
-    std::list<TranslatePathTuple*> manifestTranslatePathTuples(g_pManifestTranslatePathTuples->begin(), g_pManifestTranslatePathTuples->end());
-
-    while (needsTranslation)
+    do
     {
-        needsTranslation = false;
-        size_t longestPath = 0;
-        std::list<TranslatePathTuple*>::iterator replacementIt;
+        TranslatePathTuple* replacementTuple = (*g_pManifestTranslatePathTuples)[tuple];
+        usedTuples[tuple] = true;
 
-        std::wstring lowCaseFinalPath(tempStr);
-        for (basic_string<wchar_t>::iterator p = lowCaseFinalPath.begin();
-            p != lowCaseFinalPath.end(); ++p) {
-            *p = towlower(*p);
-        }
+        std::wstring t(replacementTuple->GetToPath());
+        t.append(tempStr, matchLength, std::wstring::npos);
 
-        // Find the longest path that can be used for translation from the g_pManifestTranslatePathTuples list.
-        // Note: The g_pManifestTranslatePathTuples always comes canonicalized from the managed code.
-        for (std::list<TranslatePathTuple*>::iterator it = manifestTranslatePathTuples.begin(); it != manifestTranslatePathTuples.end(); ++it)
+        if (debug)
         {
-            TranslatePathTuple* tpTuple = *it;
-            const std::wstring& lowCaseTargetPath = tpTuple->GetFromPath();
-            size_t targetLen = lowCaseTargetPath.length();
-            bool mayBeDirectoryPath = false;
-
-            int comp = lowCaseFinalPath.compare(0, targetLen, lowCaseTargetPath);
-            
-            if (comp != 0)
-            {
-                // The path to be translated can be a directory path that does not have trailing '\\'.
-                
-                if (lowCaseFinalPath.back() != L'\\' 
-                    && lowCaseTargetPath.back() == L'\\' 
-                    && lowCaseFinalPath.length() == (targetLen - 1)) 
-                {
-                    std::wstring lowCaseFinalPathWithBs = lowCaseFinalPath + L'\\';
-                    comp = lowCaseFinalPathWithBs.compare(0, targetLen, lowCaseTargetPath);
-                    mayBeDirectoryPath = true;
-                }
-            }
-
-            if (comp == 0)
-            {
-                if (longestPath < targetLen)
-                {
-                    replacementIt = it;
-                    longestPath = !mayBeDirectoryPath ? targetLen : targetLen - 1;
-                    translated = true;
-                    needsTranslation = true;
-                }
-            }
+            Dbg(
+                L"TranslateFilePath-1: from: '%s', to '%s' (used mapping: '%s' --> '%s')",
+                tempStr.c_str(),
+                t.c_str(),
+                replacementTuple->GetFromPath().c_str(),
+                replacementTuple->GetToPath().c_str());
         }
 
-        // Translate using the longest translation path.
-        if (needsTranslation)
-        {
-            TranslatePathTuple* replacementTuple = *replacementIt;
+        tempStr.swap(t);
+        tuple = FindLongestTranslatePathTuple(tempStr.c_str(), tempStr.length(), &usedTuples, matchLength);
+    } while (tuple != -1);
 
-            std::wstring t(replacementTuple->GetToPath());
-            t.append(tempStr, longestPath);
+    // Keep the \\?\ or \??\ prefix of the original path.
+    outFileName.assign(path.GetPathString(), pathWithoutTypePrefix - path.GetPathString());
+    outFileName.append(tempStr);
 
-            if (debug)
-            {
-                Dbg(
-                    L"TranslateFilePath-1: from: '%s', to '%s' (used mapping: '%s' --> '%s')",
-                    tempStr.c_str(),
-                    t.c_str(),
-                    replacementTuple->GetFromPath().c_str(),
-                    replacementTuple->GetToPath().c_str());
-            }
+    if (debug)
+    {
+        Dbg(L"TranslateFilePath-2: final: '%s' --> '%s'", path.GetPathString(), outFileName.c_str());
+    }
 
-            tempStr.assign(t);
-            manifestTranslatePathTuples.erase(replacementIt);
-        }
+    IncrementFeatureCounter(FeatureCounter::PathsTranslated);
+    return true;
+}
+
+/// <summary>
+/// Translates a path that a path-returning API (such as GetFinalPathNameByHandleW) wrote into a caller's buffer, in the buffer.
+/// </summary>
+/// <remarks>
+/// Same translation as TranslateFilePath, for a path with the \\?\ prefix, which canonicalization leaves as it is. The translations
+/// are found walking the trie over the to path of the last tuple used followed by the rest of the original path, and the result is
+/// then written over the original path, so that no temporary string is built.
+/// Returns false, without touching the buffer, for a path that has to be translated by TranslateFilePath instead: one without the prefix,
+/// or one for which a translation would replace only part of the to path of the previous one. Otherwise translatedLength is the length
+/// of the translated path, which is in the buffer if it fits along with its terminating null.
+/// </remarks>
+bool TryTranslateFilePathInBuffer(_Inout_updates_(bufferLength) PWSTR buffer, _In_ size_t pathLength, _In_ size_t bufferLength, _Out_ size_t& translatedLength)
+{
+    translatedLength = pathLength;
+    if (g_pManifestTranslatePathTuples->empty())
+    {
+        return true;
     }
 
-    if (translated)
+    if (pathLength < 4 || !IsWin32NtPathName(buffer))
+    {
+        return false;
+    }
+
+    const size_t prefixLength = 4;
+    PCWSTR original = buffer + prefixLength;
+    size_t originalLength = pathLength - prefixLength;
+
+    // The path being translated is head followed by original from offset on.
+    PCWSTR head = L"";
+    size_t headLength = 0;
+    size_t offset = 0;
+    UsedTranslatePathTuples usedTuples;
+    usedTuples.Count = 0;
+
+    size_t matchLength = 0;
+    int32_t tuple;
+    while ((tuple = FindLongestTranslatePathTuple(head, headLength, original + offset, originalLength - offset, &usedTuples, matchLength)) != -1)
     {
-        if (hasPrefix)
+        if (matchLength < headLength || usedTuples.Count == UsedTranslatePathTuples::Capacity)
         {
-            outFileName.assign(prefix);
+            return false;
         }
-        else
-        {
-            if (hasPrefixNt)
-            {
-                outFileName.assign(prefixNt);
+
+        const std::wstring& toPath = (*g_pManifestTranslatePathTuples)[tuple]->GetToPath();
+        offset += matchLength - headLength;
+        head = toPath.c_str();
+        headLength = toPath.length();
+        usedTuples.Tuples[usedTuples.Count++] = tuple;
+    }
+
+    if (usedTuples.Count == 0)
+    {
+        return true;
+    }
+
+    size_t restLength = originalLength - offset;
+    translatedLength = prefixLength + headLength + restLength;
+    if (translatedLength < bufferLength)
+    {
+        // The rest of the path (with its terminating null) moves to behind the new head.
+        wmemmove(buffer + prefixLength + headLength, original + offset, restLength + 1);
+        wmemcpy(buffer + prefixLength, head, headLength);
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Gets the normalized (or subst'ed) path from a full path.
+/// </summary>
+/// <remarks>
+/// The debug parameter is temporary to catch non-deterministic bug 1027027
+/// </remarks>
+void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring& outFileName, _In_ bool debug)
+{
+    if (g_pManifestTranslatePathTuples->empty()) 
+    {
+        // Nothing to translate.
+        outFileName.assign(inFileName);
+        return;
+    }
+
+    // If the string coming in is null or empty, just return. No need to do anything.
+    if (inFileName.empty() || inFileName.c_str() == nullptr)
+    {
+        outFileName.assign(inFileName);
+        return;
+    }
+
+    if (!TryTranslateFilePath(CanonicalizedPath::Canonicalize(inFileName.c_str()), outFileName, debug))
+    {
+        outFileName.assign(inFileName);
+    }
+}
+
+// Special-case rules matched on the paths of accesses. Which ones apply depends only on the process kind and the manifest,
+// so InitProcessKind computes them once into g_specialCaseRules rather than each access going through the process kind.
+enum SpecialCaseRule : DWORD {
+    // Some tools (csc, cvtres, resonexe) emit *.tmp files into the same directory as the final output file.
+    SpecialCaseRule_TempFile = 0x1,
+    // The native resource compiler (RC) emits \RC?xxxxxx temporary files, with ? one of C, D or F, next to its output.
+    SpecialCaseRule_RCTempFile = 0x2,
+    // The Mt tool emits <pre><uuuu>.TMP temporary files next to its output, where <pre> is RCX.
+    // See https://docs.microsoft.com/en-us/windows/desktop/api/fileapi/nf-fileapi-gettempfilenamew
+    SpecialCaseRule_MtTempFile = 0x4,
+    // The cc-line of tools like to find pdb files by using the pdb path embedded in a dll/exe.
+    // If the dll/exe was built with different roots, then this results in somewhat random file accesses.
+    SpecialCaseRule_PdbFile = 0x8,
+    // Test runs with code coverage enabled load more *.pdb, *.nls and *.dll files.
+    SpecialCaseRule_CodeCoverageFile = 0x10,
+    // build.exe and tracelog.dll capture dependency information in temporary files in the object root called
+    // _buildc_dep_out.pass<NUMBER>. Applies to every process.
+    SpecialCaseRule_BuildExeTraceLog = 0x20,
+};
+
+// The rules of GetSpecialCaseRulesForSpecialTools for this process, see InitProcessKind.
+static DWORD g_specialCaseRules = SpecialCaseRule_BuildExeTraceLog;
+
+// Returns the subset of the given rules that the path matches.
+// The extension rules are decided together from one look at the final four characters.
+static DWORD MatchSpecialCaseRules(PCWSTR path, size_t pathLength, DWORD rules)
+{
+    DWORD matched = 0;
+
+    DWORD const extensionRules = SpecialCaseRule_TempFile | SpecialCaseRule_MtTempFile | SpecialCaseRule_PdbFile | SpecialCaseRule_CodeCoverageFile;
+    if ((rules & extensionRules) != 0 && pathLength >= 4 && path[pathLength - 4] == L'.') {
+        PathChar e1 = NormalizePathChar(path[pathLength - 3]);
+        PathChar e2 = NormalizePathChar(path[pathLength - 2]);
+        PathChar e3 = NormalizePathChar(path[pathLength - 1]);
+
+        if (e1 == L'T' && e2 == L'M' && e3 == L'P') {
+            matched |= rules & (SpecialCaseRule_TempFile | SpecialCaseRule_MtTempFile);
+        }
+        else if (e1 == L'P' && e2 == L'D' && e3 == L'B') {
+            matched |= rules & (SpecialCaseRule_PdbFile | SpecialCaseRule_CodeCoverageFile);
+        }
+        else if ((e1 == L'N' && e2 == L'L' && e3 == L'S') || (e1 == L'D' && e2 == L'L' && e3 == L'L')) {
+            matched |= rules & SpecialCaseRule_CodeCoverageFile;
+        }
+
+        if ((matched & SpecialCaseRule_MtTempFile) != 0) {
+            // The final component has to start with RCX.
+            size_t separator = pathLength - 4;
+            while (separator > 0 && path[separator] != L'\\') {
+                separator--;
             }
-            else
-            {
-                outFileName.assign(L"");
+
+            if (path[separator] != L'\\'
+                || separator + 3 >= pathLength
+                || NormalizePathChar(path[separator + 1]) != L'R'
+                || NormalizePathChar(path[separator + 2]) != L'C'
+                || NormalizePathChar(path[separator + 3]) != L'X') {
+                matched &= ~(DWORD)SpecialCaseRule_MtTempFile;
             }
         }
+    }
 
-        outFileName.append(tempStr);
+    if ((rules & SpecialCaseRule_RCTempFile) != 0 && StringLooksLikeRCTempFile(path, pathLength)) {
+        matched |= SpecialCaseRule_RCTempFile;
+    }
 
-        if (debug)
-        {
-            Dbg(L"TranslateFilePath-2: final: '%s' --> '%s'", inFileName.c_str(), outFileName.c_str());
-        }
+    if ((rules & SpecialCaseRule_BuildExeTraceLog) != 0 && StringLooksLikeBuildExeTraceLog(path, pathLength)) {
+        matched |= SpecialCaseRule_BuildExeTraceLog;
     }
+
+    return matched;
 }
 
 // Some perform file accesses, which don't yet fall into any configurable file access manifest category.
@@ -188,89 +458,18 @@ bool GetSpecialCaseRulesForSpecialTools(
     assert(absolutePath);
     assert(absolutePathLength == wcslen(absolutePath));
 
-    switch (GetProcessKind())
-    {
-    case SpecialProcessKind::Csc:
-    case SpecialProcessKind::Cvtres:
-    case SpecialProcessKind::Resonexe:
-        // Some tools emit temporary files into the same directory
-        // as the final output file.
-        if (HasSuffix(absolutePath, absolutePathLength, L".tmp")) {
-#if SUPER_VERBOSE
-            Dbg(L"special case: temp file: %s", absolutePath);
-#endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
-        break;
-
-    case SpecialProcessKind::RC:
-        // The native resource compiler (RC) emits temporary files into the same
-        // directory as the final output file.
-        if (StringLooksLikeRCTempFile(absolutePath, absolutePathLength)) {
-#if SUPER_VERBOSE
-            Dbg(L"special case: temp file: %s", absolutePath);
-#endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
-        break;
-
-    case SpecialProcessKind::Mt:
-        // The Mt tool emits temporary files into the same directory as the final output file.
-        if (StringLooksLikeMtTempFile(absolutePath, absolutePathLength, L".tmp")) {
-#if SUPER_VERBOSE
-            Dbg(L"special case: temp file: %s", absolutePath);
-#endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
-        break;
-
-    case SpecialProcessKind::CCCheck:
-    case SpecialProcessKind::CCDocGen:
-    case SpecialProcessKind::CCRefGen:
-    case SpecialProcessKind::CCRewrite:
-        // The cc-line of tools like to find pdb files by using the pdb path embedded in a dll/exe. 
-        // If the dll/exe was built with different roots, then this results in somewhat random file accesses.
-        if (HasSuffix(absolutePath, absolutePathLength, L".pdb")) {
+    if (MatchSpecialCaseRules(absolutePath, absolutePathLength, g_specialCaseRules) != 0) {
 #if SUPER_VERBOSE
-            Dbg(L"special case: pdb file: %s", absolutePath);
+        Dbg(L"special case: tool file: %s", absolutePath);
 #endif // SUPER_VERBOSE
-            int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
-            policy = (FileAccessPolicy)intPolicy;
-            return true;
-        }
-        break;
-
-    case SpecialProcessKind::WinDbg:
-    case SpecialProcessKind::NotSpecial:
-        // no special treatment
-        break;
-    }
-
-    // build.exe and tracelog.dll capture dependency information in temporary files in the object root called _buildc_dep_out.<pass#>
-    if (StringLooksLikeBuildExeTraceLog(absolutePath, absolutePathLength)) {
         int intPolicy = (int)policy | (int)FileAccessPolicy_AllowAll;
         policy = (FileAccessPolicy)intPolicy;
-#if SUPER_VERBOSE
-        Dbg(L"Build.exe trace log path: %s", absolutePath);
-#endif // SUPER_VERBOSE
         return true;
     }
 
     return false;
 }
 
-// This functions allows file accesses for special undeclared files.
-// In the special set set we include:
-//     1. Code coverage runs
-//     2. Te drive devices
-//     3. Dos devices and special system devices/names (pipes, null dev etc).
-// These accesses now should be white listed, but many users have deployed products that have specs not declaring such accesses.
 bool GetSpecialCaseRulesForCoverageAndSpecialDevices(
     __in  PCWSTR absolutePath,
     __in  size_t absolutePathLength,
@@ -282,9 +481,7 @@ bool GetSpecialCaseRulesForCoverageAndSpecialDevices(
 
     // When running test cases with Code Coverage enabled, some more files are loaded that we should ignore
     if (IgnoreCodeCoverage()) {
-        if (HasSuffix(absolutePath, absolutePathLength, L".pdb") ||
-            HasSuffix(absolutePath, absolutePathLength, L".nls") ||
-            HasSuffix(absolutePath, absolutePathLength, L".dll"))
+        if (MatchSpecialCaseRules(absolutePath, absolutePathLength, SpecialCaseRule_CodeCoverageFile) != 0)
         {
 #if SUPER_VERBOSE
             Dbg(L"Ignoring possibly code coverage related path: %s", absolutePath);
@@ -512,6 +709,80 @@ void WriteToInternalErrorsFile(PCWSTR format, ...)
     }
 }
 
+/// Reads the directory translations of the manifest into g_pManifestTranslatePathTuples and builds their trie.
+/// Returns the offset of the next block.
+static size_t ParseTranslatePathsBlock(const byte* payloadBytes, size_t offset)
+{
+    g_manifestTranslatePathsStrings = reinterpret_cast<const PManifestTranslatePathsStrings>(&payloadBytes[offset]);
+    g_manifestTranslatePathsStrings->AssertValid();
+
+#ifdef _DEBUG
+    offset += sizeof(uint32_t);
+#endif
+
+    uint32_t manifestTranslatePathsSize = *(uint32_t*)(&payloadBytes[offset]);
+    offset += sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < manifestTranslatePathsSize; i++)
+    {
+        uint32_t manifestTranslatePathsFromSize = *(uint32_t*)(&payloadBytes[offset]);
+        offset += sizeof(uint32_t);
+        std::wstring translateFrom;
+        translateFrom.assign(L"");
+        if (manifestTranslatePathsFromSize > 0)
+        {
+            translateFrom.append((wchar_t*)(&payloadBytes[offset]), manifestTranslatePathsFromSize);
+
+            for (basic_string<wchar_t>::iterator p = translateFrom.begin();
+                p != translateFrom.end(); ++p) 
+            {
+                *p = towlower(*p);
+            }
+
+            offset += sizeof(WCHAR) * manifestTranslatePathsFromSize;
+        }
+
+        uint32_t manifestTranslatePathsToSize = *(uint32_t*)(&payloadBytes[offset]);
+        offset += sizeof(uint32_t);
+        std::wstring translateTo;
+        translateTo.assign(L"");
+        if (manifestTranslatePathsToSize > 0)
+        {
+            translateTo.append((wchar_t*)(&payloadBytes[offset]), manifestTranslatePathsToSize);
+            offset += sizeof(WCHAR) * manifestTranslatePathsToSize;
+        }
+
+        if (!translateFrom.empty() && !translateTo.empty())
+        {
+            g_pManifestTranslatePathTuples->push_back(new TranslatePathTuple(translateFrom, translateTo));
+        }
+    }
+
+    BuildTranslatePathTrie();
+
+    return offset;
+}
+
+/// Translates the directory the temp directory is redirected to back to the temp directory (see TempRedirection.h), after the
+/// translations of the manifest.
+static void AddTempRedirectionTranslation()
+{
+    std::wstring translateFrom(GetRedirectedTempDirectoryTarget());
+    for (basic_string<wchar_t>::iterator p = translateFrom.begin(); p != translateFrom.end(); ++p)
+    {
+        *p = towlower(*p);
+    }
+
+    // Like the translations of the manifest, both end with a separator (see DirectoryTranslator.cs).
+    translateFrom.push_back(L'\\');
+    std::wstring translateTo(GetRedirectedTempDirectorySource());
+    translateTo.push_back(L'\\');
+
+    g_pManifestTranslatePathTuples->push_back(new TranslatePathTuple(translateFrom, translateTo));
+
+    BuildTranslatePathTrie();
+}
+
 bool ParseFileAccessManifest(
     const void* payload,
     DWORD)
@@ -552,7 +823,12 @@ bool ParseFileAccessManifest(
     assert(payloadSize > 0);
     assert(payloadBytes != nullptr);
 
-    g_manifestPtr = VirtualAlloc(nullptr, payloadSize, MEM_COMMIT, PAGE_READWRITE);
+    // A payload shared with the rest of the process tree is already a read-only view, so there is nothing to copy or protect.
+    bool isPayloadShared = g_pDetouredProcessInjector->IsPayloadShared();
+
+    g_manifestPtr = isPayloadShared
+        ? const_cast<byte *>(payloadBytes)
+        : VirtualAlloc(nullptr, payloadSize, MEM_COMMIT, PAGE_READWRITE);
     g_manifestSizePtr = (PDWORD)VirtualAlloc(nullptr, sizeof(DWORD), MEM_COMMIT, PAGE_READWRITE);
     if (g_manifestPtr == nullptr || g_manifestSizePtr == nullptr)
     {
@@ -563,7 +839,7 @@ bool ParseFileAccessManifest(
         return false;
     }
 
-    if (memcpy_s(g_manifestPtr, payloadSize, payloadBytes, payloadSize))
+    if (!isPayloadShared && memcpy_s(g_manifestPtr, payloadSize, payloadBytes, payloadSize))
     {
         // Could't copy the payload.
         wprintf(L"Error copying payload to virtual memory.");
@@ -575,7 +851,7 @@ bool ParseFileAccessManifest(
     *g_manifestSizePtr = payloadSize;
 
     DWORD oldProtection = 0;
-    if (VirtualProtect(g_manifestPtr, payloadSize, PAGE_READONLY, &oldProtection) == 0)
+    if (!isPayloadShared && VirtualProtect(g_manifestPtr, payloadSize, PAGE_READONLY, &oldProtection) == 0)
     {
         // Error protecting the memory for the payload.
         wprintf(L"Error protecting payload in virtual memory.");
@@ -640,50 +916,7 @@ bool ParseFileAccessManifest(
 
     offset += injectionTimeoutFlag->GetSize();
 
-    g_manifestTranslatePathsStrings = reinterpret_cast<const PManifestTranslatePathsStrings>(&payloadBytes[offset]);
-    g_manifestTranslatePathsStrings->AssertValid();
-
-#ifdef _DEBUG
-    offset += sizeof(uint32_t);
-#endif
-
-    uint32_t manifestTranslatePathsSize = *(uint32_t*)(&payloadBytes[offset]);
-    offset += sizeof(uint32_t);
-
-    for (uint32_t i = 0; i < manifestTranslatePathsSize; i++)
-    {
-        uint32_t manifestTranslatePathsFromSize = *(uint32_t*)(&payloadBytes[offset]);
-        offset += sizeof(uint32_t);
-        std::wstring translateFrom;
-        translateFrom.assign(L"");
-        if (manifestTranslatePathsFromSize > 0)
-        {
-            translateFrom.append((wchar_t*)(&payloadBytes[offset]), manifestTranslatePathsFromSize);
-
-            for (basic_string<wchar_t>::iterator p = translateFrom.begin();
-                p != translateFrom.end(); ++p) 
-            {
-                *p = towlower(*p);
-            }
-
-            offset += sizeof(WCHAR) * manifestTranslatePathsFromSize;
-        }
-
-        uint32_t manifestTranslatePathsToSize = *(uint32_t*)(&payloadBytes[offset]);
-        offset += sizeof(uint32_t);
-        std::wstring translateTo;
-        translateTo.assign(L"");
-        if (manifestTranslatePathsToSize > 0)
-        {
-            translateTo.append((wchar_t*)(&payloadBytes[offset]), manifestTranslatePathsToSize);
-            offset += sizeof(WCHAR) * manifestTranslatePathsToSize;
-        }
-
-        if (!translateFrom.empty() && !translateTo.empty())
-        {
-            g_pManifestTranslatePathTuples->push_back(new TranslatePathTuple(translateFrom, translateTo));
-        }
-    }
+    offset = ParseTranslatePathsBlock(payloadBytes, offset);
 
     g_manifestInternalDetoursErrorNotificationFileString = reinterpret_cast<const PManifestInternalDetoursErrorNotificationFileString>(&payloadBytes[offset]);
     g_manifestInternalDetoursErrorNotificationFileString->AssertValid();
@@ -756,6 +989,23 @@ bool ParseFileAccessManifest(
             HandleDetoursInjectionAndCommunicationErrors(DETOURS_SEMAPHOREOPEN_ERROR_6, L"Detours Error : Failed opening semaphore for tracking message count. exit(-48).", DETOURS_WINDOWS_LOG_MESSAGE_6);
         }
 
+        // NOTE: This calls the real OpenFileMappingW(), because the detoured functions have not been installed yet.
+        std::wstring messageCountName(helperString);
+        messageCountName.append(MESSAGE_COUNT_NAME_SUFFIX);
+        HANDLE hMessageCountMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, messageCountName.c_str());
+        if (hMessageCountMapping != NULL)
+        {
+            g_messageCount = reinterpret_cast<volatile LONG64*>(MapViewOfFile(hMessageCountMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(LONG64)));
+
+            // The view keeps the section alive.
+            CloseHandle(hMessageCountMapping);
+        }
+
+        if (g_messageCount == nullptr)
+        {
+            Dbg(L"Warning: Could not open the message count '%s'. Last Error: %d. Releasing the semaphore instead.", messageCountName.c_str(), (int)GetLastError());
+        }
+
         delete[] helperString;
     }
 
@@ -764,6 +1014,7 @@ bool ParseFileAccessManifest(
 
     if (report->IsReportPresent()) {
         if (report->IsReportHandle()) {
+            // With report channels, this is the channel the parent assigned to this process (see DetouredProcessInjector::SetReportChannels).
             g_reportFileHandle = g_pDetouredProcessInjector->ReportPipe();
             //g_reportFileHandle = (HANDLE)(intptr_t)(report->Report.ReportHandle32Bit);
 #ifdef _DEBUG
@@ -819,6 +1070,49 @@ bool ParseFileAccessManifest(
 
     offset += dllBlock->GetSize();
 
+    g_manifestSuffixPolicies = reinterpret_cast<PCManifestSuffixPolicies>(&payloadBytes[offset]);
+    g_manifestSuffixPolicies->AssertValid();
+    offset += g_manifestSuffixPolicies->GetSize();
+
+    g_manifestFileMetadata = reinterpret_cast<PCManifestFileMetadata>(&payloadBytes[offset]);
+    g_manifestFileMetadata->AssertValid();
+    offset += g_manifestFileMetadata->GetSize();
+
+    g_manifestBreakawayChildProcesses = reinterpret_cast<PCManifestBreakawayChildProcesses>(&payloadBytes[offset]);
+    g_manifestBreakawayChildProcesses->AssertValid();
+    offset += g_manifestBreakawayChildProcesses->GetSize();
+
+    g_manifestProcessAdmission = reinterpret_cast<PCManifestProcessAdmission>(&payloadBytes[offset]);
+    g_manifestProcessAdmission->AssertValid();
+    offset += g_manifestProcessAdmission->GetSize();
+
+    if (g_manifestProcessAdmission->IsEnabled())
+    {
+        LPCWSTR gateName = reinterpret_cast<LPCWSTR>(g_manifestProcessAdmission->GateName);
+        g_processAdmissionGate = OpenEventW(SYNCHRONIZE, FALSE, gateName);
+        if (g_processAdmissionGate == NULL)
+        {
+            Dbg(L"Warning: Could not open the process admission gate '%s'. Last Error: %d. Child processes are admitted right away.", gateName, (int)GetLastError());
+        }
+    }
+
+    g_manifestTempRedirection = reinterpret_cast<PCManifestTempRedirection>(&payloadBytes[offset]);
+    g_manifestTempRedirection->AssertValid();
+    offset += g_manifestTempRedirection->GetSize();
+
+    if (InitializeTempRedirection())
+    {
+        AddTempRedirectionTranslation();
+    }
+
+    g_manifestLookupProfile = reinterpret_cast<PCManifestLookupProfile>(&payloadBytes[offset]);
+    g_manifestLookupProfile->AssertValid();
+    offset += g_manifestLookupProfile->GetSize();
+
+    g_manifestProcessPriority = reinterpret_cast<PCManifestProcessPriority>(&payloadBytes[offset]);
+    g_manifestProcessPriority->AssertValid();
+    offset += g_manifestProcessPriority->GetSize();
+
     g_manifestTreeRoot = reinterpret_cast<PCManifestRecord>(&payloadBytes[offset]);
     VerifyManifestRoot(g_manifestTreeRoot);
 
@@ -872,23 +1166,196 @@ bool ParseFileAccessManifest(
     return true;
 }
 
+ULONG64 MicrosecondsSince(LARGE_INTEGER const& start)
+{
+    LARGE_INTEGER now;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&now);
+    if (!QueryPerformanceFrequency(&frequency) || frequency.QuadPart == 0 || now.QuadPart < start.QuadPart)
+    {
+        return 0;
+    }
+
+    ULONG64 ticks = (ULONG64)(now.QuadPart - start.QuadPart);
+    return (ticks / frequency.QuadPart) * 1000000 + ((ticks % frequency.QuadPart) * 1000000) / frequency.QuadPart;
+}
+
+bool ParseFileAccessManifestPolicies(
+    const void* payload,
+    DWORD payloadSize)
+{
+    const byte * const payloadBytes = reinterpret_cast<const byte *>(payload);
+    if (payloadSize <= sizeof(size_t))
+    {
+        return false;
+    }
+
+    size_t offset = 0;
+
+    PCManifestDebugFlag debugFlag = reinterpret_cast<PCManifestDebugFlag>(&payloadBytes[offset]);
+    if (!debugFlag->CheckValidityAndHandleInvalid())
+    {
+        return false;
+    }
+
+    offset += debugFlag->GetSize();
+
+    PCManifestInjectionTimeout injectionTimeoutFlag = reinterpret_cast<PCManifestInjectionTimeout>(&payloadBytes[offset]);
+    if (!injectionTimeoutFlag->CheckValidityAndHandleInvalid())
+    {
+        return false;
+    }
+
+    offset += injectionTimeoutFlag->GetSize();
+    offset = ParseTranslatePathsBlock(payloadBytes, offset);
+
+    // The error notification file is only read for its size: nothing gets opened here.
+    PManifestInternalDetoursErrorNotificationFileString errorFileString = reinterpret_cast<const PManifestInternalDetoursErrorNotificationFileString>(&payloadBytes[offset]);
+    errorFileString->AssertValid();
+
+#ifdef _DEBUG
+    offset += sizeof(uint32_t);
+#endif
+    uint32_t errorFileSize = *(uint32_t*)(&payloadBytes[offset]);
+    offset += sizeof(uint32_t) + sizeof(wchar_t) * errorFileSize;
+
+    PCManifestFlags flags = reinterpret_cast<PCManifestFlags>(&payloadBytes[offset]);
+    flags->AssertValid();
+    g_fileAccessManifestFlags = static_cast<FileAccessManifestFlag>(flags->Flags);
+    offset += flags->GetSize();
+
+    PCManifestExtraFlags extraFlags = reinterpret_cast<PCManifestExtraFlags>(&payloadBytes[offset]);
+    extraFlags->AssertValid();
+    g_fileAccessManifestExtraFlags = static_cast<FileAccessManifestExtraFlag>(extraFlags->ExtraFlags);
+    offset += extraFlags->GetSize();
+
+    PCManifestPipId pipId = reinterpret_cast<PCManifestPipId>(&payloadBytes[offset]);
+    pipId->AssertValid();
+    g_FileAccessManifestPipId = static_cast<uint64_t>(pipId->PipId);
+    offset += pipId->GetSize();
+
+    PCManifestReport report = reinterpret_cast<PCManifestReport>(&payloadBytes[offset]);
+    report->AssertValid();
+    offset += report->GetSize();
+
+    PCManifestDllBlock dllBlock = reinterpret_cast<PCManifestDllBlock>(&payloadBytes[offset]);
+    dllBlock->AssertValid();
+    offset += dllBlock->GetSize();
+
+    g_manifestSuffixPolicies = reinterpret_cast<PCManifestSuffixPolicies>(&payloadBytes[offset]);
+    g_manifestSuffixPolicies->AssertValid();
+    offset += g_manifestSuffixPolicies->GetSize();
+
+    g_manifestFileMetadata = reinterpret_cast<PCManifestFileMetadata>(&payloadBytes[offset]);
+    g_manifestFileMetadata->AssertValid();
+    offset += g_manifestFileMetadata->GetSize();
+
+    g_manifestBreakawayChildProcesses = reinterpret_cast<PCManifestBreakawayChildProcesses>(&payloadBytes[offset]);
+    g_manifestBreakawayChildProcesses->AssertValid();
+    offset += g_manifestBreakawayChildProcesses->GetSize();
+
+    g_manifestProcessAdmission = reinterpret_cast<PCManifestProcessAdmission>(&payloadBytes[offset]);
+    g_manifestProcessAdmission->AssertValid();
+    offset += g_manifestProcessAdmission->GetSize();
+
+    // Nothing is redirected when only evaluating policies.
+    g_manifestTempRedirection = reinterpret_cast<PCManifestTempRedirection>(&payloadBytes[offset]);
+    g_manifestTempRedirection->AssertValid();
+    offset += g_manifestTempRedirection->GetSize();
+
+    // Nor are the lookups profiled.
+    g_manifestLookupProfile = reinterpret_cast<PCManifestLookupProfile>(&payloadBytes[offset]);
+    g_manifestLookupProfile->AssertValid();
+    offset += g_manifestLookupProfile->GetSize();
+
+    // Nor are priorities set.
+    g_manifestProcessPriority = reinterpret_cast<PCManifestProcessPriority>(&payloadBytes[offset]);
+    g_manifestProcessPriority->AssertValid();
+    offset += g_manifestProcessPriority->GetSize();
+
+    if (offset >= payloadSize)
+    {
+        return false;
+    }
+
+    g_manifestTreeRoot = reinterpret_cast<PCManifestRecord>(&payloadBytes[offset]);
+    VerifyManifestRoot(g_manifestTreeRoot);
+
+    return true;
+}
+
 bool LocateAndParseFileAccessManifest()
 {
     const void* manifest;
     DWORD manifestSize;
 
-    if (!LocateFileAccessManifest(/*out*/ manifest, /*out*/ manifestSize)) {
+    LARGE_INTEGER phaseStart;
+    QueryPerformanceCounter(&phaseStart);
+    bool located = LocateFileAccessManifest(/*out*/ manifest, /*out*/ manifestSize);
+    g_detoursAttachLocateManifestMicroseconds = (LONG64)MicrosecondsSince(phaseStart);
+
+    if (!located) {
         wprintf(L"Failed to find payload coming from Detours");
         fwprintf(stderr, L"Failed to find payload coming from Detours");
         HandleDetoursInjectionAndCommunicationErrors(DETOURS_NO_PAYLOAD_FOUND_8, L"Failure to find payload coming from Detours: exit(-50).", DETOURS_WINDOWS_LOG_MESSAGE_8);
         return false;
     }
 
-    return ParseFileAccessManifest(manifest, manifestSize);
+    QueryPerformanceCounter(&phaseStart);
+    bool parsed = ParseFileAccessManifest(manifest, manifestSize);
+    g_detoursAttachParseManifestMicroseconds = (LONG64)MicrosecondsSince(phaseStart);
+
+    return parsed;
 }
 
 SpecialProcessKind  g_ProcessKind = SpecialProcessKind::NotSpecial;
 
+void InitProcessNameAndCommandLine()
+{
+    // Reports need these over and over, and neither changes during the life of the process.
+    // Like the manifest, they are never freed.
+    DWORD len = MAX_PATH;
+    wchar_t* moduleName = new wchar_t[len];
+
+    // The name may be cut off; this is known by testing if the last error is ERROR_INSUFFICIENT_BUFFER.
+    // Other failures cannot be tested for, because very often Windows APIs don't change the last error
+    // in success cases and another error code might be left over from a previous operation.
+    while (true)
+    {
+        if (GetModuleFileNameW(NULL, moduleName, len) == 0)
+        {
+            Dbg(L"Could not get the processName. GetModuleFileNameW function failed.");
+            delete[] moduleName;
+            moduleName = nullptr;
+            break;
+        }
+
+        if (GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+        {
+            delete[] moduleName;
+            len = 2 * len;
+            moduleName = new wchar_t[len];
+            continue;
+        }
+
+        break;
+    }
+
+    g_currentProcessModuleName = moduleName;
+
+    // The text report format is line based, so line breaks in the command line are replaced with spaces.
+    // This does not change the length of the command line.
+    PCWSTR commandLine = g_currentProcessCommandLine != nullptr ? g_currentProcessCommandLine : L"";
+    size_t commandLineLength = wcslen(commandLine);
+    wchar_t* sanitizedCommandLine = new wchar_t[commandLineLength + 1];
+    for (size_t i = 0; i <= commandLineLength; i++)
+    {
+        sanitizedCommandLine[i] = commandLine[i] == L'\r' || commandLine[i] == L'\n' ? L' ' : commandLine[i];
+    }
+
+    g_currentProcessSanitizedCommandLine = sanitizedCommandLine;
+}
+
 void InitProcessKind()
 {
     struct ProcessPair {
@@ -911,21 +1378,60 @@ void InitProcessKind()
 
     size_t count = sizeof(pairs) / sizeof(pairs[0]);
 
-    WCHAR wszFileName[MAX_PATH];
-    DWORD nFileName = GetModuleFileNameW(NULL, wszFileName, MAX_PATH);
-    if (nFileName == 0 || nFileName == MAX_PATH) {
+    if (g_currentProcessModuleName == nullptr) {
         return;
     }
 
+    size_t nFileName = wcslen(g_currentProcessModuleName);
+
     for (size_t i = 0; i < count; i++) {
-        if (HasSuffix(wszFileName, nFileName, pairs[i].Name)) {
+        if (HasSuffix(g_currentProcessModuleName, nFileName, pairs[i].Name)) {
             g_ProcessKind = pairs[i].Kind;
-            return;
+            break;
         }
     }
+
+    switch (g_ProcessKind)
+    {
+    case SpecialProcessKind::Csc:
+    case SpecialProcessKind::Cvtres:
+    case SpecialProcessKind::Resonexe:
+        g_specialCaseRules |= SpecialCaseRule_TempFile;
+        break;
+
+    case SpecialProcessKind::RC:
+        g_specialCaseRules |= SpecialCaseRule_RCTempFile;
+        break;
+
+    case SpecialProcessKind::Mt:
+        g_specialCaseRules |= SpecialCaseRule_MtTempFile;
+        break;
+
+    case SpecialProcessKind::CCCheck:
+    case SpecialProcessKind::CCDocGen:
+    case SpecialProcessKind::CCRefGen:
+    case SpecialProcessKind::CCRewrite:
+        g_specialCaseRules |= SpecialCaseRule_PdbFile;
+        break;
+
+    case SpecialProcessKind::WinDbg:
+    case SpecialProcessKind::NotSpecial:
+        // no special treatment
+        break;
+    }
 }
 
 void ReportIfNeeded(AccessCheckResult const& checkResult, FileOperationContext const& context, PolicyResult const& policyResult, DWORD error, USN usn, wchar_t const* filter) {
+    if (IsDetoursEventEnabled(DetoursEvent_PolicyDecision)) {
+        WritePolicyDecisionEvent(
+            context.Operation,
+            policyResult.IsIndeterminate() ? context.NoncanonicalPath : policyResult.GetCanonicalizedPath().GetPathString(),
+            static_cast<DWORD>(checkResult.RequestedAccess),
+            checkResult.GetFileAccessStatus(),
+            checkResult.ShouldReport(),
+            error);
+    }
+
     if (!checkResult.ShouldReport()) {
         return;
     }
@@ -946,59 +1452,115 @@ void ReportIfNeeded(AccessCheckResult const& checkResult, FileOperationContext c
         filter);
 }
 
+// Size of the buffer EnumerateDirectory queries entries into. Holds a few hundred entries of typical names.
+#define ENUMERATE_DIRECTORY_BUFFER_SIZE (64 * 1024)
+
+#define DETOURS_STATUS_NO_MORE_FILES (NTSTATUS)0x80000006L
+
 bool EnumerateDirectory(
     const std::wstring& directoryPath,
     const std::wstring& filter,
     bool recursive,
     bool treatReparsePointAsFile,
-    _Inout_ std::vector<std::pair<std::wstring, DWORD>>& filesAndDirectories)
+    const std::function<bool(const std::wstring& path, DWORD attributes)>& onEntry)
 {
-    HANDLE hFind = INVALID_HANDLE_VALUE;
-    WIN32_FIND_DATA ffd;
+    // One buffer serves the whole enumeration.
+    std::unique_ptr<BYTE[]> buffer(new BYTE[ENUMERATE_DIRECTORY_BUFFER_SIZE]);
     std::stack<std::wstring> directoriesToEnumerate;
+    std::wstring path;
+
+    UNICODE_STRING fileName;
+    fileName.Buffer = const_cast<PWSTR>(filter.c_str());
+    fileName.Length = (USHORT)(filter.length() * sizeof(wchar_t));
+    fileName.MaximumLength = fileName.Length;
 
     directoriesToEnumerate.push(directoryPath);
-    filesAndDirectories.clear();
 
     while (!directoriesToEnumerate.empty()) {
         std::wstring directoryToEnumerate = directoriesToEnumerate.top();
-        std::wstring spec = directoryToEnumerate + L"\\" + filter;
         directoriesToEnumerate.pop();
 
-        hFind = FindFirstFileW(spec.c_str(), &ffd);
-        if (hFind == INVALID_HANDLE_VALUE) {
+        HANDLE hDirectory = CreateFileW(
+            directoryToEnumerate.c_str(),
+            FILE_LIST_DIRECTORY | SYNCHRONIZE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            NULL,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS,
+            NULL);
+
+        if (hDirectory == INVALID_HANDLE_VALUE) {
             return false;
         }
 
-        do {
-            if (wcscmp(ffd.cFileName, L".") != 0 &&
-                wcscmp(ffd.cFileName, L"..") != 0) {
+        // The filter only needs to be passed to the first query of a directory.
+        bool firstQuery = true;
+
+        for (;;) {
+            IO_STATUS_BLOCK ioStatusBlock;
+            NTSTATUS status = Real_NtQueryDirectoryFile(
+                hDirectory,
+                NULL,
+                NULL,
+                NULL,
+                &ioStatusBlock,
+                buffer.get(),
+                ENUMERATE_DIRECTORY_BUFFER_SIZE,
+                FileDirectoryInformation,
+                FALSE,
+                firstQuery ? &fileName : NULL,
+                firstQuery ? TRUE : FALSE);
 
-                std::wstring path = directoryToEnumerate + L"\\" + ffd.cFileName;
-                filesAndDirectories.push_back(std::make_pair(path, ffd.dwFileAttributes));
+            firstQuery = false;
 
-                if (recursive) {
-                    
-                    bool isDirectory = (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-                    
-                    if (isDirectory && treatReparsePointAsFile) {
-                        isDirectory = (ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0;
+            if (status == DETOURS_STATUS_NO_MORE_FILES) {
+                break;
+            }
+
+            if (!NT_SUCCESS(status)) {
+                CloseHandle(hDirectory);
+                return false;
+            }
+
+            PFILE_DIRECTORY_INFORMATION entry = reinterpret_cast<PFILE_DIRECTORY_INFORMATION>(buffer.get());
+            for (;;) {
+                size_t nameLength = entry->FileNameLength / sizeof(wchar_t);
+                bool isDotOrDotDot = entry->FileName[0] == L'.'
+                    && (nameLength == 1 || (nameLength == 2 && entry->FileName[1] == L'.'));
+
+                if (!isDotOrDotDot) {
+                    path.assign(directoryToEnumerate);
+                    path.push_back(L'\\');
+                    path.append(entry->FileName, nameLength);
+
+                    if (!onEntry(path, entry->FileAttributes)) {
+                        CloseHandle(hDirectory);
+                        return false;
                     }
 
-                    if (isDirectory) {
-                        directoriesToEnumerate.push(path);
+                    if (recursive) {
+
+                        bool isDirectory = (entry->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+
+                        if (isDirectory && treatReparsePointAsFile) {
+                            isDirectory = (entry->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0;
+                        }
+
+                        if (isDirectory) {
+                            directoriesToEnumerate.push(path);
+                        }
                     }
                 }
-            }
-        } while (FindNextFile(hFind, &ffd) != 0);
 
-        if (GetLastError() != ERROR_NO_MORE_FILES) {
-            FindClose(hFind);
-            return false;
+                if (entry->NextEntryOffset == 0) {
+                    break;
+                }
+
+                entry = reinterpret_cast<PFILE_DIRECTORY_INFORMATION>(reinterpret_cast<BYTE*>(entry) + entry->NextEntryOffset);
+            }
         }
 
-        FindClose(hFind);
-        hFind = INVALID_HANDLE_VALUE;
+        CloseHandle(hDirectory);
     }
 
     return true;
@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <functional>
+
 #include "DetoursServices.h"
 #include "FileAccessHelpers.h"
 #include "PolicyResult.h"
@@ -101,12 +103,29 @@ bool ParseFileAccessManifest(
 
 bool LocateAndParseFileAccessManifest();
 
+/// Sets up the policies of the given manifest payload (flags, directory translations, suffix policies, file metadata and
+/// the manifest tree), without anything ParseFileAccessManifest opens or hands to the injector, for tools that evaluate
+/// policies offline (see PolicyInputCapture.h). The payload must outlive the use of the policies.
+bool ParseFileAccessManifestPolicies(
+    const void* payload,
+    DWORD payloadSize);
+
+/// Microseconds elapsed since the given QueryPerformanceCounter value.
+ULONG64 MicrosecondsSince(LARGE_INTEGER const& start);
+
 void WriteToInternalErrorsFile(PCWSTR format, ...);
 
+/// Computes g_currentProcessModuleName and g_currentProcessSanitizedCommandLine. Must be called once at attach.
+void InitProcessNameAndCommandLine();
+
 void InitProcessKind();
 
 void TranslateFilePath(_In_ const std::wstring& inFileName, _Out_ std::wstring& outFileName, _In_ bool debug);
 
+bool TryTranslateFilePath(_In_ const CanonicalizedPath& path, _Inout_ std::wstring& outFileName, _In_ bool debug);
+
+bool TryTranslateFilePathInBuffer(_Inout_updates_(bufferLength) PWSTR buffer, _In_ size_t pathLength, _In_ size_t bufferLength, _Out_ size_t& translatedLength);
+
 void ReportIfNeeded(
     AccessCheckResult const& checkResult, 
     FileOperationContext const& context, 
@@ -115,12 +134,30 @@ void ReportIfNeeded(
     USN usn = -1, 
     wchar_t const* filter = nullptr);
 
+// Directory entries returned by NtQueryDirectoryFile / ZwQueryDirectoryFile that have timestamps or short names.
+typedef struct _FILE_DIRECTORY_INFORMATION {
+    ULONG         NextEntryOffset;
+    ULONG         FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG         FileAttributes;
+    ULONG         FileNameLength;
+    WCHAR         FileName[1];
+} FILE_DIRECTORY_INFORMATION, *PFILE_DIRECTORY_INFORMATION;
+
+// Enumerates the entries of a directory matching a filter, and of its subdirectories if recursive, calling onEntry with
+// the path and attributes of each. The entries are queried in bulk with NtQueryDirectoryFile (FileDirectoryInformation).
+// Stops and returns false if onEntry returns false or a directory cannot be enumerated.
 bool EnumerateDirectory(
     const std::wstring& directoryPath,
     const std::wstring& filter,
     bool recursive,
     bool treatReparsePointAsFile,
-    _Inout_ std::vector<std::pair<std::wstring, DWORD>>& filesAndDirectories);
+    const std::function<bool(const std::wstring& path, DWORD attributes)>& onEntry);
 
 class ReportData
 {
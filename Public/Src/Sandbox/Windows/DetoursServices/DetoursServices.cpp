@@ -21,14 +21,25 @@
 #include "DetouredFunctionTypes.h"
 #include "DetoursHelpers.h"
 #include "DetoursServices.h"
+#include "FeatureCounters.h"
 #include "FileAccessHelpers.h"
 #include "globals.h"
 #include "buildXL_mem.h"
 #include "DetouredScope.h"
 #include "StringOperations.h"
 #include "HandleOverlay.h"
+#include "LiveCounters.h"
+#include "LookupProfile.h"
+#include "MemoryPressure.h"
+#include "PolicyInputCapture.h"
+#include "ProcessPriority.h"
+#include "TempRedirection.h"
 #include "DetouredProcessInjector.h"
+#include "DetoursEvents.h"
 #include "SendReport.h"
+#include "ReportCache.h"
+#include "ReportRing.h"
+#include "Materialization.h"
 #include <Psapi.h>
 
 #define BUILDXL_DETOURS_CREATE_PROCESS_RETRY_COUNT 5
@@ -66,12 +77,8 @@ extern "C" {
 }
 
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
-volatile LONG g_msTimeToPopulatePoolList = 0;
 volatile ULONGLONG g_pipExecutionStart = 0;
 volatile LONG g_ntCloseHandeCount = 0;
-volatile LONG g_maxClosedListCount = 0;
-volatile LONG g_msTimeInAddClosedList = 0;
-volatile LONG g_msTimeInRemoveClosedList = 0;
 #endif // #if MEASURE_DETOURED_NT_CLOSE_IMPACT
 
 extern "C" {
@@ -100,6 +107,35 @@ extern "C" {
         _In_     BOOLEAN                ReturnSingleEntry,
         _In_opt_ PUNICODE_STRING        FileName,
         _In_     BOOLEAN                RestartScan);
+
+    NTSTATUS NTAPI NtWriteFile(
+        _In_     HANDLE           FileHandle,
+        _In_opt_ HANDLE           Event,
+        _In_opt_ PIO_APC_ROUTINE  ApcRoutine,
+        _In_opt_ PVOID            ApcContext,
+        _Out_    PIO_STATUS_BLOCK IoStatusBlock,
+        _In_     PVOID            Buffer,
+        _In_     ULONG            Length,
+        _In_opt_ PLARGE_INTEGER   ByteOffset,
+        _In_opt_ PULONG           Key);
+
+    NTSTATUS NTAPI NtDuplicateObject(
+        _In_      HANDLE      SourceProcessHandle,
+        _In_      HANDLE      SourceHandle,
+        _In_opt_  HANDLE      TargetProcessHandle,
+        _Out_opt_ PHANDLE     TargetHandle,
+        _In_      ACCESS_MASK DesiredAccess,
+        _In_      ULONG       HandleAttributes,
+        _In_      ULONG       Options);
+
+    // The information is a FILE_BASIC_INFORMATION and a FILE_NETWORK_OPEN_INFORMATION respectively; the detours only pass it on.
+    NTSTATUS NTAPI NtQueryAttributesFile(
+        _In_  POBJECT_ATTRIBUTES ObjectAttributes,
+        _Out_ PVOID              FileInformation);
+
+    NTSTATUS NTAPI NtQueryFullAttributesFile(
+        _In_  POBJECT_ATTRIBUTES ObjectAttributes,
+        _Out_ PVOID              FileInformation);
 }
 
 #pragma warning( disable : 4711)
@@ -208,6 +244,8 @@ PVOID g_manifestPtr = nullptr;
 PDWORD g_manifestSizePtr = 0;
 DWORD g_currentProcessId;
 PCWSTR g_currentProcessCommandLine = nullptr;
+PCWSTR g_currentProcessSanitizedCommandLine = nullptr;
+PCWSTR g_currentProcessModuleName = nullptr;
 DWORD g_parentProcessId = 0;
 
 FileAccessManifestFlag g_fileAccessManifestFlags;
@@ -216,6 +254,13 @@ FileAccessManifestExtraFlag g_fileAccessManifestExtraFlags;
 uint64_t g_FileAccessManifestPipId;
 
 PCManifestRecord g_manifestTreeRoot;
+PCManifestSuffixPolicies g_manifestSuffixPolicies;
+PCManifestFileMetadata g_manifestFileMetadata;
+PCManifestBreakawayChildProcesses g_manifestBreakawayChildProcesses;
+PCManifestProcessAdmission g_manifestProcessAdmission;
+PCManifestTempRedirection g_manifestTempRedirection;
+PCManifestLookupProfile g_manifestLookupProfile;
+PCManifestProcessPriority g_manifestProcessPriority;
 
 PManifestTranslatePathsStrings g_manifestTranslatePathsStrings;
 vector<TranslatePathTuple*>* g_pManifestTranslatePathTuples = nullptr;
@@ -224,6 +269,8 @@ PManifestInternalDetoursErrorNotificationFileString g_manifestInternalDetoursErr
 LPCTSTR g_internalDetoursErrorNotificationFile = nullptr;
 
 HANDLE g_messageCountSemaphore = INVALID_HANDLE_VALUE;
+HANDLE g_processAdmissionGate = NULL;
+volatile LONG64* g_messageCount = nullptr;
 
 HANDLE g_reportFileHandle;
 
@@ -243,13 +290,78 @@ volatile LONG64 g_detoursMaxAllocatedMemoryInBytes = 0;
 volatile LONG64 g_detoursHeapAllocatedMemoryInBytes = 0;
 
 // The number of entries allocated in the no-lock, concurrent list for use by NtClose.
+// No longer used: NtClose marks handle overlays closed directly. Kept (always 0) for the layout of the process data report.
 volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries = 0;
 
 // The max number of entries in the HandleHeapMap hash table. Allocated in private heap.
 volatile LONG64 g_detoursMaxHandleHeapEntries = 0;
 
 // Currently allocated entries in the HandleHeapMap hash table. Allocated in private heap.
-volatile LONG64 g_detoursHandleHeapEntries = 0;\
+volatile LONG64 g_detoursHandleHeapEntries = 0;
+
+// The number of HandleOverlay map updates that had to wait for the lock of their shard.
+volatile LONG64 g_detoursHandleOverlayContendedWrites = 0;
+
+// The number of HandleOverlay map lookups that had to wait for the lock of their shard.
+volatile LONG64 g_detoursHandleOverlayContendedReads = 0;
+
+// The number of NtClose calls that found the closed handles pool empty, leaving the handle in the HandleOverlay map.
+// No longer used, like g_detoursAllocatedNoLockConcurentPoolEntries.
+volatile LONG64 g_detoursNtClosePoolExhaustions = 0;
+
+// The number of times the closed handles pool got grown after its initial allocation.
+// No longer used, like g_detoursAllocatedNoLockConcurentPoolEntries.
+volatile LONG64 g_detoursNtClosePoolRefills = 0;
+
+// The number of paths canonicalized, and how many of them were already canonical and skipped GetFullPathNameW.
+volatile LONG64 g_detoursCanonicalizations = 0;
+volatile LONG64 g_detoursFastCanonicalizations = 0;
+
+// Time spent in each phase of DllProcessAttach, in microseconds.
+volatile LONG64 g_detoursAttachLocateManifestMicroseconds = 0;
+volatile LONG64 g_detoursAttachParseManifestMicroseconds = 0;
+volatile LONG64 g_detoursAttachHandleOverlayMicroseconds = 0;
+volatile LONG64 g_detoursAttachTransactionMicroseconds = 0;
+
+// The number of child processes injected locally, how many of their images were found from their PEB, and the time
+// spent in each step of updating their imports, in microseconds.
+volatile LONG64 g_detoursInjectedProcesses = 0;
+volatile LONG64 g_detoursInjectionImagesFromPeb = 0;
+volatile LONG64 g_detoursInjectionFindImageMicroseconds = 0;
+volatile LONG64 g_detoursInjectionAllocateMicroseconds = 0;
+volatile LONG64 g_detoursInjectionWriteImportsMicroseconds = 0;
+volatile LONG64 g_detoursInjectionChecksumMicroseconds = 0;
+
+// The time spent applying the device map of the pip to child processes, in microseconds, and the number of child processes
+// that inherited it instead (see FileAccessManifestExtraFlag::InheritDeviceMap).
+volatile LONG64 g_detoursInjectionApplyMappingMicroseconds = 0;
+volatile LONG64 g_detoursInjectionInheritedDeviceMaps = 0;
+
+// The number of policies found in and missing from the policy result cache (see FileAccessManifestExtraFlag::CachePolicyResults),
+// and the number of entries in it.
+volatile LONG64 g_detoursPolicyResultCacheHits = 0;
+volatile LONG64 g_detoursPolicyResultCacheMisses = 0;
+volatile LONG64 g_detoursPolicyResultCacheEntries = 0;
+
+// The number of times the caches shed their cold entries because memory was low (see FileAccessManifestExtraFlag::ShrinkCachesUnderMemoryPressure).
+volatile LONG64 g_detoursCacheShrinks = 0;
+
+// The number of child processes that waited on the process admission gate (see ManifestProcessAdmission), and the time they
+// waited in total, in microseconds.
+volatile LONG64 g_detoursProcessAdmissionWaits = 0;
+volatile LONG64 g_detoursProcessAdmissionWaitMicroseconds = 0;
+
+// The number of directory checks answered from the options and the result of an open, or from the overlay of a handle, instead
+// of a query of the file system (see IsNtOpenOfDirectory and TryCheckHandleOfDirectoryFromOverlay).
+volatile LONG64 g_detoursDirectoryQueriesAvoided = 0;
+
+// The number of queries of the attributes of a file handle (see TryQueryFileStat), and the number of checks answered from the
+// result of one of them made for another check, after the same open or when it was made (see OpenedFileStat and HandleOverlay::Stat).
+volatile LONG64 g_detoursFileStatQueries = 0;
+volatile LONG64 g_detoursFileStatQueriesSaved = 0;
+
+// The number of functions detoured by DllProcessAttach with the prologue from the cache received from the parent process.
+volatile LONG64 g_detoursAttachCachedPrologues = 0;
 
 //
 // Real Windows API function pointers
@@ -311,6 +423,8 @@ CreateDirectoryExW_t Real_CreateDirectoryExW;
 CreateDirectoryExA_t Real_CreateDirectoryExA;
 RemoveDirectoryW_t Real_RemoveDirectoryW;
 RemoveDirectoryA_t Real_RemoveDirectoryA;
+SetCurrentDirectoryW_t Real_SetCurrentDirectoryW;
+SetCurrentDirectoryA_t Real_SetCurrentDirectoryA;
 DecryptFileW_t Real_DecryptFileW;
 DecryptFileA_t Real_DecryptFileA;
 EncryptFileW_t Real_EncryptFileW;
@@ -322,6 +436,7 @@ GetFinalPathNameByHandleW_t Real_GetFinalPathNameByHandleW;
 GetFinalPathNameByHandleA_t Real_GetFinalPathNameByHandleA;
 
 NtClose_t Real_NtClose;
+NtDuplicateObject_t Real_NtDuplicateObject;
 NtCreateFile_t Real_NtCreateFile;
 NtOpenFile_t Real_NtOpenFile;
 ZwCreateFile_t Real_ZwCreateFile;
@@ -329,6 +444,9 @@ ZwOpenFile_t Real_ZwOpenFile;
 NtQueryDirectoryFile_t Real_NtQueryDirectoryFile;
 ZwQueryDirectoryFile_t Real_ZwQueryDirectoryFile;
 ZwSetInformationFile_t Real_ZwSetInformationFile;
+NtWriteFile_t Real_NtWriteFile;
+NtQueryAttributesFile_t Real_NtQueryAttributesFile;
+NtQueryFullAttributesFile_t Real_NtQueryFullAttributesFile;
 
 // Value used to signal the the exit code of the current process cannot be retrieved
 #define PROCESS_EXIT_CODE_CANNOT_BE_RETRIEVED 0xFFFFFF9A
@@ -428,6 +546,12 @@ void LogEventLogMessage(const std::wstring& a_msg,
     UnsetEventLogSource(a_name);
 }
 
+/// Saturates a duration to the 32 bits it is reported with.
+static inline uint32_t ToReportedMicroseconds(ULONG64 microseconds)
+{
+    return microseconds > UINT32_MAX ? UINT32_MAX : (uint32_t)microseconds;
+}
+
 //
 // Code to create a detoured process
 //
@@ -438,6 +562,8 @@ void LogEventLogMessage(const std::wstring& a_msg,
 // it will point at the prior CreateProcessW entry point.  When called
 // from outside (not within the detour of CreateProcessW) it will be
 // passed the normal public CreateProcessW entry point.
+// attributesMicroseconds is the time the caller spent building the attribute list
+// of the child, if it built one; it is only reported.
 //
 
 CreateDetouredProcessStatus
@@ -455,16 +581,21 @@ InternalCreateDetouredProcess(
     HANDLE hJob,
     DetouredProcessInjector *pInjector,
     LPPROCESS_INFORMATION lpProcessInformation,
-    CreateProcessW_t pfCreateProcessW)
+    CreateProcessW_t pfCreateProcessW,
+    ULONG64 attributesMicroseconds)
 {
     // No detours should be called recursively from here.
     DetouredScope scope;
 
+    ProcessDetouringTimings timings = {};
+    timings.AttributesMicroseconds = ToReportedMicroseconds(attributesMicroseconds);
+    LARGE_INTEGER stepStart;
+
     DWORD error = ERROR_SUCCESS;
     BOOL fProcCreated = FALSE;
     BOOL fProcDetoured = FALSE;
     CreateDetouredProcessStatus status = CreateDetouredProcessStatus::Succeeded;
-    DWORD creationFlags = dwCreationFlags;
+    DWORD creationFlags = ApplyPriorityClassToCreationFlags(dwCreationFlags);
     unsigned nRetryCount = 0;
 
     bool disabledDetours = DisableDetours();
@@ -490,6 +621,8 @@ InternalCreateDetouredProcess(
             status);
     }
 
+    QueryPerformanceCounter(&stepStart);
+
     // It appears the AV might hold exclusive read lock while scaning and this can fail create process.
     // Inject some retries.
     while (true)
@@ -523,6 +656,9 @@ InternalCreateDetouredProcess(
         break;
     }
 
+    timings.CreateProcessMicroseconds = ToReportedMicroseconds(MicrosecondsSince(stepStart));
+    QueryPerformanceCounter(&stepStart);
+
     if (!fProcCreated)
     {
         error = GetLastError();
@@ -537,8 +673,25 @@ InternalCreateDetouredProcess(
         bool fullInheritHandles = bInheritHandles == TRUE && !(dwCreationFlags & EXTENDED_STARTUPINFO_PRESENT);
         error = pInjector->InjectProcess(lpProcessInformation->hProcess, fullInheritHandles);
         fProcDetoured = error == ERROR_SUCCESS;
+
+        // The child inherits all inheritable handles; pass their overlays on so that it need not look them up again.
+        // With a handle list in the extended attributes, which handles are inherited is unknown, so none are passed.
+        if (fProcDetoured && fullInheritHandles)
+        {
+            CopyInheritableHandleOverlaysToProcess(lpProcessInformation->hProcess);
+        }
+
+        timings.InjectionMicroseconds = ToReportedMicroseconds(MicrosecondsSince(stepStart));
+    }
+
+    if (fProcCreated)
+    {
+        // The I/O priority is not inherited; the child is still suspended unless it needed neither injection nor a job.
+        ApplyIoPriorityToProcess(lpProcessInformation->hProcess);
     }
 
+    QueryPerformanceCounter(&stepStart);
+
     if ((fProcDetoured || !needInjection) && fProcCreated) {
         status = CreateDetouredProcessStatus::Succeeded;
 
@@ -555,15 +708,21 @@ InternalCreateDetouredProcess(
         status = CreateDetouredProcessStatus::ProcessCreationFailed;
     }
     
+    // Only resume the child if it was suspended here; the creation flags may also differ by their priority class.
     if (status == CreateDetouredProcessStatus::Succeeded &&
         !(dwCreationFlags & CREATE_SUSPENDED) &&
-        dwCreationFlags != creationFlags &&
+        (creationFlags & CREATE_SUSPENDED) &&
         ResumeThread(lpProcessInformation->hThread) == -1) {
 
         status = CreateDetouredProcessStatus::ProcessResumeFailed;
         error = GetLastError();
     }
 
+    if (fProcCreated)
+    {
+        timings.ResumeMicroseconds = ToReportedMicroseconds(MicrosecondsSince(stepStart));
+    }
+
     if (status != CreateDetouredProcessStatus::Succeeded) {
         // clean-up
         if (fProcCreated) {
@@ -598,7 +757,8 @@ InternalCreateDetouredProcess(
             creationFlags,
             fProcDetoured,
             error,
-            status);
+            status,
+            &timings);
     }
 
     SetLastError(error);
@@ -626,26 +786,118 @@ struct ProcessCreationAttributes {
 	ProcessCreationAttributes(const ProcessCreationAttributes&) = delete;
 	ProcessCreationAttributes& operator=(const ProcessCreationAttributes&) = delete;
 
-	ProcessCreationAttributes(ProcessCreationAttributes&& other)
-        : attrList(move(other.attrList)), handles(move(other.handles)) 
-    { 
-        hJob = other.hJob;
-    }
-
-	ProcessCreationAttributes& operator=(ProcessCreationAttributes&& other) 
+    /// Whether the attribute list is populated for exactly this configuration.
+    bool Matches(HANDLE stdInput, HANDLE stdOutput, HANDLE stdError, HANDLE job, bool addToSilo) const
     {
-        attrList = move(other.attrList);
-        handles = move(other.handles);
-        hJob = other.hJob;
-
-        return *this;
+        return populated
+            && hStdInput == stdInput
+            && hStdOutput == stdOutput
+            && hStdError == stdError
+            && addProcessToSilo == addToSilo
+            && (!addToSilo || hJob == job);
     }
 
+    // The attribute list keeps pointers to hJob and to the content of handles, so an instance must not move while
+    // the list is in use (instances are only handed around by pointer).
     HANDLE hJob;
     attrlist_ptr attrList;
     vector<HANDLE> handles;
+
+    // Allocated size and attribute count of attrList, so that the buffer can be initialized again without querying its size.
+    SIZE_T attrListSize = 0;
+    DWORD attributeCount = 0;
+
+    // The configuration attrList is populated for, if populated.
+    bool populated = false;
+    HANDLE hStdInput = INVALID_HANDLE_VALUE;
+    HANDLE hStdOutput = INVALID_HANDLE_VALUE;
+    HANDLE hStdError = INVALID_HANDLE_VALUE;
+    bool addProcessToSilo = false;
 };
 
+typedef unique_ptr<ProcessCreationAttributes> ProcessCreationAttributesPtr;
+
+// Attribute lists of detoured processes that have been created, for reuse by the next ones. BuildXL starts many pips
+// with the same configuration (e.g. the same inherited handles when pips share their standard handles), so an
+// identical list is often already there; otherwise the buffer of a list with the same attribute count is reused.
+#define PROCESS_CREATION_ATTRIBUTES_POOL_SIZE 16
+
+static SRWLOCK g_processCreationAttributesPoolLock = SRWLOCK_INIT;
+static vector<ProcessCreationAttributesPtr> g_processCreationAttributesPool;
+
+/** Takes from the pool the attributes populated for the given configuration, or else ones with a buffer that can be reused,
+    or else makes new ones. Only the first are populated on return.
+*/
+static ProcessCreationAttributesPtr AcquireProcessCreationAttributes(
+    HANDLE hStdInput,
+    HANDLE hStdOutput,
+    HANDLE hStdError,
+    HANDLE hJob,
+    bool addProcessToSilo)
+{
+    DWORD attributeCount = addProcessToSilo ? 2ul : 1ul;
+    ProcessCreationAttributesPtr attr;
+
+    AcquireSRWLockExclusive(&g_processCreationAttributesPoolLock);
+
+    size_t candidate = g_processCreationAttributesPool.size();
+    for (size_t i = 0; i < g_processCreationAttributesPool.size(); i++)
+    {
+        ProcessCreationAttributes const& pooled = *g_processCreationAttributesPool[i];
+        if (pooled.Matches(hStdInput, hStdOutput, hStdError, hJob, addProcessToSilo))
+        {
+            candidate = i;
+            break;
+        }
+
+        if (candidate == g_processCreationAttributesPool.size() && pooled.attributeCount == attributeCount)
+        {
+            candidate = i;
+        }
+    }
+
+    if (candidate < g_processCreationAttributesPool.size())
+    {
+        attr = std::move(g_processCreationAttributesPool[candidate]);
+        g_processCreationAttributesPool.erase(g_processCreationAttributesPool.begin() + candidate);
+    }
+
+    ReleaseSRWLockExclusive(&g_processCreationAttributesPoolLock);
+
+    if (attr == nullptr)
+    {
+        return make_unique<ProcessCreationAttributes>(hJob);
+    }
+
+    if (!attr->Matches(hStdInput, hStdOutput, hStdError, hJob, addProcessToSilo))
+    {
+        attr->populated = false;
+    }
+
+    attr->hJob = hJob;
+    return attr;
+}
+
+/** Returns attributes to the pool once the process they were used for is created. Attributes that failed to be
+    populated are dropped, as their list may be partially updated.
+*/
+static void ReleaseProcessCreationAttributes(ProcessCreationAttributesPtr attr)
+{
+    if (!attr->populated)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&g_processCreationAttributesPoolLock);
+
+    if (g_processCreationAttributesPool.size() < PROCESS_CREATION_ATTRIBUTES_POOL_SIZE)
+    {
+        g_processCreationAttributesPool.push_back(std::move(attr));
+    }
+
+    ReleaseSRWLockExclusive(&g_processCreationAttributesPoolLock);
+}
+
 /** Initializes the list of attributes based on whether the process needs to be added to a silo
 */
 static bool InitializeAttributeList(ProcessCreationAttributes& attr, bool addProcessToSilo) {
@@ -653,6 +905,22 @@ static bool InitializeAttributeList(ProcessCreationAttributes& attr, bool addPro
 	// if the process needs to be created inside a silo
 	DWORD attributeCount = addProcessToSilo ? 2ul : 1ul;
 
+	// A reused list is cleared and initialized again in its own buffer.
+	if (attr.attrList.get() != nullptr && attr.attributeCount == attributeCount) {
+		DeleteProcThreadAttributeList(attr.attrList.get());
+
+		SIZE_T reusedSize = attr.attrListSize;
+		if (InitializeProcThreadAttributeList(attr.attrList.get(), attributeCount, /*flags*/ 0, &reusedSize)) {
+			return true;
+		}
+
+		// The buffer is left uninitialized; it must not be deleted as a list.
+		dd_free((void*)attr.attrList.release());
+	}
+
+	attr.attrList.reset();
+	attr.attributeCount = 0;
+
 	// First we establish the required allocation size.
 	SIZE_T requiredSize = 0;
 	if (!InitializeProcThreadAttributeList(NULL, attributeCount, /*flags*/ 0, &requiredSize) &&
@@ -662,15 +930,19 @@ static bool InitializeAttributeList(ProcessCreationAttributes& attr, bool addPro
 
 	assert(requiredSize > 0);
 
-	attr.attrList = ProcessCreationAttributes::attrlist_ptr(
-		static_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(dd_malloc(requiredSize)));
+	LPPROC_THREAD_ATTRIBUTE_LIST buffer = static_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(dd_malloc(requiredSize));
 
-	assert(attr.attrList.get() != nullptr);
+	assert(buffer != nullptr);
 
-	if (!InitializeProcThreadAttributeList(attr.attrList.get(), attributeCount, /*flags*/ 0, &requiredSize)) {
+	if (!InitializeProcThreadAttributeList(buffer, attributeCount, /*flags*/ 0, &requiredSize)) {
+		dd_free((void*)buffer);
 		return false;
 	}
 
+	attr.attrList = ProcessCreationAttributes::attrlist_ptr(buffer);
+	attr.attrListSize = requiredSize;
+	attr.attributeCount = attributeCount;
+
 	return true;
 }
 
@@ -689,6 +961,8 @@ static bool CreateProcAttributesForExplicitHandleInheritance(
 	/*out    */ ProcessCreationAttributes& attr
 ) {
 
+	attr.handles.clear();
+
 	if (hStdInput != INVALID_HANDLE_VALUE) {
 		attr.handles.push_back(hStdInput);
 	}
@@ -744,6 +1018,12 @@ static CreateDetouredProcessStatus CreateProcessAttributes(
     /*in     */ bool addProcessToSilo,
 	/*out    */ ProcessCreationAttributes& processCreationAttributes) {
 
+	if (processCreationAttributes.Matches(hStdInput, hStdOutput, hStdError, processCreationAttributes.hJob, addProcessToSilo))
+	{
+		// Reused as is from a process created with the same configuration.
+		return CreateDetouredProcessStatus::Succeeded;
+	}
+
 	if (!InitializeAttributeList(processCreationAttributes, addProcessToSilo))
 	{
 		Dbg(L"Failed initializing attribute list");
@@ -821,7 +1101,13 @@ static CreateDetouredProcessStatus CreateProcessAttributes(
 			return CreateDetouredProcessStatus::AddProcessToSiloFailed;
 		}
 	}
-	
+
+	processCreationAttributes.populated = true;
+	processCreationAttributes.hStdInput = hStdInput;
+	processCreationAttributes.hStdOutput = hStdOutput;
+	processCreationAttributes.hStdError = hStdError;
+	processCreationAttributes.addProcessToSilo = addProcessToSilo;
+
 	return CreateDetouredProcessStatus::Succeeded;
 }
 
@@ -859,7 +1145,15 @@ CreateDetouredProcess(
     PROCESS_INFORMATION pi;
     ZeroMemory(&pi, sizeof(pi));
 
-	ProcessCreationAttributes processCreationAttributes = ProcessCreationAttributes(hJob);
+    LARGE_INTEGER attributesStart;
+    QueryPerformanceCounter(&attributesStart);
+
+	ProcessCreationAttributesPtr processCreationAttributes = AcquireProcessCreationAttributes(
+		hStdInput,
+		hStdOutput,
+		hStdError,
+		hJob,
+		addProcessToSilo);
     
 	CreateDetouredProcessStatus createAttributesStatus = CreateProcessAttributes(
 		hStdInput, 
@@ -868,14 +1162,16 @@ CreateDetouredProcess(
 		lpcwCommandLine,
         dwCreationFlags,
         addProcessToSilo,
-		/*in out*/ processCreationAttributes);
+		/*in out*/ *processCreationAttributes);
 
 	if (createAttributesStatus != CreateDetouredProcessStatus::Succeeded)
 	{
 		return createAttributesStatus;
 	}
 
-    si.lpAttributeList = processCreationAttributes.attrList.get();
+    ULONG64 attributesMicroseconds = MicrosecondsSince(attributesStart);
+
+    si.lpAttributeList = processCreationAttributes->attrList.get();
 
     // Here we pass in the public CreateProcessW entry point as we are not within the
     // detour of CreateProcessW but rather doing one of our own.
@@ -889,10 +1185,13 @@ CreateDetouredProcess(
         lpEnvironment,
         lpcwWorkingDirectory,
         /* lpStartupInfo */ (STARTUPINFOW*)&si,
-        processCreationAttributes.hJob,
+        processCreationAttributes->hJob,
         injector,
         &pi,
-        CreateProcessW);
+        CreateProcessW,
+        attributesMicroseconds);
+
+    ReleaseProcessCreationAttributes(std::move(processCreationAttributes));
 
     *phProcess = pi.hProcess;
     *phThread = pi.hThread;
@@ -922,6 +1221,24 @@ static int __cdecl CrtDebugHook(int nReportType, wchar_t* szMsg, int* pnRet) {
 
 static bool DllProcessDetach()
 {
+    // Anything still sitting in the report buffer has to go out before the process is gone.
+    // This also turns buffering off, so the reports below are written directly.
+    FlushReportBuffer(true);
+
+    // Queued reports are all newer than the buffered ones.
+    DrainReportQueue(true);
+
+    // Debug messages are written on the report channel as well; they do not need to be ordered with the reports.
+    FlushDebugMessages(true);
+
+    // The summary goes out as a whole, after everything sent one by one.
+    FlushAccessSummary(true);
+
+    // Everything this process sends is counted by now, apart from its process data.
+    PublishFinalLiveCounters();
+
+    FlushPolicyInputCapture();
+
     if (ShouldLogProcessData())
     {
         FILETIME creationTime;
@@ -961,12 +1278,8 @@ static bool DllProcessDetach()
 
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT	
     // Do some statistical information logging for different measurements
-    Dbg(L"Populate NtClose pool list entries time: %d ms.", g_msTimeToPopulatePoolList);
     Dbg(L"Pip execution time: %d ms.", (LONG)(GetTickCount64() - g_pipExecutionStart));
     Dbg(L"NtCloseHandle call times: %d", g_ntCloseHandeCount);
-    Dbg(L"Maxinum closed list count: %d", g_maxClosedListCount);
-    Dbg(L"Time adding to closed list: %d ms.", g_msTimeInAddClosedList);
-    Dbg(L"Time removing from closed list: %d ms.", g_msTimeInRemoveClosedList);
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
 
     return TRUE;
@@ -987,6 +1300,7 @@ static bool DllProcessDetach()
 
     if (g_hPrivateHeap != nullptr)
     {
+        dd_reset_pools();
         HeapDestroy(g_hPrivateHeap);
     }
 
@@ -1039,6 +1353,7 @@ static bool DllProcessAttach()
 
     // One-time init for the Detours library.
     DetourInit();
+    InitializeDetoursEvents();
 
     // Debug hook for CRT-sourced failures, e.g. heap corruption detection.
     // Causes a debugger break (or post-mortem launch) instead of showing a modal dialog.
@@ -1069,20 +1384,90 @@ static bool DllProcessAttach()
     }
 
     g_invariantLocale = _wcreate_locale(LC_CTYPE, L"");
+    InitProcessNameAndCommandLine();
     InitProcessKind();
-    InitializeHandleOverlay();
 
-#define ATTACH(Name) \
+    LARGE_INTEGER phaseStart;
+    QueryPerformanceCounter(&phaseStart);
+    InitializeHandleOverlay();
+    AdoptInheritedHandleOverlays();
+    g_detoursAttachHandleOverlayMicroseconds = (LONG64)MicrosecondsSince(phaseStart);
+
+    InitializeReportSequence();
+    InitializeAccessBitmap();
+    InitializeLiveCounters();
+    InitializeLookupProfile();
+    ApplyProcessPriorityToCurrentProcess();
+    InitializeMemoryPressureMonitor();
+    InitializePolicyInputCapture();
+    InitializeMaterialization();
+    InitializeReportBuffer();
+    InitializeReportRing();
+    InitializeReportQueue();
+    InitializeDebugMessageRing();
+    InitializeSharedReportCache();
+
+    // This process has the device map of the pip, applied by its parent, and passes it on to the processes it creates.
+    g_pDetouredProcessInjector->SetDeviceMapInherited(InheritDeviceMap());
+
+// Detours Name with the given detour rather than Detoured_<Name>.
+#define ATTACH_AS(Name, Detour) \
     Real_##Name = ::Name; \
-    error = DetourAttach((PVOID*)&Real_##Name, Detoured_##Name); \
+    error = DetourAttach((PVOID*)&Real_##Name, (PVOID)(Detour)); \
     if (error != ERROR_SUCCESS) { \
         Dbg(L"Failed to attach to function: " L#Name); \
         failed = true; \
     }
+// end #define ATTACH_AS
+
+#define ATTACH(Name) \
+    ATTACH_AS(Name, Detoured_##Name)
 // end #define ATTACH
 
+// Leaves Real_<Name> pointing at the real function without detouring it.
+#define SKIP_ATTACH(Name) \
+    Real_##Name = ::Name;
+// end #define SKIP_ATTACH
+
+// Detours that only ever call through to the real function given the manifest are left out with OmitPassThroughDetours,
+// as every attached function adds to the cost of the transaction. Picking them here rather than detouring them lazily on
+// first use keeps the transaction the only place where code gets patched and avoids suspending threads later on.
+#define ATTACH_UNLESS_PASS_THROUGH(Name, isPassThrough) \
+    if (OmitPassThroughDetours() && (isPassThrough)) { \
+        SKIP_ATTACH(Name) \
+    } \
+    else { \
+        ATTACH(Name) \
+    }
+// end #define ATTACH_UNLESS_PASS_THROUGH
+
+// With DetourNtLayerOnly, the Win32 functions that reach the file system through the detoured ntdll functions are left out,
+// so that their calls are canonicalized, checked and reported once, by the ntdll detours, instead of by both layers.
+#define ATTACH_UNLESS_NT_LAYER_ONLY(Name) \
+    if (ntLayerOnly) { \
+        SKIP_ATTACH(Name) \
+        IncrementFeatureCounter(FeatureCounter::Win32DetoursLeftOut); \
+    } \
+    else { \
+        ATTACH(Name) \
+    }
+// end #define ATTACH_UNLESS_NT_LAYER_ONLY
+
     bool failed = false;
 
+    // The ntdll detours only enforce the manifest on their own with these flags.
+    bool ntLayerOnly = DetourNtLayerOnly()
+        && MonitorNtCreateFile()
+        && MonitorZwCreateOpenQueryFile()
+        && !IgnoreZwRenameFileInformation()
+        && !IgnoreZwOtherFileInformation();
+
+    QueryPerformanceCounter(&phaseStart);
+
+    // The parent detoured the same functions, most likely at the same addresses: let the attaches take their prologues
+    // from there rather than disassembling them again.
+    DetourSetPrologueCache(g_pDetouredProcessInjector->PrologueCache(), g_pDetouredProcessInjector->PrologueCacheSize());
+
     error = DetourTransactionBegin();
     if (error != NO_ERROR) {
         Dbg(L"DetourTransactionBegin() failed.  Cannot detour file access.");
@@ -1096,10 +1481,21 @@ static bool DllProcessAttach()
         ATTACH(CreateProcessW);
 
         if (GetProcessKind() != SpecialProcessKind::WinDbg) {
-            ATTACH(CreateFileW);
-            ATTACH(CreateFileA);
-       
+            if (ntLayerOnly) {
+                SKIP_ATTACH(CreateFileW);
+                IncrementFeatureCounter(FeatureCounter::Win32DetoursLeftOut);
+            }
+            else {
+                // The flags never change in this process, so the hottest detours are attached in the variant that has them folded in.
+                ATTACH_AS(CreateFileW, SelectDetoured_CreateFileW());
+            }
+
+            ATTACH_UNLESS_NT_LAYER_ONLY(CreateFileA);
+
             ATTACH(GetVolumePathNameW);
+
+            // Attributes are queried with NtQueryAttributesFile and NtQueryFullAttributesFile, which are only detoured to redirect
+            // the temp directory (see below).
             ATTACH(GetFileAttributesA);
             ATTACH(GetFileAttributesW);
             ATTACH(GetFileAttributesExW);
@@ -1107,55 +1503,58 @@ static bool DllProcessAttach()
 
             ATTACH(GetFileInformationByHandle);
             ATTACH(GetFileInformationByHandleEx);
-            ATTACH(SetFileInformationByHandle);
+            // Renames and deletes through it also invalidate the caches of reparse points and known directories.
+            ATTACH_UNLESS_PASS_THROUGH(SetFileInformationByHandle, IgnoreSetFileInformationByHandle() && !CacheReparsePointProbes() && !CacheKnownDirectories());
 
             ATTACH(CopyFileW);
             ATTACH(CopyFileA);
             ATTACH(CopyFileExW);
             ATTACH(CopyFileExA);
-            ATTACH(MoveFileW);
-            ATTACH(MoveFileA);
-            ATTACH(MoveFileExW);
-            ATTACH(MoveFileExA);
-            ATTACH(MoveFileWithProgressW);
-            ATTACH(MoveFileWithProgressA);
-            ATTACH(ReplaceFileW);
-            ATTACH(ReplaceFileA);
-            ATTACH(DeleteFileA);
-            ATTACH(DeleteFileW);
-
-            ATTACH(CreateHardLinkW);
-            ATTACH(CreateHardLinkA);
+            ATTACH_UNLESS_NT_LAYER_ONLY(MoveFileW);
+            ATTACH_UNLESS_NT_LAYER_ONLY(MoveFileA);
+            ATTACH_UNLESS_NT_LAYER_ONLY(MoveFileExW);
+            ATTACH_UNLESS_NT_LAYER_ONLY(MoveFileExA);
+            ATTACH_UNLESS_NT_LAYER_ONLY(MoveFileWithProgressW);
+            ATTACH_UNLESS_NT_LAYER_ONLY(MoveFileWithProgressA);
+            ATTACH_UNLESS_PASS_THROUGH(ReplaceFileW, !CacheReparsePointProbes());
+            ATTACH_UNLESS_PASS_THROUGH(ReplaceFileA, !CacheReparsePointProbes());
+            ATTACH_UNLESS_NT_LAYER_ONLY(DeleteFileA);
+            ATTACH_UNLESS_NT_LAYER_ONLY(DeleteFileW);
+
+            ATTACH_UNLESS_NT_LAYER_ONLY(CreateHardLinkW);
+            ATTACH_UNLESS_NT_LAYER_ONLY(CreateHardLinkA);
             ATTACH(CreateSymbolicLinkW);
             ATTACH(CreateSymbolicLinkA);
-            ATTACH(FindFirstFileW);
-            ATTACH(FindFirstFileA);
-            ATTACH(FindFirstFileExW);
-            ATTACH(FindFirstFileExA);
-            ATTACH(FindNextFileW);
-            ATTACH(FindNextFileA);
-            ATTACH(FindClose);
+            ATTACH_UNLESS_NT_LAYER_ONLY(FindFirstFileW);
+            ATTACH_UNLESS_NT_LAYER_ONLY(FindFirstFileA);
+            ATTACH_UNLESS_NT_LAYER_ONLY(FindFirstFileExW);
+            ATTACH_UNLESS_NT_LAYER_ONLY(FindFirstFileExA);
+            ATTACH_UNLESS_NT_LAYER_ONLY(FindNextFileW);
+            ATTACH_UNLESS_NT_LAYER_ONLY(FindNextFileA);
+            ATTACH_UNLESS_NT_LAYER_ONLY(FindClose);
             ATTACH(OpenFileMappingW);
             ATTACH(OpenFileMappingA);
             ATTACH(GetTempFileNameW);
             ATTACH(GetTempFileNameA);
-            ATTACH(CreateDirectoryW);
-            ATTACH(CreateDirectoryA);
-            ATTACH(CreateDirectoryExW);
-            ATTACH(CreateDirectoryExA);
-            ATTACH(RemoveDirectoryW);
-            ATTACH(RemoveDirectoryA);
-            ATTACH(DecryptFileW);
-            ATTACH(DecryptFileA);
-            ATTACH(EncryptFileW);
-            ATTACH(EncryptFileA);
-            ATTACH(OpenEncryptedFileRawW);
-            ATTACH(OpenEncryptedFileRawA);
+            ATTACH_UNLESS_NT_LAYER_ONLY(CreateDirectoryW);
+            ATTACH_UNLESS_NT_LAYER_ONLY(CreateDirectoryA);
+            ATTACH_UNLESS_NT_LAYER_ONLY(CreateDirectoryExW);
+            ATTACH_UNLESS_NT_LAYER_ONLY(CreateDirectoryExA);
+            ATTACH_UNLESS_NT_LAYER_ONLY(RemoveDirectoryW);
+            ATTACH_UNLESS_NT_LAYER_ONLY(RemoveDirectoryA);
+            ATTACH_UNLESS_PASS_THROUGH(SetCurrentDirectoryW, !CacheCurrentDirectory());
+            ATTACH_UNLESS_PASS_THROUGH(SetCurrentDirectoryA, !CacheCurrentDirectory());
+            ATTACH_UNLESS_PASS_THROUGH(DecryptFileW, true);
+            ATTACH_UNLESS_PASS_THROUGH(DecryptFileA, true);
+            ATTACH_UNLESS_PASS_THROUGH(EncryptFileW, true);
+            ATTACH_UNLESS_PASS_THROUGH(EncryptFileA, true);
+            ATTACH_UNLESS_PASS_THROUGH(OpenEncryptedFileRawW, true);
+            ATTACH_UNLESS_PASS_THROUGH(OpenEncryptedFileRawA, true);
             ATTACH(OpenFileById);
             ATTACH(GetFinalPathNameByHandleW);
             ATTACH(GetFinalPathNameByHandleA);
 
-            ATTACH(NtCreateFile);
+            ATTACH_AS(NtCreateFile, SelectDetoured_NtCreateFile());
             ATTACH(NtOpenFile);
             ATTACH(ZwCreateFile);
             ATTACH(ZwOpenFile);
@@ -1165,7 +1564,26 @@ static bool DllProcessAttach()
             // on the Detoured_NtClose for more information 
             // on this function.
             ATTACH(NtClose);
-            ATTACH(ZwSetInformationFile);
+            ATTACH(NtDuplicateObject);
+            ATTACH_UNLESS_PASS_THROUGH(ZwSetInformationFile, IgnoreZwRenameFileInformation() && IgnoreZwOtherFileInformation() && !CacheReparsePointProbes() && !CacheKnownDirectories() && !RedirectsTempDirectory());
+
+            // Only names are rewritten there; nothing is checked or reported.
+            if (RedirectsTempDirectory()) {
+                ATTACH(NtQueryAttributesFile);
+                ATTACH(NtQueryFullAttributesFile);
+            }
+            else {
+                SKIP_ATTACH(NtQueryAttributesFile);
+                SKIP_ATTACH(NtQueryFullAttributesFile);
+            }
+
+            // Writes are only observed to hash outputs, so NtWriteFile (the hottest function of many tools) is otherwise left alone.
+            if (HashOutputsWhileWriting()) {
+                ATTACH(NtWriteFile);
+            }
+            else {
+                SKIP_ATTACH(NtWriteFile);
+            }
         }
         else {
             Dbg(L"File detours are disabled while running inside of WinDbg. Child processes will still be detoured.");
@@ -1186,6 +1604,16 @@ static bool DllProcessAttach()
         return false;
     }
 
+    g_detoursAttachTransactionMicroseconds = (LONG64)MicrosecondsSince(phaseStart);
+    g_detoursAttachCachedPrologues = (LONG64)DetourGetPrologueCacheHits();
+
+    // Pass the prologues moved here on to the children. This replaces the cache from the parent, so Detours must let go of it first.
+    DetourSetPrologueCache(nullptr, 0);
+    vector<DETOUR_PROLOGUE_CACHE_ENTRY> prologues(DETOUR_PROLOGUE_CACHE_MAX_ENTRIES);
+    // Detours never records more than DETOUR_PROLOGUE_CACHE_MAX_ENTRIES of them.
+    prologues.resize(DetourGetPrologueCache(prologues.data(), static_cast<DWORD>(prologues.size())));
+    g_pDetouredProcessInjector->SetPrologueCache(prologues.data(), static_cast<uint32_t>(prologues.size()));
+
     //
     // File APIs successfully detoured.
     //
@@ -1197,10 +1625,15 @@ static bool DllProcessAttach()
         g_BreakOnAccessDenied = true;
     }
 
+#undef ATTACH_UNLESS_NT_LAYER_ONLY
+#undef ATTACH_UNLESS_PASS_THROUGH
+#undef SKIP_ATTACH
 #undef ATTACH
 
     g_isAttached = true;
 
+    ReopenCurrentDirectoryInTempDirectory();
+
     if (!IgnorePreloadedDlls())
     {
         HMODULE hMods[1024];
@@ -1268,6 +1701,9 @@ static bool DllProcessAttach()
 #elif defined(BUILDXL_NATIVES_LIBRARY) 
 static bool DllProcessAttach()
 {
+    // For the injections made from the BuildXL process.
+    InitializeDetoursEvents();
+
     g_hPrivateHeap = HeapCreate(0, 40960, 0); // Commit initially 40k of memory for the private heap.
     if (g_hPrivateHeap == nullptr)
     {
@@ -1333,6 +1769,11 @@ _In_ PVOID reserved)
 #endif // DETOURS_SERVICES_NATIVES_LIBRARY
         return FALSE;
 
+    case DLL_THREAD_DETACH:
+        // Hand the blocks cached by the exiting thread over to the other threads.
+        dd_release_thread_cache();
+        return TRUE;
+
     default:
         return TRUE;
     }
@@ -66,7 +66,8 @@ InternalCreateDetouredProcess(
     HANDLE hJob,
     DetouredProcessInjector *injector,
     LPPROCESS_INFORMATION lpProcessInformation,
-    CreateProcessW_t pfCreateProcessW
+    CreateProcessW_t pfCreateProcessW,
+    ULONG64 attributesMicroseconds = 0
 );
 
 CreateDetouredProcessStatus
@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "FeatureCounters.h"
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+volatile LONG64 g_featureCounters[(int)FeatureCounter::Count] = { 0 };
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+std::wstring FormatFeatureCounters()
+{
+    static wchar_t const* const s_counterNames[] = {
+#define GEN_FEATURE_COUNTER_NAME(name) L#name,
+        FOR_ALL_FEATURE_COUNTERS(GEN_FEATURE_COUNTER_NAME)
+#undef GEN_FEATURE_COUNTER_NAME
+    };
+
+    static_assert(_countof(s_counterNames) == (size_t)FeatureCounter::Count, "Every feature counter needs a name");
+
+    std::wstring field;
+    for (int i = 0; i < (int)FeatureCounter::Count; i++)
+    {
+        LONG64 value = g_featureCounters[i];
+        if (value == 0)
+        {
+            continue;
+        }
+
+        if (!field.empty())
+        {
+            field.push_back(L';');
+        }
+
+        field.append(s_counterNames[i]);
+        field.push_back(L',');
+        field.append(std::to_wstring((ULONG64)value));
+    }
+
+    return field;
+}
@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Counters of the optional features of the detours, by name.
+//
+// Most features behind a FileAccessManifestExtraFlag only show in what they leave out or do faster, so each one counts the
+// times it took effect (a report dropped, a probe answered without the file system, ...). The counters of a process are
+// reported in its process data (see ReportProcessData) as "Name,Value" pairs separated by ';', for the ones that are not 0,
+// and summed per pip into SandboxedProcessResult.ProcessDataCounters.
+//
+// Adding a counter only takes a line in FOR_ALL_FEATURE_COUNTERS and a call to IncrementFeatureCounter.
+
+#pragma once
+
+#include <string>
+
+#include "DataTypes.h"
+
+//
+// Higher-order macro that enumerates the feature counters.
+//
+#define FOR_ALL_FEATURE_COUNTERS(m) \
+    m(ReportsDeduplicated) \
+    m(SharedReportsDeduplicated) \
+    m(PathsTranslated) \
+    m(PerfectHashLookups) \
+    m(ProbesAnsweredFromManifest) \
+    m(TempPathsRedirected) \
+    m(ReparsePointCacheHits) \
+    m(ReportsQueued) \
+    m(FinalPathCacheHits) \
+    m(BlockCloneAttempts) \
+    m(BlockClonedCopies) \
+    m(TempFileNamesGenerated) \
+    m(LargeFetchSearches) \
+    m(CurrentDirectoryJoins) \
+    m(Win32DetoursLeftOut) \
+    m(MemoryPressureMonitorsStarted) \
+    m(PrioritiesLowered)
+
+#define GEN_FEATURE_COUNTER_ID(name) name,
+enum class FeatureCounter {
+    FOR_ALL_FEATURE_COUNTERS(GEN_FEATURE_COUNTER_ID)
+    Count
+};
+#undef GEN_FEATURE_COUNTER_ID
+
+extern volatile LONG64 g_featureCounters[(int)FeatureCounter::Count];
+
+inline void IncrementFeatureCounter(FeatureCounter counter)
+{
+    InterlockedIncrement64(&g_featureCounters[(int)counter]);
+}
+
+/// Formats the counters that are not 0 for the process data report. Contains no '|'.
+std::wstring FormatFeatureCounters();
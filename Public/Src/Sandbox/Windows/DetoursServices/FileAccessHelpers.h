@@ -5,10 +5,10 @@
 
 #include "stdafx.h"
 
-#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
 #include "globals.h"
 #include <string>
-#endif // if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#endif // if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
 
 #include "DataTypes.h"
 #include "PolicySearch.h"
@@ -19,6 +19,15 @@ typedef wchar_t const* StrType;
 typedef char const* StrType;
 #endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
 
+#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
+class FileOperationContext;
+
+// Set while this process captures the inputs of its policy evaluations (see PolicyInputCapture.h).
+extern bool g_policyInputCaptureActive;
+
+void CapturePolicyInput(FileOperationContext const& context);
+#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
+
 // Represents the (semi-)static context of a detoured call's eventual access to a file. This context includes that information
 // obtained directly from the calling process and the nature of the call in question (operation name, open mode, raw path, etc.)
 // Note that this context is meant to live within the operation's stack; it may contain a pointer to the non-canonical path as
@@ -33,6 +42,12 @@ public:
     DWORD CreationDisposition;
     DWORD FlagsAndAttributes;
 
+    // Identity of the accessed file, when a detour learned it without asking for it (see FileAccessReportRecord::FileIdLow).
+    // All zeros otherwise.
+    uint64_t VolumeSerialNumber = 0;
+    uint64_t FileIdLow = 0;
+    uint64_t FileIdHigh = 0;
+
     FileOperationContext(
         StrType lpOperation,
         DWORD dwDesiredAccess,
@@ -46,7 +61,15 @@ public:
         ShareMode(dwShareMode),
         CreationDisposition(dwCreationDisposition),
         FlagsAndAttributes(dwFlagsAndAttributes)
-    {}
+    {
+#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
+        // Every file operation the detours evaluate a policy for starts with its context.
+        if (g_policyInputCaptureActive)
+        {
+            CapturePolicyInput(*this);
+        }
+#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
+    }
     
     // Creates a call context for an operation on a path that reads existing content.
     // (this fills in convincing CreateFile-like parameters).
@@ -269,13 +292,13 @@ public:
     AccessCheckResult(const AccessCheckResult& other) = default;
     AccessCheckResult& operator=(const AccessCheckResult&) = default;
 
-#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
     // Calls SetLastError with DenialError.
     // It is an error to call this method when ResultAction is not ResultAction::Deny.
     void SetLastErrorToDenialError() const {
         SetLastError(DenialError());
     }
-#endif // !(MAC_OS_SANDBOX)
+#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
 };
 
 enum PathType {
@@ -293,15 +316,40 @@ enum PathType {
 // INLINE FUNCTION DEFINITIONS
 // ----------------------------------------------------------------------------
 
-#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
 
 #define GEN_CHECK_GLOBAL_FAM_FLAG(flag_name, flag_value) \
 inline bool flag_name()         { return Check##flag_name(g_fileAccessManifestFlags); } \
 inline bool Should##flag_name() { return Check##flag_name(g_fileAccessManifestFlags); }
 
 FOR_ALL_FAM_FLAGS(GEN_CHECK_GLOBAL_FAM_FLAG)
+
+#define GEN_CHECK_GLOBAL_FAM_EXTRA_FLAG(flag_name, flag_value) \
+inline bool flag_name()         { return Check##flag_name(g_fileAccessManifestExtraFlags); } \
+inline bool Should##flag_name() { return Check##flag_name(g_fileAccessManifestExtraFlags); }
+
+FOR_ALL_FAM_EXTRA_FLAGS(GEN_CHECK_GLOBAL_FAM_EXTRA_FLAG)
 inline bool ReportAnyAccess(bool accessDenied) { return CheckReportAnyAccess(g_fileAccessManifestFlags, accessDenied); }
 
+// FAM flags with values known at compile time, for the variants of the hottest detours specialized for the flags of the
+// process (see SelectDetoured_CreateFileW and SelectDetoured_NtCreateFile). TFamFlags::flag_name() is a constant for the
+// flags in KnownFlags, so that the compiler drops the branches they rule out, and reads the manifest like the accessors
+// above for the other flags.
+template <DWORD KnownFlags, DWORD FlagValues>
+struct SpecializedFamFlags
+{
+#define GEN_SPECIALIZED_FAM_FLAG(flag_name, flag_value) \
+    static inline bool flag_name() { return (KnownFlags & (flag_value)) != 0 ? (FlagValues & (flag_value)) != 0 : ::flag_name(); }
+
+    FOR_ALL_FAM_FLAGS(GEN_SPECIALIZED_FAM_FLAG)
+
+    /// Indicates if the flags of this process have the values this specialization assumes.
+    static inline bool Matches() { return ((DWORD)g_fileAccessManifestFlags & KnownFlags) == FlagValues; }
+};
+
+// Reads every flag from the manifest.
+typedef SpecializedFamFlags<0, 0> GenericFamFlags;
+
 inline LPCTSTR InternalDetoursErrorNotificationFile()
 {
     return g_internalDetoursErrorNotificationFile;
@@ -322,4 +370,4 @@ inline bool IsNullOrInvalidHandle(HANDLE h)
     return (h == NULL || h == INVALID_HANDLE_VALUE);
 }
 
-#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
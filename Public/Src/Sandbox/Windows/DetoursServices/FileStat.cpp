@@ -0,0 +1,218 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <winternl.h>
+
+#include "FileStat.h"
+#include "FileAccessHelpers.h"
+#include "ReparsePointCache.h"
+
+extern volatile LONG64 g_detoursFileStatQueries;
+extern volatile LONG64 g_detoursFileStatQueriesSaved;
+
+#ifndef STATUS_NOT_IMPLEMENTED
+#define STATUS_NOT_IMPLEMENTED ((NTSTATUS)0xC0000002L)
+#endif
+
+#ifndef STATUS_INVALID_INFO_CLASS
+#define STATUS_INVALID_INFO_CLASS ((NTSTATUS)0xC0000003L)
+#endif
+
+#ifndef STATUS_BUFFER_OVERFLOW
+#define STATUS_BUFFER_OVERFLOW ((NTSTATUS)0x80000005L)
+#endif
+
+// Values of FILE_INFORMATION_CLASS from wdm.h (see also FILE_INFORMATION_CLASS_EXTRA in DetouredFunctions.cpp).
+#define FILE_STAT_INFORMATION_CLASS ((FILE_INFORMATION_CLASS)68)
+#define FILE_ALL_INFORMATION_CLASS ((FILE_INFORMATION_CLASS)18)
+
+// From ntifs.h; FileStatInformation is available from Windows 10 1709.
+typedef struct _FILE_STAT_INFORMATION {
+    LARGE_INTEGER FileId;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER EndOfFile;
+    ULONG FileAttributes;
+    ULONG ReparseTag;
+    ULONG NumberOfLinks;
+    ACCESS_MASK EffectiveAccess;
+} FILE_STAT_INFORMATION;
+
+// From wdm.h and ntifs.h, up to the name of the file, which is not needed: the query fills in the rest and reports an overflow.
+typedef struct _FILE_ALL_INFORMATION_WITHOUT_NAME {
+    // FILE_BASIC_INFORMATION
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    ULONG FileAttributes;
+    // FILE_STANDARD_INFORMATION
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER EndOfFile;
+    ULONG NumberOfLinks;
+    BOOLEAN DeletePending;
+    BOOLEAN Directory;
+    // FILE_INTERNAL_INFORMATION
+    LARGE_INTEGER IndexNumber;
+    // FILE_EA_INFORMATION, FILE_ACCESS_INFORMATION, FILE_POSITION_INFORMATION, FILE_MODE_INFORMATION, FILE_ALIGNMENT_INFORMATION
+    ULONG EaSize;
+    ACCESS_MASK AccessFlags;
+    LARGE_INTEGER CurrentByteOffset;
+    ULONG Mode;
+    ULONG AlignmentRequirement;
+    // FILE_NAME_INFORMATION
+    ULONG FileNameLength;
+    WCHAR FileName[1];
+} FILE_ALL_INFORMATION_WITHOUT_NAME;
+
+typedef NTSTATUS(NTAPI *NtQueryInformationFile_t)(
+    HANDLE FileHandle,
+    PIO_STATUS_BLOCK IoStatusBlock,
+    PVOID FileInformation,
+    ULONG Length,
+    FILE_INFORMATION_CLASS FileInformationClass);
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+// NtQueryInformationFile is not detoured; it is looked up on first use.
+static NtQueryInformationFile_t volatile g_ntQueryInformationFile = nullptr;
+
+// Set once the system turned out not to know FileStatInformation, so that it is not asked again.
+static volatile bool g_fileStatInformationUnsupported = false;
+
+// ----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+// ----------------------------------------------------------------------------
+
+static NtQueryInformationFile_t GetNtQueryInformationFile()
+{
+    NtQueryInformationFile_t ntQueryInformationFile = g_ntQueryInformationFile;
+    if (ntQueryInformationFile == nullptr)
+    {
+        HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+        ntQueryInformationFile = ntdll != NULL
+            ? reinterpret_cast<NtQueryInformationFile_t>(GetProcAddress(ntdll, "NtQueryInformationFile"))
+            : nullptr;
+        g_ntQueryInformationFile = ntQueryInformationFile;
+    }
+
+    return ntQueryInformationFile;
+}
+
+static bool TryQueryFileStatInformation(NtQueryInformationFile_t ntQueryInformationFile, HANDLE handle, FileStat& stat)
+{
+    FILE_STAT_INFORMATION information;
+    IO_STATUS_BLOCK ioStatusBlock;
+    NTSTATUS status = ntQueryInformationFile(handle, &ioStatusBlock, &information, sizeof(information), FILE_STAT_INFORMATION_CLASS);
+    if (!NT_SUCCESS(status))
+    {
+        // File systems that do not support the class fail with other statuses, and are asked for FileAllInformation each time.
+        if (status == STATUS_INVALID_INFO_CLASS || status == STATUS_NOT_IMPLEMENTED)
+        {
+            g_fileStatInformationUnsupported = true;
+        }
+
+        return false;
+    }
+
+    stat.FileAttributes = information.FileAttributes;
+    stat.ReparseTag = information.ReparseTag;
+    stat.HasReparseTag = true;
+    stat.FileId = information.FileId;
+    stat.EndOfFile = information.EndOfFile;
+    return true;
+}
+
+static bool TryQueryFileAllInformation(NtQueryInformationFile_t ntQueryInformationFile, HANDLE handle, FileStat& stat)
+{
+    FILE_ALL_INFORMATION_WITHOUT_NAME information;
+    IO_STATUS_BLOCK ioStatusBlock;
+    NTSTATUS status = ntQueryInformationFile(handle, &ioStatusBlock, &information, sizeof(information), FILE_ALL_INFORMATION_CLASS);
+    if (!NT_SUCCESS(status) && status != STATUS_BUFFER_OVERFLOW)
+    {
+        return false;
+    }
+
+    stat.FileAttributes = information.FileAttributes;
+    stat.ReparseTag = 0;
+    stat.HasReparseTag = false;
+    stat.FileId = information.IndexNumber;
+    stat.EndOfFile = information.EndOfFile;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+bool TryQueryFileStat(HANDLE handle, _Out_ FileStat& stat)
+{
+    NtQueryInformationFile_t ntQueryInformationFile = GetNtQueryInformationFile();
+    if (ntQueryInformationFile == nullptr || IsNullOrInvalidHandle(handle))
+    {
+        return false;
+    }
+
+    DWORD lastError = GetLastError();
+    InterlockedIncrement64(&g_detoursFileStatQueries);
+
+    bool queried = (!g_fileStatInformationUnsupported && TryQueryFileStatInformation(ntQueryInformationFile, handle, stat))
+        || TryQueryFileAllInformation(ntQueryInformationFile, handle, stat);
+
+    SetLastError(lastError);
+    return queried;
+}
+
+FileStat const* OpenedFileStat::Get()
+{
+    if (m_queried)
+    {
+        if (m_valid)
+        {
+            InterlockedIncrement64(&g_detoursFileStatQueriesSaved);
+        }
+    }
+    else
+    {
+        m_queried = true;
+        m_generation = GetReparsePointCacheGeneration();
+        m_valid = TryQueryFileStat(m_handle, m_stat);
+    }
+
+    return m_valid ? &m_stat : nullptr;
+}
+
+bool OpenedFileStat::TryCheckReparsePoint(_Out_ bool& isReparsePoint)
+{
+    isReparsePoint = false;
+
+    FileStat const* stat = m_openedReparsePoint ? Get() : nullptr;
+    if (stat == nullptr)
+    {
+        return false;
+    }
+
+    isReparsePoint = stat->IsReparsePoint();
+    return true;
+}
+
+bool OpenedFileStat::TryCheckDirectory(bool treatReparsePointAsFile, _Out_ bool& isDirectory)
+{
+    isDirectory = false;
+
+    FileStat const* stat = Get();
+    if (stat == nullptr)
+    {
+        return false;
+    }
+
+    isDirectory = stat->IsDirectory(treatReparsePointAsFile);
+    return true;
+}
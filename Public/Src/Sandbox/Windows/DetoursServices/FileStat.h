@@ -0,0 +1,89 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Attributes of an opened file, read with a single query of its handle.
+//
+// After a successful open, the detours check whether the opened path is a reparse point and whether the handle is of a
+// directory, and the checks made later on the handle (renames, for instance) ask again. Each check used to query the file
+// system on its own: GetFileAttributesW on the path, or GetFileInformationByHandle on the handle, which itself takes two
+// queries. Instead, the handle is queried once, with NtQueryInformationFile(FileStatInformation) or, on systems or file
+// systems without it, NtQueryInformationFile(FileAllInformation), and the checks following the open share the result
+// (see OpenedFileStat). The result is kept on the HandleOverlay of the handle for the checks made later on it.
+//
+// The queries made and the ones saved are counted, and reported in the ProcessData report.
+
+#pragma once
+
+#include <windows.h>
+
+// ----------------------------------------------------------------------------
+// STRUCTS
+// ----------------------------------------------------------------------------
+
+struct FileStat
+{
+    DWORD FileAttributes;
+    // Only meaningful if HasReparseTag; FileAllInformation does not carry the tag.
+    DWORD ReparseTag;
+    bool HasReparseTag;
+    LARGE_INTEGER FileId;
+    LARGE_INTEGER EndOfFile;
+
+    bool IsReparsePoint() const { return (FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0; }
+
+    bool IsDirectory(bool treatReparsePointAsFile) const
+    {
+        bool isDirectory = (FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        return isDirectory && treatReparsePointAsFile ? !IsReparsePoint() : isDirectory;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Queries the attributes of the file of a handle. Fails if the handle was not opened with FILE_READ_ATTRIBUTES (or an access
+/// implying it), like GetFileInformationByHandle. Preserves the last error.
+bool TryQueryFileStat(HANDLE handle, _Out_ FileStat& stat);
+
+// ----------------------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------------------
+
+/// The attributes of a handle just opened, queried on first use by the checks that follow the open and shared among them.
+class OpenedFileStat
+{
+public:
+    /// The handle may be invalid, in which case nothing is ever queried. openedReparsePoint tells whether the handle was opened
+    /// with FILE_FLAG_OPEN_REPARSE_POINT / FILE_OPEN_REPARSE_POINT, i.e., whether it is of the opened path rather than of the
+    /// final target of the reparse points along it.
+    OpenedFileStat(HANDLE handle, bool openedReparsePoint)
+        : m_handle(handle), m_openedReparsePoint(openedReparsePoint), m_queried(false), m_valid(false), m_generation(0)
+    { }
+
+    /// Gets the attributes, querying them the first time. Null if there is no handle or the query failed.
+    FileStat const* Get();
+
+    /// Gets the attributes if they were queried already, without querying them. For the HandleOverlay of the handle.
+    FileStat const* GetIfQueried() const { return m_valid ? &m_stat : nullptr; }
+
+    /// The generation of the reparse point cache read before querying the attributes, to stamp what is derived from them with.
+    LONG GetGeneration() const { return m_generation; }
+
+    /// Checks whether the opened path is a reparse point. Fails if the handle is of the final target of the path.
+    bool TryCheckReparsePoint(_Out_ bool& isReparsePoint);
+
+    /// Checks whether the handle is of a directory.
+    bool TryCheckDirectory(bool treatReparsePointAsFile, _Out_ bool& isDirectory);
+
+private:
+    HANDLE m_handle;
+    bool m_openedReparsePoint;
+    bool m_queried;
+    bool m_valid;
+    LONG m_generation;
+    FileStat m_stat;
+
+    OpenedFileStat(const OpenedFileStat&) = delete;
+    OpenedFileStat& operator=(const OpenedFileStat&) = delete;
+};
@@ -2,50 +2,123 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include "stdafx.h"
+#include <unordered_map>
 #include "HandleOverlay.h"
-#include <map>
+#include "DetoursEvents.h"
+#include "DebuggingHelpers.h"
+#include "DetourStatistics.h"
 #include "buildXL_mem.h"
 
-// A pre-allocated list with entries to be used to accumulate the closed handles by NtClose.
-// During testing there were never more than 2 entries in this list on SelfHost and Office builds.
-// Allocating 1000 should be safe we are not skipping handles. If we need more than 1000,
-// a warning will be issued and the handle will not removed from the fie handle map.
-// In such case we will behave exactly as we behave now - without this change we don't remove any handles from the map.
-// If the list is full we will not remove the handle from the map. If that happens, increase the preallocated list size.
-#define CLOSED_HANDLES_POOL_ENTRIES 2000
-#define NT_CLOSE_CLEANUP_THRESHOLD 500
-#define LARGE_LIST_MULTIPLIER 20
+// The overlay map is split into shards, each an open-addressing hash table with its own lock, so that threads
+// working on different handles rarely contend. Lookups take the shard lock shared.
+// Note that the lock cannot be avoided entirely for lookups: copying a HandleOverlayRef races with another thread
+// replacing or removing it.
+//
+// NtClose is the exception: it is called by RtlFreeHeap while holding the heap lock, and freeing an overlay under the
+// shard lock takes the heap lock, so NtClose must never wait for a shard lock. Instead it marks the slot of the handle
+// closed without any lock (see HandleOverlayShard::MarkClosed), and the writers holding the shard lock reclaim the slot
+// and release its overlay later. A rehash may free the slot array NtClose is reading, so each shard counts the NtClose
+// calls in flight, and the arrays a rehash replaces are only freed once a writer sees no NtClose in flight.
+#define HANDLE_OVERLAY_SHARD_COUNT 16
+#define HANDLE_OVERLAY_SHARD_INITIAL_CAPACITY 64
+
+// Slot keys that are never valid handle values (handles are multiples of 4, except for legacy console handles ending in binary 11).
+#define HANDLE_OVERLAY_EMPTY_SLOT ((HANDLE)nullptr)
+#define HANDLE_OVERLAY_DELETED_SLOT ((HANDLE)(ULONG_PTR)1)
+
+// Number of interned policies at which the ones no overlay references anymore are dropped for the first time. Later purges
+// happen when the table has doubled since the last one.
+#define HANDLE_POLICY_INITIAL_PURGE_THRESHOLD 256
+
+// Version of the snapshot of inherited overlays a parent copies into a child (see CopyInheritableHandleOverlaysToProcess).
+#define INHERITED_HANDLE_OVERLAYS_VERSION 2
 
 bool g_initialized;
-CRITICAL_SECTION g_handleOverlayLock;
 
-class HandleOverlayMap;
-HandleOverlayMap* g_handleOverlayMap;
-PSLIST_HEADER g_pClosedHandles = nullptr;
+class HandleOverlayShard;
+HandleOverlayShard* g_handleOverlayShards;
 
-// Used to pre-create entries for closed handles in NtClose, 
-// so we can clean them from the overlay map when it is safe to get the lock.
-PSLIST_HEADER g_pClosedHandlesPool = nullptr;
-
-extern volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries;
 extern volatile LONG64 g_detoursMaxHandleHeapEntries;
 extern volatile LONG64 g_detoursHandleHeapEntries;
+extern volatile LONG64 g_detoursHandleOverlayContendedWrites;
+extern volatile LONG64 g_detoursHandleOverlayContendedReads;
+
+struct HandleOverlaySlot {
+    HANDLE Key;
+    // Set by NtClose for a live slot. The slot then counts as deleted, but keeps its key and overlay until a writer reclaims it.
+    volatile LONG Closed;
+    HandleOverlayRef Value;
+};
+
+// Slot array of a shard, with its capacity so that NtClose reads both at once.
+struct HandleOverlaySlotTable {
+    size_t Capacity;
+    HandleOverlaySlot* Slots;
+    // Next table replaced by a rehash that NtClose may still be reading.
+    HandleOverlaySlotTable* NextRetired;
+};
 
-static volatile LONG g_usedPoolEntries = 0;
+// Fibonacci hashing of the handle value. The low two bits of a handle carry no information.
+static inline uint64_t HashHandle(HANDLE handle) {
+    return ((uint64_t)(ULONG_PTR)handle >> 2) * 0x9E3779B97F4A7C15ull;
+}
 
-typedef struct _HANDLE_TO_CLOSE {
-    SLIST_ENTRY ItemEntry;
-    HANDLE Handle;
-} HANDLE_TO_CLOSE, *PHANDLE_TO_CLOSE;
+static inline bool IsLiveSlot(HandleOverlaySlot const& slot) {
+    return slot.Key != HANDLE_OVERLAY_EMPTY_SLOT && slot.Key != HANDLE_OVERLAY_DELETED_SLOT && !slot.Closed;
+}
 
-class HandleOverlayMap {
+// One shard of the overlay map: an open-addressing (linear probing) hash table keyed by handle value.
+// Removed entries leave a tombstone behind, which is reclaimed when the table is rehashed. Closed slots (marked by NtClose)
+// are tombstones that still hold their overlay: they are reused by insertions and dropped by rehashes.
+// All members but MarkClosed must be called with the shard lock held (shared for lookups, exclusive otherwise).
+class HandleOverlayShard {
 public:
-    void MapRegisterHandleOverlay(HANDLE handle, HandleOverlayRef& newRef) {
-        
-        // Now, insert (move-assign to empty) or replace (destruct then move-assign). Note that despite perhaps
-        // holding g_handleOverlayLock, we require here that shared_ptr is thread safe for refcount changes (as documented).
-        // When destructing, we need to atomically decrement the ref-count ; some other routine may still be using another ref to the same overlay.
-        m_map[handle] = std::move(newRef);
+    void Initialize() {
+        InitializeSRWLock(&m_lock);
+        m_table = nullptr;
+        m_retiredTables = nullptr;
+        m_lockFreeReaders = 0;
+        m_count = 0;
+        m_used = 0;
+    }
+
+    SRWLOCK* GetLock() {
+        return &m_lock;
+    }
+
+    void MapRegisterHandleOverlay(HANDLE handle, uint64_t hash, HandleOverlayRef& newRef) {
+        if (handle == HANDLE_OVERLAY_EMPTY_SLOT || handle == HANDLE_OVERLAY_DELETED_SLOT) {
+            return;
+        }
+
+        size_t index = FindSlot(m_table, handle, hash);
+        if (index != NotFound) {
+            // Replace (destruct then move-assign). Note that despite holding the shard lock, we require here that shared_ptr is
+            // thread safe for refcount changes (as documented). When destructing, we need to atomically decrement the ref-count;
+            // some other routine may still be using another ref to the same overlay.
+            m_table->Slots[index].Value = std::move(newRef);
+            return;
+        }
+
+        // Keep the load (including tombstones) at or below 3/4 so that probe sequences stay short.
+        if (m_table == nullptr || (m_used + 1) * 4 > m_table->Capacity * 3) {
+            Rehash(m_count + 1);
+        }
+
+        index = FindInsertionSlot(m_table, hash);
+        HandleOverlaySlot& slot = m_table->Slots[index];
+        if (slot.Key == HANDLE_OVERLAY_EMPTY_SLOT) {
+            m_used++;
+        }
+        else if (slot.Closed) {
+            // Reclaim a slot closed by NtClose; its overlay is released by the assignment below.
+            slot.Closed = 0;
+            RemoveEntry();
+        }
+
+        slot.Key = handle;
+        slot.Value = std::move(newRef);
+        m_count++;
 
         // If we are tracking process data, track also the HandleOverlay map entries.
         if (ShouldLogProcessData())
@@ -62,287 +135,556 @@ public:
         }
     }
 
-    HandleOverlayRef TryLookupHandleOverlay(HANDLE handle) {
-        auto iter = m_map.find(handle);
-        if (iter == m_map.end()) {
+    HandleOverlayRef TryLookupHandleOverlay(HANDLE handle, uint64_t hash) {
+        size_t index = FindSlot(m_table, handle, hash);
+        if (index == NotFound) {
             return HandleOverlayRef();
         }
         else {
             // Create a new ref (refcount increases) via copy-construction of the existing one.
-            return HandleOverlayRef(iter->second);
+            return HandleOverlayRef(m_table->Slots[index].Value);
         }
     }
 
-    void CloseHandleOverlay(HANDLE handle) {
-        size_t removed = m_map.erase(handle);
-        if (removed != 0 && ShouldLogProcessData())
-        {
-            InterlockedAdd64(&g_detoursHandleHeapEntries, -((LONG64)removed));
+    bool CloseHandleOverlay(HANDLE handle, uint64_t hash) {
+        size_t index = FindSlot(m_table, handle, hash);
+        if (index == NotFound) {
+            return false;
+        }
+
+        m_table->Slots[index].Key = HANDLE_OVERLAY_DELETED_SLOT;
+        m_table->Slots[index].Value.reset();
+        RemoveEntry();
+        return true;
+    }
+
+    // Appends the handles with an overlay in this shard, with their overlays.
+    void CollectLiveEntries(std::vector<std::pair<HANDLE, HandleOverlayRef>>& entries) {
+        for (size_t i = 0; m_table != nullptr && i < m_table->Capacity; i++) {
+            HandleOverlaySlot const& slot = m_table->Slots[i];
+            if (IsLiveSlot(slot)) {
+                entries.emplace_back(slot.Key, slot.Value);
+            }
         }
     }
 
+    // Marks the slot of a handle closed, without the shard lock. It neither waits, allocates nor frees, so it is safe from NtClose.
+    // Since the handle is only closed afterwards, its value cannot be reused (and registered again) before it is marked.
+    bool MarkClosed(HANDLE handle, uint64_t hash) {
+        // Announce the read before loading the table, so that a rehash does not free it under us.
+        InterlockedIncrement(&m_lockFreeReaders);
+
+        bool found = false;
+        HandleOverlaySlotTable* table = (HandleOverlaySlotTable*)InterlockedCompareExchangePointer((PVOID volatile*)&m_table, nullptr, nullptr);
+        while (true) {
+            size_t index = FindSlot(table, handle, hash);
+            if (index != NotFound) {
+                InterlockedExchange(&table->Slots[index].Closed, 1);
+                found = true;
+            }
+
+            // A rehash may have copied the slot into a new table before it got marked: mark it there too.
+            HandleOverlaySlotTable* current = (HandleOverlaySlotTable*)InterlockedCompareExchangePointer((PVOID volatile*)&m_table, nullptr, nullptr);
+            if (current == table) {
+                break;
+            }
+
+            table = current;
+        }
+
+        InterlockedDecrement(&m_lockFreeReaders);
+        return found;
+    }
+
 private:
-    std::map<HANDLE, HandleOverlayRef> m_map;
+    static const size_t NotFound = (size_t)-1;
+
+    static inline size_t StartIndex(HandleOverlaySlotTable const* table, uint64_t hash) {
+        // The top bits of the hash select the shard; use the next ones for the slot.
+        return (size_t)(hash >> 32) & (table->Capacity - 1);
+    }
+
+    static size_t FindSlot(HandleOverlaySlotTable const* table, HANDLE handle, uint64_t hash) {
+        if (table == nullptr || handle == HANDLE_OVERLAY_EMPTY_SLOT || handle == HANDLE_OVERLAY_DELETED_SLOT) {
+            return NotFound;
+        }
+
+        size_t capacity = table->Capacity;
+        for (size_t i = StartIndex(table, hash), probes = 0; probes < capacity; i = (i + 1) & (capacity - 1), probes++) {
+            HandleOverlaySlot const& slot = table->Slots[i];
+            if (slot.Key == handle && !slot.Closed) {
+                return i;
+            }
+
+            if (slot.Key == HANDLE_OVERLAY_EMPTY_SLOT) {
+                return NotFound;
+            }
+        }
+
+        return NotFound;
+    }
+
+    // Returns the first empty, deleted or closed slot on the probe sequence. The table must have room.
+    static size_t FindInsertionSlot(HandleOverlaySlotTable const* table, uint64_t hash) {
+        size_t i = StartIndex(table, hash);
+        while (IsLiveSlot(table->Slots[i])) {
+            i = (i + 1) & (table->Capacity - 1);
+        }
+
+        return i;
+    }
+
+    void RemoveEntry() {
+        m_count--;
+
+        if (ShouldLogProcessData())
+        {
+            InterlockedDecrement64(&g_detoursHandleHeapEntries);
+        }
+    }
+
+    // Moves the live entries into a table sized for the given number of entries, dropping all tombstones and closed slots.
+    void Rehash(size_t entries) {
+        size_t capacity = HANDLE_OVERLAY_SHARD_INITIAL_CAPACITY;
+        while (entries * 2 > capacity) {
+            capacity *= 2;
+        }
+
+        HandleOverlaySlotTable* oldTable = m_table;
+
+        HandleOverlaySlotTable* table = new HandleOverlaySlotTable();
+        table->Capacity = capacity;
+        table->Slots = new HandleOverlaySlot[capacity]();
+        table->NextRetired = nullptr;
+
+        size_t count = 0;
+        for (size_t i = 0; oldTable != nullptr && i < oldTable->Capacity; i++) {
+            HandleOverlaySlot& oldSlot = oldTable->Slots[i];
+            HANDLE key = oldSlot.Key;
+            if (key == HANDLE_OVERLAY_EMPTY_SLOT || key == HANDLE_OVERLAY_DELETED_SLOT) {
+                continue;
+            }
+
+            // An NtClose may mark the old slot right after it is read here; it then marks the copy too once it sees the new table.
+            if (oldSlot.Closed) {
+                oldSlot.Value.reset();
+                RemoveEntry();
+                continue;
+            }
+
+            size_t index = FindInsertionSlot(table, HashHandle(key));
+            table->Slots[index].Key = key;
+            table->Slots[index].Value = std::move(oldSlot.Value);
+            count++;
+        }
+
+        m_count = count;
+        m_used = count;
+        InterlockedExchangePointer((PVOID volatile*)&m_table, table);
+
+        if (oldTable != nullptr) {
+            oldTable->NextRetired = m_retiredTables;
+            m_retiredTables = oldTable;
+        }
+
+        FreeRetiredTables();
+    }
+
+    // Frees the tables replaced by rehashes, unless an NtClose may still be reading one. An NtClose that starts after the
+    // reader count is seen at zero loads the current table, which is never retired here.
+    void FreeRetiredTables() {
+        if (m_retiredTables == nullptr || InterlockedCompareExchange(&m_lockFreeReaders, 0, 0) != 0) {
+            return;
+        }
+
+        while (m_retiredTables != nullptr) {
+            HandleOverlaySlotTable* table = m_retiredTables;
+            m_retiredTables = table->NextRetired;
+            delete[] table->Slots;
+            delete table;
+        }
+    }
+
+    SRWLOCK m_lock;
+    HandleOverlaySlotTable* volatile m_table;
+    // Only touched by writers.
+    HandleOverlaySlotTable* m_retiredTables;
+    // Number of MarkClosed calls in flight.
+    volatile LONG m_lockFreeReaders;
+    // Live entries, plus closed slots not reclaimed yet.
+    size_t m_count;
+    // Occupied slots, including tombstones.
+    size_t m_used;
 };
 
-// Holds g_handleOverlayLock
+// Holds the lock of the shard a handle belongs to.
+// Acquisitions that have to wait are counted, so that lock contention shows up in the process data report. The time the lock
+// is waited for and held is accounted to DetourOverheadCategory::HandleOverlayLock.
 struct HandleOverlayLockGuard {
-    HandleOverlayLockGuard() {
+    HandleOverlayLockGuard(uint64_t hash, bool exclusive)
+        : m_overhead(DetourOverheadCategory::HandleOverlayLock), m_exclusive(exclusive)
+    {
         assert(g_initialized);
-        EnterCriticalSection(&g_handleOverlayLock);
+        assert(g_handleOverlayShards != nullptr);
+        m_shard = &g_handleOverlayShards[(size_t)(hash >> 60) & (HANDLE_OVERLAY_SHARD_COUNT - 1)];
+
+        SRWLOCK* lock = m_shard->GetLock();
+        if (m_exclusive) {
+            if (!TryAcquireSRWLockExclusive(lock)) {
+                if (ShouldLogProcessData()) {
+                    InterlockedIncrement64(&g_detoursHandleOverlayContendedWrites);
+                }
+
+                AcquireSRWLockExclusive(lock);
+            }
+        }
+        else {
+            if (!TryAcquireSRWLockShared(lock)) {
+                if (ShouldLogProcessData()) {
+                    InterlockedIncrement64(&g_detoursHandleOverlayContendedReads);
+                }
+
+                AcquireSRWLockShared(lock);
+            }
+        }
     }
 
     ~HandleOverlayLockGuard() {
-        LeaveCriticalSection(&g_handleOverlayLock);
+        if (m_exclusive) {
+            ReleaseSRWLockExclusive(m_shard->GetLock());
+        }
+        else {
+            ReleaseSRWLockShared(m_shard->GetLock());
+        }
     }
 
-    // This is a member function to make sure we always get the map inside a lock.
-    inline HandleOverlayMap* GetGlobalOverlayMap() {
-        assert(g_handleOverlayMap != nullptr);
-        return g_handleOverlayMap;
+    // This is a member function to make sure we always get the shard inside a lock.
+    inline HandleOverlayShard* GetShard() {
+        return m_shard;
     }
+
+private:
+    // First, so that it is ended after the lock is released.
+    DetourOverheadScope m_overhead;
+    HandleOverlayShard* m_shard;
+    bool m_exclusive;
 };
 
-static void PopulateNtCloseListPool()
-{
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-   ULONGLONG startTime = GetTickCount64();
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    unsigned allocationSize = CLOSED_HANDLES_POOL_ENTRIES;
-    if (UseLargeNtClosePreallocatedList())
+void InitializeHandleOverlay() {
+
+    assert(!g_initialized);
+    // Always create the shards. This is called from DllAttach, so it is inside a lock already.
+    // Doing it here, we save check and creating the map inside the lookups. The slot tables themselves are allocated on first use.
+    g_handleOverlayShards = new HandleOverlayShard[HANDLE_OVERLAY_SHARD_COUNT];
+    for (int i = 0; i < HANDLE_OVERLAY_SHARD_COUNT; i++)
     {
-        // Allocate a large list.
-        allocationSize *= LARGE_LIST_MULTIPLIER;
+        g_handleOverlayShards[i].Initialize();
     }
 
-    for (unsigned i = 0; i < allocationSize; i++)
-    {
-        PHANDLE_TO_CLOSE pPoolHandleEntry = (PHANDLE_TO_CLOSE)_dd_aligned_malloc(sizeof(HANDLE_TO_CLOSE), MEMORY_ALLOCATION_ALIGNMENT);
-        if (pPoolHandleEntry == nullptr)
-        {
-            Dbg(L"Memory alloc failed for g_pClosedHandlesPool node 0x%p", g_pClosedHandlesPool);
-        }
-        else
-        {
-            pPoolHandleEntry->Handle = INVALID_HANDLE_VALUE;
+    g_initialized = true;
+}
 
-            // Populate the pool
-            InterlockedPushEntrySList(g_pClosedHandlesPool, &(pPoolHandleEntry->ItemEntry));
-            InterlockedIncrement(&g_detoursAllocatedNoLockConcurentPoolEntries);
-        }
+bool HandleOverlay::TryGetFinalPath(LONG generation, std::wstring& finalPath) {
+    bool found = false;
+
+    AcquireSRWLockShared(&FinalPathLock);
+    if (HasFinalPath && FinalPathGeneration == generation) {
+        finalPath.assign(FinalPath);
+        found = true;
     }
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG endTime = GetTickCount64();
-    InterlockedExchangeAdd(&g_msTimeToPopulatePoolList, (LONG)(endTime - startTime));
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
+    ReleaseSRWLockShared(&FinalPathLock);
 
+    return found;
 }
 
-// This is a routine that creates a background thread to close any NtClose accumulated handles.
-// The prebuild step of Office uses Perl and tons of pipe logging, without opening a file, so the
-// NtClose list drain logic doesn't kick in, thus creating a potential problem of having invalid 
-// handles in the map (handles that have been reused, but never cleaned up).
-DWORD WINAPI CleanupNtClosedHandles(LPVOID lpParam)
-{
-    UNREFERENCED_PARAMETER(lpParam);
-    if (UseExtraThreadToDrainNtClose())
-    {
-        RemoveClosedHandles();
+void HandleOverlay::SetFinalPath(LONG generation, std::wstring const& finalPath) {
+    AcquireSRWLockExclusive(&FinalPathLock);
+    FinalPath.assign(finalPath);
+    FinalPathGeneration = generation;
+    HasFinalPath = true;
+    ReleaseSRWLockExclusive(&FinalPathLock);
+}
+
+// Policies of the open handles, by canonicalized path. The table only holds weak references: a policy goes away with the last
+// overlay referencing it, and its entry is dropped by the next purge (or replaced by the next registration for the path).
+typedef std::unordered_map<std::wstring, std::weak_ptr<const PolicyResult>> HandlePolicyMap;
+
+static SRWLOCK g_handlePolicyLock = SRWLOCK_INIT;
+static HandlePolicyMap* g_handlePolicies = nullptr;
+static size_t g_handlePolicyPurgeThreshold = HANDLE_POLICY_INITIAL_PURGE_THRESHOLD;
+
+// Returns the interned policy equivalent to the given one, interning a copy of it if there is none.
+static HandlePolicyRef InternHandlePolicy(PolicyResult const& policy) {
+    if (policy.GetCanonicalizedPath().IsNull()) {
+        return std::make_shared<const PolicyResult>(policy);
     }
 
-    return 0;
-}
+    std::wstring path(policy.GetCanonicalizedPath().GetPathString());
 
-void StartCleanupNtClosedHandlesThread()
-{
-    HANDLE threadHandle = CreateThread(
-        NULL,
-        0,
-        CleanupNtClosedHandles,
-        nullptr,
-        0,
-        nullptr);
-    
-    if (threadHandle == INVALID_HANDLE_VALUE)
-    {
-        Dbg(L"Warning: Could not create CleanupNtClosedHandlesThread.");
+    AcquireSRWLockShared(&g_handlePolicyLock);
+    HandlePolicyRef interned;
+    if (g_handlePolicies != nullptr) {
+        HandlePolicyMap::const_iterator it = g_handlePolicies->find(path);
+        if (it != g_handlePolicies->end()) {
+            interned = it->second.lock();
+        }
     }
-    else
-    {
-        SetThreadPriority(threadHandle, THREAD_PRIORITY_HIGHEST);
+    ReleaseSRWLockShared(&g_handlePolicyLock);
+
+    if (interned != nullptr && interned->IsEquivalentTo(policy)) {
+        return interned;
     }
-}
 
-void InitializeHandleOverlay() {
+    // Policies for the same path normally agree; one that does not replaces the interned one, which stays alive for the overlays
+    // that reference it.
+    HandlePolicyRef newPolicy = std::make_shared<const PolicyResult>(policy);
 
-    assert(!g_initialized);
-    InitializeCriticalSection(&g_handleOverlayLock);
-    // Always create the OverlayMap.This is called from DllAttach, so it is inside alock already.
-    // Doing it here, we save check and creating the map inside the GetOverlayMap.
-    g_handleOverlayMap = new HandleOverlayMap();
-
-    // The NtClose(d) handles are in the g_pClosedHandles. (It is a lock free list.)
-    // Since allocation of memory is unsafe inside the NtClose execution path (there should
-    // not be locks on this path), preallocate a list of nodes to be used as a pool - g_pClosedHandlesPool.
-    g_pClosedHandles = (PSLIST_HEADER)_dd_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
-    if (g_pClosedHandles == nullptr)
-    {
-        Dbg(L"Allocation for g_pClosedHandles failed");
+    AcquireSRWLockExclusive(&g_handlePolicyLock);
+
+    if (g_handlePolicies == nullptr) {
+        g_handlePolicies = new HandlePolicyMap();
     }
 
-    assert(g_pClosedHandles != nullptr);
-    InitializeSListHead(g_pClosedHandles);
+    std::weak_ptr<const PolicyResult>& entry = (*g_handlePolicies)[std::move(path)];
+    interned = entry.lock();
+    if (interned != nullptr && interned->IsEquivalentTo(policy)) {
+        // Another thread interned it in the meantime.
+        newPolicy = std::move(interned);
+    }
+    else {
+        entry = newPolicy;
+    }
 
-    g_pClosedHandlesPool = (PSLIST_HEADER)_dd_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
-    if (g_pClosedHandlesPool == nullptr)
-    {
-        Dbg(L"Allocation for g_pClosedHandlesPool failed");
+    if (g_handlePolicies->size() >= g_handlePolicyPurgeThreshold) {
+        for (HandlePolicyMap::iterator it = g_handlePolicies->begin(); it != g_handlePolicies->end();) {
+            it = it->second.expired() ? g_handlePolicies->erase(it) : std::next(it);
+        }
+
+        size_t liveEntries = g_handlePolicies->size();
+        g_handlePolicyPurgeThreshold = liveEntries * 2 > HANDLE_POLICY_INITIAL_PURGE_THRESHOLD ? liveEntries * 2 : HANDLE_POLICY_INITIAL_PURGE_THRESHOLD;
     }
 
-    assert(g_pClosedHandlesPool != nullptr);
-    InitializeSListHead(g_pClosedHandlesPool);
-    PopulateNtCloseListPool();
+    ReleaseSRWLockExclusive(&g_handlePolicyLock);
 
-    g_initialized = true;
+    return newPolicy;
 }
 
-void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type) {
-    if (UseExtraThreadToDrainNtClose())
+void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type,
+    std::shared_ptr<OutputHasher> hasher, bool followedReparsePoints, FileStat const* stat, LONG statGeneration) {
+    // First we create a shared_ptr for a new HandleOverlay (ref count 1), without holding the shard lock for the allocations.
+    HandleOverlayRef newRef = std::make_shared<HandleOverlay>(accessCheck, InternHandlePolicy(policy), type);
+    newRef->Hasher = std::move(hasher);
+    newRef->FollowedReparsePoints = followedReparsePoints;
+    if (stat != nullptr) {
+        newRef->Stat = *stat;
+        newRef->StatGeneration = statGeneration;
+        newRef->HasStat = true;
+    }
+
     {
-        RemoveClosedHandles();
-    }
-
-    // First we create a shared_ptr for a new HandleOverlay (ref count 1).
-    // Note: This must be created outside of the HandleOverlayLockGuard lock below,
-    //       because otherwise we will get a deadlock - the HandleMap lock and the RtlAllocHeap in the OS heap allocator lock.
-    //       
-    HandleOverlayRef newRef = std::make_shared<HandleOverlay>(accessCheck, policy, type);
-
-    // Get an extra reference to the handle. This way the shared_ptr is not deleted when removed from the map.
-    //
-    // The issue of destroying the object when removing from the map is that there is a potential for a deadlock.
-    // The removal from the map happens while holding the HandleOverlayLockGuard lock 
-    // (in the MapRegisterHandleOverlay method we do std::move that can call an object destruction and RtlFreeHeap).
-    // The freeing of memory happens while a heap lock is held - so if destruction happens,
-    // the order of lock aquisition is HandleMapLock--> HeapLock.
-    // RtlFreeHeap also calls NtClose, while holding the heap lock, so it is possible to try to get the locks in 
-    // order HeapLock-->HandleMapLock.
-    // These two clearly point to a deadlock due to inverted lock aquisition.
-    HandleOverlayRef overlay = TryLookupHandleOverlay(handle, false);
+        uint64_t hash = HashHandle(handle);
+        HandleOverlayLockGuard lock(hash, true);
+        lock.GetShard()->MapRegisterHandleOverlay(handle, hash, newRef);
+    }
 
+    if (IsDetoursEventEnabled(DetoursEvent_HandleOverlayRegistered))
     {
-        HandleOverlayLockGuard lock;
-        HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-        map->MapRegisterHandleOverlay(handle, newRef);
+        WriteHandleOverlayRegisteredEvent(handle, static_cast<DWORD>(type), policy.GetCanonicalizedPath().GetPathString());
     }
 }
 
-HandleOverlayRef TryLookupHandleOverlay(HANDLE handle, bool drain) {
-    if (drain && UseExtraThreadToDrainNtClose())
+void RegisterDuplicatedHandleOverlay(HANDLE handle, HandleOverlayRef const& overlay) {
+    HandleOverlayRef newRef(overlay);
+
     {
-        RemoveClosedHandles();
+        uint64_t hash = HashHandle(handle);
+        HandleOverlayLockGuard lock(hash, true);
+        lock.GetShard()->MapRegisterHandleOverlay(handle, hash, newRef);
     }
 
-    HandleOverlayLockGuard lock;
-    HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-    return map->TryLookupHandleOverlay(handle);
+    if (IsDetoursEventEnabled(DetoursEvent_HandleOverlayRegistered))
+    {
+        WriteHandleOverlayRegisteredEvent(handle, static_cast<DWORD>(overlay->Type), overlay->Policy->GetCanonicalizedPath().GetPathString());
+    }
 }
 
-void CloseHandleOverlay(HANDLE handle, bool inRecursion) {
-    if (!inRecursion)
+HandleOverlayRef TryLookupHandleOverlay(HANDLE handle) {
+    uint64_t hash = HashHandle(handle);
+    HandleOverlayLockGuard lock(hash, false);
+    return lock.GetShard()->TryLookupHandleOverlay(handle, hash);
+}
+
+void CloseHandleOverlay(HANDLE handle) {
+    bool found;
+
     {
-        // Call this from here to relieve pressure on the pre-allocated SList entry pool.
-        if (UseExtraThreadToDrainNtClose())
-        {
-            RemoveClosedHandles();
-        }
-    }
-    
-    // Get an extra reference to the handle. This way the shared_ptr is not deleted when removed from the 
-    // map.
-    // The issue of destroying the object when removing from the map is that there is a potential for a deadlock.
-    // The removal from the map happens while holding the HandleOverlayLockGuard lock (see below).
-    // If the map holds the last ref to the shared_ptr, when removing it, the destructor of the object will be called,
-    // thus triggering deletion of the object from the OS heap - RtlFreeHeap. The freeing of memory happens
-    // while a heap lock is held - so if destruction happens, the order of lock aquisition is HandleMapLock--> HeapLock.
-    // RtlAllocateHeap also calls NtClose, while holding the heap lock, so it is possible to try to get the locks in 
-    // order HeapLock-->HandleMapLock.
-    // These two clearly point to a deadlock due to inverted lock aquisition.
-    HandleOverlayRef overlay = TryLookupHandleOverlay(handle, false);
-    
+        uint64_t hash = HashHandle(handle);
+        HandleOverlayLockGuard lock(hash, true);
+        found = lock.GetShard()->CloseHandleOverlay(handle, hash);
+    }
+
+    if (IsDetoursEventEnabled(DetoursEvent_HandleOverlayClosed))
     {
-        // Extra scope here to make sure the lock is destroied before the overlay above goes out of scope
-        // and releases the last ref to the object pointer.
-        HandleOverlayLockGuard lock;
-        HandleOverlayMap* map = lock.GetGlobalOverlayMap();
-        map->CloseHandleOverlay(handle);
+        WriteHandleOverlayClosedEvent(handle, found);
     }
 }
 
-void AddClosedHandle(HANDLE handle) {
-    // Be safe and check all the list pointers as well since a NtClose (where this method is called from)
-    // can come very early in the execution of a process.
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG startAdd = GetTickCount64();
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    // Cleaup any pending NtClose handles, if the remaining unused are less than NT_CLOSE_CLEANUP_THRESHOLD
-    if ((g_detoursAllocatedNoLockConcurentPoolEntries - g_usedPoolEntries) < NT_CLOSE_CLEANUP_THRESHOLD)
+void MarkHandleOverlayClosed(HANDLE handle) {
+    // NtClose can come very early in the execution of a process.
+    if (!g_initialized) {
+        return;
+    }
+
+    uint64_t hash = HashHandle(handle);
+    HandleOverlayShard* shard = &g_handleOverlayShards[(size_t)(hash >> 60) & (HANDLE_OVERLAY_SHARD_COUNT - 1)];
+    bool found = shard->MarkClosed(handle, hash);
+
+    if (IsDetoursEventEnabled(DetoursEvent_HandleOverlayClosed))
     {
-        // When below threshold start a new thread. It will be with higher priority to drain the list.
-        // The thread routine is completely thread safe and we might create multiple threads and that is just fine.
-        // The expectation is that multiple threads creation will happen very rarely.
-        StartCleanupNtClosedHandlesThread();
+        WriteHandleOverlayClosedEvent(handle, found);
     }
+}
 
-    if (g_initialized && g_pClosedHandles != nullptr && g_pClosedHandlesPool != nullptr) {
-        PSLIST_ENTRY pEntry = InterlockedPopEntrySList(g_pClosedHandlesPool);
+// Payload of the snapshot of inherited overlays: a header, then one entry per handle, each followed by its canonicalized path
+// (PathLength characters, not null-terminated) padded to 8 bytes. The layout does not depend on the bitness of the processes.
+static const GUID s_inheritedHandleOverlaysGuid = { 0x3B1E55A4, 0x8C2D, 0x4F6B, { 0x9E, 0x71, 0x0A, 0x5D, 0xC2, 0x48, 0x6F, 0x13 } };
 
-        if (pEntry == nullptr)
-        {
-            Dbg(L"Warning: No available entries in g_pClosedHandlesPool list.");
+struct InheritedHandleOverlaysHeader {
+    uint32_t Version;
+    uint32_t Count;
+};
+
+struct InheritedHandleOverlayEntry {
+    uint64_t Handle;
+    uint32_t Type;
+    uint32_t FollowedReparsePoints;
+    uint32_t RequestedAccess;
+    uint32_t ResultAction;
+    uint32_t ReportLevel;
+    uint32_t PathValidity;
+    uint32_t PathLength;
+    uint32_t Reserved;
+};
+
+static inline size_t InheritedHandleOverlayEntrySize(size_t pathLength) {
+    return sizeof(InheritedHandleOverlayEntry) + ((pathLength * sizeof(wchar_t) + 7) & ~(size_t)7);
+}
+
+void CopyInheritableHandleOverlaysToProcess(HANDLE process) {
+    if (!g_initialized) {
+        return;
+    }
+
+    // Take the overlays out of the map first: the handle flags are queried without holding the shard locks.
+    std::vector<std::pair<HANDLE, HandleOverlayRef>> entries;
+    for (int i = 0; i < HANDLE_OVERLAY_SHARD_COUNT; i++) {
+        HandleOverlayShard& shard = g_handleOverlayShards[i];
+        AcquireSRWLockShared(shard.GetLock());
+        shard.CollectLiveEntries(entries);
+        ReleaseSRWLockShared(shard.GetLock());
+    }
+
+    std::vector<BYTE> snapshot(sizeof(InheritedHandleOverlaysHeader));
+    uint32_t count = 0;
+
+    for (auto const& entry : entries) {
+        HandleOverlay const& overlay = *entry.second;
+        DWORD flags;
+
+        // Find handles are pseudo-handles, never inherited.
+        if (overlay.Type == HandleType::Find
+            || overlay.Policy->GetCanonicalizedPath().IsNull()
+            || !GetHandleInformation(entry.first, &flags)
+            || (flags & HANDLE_FLAG_INHERIT) == 0) {
+            continue;
         }
-        else
-        {
-            ((PHANDLE_TO_CLOSE)pEntry)->Handle = handle;
-            InterlockedPushEntrySList(g_pClosedHandles, &(((PHANDLE_TO_CLOSE)pEntry)->ItemEntry));
-            InterlockedIncrement(&g_usedPoolEntries);
+
+        // The child may write through the handle as well; the hash of the writes of this process alone would be wrong.
+        if (overlay.Hasher != nullptr) {
+            overlay.Hasher->Lock();
+            overlay.Hasher->Invalidate();
+            overlay.Hasher->Unlock();
         }
+
+        CanonicalizedPathType const& path = overlay.Policy->GetCanonicalizedPath();
+        size_t pathLength = path.Length();
+
+        size_t offset = snapshot.size();
+        snapshot.resize(offset + InheritedHandleOverlayEntrySize(pathLength));
+
+        InheritedHandleOverlayEntry* serialized = reinterpret_cast<InheritedHandleOverlayEntry*>(&snapshot[offset]);
+        serialized->Handle = (uint64_t)(ULONG_PTR)entry.first;
+        serialized->Type = (uint32_t)overlay.Type;
+        serialized->FollowedReparsePoints = overlay.FollowedReparsePoints ? 1 : 0;
+        serialized->RequestedAccess = (uint32_t)overlay.AccessCheck.RequestedAccess;
+        serialized->ResultAction = (uint32_t)overlay.AccessCheck.ResultAction;
+        serialized->ReportLevel = (uint32_t)overlay.AccessCheck.ReportLevel;
+        serialized->PathValidity = (uint32_t)overlay.AccessCheck.PathValidity;
+        serialized->PathLength = (uint32_t)pathLength;
+        serialized->Reserved = 0;
+        memcpy(serialized + 1, path.GetPathString(), pathLength * sizeof(wchar_t));
+
+        count++;
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    InheritedHandleOverlaysHeader* header = reinterpret_cast<InheritedHandleOverlaysHeader*>(snapshot.data());
+    header->Version = INHERITED_HANDLE_OVERLAYS_VERSION;
+    header->Count = count;
+
+    if (!DetourCopyPayloadToProcess(process, s_inheritedHandleOverlaysGuid, snapshot.data(), (DWORD)snapshot.size())) {
+        Dbg(L"Warning: Could not copy the overlays of %d inherited handles to the child process. Last Error: %d", (int)count, (int)GetLastError());
     }
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    InterlockedIncrement(&g_maxClosedListCount);
-    ULONGLONG endAdd = GetTickCount64();
-    InterlockedExchangeAdd(&g_msTimeInAddClosedList, (LONG)(endAdd - startAdd));
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
 }
 
-// Note: It is potentially possible to call these method while an entry is added to the non-locking list.
-// In such case the entry will be removed from the overlay map on the next iteration.
-void RemoveClosedHandles() {
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG startAdd = GetTickCount64();
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
-    if (g_initialized && g_pClosedHandles != nullptr && g_pClosedHandlesPool != nullptr) {
-        PSLIST_ENTRY pEntry = InterlockedPopEntrySList(g_pClosedHandles);
-        while (pEntry != NULL)
-        {
-            CloseHandleOverlay(((PHANDLE_TO_CLOSE)pEntry)->Handle, true);
-            ((PHANDLE_TO_CLOSE)pEntry)->Handle = INVALID_HANDLE_VALUE;
-            InterlockedPushEntrySList(g_pClosedHandlesPool, &(((PHANDLE_TO_CLOSE)pEntry)->ItemEntry));
-            pEntry = InterlockedPopEntrySList(g_pClosedHandles);
-            InterlockedDecrement(&g_usedPoolEntries);
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-            InterlockedDecrement(&g_maxClosedListCount);
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT        
-        }
-
-        // Grow the list if needed.
-        if ((g_detoursAllocatedNoLockConcurentPoolEntries - g_usedPoolEntries) < NT_CLOSE_CLEANUP_THRESHOLD)
-        {
-            PopulateNtCloseListPool();
+void AdoptInheritedHandleOverlays() {
+    DWORD size = 0;
+    BYTE const* snapshot = reinterpret_cast<BYTE const*>(DetourFindPayloadEx(s_inheritedHandleOverlaysGuid, &size));
+    if (snapshot == nullptr || size < sizeof(InheritedHandleOverlaysHeader)) {
+        return;
+    }
+
+    InheritedHandleOverlaysHeader const* header = reinterpret_cast<InheritedHandleOverlaysHeader const*>(snapshot);
+    if (header->Version != INHERITED_HANDLE_OVERLAYS_VERSION) {
+        return;
+    }
+
+    size_t offset = sizeof(InheritedHandleOverlaysHeader);
+    for (uint32_t i = 0; i < header->Count; i++) {
+        if (offset + sizeof(InheritedHandleOverlayEntry) > size) {
+            break;
+        }
+
+        InheritedHandleOverlayEntry const* entry = reinterpret_cast<InheritedHandleOverlayEntry const*>(snapshot + offset);
+        size_t entrySize = InheritedHandleOverlayEntrySize(entry->PathLength);
+        if (offset + entrySize > size) {
+            break;
+        }
+
+        offset += entrySize;
+
+        // A handle closed by another thread of the parent while this process was created is not inherited, and its value may be
+        // taken by some other object here; only adopt the overlays of handles that are still file handles.
+        HANDLE handle = (HANDLE)(ULONG_PTR)entry->Handle;
+        if (GetFileType(handle) != FILE_TYPE_DISK) {
+            continue;
+        }
+
+        std::wstring path(reinterpret_cast<wchar_t const*>(entry + 1), entry->PathLength);
+        PolicyResult policy;
+        if (!policy.Initialize(path.c_str())) {
+            continue;
         }
+
+        AccessCheckResult accessCheck(
+            (RequestedAccess)entry->RequestedAccess,
+            (ResultAction)entry->ResultAction,
+            (ReportLevel)entry->ReportLevel,
+            (PathValidity)entry->PathValidity);
+
+        RegisterHandleOverlay(handle, accessCheck, policy, (HandleType)entry->Type, nullptr, entry->FollowedReparsePoints != 0);
     }
-#if MEASURE_DETOURED_NT_CLOSE_IMPACT
-    ULONGLONG endAdd = GetTickCount64();
-    InterlockedExchangeAdd(&g_msTimeInRemoveClosedList, (LONG)(endAdd - startAdd));
-#endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
 }
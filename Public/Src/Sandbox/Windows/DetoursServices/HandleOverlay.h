@@ -12,6 +12,8 @@
 // Instead, we define a process-global HANDLE -> overlay map and return all HANDLEs unmodified.
 
 #include "FileAccessHelpers.h"
+#include "FileStat.h"
+#include "OutputHashing.h"
 #include "PolicyResult.h"
 
 enum class HandleType {
@@ -21,24 +23,61 @@ enum class HandleType {
     Find
 };
 
-// Per-handle overlay data.
+// Policy shared by the overlays of the handles opened for the same path. It is immutable once interned, so that it can be
+// shared without a lock; it goes away with the last overlay referencing it.
+typedef std::shared_ptr<const PolicyResult> HandlePolicyRef;
+
+// Per-handle overlay data. The policy, with its canonicalized and translated paths, is interned (see RegisterHandleOverlay)
+// since processes tend to keep many handles to the same few paths open; only what is specific to the handle is held inline.
 struct HandleOverlay {
     // Constructs a handle overlay for a handle, wrapping the creating operation's policy / access check.
     // The policy represents what operations should be allowed via operations on this handle.
-    HandleOverlay(AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type)
-        : Policy(policy), AccessCheck(accessCheck), Type(type), EnumerationHasBeenReported(false) { }
+    HandleOverlay(AccessCheckResult const& accessCheck, HandlePolicyRef policy, HandleType type)
+        : Policy(std::move(policy)), AccessCheck(accessCheck), Type(type), FollowedReparsePoints(false), EnumerationHasBeenReported(false), FinalPathGeneration(0), HasFinalPath(false),
+          Stat(), StatGeneration(0), HasStat(false)
+    {
+        InitializeSRWLock(&FinalPathLock);
+    }
 
     HandleOverlay(const HandleOverlay& other) = default;
     HandleOverlay& operator=(const HandleOverlay&) = default;
 
-    PolicyResult Policy;
+    // Never null.
+    HandlePolicyRef Policy;
     AccessCheckResult AccessCheck;
     HandleType Type;
 
+    // Set when the handle was opened following reparse points (without FILE_OPEN_REPARSE_POINT / FILE_FLAG_OPEN_REPARSE_POINT), so that
+    // a Directory handle is known not to be a directory reparse point. Checks that treat those as files can then rely on Type as well.
+    bool FollowedReparsePoints;
+
     // This flag is set when a directory handle enumeration is reported to BuildXL
     // by NtQueryDirectoryFile. It prevents multiple reports for the same directory
     // (some big enumerations require multiple calls to NtQueryDirectoryFile).
     bool EnumerationHasBeenReported;
+
+    // Gets the normalized final path of the handle (as GetFinalPathNameByHandleW(FILE_NAME_NORMALIZED) returns it) cached by
+    // SetFinalPath, if it was resolved in the given generation. Renames of the file or of a directory above it change the final path,
+    // so callers pass a generation that such operations advance.
+    bool TryGetFinalPath(LONG generation, std::wstring& finalPath);
+
+    // Caches the normalized final path of the handle, resolved while the given generation was current.
+    void SetFinalPath(LONG generation, std::wstring const& finalPath);
+
+    SRWLOCK FinalPathLock;
+    std::wstring FinalPath;
+    LONG FinalPathGeneration;
+    bool HasFinalPath;
+
+    // Attributes of the file queried by the checks that followed the open, if they queried them (see OpenedFileStat), and the
+    // generation of the reparse point cache (see GetReparsePointCacheGeneration) read before. Operations of this process that may
+    // have turned the file into a reparse point, or removed one, advance the generation and so make them stale.
+    FileStat Stat;
+    LONG StatGeneration;
+    bool HasStat;
+
+    // Hash of the bytes written through the handle, if the handle created or truncated the file (see OutputHashing.h).
+    std::shared_ptr<OutputHasher> Hasher;
 };
 
 // Sets up structures for recording handle overlays.
@@ -53,18 +92,34 @@ typedef std::shared_ptr<HandleOverlay> HandleOverlayRef;
 
 // Creates or replaces an overlay for the given handle (intended for the time at which a handle is created).
 // The new overlays wraps the policy / access check determined for the handle so far.
-// The policy represents what operations should be allowed via operations on this handle.
-void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type);
+// The policy represents what operations should be allowed via operations on this handle. The overlay references an equivalent
+// policy registered for the same path before, if its handle is still open, rather than a copy of its own.
+// A hasher, if given, is fed the writes through the handle. The attributes of the file, if given, are the ones queried after the open,
+// while the given generation of the reparse point cache was current.
+void RegisterHandleOverlay(HANDLE handle, AccessCheckResult const& accessCheck, PolicyResult const& policy, HandleType type,
+    std::shared_ptr<OutputHasher> hasher = nullptr, bool followedReparsePoints = false, FileStat const* stat = nullptr, LONG statGeneration = 0);
+
+// Associates an existing overlay with a duplicate of its handle in the same process (see Detoured_NtDuplicateObject).
+// Both handles refer to the same file object, so they share the overlay, including its hasher and enumeration state.
+void RegisterDuplicatedHandleOverlay(HANDLE handle, HandleOverlayRef const& overlay);
 
 // Tries to look up an existing overlay for the given handle. The returned ref may wrap nullptr in the event that there was no overlay found.
-HandleOverlayRef TryLookupHandleOverlay(HANDLE handle, bool drain = true);
+HandleOverlayRef TryLookupHandleOverlay(HANDLE handle);
 
 // If an overlay exists for the given handle, disassociates it from the handle. Future calls to TryLookupHandleOverlay for the handle will no
 // longer succeed. Concurrent users that already have a ref to the overlay may continue to use it safely.
-void CloseHandleOverlay(HANDLE handle, bool inRecursion = false);
+void CloseHandleOverlay(HANDLE handle);
+
+// Same as CloseHandleOverlay, for NtClose: it never waits for a lock, nor allocates or frees memory (RtlFreeHeap calls NtClose while
+// holding the heap lock). The overlay is released later, by the next update of the map that reuses its slot.
+void MarkHandleOverlayClosed(HANDLE handle);
 
-// Adds a closed handle to the closed handle list.
-void AddClosedHandle(HANDLE handle);
+// Copies a snapshot of the overlays of the inheritable handles into a child process created inheriting all of them (suspended,
+// before it runs any code), for the child to adopt with AdoptInheritedHandleOverlays. The hashers of these handles are invalidated,
+// since the child may write through them. Failing to copy the snapshot is not fatal: the child then looks the handles up on use.
+void CopyInheritableHandleOverlaysToProcess(HANDLE process);
 
-// Remove all closed handlefrom the overlay map.
-void RemoveClosedHandles();
+// Registers the overlays of the handles inherited from the parent process, if it passed a snapshot of them. The policy of each one
+// is searched again for its canonicalized path, as the manifest of this process is a different copy.
+// Call it from DllProcessAttach, once the manifest is parsed and the overlay map initialized.
+void AdoptInheritedHandleOverlays();
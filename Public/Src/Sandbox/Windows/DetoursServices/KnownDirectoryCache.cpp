@@ -0,0 +1,116 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <string>
+#include <unordered_map>
+
+#include "KnownDirectoryCache.h"
+#include "MemoryPressure.h"
+#include "ReparsePointCache.h"
+
+// Beyond this many directories the set starts over rather than growing without bound.
+#define KNOWN_DIRECTORY_CACHE_MAX_ENTRIES 16384
+
+// Maps each directory to the generation it was recorded in; entries of older generations are stale.
+typedef std::unordered_map<std::wstring, LONG, CaseInsensitivePathHash, CaseInsensitivePathEqual> KnownDirectoryMap;
+
+static volatile LONG g_knownDirectoryCacheGeneration = 0;
+
+static SRWLOCK g_knownDirectoryCacheLock = SRWLOCK_INIT;
+static KnownDirectoryMap* g_knownDirectories = nullptr;
+
+LONG GetKnownDirectoryCacheGeneration()
+{
+    return g_knownDirectoryCacheGeneration;
+}
+
+bool IsKnownDirectory(_In_ LPCWSTR path)
+{
+    if (!CacheKnownDirectories() || path == nullptr)
+    {
+        return false;
+    }
+
+    LONG generation = g_knownDirectoryCacheGeneration;
+    bool found = false;
+
+    AcquireSRWLockShared(&g_knownDirectoryCacheLock);
+
+    if (g_knownDirectories != nullptr)
+    {
+        KnownDirectoryMap::const_iterator it = g_knownDirectories->find(std::wstring(path));
+        found = it != g_knownDirectories->end() && it->second == generation;
+    }
+
+    ReleaseSRWLockShared(&g_knownDirectoryCacheLock);
+
+    return found;
+}
+
+void AddKnownDirectory(_In_ LPCWSTR path, LONG generation)
+{
+    if (!CacheKnownDirectories() || path == nullptr || generation != g_knownDirectoryCacheGeneration)
+    {
+        return;
+    }
+
+    std::wstring key(path);
+
+    AcquireSRWLockExclusive(&g_knownDirectoryCacheLock);
+
+    if (g_knownDirectories == nullptr)
+    {
+        g_knownDirectories = new KnownDirectoryMap();
+        EnsureMemoryPressureMonitorStarted();
+    }
+    else if (g_knownDirectories->size() >= KNOWN_DIRECTORY_CACHE_MAX_ENTRIES)
+    {
+        g_knownDirectories->clear();
+    }
+
+    (*g_knownDirectories)[std::move(key)] = generation;
+
+    ReleaseSRWLockExclusive(&g_knownDirectoryCacheLock);
+}
+
+void InvalidateKnownDirectories()
+{
+    InterlockedIncrement(&g_knownDirectoryCacheGeneration);
+}
+
+size_t ShrinkKnownDirectoryCache(size_t floor)
+{
+    LONG generation = g_knownDirectoryCacheGeneration;
+    size_t removed = 0;
+
+    AcquireSRWLockExclusive(&g_knownDirectoryCacheLock);
+
+    if (g_knownDirectories != nullptr)
+    {
+        for (KnownDirectoryMap::iterator it = g_knownDirectories->begin(); it != g_knownDirectories->end(); )
+        {
+            if (it->second != generation)
+            {
+                it = g_knownDirectories->erase(it);
+                removed++;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        // The set keeps no track of which directories are still used; losing one only costs creating it again.
+        while (g_knownDirectories->size() > floor)
+        {
+            g_knownDirectories->erase(g_knownDirectories->begin());
+            removed++;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&g_knownDirectoryCacheLock);
+
+    return removed;
+}
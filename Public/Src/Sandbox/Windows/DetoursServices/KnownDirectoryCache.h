@@ -0,0 +1,60 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Per-process set of the directories this process knows to exist, because it created them or because CreateDirectoryW
+// found them already there.
+//
+// With FileAccessManifestExtraFlag::CacheKnownDirectories, Detoured_CreateDirectoryW answers a call for a directory in the
+// set with ERROR_ALREADY_EXISTS right away, without checking the policy, reporting, or calling the real API: scripts and
+// CMake-generated builds "mkdir -p" every ancestor of every output, and the first call for a directory already reported
+// what the later ones would.
+//
+// Every detoured function that may remove or move a directory in this process (RemoveDirectoryW, MoveFileWithProgressW,
+// renames and deletions through SetFileInformationByHandle and ZwSetInformationFile, opening with delete-on-close)
+// forgets the whole set by bumping its generation, since a move of a directory affects every directory below it.
+// Directories removed by other processes are not seen, just like with the reparse point cache.
+
+#pragma once
+
+#include "DataTypes.h"
+#include "FileAccessHelpers.h"
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Returns the generation to record a directory found from now on with.
+LONG GetKnownDirectoryCacheGeneration();
+
+/// Checks whether a (canonicalized) path is a directory known to exist. Always fails when the cache is disabled.
+bool IsKnownDirectory(_In_ LPCWSTR path);
+
+/// Records a directory known to exist; dropped if the set got invalidated since the given generation was read.
+void AddKnownDirectory(_In_ LPCWSTR path, LONG generation);
+
+/// Forgets all the known directories.
+void InvalidateKnownDirectories();
+
+/// Removes the stale directories from the set, then others until it holds no more than the given number of directories.
+/// Returns the number of directories removed.
+size_t ShrinkKnownDirectoryCache(size_t floor);
+
+/// Invalidates the known directories when leaving the scope, i.e., after the operation it guards has completed.
+class KnownDirectoryCacheInvalidationScope
+{
+public:
+    KnownDirectoryCacheInvalidationScope(bool invalidate = true) : m_invalidate(invalidate) { }
+    ~KnownDirectoryCacheInvalidationScope()
+    {
+        if (m_invalidate)
+        {
+            InvalidateKnownDirectories();
+        }
+    }
+
+private:
+    bool m_invalidate;
+
+    KnownDirectoryCacheInvalidationScope(const KnownDirectoryCacheInvalidationScope&) = delete;
+    KnownDirectoryCacheInvalidationScope& operator=(const KnownDirectoryCacheInvalidationScope&) = delete;
+};
@@ -0,0 +1,219 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <string>
+
+#include "LiveCounters.h"
+#include "DebuggingHelpers.h"
+#include "DetourStatistics.h"
+#include "FileAccessHelpers.h"
+#include "globals.h"
+
+extern volatile LONG64 g_detoursHandleHeapEntries;
+extern volatile LONG64 g_detoursHeapAllocatedMemoryInBytes;
+extern volatile LONG64 g_detoursPolicyResultCacheHits;
+extern volatile LONG64 g_detoursPolicyResultCacheMisses;
+extern volatile LONG64 g_detoursCacheShrinks;
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+#define GEN_LIVE_COUNTER_CUMULATIVE(name, cumulative) cumulative,
+static bool const s_liveCounterIsCumulative[] = {
+    FOR_ALL_LIVE_COUNTERS(GEN_LIVE_COUNTER_CUMULATIVE)
+};
+#undef GEN_LIVE_COUNTER_CUMULATIVE
+
+// Null when the process publishes nothing.
+static LiveCountersHeader* g_liveCountersHeader = nullptr;
+static ProcessLiveCounters* g_liveCounters = nullptr;
+
+static volatile LONG g_liveCountersPublisherStarted = 0;
+
+// ----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+// ----------------------------------------------------------------------------
+
+/// Claims a free slot, or failing that the slot of a process that exited, whose counters are already in the totals.
+static ProcessLiveCounters* ClaimSlot(ProcessLiveCounters* slots, uint32_t slotCount)
+{
+    for (LONG reclaimable : { (LONG)LiveCountersSlotState_Free, (LONG)LiveCountersSlotState_Exited })
+    {
+        for (uint32_t i = 0; i < slotCount; i++)
+        {
+            ProcessLiveCounters* slot = &slots[i];
+            if (slot->State == reclaimable
+                && InterlockedCompareExchange(&slot->State, LiveCountersSlotState_Claiming, reclaimable) == reclaimable)
+            {
+                slot->ProcessId = GetCurrentProcessId();
+                slot->PublishTime = 0;
+                for (int j = 0; j < LIVE_COUNTERS_CAPACITY; j++)
+                {
+                    slot->Counters[j] = 0;
+                }
+
+                InterlockedExchange(&slot->State, LiveCountersSlotState_Running);
+                return slot;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+/// Copies the counters kept by the detours into the slot. Reports are counted in the slot directly.
+static void CopyCountersToSlot(ProcessLiveCounters* slot)
+{
+    // The per-thread statistics are only merged at exit otherwise; reading them while the threads run may miss their last call.
+    DetourOverhead overhead = GetDetourOverhead();
+
+    slot->Counters[(int)LiveCounter::HandleOverlays] = g_detoursHandleHeapEntries;
+    slot->Counters[(int)LiveCounter::PolicyCacheHits] = g_detoursPolicyResultCacheHits;
+    slot->Counters[(int)LiveCounter::PolicyCacheMisses] = g_detoursPolicyResultCacheMisses;
+    slot->Counters[(int)LiveCounter::DetourMicroseconds] = (LONG64)overhead.TotalMicroseconds;
+    slot->Counters[(int)LiveCounter::PrivateHeapBytes] = g_detoursHeapAllocatedMemoryInBytes;
+    slot->Counters[(int)LiveCounter::CacheShrinks] = g_detoursCacheShrinks;
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    slot->PublishTime = (LONG64)(((ULONG64)now.dwHighDateTime << 32) | now.dwLowDateTime);
+}
+
+static DWORD WINAPI LiveCountersPublisher(LPVOID lpParam)
+{
+    UNREFERENCED_PARAMETER(lpParam);
+
+    while (true)
+    {
+        ProcessLiveCounters* slot = g_liveCounters;
+        if (slot == nullptr)
+        {
+            return 0;
+        }
+
+        CopyCountersToSlot(slot);
+        Sleep(LIVE_COUNTERS_PUBLISH_INTERVAL_MS);
+    }
+}
+
+/// Starts the publisher on the first report. It is not started from DllProcessAttach to stay clear of the loader lock.
+static void EnsureLiveCountersPublisherStarted()
+{
+    if (g_liveCountersPublisherStarted != 0 || InterlockedCompareExchange(&g_liveCountersPublisherStarted, 1, 0) != 0)
+    {
+        return;
+    }
+
+    HANDLE threadHandle = CreateThread(NULL, 0, LiveCountersPublisher, nullptr, 0, nullptr);
+
+    if (threadHandle == NULL)
+    {
+        // Reports are still counted, and the other counters are published when the process exits.
+        Dbg(L"Warning: Could not create the live counters publisher thread. Last Error: %d", (int)GetLastError());
+    }
+    else
+    {
+        CloseHandle(threadHandle);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+void InitializeLiveCounters()
+{
+    if (!PublishLiveCounters() || g_internalDetoursErrorNotificationFile == nullptr)
+    {
+        return;
+    }
+
+    // Object names don't allow '\\'; use the same derivation as for the message count semaphore.
+    std::wstring name(g_internalDetoursErrorNotificationFile);
+    std::replace(name.begin(), name.end(), L'\\', L'_');
+    name.append(LIVE_COUNTERS_NAME_SUFFIX);
+
+    // NOTE: This calls the real OpenFileMappingW(), because the detoured functions have not been installed yet.
+    HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name.c_str());
+    if (hMapping == NULL)
+    {
+        Dbg(L"Warning: Could not open the live counters '%s'. Last Error: %d.", name.c_str(), (int)GetLastError());
+        return;
+    }
+
+    void* view = MapViewOfFile(hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+
+    // The view keeps the section alive.
+    CloseHandle(hMapping);
+
+    if (view == nullptr)
+    {
+        Dbg(L"Warning: Could not map the live counters '%s'. Last Error: %d.", name.c_str(), (int)GetLastError());
+        return;
+    }
+
+    // Do not trust the header beyond the size of the view.
+    LiveCountersHeader* header = reinterpret_cast<LiveCountersHeader*>(view);
+    MEMORY_BASIC_INFORMATION info;
+    if (header->Version != LIVE_COUNTERS_VERSION
+        || VirtualQuery(view, &info, sizeof(info)) == 0
+        || info.RegionSize < sizeof(LiveCountersHeader) + (size_t)header->SlotCount * sizeof(ProcessLiveCounters))
+    {
+        Dbg(L"Warning: The live counters '%s' do not match the expected layout.", name.c_str());
+        UnmapViewOfFile(view);
+        return;
+    }
+
+    ProcessLiveCounters* slot = ClaimSlot(reinterpret_cast<ProcessLiveCounters*>(header + 1), header->SlotCount);
+    if (slot == nullptr)
+    {
+        InterlockedIncrement(&header->ProcessesWithoutSlot);
+        UnmapViewOfFile(view);
+        return;
+    }
+
+    InterlockedIncrement(&header->Processes);
+    g_liveCountersHeader = header;
+    g_liveCounters = slot;
+}
+
+void CountReportsWritten(LONG messageCount, size_t bytes)
+{
+    ProcessLiveCounters* slot = g_liveCounters;
+    if (slot == nullptr)
+    {
+        return;
+    }
+
+    InterlockedExchangeAdd64(&slot->Counters[(int)LiveCounter::ReportsSent], messageCount);
+    InterlockedExchangeAdd64(&slot->Counters[(int)LiveCounter::ReportBytes], (LONG64)bytes);
+    EnsureLiveCountersPublisherStarted();
+}
+
+void PublishFinalLiveCounters()
+{
+    ProcessLiveCounters* slot = g_liveCounters;
+    if (slot == nullptr)
+    {
+        return;
+    }
+
+    // Stops the publisher, and the counting of the reports still written by other threads.
+    g_liveCounters = nullptr;
+
+    CopyCountersToSlot(slot);
+    for (int i = 0; i < (int)LiveCounter::Count; i++)
+    {
+        if (s_liveCounterIsCumulative[i])
+        {
+            InterlockedExchangeAdd64(&g_liveCountersHeader->ExitedTotals[i], slot->Counters[i]);
+        }
+    }
+
+    // The slot stays readable (as exited) until another process of the pip claims it.
+    InterlockedExchange(&slot->State, LiveCountersSlotState_Exited);
+}
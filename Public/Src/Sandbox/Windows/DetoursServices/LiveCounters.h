@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Live counters of the detoured processes of a pip, for the DetoursMonitor tool.
+//
+// With FileAccessManifestExtraFlag::PublishLiveCounters, the consumer creates a mapping named after the message count
+// semaphore, with a header identifying the pip and a fixed number of process slots. Each detoured process claims a slot at
+// attach and publishes its counters there while it runs, instead of only reporting them in ReportProcessData when it exits.
+// Reports are counted as they are written; the other counters are copied into the slot by a background thread every
+// LIVE_COUNTERS_PUBLISH_INTERVAL_MS. When a process exits, its cumulative counters are added to the totals of the header and
+// its slot can be claimed again, so a pip with more processes than slots keeps its totals.
+//
+// This header only depends on <windows.h>, so that the monitor can include it for the layout.
+//
+// IMPORTANT: Keep the layout in sync with the C# version declared in LiveCounters.cs
+
+#pragma once
+
+#include <windows.h>
+#include <stdint.h>
+
+// Appended to the message count semaphore name to form the name of the mapping holding the live counters.
+// The monitor finds the mappings of all pips by this suffix.
+#define LIVE_COUNTERS_NAME_SUFFIX L"_LiveCounters"
+
+#define LIVE_COUNTERS_VERSION 1
+
+// Interval at which a process copies its counters into its slot.
+#define LIVE_COUNTERS_PUBLISH_INTERVAL_MS 250
+
+// Room for counters in a slot and in the totals of the header; the ones not listed below are 0.
+#define LIVE_COUNTERS_CAPACITY 12
+
+//
+// Higher-order macro that enumerates the live counters, and whether each one is cumulative (and added to the totals of the
+// pip when a process exits) or a gauge of the current state of the process.
+//
+#define FOR_ALL_LIVE_COUNTERS(m) \
+    m(ReportsSent,        true)   \
+    m(ReportBytes,        true)   \
+    m(HandleOverlays,     false)  \
+    m(PolicyCacheHits,    true)   \
+    m(PolicyCacheMisses,  true)   \
+    m(DetourMicroseconds, true)   \
+    m(PrivateHeapBytes,   false)  \
+    m(CacheShrinks,       true)
+
+#define GEN_LIVE_COUNTER_ID(name, cumulative) name,
+enum class LiveCounter {
+    FOR_ALL_LIVE_COUNTERS(GEN_LIVE_COUNTER_ID)
+    Count
+};
+#undef GEN_LIVE_COUNTER_ID
+
+static_assert((int)LiveCounter::Count <= LIVE_COUNTERS_CAPACITY, "The live counters must fit in a slot");
+
+enum LiveCountersSlotState : LONG
+{
+    LiveCountersSlotState_Free = 0,
+    LiveCountersSlotState_Running = 1,
+    LiveCountersSlotState_Exited = 2,
+    // Taken by a process that is resetting the slot; not to be read.
+    LiveCountersSlotState_Claiming = 3,
+};
+
+// One process of the pip. Slots are a cache line apart, so that processes do not share lines.
+typedef struct alignas(64) ProcessLiveCounters_t
+{
+    volatile LONG State;
+    volatile DWORD ProcessId;
+    // System time (as a FILETIME) of the last copy of the counters into the slot.
+    volatile LONG64 PublishTime;
+    volatile LONG64 Counters[LIVE_COUNTERS_CAPACITY];
+} ProcessLiveCounters;
+
+// Start of the mapping, followed by SlotCount slots.
+typedef struct alignas(64) LiveCountersHeader_t
+{
+    uint32_t Version;
+    uint32_t SlotCount;
+    uint64_t PipId;
+    uint32_t ConsumerProcessId;
+    // Number of processes that claimed a slot, and how many of them could not find one.
+    volatile LONG Processes;
+    volatile LONG ProcessesWithoutSlot;
+    // Sum of the cumulative counters of the processes that exited.
+    volatile LONG64 ExitedTotals[LIVE_COUNTERS_CAPACITY];
+} LiveCountersHeader;
+
+static_assert(sizeof(ProcessLiveCounters) == 128, "Keep in sync with LiveCounters.cs");
+static_assert(sizeof(LiveCountersHeader) == 128, "Keep in sync with LiveCounters.cs");
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Opens the live counters of the pip and claims a slot when FileAccessManifestExtraFlag::PublishLiveCounters is set.
+/// Failing to do either is not fatal; the process then publishes nothing.
+void InitializeLiveCounters();
+
+/// Counts reports written to the report channel. Does nothing when the process has no slot.
+void CountReportsWritten(LONG messageCount, size_t bytes);
+
+/// Copies the counters into the slot a last time, adds them to the totals of the pip and releases the slot.
+/// Call it from DllProcessDetach, after the last report has been written.
+void PublishFinalLiveCounters();
@@ -0,0 +1,89 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <string>
+
+#include "LookupProfile.h"
+#include "DebuggingHelpers.h"
+#include "globals.h"
+#include "PolicySearch.h"
+
+// Appended to the message count semaphore name to form the name of the mapping holding the lookup counters.
+#define LOOKUP_PROFILE_NAME_SUFFIX L"_ManifestLookupProfile"
+
+// Start of the mapping, which the consumer creates before the first detoured process of the pip starts.
+// The header is followed by ProbeLengthCount 64-bit counts of lookups per number of probes, and then by HitCounterCount 32-bit
+// counts of lookups per node, indexed by PathId & PathIdIndexMask. The last field only keeps the 64-bit counts aligned.
+//
+// IMPORTANT: Keep this in sync with the C# version declared in ManifestLookupCounters.cs
+typedef struct LookupProfileHeader_t
+{
+    uint32_t HitCounterCount;
+    uint32_t PathIdIndexMask;
+    uint32_t ProbeLengthCount;
+    uint32_t Reserved;
+} LookupProfileHeader;
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+static ManifestLookupCounters g_lookupCounters;
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+void InitializeLookupProfile()
+{
+    if (g_manifestLookupProfile == nullptr || !g_manifestLookupProfile->IsEnabled() || g_internalDetoursErrorNotificationFile == nullptr)
+    {
+        return;
+    }
+
+    // Object names don't allow '\\'; use the same derivation as for the message count semaphore.
+    std::wstring name(g_internalDetoursErrorNotificationFile);
+    std::replace(name.begin(), name.end(), L'\\', L'_');
+    name.append(LOOKUP_PROFILE_NAME_SUFFIX);
+
+    // NOTE: This calls the real OpenFileMappingW(), because the detoured functions have not been installed yet.
+    HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name.c_str());
+    if (hMapping == NULL)
+    {
+        Dbg(L"Warning: Could not open the manifest lookup profile '%s'. Last Error: %d.", name.c_str(), (int)GetLastError());
+        return;
+    }
+
+    void* view = MapViewOfFile(hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+
+    // The view keeps the section alive.
+    CloseHandle(hMapping);
+
+    if (view == nullptr)
+    {
+        Dbg(L"Warning: Could not map the manifest lookup profile '%s'. Last Error: %d.", name.c_str(), (int)GetLastError());
+        return;
+    }
+
+    // Do not trust the header beyond the size of the view.
+    LookupProfileHeader const* header = reinterpret_cast<LookupProfileHeader const*>(view);
+    MEMORY_BASIC_INFORMATION info;
+    if (header->ProbeLengthCount == 0
+        || VirtualQuery(view, &info, sizeof(info)) == 0
+        || info.RegionSize < sizeof(LookupProfileHeader) + (size_t)header->ProbeLengthCount * sizeof(LONG64) + (size_t)header->HitCounterCount * sizeof(LONG))
+    {
+        Dbg(L"Warning: The manifest lookup profile '%s' does not match the expected layout.", name.c_str());
+        UnmapViewOfFile(view);
+        return;
+    }
+
+    g_lookupCounters.ProbeLengthHistogram = reinterpret_cast<volatile LONG64*>(reinterpret_cast<char*>(view) + sizeof(LookupProfileHeader));
+    g_lookupCounters.ProbeLengthCount = header->ProbeLengthCount;
+    g_lookupCounters.HitCounts = reinterpret_cast<volatile LONG*>(g_lookupCounters.ProbeLengthHistogram + header->ProbeLengthCount);
+    g_lookupCounters.HitCounterCount = header->HitCounterCount;
+    g_lookupCounters.PathIdIndexMask = header->PathIdIndexMask;
+    g_manifestLookupCounters = &g_lookupCounters;
+}
@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Profile of the lookups of the manifest tree of a pip (see ManifestLookupProfile).
+//
+// FileAccessManifest.cs lays out the children of each node in a hash table without knowing which of them get looked up. When the
+// manifest asks for it, the consumer creates a mapping named after the message count semaphore, and ManifestRecord::FindChild
+// counts there each child it finds, by the index of its path id, and the number of probes the lookup took. The counts of all the
+// processes of the pip add up; the consumer reads them once the pip is done, and can give the hot children of each node the
+// first buckets of its table in the manifests of later runs of the pip.
+//
+// Only the lookups that find a child are counted: the ones that find nothing have no node to count them against.
+
+#pragma once
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Opens the lookup counters of the pip when g_manifestLookupProfile is enabled, and has FindChild count in them.
+/// Failing to open them is not fatal; the process then counts nothing. Must be called before the detours are attached.
+void InitializeLookupProfile();
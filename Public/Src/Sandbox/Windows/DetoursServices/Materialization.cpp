@@ -0,0 +1,99 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+
+#include "DebuggingHelpers.h"
+#include "DetoursHelpers.h"
+#include "Materialization.h"
+
+// Appended to the message count semaphore name to form the name of the pipe BuildXL serves materialization requests on.
+#define MATERIALIZATION_PIPE_NAME_SUFFIX L"_Materialize"
+
+// IMPORTANT: Keep these in sync with the C# versions declared in MaterializationServer.cs
+typedef struct MaterializationRequest_t
+{
+    uint32_t PathId;
+    uint32_t ProcessId;
+} MaterializationRequest;
+
+#define MATERIALIZATION_STATUS_SUCCEEDED 0
+
+// Null when there is no error notification file to derive the name from.
+static std::wstring* g_materializationPipeName = nullptr;
+
+// The path ids this process got BuildXL to materialize.
+static SRWLOCK g_materializedPathIdsLock = SRWLOCK_INIT;
+static std::unordered_set<DWORD>* g_materializedPathIds = nullptr;
+
+void InitializeMaterialization()
+{
+    if (g_internalDetoursErrorNotificationFile == nullptr)
+    {
+        return;
+    }
+
+    // Pipe names don't allow '\\' after the prefix; use the same derivation as for the message count semaphore.
+    std::wstring name(g_internalDetoursErrorNotificationFile);
+    std::replace(name.begin(), name.end(), L'\\', L'_');
+    name.insert(0, L"\\\\.\\pipe\\");
+    name.append(MATERIALIZATION_PIPE_NAME_SUFFIX);
+
+    g_materializationPipeName = new std::wstring(std::move(name));
+    g_materializedPathIds = new std::unordered_set<DWORD>();
+}
+
+bool MaterializeIfNeeded(PolicyResult const& policyResult)
+{
+    if (!policyResult.MaterializeOnOpen() || !policyResult.IsExactManifestMatch())
+    {
+        return true;
+    }
+
+    if (g_materializationPipeName == nullptr)
+    {
+        return false;
+    }
+
+    DWORD pathId = policyResult.GetPathId();
+
+    AcquireSRWLockShared(&g_materializedPathIdsLock);
+    bool materialized = g_materializedPathIds->find(pathId) != g_materializedPathIds->end();
+    ReleaseSRWLockShared(&g_materializedPathIdsLock);
+
+    if (materialized)
+    {
+        return true;
+    }
+
+    // The lock is not held while waiting: other threads go on opening other files. Threads racing on the same file each make
+    // a request, which BuildXL answers for the second one as soon as the file is there.
+    MaterializationRequest request = { pathId, GetCurrentProcessId() };
+    uint32_t status = 0;
+    DWORD bytesRead = 0;
+
+    // NOTE: CallNamedPipeW opens the pipe with CreateFileW, which runs undetoured since the caller holds a DetouredScope.
+    if (!CallNamedPipeW(g_materializationPipeName->c_str(), &request, sizeof(request), &status, sizeof(status), &bytesRead, NMPWAIT_WAIT_FOREVER)
+        || bytesRead != sizeof(status))
+    {
+        Dbg(L"Warning: Could not request the materialization of '%s' on '%s'. Last Error: %d.",
+            policyResult.GetCanonicalizedPath().GetPathString(), g_materializationPipeName->c_str(), (int)GetLastError());
+        return false;
+    }
+
+    if (status != MATERIALIZATION_STATUS_SUCCEEDED)
+    {
+        Dbg(L"Warning: BuildXL could not materialize '%s'.", policyResult.GetCanonicalizedPath().GetPathString());
+        return false;
+    }
+
+    AcquireSRWLockExclusive(&g_materializedPathIdsLock);
+    g_materializedPathIds->insert(pathId);
+    ReleaseSRWLockExclusive(&g_materializedPathIdsLock);
+
+    return true;
+}
@@ -0,0 +1,25 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// On-demand materialization of the inputs BuildXL has not placed on disk yet.
+//
+// A path added to the manifest with FileAccessPolicy_MaterializeOnOpen may be missing when the pip starts. The first open of
+// such a path in a process asks BuildXL to materialize it, through a named pipe named after the message count semaphore, and
+// waits for the answer before the real open proceeds. BuildXL answers right away for the files it already materialized for
+// another process of the pip.
+
+#pragma once
+
+#include "PolicyResult.h"
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Derives the name of the materialization pipe. Called once the manifest is parsed.
+void InitializeMaterialization();
+
+/// Asks BuildXL to materialize the path of a policy with FileAccessPolicy_MaterializeOnOpen, unless this process already did.
+/// The policy only applies to a path matched exactly by the manifest. Returns false if the request could not be made or
+/// BuildXL could not materialize the file; the open proceeds regardless, and then fails as it would have without the request.
+bool MaterializeIfNeeded(PolicyResult const& policyResult);
@@ -0,0 +1,98 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "MemoryPressure.h"
+#include "DebuggingHelpers.h"
+#include "FeatureCounters.h"
+#include "FileAccessHelpers.h"
+#include "KnownDirectoryCache.h"
+#include "PolicyResult.h"
+#include "ReparsePointCache.h"
+#include "VolumeCache.h"
+
+extern volatile LONG64 g_detoursCacheShrinks;
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+// Null when caches are not shrunk under memory pressure.
+static HANDLE g_lowMemoryNotification = NULL;
+
+static volatile LONG g_memoryPressureMonitorStarted = 0;
+
+// ----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+// ----------------------------------------------------------------------------
+
+static void ShrinkCaches()
+{
+    size_t policyResults = ShrinkPolicyResultCache(MEMORY_PRESSURE_CACHE_FLOOR);
+    size_t reparsePoints = ShrinkReparsePointCache(MEMORY_PRESSURE_CACHE_FLOOR);
+    size_t knownDirectories = ShrinkKnownDirectoryCache(MEMORY_PRESSURE_CACHE_FLOOR);
+    size_t volumeDirectories = ShrinkVolumeCache(MEMORY_PRESSURE_CACHE_FLOOR);
+
+    InterlockedIncrement64(&g_detoursCacheShrinks);
+    Dbg(L"Memory is low: shed %d cached policy results, %d reparse point probes, %d known directories and %d volume lookups",
+        (int)policyResults, (int)reparsePoints, (int)knownDirectories, (int)volumeDirectories);
+}
+
+static DWORD WINAPI MemoryPressureMonitor(LPVOID lpParam)
+{
+    UNREFERENCED_PARAMETER(lpParam);
+
+    while (WaitForSingleObject(g_lowMemoryNotification, INFINITE) == WAIT_OBJECT_0)
+    {
+        ShrinkCaches();
+
+        // The notification stays signaled as long as memory is low; give the caches time to refill with what is actually in use.
+        Sleep(MEMORY_PRESSURE_SHRINK_INTERVAL_MS);
+    }
+
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+void InitializeMemoryPressureMonitor()
+{
+    if (!ShrinkCachesUnderMemoryPressure())
+    {
+        return;
+    }
+
+    g_lowMemoryNotification = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+    if (g_lowMemoryNotification == NULL)
+    {
+        Dbg(L"Warning: Could not subscribe to the low memory notification. Last Error: %d", (int)GetLastError());
+    }
+}
+
+void EnsureMemoryPressureMonitorStarted()
+{
+    // Not started from DllProcessAttach to stay clear of the loader lock.
+    if (g_lowMemoryNotification == NULL
+        || g_memoryPressureMonitorStarted != 0
+        || InterlockedCompareExchange(&g_memoryPressureMonitorStarted, 1, 0) != 0)
+    {
+        return;
+    }
+
+    HANDLE threadHandle = CreateThread(NULL, 0, MemoryPressureMonitor, nullptr, 0, nullptr);
+
+    if (threadHandle == NULL)
+    {
+        // The caches keep their own bounds.
+        Dbg(L"Warning: Could not create the memory pressure monitor thread. Last Error: %d", (int)GetLastError());
+    }
+    else
+    {
+        SetThreadPriority(threadHandle, THREAD_PRIORITY_BELOW_NORMAL);
+        CloseHandle(threadHandle);
+        IncrementFeatureCounter(FeatureCounter::MemoryPressureMonitorsStarted);
+    }
+}
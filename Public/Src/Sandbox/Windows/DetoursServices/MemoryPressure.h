@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Shedding of the per-process caches of the detours when the machine runs low on memory.
+//
+// With FileAccessManifestExtraFlag::ShrinkCachesUnderMemoryPressure, a background thread waits on the low memory resource
+// notification of the system. While the notification is signaled, the thread has the caches that grow with the paths a
+// process touches (policy results, reparse point probes, known directories and the volumes of directories) shed their cold entries, down to
+// MEMORY_PRESSURE_CACHE_FLOOR entries each, every MEMORY_PRESSURE_SHRINK_INTERVAL_MS. No cache needs any of its entries to
+// be correct, so a shed entry only costs searching or probing again.
+//
+// Each shrink is logged as a debug message and counted in the live counters of the process (LiveCounter::CacheShrinks).
+
+#pragma once
+
+// Number of entries each cache keeps when shrinking, however cold they are.
+#define MEMORY_PRESSURE_CACHE_FLOOR 1024
+
+// Interval between two shrinks while memory stays low.
+#define MEMORY_PRESSURE_SHRINK_INTERVAL_MS 2000
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Subscribes to the low memory resource notification when FileAccessManifestExtraFlag::ShrinkCachesUnderMemoryPressure is set.
+/// Failing to do so is not fatal; the caches then keep their own bounds only.
+void InitializeMemoryPressureMonitor();
+
+/// Starts the thread shrinking the caches under memory pressure, if there is a notification to wait on.
+/// Called by the caches when they allocate their tables, as there is nothing to shed before.
+void EnsureMemoryPressureMonitorStarted();
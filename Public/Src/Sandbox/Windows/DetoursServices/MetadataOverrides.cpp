@@ -11,7 +11,7 @@
 // it is quite possible that there are latent bugs in which tools assume that (current time - file time) is positive.
 const FILETIME NewInputTimestamp{ 0x9add0900, 0x1c1ab8d };
 
-static LARGE_INTEGER GetNewInputTimestampAsLargeInteger() {
+LARGE_INTEGER GetNewInputTimestampAsLargeInteger() {
     LARGE_INTEGER i;
     i.LowPart = NewInputTimestamp.dwLowDateTime;
     i.HighPart = static_cast<LONG>(NewInputTimestamp.dwHighDateTime);
@@ -19,34 +19,7 @@ static LARGE_INTEGER GetNewInputTimestampAsLargeInteger() {
 }
 
 void OverrideTimestampsForInputFile(FILE_BASIC_INFO* result) {
-    LARGE_INTEGER newTimestamp = GetNewInputTimestampAsLargeInteger();
-
-	if (NormalizeReadTimestamps())
-	{
-		result->CreationTime = newTimestamp;
-		result->LastAccessTime = newTimestamp;
-		result->LastWriteTime = newTimestamp;
-		result->ChangeTime = newTimestamp;
-	}
-	else
-	{
-		if (result->CreationTime.QuadPart < newTimestamp.QuadPart)
-		{
-			result->CreationTime = newTimestamp;
-		}
-		if (result->LastAccessTime.QuadPart < newTimestamp.QuadPart)
-		{
-			result->LastAccessTime = newTimestamp;
-		}
-		if (result->LastWriteTime.QuadPart < newTimestamp.QuadPart)
-		{
-			result->LastWriteTime = newTimestamp;
-		}
-		if (result->ChangeTime.QuadPart < newTimestamp.QuadPart)
-		{
-			result->ChangeTime = newTimestamp;
-		}
-	}
+    OverrideTimestampsForInputFileInformation(result);
 }
 
 void ScrubShortFileName(WIN32_FIND_DATAW* result) {
@@ -38,8 +38,58 @@ void OverrideTimestampsForInputFile(TResult* result) {
 	}
 }
 
+// NewInputTimestamp as the LARGE_INTEGER used by the native file information classes.
+LARGE_INTEGER GetNewInputTimestampAsLargeInteger();
+
+// Replaces timestamps to be NewInputTimestamp.
+// This implementation works for types with LARGE_INTEGER CreationTime, LastAccessTime, LastWriteTime, and ChangeTime.
+// This includes FILE_BASIC_INFO and the directory entries returned by NtQueryDirectoryFile (e.g. FILE_BOTH_DIR_INFORMATION).
+template<typename TInformation>
+void OverrideTimestampsForInputFileInformation(TInformation* result) {
+    static_assert(std::is_same<decltype(result->CreationTime), LARGE_INTEGER>::value, "result->CreationTime must be a LARGE_INTEGER");
+    static_assert(std::is_same<decltype(result->LastAccessTime), LARGE_INTEGER>::value, "result->LastAccessTime must be a LARGE_INTEGER");
+    static_assert(std::is_same<decltype(result->LastWriteTime), LARGE_INTEGER>::value, "result->LastWriteTime must be a LARGE_INTEGER");
+    static_assert(std::is_same<decltype(result->ChangeTime), LARGE_INTEGER>::value, "result->ChangeTime must be a LARGE_INTEGER");
+
+    LARGE_INTEGER newTimestamp = GetNewInputTimestampAsLargeInteger();
+
+	if (NormalizeReadTimestamps())
+	{
+		result->CreationTime = newTimestamp;
+		result->LastAccessTime = newTimestamp;
+		result->LastWriteTime = newTimestamp;
+		result->ChangeTime = newTimestamp;
+	}
+	else
+	{
+		if (result->CreationTime.QuadPart < newTimestamp.QuadPart)
+		{
+			result->CreationTime = newTimestamp;
+		}
+		if (result->LastAccessTime.QuadPart < newTimestamp.QuadPart)
+		{
+			result->LastAccessTime = newTimestamp;
+		}
+		if (result->LastWriteTime.QuadPart < newTimestamp.QuadPart)
+		{
+			result->LastWriteTime = newTimestamp;
+		}
+		if (result->ChangeTime.QuadPart < newTimestamp.QuadPart)
+		{
+			result->ChangeTime = newTimestamp;
+		}
+	}
+}
+
 void OverrideTimestampsForInputFile(FILE_BASIC_INFO* result);
 
 // Removes the short file name from directory-entry data (simulate short file names disabled on the volume).
-// TODO: Could scrub FILE_ID_BOTH_DIR_INFO too (https://msdn.microsoft.com/en-us/library/windows/desktop/aa364226(v=vs.85).aspx)
 void ScrubShortFileName(WIN32_FIND_DATAW* result);
+
+// Same as above for the directory entries returned by NtQueryDirectoryFile that have a short name
+// (FILE_BOTH_DIR_INFORMATION and FILE_ID_BOTH_DIR_INFORMATION).
+template<typename TInformation>
+void ScrubShortFileNameOfDirectoryEntry(TInformation* result) {
+    result->ShortNameLength = 0;
+    ZeroMemory(&(result->ShortName[0]), sizeof(result->ShortName));
+}
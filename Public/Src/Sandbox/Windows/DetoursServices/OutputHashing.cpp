@@ -0,0 +1,286 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "OutputHashing.h"
+
+// IMPORTANT: Keep these in sync with VsoHash.cs
+#define VSO_PAGE_SIZE (64 * 1024)
+#define VSO_PAGES_PER_BLOCK 32
+
+// The rolling id starts from the seed itself, not from its hash.
+static const char VsoRollingIdSeed[] = "VSO Content Identifier Seed";
+
+// ----------------------------------------------------------------------------
+// SHA-256
+// ----------------------------------------------------------------------------
+
+static const uint32_t Sha256RoundConstants[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t RotateRight(uint32_t value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+void Sha256::Reset()
+{
+    m_state[0] = 0x6a09e667;
+    m_state[1] = 0xbb67ae85;
+    m_state[2] = 0x3c6ef372;
+    m_state[3] = 0xa54ff53a;
+    m_state[4] = 0x510e527f;
+    m_state[5] = 0x9b05688c;
+    m_state[6] = 0x1f83d9ab;
+    m_state[7] = 0x5be0cd19;
+    m_length = 0;
+    m_chunkLength = 0;
+}
+
+void Sha256::Transform(BYTE const* chunk)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)chunk[4 * i] << 24) | ((uint32_t)chunk[4 * i + 1] << 16) | ((uint32_t)chunk[4 * i + 2] << 8) | (uint32_t)chunk[4 * i + 3];
+    }
+
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+    uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t temp1 = h + s1 + choice + Sha256RoundConstants[i] + w[i];
+        uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t temp2 = s0 + majority;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    m_state[0] += a;
+    m_state[1] += b;
+    m_state[2] += c;
+    m_state[3] += d;
+    m_state[4] += e;
+    m_state[5] += f;
+    m_state[6] += g;
+    m_state[7] += h;
+}
+
+void Sha256::Update(BYTE const* data, size_t length)
+{
+    m_length += length;
+
+    if (m_chunkLength > 0)
+    {
+        size_t toCopy = sizeof(m_chunk) - m_chunkLength;
+        if (toCopy > length)
+        {
+            toCopy = length;
+        }
+
+        memcpy(m_chunk + m_chunkLength, data, toCopy);
+        m_chunkLength += toCopy;
+        data += toCopy;
+        length -= toCopy;
+
+        if (m_chunkLength < sizeof(m_chunk))
+        {
+            return;
+        }
+
+        Transform(m_chunk);
+        m_chunkLength = 0;
+    }
+
+    while (length >= sizeof(m_chunk))
+    {
+        Transform(data);
+        data += sizeof(m_chunk);
+        length -= sizeof(m_chunk);
+    }
+
+    memcpy(m_chunk, data, length);
+    m_chunkLength = length;
+}
+
+void Sha256::Finalize(BYTE* hash)
+{
+    uint64_t lengthInBits = m_length * 8;
+
+    // A 1 bit, zeros up to 8 bytes short of a whole chunk, and the length in bits.
+    static const BYTE padding[64] = { 0x80 };
+    size_t paddingLength = m_chunkLength < 56 ? 56 - m_chunkLength : 120 - m_chunkLength;
+    Update(padding, paddingLength);
+
+    BYTE lengthBytes[8];
+    for (int i = 0; i < 8; i++)
+    {
+        lengthBytes[i] = (BYTE)(lengthInBits >> (56 - 8 * i));
+    }
+
+    Update(lengthBytes, sizeof(lengthBytes));
+    assert(m_chunkLength == 0);
+
+    for (int i = 0; i < 8; i++)
+    {
+        hash[4 * i] = (BYTE)(m_state[i] >> 24);
+        hash[4 * i + 1] = (BYTE)(m_state[i] >> 16);
+        hash[4 * i + 2] = (BYTE)(m_state[i] >> 8);
+        hash[4 * i + 3] = (BYTE)m_state[i];
+    }
+}
+
+// ----------------------------------------------------------------------------
+// OutputHasher
+// ----------------------------------------------------------------------------
+
+OutputHasher::OutputHasher()
+    : m_valid(true), m_length(0), m_pageLength(0), m_blockPageCount(0), m_hasPendingBlock(false), m_hasRollingId(false)
+{
+    InitializeSRWLock(&m_lock);
+}
+
+void OutputHasher::Write(uint64_t offset, BYTE const* data, size_t length)
+{
+    if (!m_valid)
+    {
+        return;
+    }
+
+    if (offset != m_length)
+    {
+        m_valid = false;
+        return;
+    }
+
+    m_length += length;
+
+    while (length > 0)
+    {
+        size_t toHash = VSO_PAGE_SIZE - m_pageLength;
+        if (toHash > length)
+        {
+            toHash = length;
+        }
+
+        m_page.Update(data, toHash);
+        m_pageLength += toHash;
+        data += toHash;
+        length -= toHash;
+
+        if (m_pageLength == VSO_PAGE_SIZE)
+        {
+            CompletePage();
+        }
+    }
+}
+
+void OutputHasher::CompletePage()
+{
+    BYTE pageHash[OUTPUT_HASH_SIZE];
+    m_page.Finalize(pageHash);
+    m_page.Reset();
+    m_pageLength = 0;
+
+    m_block.Update(pageHash, sizeof(pageHash));
+    if (++m_blockPageCount == VSO_PAGES_PER_BLOCK)
+    {
+        CompleteBlock();
+    }
+}
+
+void OutputHasher::CompleteBlock()
+{
+    if (m_hasPendingBlock)
+    {
+        AddBlockToRollingId(m_pendingBlockHash, false);
+    }
+
+    m_block.Finalize(m_pendingBlockHash);
+    m_block.Reset();
+    m_blockPageCount = 0;
+    m_hasPendingBlock = true;
+}
+
+void OutputHasher::AddBlockToRollingId(BYTE const* blockHash, bool isFinalBlock)
+{
+    Sha256 rollingId;
+    if (m_hasRollingId)
+    {
+        rollingId.Update(m_rollingId, sizeof(m_rollingId));
+    }
+    else
+    {
+        rollingId.Update(reinterpret_cast<BYTE const*>(VsoRollingIdSeed), sizeof(VsoRollingIdSeed) - 1);
+    }
+
+    BYTE finalBlockByte = isFinalBlock ? 1 : 0;
+    rollingId.Update(blockHash, OUTPUT_HASH_SIZE);
+    rollingId.Update(&finalBlockByte, 1);
+    rollingId.Finalize(m_rollingId);
+    m_hasRollingId = true;
+}
+
+bool OutputHasher::TryFinalize(BYTE* hash)
+{
+    if (!m_valid)
+    {
+        return false;
+    }
+
+    // A partial block, or the empty block of an empty file, is the final block; otherwise the last complete one is.
+    if (m_pageLength > 0)
+    {
+        CompletePage();
+    }
+
+    if (m_blockPageCount > 0 || !m_hasPendingBlock)
+    {
+        if (m_hasPendingBlock)
+        {
+            AddBlockToRollingId(m_pendingBlockHash, false);
+        }
+
+        BYTE blockHash[OUTPUT_HASH_SIZE];
+        m_block.Finalize(blockHash);
+        AddBlockToRollingId(blockHash, true);
+    }
+    else
+    {
+        AddBlockToRollingId(m_pendingBlockHash, true);
+    }
+
+    memcpy(hash, m_rollingId, OUTPUT_HASH_SIZE);
+
+    // The state is consumed.
+    m_valid = false;
+    return true;
+}
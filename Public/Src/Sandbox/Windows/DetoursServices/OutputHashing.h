@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Streaming content hashing of the files the detoured processes write.
+//
+// With FileAccessManifestExtraFlag::HashOutputsWhileWriting, a handle that creates or truncates a file it may write gets an
+// OutputHasher in its overlay. The writes through the handle feed the hasher as long as they are sequential, i.e., each write
+// starts where the previous one ended. When the handle is closed (CloseHandle), the hash is reported along with the size and
+// last write time of the file. A hash that got invalidated (a write elsewhere, a write whose outcome is unknown at return, a size
+// that disagrees with the bytes hashed) is reported as such. Writes through a mapped view, another handle or another process are
+// not seen, so even a valid hash is only a hint that BuildXL does not trust as the content hash of the output.
+//
+// The hash is the VSO0 content hash BuildXL hashes outputs with by default (see VsoHash.cs): the SHA-256 of the 64KB pages of
+// each 2MB block are hashed into a block hash, and the block hashes are chained into a rolling SHA-256 from a fixed seed.
+
+#pragma once
+
+#include "DataTypes.h"
+
+#define OUTPUT_HASH_SIZE 32
+
+// SHA-256, as defined by FIPS 180-4.
+class Sha256
+{
+public:
+    Sha256() { Reset(); }
+
+    void Reset();
+    void Update(_In_reads_bytes_(length) BYTE const* data, size_t length);
+    void Finalize(_Out_writes_bytes_all_(OUTPUT_HASH_SIZE) BYTE* hash);
+
+private:
+    void Transform(BYTE const* chunk);
+
+    uint32_t m_state[8];
+    uint64_t m_length;
+    BYTE m_chunk[64];
+    size_t m_chunkLength;
+};
+
+// Computes the VSO0 hash of the bytes written sequentially through a handle. Thread-safe.
+class OutputHasher
+{
+public:
+    OutputHasher();
+
+    OutputHasher(const OutputHasher&) = delete;
+    OutputHasher& operator=(const OutputHasher&) = delete;
+
+    // Indicates if the writes so far were all sequential. Once invalidated, a hasher stays so.
+    bool IsValid() const { return m_valid; }
+
+    // Serializes the writes to the file, so that each one is hashed in the order it was made.
+    void Lock() { AcquireSRWLockExclusive(&m_lock); }
+    void Unlock() { ReleaseSRWLockExclusive(&m_lock); }
+
+    // Hashes the bytes written at the given offset. A write anywhere but at the end of the bytes hashed so far invalidates the hash.
+    // Must be called under Lock.
+    void Write(uint64_t offset, _In_reads_bytes_(length) BYTE const* data, size_t length);
+
+    // Must be called under Lock.
+    void Invalidate() { m_valid = false; }
+
+    // Number of bytes hashed so far.
+    uint64_t GetLength() const { return m_length; }
+
+    // Completes the hash of the bytes hashed so far. Returns false if the hash got invalidated. Must be called under Lock, once.
+    bool TryFinalize(_Out_writes_bytes_all_(OUTPUT_HASH_SIZE) BYTE* hash);
+
+private:
+    void CompletePage();
+    void CompleteBlock();
+    void AddBlockToRollingId(BYTE const* blockHash, bool isFinalBlock);
+
+    SRWLOCK m_lock;
+    volatile bool m_valid;
+    uint64_t m_length;
+
+    Sha256 m_page;
+    size_t m_pageLength;
+    Sha256 m_block;
+    size_t m_blockPageCount;
+
+    // The last completed block is only known to be the final one once the file is closed.
+    BYTE m_pendingBlockHash[OUTPUT_HASH_SIZE];
+    bool m_hasPendingBlock;
+
+    BYTE m_rollingId[OUTPUT_HASH_SIZE];
+    bool m_hasRollingId;
+};
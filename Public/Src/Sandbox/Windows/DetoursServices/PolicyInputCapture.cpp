@@ -0,0 +1,163 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <string>
+#include <vector>
+
+#include "PolicyInputCapture.h"
+#include "DebuggingHelpers.h"
+#include "FileAccessHelpers.h"
+#include "globals.h"
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+bool g_policyInputCaptureActive = false;
+
+static SRWLOCK g_policyInputCaptureLock = SRWLOCK_INIT;
+static HANDLE g_policyInputCaptureFile = INVALID_HANDLE_VALUE;
+static std::vector<BYTE>* g_policyInputCaptureBuffer = nullptr;
+
+// ----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+// ----------------------------------------------------------------------------
+
+/// Writes the whole buffer to the capture. Stops capturing if that fails, as the records that follow would not line up.
+/// Must be called with the capture lock held.
+static void WriteCaptureBuffer()
+{
+    std::vector<BYTE>& buffer = *g_policyInputCaptureBuffer;
+    size_t written = 0;
+    while (written < buffer.size())
+    {
+        DWORD chunk;
+        if (!WriteFile(g_policyInputCaptureFile, buffer.data() + written, (DWORD)(buffer.size() - written), &chunk, nullptr) || chunk == 0)
+        {
+            Dbg(L"Warning: Could not write the policy input capture. Last Error: %d. Capturing stops.", (int)GetLastError());
+            g_policyInputCaptureActive = false;
+            break;
+        }
+
+        written += chunk;
+    }
+
+    buffer.clear();
+}
+
+/// Length of a string, capped to what a record holds.
+static size_t CappedLength(StrType str)
+{
+    size_t length = str == nullptr ? 0 : wcslen(str);
+    return length > UINT16_MAX ? UINT16_MAX : length;
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+void InitializePolicyInputCapture()
+{
+    if (!CapturePolicyInputs() || g_internalDetoursErrorNotificationFile == nullptr || g_manifestPtr == nullptr)
+    {
+        return;
+    }
+
+    std::wstring path(g_internalDetoursErrorNotificationFile);
+    path.append(L".");
+    path.append(std::to_wstring(GetCurrentProcessId()));
+    path.append(POLICY_CAPTURE_FILE_SUFFIX);
+
+    // NOTE: This calls the real CreateFileW(), because the detoured functions have not been installed yet.
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        Dbg(L"Warning: Could not create the policy input capture '%s'. Last Error: %d.", path.c_str(), (int)GetLastError());
+        return;
+    }
+
+    DWORD manifestSize = *g_manifestSizePtr;
+
+    g_policyInputCaptureFile = file;
+    g_policyInputCaptureBuffer = new std::vector<BYTE>();
+    g_policyInputCaptureBuffer->reserve(POLICY_CAPTURE_FLUSH_THRESHOLD + sizeof(PolicyCaptureHeader) + manifestSize);
+
+    PolicyCaptureHeader header;
+    header.Magic = POLICY_CAPTURE_MAGIC;
+    header.Version = POLICY_CAPTURE_VERSION;
+    header.ProcessId = GetCurrentProcessId();
+    header.ManifestSize = manifestSize;
+
+    BYTE const* headerBytes = reinterpret_cast<BYTE const*>(&header);
+    BYTE const* manifestBytes = reinterpret_cast<BYTE const*>(g_manifestPtr);
+    g_policyInputCaptureBuffer->insert(g_policyInputCaptureBuffer->end(), headerBytes, headerBytes + sizeof(header));
+    g_policyInputCaptureBuffer->insert(g_policyInputCaptureBuffer->end(), manifestBytes, manifestBytes + manifestSize);
+
+    g_policyInputCaptureActive = true;
+}
+
+void CapturePolicyInput(FileOperationContext const& context)
+{
+    size_t operationLength = CappedLength(context.Operation);
+    size_t pathLength = CappedLength(context.NoncanonicalPath);
+
+    PolicyCaptureRecord record;
+    record.DesiredAccess = context.DesiredAccess;
+    record.ShareMode = context.ShareMode;
+    record.CreationDisposition = context.CreationDisposition;
+    record.FlagsAndAttributes = context.FlagsAndAttributes;
+    record.OperationLength = (uint16_t)operationLength;
+    record.PathLength = (uint16_t)pathLength;
+
+    AcquireSRWLockExclusive(&g_policyInputCaptureLock);
+
+    if (g_policyInputCaptureActive)
+    {
+        std::vector<BYTE>& buffer = *g_policyInputCaptureBuffer;
+        BYTE const* recordBytes = reinterpret_cast<BYTE const*>(&record);
+        buffer.insert(buffer.end(), recordBytes, recordBytes + sizeof(record));
+
+        if (operationLength > 0)
+        {
+            BYTE const* operationBytes = reinterpret_cast<BYTE const*>(context.Operation);
+            buffer.insert(buffer.end(), operationBytes, operationBytes + operationLength * sizeof(wchar_t));
+        }
+
+        if (pathLength > 0)
+        {
+            BYTE const* pathBytes = reinterpret_cast<BYTE const*>(context.NoncanonicalPath);
+            buffer.insert(buffer.end(), pathBytes, pathBytes + pathLength * sizeof(wchar_t));
+        }
+
+        if (buffer.size() >= POLICY_CAPTURE_FLUSH_THRESHOLD)
+        {
+            WriteCaptureBuffer();
+        }
+    }
+
+    ReleaseSRWLockExclusive(&g_policyInputCaptureLock);
+}
+
+void FlushPolicyInputCapture()
+{
+    if (g_policyInputCaptureBuffer == nullptr)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&g_policyInputCaptureLock);
+
+    if (g_policyInputCaptureActive)
+    {
+        WriteCaptureBuffer();
+    }
+
+    // Operations after this point, e.g. by threads still running in DllProcessDetach, are not captured.
+    g_policyInputCaptureActive = false;
+    CloseHandle(g_policyInputCaptureFile);
+    g_policyInputCaptureFile = INVALID_HANDLE_VALUE;
+
+    ReleaseSRWLockExclusive(&g_policyInputCaptureLock);
+}
@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Capture of the inputs of the policy evaluations of a process, to evaluate changes to the policy search against real traffic.
+//
+// With FileAccessManifestExtraFlag::CapturePolicyInputs, each detoured process records the context of every file operation it
+// evaluates a policy for: the operation, the path as the caller passed it, and the CreateFile-like flags of FileOperationContext.
+// The capture goes to a file next to the internal error notification file, named after it with the process id and
+// POLICY_CAPTURE_FILE_SUFFIX, and starts with the manifest payload of the process, so that the PolicyCaptureReplay tool can
+// evaluate the same operations against the same policies, and compare the decisions of two versions of the policy search.
+// Records are buffered and written in chunks. Capturing slows the process down; it is not meant for regular builds.
+//
+// Layout (little-endian): PolicyCaptureHeader, the manifest payload (ManifestSize bytes), then the records, each a
+// PolicyCaptureRecord followed by OperationLength and PathLength UTF-16 characters (not null-terminated).
+//
+// This header only depends on <windows.h>, so that the replay tool can include it for the layout.
+
+#pragma once
+
+#include <windows.h>
+#include <stdint.h>
+
+#define POLICY_CAPTURE_FILE_SUFFIX L".policyinputs"
+
+// 'BXPC'
+#define POLICY_CAPTURE_MAGIC 0x43505842
+#define POLICY_CAPTURE_VERSION 1
+
+// Size of the buffered records at which they are written to the capture.
+#define POLICY_CAPTURE_FLUSH_THRESHOLD (256 * 1024)
+
+typedef struct PolicyCaptureHeader_t
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t ProcessId;
+    uint32_t ManifestSize;
+} PolicyCaptureHeader;
+
+typedef struct PolicyCaptureRecord_t
+{
+    uint32_t DesiredAccess;
+    uint32_t ShareMode;
+    uint32_t CreationDisposition;
+    uint32_t FlagsAndAttributes;
+    uint16_t OperationLength;
+    uint16_t PathLength;
+} PolicyCaptureRecord;
+
+static_assert(sizeof(PolicyCaptureHeader) == 16, "The capture layout must not depend on the bitness of the process");
+static_assert(sizeof(PolicyCaptureRecord) == 20, "The capture layout must not depend on the bitness of the process");
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Creates the capture of this process and writes the manifest payload to it, when FileAccessManifestExtraFlag::CapturePolicyInputs
+/// is set. Failing to create it is not fatal; the process then captures nothing. Must be called once the manifest is parsed.
+void InitializePolicyInputCapture();
+
+/// Writes the buffered records to the capture. Call it from DllProcessDetach.
+void FlushPolicyInputCapture();
@@ -1,15 +1,277 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#include <unordered_map>
+
 #include "PolicyResult.h"
 #include "DetoursHelpers.h"
+#include "DetourStatistics.h"
 #include "SendReport.h"
+#include "DeclaredInputPrefetch.h"
+#include "MemoryPressure.h"
+
+extern volatile LONG64 g_detoursPolicyResultCacheHits;
+extern volatile LONG64 g_detoursPolicyResultCacheMisses;
+extern volatile LONG64 g_detoursPolicyResultCacheEntries;
+
+// Number of directories whose policy search cursor each thread remembers.
+#define DIRECTORY_CURSOR_CACHE_SIZE 4
+
+// A directory (without type prefix or trailing separator) and the cursor that searching for it from Root produced.
+struct DirectoryCursorCacheEntry
+{
+    PCManifestRecord Root;
+    size_t Length;
+    PolicySearchCursor Cursor;
+    PathChar Directory[MAX_PATH];
+};
+
+struct DirectoryCursorCache
+{
+    unsigned int NextVictim;
+    DirectoryCursorCacheEntry Entries[DIRECTORY_CURSOR_CACHE_SIZE];
+};
+
+// Processes tend to access many files in the same few directories in a row, so remembering the last directories
+// searched for lets most searches skip straight to the last path component. The manifest never changes during the
+// lifetime of the process, hence a remembered cursor never goes stale. Zero-initialized, i.e., all entries are unused.
+static __declspec(thread) DirectoryCursorCache t_directoryCursorCache;
+
+/// Returns the cache entry for the longest remembered directory that contains the given one (or is equal to it), if any.
+static DirectoryCursorCacheEntry const* FindDirectoryCursor(PCManifestRecord root, PCPathChar directory, size_t directoryLength)
+{
+    DirectoryCursorCacheEntry const* best = nullptr;
+
+    for (unsigned int i = 0; i < DIRECTORY_CURSOR_CACHE_SIZE; i++) {
+        DirectoryCursorCacheEntry const& entry = t_directoryCursorCache.Entries[i];
+        if (entry.Root != root || entry.Length == 0 || entry.Length > directoryLength) {
+            continue;
+        }
+
+        if (entry.Length < directoryLength && !IsDirectorySeparator(directory[entry.Length])) {
+            continue;
+        }
+
+        if ((best == nullptr || entry.Length > best->Length) && wmemcmp(entry.Directory, directory, entry.Length) == 0) {
+            best = &entry;
+        }
+    }
+
+    return best;
+}
+
+static void RememberDirectoryCursor(PCManifestRecord root, PCPathChar directory, size_t directoryLength, PolicySearchCursor const& cursor)
+{
+    if (directoryLength == 0 || directoryLength >= MAX_PATH) {
+        return;
+    }
+
+    DirectoryCursorCacheEntry& entry = t_directoryCursorCache.Entries[t_directoryCursorCache.NextVictim];
+    t_directoryCursorCache.NextVictim = (t_directoryCursorCache.NextVictim + 1) % DIRECTORY_CURSOR_CACHE_SIZE;
+
+    entry.Root = root;
+    entry.Length = directoryLength;
+    entry.Cursor = cursor;
+    wmemcpy(entry.Directory, directory, directoryLength);
+}
+
+// Beyond this many paths the policy result cache starts over rather than growing without bound.
+#define POLICY_RESULT_CACHE_MAX_ENTRIES 16384
+
+// What resolving the policy of a canonicalized path from the root of the manifest produced. The path id is the one of the cursor's record.
+struct CachedPolicyResult
+{
+    PolicySearchCursor Cursor;
+    FileAccessPolicy Policy;
+    // Empty if no translation applies, as for PolicyResult::m_translatedPath.
+    std::wstring TranslatedPath;
+    // Set when the entry is hit, and cleared when the cache is shrunk: entries found clear have not been used since the last shrink.
+    volatile LONG Referenced;
+};
+
+// Keyed by the canonicalized path including its type prefix, which the special case rules depend on. The key is case
+// sensitive so that the translated path keeps the case of the path it was computed from.
+typedef std::unordered_map<std::wstring, CachedPolicyResult> PolicyResultCacheMap;
+
+// With FileAccessManifestExtraFlag::CachePolicyResults, the policies resolved for full paths are remembered for the
+// lifetime of the process: the manifest, the path translations and the special case rules (which only depend on the
+// path and on the kind of process) never change, so an entry never goes stale.
+static SRWLOCK g_policyResultCacheLock = SRWLOCK_INIT;
+static PolicyResultCacheMap* g_policyResultCache = nullptr;
+
+static bool TryGetCachedPolicyResult(std::wstring const& path, _Out_ CachedPolicyResult& result)
+{
+    bool found = false;
+
+    AcquireSRWLockShared(&g_policyResultCacheLock);
+
+    if (g_policyResultCache != nullptr) {
+        PolicyResultCacheMap::iterator it = g_policyResultCache->find(path);
+        if (it != g_policyResultCache->end()) {
+            result = it->second;
+            found = true;
+
+            if (it->second.Referenced == 0) {
+                InterlockedExchange(&it->second.Referenced, 1);
+            }
+        }
+    }
+
+    ReleaseSRWLockShared(&g_policyResultCacheLock);
+
+    InterlockedIncrement64(found ? &g_detoursPolicyResultCacheHits : &g_detoursPolicyResultCacheMisses);
+    return found;
+}
+
+static void SetCachedPolicyResult(std::wstring&& path, CachedPolicyResult&& result)
+{
+    AcquireSRWLockExclusive(&g_policyResultCacheLock);
+
+    if (g_policyResultCache == nullptr) {
+        g_policyResultCache = new PolicyResultCacheMap();
+        EnsureMemoryPressureMonitorStarted();
+    }
+    else if (g_policyResultCache->size() >= POLICY_RESULT_CACHE_MAX_ENTRIES) {
+        g_policyResultCache->clear();
+    }
+
+    (*g_policyResultCache)[std::move(path)] = std::move(result);
+    g_detoursPolicyResultCacheEntries = (LONG64)g_policyResultCache->size();
+
+    ReleaseSRWLockExclusive(&g_policyResultCacheLock);
+}
+
+size_t ShrinkPolicyResultCache(size_t floor)
+{
+    size_t removed = 0;
+
+    AcquireSRWLockExclusive(&g_policyResultCacheLock);
+
+    if (g_policyResultCache != nullptr) {
+        // Second chance: the entries not hit since the last shrink go first, and the others lose their reference.
+        for (PolicyResultCacheMap::iterator it = g_policyResultCache->begin(); it != g_policyResultCache->end(); ) {
+            if (it->second.Referenced == 0 && g_policyResultCache->size() > floor) {
+                it = g_policyResultCache->erase(it);
+                removed++;
+            }
+            else {
+                it->second.Referenced = 0;
+                ++it;
+            }
+        }
+
+        g_detoursPolicyResultCacheEntries = (LONG64)g_policyResultCache->size();
+    }
+
+    ReleaseSRWLockExclusive(&g_policyResultCacheLock);
+
+    return removed;
+}
+
+/// Searches the policy tree for a full path starting at its root, resuming from the cursor of the path's parent directory when it is remembered.
+static PolicySearchCursor FindFileAccessPolicyFromRoot(PCManifestRecord root, PCPathChar path, size_t pathLength)
+{
+    // Leading separators belong to the first path component (as in "\\server"), so they can't end the directory.
+    size_t leadingSeparators = 0;
+    while (leadingSeparators < pathLength && IsDirectorySeparator(path[leadingSeparators])) {
+        leadingSeparators++;
+    }
+
+    size_t directoryLength = pathLength;
+    while (directoryLength > leadingSeparators && !IsDirectorySeparator(path[directoryLength - 1])) {
+        directoryLength--;
+    }
+
+    if (directoryLength == leadingSeparators) {
+        // No parent directory to remember (e.g., a bare drive).
+        return FindFileAccessPolicyInTreeEx(root, path, pathLength);
+    }
+
+    // Search up to the last separator, not including it.
+    size_t lastComponentStart = directoryLength;
+    directoryLength--;
+
+    PolicySearchCursor directoryCursor;
+    DirectoryCursorCacheEntry const* cached = FindDirectoryCursor(root, path, directoryLength);
+    if (cached != nullptr && cached->Length == directoryLength) {
+        directoryCursor = cached->Cursor;
+    }
+    else {
+        if (cached != nullptr) {
+            // Resume after the remembered ancestor and the separator following it.
+            size_t consumed = cached->Length + 1;
+            directoryCursor = FindFileAccessPolicyInTreeEx(cached->Cursor, path + consumed, directoryLength - consumed);
+        }
+        else {
+            directoryCursor = FindFileAccessPolicyInTreeEx(root, path, directoryLength);
+        }
+
+        RememberDirectoryCursor(root, path, directoryLength, directoryCursor);
+    }
+
+    return FindFileAccessPolicyInTreeEx(directoryCursor, path + lastComponentStart, pathLength - lastComponentStart);
+}
+
+/// Returns the position in the index of the component starting at the given offset, the number of components if the offset
+/// is the end of the path, or -1 if the offset is not at the start of a component.
+static size_t FindComponentStartingAt(PathComponentIndex const* index, size_t offset, size_t pathLength)
+{
+    if (offset == pathLength) {
+        return index->Count;
+    }
+
+    size_t low = 0;
+    size_t high = index->Count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index->Components[middle].Offset < offset) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    return low < index->Count && index->Components[low].Offset == offset ? low : (size_t)-1;
+}
+
+/// Same as above, for a path whose components are already known.
+static PolicySearchCursor FindFileAccessPolicyFromRoot(PCManifestRecord root, PCPathChar path, size_t pathLength, PathComponentIndex const* index)
+{
+    size_t count = index->Count;
+    if (count < 2) {
+        // No parent directory to remember (e.g., a bare drive).
+        return FindFileAccessPolicyInTreeEx(root, path, index->Components, count);
+    }
+
+    // The directory holds all the components but the last, and ends right before the separator preceding it.
+    size_t directoryLength = index->Components[count - 1].Offset - 1;
+
+    PolicySearchCursor directoryCursor;
+    DirectoryCursorCacheEntry const* cached = FindDirectoryCursor(root, path, directoryLength);
+    if (cached != nullptr && cached->Length == directoryLength) {
+        directoryCursor = cached->Cursor;
+    }
+    else {
+        // Resume after the remembered ancestor and the separator following it, unless that isn't where a component starts.
+        size_t resumeAt = cached != nullptr ? FindComponentStartingAt(index, cached->Length + 1, pathLength) : (size_t)-1;
+        directoryCursor = resumeAt != (size_t)-1 && resumeAt < count - 1
+            ? FindFileAccessPolicyInTreeEx(cached->Cursor, path, index->Components + resumeAt, count - 1 - resumeAt)
+            : FindFileAccessPolicyInTreeEx(root, path, index->Components, count - 1);
+
+        RememberDirectoryCursor(root, path, directoryLength, directoryCursor);
+    }
+
+    return FindFileAccessPolicyInTreeEx(directoryCursor, path, index->Components + count - 1, 1);
+}
 
 bool PolicyResult::Initialize(PCPathChar path)
 {
     assert(m_isIndeterminate);
     assert(path);
 
+    DetourOverheadScope overhead(DetourOverheadCategory::PolicyResolution);
+
     CanonicalizedPathType canonicalizedPath = CanonicalizedPath::Canonicalize(path);
     if (canonicalizedPath.IsNull()) {
         // This policy remains indeterminate.
@@ -22,12 +284,38 @@ bool PolicyResult::Initialize(PCPathChar path)
 
 void PolicyResult::Initialize(CanonicalizedPathType const& canonicalizedPath)
 {
+    DetourOverheadScope overhead(DetourOverheadCategory::PolicyResolution);
+
+    // The first file access of the pip is when its inputs are about to be read.
+    EnsureDeclaredInputPrefetchStarted();
+
     // Initializing from a canonicalized path without a cursor; use the global tree root as the start cursor, and the entire path (without the type prefix)
     // as the search 'suffix' (we aren't resuming a search - we are starting a new one).
     // For reporting it is important that we preserve the \\?\ or \??\ prefix; \\?\C: and C: are different!
     // The former refers to a device. The other is drive-relative (based on current directory of that drive).
     // But for evaluating special cases and traversing the manifest tree, we strip the prefix (the tree shouldn't have \\?\ in it for example).
+    if (!CachePolicyResults()) {
+        InitializeFromCursor(canonicalizedPath, g_manifestTreeRoot, nullptr);
+        return;
+    }
+
+    std::wstring key(canonicalizedPath.GetPathString());
+    CachedPolicyResult cached;
+    if (TryGetCachedPolicyResult(key, cached)) {
+        assert(m_canonicalizedPath.IsNull());
+        m_translatedPath = std::move(cached.TranslatedPath);
+        Initialize(canonicalizedPath, cached.Cursor);
+        m_policy = cached.Policy;
+        return;
+    }
+
     InitializeFromCursor(canonicalizedPath, g_manifestTreeRoot, nullptr);
+
+    cached.Cursor = m_policySearchCursor;
+    cached.Policy = m_policy;
+    cached.TranslatedPath = m_translatedPath;
+    cached.Referenced = 0;
+    SetCachedPolicyResult(std::move(key), std::move(cached));
 }
 
 void PolicyResult::InitializeFromCursor(CanonicalizedPathType const& canonicalizedPath, PolicySearchCursor const& policySearchCursor, PCPathChar const searchSuffix)
@@ -40,13 +328,41 @@ void PolicyResult::InitializeFromCursor(CanonicalizedPathType const& canonicaliz
     // We will do so via special-case rules (no policy search or cursor) or via the policy tree (which is searched, producing a cursor). 
     m_canonicalizedPath = canonicalizedPath;
 
-    TranslateFilePath(std::wstring(canonicalizedPath.GetPathString()), m_translatedPath, false);
+    // Without a translation the translated path is the canonicalized one; leaving m_translatedPath empty saves copying it.
+    TryTranslateFilePath(canonicalizedPath, m_translatedPath, false);
+
     wchar_t const* translatedSearchSuffix = searchSuffix != nullptr ? searchSuffix : GetTranslatedPathWithoutTypePrefix();
     size_t searchSuffixLength = wcslen(translatedSearchSuffix);
 
-    PolicySearchCursor newCursor = FindFileAccessPolicyInTreeEx(policySearchCursor, translatedSearchSuffix, searchSuffixLength);
+    // Without a translation the search runs over the component index of the canonicalized path, which is only scanned and hashed
+    // once however many times it (or the paths extending it) gets searched for.
+    PathComponentIndex const* index = m_translatedPath.empty() ? canonicalizedPath.GetComponentIndex() : nullptr;
+    wchar_t const* indexedPath = canonicalizedPath.GetPathStringWithoutTypePrefix();
+    size_t firstComponent = (size_t)-1;
+    if (index != nullptr) {
+        firstComponent = searchSuffix == nullptr
+            ? 0
+            : FindComponentStartingAt(index, translatedSearchSuffix - indexedPath, wcslen(indexedPath));
+    }
+
+    PolicySearchCursor newCursor;
+    if (searchSuffix == nullptr && policySearchCursor.IsValid() && !policySearchCursor.SearchWasTruncated) {
+        newCursor = index != nullptr
+            ? FindFileAccessPolicyFromRoot(policySearchCursor.Record, translatedSearchSuffix, searchSuffixLength, index)
+            : FindFileAccessPolicyFromRoot(policySearchCursor.Record, translatedSearchSuffix, searchSuffixLength);
+    }
+    else if (firstComponent != (size_t)-1) {
+        newCursor = FindFileAccessPolicyInTreeEx(policySearchCursor, indexedPath, index->Components + firstComponent, index->Count - firstComponent);
+    }
+    else {
+        newCursor = FindFileAccessPolicyInTreeEx(policySearchCursor, translatedSearchSuffix, searchSuffixLength);
+    }
+
     Initialize(canonicalizedPath, newCursor);
 
+    // Special case rules still take precedence over the suffix policies.
+    ApplySuffixPolicy(g_manifestSuffixPolicies, translatedSearchSuffix, searchSuffixLength, /*inout*/ m_policy);
+
     if (GetSpecialCaseRulesForCoverageAndSpecialDevices(translatedSearchSuffix, searchSuffixLength, canonicalizedPath.Type, /*out*/ m_policy)) {
 #if SUPER_VERBOSE
         Dbg(L"match (special case rules.1): %s - policySearchCursor: %x, searchSuffix: %s", canonicalizedPath.GetPathString(), policySearchCursor, searchSuffix);
@@ -67,6 +383,8 @@ PolicyResult PolicyResult::GetPolicyForSubpath(wchar_t const* pathSuffix) const
     assert(!m_isIndeterminate);
     assert(!m_canonicalizedPath.IsNull());
 
+    DetourOverheadScope overhead(DetourOverheadCategory::PolicyResolution);
+
     size_t extensionStartIndex = 0;
     CanonicalizedPathType extendedPath = m_canonicalizedPath.Extend(pathSuffix, &extensionStartIndex);
 
@@ -81,6 +399,42 @@ PolicyResult PolicyResult::GetPolicyForSubpath(wchar_t const* pathSuffix) const
     return subpolicy;
 }
 
+bool PolicyResult::TryGetPolicyForChild(wchar_t const* childName, size_t childNameLength, _Out_ FileAccessPolicy& policy) const {
+    assert(!m_isIndeterminate);
+    assert(childNameLength == wcslen(childName));
+
+    DetourOverheadScope overhead(DetourOverheadCategory::PolicyResolution);
+
+    policy = m_policy;
+
+    // A translation may apply to the path of the child but not to the one of this result, so then the child path is needed.
+    if (!m_policySearchCursor.IsValid() || (g_pManifestTranslatePathTuples != nullptr && !g_pManifestTranslatePathTuples->empty())) {
+        return false;
+    }
+
+    // Same as InitializeFromCursor with the child name as search suffix.
+    PolicySearchCursor childCursor = FindFileAccessPolicyInTreeEx(m_policySearchCursor, childName, childNameLength);
+    policy = childCursor.SearchWasTruncated ? childCursor.Record->GetConePolicy() : childCursor.Record->GetNodePolicy();
+    ApplySuffixPolicy(g_manifestSuffixPolicies, childName, childNameLength, /*inout*/ policy);
+
+    if (!GetSpecialCaseRulesForCoverageAndSpecialDevices(childName, childNameLength, m_canonicalizedPath.Type, /*out*/ policy)) {
+        GetSpecialCaseRulesForSpecialTools(childName, childNameLength, /*out*/ policy);
+    }
+
+    return true;
+}
+
+PolicyResult PolicyResult::GetPolicyForSibling(wchar_t const* siblingName) const {
+    assert(!m_isIndeterminate);
+    assert(!m_canonicalizedPath.IsNull());
+
+    DetourOverheadScope overhead(DetourOverheadCategory::PolicyResolution);
+
+    PolicyResult siblingPolicy;
+    siblingPolicy.Initialize(m_canonicalizedPath.RemoveLastComponent().Extend(siblingName));
+    return siblingPolicy;
+}
+
 void PolicyResult::ReportIndeterminatePolicyAndSetLastError(FileOperationContext const& fileOperationContext) const
 {
     assert(IsIndeterminate());
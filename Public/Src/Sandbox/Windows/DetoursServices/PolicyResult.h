@@ -5,12 +5,12 @@
 
 #include "FileAccessHelpers.h"
 
-#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
 #include "CanonicalizedPath.h"
 typedef CanonicalizedPath CanonicalizedPathType;
-#else // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#else // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
 typedef PCPathChar CanonicalizedPathType;
-#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
 
 // Result of determining an access policy for a path. This involves canonicalizing the desired path and performing a policy lookup.
 class PolicyResult
@@ -44,7 +44,7 @@ public:
     CanonicalizedPathType Path() const        { return m_canonicalizedPath; }
     void SetPath(CanonicalizedPathType path)  { m_canonicalizedPath = path; }
 
-#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
 
 private:
     // Result of path translation.
@@ -67,7 +67,7 @@ public:
         : m_canonicalizedPath(std::move(other.m_canonicalizedPath)),
         m_policy(other.m_policy), m_policySearchCursor(other.m_policySearchCursor),
         m_isIndeterminate(other.m_isIndeterminate),
-        m_translatedPath(other.m_translatedPath)
+        m_translatedPath(std::move(other.m_translatedPath))
     {
         other.m_isIndeterminate = true;
         other.m_policy = (FileAccessPolicy)0;
@@ -92,23 +92,44 @@ public:
     // TODO: This is a poorly exercised and very exceptional path; for simplicity consider throwing (failfast exception?)
     void ReportIndeterminatePolicyAndSetLastError(FileOperationContext const& fileOperationContext) const;
 
-    PCPathChar const GetTranslatedPath() const { return m_translatedPath.c_str(); }
+    // An empty m_translatedPath means that no translation applies.
+    PCPathChar const GetTranslatedPath() const { return m_translatedPath.empty() ? m_canonicalizedPath.GetPathString() : m_translatedPath.c_str(); }
     
     PCPathChar const GetTranslatedPathWithoutTypePrefix() const {
         switch (m_canonicalizedPath.Type) {
             case PathType::Null:
                 return nullptr;
             case PathType::Win32:
-                return m_translatedPath.c_str();
+                return GetTranslatedPath();
             case Win32Nt:
             case LocalDevice:
-                return m_translatedPath.c_str() + 4;
+                return GetTranslatedPath() + 4;
             default:
                 assert(false);
                 return nullptr;
         }
     }
-#else // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+
+    // Indicates if the USN of this file should be reported after it is opened, for the policy or for all files.
+    bool ShouldReportUsnAfterOpen() const { return ReportUsnAfterOpen() || ReportUsnsAfterOpen(); }
+
+    // Indicates if accesses to this path, or to anything below it, are allowed and never reported, so that detours can
+    // call through without access checks, reports, USNs, or handle overlays.
+    // Special-case rules may restrict the policy found in the manifest, hence the check of the effective policy too.
+    bool IsTransparent() const {
+        return !m_isIndeterminate && !ReportAnyAccess(false) && !ReportUsnsAfterOpen()
+            && m_policySearchCursor.IsInTransparentScope() && IsTransparentPolicy(m_policy);
+    }
+
+    // Indicates if this result was determined the same way as another one for the same canonicalized path, so that either can
+    // stand in for the other (see InternHandlePolicy in HandleOverlay.cpp).
+    bool IsEquivalentTo(PolicyResult const& other) const {
+        return m_isIndeterminate == other.m_isIndeterminate && m_policy == other.m_policy
+            && m_policySearchCursor.Record == other.m_policySearchCursor.Record
+            && m_policySearchCursor.SearchWasTruncated == other.m_policySearchCursor.SearchWasTruncated
+            && m_translatedPath == other.m_translatedPath;
+    }
+#else // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
     
 private:
     FileAccessManifestFlag m_famFlag;
@@ -125,11 +146,17 @@ public:
         Initialize(path, cursor);
     }
 
+    PolicyResult(FileAccessManifestFlag famFlag, CanonicalizedPathType path, PolicySearchCursor cursor, PCManifestSuffixPolicies suffixPolicies)
+        : PolicyResult(famFlag, path, cursor)
+    {
+        ApplySuffixPolicy(suffixPolicies, path, pathlen(path), m_policy);
+    }
+
     #define GEN_CHECK_FAM_FLAG_FUNC(flag_name, flag_value) inline bool flag_name() const { return Check##flag_name(m_famFlag); }
     FOR_ALL_FAM_FLAGS(GEN_CHECK_FAM_FLAG_FUNC)
     inline bool ReportAnyAccess(bool accessDenied) const { return CheckReportAnyAccess(m_famFlag, accessDenied); }
 
-#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
     
     // Performs an access check for a read-access, based on dynamically-observed read context (existence, etc.)
     // May only be called when !IsIndeterminate().
@@ -155,6 +182,16 @@ public:
     // Determines a policy result for the combined path GetCanonicalizedPath() + pathSuffix.
     PolicyResult GetPolicyForSubpath(wchar_t const* pathSuffix) const;
 
+    // Determines the policy GetPolicyForSubpath(childName) would have for a single (NUL-terminated) path component, by resuming
+    // the policy search from this result's cursor without building the path of the child.
+    // Returns false if the search cannot be resumed this way, in which case callers should fall back to GetPolicyForSubpath.
+    bool TryGetPolicyForChild(wchar_t const* childName, size_t childNameLength, _Out_ FileAccessPolicy& policy) const;
+
+    // Determines the policy for a (NUL-terminated) name in the same directory as this path, without canonicalizing a path again.
+    // The search for this path remembered the cursor of its directory (see FindFileAccessPolicyFromRoot), so only the new last
+    // component is searched for. The name must be a single, already canonical path component.
+    PolicyResult GetPolicyForSibling(wchar_t const* siblingName) const;
+
     CanonicalizedPathType const& GetCanonicalizedPath() const { return m_canonicalizedPath; }
     bool AllowRead() const { return (m_policy & FileAccessPolicy_AllowRead) != 0; }
     bool AllowReadIfNonexistent() const { return (m_policy & FileAccessPolicy_AllowReadIfNonExistent) != 0; }
@@ -164,9 +201,12 @@ public:
 	bool AllowRealInputTimestamps() const { return (m_policy & FileAccessPolicy_AllowRealInputTimestamps) != 0; }
     bool ReportUsnAfterOpen() const { return (m_policy & FileAccessPolicy_ReportUsnAfterOpen) != 0; }
     bool ReportDirectoryEnumeration() const { return (m_policy & FileAccessPolicy_ReportDirectoryEnumerationAccess) != 0; }
+    bool MaterializeOnOpen() const { return (m_policy & FileAccessPolicy_MaterializeOnOpen) != 0; }
     DWORD GetPathId() const { return m_policySearchCursor.IsValid() ? m_policySearchCursor.Record->GetPathId() : 0; }
     FileAccessPolicy GetPolicy() const { return m_policy; }
     USN GetExpectedUsn() const { return m_policySearchCursor.GetExpectedUsn(); }
+    // Indicates if the whole path was matched by a manifest node, in which case GetPathId() names the path itself.
+    bool IsExactManifestMatch() const { return m_policySearchCursor.IsValid() && !m_policySearchCursor.SearchWasTruncated; }
     // Indicates if this policy is invalid (iff Initialize did not complete successfully or has not been called).
     bool IsIndeterminate() const { return m_isIndeterminate; }
 
@@ -188,3 +228,7 @@ private:
     AccessCheckResult CreateAccessCheckResult(ResultAction result, ReportLevel reportLevel) const;
     AccessCheckResult CreateAccessCheckResult(bool isAllowed) const;
 };
+
+/// Sheds the entries of the policy result cache (see FileAccessManifestExtraFlag::CachePolicyResults) that were not hit since the
+/// last shrink, as long as it holds more than the given number of entries. Returns the number of entries removed.
+size_t ShrinkPolicyResultCache(size_t floor);
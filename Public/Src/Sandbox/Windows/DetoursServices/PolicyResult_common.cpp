@@ -4,7 +4,7 @@
 #include "PolicyResult.h"
 
 PathValidity ProbePathForValidity(CanonicalizedPathType canonicalizedPath) {
-#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#if !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
     LPCWSTR path = canonicalizedPath.GetPathString();
     // Note that this unfortunately touches the disk, whereas we really just need to validate
     // that the path is parse-able on the target FS (e.g. ReFS doesn't allow stream syntax like .\A:X but NTFS does).
@@ -31,7 +31,7 @@ PathValidity ProbePathForValidity(CanonicalizedPathType canonicalizedPath) {
     if (error == ERROR_INVALID_NAME) {
         return PathValidity::Invalid;
     }
-#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY)
+#endif // !(MAC_OS_SANDBOX) && !(MAC_OS_LIBRARY) && !(BUILDXL_MINIFILTER)
 
     return PathValidity::Valid; // Optimism!
 }
@@ -5,6 +5,12 @@
 #include "PolicySearch.h"
 #include "StringOperations.h"
 
+#if !(MAC_OS_LIBRARY) && !(MAC_OS_SANDBOX) && !(BUILDXL_MINIFILTER)
+#include "FeatureCounters.h"
+
+ManifestLookupCounters const* g_manifestLookupCounters = nullptr;
+#endif // !(MAC_OS_LIBRARY) && !(MAC_OS_SANDBOX) && !(BUILDXL_MINIFILTER)
+
 /// GetPartialPathAndRemainder
 ///
 /// Takes a path and trims out the first partial path. Because the contract
@@ -15,6 +21,9 @@
 ///
 /// Remainder is the string beginning after the dividing path separator.
 ///
+/// The path only needs to be absolutePathLength characters long; it does not need to be null-terminated there,
+/// which allows searching for a prefix (such as the parent directory) of a longer path.
+///
 /// Returns:
 ///     The length of the partial path, not including the null terminator or path separator.
 /// Outputs:
@@ -26,12 +35,11 @@ static size_t GetPartialPathAndRemainder(
     __out PCPathChar& remainder)
 {
     assert(absolutePath);
-    assert(absolutePathLength == pathlen(absolutePath));
     
     size_t found = 0; // look for a path separator or end of string
     // Skip all the leading PathSeparators.
     // This is needed for the case of network path ("\\foo-server\bar").
-    while (IsDirectorySeparator(absolutePath[found]))
+    while (found < absolutePathLength && IsDirectorySeparator(absolutePath[found]))
     {
         found++;
     }
@@ -45,66 +53,133 @@ static size_t GetPartialPathAndRemainder(
         // we found a path separator, and we need to increment the remainder past the path separator
         remainder++;
     }
-    else {
-        // absolutely do not increment past the null terminator
-        assert(remainder[0] == L'\0');
-    }
+
+    // Otherwise, absolutely do not increment past the end of the path.
 
     return found;
 }
 
 PolicySearchCursor FindFileAccessPolicyInTreeEx(
-    __in  PolicySearchCursor const& cursor,
+    __in  PolicySearchCursor const& startCursor,
     __in  PCPathChar absolutePath,
     __in  size_t absolutePathLength)
 {
     assert(absolutePath);
-    assert(absolutePathLength == pathlen(absolutePath));
+    assert(absolutePathLength <= pathlen(absolutePath));
 
-    assert(cursor.Record != nullptr);
+    assert(startCursor.Record != nullptr);
     assert(absolutePath != nullptr);
 
     // For a truncated cursor, any further search should yield the same policy and remain truncated.
     // One can imagine that below each record, there is a default record for any unmatched path
     // which is an equivalent copy. But instead of realizing those records we just remember that
     // we have begun traversing them.
-    if (cursor.SearchWasTruncated) {
-        return cursor;
+    if (startCursor.SearchWasTruncated) {
+        return startCursor;
     }
 
-    // Terminal cases: Maybe we can't walk further down the tree, or maybe we've matched all of the path.
-    ManifestRecord::BucketCountType numBuckets = cursor.Record->BucketCount;
-    bool isLeaf = numBuckets == 0; // we found a leaf, even if there is more path, we have gone as far as we can
-    bool endOfPath = absolutePath[0] == 0; // no more path to search, wherever we ended up is the node to consider
-    if (isLeaf || endOfPath)
-    {
-        return PolicySearchCursor(cursor.Record, /*searchWasTruncated*/ !endOfPath);
+    // Each iteration consumes one path component. Past the first iteration the current record always comes from
+    // a matched child, so the search so far is never truncated.
+    PCManifestRecord record = startCursor.Record;
+    for (;;) {
+        // Terminal cases: Maybe we can't walk further down the tree, or maybe we've matched all of the path.
+        ManifestRecord::BucketCountType numBuckets = record->GetBucketCount();
+        bool isLeaf = numBuckets == 0; // we found a leaf, even if there is more path, we have gone as far as we can
+        bool endOfPath = absolutePathLength == 0; // no more path to search, wherever we ended up is the node to consider
+        if (isLeaf || endOfPath)
+        {
+            return PolicySearchCursor(record, /*searchWasTruncated*/ !endOfPath);
+        }
+
+        // We're now committed to tokenizing a further path component, and trying to find a matching child.
+
+        PCPathChar remainder = NULL;
+        size_t partialPathLength = GetPartialPathAndRemainder(absolutePath, absolutePathLength, /*out*/ remainder);
+        assert(absolutePath + partialPathLength <= remainder);
+        assert(remainder >= absolutePath);
+        assert(remainder <= absolutePath + absolutePathLength);
+
+        PCManifestRecord childRecord = NULL;
+        bool childFound = record->FindChild(absolutePath, partialPathLength, /*out*/ childRecord);
+        if (!childFound || childRecord == NULL)
+        {
+            // There was path to consume, and a chance of finding a child record, but that didn't work.
+            // So, this is a third terminal case (but we had to do a bit of work to determine so).
+            return PolicySearchCursor(record, /*searchWasTruncated*/ true);
+        }
+
+        assert(childRecord != NULL);
+
+        // childRecord's partialPath is a prefix of remainder. Consume some more of the path, if any.
+        absolutePathLength -= (remainder - absolutePath);
+        absolutePath = remainder;
+        record = childRecord;
     }
+}
 
-    // We're now committed to tokenizing a further path component, and trying to find a matching child.
+size_t TokenizePathComponents(
+    __in  PCPathChar path,
+    __in  size_t length,
+    __out_ecount(capacity) PathComponent* components,
+    __in  size_t capacity)
+{
+    assert(path);
 
-    PCPathChar remainder = NULL;
-    size_t partialPathLength = GetPartialPathAndRemainder(absolutePath, absolutePathLength, /*out*/ remainder);
-    assert(absolutePath + partialPathLength <= remainder);
-    assert(remainder >= absolutePath);
-    assert(remainder <= absolutePath + absolutePathLength);
+    // Same split as GetPartialPathAndRemainder: leading separators belong to the component, and one separator is skipped after it.
+    size_t count = 0;
+    size_t start = 0;
+    while (start < length) {
+        size_t end = start;
+        while (end < length && IsDirectorySeparator(path[end])) {
+            end++;
+        }
 
-    PCManifestRecord childRecord = NULL;
-    bool childFound = cursor.Record->FindChild(absolutePath, partialPathLength, /*out*/ childRecord);
-    if (!childFound || childRecord == NULL)
-    {
-        // There was path to consume, and a chance of finding a child record, but that didn't work.
-        // So, this is a third terminal case (but we had to do a bit of work to determine so).
-        return PolicySearchCursor(cursor.Record, /*searchWasTruncated*/ true);
+        while (end < length && !IsDirectorySeparator(path[end])) {
+            end++;
+        }
+
+        if (count < capacity) {
+            components[count].Offset = static_cast<DWORD>(start);
+            components[count].Length = static_cast<DWORD>(end - start);
+            components[count].Hash = HashPath(path + start, end - start);
+        }
+
+        count++;
+        start = end < length ? end + 1 : end;
+    }
+
+    return count;
+}
+
+PolicySearchCursor FindFileAccessPolicyInTreeEx(
+    __in  PolicySearchCursor const& startCursor,
+    __in  PCPathChar path,
+    __in_ecount(componentCount) PathComponent const* components,
+    __in  size_t componentCount)
+{
+    assert(startCursor.Record != nullptr);
+    assert(path != nullptr || componentCount == 0);
+
+    if (startCursor.SearchWasTruncated) {
+        return startCursor;
     }
 
-    assert(childRecord != NULL);
+    PCManifestRecord record = startCursor.Record;
+    for (size_t i = 0; i < componentCount; i++) {
+        if (record->GetBucketCount() == 0) {
+            return PolicySearchCursor(record, /*searchWasTruncated*/ true);
+        }
+
+        PathComponent const& component = components[i];
+        PCManifestRecord childRecord = NULL;
+        if (!record->FindChild(path + component.Offset, component.Length, component.Hash, /*out*/ childRecord) || childRecord == NULL) {
+            return PolicySearchCursor(record, /*searchWasTruncated*/ true);
+        }
 
-    // childRecord's partialPath is a prefix of remainder.
-    size_t remainderLength = absolutePathLength - (remainder - absolutePath);
-    assert(remainderLength == pathlen(remainder));
-    // Recursive step: Consume some more of the path, if any. Note that we always recurse with a non-truncated cursor due to the terminal cases above.
-    return FindFileAccessPolicyInTreeEx(PolicySearchCursor(childRecord), remainder, remainderLength);
+        record = childRecord;
+    }
+
+    return PolicySearchCursor(record, /*searchWasTruncated*/ false);
 }
 
 #ifdef BUILDXL_NATIVES_LIBRARY
@@ -128,8 +203,127 @@ BOOL WINAPI FindFileAccessPolicyInTree(
     pathId = newCursor.Record->GetPathId();
     return true;
 }
+
+// A cursor reached by a batched search, along with how much of the path had been consumed to reach it:
+// components up to and including their trailing separator.
+struct ComponentCursor
+{
+    size_t Consumed;
+    PolicySearchCursor Cursor;
+};
+
+BOOL WINAPI FindFileAccessPoliciesInTree(
+    __in  ManifestRecord const* record,
+    __in  PCPathChar absolutePaths,
+    __in_ecount(pathCount) size_t const* absolutePathLengths,
+    __in  size_t pathCount,
+    __out_ecount(pathCount) PolicySearchResult* results)
+{
+    if (record == nullptr || (pathCount != 0 && (absolutePaths == nullptr || absolutePathLengths == nullptr || results == nullptr))) {
+        return false;
+    }
+
+    // The cursors reached for the components of the previous path. The first one is the root, which every path shares.
+    std::vector<ComponentCursor> cursors;
+    cursors.push_back({ 0, PolicySearchCursor(record) });
+
+    PCPathChar previousPath = absolutePaths;
+    size_t previousPathLength = 0;
+    PCPathChar absolutePath = absolutePaths;
+
+    for (size_t i = 0; i < pathCount; absolutePath += absolutePathLengths[i], i++) {
+        size_t absolutePathLength = absolutePathLengths[i];
+
+        // A cursor can be reused if the path is identical to the previous one up to there. Since cursors are only kept
+        // for components followed by a separator, such a path tokenizes into the same components.
+        size_t common = 0;
+        size_t maxCommon = previousPathLength < absolutePathLength ? previousPathLength : absolutePathLength;
+        while (common < maxCommon && previousPath[common] == absolutePath[common]) {
+            common++;
+        }
+
+        while (cursors.back().Consumed > common) {
+            cursors.pop_back();
+        }
+
+        PolicySearchCursor cursor = cursors.back().Cursor;
+        size_t consumed = cursors.back().Consumed;
+
+        // The equivalent of FindFileAccessPolicyInTreeEx, one component at a time to remember the intermediate cursors.
+        while (consumed < absolutePathLength) {
+            PCPathChar component = absolutePath + consumed;
+            PCPathChar remainder = NULL;
+            size_t partialPathLength = GetPartialPathAndRemainder(component, absolutePathLength - consumed, /*out*/ remainder);
+            cursor = FindFileAccessPolicyInTreeEx(cursor, component, partialPathLength);
+
+            if (remainder == component + partialPathLength) {
+                // The last component
+                break;
+            }
+
+            consumed = remainder - absolutePath;
+            cursors.push_back({ consumed, cursor });
+        }
+
+        results[i].ConePolicy = cursor.Record->GetConePolicy();
+        results[i].NodePolicy = cursor.Record->GetNodePolicy();
+        results[i].PathId = cursor.Record->GetPathId();
+        results[i].ExpectedUsn = cursor.GetExpectedUsn();
+
+        previousPath = absolutePath;
+        previousPathLength = absolutePathLength;
+    }
+
+    return true;
+}
 #endif // BUILDXL_NATIVES_LIBRARY
 
+/// Checks if the child in a (non-empty) bucket of a record has the given partial path, and sets child to it if so.
+static inline bool IsChildInBucket(
+    __in  ManifestRecord const* record,
+    __in  ManifestRecord::BucketCountType index,
+    __in  DWORD hash,
+    __in  PCPathChar target,
+    __in  size_t targetLength,
+    __out PCManifestRecord& child)
+{
+    // With inline hashes, the record of a child that can't match is never read.
+    if (record->HasInlineChildHashes() && record->GetInlineChildHash(index) != hash)
+    {
+        return false;
+    }
+
+    child = record->GetChildRecord(index);
+    assert(child);
+
+    return child->Hash == hash && ArePathsEqual(target, child->GetPartialPath(), targetLength);
+}
+
+/// Counts a child found after the given number of probes, when the lookups are profiled.
+static inline void CountLookupHit(
+    __in  PCManifestRecord child,
+    __in  ManifestRecord::BucketCountType probes)
+{
+#if !(MAC_OS_LIBRARY) && !(MAC_OS_SANDBOX) && !(BUILDXL_MINIFILTER)
+    ManifestLookupCounters const* counters = g_manifestLookupCounters;
+    if (counters == nullptr)
+    {
+        return;
+    }
+
+    uint32_t index = child->PathId & counters->PathIdIndexMask;
+    if (index < counters->HitCounterCount)
+    {
+        InterlockedIncrement(&counters->HitCounts[index]);
+    }
+
+    InterlockedIncrement64(&counters->ProbeLengthHistogram[(probes < counters->ProbeLengthCount ? probes : counters->ProbeLengthCount) - 1]);
+#else
+    (void)child;
+    (void)probes;
+#endif // !(MAC_OS_LIBRARY) && !(MAC_OS_SANDBOX) && !(BUILDXL_MINIFILTER)
+}
+
 /// FindChild
 ///
 /// Search for the given partial path in the children of the given node.
@@ -140,20 +334,47 @@ __in  PCPathChar target,
 __in  size_t targetLength,
 __out PCManifestRecord& child) const
 {
-    DWORD hash = HashPath(target, targetLength);
-    ManifestRecord::BucketCountType numBuckets = this->BucketCount;
+    return FindChild(target, targetLength, HashPath(target, targetLength), child);
+}
+
+__success(return)
+bool ManifestRecord::FindChild(
+__in  PCPathChar target,
+__in  size_t targetLength,
+__in  DWORD hash,
+__out PCManifestRecord& child) const
+{
+    ManifestRecord::BucketCountType numBuckets = this->GetBucketCount();
+
+    child = nullptr;
+    if (this->HasPerfectHash())
+    {
+        // One probe: the child is in that bucket, or is not there at all.
+#if !(MAC_OS_LIBRARY) && !(MAC_OS_SANDBOX) && !(BUILDXL_MINIFILTER)
+        IncrementFeatureCounter(FeatureCounter::PerfectHashLookups);
+#endif // !(MAC_OS_LIBRARY) && !(MAC_OS_SANDBOX) && !(BUILDXL_MINIFILTER)
+        ManifestRecord::BucketCountType bucket = this->GetPerfectHashBucket(hash);
+        if (this->GetChildOffset(bucket) != 0 && IsChildInBucket(this, bucket, hash, target, targetLength, child))
+        {
+            CountLookupHit(child, 1);
+            return true;
+        }
+
+        child = nullptr;
+        return false;
+    }
 
     // We are searching a hash-table that has been constructed in FileAccessManifest.cs
     ManifestRecord::BucketCountType index = hash % numBuckets;
 
-    child = this->GetChildRecord(index);
-    if (child == nullptr)
+    if (this->GetChildOffset(index) == 0)
     {
         return false;
     }
 
-    if (child->Hash == hash && ArePathsEqual(target, child->GetPartialPath(), targetLength))
+    if (IsChildInBucket(this, index, hash, target, targetLength, child))
     {
+        CountLookupHit(child, 1);
         return true;
     }
 
@@ -162,17 +383,89 @@ __out PCManifestRecord& child) const
         return false;
     }
 
+    // A chain never wraps around to where it started, whatever the flags of a damaged table say.
+    ManifestRecord::BucketCountType probes = 1;
     do {
         index = (index + 1) % numBuckets;
-        child = this->GetChildRecord(index);
-
-        assert(child);
-        if (child->Hash == hash &&
-            ArePathsEqual(target, child->GetPartialPath(), targetLength))
+        if (IsChildInBucket(this, index, hash, target, targetLength, child))
         {
+            CountLookupHit(child, probes + 1);
             return true;
         }
-    } while (this->IsCollisionChainContinuation(index));
+    } while (++probes < numBuckets && this->IsCollisionChainContinuation(index));
+
+    return false;
+}
+
+/// TryFindSuffixPolicy
+///
+/// Looks the suffixes of the file name starting at a dot up in the table, longest first. A name has few dots, hence
+/// typically a single lookup; only the suffixes of at most MaxSuffixLength characters are looked up.
+__success(return)
+bool ManifestSuffixPolicies::TryFindSuffixPolicy(
+__in  PCPathChar fileName,
+__in  size_t fileNameLength,
+__out PolicyType& mask,
+__out PolicyType& values) const
+{
+    if (BucketCount == 0)
+    {
+        return false;
+    }
+
+    // No longer suffix is in the table, and hashing each of them would make the lookup quadratic in the number of dots.
+    size_t firstStart = fileNameLength > MaxSuffixLength ? fileNameLength - MaxSuffixLength : 0;
+    for (size_t start = firstStart; start < fileNameLength; start++)
+    {
+        if (fileName[start] != '.')
+        {
+            continue;
+        }
+
+        PCPathChar suffix = fileName + start;
+        size_t suffixLength = fileNameLength - start;
+        HashType hash = HashPath(suffix, suffixLength);
+
+        // We are searching a hash-table that has been constructed in FileAccessManifest.cs
+        for (OffsetType index = hash % BucketCount; Buckets[index].SuffixOffset != 0; index = (index + 1) % BucketCount)
+        {
+            Entry const& entry = Buckets[index];
+            if (entry.Hash == hash && ArePathsEqual(suffix, GetSuffix(entry), suffixLength))
+            {
+                mask = entry.Mask;
+                values = entry.Values;
+                return true;
+            }
+        }
+    }
 
     return false;
 }
+
+bool ApplySuffixPolicy(
+    __in    PCManifestSuffixPolicies suffixPolicies,
+    __in    PCPathChar path,
+    __in    size_t pathLength,
+    __inout FileAccessPolicy& policy)
+{
+    if (suffixPolicies == nullptr || suffixPolicies->BucketCount == 0)
+    {
+        return false;
+    }
+
+    size_t fileNameStart = pathLength;
+    while (fileNameStart > 0 && !IsDirectorySeparator(path[fileNameStart - 1]))
+    {
+        fileNameStart--;
+    }
+
+    ManifestSuffixPolicies::PolicyType mask;
+    ManifestSuffixPolicies::PolicyType values;
+    if (!suffixPolicies->TryFindSuffixPolicy(path + fileNameStart, pathLength - fileNameStart, mask, values))
+    {
+        return false;
+    }
+
+    policy = static_cast<FileAccessPolicy>((policy & mask) | values);
+    return true;
+}
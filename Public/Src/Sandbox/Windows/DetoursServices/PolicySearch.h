@@ -50,6 +50,16 @@ struct PolicySearchCursor {
         return Record != nullptr;
     }
 
+    // Indicates if the matched path and everything below it is transparent (see IsTransparentPolicy).
+    // A truncated search matched no record for the path, so only the cone policy of the record it stopped at applies below it.
+    bool IsInTransparentScope() const {
+        if (!IsValid()) {
+            return false;
+        }
+
+        return SearchWasTruncated ? IsTransparentPolicy(Record->GetConePolicy()) : Record->IsTransparentScope();
+    }
+
     ManifestRecord const* Record;
 
     // Indicates if the search generating this cursor was truncated due to reaching the bottom of the tree.
@@ -67,6 +77,30 @@ PolicySearchCursor FindFileAccessPolicyInTreeEx(
     __in  PCPathChar absolutePath,
     __in  size_t absolutePathLength);
 
+// One component of a path as the policy search consumes it: where it starts in the path, its length,
+// and its hash as computed by HashPath (which ManifestRecord::FindChild compares against).
+struct PathComponent {
+    DWORD Offset;
+    DWORD Length;
+    DWORD Hash;
+};
+
+// Splits the first 'length' characters of a path into the components FindFileAccessPolicyInTreeEx would consume,
+// hashing each. Writes at most 'capacity' of them, and returns how many there are.
+size_t TokenizePathComponents(
+    __in  PCPathChar path,
+    __in  size_t length,
+    __out_ecount(capacity) PathComponent* components,
+    __in  size_t capacity);
+
+// Equivalent to FindFileAccessPolicyInTreeEx for the path the components were tokenized from, but without
+// scanning or hashing the path again.
+PolicySearchCursor FindFileAccessPolicyInTreeEx(
+    __in  PolicySearchCursor const& startCursor,
+    __in  PCPathChar path,
+    __in_ecount(componentCount) PathComponent const* components,
+    __in  size_t componentCount);
+
 // This is equivalent to FindFileAccessPolicyInTreeEx, but taking just a start record
 // rather than a full cursor, and returning only the matched record details rather than a cursor.
 // This is a simplified variant for easier C#-side testing.
@@ -79,4 +113,51 @@ BOOL WINAPI FindFileAccessPolicyInTree(
     __out DWORD& pathId,
     __out USN& expectedUsn);
 
+// The policy FindFileAccessPoliciesInTree found for one path (the outputs of FindFileAccessPolicyInTree).
+// Keep this in sync with the C# version declared in ProcessUtilities.Win.WinOnly.cs
+typedef struct PolicySearchResult_t
+{
+    DWORD   ConePolicy;
+    DWORD   NodePolicy;
+    DWORD   PathId;
+    USN     ExpectedUsn;
+} PolicySearchResult;
+
+// Batch variant of FindFileAccessPolicyInTree, saving a call (and a search from the root) per path.
+// The paths are given back to back in 'absolutePaths', with the length of each in 'absolutePathLengths'.
+// When consecutive paths share leading path components (e.g. when the paths are sorted), the search of a path
+// resumes from the cursor the previous one reached for their common components.
+BOOL WINAPI FindFileAccessPoliciesInTree(
+    __in  PCManifestRecord record,
+    __in  PCPathChar absolutePaths,
+    __in_ecount(pathCount) size_t const* absolutePathLengths,
+    __in  size_t pathCount,
+    __out_ecount(pathCount) PolicySearchResult* results);
+
+// Applies to a policy the suffix policy (see ManifestSuffixPolicies) of the file the path ends with, if any.
+// Returns whether one applied.
+bool ApplySuffixPolicy(
+    __in    PCManifestSuffixPolicies suffixPolicies,
+    __in    PCPathChar path,
+    __in    size_t pathLength,
+    __inout FileAccessPolicy& policy);
+
+#if !(MAC_OS_LIBRARY) && !(MAC_OS_SANDBOX) && !(BUILDXL_MINIFILTER)
+
+// Where ManifestRecord::FindChild counts the children it finds, when the lookups of the pip are profiled (see LookupProfile.h).
+struct ManifestLookupCounters {
+    // ProbeLengthCount entries: entry i counts the children found after i + 1 probes, the last one also the longer probes.
+    volatile LONG64* ProbeLengthHistogram;
+    uint32_t ProbeLengthCount;
+    // HitCounterCount entries, indexed by PathId & PathIdIndexMask.
+    volatile LONG* HitCounts;
+    uint32_t HitCounterCount;
+    uint32_t PathIdIndexMask;
+};
+
+// Null unless the lookups are profiled.
+extern ManifestLookupCounters const* g_manifestLookupCounters;
+
+#endif // !(MAC_OS_LIBRARY) && !(MAC_OS_SANDBOX) && !(BUILDXL_MINIFILTER)
+
 #endif
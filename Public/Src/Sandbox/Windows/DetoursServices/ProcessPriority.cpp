@@ -0,0 +1,165 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <winternl.h>
+
+#include "ProcessPriority.h"
+#include "DebuggingHelpers.h"
+#include "FeatureCounters.h"
+#include "globals.h"
+
+// Value of PROCESSINFOCLASS from ntddk.h; the information is the IO_PRIORITY_HINT of the process, as a ULONG.
+#define PROCESS_IO_PRIORITY_INFORMATION_CLASS ((PROCESSINFOCLASS)33)
+
+// The priority class flags of CreateProcess.
+#define PRIORITY_CLASS_FLAGS \
+    (IDLE_PRIORITY_CLASS | BELOW_NORMAL_PRIORITY_CLASS | NORMAL_PRIORITY_CLASS | ABOVE_NORMAL_PRIORITY_CLASS | HIGH_PRIORITY_CLASS | REALTIME_PRIORITY_CLASS)
+
+typedef NTSTATUS(NTAPI *NtQueryInformationProcess_t)(
+    HANDLE ProcessHandle,
+    PROCESSINFOCLASS ProcessInformationClass,
+    PVOID ProcessInformation,
+    ULONG ProcessInformationLength,
+    PULONG ReturnLength);
+
+typedef NTSTATUS(NTAPI *NtSetInformationProcess_t)(
+    HANDLE ProcessHandle,
+    PROCESSINFOCLASS ProcessInformationClass,
+    PVOID ProcessInformation,
+    ULONG ProcessInformationLength);
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+// Neither function is detoured. Looked up when the process starts, and only if the manifest sets an I/O priority.
+static NtQueryInformationProcess_t g_ntQueryInformationProcess = nullptr;
+static NtSetInformationProcess_t g_ntSetInformationProcess = nullptr;
+
+// ----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+// ----------------------------------------------------------------------------
+
+/// Orders the priority classes from the lowest; -1 for anything but a single class.
+static int GetPriorityClassRank(DWORD priorityClass)
+{
+    switch (priorityClass)
+    {
+        case IDLE_PRIORITY_CLASS:           return 0;
+        case BELOW_NORMAL_PRIORITY_CLASS:   return 1;
+        case NORMAL_PRIORITY_CLASS:         return 2;
+        case ABOVE_NORMAL_PRIORITY_CLASS:   return 3;
+        case HIGH_PRIORITY_CLASS:           return 4;
+        case REALTIME_PRIORITY_CLASS:       return 5;
+        default:                            return -1;
+    }
+}
+
+static bool TryGetManifestPriorityClass(_Out_ DWORD& priorityClass)
+{
+    PCManifestProcessPriority priority = g_manifestProcessPriority;
+    if (priority == nullptr || !priority->HasPriorityClass() || GetPriorityClassRank(priority->PriorityClass) < 0)
+    {
+        return false;
+    }
+
+    priorityClass = priority->PriorityClass;
+    return true;
+}
+
+/// Lowers the I/O priority of a process to the one of the manifest, if it has a higher one.
+static void LowerIoPriority(HANDLE process)
+{
+    PCManifestProcessPriority priority = g_manifestProcessPriority;
+    if (priority == nullptr || !priority->HasIoPriority() || g_ntQueryInformationProcess == nullptr || g_ntSetInformationProcess == nullptr)
+    {
+        return;
+    }
+
+    ULONG hint = priority->GetIoPriorityHint();
+    ULONG currentHint;
+    if (NT_SUCCESS(g_ntQueryInformationProcess(process, PROCESS_IO_PRIORITY_INFORMATION_CLASS, &currentHint, sizeof(currentHint), nullptr))
+        && currentHint <= hint)
+    {
+        return;
+    }
+
+    NTSTATUS status = g_ntSetInformationProcess(process, PROCESS_IO_PRIORITY_INFORMATION_CLASS, &hint, sizeof(hint));
+    if (!NT_SUCCESS(status))
+    {
+        Dbg(L"Warning: Could not set the I/O priority of process %d. Status: 0x%08X.", (int)GetProcessId(process), (int)status);
+        return;
+    }
+
+    IncrementFeatureCounter(FeatureCounter::PrioritiesLowered);
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+DWORD ApplyPriorityClassToCreationFlags(DWORD creationFlags)
+{
+    DWORD priorityClass;
+    if (!TryGetManifestPriorityClass(priorityClass))
+    {
+        return creationFlags;
+    }
+
+    DWORD requested = creationFlags & PRIORITY_CLASS_FLAGS;
+    if (requested == 0)
+    {
+        // A child created without a class gets NORMAL_PRIORITY_CLASS, unless the class of its parent is lower.
+        DWORD parentClass = GetPriorityClass(GetCurrentProcess());
+        requested = parentClass == IDLE_PRIORITY_CLASS || parentClass == BELOW_NORMAL_PRIORITY_CLASS ? parentClass : NORMAL_PRIORITY_CLASS;
+    }
+
+    // Several classes at once fail CreateProcess; let them.
+    int requestedRank = GetPriorityClassRank(requested);
+    if (requestedRank < 0 || requestedRank <= GetPriorityClassRank(priorityClass))
+    {
+        return creationFlags;
+    }
+
+    IncrementFeatureCounter(FeatureCounter::PrioritiesLowered);
+    return (creationFlags & ~PRIORITY_CLASS_FLAGS) | priorityClass;
+}
+
+void ApplyIoPriorityToProcess(HANDLE process)
+{
+    DWORD lastError = GetLastError();
+    LowerIoPriority(process);
+    SetLastError(lastError);
+}
+
+void ApplyProcessPriorityToCurrentProcess()
+{
+    PCManifestProcessPriority priority = g_manifestProcessPriority;
+    HMODULE ntdll = priority != nullptr && priority->HasIoPriority() ? GetModuleHandleW(L"ntdll.dll") : NULL;
+    if (ntdll != NULL)
+    {
+        g_ntQueryInformationProcess = reinterpret_cast<NtQueryInformationProcess_t>(GetProcAddress(ntdll, "NtQueryInformationProcess"));
+        g_ntSetInformationProcess = reinterpret_cast<NtSetInformationProcess_t>(GetProcAddress(ntdll, "NtSetInformationProcess"));
+    }
+
+    DWORD priorityClass;
+    if (TryGetManifestPriorityClass(priorityClass))
+    {
+        DWORD currentClass = GetPriorityClass(GetCurrentProcess());
+        if (GetPriorityClassRank(currentClass) > GetPriorityClassRank(priorityClass))
+        {
+            if (SetPriorityClass(GetCurrentProcess(), priorityClass))
+            {
+                IncrementFeatureCounter(FeatureCounter::PrioritiesLowered);
+            }
+            else
+            {
+                Dbg(L"Warning: Could not set the priority class of the process. Last Error: %d.", (int)GetLastError());
+            }
+        }
+    }
+
+    LowerIoPriority(GetCurrentProcess());
+}
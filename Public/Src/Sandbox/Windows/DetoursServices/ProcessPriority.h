@@ -0,0 +1,31 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Priorities of the processes of a pip (see ManifestProcessPriority).
+//
+// Windows only passes the priority class of a process on to the children it creates without a class of their own, and only
+// when it is IDLE_PRIORITY_CLASS or BELOW_NORMAL_PRIORITY_CLASS; the I/O priority is not passed on at all. So that all the
+// processes of a low-priority pip yield to the others, the detoured processes lower their own priorities to the ones of the
+// manifest when they start, create their children with a priority class no higher than it, and lower the I/O priority of
+// their children before these run. Priorities are only ever lowered: a process or child asking for a lower one keeps it.
+//
+// Children breaking away from the job of the pip are left alone.
+
+#pragma once
+
+#include <windows.h>
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// The creation flags of CreateProcess with a priority class no higher than the one of the manifest. Flags without a priority
+/// class get the one of the manifest if the class the child would default to is higher.
+DWORD ApplyPriorityClassToCreationFlags(DWORD creationFlags);
+
+/// Lowers the I/O priority of a child just created to the one of the manifest. Failing to is not fatal. Preserves the last error.
+void ApplyIoPriorityToProcess(HANDLE process);
+
+/// Lowers the priority class and the I/O priority of the current process to the ones of the manifest.
+/// Must be called once the manifest is parsed, before the process creates any child.
+void ApplyProcessPriorityToCurrentProcess();
@@ -0,0 +1,213 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <unordered_map>
+
+#include "ReparsePointCache.h"
+#include "FeatureCounters.h"
+#include "MemoryPressure.h"
+
+// Beyond this many paths the cache starts over rather than growing without bound.
+#define REPARSE_POINT_CACHE_MAX_ENTRIES 16384
+
+struct StampedReparsePointCacheEntry
+{
+    LONG Generation;
+    ReparsePointCacheEntry Entry;
+};
+
+struct StampedReparsePointChain
+{
+    LONG Generation;
+    std::vector<std::wstring> Chain;
+};
+
+typedef std::unordered_map<std::wstring, StampedReparsePointCacheEntry, CaseInsensitivePathHash, CaseInsensitivePathEqual> ReparsePointCacheMap;
+typedef std::unordered_map<std::wstring, StampedReparsePointChain, CaseInsensitivePathHash, CaseInsensitivePathEqual> ReparsePointChainMap;
+
+static volatile LONG g_reparsePointCacheGeneration = 0;
+
+// Entries of older generations are stale; they get overwritten or dropped as the cache is used.
+static SRWLOCK g_reparsePointCacheLock = SRWLOCK_INIT;
+static ReparsePointCacheMap* g_reparsePointCache = nullptr;
+static ReparsePointChainMap* g_reparsePointChains = nullptr;
+
+LONG GetReparsePointCacheGeneration()
+{
+    return g_reparsePointCacheGeneration;
+}
+
+bool TryGetReparsePointCacheEntry(_In_ LPCWSTR path, _Out_ ReparsePointCacheEntry& entry)
+{
+    if (!CacheReparsePointProbes() || path == nullptr)
+    {
+        return false;
+    }
+
+    LONG generation = g_reparsePointCacheGeneration;
+    bool found = false;
+
+    AcquireSRWLockShared(&g_reparsePointCacheLock);
+
+    if (g_reparsePointCache != nullptr)
+    {
+        ReparsePointCacheMap::const_iterator it = g_reparsePointCache->find(std::wstring(path));
+        if (it != g_reparsePointCache->end() && it->second.Generation == generation)
+        {
+            entry = it->second.Entry;
+            found = true;
+        }
+    }
+
+    ReleaseSRWLockShared(&g_reparsePointCacheLock);
+
+    if (found)
+    {
+        IncrementFeatureCounter(FeatureCounter::ReparsePointCacheHits);
+    }
+
+    return found;
+}
+
+void SetReparsePointCacheEntry(_In_ LPCWSTR path, LONG generation, ReparsePointCacheEntry const& entry)
+{
+    if (!CacheReparsePointProbes() || path == nullptr || generation != g_reparsePointCacheGeneration)
+    {
+        return;
+    }
+
+    std::wstring key(path);
+
+    AcquireSRWLockExclusive(&g_reparsePointCacheLock);
+
+    if (g_reparsePointCache == nullptr)
+    {
+        g_reparsePointCache = new ReparsePointCacheMap();
+        EnsureMemoryPressureMonitorStarted();
+    }
+    else if (g_reparsePointCache->size() >= REPARSE_POINT_CACHE_MAX_ENTRIES)
+    {
+        g_reparsePointCache->clear();
+    }
+
+    StampedReparsePointCacheEntry& stamped = (*g_reparsePointCache)[std::move(key)];
+    stamped.Generation = generation;
+    stamped.Entry = entry;
+
+    ReleaseSRWLockExclusive(&g_reparsePointCacheLock);
+}
+
+bool TryGetResolvedReparsePointChain(_In_ LPCWSTR path, _Inout_ std::vector<std::wstring>& chain)
+{
+    if (!CacheReparsePointProbes() || path == nullptr)
+    {
+        return false;
+    }
+
+    LONG generation = g_reparsePointCacheGeneration;
+    bool found = false;
+
+    AcquireSRWLockShared(&g_reparsePointCacheLock);
+
+    if (g_reparsePointChains != nullptr)
+    {
+        ReparsePointChainMap::const_iterator it = g_reparsePointChains->find(std::wstring(path));
+        if (it != g_reparsePointChains->end() && it->second.Generation == generation)
+        {
+            chain.insert(chain.end(), it->second.Chain.begin(), it->second.Chain.end());
+            found = true;
+        }
+    }
+
+    ReleaseSRWLockShared(&g_reparsePointCacheLock);
+
+    if (found)
+    {
+        IncrementFeatureCounter(FeatureCounter::ReparsePointCacheHits);
+    }
+
+    return found;
+}
+
+void SetResolvedReparsePointChain(_In_ LPCWSTR path, LONG generation, std::vector<std::wstring> const& chain)
+{
+    if (!CacheReparsePointProbes() || path == nullptr || generation != g_reparsePointCacheGeneration)
+    {
+        return;
+    }
+
+    std::wstring key(path);
+
+    AcquireSRWLockExclusive(&g_reparsePointCacheLock);
+
+    if (g_reparsePointChains == nullptr)
+    {
+        g_reparsePointChains = new ReparsePointChainMap();
+        EnsureMemoryPressureMonitorStarted();
+    }
+    else if (g_reparsePointChains->size() >= REPARSE_POINT_CACHE_MAX_ENTRIES)
+    {
+        g_reparsePointChains->clear();
+    }
+
+    StampedReparsePointChain& stamped = (*g_reparsePointChains)[std::move(key)];
+    stamped.Generation = generation;
+    stamped.Chain = chain;
+
+    ReleaseSRWLockExclusive(&g_reparsePointCacheLock);
+}
+
+/// Removes the entries of older generations, then (the map keeping no track of their use) the first ones until the map is
+/// down to the floor.
+template <typename TMap>
+static size_t ShrinkStampedMap(TMap* map, LONG generation, size_t floor)
+{
+    if (map == nullptr)
+    {
+        return 0;
+    }
+
+    size_t removed = 0;
+    for (typename TMap::iterator it = map->begin(); it != map->end(); )
+    {
+        if (it->second.Generation != generation)
+        {
+            it = map->erase(it);
+            removed++;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    while (map->size() > floor)
+    {
+        map->erase(map->begin());
+        removed++;
+    }
+
+    return removed;
+}
+
+size_t ShrinkReparsePointCache(size_t floor)
+{
+    LONG generation = g_reparsePointCacheGeneration;
+
+    AcquireSRWLockExclusive(&g_reparsePointCacheLock);
+
+    size_t removed = ShrinkStampedMap(g_reparsePointCache, generation, floor)
+        + ShrinkStampedMap(g_reparsePointChains, generation, floor);
+
+    ReleaseSRWLockExclusive(&g_reparsePointCacheLock);
+
+    return removed;
+}
+
+void InvalidateReparsePointCache()
+{
+    // Also advanced when the cache is disabled, since the final paths cached in handle overlays are stamped with it.
+    InterlockedIncrement(&g_reparsePointCacheGeneration);
+}
@@ -0,0 +1,111 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Per-process cache of the file attributes and reparse point tags probed to detect reparse points, and of the reparse
+// point chains resolved from them.
+//
+// With FileAccessManifestExtraFlag::CacheReparsePointProbes, IsReparsePoint and GetReparsePointType only hit the
+// filesystem the first time they see a path (including paths that do not exist), and the chain of paths leading from a
+// reparse point to its final target is only resolved once.
+//
+// Every detoured function that creates, moves, or deletes files in this process (CreateSymbolicLinkW, renames and
+// deletions through ZwSetInformationFile, etc.) invalidates the whole cache by bumping its generation: a rename of a
+// directory affects every path below it, so invalidating single paths would not be enough. Entries are stamped with the
+// generation read before probing, so a probe racing with a mutation never leaves a stale entry behind.
+//
+// The generation always advances, whether the cache is enabled or not, so that other per-process caches of file system
+// state (the final paths of handles, with FileAccessManifestExtraFlag::CacheFinalPathsOfHandles) can be stamped with it.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "DataTypes.h"
+#include "FileAccessHelpers.h"
+
+// ----------------------------------------------------------------------------
+// STRUCTS
+// ----------------------------------------------------------------------------
+
+// Hash and equality for maps keyed by paths (shared with KnownDirectoryCache).
+// Paths are compared case-insensitively, so the hash must not depend on case either.
+struct CaseInsensitivePathHash
+{
+    size_t operator()(std::wstring const& path) const
+    {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (wchar_t c : path)
+        {
+            hash ^= (uint32_t)towupper(c);
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+};
+
+struct CaseInsensitivePathEqual
+{
+    bool operator()(std::wstring const& left, std::wstring const& right) const
+    {
+        return left.length() == right.length() && _wcsnicmp(left.c_str(), right.c_str(), left.length()) == 0;
+    }
+};
+
+struct ReparsePointCacheEntry
+{
+    // INVALID_FILE_ATTRIBUTES if the path did not exist.
+    DWORD Attributes;
+    // Only meaningful if HasReparseTag.
+    DWORD ReparseTag;
+    bool HasReparseTag;
+};
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Returns the generation to stamp an entry probed from now on with.
+LONG GetReparsePointCacheGeneration();
+
+/// Looks up a path probed since the last invalidation. Always fails when the cache is disabled.
+bool TryGetReparsePointCacheEntry(_In_ LPCWSTR path, _Out_ ReparsePointCacheEntry& entry);
+
+/// Records the result of probing a path; dropped if the cache got invalidated since the given generation was read.
+void SetReparsePointCacheEntry(_In_ LPCWSTR path, LONG generation, ReparsePointCacheEntry const& entry);
+
+/// Looks up the chain of paths leading to and including the final target of a reparse point resolved since the last invalidation.
+/// Always fails when the cache is disabled.
+bool TryGetResolvedReparsePointChain(_In_ LPCWSTR path, _Inout_ std::vector<std::wstring>& chain);
+
+/// Records the chain resolved for a reparse point; dropped if the cache got invalidated since the given generation was read.
+void SetResolvedReparsePointChain(_In_ LPCWSTR path, LONG generation, std::vector<std::wstring> const& chain);
+
+/// Forgets all the probed paths and resolved chains. Cheap enough to call on every mutating file operation.
+void InvalidateReparsePointCache();
+
+/// Removes the stale entries of the cache, then others until it holds no more than the given number of probed paths and of
+/// resolved chains. Returns the number of entries removed.
+size_t ShrinkReparsePointCache(size_t floor);
+
+/// Invalidates the cache when leaving the scope, i.e., after the mutating operation it guards has completed.
+class ReparsePointCacheInvalidationScope
+{
+public:
+    ReparsePointCacheInvalidationScope(bool invalidate = true) : m_invalidate(invalidate) { }
+    ~ReparsePointCacheInvalidationScope()
+    {
+        if (m_invalidate)
+        {
+            InvalidateReparsePointCache();
+        }
+    }
+
+private:
+    bool m_invalidate;
+
+    ReparsePointCacheInvalidationScope(const ReparsePointCacheInvalidationScope&) = delete;
+    ReparsePointCacheInvalidationScope& operator=(const ReparsePointCacheInvalidationScope&) = delete;
+};
@@ -0,0 +1,509 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "DebuggingHelpers.h"
+#include "FeatureCounters.h"
+#include "globals.h"
+#include "ReportCache.h"
+#include "buildXL_mem.h"
+
+// Number of slots of the cache. Must be a power of two.
+#define REPORT_CACHE_SIZE 16384
+
+// How many slots a lookup probes before giving up on deduplicating the report.
+#define REPORT_CACHE_MAX_PROBES 32
+
+// Number of slots of the cache shared by the processes of a pip. Must be a power of two.
+#define SHARED_REPORT_CACHE_SIZE 65536
+
+// Changed along with the layout of the shared cache, so that processes of different builds do not share it.
+#define SHARED_REPORT_CACHE_TAG 0x5CA7CAC5
+
+// Number of slots of the enumeration cache. Must be a power of two.
+#define ENUMERATION_REPORT_CACHE_SIZE 4096
+
+// Number of slots of the table of interned filters. Must be a power of two.
+#define INTERNED_FILTER_TABLE_SIZE 256
+
+struct ReportCacheEntry
+{
+    // Accesses seen for the path with Error, closed under implication.
+    volatile LONG Access;
+    // Hash of the path alone, so that the entries of a path for different errors share a probe sequence.
+    uint32_t Hash;
+    DWORD Error;
+    size_t PathLength;
+    // Not null-terminated; PathLength characters follow the entry.
+    wchar_t Path[1];
+};
+
+// Zero-initialized, so pages of the table are only committed once slots in them get used.
+static ReportCacheEntry* volatile g_reportCache[REPORT_CACHE_SIZE];
+
+struct InternedFilter
+{
+    uint32_t Hash;
+    size_t FilterLength;
+    // Null-terminated; FilterLength characters plus the terminator follow the entry.
+    wchar_t Filter[1];
+};
+
+struct EnumerationReportCacheEntry
+{
+    uint32_t Hash;
+    DWORD Error;
+    // Interned, so filters are compared by address.
+    InternedFilter const* Filter;
+    size_t PathLength;
+    // Not null-terminated; PathLength characters follow the entry.
+    wchar_t Path[1];
+};
+
+static InternedFilter* volatile g_internedFilters[INTERNED_FILTER_TABLE_SIZE];
+static EnumerationReportCacheEntry* volatile g_enumerationReportCache[ENUMERATION_REPORT_CACHE_SIZE];
+
+// Header of the shared cache section; the slots follow it.
+struct SharedReportCacheHeader
+{
+    uint32_t Tag;
+    uint32_t SlotCount;
+    uint64_t Reserved;
+};
+
+struct SharedReportCacheSlot
+{
+    // Hash of the path and the error, or 0 for a free slot.
+    volatile LONG64 Key;
+    // Accesses seen for the path with the error by any process of the pip, closed under implication.
+    volatile LONG Access;
+    // Low half of the hash of the path alone, for InvalidateReportCache to find the slots of the path whatever their error.
+    // Written right after the key is published, so 0 while the slot is being claimed.
+    volatile LONG PathTag;
+};
+
+// Slots of the shared cache, or nullptr if there is none. The section is zero-filled on demand as well.
+static SharedReportCacheSlot* g_sharedReportCache = nullptr;
+
+static const RequestedAccess LookupProbe     = RequestedAccess::Lookup | RequestedAccess::Probe;
+static const RequestedAccess LookupProbeRead = LookupProbe | RequestedAccess::Read;
+
+// CODESYNC: MacOs/Sandbox/Src/CacheRecord.cpp
+static inline RequestedAccess Implies(RequestedAccess access)
+{
+    RequestedAccess result = RequestedAccess::None;
+
+    // Probe implies Lookup
+    if ((access & RequestedAccess::Probe) != RequestedAccess::None)
+    {
+        result |= RequestedAccess::Lookup;
+    }
+
+    // Read implies Probe (and, transitively, Lookup)
+    if ((access & RequestedAccess::Read) != RequestedAccess::None)
+    {
+        result |= LookupProbe;
+    }
+
+    // Write implies Read (and, transitively, Probe and Lookup)
+    if ((access & RequestedAccess::Write) != RequestedAccess::None)
+    {
+        result |= LookupProbeRead;
+    }
+
+    return result;
+}
+
+// Paths are compared case-insensitively, so the hash must not depend on case either.
+static uint32_t HashPath(PCWSTR path, size_t pathLength)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < pathLength; i++)
+    {
+        hash ^= (uint32_t)towupper(path[i]);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Wider than HashPath, as only the hash is kept in the shared cache.
+static uint64_t HashPathForSharedCache(PCWSTR path, size_t pathLength)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < pathLength; i++)
+    {
+        hash ^= (uint64_t)towupper(path[i]);
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// Key of the slot of a path and an error in the shared cache.
+static LONG64 GetSharedReportCacheKey(uint64_t pathHash, DWORD error)
+{
+    // Continues FNV-1a over the error, so that the key stays a 64-bit hash of both.
+    uint64_t hash = pathHash;
+    for (int i = 0; i < 4; i++)
+    {
+        hash ^= (uint64_t)((error >> (8 * i)) & 0xFF);
+        hash *= 1099511628211ull;
+    }
+
+    // 0 marks free slots.
+    return (LONG64)(hash == 0 ? 1 : hash);
+}
+
+// 0 marks slots whose tag is not written yet.
+static inline LONG GetSharedReportCachePathTag(uint64_t pathHash)
+{
+    LONG tag = (LONG)(uint32_t)pathHash;
+    return tag == 0 ? 1 : tag;
+}
+
+static inline bool EntryMatches(ReportCacheEntry const* entry, uint32_t hash, PCWSTR path, size_t pathLength)
+{
+    return entry->Hash == hash
+        && entry->PathLength == pathLength
+        && _wcsnicmp(entry->Path, path, pathLength) == 0;
+}
+
+/// Returns the entry for the path and the error, creating it if needed, or nullptr if the neighbourhood of the path in the
+/// table is full.
+static ReportCacheEntry* FindOrAddEntry(PCWSTR path, size_t pathLength, DWORD error)
+{
+    uint32_t hash = HashPath(path, pathLength);
+    ReportCacheEntry* newEntry = nullptr;
+
+    for (uint32_t probe = 0; probe < REPORT_CACHE_MAX_PROBES; probe++)
+    {
+        ReportCacheEntry* volatile* slot = &g_reportCache[(hash + probe) & (REPORT_CACHE_SIZE - 1)];
+        ReportCacheEntry* entry = *slot;
+
+        if (entry == nullptr)
+        {
+            if (newEntry == nullptr)
+            {
+                newEntry = reinterpret_cast<ReportCacheEntry*>(new char[sizeof(ReportCacheEntry) + sizeof(wchar_t) * pathLength]);
+                newEntry->Access = 0;
+                newEntry->Hash = hash;
+                newEntry->Error = error;
+                newEntry->PathLength = pathLength;
+                wmemcpy(newEntry->Path, path, pathLength);
+            }
+
+            entry = reinterpret_cast<ReportCacheEntry*>(InterlockedCompareExchangePointer((PVOID volatile*)slot, newEntry, nullptr));
+            if (entry == nullptr)
+            {
+                return newEntry;
+            }
+
+            // Another thread claimed the slot first; it may have done so for the same path.
+        }
+
+        if (entry->Error == error && EntryMatches(entry, hash, path, pathLength))
+        {
+            if (newEntry != nullptr)
+            {
+                delete[] reinterpret_cast<char*>(newEntry);
+            }
+
+            return entry;
+        }
+    }
+
+    if (newEntry != nullptr)
+    {
+        delete[] reinterpret_cast<char*>(newEntry);
+    }
+
+    return nullptr;
+}
+
+/// Returns the interned copy of the filter, or nullptr if the neighbourhood of the filter in the table is full.
+static InternedFilter const* InternFilter(PCWSTR filter)
+{
+    size_t filterLength = wcslen(filter);
+    uint32_t hash = HashPath(filter, filterLength);
+    InternedFilter* newFilter = nullptr;
+
+    for (uint32_t probe = 0; probe < REPORT_CACHE_MAX_PROBES; probe++)
+    {
+        InternedFilter* volatile* slot = &g_internedFilters[(hash + probe) & (INTERNED_FILTER_TABLE_SIZE - 1)];
+        InternedFilter* interned = *slot;
+
+        if (interned == nullptr)
+        {
+            if (newFilter == nullptr)
+            {
+                newFilter = reinterpret_cast<InternedFilter*>(new char[sizeof(InternedFilter) + sizeof(wchar_t) * filterLength]);
+                newFilter->Hash = hash;
+                newFilter->FilterLength = filterLength;
+                wmemcpy(newFilter->Filter, filter, filterLength + 1);
+            }
+
+            interned = reinterpret_cast<InternedFilter*>(InterlockedCompareExchangePointer((PVOID volatile*)slot, newFilter, nullptr));
+            if (interned == nullptr)
+            {
+                return newFilter;
+            }
+        }
+
+        if (interned->Hash == hash
+            && interned->FilterLength == filterLength
+            && _wcsnicmp(interned->Filter, filter, filterLength) == 0)
+        {
+            if (newFilter != nullptr)
+            {
+                delete[] reinterpret_cast<char*>(newFilter);
+            }
+
+            return interned;
+        }
+    }
+
+    if (newFilter != nullptr)
+    {
+        delete[] reinterpret_cast<char*>(newFilter);
+    }
+
+    return nullptr;
+}
+
+void InitializeSharedReportCache()
+{
+    if (!DeduplicateReports() || !ShareReportCacheAcrossProcesses() || g_pDetouredProcessInjector == nullptr)
+    {
+        return;
+    }
+
+    const DWORD sectionSize = sizeof(SharedReportCacheHeader) + SHARED_REPORT_CACHE_SIZE * sizeof(SharedReportCacheSlot);
+    HANDLE section = g_pDetouredProcessInjector->ReportCacheSection();
+    bool created = false;
+
+    if (section == nullptr)
+    {
+        // This is the first detoured process of the pip (or the parent could not pass the section on).
+        section = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sectionSize, nullptr);
+        if (section == nullptr)
+        {
+            Dbg(L"InitializeSharedReportCache - Failed to create section, reports are only deduplicated per process: 0x%08x", (int)GetLastError());
+            return;
+        }
+
+        created = true;
+    }
+
+    SharedReportCacheHeader* header = reinterpret_cast<SharedReportCacheHeader*>(MapViewOfFile(section, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sectionSize));
+    if (header == nullptr)
+    {
+        Dbg(L"InitializeSharedReportCache - Failed to map section, reports are only deduplicated per process: 0x%08x", (int)GetLastError());
+        if (created)
+        {
+            CloseHandle(section);
+        }
+
+        return;
+    }
+
+    if (created)
+    {
+        // No other process can see the section before it is handed to the injector.
+        header->SlotCount = SHARED_REPORT_CACHE_SIZE;
+        header->Tag = SHARED_REPORT_CACHE_TAG;
+        g_pDetouredProcessInjector->SetReportCacheSection(section);
+    }
+    else if (header->Tag != SHARED_REPORT_CACHE_TAG || header->SlotCount != SHARED_REPORT_CACHE_SIZE)
+    {
+        // Created by a different build of this library.
+        Dbg(L"InitializeSharedReportCache - Unexpected section layout, reports are only deduplicated per process");
+        UnmapViewOfFile(header);
+        return;
+    }
+
+    g_sharedReportCache = reinterpret_cast<SharedReportCacheSlot*>(header + 1);
+}
+
+/// Records the accesses in the shared cache. Returns true if they had all been seen before, like CheckAndUpdateReportCache.
+static bool CheckAndUpdateSharedReportCache(PCWSTR path, size_t pathLength, DWORD error, LONG access, LONG impliedAccess)
+{
+    // Slots are probed from the hash of the path alone, like entries of the per-process cache.
+    uint64_t hash = HashPathForSharedCache(path, pathLength);
+    LONG64 key = GetSharedReportCacheKey(hash, error);
+
+    for (uint32_t probe = 0; probe < REPORT_CACHE_MAX_PROBES; probe++)
+    {
+        SharedReportCacheSlot* slot = &g_sharedReportCache[(hash + probe) & (SHARED_REPORT_CACHE_SIZE - 1)];
+        LONG64 slotKey = slot->Key;
+
+        if (slotKey == 0)
+        {
+            slotKey = InterlockedCompareExchange64(&slot->Key, key, 0);
+            if (slotKey == 0)
+            {
+                InterlockedExchange(&slot->PathTag, GetSharedReportCachePathTag(hash));
+                slotKey = key;
+            }
+
+            // Otherwise another thread (of this process or another one) claimed the slot first; it may have done so for the same path.
+        }
+
+        if (slotKey == key)
+        {
+            LONG previous = InterlockedOr(&slot->Access, access | impliedAccess);
+            return (previous & access) == access;
+        }
+    }
+
+    return false;
+}
+
+void InvalidateReportCache(_In_reads_(pathLength) PCWSTR canonicalizedPath, size_t pathLength)
+{
+    if (pathLength == 0)
+    {
+        return;
+    }
+
+    // The path may have an entry per error, all along its probe sequence.
+    uint32_t hash = HashPath(canonicalizedPath, pathLength);
+    for (uint32_t probe = 0; probe < REPORT_CACHE_MAX_PROBES; probe++)
+    {
+        ReportCacheEntry* entry = g_reportCache[(hash + probe) & (REPORT_CACHE_SIZE - 1)];
+        if (entry == nullptr)
+        {
+            break;
+        }
+
+        if (EntryMatches(entry, hash, canonicalizedPath, pathLength))
+        {
+            InterlockedExchange(&entry->Access, 0);
+        }
+    }
+
+    if (g_sharedReportCache == nullptr)
+    {
+        return;
+    }
+
+    // The path is gone for the other processes of the pip as well. Slots of other paths with the same tag, or whose tag is
+    // not written yet, are reset too: that only costs a report that could have been dropped.
+    uint64_t sharedHash = HashPathForSharedCache(canonicalizedPath, pathLength);
+    LONG tag = GetSharedReportCachePathTag(sharedHash);
+    for (uint32_t probe = 0; probe < REPORT_CACHE_MAX_PROBES; probe++)
+    {
+        SharedReportCacheSlot* slot = &g_sharedReportCache[(sharedHash + probe) & (SHARED_REPORT_CACHE_SIZE - 1)];
+        if (slot->Key == 0)
+        {
+            return;
+        }
+
+        LONG slotTag = slot->PathTag;
+        if (slotTag == tag || slotTag == 0)
+        {
+            InterlockedExchange(&slot->Access, 0);
+        }
+    }
+}
+
+bool CheckAndUpdateReportCache(_In_reads_(pathLength) PCWSTR canonicalizedPath, size_t pathLength, RequestedAccess requestedAccess, DWORD error)
+{
+    if (pathLength == 0 || requestedAccess == RequestedAccess::None)
+    {
+        return false;
+    }
+
+    ReportCacheEntry* entry = FindOrAddEntry(canonicalizedPath, pathLength, error);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    // It's a cache hit if all the requested accesses have been seen before (directly or by implication).
+    LONG access = (LONG)requestedAccess;
+    LONG impliedAccess = (LONG)Implies(requestedAccess);
+    LONG previous = InterlockedOr(&entry->Access, access | impliedAccess);
+    if ((previous & access) == access)
+    {
+        IncrementFeatureCounter(FeatureCounter::ReportsDeduplicated);
+        return true;
+    }
+
+    if (g_sharedReportCache != nullptr && CheckAndUpdateSharedReportCache(canonicalizedPath, pathLength, error, access, impliedAccess))
+    {
+        IncrementFeatureCounter(FeatureCounter::SharedReportsDeduplicated);
+        return true;
+    }
+
+    return false;
+}
+
+bool CheckAndUpdateEnumerationReportCache(_In_reads_(pathLength) PCWSTR canonicalizedPath, size_t pathLength, PCWSTR filter, DWORD error)
+{
+    if (pathLength == 0)
+    {
+        return false;
+    }
+
+    InternedFilter const* internedFilter = InternFilter(filter != nullptr ? filter : L"");
+    if (internedFilter == nullptr)
+    {
+        return false;
+    }
+
+    uint32_t hash = HashPath(canonicalizedPath, pathLength) ^ (internedFilter->Hash * 31);
+    EnumerationReportCacheEntry* newEntry = nullptr;
+
+    for (uint32_t probe = 0; probe < REPORT_CACHE_MAX_PROBES; probe++)
+    {
+        EnumerationReportCacheEntry* volatile* slot = &g_enumerationReportCache[(hash + probe) & (ENUMERATION_REPORT_CACHE_SIZE - 1)];
+        EnumerationReportCacheEntry* entry = *slot;
+
+        if (entry == nullptr)
+        {
+            if (newEntry == nullptr)
+            {
+                newEntry = reinterpret_cast<EnumerationReportCacheEntry*>(new char[sizeof(EnumerationReportCacheEntry) + sizeof(wchar_t) * pathLength]);
+                newEntry->Hash = hash;
+                newEntry->Error = error;
+                newEntry->Filter = internedFilter;
+                newEntry->PathLength = pathLength;
+                wmemcpy(newEntry->Path, canonicalizedPath, pathLength);
+            }
+
+            entry = reinterpret_cast<EnumerationReportCacheEntry*>(InterlockedCompareExchangePointer((PVOID volatile*)slot, newEntry, nullptr));
+            if (entry == nullptr)
+            {
+                // First report of this enumeration.
+                return false;
+            }
+
+            // Another thread claimed the slot first; it may have done so for the same enumeration.
+        }
+
+        if (entry->Hash == hash
+            && entry->Error == error
+            && entry->Filter == internedFilter
+            && entry->PathLength == pathLength
+            && _wcsnicmp(entry->Path, canonicalizedPath, pathLength) == 0)
+        {
+            if (newEntry != nullptr)
+            {
+                delete[] reinterpret_cast<char*>(newEntry);
+            }
+
+            return true;
+        }
+    }
+
+    if (newEntry != nullptr)
+    {
+        delete[] reinterpret_cast<char*>(newEntry);
+    }
+
+    return false;
+}
@@ -0,0 +1,57 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Per-process cache of already reported file accesses.
+//
+// With FileAccessManifestExtraFlag::DeduplicateReports, a report is dropped when the same process has already reported
+// an access to the same canonicalized path, with the same error, that implies it. Implication follows the same lattice as
+// the macOS sandbox (see CacheRecord.cpp): Write implies Read, Read implies Probe, and Probe implies Lookup.
+// The error is part of the key because BuildXL infers from it whether the path existed: a read of a path that was absent
+// does not make a later read of the same path, once it exists (e.g. after a rename of its parent), redundant.
+//
+// The cache is a fixed-size open-addressing table. Entries are published with a single compare-exchange and are never
+// removed, and the accesses seen for an entry only ever grow (until the path is deleted or renamed, which resets them),
+// so lookups and updates need no lock. When the table is full, reports are simply no longer deduplicated.
+//
+// With FileAccessManifestExtraFlag::CoalesceOutputWrites (and without DeduplicateReports), only writes go through the
+// cache, so that tools opening the same output for write over and over (log appenders, incremental linkers, writers of
+// dependency files) report it once.
+//
+// With FileAccessManifestExtraFlag::ShareReportCacheAcrossProcesses as well, a report that misses the per-process cache
+// is also looked up in a table shared by all the detoured processes of the pip, so that e.g. the SDK headers read by
+// hundreds of compiler instances are only reported by the first one to read them. That report still carries the id of
+// its process, so the process that made the first access stays known. The first detoured process creates the table in
+// a pagefile-backed section, and DetouredProcessInjector hands the section on to the processes it injects. The shared
+// table only keeps 64-bit hashes of the paths and errors (cross-process pointers to the paths would be useless), and
+// follows the same publication scheme as the per-process one.
+//
+// Enumerations are deduplicated per process as well, on the pair of the enumerated directory and the filter, so that
+// e.g. the same wildcard search repeated over FindFirstFileEx/FindClose cycles is only reported once. The filters are
+// interned, as the same few of them ("*", "*.cs", ...) come back for most directories.
+
+#pragma once
+
+#include "DataTypes.h"
+#include "FileAccessHelpers.h"
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Maps the shared report cache received from the parent process, or creates it if there is none.
+/// Does nothing unless the manifest asks for it. Must be called once the manifest is parsed.
+void InitializeSharedReportCache();
+
+/// Records that the given access to the canonicalized path, which ended with the given error, is about to be reported.
+/// Returns true if an earlier report from this process (or, with a shared cache, any process of the pip) with the same
+/// error already implies it, in which case the report can be dropped.
+bool CheckAndUpdateReportCache(_In_reads_(pathLength) PCWSTR canonicalizedPath, size_t pathLength, RequestedAccess requestedAccess, DWORD error);
+
+/// Forgets the accesses seen for the canonicalized path (whatever their error), which has been deleted or renamed, so that
+/// the next accesses to the path (e.g., writing it anew) are reported again.
+void InvalidateReportCache(_In_reads_(pathLength) PCWSTR canonicalizedPath, size_t pathLength);
+
+/// Records that an enumeration of the canonicalized directory with the given filter, which ended with the given error, is
+/// about to be reported. Returns true if this process already reported the same enumeration with the same error, in which
+/// case the report can be dropped.
+bool CheckAndUpdateEnumerationReportCache(_In_reads_(pathLength) PCWSTR canonicalizedPath, size_t pathLength, PCWSTR filter, DWORD error);
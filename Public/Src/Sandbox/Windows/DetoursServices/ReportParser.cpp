@@ -0,0 +1,413 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "ReportParser.h"
+
+// Lines are scanned for their terminator and their separators 8 characters at a time.
+#if defined(_M_X64) || defined(_M_IX86)
+#define REPORT_PARSER_SIMD 1
+#include <intrin.h>
+#include <emmintrin.h>
+#else
+#define REPORT_PARSER_SIMD 0
+#endif
+
+// Number of '|'-separated fields of a file access line before its path (see ReportFileAccess in SendReport.cpp):
+// process id, requested access, status, explicitly reported, error, USN, desired access, share mode, creation disposition,
+// flags and attributes, and path id.
+#define FILE_ACCESS_LINE_NUMERIC_FIELDS 11
+
+// The path and the filter follow the numeric fields, and the command line (which may contain '|' itself), if any, comes last.
+#define FILE_ACCESS_LINE_MAX_SEPARATORS (FILE_ACCESS_LINE_NUMERIC_FIELDS + 2)
+
+enum class ParseStatus
+{
+    Parsed,
+    Incomplete,
+    Full,
+    Malformed,
+};
+
+// The string arena passed to ParseReports.
+struct ReportArena
+{
+    wchar_t* Data;
+    size_t Capacity;
+    size_t Length;
+
+    bool Append(wchar_t const* string, size_t length, uint32_t& offset, uint32_t& appendedLength)
+    {
+        if (length > Capacity - Length || Length + length > UINT32_MAX)
+        {
+            return false;
+        }
+
+        memcpy(Data + Length, string, length * sizeof(wchar_t));
+        offset = static_cast<uint32_t>(Length);
+        appendedLength = static_cast<uint32_t>(length);
+        Length += length;
+        return true;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+// ----------------------------------------------------------------------------
+
+// Returns the position of the first 'c' in 'string', or 'length' if there is none.
+static size_t FindChar(wchar_t const* string, size_t length, wchar_t c)
+{
+    size_t i = 0;
+
+#if REPORT_PARSER_SIMD
+    __m128i const needle = _mm_set1_epi16(static_cast<short>(c));
+    for (; i + 8 <= length; i += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(string + i));
+
+        // Two bits per character.
+        unsigned long mask = (unsigned long)_mm_movemask_epi8(_mm_cmpeq_epi16(v, needle));
+        if (mask != 0)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return i + bit / 2;
+        }
+    }
+#endif
+
+    for (; i < length; i++)
+    {
+        if (string[i] == c)
+        {
+            return i;
+        }
+    }
+
+    return length;
+}
+
+// Stores the positions of the first (up to) 'maxCount' occurrences of 'c' in 'string' to 'positions', and returns their number.
+static size_t FindAll(wchar_t const* string, size_t length, wchar_t c, size_t* positions, size_t maxCount)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+#if REPORT_PARSER_SIMD
+    __m128i const needle = _mm_set1_epi16(static_cast<short>(c));
+    for (; i + 8 <= length && count < maxCount; i += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(string + i));
+        unsigned long mask = (unsigned long)_mm_movemask_epi8(_mm_cmpeq_epi16(v, needle));
+        while (mask != 0 && count < maxCount)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            positions[count++] = i + bit / 2;
+            mask &= ~(3ul << bit);
+        }
+    }
+#endif
+
+    for (; i < length && count < maxCount; i++)
+    {
+        if (string[i] == c)
+        {
+            positions[count++] = i;
+        }
+    }
+
+    return count;
+}
+
+static bool ParseHex(wchar_t const* string, size_t length, uint64_t& value)
+{
+    if (length == 0 || length > 16)
+    {
+        return false;
+    }
+
+    value = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        wchar_t c = string[i];
+        uint64_t digit =
+            (c >= L'0' && c <= L'9') ? (uint64_t)(c - L'0') :
+            (c >= L'a' && c <= L'f') ? (uint64_t)(c - L'a' + 10) :
+            (c >= L'A' && c <= L'F') ? (uint64_t)(c - L'A' + 10) :
+            16;
+        if (digit == 16)
+        {
+            return false;
+        }
+
+        value = (value << 4) | digit;
+    }
+
+    return true;
+}
+
+static bool ParseHex32(wchar_t const* string, size_t length, uint32_t& value)
+{
+    uint64_t value64;
+    if (!ParseHex(string, length, value64) || value64 > UINT32_MAX)
+    {
+        return false;
+    }
+
+    value = static_cast<uint32_t>(value64);
+    return true;
+}
+
+// Decodes the fields of a file access line (see ReportFileAccess in SendReport.cpp) that follow its "<type>,".
+static ParseStatus ParseFileAccessLine(wchar_t const* line, size_t length, ParsedReport& report, ReportArena& arena)
+{
+    size_t operationLength = FindChar(line, length, L':');
+    if (operationLength == length)
+    {
+        return ParseStatus::Malformed;
+    }
+
+    wchar_t const* fields = line + operationLength + 1;
+    size_t fieldsLength = length - operationLength - 1;
+
+    size_t separators[FILE_ACCESS_LINE_MAX_SEPARATORS];
+    size_t separatorCount = FindAll(fields, fieldsLength, L'|', separators, FILE_ACCESS_LINE_MAX_SEPARATORS);
+    if (separatorCount < FILE_ACCESS_LINE_MAX_SEPARATORS - 1)
+    {
+        return ParseStatus::Malformed;
+    }
+
+    // Start and end of the i-th field.
+    auto start = [&](size_t i) { return i == 0 ? 0 : separators[i - 1] + 1; };
+    auto end = [&](size_t i) { return i < separatorCount ? separators[i] : fieldsLength; };
+
+    uint32_t* const numericFields[] =
+    {
+        &report.ProcessId, &report.RequestedAccess, &report.Status, &report.ExplicitlyReported, &report.Error, nullptr,
+        &report.DesiredAccess, &report.ShareMode, &report.CreationDisposition, &report.FlagsAndAttributes, &report.PathId,
+    };
+
+    static_assert(ARRAYSIZE(numericFields) == FILE_ACCESS_LINE_NUMERIC_FIELDS, "every numeric field must be decoded");
+
+    for (size_t i = 0; i < FILE_ACCESS_LINE_NUMERIC_FIELDS; i++)
+    {
+        bool parsed = numericFields[i] != nullptr
+            ? ParseHex32(fields + start(i), end(i) - start(i), *numericFields[i])
+            : ParseHex(fields + start(i), end(i) - start(i), report.Usn);
+        if (!parsed)
+        {
+            return ParseStatus::Malformed;
+        }
+    }
+
+    size_t path = FILE_ACCESS_LINE_NUMERIC_FIELDS;
+    size_t filter = path + 1;
+    size_t commandLine = filter + 1;
+
+    bool appended =
+        arena.Append(line, operationLength, report.OperationOffset, report.OperationLength) &&
+        arena.Append(fields + start(path), end(path) - start(path), report.PathOffset, report.PathLength) &&
+        arena.Append(fields + start(filter), end(filter) - start(filter), report.FilterOffset, report.FilterLength) &&
+        (separatorCount < FILE_ACCESS_LINE_MAX_SEPARATORS ||
+            arena.Append(fields + start(commandLine), fieldsLength - start(commandLine), report.CommandLineOffset, report.CommandLineLength));
+
+    return appended ? ParseStatus::Parsed : ParseStatus::Full;
+}
+
+// Decodes the line at the start of 'text', if it is complete, and sets 'consumed' to its length (in characters) if so.
+static ParseStatus ParseLine(wchar_t const* text, size_t length, ParsedReport& report, ReportArena& arena, size_t& consumed)
+{
+    size_t lineLength = FindChar(text, length, L'\n');
+    if (lineLength == length)
+    {
+        return ParseStatus::Incomplete;
+    }
+
+    consumed = lineLength + 1;
+    if (lineLength > 0 && text[lineLength - 1] == L'\r')
+    {
+        lineLength--;
+    }
+
+    size_t typeLength = FindChar(text, lineLength, L',');
+    uint32_t type = 0;
+    for (size_t i = 0; i < typeLength; i++)
+    {
+        if (text[i] < L'0' || text[i] > L'9' || type > ReportType_Max)
+        {
+            return ParseStatus::Malformed;
+        }
+
+        type = type * 10 + (text[i] - L'0');
+    }
+
+    if (typeLength == 0 || typeLength == lineLength || type <= ReportType_None || type >= ReportType_Max)
+    {
+        return ParseStatus::Malformed;
+    }
+
+    report.Type = type;
+    if (type == ReportType_FileAccess)
+    {
+        return ParseFileAccessLine(text + typeLength + 1, lineLength - typeLength - 1, report, arena);
+    }
+
+    return arena.Append(text, lineLength, report.TextOffset, report.TextLength) ? ParseStatus::Parsed : ParseStatus::Full;
+}
+
+// Decodes the record at the start of 'buffer', if it is complete, and sets 'consumed' to its size if so.
+static ParseStatus ParseRecord(BYTE const* buffer, size_t size, ParsedReport& report, ReportArena& arena, size_t& consumed)
+{
+    ReportRecordHeader header;
+    if (size < sizeof(header))
+    {
+        return ParseStatus::Incomplete;
+    }
+
+    memcpy(&header, buffer, sizeof(header));
+    if (header.Size < sizeof(header) || header.Version != REPORT_RECORD_VERSION || header.Type <= ReportType_None || header.Type >= ReportType_Max)
+    {
+        return ParseStatus::Malformed;
+    }
+
+    if (header.Size > size)
+    {
+        return ParseStatus::Incomplete;
+    }
+
+    consumed = header.Size;
+    report.Type = header.Type;
+    report.Sequence = header.Sequence;
+
+    if (header.Type == ReportType_ProcessDetouringStatus)
+    {
+        // The managed side decodes these records itself; they are rare.
+        return ParseStatus::Parsed;
+    }
+
+    if (header.Type != ReportType_FileAccess)
+    {
+        wchar_t const* text = reinterpret_cast<wchar_t const*>(buffer + sizeof(header));
+        size_t textLength = (header.Size - sizeof(header)) / sizeof(wchar_t);
+        while (textLength > 0 && (text[textLength - 1] == L'\r' || text[textLength - 1] == L'\n'))
+        {
+            textLength--;
+        }
+
+        return arena.Append(text, textLength, report.TextOffset, report.TextLength) ? ParseStatus::Parsed : ParseStatus::Full;
+    }
+
+    FileAccessReportRecord record;
+    if (header.Size < sizeof(record))
+    {
+        return ParseStatus::Malformed;
+    }
+
+    memcpy(&record, buffer, sizeof(record));
+    uint64_t stringsLength = (uint64_t)record.OperationLength + record.PathLength + record.FilterLength + record.CommandLineLength;
+    if (sizeof(record) + stringsLength * sizeof(wchar_t) != header.Size)
+    {
+        return ParseStatus::Malformed;
+    }
+
+    report.ProcessId = record.ProcessId;
+    report.RequestedAccess = record.RequestedAccess;
+    report.Status = record.Status;
+    report.ExplicitlyReported = record.ExplicitlyReported;
+    report.Error = record.Error;
+    report.DesiredAccess = record.DesiredAccess;
+    report.ShareMode = record.ShareMode;
+    report.CreationDisposition = record.CreationDisposition;
+    report.FlagsAndAttributes = record.FlagsAndAttributes;
+    report.PathId = record.PathId;
+    report.Usn = record.Usn;
+    report.LocalPathId = record.LocalPathId;
+    report.PathFlags = record.PathFlags;
+    report.VolumeSerialNumber = record.VolumeSerialNumber;
+    report.FileIdLow = record.FileIdLow;
+    report.FileIdHigh = record.FileIdHigh;
+
+    wchar_t const* strings = reinterpret_cast<wchar_t const*>(buffer + sizeof(record));
+    wchar_t const* path = strings + record.OperationLength;
+    wchar_t const* filter = path + record.PathLength;
+    wchar_t const* commandLine = filter + record.FilterLength;
+
+    bool appended =
+        arena.Append(strings, record.OperationLength, report.OperationOffset, report.OperationLength) &&
+        arena.Append(path, record.PathLength, report.PathOffset, report.PathLength) &&
+        arena.Append(filter, record.FilterLength, report.FilterOffset, report.FilterLength) &&
+        arena.Append(commandLine, record.CommandLineLength, report.CommandLineOffset, report.CommandLineLength);
+
+    return appended ? ParseStatus::Parsed : ParseStatus::Full;
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+#ifdef BUILDXL_NATIVES_LIBRARY
+BOOL WINAPI ParseReports(
+    __in_bcount(bufferSize)         BYTE const* buffer,
+    __in                            size_t bufferSize,
+    __in                            BOOL binary,
+    __out_ecount(reportCapacity)    ParsedReport* reports,
+    __in                            size_t reportCapacity,
+    __out                           size_t* reportCount,
+    __out_ecount(arenaCapacity)     wchar_t* arena,
+    __in                            size_t arenaCapacity,
+    __out                           size_t* arenaLength,
+    __out                           size_t* bytesConsumed)
+{
+    *reportCount = 0;
+    *arenaLength = 0;
+    *bytesConsumed = 0;
+
+    if (buffer == nullptr || reports == nullptr || arena == nullptr)
+    {
+        return false;
+    }
+
+    ReportArena reportArena = { arena, arenaCapacity, 0 };
+    size_t offset = 0;
+
+    while (*reportCount < reportCapacity)
+    {
+        ParsedReport& report = reports[*reportCount];
+        ZeroMemory(&report, sizeof(report));
+
+        size_t arenaLengthBefore = reportArena.Length;
+        size_t consumed = 0;
+        ParseStatus status = binary
+            ? ParseRecord(buffer + offset, bufferSize - offset, report, reportArena, consumed)
+            : ParseLine(reinterpret_cast<wchar_t const*>(buffer + offset), (bufferSize - offset) / sizeof(wchar_t), report, reportArena, consumed);
+
+        if (status != ParseStatus::Parsed)
+        {
+            // The strings of a report that did not make it must not be left behind in the arena.
+            reportArena.Length = arenaLengthBefore;
+            if (status == ParseStatus::Malformed)
+            {
+                *arenaLength = reportArena.Length;
+                *bytesConsumed = offset;
+                return false;
+            }
+
+            break;
+        }
+
+        size_t consumedBytes = binary ? consumed : consumed * sizeof(wchar_t);
+        report.RecordOffset = offset;
+        report.RecordSize = static_cast<uint32_t>(consumedBytes);
+
+        offset += consumedBytes;
+        (*reportCount)++;
+    }
+
+    *arenaLength = reportArena.Length;
+    *bytesConsumed = offset;
+    return true;
+}
+#endif // BUILDXL_NATIVES_LIBRARY
@@ -0,0 +1,78 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "DataTypes.h"
+
+// ----------------------------------------------------------------------------
+// Decoding of the reports Detours writes to the report pipe, for the managed side (see ParseReports).
+// ----------------------------------------------------------------------------
+
+// A decoded report.
+//
+// File access reports are decoded field by field, with their strings copied to the string arena passed to ParseReports.
+// For any other report only Type is decoded: Text then names its text line (without the trailing "\r\n", ready for
+// ReportLineReceived) in the arena. Binary records that do not carry a text line (process detouring statuses) have no Text;
+// they can be found in the input buffer with RecordOffset and RecordSize (in bytes), which every report has.
+//
+// Strings are referred to by offset and length in UTF-16 code units into the arena, and are not null-terminated.
+// Fields that only binary records carry (Sequence, LocalPathId, PathFlags and the file identity) are 0 for text lines.
+//
+// Keep this in sync with the C# version declared in ProcessUtilities.Win.cs
+typedef struct ParsedReport_t
+{
+    uint32_t    Type;
+    uint32_t    ProcessId;
+    uint32_t    RequestedAccess;
+    uint32_t    Status;
+    uint32_t    ExplicitlyReported;
+    uint32_t    Error;
+    uint32_t    DesiredAccess;
+    uint32_t    ShareMode;
+    uint32_t    CreationDisposition;
+    uint32_t    FlagsAndAttributes;
+    uint32_t    PathId;
+    uint32_t    LocalPathId;
+    uint32_t    PathFlags;
+    uint32_t    RecordSize;
+    uint64_t    RecordOffset;
+    uint64_t    Usn;
+    uint64_t    Sequence;
+    uint64_t    VolumeSerialNumber;
+    uint64_t    FileIdLow;
+    uint64_t    FileIdHigh;
+
+    uint32_t    OperationOffset;
+    uint32_t    OperationLength;
+    uint32_t    PathOffset;
+    uint32_t    PathLength;
+    uint32_t    FilterOffset;
+    uint32_t    FilterLength;
+    uint32_t    CommandLineOffset;
+    uint32_t    CommandLineLength;
+    uint32_t    TextOffset;
+    uint32_t    TextLength;
+} ParsedReport;
+
+static_assert(sizeof(ParsedReport) == 144, "ParsedReport layout is shared with the managed side");
+
+// Decodes the complete reports at the start of 'buffer' (bytes read from the report pipe): "\r\n"-terminated UTF-16 lines
+// or, if 'binary' is set (FileAccessManifestExtraFlag::UseBinaryReportFormat), records framed by a ReportRecordHeader.
+//
+// Stops at the first incomplete report, or as soon as 'reports' or 'arena' is full. '*bytesConsumed' tells where the next
+// call should resume: the caller keeps the remaining bytes and appends the next read to them. If a complete report is left
+// but nothing was decoded, the strings of that report do not fit into the arena.
+//
+// Returns false if the report at '*bytesConsumed' is malformed; the reports before it are decoded nonetheless.
+BOOL WINAPI ParseReports(
+    __in_bcount(bufferSize)         BYTE const* buffer,
+    __in                            size_t bufferSize,
+    __in                            BOOL binary,
+    __out_ecount(reportCapacity)    ParsedReport* reports,
+    __in                            size_t reportCapacity,
+    __out                           size_t* reportCount,
+    __out_ecount(arenaCapacity)     wchar_t* arena,
+    __in                            size_t arenaCapacity,
+    __out                           size_t* arenaLength,
+    __out                           size_t* bytesConsumed);
@@ -0,0 +1,205 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <algorithm>
+
+#include "DebuggingHelpers.h"
+#include "FileAccessHelpers.h"
+#include "ReportRing.h"
+#include "buildXL_mem.h"
+
+// How many times a producer retries reserving space in a full ring before falling back to the report file.
+#define REPORT_RING_FULL_RETRY_COUNT 64
+
+// Records larger than this fraction of the ring go to the report file directly, so that a single record
+// cannot starve the ring.
+#define REPORT_RING_MAX_RECORD_FRACTION 4
+
+// Longest time a process that falls back to the report file waits for the consumer to drain what it wrote to the ring.
+#define REPORT_RING_DRAIN_WAIT_MS 5000
+
+static ReportRingHeader* g_reportRing = nullptr;
+static char* g_reportRingData = nullptr;
+
+// Set once a report of this process did not go to the ring; all later ones go to the report file then.
+static volatile LONG g_reportRingAbandoned = 0;
+
+// End of the last slot this process reserved, which the consumer has to get past before the process writes to the report file.
+static volatile LONG64 g_reportRingReservedEnd = 0;
+
+static inline LONG64 AlignSlotSize(size_t size)
+{
+    return (LONG64)((size + REPORT_RING_SLOT_ALIGNMENT - 1) & ~((size_t)REPORT_RING_SLOT_ALIGNMENT - 1));
+}
+
+void InitializeReportRing()
+{
+    if (!UseReportRingBuffer() || g_internalDetoursErrorNotificationFile == nullptr)
+    {
+        return;
+    }
+
+    // Object names don't allow '\\'; use the same derivation as for the message count semaphore.
+    std::wstring name(g_internalDetoursErrorNotificationFile);
+    std::replace(name.begin(), name.end(), L'\\', L'_');
+    name.append(REPORT_RING_NAME_SUFFIX);
+
+    // NOTE: This calls the real OpenFileMappingW(), because the detoured functions have not been installed yet.
+    HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name.c_str());
+    if (hMapping == NULL)
+    {
+        Dbg(L"Warning: Could not open the report ring '%s'. Last Error: %d. Reports go to the report file.", name.c_str(), (int)GetLastError());
+        return;
+    }
+
+    ReportRingHeader* ring = reinterpret_cast<ReportRingHeader*>(MapViewOfFile(hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0));
+
+    // The view keeps the section alive.
+    CloseHandle(hMapping);
+
+    if (ring == nullptr)
+    {
+        Dbg(L"Warning: Could not map the report ring '%s'. Last Error: %d. Reports go to the report file.", name.c_str(), (int)GetLastError());
+        return;
+    }
+
+    if (ring->Magic != REPORT_RING_MAGIC
+        || ring->Version != REPORT_RING_VERSION
+        || ring->Capacity == 0
+        || ring->Capacity > REPORT_RING_SKIP_SLOT
+        || (ring->Capacity & (ring->Capacity - 1)) != 0)
+    {
+        Dbg(L"Warning: The report ring '%s' has an unexpected header. Reports go to the report file.", name.c_str());
+        UnmapViewOfFile(ring);
+        return;
+    }
+
+    g_reportRingData = reinterpret_cast<char*>(ring) + sizeof(ReportRingHeader);
+    g_reportRing = ring;
+}
+
+/// <summary>
+/// Makes all later reports of this process go to the report file, after the consumer drained the ones it wrote to the ring, so that
+/// they keep their order.
+/// </summary>
+static void AbandonReportRing(ReportRingHeader* ring)
+{
+    if (InterlockedExchange(&g_reportRingAbandoned, 1) != 0)
+    {
+        return;
+    }
+
+    LONG64 reservedEnd = g_reportRingReservedEnd;
+    ULONGLONG start = GetTickCount64();
+    while (ring->ReadOffset < reservedEnd && GetTickCount64() - start < REPORT_RING_DRAIN_WAIT_MS)
+    {
+        Sleep(1);
+    }
+
+    if (ring->ReadOffset < reservedEnd)
+    {
+        Dbg(L"Warning: The report ring was not drained in time. Reports of this process may reach BuildXL out of order.");
+    }
+}
+
+/// <summary>
+/// Raises g_reportRingReservedEnd to the end of a slot this process reserved.
+/// </summary>
+static void UpdateReservedEnd(LONG64 end)
+{
+    LONG64 current = g_reportRingReservedEnd;
+    while (current < end)
+    {
+        LONG64 previous = InterlockedCompareExchange64(&g_reportRingReservedEnd, end, current);
+        if (previous == current)
+        {
+            break;
+        }
+
+        current = previous;
+    }
+}
+
+bool TryWriteReportRing(_In_reads_bytes_(size) void const* data, size_t size)
+{
+    ReportRingHeader* ring = g_reportRing;
+    if (ring == nullptr || g_reportRingAbandoned != 0)
+    {
+        return false;
+    }
+
+    LONG64 capacity = (LONG64)ring->Capacity;
+    LONG64 slotSize = AlignSlotSize(sizeof(ReportRingSlot) + size);
+
+    if (slotSize > capacity / REPORT_RING_MAX_RECORD_FRACTION)
+    {
+        AbandonReportRing(ring);
+        return false;
+    }
+
+    LONG64 reserve = 0;
+    LONG64 needed = 0;
+    LONG64 contiguous = 0;
+    bool reserved = false;
+
+    for (int attempt = 0; attempt < REPORT_RING_FULL_RETRY_COUNT && !reserved; attempt++)
+    {
+        reserve = ring->ReserveOffset;
+        contiguous = capacity - (reserve & (capacity - 1));
+
+        // A slot never wraps around; pad to the end of the data area first if it would.
+        needed = slotSize <= contiguous ? slotSize : contiguous + slotSize;
+
+        if (reserve + needed - ring->ReadOffset > capacity)
+        {
+            // Full. Give the consumer a chance to catch up.
+            if (attempt < REPORT_RING_FULL_RETRY_COUNT / 2)
+            {
+                YieldProcessor();
+            }
+            else
+            {
+                Sleep(0);
+            }
+
+            continue;
+        }
+
+        reserved = InterlockedCompareExchange64(&ring->ReserveOffset, reserve + needed, reserve) == reserve;
+    }
+
+    if (!reserved)
+    {
+        AbandonReportRing(ring);
+        return false;
+    }
+
+    UpdateReservedEnd(reserve + needed);
+
+    LONG64 position = reserve & (capacity - 1);
+
+    if (needed != slotSize)
+    {
+        ReportRingSlot* skip = reinterpret_cast<ReportRingSlot*>(g_reportRingData + position);
+        InterlockedExchange(&skip->SlotSize, (LONG)contiguous);
+        InterlockedExchange(&skip->Length, (LONG)(REPORT_RING_SKIP_SLOT | (ULONG)contiguous));
+        position = 0;
+    }
+
+    // The size lets the consumer skip the slot if this process gets killed before committing it.
+    ReportRingSlot* slot = reinterpret_cast<ReportRingSlot*>(g_reportRingData + position);
+    InterlockedExchange(&slot->SlotSize, (LONG)slotSize);
+    memcpy(g_reportRingData + position + sizeof(ReportRingSlot), data, size);
+
+    // Publishing the length commits the slot; the interlocked write is a full barrier, so the payload is visible first.
+    // The consumer skipped the slot if it took too long to get here, in which case the report goes to the report file.
+    if (InterlockedCompareExchange(&slot->Length, (LONG)size, 0) != 0)
+    {
+        AbandonReportRing(ring);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,76 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Shared-memory transport for reports.
+//
+// The parent (BuildXL) creates a named file mapping holding a ReportRingHeader followed by a data area whose size
+// is a power of two. Every detoured process of the pip opens the same mapping (its name is derived from the payload,
+// the same way the message count semaphore name is) and appends the bytes it would otherwise have written to the
+// report file. Producers reserve space with interlocked operations on ReserveOffset; the consumer drains committed
+// slots in order and advances ReadOffset. Offsets grow monotonically and are reduced modulo the capacity.
+//
+// Each slot starts with a ReportRingSlot. A zero length means the slot has been reserved but not yet committed, which
+// stops the consumer. A length with REPORT_RING_SKIP_SLOT set marks padding up to the end of the data area, used when a
+// record would otherwise wrap around. The consumer zeroes the bytes it consumes before it advances ReadOffset.
+//
+// A producer writes the size of its slot to SlotSize right after reserving it, and commits it by swapping the length
+// from 0. A slot left uncommitted for long (its producer was killed between the two) is skipped by the consumer, which
+// swaps its length from 0 to REPORT_RING_SKIP_SLOT | SlotSize; a producer that loses that race reports through the pipe.
+// A producer killed before writing SlotSize leaves no way to find the slot after its own, so the consumer stops there until
+// no producer is left, and then skips everything up to ReserveOffset (reporting the loss).
+//
+// A process only ever writes its reports to one channel at a time: once a report does not go to the ring, the process
+// waits for the consumer to drain what it wrote to the ring, and writes all its later reports to the pipe.
+//
+// IMPORTANT: Keep this in sync with the C# version declared in ReportRingBuffer.cs
+
+#pragma once
+
+#include "DataTypes.h"
+
+#define REPORT_RING_MAGIC           0x474E4952 // "RING"
+#define REPORT_RING_VERSION         2
+#define REPORT_RING_NAME_SUFFIX     L"_ReportRing"
+#define REPORT_RING_SLOT_ALIGNMENT  8
+#define REPORT_RING_SKIP_SLOT       0x80000000
+
+typedef struct ReportRingHeader_t
+{
+    uint32_t        Magic;
+    uint32_t        Version;
+    // Size of the data area in bytes. Always a power of two.
+    uint64_t        Capacity;
+    uint8_t         Padding0[48];
+
+    // Written by producers only.
+    volatile LONG64 ReserveOffset;
+    uint8_t         Padding1[56];
+
+    // Written by the consumer only.
+    volatile LONG64 ReadOffset;
+    uint8_t         Padding2[56];
+} ReportRingHeader;
+
+typedef struct ReportRingSlot_t
+{
+    // Payload length in bytes, or REPORT_RING_SKIP_SLOT | <padding size>, or 0 when not yet committed.
+    volatile LONG   Length;
+    // Size of the slot (header, payload and alignment padding), written once reserved.
+    volatile LONG   SlotSize;
+} ReportRingSlot;
+
+static_assert(sizeof(ReportRingHeader) == 192, "ReportRingHeader layout is shared with the consumer");
+static_assert(sizeof(ReportRingSlot) == REPORT_RING_SLOT_ALIGNMENT, "ReportRingSlot layout is shared with the consumer");
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Opens the report ring shared by the pip when FileAccessManifestExtraFlag::UseReportRingBuffer is set.
+/// Failing to open it is not fatal; reports then keep going to the report file.
+void InitializeReportRing();
+
+/// Appends one chunk of report data to the ring.
+/// Returns false if there is no ring, if it stays full, or if the process already fell back to the report file, in which case
+/// the caller writes to the report file (and so does the process from then on).
+bool TryWriteReportRing(_In_reads_bytes_(size) void const* data, size_t size);
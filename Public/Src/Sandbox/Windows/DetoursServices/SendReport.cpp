@@ -5,13 +5,25 @@
 
 #include <algorithm>
 #include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "DataTypes.h"
 #include "DebuggingHelpers.h"
+#include "DetouredScope.h"
+#include "DetourStatistics.h"
+#include "DetoursEvents.h"
 #include "DetoursHelpers.h"
+#include "FeatureCounters.h"
 #include "FileAccessHelpers.h"
+#include "LiveCounters.h"
+#include "OutputHashing.h"
 #include "SendReport.h"
 #include "PolicyResult.h"
+#include "ReportCache.h"
+#include "ReportRing.h"
 #include "buildXL_mem.h"
 
 using std::unique_ptr;
@@ -19,47 +31,1441 @@ using std::unique_ptr;
 extern volatile LONG g_detoursAllocatedNoLockConcurentPoolEntries;
 extern volatile LONG64 g_detoursMaxHandleHeapEntries;
 extern volatile LONG64 g_detoursHandleHeapEntries;
+extern volatile LONG64 g_detoursHandleOverlayContendedWrites;
+extern volatile LONG64 g_detoursHandleOverlayContendedReads;
+extern volatile LONG64 g_detoursAttachLocateManifestMicroseconds;
+extern volatile LONG64 g_detoursAttachParseManifestMicroseconds;
+extern volatile LONG64 g_detoursAttachHandleOverlayMicroseconds;
+extern volatile LONG64 g_detoursAttachTransactionMicroseconds;
+extern volatile LONG64 g_detoursNtClosePoolExhaustions;
+extern volatile LONG64 g_detoursNtClosePoolRefills;
+extern volatile LONG64 g_detoursCanonicalizations;
+extern volatile LONG64 g_detoursFastCanonicalizations;
+extern volatile LONG64 g_detoursInjectedProcesses;
+extern volatile LONG64 g_detoursInjectionImagesFromPeb;
+extern volatile LONG64 g_detoursInjectionFindImageMicroseconds;
+extern volatile LONG64 g_detoursInjectionAllocateMicroseconds;
+extern volatile LONG64 g_detoursInjectionWriteImportsMicroseconds;
+extern volatile LONG64 g_detoursInjectionChecksumMicroseconds;
+extern volatile LONG64 g_detoursAttachCachedPrologues;
+extern volatile LONG64 g_detoursInjectionApplyMappingMicroseconds;
+extern volatile LONG64 g_detoursInjectionInheritedDeviceMaps;
+extern volatile LONG64 g_detoursPolicyResultCacheHits;
+extern volatile LONG64 g_detoursPolicyResultCacheMisses;
+extern volatile LONG64 g_detoursPolicyResultCacheEntries;
+extern volatile LONG64 g_detoursProcessAdmissionWaits;
+extern volatile LONG64 g_detoursProcessAdmissionWaitMicroseconds;
+extern volatile LONG64 g_detoursDirectoryQueriesAvoided;
+extern volatile LONG64 g_detoursFileStatQueries;
+extern volatile LONG64 g_detoursFileStatQueriesSaved;
+
+// ----------------------------------------------------------------------------
+// REPORT SEQUENCE
+// ----------------------------------------------------------------------------
+
+// Appended to the message count semaphore name to form the name of the mapping holding the sequence counter.
+#define REPORT_SEQUENCE_NAME_SUFFIX L"_ReportSequence"
+
+// Counter shared by all the detoured processes of the pip, in a mapping created by the consumer. Null when not sequencing.
+static volatile LONG64* g_reportSequence = nullptr;
+
+// ----------------------------------------------------------------------------
+// ACCESS BITMAP
+// ----------------------------------------------------------------------------
+
+// Appended to the message count semaphore name to form the name of the mapping holding the access bitmaps.
+#define ACCESS_BITMAP_NAME_SUFFIX L"_AccessBitmap"
+
+// Start of the mapping, which the consumer creates before the first detoured process of the pip starts.
+// The header is followed by the read bitmap and then the probe bitmap, each of BitCount bits rounded up to whole 64-bit words.
+// Bit i of a bitmap stands for the manifest node whose path id has the index i (PathId & PathIdIndexMask).
+//
+// IMPORTANT: Keep this in sync with the C# version declared in AccessBitmap.cs
+typedef struct AccessBitmapHeader_t
+{
+    uint32_t BitCount;
+    uint32_t PathIdIndexMask;
+} AccessBitmapHeader;
+
+// Null when the accesses are not recorded in the bitmaps.
+static AccessBitmapHeader const* g_accessBitmapHeader = nullptr;
+static volatile LONG64* g_accessBitmapRead = nullptr;
+static volatile LONG64* g_accessBitmapProbe = nullptr;
+
+// ----------------------------------------------------------------------------
+// REPORT BUFFERING
+// ----------------------------------------------------------------------------
+
+// Size of the per-process report buffer. Reports are written out once this fills up.
+#define REPORT_BUFFER_SIZE (64 * 1024)
+
+// Maximum time a buffered report waits before the background flusher writes it out.
+#define REPORT_BUFFER_FLUSH_INTERVAL_MS 100
+
+// The buffer is shared by all threads of the process so that reports keep the order in which they were produced.
+// g_reportBufferInitialized only changes while the process attaches, before any report is sent. The buffer itself is only read or
+// reset with g_reportBufferLock held, except when the process detaches with the lock left held by a thread that is gone
+// (g_reportBufferLockAbandoned), when no other thread is left to touch it.
+static CRITICAL_SECTION g_reportBufferLock;
+static bool g_reportBufferInitialized = false;
+static bool g_reportBufferLockAbandoned = false;
+static char* g_reportBuffer = nullptr;
+static size_t g_reportBufferUsed = 0;
+static LONG g_reportBufferMessageCount = 0;
+static volatile LONG g_reportBufferFlusherStarted = 0;
+
+// ----------------------------------------------------------------------------
+// REPORT BACKPRESSURE
+// ----------------------------------------------------------------------------
+
+// With FileAccessManifestExtraFlag::AdaptiveReportBackpressure, a write to the report file taking at least this long means
+// that BuildXL lags behind, and allowed accesses get summarized (as with SummarizeFileAccesses) to send fewer reports.
+#define BACKPRESSURE_ENTER_WRITE_MICROSECONDS 20000
+
+// Number of consecutive writes taking at most this long after which reports are sent one by one again.
+#define BACKPRESSURE_LEAVE_WRITE_MICROSECONDS 1000
+#define BACKPRESSURE_LEAVE_FAST_WRITES 32
+
+static volatile LONG g_reportBackpressure = 0;
+static volatile LONG g_fastWritesUnderBackpressure = 0;
+static volatile LONG g_reportBackpressureModeChanges = 0;
+
+// ----------------------------------------------------------------------------
+// REPORT QUEUE
+// ----------------------------------------------------------------------------
+
+// Beyond this many queued reports, the reporting thread formats and sends its report (and everything queued) itself.
+#define MAX_QUEUED_REPORTS 4096
+
+// An allowed file access waiting to be formatted and sent by the report writer thread.
+// Everything the report needs is copied, since the strings of the detoured call do not outlive it.
+// Allocated with new, which is aligned enough for the SLIST_ENTRY (MEMORY_ALLOCATION_ALIGNMENT).
+struct QueuedFileAccessReport
+{
+    SLIST_ENTRY ItemEntry;
+    std::wstring Operation;
+    std::wstring FileName;
+    std::wstring Filter;
+    FileOperationContext Context;
+    FileAccessStatus Status;
+    PolicyResult Policy;
+    AccessCheckResult AccessCheck;
+    DWORD Error;
+    USN Usn;
+
+    QueuedFileAccessReport(
+        FileOperationContext const& fileOperationContext,
+        FileAccessStatus status,
+        PolicyResult const& policyResult,
+        AccessCheckResult const& accessCheckResult,
+        DWORD error,
+        USN usn,
+        PCWSTR fileName,
+        PCWSTR filterStr)
+        : Operation(fileOperationContext.Operation), FileName(fileName), Filter(filterStr),
+        Context(fileOperationContext), Status(status), Policy(policyResult), AccessCheck(accessCheckResult), Error(error), Usn(usn)
+    {
+        Context.Operation = Operation.c_str();
+        Context.NoncanonicalPath = nullptr;
+    }
+};
+
+// Reports are pushed without taking any lock. The list is LIFO, so the writer reverses what it pops.
+// A zeroed SLIST_HEADER is an empty list.
+static SLIST_HEADER g_reportQueue;
+static volatile LONG g_queuedReportCount = 0;
+static volatile bool g_reportQueueEnabled = false;
+static volatile LONG g_reportQueueWriterStarted = 0;
+
+// Set when the queue gets drained from DllProcessDetach. The writer thread may have been terminated while holding the
+// reported path table lock, so paths are no longer interned from then on.
+static volatile bool g_reportQueueDetaching = false;
+
+// Signaled when a report gets pushed to an empty queue.
+static HANDLE g_reportQueueEvent = NULL;
+
+// Held while writing out popped reports so that two drains cannot interleave their reports.
+static CRITICAL_SECTION g_reportQueueDrainLock;
+
+// Popped reports not sent yet, oldest first. Only touched with g_reportQueueDrainLock held, so that what a terminated
+// writer thread did not get to send is still there for DllProcessDetach.
+static PSLIST_ENTRY g_pendingReports = nullptr;
+
+// ----------------------------------------------------------------------------
+// REPORTED PATH INTERNING
+// ----------------------------------------------------------------------------
+
+// Upper bound on the number of interned paths per process. Paths beyond it are always sent in full.
+#define MAX_INTERNED_REPORT_PATHS 65536
+
+// Maps reported paths to their process-local ids. A record defining an id is sent while the lock is held exclusively,
+// so no record using that id can reach the report file ahead of it.
+static SRWLOCK g_reportPathTableLock = SRWLOCK_INIT;
+static std::unordered_map<std::wstring, uint32_t>* g_reportPathTable = nullptr;
+
+// ----------------------------------------------------------------------------
+// ACCESS SUMMARY
+// ----------------------------------------------------------------------------
+
+// Number of slots of the access summary. Must be a power of two.
+#define ACCESS_SUMMARY_SIZE 16384
+
+// How many slots a lookup probes before giving up on summarizing the access, which is then reported on its own.
+#define ACCESS_SUMMARY_MAX_PROBES 32
+
+// Operation of the reports sent for summarized accesses.
+#define ACCESS_SUMMARY_OPERATION L"MultipleOperations"
+
+// Number of summarized paths at which the summary is flushed right away, so that it keeps room for the paths still to come.
+#define ACCESS_SUMMARY_FLUSH_THRESHOLD (ACCESS_SUMMARY_SIZE / 2)
+
+// Maximum time a summarized access waits before the background flusher sends it, so that a process terminated without detaching
+// only loses the accesses of its last moments.
+#define ACCESS_SUMMARY_FLUSH_INTERVAL_MS 1000
+
+// All allowed accesses to a path since the summary was last flushed.
+struct AccessSummaryEntry
+{
+    std::wstring FileName;
+    FileOperationContext Context;
+    PolicyResult Policy;
+    // Requested accesses OR-ed together, explicit if any of them was.
+    AccessCheckResult AccessCheck;
+    DWORD FirstError;
+    DWORD LastError;
+    USN Usn;
+    uint32_t Hash;
+
+    AccessSummaryEntry(
+        FileOperationContext const& fileOperationContext,
+        PolicyResult const& policyResult,
+        AccessCheckResult const& accessCheckResult,
+        DWORD error,
+        USN usn,
+        PCWSTR fileName,
+        uint32_t hash)
+        : FileName(fileName), Context(fileOperationContext), Policy(policyResult), AccessCheck(accessCheckResult),
+        FirstError(error), LastError(error), Usn(usn), Hash(hash)
+    {
+        Context.Operation = ACCESS_SUMMARY_OPERATION;
+        Context.NoncanonicalPath = nullptr;
+    }
+};
+
+// Only held to update an entry in memory, which takes far less than writing the report it replaces.
+static SRWLOCK g_accessSummaryLock = SRWLOCK_INIT;
+static AccessSummaryEntry* g_accessSummary[ACCESS_SUMMARY_SIZE];
+static LONG g_accessSummaryCount = 0;
+static volatile LONG g_accessSummaryFlusherStarted = 0;
+
+// ----------------------------------------------------------------------------
+// PROCESS DETOURING STATUS
+// ----------------------------------------------------------------------------
+
+// Number of child process command lines remembered as already sent in full. Must be a power of two.
+#define REPORTED_COMMAND_LINE_SLOTS 64
+
+// Hashes of child process command lines already sent in full in a status report, by the low bits of the hash.
+// A slot is only ever overwritten, so a command line may be forgotten, in which case it is simply sent in full again.
+static volatile LONG64 g_reportedCommandLineHashes[REPORTED_COMMAND_LINE_SLOTS];
+
+// Reports formatted in memory, to be written out together.
+struct ReportBlob
+{
+    std::vector<char> Bytes;
+    LONG MessageCount = 0;
+};
 
 // ----------------------------------------------------------------------------
 // HELPER FUNCTION DEFINITIONS
 // ----------------------------------------------------------------------------
 
-void SendReportString(_In_z_ wchar_t const* dataString)
+/// <summary>
+/// Takes the sequence number of a report being formatted, or 0 if reports are not sequenced.
+/// </summary>
+static inline uint64_t NextReportSequence()
+{
+    return g_reportSequence != nullptr ? (uint64_t)InterlockedIncrement64(g_reportSequence) : 0;
+}
+
+/// <summary>
+/// Records an access in the read or probe bitmap instead of reporting it, if the bitmaps are in use and say all there is to say about it:
+/// a successful, allowed, explicitly reported read or probe of a path that is a manifest node of its own (without an expected USN).
+/// </summary>
+static bool TryRecordInAccessBitmap(
+    FileOperationContext const& fileOperationContext,
+    FileAccessStatus status,
+    PolicyResult const& policyResult,
+    AccessCheckResult const& accessCheckResult,
+    DWORD error,
+    USN usn)
+{
+    if (g_accessBitmapHeader == nullptr
+        || status != FileAccessStatus_Allowed
+        || error != ERROR_SUCCESS
+        || usn != -1
+        || accessCheckResult.ReportLevel != ReportLevel::ReportExplicit
+        || policyResult.IsIndeterminate()
+        || !policyResult.IsExactManifestMatch()
+        || policyResult.GetExpectedUsn() != -1
+        || _wcsicmp(fileOperationContext.Operation, L"Process") == 0)
+    {
+        return false;
+    }
+
+    volatile LONG64* bitmap;
+    if (accessCheckResult.RequestedAccess == RequestedAccess::Read)
+    {
+        bitmap = g_accessBitmapRead;
+    }
+    else if (accessCheckResult.RequestedAccess == RequestedAccess::Probe)
+    {
+        bitmap = g_accessBitmapProbe;
+    }
+    else
+    {
+        return false;
+    }
+
+    uint32_t index = policyResult.GetPathId() & g_accessBitmapHeader->PathIdIndexMask;
+    if (index == 0 || index >= g_accessBitmapHeader->BitCount)
+    {
+        return false;
+    }
+
+    // Most accesses are repeated; reading first saves the interlocked operation (and the cache line bouncing) for those.
+    volatile LONG64* word = bitmap + (index / 64);
+    LONG64 bit = 1LL << (index % 64);
+    if ((*word & bit) == 0)
+    {
+        InterlockedOr64(word, bit);
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Switches in and out of summarizing allowed accesses depending on how long writing reports takes.
+/// </summary>
+static void UpdateReportBackpressure(ULONG64 writeMicroseconds)
+{
+    if (!AdaptiveReportBackpressure())
+    {
+        return;
+    }
+
+    if (g_reportBackpressure == 0)
+    {
+        if (writeMicroseconds >= BACKPRESSURE_ENTER_WRITE_MICROSECONDS && InterlockedCompareExchange(&g_reportBackpressure, 1, 0) == 0)
+        {
+            g_fastWritesUnderBackpressure = 0;
+            LONG changes = InterlockedIncrement(&g_reportBackpressureModeChanges);
+            Dbg(L"Writing reports took %llu us; summarizing allowed accesses until it speeds up (mode change %d).", writeMicroseconds, (int)changes);
+        }
+
+        return;
+    }
+
+    if (writeMicroseconds > BACKPRESSURE_LEAVE_WRITE_MICROSECONDS)
+    {
+        g_fastWritesUnderBackpressure = 0;
+    }
+    else if (InterlockedIncrement(&g_fastWritesUnderBackpressure) == BACKPRESSURE_LEAVE_FAST_WRITES
+        && InterlockedCompareExchange(&g_reportBackpressure, 0, 1) == 1)
+    {
+        LONG changes = InterlockedIncrement(&g_reportBackpressureModeChanges);
+        Dbg(L"Writing reports sped up; sending allowed accesses one by one again (mode change %d).", (int)changes);
+    }
+}
+
+/// <summary>
+/// Writes one or more complete reports to the report file and accounts for them in the message count semaphore.
+/// </summary>
+static void WriteReportBytes(_In_reads_bytes_(size) void const* data, size_t size, LONG messageCount)
+{
+    // Increment the message sent counter.
+    if (g_messageCount != nullptr)
+    {
+        InterlockedExchangeAdd64(g_messageCount, messageCount);
+    }
+    else if (g_messageCountSemaphore != INVALID_HANDLE_VALUE)
+    {
+        ReleaseSemaphore(g_messageCountSemaphore, messageCount, nullptr);
+    }
+
+    CountReportsWritten(messageCount, size);
+
+    if (TryWriteReportRing(data, size))
+    {
+        if (IsDetoursEventEnabled(DetoursEvent_ReportsWritten))
+        {
+            WriteReportsWrittenEvent(messageCount, size, true);
+        }
+
+        return;
+    }
+
+    OVERLAPPED overlapped;
+    ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+    // This offset specifies "append".
+    overlapped.Offset = 0xFFFFFFFF;
+    overlapped.OffsetHigh = 0xFFFFFFFF;
+
+    DWORD bytesWritten;
+    DWORD lastError = GetLastError();
+    LARGE_INTEGER writeStart;
+    QueryPerformanceCounter(&writeStart);
+    if (!WriteFile(g_reportFileHandle, data, (DWORD)size, &bytesWritten, &overlapped))
+    {
+        DWORD error = GetLastError();
+        Dbg(L"Failed to write file access report line: %08X. Exiting with code %d.", (int)error, DETOURS_PIPE_WRITE_ERROR_4);
+        wprintf(L"Failed to write file access report line: %08X. Exiting with code %d.", (int)error, DETOURS_PIPE_WRITE_ERROR_4);
+        fwprintf(stderr, L"Failed to write file access report line: %08X. Exiting with code %d.", (int)error, DETOURS_PIPE_WRITE_ERROR_4);
+        HandleDetoursInjectionAndCommunicationErrors(DETOURS_PIPE_WRITE_ERROR_4, L"Failure writing message to pipe: exit(-46).", DETOURS_WINDOWS_LOG_MESSAGE_4);
+    }
+
+    UpdateReportBackpressure(MicrosecondsSince(writeStart));
+
+    if (IsDetoursEventEnabled(DetoursEvent_ReportsWritten))
+    {
+        WriteReportsWrittenEvent(messageCount, size, false);
+    }
+
+    SetLastError(lastError);
+}
+
+/// <summary>
+/// Writes out the buffered reports. Must be called with g_reportBufferLock held.
+/// </summary>
+static void FlushReportBufferLocked()
+{
+    if (g_reportBufferUsed == 0)
+    {
+        return;
+    }
+
+    // Reset the buffer before writing so that a failing write that ends up exiting the process
+    // does not try to write the same reports again from DllProcessDetach.
+    size_t size = g_reportBufferUsed;
+    LONG messageCount = g_reportBufferMessageCount;
+    g_reportBufferUsed = 0;
+    g_reportBufferMessageCount = 0;
+
+    WriteReportBytes(g_reportBuffer, size, messageCount);
+}
+
+static DWORD WINAPI ReportBufferFlusher(LPVOID lpParam)
+{
+    UNREFERENCED_PARAMETER(lpParam);
+
+    while (true)
+    {
+        Sleep(REPORT_BUFFER_FLUSH_INTERVAL_MS);
+        FlushReportBuffer(false);
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Starts the background flusher on first use. It is not started from DllProcessAttach to stay clear of the loader lock.
+/// </summary>
+static void EnsureReportBufferFlusherStarted()
+{
+    if (g_reportBufferFlusherStarted != 0 || InterlockedCompareExchange(&g_reportBufferFlusherStarted, 1, 0) != 0)
+    {
+        return;
+    }
+
+    HANDLE threadHandle = CreateThread(NULL, 0, ReportBufferFlusher, nullptr, 0, nullptr);
+
+    if (threadHandle == NULL)
+    {
+        // Reports still get written when the buffer fills up and when the process detaches.
+        Dbg(L"Warning: Could not create the report buffer flusher thread. Last Error: %d", (int)GetLastError());
+    }
+    else
+    {
+        CloseHandle(threadHandle);
+    }
+}
+
+/// <summary>
+/// Writes out the buffered reports right after one that BuildXL should see without delay (a denial or a process start or
+/// status), instead of leaving it in the buffer until that fills up or the flusher comes around. Reports share one ordered
+/// channel, so this is the priority lane on Windows: the urgent report only overtakes the reports still to be written.
+/// </summary>
+static void FlushUrgentReport()
+{
+    if (g_reportBufferInitialized)
+    {
+        FlushReportBuffer(false);
+    }
+}
+
+void InitializeReportSequence()
+{
+    if (!SequenceReports() || !UseBinaryReportFormat() || g_internalDetoursErrorNotificationFile == nullptr)
+    {
+        return;
+    }
+
+    // Object names don't allow '\\'; use the same derivation as for the message count semaphore.
+    std::wstring name(g_internalDetoursErrorNotificationFile);
+    std::replace(name.begin(), name.end(), L'\\', L'_');
+    name.append(REPORT_SEQUENCE_NAME_SUFFIX);
+
+    // NOTE: This calls the real OpenFileMappingW(), because the detoured functions have not been installed yet.
+    HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name.c_str());
+    if (hMapping == NULL)
+    {
+        Dbg(L"Warning: Could not open the report sequence '%s'. Last Error: %d. Reports are not sequenced.", name.c_str(), (int)GetLastError());
+        return;
+    }
+
+    void* view = MapViewOfFile(hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(LONG64));
+
+    // The view keeps the section alive.
+    CloseHandle(hMapping);
+
+    if (view == nullptr)
+    {
+        Dbg(L"Warning: Could not map the report sequence '%s'. Last Error: %d. Reports are not sequenced.", name.c_str(), (int)GetLastError());
+        return;
+    }
+
+    g_reportSequence = reinterpret_cast<volatile LONG64*>(view);
+}
+
+void InitializeAccessBitmap()
+{
+    if (!UseAccessBitmap() || g_internalDetoursErrorNotificationFile == nullptr)
+    {
+        return;
+    }
+
+    // Object names don't allow '\\'; use the same derivation as for the message count semaphore.
+    std::wstring name(g_internalDetoursErrorNotificationFile);
+    std::replace(name.begin(), name.end(), L'\\', L'_');
+    name.append(ACCESS_BITMAP_NAME_SUFFIX);
+
+    // NOTE: This calls the real OpenFileMappingW(), because the detoured functions have not been installed yet.
+    HANDLE hMapping = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name.c_str());
+    if (hMapping == NULL)
+    {
+        Dbg(L"Warning: Could not open the access bitmap '%s'. Last Error: %d. Accesses are reported instead.", name.c_str(), (int)GetLastError());
+        return;
+    }
+
+    void* view = MapViewOfFile(hMapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+
+    // The view keeps the section alive.
+    CloseHandle(hMapping);
+
+    if (view == nullptr)
+    {
+        Dbg(L"Warning: Could not map the access bitmap '%s'. Last Error: %d. Accesses are reported instead.", name.c_str(), (int)GetLastError());
+        return;
+    }
+
+    // Do not trust the header beyond the size of the view.
+    AccessBitmapHeader const* header = reinterpret_cast<AccessBitmapHeader const*>(view);
+    size_t wordCount = ((size_t)header->BitCount + 63) / 64;
+    MEMORY_BASIC_INFORMATION info;
+    if (VirtualQuery(view, &info, sizeof(info)) == 0
+        || info.RegionSize < sizeof(AccessBitmapHeader) + 2 * wordCount * sizeof(LONG64))
+    {
+        Dbg(L"Warning: The access bitmap '%s' is smaller than its header says. Accesses are reported instead.", name.c_str());
+        UnmapViewOfFile(view);
+        return;
+    }
+
+    g_accessBitmapRead = reinterpret_cast<volatile LONG64*>(reinterpret_cast<char*>(view) + sizeof(AccessBitmapHeader));
+    g_accessBitmapProbe = g_accessBitmapRead + wordCount;
+    g_accessBitmapHeader = header;
+}
+
+void InitializeReportBuffer()
+{
+    if (!BufferReports() || g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    InitializeCriticalSection(&g_reportBufferLock);
+    g_reportBuffer = new char[REPORT_BUFFER_SIZE];
+    g_reportBufferInitialized = true;
+}
+
+void FlushReportBuffer(bool processDetach)
+{
+    if (!g_reportBufferInitialized || g_reportBufferLockAbandoned)
+    {
+        return;
+    }
+
+    if (processDetach)
+    {
+        // On process exit all other threads are already gone, and one of them may have been holding the lock.
+        // Writing without it is safe then, since nobody else can touch the buffer anymore; the reports sent while detaching
+        // then skip the lock, which would never be released.
+        // Buffering is turned off afterwards so that reports sent while detaching are written directly.
+        bool acquired = TryEnterCriticalSection(&g_reportBufferLock) != FALSE;
+        if (g_reportBuffer != nullptr)
+        {
+            FlushReportBufferLocked();
+            g_reportBuffer = nullptr;
+        }
+
+        if (acquired)
+        {
+            LeaveCriticalSection(&g_reportBufferLock);
+        }
+        else
+        {
+            g_reportBufferLockAbandoned = true;
+        }
+
+        return;
+    }
+
+    EnterCriticalSection(&g_reportBufferLock);
+    if (g_reportBuffer != nullptr)
+    {
+        FlushReportBufferLocked();
+    }
+
+    LeaveCriticalSection(&g_reportBufferLock);
+}
+
+void SendReportBytes(_In_reads_bytes_(size) void const* data, size_t size)
+{
+    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    if (!g_reportBufferInitialized || g_reportBufferLockAbandoned)
+    {
+        WriteReportBytes(data, size, 1);
+        return;
+    }
+
+    EnterCriticalSection(&g_reportBufferLock);
+
+    if (g_reportBuffer == nullptr)
+    {
+        // Buffering was turned off when the process detached; writing with the lock held keeps the order.
+        WriteReportBytes(data, size, 1);
+        LeaveCriticalSection(&g_reportBufferLock);
+        return;
+    }
+
+    if (g_reportBufferUsed + size > REPORT_BUFFER_SIZE)
+    {
+        FlushReportBufferLocked();
+    }
+
+    if (size > REPORT_BUFFER_SIZE)
+    {
+        // Larger than the whole buffer; the buffer has just been flushed, so the order is preserved.
+        WriteReportBytes(data, size, 1);
+    }
+    else
+    {
+        memcpy(g_reportBuffer + g_reportBufferUsed, data, size);
+        g_reportBufferUsed += size;
+        g_reportBufferMessageCount++;
+    }
+
+    LeaveCriticalSection(&g_reportBufferLock);
+
+    EnsureReportBufferFlusherStarted();
+}
+
+/// <summary>
+/// Sends a complete report, or appends it to the given blob if there is one.
+/// </summary>
+static void SendOrAppendReportBytes(_In_reads_bytes_(size) void const* data, size_t size, ReportBlob* blob)
+{
+    if (blob == nullptr)
+    {
+        SendReportBytes(data, size);
+        return;
+    }
+
+    char const* bytes = reinterpret_cast<char const*>(data);
+    blob->Bytes.insert(blob->Bytes.end(), bytes, bytes + size);
+    blob->MessageCount++;
+}
+
+static void SendReportString(ReportType reportType, _In_z_ wchar_t const* dataString, ReportBlob* blob)
+{
+    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    size_t reportLineLength = sizeof(wchar_t) * wcslen(dataString);
+
+    if (!UseBinaryReportFormat())
+    {
+        SendOrAppendReportBytes(dataString, reportLineLength, blob);
+        return;
+    }
+
+    // In binary mode the text line is sent verbatim as the body of a framed record.
+    size_t recordSize = sizeof(ReportRecordHeader) + reportLineLength;
+    unique_ptr<char[]> record(new char[recordSize]);
+    assert(record.get());
+
+    InitializeReportRecordHeader(*reinterpret_cast<ReportRecordHeader*>(record.get()), reportType, recordSize, NextReportSequence());
+    memcpy(record.get() + sizeof(ReportRecordHeader), dataString, reportLineLength);
+
+    SendOrAppendReportBytes(record.get(), recordSize, blob);
+}
+
+void SendReportString(ReportType reportType, _In_z_ wchar_t const* dataString)
+{
+    SendReportString(reportType, dataString, nullptr);
+}
+
+/// <summary>
+/// Sends a file access report as a <code>FileAccessReportRecord</code>.
+/// </summary>
+/// <remarks>
+/// Most records are small, so a stack buffer is tried first so that only unusually long paths or command lines hit the heap.
+/// </remarks>
+static void SendFileAccessReportRecord(
+    FileOperationContext const& fileOperationContext,
+    FileAccessStatus status,
+    PolicyResult const& policyResult,
+    AccessCheckResult const& accessCheckResult,
+    DWORD error,
+    USN usn,
+    PCWSTR fileName,
+    PCWSTR filterStr,
+    PCWSTR commandLine,
+    ReportBlob* blob)
+{
+    size_t operationLength = wcslen(fileOperationContext.Operation); // in characters
+    size_t fileNameLength = wcslen(fileName); // in characters
+    size_t filterLength = wcslen(filterStr); // in characters
+    size_t commandLineLength = commandLine != nullptr ? wcslen(commandLine) : 0; // in characters
+    uint32_t localPathId = 0;
+    uint32_t pathFlags = 0;
+    bool holdsPathTableLock = false;
+
+    // Interning needs records to reach the consumer in the order they were sent, which the ring does not guarantee
+    // when it falls back to the report file, and a blob does not either since it is written after the lock is released.
+    if (InternReportedPaths() && !UseReportRingBuffer() && !g_reportQueueDetaching && blob == nullptr && fileNameLength > 0)
+    {
+        if (policyResult.IsExactManifestMatch() && policyResult.GetPathId() != 0)
+        {
+            pathFlags = REPORT_RECORD_PATH_IS_MANIFEST_PATH;
+        }
+        else
+        {
+            std::wstring path(fileName, fileNameLength);
+
+            AcquireSRWLockShared(&g_reportPathTableLock);
+            if (g_reportPathTable != nullptr)
+            {
+                auto it = g_reportPathTable->find(path);
+                if (it != g_reportPathTable->end())
+                {
+                    localPathId = it->second;
+                    pathFlags = REPORT_RECORD_PATH_USES_LOCAL_ID;
+                }
+            }
+            ReleaseSRWLockShared(&g_reportPathTableLock);
+
+            if (pathFlags == 0)
+            {
+                AcquireSRWLockExclusive(&g_reportPathTableLock);
+                holdsPathTableLock = true;
+
+                if (g_reportPathTable == nullptr)
+                {
+                    g_reportPathTable = new std::unordered_map<std::wstring, uint32_t>();
+                }
+
+                // Another thread may have interned the path in the meantime.
+                auto it = g_reportPathTable->find(path);
+                if (it != g_reportPathTable->end())
+                {
+                    localPathId = it->second;
+                    pathFlags = REPORT_RECORD_PATH_USES_LOCAL_ID;
+                }
+                else if (g_reportPathTable->size() < MAX_INTERNED_REPORT_PATHS)
+                {
+                    localPathId = (uint32_t)g_reportPathTable->size() + 1;
+                    g_reportPathTable->emplace(std::move(path), localPathId);
+                    pathFlags = REPORT_RECORD_PATH_DEFINES_LOCAL_ID;
+                }
+            }
+        }
+
+        if ((pathFlags & (REPORT_RECORD_PATH_IS_MANIFEST_PATH | REPORT_RECORD_PATH_USES_LOCAL_ID)) != 0)
+        {
+            fileNameLength = 0;
+        }
+    }
+
+    size_t recordSize = sizeof(FileAccessReportRecord) + sizeof(wchar_t) * (operationLength + fileNameLength + filterLength + commandLineLength);
+
+    char stackBuffer[1024];
+    unique_ptr<char[]> heapBuffer;
+    char* buffer = stackBuffer;
+
+    if (recordSize > sizeof(stackBuffer))
+    {
+        heapBuffer.reset(new char[recordSize]);
+        assert(heapBuffer.get());
+        buffer = heapBuffer.get();
+    }
+
+    FileAccessReportRecord* record = reinterpret_cast<FileAccessReportRecord*>(buffer);
+    InitializeReportRecordHeader(record->Header, ReportType_FileAccess, recordSize, NextReportSequence());
+    record->ProcessId = g_currentProcessId;
+    record->RequestedAccess = static_cast<uint32_t>(accessCheckResult.RequestedAccess);
+    record->Status = static_cast<uint32_t>(status);
+    record->ExplicitlyReported = accessCheckResult.ReportLevel == ReportLevel::ReportExplicit ? 1 : 0;
+    record->Error = error;
+    record->DesiredAccess = fileOperationContext.DesiredAccess;
+    record->ShareMode = fileOperationContext.ShareMode;
+    record->CreationDisposition = fileOperationContext.CreationDisposition;
+    record->FlagsAndAttributes = fileOperationContext.FlagsAndAttributes;
+    record->PathId = policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId();
+    record->Usn = static_cast<uint64_t>(usn);
+    record->OperationLength = static_cast<uint32_t>(operationLength);
+    record->PathLength = static_cast<uint32_t>(fileNameLength);
+    record->FilterLength = static_cast<uint32_t>(filterLength);
+    record->CommandLineLength = static_cast<uint32_t>(commandLineLength);
+    record->LocalPathId = localPathId;
+    record->PathFlags = pathFlags;
+    record->VolumeSerialNumber = fileOperationContext.VolumeSerialNumber;
+    record->FileIdLow = fileOperationContext.FileIdLow;
+    record->FileIdHigh = fileOperationContext.FileIdHigh;
+
+    wchar_t* strings = reinterpret_cast<wchar_t*>(buffer + sizeof(FileAccessReportRecord));
+    wmemcpy(strings, fileOperationContext.Operation, operationLength);
+    strings += operationLength;
+    wmemcpy(strings, fileName, fileNameLength);
+    strings += fileNameLength;
+    wmemcpy(strings, filterStr, filterLength);
+    strings += filterLength;
+
+    if (commandLineLength > 0)
+    {
+        wmemcpy(strings, commandLine, commandLineLength);
+    }
+
+    SendOrAppendReportBytes(buffer, recordSize, blob);
+
+    if (holdsPathTableLock)
+    {
+        ReleaseSRWLockExclusive(&g_reportPathTableLock);
+    }
+}
+
+/// <summary>
+/// Formats a file access report in the format the manifest asks for and sends it, or appends it to the given blob.
+/// </summary>
+static void SendFileAccessReport(
+    FileOperationContext const& fileOperationContext,
+    FileAccessStatus status,
+    PolicyResult const& policyResult,
+    AccessCheckResult const& accessCheckResult,
+    DWORD error,
+    USN usn,
+    PCWSTR fileName,
+    PCWSTR filterStr,
+    ReportBlob* blob = nullptr)
+{
+    if (g_currentProcessCommandLine == nullptr) {
+        g_currentProcessCommandLine = L"";
+    }
+
+    if (UseBinaryReportFormat())
+    {
+        // The binary record is length-prefixed, so the command line needs neither to come last nor to be sanitized.
+        PCWSTR commandLine = ReportProcessArgs() && !_wcsicmp(fileOperationContext.Operation, L"Process")
+            ? g_currentProcessCommandLine
+            : nullptr;
+
+        SendFileAccessReportRecord(fileOperationContext, status, policyResult, accessCheckResult, error, usn, fileName, filterStr, commandLine, blob);
+        return;
+    }
+
+    // Only report the process command line args when the C# code has requested it and when the file operation context is "Process"
+    // This way we only transmit the command line arguments once
+    bool reportCommandLine = ReportProcessArgs() && !_wcsicmp(fileOperationContext.Operation, L"Process");
+    PCWSTR sanitizedCommandLine = g_currentProcessSanitizedCommandLine != nullptr ? g_currentProcessSanitizedCommandLine : L"";
+
+    size_t fileNameLength = wcslen(fileName); // in characters
+    size_t filterLength = wcslen(filterStr); // in characters
+    size_t fileProcessCommandLineLength = reportCommandLine ? wcslen(sanitizedCommandLine) : 0; // in characters
+    size_t operationLen = wcslen(fileOperationContext.Operation); // in characters
+    size_t reportBufferSize = fileNameLength + filterLength + fileProcessCommandLineLength + operationLen + 100; // in characters
+
+    // Adding 100 should be enough for now since the max values for the members of the message are:
+    // ReportType_FileAccess � 1 char
+    // g_currentProcessId � 8 chars
+    // accessCheckResult.RequestedAccess � 1 char
+    // status � 1 char
+    // (int)(accessCheckResult.ReportLevel == ReportLevel::ReportExplicit) � 1 char(0 or 1)
+    // Error � 8 chars
+    // Usn � 16 chars
+    // fileOperationContext.DesiredAccess � 8 chars
+    // fileOperationContext.ShareMode � 8 chars
+    // fileOperationContext.CreationDisposition � 8 chars,
+    // fileOperationContext.FlagsAndAttributes � 8 chars
+    // policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId() � 8 chars
+    // filename separately added
+    // filterStr separately added
+    // g_currentProcessCommandLine � separately added
+    // 13 chars for | chars
+    // 5 chars for �, �  � : � �\r� �\n� �\0� chars
+    // Total : 94 characters.
+
+    unique_ptr<wchar_t[]> report(new wchar_t[reportBufferSize]);
+    assert(report.get());
+
+    int constructReportResult = -1;
+    if (reportCommandLine) {
+        // The command line arguments may contain the | (pipe) character - the same character that is used here as a field separator.
+        // It is important to keep the command line arguments last in this string because the C# code will 
+        // check how many | chars the string contains and if there are more fields than expected, it will assume that  
+        // everything after the last expected (13th) field is part of the command line arguments.
+        //
+        // The command line can contain newline characters. In the C# code our pipe reader performs read line, and thus it can read part of
+        // the command line. Thus, the command line needs to be sanitized. This is OK because no further consumer should rely on the exact
+        // form of the command line. It is sanitized once at attach (see InitProcessNameAndCommandLine).
+
+        constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%d,%s:%lx|%x|%x|%x|%lx|%llx|%lx|%lx|%lx|%lx|%lx|%s|%s|%s\r\n",
+            ReportType_FileAccess,
+            fileOperationContext.Operation,
+            g_currentProcessId,
+            accessCheckResult.RequestedAccess,
+            status,
+            (int)(accessCheckResult.ReportLevel == ReportLevel::ReportExplicit),
+            error,
+            usn,
+            fileOperationContext.DesiredAccess,
+            fileOperationContext.ShareMode,
+            fileOperationContext.CreationDisposition,
+            fileOperationContext.FlagsAndAttributes,
+            policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId(),
+            fileName,
+            filterStr,
+            sanitizedCommandLine);
+    }
+    else
+    {
+        constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%d,%s:%lx|%x|%x|%x|%lx|%llx|%lx|%lx|%lx|%lx|%lx|%s|%s\r\n",
+            ReportType_FileAccess,
+            fileOperationContext.Operation,
+            g_currentProcessId,
+            accessCheckResult.RequestedAccess,
+            status,
+            (int)(accessCheckResult.ReportLevel == ReportLevel::ReportExplicit),
+            error,
+            usn,
+            fileOperationContext.DesiredAccess,
+            fileOperationContext.ShareMode,
+            fileOperationContext.CreationDisposition,
+            fileOperationContext.FlagsAndAttributes,
+            policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId(),
+            fileName,
+            filterStr);
+    }
+
+    if (constructReportResult <= 0)
+    {
+        Dbg(L"ReportFileAccess:swprintf_s: %d <= 0", constructReportResult);
+        assert(!L"ReportFileAccess:swprintf_s: %d <= 0");
+    }
+    else
+    {
+        SendReportString(ReportType_FileAccess, report.get(), blob);
+    }
+}
+
+// Paths are compared case-insensitively, so the hash must not depend on case either.
+static uint32_t HashSummarizedPath(PCWSTR path)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (; *path != L'\0'; path++)
+    {
+        hash ^= (uint32_t)towupper(*path);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static DWORD WINAPI AccessSummaryFlusher(LPVOID lpParam)
+{
+    UNREFERENCED_PARAMETER(lpParam);
+
+    while (true)
+    {
+        Sleep(ACCESS_SUMMARY_FLUSH_INTERVAL_MS);
+        FlushAccessSummary(false);
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Starts the background flusher of the access summary on first use, like EnsureReportBufferFlusherStarted.
+/// </summary>
+static void EnsureAccessSummaryFlusherStarted()
+{
+    if (g_accessSummaryFlusherStarted != 0 || InterlockedCompareExchange(&g_accessSummaryFlusherStarted, 1, 0) != 0)
+    {
+        return;
+    }
+
+    HANDLE threadHandle = CreateThread(NULL, 0, AccessSummaryFlusher, nullptr, 0, nullptr);
+
+    if (threadHandle == NULL)
+    {
+        // The summary still gets flushed when it fills up, when a child process starts and when the process detaches.
+        Dbg(L"Warning: Could not create the access summary flusher thread. Last Error: %d", (int)GetLastError());
+    }
+    else
+    {
+        CloseHandle(threadHandle);
+    }
+}
+
+/// <summary>
+/// Merges an allowed file access into the access summary. Returns false if the summary is full around the path,
+/// in which case the caller has to report the access itself. Sets flushNeeded when the summary holds enough paths to be
+/// flushed right away.
+/// </summary>
+static bool TryAddToAccessSummary(
+    FileOperationContext const& fileOperationContext,
+    PolicyResult const& policyResult,
+    AccessCheckResult const& accessCheckResult,
+    DWORD error,
+    USN usn,
+    PCWSTR fileName,
+    bool& flushNeeded)
+{
+    uint32_t hash = HashSummarizedPath(fileName);
+    bool added = false;
+
+    AcquireSRWLockExclusive(&g_accessSummaryLock);
+
+    for (uint32_t probe = 0; probe < ACCESS_SUMMARY_MAX_PROBES; probe++)
+    {
+        AccessSummaryEntry*& slot = g_accessSummary[(hash + probe) & (ACCESS_SUMMARY_SIZE - 1)];
+
+        if (slot == nullptr)
+        {
+            slot = new (std::nothrow) AccessSummaryEntry(fileOperationContext, policyResult, accessCheckResult, error, usn, fileName, hash);
+            if (slot != nullptr)
+            {
+                g_accessSummaryCount++;
+                added = true;
+            }
+
+            break;
+        }
+
+        if (slot->Hash == hash && _wcsicmp(slot->FileName.c_str(), fileName) == 0)
+        {
+            slot->AccessCheck.RequestedAccess |= accessCheckResult.RequestedAccess;
+            if (accessCheckResult.ReportLevel == ReportLevel::ReportExplicit)
+            {
+                slot->AccessCheck.ReportLevel = ReportLevel::ReportExplicit;
+            }
+
+            slot->Context.DesiredAccess |= fileOperationContext.DesiredAccess;
+            slot->LastError = error;
+            slot->Usn = usn;
+            added = true;
+            break;
+        }
+    }
+
+    flushNeeded = g_accessSummaryCount >= ACCESS_SUMMARY_FLUSH_THRESHOLD;
+    ReleaseSRWLockExclusive(&g_accessSummaryLock);
+    return added;
+}
+
+/// <summary>
+/// Sends the queued reports, oldest first. Must be called with g_reportQueueDrainLock held (or from DllProcessDetach).
+/// </summary>
+static void DrainReportQueueLocked()
+{
+    PSLIST_ENTRY entry = InterlockedFlushSList(&g_reportQueue);
+
+    // Restore the order in which the reports were queued.
+    PSLIST_ENTRY oldest = nullptr;
+    while (entry != nullptr)
+    {
+        PSLIST_ENTRY next = entry->Next;
+        entry->Next = oldest;
+        oldest = entry;
+        entry = next;
+    }
+
+    // Only the drain from DllProcessDetach can find reports left over.
+    PSLIST_ENTRY* tail = &g_pendingReports;
+    while (*tail != nullptr)
+    {
+        tail = &(*tail)->Next;
+    }
+
+    *tail = oldest;
+
+    while (g_pendingReports != nullptr)
+    {
+        QueuedFileAccessReport* report = CONTAINING_RECORD(g_pendingReports, QueuedFileAccessReport, ItemEntry);
+
+        SendFileAccessReport(
+            report->Context,
+            report->Status,
+            report->Policy,
+            report->AccessCheck,
+            report->Error,
+            report->Usn,
+            report->FileName.c_str(),
+            report->Filter.c_str());
+
+        // Only forget the report once sent: sending it twice is better than not at all.
+        g_pendingReports = g_pendingReports->Next;
+        delete report;
+        InterlockedDecrement(&g_queuedReportCount);
+    }
+}
+
+static DWORD WINAPI ReportQueueWriter(LPVOID lpParam)
+{
+    UNREFERENCED_PARAMETER(lpParam);
+
+    // Whatever this thread does is on behalf of already reported accesses, so keep its own calls out of the reports.
+    DetouredScope scope;
+
+    while (true)
+    {
+        WaitForSingleObject(g_reportQueueEvent, INFINITE);
+        DrainReportQueue(false);
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Starts the report writer on first use. It is not started from DllProcessAttach to stay clear of the loader lock.
+/// Returns false if there is no writer to hand reports to.
+/// </summary>
+static bool EnsureReportQueueWriterStarted()
+{
+    if (g_reportQueueWriterStarted != 0 || InterlockedCompareExchange(&g_reportQueueWriterStarted, 1, 0) != 0)
+    {
+        return g_reportQueueEnabled;
+    }
+
+    HANDLE threadHandle = CreateThread(NULL, 0, ReportQueueWriter, nullptr, 0, nullptr);
+
+    if (threadHandle == NULL)
+    {
+        // Fall back to sending reports synchronously.
+        Dbg(L"Warning: Could not create the report writer thread. Last Error: %d", (int)GetLastError());
+        g_reportQueueEnabled = false;
+        return false;
+    }
+
+    CloseHandle(threadHandle);
+    return true;
+}
+
+/// <summary>
+/// Hands an allowed file access report to the report writer thread. Returns false if the caller has to send it itself.
+/// </summary>
+static bool TryQueueFileAccessReport(
+    FileOperationContext const& fileOperationContext,
+    FileAccessStatus status,
+    PolicyResult const& policyResult,
+    AccessCheckResult const& accessCheckResult,
+    DWORD error,
+    USN usn,
+    PCWSTR fileName,
+    PCWSTR filterStr)
+{
+    if (!g_reportQueueEnabled || g_queuedReportCount >= MAX_QUEUED_REPORTS || !EnsureReportQueueWriterStarted())
+    {
+        return false;
+    }
+
+    QueuedFileAccessReport* report = new (std::nothrow) QueuedFileAccessReport(
+        fileOperationContext, status, policyResult, accessCheckResult, error, usn, fileName, filterStr);
+
+    if (report == nullptr)
+    {
+        return false;
+    }
+
+    LONG queuedReports = InterlockedIncrement(&g_queuedReportCount);
+    if (InterlockedPushEntrySList(&g_reportQueue, &report->ItemEntry) == nullptr)
+    {
+        SetEvent(g_reportQueueEvent);
+    }
+
+    IncrementFeatureCounter(FeatureCounter::ReportsQueued);
+
+    if (IsDetoursEventEnabled(DetoursEvent_ReportQueued))
+    {
+        WriteReportQueuedEvent(fileOperationContext.Operation, fileName, queuedReports);
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Sends a process detouring status as a text line. The command line is the one to send, after its hash prefix.
+/// </summary>
+static void SendProcessDetouringStatusLine(
+    ProcessDetouringStatus status,
+    PCWSTR processName,
+    PCWSTR applicationName,
+    PCWSTR commandLineHashPrefix,
+    PCWSTR commandLine,
+    const BOOL needsInjectioin,
+    const HANDLE hJob,
+    const BOOL disableDetours,
+    const DWORD dwCreationFlags,
+    const BOOL detoured,
+    const DWORD error,
+    const CreateDetouredProcessStatus createProcessStatus,
+    const ProcessDetouringTimings& timings)
+{
+    size_t const reportBufferSize =
+        30 /*Report ID type*/ +
+        30 /*Process ID*/ +
+        (30 * 10) /*4-byte int values*/ +
+        (11 * 4) /*Timings*/ +
+        16 /*Separators*/ +
+        wcslen(processName) /*processName*/ +
+        wcslen(applicationName) /*lpApplicationName*/ +
+        wcslen(commandLineHashPrefix) + wcslen(commandLine) /*lpCommandLine*/ +
+        3; /*\r\n null*/
+
+    unique_ptr<wchar_t[]> report(new wchar_t[reportBufferSize]);
+
+#pragma warning(suppress: 4826)
+    int const constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%u,%lu|%u|%s|%s|%u|%llu|%u|%u|%u|%u|%u|%u;%u;%u;%u|%s%s\r\n",
+        ReportType_ProcessDetouringStatus,
+        GetCurrentProcessId(),
+        status,
+        processName,
+        applicationName,
+        needsInjectioin ? 1 : 0,
+        reinterpret_cast<unsigned long long>(hJob),
+        disableDetours ? 1 : 0,
+        (unsigned)dwCreationFlags,
+        detoured ? 1 : 0,
+        (unsigned)error,
+        (unsigned)createProcessStatus,
+        (unsigned)timings.AttributesMicroseconds,
+        (unsigned)timings.CreateProcessMicroseconds,
+        (unsigned)timings.InjectionMicroseconds,
+        (unsigned)timings.ResumeMicroseconds,
+        commandLineHashPrefix,
+        commandLine);
+
+    assert(constructReportResult > 0);
+
+    if (constructReportResult > 0)
+    {
+        SendReportString(ReportType_ProcessDetouringStatus, report.get());
+    }
+}
+
+/// <summary>
+/// Sends a process detouring status as a <code>ProcessDetouringStatusRecord</code>. The command line is the one to send:
+/// empty when it was sent before under the same hash.
+/// </summary>
+static void SendProcessDetouringStatusRecord(
+    ProcessDetouringStatus status,
+    PCWSTR processName,
+    PCWSTR applicationName,
+    PCWSTR commandLine,
+    uint64_t commandLineHash,
+    bool commandLineSentBefore,
+    const BOOL needsInjectioin,
+    const HANDLE hJob,
+    const BOOL disableDetours,
+    const DWORD dwCreationFlags,
+    const BOOL detoured,
+    const DWORD error,
+    const CreateDetouredProcessStatus createProcessStatus,
+    const ProcessDetouringTimings& timings)
+{
+    size_t processNameLength = wcslen(processName); // in characters
+    size_t applicationNameLength = applicationName != nullptr ? wcslen(applicationName) : 0; // in characters
+    size_t commandLineLength = wcslen(commandLine); // in characters
+    size_t recordSize = sizeof(ProcessDetouringStatusRecord) + sizeof(wchar_t) * (processNameLength + applicationNameLength + commandLineLength);
+
+    unique_ptr<char[]> buffer(new char[recordSize]);
+    assert(buffer.get());
+
+    ProcessDetouringStatusRecord* record = reinterpret_cast<ProcessDetouringStatusRecord*>(buffer.get());
+    InitializeReportRecordHeader(record->Header, ReportType_ProcessDetouringStatus, recordSize, NextReportSequence());
+    record->ProcessId = GetCurrentProcessId();
+    record->Status = static_cast<uint32_t>(status);
+    record->NeedsInjection = needsInjectioin ? 1 : 0;
+    record->DisableDetours = disableDetours ? 1 : 0;
+    record->CreationFlags = dwCreationFlags;
+    record->Detoured = detoured ? 1 : 0;
+    record->Error = error;
+    record->CreateProcessStatus = static_cast<uint32_t>(createProcessStatus);
+    record->Job = static_cast<uint64_t>(reinterpret_cast<ULONG_PTR>(hJob));
+    record->CommandLineHash = commandLineHash;
+    record->ProcessNameLength = static_cast<uint32_t>(processNameLength);
+    record->ApplicationNameLength = static_cast<uint32_t>(applicationNameLength);
+    record->CommandLineLength = static_cast<uint32_t>(commandLineLength);
+    record->Flags = (commandLineSentBefore ? REPORT_RECORD_COMMAND_LINE_SENT_BEFORE : 0)
+        | (applicationName == nullptr ? REPORT_RECORD_NO_APPLICATION_NAME : 0);
+    record->AttributesMicroseconds = timings.AttributesMicroseconds;
+    record->CreateProcessMicroseconds = timings.CreateProcessMicroseconds;
+    record->InjectionMicroseconds = timings.InjectionMicroseconds;
+    record->ResumeMicroseconds = timings.ResumeMicroseconds;
+
+    wchar_t* strings = reinterpret_cast<wchar_t*>(buffer.get() + sizeof(ProcessDetouringStatusRecord));
+    wmemcpy(strings, processName, processNameLength);
+    strings += processNameLength;
+    wmemcpy(strings, applicationName != nullptr ? applicationName : L"", applicationNameLength);
+    strings += applicationNameLength;
+    wmemcpy(strings, commandLine, commandLineLength);
+
+    SendReportBytes(buffer.get(), recordSize);
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+void InitializeReportQueue()
 {
-    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
+    if (!SendReportsAsynchronously() || g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE)
+    {
         return;
     }
 
-    // Increment the message sent counter.
-    if (g_messageCountSemaphore != INVALID_HANDLE_VALUE)
+    g_reportQueueEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (g_reportQueueEvent == NULL)
     {
-        ReleaseSemaphore(g_messageCountSemaphore, 1, nullptr);
+        Dbg(L"Warning: Could not create the report queue event. Last Error: %d", (int)GetLastError());
+        return;
     }
 
-    OVERLAPPED overlapped;
-    ZeroMemory(&overlapped, sizeof(OVERLAPPED));
-    // This offset specifies "append".
-    overlapped.Offset = 0xFFFFFFFF;
-    overlapped.OffsetHigh = 0xFFFFFFFF;
+    InitializeCriticalSection(&g_reportQueueDrainLock);
+    InitializeSListHead(&g_reportQueue);
+    g_reportQueueEnabled = true;
+}
 
-    size_t reportLineLength = sizeof(wchar_t) * wcslen(dataString);
-    DWORD bytesWritten;
-    DWORD lastError = GetLastError();
-    if (!WriteFile(g_reportFileHandle, dataString, (DWORD)reportLineLength, &bytesWritten, &overlapped))
+void DrainReportQueue(bool processDetach)
+{
+    if (g_reportQueueEvent == NULL)
     {
-        DWORD error = GetLastError();
-        Dbg(L"Failed to write file access report line: %08X. Exiting with code %d.", (int)error, DETOURS_PIPE_WRITE_ERROR_4);
-        wprintf(L"Failed to write file access report line: %08X. Exiting with code %d.", (int)error, DETOURS_PIPE_WRITE_ERROR_4);
-        fwprintf(stderr, L"Failed to write file access report line: %08X. Exiting with code %d.", (int)error, DETOURS_PIPE_WRITE_ERROR_4);
-        HandleDetoursInjectionAndCommunicationErrors(DETOURS_PIPE_WRITE_ERROR_4, L"Failure writing message to pipe: exit(-46).", DETOURS_WINDOWS_LOG_MESSAGE_4);
+        return;
     }
 
-    SetLastError(lastError);
+    if (processDetach)
+    {
+        // On process exit all other threads are already gone, and the writer may have been holding the lock.
+        // Queueing is turned off afterwards so that reports sent while detaching are written directly.
+        g_reportQueueEnabled = false;
+        g_reportQueueDetaching = true;
+        bool acquired = TryEnterCriticalSection(&g_reportQueueDrainLock) != FALSE;
+        DrainReportQueueLocked();
+
+        if (acquired)
+        {
+            LeaveCriticalSection(&g_reportQueueDrainLock);
+        }
+
+        return;
+    }
+
+    EnterCriticalSection(&g_reportQueueDrainLock);
+    DrainReportQueueLocked();
+    LeaveCriticalSection(&g_reportQueueDrainLock);
 }
 
-// ----------------------------------------------------------------------------
-// FUNCTION DEFINITIONS
-// ----------------------------------------------------------------------------
+void FlushAccessSummary(bool processDetach)
+{
+    if ((!SummarizeFileAccesses() && !AdaptiveReportBackpressure()) || g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    // On process exit all other threads are already gone, and one of them may have been holding the lock.
+    bool acquired = true;
+    if (processDetach)
+    {
+        acquired = TryAcquireSRWLockExclusive(&g_accessSummaryLock) != FALSE;
+    }
+    else
+    {
+        AcquireSRWLockExclusive(&g_accessSummaryLock);
+    }
+
+    ReportBlob blob;
+    if (g_accessSummaryCount > 0)
+    {
+        for (size_t i = 0; i < ACCESS_SUMMARY_SIZE; i++)
+        {
+            AccessSummaryEntry* entry = g_accessSummary[i];
+            if (entry == nullptr)
+            {
+                continue;
+            }
+
+            // Report the outcome of the first access too when it differs, e.g. a probe of a file that did not exist yet.
+            if (entry->FirstError != entry->LastError)
+            {
+                SendFileAccessReport(entry->Context, FileAccessStatus_Allowed, entry->Policy, entry->AccessCheck,
+                    entry->FirstError, entry->Usn, entry->FileName.c_str(), L"", &blob);
+            }
+
+            SendFileAccessReport(entry->Context, FileAccessStatus_Allowed, entry->Policy, entry->AccessCheck,
+                entry->LastError, entry->Usn, entry->FileName.c_str(), L"", &blob);
+
+            g_accessSummary[i] = nullptr;
+            delete entry;
+        }
+
+        g_accessSummaryCount = 0;
+    }
+
+    if (acquired)
+    {
+        ReleaseSRWLockExclusive(&g_accessSummaryLock);
+    }
+
+    if (blob.MessageCount > 0)
+    {
+        // Buffered reports are older than anything in the summary.
+        FlushReportBuffer(false);
+        WriteReportBytes(blob.Bytes.data(), blob.Bytes.size(), blob.MessageCount);
+    }
+}
+
+void InvalidateReportedAccesses(PolicyResult const& policyResult)
+{
+    if ((!DeduplicateReports() && !CoalesceOutputWrites()) || policyResult.IsIndeterminate()) {
+        return;
+    }
+
+    CanonicalizedPath const& path = policyResult.GetCanonicalizedPath();
+    InvalidateReportCache(path.GetPathString(), path.Length());
+}
 
 void ReportFileAccess(
     FileOperationContext const& fileOperationContext,
@@ -74,6 +1480,12 @@ void ReportFileAccess(
         return;
     }
 
+    DetourOverheadScope overhead(DetourOverheadCategory::Reporting);
+
+    if (TryRecordInAccessBitmap(fileOperationContext, status, policyResult, accessCheckResult, error, usn)) {
+        return;
+    }
+
     PCWSTR fileName, filterStr;
 
     if (policyResult.IsIndeterminate()) {
@@ -94,102 +1506,69 @@ void ReportFileAccess(
         filterStr = filter;
     }
 
-    if (g_currentProcessCommandLine == nullptr) {
-        g_currentProcessCommandLine = L"";
+    // Only allowed accesses to a known path are deduplicated. Denials must always reach BuildXL, enumerations carry a
+    // filter that the cache does not distinguish (they have a cache of their own), and the "Process" report carries the
+    // process start itself. With CoalesceOutputWrites alone, only writes are.
+    if (DeduplicateReports()
+        && !policyResult.IsIndeterminate()
+        && status == FileAccessStatus_Allowed
+        && accessCheckResult.RequestedAccess == RequestedAccess::Enumerate
+        && CheckAndUpdateEnumerationReportCache(
+            policyResult.GetCanonicalizedPath().GetPathString(),
+            policyResult.GetCanonicalizedPath().Length(),
+            filterStr,
+            error))
+    {
+        return;
     }
 
-    size_t fileNameLength = wcslen(fileName); // in characters
-    size_t filterLength = wcslen(filterStr); // in characters
-    size_t fileProcessCommandLineLength = wcslen(g_currentProcessCommandLine); // in characters
-    size_t operationLen = wcslen(fileOperationContext.Operation); // in characters
-    size_t reportBufferSize = fileNameLength + filterLength + fileProcessCommandLineLength + operationLen + 100; // in characters
-
-    // Adding 100 should be enough for now since the max values for the members of the message are:
-    // ReportType_FileAccess � 1 char
-    // g_currentProcessId � 8 chars
-    // accessCheckResult.RequestedAccess � 1 char
-    // status � 1 char
-    // (int)(accessCheckResult.ReportLevel == ReportLevel::ReportExplicit) � 1 char(0 or 1)
-    // Error � 8 chars
-    // Usn � 16 chars
-    // fileOperationContext.DesiredAccess � 8 chars
-    // fileOperationContext.ShareMode � 8 chars
-    // fileOperationContext.CreationDisposition � 8 chars,
-    // fileOperationContext.FlagsAndAttributes � 8 chars
-    // policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId() � 8 chars
-    // filename separately added
-    // filterStr separately added
-    // g_currentProcessCommandLine � separately added
-    // 13 chars for | chars
-    // 5 chars for �, �  � : � �\r� �\n� �\0� chars
-    // Total : 94 characters.
-
-    unique_ptr<wchar_t[]> report(new wchar_t[reportBufferSize]);
-    assert(report.get());
-
-    // Only report the process command line args when the C# code has requested it and when the file operation context is "Process"
-    // This way we only transmit the command line arguments once
-    int constructReportResult = -1;
-    if (ReportProcessArgs() && !_wcsicmp(fileOperationContext.Operation, L"Process")) {
-        // The command line arguments may contain the | (pipe) character - the same character that is used here as a field separator.
-        // It is important to keep the command line arguments last in this string because the C# code will 
-        // check how many | chars the string contains and if there are more fields than expected, it will assume that  
-        // everything after the last expected (13th) field is part of the command line arguments.
-        //
-        // The command line can contain newline characters. In the C# code our pipe reader performs read line, and thus it can read part of
-        // the command line. Thus, the command line needs to be sanitized. This is OK because no further consumer should rely on the exact
-        // form of the command line. Here, newline characters are simply replaced with space. Replacing it with space is fine because
-        // it won't change the length of the string, and thus no need to resize the report buffer.
-        std::wstring commandLine(g_currentProcessCommandLine);
-        std::replace(commandLine.begin(), commandLine.end(), L'\r', L' ');
-        std::replace(commandLine.begin(), commandLine.end(), L'\n', L' ');
-
-        constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%d,%s:%lx|%x|%x|%x|%lx|%llx|%lx|%lx|%lx|%lx|%lx|%s|%s|%s\r\n",
-            ReportType_FileAccess,
-            fileOperationContext.Operation,
-            g_currentProcessId,
+    if ((DeduplicateReports() || (CoalesceOutputWrites() && (accessCheckResult.RequestedAccess & RequestedAccess::Write) != RequestedAccess::None))
+        && !policyResult.IsIndeterminate()
+        && status == FileAccessStatus_Allowed
+        && (accessCheckResult.RequestedAccess & RequestedAccess::Enumerate) == RequestedAccess::None
+        && _wcsicmp(fileOperationContext.Operation, L"Process") != 0
+        && CheckAndUpdateReportCache(
+            policyResult.GetCanonicalizedPath().GetPathString(),
+            policyResult.GetCanonicalizedPath().Length(),
             accessCheckResult.RequestedAccess,
-            status,
-            (int)(accessCheckResult.ReportLevel == ReportLevel::ReportExplicit),
-            error,
-            usn,
-            fileOperationContext.DesiredAccess,
-            fileOperationContext.ShareMode,
-            fileOperationContext.CreationDisposition,
-            fileOperationContext.FlagsAndAttributes,
-            policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId(),
-            fileName,
-            filterStr,
-            commandLine.c_str());
+            error))
+    {
+        return;
     }
-    else
+
+    // Summarized accesses are sent once per path when the summary gets flushed. The same accesses as above are left out.
+    bool summaryFlushNeeded = false;
+    if ((SummarizeFileAccesses() || g_reportBackpressure != 0)
+        && !policyResult.IsIndeterminate()
+        && status == FileAccessStatus_Allowed
+        && (accessCheckResult.RequestedAccess & RequestedAccess::Enumerate) == RequestedAccess::None
+        && _wcsicmp(fileOperationContext.Operation, L"Process") != 0
+        && TryAddToAccessSummary(fileOperationContext, policyResult, accessCheckResult, error, usn, fileName, summaryFlushNeeded))
     {
-        constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%d,%s:%lx|%x|%x|%x|%lx|%llx|%lx|%lx|%lx|%lx|%lx|%s|%s\r\n",
-            ReportType_FileAccess,
-            fileOperationContext.Operation,
-            g_currentProcessId,
-            accessCheckResult.RequestedAccess,
-            status,
-            (int)(accessCheckResult.ReportLevel == ReportLevel::ReportExplicit),
-            error,
-            usn,
-            fileOperationContext.DesiredAccess,
-            fileOperationContext.ShareMode,
-            fileOperationContext.CreationDisposition,
-            fileOperationContext.FlagsAndAttributes,
-            policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId(),
-            fileName,
-            filterStr);
+        if (summaryFlushNeeded)
+        {
+            FlushAccessSummary(false);
+        }
+
+        EnsureAccessSummaryFlusherStarted();
+        return;
     }
 
-    if (constructReportResult <= 0)
+    // Denials have to reach BuildXL before the denied call returns, and the "Process" report has to come first.
+    if (status == FileAccessStatus_Allowed
+        && _wcsicmp(fileOperationContext.Operation, L"Process") != 0
+        && TryQueueFileAccessReport(fileOperationContext, status, policyResult, accessCheckResult, error, usn, fileName, filterStr))
     {
-        Dbg(L"ReportFileAccess:swprintf_s: %d <= 0", constructReportResult);
-        assert(!L"ReportFileAccess:swprintf_s: %d <= 0");
+        return;
     }
-    else
+
+    // Whatever got queued before has to go out first to keep the reports in order.
+    DrainReportQueue(false);
+    SendFileAccessReport(fileOperationContext, status, policyResult, accessCheckResult, error, usn, fileName, filterStr);
+
+    if (status != FileAccessStatus_Allowed || _wcsicmp(fileOperationContext.Operation, L"Process") == 0)
     {
-        SendReportString(report.get());
+        FlushUrgentReport();
     }
 }
 
@@ -203,83 +1582,92 @@ void ReportProcessDetouringStatus(
     const DWORD dwCreationFlags,
     const BOOL detoured,
     const DWORD error,
-    const CreateDetouredProcessStatus createProcessStatus)
+    const CreateDetouredProcessStatus createProcessStatus,
+    const ProcessDetouringTimings* timings)
 {
     if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE || !ShouldLogProcessDetouringStatus()) {
         return;
     }
 
-    DWORD len = MAX_PATH;
+    // Keep the status after the file accesses of the process that led up to it.
+    DrainReportQueue(false);
+
     static wchar_t* errorString = L"Error getting process name: GetModuleFileNameW failed";
+    PCWSTR processName = g_currentProcessModuleName != nullptr ? g_currentProcessModuleName : errorString;
 
-    unique_ptr<wchar_t[]> processName(new wchar_t[len]);
-    wcscpy_s(processName.get(), len, errorString);
+    wchar_t* nullStringPtr = L"null";
+    ProcessDetouringTimings const noTimings = {};
 
-    // See https://msdn.microsoft.com/query/dev14.query?appId=Dev14IDEF1&l=EN-US&k=k(LIBLOADERAPI%2FGetModuleFileNameW);k(GetModuleFileNameW);k(SolutionItemsProject);k(SolutionItemsProject);k(SolutionItemsProject);k(TargetFrameworkMoniker-.NETFramework,Version%3Dv4.5.1);k(DevLang-C%2B%2B);k(TargetOS-Windows)&rd=true.
-    // this function always succeeds with putting something in the processName.
-    // The process name could be cut off and this will be known by testing if last error 
-    // is ERROR_INSUFFICIENT_BUFFER.
-    // We can't test for other failures, because very often Windows PI don't change the last error 
-    // in success cases and another error code might be left over from a previous operation.
-    while (true)
+    // A child goes through several statuses, so its command line is only sent in full the first time, prefixed with its hash,
+    // and by hash alone afterwards. The full line has to reach the consumer first, which the ring does not guarantee when it
+    // falls back to the report file.
+    wchar_t commandLineHashPrefix[24] = L"";
+    PCWSTR commandLine = lpCommandLine != nullptr ? lpCommandLine : nullStringPtr;
+    uint64_t commandLineHash = 0;
+    bool commandLineSentBefore = false;
+
+    if (lpCommandLine != nullptr && !UseReportRingBuffer())
     {
-        if (GetModuleFileNameW(NULL, processName.get(), len) == 0)
+        // FNV-1a
+        commandLineHash = 14695981039346656037ull;
+        for (PCWSTR c = lpCommandLine; *c != L'\0'; c++)
         {
-            // If the the function fails, log a Dbg message and continue..
-            // Otherwise it is OK to continue. Just send an "unknown" process name.
-            Dbg(L"Could not get the processName. GetModuleFileNameW function failed.");
-            break;
+            commandLineHash ^= (uint64_t)*c;
+            commandLineHash *= 1099511628211ull;
         }
 
-        // Check need to allocate more space.
-        if (GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+        commandLineSentBefore = (uint64_t)g_reportedCommandLineHashes[commandLineHash & (REPORTED_COMMAND_LINE_SLOTS - 1)] == commandLineHash;
+        swprintf_s(commandLineHashPrefix, L"%c%016llx%s", COMMAND_LINE_HASH_MARKER, (unsigned long long)commandLineHash, commandLineSentBefore ? L"" : L"=");
+
+        if (commandLineSentBefore)
         {
-            len = 2 * len;
-            processName.reset(new wchar_t[len]);
-            ZeroMemory(processName.get(), len * sizeof(wchar_t));
-            continue;
+            commandLine = L"";
         }
-
-        // Gotten the process name. Break out of the loop.
-        break;
     }
 
-    size_t const reportBufferSize =
-        30 /*Report ID type*/ +
-        30 /*Process ID*/ +
-        (30 * 10) /*4-byte int values*/ +
-        12 /*Separators*/ +
-        (processName != nullptr ? wcslen(processName.get()) : 10) /*processName*/ +
-        (lpApplicationName != nullptr ? wcslen(lpApplicationName) : 10) /*lpApplicationName*/ +
-        (lpCommandLine != nullptr ? wcslen(lpCommandLine) : 10) /*lpCommandLine*/ +
-        3; /*\r\n null*/
-
-    wchar_t* nullStringPtr = L"null";
-
-    unique_ptr<wchar_t[]> report(new wchar_t[reportBufferSize]);
-
-#pragma warning(suppress: 4826)
-    int const constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%u,%lu|%u|%s|%s|%u|%llu|%u|%u|%u|%u|%u|%s\r\n",
-        ReportType_ProcessDetouringStatus,
-        GetCurrentProcessId(),
-        status,
-        processName.get() != nullptr ? processName.get() : nullStringPtr,
-        lpApplicationName != nullptr ? lpApplicationName : nullStringPtr,
-        needsInjectioin ? 1 : 0,
-        reinterpret_cast<unsigned long long>(hJob),
-        disableDetours ? 1 : 0,
-        (unsigned)dwCreationFlags,
-        detoured ? 1 : 0,
-        (unsigned)error,
-        (unsigned)createProcessStatus,
-        lpCommandLine != nullptr ? lpCommandLine : nullStringPtr);
-
-    assert(constructReportResult > 0);
+    if (UseBinaryReportFormat())
+    {
+        SendProcessDetouringStatusRecord(
+            status,
+            processName,
+            lpApplicationName,
+            commandLine,
+            commandLineHash,
+            commandLineSentBefore,
+            needsInjectioin,
+            hJob,
+            disableDetours,
+            dwCreationFlags,
+            detoured,
+            error,
+            createProcessStatus,
+            timings != nullptr ? *timings : noTimings);
+    }
+    else
+    {
+        SendProcessDetouringStatusLine(
+            status,
+            processName,
+            lpApplicationName != nullptr ? lpApplicationName : nullStringPtr,
+            commandLineHashPrefix,
+            commandLine,
+            needsInjectioin,
+            hJob,
+            disableDetours,
+            dwCreationFlags,
+            detoured,
+            error,
+            createProcessStatus,
+            timings != nullptr ? *timings : noTimings);
+    }
 
-    if (constructReportResult > 0)
+    // Only remembered once sent, so that no report refers to the hash ahead of the one defining it.
+    if (commandLineHash != 0 && !commandLineSentBefore)
     {
-        SendReportString(report.get());
+        InterlockedExchange64(&g_reportedCommandLineHashes[commandLineHash & (REPORTED_COMMAND_LINE_SLOTS - 1)], (LONG64)commandLineHash);
     }
+
+    FlushUrgentReport();
 }
 
 void ReportProcessData(
@@ -302,6 +1690,10 @@ void ReportProcessData(
         return;
     }
 
+    std::wstring detourStatistics = FormatDetourStatistics();
+    std::wstring featureCounters = FormatFeatureCounters();
+    DetourOverhead detourOverhead = GetDetourOverhead();
+
     // There is 1 32-bit report type (ReportType_ProcessData), which has a max character length of 10 characters.
     // There is 1 32-bit process ID, which has a max character length of 10 characters.
     // There are 6 64-bit values, each value has a max length of 20 characters each. These represent the IO counters,
@@ -309,9 +1701,30 @@ void ReportProcessData(
     // exit time, and the kernel and user mode execution times. They have a high and low DWORD value.
     // There is 1 32 bit process exit code.
     // There is 1 32 bit parent process id.
-    // There are 29 separators for the "," and "|" characters. (30 values total gives us 29 separators)
+    // There are 24 separators for the "," and "|" characters. (25 values total gives us 24 separators)
     // There are 5 * 64 bit and 2 * 32 bit for detours max memory heap size * and payload size, final heap allocated, max and final HandleHeapEntries, allocated pool entries for the non-locking list.
     // There are 6 * 64 bit for the max allocated/reallocated, virtual allocated data, max realloc chunck, final and max app used heap space
+    // There are 2 * 64 bit for the contended HandleOverlay map writes and reads (and 2 more separators).
+    // There are 4 * 64 bit for the time spent locating and parsing the manifest, initializing the HandleOverlay map and
+    // committing the detours transaction in DllProcessAttach (and 4 more separators).
+    // There are 2 * 64 bit for the NtClose closed handles pool exhaustions and refills (and 2 more separators).
+    // There are 2 * 64 bit for the canonicalizations and the fast canonicalizations (and 2 more separators).
+    // There are 6 * 64 bit for the injected child processes, the images found from their PEB and the time spent in each
+    // step of updating their imports (and 6 more separators).
+    // There is 1 * 64 bit for the detoured functions whose prologue was taken from the prologue cache (and 1 more separator).
+    // There are 2 * 64 bit for the time spent applying the device map to child processes and the number of child processes
+    // that inherited it (and 2 more separators).
+    // There are 3 * 64 bit for the hits, misses and entries of the policy result cache (and 3 more separators).
+    // There are 2 * 64 bit for the child processes that waited on the process admission gate and the time they waited (and 2 more separators).
+    // There is 1 * 64 bit for the directory checks that needed no query of the file system (and 1 more separator).
+    // There are 2 * 64 bit for the queries of the attributes of file handles and the checks answered from one made for another
+    // check (and 2 more separators).
+    // There are 5 * 64 bit for the time the detours spent around the real functions, in total and on policy resolution, reparse
+    // point resolution, reporting and the HandleOverlay map lock (and 5 more separators).
+    // There are the detoured function statistics, which contain no "|" (and 1 more separator).
+    // There are the feature counters, which contain no "|" either (and 1 more separator).
+    // That makes 58 separators, 57 of them "|", so the message splits into the 58 entries SandboxedProcessReports expects
+    // (NumberOfEntriesInMessage).
     // And the length of the module file name.
     // 3 characters for "\r\n" and null.
     size_t const reportBufferSize = 
@@ -319,11 +1732,25 @@ void ReportProcessData(
         10 /*Process ID*/ +
         (20 * 6) /*IO Counters*/ +
         (10 * 7) /*Creation, exit, kernel, user times*/ +
-        29 /*Separators*/ +
+        24 /*Separators*/ +
         wcslen(fileName) + /*Module file name*/ +
         10 /*Process exit code*/ +
         10 /*Parent process id*/ +
         120 /*Detours max memory heap size * and payload size, final heap allocated, max and final HandleHeapEntries, allocated pool entries for the non-locking list. */ +
+        (20 * 2) + 2 /*Contended HandleOverlay map writes and reads, with separators*/ +
+        (20 * 4) + 4 /*DllProcessAttach phase times, with separators*/ +
+        (20 * 2) + 2 /*NtClose pool exhaustions and refills, with separators*/ +
+        (20 * 2) + 2 /*Canonicalizations and fast canonicalizations, with separators*/ +
+        (20 * 6) + 6 /*Child process injections, with separators*/ +
+        20 + 1 /*Cached prologues, with separator*/ +
+        (20 * 2) + 2 /*Device map applications and inheritances, with separators*/ +
+        (20 * 3) + 3 /*Policy result cache hits, misses and entries, with separators*/ +
+        (20 * 2) + 2 /*Process admission waits and wait time, with separators*/ +
+        20 + 1 /*Directory queries avoided, with separator*/ +
+        (20 * 2) + 2 /*File stat queries made and saved, with separators*/ +
+        (20 * 5) + 5 /*Detour overhead, in total and by category, with separators*/ +
+        detourStatistics.length() + 1 /*Detoured function statistics, with separator*/ +
+        featureCounters.length() + 1 /*Feature counters, with separator*/ +
         3; /*\r\n null*/
 
     unique_ptr<wchar_t[]> report(new wchar_t[reportBufferSize]);
@@ -336,7 +1763,7 @@ void ReportProcessData(
         return;
     }
 
-    int const constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%u,%lu|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%s|%lu|%lu|%I64u|%lu|%I64u|%lu|%I64u|%I64u\r\n",
+    int const constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%u,%lu|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%lu|%s|%lu|%lu|%I64u|%lu|%I64u|%lu|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%I64u|%s|%s\r\n",
         ReportType_ProcessData,
         GetCurrentProcessId(),
         ioCounters.ReadOperationCount,
@@ -361,12 +1788,100 @@ void ReportProcessData(
         (ULONG64)g_detoursHeapAllocatedMemoryInBytes,
         (ULONG)g_detoursAllocatedNoLockConcurentPoolEntries,
         (ULONG64)g_detoursMaxHandleHeapEntries,
-        (ULONG64)g_detoursHandleHeapEntries);
+        (ULONG64)g_detoursHandleHeapEntries,
+        (ULONG64)g_detoursHandleOverlayContendedWrites,
+        (ULONG64)g_detoursHandleOverlayContendedReads,
+        (ULONG64)g_detoursAttachLocateManifestMicroseconds,
+        (ULONG64)g_detoursAttachParseManifestMicroseconds,
+        (ULONG64)g_detoursAttachHandleOverlayMicroseconds,
+        (ULONG64)g_detoursAttachTransactionMicroseconds,
+        (ULONG64)g_detoursNtClosePoolExhaustions,
+        (ULONG64)g_detoursNtClosePoolRefills,
+        (ULONG64)g_detoursCanonicalizations,
+        (ULONG64)g_detoursFastCanonicalizations,
+        (ULONG64)g_detoursInjectedProcesses,
+        (ULONG64)g_detoursInjectionImagesFromPeb,
+        (ULONG64)g_detoursInjectionFindImageMicroseconds,
+        (ULONG64)g_detoursInjectionAllocateMicroseconds,
+        (ULONG64)g_detoursInjectionWriteImportsMicroseconds,
+        (ULONG64)g_detoursInjectionChecksumMicroseconds,
+        (ULONG64)g_detoursAttachCachedPrologues,
+        (ULONG64)g_detoursInjectionApplyMappingMicroseconds,
+        (ULONG64)g_detoursInjectionInheritedDeviceMaps,
+        (ULONG64)g_detoursPolicyResultCacheHits,
+        (ULONG64)g_detoursPolicyResultCacheMisses,
+        (ULONG64)g_detoursPolicyResultCacheEntries,
+        (ULONG64)g_detoursProcessAdmissionWaits,
+        (ULONG64)g_detoursProcessAdmissionWaitMicroseconds,
+        (ULONG64)g_detoursDirectoryQueriesAvoided,
+        (ULONG64)g_detoursFileStatQueries,
+        (ULONG64)g_detoursFileStatQueriesSaved,
+        detourOverhead.TotalMicroseconds,
+        detourOverhead.CategoryMicroseconds[(int)DetourOverheadCategory::PolicyResolution],
+        detourOverhead.CategoryMicroseconds[(int)DetourOverheadCategory::ReparsePointResolution],
+        detourOverhead.CategoryMicroseconds[(int)DetourOverheadCategory::Reporting],
+        detourOverhead.CategoryMicroseconds[(int)DetourOverheadCategory::HandleOverlayLock],
+        detourStatistics.c_str(),
+        featureCounters.c_str());
+
+    assert(constructReportResult > 0);
+
+    if (constructReportResult > 0)
+    {
+        SendReportString(ReportType_ProcessData, report.get());
+    }
+}
+
+void ReportOutputContentHash(
+    PolicyResult const& policyResult,
+    BYTE const* hash,
+    uint64_t length,
+    FILETIME const& lastWriteTime)
+{
+    if (g_reportFileHandle == NULL || g_reportFileHandle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    PCWSTR fileName = policyResult.GetCanonicalizedPath().GetPathString();
+    if (fileName == nullptr) {
+        fileName = L"";
+    }
+
+    // An invalidated hash is sent as all zeros, which the consumer ignores.
+    wchar_t hashString[OUTPUT_HASH_SIZE * 2 + 1];
+    for (int i = 0; i < OUTPUT_HASH_SIZE; i++) {
+        swprintf_s(hashString + 2 * i, 3, L"%02X", hash != nullptr ? hash[i] : 0);
+    }
+
+    ULARGE_INTEGER lastWrite;
+    lastWrite.LowPart = lastWriteTime.dwLowDateTime;
+    lastWrite.HighPart = lastWriteTime.dwHighDateTime;
+
+    // The path id is only sent if it names the path itself (0 otherwise).
+    // Report type, process id, path id and status (10 characters each), the hash, the length and last write time
+    // (20 characters each), 6 separators, the path, and "\r\n" and null.
+    size_t const reportBufferSize = (10 * 4) + _countof(hashString) + (20 * 2) + 6 + wcslen(fileName) + 3;
+
+    unique_ptr<wchar_t[]> report(new wchar_t[reportBufferSize]);
+    if (report.get() == nullptr)
+    {
+        return;
+    }
+
+    int const constructReportResult = swprintf_s(report.get(), reportBufferSize, L"%u,%lu|%lu|%u|%s|%I64u|%I64u|%s\r\n",
+        ReportType_OutputContentHash,
+        GetCurrentProcessId(),
+        policyResult.IsExactManifestMatch() ? policyResult.GetPathId() : 0,
+        hash != nullptr ? OutputContentHashStatus_Hashed : OutputContentHashStatus_Invalidated,
+        hashString,
+        length,
+        lastWrite.QuadPart,
+        fileName);
 
     assert(constructReportResult > 0);
 
     if (constructReportResult > 0)
     {
-        SendReportString(report.get());
+        SendReportString(ReportType_OutputContentHash, report.get());
     }
 }
@@ -13,6 +13,33 @@
 // FUNCTION DECLARATIONS
 // ----------------------------------------------------------------------------
 
+/// Opens the report sequence counter of the pip when FileAccessManifestExtraFlag::SequenceReports is set.
+/// Failing to open it is not fatal; reports are then sent with a sequence of 0.
+void InitializeReportSequence();
+
+/// Opens the access bitmaps of the pip when FileAccessManifestExtraFlag::UseAccessBitmap is set. Explicitly reported reads and probes of
+/// manifest nodes are then recorded there instead of being reported. Failing to open them is not fatal; such accesses are then reported.
+void InitializeAccessBitmap();
+
+/// Sets up the per-process report buffer when FileAccessManifestExtraFlag::BufferReports is set.
+/// Must be called after the file access manifest has been parsed.
+void InitializeReportBuffer();
+
+/// Writes out all buffered reports. Pass processDetach when called from DllProcessDetach, which also turns buffering off.
+void FlushReportBuffer(bool processDetach);
+
+/// Sets up the queue of reports sent by a background thread when FileAccessManifestExtraFlag::SendReportsAsynchronously is set.
+/// Must be called after the file access manifest has been parsed.
+void InitializeReportQueue();
+
+/// Sends all queued reports from the calling thread. Call it before anything that must observe all reports sent so far,
+/// such as starting a child process. Pass processDetach when called from DllProcessDetach, which also turns queueing off.
+void DrainReportQueue(bool processDetach);
+
+/// Sends the accesses summarized so far when FileAccessManifestExtraFlag::SummarizeFileAccesses is set (or while writing reports
+/// was slow, with FileAccessManifestExtraFlag::AdaptiveReportBackpressure), one report per path, all in a single write. Call it before starting a child process and from DllProcessDetach (passing processDetach).
+void FlushAccessSummary(bool processDetach);
+
 void ReportFileAccess(
     FileOperationContext const& fileOperationContext,
     FileAccessStatus status,
@@ -22,6 +49,10 @@ void ReportFileAccess(
     USN usn,
 	wchar_t const* filter = nullptr);
 
+/// Tells the report cache (see ReportCache.h) that the path of the policy has been deleted or renamed, once the operation
+/// has been reported. Does nothing unless FileAccessManifestExtraFlag::DeduplicateReports or CoalesceOutputWrites is set.
+void InvalidateReportedAccesses(PolicyResult const& policyResult);
+
 void ReportProcessData(
     IO_COUNTERS const&  ioCounters,
     FILETIME const& creationTime,
@@ -32,6 +63,14 @@ void ReportProcessData(
     DWORD const& parentProcessId,
     LONG64 const& detoursMaxMemHeapSize);
 
+/// Reports the content hash of an output computed while it was written (see OutputHashing.h), along with the size and last write
+/// time of the file when the hash was completed. A null hash reports that the hash got invalidated.
+void ReportOutputContentHash(
+    PolicyResult const& policyResult,
+    _In_opt_ BYTE const* hash,
+    uint64_t length,
+    FILETIME const& lastWriteTime);
+
 void ReportProcessDetouringStatus(
     ProcessDetouringStatus status,
     const LPCWSTR lpApplicationName,
@@ -42,4 +81,5 @@ void ReportProcessDetouringStatus(
     const DWORD dwCreationFlags,
     const BOOL detoured,
     const DWORD error,
-    const CreateDetouredProcessStatus createProcessStatus);
+    const CreateDetouredProcessStatus createProcessStatus,
+    const ProcessDetouringTimings* timings = nullptr);
@@ -9,6 +9,17 @@
 #include <string.h>
 #endif // MAC_OS_LIBRARY
 
+// Vectorized kernels for ASCII-only runs of UTF-16 paths. Only built for x86/x64 Windows user mode (the minifilter would
+// have to save the extended processor state around them); everywhere else (and for any non-ASCII character) the scalar
+// NormalizePathChar path is used.
+#if !MAC_OS_LIBRARY && !MAC_OS_SANDBOX && !BUILDXL_MINIFILTER && (defined(_M_X64) || defined(_M_IX86))
+#define PATH_KERNELS_SIMD 1
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#define PATH_KERNELS_SIMD 0
+#endif
+
 // Magic numbers known to provide good hash distributions.
 // See here: http://www.isthe.com/chongo/tech/comp/fnv/
 
@@ -25,39 +36,250 @@ inline static DWORD Fold(DWORD hash, WORD value)
     return _Fold(_Fold(hash, (BYTE)value), (BYTE)(((WORD)value) >> 8));
 }
 
-#pragma warning( push )
-#pragma warning( disable : 4100) // 'nBufferLength' : unreferenced formal parameter // in Release builds
-DWORD WINAPI NormalizeAndHashPath(
-    __in                            PCPathChar pPath,
-    __out_ecount(nBufferLength)     PBYTE pBuffer,
-    __in                            DWORD nBufferLength)
+#if PATH_KERNELS_SIMD
+
+// For characters below 0x80, NormalizePathChar (towupper in the invariant locale) only maps a-z to A-Z.
+// The kernels below rely on that, so their output is identical to the scalar path and hashes stay bit-identical.
+inline static PathChar NormalizeAsciiPathChar(PathChar c)
+{
+    return (c >= L'a' && c <= L'z') ? (PathChar)(c - (L'a' - L'A')) : c;
+}
+
+inline static bool IsAsciiPathChar(PathChar c)
+{
+    return c < 0x80;
+}
+
+inline static __m128i NormalizeAscii128(__m128i v)
+{
+    __m128i isLower = _mm_and_si128(
+        _mm_cmpgt_epi16(v, _mm_set1_epi16(L'a' - 1)),
+        _mm_cmplt_epi16(v, _mm_set1_epi16(L'z' + 1)));
+    return _mm_sub_epi16(v, _mm_and_si128(isLower, _mm_set1_epi16(L'a' - L'A')));
+}
+
+inline static bool IsAscii128(__m128i v)
+{
+    __m128i high = _mm_and_si128(v, _mm_set1_epi16((short)0xFF80));
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF;
+}
+
+inline static __m256i NormalizeAscii256(__m256i v)
+{
+    __m256i isLower = _mm256_and_si256(
+        _mm256_cmpgt_epi16(v, _mm256_set1_epi16(L'a' - 1)),
+        _mm256_cmpgt_epi16(_mm256_set1_epi16(L'z' + 1), v));
+    return _mm256_sub_epi16(v, _mm256_and_si256(isLower, _mm256_set1_epi16(L'a' - L'A')));
+}
+
+inline static bool IsAscii256(__m256i v)
+{
+    __m256i high = _mm256_and_si256(v, _mm256_set1_epi16((short)0xFF80));
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi16(high, _mm256_setzero_si256())) == -1;
+}
+
+// Normalizes characters of pPath into pOutput until the first non-ASCII character; returns how many were normalized.
+typedef size_t (*NormalizeAsciiKernel)(PCPathChar pPath, PPathChar pOutput, size_t nLength);
+
+// Compares normalized characters of pPath to pNormalizedPath until the first non-ASCII character or mismatch;
+// returns how many characters matched.
+typedef size_t (*MatchNormalizedAsciiKernel)(PCPathChar pPath, PCPathChar pNormalizedPath, size_t nLength);
+
+static size_t NormalizeAsciiScalarTail(PCPathChar pPath, PPathChar pOutput, size_t i, size_t nLength)
+{
+    for (; i < nLength && IsAsciiPathChar(pPath[i]); i++) {
+        pOutput[i] = NormalizeAsciiPathChar(pPath[i]);
+    }
+
+    return i;
+}
+
+static size_t MatchNormalizedAsciiScalarTail(PCPathChar pPath, PCPathChar pNormalizedPath, size_t i, size_t nLength)
+{
+    for (; i < nLength && IsAsciiPathChar(pPath[i]) && NormalizeAsciiPathChar(pPath[i]) == pNormalizedPath[i]; i++) {
+    }
+
+    return i;
+}
+
+static size_t NormalizeAsciiSse2(PCPathChar pPath, PPathChar pOutput, size_t nLength)
+{
+    size_t i = 0;
+    for (; i + 8 <= nLength; i += 8) {
+        __m128i v = _mm_loadu_si128((__m128i const*)(pPath + i));
+        if (!IsAscii128(v)) {
+            break;
+        }
+
+        _mm_storeu_si128((__m128i*)(pOutput + i), NormalizeAscii128(v));
+    }
+
+    return NormalizeAsciiScalarTail(pPath, pOutput, i, nLength);
+}
+
+static size_t MatchNormalizedAsciiSse2(PCPathChar pPath, PCPathChar pNormalizedPath, size_t nLength)
 {
-    assert((pathlen(pPath) + 1)*sizeof(PathChar) == nBufferLength);
+    size_t i = 0;
+    for (; i + 8 <= nLength; i += 8) {
+        __m128i v = _mm_loadu_si128((__m128i const*)(pPath + i));
+        __m128i expected = _mm_loadu_si128((__m128i const*)(pNormalizedPath + i));
+        if (!IsAscii128(v) || _mm_movemask_epi8(_mm_cmpeq_epi16(NormalizeAscii128(v), expected)) != 0xFFFF) {
+            break;
+        }
+    }
+
+    return MatchNormalizedAsciiScalarTail(pPath, pNormalizedPath, i, nLength);
+}
+
+static size_t NormalizeAsciiAvx2(PCPathChar pPath, PPathChar pOutput, size_t nLength)
+{
+    size_t i = 0;
+    for (; i + 16 <= nLength; i += 16) {
+        __m256i v = _mm256_loadu_si256((__m256i const*)(pPath + i));
+        if (!IsAscii256(v)) {
+            break;
+        }
+
+        _mm256_storeu_si256((__m256i*)(pOutput + i), NormalizeAscii256(v));
+    }
+
+    // Finish the remaining (fewer than 16, or the non-ASCII block) with the narrower kernel.
+    return i + NormalizeAsciiSse2(pPath + i, pOutput + i, nLength - i);
+}
+
+static size_t MatchNormalizedAsciiAvx2(PCPathChar pPath, PCPathChar pNormalizedPath, size_t nLength)
+{
+    size_t i = 0;
+    for (; i + 16 <= nLength; i += 16) {
+        __m256i v = _mm256_loadu_si256((__m256i const*)(pPath + i));
+        __m256i expected = _mm256_loadu_si256((__m256i const*)(pNormalizedPath + i));
+        if (!IsAscii256(v) || _mm256_movemask_epi8(_mm256_cmpeq_epi16(NormalizeAscii256(v), expected)) != -1) {
+            break;
+        }
+    }
+
+    return i + MatchNormalizedAsciiSse2(pPath + i, pNormalizedPath + i, nLength - i);
+}
+
+static bool IsAvx2Supported()
+{
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+
+    // AVX2 needs the OS to save the YMM registers (OSXSAVE, and XCR0 covering SSE and AVX state).
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+// Chosen when the library is loaded (see SelectPathKernels). Null when the scalar loops are selected.
+static const bool s_isAvx2Supported = IsAvx2Supported();
+static NormalizeAsciiKernel s_normalizeAscii = s_isAvx2Supported ? NormalizeAsciiAvx2 : NormalizeAsciiSse2;
+static MatchNormalizedAsciiKernel s_matchNormalizedAscii = s_isAvx2Supported ? MatchNormalizedAsciiAvx2 : MatchNormalizedAsciiSse2;
+
+// Size of the scratch buffer HashPath normalizes into before folding.
+#define HASH_PATH_CHUNK_LENGTH 64
 
+#endif // PATH_KERNELS_SIMD
+
+// Normalizes the 'length' characters of pPath into pOutput (followed by a null character), and returns their hash.
+static inline DWORD NormalizeAndHashChars(
+    __in_ecount(length)         PCPathChar pPath,
+    __in                        size_t length,
+    __out_ecount(length + 1)    PPathChar pOutput)
+{
     // not the fastest hashing implementation, but gives awesome distribution
     DWORD hash = Fnv1Basis32;
-    size_t i;
-    for (i = 0; pPath[i]; i++) {
+    size_t i = 0;
+#if PATH_KERNELS_SIMD
+    while (s_normalizeAscii != nullptr && i < length) {
+        // Normalize the ASCII run in bulk, then the following non-ASCII character (if any) with the locale.
+        size_t end = i + s_normalizeAscii(pPath + i, pOutput + i, length - i);
+        if (end < length) {
+            pOutput[end] = NormalizePathChar(pPath[end]);
+            end++;
+        }
+
+        for (; i < end; i++) {
+            hash = Fold(hash, pOutput[i]);
+        }
+    }
+#endif // PATH_KERNELS_SIMD
+
+    for (; i < length; i++) {
         PathChar c = NormalizePathChar(pPath[i]);
-        ((PPathChar)pBuffer)[i] = c;
+        pOutput[i] = c;
         hash = Fold(hash, c);
     }
 
-    ((PPathChar)pBuffer)[i] = 0;
-    assert((i + 1)*sizeof(PathChar) == nBufferLength);
+    pOutput[i] = 0;
     assert(hash == HashPath(pPath, i));
     return hash;
 }
+
+#pragma warning( push )
+#pragma warning( disable : 4100) // 'nBufferLength' : unreferenced formal parameter // in Release builds
+DWORD WINAPI NormalizeAndHashPath(
+    __in                            PCPathChar pPath,
+    __out_ecount(nBufferLength)     PBYTE pBuffer,
+    __in                            DWORD nBufferLength)
+{
+    size_t length = pathlen(pPath);
+    assert((length + 1)*sizeof(PathChar) == nBufferLength);
+
+    return NormalizeAndHashChars(pPath, length, (PPathChar)pBuffer);
+}
 #pragma warning( pop )
 
+void WINAPI NormalizeAndHashPaths(
+    __in                        PCPathChar pPaths,
+    __in_ecount(nCount)         size_t const* pLengths,
+    __in                        size_t nCount,
+    __out                       PPathChar pBuffer,
+    __out_ecount(nCount)        DWORD* pHashes)
+{
+    for (size_t i = 0; i < nCount; i++) {
+        pHashes[i] = NormalizeAndHashChars(pPaths, pLengths[i], pBuffer);
+        pPaths += pLengths[i];
+        pBuffer += pLengths[i] + 1;
+    }
+}
+
 DWORD WINAPI HashPath(
     __in_ecount(nLength)        PCPathChar pPath,
     __in                        size_t nLength)
 {
     // not the fastest hashing implementation, but gives awesome distribution
     DWORD hash = Fnv1Basis32;
-    size_t i;
-    for (i = 0; i < nLength; i++) {
+    size_t i = 0;
+#if PATH_KERNELS_SIMD
+    PathChar normalized[HASH_PATH_CHUNK_LENGTH];
+    while (s_normalizeAscii != nullptr && i < nLength) {
+        size_t chunkLength = nLength - i < HASH_PATH_CHUNK_LENGTH ? nLength - i : HASH_PATH_CHUNK_LENGTH;
+        size_t count = s_normalizeAscii(pPath + i, normalized, chunkLength);
+        if (count < chunkLength) {
+            normalized[count] = NormalizePathChar(pPath[i + count]);
+            count++;
+        }
+
+        for (size_t j = 0; j < count; j++) {
+            hash = Fold(hash, normalized[j]);
+        }
+
+        i += count;
+    }
+#endif // PATH_KERNELS_SIMD
+
+    for (; i < nLength; i++) {
         PathChar c = NormalizePathChar(pPath[i]);
         hash = Fold(hash, c);
     }
@@ -75,11 +297,31 @@ BOOL WINAPI AreBuffersEqual(
 
 BOOL WINAPI ArePathsEqual(
     __in_ecount(nLength)        PCPathChar pPath,
-    __in_ecount(nLength + 1)    PCPathChar pNormalizedPath,
+    __in_z                      PCPathChar pNormalizedPath,
     __in                        size_t nLength)
 {
-    size_t i;
-    for (i = 0; i < nLength; i++) {
+    size_t i = 0;
+#if PATH_KERNELS_SIMD
+    // The kernels load whole blocks of both strings, so they may only run over characters both of them have: a normalized path
+    // of another length (whose null terminator may sit right before an unreadable page) is told apart before any block is read.
+    if (s_matchNormalizedAscii != nullptr && wcsnlen(pNormalizedPath, nLength + 1) != nLength) {
+        return false;
+    }
+
+    while (s_matchNormalizedAscii != nullptr && i < nLength) {
+        // The kernel stops at a non-ASCII character or at a mismatch; the locale decides in either case.
+        i += s_matchNormalizedAscii(pPath + i, pNormalizedPath + i, nLength - i);
+        if (i < nLength) {
+            if (NormalizePathChar(pPath[i]) != pNormalizedPath[i]) {
+                return false;
+            }
+
+            i++;
+        }
+    }
+#endif // PATH_KERNELS_SIMD
+
+    for (; i < nLength; i++) {
         PathChar c = NormalizePathChar(pPath[i]);
         if (c != pNormalizedPath[i]) {
             return false;
@@ -89,6 +331,34 @@ BOOL WINAPI ArePathsEqual(
     return !pNormalizedPath[i];
 }
 
+bool SelectPathKernels(PathKernels kernels)
+{
+    switch (kernels) {
+    case PathKernels::Scalar:
+#if PATH_KERNELS_SIMD
+        s_normalizeAscii = nullptr;
+        s_matchNormalizedAscii = nullptr;
+#endif // PATH_KERNELS_SIMD
+        return true;
+#if PATH_KERNELS_SIMD
+    case PathKernels::Sse2:
+        s_normalizeAscii = NormalizeAsciiSse2;
+        s_matchNormalizedAscii = MatchNormalizedAsciiSse2;
+        return true;
+    case PathKernels::Avx2:
+        if (!s_isAvx2Supported) {
+            return false;
+        }
+
+        s_normalizeAscii = NormalizeAsciiAvx2;
+        s_matchNormalizedAscii = MatchNormalizedAsciiAvx2;
+        return true;
+#endif // PATH_KERNELS_SIMD
+    default:
+        return false;
+    }
+}
+
 bool HasPrefix(PCPathChar str, PCPathChar prefix)
 {
     for (size_t i = 0;; i++) {
@@ -272,47 +542,6 @@ bool StringLooksLikeBuildExeTraceLog(PCPathChar str, size_t str_length)
     return HasSuffix(str, str_length, BUILD_EXE_TRACE_FILE);
 }
 
-bool StringLooksLikeMtTempFile(PCPathChar str, size_t str_length, PCPathChar expected_extension)
-{
-    // The file has this format: <pre><uuuu>.TMP, where <pre> can be anything up to 3 characters.
-    // The API call being used by the tool is https://docs.microsoft.com/en-us/windows/desktop/api/fileapi/nf-fileapi-gettempfilenamew
-
-    if (!HasSuffix(str, str_length, expected_extension)) {
-        return false;
-    }
-
-    // Find last "\".
-    size_t beginCharIndex = (size_t) -1;
-
-    for (size_t i = 0; i < str_length; ++i) {
-        if (IsPathCharEqual(str[i], '\\')) {
-            beginCharIndex = i;
-        }
-    }
-
-    // Expect to check "\RCX..".
-    if (beginCharIndex == (size_t) -1 || beginCharIndex + 3 >= str_length) {
-        return false;
-    }
-
-    PathChar c1 = str[beginCharIndex + 1];
-    if (!IsPathCharEqual(c1, 'R')) {
-        return false;
-    }
-    
-    PathChar c2 = str[beginCharIndex + 2];
-    if (!IsPathCharEqual(c2, 'C')) {
-        return false;
-    }
-
-    PathChar c3 = str[beginCharIndex + 3];
-    if (!IsPathCharEqual(c3, 'X')) {
-        return false;
-    }
-
-    return true;
-}
-
 size_t FindFinalPathSeparator(PCPathChar const path) {
     size_t newTerminatorPosition = 0;
     size_t currentPosition = 0;
@@ -69,7 +69,10 @@ extern _locale_t g_invariantLocale;
 
 inline PathChar NormalizePathChar(PathChar c)
 {
-#if !defined(MAC_OS_LIBRARY)
+#if BUILDXL_MINIFILTER
+    // The upcase table of the kernel, which is the one NTFS compares names with
+    return RtlUpcaseUnicodeChar(c);
+#elif !defined(MAC_OS_LIBRARY)
     return (PathChar)_towupper_l(c, g_invariantLocale);
 #elif  MAC_OS_LIBRARY || MAC_OS_SANDBOX
     return utf8proc_toupper(c);
@@ -181,18 +184,42 @@ DWORD WINAPI NormalizeAndHashPath(
     __out_ecount(nBufferLength)     PBYTE pBuffer,
     __in                            DWORD nBufferLength);
 
+// NormalizeAndHashPaths is the batch variant of NormalizeAndHashPath, saving a call per path (e.g. for the fragments of a manifest).
+// The nCount paths are given back to back in pPaths, with the length of each in pLengths. Their normalized versions are stored
+// back to back in pBuffer, each followed by a null character, and their hashes in pHashes.
+void WINAPI NormalizeAndHashPaths(
+    __in                        PCPathChar pPaths,
+    __in_ecount(nCount)         size_t const* pLengths,
+    __in                        size_t nCount,
+    __out                       PPathChar pBuffer,
+    __out_ecount(nCount)        DWORD* pHashes);
+
 // Fast check if two buffers are equal (for use by managed code where memcmp isn't directly available)
 BOOL WINAPI AreBuffersEqual(
     __in_ecount(nBufferLength)    PBYTE pBuffer1,
     __in_ecount(nBufferLength)    PBYTE pBuffer2,
     __in                          DWORD nBufferLength);
 
-// Check if a path is equal to a normalized path, after applying NormalizePathChar to all characters of the un-normalized path
+// Check if a path is equal to a normalized path, after applying NormalizePathChar to all characters of the un-normalized path.
+// The normalized path may be shorter than nLength; only its null terminator bounds it.
 BOOL WINAPI ArePathsEqual(
     __in_ecount(nLength)        PCPathChar pPath,
-    __in_ecount(nLength + 1)    PCPathChar pNormalizedPath,
+    __in_z                      PCPathChar pNormalizedPath,
     __in                        size_t nLength);
 
+// Implementations of HashPath, NormalizeAndHashPath(s) and ArePathsEqual: the NormalizePathChar loops, or the loops over the
+// ASCII runs of the path with the SSE2 or AVX2 kernels (only built for x86/x64 Windows user mode).
+enum class PathKernels
+{
+    Scalar,
+    Sse2,
+    Avx2,
+};
+
+// Selects the implementation the path functions use from then on (by default, the widest kernels the processor supports), e.g.
+// for the benchmarks to compare them. Returns false, leaving the selection unchanged, if it is not available. Not thread-safe.
+bool SelectPathKernels(PathKernels kernels);
+
 // HasPrefix and HasSuffix compare using IsPathCharEqual
 bool HasPrefix(PCPathChar text, PCPathChar prefix);
 bool HasSuffix(PCPathChar str, size_t str_length, PCPathChar suffix);
@@ -211,8 +238,6 @@ bool StringLooksLikeRCTempFile(PCPathChar str, size_t str_length);
 
 bool StringLooksLikeBuildExeTraceLog(PCPathChar str, size_t str_length);
 
-bool StringLooksLikeMtTempFile(PCPathChar str, size_t str_length, PCPathChar expected_extension);
-
 // Find the index of the final directory separator (possibly zero), or zero if none are found.
 size_t FindFinalPathSeparator(PCPathChar const original);
 
@@ -0,0 +1,308 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <stddef.h>
+
+#include "TempRedirection.h"
+#include "DebuggingHelpers.h"
+#include "FeatureCounters.h"
+#include "globals.h"
+
+// The prefix of the NT names of Win32 paths, as RtlDosPathNameToNtPathName makes them.
+#define NT_DOS_DEVICES_PREFIX L"\\??\\"
+#define NT_DOS_DEVICES_PREFIX_LENGTH 4
+
+// The longest name a UNICODE_STRING holds, in bytes.
+#define MAX_UNICODE_STRING_NAME_BYTES 0xFFFE
+
+// The common layout of FILE_RENAME_INFORMATION, FILE_LINK_INFORMATION and their Ex variants (see DetouredFunctions.cpp).
+typedef struct _FILE_RENAME_OR_LINK_INFORMATION {
+    union {
+        BOOLEAN ReplaceIfExists;
+        ULONG Flags;
+    };
+    HANDLE  RootDirectory;
+    ULONG   FileNameLength;
+    WCHAR   FileName[1];
+} FILE_RENAME_OR_LINK_INFORMATION, *PFILE_RENAME_OR_LINK_INFORMATION;
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+// Both point into the manifest, which lives as long as the process. Null when the temp directory is not redirected.
+static wchar_t const* g_tempDirectory = nullptr;
+static size_t g_tempDirectoryLength = 0;
+static wchar_t const* g_redirectedTempDirectory = nullptr;
+static size_t g_redirectedTempDirectoryLength = 0;
+
+// ----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+// ----------------------------------------------------------------------------
+
+/// Indicates if the path (not null-terminated) is the directory or a path below it.
+static bool IsPathInDirectory(PCWSTR path, size_t pathLength, PCWSTR directory, size_t directoryLength)
+{
+    return pathLength >= directoryLength
+        && _wcsnicmp(path, directory, directoryLength) == 0
+        && (pathLength == directoryLength || path[directoryLength] == L'\\');
+}
+
+/// Indicates if the path starts with a drive letter, whose volume a name from the root of the volume leaves out.
+static bool HasDriveLetter(PCWSTR path, size_t pathLength)
+{
+    return pathLength >= 2 && path[1] == L':' && iswalpha(path[0]);
+}
+
+/// Rewrites an NT name (not null-terminated) of the temp directory or of a path below it to the redirected directory.
+static bool TryRedirectNtName(PCWSTR name, size_t nameLength, _Out_ std::wstring& redirected)
+{
+    if (nameLength < NT_DOS_DEVICES_PREFIX_LENGTH + g_tempDirectoryLength
+        || wcsncmp(name, NT_DOS_DEVICES_PREFIX, NT_DOS_DEVICES_PREFIX_LENGTH) != 0)
+    {
+        return false;
+    }
+
+    PCWSTR path = name + NT_DOS_DEVICES_PREFIX_LENGTH;
+    size_t pathLength = nameLength - NT_DOS_DEVICES_PREFIX_LENGTH;
+
+    if (!IsPathInDirectory(path, pathLength, g_tempDirectory, g_tempDirectoryLength))
+    {
+        return false;
+    }
+
+    redirected.reserve(NT_DOS_DEVICES_PREFIX_LENGTH + g_redirectedTempDirectoryLength + pathLength - g_tempDirectoryLength);
+    redirected.assign(name, NT_DOS_DEVICES_PREFIX_LENGTH);
+    redirected.append(g_redirectedTempDirectory, g_redirectedTempDirectoryLength);
+    redirected.append(path + g_tempDirectoryLength, pathLength - g_tempDirectoryLength);
+
+    // A name too long to be redirected is opened where it is, and fails there like it would have in the redirected directory.
+    if (redirected.length() * sizeof(WCHAR) > MAX_UNICODE_STRING_NAME_BYTES)
+    {
+        return false;
+    }
+
+    IncrementFeatureCounter(FeatureCounter::TempPathsRedirected);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+bool InitializeTempRedirection()
+{
+    PCManifestTempRedirection redirection = g_manifestTempRedirection;
+    if (redirection == nullptr || !redirection->IsEnabled())
+    {
+        return false;
+    }
+
+    wchar_t const* tempDirectory = reinterpret_cast<wchar_t const*>(redirection->GetTempDirectory());
+    wchar_t const* redirectedDirectory = reinterpret_cast<wchar_t const*>(redirection->GetRedirectedDirectory());
+    if (tempDirectory[0] == L'\0' || redirectedDirectory[0] == L'\0')
+    {
+        return false;
+    }
+
+    // NOTE: This calls the real CreateDirectoryW(), because the detoured functions have not been installed yet.
+    // The first process of the pip creates the directory; the volume it is on is set up by BuildXL, along with its parent.
+    if (!CreateDirectoryW(redirectedDirectory, nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        Dbg(L"Warning: Could not create the redirected temp directory '%s'. Last Error: %d. The temp directory is not redirected.",
+            redirectedDirectory, (int)GetLastError());
+        return false;
+    }
+
+    g_tempDirectory = tempDirectory;
+    g_tempDirectoryLength = wcslen(tempDirectory);
+    g_redirectedTempDirectory = redirectedDirectory;
+    g_redirectedTempDirectoryLength = wcslen(redirectedDirectory);
+    return true;
+}
+
+bool RedirectsTempDirectory()
+{
+    return g_tempDirectory != nullptr;
+}
+
+wchar_t const* GetRedirectedTempDirectorySource()
+{
+    return g_tempDirectory;
+}
+
+wchar_t const* GetRedirectedTempDirectoryTarget()
+{
+    return g_redirectedTempDirectory;
+}
+
+bool IsInRedirectedTempDirectory(wchar_t const* path)
+{
+    return g_tempDirectory != nullptr
+        && path != nullptr
+        && IsPathInDirectory(path, wcslen(path), g_tempDirectory, g_tempDirectoryLength);
+}
+
+bool TryRedirectPath(wchar_t const* path, _Out_ std::wstring& redirected)
+{
+    redirected.clear();
+    if (!IsInRedirectedTempDirectory(path))
+    {
+        return false;
+    }
+
+    redirected.assign(g_redirectedTempDirectory, g_redirectedTempDirectoryLength);
+    redirected.append(path + g_tempDirectoryLength);
+    IncrementFeatureCounter(FeatureCounter::TempPathsRedirected);
+    return true;
+}
+
+bool TryTranslateRedirectedFileName(
+    HANDLE hFile,
+    FILE_INFO_BY_HANDLE_CLASS fileInformationClass,
+    _Inout_ LPVOID lpFileInformation,
+    DWORD dwBufferSize,
+    _Inout_ BOOL& result,
+    _Inout_ DWORD& error)
+{
+    size_t nameOffset = offsetof(FILE_NAME_INFO, FileName);
+    if (g_tempDirectory == nullptr
+        || (fileInformationClass != FileNameInfo && fileInformationClass != FileNormalizedNameInfo)
+        || lpFileInformation == nullptr
+        || dwBufferSize < nameOffset
+        || (!result && error != ERROR_MORE_DATA)
+        || !HasDriveLetter(g_tempDirectory, g_tempDirectoryLength)
+        || !HasDriveLetter(g_redirectedTempDirectory, g_redirectedTempDirectoryLength))
+    {
+        return false;
+    }
+
+    // On ERROR_MORE_DATA, FileNameLength is the length of the whole name.
+    PFILE_NAME_INFO nameInfo = (PFILE_NAME_INFO)lpFileInformation;
+    std::vector<BYTE> wholeName;
+    if (!result)
+    {
+        wholeName.resize(nameOffset + nameInfo->FileNameLength);
+        if (!Real_GetFileInformationByHandleEx(hFile, fileInformationClass, wholeName.data(), (DWORD)wholeName.size()))
+        {
+            return false;
+        }
+
+        nameInfo = (PFILE_NAME_INFO)wholeName.data();
+    }
+
+    // The names are from the root of the volume: both directories without their drive letter.
+    PCWSTR name = nameInfo->FileName;
+    size_t nameLength = nameInfo->FileNameLength / sizeof(WCHAR);
+    if (!IsPathInDirectory(name, nameLength, g_redirectedTempDirectory + 2, g_redirectedTempDirectoryLength - 2))
+    {
+        return false;
+    }
+
+    std::wstring translated(g_tempDirectory + 2, g_tempDirectoryLength - 2);
+    translated.append(name + g_redirectedTempDirectoryLength - 2, nameLength - (g_redirectedTempDirectoryLength - 2));
+
+    // As the real function does, a buffer too small gets the length of the whole name, and as much of it as fits.
+    PFILE_NAME_INFO callerNameInfo = (PFILE_NAME_INFO)lpFileInformation;
+    size_t translatedBytes = translated.length() * sizeof(WCHAR);
+    size_t room = (dwBufferSize - nameOffset) & ~(sizeof(WCHAR) - 1);
+    callerNameInfo->FileNameLength = (DWORD)translatedBytes;
+    memcpy_s(callerNameInfo->FileName, room, translated.c_str(), translatedBytes < room ? translatedBytes : room);
+
+    result = translatedBytes <= room;
+    error = result ? ERROR_SUCCESS : ERROR_MORE_DATA;
+    return true;
+}
+
+void ReopenCurrentDirectoryInTempDirectory()
+{
+    if (g_tempDirectory == nullptr)
+    {
+        return;
+    }
+
+    DWORD lastError = GetLastError();
+
+    std::vector<wchar_t> currentDirectory(MAX_PATH);
+    DWORD length = GetCurrentDirectoryW((DWORD)currentDirectory.size(), currentDirectory.data());
+    if (length >= currentDirectory.size())
+    {
+        currentDirectory.resize(length);
+        length = GetCurrentDirectoryW((DWORD)currentDirectory.size(), currentDirectory.data());
+    }
+
+    // The current directory ends with a separator only when it is the root of a volume.
+    if (length != 0
+        && length < currentDirectory.size()
+        && IsPathInDirectory(currentDirectory.data(), length, g_tempDirectory, g_tempDirectoryLength))
+    {
+        // The real function opens the directory with the detoured NtOpenFile, which redirects it.
+        if (!Real_SetCurrentDirectoryW(currentDirectory.data()))
+        {
+            Dbg(L"Warning: Could not reopen the current directory '%s' in the redirected temp directory. Last Error: %d.",
+                currentDirectory.data(), (int)GetLastError());
+        }
+    }
+
+    SetLastError(lastError);
+}
+
+RedirectedObjectAttributes::RedirectedObjectAttributes(POBJECT_ATTRIBUTES objectAttributes)
+    : m_original(objectAttributes), m_redirected(false)
+{
+    if (g_tempDirectory == nullptr
+        || objectAttributes == nullptr
+        || objectAttributes->RootDirectory != NULL
+        || objectAttributes->ObjectName == nullptr
+        || objectAttributes->ObjectName->Buffer == nullptr)
+    {
+        return;
+    }
+
+    PCUNICODE_STRING name = objectAttributes->ObjectName;
+    if (!TryRedirectNtName(name->Buffer, name->Length / sizeof(WCHAR), m_nameBuffer))
+    {
+        return;
+    }
+
+    m_name.Buffer = &m_nameBuffer[0];
+    m_name.Length = (USHORT)(m_nameBuffer.length() * sizeof(WCHAR));
+    m_name.MaximumLength = m_name.Length;
+
+    m_objectAttributes = *objectAttributes;
+    m_objectAttributes.ObjectName = &m_name;
+    m_redirected = true;
+}
+
+RedirectedTargetInformation::RedirectedTargetInformation(PVOID fileInformation, ULONG length, bool namesTarget)
+    : m_original(fileInformation), m_originalLength(length)
+{
+    size_t nameOffset = offsetof(FILE_RENAME_OR_LINK_INFORMATION, FileName);
+    if (g_tempDirectory == nullptr || !namesTarget || fileInformation == nullptr || length < nameOffset)
+    {
+        return;
+    }
+
+    PFILE_RENAME_OR_LINK_INFORMATION information = (PFILE_RENAME_OR_LINK_INFORMATION)fileInformation;
+    if (information->RootDirectory != NULL || nameOffset + information->FileNameLength > length)
+    {
+        return;
+    }
+
+    std::wstring redirected;
+    if (!TryRedirectNtName(information->FileName, information->FileNameLength / sizeof(WCHAR), redirected))
+    {
+        return;
+    }
+
+    // The real function checks the length against the size of the structure, which may be more than the name needs.
+    size_t size = nameOffset + redirected.length() * sizeof(WCHAR);
+    m_buffer.resize(size < sizeof(FILE_RENAME_OR_LINK_INFORMATION) ? sizeof(FILE_RENAME_OR_LINK_INFORMATION) : size);
+    memcpy_s(m_buffer.data(), m_buffer.size(), information, nameOffset);
+
+    PFILE_RENAME_OR_LINK_INFORMATION redirectedInformation = (PFILE_RENAME_OR_LINK_INFORMATION)m_buffer.data();
+    redirectedInformation->FileNameLength = (ULONG)(redirected.length() * sizeof(WCHAR));
+    memcpy_s(redirectedInformation->FileName, m_buffer.size() - nameOffset, redirected.c_str(), redirectedInformation->FileNameLength);
+}
@@ -0,0 +1,121 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Redirection of the untracked temp directory of a pip to a directory on another volume (see ManifestTempRedirection).
+//
+// Tools write large amounts of scratch data to their temp directory, which is normally on the same volume as the sources and
+// outputs of the build. When the manifest redirects the temp directory, the names the ntdll functions open files with
+// (NtCreateFile, NtOpenFile, ZwCreateFile, ZwOpenFile, NtQueryAttributesFile, NtQueryFullAttributesFile) and the targets of
+// renames and hard links (ZwSetInformationFile) are rewritten from the temp directory to the redirected directory right before
+// the real functions are called, whether or not a detour higher on the stack already handles the call. Everything above these
+// functions, the Win32 functions and the detours themselves included, keeps seeing the temp directory.
+//
+// The other way around, the redirected directory is added to the path translations of the manifest, translated to the temp
+// directory. The paths returned by GetFinalPathNameByHandle are thus those of the temp directory, and the policy of a path the
+// detours only find from a handle is the one of the temp directory.
+//
+// Paths are only redirected when they are absolute (\??\ names without a root directory); names relative to a handle opened in
+// the redirected directory need no redirection.
+//
+// A few calls do not go through these functions, and are redirected where the detours see them:
+// - Process creation opens the image with a system call of its own: CreateProcess starts images given by path (lpApplicationName,
+//   or the first token of the command line) from the redirected directory. Images found by searching (bare names found in the
+//   current directory or the PATH) are not redirected.
+// - The names returned by FileNameInfo and FileNormalizedNameInfo queries (GetFileInformationByHandleEx) are translated back to the
+//   temp directory. Direct NtQueryInformationFile calls still return the redirected name.
+// - The redirected directory is on another volume, so MoveFileWithProgress (and the MoveFile functions) copies the files it moves
+//   between it and the rest of the build, even without MOVEFILE_COPY_ALLOWED. Directories cannot be moved across volumes, nor can
+//   files be renamed by handle (SetFileInformationByHandle, NtSetInformationFile) or hard linked across them: those fail with
+//   ERROR_NOT_SAME_DEVICE, which is why the redirection is only for pips that opt in.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <winternl.h>
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Reads the redirection from g_manifestTempRedirection and creates the redirected directory if it does not exist yet. Failing to
+/// create it leaves the temp directory where it is. Returns true if the temp directory is redirected.
+/// Must be called while parsing the manifest, before the detours are attached.
+bool InitializeTempRedirection();
+
+/// Indicates if the temp directory is redirected.
+bool RedirectsTempDirectory();
+
+/// The temp directory, or null if it is not redirected.
+wchar_t const* GetRedirectedTempDirectorySource();
+
+/// The directory the temp directory is redirected to, or null if it is not redirected.
+wchar_t const* GetRedirectedTempDirectoryTarget();
+
+/// Indicates if the path (canonicalized, without a type prefix) is the temp directory or a path below it, while it is redirected.
+bool IsInRedirectedTempDirectory(wchar_t const* path);
+
+/// Rewrites a path (canonicalized, without a type prefix) of the temp directory or of a path below it to the redirected directory.
+/// Returns false if the temp directory is not redirected or the path is not in it.
+bool TryRedirectPath(wchar_t const* path, _Out_ std::wstring& redirected);
+
+/// Translates the name returned by a FileNameInfo or FileNormalizedNameInfo query (a path from the root of the volume), given the
+/// result and error of the real GetFileInformationByHandleEx, from the redirected directory back to the temp directory. The name is
+/// queried again when the buffer of the caller was too small for it. Returns false, leaving the result and the buffer as they are,
+/// when the name is not in the redirected directory.
+bool TryTranslateRedirectedFileName(
+    HANDLE hFile,
+    FILE_INFO_BY_HANDLE_CLASS fileInformationClass,
+    _Inout_ LPVOID lpFileInformation,
+    DWORD dwBufferSize,
+    _Inout_ BOOL& result,
+    _Inout_ DWORD& error);
+
+/// Sets the current directory again if it is in the temp directory. A child process opens its current directory before the detours
+/// are attached, so relative names opened under it would otherwise not be redirected. Must be called once the detours are attached.
+void ReopenCurrentDirectoryInTempDirectory();
+
+// ----------------------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------------------
+
+/// The object attributes to call a real ntdll function with: the given ones, or a copy naming the redirected directory when
+/// they name a file in the temp directory.
+class RedirectedObjectAttributes
+{
+public:
+    explicit RedirectedObjectAttributes(POBJECT_ATTRIBUTES objectAttributes);
+
+    POBJECT_ATTRIBUTES Get() { return m_redirected ? &m_objectAttributes : m_original; }
+
+private:
+    POBJECT_ATTRIBUTES m_original;
+    bool m_redirected;
+    OBJECT_ATTRIBUTES m_objectAttributes;
+    UNICODE_STRING m_name;
+    std::wstring m_nameBuffer;
+
+    RedirectedObjectAttributes(const RedirectedObjectAttributes&) = delete;
+    RedirectedObjectAttributes& operator=(const RedirectedObjectAttributes&) = delete;
+};
+
+/// The information to call the real ZwSetInformationFile with, for the classes naming a target (renames and hard links, whose
+/// structures share their layout): the given one, or a copy naming the redirected directory when the target is in the temp
+/// directory. The information of other classes (namesTarget false) is passed as it is.
+class RedirectedTargetInformation
+{
+public:
+    RedirectedTargetInformation(PVOID fileInformation, ULONG length, bool namesTarget);
+
+    PVOID Get() { return m_buffer.empty() ? m_original : m_buffer.data(); }
+
+    ULONG GetLength() const { return m_buffer.empty() ? m_originalLength : (ULONG)m_buffer.size(); }
+
+private:
+    PVOID m_original;
+    ULONG m_originalLength;
+    std::vector<BYTE> m_buffer;
+
+    RedirectedTargetInformation(const RedirectedTargetInformation&) = delete;
+    RedirectedTargetInformation& operator=(const RedirectedTargetInformation&) = delete;
+};
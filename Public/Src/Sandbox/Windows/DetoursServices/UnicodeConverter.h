@@ -6,14 +6,60 @@
 #include "buildXL_mem.h"
 #include "DebuggingHelpers.h"
 
+#if defined(_M_X64) || defined(_M_IX86)
+#define UNICODE_CONVERTER_SIMD 1
+#include <emmintrin.h>
+#else
+#define UNICODE_CONVERTER_SIMD 0
+#endif
+
 // ----------------------------------------------------------------------------
 // CLASSES
 // ----------------------------------------------------------------------------
 
+// Converts the ANSI arguments of the A-suffixed detours to UTF-16.
+// Strings of up to MAX_PATH characters that are plain ASCII, which is almost all paths, are widened into inline storage.
+// Every ANSI code page maps ASCII to the same code points, so that is what MultiByteToWideChar would produce for them.
+// Longer or non-ASCII strings go through MultiByteToWideChar into a heap buffer.
 class UnicodeConverter
 {
 private:
     wchar_t *m_str;
+    wchar_t m_inline[MAX_PATH + 1];
+
+    // Widens s[0, length) into m_inline if it is all ASCII. The terminator is not written.
+    bool TryWidenAscii(PCSTR s, size_t length)
+    {
+        size_t i = 0;
+
+#if UNICODE_CONVERTER_SIMD
+        __m128i const zero = _mm_setzero_si128();
+        for (; i + 16 <= length; i += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + i));
+            if (_mm_movemask_epi8(bytes) != 0)
+            {
+                return false;
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(m_inline + i), _mm_unpacklo_epi8(bytes, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(m_inline + i + 8), _mm_unpackhi_epi8(bytes, zero));
+        }
+#endif
+
+        for (; i < length; i++)
+        {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            if (c >= 0x80)
+            {
+                return false;
+            }
+
+            m_inline[i] = static_cast<wchar_t>(c);
+        }
+
+        return true;
+    }
 
 public:
     UnicodeConverter(PCSTR s)
@@ -21,27 +67,34 @@ public:
         if (!s)
         {
             m_str = NULL;
+            return;
         }
-        else
+
+        size_t length = strlen(s);
+        if (length <= MAX_PATH && TryWidenAscii(s, length))
         {
-            int charsRequired = MultiByteToWideChar(CP_ACP, 0, s, -1, NULL, 0);
-            if (charsRequired <= 0) {
-                Dbg(L"UnicodeConverter::UnicodeConverter - Failed to convert string:2.");
-                wprintf(L"Error: UnicodeConverter::UnicodeConverter - Failed to convert string:2.");
-                fwprintf(stderr, L"Error: UnicodeConverter::UnicodeConverter - Failed to convert string:2.");
-                HandleDetoursInjectionAndCommunicationErrors(DETOURS_UNICODE_CONVERSION_18, L"Failure writing message to pipe:2: exit(-60).", DETOURS_UNICODE_LOG_MESSAGE_18);
-            }
+            m_inline[length] = L'\0';
+            m_str = m_inline;
+            return;
+        }
 
-            m_str = new wchar_t[(size_t)charsRequired];
-            assert(m_str);
+        int charsRequired = MultiByteToWideChar(CP_ACP, 0, s, -1, NULL, 0);
+        if (charsRequired <= 0) {
+            Dbg(L"UnicodeConverter::UnicodeConverter - Failed to convert string:2.");
+            wprintf(L"Error: UnicodeConverter::UnicodeConverter - Failed to convert string:2.");
+            fwprintf(stderr, L"Error: UnicodeConverter::UnicodeConverter - Failed to convert string:2.");
+            HandleDetoursInjectionAndCommunicationErrors(DETOURS_UNICODE_CONVERSION_18, L"Failure writing message to pipe:2: exit(-60).", DETOURS_UNICODE_LOG_MESSAGE_18);
+        }
 
-            int charsConverted = MultiByteToWideChar(CP_ACP, 0, s, -1, m_str, charsRequired);
-            if (charsConverted != charsRequired) {
-                Dbg(L"UnicodeConverter::UnicodeConverter - Failed to convert string:1.");
-                wprintf(L"Error: UnicodeConverter::UnicodeConverter - Failed to convert string:1.");
-                fwprintf(stderr, L"Error: UnicodeConverter::UnicodeConverter - Failed to convert string:1.");
-                HandleDetoursInjectionAndCommunicationErrors(DETOURS_UNICODE_CONVERSION_18, L"Failure writing message to pipe:1: exit(-60).", DETOURS_UNICODE_LOG_MESSAGE_18);
-            }
+        m_str = new wchar_t[(size_t)charsRequired];
+        assert(m_str);
+
+        int charsConverted = MultiByteToWideChar(CP_ACP, 0, s, -1, m_str, charsRequired);
+        if (charsConverted != charsRequired) {
+            Dbg(L"UnicodeConverter::UnicodeConverter - Failed to convert string:1.");
+            wprintf(L"Error: UnicodeConverter::UnicodeConverter - Failed to convert string:1.");
+            fwprintf(stderr, L"Error: UnicodeConverter::UnicodeConverter - Failed to convert string:1.");
+            HandleDetoursInjectionAndCommunicationErrors(DETOURS_UNICODE_CONVERSION_18, L"Failure writing message to pipe:1: exit(-60).", DETOURS_UNICODE_LOG_MESSAGE_18);
         }
     }
 
@@ -54,7 +107,10 @@ public:
 
     ~UnicodeConverter()
     {
-        delete[] m_str;
+        if (m_str != m_inline)
+        {
+            delete[] m_str;
+        }
     }
 
     PWSTR GetMutableString()
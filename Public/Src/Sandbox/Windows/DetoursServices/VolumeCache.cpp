@@ -0,0 +1,172 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "VolumeCache.h"
+#include "globals.h"
+#include "MemoryPressure.h"
+#include "ReparsePointCache.h"
+
+// Beyond this many directories the cache starts over rather than growing without bound.
+#define VOLUME_CACHE_MAX_DIRECTORIES 16384
+
+typedef std::unordered_map<std::wstring, VolumeInformation, CaseInsensitivePathHash, CaseInsensitivePathEqual> VolumesByRootMap;
+// Null for directories whose volume could not be determined.
+typedef std::unordered_map<std::wstring, VolumeInformation const*, CaseInsensitivePathHash, CaseInsensitivePathEqual> VolumesByDirectoryMap;
+
+// The volumes are never removed, so the directories can point at them (the nodes of the map do not move).
+static SRWLOCK g_volumeCacheLock = SRWLOCK_INIT;
+static VolumesByRootMap* g_volumesByRoot = nullptr;
+static VolumesByDirectoryMap* g_volumesByDirectory = nullptr;
+
+/// Looks up a directory; true if it was resolved already, in which case volume is null if it has no known volume.
+static bool TryGetVolumeOfDirectory(std::wstring const& directory, _Out_ VolumeInformation const*& volume)
+{
+    bool found = false;
+
+    AcquireSRWLockShared(&g_volumeCacheLock);
+
+    if (g_volumesByDirectory != nullptr)
+    {
+        VolumesByDirectoryMap::const_iterator it = g_volumesByDirectory->find(directory);
+        if (it != g_volumesByDirectory->end())
+        {
+            volume = it->second;
+            found = true;
+        }
+    }
+
+    ReleaseSRWLockShared(&g_volumeCacheLock);
+
+    return found;
+}
+
+/// Asks the file system for the volume root of a directory, and for the volume behind that root if it is not known yet.
+static VolumeInformation const* ResolveVolumeOfDirectory(std::wstring const& directory)
+{
+    // The volume root is never longer than the path it is found for, plus a trailing separator.
+    std::vector<wchar_t> rootBuffer(directory.length() + 2);
+    if (!Real_GetVolumePathNameW(directory.c_str(), rootBuffer.data(), (DWORD)rootBuffer.size()))
+    {
+        return nullptr;
+    }
+
+    std::wstring root(rootBuffer.data());
+    VolumeInformation const* volume = nullptr;
+
+    AcquireSRWLockShared(&g_volumeCacheLock);
+
+    if (g_volumesByRoot != nullptr)
+    {
+        VolumesByRootMap::const_iterator it = g_volumesByRoot->find(root);
+        if (it != g_volumesByRoot->end())
+        {
+            volume = &it->second;
+        }
+    }
+
+    ReleaseSRWLockShared(&g_volumeCacheLock);
+
+    if (volume != nullptr)
+    {
+        return volume;
+    }
+
+    VolumeInformation information;
+    if (!GetVolumeInformationW(root.c_str(), nullptr, 0, &information.SerialNumber, nullptr, &information.FileSystemFlags, nullptr, 0))
+    {
+        return nullptr;
+    }
+
+    AcquireSRWLockExclusive(&g_volumeCacheLock);
+
+    if (g_volumesByRoot == nullptr)
+    {
+        g_volumesByRoot = new VolumesByRootMap();
+    }
+
+    // A racing thread may have added the volume already; either answer is as good.
+    volume = &g_volumesByRoot->emplace(std::move(root), information).first->second;
+
+    ReleaseSRWLockExclusive(&g_volumeCacheLock);
+
+    return volume;
+}
+
+bool TryGetVolumeInformation(CanonicalizedPath const& path, _Out_ VolumeInformation& volume)
+{
+    // Device paths (\\.\) are not on volumes. Without its prefix, a \\?\ path is only a path GetVolumePathNameW takes if it
+    // starts with a drive letter (\\?\UNC\ paths do not).
+    if (path.Type != PathType::Win32 && path.Type != PathType::Win32Nt)
+    {
+        return false;
+    }
+
+    wchar_t const* pathString = path.GetPathStringWithoutTypePrefix();
+    if (path.Type == PathType::Win32Nt && (pathString[0] == L'\0' || pathString[1] != L':'))
+    {
+        return false;
+    }
+
+    // The directory keeps its trailing separator, so that a volume root is a directory like any other.
+    wchar_t const* lastSeparator = wcsrchr(pathString, L'\\');
+    if (lastSeparator == nullptr)
+    {
+        return false;
+    }
+
+    std::wstring directory(pathString, lastSeparator - pathString + 1);
+
+    VolumeInformation const* found;
+    if (!TryGetVolumeOfDirectory(directory, found))
+    {
+        found = ResolveVolumeOfDirectory(directory);
+
+        AcquireSRWLockExclusive(&g_volumeCacheLock);
+
+        if (g_volumesByDirectory == nullptr)
+        {
+            g_volumesByDirectory = new VolumesByDirectoryMap();
+            EnsureMemoryPressureMonitorStarted();
+        }
+        else if (g_volumesByDirectory->size() >= VOLUME_CACHE_MAX_DIRECTORIES)
+        {
+            g_volumesByDirectory->clear();
+        }
+
+        (*g_volumesByDirectory)[std::move(directory)] = found;
+
+        ReleaseSRWLockExclusive(&g_volumeCacheLock);
+    }
+
+    if (found == nullptr)
+    {
+        return false;
+    }
+
+    volume = *found;
+    return true;
+}
+
+size_t ShrinkVolumeCache(size_t floor)
+{
+    size_t removed = 0;
+
+    AcquireSRWLockExclusive(&g_volumeCacheLock);
+
+    // Nothing tells the directories in use apart; any of them is resolved again in one call.
+    while (g_volumesByDirectory != nullptr && g_volumesByDirectory->size() > floor)
+    {
+        g_volumesByDirectory->erase(g_volumesByDirectory->begin());
+        removed++;
+    }
+
+    ReleaseSRWLockExclusive(&g_volumeCacheLock);
+
+    return removed;
+}
@@ -0,0 +1,46 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Per-process cache of the volumes the files of the process live on: their serial number and file system flags, read once
+// per volume root, and the volume root of every directory looked up, resolved once per directory.
+//
+// The USN and file id queries made after opening a file, and block cloning, need the capabilities and serial number of the
+// volume of the file; asking the volume for them (GetVolumeInformationByHandleW) costs a round trip to the file system per
+// call, and the USN query itself is wasted on a volume without a change journal. With the cache, the volume of a file is
+// found by the directory it is in, a prefix of its path: mounted folders make the longest known volume root prefix of a path
+// an unreliable answer, but all the files of a directory are on the same volume.
+//
+// Volumes mounted or dismounted while the process runs are not seen, just like volumes never go away from the volume roots.
+
+#pragma once
+
+#include "DataTypes.h"
+#include "CanonicalizedPath.h"
+
+// ----------------------------------------------------------------------------
+// STRUCTS
+// ----------------------------------------------------------------------------
+
+struct VolumeInformation
+{
+    DWORD SerialNumber;
+    // FILE_SUPPORTS_* and other FILE_* flags, as returned by GetVolumeInformationW.
+    DWORD FileSystemFlags;
+
+    bool SupportsUsnJournal() const { return (FileSystemFlags & FILE_SUPPORTS_USN_JOURNAL) != 0; }
+    bool SupportsBlockRefcounting() const { return (FileSystemFlags & FILE_SUPPORTS_BLOCK_REFCOUNTING) != 0; }
+};
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+/// Finds the volume of the directory containing a path, i.e., the volume a file at that path is on (for a mounted folder, this
+/// is the volume it is mounted in, not the mounted volume). Fails for paths whose volume cannot be determined, such as device
+/// paths, and then again for the other paths of the same directory.
+/// Must be called in a DetouredScope, since resolving a directory the first time goes through detoured functions.
+bool TryGetVolumeInformation(CanonicalizedPath const& path, _Out_ VolumeInformation& volume);
+
+/// Forgets the volume roots of the directories when there are more than the given number of them; the volumes themselves are
+/// kept. Returns the number of directories forgotten.
+size_t ShrinkVolumeCache(size_t floor);
@@ -0,0 +1,157 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "stdafx.h"
+
+#include "buildXL_mem.h"
+
+// ----------------------------------------------------------------------------
+// DEFINES
+// ----------------------------------------------------------------------------
+
+// Number of blocks a thread caches per size class. Half of it moves at a time between a magazine and the depot.
+#define DD_MAGAZINE_SIZE 32
+
+// Size of the slabs blocks are carved out of.
+#define DD_SLAB_SIZE (64 * 1024)
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+typedef struct DD_MAGAZINE_t
+{
+    uint32_t Count;
+    DD_ALLOCATION_PREFIX* Blocks[DD_MAGAZINE_SIZE];
+} DD_MAGAZINE;
+
+// Per-thread block caches. Allocations and frees that hit them take no interlocked operation at all.
+static __declspec(thread) DD_MAGAZINE t_magazines[DD_SIZE_CLASS_COUNT];
+
+// Blocks not cached by any thread. A zeroed SLIST_HEADER is an empty list, so no initialization is needed.
+// The SLIST_ENTRY of a block lives in its (MEMORY_ALLOCATION_ALIGNMENT aligned) prefix while the block is in a depot.
+static SLIST_HEADER g_depots[DD_SIZE_CLASS_COUNT];
+
+static_assert(sizeof(SLIST_ENTRY) <= sizeof(DD_ALLOCATION_PREFIX), "A depot entry must fit in the allocation prefix");
+
+// ----------------------------------------------------------------------------
+// STATIC FUNCTIONS
+// ----------------------------------------------------------------------------
+
+static inline size_t BlockSize(uint32_t sizeClass)
+{
+    return sizeof(DD_ALLOCATION_PREFIX) + ((size_t)DD_MIN_POOLED_ALLOCATION_SIZE << sizeClass);
+}
+
+/// <summary>
+/// Fills an empty magazine up to half, from the depot if it has blocks and from a new slab otherwise.
+/// </summary>
+static void RefillMagazine(uint32_t sizeClass, DD_MAGAZINE* magazine)
+{
+    while (magazine->Count < DD_MAGAZINE_SIZE / 2)
+    {
+        PSLIST_ENTRY entry = InterlockedPopEntrySList(&g_depots[sizeClass]);
+        if (entry == nullptr)
+        {
+            break;
+        }
+
+        magazine->Blocks[magazine->Count++] = (DD_ALLOCATION_PREFIX*)entry;
+    }
+
+    if (magazine->Count > 0)
+    {
+        return;
+    }
+
+    char* slab = (char*)HeapAlloc(g_hPrivateHeap, 0, DD_SLAB_SIZE);
+    if (slab == nullptr)
+    {
+        return;
+    }
+
+    size_t blockSize = BlockSize(sizeClass);
+    size_t blockCount = DD_SLAB_SIZE / blockSize;
+
+    for (size_t i = 0; i < blockCount; i++)
+    {
+        DD_ALLOCATION_PREFIX* block = (DD_ALLOCATION_PREFIX*)(slab + i * blockSize);
+        if (magazine->Count < DD_MAGAZINE_SIZE / 2)
+        {
+            magazine->Blocks[magazine->Count++] = block;
+        }
+        else
+        {
+            InterlockedPushEntrySList(&g_depots[sizeClass], (PSLIST_ENTRY)block);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+void* dd_pool_malloc(uint32_t sizeClass)
+{
+    assert(sizeClass < DD_SIZE_CLASS_COUNT);
+    DD_MAGAZINE* magazine = &t_magazines[sizeClass];
+
+    if (magazine->Count == 0)
+    {
+        RefillMagazine(sizeClass, magazine);
+        if (magazine->Count == 0)
+        {
+            return nullptr;
+        }
+    }
+
+    DD_ALLOCATION_PREFIX* block = magazine->Blocks[--magazine->Count];
+    size_t size = (size_t)DD_MIN_POOLED_ALLOCATION_SIZE << sizeClass;
+
+    block->SizeClass = sizeClass;
+    block->Reserved = 0;
+    block->Size = size;
+
+    // Keep the HEAP_ZERO_MEMORY semantics of the heap path.
+    ZeroMemory(block + 1, size);
+    return block + 1;
+}
+
+void dd_pool_free(DD_ALLOCATION_PREFIX* prefix)
+{
+    uint32_t sizeClass = prefix->SizeClass;
+    assert(sizeClass < DD_SIZE_CLASS_COUNT);
+    DD_MAGAZINE* magazine = &t_magazines[sizeClass];
+
+    if (magazine->Count == DD_MAGAZINE_SIZE)
+    {
+        // Hand half of the blocks to other threads. Keeping the other half avoids bouncing on alternating alloc/free.
+        while (magazine->Count > DD_MAGAZINE_SIZE / 2)
+        {
+            InterlockedPushEntrySList(&g_depots[sizeClass], (PSLIST_ENTRY)magazine->Blocks[--magazine->Count]);
+        }
+    }
+
+    magazine->Blocks[magazine->Count++] = prefix;
+}
+
+void dd_release_thread_cache()
+{
+    for (uint32_t sizeClass = 0; sizeClass < DD_SIZE_CLASS_COUNT; sizeClass++)
+    {
+        DD_MAGAZINE* magazine = &t_magazines[sizeClass];
+        while (magazine->Count > 0)
+        {
+            InterlockedPushEntrySList(&g_depots[sizeClass], (PSLIST_ENTRY)magazine->Blocks[--magazine->Count]);
+        }
+    }
+}
+
+void dd_reset_pools()
+{
+    for (uint32_t sizeClass = 0; sizeClass < DD_SIZE_CLASS_COUNT; sizeClass++)
+    {
+        t_magazines[sizeClass].Count = 0;
+        InterlockedFlushSList(&g_depots[sizeClass]);
+    }
+}
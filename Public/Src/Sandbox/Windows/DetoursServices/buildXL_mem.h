@@ -13,29 +13,103 @@ extern volatile LONG64 g_detoursHeapAllocatedMemoryInBytes;
 // This file defines a memory interface for BuildXL Detours, using the dd_ prefix.
 // The general allocation APIs are stubbed out and one should call only the dd_* methods.
 // The memory allocation done from the BuildXL Detours library happens on a private heap.
+//
+// Small allocations (up to DD_MAX_POOLED_ALLOCATION_SIZE bytes) are served from size-class pools rather than by a
+// HeapAlloc each. Blocks of a size class are carved out of slabs taken from the private heap, cached per thread in a
+// small magazine, and exchanged with the other threads through a lock-free depot list. Slabs are never returned to
+// the heap. Every allocation carries a DD_ALLOCATION_PREFIX recording its size class, so that dd_free knows where the
+// block goes and the process data accounting does not need a HeapSize call. Memory is zeroed in either case.
+
+// Size classes are powers of two from DD_MIN_POOLED_ALLOCATION_SIZE to DD_MAX_POOLED_ALLOCATION_SIZE.
+#define DD_MIN_POOLED_ALLOCATION_SIZE 16
+#define DD_MAX_POOLED_ALLOCATION_SIZE 512
+#define DD_SIZE_CLASS_COUNT 6
+
+// Size class of allocations that go to the private heap directly.
+#define DD_LARGE_ALLOCATION 0xFFFFFFFF
+
+typedef struct DD_ALLOCATION_PREFIX_t
+{
+    // Index of the size class, or DD_LARGE_ALLOCATION.
+    uint32_t SizeClass;
+    uint32_t Reserved;
+    // Usable size of the allocation in bytes.
+    uint64_t Size;
+} DD_ALLOCATION_PREFIX;
+
+// Keeps the memory handed out aligned to MEMORY_ALLOCATION_ALIGNMENT.
+static_assert(sizeof(DD_ALLOCATION_PREFIX) % MEMORY_ALLOCATION_ALIGNMENT == 0, "The allocation prefix must preserve the heap alignment");
+
+// Implemented in buildXL_mem.cpp.
+void* dd_pool_malloc(uint32_t sizeClass);
+void dd_pool_free(DD_ALLOCATION_PREFIX* prefix);
+
+// Returns the blocks cached by the calling thread to the shared depots. Called when a thread detaches.
+void dd_release_thread_cache();
+
+// Forgets all pooled blocks. Called right before the private heap is destroyed.
+void dd_reset_pools();
+
+inline void dd_account_allocation(LONG64 size)
+{
+    LONG64 allocatedSize = InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, size);
+    LONG64 localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
+
+    // Update the global MaxAllocated heap only if the current allocated heap is bigger than what is recorded.
+    while (allocatedSize > localMax)
+    {
+        InterlockedCompareExchange64(&g_detoursMaxAllocatedMemoryInBytes, allocatedSize, localMax);
+        localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
+    }
+}
+
+inline uint32_t dd_size_class(size_t size)
+{
+    uint32_t sizeClass = 0;
+    size_t classSize = DD_MIN_POOLED_ALLOCATION_SIZE;
+    while (classSize < size)
+    {
+        classSize <<= 1;
+        sizeClass++;
+    }
+
+    return sizeClass;
+}
 
 // malloc and free versions for this DLL.
 inline void* dd_malloc(size_t size)
 {
     assert(g_hPrivateHeap != nullptr);
-    void* ret = HeapAlloc(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, size);
+    void* ret;
 
-    if (ShouldLogProcessData())
+    if (size <= DD_MAX_POOLED_ALLOCATION_SIZE)
     {
-        // Get the size since alignment matters and the actual allocated bytes can be a bit moe than size.
-        LONG64 allocatedSize = (LONG64)HeapSize(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, ret);
-        allocatedSize = InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, allocatedSize);
-        LONG64 localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
+        uint32_t sizeClass = dd_size_class(size);
+        ret = dd_pool_malloc(sizeClass);
 
-        // Update the global MaxAllocated heap only if the current allocated heap is bigger than what is recorded.
-        while (allocatedSize > localMax)
+        if (ret != nullptr && ShouldLogProcessData())
         {
-            InterlockedCompareExchange64(&g_detoursMaxAllocatedMemoryInBytes, allocatedSize, localMax);
-            localMax = InterlockedAdd64(&g_detoursMaxAllocatedMemoryInBytes, 0);
+            dd_account_allocation((LONG64)DD_MIN_POOLED_ALLOCATION_SIZE << sizeClass);
         }
+
+        return ret;
+    }
+
+    DD_ALLOCATION_PREFIX* prefix = (DD_ALLOCATION_PREFIX*)HeapAlloc(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, sizeof(DD_ALLOCATION_PREFIX) + size);
+    if (prefix == nullptr)
+    {
+        return nullptr;
+    }
+
+    prefix->SizeClass = DD_LARGE_ALLOCATION;
+    prefix->Size = size;
+
+    if (ShouldLogProcessData())
+    {
+        dd_account_allocation((LONG64)size);
     }
 
-    return ret;
+    return prefix + 1;
 }
 
 inline void dd_free(void* pMem)
@@ -46,14 +120,20 @@ inline void dd_free(void* pMem)
         return;
     }
 
+    DD_ALLOCATION_PREFIX* prefix = ((DD_ALLOCATION_PREFIX*)pMem) - 1;
+
     if (ShouldLogProcessData())
     {
-        // Get the size since alignment matters and the actual allocated bytes can be a bit moe than size.
-        LONG64 deallocatedSize = (LONG64)HeapSize(g_hPrivateHeap, BUILDXL_DETOURS_MEMORY_ALLOC_FLAGS, pMem);
-        InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, -(deallocatedSize));
+        InterlockedAdd64(&g_detoursHeapAllocatedMemoryInBytes, -((LONG64)prefix->Size));
+    }
+
+    if (prefix->SizeClass != DD_LARGE_ALLOCATION)
+    {
+        dd_pool_free(prefix);
+        return;
     }
 
-    HeapFree(g_hPrivateHeap, HEAP_ZERO_MEMORY, pMem);
+    HeapFree(g_hPrivateHeap, HEAP_ZERO_MEMORY, prefix);
 }
 
 // New news and deletes operators that call the private heap.
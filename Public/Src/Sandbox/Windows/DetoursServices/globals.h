@@ -36,12 +36,23 @@ extern PVOID g_manifestPtr;
 extern PDWORD g_manifestSizePtr;
 extern DWORD g_currentProcessId;
 extern PCWSTR g_currentProcessCommandLine;
+// Computed once at attach and never changed; null until then (or if they could not be computed).
+// The sanitized command line has its line breaks replaced with spaces, for the text report format.
+extern PCWSTR g_currentProcessSanitizedCommandLine;
+extern PCWSTR g_currentProcessModuleName;
 
 extern FileAccessManifestFlag g_fileAccessManifestFlags;
 extern FileAccessManifestExtraFlag g_fileAccessManifestExtraFlags;
 extern uint64_t g_FileAccessManifestPipId;
 
 extern PCManifestRecord g_manifestTreeRoot;
+extern PCManifestSuffixPolicies g_manifestSuffixPolicies;
+extern PCManifestFileMetadata g_manifestFileMetadata;
+extern PCManifestBreakawayChildProcesses g_manifestBreakawayChildProcesses;
+extern PCManifestProcessAdmission g_manifestProcessAdmission;
+extern PCManifestTempRedirection g_manifestTempRedirection;
+extern PCManifestLookupProfile g_manifestLookupProfile;
+extern PCManifestProcessPriority g_manifestProcessPriority;
 
 extern PManifestTranslatePathsStrings g_manifestTranslatePathsStrings;
 extern vector<TranslatePathTuple*>* g_pManifestTranslatePathTuples;
@@ -51,6 +62,13 @@ extern LPCTSTR g_internalDetoursErrorNotificationFile;
 
 extern HANDLE g_messageCountSemaphore;
 
+// The process admission gate (see ManifestProcessAdmission), or NULL when there is none or when it could not be opened.
+extern HANDLE g_processAdmissionGate;
+
+// Number of reports sent by all the detoured processes of the pip, in a mapping created by the consumer next to the message count
+// semaphore. Counting there takes no system call; the semaphore is only released when the mapping cannot be opened.
+extern volatile LONG64* g_messageCount;
+
 extern HANDLE g_reportFileHandle;
 
 extern unsigned long g_injectionTimeoutInMinutes;
@@ -123,6 +141,8 @@ extern CreateDirectoryExW_t Real_CreateDirectoryExW;
 extern CreateDirectoryExA_t Real_CreateDirectoryExA;
 extern RemoveDirectoryW_t Real_RemoveDirectoryW;
 extern RemoveDirectoryA_t Real_RemoveDirectoryA;
+extern SetCurrentDirectoryW_t Real_SetCurrentDirectoryW;
+extern SetCurrentDirectoryA_t Real_SetCurrentDirectoryA;
 extern DecryptFileW_t Real_DecryptFileW;
 extern DecryptFileA_t Real_DecryptFileA;
 extern EncryptFileW_t Real_EncryptFileW;
@@ -134,6 +154,7 @@ extern GetFinalPathNameByHandleW_t Real_GetFinalPathNameByHandleW;
 extern GetFinalPathNameByHandleA_t Real_GetFinalPathNameByHandleA;
 
 extern NtClose_t Real_NtClose;
+extern NtDuplicateObject_t Real_NtDuplicateObject;
 extern NtCreateFile_t Real_NtCreateFile;
 extern NtOpenFile_t Real_NtOpenFile;
 extern ZwCreateFile_t Real_ZwCreateFile;
@@ -141,12 +162,11 @@ extern ZwOpenFile_t Real_ZwOpenFile;
 extern NtQueryDirectoryFile_t Real_NtQueryDirectoryFile;
 extern ZwQueryDirectoryFile_t Real_ZwQueryDirectoryFile;
 extern ZwSetInformationFile_t Real_ZwSetInformationFile;
+extern NtWriteFile_t Real_NtWriteFile;
+extern NtQueryAttributesFile_t Real_NtQueryAttributesFile;
+extern NtQueryFullAttributesFile_t Real_NtQueryFullAttributesFile;
 
 #if MEASURE_DETOURED_NT_CLOSE_IMPACT
-extern volatile LONG g_msTimeToPopulatePoolList;
 extern volatile ULONGLONG g_pipExecutionStart;
 extern volatile LONG g_ntCloseHandeCount;
-extern volatile LONG g_maxClosedListCount;
-extern volatile LONG g_msTimeInAddClosedList;
-extern volatile LONG g_msTimeInRemoveClosedList;
 #endif // MEASURE_DETOURED_NT_CLOSE_IMPACT
@@ -32,7 +32,10 @@
 
 #define __in
 #define __out
+#define __inout
 #define __in_ecount(nBufferLength)
+#define __in_z
+#define _Out_
 #define __out_ecount(nBufferLength)
 
 #define Dbg(format, ...)
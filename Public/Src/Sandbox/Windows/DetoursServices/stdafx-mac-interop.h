@@ -7,3 +7,13 @@
 
 #include <assert.h>
 #include <stdio.h>
+
+#if defined(__linux__)
+// The interop configuration is also what the Linux sandbox builds the shared sources with. libstdc++ names parameters
+// __in and __out, which stdafx-mac-common.h defines away, so its headers have to come first.
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#endif
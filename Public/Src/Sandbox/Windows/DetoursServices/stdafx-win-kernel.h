@@ -0,0 +1,46 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// stdafx-win-kernel.h : windows-specific stdafx only to be used for the minifilter (which runs in kernel space)
+//
+// Only the parts of DetoursServices that do not depend on Win32 or the C++ runtime are compiled into the minifilter:
+// the manifest data types, the policy search, the string operations and PolicyResult (in its portable form, as for the kext).
+
+#pragma once
+
+#pragma warning( push )
+#pragma warning( disable : 4201 4668 )
+#include <fltKernel.h>
+#include <ntstrsafe.h>
+#include <stdint.h>
+#pragma warning( pop )
+
+#define assert(e) NT_ASSERT(e)
+
+typedef ULONG DWORD;
+typedef DWORD *PDWORD;
+typedef UCHAR BYTE;
+typedef BYTE *PBYTE;
+typedef USHORT WORD;
+typedef int BOOL;
+
+#define WINAPI
+
+#define Dbg(format, ...)
+#define wprintf(format, ...)
+#define WriteWarningOrErrorF(format, ...)
+#define MaybeBreakOnAccessDenied()
+
+// =============== from winerror.h ==================
+
+#define ERROR_PATH_NOT_FOUND 3L
+#define ERROR_ACCESS_DENIED  5L
+#define ERROR_INVALID_NAME   123L
+
+// =============== from fileapi.h =====================
+
+#define CREATE_NEW        1
+#define CREATE_ALWAYS     2
+#define OPEN_EXISTING     3
+#define OPEN_ALWAYS       4
+#define TRUNCATE_EXISTING 5
@@ -16,7 +16,15 @@
 #define MAC_OS_SANDBOX 0
 #endif // !defined(MAC_OS_SANDBOX)
 
-#if !(MAC_OS_LIBRARY) && !(MAC_OS_SANDBOX)
+#if !defined(BUILDXL_MINIFILTER)
+#define BUILDXL_MINIFILTER 0
+#endif // !defined(BUILDXL_MINIFILTER)
+
+#if BUILDXL_MINIFILTER
+
+#include "stdafx-win-kernel.h"
+
+#elif !(MAC_OS_LIBRARY) && !(MAC_OS_SANDBOX)
 
 #include "stdafx-win.h"
 
@@ -0,0 +1,125 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// BuildXLFilter.h : declarations shared by the parts of the minifilter.
+//
+// The minifilter is the Windows counterpart of the macOS kext: it checks the file accesses of the processes of a pip
+// against the pip's file access manifest in kernel, so that processes Detours cannot follow (protected processes,
+// statically linked or injection-hostile tools, ...) are sandboxed too. It is compiled with BUILDXL_MINIFILTER, which
+// makes the shared DataTypes/PolicySearch/PolicyResult code take its kernel-friendly form.
+
+#pragma once
+
+#include "stdafx.h"
+
+#include "BuildXLFilterShared.h"
+#include "PolicyResult.h"
+#include "ReportRing.h"
+
+#define BUILDXL_FILTER_POOL_TAG             'fLXB'
+
+// Longest path (in characters) the minifilter checks. Longer ones are let through unchecked and unreported.
+#define BUILDXL_FILTER_MAX_PATH             32767
+
+// ----------------------------------------------------------------------------
+// TYPE DEFINITIONS
+// ----------------------------------------------------------------------------
+
+/// A pip sandboxed by the minifilter. Lives in the context slot of the silo of the pip (see SandboxedPip.cpp), so that
+/// the pip of a process is found from the silo of the current thread. Immutable once inserted, except for its counters.
+typedef struct _SANDBOXED_PIP
+{
+    uint64_t PipId;
+
+    // Copy of the manifest, which the fields below point into.
+    PBYTE Payload;
+    ULONG PayloadSize;
+
+    FileAccessManifestFlag Flags;
+    FileAccessManifestExtraFlag ExtraFlags;
+    PCManifestRecord Root;
+    PCManifestSuffixPolicies SuffixPolicies;
+
+    // Report ring of the pip, mapped into system space.
+    PVOID RingSection;
+    ReportRingHeader* Ring;
+    char* RingData;
+
+    // Reports that did not fit into the ring.
+    volatile LONG64 DroppedReports;
+} SANDBOXED_PIP, *PSANDBOXED_PIP;
+
+/// Global state of the minifilter.
+typedef struct _BUILDXL_FILTER_DATA
+{
+    PDRIVER_OBJECT DriverObject;
+    PFLT_FILTER Filter;
+    PFLT_PORT ServerPort;
+    PFLT_PORT ClientPort;
+    ULONG PipContextSlot;
+
+    // Pips whose silo context has not been cleaned up yet.
+    volatile LONG LivePips;
+
+    bool ProcessNotifyRegistered;
+} BUILDXL_FILTER_DATA;
+
+extern BUILDXL_FILTER_DATA g_filterData;
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+// SandboxedPip.cpp
+
+NTSTATUS InitializePipTracking();
+void UninitializePipTracking();
+
+/// Handles an AddPip or RemovePip message. Called in the context of the sending process.
+NTSTATUS HandleFilterMessage(_In_reads_bytes_(size) BuildXLFilterMessage const* message, ULONG size);
+
+/// Returns the pip the current thread belongs to, referenced, or nullptr. Release it with DereferencePip.
+PSANDBOXED_PIP ReferenceCurrentPip();
+void DereferencePip(_In_ PSANDBOXED_PIP pip);
+
+/// Appends a text report line (in the format SendReport.cpp writes) to the report ring of the pip. Returns false, and
+/// counts the report as dropped, if it does not fit.
+bool SendReportLine(_In_ PSANDBOXED_PIP pip, _In_reads_(length) PCWSTR line, size_t length);
+
+/// Formats and sends a file access report for the current process.
+void ReportFileAccess(
+    _In_ PSANDBOXED_PIP pip,
+    _In_z_ PCWSTR operation,
+    HANDLE processId,
+    PolicyResult const& policyResult,
+    AccessCheckResult const& accessCheckResult,
+    DWORD error,
+    DWORD desiredAccess,
+    DWORD shareMode,
+    DWORD creationDisposition,
+    DWORD flagsAndAttributes,
+    _In_z_ PCWSTR path);
+
+// Volumes.cpp
+
+NTSTATUS InitializeVolumes();
+void UninitializeVolumes();
+
+/// Remembers the DOS name (e.g. "C:") of the volume an instance is attached to.
+void AddVolume(_In_ PCFLT_RELATED_OBJECTS fltObjects);
+void RemoveVolume(_In_ PCFLT_RELATED_OBJECTS fltObjects);
+
+/// Converts an NT path (\Device\HarddiskVolume3\foo) into the form manifest paths have (C:\foo), NUL-terminated.
+/// Returns the length of the converted path, or 0 if its volume has no DOS name or it does not fit.
+size_t ToDosPath(_In_ PCUNICODE_STRING ntPath, _Out_writes_(bufferLength) PWCHAR buffer, size_t bufferLength);
+
+// FileOperations.cpp
+
+FLT_PREOP_CALLBACK_STATUS FLTAPI PreCreate(_Inout_ PFLT_CALLBACK_DATA data, _In_ PCFLT_RELATED_OBJECTS fltObjects, _Outptr_result_maybenull_ PVOID* completionContext);
+FLT_POSTOP_CALLBACK_STATUS FLTAPI PostCreate(_Inout_ PFLT_CALLBACK_DATA data, _In_ PCFLT_RELATED_OBJECTS fltObjects, _In_opt_ PVOID completionContext, FLT_POST_OPERATION_FLAGS flags);
+FLT_PREOP_CALLBACK_STATUS FLTAPI PreSetInformation(_Inout_ PFLT_CALLBACK_DATA data, _In_ PCFLT_RELATED_OBJECTS fltObjects, _Outptr_result_maybenull_ PVOID* completionContext);
+
+// ProcessTracking.cpp
+
+NTSTATUS InitializeProcessTracking();
+void UninitializeProcessTracking();
@@ -0,0 +1,50 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Messages BuildXL sends to the minifilter over its communication port.
+//
+// A pip is sandboxed by the minifilter instead of by Detours by running it in a job that has been turned into a silo
+// (SetInformationJobObject with JobObjectCreateSilo) before its first process is assigned to it. BuildXL then sends
+// an AddPip message with the job, the report ring of the pip (see ReportRing.h) and its file access manifest, and
+// resumes the process. Every process of the silo is checked against that manifest until RemovePip, or until the silo
+// goes away. The handles are handles of the sending process; the minifilter looks them up while handling the message.
+//
+// IMPORTANT: Keep this in sync with the C# version declared in MinifilterConnection.cs
+
+#pragma once
+
+#define BUILDXL_FILTER_PORT_NAME            L"\\BuildXLFilterPort"
+#define BUILDXL_FILTER_PROTOCOL_VERSION     1
+
+// Manifests larger than this are rejected rather than copied into the kernel.
+#define BUILDXL_FILTER_MAX_PAYLOAD_SIZE     (64 * 1024 * 1024)
+
+typedef enum
+{
+    BuildXLFilterCommand_AddPip    = 1,
+    BuildXLFilterCommand_RemovePip = 2,
+} BuildXLFilterCommand;
+
+#pragma pack(push, 8)
+typedef struct BuildXLFilterMessage_t
+{
+    uint32_t Version;
+    uint32_t Command;
+    uint64_t PipId;
+
+    // Job (silo) of the pip, for both commands.
+    uint64_t JobHandle;
+
+    // Section of the report ring of the pip. AddPip only.
+    uint64_t ReportRingSection;
+
+    // Size of the serialized manifest that follows (the bytes FileAccessManifest.cs produces). AddPip only.
+    uint32_t PayloadSize;
+    uint32_t Reserved;
+    uint8_t  Payload[1];
+} BuildXLFilterMessage;
+#pragma pack(pop)
+
+#define BUILDXL_FILTER_MESSAGE_HEADER_SIZE  FIELD_OFFSET(BuildXLFilterMessage, Payload)
+
+static_assert(BUILDXL_FILTER_MESSAGE_HEADER_SIZE == 40, "BuildXLFilterMessage layout is shared with MinifilterConnection.cs");
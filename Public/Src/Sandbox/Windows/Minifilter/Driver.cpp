@@ -0,0 +1,254 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Driver.cpp : registration of the minifilter and of its communication port.
+
+#include "BuildXLFilter.h"
+
+// Only one BuildXL instance at a time drives the minifilter.
+#define BUILDXL_FILTER_MAX_CONNECTIONS 1
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+BUILDXL_FILTER_DATA g_filterData;
+
+// ----------------------------------------------------------------------------
+// FUNCTION DECLARATIONS
+// ----------------------------------------------------------------------------
+
+extern "C" DRIVER_INITIALIZE DriverEntry;
+
+static NTSTATUS FLTAPI FilterUnload(FLT_FILTER_UNLOAD_FLAGS flags);
+static NTSTATUS FLTAPI InstanceSetup(PCFLT_RELATED_OBJECTS fltObjects, FLT_INSTANCE_SETUP_FLAGS flags, DEVICE_TYPE volumeDeviceType, FLT_FILESYSTEM_TYPE volumeFilesystemType);
+static VOID FLTAPI InstanceTeardownComplete(PCFLT_RELATED_OBJECTS fltObjects, FLT_INSTANCE_TEARDOWN_FLAGS flags);
+static NTSTATUS FLTAPI PortConnect(PFLT_PORT clientPort, PVOID serverPortCookie, PVOID connectionContext, ULONG sizeOfContext, PVOID* connectionPortCookie);
+static VOID FLTAPI PortDisconnect(PVOID connectionCookie);
+static NTSTATUS FLTAPI PortMessage(PVOID portCookie, PVOID inputBuffer, ULONG inputBufferLength, PVOID outputBuffer, ULONG outputBufferLength, PULONG returnOutputBufferLength);
+
+// ----------------------------------------------------------------------------
+// REGISTRATION
+// ----------------------------------------------------------------------------
+
+static const FLT_OPERATION_REGISTRATION s_callbacks[] =
+{
+    { IRP_MJ_CREATE,          0,                                 PreCreate,         PostCreate },
+    { IRP_MJ_SET_INFORMATION, FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO, PreSetInformation, nullptr },
+    { IRP_MJ_OPERATION_END }
+};
+
+static const FLT_REGISTRATION s_registration =
+{
+    sizeof(FLT_REGISTRATION),
+    FLT_REGISTRATION_VERSION,
+    0,                              // Flags
+    nullptr,                        // Context
+    s_callbacks,                    // Operation callbacks
+    FilterUnload,                   // FilterUnload
+    InstanceSetup,                  // InstanceSetup
+    nullptr,                        // InstanceQueryTeardown
+    nullptr,                        // InstanceTeardownStart
+    InstanceTeardownComplete,       // InstanceTeardownComplete
+    nullptr,                        // GenerateFileName
+    nullptr,                        // NormalizeNameComponent
+    nullptr,                        // NormalizeContextCleanup
+};
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+static void Cleanup()
+{
+    UninitializeProcessTracking();
+
+    if (g_filterData.ServerPort != nullptr)
+    {
+        FltCloseCommunicationPort(g_filterData.ServerPort);
+        g_filterData.ServerPort = nullptr;
+    }
+
+    if (g_filterData.Filter != nullptr)
+    {
+        FltUnregisterFilter(g_filterData.Filter);
+        g_filterData.Filter = nullptr;
+    }
+
+    UninitializePipTracking();
+    UninitializeVolumes();
+}
+
+/// Only administrators (and the system) may connect to the port: a connection decides what every sandboxed process can access.
+static NTSTATUS CreateCommunicationPort()
+{
+    PSECURITY_DESCRIPTOR securityDescriptor = nullptr;
+    NTSTATUS status = FltBuildDefaultSecurityDescriptor(&securityDescriptor, FLT_PORT_ALL_ACCESS);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    UNICODE_STRING portName = RTL_CONSTANT_STRING(BUILDXL_FILTER_PORT_NAME);
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(&attributes, &portName, OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, nullptr, securityDescriptor);
+
+    status = FltCreateCommunicationPort(
+        g_filterData.Filter,
+        &g_filterData.ServerPort,
+        &attributes,
+        nullptr,
+        PortConnect,
+        PortDisconnect,
+        PortMessage,
+        BUILDXL_FILTER_MAX_CONNECTIONS);
+
+    FltFreeSecurityDescriptor(securityDescriptor);
+    return status;
+}
+
+extern "C" NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT driverObject, _In_ PUNICODE_STRING registryPath)
+{
+    UNREFERENCED_PARAMETER(registryPath);
+
+    RtlZeroMemory(&g_filterData, sizeof(g_filterData));
+    g_filterData.DriverObject = driverObject;
+
+    NTSTATUS status = InitializeVolumes();
+    if (NT_SUCCESS(status))
+    {
+        status = InitializePipTracking();
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        status = FltRegisterFilter(driverObject, &s_registration, &g_filterData.Filter);
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        status = CreateCommunicationPort();
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        status = InitializeProcessTracking();
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        status = FltStartFiltering(g_filterData.Filter);
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        Cleanup();
+    }
+
+    return status;
+}
+
+static NTSTATUS FLTAPI FilterUnload(FLT_FILTER_UNLOAD_FLAGS flags)
+{
+    PAGED_CODE();
+
+    // Unloading would leave the pips that are still running unsandboxed.
+    if (g_filterData.LivePips != 0 && !FlagOn(flags, FLTFL_FILTER_UNLOAD_MANDATORY))
+    {
+        return STATUS_FLT_DO_NOT_DETACH;
+    }
+
+    Cleanup();
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS FLTAPI InstanceSetup(
+    PCFLT_RELATED_OBJECTS fltObjects,
+    FLT_INSTANCE_SETUP_FLAGS flags,
+    DEVICE_TYPE volumeDeviceType,
+    FLT_FILESYSTEM_TYPE volumeFilesystemType)
+{
+    UNREFERENCED_PARAMETER(flags);
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER(volumeDeviceType);
+
+    if (volumeFilesystemType == FLT_FSTYPE_RAW)
+    {
+        return STATUS_FLT_DO_NOT_ATTACH;
+    }
+
+    AddVolume(fltObjects);
+    return STATUS_SUCCESS;
+}
+
+static VOID FLTAPI InstanceTeardownComplete(PCFLT_RELATED_OBJECTS fltObjects, FLT_INSTANCE_TEARDOWN_FLAGS flags)
+{
+    UNREFERENCED_PARAMETER(flags);
+
+    PAGED_CODE();
+
+    RemoveVolume(fltObjects);
+}
+
+static NTSTATUS FLTAPI PortConnect(
+    PFLT_PORT clientPort,
+    PVOID serverPortCookie,
+    PVOID connectionContext,
+    ULONG sizeOfContext,
+    PVOID* connectionPortCookie)
+{
+    UNREFERENCED_PARAMETER(serverPortCookie);
+    UNREFERENCED_PARAMETER(connectionContext);
+    UNREFERENCED_PARAMETER(sizeOfContext);
+
+    PAGED_CODE();
+
+    g_filterData.ClientPort = clientPort;
+    *connectionPortCookie = nullptr;
+    return STATUS_SUCCESS;
+}
+
+static VOID FLTAPI PortDisconnect(PVOID connectionCookie)
+{
+    UNREFERENCED_PARAMETER(connectionCookie);
+
+    PAGED_CODE();
+
+    // The pips of the client stay sandboxed until their silos go away.
+    FltCloseClientPort(g_filterData.Filter, &g_filterData.ClientPort);
+}
+
+static NTSTATUS FLTAPI PortMessage(
+    PVOID portCookie,
+    PVOID inputBuffer,
+    ULONG inputBufferLength,
+    PVOID outputBuffer,
+    ULONG outputBufferLength,
+    PULONG returnOutputBufferLength)
+{
+    UNREFERENCED_PARAMETER(portCookie);
+    UNREFERENCED_PARAMETER(outputBuffer);
+    UNREFERENCED_PARAMETER(outputBufferLength);
+
+    PAGED_CODE();
+
+    *returnOutputBufferLength = 0;
+
+    if (inputBuffer == nullptr || inputBufferLength < BUILDXL_FILTER_MESSAGE_HEADER_SIZE)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // The input buffer is the sender's memory: it is only read under a try.
+    __try
+    {
+        ProbeForRead(inputBuffer, inputBufferLength, sizeof(uint64_t));
+        return HandleFilterMessage(reinterpret_cast<BuildXLFilterMessage const*>(inputBuffer), inputBufferLength);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        return GetExceptionCode();
+    }
+}
@@ -0,0 +1,442 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// FileOperations.cpp : the file system callbacks, which check the accesses of sandboxed processes.
+//
+// Writes are decided before the operation reaches the file system, since they cannot be taken back afterwards. Reads
+// depend on whether the file exists, so opens are decided after the file system has handled them, and an open that
+// is not allowed is cancelled then (FltCancelFileOpen). The reports name the operations like the detours of the same
+// calls do (NtCreateFile, ZwSetRenameInformationFile, ...), so that BuildXL treats them the same way.
+
+#include "BuildXLFilter.h"
+
+// ----------------------------------------------------------------------------
+// TYPE DEFINITIONS
+// ----------------------------------------------------------------------------
+
+/// What PreCreate passes on to PostCreate.
+typedef struct _CREATE_CONTEXT
+{
+    PSANDBOXED_PIP Pip;
+
+    // Result of the policy search of the path (see PolicySearchCursor)
+    ManifestRecord const* Record;
+    bool SearchWasTruncated;
+
+    bool ChecksWrite;
+    bool CreatesDirectory;
+    DWORD DesiredAccess;
+    DWORD ShareMode;
+    DWORD CreateDisposition;
+    DWORD CreateOptions;
+
+    size_t PathLength;
+    WCHAR Path[ANYSIZE_ARRAY];
+} CREATE_CONTEXT, *PCREATE_CONTEXT;
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+static inline bool WantsWriteAccess(DWORD access)
+{
+    return (access & (GENERIC_WRITE | DELETE | FILE_WRITE_DATA | FILE_WRITE_ATTRIBUTES | FILE_WRITE_EA | FILE_APPEND_DATA)) != 0;
+}
+
+/// Accesses that only read metadata are probes, as for the detours.
+static inline bool WantsReadContent(DWORD access)
+{
+    return (access & (GENERIC_READ | GENERIC_EXECUTE | FILE_READ_DATA | FILE_EXECUTE)) != 0;
+}
+
+static inline PolicyResult GetPolicy(_In_ PSANDBOXED_PIP pip, ManifestRecord const* record, bool searchWasTruncated, _In_z_ PCWSTR path)
+{
+    return PolicyResult(pip->Flags, path, PolicySearchCursor(record, searchWasTruncated), pip->SuffixPolicies);
+}
+
+static inline PolicyResult GetPolicy(_In_ PSANDBOXED_PIP pip, _In_reads_(pathLength) PCWSTR path, size_t pathLength)
+{
+    return PolicyResult(pip->Flags, path, FindFileAccessPolicyInTreeEx(pip->Root, path, pathLength), pip->SuffixPolicies);
+}
+
+/// Returns the DOS path of a file name, in a buffer to be freed with ExFreePoolWithTag, or nullptr if it has none.
+static PWCHAR GetDosPath(_In_ PFLT_FILE_NAME_INFORMATION nameInfo, _Out_ size_t& pathLength, size_t extraBytes = 0)
+{
+    pathLength = 0;
+
+    // The DOS name of a volume is never longer than its device name, so the length of the NT path is enough.
+    size_t bufferLength = nameInfo->Name.Length / sizeof(WCHAR) + 1;
+    if (bufferLength > BUILDXL_FILTER_MAX_PATH)
+    {
+        return nullptr;
+    }
+
+    PBYTE buffer = reinterpret_cast<PBYTE>(ExAllocatePool2(POOL_FLAG_PAGED, extraBytes + bufferLength * sizeof(WCHAR), BUILDXL_FILTER_POOL_TAG));
+    if (buffer == nullptr)
+    {
+        return nullptr;
+    }
+
+    PWCHAR path = reinterpret_cast<PWCHAR>(buffer + extraBytes);
+    pathLength = ToDosPath(&nameInfo->Name, path, bufferLength);
+    if (pathLength == 0)
+    {
+        ExFreePoolWithTag(buffer, BUILDXL_FILTER_POOL_TAG);
+        return nullptr;
+    }
+
+    return path;
+}
+
+static void FreeCreateContext(_In_ PCREATE_CONTEXT context)
+{
+    DereferencePip(context->Pip);
+    ExFreePoolWithTag(context, BUILDXL_FILTER_POOL_TAG);
+}
+
+/// Opens by the kernel, of paging files, of volumes and by file id (which have no path to look up) are not checked.
+static bool ShouldCheckCreate(_In_ PFLT_CALLBACK_DATA data)
+{
+    return data->RequestorMode == UserMode
+        && !FlagOn(data->Iopb->OperationFlags, SL_OPEN_PAGING_FILE)
+        && !FlagOn(data->Iopb->TargetFileObject->Flags, FO_VOLUME_OPEN)
+        && !FlagOn(data->Iopb->Parameters.Create.Options, FILE_OPEN_BY_FILE_ID);
+}
+
+static PCREATE_CONTEXT CreateContext(_In_ PSANDBOXED_PIP pip, _In_ PFLT_CALLBACK_DATA data)
+{
+    PFLT_FILE_NAME_INFORMATION nameInfo = nullptr;
+    if (!NT_SUCCESS(FltGetFileNameInformation(data, FLT_FILE_NAME_OPENED | FLT_FILE_NAME_QUERY_DEFAULT, &nameInfo)))
+    {
+        return nullptr;
+    }
+
+    size_t pathLength = 0;
+    PWCHAR path = GetDosPath(nameInfo, pathLength, FIELD_OFFSET(CREATE_CONTEXT, Path));
+    FltReleaseFileNameInformation(nameInfo);
+
+    if (path == nullptr)
+    {
+        return nullptr;
+    }
+
+    PCREATE_CONTEXT context = CONTAINING_RECORD(path, CREATE_CONTEXT, Path);
+    context->Pip = pip;
+    context->PathLength = pathLength;
+
+    PolicySearchCursor cursor = FindFileAccessPolicyInTreeEx(pip->Root, context->Path, pathLength);
+    context->Record = cursor.Record;
+    context->SearchWasTruncated = cursor.SearchWasTruncated;
+
+    auto const& create = data->Iopb->Parameters.Create;
+    context->DesiredAccess = create.SecurityContext->DesiredAccess;
+    context->ShareMode = create.ShareAccess;
+    context->CreateDisposition = (create.Options >> 24) & 0xFF;
+    context->CreateOptions = create.Options & FILE_VALID_OPTION_FLAGS;
+
+    context->CreatesDirectory = FlagOn(context->CreateOptions, FILE_DIRECTORY_FILE)
+        && (context->CreateDisposition == FILE_CREATE || context->CreateDisposition == FILE_OPEN_IF);
+
+    context->ChecksWrite = !context->CreatesDirectory
+        && (WantsWriteAccess(context->DesiredAccess)
+            || FlagOn(context->CreateOptions, FILE_DELETE_ON_CLOSE)
+            || context->CreateDisposition == FILE_SUPERSEDE
+            || context->CreateDisposition == FILE_CREATE
+            || context->CreateDisposition == FILE_OVERWRITE
+            || context->CreateDisposition == FILE_OVERWRITE_IF);
+
+    return context;
+}
+
+static void ReportCreate(_In_ PCREATE_CONTEXT context, PolicyResult const& policy, AccessCheckResult const& check, DWORD error)
+{
+    if (check.ShouldReport())
+    {
+        ReportFileAccess(context->Pip, L"NtCreateFile", PsGetCurrentProcessId(), policy, check, error,
+            context->DesiredAccess, context->ShareMode, context->CreateDisposition, context->CreateOptions, context->Path);
+    }
+}
+
+FLT_PREOP_CALLBACK_STATUS FLTAPI PreCreate(
+    _Inout_ PFLT_CALLBACK_DATA data,
+    _In_ PCFLT_RELATED_OBJECTS fltObjects,
+    _Outptr_result_maybenull_ PVOID* completionContext)
+{
+    UNREFERENCED_PARAMETER(fltObjects);
+
+    PAGED_CODE();
+
+    *completionContext = nullptr;
+
+    if (!ShouldCheckCreate(data))
+    {
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    PSANDBOXED_PIP pip = ReferenceCurrentPip();
+    if (pip == nullptr)
+    {
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    PCREATE_CONTEXT context = CreateContext(pip, data);
+    if (context == nullptr)
+    {
+        DereferencePip(pip);
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    PolicyResult policy = GetPolicy(pip, context->Record, context->SearchWasTruncated, context->Path);
+    AccessCheckResult check = AccessCheckResult(RequestedAccess::None, ResultAction::Allow, ReportLevel::Ignore);
+
+    if (context->ChecksWrite)
+    {
+        check = policy.CheckWriteAccess();
+    }
+    else if (context->CreatesDirectory && !policy.AllowCreateDirectory())
+    {
+        if (context->CreateDisposition == FILE_CREATE)
+        {
+            check = policy.CheckCreateDirectoryAccess();
+        }
+        else
+        {
+            // Opening an existing directory is fine; only creating one is not, which PostCreate finds out.
+            data->Iopb->Parameters.Create.Options = (FILE_OPEN << 24) | context->CreateOptions;
+            FltSetCallbackDataDirty(data);
+        }
+    }
+
+    if (check.ShouldDenyAccess())
+    {
+        ReportCreate(context, policy, check, ERROR_ACCESS_DENIED);
+        FreeCreateContext(context);
+
+        data->IoStatus.Status = check.DenialNtStatus();
+        data->IoStatus.Information = 0;
+        return FLT_PREOP_COMPLETE;
+    }
+
+    *completionContext = context;
+    return FLT_PREOP_SYNCHRONIZE;
+}
+
+FLT_POSTOP_CALLBACK_STATUS FLTAPI PostCreate(
+    _Inout_ PFLT_CALLBACK_DATA data,
+    _In_ PCFLT_RELATED_OBJECTS fltObjects,
+    _In_opt_ PVOID completionContext,
+    FLT_POST_OPERATION_FLAGS flags)
+{
+    PCREATE_CONTEXT context = reinterpret_cast<PCREATE_CONTEXT>(completionContext);
+    if (context == nullptr)
+    {
+        return FLT_POSTOP_FINISHED_PROCESSING;
+    }
+
+    if (FlagOn(flags, FLTFL_POST_OPERATION_DRAINING))
+    {
+        FreeCreateContext(context);
+        return FLT_POSTOP_FINISHED_PROCESSING;
+    }
+
+    // Post-create callbacks run at passive level (and the operation is synchronized).
+    PAGED_CODE();
+
+    NTSTATUS status = data->IoStatus.Status;
+
+    FileReadContext readContext(FileExistence::Existent);
+    if (status == STATUS_OBJECT_NAME_NOT_FOUND || status == STATUS_OBJECT_PATH_NOT_FOUND || status == STATUS_NO_SUCH_FILE)
+    {
+        readContext.FileExistence = FileExistence::Nonexistent;
+    }
+    else if (status == STATUS_OBJECT_NAME_INVALID)
+    {
+        readContext.FileExistence = FileExistence::InvalidPath;
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        BOOLEAN isDirectory = FALSE;
+        readContext.OpenedDirectory = NT_SUCCESS(FltIsDirectory(fltObjects->FileObject, fltObjects->Instance, &isDirectory)) && isDirectory;
+    }
+
+    PolicyResult policy = GetPolicy(context->Pip, context->Record, context->SearchWasTruncated, context->Path);
+    AccessCheckResult check = AccessCheckResult(RequestedAccess::None, ResultAction::Allow, ReportLevel::Ignore);
+
+    if (context->CreatesDirectory && !policy.AllowCreateDirectory())
+    {
+        // PreCreate turned the open-or-create into an open: a directory that was not there may not be created.
+        check = readContext.FileExistence == FileExistence::Existent
+            ? policy.CheckDirectoryAccess(false)
+            : policy.CheckCreateDirectoryAccess();
+    }
+    else if (context->CreatesDirectory)
+    {
+        check = policy.CheckCreateDirectoryAccess();
+    }
+    else if (readContext.OpenedDirectory && !context->ChecksWrite)
+    {
+        check = policy.CheckDirectoryAccess(false);
+    }
+    else
+    {
+        RequestedReadAccess readAccess = WantsReadContent(context->DesiredAccess) ? RequestedReadAccess::Read : RequestedReadAccess::Probe;
+        check = policy.CheckReadAccess(readAccess, readContext);
+
+        if (context->ChecksWrite)
+        {
+            check = AccessCheckResult::Combine(policy.CheckWriteAccess(), check);
+        }
+    }
+
+    DWORD error = NT_SUCCESS(status) ? 0 : RtlNtStatusToDosError(status);
+
+    if (check.ShouldDenyAccess())
+    {
+        if (NT_SUCCESS(status))
+        {
+            FltCancelFileOpen(fltObjects->Instance, fltObjects->FileObject);
+        }
+
+        data->IoStatus.Status = check.DenialNtStatus();
+        data->IoStatus.Information = 0;
+        error = ERROR_ACCESS_DENIED;
+    }
+
+    ReportCreate(context, policy, check, error);
+    FreeCreateContext(context);
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
+
+/// Checks (and reports) a write of the named file by a set-information operation. Returns false if it is denied.
+static bool CheckSetInformationWrite(
+    _In_ PSANDBOXED_PIP pip,
+    _In_z_ PCWSTR operation,
+    _In_ PFLT_FILE_NAME_INFORMATION nameInfo)
+{
+    size_t pathLength = 0;
+    PWCHAR path = GetDosPath(nameInfo, pathLength);
+    if (path == nullptr)
+    {
+        return true;
+    }
+
+    PolicyResult policy = GetPolicy(pip, path, pathLength);
+    AccessCheckResult check = policy.CheckWriteAccess();
+
+    if (check.ShouldReport())
+    {
+        ReportFileAccess(pip, operation, PsGetCurrentProcessId(), policy, check, check.ShouldDenyAccess() ? ERROR_ACCESS_DENIED : 0,
+            DELETE, 0, 0, 0, path);
+    }
+
+    ExFreePoolWithTag(path, BUILDXL_FILTER_POOL_TAG);
+    return !check.ShouldDenyAccess();
+}
+
+FLT_PREOP_CALLBACK_STATUS FLTAPI PreSetInformation(
+    _Inout_ PFLT_CALLBACK_DATA data,
+    _In_ PCFLT_RELATED_OBJECTS fltObjects,
+    _Outptr_result_maybenull_ PVOID* completionContext)
+{
+    PAGED_CODE();
+
+    *completionContext = nullptr;
+
+    if (data->RequestorMode != UserMode)
+    {
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    auto const& setInformation = data->Iopb->Parameters.SetFileInformation;
+    PVOID buffer = setInformation.InfoBuffer;
+
+    // The operations the detours of SetFileInformationByHandle / ZwSetInformationFile check: renames and hard links
+    // write their destination (and a rename its source), deletes their file.
+    PCWSTR operation = nullptr;
+    bool checksSource = false;
+    switch (setInformation.FileInformationClass)
+    {
+        case FileRenameInformation:
+        case FileRenameInformationEx:
+            operation = L"ZwSetRenameInformationFile";
+            checksSource = true;
+            break;
+
+        case FileLinkInformation:
+        case FileLinkInformationEx:
+            operation = L"ZwSetLinkInformationFile";
+            break;
+
+        case FileDispositionInformation:
+            operation = L"ZwSetDispositionInformationFile";
+            checksSource = reinterpret_cast<PFILE_DISPOSITION_INFORMATION>(buffer)->DeleteFile != FALSE;
+            break;
+
+        case FileDispositionInformationEx:
+            operation = L"ZwSetDispositionInformationFile";
+            checksSource = FlagOn(reinterpret_cast<PFILE_DISPOSITION_INFORMATION_EX>(buffer)->Flags, FILE_DISPOSITION_DELETE);
+            break;
+
+        default:
+            return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    bool isDisposition = setInformation.FileInformationClass == FileDispositionInformation
+        || setInformation.FileInformationClass == FileDispositionInformationEx;
+
+    if (isDisposition && !checksSource)
+    {
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    PSANDBOXED_PIP pip = ReferenceCurrentPip();
+    if (pip == nullptr)
+    {
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    bool allowed = true;
+
+    if (checksSource)
+    {
+        PFLT_FILE_NAME_INFORMATION nameInfo = nullptr;
+        if (NT_SUCCESS(FltGetFileNameInformation(data, FLT_FILE_NAME_OPENED | FLT_FILE_NAME_QUERY_DEFAULT, &nameInfo)))
+        {
+            allowed = CheckSetInformationWrite(pip, operation, nameInfo);
+            FltReleaseFileNameInformation(nameInfo);
+        }
+    }
+
+    if (allowed && !isDisposition)
+    {
+        // FILE_RENAME_INFORMATION and FILE_LINK_INFORMATION have the same layout.
+        PFILE_RENAME_INFORMATION target = reinterpret_cast<PFILE_RENAME_INFORMATION>(buffer);
+        PFLT_FILE_NAME_INFORMATION nameInfo = nullptr;
+
+        if (NT_SUCCESS(FltGetDestinationFileNameInformation(
+                fltObjects->Instance,
+                fltObjects->FileObject,
+                target->RootDirectory,
+                target->FileName,
+                target->FileNameLength,
+                FLT_FILE_NAME_OPENED | FLT_FILE_NAME_QUERY_DEFAULT,
+                &nameInfo)))
+        {
+            allowed = CheckSetInformationWrite(pip, operation, nameInfo);
+            FltReleaseFileNameInformation(nameInfo);
+        }
+    }
+
+    DereferencePip(pip);
+
+    if (!allowed)
+    {
+        data->IoStatus.Status = STATUS_ACCESS_DENIED;
+        data->IoStatus.Information = 0;
+        return FLT_PREOP_COMPLETE;
+    }
+
+    return FLT_PREOP_SUCCESS_NO_CALLBACK;
+}
@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// ProcessTracking.cpp : reports of the processes started by sandboxed processes.
+//
+// Every process of a pip is reported with a "Process" report, as the detours report the processes they are injected
+// into. The notification comes in the context of the creating thread, so the pip is that of the parent: the root
+// process of a pip is started (suspended) before its job becomes a pip, and is reported by the client instead.
+//
+// Registering the notification requires the driver to be linked with /INTEGRITYCHECK.
+
+#include "BuildXLFilter.h"
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+/// Returns the DOS form of the name the image was opened with, in a buffer to be freed with ExFreePoolWithTag.
+static PWCHAR GetImagePath(_In_ PCUNICODE_STRING imageFileName)
+{
+    size_t bufferLength = imageFileName->Length / sizeof(WCHAR) + 1;
+    if (bufferLength > BUILDXL_FILTER_MAX_PATH)
+    {
+        return nullptr;
+    }
+
+    PWCHAR path = reinterpret_cast<PWCHAR>(ExAllocatePool2(POOL_FLAG_PAGED, bufferLength * sizeof(WCHAR), BUILDXL_FILTER_POOL_TAG));
+    if (path == nullptr)
+    {
+        return nullptr;
+    }
+
+    // Usually \??\C:\foo; otherwise a device path.
+    UNICODE_STRING ntPrefix = RTL_CONSTANT_STRING(NT_PATH_PREFIX);
+    if (RtlPrefixUnicodeString(&ntPrefix, imageFileName, /*CaseInSensitive*/ FALSE))
+    {
+        size_t length = (imageFileName->Length - ntPrefix.Length) / sizeof(WCHAR);
+        RtlCopyMemory(path, imageFileName->Buffer + ntPrefix.Length / sizeof(WCHAR), length * sizeof(WCHAR));
+        path[length] = L'\0';
+
+        if (IsDriveBasedAbsolutePath(path))
+        {
+            return path;
+        }
+    }
+    else if (ToDosPath(imageFileName, path, bufferLength) != 0)
+    {
+        return path;
+    }
+
+    ExFreePoolWithTag(path, BUILDXL_FILTER_POOL_TAG);
+    return nullptr;
+}
+
+/// Mirrors the "Process" report of the detours (see ParseFileAccessManifest).
+static VOID CreateProcessNotify(_Inout_ PEPROCESS process, _In_ HANDLE processId, _Inout_opt_ PPS_CREATE_NOTIFY_INFO createInfo)
+{
+    UNREFERENCED_PARAMETER(process);
+
+    PAGED_CODE();
+
+    // Only starts are reported; the exit of a process is observed by the client through the job.
+    if (createInfo == nullptr || createInfo->ImageFileName == nullptr)
+    {
+        return;
+    }
+
+    PSANDBOXED_PIP pip = ReferenceCurrentPip();
+    if (pip == nullptr)
+    {
+        return;
+    }
+
+    PWCHAR path = GetImagePath(createInfo->ImageFileName);
+    if (path != nullptr)
+    {
+        PolicyResult policy(pip->Flags, path, FindFileAccessPolicyInTreeEx(pip->Root, path, wcslen(path)), pip->SuffixPolicies);
+
+        // Clearly the image exists: the process is being started from it.
+        AccessCheckResult readCheck = policy.CheckReadAccess(RequestedReadAccess::Read, FileReadContext(FileExistence::Existent));
+
+        FileOperationContext context = FileOperationContext::CreateForRead(L"Process", path);
+        ReportFileAccess(pip, context.Operation, processId, policy, readCheck, 0,
+            context.DesiredAccess, context.ShareMode, context.CreationDisposition, context.FlagsAndAttributes, path);
+
+        ExFreePoolWithTag(path, BUILDXL_FILTER_POOL_TAG);
+    }
+
+    DereferencePip(pip);
+}
+
+NTSTATUS InitializeProcessTracking()
+{
+    NTSTATUS status = PsSetCreateProcessNotifyRoutineEx(CreateProcessNotify, FALSE);
+    g_filterData.ProcessNotifyRegistered = NT_SUCCESS(status);
+    return status;
+}
+
+void UninitializeProcessTracking()
+{
+    if (g_filterData.ProcessNotifyRegistered)
+    {
+        PsSetCreateProcessNotifyRoutineEx(CreateProcessNotify, TRUE);
+        g_filterData.ProcessNotifyRegistered = false;
+    }
+}
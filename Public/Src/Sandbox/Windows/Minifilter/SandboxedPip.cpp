@@ -0,0 +1,543 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// SandboxedPip.cpp : tracking of the pips sandboxed by the minifilter, and their reports.
+//
+// A pip is the silo context of the silo its job was turned into: the system hands it back for any thread of the silo
+// (PsGetCurrentSilo / PsGetSiloContext), including threads of processes created after AddPip, and cleans it up when
+// the silo goes away, so that a pip whose client died is not leaked.
+
+#include "BuildXLFilter.h"
+
+// How many times a producer retries reserving space in a full ring before dropping the report (same as in ReportRing.cpp).
+#define REPORT_RING_FULL_RETRY_COUNT 64
+
+// Records larger than this fraction of the ring are dropped, so that a single record cannot starve the ring.
+#define REPORT_RING_MAX_RECORD_FRACTION 4
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+NTSTATUS InitializePipTracking()
+{
+    return PsAllocSiloContextSlot(0, &g_filterData.PipContextSlot);
+}
+
+void UninitializePipTracking()
+{
+    // The filter is unregistered first, so no callback looks up a pip anymore, and it only unloads while pips are
+    // left (see FilterUnload) when the unload is mandatory.
+    if (g_filterData.PipContextSlot != 0)
+    {
+        PsFreeSiloContextSlot(g_filterData.PipContextSlot);
+        g_filterData.PipContextSlot = 0;
+    }
+}
+
+static void UnmapReportRing(_Inout_ PSANDBOXED_PIP pip)
+{
+    if (pip->Ring != nullptr)
+    {
+        MmUnmapViewInSystemSpace(pip->Ring);
+        pip->Ring = nullptr;
+        pip->RingData = nullptr;
+    }
+
+    if (pip->RingSection != nullptr)
+    {
+        ObDereferenceObject(pip->RingSection);
+        pip->RingSection = nullptr;
+    }
+}
+
+static VOID CleanupPip(_In_ PVOID siloContext)
+{
+    PSANDBOXED_PIP pip = reinterpret_cast<PSANDBOXED_PIP>(siloContext);
+
+    UnmapReportRing(pip);
+    InterlockedDecrement(&g_filterData.LivePips);
+
+    if (pip->Payload != nullptr)
+    {
+        ExFreePoolWithTag(pip->Payload, BUILDXL_FILTER_POOL_TAG);
+        pip->Payload = nullptr;
+    }
+}
+
+/// Maps the report ring the client created (see ReportRingBuffer.cs) into system space.
+static NTSTATUS MapReportRing(uint64_t sectionHandle, _Inout_ PSANDBOXED_PIP pip)
+{
+    NTSTATUS status = ObReferenceObjectByHandle(
+        reinterpret_cast<HANDLE>(sectionHandle),
+        SECTION_MAP_READ | SECTION_MAP_WRITE,
+        *MmSectionObjectType,
+        UserMode,
+        &pip->RingSection,
+        nullptr);
+
+    if (!NT_SUCCESS(status))
+    {
+        pip->RingSection = nullptr;
+        return status;
+    }
+
+    PVOID view = nullptr;
+    SIZE_T viewSize = 0;
+    status = MmMapViewInSystemSpace(pip->RingSection, &view, &viewSize);
+    if (!NT_SUCCESS(status))
+    {
+        UnmapReportRing(pip);
+        return status;
+    }
+
+    pip->Ring = reinterpret_cast<ReportRingHeader*>(view);
+    pip->RingData = reinterpret_cast<char*>(view) + sizeof(ReportRingHeader);
+
+    ReportRingHeader* ring = pip->Ring;
+    if (viewSize <= sizeof(ReportRingHeader)
+        || ring->Magic != REPORT_RING_MAGIC
+        || ring->Version != REPORT_RING_VERSION
+        || ring->Capacity == 0
+        || ring->Capacity > REPORT_RING_SKIP_SLOT
+        || (ring->Capacity & (ring->Capacity - 1)) != 0
+        || ring->Capacity > viewSize - sizeof(ReportRingHeader))
+    {
+        UnmapReportRing(pip);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// Returns the block at 'offset' and moves past it, or nullptr if it is not valid or does not fit into the payload.
+template <class T>
+static T const* ParseBlock(_In_reads_bytes_(payloadSize) PBYTE payload, ULONG payloadSize, _Inout_ size_t& offset)
+{
+    if (offset + sizeof(T) > payloadSize)
+    {
+        return nullptr;
+    }
+
+    T const* block = reinterpret_cast<T const*>(payload + offset);
+    if (block->CheckValid() != nullptr || offset + block->GetSize() > payloadSize)
+    {
+        return nullptr;
+    }
+
+    offset += block->GetSize();
+    return block;
+}
+
+/// Moves past a length-prefixed string of the payload.
+static bool SkipCharArray(_In_reads_bytes_(payloadSize) PBYTE payload, ULONG payloadSize, _Inout_ size_t& offset)
+{
+    if (offset + sizeof(uint32_t) > payloadSize)
+    {
+        return false;
+    }
+
+    uint32_t length = *reinterpret_cast<uint32_t const*>(payload + offset);
+    offset += sizeof(uint32_t) + sizeof(WCHAR) * (size_t)length;
+    return offset <= payloadSize;
+}
+
+/// Moves past a block that, in release builds, has no fields at all (its tag is only there in debug builds).
+template <class T>
+static bool SkipTaggedBlock(_In_reads_bytes_(payloadSize) PBYTE payload, ULONG payloadSize, _Inout_ size_t& offset)
+{
+#ifdef _DEBUG
+    if (offset + sizeof(uint32_t) > payloadSize
+        || reinterpret_cast<T const*>(payload + offset)->CheckValid() != nullptr)
+    {
+        return false;
+    }
+
+    offset += sizeof(uint32_t);
+#else
+    UNREFERENCED_PARAMETER(payload);
+    UNREFERENCED_PARAMETER(payloadSize);
+    UNREFERENCED_PARAMETER(offset);
+#endif
+
+    return true;
+}
+
+/// Parses the manifest copied into pip->Payload, the way ParseFileAccessManifest does.
+/// Only the blocks the minifilter uses are kept; the others are skipped.
+///
+/// CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/DetoursHelpers.cpp (ParseFileAccessManifest)
+static NTSTATUS ParseManifest(_Inout_ PSANDBOXED_PIP pip)
+{
+    PBYTE payload = pip->Payload;
+    ULONG payloadSize = pip->PayloadSize;
+    size_t offset = 0;
+
+    if (ParseBlock<ManifestDebugFlag>(payload, payloadSize, offset) == nullptr
+        || ParseBlock<ManifestInjectionTimeout>(payload, payloadSize, offset) == nullptr
+        || !SkipTaggedBlock<ManifestTranslatePathsStrings_t>(payload, payloadSize, offset))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // Path translations only matter to processes that see the paths (Detours); the file system sees the real ones.
+    if (offset + sizeof(uint32_t) > payloadSize)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    uint32_t translatePathsCount = *reinterpret_cast<uint32_t const*>(payload + offset);
+    offset += sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < translatePathsCount; i++)
+    {
+        if (!SkipCharArray(payload, payloadSize, offset) || !SkipCharArray(payload, payloadSize, offset))
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+    }
+
+    // Internal error notification file
+    if (!SkipTaggedBlock<ManifestInternalDetoursErrorNotificationFileString_t>(payload, payloadSize, offset)
+        || !SkipCharArray(payload, payloadSize, offset))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PCManifestFlags flags = ParseBlock<ManifestFlags>(payload, payloadSize, offset);
+    PCManifestExtraFlags extraFlags = flags != nullptr ? ParseBlock<ManifestExtraFlags>(payload, payloadSize, offset) : nullptr;
+    if (extraFlags == nullptr
+        || ParseBlock<ManifestPipId>(payload, payloadSize, offset) == nullptr
+        || ParseBlock<ManifestReport>(payload, payloadSize, offset) == nullptr
+        || ParseBlock<ManifestDllBlock>(payload, payloadSize, offset) == nullptr)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PCManifestSuffixPolicies suffixPolicies = ParseBlock<ManifestSuffixPolicies>(payload, payloadSize, offset);
+    if (suffixPolicies == nullptr
+        || ParseBlock<ManifestFileMetadata>(payload, payloadSize, offset) == nullptr
+        || ParseBlock<ManifestBreakawayChildProcesses>(payload, payloadSize, offset) == nullptr
+        || ParseBlock<ManifestProcessAdmission>(payload, payloadSize, offset) == nullptr
+        || ParseBlock<ManifestTempRedirection>(payload, payloadSize, offset) == nullptr
+        || ParseBlock<ManifestLookupProfile>(payload, payloadSize, offset) == nullptr
+        || ParseBlock<ManifestProcessPriority>(payload, payloadSize, offset) == nullptr)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (offset + sizeof(ManifestRecord) > payloadSize)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PCManifestRecord root = reinterpret_cast<PCManifestRecord>(payload + offset);
+    if (root->CheckValid() != nullptr || root->GetPartialPath()[0] != L'\0')
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    pip->Flags = static_cast<FileAccessManifestFlag>(flags->Flags);
+    pip->ExtraFlags = static_cast<FileAccessManifestExtraFlag>(extraFlags->ExtraFlags);
+    pip->SuffixPolicies = suffixPolicies;
+    pip->Root = root;
+
+    // The reports are text lines; the consumer would expect records otherwise.
+    return CheckUseBinaryReportFormat(pip->ExtraFlags) ? STATUS_NOT_SUPPORTED : STATUS_SUCCESS;
+}
+
+static NTSTATUS LookUpSilo(uint64_t jobHandle, _Outptr_ PEJOB* job, _Outptr_ PESILO* silo)
+{
+    NTSTATUS status = ObReferenceObjectByHandle(
+        reinterpret_cast<HANDLE>(jobHandle),
+        JOB_OBJECT_QUERY,
+        *PsJobType,
+        UserMode,
+        reinterpret_cast<PVOID*>(job),
+        nullptr);
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    // The silo is the job itself; it is only valid while the job is referenced.
+    status = PsGetJobSilo(*job, silo);
+    if (!NT_SUCCESS(status))
+    {
+        ObDereferenceObject(*job);
+        *job = nullptr;
+    }
+
+    return status;
+}
+
+static NTSTATUS AddPip(_In_ BuildXLFilterMessage const& header, _In_reads_bytes_(header.PayloadSize) PBYTE userPayload, _In_ PESILO silo)
+{
+    if (header.PayloadSize == 0 || header.PayloadSize > BUILDXL_FILTER_MAX_PAYLOAD_SIZE)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PSANDBOXED_PIP pip = nullptr;
+    NTSTATUS status = PsCreateSiloContext(silo, sizeof(SANDBOXED_PIP), NonPagedPoolNx, CleanupPip, reinterpret_cast<PVOID*>(&pip));
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    RtlZeroMemory(pip, sizeof(SANDBOXED_PIP));
+    pip->PipId = header.PipId;
+    InterlockedIncrement(&g_filterData.LivePips);
+
+    // The manifest is copied, so that the client cannot change it under the policy search.
+    pip->Payload = reinterpret_cast<PBYTE>(ExAllocatePool2(POOL_FLAG_PAGED, header.PayloadSize, BUILDXL_FILTER_POOL_TAG));
+    pip->PayloadSize = header.PayloadSize;
+
+    if (pip->Payload == nullptr)
+    {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+    else
+    {
+        RtlCopyMemory(pip->Payload, userPayload, header.PayloadSize);
+        status = ParseManifest(pip);
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        status = MapReportRing(header.ReportRingSection, pip);
+    }
+
+    if (NT_SUCCESS(status))
+    {
+        // Fails with STATUS_OBJECT_NAME_EXISTS if the silo already belongs to a pip.
+        status = PsInsertSiloContext(silo, g_filterData.PipContextSlot, pip);
+    }
+
+    // The silo holds its own reference once inserted; otherwise this releases the pip (through CleanupPip).
+    PsDereferenceSiloContext(pip);
+    return status;
+}
+
+static NTSTATUS RemovePip(_In_ PESILO silo)
+{
+    PVOID removed = nullptr;
+    NTSTATUS status = PsRemoveSiloContext(silo, g_filterData.PipContextSlot, &removed);
+    if (NT_SUCCESS(status))
+    {
+        PsDereferenceSiloContext(removed);
+    }
+
+    return status;
+}
+
+NTSTATUS HandleFilterMessage(_In_reads_bytes_(size) BuildXLFilterMessage const* message, ULONG size)
+{
+    PAGED_CODE();
+
+    // Read once: the message is in the sender's memory.
+    BuildXLFilterMessage header = *message;
+
+    if (header.Version != BUILDXL_FILTER_PROTOCOL_VERSION)
+    {
+        return STATUS_REVISION_MISMATCH;
+    }
+
+    if (header.Command == BuildXLFilterCommand_AddPip
+        && (size < BUILDXL_FILTER_MESSAGE_HEADER_SIZE || header.PayloadSize > size - BUILDXL_FILTER_MESSAGE_HEADER_SIZE))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PEJOB job = nullptr;
+    PESILO silo = nullptr;
+    NTSTATUS status = LookUpSilo(header.JobHandle, &job, &silo);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    switch (header.Command)
+    {
+        case BuildXLFilterCommand_AddPip:
+            status = AddPip(header, const_cast<PBYTE>(message->Payload), silo);
+            break;
+
+        case BuildXLFilterCommand_RemovePip:
+            status = RemovePip(silo);
+            break;
+
+        default:
+            status = STATUS_INVALID_PARAMETER;
+            break;
+    }
+
+    ObDereferenceObject(job);
+    return status;
+}
+
+PSANDBOXED_PIP ReferenceCurrentPip()
+{
+    PESILO silo = PsGetCurrentSilo();
+    if (silo == nullptr)
+    {
+        return nullptr;
+    }
+
+    PVOID pip = nullptr;
+    return NT_SUCCESS(PsGetSiloContext(silo, g_filterData.PipContextSlot, &pip))
+        ? reinterpret_cast<PSANDBOXED_PIP>(pip)
+        : nullptr;
+}
+
+void DereferencePip(_In_ PSANDBOXED_PIP pip)
+{
+    PsDereferenceSiloContext(pip);
+}
+
+static inline LONG64 AlignSlotSize(size_t size)
+{
+    return (LONG64)((size + REPORT_RING_SLOT_ALIGNMENT - 1) & ~((size_t)REPORT_RING_SLOT_ALIGNMENT - 1));
+}
+
+/// The producer side of ReportRing.cpp, over the view of the ring in system space.
+///
+/// CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/ReportRing.cpp (TryWriteReportRing)
+static bool TryWriteReportRing(_In_ PSANDBOXED_PIP pip, _In_reads_bytes_(size) void const* data, size_t size)
+{
+    ReportRingHeader* ring = pip->Ring;
+    LONG64 capacity = (LONG64)ring->Capacity;
+    LONG64 slotSize = AlignSlotSize(sizeof(ReportRingSlot) + size);
+
+    if (slotSize > capacity / REPORT_RING_MAX_RECORD_FRACTION)
+    {
+        return false;
+    }
+
+    LONG64 reserve = 0;
+    LONG64 needed = 0;
+    LONG64 contiguous = 0;
+    bool reserved = false;
+
+    for (int attempt = 0; attempt < REPORT_RING_FULL_RETRY_COUNT && !reserved; attempt++)
+    {
+        reserve = ring->ReserveOffset;
+        contiguous = capacity - (reserve & (capacity - 1));
+
+        // A slot never wraps around; pad to the end of the data area first if it would.
+        needed = slotSize <= contiguous ? slotSize : contiguous + slotSize;
+
+        if (reserve + needed - ring->ReadOffset > capacity)
+        {
+            // Full. Give the consumer a chance to catch up.
+            if (attempt < REPORT_RING_FULL_RETRY_COUNT / 2)
+            {
+                YieldProcessor();
+            }
+            else
+            {
+                ZwYieldExecution();
+            }
+
+            continue;
+        }
+
+        reserved = InterlockedCompareExchange64(&ring->ReserveOffset, reserve + needed, reserve) == reserve;
+    }
+
+    if (!reserved)
+    {
+        return false;
+    }
+
+    LONG64 position = reserve & (capacity - 1);
+
+    if (needed != slotSize)
+    {
+        ReportRingSlot* skip = reinterpret_cast<ReportRingSlot*>(pip->RingData + position);
+        InterlockedExchange(&skip->SlotSize, (LONG)contiguous);
+        InterlockedExchange(&skip->Length, (LONG)(REPORT_RING_SKIP_SLOT | (ULONG)contiguous));
+        position = 0;
+    }
+
+    ReportRingSlot* slot = reinterpret_cast<ReportRingSlot*>(pip->RingData + position);
+    InterlockedExchange(&slot->SlotSize, (LONG)slotSize);
+    RtlCopyMemory(pip->RingData + position + sizeof(ReportRingSlot), data, size);
+
+    // Publishing the length commits the slot; the interlocked write is a full barrier, so the payload is visible first.
+    // The consumer skipped the slot if this took too long, in which case the report is dropped.
+    return InterlockedCompareExchange(&slot->Length, (LONG)size, 0) == 0;
+}
+
+bool SendReportLine(_In_ PSANDBOXED_PIP pip, _In_reads_(length) PCWSTR line, size_t length)
+{
+    // The view of the ring is pageable.
+    PAGED_CODE();
+
+    if (TryWriteReportRing(pip, line, length * sizeof(WCHAR)))
+    {
+        return true;
+    }
+
+    InterlockedIncrement64(&pip->DroppedReports);
+    return false;
+}
+
+/// Formats the report line the way SendFileAccessReport does for text reports (without the command line, which the
+/// minifilter does not see).
+///
+/// CODESYNC: Public/Src/Sandbox/Windows/DetoursServices/SendReport.cpp (SendFileAccessReport)
+void ReportFileAccess(
+    _In_ PSANDBOXED_PIP pip,
+    _In_z_ PCWSTR operation,
+    HANDLE processId,
+    PolicyResult const& policyResult,
+    AccessCheckResult const& accessCheckResult,
+    DWORD error,
+    DWORD desiredAccess,
+    DWORD shareMode,
+    DWORD creationDisposition,
+    DWORD flagsAndAttributes,
+    _In_z_ PCWSTR path)
+{
+    PAGED_CODE();
+
+    // See SendFileAccessReport for what the 100 characters are for.
+    size_t reportLength = wcslen(path) + wcslen(operation) + 100;
+    PWCHAR report = reinterpret_cast<PWCHAR>(ExAllocatePool2(POOL_FLAG_PAGED, reportLength * sizeof(WCHAR), BUILDXL_FILTER_POOL_TAG));
+    if (report == nullptr)
+    {
+        InterlockedIncrement64(&pip->DroppedReports);
+        return;
+    }
+
+    size_t remaining = 0;
+    NTSTATUS status = RtlStringCchPrintfExW(report, reportLength, nullptr, &remaining, 0, L"%d,%s:%lx|%x|%x|%x|%lx|%llx|%lx|%lx|%lx|%lx|%lx|%s|%s\r\n",
+        ReportType_FileAccess,
+        operation,
+        (DWORD)(ULONG_PTR)processId,
+        (DWORD)accessCheckResult.RequestedAccess,
+        (DWORD)accessCheckResult.GetFileAccessStatus(),
+        (int)(accessCheckResult.ReportLevel == ReportLevel::ReportExplicit),
+        error,
+        (USN)-1,
+        desiredAccess,
+        shareMode,
+        creationDisposition,
+        flagsAndAttributes,
+        policyResult.IsIndeterminate() ? 0 : policyResult.GetPathId(),
+        path,
+        L"");
+
+    if (NT_SUCCESS(status))
+    {
+        SendReportLine(pip, report, reportLength - remaining);
+    }
+    else
+    {
+        InterlockedIncrement64(&pip->DroppedReports);
+    }
+
+    ExFreePoolWithTag(report, BUILDXL_FILTER_POOL_TAG);
+}
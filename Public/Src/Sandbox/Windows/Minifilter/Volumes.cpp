@@ -0,0 +1,194 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Volumes.cpp : the DOS names of the volumes the minifilter is attached to.
+//
+// The file system reports NT paths (\Device\HarddiskVolume3\foo) while manifest paths are DOS paths (C:\foo), so paths
+// are converted before any policy lookup. A volume without a drive letter (e.g. one mounted into a directory) has no
+// DOS path of its own; accesses through it are not checked.
+
+#include "BuildXLFilter.h"
+
+#define MAX_VOLUMES 64
+
+// ----------------------------------------------------------------------------
+// TYPE DEFINITIONS
+// ----------------------------------------------------------------------------
+
+typedef struct _VOLUME_ENTRY
+{
+    PFLT_VOLUME Volume;
+    UNICODE_STRING DeviceName;
+    WCHAR DosName[8];
+    USHORT DosNameLength; // in characters
+} VOLUME_ENTRY;
+
+// ----------------------------------------------------------------------------
+// GLOBALS
+// ----------------------------------------------------------------------------
+
+static EX_PUSH_LOCK s_volumesLock;
+static VOLUME_ENTRY s_volumes[MAX_VOLUMES];
+
+// ----------------------------------------------------------------------------
+// FUNCTION DEFINITIONS
+// ----------------------------------------------------------------------------
+
+NTSTATUS InitializeVolumes()
+{
+    FltInitializePushLock(&s_volumesLock);
+    RtlZeroMemory(s_volumes, sizeof(s_volumes));
+    return STATUS_SUCCESS;
+}
+
+void UninitializeVolumes()
+{
+    for (size_t i = 0; i < MAX_VOLUMES; i++)
+    {
+        if (s_volumes[i].DeviceName.Buffer != nullptr)
+        {
+            ExFreePoolWithTag(s_volumes[i].DeviceName.Buffer, BUILDXL_FILTER_POOL_TAG);
+        }
+    }
+
+    RtlZeroMemory(s_volumes, sizeof(s_volumes));
+    FltDeletePushLock(&s_volumesLock);
+}
+
+void AddVolume(_In_ PCFLT_RELATED_OBJECTS fltObjects)
+{
+    PAGED_CODE();
+
+    PDEVICE_OBJECT diskDevice = nullptr;
+    if (!NT_SUCCESS(FltGetDiskDeviceObject(fltObjects->Volume, &diskDevice)))
+    {
+        return;
+    }
+
+    UNICODE_STRING dosName = { 0 };
+    NTSTATUS status = IoVolumeDeviceToDosName(diskDevice, &dosName);
+    ObDereferenceObject(diskDevice);
+
+    if (!NT_SUCCESS(status))
+    {
+        return;
+    }
+
+    VOLUME_ENTRY entry = { 0 };
+    entry.Volume = fltObjects->Volume;
+
+    // Only drive letters: a volume mounted into a directory is reached through the path of that directory.
+    if (dosName.Length == 2 * sizeof(WCHAR) && dosName.Buffer[1] == NT_VOLUME_SEPARATOR)
+    {
+        entry.DosName[0] = dosName.Buffer[0];
+        entry.DosName[1] = NT_VOLUME_SEPARATOR;
+        entry.DosNameLength = 2;
+    }
+
+    ExFreePool(dosName.Buffer);
+
+    if (entry.DosNameLength == 0)
+    {
+        return;
+    }
+
+    ULONG deviceNameSize = 0;
+    FltGetVolumeName(fltObjects->Volume, nullptr, &deviceNameSize);
+    if (deviceNameSize == 0)
+    {
+        return;
+    }
+
+    entry.DeviceName.Buffer = reinterpret_cast<PWCH>(ExAllocatePool2(POOL_FLAG_PAGED, deviceNameSize, BUILDXL_FILTER_POOL_TAG));
+    if (entry.DeviceName.Buffer == nullptr)
+    {
+        return;
+    }
+
+    entry.DeviceName.MaximumLength = (USHORT)deviceNameSize;
+    if (!NT_SUCCESS(FltGetVolumeName(fltObjects->Volume, &entry.DeviceName, nullptr)))
+    {
+        ExFreePoolWithTag(entry.DeviceName.Buffer, BUILDXL_FILTER_POOL_TAG);
+        return;
+    }
+
+    bool added = false;
+
+    FltAcquirePushLockExclusive(&s_volumesLock);
+    for (size_t i = 0; i < MAX_VOLUMES && !added; i++)
+    {
+        if (s_volumes[i].Volume == nullptr)
+        {
+            s_volumes[i] = entry;
+            added = true;
+        }
+    }
+    FltReleasePushLock(&s_volumesLock);
+
+    if (!added)
+    {
+        ExFreePoolWithTag(entry.DeviceName.Buffer, BUILDXL_FILTER_POOL_TAG);
+    }
+}
+
+void RemoveVolume(_In_ PCFLT_RELATED_OBJECTS fltObjects)
+{
+    PAGED_CODE();
+
+    PWCH deviceName = nullptr;
+
+    FltAcquirePushLockExclusive(&s_volumesLock);
+    for (size_t i = 0; i < MAX_VOLUMES; i++)
+    {
+        if (s_volumes[i].Volume == fltObjects->Volume)
+        {
+            deviceName = s_volumes[i].DeviceName.Buffer;
+            RtlZeroMemory(&s_volumes[i], sizeof(VOLUME_ENTRY));
+            break;
+        }
+    }
+    FltReleasePushLock(&s_volumesLock);
+
+    if (deviceName != nullptr)
+    {
+        ExFreePoolWithTag(deviceName, BUILDXL_FILTER_POOL_TAG);
+    }
+}
+
+size_t ToDosPath(_In_ PCUNICODE_STRING ntPath, _Out_writes_(bufferLength) PWCHAR buffer, size_t bufferLength)
+{
+    size_t length = 0;
+
+    FltAcquirePushLockShared(&s_volumesLock);
+    for (size_t i = 0; i < MAX_VOLUMES; i++)
+    {
+        VOLUME_ENTRY const& entry = s_volumes[i];
+        if (entry.Volume == nullptr || !RtlPrefixUnicodeString(&entry.DeviceName, ntPath, /*CaseInSensitive*/ TRUE))
+        {
+            continue;
+        }
+
+        // The prefix has to end at a component boundary (\Device\HarddiskVolume1 is a prefix of \Device\HarddiskVolume12\foo).
+        size_t deviceNameLength = entry.DeviceName.Length / sizeof(WCHAR);
+        size_t ntPathLength = ntPath->Length / sizeof(WCHAR);
+        if (ntPathLength > deviceNameLength && ntPath->Buffer[deviceNameLength] != NT_DIRECTORY_SEPARATOR)
+        {
+            continue;
+        }
+
+        size_t remainderLength = ntPathLength - deviceNameLength;
+        if (entry.DosNameLength + remainderLength + 1 > bufferLength)
+        {
+            break;
+        }
+
+        RtlCopyMemory(buffer, entry.DosName, entry.DosNameLength * sizeof(WCHAR));
+        RtlCopyMemory(buffer + entry.DosNameLength, ntPath->Buffer + deviceNameLength, remainderLength * sizeof(WCHAR));
+        length = entry.DosNameLength + remainderLength;
+        buffer[length] = L'\0';
+        break;
+    }
+    FltReleasePushLock(&s_volumesLock);
+
+    return length;
+}
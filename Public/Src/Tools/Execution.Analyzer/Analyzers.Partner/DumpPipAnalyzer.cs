@@ -326,7 +326,8 @@ namespace BuildXL.Execution.Analyzer
                 m_html.CreateRow("CreationFlags", data.CreationFlags.ToString(CultureInfo.InvariantCulture)),
                 m_html.CreateRow("Detoured", data.Detoured),
                 m_html.CreateRow("Error", data.Error.ToString(CultureInfo.InvariantCulture)),
-                m_html.CreateRow("CreateProcessStatusReturn", data.CreateProcessStatusReturn.ToString(CultureInfo.InvariantCulture)));
+                m_html.CreateRow("CreateProcessStatusReturn", data.CreateProcessStatusReturn.ToString(CultureInfo.InvariantCulture)),
+                m_html.CreateRow("Timings", data.Timings.ToString()));
         }
 
         private string PrintIoTypeCounters(IOTypeCounters counters)
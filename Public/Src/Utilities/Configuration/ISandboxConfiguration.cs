@@ -125,6 +125,12 @@ namespace BuildXL.Utilities.Configuration
         /// </summary>
         bool LogProcessData { get; }
 
+        /// <summary>
+        /// Records one summary of the processes of each pip (execution times, IO counts and peak memory), from the accounting of
+        /// the job object the pip runs in. Unlike <see cref="LogProcessData"/>, the detoured processes send nothing for it.
+        /// </summary>
+        bool LogPipProcessData { get; }
+
         /// <summary>
         /// Records the file enforcement access tables for individual pips to the log. Defaults to off.
         /// </summary>
@@ -188,6 +194,68 @@ namespace BuildXL.Utilities.Configuration
         /// </summary>
         bool KextEnableReportBatching { get; }
 
+        /// <summary>
+        /// Number of report queues the sandbox kernel extension allocates for this client.
+        /// </summary>
+        /// <remarks>
+        /// Each queue has its own listener thread, and all reports of a pip go through the same queue.
+        /// The size of each queue is <see cref="KextReportQueueSizeMb"/>.
+        /// </remarks>
+        uint KextNumReportQueues { get; }
+
+        /// <summary>
+        /// Maximum number of paths the sandbox kernel extension caches per pip; 0 means no limit.
+        /// </summary>
+        /// <remarks>
+        /// When a pip exceeds it, the paths it has not accessed recently are evicted from its cache.
+        /// </remarks>
+        uint KextPathCacheBudget { get; }
+
+        /// <summary>
+        /// Tells the sandbox kernel extension to map the file access manifests of started pips instead of copying them.
+        /// </summary>
+        bool KextMapPipPayloads { get; }
+
+        /// <summary>
+        /// Classes of operations (a combination of the flags of Sandbox.OperationClasses) whose allowed accesses the sandbox
+        /// kernel extension does not report; 0 to report all of them.
+        /// </summary>
+        /// <remarks>
+        /// Meant for builds that never look at some accesses (e.g., lookups and probes), which then are neither computed nor queued.
+        /// </remarks>
+        uint KextIgnoredOperationClasses { get; }
+
+        /// <summary>
+        /// When greater than 0 (and <see cref="KextEnableReportBatching"/> is set), the sandbox kernel extension merges consecutive
+        /// reports of the same process for the same path, created at most this many microseconds apart, into one report.
+        /// </summary>
+        uint KextReportCoalescingWindowUs { get; }
+
+        /// <summary>
+        /// When set, access denials and process starts and exits are sent through a separate report queue (with its own listener),
+        /// so that they are not held up behind the bulk of the access reports.
+        /// </summary>
+        bool KextEnablePriorityReportQueue { get; }
+
+        /// <summary>
+        /// When set (and <see cref="KextEnableReportBatching"/> is set), the sandbox kernel extension summarizes the allowed accesses
+        /// reported through a queue while BuildXL lags behind on it, instead of holding processes back and eventually failing.
+        /// </summary>
+        bool KextSummarizeReportsWhenLagging { get; }
+
+        /// <summary>
+        /// When its counters are enabled, the sandbox kernel extension only times 1 in every this many events (every event if 0 or 1)
+        /// and scales the measured durations accordingly.  Timing every event stays available through 'sysctl kern.bxl_enable_full_timing=1'.
+        /// </summary>
+        uint KextTimingSampleRate { get; }
+
+        /// <summary>
+        /// When greater than 0 (and <see cref="KextEnableReportBatching"/> is set), the sandbox kernel extension summarizes the allowed
+        /// accesses a pip reports beyond this many per second, and sends them once the report queue has nothing else to send, so that
+        /// a pip flooding a queue it shares with others does not hold their reports up.
+        /// </summary>
+        uint KextMaxPipReportRate { get; }
+
         /// <summary>
         /// Throttling can be triggered when CPU usage is above this value.
         /// </summary>
@@ -203,6 +271,59 @@ namespace BuildXL.Utilities.Configuration
         /// </summary>
         uint KextThrottleMinAvailableRamMB { get; }
 
+        /// <summary>
+        /// A process blocked because of low RAM can be awakened only when available RAM is at least
+        /// <see cref="KextThrottleMinAvailableRamMB"/> plus this value.
+        /// </summary>
+        uint KextThrottleRamWakeupMarginMB { get; }
+
+        /// <summary>
+        /// When greater than 0, the sandbox kernel extension samples CPU usage itself at most this often (in milliseconds).
+        /// </summary>
+        uint KextThrottleCpuSampleIntervalMs { get; }
+
+        /// <summary>
+        /// When greater than 0, the sandbox kernel extension sheds the cold entries of the path caches of the pips whenever available RAM
+        /// drops below this value (in megabytes), so that its caches do not add to the memory pressure of the machine.
+        /// </summary>
+        uint KextCacheShrinkRamMB { get; }
+
+        /// <summary>
+        /// When greater than 0, a native thread of the interop library pushes CPU usage and available RAM to the sandbox kernel
+        /// extension this often (in milliseconds), instead of the scheduler pushing them each time it collects performance counters.
+        /// </summary>
+        uint KextThrottleResourceSampleIntervalMs { get; }
+
+        /// <summary>
+        /// When greater than 0 (and a power of 2), the interop library puts the reports of each pip into a ring of this many reports
+        /// that the executor of the pip drains itself, instead of handing all reports to the listener of their queue for routing.
+        /// </summary>
+        uint KextPipReportRingCapacity { get; }
+
+        /// <summary>
+        /// How long (in microseconds) the listeners of the sandbox kernel extension report queues keep polling after draining their
+        /// queue, before they block and wait to be woken up; 0 to block right away.
+        /// </summary>
+        uint KextListenerSpinUs { get; }
+
+        /// <summary>
+        /// QoS class (a qos_class_t value, e.g., 0x21 for user-interactive) the listeners of the report queues run at; 0 to leave it as it is.
+        /// </summary>
+        uint KextListenerQosClass { get; }
+
+        /// <summary>
+        /// When greater than 0 (on Windows), the detoured processes wait before starting a child process while the commit charge or the
+        /// CPU usage of the machine is above this percentage, so that highly parallel pips stop spawning processes instead of making the
+        /// machine page.
+        /// </summary>
+        uint ProcessAdmissionThresholdPercent { get; }
+
+        /// <summary>
+        /// Longest time (in milliseconds) a detoured process waits to start a child process when <see cref="ProcessAdmissionThresholdPercent"/>
+        /// is set; 0 for no limit.
+        /// </summary>
+        uint ProcessAdmissionMaxWaitMs { get; }
+
         /// <summary>
         /// Container-related configuration
         /// </summary>
@@ -36,9 +36,27 @@ namespace BuildXL.Utilities.Configuration.Mutable
             KextMeasureProcessCpuTimes = false;             // measuring CPU times amounts to wrapping processes in /usr/bin/time, so let's not do that by default
             KextReportQueueSizeMb = 0;                      // let the sandbox kernel extension apply defaults
             KextEnableReportBatching = true;                // use lock-free queue for batching access reports
+            KextNumReportQueues = 1;                        // a single report queue (and listener) per client
+            KextPathCacheBudget = 0;                        // no limit on the number of paths cached per pip
+            KextMapPipPayloads = false;                     // copy file access manifests into the sandbox kernel extension
+            KextIgnoredOperationClasses = 0;                // report accesses of all operation classes
+            KextReportCoalescingWindowUs = 0;               // don't merge reports
+            KextEnablePriorityReportQueue = false;          // all reports of a pip go through the same queue
+            KextSummarizeReportsWhenLagging = false;        // send every report, no matter how far behind the listener is
+            KextTimingSampleRate = 16;                      // time 1 in 16 events when sandbox kernel extension counters are enabled
+            KextMaxPipReportRate = 0;                       // no pip reports too fast
             KextThrottleCpuUsageBlockThresholdPercent = 0;  // no throttling by default
             KextThrottleCpuUsageWakeupThresholdPercent = 0; // no throttling by default
             KextThrottleMinAvailableRamMB = 0;              // no throttling by default
+            KextThrottleRamWakeupMarginMB = 0;              // no hysteresis on available RAM by default
+            KextThrottleCpuSampleIntervalMs = 0;            // CPU usage is pushed to the sandbox kernel extension by default
+            KextCacheShrinkRamMB = 0;                       // path caches only ever shrink to their budget by default
+            KextThrottleResourceSampleIntervalMs = 0;       // resource usage is pushed by the scheduler by default
+            KextPipReportRingCapacity = 0;                  // reports are routed to their pips by the listeners by default
+            KextListenerSpinUs = 0;                         // listeners block as soon as their queue is empty
+            KextListenerQosClass = 0;                       // listeners run at the QoS class of their threads
+            ProcessAdmissionThresholdPercent = 0;           // detoured processes start their child processes right away
+            ProcessAdmissionMaxWaitMs = 60000;              // wait at most a minute to start a child process
             ContainerConfiguration = new SandboxContainerConfiguration();
             AdminRequiredProcessExecutionMode = AdminRequiredProcessExecutionMode.Internal;
         }
@@ -61,6 +79,7 @@ namespace BuildXL.Utilities.Configuration.Mutable
             LogObservedFileAccesses = template.LogObservedFileAccesses;
             LogProcesses = template.LogProcesses;
             LogProcessData = template.LogProcessData;
+            LogPipProcessData = template.LogPipProcessData;
             LogFileAccessTables = template.LogFileAccessTables;
             OutputReportingMode = template.OutputReportingMode;
             FileSystemMode = template.FileSystemMode;
@@ -78,9 +97,27 @@ namespace BuildXL.Utilities.Configuration.Mutable
             KextMeasureProcessCpuTimes = template.KextMeasureProcessCpuTimes;
             KextReportQueueSizeMb = template.KextReportQueueSizeMb;
             KextEnableReportBatching = template.KextEnableReportBatching;
+            KextNumReportQueues = template.KextNumReportQueues;
+            KextPathCacheBudget = template.KextPathCacheBudget;
+            KextMapPipPayloads = template.KextMapPipPayloads;
+            KextIgnoredOperationClasses = template.KextIgnoredOperationClasses;
+            KextReportCoalescingWindowUs = template.KextReportCoalescingWindowUs;
+            KextEnablePriorityReportQueue = template.KextEnablePriorityReportQueue;
+            KextSummarizeReportsWhenLagging = template.KextSummarizeReportsWhenLagging;
+            KextTimingSampleRate = template.KextTimingSampleRate;
+            KextMaxPipReportRate = template.KextMaxPipReportRate;
             KextThrottleCpuUsageBlockThresholdPercent = template.KextThrottleCpuUsageBlockThresholdPercent;
             KextThrottleCpuUsageWakeupThresholdPercent = template.KextThrottleCpuUsageWakeupThresholdPercent;
             KextThrottleMinAvailableRamMB = template.KextThrottleMinAvailableRamMB;
+            KextThrottleRamWakeupMarginMB = template.KextThrottleRamWakeupMarginMB;
+            KextThrottleCpuSampleIntervalMs = template.KextThrottleCpuSampleIntervalMs;
+            KextCacheShrinkRamMB = template.KextCacheShrinkRamMB;
+            KextThrottleResourceSampleIntervalMs = template.KextThrottleResourceSampleIntervalMs;
+            KextPipReportRingCapacity = template.KextPipReportRingCapacity;
+            KextListenerSpinUs = template.KextListenerSpinUs;
+            KextListenerQosClass = template.KextListenerQosClass;
+            ProcessAdmissionThresholdPercent = template.ProcessAdmissionThresholdPercent;
+            ProcessAdmissionMaxWaitMs = template.ProcessAdmissionMaxWaitMs;
             ContainerConfiguration = new SandboxContainerConfiguration(template.ContainerConfiguration);
             AdminRequiredProcessExecutionMode = template.AdminRequiredProcessExecutionMode;
         }
@@ -158,6 +195,9 @@ namespace BuildXL.Utilities.Configuration.Mutable
         /// <inheritdoc />
         public bool LogProcessData { get; set; }
 
+        /// <inheritdoc />
+        public bool LogPipProcessData { get; set; }
+
         /// <inheritdoc />
         public bool LogFileAccessTables { get; set; }
 
@@ -200,6 +240,33 @@ namespace BuildXL.Utilities.Configuration.Mutable
         /// <inheritdoc />
         public bool KextEnableReportBatching { get; set; }
 
+        /// <inheritdoc />
+        public uint KextNumReportQueues { get; set; }
+
+        /// <inheritdoc />
+        public uint KextPathCacheBudget { get; set; }
+
+        /// <inheritdoc />
+        public bool KextMapPipPayloads { get; set; }
+
+        /// <inheritdoc />
+        public uint KextIgnoredOperationClasses { get; set; }
+
+        /// <inheritdoc />
+        public uint KextReportCoalescingWindowUs { get; set; }
+
+        /// <inheritdoc />
+        public bool KextEnablePriorityReportQueue { get; set; }
+
+        /// <inheritdoc />
+        public bool KextSummarizeReportsWhenLagging { get; set; }
+
+        /// <inheritdoc />
+        public uint KextTimingSampleRate { get; set; }
+
+        /// <inheritdoc />
+        public uint KextMaxPipReportRate { get; set; }
+
         /// <inheritdoc />
         public uint KextThrottleCpuUsageBlockThresholdPercent { get; set;  }
 
@@ -209,6 +276,33 @@ namespace BuildXL.Utilities.Configuration.Mutable
         /// <inheritdoc />
         public uint KextThrottleMinAvailableRamMB { get; set; }
 
+        /// <inheritdoc />
+        public uint KextThrottleRamWakeupMarginMB { get; set; }
+
+        /// <inheritdoc />
+        public uint KextThrottleCpuSampleIntervalMs { get; set; }
+
+        /// <inheritdoc />
+        public uint KextCacheShrinkRamMB { get; set; }
+
+        /// <inheritdoc />
+        public uint KextThrottleResourceSampleIntervalMs { get; set; }
+
+        /// <inheritdoc />
+        public uint KextPipReportRingCapacity { get; set; }
+
+        /// <inheritdoc />
+        public uint KextListenerSpinUs { get; set; }
+
+        /// <inheritdoc />
+        public uint KextListenerQosClass { get; set; }
+
+        /// <inheritdoc />
+        public uint ProcessAdmissionThresholdPercent { get; set; }
+
+        /// <inheritdoc />
+        public uint ProcessAdmissionMaxWaitMs { get; set; }
+
         /// <inheritdoc />
         public SandboxContainerConfiguration ContainerConfiguration { get; set; }
 
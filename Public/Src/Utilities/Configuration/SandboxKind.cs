@@ -31,6 +31,29 @@ namespace BuildXL.Utilities.Configuration
         /// <summary>
         /// Like <see cref="MacOsKext"/> except that it gnores all reported file accesses.
         /// </summary>
-        MacOsKextIgnoreFileAccesses
+        MacOsKextIgnoreFileAccesses,
+
+        /// <summary>
+        /// Linux-specific: using a library the processes load through LD_PRELOAD
+        /// </summary>
+        LinuxLdPreload,
+
+        /// <summary>
+        /// Linux-specific: using the eBPF observer, which sees statically linked tools too but cannot deny accesses (report-only);
+        /// needs CAP_BPF and CAP_PERFMON, and cgroup v2
+        /// </summary>
+        LinuxEbpf,
+
+        /// <summary>
+        /// Windows-specific: using the BuildXL minifilter instead of Detours, which also sees the processes Detours cannot follow;
+        /// needs the minifilter to be loaded
+        /// </summary>
+        WinMinifilter,
+
+        /// <summary>
+        /// macOS-specific: using the Endpoint Security client of the interop library instead of the kernel extension (macOS 10.15+);
+        /// needs BuildXL to run as root and to be signed with the Endpoint Security client entitlement
+        /// </summary>
+        MacOsEndpointSecurity
     }
 }
@@ -3,6 +3,10 @@
 #if FEATURE_ARIA_TELEMETRY
 
 using System;
+#if PLATFORM_OSX
+using System.IO;
+using System.Text;
+#endif
 #if !FEATURE_CORECLR
 using Microsoft.Applications.Telemetry;
 using Microsoft.Applications.Telemetry.Desktop;
@@ -37,7 +41,10 @@ namespace BuildXL.Utilities.Instrumentation.Common
         private EventProperties m_eventProperties;
 #else
     #if PLATFORM_OSX
-        private IntPtr m_eventProperties;
+        // The event is packed into a buffer and logged in a single interop call (see LogEventBatch in AriaLogger.hpp)
+        private MemoryStream m_packedEvent;
+        private BinaryWriter m_packedEventWriter;
+        private ushort m_propertyCount;
     #endif
 #endif
         private readonly string m_targetFramework;
@@ -49,7 +56,8 @@ namespace BuildXL.Utilities.Instrumentation.Common
         /// <param name="name">The event name</param>
         /// <param name="targetFramework">The target framework to create the Aria logging facilities for</param>
         /// <param name="targetRuntime">TThe target runtime to create the Aria logging facilities for</param>
-        public AriaEvent(string name, string targetFramework, string targetRuntime)
+        /// <param name="priority">Events of lower priorities are dropped first under memory pressure (macOS only)</param>
+        public AriaEvent(string name, string targetFramework, string targetRuntime, byte priority = 1)
         {
             m_targetFramework = targetFramework;
             m_targetRuntime = targetRuntime;
@@ -58,11 +66,31 @@ namespace BuildXL.Utilities.Instrumentation.Common
             m_eventProperties = new EventProperties(name);
 #else
     #if PLATFORM_OSX
-            m_eventProperties = AriaMacOS.CreateEvent(name);
+            m_packedEvent = new MemoryStream();
+            m_packedEventWriter = new BinaryWriter(m_packedEvent);
+            m_packedEventWriter.Write((uint)0); // length, set in Log()
+            m_packedEventWriter.Write(Math.Min(priority, AriaMacOS.MaxEventPriority));
+            m_packedEventWriter.Write((ushort)0); // property count, set in Log()
+            WritePackedString(name);
     #endif
 #endif
         }
 
+#if FEATURE_CORECLR && PLATFORM_OSX
+        private void WritePackedString(string value)
+        {
+            m_packedEventWriter.Write(Encoding.UTF8.GetBytes(value ?? string.Empty));
+            m_packedEventWriter.Write((byte)0);
+        }
+
+        private void WritePackedPropertyHeader(byte type, string name)
+        {
+            m_packedEventWriter.Write(type);
+            WritePackedString(name);
+            m_propertyCount++;
+        }
+#endif
+
         /// <summary>
         /// Sets a property on a concrete Aria event
         /// </summary>
@@ -74,7 +102,8 @@ namespace BuildXL.Utilities.Instrumentation.Common
             m_eventProperties.SetProperty(name, value);
 #else
     #if PLATFORM_OSX
-            AriaMacOS.SetStringProperty(m_eventProperties, name, value);
+            WritePackedPropertyHeader(AriaMacOS.PropertyTypeString, name);
+            WritePackedString(value);
     #endif
 #endif
         }
@@ -91,7 +120,9 @@ namespace BuildXL.Utilities.Instrumentation.Common
             m_eventProperties.SetProperty(name, value, ConvertPiiType(type));
 #else
     #if PLATFORM_OSX
-            AriaMacOS.SetStringPropertyWithPiiKind(m_eventProperties, name, value, (int) type);
+            WritePackedPropertyHeader(AriaMacOS.PropertyTypeStringWithPii, name);
+            m_packedEventWriter.Write((int)type);
+            WritePackedString(value);
     #endif
 #endif
         }
@@ -107,7 +138,8 @@ namespace BuildXL.Utilities.Instrumentation.Common
             m_eventProperties.SetProperty(name, value);
 #else
     #if PLATFORM_OSX
-            AriaMacOS.SetInt64Property(m_eventProperties, name, value);
+            WritePackedPropertyHeader(AriaMacOS.PropertyTypeInt64, name);
+            m_packedEventWriter.Write(value);
     #endif
 #endif
         }
@@ -121,11 +153,18 @@ namespace BuildXL.Utilities.Instrumentation.Common
             LogManager.GetLogger().LogEvent(m_eventProperties);
 #else
     #if PLATFORM_OSX
-            AriaMacOS.LogEvent(AriaV2StaticState.s_AriaLogger, m_eventProperties);
+            m_packedEventWriter.Flush();
+            byte[] packedEvent = m_packedEvent.GetBuffer();
+            uint length = (uint)m_packedEvent.Length;
+            BitConverter.GetBytes(length).CopyTo(packedEvent, 0);
+            BitConverter.GetBytes(m_propertyCount).CopyTo(packedEvent, sizeof(uint) + sizeof(byte));
+
+            // Queued for the native background thread, so logging never waits on the Aria SDK
+            AriaMacOS.LogEventBatch(AriaV2StaticState.s_AriaLogger, packedEvent, length);
 
-            // Free the native Aria event
-            AriaMacOS.DisposeEvent(m_eventProperties);
-            m_eventProperties = IntPtr.Zero;
+            m_packedEventWriter.Dispose();
+            m_packedEventWriter = null;
+            m_packedEvent = null;
     #endif
 #endif
         }
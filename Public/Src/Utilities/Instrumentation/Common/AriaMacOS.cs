@@ -46,6 +46,28 @@ namespace BuildXL.Utilities.Instrumentation.Common
         /// <nodoc />
         [DllImport(AriaLibMacOS)]
         static public extern void LogEvent(IntPtr logger, IntPtr event_);
+
+        /// <summary>
+        /// Property types of a packed event (must match ARIA_PROPERTY_* in AriaLogger.hpp)
+        /// </summary>
+        public const byte PropertyTypeString = 0;
+
+        /// <nodoc />
+        public const byte PropertyTypeStringWithPii = 1;
+
+        /// <nodoc />
+        public const byte PropertyTypeInt64 = 2;
+
+        /// <summary>
+        /// Highest priority a packed event can have (ARIA_EVENT_PRIORITY_COUNT - 1 in AriaLogger.hpp)
+        /// </summary>
+        public const byte MaxEventPriority = 3;
+
+        /// <summary>
+        /// Queues a buffer of packed events to be logged on a background thread; returns the number of events dropped
+        /// </summary>
+        [DllImport(AriaLibMacOS)]
+        static public extern int LogEventBatch(IntPtr logger, byte[] batch, uint length);
     }
 }
 #endif //FEATURE_ARIA_TELEMETRY
\ No newline at end of file
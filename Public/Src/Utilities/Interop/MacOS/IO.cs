@@ -163,6 +163,41 @@ namespace BuildXL.Interop.MacOS
         public static int StatFileDescriptor(SafeFileHandle fd, ref StatBuffer statBuf)
             => StatFileDescriptor(fd, ref statBuf, Marshal.SizeOf(statBuf));
 
+        /// <summary>
+        /// Maximum length of <see cref="DirectoryEntryStatBuffer.Name"/> (must match DIRECTORY_ENTRY_NAME_MAX in io.h)
+        /// </summary>
+        public const int DirectoryEntryNameMax = 768;
+
+        [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Ansi)]
+        public struct DirectoryEntryStatBuffer
+        {
+            public StatBuffer Stat;
+
+            [MarshalAs(UnmanagedType.ByValTStr, SizeConst = DirectoryEntryNameMax)]
+            public string Name;
+        }
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
+        private static extern int StatDirectoryEntries(string path, [In, Out] DirectoryEntryStatBuffer[] entries, int entryCapacity, long entrySize, out int entryCount);
+
+        /// <summary>
+        /// Stats all entries of the directory at <paramref name="path"/> in bulk, without following symlinks.
+        /// Returns 0 on success, ENOBUFS when <paramref name="entries"/> is too small to hold <paramref name="entryCount"/> entries,
+        /// and an error code otherwise.
+        /// </summary>
+        public static int StatDirectoryEntries(string path, DirectoryEntryStatBuffer[] entries, out int entryCount)
+            => StatDirectoryEntries(path, entries, entries.Length, Marshal.SizeOf<DirectoryEntryStatBuffer>(), out entryCount);
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
+        private static extern int StatFiles(string[] paths, int pathCount, bool followSymlink, [Out] StatBuffer[] statBuffers, [Out] int[] results, long statBufferSize, int maxThreads);
+
+        /// <summary>
+        /// Stats all <paramref name="paths"/> using up to <paramref name="maxThreads"/> threads; <paramref name="results"/> receives
+        /// 0 or the error code of each path.
+        /// </summary>
+        public static int StatFiles(string[] paths, bool followSymlink, StatBuffer[] statBuffers, int[] results, int maxThreads)
+            => StatFiles(paths, paths.Length, followSymlink, statBuffers, results, Marshal.SizeOf<StatBuffer>(), maxThreads);
+
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true, CharSet = CharSet.Ansi)]
         public static extern int GetFileSystemType(SafeFileHandle fd, StringBuilder fsTypeName, long bufferSize);
 
@@ -173,6 +208,16 @@ namespace BuildXL.Interop.MacOS
         [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
         public static extern int SetTimeStampsForFilePath(string path, bool followSymlink, StatBuffer buffer);
 
+        [DllImport(Libraries.BuildXLInteropLibMacOS, SetLastError = true)]
+        private static extern int SetTimeStampsForFilePaths(string[] paths, int pathCount, bool followSymlink, StatBuffer[] statBuffers, int statBufferCount, [Out] int[] results, long statBufferSize, int maxThreads);
+
+        /// <summary>
+        /// Sets the time stamps of all <paramref name="paths"/> using up to <paramref name="maxThreads"/> threads; <paramref name="statBuffers"/>
+        /// holds either one set of time stamps per path or a single one for all of them, and <paramref name="results"/> receives 0 or the error code of each path.
+        /// </summary>
+        public static int SetTimeStampsForFilePaths(string[] paths, bool followSymlink, StatBuffer[] statBuffers, int[] results, int maxThreads)
+            => SetTimeStampsForFilePaths(paths, paths.Length, followSymlink, statBuffers, statBuffers.Length, results, Marshal.SizeOf<StatBuffer>(), maxThreads);
+
         /// <summary>
         /// Read the value of a symbolic link specified by <paramref name="link"/>
         /// Returns number of bytes placed in buf, and -1 otherwise.
@@ -213,6 +258,13 @@ namespace BuildXL.Interop.MacOS
         [DllImport(Libraries.LibC, SetLastError = true)]
         public static extern int link(string link, string hardlinkFilePath);
 
+        /// <summary>
+        /// Creates a FIFO (named pipe) at <paramref name="pathname"/> with permissions <paramref name="mode"/>.
+        /// Returns 0 upon successful completion, and -1 otherwise.
+        /// </summary>
+        [DllImport("libc", SetLastError = true)]
+        public static extern int mkfifo(string pathname, FilePermissions mode);
+
         /// <summary>
         /// Flags for <see cref="Open"/>
         /// </summary>
@@ -44,6 +44,53 @@ namespace BuildXL.Interop.MacOS
         public static int GetProcessTimes(int pid, ref ProcessTimesInfo buffer, bool includeChildProcesses)
             => GetProcessTimes(pid, ref buffer, Marshal.SizeOf(buffer), includeChildProcesses);
 
+        /// <summary>
+        /// Aggregated resource usage of a process tree (see <see cref="GetProcessTreeResourceUsage(int, ref ProcessTreeResourceUsage)"/>)
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct ProcessTreeResourceUsage
+        {
+            /// <summary>
+            /// Number of live processes in the tree, including the root.
+            /// </summary>
+            public uint NumProcesses;
+
+            /// <summary>
+            /// System time of the tree in nanoseconds, including exited descendants.
+            /// </summary>
+            public ulong SystemTimeNs;
+
+            /// <summary>
+            /// User time of the tree in nanoseconds, including exited descendants.
+            /// </summary>
+            public ulong UserTimeNs;
+
+            /// <summary>
+            /// Sum of the current physical footprints of the live processes in bytes.
+            /// </summary>
+            public ulong ResidentSize;
+
+            /// <summary>
+            /// Sum of the peak physical footprints of the live processes in bytes.
+            /// </summary>
+            public ulong PeakResidentSize;
+
+            /// <nodoc />
+            public ulong DiskBytesRead;
+
+            /// <nodoc />
+            public ulong DiskBytesWritten;
+        }
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        private static extern int GetProcessTreeResourceUsage(int rootPid, ref ProcessTreeResourceUsage buffer, long bufferSize);
+
+        /// <summary>
+        /// Returns the resource usage of the process tree rooted at <paramref name="rootPid"/>, sampled in a single call
+        /// </summary>
+        public static int GetProcessTreeResourceUsage(int rootPid, ref ProcessTreeResourceUsage buffer)
+            => GetProcessTreeResourceUsage(rootPid, ref buffer, Marshal.SizeOf(buffer));
+
         /// <summary>
         /// Returns true if core dump file creation for abnormal process exits has been set up successfully, and passes out
         /// the path where the system writes core dump files.
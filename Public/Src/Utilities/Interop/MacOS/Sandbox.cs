@@ -1,6 +1,7 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+using System;
 using System.Runtime.InteropServices;
 using System.Text;
 
@@ -17,10 +18,19 @@ namespace BuildXL.Interop.MacOS
         /// <nodoc />
         public static readonly int KextSuccess = 0x0;
 
+        /// <summary>
+        /// Maximum number of report queues per client, see <see cref="KextConfig.NumReportQueues"/>.
+        /// </summary>
+        public const uint MaxReportQueues = 16;
+
         /// <nodoc />
         [DllImport(Libraries.BuildXLInteropLibMacOS)]
         public static extern unsafe int NormalizePathAndReturnHash(byte[] pPath, byte* buffer, int bufferLength);
 
+        /// <nodoc />
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        public static extern unsafe void NormalizePathsAndReturnHashes(byte* paths, UIntPtr* lengths, UIntPtr count, byte* buffer, int* hashes);
+
         /// <nodoc />
         [StructLayout(LayoutKind.Sequential)]
         public struct KextConnectionInfo
@@ -57,6 +67,11 @@ namespace BuildXL.Interop.MacOS
 
             /// <nodoc />
             public uint Port;
+
+            /// <summary>
+            /// Index of the report queue this memory belongs to; set by the caller.
+            /// </summary>
+            public uint QueueIndex;
         }
 
         [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention = CallingConvention.Cdecl)]
@@ -114,6 +129,27 @@ namespace BuildXL.Interop.MacOS
             /// </summary>
             public uint MinAvailableRamMB;
 
+            /// <summary>
+            /// A process blocked because of low RAM can be awakened only when available RAM is at least
+            /// <see cref="MinAvailableRamMB"/> plus this margin.
+            /// </summary>
+            public uint RamWakeupMarginMB;
+
+            /// <summary>
+            /// When greater than 0, the sandbox kernel extension samples CPU usage itself at most this often (in milliseconds)
+            /// instead of relying on the CPU usage updates it receives.
+            /// </summary>
+            public uint CpuSampleIntervalMs;
+
+            /// <summary>
+            /// When greater than 0, the pips tracked by the sandbox kernel extension shed the cold entries of their path caches whenever
+            /// available RAM is sampled below this value (in megabytes).
+            /// </summary>
+            /// <remarks>
+            /// Only takes effect if resource usage is sent to the sandbox kernel extension, which is also done for this when throttling is disabled.
+            /// </remarks>
+            public uint CacheShrinkRamMB;
+
             /// <summary>
             /// Returns whether these resource threshold parameters enable process throttling or not.
             /// </summary>
@@ -127,6 +163,40 @@ namespace BuildXL.Interop.MacOS
             }
         }
 
+        /// <summary>
+        /// Classes of operations whose allowed accesses a client can ask the sandbox kernel extension not to report.
+        /// </summary>
+        /// <remarks>
+        /// CODESYNC: Public/Src/Sandbox/MacOs/Sandbox/Src/BuildXLSandboxShared.hpp (OperationClass)
+        /// </remarks>
+        [Flags]
+        public enum OperationClasses : uint
+        {
+            /// <nodoc />
+            None = 0,
+
+            /// <summary>MAC_LOOKUP</summary>
+            Lookup = 1 << 0,
+
+            /// <summary>MAC_READLINK</summary>
+            Readlink = 1 << 1,
+
+            /// <summary>VNODE_PROBE and FILEOP_OPEN_DIR</summary>
+            Probe = 1 << 2,
+
+            /// <summary>VNODE_READ, FILEOP_OPEN_FILE, and the sources of links and exchanges</summary>
+            Read = 1 << 3,
+
+            /// <summary>VNODE_WRITE, MAC_VNODE_CREATE, and the other FILEOP_ operations</summary>
+            Write = 1 << 4,
+
+            /// <summary>VNODE_EXECUTE</summary>
+            Execute = 1 << 5,
+
+            /// <summary>Process starts</summary>
+            Process = 1 << 6,
+        }
+
         /// <nodoc />
         [StructLayout(LayoutKind.Sequential)]
         public struct KextConfig
@@ -135,8 +205,71 @@ namespace BuildXL.Interop.MacOS
             public uint ReportQueueSizeMB;
 
             /// <nodoc />
+            [MarshalAs(UnmanagedType.U1)]
             public bool EnableReportBatching;
 
+            /// <summary>
+            /// When set, access reports are sent through the report queue without the unused part of their path.
+            /// </summary>
+            [MarshalAs(UnmanagedType.U1)]
+            public bool EnableCompactReports;
+
+            /// <summary>
+            /// Number of report queues (between 1 and <see cref="MaxReportQueues"/>) per client.
+            /// All reports of a pip go through the same queue.
+            /// </summary>
+            public uint NumReportQueues;
+
+            /// <summary>
+            /// Maximum number of paths the sandbox kernel extension caches per pip (0 means no limit).
+            /// </summary>
+            public uint PathCacheBudget;
+
+            /// <summary>
+            /// When set, the sandbox kernel extension maps the file access manifest of a started pip instead of copying it.
+            /// </summary>
+            [MarshalAs(UnmanagedType.U1)]
+            public bool MapPipPayloads;
+
+            /// <summary>
+            /// Classes of operations whose allowed accesses are not reported.
+            /// Denied accesses, process exits and process tree completions are reported regardless.
+            /// </summary>
+            public OperationClasses IgnoredOperationClasses;
+
+            /// <summary>
+            /// When greater than 0 (and report batching is enabled), consecutive reports of the same process for the same path,
+            /// created at most this many microseconds apart, are delivered as one report carrying all of their requested accesses.
+            /// </summary>
+            public uint ReportCoalescingWindowUs;
+
+            /// <summary>
+            /// When set, each client gets one more report queue (after the <see cref="NumReportQueues"/> others) for access denials
+            /// and process starts and exits.  A process tree completion then carries in its <see cref="AccessReport.RequestedAccess"/>
+            /// the number of reports its pip has sent through that queue.
+            /// </summary>
+            [MarshalAs(UnmanagedType.U1)]
+            public bool EnablePriorityReportQueue;
+
+            /// <summary>
+            /// When set (and report batching is enabled), a report queue the client lags behind on merges the allowed accesses of each
+            /// process to each path into one report until the client has caught up, instead of eventually failing.
+            /// </summary>
+            [MarshalAs(UnmanagedType.U1)]
+            public bool SummarizeWhenLagging;
+
+            /// <summary>
+            /// When counters are enabled in the sandbox kernel extension, only 1 in every this many events is timed (every event if 0 or 1),
+            /// and the durations of the timed events are scaled accordingly.  Reports of events that are not timed carry no time stamps.
+            /// </summary>
+            public uint TimingSampleRate;
+
+            /// <summary>
+            /// When greater than 0 (and report batching is enabled), the allowed accesses a pip reports beyond this many per second
+            /// go through the summary of its report queue, which sends them once the queue has nothing else to send.
+            /// </summary>
+            public uint MaxPipReportRate;
+
             /// <nodoc />
             public ResourceThresholds ResourceThresholds;
         }
@@ -151,6 +284,20 @@ namespace BuildXL.Interop.MacOS
         [return: MarshalAs(UnmanagedType.Bool)]
         public static extern bool UpdateCurrentResourceUsage(uint cpuUsageBasisPoints, uint availableRamMB, KextConnectionInfo info);
 
+        /// <summary>
+        /// Starts a native thread that pushes the CPU usage and available RAM to the kernel extension every <paramref name="intervalMs"/>
+        /// milliseconds, in place of periodic calls to <see cref="UpdateCurrentResourceUsage"/>. Returns false if one is already running.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, EntryPoint = "StartResourceSampler")]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        public static extern bool StartResourceSampler(uint intervalMs, KextConnectionInfo info);
+
+        /// <summary>
+        /// Stops the thread started by <see cref="StartResourceSampler"/>, if any.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, EntryPoint = "StopResourceSampler")]
+        public static extern void StopResourceSampler();
+
         private static readonly Encoding s_accessReportStringEncoding = Encoding.UTF8;
 
         /// <nodoc />
@@ -167,6 +314,23 @@ namespace BuildXL.Interop.MacOS
             public ulong DequeueTime;
         }
 
+        /// <summary>
+        /// Identity of a reported file (its device and inode numbers), which can key files instead of their paths.
+        /// Only set when the sandbox got it at no extra cost; both are 0 otherwise.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct FileIdentity
+        {
+            /// <nodoc />
+            public ulong Volume;
+
+            /// <nodoc />
+            public ulong File;
+
+            /// <summary>Whether the identity is known</summary>
+            public bool IsKnown => Volume != 0 || File != 0;
+        }
+
         /// <nodoc />
         [StructLayout(LayoutKind.Sequential)]
         public struct AccessReport
@@ -196,11 +360,14 @@ namespace BuildXL.Interop.MacOS
             public long PipId;
 
             /// <nodoc />
-            [MarshalAs(UnmanagedType.ByValTStr, SizeConst = Constants.MaxPathLength)]
-            public string Path;
+            public AccessReportStatistics Statistics;
 
             /// <nodoc />
-            public AccessReportStatistics Statistics;
+            public FileIdentity FileIdentity;
+
+            /// <remarks>Must be the last field, see <see cref="KextConfig.EnableCompactReports"/>.</remarks>
+            [MarshalAs(UnmanagedType.ByValTStr, SizeConst = Constants.MaxPathLength)]
+            public string Path;
 
             /// <nodoc />
             public string DecodeOperation() => Operation.GetName();
@@ -218,6 +385,110 @@ namespace BuildXL.Interop.MacOS
             ulong address,
             uint port);
 
+        /// <summary>
+        /// Maximum number of reports passed to an <see cref="AccessReportBatchCallback"/> at once.
+        /// </summary>
+        public const int AccessReportBatchSize = 64;
+
+        /// <summary>
+        /// Receives <paramref name="count"/> reports at once (no reports when <paramref name="error"/> is not <see cref="ReportQueueSuccessCode"/>).
+        /// </summary>
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        public delegate void AccessReportBatchCallback([MarshalAs(UnmanagedType.LPArray, SizeParamIndex = 1)] AccessReport[] reports, int count, int error);
+
+        /// <summary>
+        /// Same as <see cref="ListenForFileAccessReports"/>, except that the reports are passed to the callback in batches
+        /// of up to <paramref name="batchSize"/> reports, which takes one interop transition per batch rather than per report.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention=CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        public static extern void ListenForFileAccessReportsBatched(
+            [MarshalAs(UnmanagedType.FunctionPtr)] AccessReportBatchCallback callbackPointer,
+            int batchSize,
+            long accessReportSize,
+            ulong address,
+            uint port);
+
+        /// <summary>
+        /// Makes <see cref="SendPipStarted"/> register a ring of <paramref name="capacity"/> reports (a power of 2) for each pip, which
+        /// <see cref="ListenForFileAccessReportsBatched"/> writes the reports of the pip into instead of passing them to its callback.
+        /// The reports of each pip are then drained with <see cref="DrainPipReports"/>. Must be called before any pip is started.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        public static extern bool EnablePipReportRings(uint capacity, long accessReportSize);
+
+        /// <summary>
+        /// Copies up to <paramref name="capacity"/> reports of pip <paramref name="pipId"/> into <paramref name="buffer"/>, waiting up to
+        /// <paramref name="timeoutMs"/> milliseconds when there are none. Returns the number of reports copied, or -1 once the pip
+        /// has no ring (see <see cref="UnregisterPipReportRing"/>). Only one thread may drain a pip.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        public static extern int DrainPipReports(long pipId, [Out] AccessReport[] buffer, int capacity, int timeoutMs);
+
+        /// <summary>
+        /// Drops the ring of pip <paramref name="pipId"/> registered by <see cref="SendPipStarted"/>; a pending <see cref="DrainPipReports"/> returns.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        public static extern void UnregisterPipReportRing(long pipId);
+
+        /// <summary>
+        /// Makes the listeners started from now on poll their queue for up to <paramref name="spinMicroseconds"/> after draining it
+        /// before blocking on its notification port (0 to block right away), and run at QoS class <paramref name="qosClass"/>
+        /// (a <c>qos_class_t</c> value, e.g., 0x21 for user-interactive; 0 to keep the QoS class of the listener thread).
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        public static extern void ConfigureReportListeners(uint spinMicroseconds, uint qosClass);
+
+        /// <summary>
+        /// Counters of all report listeners.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct ReportListenerCounters
+        {
+            /// <summary>Number of times a listener blocked on the notification port of its queue.</summary>
+            public ulong NumWakeups;
+
+            /// <summary>Number of times a listener found new reports while spinning, and so did not need to block.</summary>
+            public ulong NumSpinHits;
+
+            /// <summary>Wakeups per second since the last reset.</summary>
+            public double WakeupsPerSecond;
+
+            /// <summary>99th percentile of the time (in microseconds) from enqueuing a report until a listener dequeued it.</summary>
+            public uint P99EnqueueToDequeueUs;
+        }
+
+        /// <summary>
+        /// Gets the counters of all listeners since the last reset, and resets them if <paramref name="reset"/> is true.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void GetReportListenerCounters(out ReportListenerCounters result, [MarshalAs(UnmanagedType.U1)] bool reset);
+
+        /// <summary>
+        /// Starts appending every report received by the listeners to the file at <paramref name="path"/>,
+        /// for <see cref="ReplayFileAccessReports"/> to replay later.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CharSet = CharSet.Ansi)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        public static extern bool StartReportCapture(string path);
+
+        /// <nodoc />
+        [DllImport(Libraries.BuildXLInteropLibMacOS)]
+        public static extern void StopReportCapture();
+
+        /// <summary>
+        /// Passes the reports captured with <see cref="StartReportCapture"/> to <paramref name="callbackPointer"/> the same way
+        /// <see cref="ListenForFileAccessReportsBatched"/> does, either as fast as possible or at the recorded pace.
+        /// Returns the number of replayed reports, or -1 if the file is not a valid capture.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention=CallingConvention.Cdecl, CharSet = CharSet.Ansi)]
+        public static extern int ReplayFileAccessReports(
+            string path,
+            [MarshalAs(UnmanagedType.FunctionPtr)] AccessReportBatchCallback callbackPointer,
+            int batchSize,
+            long accessReportSize,
+            [MarshalAs(UnmanagedType.U1)] bool realTime);
+
         /// <summary>
         /// Callback the kernel extension can use to report any unrecoverable failures.
         ///
@@ -244,5 +515,200 @@ namespace BuildXL.Interop.MacOS
         /// <nodoc />
         [DllImport(Libraries.BuildXLInteropLibMacOS)]
         public static extern ulong GetMachAbsoluteTime();
+
+        /// <summary>
+        /// Number of buckets of a <see cref="LatencyHistogram"/>.
+        /// </summary>
+        public const int LatencyHistogramBucketCount = 32;
+
+        /// <summary>
+        /// Durations bucketed by their order of magnitude: bucket 0 counts durations under 1us, and bucket i &gt; 0 counts
+        /// durations in [2^(i-1), 2^i) us (the last bucket also counts all longer durations).
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct LatencyHistogram
+        {
+            /// <nodoc />
+            [MarshalAs(UnmanagedType.ByValArray, SizeConst = LatencyHistogramBucketCount)]
+            public uint[] Buckets;
+
+            /// <nodoc />
+            public uint MaxUs;
+
+            /// <summary>
+            /// Number of recorded durations.
+            /// </summary>
+            public long Count
+            {
+                get
+                {
+                    long count = 0;
+                    foreach (var bucketCount in Buckets ?? new uint[0])
+                    {
+                        count += bucketCount;
+                    }
+
+                    return count;
+                }
+            }
+
+            /// <summary>
+            /// An upper bound for the duration (in microseconds) that <paramref name="percent"/>% of the recorded durations do not exceed.
+            /// </summary>
+            public uint PercentileUs(double percent)
+            {
+                long total = Count;
+                if (total == 0)
+                {
+                    return 0;
+                }
+
+                long rank = (long)(total * percent / 100.0);
+                long seen = 0;
+                for (int i = 0; i < Buckets.Length; i++)
+                {
+                    seen += Buckets[i];
+                    if (seen > rank)
+                    {
+                        uint bucketUpperBound = i == 0 ? 1u : (1u << i);
+                        return bucketUpperBound < MaxUs ? bucketUpperBound : MaxUs;
+                    }
+                }
+
+                return MaxUs;
+            }
+        }
+
+        /// <summary>
+        /// Latencies of the access reports received by this process, computed from their <see cref="AccessReportStatistics"/>.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct ReportLatencies
+        {
+            /// <summary>From the creation of a report until the kernel extension enqueued it.</summary>
+            public LatencyHistogram CreationToEnqueue;
+
+            /// <summary>From enqueuing a report until it was dequeued in this process.</summary>
+            public LatencyHistogram EnqueueToDequeue;
+
+            /// <summary>From dequeuing a report until the report callback returned.</summary>
+            public LatencyHistogram DequeueToCallback;
+        }
+
+        /// <summary>
+        /// Gets the latencies of all reports received since the last reset, and resets them if <paramref name="reset"/> is true.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void GetReportLatencies(out ReportLatencies result, [MarshalAs(UnmanagedType.U1)] bool reset);
+
+        /// <summary>
+        /// The Endpoint Security client could not be created (e.g., because the system is older than macOS 10.15).
+        /// </summary>
+        public const int EndpointSecurityClientCreationError = 0x200;
+
+        /// <summary>
+        /// The process is not signed with the 'com.apple.developer.endpoint-security.client' entitlement.
+        /// </summary>
+        public const int EndpointSecurityClientNotEntitled = 0x400;
+
+        /// <summary>
+        /// The process does not run as root, or has not been granted Full Disk Access.
+        /// </summary>
+        public const int EndpointSecurityClientNotPermitted = 0x800;
+
+        /// <nodoc />
+        public const int EndpointSecuritySubscriptionError = 0x2000;
+
+        /// <summary>
+        /// Handle to the Endpoint Security client of the interop library (see <see cref="StartEndpointSecuritySandbox"/>).
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct EndpointSecurityInfo
+        {
+            /// <nodoc />
+            public int Error;
+
+            /// <summary>
+            /// The native client; only the interop library uses it.
+            /// </summary>
+            private readonly IntPtr m_sandbox;
+        }
+
+        /// <nodoc />
+        [StructLayout(LayoutKind.Sequential)]
+        public struct EndpointSecurityCounters
+        {
+            /// <nodoc />
+            public ulong NumAuthMessages;
+
+            /// <nodoc />
+            public ulong NumNotifyMessages;
+
+            /// <summary>
+            /// Messages about processes that belong to no pip.
+            /// </summary>
+            public ulong NumUntrackedMessages;
+
+            /// <nodoc />
+            public ulong NumDenied;
+
+            /// <nodoc />
+            public ulong NumReports;
+
+            /// <nodoc />
+            public ulong NumBatches;
+
+            /// <nodoc />
+            public ulong NumDroppedMessages;
+
+            /// <summary>From the time an AUTH message was sent until it was responded to.</summary>
+            public LatencyHistogram AuthLatency;
+
+            /// <summary>From the time a NOTIFY message was sent until it was handled.</summary>
+            public LatencyHistogram NotifyLatency;
+        }
+
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention = CallingConvention.Cdecl)]
+        private static extern void StartEndpointSecuritySandbox(
+            [MarshalAs(UnmanagedType.FunctionPtr)] AccessReportBatchCallback callbackPointer,
+            int batchSize,
+            uint flushIntervalMs,
+            ref EndpointSecurityInfo info,
+            long infoSize);
+
+        /// <summary>
+        /// Creates an Endpoint Security client, a user-space alternative to the kernel extension, which passes the same reports to
+        /// <paramref name="callbackPointer"/> in batches of up to <paramref name="batchSize"/> reports, at least every
+        /// <paramref name="flushIntervalMs"/> milliseconds. <see cref="EndpointSecurityInfo.Error"/> tells whether it could be created.
+        /// </summary>
+        /// <remarks>
+        /// The callback is called from a native thread until <see cref="StopEndpointSecuritySandbox"/> returns, so the caller must keep it alive.
+        /// </remarks>
+        public static void StartEndpointSecuritySandbox(AccessReportBatchCallback callbackPointer, int batchSize, uint flushIntervalMs, ref EndpointSecurityInfo info)
+            => StartEndpointSecuritySandbox(callbackPointer, batchSize, flushIntervalMs, ref info, Marshal.SizeOf(info));
+
+        /// <nodoc />
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void StopEndpointSecuritySandbox(EndpointSecurityInfo info);
+
+        /// <summary>
+        /// Same as <see cref="SendPipStarted"/>, for the Endpoint Security client.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention = CallingConvention.Cdecl)]
+        [return: MarshalAs(UnmanagedType.U1)]
+        public static extern bool EndpointSecuritySendPipStarted(int processId, long pipId, byte[] famBytes, int famBytesLength, EndpointSecurityInfo info);
+
+        /// <summary>
+        /// Same as <see cref="SendPipProcessTerminated"/>, for the Endpoint Security client.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention = CallingConvention.Cdecl)]
+        [return: MarshalAs(UnmanagedType.U1)]
+        public static extern bool EndpointSecuritySendPipProcessTerminated(long pipId, int processId, EndpointSecurityInfo info);
+
+        /// <summary>
+        /// Gets the counters of the Endpoint Security client, and resets them if <paramref name="reset"/> is true.
+        /// </summary>
+        [DllImport(Libraries.BuildXLInteropLibMacOS, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void GetEndpointSecurityCounters(EndpointSecurityInfo info, out EndpointSecurityCounters result, [MarshalAs(UnmanagedType.U1)] bool reset);
     }
 }
@@ -379,6 +379,10 @@ namespace BuildXL.Native.IO
         public static void SetFileTimestamps(string path, FileTimestamps timestamps, bool followSymlink = false)
             => s_fileUtilities.SetFileTimestamps(path, timestamps, followSymlink);
 
+        /// <see cref="IFileUtilities.TrySetFileTimestamps"/>
+        public static bool[] TrySetFileTimestamps(IReadOnlyList<string> paths, FileTimestamps timestamps, bool followSymlink = false)
+            => s_fileUtilities.TrySetFileTimestamps(paths, timestamps, followSymlink);
+
         /// <see cref="IFileUtilities.WriteAllTextAsync(string, string, Encoding)"/>
         public static Task WriteAllTextAsync(
             string filePath,
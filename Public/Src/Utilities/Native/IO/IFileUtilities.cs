@@ -220,6 +220,12 @@ namespace BuildXL.Native.IO
         /// </exception>
         void SetFileTimestamps(string path, FileTimestamps timestamps, bool followSymlink = false);
 
+        /// <summary>
+        /// Sets the same time stamps on many files at once (in parallel where the platform supports it).
+        /// </summary>
+        /// <returns>For each of <paramref name="paths"/>, whether its time stamps were set.</returns>
+        bool[] TrySetFileTimestamps(IReadOnlyList<string> paths, FileTimestamps timestamps, bool followSymlink = false);
+
         /// <summary>
         /// Gets the time stamp of a specified file.
         /// </summary>
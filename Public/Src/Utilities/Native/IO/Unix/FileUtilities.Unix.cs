@@ -5,6 +5,7 @@ using System;
 using System.Collections.Generic;
 using System.Diagnostics.ContractsLight;
 using System.IO;
+using System.Linq;
 using System.Runtime.InteropServices;
 using System.Security.AccessControl;
 using System.Text;
@@ -229,6 +230,42 @@ namespace BuildXL.Native.IO.Unix
 
         /// <inheritdoc />
         public void SetFileTimestamps(string path, FileTimestamps timestamps, bool followSymlink)
+        {
+            StatBuffer statBuffer = CreateStatBuffer(timestamps);
+
+            unsafe
+            {
+                int result = SetTimeStampsForFilePath(path, followSymlink, statBuffer);
+
+                if (result != 0)
+                {
+                    throw new BuildXLException("Failed to open a file to set its timestamps - error: " + Marshal.GetLastWin32Error());
+                }
+            }
+        }
+
+        /// <inheritdoc />
+        public bool[] TrySetFileTimestamps(IReadOnlyList<string> paths, FileTimestamps timestamps, bool followSymlink)
+        {
+            Contract.Requires(paths != null);
+
+            string[] pathArray = paths as string[] ?? paths.ToArray();
+            var results = new int[pathArray.Length];
+            var succeeded = new bool[pathArray.Length];
+
+            // A single buffer applies to all the paths
+            if (SetTimeStampsForFilePaths(pathArray, followSymlink, new[] { CreateStatBuffer(timestamps) }, results, Environment.ProcessorCount) == 0)
+            {
+                for (int i = 0; i < results.Length; i++)
+                {
+                    succeeded[i] = results[i] == 0;
+                }
+            }
+
+            return succeeded;
+        }
+
+        private static StatBuffer CreateStatBuffer(FileTimestamps timestamps)
         {
             Contract.Requires(timestamps.CreationTime >= UnixEpoch);
             Contract.Requires(timestamps.AccessTime >= UnixEpoch);
@@ -237,32 +274,24 @@ namespace BuildXL.Native.IO.Unix
 
             var statBuffer = new StatBuffer();
 
-            unsafe
-            {
-                Timespec creationTime = Timespec.CreateFromUtcDateTime(timestamps.CreationTime);
-                Timespec lastAccessTime = Timespec.CreateFromUtcDateTime(timestamps.AccessTime);
-                Timespec lastModificationTime = Timespec.CreateFromUtcDateTime(timestamps.LastWriteTime);
-                Timespec lastStatusChangeTime = Timespec.CreateFromUtcDateTime(timestamps.LastChangeTime);
-
-                statBuffer.TimeCreation = creationTime.Tv_sec;
-                statBuffer.TimeNSecCreation = creationTime.Tv_nsec;
+            Timespec creationTime = Timespec.CreateFromUtcDateTime(timestamps.CreationTime);
+            Timespec lastAccessTime = Timespec.CreateFromUtcDateTime(timestamps.AccessTime);
+            Timespec lastModificationTime = Timespec.CreateFromUtcDateTime(timestamps.LastWriteTime);
+            Timespec lastStatusChangeTime = Timespec.CreateFromUtcDateTime(timestamps.LastChangeTime);
 
-                statBuffer.TimeLastAccess = lastAccessTime.Tv_sec;
-                statBuffer.TimeNSecLastAccess = lastAccessTime.Tv_nsec;
+            statBuffer.TimeCreation = creationTime.Tv_sec;
+            statBuffer.TimeNSecCreation = creationTime.Tv_nsec;
 
-                statBuffer.TimeLastModification = lastModificationTime.Tv_sec;
-                statBuffer.TimeNSecLastModification = lastModificationTime.Tv_nsec;
+            statBuffer.TimeLastAccess = lastAccessTime.Tv_sec;
+            statBuffer.TimeNSecLastAccess = lastAccessTime.Tv_nsec;
 
-                statBuffer.TimeLastStatusChange = lastStatusChangeTime.Tv_sec;
-                statBuffer.TimeNSecLastStatusChange = lastStatusChangeTime.Tv_nsec;
+            statBuffer.TimeLastModification = lastModificationTime.Tv_sec;
+            statBuffer.TimeNSecLastModification = lastModificationTime.Tv_nsec;
 
-                int result = SetTimeStampsForFilePath(path, followSymlink, statBuffer);
+            statBuffer.TimeLastStatusChange = lastStatusChangeTime.Tv_sec;
+            statBuffer.TimeNSecLastStatusChange = lastStatusChangeTime.Tv_nsec;
 
-                if (result != 0)
-                {
-                    throw new BuildXLException("Failed to open a file to set its timestamps - error: " + Marshal.GetLastWin32Error());
-                }
-            }
+            return statBuffer;
         }
 
         /// <inheritdoc />
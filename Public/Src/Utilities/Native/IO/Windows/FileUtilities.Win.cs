@@ -932,6 +932,28 @@ namespace BuildXL.Native.IO.Windows
             }
         }
 
+        /// <inheritdoc />
+        public bool[] TrySetFileTimestamps(IReadOnlyList<string> paths, FileTimestamps timestamps, bool followSymlink)
+        {
+            Contract.Requires(paths != null);
+
+            var succeeded = new bool[paths.Count];
+            for (int i = 0; i < paths.Count; i++)
+            {
+                try
+                {
+                    SetFileTimestamps(paths[i], timestamps, followSymlink);
+                    succeeded[i] = true;
+                }
+                catch (BuildXLException)
+                {
+                    succeeded[i] = false;
+                }
+            }
+
+            return succeeded;
+        }
+
         /// <inheritdoc />
         public FileTimestamps GetFileTimestamps(
             string path,
@@ -162,6 +162,7 @@ namespace BuildXL.Native.Processes
         ExtendedLimitInformation = 9,
         SecurityLimitInformation = 5,
         GroupInformation = 11,
+        JobObjectCreateSilo = 35,
     }
 
     /// <summary>
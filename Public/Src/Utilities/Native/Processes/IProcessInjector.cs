@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 using System;
+using System.Runtime.InteropServices;
 
 namespace BuildXL.Native.Processes
 {
@@ -16,5 +17,11 @@ namespace BuildXL.Native.Processes
 
         /// <nodoc />
         uint Inject(uint processId, bool inheritedHandles);
+
+        /// <summary>
+        /// Gives each process injected from now on one of the given pipes (write sides) as its report pipe, round-robin, in place of
+        /// the report pipe of the injector. The handles are duplicated. Must be called before the first process is injected.
+        /// </summary>
+        void SetReportChannels(SafeHandle[] reportChannels);
     }
 }
@@ -70,6 +70,18 @@ namespace BuildXL.Native.Processes
         public static int NormalizeAndHashPath(string path, out byte[] bytes)
             => s_nativeMethods.NormalizeAndHashPath(path, out bytes);
 
+        /// <summary>
+        /// Batch variant of <see cref="NormalizeAndHashPath"/>, normalizing and hashing all the paths in a single native call.
+        ///
+        /// The normalized version and the hash code of paths[i] are stored to normalizedPathBytes[i] and hashes[i].
+        ///
+        /// @requires paths != null
+        /// @requires normalizedPathBytes.Length >= paths.Count
+        /// @requires hashes.Length >= paths.Count
+        /// </summary>
+        public static void NormalizeAndHashPaths(IReadOnlyList<string> paths, byte[][] normalizedPathBytes, int[] hashes)
+            => s_nativeMethods.NormalizeAndHashPaths(paths, normalizedPathBytes, hashes);
+
         /// <summary>
         /// Returns if two native buffers are equal up to a given number of elements.
         /// 
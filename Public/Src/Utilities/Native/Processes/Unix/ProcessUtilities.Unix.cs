@@ -49,6 +49,49 @@ namespace BuildXL.Native.Processes.Unix
             }
         }
 
+        /// <inheritdoc />
+        public unsafe void NormalizeAndHashPaths(IReadOnlyList<string> paths, byte[][] normalizedPathBytes, int[] hashes)
+        {
+            Contract.Requires(paths != null);
+            Contract.Requires(normalizedPathBytes != null && normalizedPathBytes.Length >= paths.Count);
+            Contract.Requires(hashes != null && hashes.Length >= paths.Count);
+
+            var lengths = new UIntPtr[paths.Count];
+            int inputLength = 0;
+            for (int i = 0; i < paths.Count; i++)
+            {
+                int length = Encoding.UTF8.GetByteCount(paths[i]);
+                lengths[i] = new UIntPtr((uint)length);
+                inputLength += length;
+            }
+
+            var input = new byte[inputLength];
+            int offset = 0;
+            for (int i = 0; i < paths.Count; i++)
+            {
+                offset += Encoding.UTF8.GetBytes(paths[i], 0, paths[i].Length, input, offset);
+            }
+
+            // The normalized paths come back to back, each with its terminating null character
+            var output = new byte[inputLength + paths.Count];
+            fixed (byte* pInput = input)
+            fixed (UIntPtr* pLengths = lengths)
+            fixed (byte* pOutput = output)
+            fixed (int* pHashes = hashes)
+            {
+                Sandbox.NormalizePathsAndReturnHashes(pInput, pLengths, new UIntPtr((uint)paths.Count), pOutput, pHashes);
+            }
+
+            offset = 0;
+            for (int i = 0; i < paths.Count; i++)
+            {
+                int length = (int)lengths[i] + 1;
+                normalizedPathBytes[i] = new byte[length];
+                Buffer.BlockCopy(output, offset, normalizedPathBytes[i], 0, length);
+                offset += length;
+            }
+        }
+
         /// <inheritdoc />
         public bool AreBuffersEqual(byte[] buffer1, byte[] buffer2)
         {
@@ -52,6 +52,22 @@ namespace BuildXL.Native.Processes.Windows
             return DetouredProcessInjector_Inject64(m_injector, processId, inheritedHandles);
         }
 
+        /// <inheritdoc />
+        [SuppressMessage("Microsoft.Reliability", "CA2001:AvoidCallingProblematicMethods",
+            MessageId = "System.Runtime.InteropServices.SafeHandle.DangerousGetHandle", Justification = "The native injector duplicates the handles.")]
+        public void SetReportChannels(SafeHandle[] reportChannels)
+        {
+            var handles = new IntPtr[reportChannels.Length];
+            for (int i = 0; i < reportChannels.Length; i++)
+            {
+                handles[i] = reportChannels[i].DangerousGetHandle();
+            }
+
+            Assert64Process();
+            DetouredProcessInjector_SetReportChannels64(m_injector, (uint)handles.Length, handles);
+            GC.KeepAlive(reportChannels);
+        }
+
         /// <nodoc />
         public void Dispose()
         {
@@ -96,6 +112,13 @@ namespace BuildXL.Native.Processes.Windows
         private static extern void DetouredProcessInjector_Destroy64(
             IntPtr injector);
 
+        [DllImport(ExternDll.BuildXLNatives64, EntryPoint = "DetouredProcessInjector_SetReportChannels", SetLastError = true)]
+        private static extern void DetouredProcessInjector_SetReportChannels64(
+            IntPtr injector,
+            [MarshalAs(UnmanagedType.U4)]
+            uint channelCount,
+            IntPtr[] channels);
+
         [DllImport(ExternDll.BuildXLNatives64, EntryPoint = "DetouredProcessInjector_Inject", CharSet = CharSet.Ansi, SetLastError = true)]
         [return: MarshalAs(UnmanagedType.U4)]
         private static extern uint DetouredProcessInjector_Inject64(
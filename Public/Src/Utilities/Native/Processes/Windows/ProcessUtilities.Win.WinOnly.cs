@@ -2,9 +2,11 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 using System;
+using System.Collections.Generic;
 using System.Diagnostics;
 using System.Diagnostics.ContractsLight;
 using System.Runtime.InteropServices;
+using System.Text;
 using BuildXL.Native.IO.Windows;
 
 namespace BuildXL.Native.Processes.Windows
@@ -343,6 +345,168 @@ namespace BuildXL.Native.Processes.Windows
             }
         }
 
+        /// <summary>
+        /// The policy <see cref="FindFileAccessPoliciesInTree"/> found for a path.
+        /// </summary>
+        /// <remarks>
+        /// Keep this in sync with PolicySearchResult declared in PolicySearch.h.
+        /// </remarks>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct PolicySearchResult
+        {
+            public uint ConePolicy;
+            public uint NodePolicy;
+            public uint PathId;
+            public IO.Usn ExpectedUsn;
+        }
+
+        /// <summary>
+        /// Batch variant of <see cref="FindFileAccessPolicyInTree"/>, filling <paramref name="results"/> with the policy of each path.
+        /// </summary>
+        /// <remarks>
+        /// Searches resume from the policy found for the leading path components shared with the previous path, so sorting
+        /// <paramref name="absolutePaths"/> saves most of the work on large path sets.
+        /// </remarks>
+        public static bool FindFileAccessPoliciesInTree(
+            byte[] recordBytes,
+            IReadOnlyList<string> absolutePaths,
+            PolicySearchResult[] results)
+        {
+            Assert64Process();
+            Contract.Requires(absolutePaths != null);
+            Contract.Requires(results != null && results.Length >= absolutePaths.Count);
+
+            var lengths = new UIntPtr[absolutePaths.Count];
+            var paths = new StringBuilder();
+            for (int i = 0; i < absolutePaths.Count; i++)
+            {
+                paths.Append(absolutePaths[i]);
+                lengths[i] = new UIntPtr((uint)absolutePaths[i].Length);
+            }
+
+            fixed (byte* pRecord = recordBytes)
+            fixed (char* pPaths = paths.ToString())
+            fixed (UIntPtr* pLengths = lengths)
+            fixed (PolicySearchResult* pResults = results)
+            {
+                return ExternFindFileAccessPoliciesInTree(pRecord, pPaths, pLengths, new UIntPtr((uint)absolutePaths.Count), pResults);
+            }
+        }
+
+        /// <summary>
+        /// A report decoded by <see cref="ParseReports"/>.
+        /// </summary>
+        /// <remarks>
+        /// Keep this in sync with ParsedReport declared in ReportParser.h. Strings are given by offset and length (in characters)
+        /// into the arena passed to <see cref="ParseReports"/>. Only file access reports are decoded field by field; any other
+        /// report has its text line in <see cref="TextOffset"/> and <see cref="TextLength"/>, or, for binary process detouring
+        /// status records, only <see cref="RecordOffset"/> and <see cref="RecordSize"/> into the parsed buffer.
+        /// </remarks>
+        [StructLayout(LayoutKind.Sequential)]
+        public struct ParsedReport
+        {
+            public uint Type;
+            public uint ProcessId;
+            public uint RequestedAccess;
+            public uint Status;
+            public uint ExplicitlyReported;
+            public uint Error;
+            public uint DesiredAccess;
+            public uint ShareMode;
+            public uint CreationDisposition;
+            public uint FlagsAndAttributes;
+            public uint PathId;
+            public uint LocalPathId;
+            public uint PathFlags;
+            public uint RecordSize;
+            public ulong RecordOffset;
+            public ulong Usn;
+            public ulong Sequence;
+            public ulong VolumeSerialNumber;
+            public ulong FileIdLow;
+            public ulong FileIdHigh;
+            public uint OperationOffset;
+            public uint OperationLength;
+            public uint PathOffset;
+            public uint PathLength;
+            public uint FilterOffset;
+            public uint FilterLength;
+            public uint CommandLineOffset;
+            public uint CommandLineLength;
+            public uint TextOffset;
+            public uint TextLength;
+        }
+
+        /// <summary>
+        /// Decodes the complete reports at the start of <paramref name="buffer"/>, bytes read from the report pipe of a detoured process.
+        /// </summary>
+        /// <remarks>
+        /// Stops at the first incomplete report, or as soon as <paramref name="reports"/> or <paramref name="arena"/> is full;
+        /// <paramref name="bytesConsumed"/> tells where decoding should resume once more bytes are read. Returns false
+        /// if the report at <paramref name="bytesConsumed"/> is malformed.
+        /// </remarks>
+        public static bool ParseReports(
+            ArraySegment<byte> buffer,
+            bool binary,
+            ParsedReport[] reports,
+            char[] arena,
+            out int reportCount,
+            out int arenaLength,
+            out int bytesConsumed)
+        {
+            Assert64Process();
+            Contract.Requires(reports != null);
+            Contract.Requires(arena != null);
+
+            fixed (byte* pBuffer = buffer.Array)
+            fixed (ParsedReport* pReports = reports)
+            fixed (char* pArena = arena)
+            {
+                bool result = ExternParseReports(
+                    pBuffer + buffer.Offset,
+                    new UIntPtr((uint)buffer.Count),
+                    binary,
+                    pReports,
+                    new UIntPtr((uint)reports.Length),
+                    out UIntPtr count,
+                    pArena,
+                    new UIntPtr((uint)arena.Length),
+                    out UIntPtr length,
+                    out UIntPtr consumed);
+
+                reportCount = (int)count;
+                arenaLength = (int)length;
+                bytesConsumed = (int)consumed;
+                return result;
+            }
+        }
+
+        /// <summary>
+        /// Hash of the first <paramref name="length"/> characters of <paramref name="path"/> once normalized, as the policy search computes it.
+        /// </summary>
+        /// <remarks>
+        /// Takes a pointer so that callers control where the characters lie (e.g. right before an unreadable page).
+        /// </remarks>
+        public static int HashPath(char* path, int length)
+        {
+            Assert64Process();
+            Contract.Requires(length >= 0);
+
+            return ExternHashPath(path, new UIntPtr((uint)length));
+        }
+
+        /// <summary>
+        /// Whether the first <paramref name="length"/> characters of <paramref name="path"/>, once normalized, are the null-terminated
+        /// <paramref name="normalizedPath"/>, as the policy search compares them.
+        /// </summary>
+        public static bool ArePathsEqual(char* path, char* normalizedPath, int length)
+        {
+            Assert64Process();
+            Contract.Requires(length >= 0);
+
+            return ExternArePathsEqual(path, normalizedPath, new UIntPtr((uint)length));
+        }
+
         /// <nodoc />
         [DllImport("kernel32.dll")]
         public static extern IntPtr GetConsoleWindow();
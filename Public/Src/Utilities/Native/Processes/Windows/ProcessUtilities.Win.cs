@@ -43,6 +43,44 @@ namespace BuildXL.Native.Processes.Windows
             }
         }
 
+        /// <inheritdoc />
+        public void NormalizeAndHashPaths(IReadOnlyList<string> paths, byte[][] normalizedPathBytes, int[] hashes)
+        {
+            Contract.Requires(paths != null);
+            Contract.Requires(normalizedPathBytes != null && normalizedPathBytes.Length >= paths.Count);
+            Contract.Requires(hashes != null && hashes.Length >= paths.Count);
+            Assert64Process();
+
+            var input = new StringBuilder();
+            var lengths = new UIntPtr[paths.Count];
+            int outputLength = 0;
+            for (int i = 0; i < paths.Count; i++)
+            {
+                input.Append(paths[i]);
+                lengths[i] = new UIntPtr((uint)paths[i].Length);
+                outputLength += paths[i].Length + 1;
+            }
+
+            // The normalized paths come back to back, each with its terminating null character
+            var output = new char[outputLength];
+            fixed (char* pInput = input.ToString())
+            fixed (UIntPtr* pLengths = lengths)
+            fixed (char* pOutput = output)
+            fixed (int* pHashes = hashes)
+            {
+                ExternNormalizeAndHashPaths(pInput, pLengths, new UIntPtr((uint)paths.Count), pOutput, pHashes);
+            }
+
+            int offset = 0;
+            for (int i = 0; i < paths.Count; i++)
+            {
+                int length = (paths[i].Length + 1) * sizeof(char);
+                normalizedPathBytes[i] = new byte[length];
+                Buffer.BlockCopy(output, offset, normalizedPathBytes[i], 0, length);
+                offset += length;
+            }
+        }
+
         /// <inheritdoc />
         /// <remarks>
         /// It is not clear why we call into native to compare the content of 2 byte arrays (using 'memcmp') instead of doing it right here.
@@ -277,6 +315,14 @@ namespace BuildXL.Native.Processes.Windows
             [MarshalAs(UnmanagedType.LPWStr)] string path,
             byte* buffer, int bufferLength);
 
+        [DllImport(ExternDll.BuildXLNatives64, EntryPoint = "NormalizeAndHashPaths")]
+        private static extern unsafe void ExternNormalizeAndHashPaths(
+            char* paths,
+            UIntPtr* lengths,
+            UIntPtr count,
+            char* buffer,
+            int* hashes);
+
         [DllImport(ExternDll.BuildXLNatives64, EntryPoint = "AreBuffersEqual")]
         [return: MarshalAs(UnmanagedType.Bool)]
         private static extern bool ExternAreBuffersEqual(byte* buffer1, byte* buffer2, int bufferLength);
@@ -410,6 +456,36 @@ namespace BuildXL.Native.Processes.Windows
             out uint pathId,
             out IO.Usn expectedUsn);
 
+        [DllImport(ExternDll.BuildXLNatives64, EntryPoint = "FindFileAccessPoliciesInTree", SetLastError = true)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        private static extern bool ExternFindFileAccessPoliciesInTree(
+            byte* record,
+            char* absolutePaths,
+            UIntPtr* absolutePathLengths,
+            UIntPtr pathCount,
+            PolicySearchResult* results);
+
+        [DllImport(ExternDll.BuildXLNatives64, EntryPoint = "ParseReports", SetLastError = true)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        private static extern bool ExternParseReports(
+            byte* buffer,
+            UIntPtr bufferSize,
+            [MarshalAs(UnmanagedType.Bool)] bool binary,
+            ParsedReport* reports,
+            UIntPtr reportCapacity,
+            out UIntPtr reportCount,
+            char* arena,
+            UIntPtr arenaCapacity,
+            out UIntPtr arenaLength,
+            out UIntPtr bytesConsumed);
+
+        [DllImport(ExternDll.BuildXLNatives64, EntryPoint = "HashPath")]
+        private static extern int ExternHashPath(char* path, UIntPtr length);
+
+        [DllImport(ExternDll.BuildXLNatives64, EntryPoint = "ArePathsEqual")]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        private static extern bool ExternArePathsEqual(char* path, char* normalizedPath, UIntPtr length);
+
         [DllImport(ExternDll.Kernel32, EntryPoint = "CreateJobObject", SetLastError = true, CharSet = CharSet.Unicode)]
         private static extern IntPtr ExternCreateJobObject([In] IntPtr lpJobAttributes, string lpName);
 
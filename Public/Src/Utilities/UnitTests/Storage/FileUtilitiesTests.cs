@@ -789,6 +789,35 @@ namespace Test.BuildXL.Storage
             XAssert.AreEqual(test, timestamps.LastWriteTime);
         }
 
+        [Fact]
+        public void TrySetFileTimestampsOnManyFiles()
+        {
+            // Enough files for the batch to be spread over several threads where it is
+            var files = new List<string>();
+            for (int i = 0; i < 300; i++)
+            {
+                string file = GetFullPath("file" + i);
+                File.WriteAllText(file, "Important Data");
+                files.Add(file);
+            }
+
+            files.Add(GetFullPath("missing"));
+
+            DateTime test = new DateTime(1999, 12, 31, 1, 1, 1, DateTimeKind.Utc);
+            bool[] succeeded = FileUtilities.TrySetFileTimestamps(files, new FileTimestamps(test));
+
+            XAssert.AreEqual(files.Count, succeeded.Length);
+            XAssert.IsFalse(succeeded[files.Count - 1]);
+            for (int i = 0; i < files.Count - 1; i++)
+            {
+                XAssert.IsTrue(succeeded[i]);
+
+                var timestamps = FileUtilities.GetFileTimestamps(files[i]);
+                XAssert.AreEqual(test, timestamps.CreationTime);
+                XAssert.AreEqual(test, timestamps.LastWriteTime);
+            }
+        }
+
         [FactIfSupported(requiresSymlinkPermission: true)]
         public void SetAndGetFileTimestampsOnlyAffectSymlink()
         {
@@ -54,7 +54,8 @@ namespace Test.BuildXL.TestUtilities.Xunit
             bool requiresWindowsBasedOperatingSystem = false, 
             bool requiresUnixBasedOperatingSystem = false, 
             bool requiresHeliumDriversAvailable = false,
-            bool requiresHeliumDriversNotAvailable = false)
+            bool requiresHeliumDriversNotAvailable = false,
+            bool requiresLinuxBasedOperatingSystem = false)
         {
             RequiresAdmin = requiresAdmin;
             RequiresJournalScan = requiresJournalScan;
@@ -136,6 +137,15 @@ namespace Test.BuildXL.TestUtilities.Xunit
                 }
             }
 
+            if (requiresLinuxBasedOperatingSystem)
+            {
+                if (!OperatingSystemHelper.IsLinux)
+                {
+                    Skip = "Test must be run on the CoreCLR on Linux!";
+                    return;
+                }
+            }
+
             if (requiresHeliumDriversAvailable)
             {
                 if (!s_isHeliumFiltersAvailable.HasValue)
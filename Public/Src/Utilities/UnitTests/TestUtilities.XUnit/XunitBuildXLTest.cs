@@ -25,12 +25,15 @@ namespace Test.BuildXL.TestUtilities.Xunit
     public abstract class XunitBuildXLTest : BuildXLTestBase, IDisposable
     {
         private static Lazy<IKextConnection> s_sandboxedKextConnection =  new Lazy<IKextConnection>(() =>
-            OperatingSystemHelper.IsUnixOS
+            OperatingSystemHelper.IsMacOS
                 ? new KextConnection(
                     skipDisposingForTests: true, 
                     config: new KextConnection.Config
                     {
                         MeasureCpuTimes = true,
+                        // The sandboxed process tests are what exercises the per-pip report rings of the interop library: small
+                        // rings, so that their overflow lists are used as well. Builds route the reports in the listeners by default.
+                        PipReportRingCapacity = 64,
                         FailureCallback = (status, description) =>
                         {
                             XAssert.Fail($"Kernel extension failed.  Status: {status}.  Description: {description}");
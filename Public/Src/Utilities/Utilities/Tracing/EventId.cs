@@ -724,6 +724,7 @@ namespace BuildXL.Utilities.Tracing
         LogMismatchedDetoursVerboseCount = 2927,
         LogDetoursMaxHeapSize = 2928,
         OutputFileHashingStats = 2929,
+        LogPipProcessData = 2930,
 
         FailedToResolveHistoricMetadataCacheFileName = 2940,
         LoadingHistoricMetadataCacheFailed = 2941,